@@ -65,6 +65,9 @@ enum {
     ARG_CHECK,
     ARG_NO_CPU_LIMIT,
     ARG_DISABLE_SHM,
+    ARG_DUMP_STARTUP_PROFILE,
+    ARG_LOG_STARTUP_TIMING,
+    ARG_REALTIME_CHECK,
     ARG_DUMP_RESAMPLE_METHODS,
     ARG_SYSTEM,
     ARG_CLEANUP_SHM,
@@ -102,6 +105,9 @@ static const struct option long_options[] = {
     {"system",                      2, 0, ARG_SYSTEM},
     {"no-cpu-limit",                2, 0, ARG_NO_CPU_LIMIT},
     {"disable-shm",                 2, 0, ARG_DISABLE_SHM},
+    {"dump-startup-profile",        2, 0, ARG_DUMP_STARTUP_PROFILE},
+    {"log-startup-timing",          2, 0, ARG_LOG_STARTUP_TIMING},
+    {"realtime-check",              2, 0, ARG_REALTIME_CHECK},
     {"dump-resample-methods",       2, 0, ARG_DUMP_RESAMPLE_METHODS},
     {"cleanup-shm",                 2, 0, ARG_CLEANUP_SHM},
     {NULL, 0, 0, 0}
@@ -154,7 +160,13 @@ void pa_cmdline_help(const char *argv0) {
            "      --use-pid-file[=BOOL]             Create a PID file\n"
            "      --no-cpu-limit[=BOOL]             Do not install CPU load limiter on\n"
            "                                        platforms that support it.\n"
-           "      --disable-shm[=BOOL]              Disable shared memory support.\n\n"
+           "      --disable-shm[=BOOL]              Disable shared memory support.\n"
+           "      --dump-startup-profile[=BOOL]     Log how long loading each module took\n"
+           "                                        after startup.\n"
+           "      --log-startup-timing[=BOOL]       Log how long each command of the startup\n"
+           "                                        script took\n"
+           "      --realtime-check[=BOOL]           Report code that may block in the IO\n"
+           "                                        threads\n\n"
 
            "STARTUP SCRIPT:\n"
            "  -L, --load=\"MODULE ARGUMENTS\"         Load the specified plugin module with\n"
@@ -387,6 +399,30 @@ int pa_cmdline_parse(pa_daemon_conf *conf, int argc, char *const argv [], int *d
                 conf->disable_shm = !!b;
                 break;
 
+            case ARG_DUMP_STARTUP_PROFILE:
+                if ((b = optarg ? pa_parse_boolean(optarg) : 1) < 0) {
+                    pa_log(_("--dump-startup-profile expects boolean argument"));
+                    goto fail;
+                }
+                conf->dump_startup_profile = !!b;
+                break;
+
+            case ARG_LOG_STARTUP_TIMING:
+                if ((b = optarg ? pa_parse_boolean(optarg) : 1) < 0) {
+                    pa_log(_("--log-startup-timing expects boolean argument"));
+                    goto fail;
+                }
+                conf->log_startup_timing = !!b;
+                break;
+
+            case ARG_REALTIME_CHECK:
+                if ((b = optarg ? pa_parse_boolean(optarg) : 1) < 0) {
+                    pa_log(_("--realtime-check expects boolean argument"));
+                    goto fail;
+                }
+                conf->realtime_check = !!b;
+                break;
+
             default:
                 goto fail;
         }
@@ -67,12 +67,14 @@ static const pa_daemon_conf default_conf = {
     .high_priority = TRUE,
     .nice_level = -11,
     .realtime_scheduling = TRUE,
+    .realtime_deadline = FALSE,
     .realtime_priority = 5,  /* Half of JACK's default rtprio */
     .disallow_module_loading = FALSE,
     .disallow_exit = FALSE,
     .flat_volumes = TRUE,
     .exit_idle_time = 20,
     .scache_idle_time = 20,
+    .memory_trim_idle_time = 60,
     .script_commands = NULL,
     .dl_search_path = NULL,
     .load_default_script_file = TRUE,
@@ -82,6 +84,7 @@ static const pa_daemon_conf default_conf = {
     .log_backtrace = 0,
     .log_meta = FALSE,
     .log_time = FALSE,
+    .log_async = TRUE,
     .resample_method = PA_RESAMPLER_AUTO,
     .disable_remixing = FALSE,
     .disable_lfe_remixing = TRUE,
@@ -93,7 +96,12 @@ static const pa_daemon_conf default_conf = {
 #endif
     .no_cpu_limit = TRUE,
     .disable_shm = FALSE,
+    .dump_startup_profile = FALSE,
+    .log_startup_timing = FALSE,
+    .realtime_check = FALSE,
     .lock_memory = FALSE,
+    .render_stats = FALSE,
+    .lock_shm = FALSE,
     .deferred_volume = TRUE,
     .default_n_fragments = 4,
     .default_fragment_size_msec = 25,
@@ -102,7 +110,11 @@ static const pa_daemon_conf default_conf = {
     .default_sample_spec = { .format = PA_SAMPLE_S16NE, .rate = 44100, .channels = 2 },
     .alternate_sample_rate = 48000,
     .default_channel_map = { .channels = 2, .map = { PA_CHANNEL_POSITION_LEFT, PA_CHANNEL_POSITION_RIGHT } },
-    .shm_size = 0
+    .shm_size = 0,
+    .shm_huge_pages = PA_SHM_HUGE_PAGES_NO,
+    .default_cpu_affinity = NULL,
+    .default_numa_node = -1,
+    .change_event_rate = 60
 #ifdef HAVE_SYS_RESOURCE_H
    ,.rlimit_fsize = { .value = 0, .is_set = FALSE },
     .rlimit_data = { .value = 0, .is_set = FALSE },
@@ -169,6 +181,7 @@ void pa_daemon_conf_free(pa_daemon_conf *c) {
     pa_xfree(c->script_commands);
     pa_xfree(c->dl_search_path);
     pa_xfree(c->default_script_file);
+    pa_xfree(c->default_cpu_affinity);
 
     if (c->log_target)
         pa_log_target_free(c->log_target);
@@ -490,6 +503,65 @@ static int parse_rtprio(pa_config_parser_state *state) {
     return 0;
 }
 
+static int parse_shm_huge_pages(pa_config_parser_state *state) {
+    pa_daemon_conf *c;
+    int b;
+
+    pa_assert(state);
+
+    c = state->data;
+
+    if (pa_streq(state->rvalue, "transparent"))
+        c->shm_huge_pages = PA_SHM_HUGE_PAGES_TRANSPARENT;
+    else if ((b = pa_parse_boolean(state->rvalue)) >= 0)
+        c->shm_huge_pages = b ? PA_SHM_HUGE_PAGES_YES : PA_SHM_HUGE_PAGES_NO;
+    else {
+        pa_log(_("[%s:%u] Invalid huge page setting '%s'."), state->filename, state->lineno, state->rvalue);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int parse_cpu_affinity(pa_config_parser_state *state) {
+    pa_daemon_conf *c;
+
+    pa_assert(state);
+
+    c = state->data;
+
+    pa_xfree(c->default_cpu_affinity);
+    c->default_cpu_affinity = NULL;
+
+    if (!*state->rvalue)
+        return 0;
+
+    if (!pa_cpu_list_valid(state->rvalue)) {
+        pa_log(_("[%s:%u] Invalid CPU list '%s'."), state->filename, state->lineno, state->rvalue);
+        return -1;
+    }
+
+    c->default_cpu_affinity = pa_xstrdup(state->rvalue);
+    return 0;
+}
+
+static int parse_numa_node(pa_config_parser_state *state) {
+    pa_daemon_conf *c;
+    int32_t node;
+
+    pa_assert(state);
+
+    c = state->data;
+
+    if (pa_atoi(state->rvalue, &node) < 0 || node < -1) {
+        pa_log(_("[%s:%u] Invalid NUMA node '%s'."), state->filename, state->lineno, state->rvalue);
+        return -1;
+    }
+
+    c->default_numa_node = (int) node;
+    return 0;
+}
+
 #ifdef HAVE_DBUS
 static int parse_server_type(pa_config_parser_state *state) {
     pa_daemon_conf *c;
@@ -531,10 +603,14 @@ int pa_daemon_conf_load(pa_daemon_conf *c, const char *filename) {
         { "enable-shm",                 pa_config_parse_not_bool, &c->disable_shm, NULL },
         { "flat-volumes",               pa_config_parse_bool,     &c->flat_volumes, NULL },
         { "lock-memory",                pa_config_parse_bool,     &c->lock_memory, NULL },
+        { "enable-render-stats",        pa_config_parse_bool,     &c->render_stats, NULL },
         { "enable-deferred-volume",     pa_config_parse_bool,     &c->deferred_volume, NULL },
         { "exit-idle-time",             pa_config_parse_int,      &c->exit_idle_time, NULL },
         { "scache-idle-time",           pa_config_parse_int,      &c->scache_idle_time, NULL },
+        { "memory-trim-idle-time",      pa_config_parse_int,      &c->memory_trim_idle_time, NULL },
+        { "change-event-rate",          pa_config_parse_unsigned, &c->change_event_rate, NULL },
         { "realtime-priority",          parse_rtprio,             c, NULL },
+        { "realtime-deadline",          pa_config_parse_bool,     &c->realtime_deadline, NULL },
         { "dl-search-path",             pa_config_parse_string,   &c->dl_search_path, NULL },
         { "default-script-file",        pa_config_parse_string,   &c->default_script_file, NULL },
         { "log-target",                 parse_log_target,         c, NULL },
@@ -559,9 +635,14 @@ int pa_daemon_conf_load(pa_daemon_conf *c, const char *filename) {
         { "enable-lfe-remixing",        pa_config_parse_not_bool, &c->disable_lfe_remixing, NULL },
         { "load-default-script-file",   pa_config_parse_bool,     &c->load_default_script_file, NULL },
         { "shm-size-bytes",             pa_config_parse_size,     &c->shm_size, NULL },
+        { "shm-huge-pages",             parse_shm_huge_pages,     c, NULL },
+        { "lock-shm",                   pa_config_parse_bool,     &c->lock_shm, NULL },
+        { "default-cpu-affinity",       parse_cpu_affinity,       c, NULL },
+        { "default-numa-node",          parse_numa_node,          c, NULL },
         { "log-meta",                   pa_config_parse_bool,     &c->log_meta, NULL },
         { "log-time",                   pa_config_parse_bool,     &c->log_time, NULL },
         { "log-backtrace",              pa_config_parse_unsigned, &c->log_backtrace, NULL },
+        { "log-async",                  pa_config_parse_bool,     &c->log_async, NULL },
 #ifdef HAVE_SYS_RESOURCE_H
         { "rlimit-fsize",               parse_rlimit,             &c->rlimit_fsize, NULL },
         { "rlimit-data",                parse_rlimit,             &c->rlimit_data, NULL },
@@ -697,6 +778,12 @@ char *pa_daemon_conf_dump(pa_daemon_conf *c) {
         [PA_LOG_ERROR] = "error"
     };
 
+    static const char* const shm_huge_pages_to_string[] = {
+        [PA_SHM_HUGE_PAGES_NO] = "no",
+        [PA_SHM_HUGE_PAGES_TRANSPARENT] = "transparent",
+        [PA_SHM_HUGE_PAGES_YES] = "yes"
+    };
+
 #ifdef HAVE_DBUS
     static const char* const server_type_to_string[] = {
         [PA_SERVER_TYPE_UNSET] = "!!UNSET!!",
@@ -728,6 +815,7 @@ char *pa_daemon_conf_dump(pa_daemon_conf *c) {
     pa_strbuf_printf(s, "nice-level = %i\n", c->nice_level);
     pa_strbuf_printf(s, "realtime-scheduling = %s\n", pa_yes_no(c->realtime_scheduling));
     pa_strbuf_printf(s, "realtime-priority = %i\n", c->realtime_priority);
+    pa_strbuf_printf(s, "realtime-deadline = %s\n", pa_yes_no(c->realtime_deadline));
     pa_strbuf_printf(s, "allow-module-loading = %s\n", pa_yes_no(!c->disallow_module_loading));
     pa_strbuf_printf(s, "allow-exit = %s\n", pa_yes_no(!c->disallow_exit));
     pa_strbuf_printf(s, "use-pid-file = %s\n", pa_yes_no(c->use_pid_file));
@@ -739,8 +827,11 @@ char *pa_daemon_conf_dump(pa_daemon_conf *c) {
     pa_strbuf_printf(s, "enable-shm = %s\n", pa_yes_no(!c->disable_shm));
     pa_strbuf_printf(s, "flat-volumes = %s\n", pa_yes_no(c->flat_volumes));
     pa_strbuf_printf(s, "lock-memory = %s\n", pa_yes_no(c->lock_memory));
+    pa_strbuf_printf(s, "enable-render-stats = %s\n", pa_yes_no(c->render_stats));
     pa_strbuf_printf(s, "exit-idle-time = %i\n", c->exit_idle_time);
     pa_strbuf_printf(s, "scache-idle-time = %i\n", c->scache_idle_time);
+    pa_strbuf_printf(s, "memory-trim-idle-time = %i\n", c->memory_trim_idle_time);
+    pa_strbuf_printf(s, "change-event-rate = %u\n", c->change_event_rate);
     pa_strbuf_printf(s, "dl-search-path = %s\n", pa_strempty(c->dl_search_path));
     pa_strbuf_printf(s, "default-script-file = %s\n", pa_strempty(pa_daemon_conf_get_default_script_file(c)));
     pa_strbuf_printf(s, "load-default-script-file = %s\n", pa_yes_no(c->load_default_script_file));
@@ -760,9 +851,14 @@ char *pa_daemon_conf_dump(pa_daemon_conf *c) {
     pa_strbuf_printf(s, "deferred-volume-safety-margin-usec = %u\n", c->deferred_volume_safety_margin_usec);
     pa_strbuf_printf(s, "deferred-volume-extra-delay-usec = %d\n", c->deferred_volume_extra_delay_usec);
     pa_strbuf_printf(s, "shm-size-bytes = %lu\n", (unsigned long) c->shm_size);
+    pa_strbuf_printf(s, "shm-huge-pages = %s\n", shm_huge_pages_to_string[c->shm_huge_pages]);
+    pa_strbuf_printf(s, "lock-shm = %s\n", pa_yes_no(c->lock_shm));
+    pa_strbuf_printf(s, "default-cpu-affinity = %s\n", pa_strempty(c->default_cpu_affinity));
+    pa_strbuf_printf(s, "default-numa-node = %i\n", c->default_numa_node);
     pa_strbuf_printf(s, "log-meta = %s\n", pa_yes_no(c->log_meta));
     pa_strbuf_printf(s, "log-time = %s\n", pa_yes_no(c->log_time));
     pa_strbuf_printf(s, "log-backtrace = %u\n", c->log_backtrace);
+    pa_strbuf_printf(s, "log-async = %s\n", pa_yes_no(c->log_async));
 #ifdef HAVE_SYS_RESOURCE_H
     pa_strbuf_printf(s, "rlimit-fsize = %li\n", c->rlimit_fsize.is_set ? (long int) c->rlimit_fsize.value : -1);
     pa_strbuf_printf(s, "rlimit-data = %li\n", c->rlimit_data.is_set ? (long int) c->rlimit_data.value : -1);
@@ -63,23 +63,31 @@ typedef struct pa_daemon_conf {
         fail,
         high_priority,
         realtime_scheduling,
+        realtime_deadline,
         disallow_module_loading,
         use_pid_file,
         system_instance,
         no_cpu_limit,
         disable_shm,
+        dump_startup_profile,
+        log_startup_timing,
+        realtime_check,
         disable_remixing,
         disable_lfe_remixing,
         load_default_script_file,
         disallow_exit,
         log_meta,
         log_time,
+        log_async,
         flat_volumes,
         lock_memory,
-        deferred_volume;
+        lock_shm,
+        deferred_volume,
+        render_stats;
     pa_server_type_t local_server_type;
     int exit_idle_time,
         scache_idle_time,
+        memory_trim_idle_time,
         realtime_priority,
         nice_level,
         resample_method;
@@ -133,6 +141,10 @@ typedef struct pa_daemon_conf {
     uint32_t alternate_sample_rate;
     pa_channel_map default_channel_map;
     size_t shm_size;
+    pa_shm_huge_pages_t shm_huge_pages;
+    char *default_cpu_affinity;
+    int default_numa_node;
+    unsigned change_event_rate;
 } pa_daemon_conf;
 
 /* Allocate a new structure and fill it with sane defaults */
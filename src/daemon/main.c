@@ -64,6 +64,7 @@
 #endif
 #include <pulse/mainloop.h>
 #include <pulse/mainloop-signal.h>
+#include <pulse/rtclock.h>
 #include <pulse/timeval.h>
 #include <pulse/xmalloc.h>
 
@@ -85,7 +86,9 @@
 #include <pulsecore/macro.h>
 #include <pulsecore/shm.h>
 #include <pulsecore/memtrap.h>
+#include <pulsecore/rtcheck.h>
 #include <pulsecore/strlist.h>
+#include <pulsecore/socket-server.h>
 #ifdef HAVE_DBUS
 #include <pulsecore/dbus-shared.h>
 #endif
@@ -135,6 +138,31 @@ static void message_cb(pa_mainloop_api*a, pa_time_event*e, const struct timeval
 
 #endif
 
+static void dump_startup_profile(pa_core *c, pa_usec_t start_time, pa_usec_t core_time) {
+    pa_module *m;
+    uint32_t idx;
+    pa_usec_t total_open = 0, total_init = 0;
+
+    pa_log_notice(_("Startup profile (milliseconds since startup):"));
+    pa_log_notice(_("%8.1f  core ready"), (double) (core_time - start_time) / PA_USEC_PER_MSEC);
+
+    PA_IDXSET_FOREACH(m, c->modules, idx) {
+        pa_log_notice(_("%8.1f  %s (#%u): open %0.1f ms, init %0.1f ms"),
+                      (double) (m->load_started - start_time) / PA_USEC_PER_MSEC,
+                      m->name, m->index,
+                      (double) m->open_time / PA_USEC_PER_MSEC,
+                      (double) m->init_time / PA_USEC_PER_MSEC);
+
+        total_open += m->open_time;
+        total_init += m->init_time;
+    }
+
+    pa_log_notice(_("%8.1f  startup script done, modules took %0.1f ms to open and %0.1f ms to initialize"),
+                  (double) (pa_rtclock_now() - start_time) / PA_USEC_PER_MSEC,
+                  (double) total_open / PA_USEC_PER_MSEC,
+                  (double) total_init / PA_USEC_PER_MSEC);
+}
+
 static void signal_callback(pa_mainloop_api*m, pa_signal_event *e, int sig, void *userdata) {
     pa_log_info(_("Got signal %s."), pa_sig2str(sig));
 
@@ -169,6 +197,88 @@ static void signal_callback(pa_mainloop_api*m, pa_signal_event *e, int sig, void
     }
 }
 
+#ifndef OS_IS_WIN32
+
+/* The state the next instance shall restore after a restart, see
+ * pa_core_restart() */
+static char *write_handoff_state(pa_core *c) {
+    pa_strbuf *buf;
+    char *fn, *s;
+    FILE *f;
+    pa_bool_t ok;
+
+    if (!(fn = pa_runtime_path("handoff.pa")))
+        return NULL;
+
+    buf = pa_strbuf_new();
+    pa_cli_command_dump_state(c, buf);
+    s = pa_strbuf_tostring_free(buf);
+
+    if (!(f = pa_fopen_cloexec(fn, "w"))) {
+        pa_log_warn(_("Failed to open %s for writing: %s"), fn, pa_cstrerror(errno));
+        ok = FALSE;
+    } else {
+        ok = fputs(s, f) >= 0;
+
+        if (fclose(f) != 0)
+            ok = FALSE;
+
+        if (!ok) {
+            pa_log_warn(_("Failed to write %s: %s"), fn, pa_cstrerror(errno));
+            unlink(fn);
+        }
+    }
+
+    pa_xfree(s);
+
+    if (!ok) {
+        pa_xfree(fn);
+        return NULL;
+    }
+
+    return fn;
+}
+
+static char *self_binary(void) {
+    char *rp;
+
+    /* After an upgrade the link points to the binary that was
+     * replaced, but we want the one that replaced it */
+    if ((rp = pa_readlink("/proc/self/exe"))) {
+        if (pa_endswith(rp, " (deleted)"))
+            rp[strlen(rp) - 10] = 0;
+
+        if (access(rp, X_OK) == 0)
+            return rp;
+
+        pa_xfree(rp);
+    }
+
+    return pa_xstrdup(PA_BINARY);
+}
+
+/* Only returns on failure */
+static void restart_daemon(char *argv[], const char *state) {
+    char *sockets, *binary;
+
+    sockets = pa_socket_server_handoff_export();
+    pa_set_env("PULSE_HANDOFF_SOCKETS", sockets);
+    pa_xfree(sockets);
+
+    if (state)
+        pa_set_env("PULSE_HANDOFF_STATE", state);
+
+    binary = self_binary();
+    pa_log_info(_("Restarting as %s."), binary);
+
+    execv(binary, argv);
+
+    pa_log(_("Failed to execute %s: %s"), binary, pa_cstrerror(errno));
+    pa_xfree(binary);
+}
+
+#endif
+
 #if defined(HAVE_PWD_H) && defined(HAVE_GRP_H)
 
 static int change_user(void) {
@@ -405,6 +515,10 @@ int main(int argc, char *argv[]) {
     pa_bool_t valid_pid_file = FALSE;
     pa_bool_t ltdl_init = FALSE;
     int passed_fd = -1;
+    int keep_fds[PA_SOCKET_SERVER_HANDOFF_MAX + 2];
+    unsigned n_keep_fds = 0;
+    char *handoff_state = NULL;
+    pa_bool_t restart = FALSE;
     const char *e;
 #ifdef HAVE_FORK
     int daemon_pipe[2] = { -1, -1 };
@@ -416,6 +530,7 @@ int main(int argc, char *argv[]) {
 #endif
     int autospawn_fd = -1;
     pa_bool_t autospawn_locked = FALSE;
+    pa_usec_t start_time, core_time;
 #ifdef HAVE_DBUS
     pa_dbusobj_server_lookup *server_lookup = NULL; /* /org/pulseaudio/server_lookup */
     pa_dbus_connection *lookup_service_bus = NULL; /* Always the user bus. */
@@ -423,6 +538,8 @@ int main(int argc, char *argv[]) {
     pa_bool_t start_server;
 #endif
 
+    start_time = pa_rtclock_now();
+
     pa_log_set_ident("pulseaudio");
     pa_log_set_level(PA_LOG_NOTICE);
     pa_log_set_flags(PA_LOG_COLORS|PA_LOG_PRINT_FILE|PA_LOG_PRINT_LEVEL, PA_LOG_RESET);
@@ -472,13 +589,30 @@ int main(int argc, char *argv[]) {
             passed_fd = -1;
     }
 
+#ifndef OS_IS_WIN32
+    /* If we replace a previous instance, its listening sockets are
+     * ours now, see restart_daemon() */
+    if ((e = getenv("PULSE_HANDOFF_SOCKETS"))) {
+        n_keep_fds = pa_socket_server_handoff_import(e, keep_fds, PA_SOCKET_SERVER_HANDOFF_MAX);
+        unsetenv("PULSE_HANDOFF_SOCKETS");
+    }
+
+    if ((e = getenv("PULSE_HANDOFF_STATE"))) {
+        handoff_state = pa_xstrdup(e);
+        unsetenv("PULSE_HANDOFF_STATE");
+    }
+#endif
+
+    keep_fds[n_keep_fds++] = passed_fd;
+    keep_fds[n_keep_fds] = -1;
+
     /* We might be autospawned, in which case have no idea in which
      * context we have been started. Let's cleanup our execution
      * context as good as possible */
 
     pa_reset_personality();
     pa_drop_root();
-    pa_close_all(passed_fd, -1);
+    pa_close_allv(keep_fds);
     pa_reset_sigs(-1);
     pa_unblock_sigs(-1);
     pa_reset_priority();
@@ -908,6 +1042,10 @@ int main(int argc, char *argv[]) {
 
     pa_set_env_and_record("PULSE_SYSTEM", conf->system_instance ? "1" : "0");
 
+    /* Only now, since the logger thread wouldn't survive the forks above */
+    if (conf->log_async)
+        pa_log_set_async(TRUE);
+
     pa_log_info(_("This is PulseAudio %s"), PACKAGE_VERSION);
     pa_log_debug(_("Compilation host: %s"), CANONICAL_HOST);
     pa_log_debug(_("Compilation CFLAGS: %s"), PA_CFLAGS);
@@ -1015,13 +1153,18 @@ int main(int argc, char *argv[]) {
 
     pa_memtrap_install();
 
+    if (conf->realtime_check)
+        pa_rtcheck_enable();
+
     pa_assert_se(mainloop = pa_mainloop_new());
 
-    if (!(c = pa_core_new(pa_mainloop_get_api(mainloop), !conf->disable_shm, conf->shm_size))) {
+    if (!(c = pa_core_new(pa_mainloop_get_api(mainloop), !conf->disable_shm, conf->shm_size, conf->shm_huge_pages, conf->lock_shm))) {
         pa_log(_("pa_core_new() failed."));
         goto finish;
     }
 
+    core_time = pa_rtclock_now();
+
     c->default_sample_spec = conf->default_sample_spec;
     c->alternate_sample_rate = conf->alternate_sample_rate;
     c->default_channel_map = conf->default_channel_map;
@@ -1031,12 +1174,21 @@ int main(int argc, char *argv[]) {
     c->deferred_volume_extra_delay_usec = conf->deferred_volume_extra_delay_usec;
     c->exit_idle_time = conf->exit_idle_time;
     c->scache_idle_time = conf->scache_idle_time;
+    c->memory_trim_idle_time = conf->memory_trim_idle_time;
     c->resample_method = conf->resample_method;
     c->realtime_priority = conf->realtime_priority;
     c->realtime_scheduling = !!conf->realtime_scheduling;
+    c->realtime_deadline = !!conf->realtime_deadline;
+    if (conf->default_cpu_affinity)
+        c->default_cpu_affinity = pa_xstrdup(conf->default_cpu_affinity);
+    else if (conf->default_numa_node >= 0 && !(c->default_cpu_affinity = pa_numa_node_cpus(conf->default_numa_node)))
+        pa_log_warn(_("NUMA node %i not found, not binding IO threads."), conf->default_numa_node);
     c->disable_remixing = !!conf->disable_remixing;
     c->disable_lfe_remixing = !!conf->disable_lfe_remixing;
     c->deferred_volume = !!conf->deferred_volume;
+    c->render_stats = !!conf->render_stats;
+    c->log_startup_timing = !!conf->log_startup_timing;
+    c->subscription_change_interval = conf->change_event_rate > 0 ? PA_USEC_PER_SEC / conf->change_event_rate : 0;
     c->running_as_daemon = !!conf->daemonize;
     c->disallow_exit = conf->disallow_exit;
     c->flat_volumes = conf->flat_volumes;
@@ -1092,6 +1244,16 @@ int main(int argc, char *argv[]) {
         if (r >= 0)
             r = pa_cli_command_execute(c, conf->script_commands, buf, &conf->fail);
 
+        /* Bring the devices back into the state the previous instance
+         * left them in. What the new configuration has no longer is
+         * just skipped. */
+        if (r >= 0 && handoff_state) {
+            pa_bool_t fail = FALSE;
+
+            pa_log_info(_("Restoring the state handed over by the previous instance."));
+            pa_cli_command_execute_file(c, handoff_state, buf, &fail);
+        }
+
         pa_log_error("%s", s = pa_strbuf_tostring_free(buf));
         pa_xfree(s);
 
@@ -1104,6 +1266,9 @@ int main(int argc, char *argv[]) {
             pa_log(_("Daemon startup without any loaded modules, refusing to work."));
             goto finish;
         }
+
+        if (conf->dump_startup_profile)
+            dump_startup_profile(c, start_time, core_time);
 #ifdef HAVE_DBUS
     } else {
         /* When we just provide the D-Bus server lookup service, we don't want
@@ -1114,9 +1279,20 @@ int main(int argc, char *argv[]) {
     }
 #endif
 
+    /* Whatever sockets the previous instance handed over and we didn't
+     * take on are closed now */
+    pa_socket_server_handoff_done();
+
+    if (handoff_state) {
+        unlink(handoff_state);
+        pa_xfree(handoff_state);
+        handoff_state = NULL;
+    }
+
     /* We completed the initial module loading, so let's disable it
      * from now on, if requested */
     c->disallow_module_loading = !!conf->disallow_module_loading;
+    c->log_startup_timing = FALSE;
 
 #ifdef HAVE_DBUS
     if (!conf->system_instance) {
@@ -1147,6 +1323,21 @@ int main(int argc, char *argv[]) {
 
     pa_log_info(_("Daemon shutdown initiated."));
 
+#ifndef OS_IS_WIN32
+    if (c->restart_requested) {
+        if (conf->system_instance)
+            /* We dropped root, the next instance couldn't set up */
+            pa_log_warn(_("Restarting a system instance is not supported, exiting."));
+        else {
+            /* Written while the devices are still around, and the
+             * sockets stay open while the modules are unloaded */
+            handoff_state = write_handoff_state(c);
+            pa_socket_server_handoff_begin();
+            restart = TRUE;
+        }
+    }
+#endif
+
 finish:
 #ifdef HAVE_DBUS
     if (server_bus)
@@ -1176,6 +1367,14 @@ finish:
         pa_scache_free_all(c);
 
         pa_core_unref(c);
+
+        if (conf->realtime_check) {
+            pa_rtcheck_violation_t v;
+
+            for (v = 0; v < PA_RTCHECK_MAX; v++)
+                pa_log_notice("Realtime violations (%s): %u", pa_rtcheck_violation_to_string(v), pa_rtcheck_get_count(v));
+        }
+
         pa_log_info(_("Daemon terminated."));
     }
 
@@ -1184,6 +1383,8 @@ finish:
 
     pa_signal_done();
 
+    pa_log_set_async(FALSE);
+
 #ifdef HAVE_FORK
     /* If we have daemon_pipe[1] still open, this means we've failed after
      * the first fork, but before the second. Therefore just write to it. */
@@ -1219,5 +1420,17 @@ finish:
     dbus_shutdown();
 #endif
 
+#ifndef OS_IS_WIN32
+    if (restart) {
+        restart_daemon(argv, handoff_state);
+        retval = 1;
+    }
+#endif
+
+    if (handoff_state) {
+        unlink(handoff_state);
+        pa_xfree(handoff_state);
+    }
+
     return retval;
 }
@@ -44,8 +44,12 @@
 #include <pulsecore/log.h>
 #include <pulsecore/macro.h>
 #include <pulsecore/core-util.h>
+#include <pulsecore/core-error.h>
 #include <pulsecore/conf-parser.h>
 #include <pulsecore/strbuf.h>
+#include <pulsecore/database.h>
+#include <pulsecore/mutex.h>
+#include <pulsecore/shared.h>
 
 #include "alsa-mixer.h"
 #include "alsa-util.h"
@@ -3746,8 +3750,9 @@ fail:
     return -1;
 }
 
+/* If no PCM is open for the mapping the mixer of the card is used */
 static void mapping_paths_probe(pa_alsa_mapping *m, pa_alsa_profile *profile,
-                                pa_alsa_direction_t direction) {
+                                pa_alsa_direction_t direction, int card_index) {
 
     pa_alsa_path *p;
     void *state;
@@ -3771,9 +3776,12 @@ static void mapping_paths_probe(pa_alsa_mapping *m, pa_alsa_profile *profile,
     if (!ps)
         return; /* No paths */
 
-    pa_assert(pcm_handle);
+    pa_assert(pcm_handle || card_index >= 0);
 
-    mixer_handle = pa_alsa_open_mixer_for_pcm(pcm_handle, NULL, &hctl_handle);
+    if (pcm_handle)
+        mixer_handle = pa_alsa_open_mixer_for_pcm(pcm_handle, NULL, &hctl_handle);
+    else
+        mixer_handle = pa_alsa_open_mixer(card_index, NULL, &hctl_handle);
     if (!mixer_handle || !hctl_handle) {
          /* Cannot open mixer, remove all entries */
         pa_hashmap_remove_all(ps->paths, NULL);
@@ -4297,6 +4305,266 @@ static void paths_drop_unsupported(pa_hashmap* h) {
     }
 }
 
+/* The probe cache remembers which profiles could be opened on a card,
+ * so that we don't have to open every PCM again on each start. Entries
+ * are keyed by driver, card name and hashes of the control list and
+ * the profile set, hence a changed card or configuration simply misses
+ * the cache. */
+
+static uint32_t probe_cache_hash(uint32_t h, const void *data, size_t length) {
+    const uint8_t *d = data;
+
+    /* FNV-1a */
+    for (; length > 0; length--, d++)
+        h = (h ^ *d) * 16777619U;
+
+    return h;
+}
+
+static uint32_t probe_cache_hash_string(uint32_t h, const char *s) {
+    return probe_cache_hash(h, s, strlen(s) + 1);
+}
+
+static int probe_cache_hash_controls(int card_index, uint32_t *hash) {
+    snd_ctl_t *ctl;
+    snd_ctl_elem_list_t *list;
+    char *name;
+    unsigned i;
+    int err;
+
+    name = pa_sprintf_malloc("hw:%i", card_index);
+    err = snd_ctl_open(&ctl, name, 0);
+    pa_xfree(name);
+
+    if (err < 0)
+        return -1;
+
+    snd_ctl_elem_list_alloca(&list);
+
+    /* The first call only tells us how much space we need */
+    if (snd_ctl_elem_list(ctl, list) < 0 ||
+        snd_ctl_elem_list_alloc_space(list, snd_ctl_elem_list_get_count(list)) < 0) {
+        snd_ctl_close(ctl);
+        return -1;
+    }
+
+    if ((err = snd_ctl_elem_list(ctl, list)) >= 0)
+        for (i = 0; i < snd_ctl_elem_list_get_used(list); i++) {
+            unsigned v[2];
+
+            v[0] = snd_ctl_elem_list_get_interface(list, i);
+            v[1] = snd_ctl_elem_list_get_index(list, i);
+
+            *hash = probe_cache_hash(*hash, v, sizeof(v));
+            *hash = probe_cache_hash_string(*hash, snd_ctl_elem_list_get_name(list, i));
+        }
+
+    snd_ctl_elem_list_free_space(list);
+    snd_ctl_close(ctl);
+
+    return err < 0 ? -1 : 0;
+}
+
+static uint32_t probe_cache_hash_profile_set(pa_alsa_profile_set *ps, const pa_sample_spec *ss) {
+    uint32_t h = 2166136261U;
+    pa_alsa_mapping *m;
+    pa_alsa_profile *p;
+    void *state;
+    char **d;
+
+    h = probe_cache_hash(h, ss, sizeof(*ss));
+
+    PA_HASHMAP_FOREACH(m, ps->mappings, state) {
+        h = probe_cache_hash_string(h, m->name);
+        h = probe_cache_hash(h, &m->channel_map, sizeof(m->channel_map));
+
+        for (d = m->device_strings; d && *d; d++)
+            h = probe_cache_hash_string(h, *d);
+    }
+
+    PA_HASHMAP_FOREACH(p, ps->profiles, state)
+        h = probe_cache_hash_string(h, p->name);
+
+    return h;
+}
+
+static char *probe_cache_key(pa_alsa_profile_set *ps, int card_index, const pa_sample_spec *ss) {
+    char *key, *driver, *longname = NULL;
+    uint32_t controls = 2166136261U;
+
+    if (probe_cache_hash_controls(card_index, &controls) < 0)
+        return NULL;
+
+    if (snd_card_get_longname(card_index, &longname) < 0)
+        return NULL;
+
+    driver = pa_alsa_get_driver_name(card_index);
+    key = pa_sprintf_malloc("%s:%s:%08x:%08x", pa_strnull(driver), longname, controls, probe_cache_hash_profile_set(ps, ss));
+    pa_xfree(driver);
+    free(longname);
+
+    return key;
+}
+
+/* Profile sets may be probed on several threads at once, see
+ * module-udev-detect, hence the database is only opened for a single
+ * access at a time, under this lock */
+static pa_static_mutex probe_cache_mutex = PA_STATIC_MUTEX_INIT;
+
+static pa_database *probe_cache_open(void) {
+    pa_database *db;
+    char *fname;
+
+    if (!(fname = pa_state_path("alsa-probe-cache", TRUE)))
+        return NULL;
+
+    if (!(db = pa_database_open(fname, TRUE)))
+        pa_log_debug("Failed to open probe cache '%s': %s", fname, pa_cstrerror(errno));
+
+    pa_xfree(fname);
+
+    return db;
+}
+
+static char *probe_cache_get(const char *key) {
+    pa_mutex *m;
+    pa_database *db;
+    pa_datum k, data;
+    char *t = NULL;
+
+    m = pa_static_mutex_get(&probe_cache_mutex, FALSE, FALSE);
+    pa_mutex_lock(m);
+
+    if ((db = probe_cache_open())) {
+        k.data = (char*) key;
+        k.size = strlen(key);
+
+        if (pa_database_get(db, &k, &data)) {
+            t = pa_xstrndup(data.data, data.size);
+            pa_datum_free(&data);
+        }
+
+        pa_database_close(db);
+    }
+
+    pa_mutex_unlock(m);
+
+    return t;
+}
+
+static void probe_cache_set(const char *key, const char *value) {
+    pa_mutex *m;
+    pa_database *db;
+    pa_datum k, data;
+
+    m = pa_static_mutex_get(&probe_cache_mutex, FALSE, FALSE);
+    pa_mutex_lock(m);
+
+    if ((db = probe_cache_open())) {
+        k.data = (char*) key;
+        k.size = strlen(key);
+        data.data = (char*) value;
+        data.size = strlen(value);
+
+        if (pa_database_set(db, &k, &data, TRUE) == 0)
+            pa_database_sync(db);
+
+        pa_database_close(db);
+    }
+
+    pa_mutex_unlock(m);
+}
+
+static pa_bool_t probe_cache_load(pa_alsa_profile_set *ps, const char *key, int card_index) {
+    pa_alsa_profile *p;
+    pa_alsa_mapping *m;
+    pa_hashmap *cached;
+    const char *split_state = NULL;
+    char *t, *name;
+    void *state;
+    uint32_t idx;
+
+    /* The data is the list of supported profiles, one name per line */
+    if (!(t = probe_cache_get(key)))
+        return FALSE;
+
+    cached = pa_hashmap_new(pa_idxset_string_hash_func, pa_idxset_string_compare_func);
+
+    while ((name = pa_split(t, "\n", &split_state))) {
+        if (!pa_hashmap_get(ps->profiles, name)) {
+            pa_log_debug("Cached profile %s is unknown, ignoring cache.", name);
+            pa_xfree(name);
+            pa_hashmap_free(cached, pa_xfree);
+            pa_xfree(t);
+            return FALSE;
+        }
+
+        if (pa_hashmap_put(cached, name, name) < 0)
+            pa_xfree(name);
+    }
+
+    pa_xfree(t);
+
+    pa_log_debug("Using cached probe results for %s.", key);
+
+    PA_HASHMAP_FOREACH(p, ps->profiles, state) {
+
+        /* Profiles marked in the config file are taken as they are */
+        if (p->supported)
+            continue;
+
+        if (!(p->supported = !!pa_hashmap_get(cached, p->name)))
+            continue;
+
+        pa_log_debug("Profile %s supported (cached).", p->name);
+
+        /* Account for the mappings just like profile_finalize_probing()
+         * does for the ones it successfully opened */
+        if (p->output_mappings)
+            PA_IDXSET_FOREACH(m, p->output_mappings, idx) {
+                m->supported++;
+                mapping_paths_probe(m, p, PA_ALSA_DIRECTION_OUTPUT, card_index);
+            }
+
+        if (p->input_mappings)
+            PA_IDXSET_FOREACH(m, p->input_mappings, idx) {
+                m->supported++;
+                mapping_paths_probe(m, p, PA_ALSA_DIRECTION_INPUT, card_index);
+            }
+    }
+
+    pa_hashmap_free(cached, pa_xfree);
+
+    pa_alsa_profile_set_drop_unsupported(ps);
+
+    paths_drop_unsupported(ps->input_paths);
+    paths_drop_unsupported(ps->output_paths);
+
+    ps->probed = TRUE;
+
+    return TRUE;
+}
+
+static void probe_cache_save(pa_alsa_profile_set *ps, const char *key) {
+    pa_alsa_profile *p;
+    pa_strbuf *buf;
+    void *state;
+    char *t;
+
+    /* Most likely the device was busy, don't remember that */
+    if (pa_hashmap_isempty(ps->profiles))
+        return;
+
+    buf = pa_strbuf_new();
+
+    PA_HASHMAP_FOREACH(p, ps->profiles, state)
+        pa_strbuf_printf(buf, "%s\n", p->name);
+
+    t = pa_strbuf_tostring_free(buf);
+    probe_cache_set(key, t);
+    pa_xfree(t);
+}
+
 void pa_alsa_profile_set_probe(
         pa_alsa_profile_set *ps,
         const char *dev_id,
@@ -4308,6 +4576,8 @@ void pa_alsa_profile_set_probe(
     pa_alsa_profile *p, *last = NULL;
     pa_alsa_mapping *m;
     pa_hashmap *broken_inputs, *broken_outputs;
+    char *key = NULL;
+    int card_index;
 
     pa_assert(ps);
     pa_assert(dev_id);
@@ -4316,6 +4586,20 @@ void pa_alsa_profile_set_probe(
     if (ps->probed)
         return;
 
+    if (ps->probe_cache &&
+        (card_index = snd_card_get_index(dev_id)) >= 0 &&
+        (key = probe_cache_key(ps, card_index, ss))) {
+
+        if (!ps->reprobe && probe_cache_load(ps, key, card_index)) {
+            /* Nothing to write back */
+            pa_xfree(key);
+            key = NULL;
+            goto finish;
+        }
+
+        pa_log_debug("No usable cached probe results, probing.");
+    }
+
     broken_inputs = pa_hashmap_new(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func);
     broken_outputs = pa_hashmap_new(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func);
 
@@ -4405,12 +4689,12 @@ void pa_alsa_profile_set_probe(
         if (p->output_mappings)
             PA_IDXSET_FOREACH(m, p->output_mappings, idx)
                 if (m->output_pcm)
-                    mapping_paths_probe(m, p, PA_ALSA_DIRECTION_OUTPUT);
+                    mapping_paths_probe(m, p, PA_ALSA_DIRECTION_OUTPUT, -1);
 
         if (p->input_mappings)
             PA_IDXSET_FOREACH(m, p->input_mappings, idx)
                 if (m->input_pcm)
-                    mapping_paths_probe(m, p, PA_ALSA_DIRECTION_INPUT);
+                    mapping_paths_probe(m, p, PA_ALSA_DIRECTION_INPUT, -1);
     }
 
     /* Clean up */
@@ -4424,6 +4708,76 @@ void pa_alsa_profile_set_probe(
     pa_hashmap_free(broken_outputs, NULL);
 
     ps->probed = TRUE;
+
+finish:
+    if (key)
+        probe_cache_save(ps, key);
+
+    pa_xfree(key);
+}
+
+struct profile_set_stash {
+    pa_alsa_profile_set *profile_set;
+    char *fname;
+    pa_bool_t ignore_dB;
+};
+
+static char *profile_set_stash_name(const char *dev_id) {
+    return pa_sprintf_malloc("alsa-profile-set-%s", dev_id);
+}
+
+/* Called from main context */
+void pa_alsa_profile_set_stash(pa_core *c, const char *dev_id, const char *fname, pa_alsa_profile_set *ps) {
+    struct profile_set_stash *s;
+    pa_alsa_profile_set *old;
+    char *name;
+
+    pa_assert(c);
+    pa_assert(dev_id);
+    pa_assert(ps);
+
+    /* Drop anything left over from an earlier attempt */
+    if ((old = pa_alsa_profile_set_unstash(c, dev_id, fname, ps->ignore_dB)))
+        pa_alsa_profile_set_free(old);
+
+    s = pa_xnew(struct profile_set_stash, 1);
+    s->profile_set = ps;
+    s->fname = pa_xstrdup(fname);
+    s->ignore_dB = ps->ignore_dB;
+
+    name = profile_set_stash_name(dev_id);
+    pa_assert_se(pa_shared_set(c, name, s) >= 0);
+    pa_xfree(name);
+}
+
+/* Called from main context */
+pa_alsa_profile_set *pa_alsa_profile_set_unstash(pa_core *c, const char *dev_id, const char *fname, pa_bool_t ignore_dB) {
+    struct profile_set_stash *s;
+    pa_alsa_profile_set *ps = NULL;
+    char *name;
+
+    pa_assert(c);
+    pa_assert(dev_id);
+
+    name = profile_set_stash_name(dev_id);
+
+    if ((s = pa_shared_get(c, name))) {
+        pa_shared_remove(c, name);
+
+        /* Only hand it out if it was set up the way the caller would
+         * have done it */
+        if (pa_safe_streq(s->fname, fname) && s->ignore_dB == ignore_dB)
+            ps = s->profile_set;
+        else
+            pa_alsa_profile_set_free(s->profile_set);
+
+        pa_xfree(s->fname);
+        pa_xfree(s);
+    }
+
+    pa_xfree(name);
+
+    return ps;
 }
 
 void pa_alsa_profile_set_dump(pa_alsa_profile_set *ps) {
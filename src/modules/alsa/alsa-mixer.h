@@ -317,6 +317,11 @@ struct pa_alsa_profile_set {
     pa_bool_t auto_profiles;
     pa_bool_t ignore_dB:1;
     pa_bool_t probed:1;
+
+    /* Use (probe_cache) or just refresh (reprobe) the on-disk cache of
+     * probe results */
+    pa_bool_t probe_cache:1;
+    pa_bool_t reprobe:1;
 };
 
 void pa_alsa_mapping_dump(pa_alsa_mapping *m);
@@ -327,6 +332,12 @@ pa_alsa_mapping *pa_alsa_mapping_get(pa_alsa_profile_set *ps, const char *name);
 pa_alsa_profile_set* pa_alsa_profile_set_new(const char *fname, const pa_channel_map *bonus);
 void pa_alsa_profile_set_probe(pa_alsa_profile_set *ps, const char *dev_id, const pa_sample_spec *ss, unsigned default_n_fragments, unsigned default_fragment_size_msec);
 void pa_alsa_profile_set_free(pa_alsa_profile_set *s);
+
+/* A profile set may be created and probed ahead of time, on any thread,
+ * and then be handed over to module-alsa-card for the card dev_id. It
+ * is only handed out again if fname and ignore_dB match. */
+void pa_alsa_profile_set_stash(pa_core *c, const char *dev_id, const char *fname, pa_alsa_profile_set *ps);
+pa_alsa_profile_set *pa_alsa_profile_set_unstash(pa_core *c, const char *dev_id, const char *fname, pa_bool_t ignore_dB);
 void pa_alsa_profile_set_dump(pa_alsa_profile_set *s);
 void pa_alsa_profile_set_drop_unsupported(pa_alsa_profile_set *s);
 
@@ -48,12 +48,16 @@
 #include <pulsecore/core-rtclock.h>
 #include <pulsecore/core-util.h>
 #include <pulsecore/sample-util.h>
+#include <pulsecore/sconv.h>
 #include <pulsecore/log.h>
 #include <pulsecore/macro.h>
 #include <pulsecore/thread.h>
 #include <pulsecore/thread-mq.h>
 #include <pulsecore/rtpoll.h>
+#include <pulsecore/memarena.h>
+#include <pulsecore/render-pool.h>
 #include <pulsecore/time-smoother.h>
+#include <pulsecore/trace.h>
 
 #include <modules/reserve-wrap.h>
 
@@ -72,6 +76,9 @@
 #define TSCHED_WATERMARK_VERIFY_AFTER_USEC (20*PA_USEC_PER_SEC)    /* 20s   -- How long after a drop out recheck if things are good now */
 #define TSCHED_WATERMARK_INC_THRESHOLD_USEC (0*PA_USEC_PER_MSEC)   /* 0ms   -- If the buffer level ever below this threshold, increase the watermark */
 #define TSCHED_WATERMARK_DEC_THRESHOLD_USEC (100*PA_USEC_PER_MSEC) /* 100ms -- If the buffer level didn't drop below this threshold in the verification time, decrease the watermark */
+#define TSCHED_WATERMARK_JITTER_VERIFY_AFTER_USEC (2*PA_USEC_PER_SEC) /* 2s -- Same as above, once the wakeup jitter has been measured */
+#define TSCHED_WATERMARK_JITTER_PERMILLE 990                       /* 99%   -- Fraction of the wakeups the watermark has to cover */
+#define TSCHED_WATERMARK_JITTER_FACTOR 2                           /* 2x    -- Headroom over that wakeup delay */
 
 /* Note that TSCHED_WATERMARK_INC_THRESHOLD_USEC == 0 means that we
  * will increase the watermark only if we hit a real underrun. */
@@ -85,11 +92,21 @@
 #define SMOOTHER_MIN_INTERVAL (2*PA_USEC_PER_MSEC)                 /* 2ms   -- min smoother update interval */
 #define SMOOTHER_MAX_INTERVAL (200*PA_USEC_PER_MSEC)               /* 200ms -- max smoother update interval */
 
+#define STATUS_IOCTLS_INTERVAL_USEC (10*PA_USEC_PER_SEC)           /* 10s   -- How often to report the number of status queries */
+
 #define VOLUME_ACCURACY (PA_VOLUME_NORM/100)  /* don't require volume adjustments to be perfectly correct. don't necessarily extend granularity in software unless the differences get greater than this level */
 
 #define DEFAULT_REWIND_SAFEGUARD_BYTES (256U) /* 1.33ms @48kHz, we'll never rewind less than this */
 #define DEFAULT_REWIND_SAFEGUARD_USEC (1330) /* 1.33ms, depending on channels/rate/sample we may rewind more than 256 above */
 
+/* A sink that owns a contiguous range of the channels of the device */
+struct split {
+    pa_sink *sink;
+    unsigned first_channel;
+    size_t offset; /* of the first channel within a device frame */
+    size_t frame_size;
+};
+
 struct userdata {
     pa_core *core;
     pa_module *module;
@@ -98,6 +115,9 @@ struct userdata {
     pa_thread *thread;
     pa_thread_mq thread_mq;
     pa_rtpoll *rtpoll;
+    pa_render_pool *render_pool;
+    pa_memarena *arena;
+    char *cpu_affinity;
 
     snd_pcm_t *pcm_handle;
 
@@ -112,8 +132,17 @@ struct userdata {
 
     unsigned int *rates;
 
+    /* With float_mixing the sink mixes in float and only the final
+     * mix is converted to the format of the device. All byte counts
+     * below are in the device's format, and mix_frame_size is the frame
+     * size of the sink. */
+    pa_sample_spec hw_sample_spec;
+    pa_convert_func_t convert_from_float;
+    uint32_t dither_seed;
+
     size_t
         frame_size,
+        mix_frame_size,
         fragment_size,
         hwbuf_size,
         tsched_watermark,
@@ -131,23 +160,46 @@ struct userdata {
     pa_usec_t min_latency_ref;
     pa_usec_t tsched_watermark_usec;
 
+    pa_alsa_jitter jitter;
+    size_t jitter_watermark;
+
     pa_memchunk memchunk;
 
     char *device_name;  /* name of the PCM device */
     char *control_device; /* name of the control device */
 
-    pa_bool_t use_mmap:1, use_tsched:1, deferred_volume:1, fixed_latency_range:1;
+    pa_bool_t use_mmap:1, use_tsched:1, deferred_volume:1, fixed_latency_range:1, soft_suspend:1, float_mixing:1, dither:1;
 
     pa_bool_t first, after_rewind;
 
     pa_rtpoll_item *alsa_rtpoll_item;
 
+    /* With soft_suspend the PCM stays open and configured while we are
+     * suspended for idleness, so that resuming only needs a prepare */
+    snd_pcm_t *idle_pcm_handle;
+    pa_sample_spec idle_sample_spec;
+
+    /* When the last resume was started, until playback starts again */
+    pa_usec_t resume_time;
+    pa_bool_t resume_soft;
+
     pa_smoother *smoother;
     uint64_t write_count;
     uint64_t since_start;
     pa_usec_t smoother_interval;
     pa_usec_t last_smoother_update;
 
+    /* The PCM status as of the beginning of the current iteration of
+     * the IO thread, shared by everyone who needs avail or delay */
+    snd_pcm_status_t *status;
+    pa_bool_t status_valid;
+    snd_pcm_sframes_t status_delay;
+    uint64_t status_write_count;
+    pa_usec_t status_time;
+
+    unsigned status_ioctls;
+    pa_usec_t status_ioctls_since;
+
     pa_idxset *formats;
 
     pa_reserve_wrapper *reserve;
@@ -157,6 +209,17 @@ struct userdata {
 
     /* ucm context */
     pa_alsa_ucm_mapping_context *ucm_context;
+
+    struct split *splits;
+    unsigned n_splits;
+    pa_sink *split_changing;
+};
+
+enum {
+    SINK_MESSAGE_UPDATE_JITTER = PA_SINK_MESSAGE_MAX,
+    SINK_MESSAGE_UPDATE_STATUS_IOCTLS,
+    SINK_MESSAGE_UPDATE_RESUME_LATENCY,
+    SINK_MESSAGE_CLOSE_IDLE_PCM
 };
 
 static void userdata_free(struct userdata *u);
@@ -179,6 +242,11 @@ static pa_hook_result_t reserve_cb(pa_reserve_wrapper *r, void *forced, struct u
     if (pa_sink_suspend(u->sink, TRUE, PA_SUSPEND_APPLICATION) < 0)
         return PA_HOOK_CANCEL;
 
+    /* If we were suspended for idleness already the device might still
+     * be open */
+    if (u->soft_suspend)
+        pa_asyncmsgq_send(u->sink->asyncmsgq, PA_MSGOBJECT(u->sink), SINK_MESSAGE_CLOSE_IDLE_PCM, NULL, 0, NULL);
+
     return PA_HOOK_OK;
 }
 
@@ -291,6 +359,40 @@ static int reserve_monitor_init(struct userdata *u, const char *dname) {
     return 0;
 }
 
+/* Called from IO context */
+static pa_usec_t get_requested_latency(struct userdata *u) {
+    pa_usec_t r;
+    unsigned i;
+
+    r = pa_sink_get_requested_latency_within_thread(u->sink);
+
+    /* The split sinks share our buffer, hence the one with the
+     * tightest requirements decides */
+    for (i = 0; i < u->n_splits; i++) {
+        pa_usec_t l = pa_sink_get_requested_latency_within_thread(u->splits[i].sink);
+
+        if (l != (pa_usec_t) -1 && (r == (pa_usec_t) -1 || l < r))
+            r = l;
+    }
+
+    return r;
+}
+
+/* Called from IO context */
+static void sync_splits(struct userdata *u) {
+    unsigned i;
+
+    for (i = 0; i < u->n_splits; i++) {
+        struct split *sp = &u->splits[i];
+
+        pa_sink_set_max_request_within_thread(sp->sink, u->sink->thread_info.max_request / u->mix_frame_size * sp->frame_size);
+        pa_sink_set_max_rewind_within_thread(sp->sink, u->sink->thread_info.max_rewind / u->mix_frame_size * sp->frame_size);
+
+        if (u->use_tsched)
+            pa_sink_set_latency_range_within_thread(sp->sink, u->sink->thread_info.min_latency, u->sink->thread_info.max_latency);
+    }
+}
+
 static void fix_min_sleep_wakeup(struct userdata *u) {
     size_t max_use, max_use_2;
 
@@ -298,12 +400,12 @@ static void fix_min_sleep_wakeup(struct userdata *u) {
     pa_assert(u->use_tsched);
 
     max_use = u->hwbuf_size - u->hwbuf_unused;
-    max_use_2 = pa_frame_align(max_use/2, &u->sink->sample_spec);
+    max_use_2 = pa_frame_align(max_use/2, &u->hw_sample_spec);
 
-    u->min_sleep = pa_usec_to_bytes(TSCHED_MIN_SLEEP_USEC, &u->sink->sample_spec);
+    u->min_sleep = pa_usec_to_bytes(TSCHED_MIN_SLEEP_USEC, &u->hw_sample_spec);
     u->min_sleep = PA_CLAMP(u->min_sleep, u->frame_size, max_use_2);
 
-    u->min_wakeup = pa_usec_to_bytes(TSCHED_MIN_WAKEUP_USEC, &u->sink->sample_spec);
+    u->min_wakeup = pa_usec_to_bytes(TSCHED_MIN_WAKEUP_USEC, &u->hw_sample_spec);
     u->min_wakeup = PA_CLAMP(u->min_wakeup, u->frame_size, max_use_2);
 }
 
@@ -320,7 +422,7 @@ static void fix_tsched_watermark(struct userdata *u) {
     if (u->tsched_watermark < u->min_wakeup)
         u->tsched_watermark = u->min_wakeup;
 
-    u->tsched_watermark_usec = pa_bytes_to_usec(u->tsched_watermark, &u->sink->sample_spec);
+    u->tsched_watermark_usec = pa_bytes_to_usec(u->tsched_watermark, &u->hw_sample_spec);
 }
 
 static void increase_watermark(struct userdata *u) {
@@ -356,6 +458,7 @@ static void increase_watermark(struct userdata *u) {
                     (double) new_min_latency / PA_USEC_PER_MSEC);
 
         pa_sink_set_latency_range_within_thread(u->sink, new_min_latency, u->sink->thread_info.max_latency);
+        sync_splits(u);
     }
 
     /* When we reach this we're officialy fucked! */
@@ -383,6 +486,9 @@ static void decrease_watermark(struct userdata *u) {
     else
         u->tsched_watermark = PA_MAX(u->tsched_watermark / 2, u->tsched_watermark - u->watermark_dec_step);
 
+    /* Never go below what the measured wakeup delays ask for */
+    u->tsched_watermark = PA_MAX(u->tsched_watermark, u->jitter_watermark);
+
     fix_tsched_watermark(u);
 
     if (old_watermark != u->tsched_watermark)
@@ -392,7 +498,134 @@ static void decrease_watermark(struct userdata *u) {
     /* We don't change the latency range*/
 
 restart:
-    u->watermark_dec_not_before = now + TSCHED_WATERMARK_VERIFY_AFTER_USEC;
+    /* If we know how late we wake up we don't need to wait as long
+     * before trusting a lower watermark */
+    u->watermark_dec_not_before = now + (u->jitter_watermark > 0 ?
+                                         TSCHED_WATERMARK_JITTER_VERIFY_AFTER_USEC :
+                                         TSCHED_WATERMARK_VERIFY_AFTER_USEC);
+}
+
+/* Called from IO context */
+static void update_jitter(struct userdata *u, pa_usec_t delay) {
+    pa_usec_t p;
+    size_t old_watermark;
+
+    pa_assert(u);
+    pa_assert(u->use_tsched);
+
+    if (pa_alsa_jitter_add(&u->jitter, delay))
+        pa_asyncmsgq_post(u->thread_mq.outq, PA_MSGOBJECT(u->sink), SINK_MESSAGE_UPDATE_JITTER,
+                          pa_xnewdup(pa_alsa_jitter, &u->jitter, 1), 0, NULL, pa_xfree);
+
+    if ((p = pa_alsa_jitter_percentile(&u->jitter, TSCHED_WATERMARK_JITTER_PERMILLE)) <= 0)
+        return;
+
+    u->jitter_watermark = pa_usec_to_bytes(p * TSCHED_WATERMARK_JITTER_FACTOR, &u->hw_sample_spec);
+
+    if (u->jitter_watermark <= u->tsched_watermark)
+        return;
+
+    /* Raise the watermark before the late wakeups turn into underruns */
+    old_watermark = u->tsched_watermark;
+    u->tsched_watermark = u->jitter_watermark;
+    fix_tsched_watermark(u);
+
+    if (old_watermark != u->tsched_watermark)
+        pa_log_info("Increasing wakeup watermark to %0.2f ms to cover wakeup delays of %0.2f ms",
+                    (double) u->tsched_watermark_usec / PA_USEC_PER_MSEC,
+                    (double) p / PA_USEC_PER_MSEC);
+}
+
+/* Called from IO context. Renders the split sinks and scatters their
+ * frames over their channels of the frames in target, replacing
+ * whatever the main sink put there. */
+static void render_splits(struct userdata *u, const pa_memchunk *target) {
+    uint8_t *dst;
+    size_t frames;
+    unsigned i;
+
+    if (u->n_splits <= 0)
+        return;
+
+    frames = target->length / u->mix_frame_size;
+
+    if (frames <= 0)
+        return;
+
+    dst = (uint8_t*) pa_memblock_acquire(target->memblock) + target->index;
+
+    for (i = 0; i < u->n_splits; i++) {
+        struct split *sp = &u->splits[i];
+        pa_memchunk chunk;
+        const uint8_t *src;
+        uint8_t *d;
+        size_t f;
+
+        if (!PA_SINK_IS_LINKED(sp->sink->thread_info.state))
+            continue;
+
+        pa_sink_render_full(sp->sink, frames * sp->frame_size, &chunk);
+
+        src = (const uint8_t*) pa_memblock_acquire(chunk.memblock) + chunk.index;
+        d = dst + sp->offset;
+
+        for (f = 0; f < frames; f++, src += sp->frame_size, d += u->mix_frame_size)
+            memcpy(d, src, sp->frame_size);
+
+        pa_memblock_release(chunk.memblock);
+        pa_memblock_unref(chunk.memblock);
+    }
+
+    pa_memblock_release(target->memblock);
+}
+
+/* Byte counts of the device and of the sink only differ with float_mixing */
+static size_t hw_to_mix_bytes(struct userdata *u, size_t nbytes) {
+    return nbytes / u->frame_size * u->mix_frame_size;
+}
+
+static size_t mix_to_hw_bytes(struct userdata *u, size_t nbytes) {
+    return nbytes / u->mix_frame_size * u->frame_size;
+}
+
+/* Called from IO context. Converts the float frames the sink rendered
+ * into chunk to the format of the device at dst. For formats of 16 bits
+ * and less we add triangular noise of one LSB first, if asked to, which
+ * is all it takes to decorrelate the rounding error from the signal. */
+static void convert_mix(struct userdata *u, pa_memchunk *chunk, void *dst) {
+    unsigned n;
+    float *src;
+
+    pa_assert(u->float_mixing);
+    pa_assert(chunk->length % u->mix_frame_size == 0);
+
+    n = (unsigned) (chunk->length / sizeof(float));
+
+    if (u->dither) {
+        float lsb;
+        unsigned i;
+
+        lsb = u->hw_sample_spec.format == PA_SAMPLE_U8 ? 1.0f / 128.0f : 1.0f / 32768.0f;
+
+        pa_memchunk_make_writable(chunk, 0);
+        src = (float*) ((uint8_t*) pa_memblock_acquire(chunk->memblock) + chunk->index);
+
+        for (i = 0; i < n; i++) {
+            int32_t r1, r2;
+
+            /* Two cheap LCG draws make for a triangular distribution */
+            u->dither_seed = u->dither_seed * 1664525U + 1013904223U;
+            r1 = (int32_t) (u->dither_seed >> 16) & 0xFFFF;
+            u->dither_seed = u->dither_seed * 1664525U + 1013904223U;
+            r2 = (int32_t) (u->dither_seed >> 16) & 0xFFFF;
+
+            src[i] += (float) (r1 - r2) * (lsb / 65536.0f);
+        }
+    } else
+        src = (float*) ((uint8_t*) pa_memblock_acquire(chunk->memblock) + chunk->index);
+
+    u->convert_from_float(n, src, dst);
+    pa_memblock_release(chunk->memblock);
 }
 
 static void hw_sleep_time(struct userdata *u, pa_usec_t *sleep_usec, pa_usec_t*process_usec) {
@@ -404,10 +637,10 @@ static void hw_sleep_time(struct userdata *u, pa_usec_t *sleep_usec, pa_usec_t*p
     pa_assert(u);
     pa_assert(u->use_tsched);
 
-    usec = pa_sink_get_requested_latency_within_thread(u->sink);
+    usec = get_requested_latency(u);
 
     if (usec == (pa_usec_t) -1)
-        usec = pa_bytes_to_usec(u->hwbuf_size, &u->sink->sample_spec);
+        usec = pa_bytes_to_usec(u->hwbuf_size, &u->hw_sample_spec);
 
     wm = u->tsched_watermark_usec;
 
@@ -434,8 +667,12 @@ static int try_recover(struct userdata *u, const char *call, int err) {
 
     pa_assert(err != -EAGAIN);
 
-    if (err == -EPIPE)
+    PA_TRACE2(alsa_sink_xrun, u->sink->index, err);
+
+    if (err == -EPIPE) {
         pa_log_debug("%s: Buffer underrun!", call);
+        u->sink->thread_info.counters.xruns++;
+    }
 
     if (err == -ESTRPIPE)
         pa_log_debug("%s: System suspended!", call);
@@ -447,9 +684,52 @@ static int try_recover(struct userdata *u, const char *call, int err) {
 
     u->first = TRUE;
     u->since_start = 0;
+    u->status_valid = FALSE;
     return 0;
 }
 
+/* Called from IO context. Counts the calls that have the driver report
+ * the hardware position, every one of them is an ioctl. */
+static void count_status_ioctl(struct userdata *u) {
+    pa_usec_t now;
+
+    u->status_ioctls++;
+
+    now = pa_rtclock_now();
+
+    if (u->status_ioctls_since <= 0)
+        u->status_ioctls_since = now;
+    else if (now >= u->status_ioctls_since + STATUS_IOCTLS_INTERVAL_USEC) {
+        int64_t rate;
+
+        rate = (int64_t) (((uint64_t) u->status_ioctls * PA_USEC_PER_SEC) / (now - u->status_ioctls_since));
+        pa_asyncmsgq_post(u->thread_mq.outq, PA_MSGOBJECT(u->sink), SINK_MESSAGE_UPDATE_STATUS_IOCTLS, NULL, rate, NULL, NULL);
+
+        u->status_ioctls = 0;
+        u->status_ioctls_since = now;
+    }
+}
+
+/* Called from IO context. Takes the status snapshot for this iteration
+ * and returns avail, or a negative error code. */
+static snd_pcm_sframes_t update_status(struct userdata *u) {
+    int err;
+
+    u->status_valid = FALSE;
+    count_status_ioctl(u);
+
+    if (PA_UNLIKELY((err = pa_alsa_safe_delay(u->pcm_handle, u->status, &u->status_delay, u->hwbuf_size, &u->hw_sample_spec, FALSE)) < 0))
+        return err;
+
+    u->status_write_count = u->write_count;
+    u->status_time = pa_rtclock_now();
+    u->status_valid = TRUE;
+
+    /* snd_pcm_status() just refreshed the hardware position, so this
+     * needs no further round trip to the driver */
+    return pa_alsa_safe_avail_update(u->pcm_handle, u->hwbuf_size, &u->hw_sample_spec);
+}
+
 static size_t check_left_to_play(struct userdata *u, size_t n_bytes, pa_bool_t on_timeout) {
     size_t left_to_play;
     pa_bool_t underrun = FALSE;
@@ -478,9 +758,9 @@ static size_t check_left_to_play(struct userdata *u, size_t n_bytes, pa_bool_t o
 
 #ifdef DEBUG_TIMING
     pa_log_debug("%0.2f ms left to play; inc threshold = %0.2f ms; dec threshold = %0.2f ms",
-                 (double) pa_bytes_to_usec(left_to_play, &u->sink->sample_spec) / PA_USEC_PER_MSEC,
-                 (double) pa_bytes_to_usec(u->watermark_inc_threshold, &u->sink->sample_spec) / PA_USEC_PER_MSEC,
-                 (double) pa_bytes_to_usec(u->watermark_dec_threshold, &u->sink->sample_spec) / PA_USEC_PER_MSEC);
+                 (double) pa_bytes_to_usec(left_to_play, &u->hw_sample_spec) / PA_USEC_PER_MSEC,
+                 (double) pa_bytes_to_usec(u->watermark_inc_threshold, &u->hw_sample_spec) / PA_USEC_PER_MSEC,
+                 (double) pa_bytes_to_usec(u->watermark_dec_threshold, &u->hw_sample_spec) / PA_USEC_PER_MSEC);
 #endif
 
     if (u->use_tsched) {
@@ -529,7 +809,14 @@ static int mmap_write(struct userdata *u, pa_usec_t *sleep_usec, pa_bool_t polle
         /* First we determine how many samples are missing to fill the
          * buffer up to 100% */
 
-        if (PA_UNLIKELY((n = pa_alsa_safe_avail(u->pcm_handle, u->hwbuf_size, &u->sink->sample_spec)) < 0)) {
+        /* Later rounds only need to know how much of what was free
+         * we didn't fill yet */
+        if (j == 0)
+            n = update_status(u);
+        else
+            n = pa_alsa_safe_avail_update(u->pcm_handle, u->hwbuf_size, &u->hw_sample_spec);
+
+        if (PA_UNLIKELY(n < 0)) {
 
             if ((r = try_recover(u, "snd_pcm_avail", (int) n)) == 0)
                 continue;
@@ -555,7 +842,7 @@ static int mmap_write(struct userdata *u, pa_usec_t *sleep_usec, pa_bool_t polle
             * a single hw buffer length. */
 
             if (!polled &&
-                pa_bytes_to_usec(left_to_play, &u->sink->sample_spec) > process_usec+max_sleep_usec/2) {
+                pa_bytes_to_usec(left_to_play, &u->hw_sample_spec) > process_usec+max_sleep_usec/2) {
 #ifdef DEBUG_TIMING
                 pa_log_debug("Not filling up, because too early.");
 #endif
@@ -607,7 +894,7 @@ static int mmap_write(struct userdata *u, pa_usec_t *sleep_usec, pa_bool_t polle
             frames = (snd_pcm_uframes_t) (n_bytes / u->frame_size);
 /*             pa_log_debug("%lu frames to write", (unsigned long) frames); */
 
-            if (PA_UNLIKELY((err = pa_alsa_safe_mmap_begin(u->pcm_handle, &areas, &offset, &frames, u->hwbuf_size, &u->sink->sample_spec)) < 0)) {
+            if (PA_UNLIKELY((err = pa_alsa_safe_mmap_begin(u->pcm_handle, &areas, &offset, &frames, u->hwbuf_size, &u->hw_sample_spec)) < 0)) {
 
                 if (!after_avail && err == -EAGAIN)
                     break;
@@ -619,8 +906,8 @@ static int mmap_write(struct userdata *u, pa_usec_t *sleep_usec, pa_bool_t polle
             }
 
             /* Make sure that if these memblocks need to be copied they will fit into one slot */
-            if (frames > pa_mempool_block_size_max(u->core->mempool)/u->frame_size)
-                frames = pa_mempool_block_size_max(u->core->mempool)/u->frame_size;
+            if (frames > pa_mempool_block_size_max(u->core->mempool)/PA_MAX(u->frame_size, u->mix_frame_size))
+                frames = pa_mempool_block_size_max(u->core->mempool)/PA_MAX(u->frame_size, u->mix_frame_size);
 
             if (!after_avail && frames == 0)
                 break;
@@ -639,12 +926,23 @@ static int mmap_write(struct userdata *u, pa_usec_t *sleep_usec, pa_bool_t polle
             p = (uint8_t*) areas[0].addr + (offset * u->frame_size);
 
             written = frames * u->frame_size;
-            chunk.memblock = pa_memblock_new_fixed(u->core->mempool, p, written, TRUE);
-            chunk.length = pa_memblock_get_length(chunk.memblock);
-            chunk.index = 0;
 
-            pa_sink_render_into_full(u->sink, &chunk);
-            pa_memblock_unref_fixed(chunk.memblock);
+            if (u->float_mixing) {
+                /* The mix can't go into the buffer directly, the
+                 * conversion is the single copy we need */
+                pa_sink_render_full(u->sink, frames * u->mix_frame_size, &chunk);
+                render_splits(u, &chunk);
+                convert_mix(u, &chunk, p);
+                pa_memblock_unref(chunk.memblock);
+            } else {
+                chunk.memblock = pa_memblock_new_fixed(u->core->mempool, p, written, TRUE);
+                chunk.length = pa_memblock_get_length(chunk.memblock);
+                chunk.index = 0;
+
+                pa_sink_render_into_full(u->sink, &chunk);
+                render_splits(u, &chunk);
+                pa_memblock_unref_fixed(chunk.memblock);
+            }
 
             if (PA_UNLIKELY((sframes = snd_pcm_mmap_commit(u->pcm_handle, offset, frames)) < 0)) {
 
@@ -676,9 +974,9 @@ static int mmap_write(struct userdata *u, pa_usec_t *sleep_usec, pa_bool_t polle
     input_underrun = pa_sink_process_input_underruns(u->sink, left_to_play);
 
     if (u->use_tsched) {
-        pa_usec_t underrun_sleep = pa_bytes_to_usec_round_up(input_underrun, &u->sink->sample_spec);
+        pa_usec_t underrun_sleep = pa_bytes_to_usec_round_up(input_underrun, &u->hw_sample_spec);
 
-        *sleep_usec = pa_bytes_to_usec(left_to_play, &u->sink->sample_spec);
+        *sleep_usec = pa_bytes_to_usec(left_to_play, &u->hw_sample_spec);
         process_usec = u->tsched_watermark_usec;
 
         if (*sleep_usec > process_usec)
@@ -711,7 +1009,14 @@ static int unix_write(struct userdata *u, pa_usec_t *sleep_usec, pa_bool_t polle
         int r;
         pa_bool_t after_avail = TRUE;
 
-        if (PA_UNLIKELY((n = pa_alsa_safe_avail(u->pcm_handle, u->hwbuf_size, &u->sink->sample_spec)) < 0)) {
+        /* Later rounds only need to know how much of what was free
+         * we didn't fill yet */
+        if (j == 0)
+            n = update_status(u);
+        else
+            n = pa_alsa_safe_avail_update(u->pcm_handle, u->hwbuf_size, &u->hw_sample_spec);
+
+        if (PA_UNLIKELY(n < 0)) {
 
             if ((r = try_recover(u, "snd_pcm_avail", (int) n)) == 0)
                 continue;
@@ -737,7 +1042,7 @@ static int unix_write(struct userdata *u, pa_usec_t *sleep_usec, pa_bool_t polle
             * a single hw buffer length. */
 
             if (!polled &&
-                pa_bytes_to_usec(left_to_play, &u->sink->sample_spec) > process_usec+max_sleep_usec/2)
+                pa_bytes_to_usec(left_to_play, &u->hw_sample_spec) > process_usec+max_sleep_usec/2)
                 break;
 
         if (PA_UNLIKELY(n_bytes <= u->hwbuf_unused)) {
@@ -773,8 +1078,27 @@ static int unix_write(struct userdata *u, pa_usec_t *sleep_usec, pa_bool_t polle
 
 /*         pa_log_debug("%lu frames to write", (unsigned long) frames); */
 
-            if (u->memchunk.length <= 0)
-                pa_sink_render(u->sink, n_bytes, &u->memchunk);
+            if (u->memchunk.length <= 0) {
+                pa_sink_render(u->sink, hw_to_mix_bytes(u, n_bytes), &u->memchunk);
+
+                if (u->n_splits > 0) {
+                    pa_memchunk_make_writable(&u->memchunk, 0);
+                    render_splits(u, &u->memchunk);
+                }
+
+                if (u->float_mixing) {
+                    pa_memchunk mix = u->memchunk;
+
+                    u->memchunk.index = 0;
+                    u->memchunk.length = mix_to_hw_bytes(u, mix.length);
+                    u->memchunk.memblock = pa_memblock_new(u->core->mempool, u->memchunk.length);
+
+                    p = pa_memblock_acquire(u->memchunk.memblock);
+                    convert_mix(u, &mix, p);
+                    pa_memblock_release(u->memchunk.memblock);
+                    pa_memblock_unref(mix.memblock);
+                }
+            }
 
             pa_assert(u->memchunk.length > 0);
 
@@ -830,9 +1154,9 @@ static int unix_write(struct userdata *u, pa_usec_t *sleep_usec, pa_bool_t polle
     input_underrun = pa_sink_process_input_underruns(u->sink, left_to_play);
 
     if (u->use_tsched) {
-        pa_usec_t underrun_sleep = pa_bytes_to_usec_round_up(input_underrun, &u->sink->sample_spec);
+        pa_usec_t underrun_sleep = pa_bytes_to_usec_round_up(input_underrun, &u->hw_sample_spec);
 
-        *sleep_usec = pa_bytes_to_usec(left_to_play, &u->sink->sample_spec);
+        *sleep_usec = pa_bytes_to_usec(left_to_play, &u->hw_sample_spec);
         process_usec = u->tsched_watermark_usec;
 
         if (*sleep_usec > process_usec)
@@ -852,39 +1176,51 @@ static void update_smoother(struct userdata *u) {
     int64_t position;
     int err;
     pa_usec_t now1 = 0, now2;
-    snd_pcm_status_t *status;
+    uint64_t write_count;
     snd_htimestamp_t htstamp = { 0, 0 };
 
-    snd_pcm_status_alloca(&status);
-
     pa_assert(u);
     pa_assert(u->pcm_handle);
 
     /* Let's update the time smoother */
 
-    if (PA_UNLIKELY((err = pa_alsa_safe_delay(u->pcm_handle, status, &delay, u->hwbuf_size, &u->sink->sample_spec, FALSE)) < 0)) {
-        pa_log_warn("Failed to query DSP status data: %s", pa_alsa_strerror(err));
-        return;
+    if (!u->status_valid) {
+        count_status_ioctl(u);
+
+        if (PA_UNLIKELY((err = pa_alsa_safe_delay(u->pcm_handle, u->status, &u->status_delay, u->hwbuf_size, &u->hw_sample_spec, FALSE)) < 0)) {
+            pa_log_warn("Failed to query DSP status data: %s", pa_alsa_strerror(err));
+            return;
+        }
+
+        u->status_write_count = u->write_count;
+        u->status_time = pa_rtclock_now();
     }
 
-    snd_pcm_status_get_htstamp(status, &htstamp);
+    /* The snapshot is only good for one update */
+    u->status_valid = FALSE;
+
+    delay = u->status_delay;
+    write_count = u->status_write_count;
+
+    snd_pcm_status_get_htstamp(u->status, &htstamp);
     now1 = pa_timespec_load(&htstamp);
 
-    /* Hmm, if the timestamp is 0, then it wasn't set and we take the current time */
+    /* Hmm, if the timestamp is 0, then it wasn't set and we take the
+     * time the status was queried */
     if (now1 <= 0)
-        now1 = pa_rtclock_now();
+        now1 = u->status_time;
 
     /* check if the time since the last update is bigger than the interval */
     if (u->last_smoother_update > 0)
         if (u->last_smoother_update + u->smoother_interval > now1)
             return;
 
-    position = (int64_t) u->write_count - ((int64_t) delay * (int64_t) u->frame_size);
+    position = (int64_t) write_count - ((int64_t) delay * (int64_t) u->frame_size);
 
     if (PA_UNLIKELY(position < 0))
         position = 0;
 
-    now2 = pa_bytes_to_usec((uint64_t) position, &u->sink->sample_spec);
+    now2 = pa_bytes_to_usec((uint64_t) position, &u->hw_sample_spec);
 
     pa_smoother_put(u->smoother, now1, now2);
 
@@ -903,12 +1239,12 @@ static pa_usec_t sink_get_latency(struct userdata *u) {
     now1 = pa_rtclock_now();
     now2 = pa_smoother_get(u->smoother, now1);
 
-    delay = (int64_t) pa_bytes_to_usec(u->write_count, &u->sink->sample_spec) - (int64_t) now2;
+    delay = (int64_t) pa_bytes_to_usec(u->write_count, &u->hw_sample_spec) - (int64_t) now2;
 
     r = delay >= 0 ? (pa_usec_t) delay : 0;
 
     if (u->memchunk.memblock)
-        r += pa_bytes_to_usec(u->memchunk.length, &u->sink->sample_spec);
+        r += pa_bytes_to_usec(u->memchunk.length, &u->hw_sample_spec);
 
     return r;
 }
@@ -935,7 +1271,20 @@ static int suspend(struct userdata *u) {
 
     /* Let's suspend -- we don't call snd_pcm_drain() here since that might
      * take awfully long with our long buffer sizes today. */
-    snd_pcm_close(u->pcm_handle);
+    if (u->soft_suspend &&
+        u->sink->suspend_cause == PA_SUSPEND_IDLE &&
+        !pa_sink_is_passthrough(u->sink)) {
+
+        /* Nobody else wants the device, so keep it configured and just
+         * stop it. The main thread is waiting for us, hence reading
+         * the suspend cause is safe. */
+        snd_pcm_drop(u->pcm_handle);
+        u->idle_pcm_handle = u->pcm_handle;
+        u->idle_sample_spec = u->hw_sample_spec;
+        pa_log_info("Keeping device open while suspended.");
+    } else
+        snd_pcm_close(u->pcm_handle);
+
     u->pcm_handle = NULL;
 
     if (u->alsa_rtpoll_item) {
@@ -950,6 +1299,7 @@ static int suspend(struct userdata *u) {
      * influence on them. */
     pa_sink_set_max_rewind_within_thread(u->sink, 0);
     pa_sink_set_max_request_within_thread(u->sink, 0);
+    sync_splits(u);
 
     pa_log_info("Device suspended...");
 
@@ -969,12 +1319,12 @@ static int update_sw_params(struct userdata *u) {
     if (u->use_tsched) {
         pa_usec_t latency;
 
-        if ((latency = pa_sink_get_requested_latency_within_thread(u->sink)) != (pa_usec_t) -1) {
+        if ((latency = get_requested_latency(u)) != (pa_usec_t) -1) {
             size_t b;
 
             pa_log_debug("Latency set to %0.2fms", (double) latency / PA_USEC_PER_MSEC);
 
-            b = pa_usec_to_bytes(latency, &u->sink->sample_spec);
+            b = pa_usec_to_bytes(latency, &u->hw_sample_spec);
 
             /* We need at least one sample in our buffer */
 
@@ -997,7 +1347,7 @@ static int update_sw_params(struct userdata *u) {
         pa_usec_t sleep_usec, process_usec;
 
         hw_sleep_time(u, &sleep_usec, &process_usec);
-        avail_min += pa_usec_to_bytes(sleep_usec, &u->sink->sample_spec) / u->frame_size;
+        avail_min += pa_usec_to_bytes(sleep_usec, &u->hw_sample_spec) / u->frame_size;
     }
 
     pa_log_debug("setting avail_min=%lu", (unsigned long) avail_min);
@@ -1007,14 +1357,16 @@ static int update_sw_params(struct userdata *u) {
         return err;
     }
 
-    pa_sink_set_max_request_within_thread(u->sink, u->hwbuf_size - u->hwbuf_unused);
+    pa_sink_set_max_request_within_thread(u->sink, hw_to_mix_bytes(u, u->hwbuf_size - u->hwbuf_unused));
      if (pa_alsa_pcm_is_hw(u->pcm_handle))
-         pa_sink_set_max_rewind_within_thread(u->sink, u->hwbuf_size);
+         pa_sink_set_max_rewind_within_thread(u->sink, hw_to_mix_bytes(u, u->hwbuf_size));
     else {
         pa_log_info("Disabling rewind_within_thread for device %s", u->device_name);
         pa_sink_set_max_rewind_within_thread(u->sink, 0);
     }
 
+    sync_splits(u);
+
     return 0;
 }
 
@@ -1022,22 +1374,27 @@ static int update_sw_params(struct userdata *u) {
 static void reset_watermark(struct userdata *u, size_t tsched_watermark, pa_sample_spec *ss,
                             pa_bool_t in_thread) {
     u->tsched_watermark = pa_usec_to_bytes_round_up(pa_bytes_to_usec_round_up(tsched_watermark, ss),
-                                                    &u->sink->sample_spec);
+                                                    &u->hw_sample_spec);
 
-    u->watermark_inc_step = pa_usec_to_bytes(TSCHED_WATERMARK_INC_STEP_USEC, &u->sink->sample_spec);
-    u->watermark_dec_step = pa_usec_to_bytes(TSCHED_WATERMARK_DEC_STEP_USEC, &u->sink->sample_spec);
+    u->watermark_inc_step = pa_usec_to_bytes(TSCHED_WATERMARK_INC_STEP_USEC, &u->hw_sample_spec);
+    u->watermark_dec_step = pa_usec_to_bytes(TSCHED_WATERMARK_DEC_STEP_USEC, &u->hw_sample_spec);
 
-    u->watermark_inc_threshold = pa_usec_to_bytes_round_up(TSCHED_WATERMARK_INC_THRESHOLD_USEC, &u->sink->sample_spec);
-    u->watermark_dec_threshold = pa_usec_to_bytes_round_up(TSCHED_WATERMARK_DEC_THRESHOLD_USEC, &u->sink->sample_spec);
+    u->watermark_inc_threshold = pa_usec_to_bytes_round_up(TSCHED_WATERMARK_INC_THRESHOLD_USEC, &u->hw_sample_spec);
+    u->watermark_dec_threshold = pa_usec_to_bytes_round_up(TSCHED_WATERMARK_DEC_THRESHOLD_USEC, &u->hw_sample_spec);
+
+    /* The device and hence the wakeup pattern may have changed */
+    pa_alsa_jitter_reset(&u->jitter);
+    u->jitter_watermark = 0;
 
     fix_min_sleep_wakeup(u);
     fix_tsched_watermark(u);
 
-    if (in_thread)
+    if (in_thread) {
         pa_sink_set_latency_range_within_thread(u->sink,
                                                 u->min_latency_ref,
                                                 pa_bytes_to_usec(u->hwbuf_size, ss));
-    else {
+        sync_splits(u);
+    } else {
         pa_sink_set_latency_range(u->sink,
                                   0,
                                   pa_bytes_to_usec(u->hwbuf_size, ss));
@@ -1065,6 +1422,31 @@ static int unsuspend(struct userdata *u) {
 
     pa_log_info("Trying resume...");
 
+    u->resume_time = pa_rtclock_now();
+    u->resume_soft = FALSE;
+
+    if (u->idle_pcm_handle) {
+        snd_pcm_t *h = u->idle_pcm_handle;
+
+        u->idle_pcm_handle = NULL;
+
+        /* The rate or the format might have been changed while we were
+         * suspended, the device needs to be set up anew then */
+        if (!pa_sink_is_passthrough(u->sink) &&
+            pa_sample_spec_equal(&u->idle_sample_spec, &u->hw_sample_spec)) {
+
+            if ((err = snd_pcm_prepare(h)) >= 0) {
+                u->pcm_handle = h;
+                u->resume_soft = TRUE;
+                goto configured;
+            }
+
+            pa_log_debug("Failed to prepare kept open device, reopening: %s", pa_alsa_strerror(err));
+        }
+
+        snd_pcm_close(h);
+    }
+
     if ((is_iec958(u) || is_hdmi(u)) && pa_sink_is_passthrough(u->sink)) {
         /* Need to open device in NONAUDIO mode */
         int len = strlen(u->device_name) + 8;
@@ -1082,7 +1464,7 @@ static int unsuspend(struct userdata *u) {
         goto fail;
     }
 
-    ss = u->sink->sample_spec;
+    ss = u->hw_sample_spec;
     period_size = u->fragment_size / u->frame_size;
     buffer_size = u->hwbuf_size / u->frame_size;
     b = u->use_mmap;
@@ -1098,7 +1480,7 @@ static int unsuspend(struct userdata *u) {
         goto fail;
     }
 
-    if (!pa_sample_spec_equal(&ss, &u->sink->sample_spec)) {
+    if (!pa_sample_spec_equal(&ss, &u->hw_sample_spec)) {
         pa_log_warn("Resume failed, couldn't restore original sample settings.");
         goto fail;
     }
@@ -1111,6 +1493,7 @@ static int unsuspend(struct userdata *u) {
         goto fail;
     }
 
+configured:
     if (update_sw_params(u) < 0)
         goto fail;
 
@@ -1127,9 +1510,9 @@ static int unsuspend(struct userdata *u) {
 
     /* reset the watermark to the value defined when sink was created */
     if (u->use_tsched)
-        reset_watermark(u, u->tsched_watermark_ref, &u->sink->sample_spec, TRUE);
+        reset_watermark(u, u->tsched_watermark_ref, &u->hw_sample_spec, TRUE);
 
-    pa_log_info("Resumed successfully...");
+    pa_log_info("Resumed successfully%s...", u->resume_soft ? " (device was kept open)" : "");
 
     pa_xfree(device_name);
     return 0;
@@ -1162,6 +1545,66 @@ static int sink_process_msg(pa_msgobject *o, int code, void *data, int64_t offse
             return 0;
         }
 
+        case SINK_MESSAGE_UPDATE_JITTER: {
+            pa_alsa_jitter *j = data;
+            pa_proplist *pl;
+            char *t;
+
+            /* This one is delivered to us from the IO thread, hence
+             * we are running in the main context here */
+
+            pl = pa_proplist_new();
+
+            t = pa_alsa_jitter_to_string(j);
+            pa_proplist_sets(pl, "alsa.wakeup_jitter", t);
+            pa_xfree(t);
+
+            pa_proplist_setf(pl, "alsa.wakeup_jitter.p99_usec", "%llu",
+                             (unsigned long long) pa_alsa_jitter_percentile(j, 990));
+
+            pa_sink_update_proplist(u->sink, PA_UPDATE_REPLACE, pl);
+            pa_proplist_free(pl);
+
+            return 0;
+        }
+
+        case SINK_MESSAGE_UPDATE_STATUS_IOCTLS: {
+            pa_proplist *pl;
+
+            /* Main context, just like SINK_MESSAGE_UPDATE_JITTER */
+
+            pl = pa_proplist_new();
+            pa_proplist_setf(pl, "alsa.status_ioctls_per_second", "%lli", (long long) offset);
+            pa_sink_update_proplist(u->sink, PA_UPDATE_REPLACE, pl);
+            pa_proplist_free(pl);
+
+            return 0;
+        }
+
+        case SINK_MESSAGE_UPDATE_RESUME_LATENCY: {
+            pa_proplist *pl;
+
+            /* Main context, just like SINK_MESSAGE_UPDATE_JITTER */
+
+            pl = pa_proplist_new();
+            pa_proplist_setf(pl, "alsa.resume_latency_usec", "%llu", (unsigned long long) offset);
+            pa_proplist_sets(pl, "alsa.resume_mode", PA_PTR_TO_UINT(data) ? "soft" : "full");
+            pa_sink_update_proplist(u->sink, PA_UPDATE_REPLACE, pl);
+            pa_proplist_free(pl);
+
+            return 0;
+        }
+
+        case SINK_MESSAGE_CLOSE_IDLE_PCM:
+
+            if (u->idle_pcm_handle) {
+                pa_log_info("Closing device kept open while suspended.");
+                snd_pcm_close(u->idle_pcm_handle);
+                u->idle_pcm_handle = NULL;
+            }
+
+            return 0;
+
         case PA_SINK_MESSAGE_SET_STATE:
 
             switch ((pa_sink_state_t) PA_PTR_TO_UINT(data)) {
@@ -1206,6 +1649,53 @@ static int sink_process_msg(pa_msgobject *o, int code, void *data, int64_t offse
     return pa_sink_process_msg(o, code, data, offset, chunk);
 }
 
+/* Called from IO context */
+static int split_process_msg(pa_msgobject *o, int code, void *data, int64_t offset, pa_memchunk *chunk) {
+    struct userdata *u = PA_SINK(o)->userdata;
+
+    switch (code) {
+
+        case PA_SINK_MESSAGE_GET_LATENCY: {
+            pa_usec_t r = 0;
+
+            if (u->pcm_handle)
+                r = sink_get_latency(u);
+
+            *((pa_usec_t*) data) = r;
+
+            return 0;
+        }
+    }
+
+    return pa_sink_process_msg(o, code, data, offset, chunk);
+}
+
+/* Called from main context */
+static pa_bool_t splits_running(struct userdata *u, pa_sink *except) {
+    unsigned i;
+
+    for (i = 0; i < u->n_splits; i++)
+        if (u->splits[i].sink != except && pa_sink_get_state(u->splits[i].sink) == PA_SINK_RUNNING)
+            return TRUE;
+
+    return FALSE;
+}
+
+/* Called from main context */
+static void suspend_splits(struct userdata *u, pa_bool_t suspend) {
+    unsigned i;
+
+    for (i = 0; i < u->n_splits; i++) {
+        pa_sink *s = u->splits[i].sink;
+
+        if (!PA_SINK_IS_LINKED(pa_sink_get_state(s)))
+            continue;
+
+        if (suspend || (s->suspend_cause & PA_SUSPEND_INTERNAL))
+            pa_sink_suspend(s, suspend, PA_SUSPEND_INTERNAL);
+    }
+}
+
 /* Called from main context */
 static int sink_set_state_cb(pa_sink *s, pa_sink_state_t new_state) {
     pa_sink_state_t old_state;
@@ -1216,12 +1706,52 @@ static int sink_set_state_cb(pa_sink *s, pa_sink_state_t new_state) {
 
     old_state = pa_sink_get_state(u->sink);
 
+    /* The device stays open as long as one of the split sinks plays */
+    if (new_state == PA_SINK_SUSPENDED && s->suspend_cause == PA_SUSPEND_IDLE && splits_running(u, u->split_changing))
+        return -PA_ERR_BUSY;
+
     if (PA_SINK_IS_OPENED(old_state) && new_state == PA_SINK_SUSPENDED)
         reserve_done(u);
     else if (old_state == PA_SINK_SUSPENDED && PA_SINK_IS_OPENED(new_state))
         if (reserve_init(u, u->device_name) < 0)
             return -PA_ERR_BUSY;
 
+    /* When we are merely idle the split sinks may still wake us up, in
+     * all other cases they have to wait for us */
+    if (PA_SINK_IS_OPENED(old_state) && new_state == PA_SINK_SUSPENDED && s->suspend_cause != PA_SUSPEND_IDLE)
+        suspend_splits(u, TRUE);
+    else if (old_state == PA_SINK_SUSPENDED && PA_SINK_IS_OPENED(new_state))
+        suspend_splits(u, FALSE);
+
+    return 0;
+}
+
+/* Called from main context */
+static int split_set_state_cb(pa_sink *s, pa_sink_state_t new_state) {
+    pa_sink_state_t old_state;
+    struct userdata *u;
+
+    pa_sink_assert_ref(s);
+    pa_assert_se(u = s->userdata);
+
+    old_state = pa_sink_get_state(s);
+
+    if (new_state == PA_SINK_RUNNING) {
+        if (u->sink->suspend_cause & PA_SUSPEND_IDLE)
+            pa_sink_suspend(u->sink, FALSE, PA_SUSPEND_IDLE);
+
+    } else if (old_state == PA_SINK_RUNNING &&
+               pa_sink_get_state(u->sink) == PA_SINK_IDLE &&
+               u->sink->suspend_cause == PA_SUSPEND_IDLE &&
+               !splits_running(u, s)) {
+
+        /* We were asked to suspend on idle earlier but refused because
+         * of this sink, so let's catch up on that now */
+        u->split_changing = s;
+        pa_sink_suspend(u->sink, TRUE, PA_SUSPEND_IDLE);
+        u->split_changing = NULL;
+    }
+
     return 0;
 }
 
@@ -1536,7 +2066,7 @@ static void sink_update_requested_latency_cb(pa_sink *s) {
 
     if (u->hwbuf_unused > before) {
         pa_log_debug("Requesting rewind due to latency change.");
-        pa_sink_request_rewind(s, (size_t) -1);
+        pa_sink_request_rewind(u->sink, (size_t) -1);
     }
 }
 
@@ -1623,28 +2153,72 @@ static pa_bool_t sink_update_rate_cb(pa_sink *s, uint32_t rate) {
     if (!PA_SINK_IS_OPENED(s->state)) {
         pa_log_info("Updating rate for device %s, new rate is %d",u->device_name, rate);
         u->sink->sample_spec.rate = rate;
+        u->hw_sample_spec.rate = rate;
         return TRUE;
     }
 
     return FALSE;
 }
 
+/* Called from IO context */
+static pa_bool_t rewind_requested(struct userdata *u) {
+    unsigned i;
+
+    if (u->sink->thread_info.rewind_requested)
+        return TRUE;
+
+    for (i = 0; i < u->n_splits; i++)
+        if (u->splits[i].sink->thread_info.rewind_requested)
+            return TRUE;
+
+    return FALSE;
+}
+
+/* Called from IO context. All sinks share the hardware buffer, so
+ * whatever we rewound has to be rendered again by all of them. */
+static void process_rewind_all(struct userdata *u, size_t nbytes) {
+    unsigned i;
+
+    pa_sink_process_rewind(u->sink, hw_to_mix_bytes(u, nbytes));
+
+    for (i = 0; i < u->n_splits; i++) {
+        struct split *sp = &u->splits[i];
+
+        if (PA_SINK_IS_LINKED(sp->sink->thread_info.state))
+            pa_sink_process_rewind(sp->sink, nbytes / u->frame_size * sp->frame_size);
+    }
+}
+
 static int process_rewind(struct userdata *u) {
     snd_pcm_sframes_t unused;
     size_t rewind_nbytes, unused_nbytes, limit_nbytes;
+    unsigned i;
     pa_assert(u);
 
     if (!PA_SINK_IS_OPENED(u->sink->thread_info.state)) {
-        pa_sink_process_rewind(u->sink, 0);
+        process_rewind_all(u, 0);
         return 0;
     }
 
     /* Figure out how much we shall rewind and reset the counter */
-    rewind_nbytes = u->sink->thread_info.rewind_nbytes;
+    rewind_nbytes = mix_to_hw_bytes(u, u->sink->thread_info.rewind_nbytes);
+
+    for (i = 0; i < u->n_splits; i++) {
+        struct split *sp = &u->splits[i];
+        size_t n;
+
+        if (!sp->sink->thread_info.rewind_requested)
+            continue;
+
+        n = sp->sink->thread_info.rewind_nbytes / sp->frame_size * u->frame_size;
+        rewind_nbytes = PA_MAX(rewind_nbytes, n);
+    }
 
     pa_log_debug("Requested to rewind %lu bytes.", (unsigned long) rewind_nbytes);
 
-    if (PA_UNLIKELY((unused = pa_alsa_safe_avail(u->pcm_handle, u->hwbuf_size, &u->sink->sample_spec)) < 0)) {
+    count_status_ioctl(u);
+
+    if (PA_UNLIKELY((unused = pa_alsa_safe_avail(u->pcm_handle, u->hwbuf_size, &u->hw_sample_spec)) < 0)) {
         pa_log("snd_pcm_avail() failed: %s", pa_alsa_strerror((int) unused));
         return -1;
     }
@@ -1685,7 +2259,7 @@ static int process_rewind(struct userdata *u) {
         else {
             u->write_count -= rewind_nbytes;
             pa_log_debug("Rewound %lu bytes.", (unsigned long) rewind_nbytes);
-            pa_sink_process_rewind(u->sink, rewind_nbytes);
+            process_rewind_all(u, rewind_nbytes);
 
             u->after_rewind = TRUE;
             return 0;
@@ -1693,7 +2267,7 @@ static int process_rewind(struct userdata *u) {
     } else
         pa_log_debug("Mhmm, actually there is nothing to rewind.");
 
-    pa_sink_process_rewind(u->sink, 0);
+    process_rewind_all(u, 0);
     return 0;
 }
 
@@ -1706,9 +2280,13 @@ static void thread_func(void *userdata) {
     pa_log_debug("Thread starting up");
 
     if (u->core->realtime_scheduling)
-        pa_make_realtime(u->core->realtime_priority);
+        pa_sink_make_realtime_within_thread(u->sink, u->core->realtime_priority);
+
+    if (u->cpu_affinity)
+        pa_set_cpu_affinity(u->cpu_affinity);
 
     pa_thread_mq_install(&u->thread_mq);
+    pa_memarena_set_thread(u->arena);
 
     for (;;) {
         int ret;
@@ -1718,7 +2296,7 @@ static void thread_func(void *userdata) {
         pa_log_debug("Loop");
 #endif
 
-        if (PA_UNLIKELY(u->sink->thread_info.rewind_requested)) {
+        if (PA_UNLIKELY(rewind_requested(u))) {
             if (process_rewind(u) < 0)
                 goto fail;
         }
@@ -1748,11 +2326,29 @@ static void thread_func(void *userdata) {
                     pa_smoother_resume(u->smoother, pa_rtclock_now(), TRUE);
 
                     u->first = FALSE;
+
+                    if (u->resume_time > 0) {
+                        pa_asyncmsgq_post(u->thread_mq.outq, PA_MSGOBJECT(u->sink), SINK_MESSAGE_UPDATE_RESUME_LATENCY,
+                                          PA_UINT_TO_PTR(u->resume_soft), (int64_t) (pa_rtclock_now() - u->resume_time), NULL, NULL);
+                        u->resume_time = 0;
+                    }
                 }
 
                 update_smoother(u);
             }
 
+            /* Let the main thread read the latency without asking us */
+            if (!u->first) {
+                pa_usec_t latency = sink_get_latency(u);
+                unsigned i;
+
+                pa_sink_publish_latency(u->sink, latency);
+
+                for (i = 0; i < u->n_splits; i++)
+                    if (PA_SINK_IS_LINKED(u->splits[i].sink->thread_info.state))
+                        pa_sink_publish_latency(u->splits[i].sink, latency);
+            }
+
             if (u->use_tsched) {
                 pa_usec_t cusec;
 
@@ -1787,6 +2383,13 @@ static void thread_func(void *userdata) {
 
                 /* We don't trust the conversion, so we wake up whatever comes first */
                 rtpoll_sleep = PA_MIN(sleep_usec, cusec);
+
+                /* Join a wakeup of the other devices on this clock if
+                 * it is shortly before ours, writing a little less */
+                if (u->sink->clock_domain) {
+                    pa_usec_t now = pa_rtclock_now();
+                    rtpoll_sleep = pa_sink_align_wakeup_within_thread(u->sink, now + rtpoll_sleep, rtpoll_sleep / 4) - now;
+                }
             }
 
             u->after_rewind = FALSE;
@@ -1811,12 +2414,15 @@ static void thread_func(void *userdata) {
         else
             pa_rtpoll_set_timer_disabled(u->rtpoll);
 
+        /* Whatever was rendered in this iteration is gone by now */
+        pa_memarena_reset(u->arena);
+
         /* Hmm, nothing to do. Let's sleep */
         if ((ret = pa_rtpoll_run(u->rtpoll, TRUE)) < 0)
             goto fail;
 
         if (rtpoll_sleep > 0) {
-            real_sleep = pa_rtclock_now() - real_sleep;
+            real_sleep = pa_rtpoll_now(u->rtpoll) - real_sleep;
 #ifdef DEBUG_TIMING
             pa_log_debug("Expected sleep: %0.2fms, real sleep: %0.2fms (diff %0.2f ms)",
                 (double) rtpoll_sleep / PA_USEC_PER_MSEC, (double) real_sleep / PA_USEC_PER_MSEC,
@@ -1826,6 +2432,11 @@ static void thread_func(void *userdata) {
                 pa_log_info("Scheduling delay of %0.2f ms > %0.2f ms, you might want to investigate this to improve latency...",
                     (double) (real_sleep - rtpoll_sleep) / PA_USEC_PER_MSEC,
                     (double) (u->tsched_watermark_usec) / PA_USEC_PER_MSEC);
+
+            /* Only timer wakeups tell us something about the
+             * scheduling delay, early ones were caused by other events */
+            if (u->use_tsched && real_sleep >= rtpoll_sleep)
+                update_jitter(u, real_sleep - rtpoll_sleep);
         }
 
         if (u->sink->flags & PA_SINK_DEFERRED_VOLUME)
@@ -1868,6 +2479,7 @@ fail:
     pa_asyncmsgq_wait_for(u->thread_mq.inq, PA_MESSAGE_SHUTDOWN);
 
 finish:
+    pa_memarena_set_thread(NULL);
     pa_log_debug("Thread shutting down");
 }
 
@@ -2017,21 +2629,109 @@ static int setup_mixer(struct userdata *u, pa_bool_t ignore_dB) {
     return 0;
 }
 
+/* Called from main context */
+static int splits_init(struct userdata *u, const char *driver, uint32_t split_channels) {
+    pa_sample_spec ss;
+    pa_channel_map map;
+    const char *description;
+    unsigned i, n;
+
+    pa_assert(u);
+    pa_assert(u->sink);
+
+    if (split_channels >= u->sink->sample_spec.channels || u->sink->sample_spec.channels % split_channels != 0) {
+        pa_log_warn("Cannot split %u channels into groups of %u, not splitting.",
+                    u->sink->sample_spec.channels, split_channels);
+        return 0;
+    }
+
+    ss = u->sink->sample_spec;
+    ss.channels = (uint8_t) split_channels;
+    pa_channel_map_init_extend(&map, ss.channels, PA_CHANNEL_MAP_ALSA);
+
+    description = pa_strnull(pa_proplist_gets(u->sink->proplist, PA_PROP_DEVICE_DESCRIPTION));
+
+    n = u->sink->sample_spec.channels / split_channels;
+    u->splits = pa_xnew0(struct split, n);
+
+    for (i = 0; i < n; i++) {
+        struct split *sp = &u->splits[i];
+        pa_sink_new_data data;
+        char *t;
+
+        sp->first_channel = i * split_channels;
+        sp->offset = sp->first_channel * pa_sample_size(&ss);
+        sp->frame_size = pa_frame_size(&ss);
+
+        pa_sink_new_data_init(&data);
+        data.driver = driver;
+        data.module = u->module;
+
+        if (u->sink->suspend_cause & ~PA_SUSPEND_IDLE)
+            data.suspend_cause = PA_SUSPEND_INTERNAL;
+
+        t = pa_sprintf_malloc("%s.split%u", u->sink->name, i);
+        pa_sink_new_data_set_name(&data, t);
+        pa_xfree(t);
+
+        pa_sink_new_data_set_sample_spec(&data, &ss);
+        pa_sink_new_data_set_channel_map(&data, &map);
+
+        pa_proplist_update(data.proplist, PA_UPDATE_REPLACE, u->sink->proplist);
+        pa_proplist_sets(data.proplist, PA_PROP_DEVICE_MASTER_DEVICE, u->sink->name);
+        pa_proplist_setf(data.proplist, PA_PROP_DEVICE_DESCRIPTION, _("%s (Channels %u-%u)"),
+                         description, sp->first_channel + 1, sp->first_channel + split_channels);
+
+        sp->sink = pa_sink_new(u->core, &data, PA_SINK_LATENCY | (u->use_tsched ? PA_SINK_DYNAMIC_LATENCY : 0));
+        pa_sink_new_data_done(&data);
+
+        if (!sp->sink) {
+            pa_log("Failed to create split sink object");
+            return -1;
+        }
+
+        sp->sink->parent.process_msg = split_process_msg;
+        if (u->use_tsched)
+            sp->sink->update_requested_latency = sink_update_requested_latency_cb;
+        sp->sink->set_state = split_set_state_cb;
+        sp->sink->userdata = u;
+
+        pa_sink_set_asyncmsgq(sp->sink, u->thread_mq.inq);
+        pa_sink_set_rtpoll(sp->sink, u->rtpoll);
+        pa_sink_enable_decibel_volume(sp->sink, TRUE);
+
+        pa_sink_set_max_request(sp->sink, u->sink->thread_info.max_request / u->mix_frame_size * sp->frame_size);
+        pa_sink_set_max_rewind(sp->sink, u->sink->thread_info.max_rewind / u->mix_frame_size * sp->frame_size);
+
+        if (u->use_tsched)
+            pa_sink_set_latency_range(sp->sink, u->sink->thread_info.min_latency, u->sink->thread_info.max_latency);
+        else
+            pa_sink_set_fixed_latency(sp->sink, u->sink->thread_info.fixed_latency);
+
+        u->n_splits++;
+    }
+
+    pa_log_info("Split into %u sinks of %u channels each.", u->n_splits, split_channels);
+
+    return 0;
+}
+
 pa_sink *pa_alsa_sink_new(pa_module *m, pa_modargs *ma, const char*driver, pa_card *card, pa_alsa_mapping *mapping) {
 
     struct userdata *u = NULL;
-    const char *dev_id = NULL, *key, *mod_name;
-    pa_sample_spec ss;
+    const char *dev_id = NULL, *key, *mod_name, *card_index;
+    pa_sample_spec ss, mix_ss;
     char *thread_name = NULL;
     uint32_t alternate_sample_rate;
     pa_channel_map map;
-    uint32_t nfrags, frag_size, buffer_size, tsched_size, tsched_watermark, rewind_safeguard;
+    uint32_t nfrags, frag_size, buffer_size, tsched_size, tsched_watermark, rewind_safeguard, render_threads = 0, split_channels = 0;
     snd_pcm_uframes_t period_frames, buffer_frames, tsched_frames;
     size_t frame_size;
-    pa_bool_t use_mmap = TRUE, b, use_tsched = TRUE, d, ignore_dB = FALSE, namereg_fail = FALSE, deferred_volume = FALSE, set_formats = FALSE, fixed_latency_range = FALSE;
+    pa_bool_t use_mmap = TRUE, b, use_tsched = TRUE, d, ignore_dB = FALSE, namereg_fail = FALSE, deferred_volume = FALSE, set_formats = FALSE, fixed_latency_range = FALSE, soft_suspend = FALSE, float_mixing = FALSE, dither = FALSE;
     pa_sink_new_data data;
     pa_alsa_profile_set *profile_set = NULL;
     void *state = NULL;
+    unsigned i;
 
     pa_assert(m);
     pa_assert(ma);
@@ -2104,6 +2804,31 @@ pa_sink *pa_alsa_sink_new(pa_module *m, pa_modargs *ma, const char*driver, pa_ca
         goto fail;
     }
 
+    if (pa_modargs_get_value_boolean(ma, "soft_suspend", &soft_suspend) < 0) {
+        pa_log("Failed to parse soft_suspend argument.");
+        goto fail;
+    }
+
+    if (pa_modargs_get_value_boolean(ma, "float_mixing", &float_mixing) < 0) {
+        pa_log("Failed to parse float_mixing argument.");
+        goto fail;
+    }
+
+    if (pa_modargs_get_value_boolean(ma, "dither", &dither) < 0) {
+        pa_log("Failed to parse dither argument.");
+        goto fail;
+    }
+
+    if (pa_modargs_get_value_u32(ma, "render_threads", &render_threads) < 0) {
+        pa_log("Failed to parse render_threads argument.");
+        goto fail;
+    }
+
+    if (pa_modargs_get_value_u32(ma, "split_channels", &split_channels) < 0) {
+        pa_log("Failed to parse split_channels argument.");
+        goto fail;
+    }
+
     use_tsched = pa_alsa_may_tsched(use_tsched);
 
     u = pa_xnew0(struct userdata, 1);
@@ -2113,11 +2838,17 @@ pa_sink *pa_alsa_sink_new(pa_module *m, pa_modargs *ma, const char*driver, pa_ca
     u->use_tsched = use_tsched;
     u->deferred_volume = deferred_volume;
     u->fixed_latency_range = fixed_latency_range;
+    u->soft_suspend = soft_suspend;
     u->first = TRUE;
     u->rewind_safeguard = rewind_safeguard;
     u->rtpoll = pa_rtpoll_new();
     pa_thread_mq_init(&u->thread_mq, m->core->mainloop, u->rtpoll);
 
+    if (pa_modargs_get_cpu_affinity(ma, m->core->default_cpu_affinity, &u->cpu_affinity) < 0) {
+        pa_log("Failed to parse cpu_affinity or numa_node argument.");
+        goto fail;
+    }
+
     u->smoother = pa_smoother_new(
             SMOOTHER_ADJUST_USEC,
             SMOOTHER_WINDOW_USEC,
@@ -2128,6 +2859,8 @@ pa_sink *pa_alsa_sink_new(pa_module *m, pa_modargs *ma, const char*driver, pa_ca
             TRUE);
     u->smoother_interval = SMOOTHER_MIN_INTERVAL;
 
+    pa_assert_se(snd_pcm_status_malloc(&u->status) >= 0);
+
     /* use ucm */
     if (mapping && mapping->ucm_context.ucm)
         u->ucm_context = &mapping->ucm_context;
@@ -2239,6 +2972,25 @@ pa_sink *pa_alsa_sink_new(pa_module *m, pa_modargs *ma, const char*driver, pa_ca
     /* ALSA might tweak the sample spec, so recalculate the frame size */
     frame_size = pa_frame_size(&ss);
 
+    /* Passthrough data must reach the device as it is, and there is
+     * nothing to gain if the device takes float anyway */
+    mix_ss = ss;
+    if (float_mixing) {
+        if (set_formats)
+            pa_log_info("Not mixing in float on a device that may do passthrough.");
+        else if (ss.format != PA_SAMPLE_FLOAT32LE && ss.format != PA_SAMPLE_FLOAT32BE) {
+            mix_ss.format = PA_SAMPLE_FLOAT32NE;
+            u->float_mixing = TRUE;
+            u->convert_from_float = pa_get_convert_from_float32ne_function(ss.format);
+            u->dither = dither && pa_sample_size(&ss) <= 2 && ss.format != PA_SAMPLE_ALAW && ss.format != PA_SAMPLE_ULAW;
+            u->dither_seed = (uint32_t) pa_rtclock_now();
+
+            pa_log_info("Mixing in float, converting to %s%s.", pa_sample_format_to_string(ss.format), u->dither ? " with dither" : "");
+        }
+    }
+
+    u->hw_sample_spec = ss;
+
     if (!u->ucm_context)
         find_mixer(u, mapping, pa_modargs_get_value(ma, "control", NULL), ignore_dB);
 
@@ -2260,7 +3012,7 @@ pa_sink *pa_alsa_sink_new(pa_module *m, pa_modargs *ma, const char*driver, pa_ca
     }
     data.namereg_fail = namereg_fail;
 
-    pa_sink_new_data_set_sample_spec(&data, &ss);
+    pa_sink_new_data_set_sample_spec(&data, &mix_ss);
     pa_sink_new_data_set_channel_map(&data, &map);
     pa_sink_new_data_set_alternate_sample_rate(&data, alternate_sample_rate);
 
@@ -2279,6 +3031,14 @@ pa_sink *pa_alsa_sink_new(pa_module *m, pa_modargs *ma, const char*driver, pa_ca
     }
 
     pa_alsa_init_description(data.proplist);
+    pa_sink_new_data_set_cpu_affinity(&data, u->cpu_affinity);
+
+    /* All devices of a sound card run from its clock */
+    if (u->use_tsched && (card_index = pa_proplist_gets(data.proplist, "alsa.card"))) {
+        char *clock_domain = pa_sprintf_malloc("alsa-card-%s", card_index);
+        pa_sink_new_data_set_clock_domain(&data, clock_domain);
+        pa_xfree(clock_domain);
+    }
 
     if (u->control_device)
         pa_alsa_init_proplist_ctl(data.proplist, u->control_device);
@@ -2323,14 +3083,24 @@ pa_sink *pa_alsa_sink_new(pa_module *m, pa_modargs *ma, const char*driver, pa_ca
         u->sink->set_port = sink_set_port_ucm_cb;
     else
         u->sink->set_port = sink_set_port_cb;
-    if (u->sink->alternate_sample_rate)
+    /* The split sinks are fixed to the rate we start with */
+    if (u->sink->alternate_sample_rate && split_channels <= 0)
         u->sink->update_rate = sink_update_rate_cb;
     u->sink->userdata = u;
 
     pa_sink_set_asyncmsgq(u->sink, u->thread_mq.inq);
     pa_sink_set_rtpoll(u->sink, u->rtpoll);
 
+    if (render_threads > 0) {
+        if (!(u->render_pool = pa_render_pool_new("alsa-sink-render", render_threads, &u->thread_mq,
+                                                  m->core->realtime_scheduling, m->core->realtime_priority)))
+            goto fail;
+
+        pa_sink_set_render_pool(u->sink, u->render_pool);
+    }
+
     u->frame_size = frame_size;
+    u->mix_frame_size = pa_frame_size(&mix_ss);
     u->fragment_size = frag_size = (size_t) (period_frames * frame_size);
     u->hwbuf_size = buffer_size = (size_t) (buffer_frames * frame_size);
     pa_cvolume_mute(&u->hardware_volume, u->sink->sample_spec.channels);
@@ -2342,9 +3112,9 @@ pa_sink *pa_alsa_sink_new(pa_module *m, pa_modargs *ma, const char*driver, pa_ca
                 (long unsigned) u->hwbuf_size,
                 (double) pa_bytes_to_usec(u->hwbuf_size, &ss) / PA_USEC_PER_MSEC);
 
-    pa_sink_set_max_request(u->sink, u->hwbuf_size);
+    pa_sink_set_max_request(u->sink, hw_to_mix_bytes(u, u->hwbuf_size));
     if (pa_alsa_pcm_is_hw(u->pcm_handle))
-        pa_sink_set_max_rewind(u->sink, u->hwbuf_size);
+        pa_sink_set_max_rewind(u->sink, hw_to_mix_bytes(u, u->hwbuf_size));
     else {
         pa_log_info("Disabling rewind for device %s", u->device_name);
         pa_sink_set_max_rewind(u->sink, 0);
@@ -2369,6 +3139,11 @@ pa_sink *pa_alsa_sink_new(pa_module *m, pa_modargs *ma, const char*driver, pa_ca
 
     pa_alsa_dump(PA_LOG_DEBUG, u->pcm_handle);
 
+    if (split_channels > 0 && splits_init(u, driver, split_channels) < 0)
+        goto fail;
+
+    u->arena = pa_memarena_new(m->core->mempool, 8 * pa_mempool_block_size_max(m->core->mempool));
+
     thread_name = pa_sprintf_malloc("alsa-sink-%s", pa_strnull(pa_proplist_gets(u->sink->proplist, "alsa.id")));
     if (!(u->thread = pa_thread_new(thread_name, thread_func, u))) {
         pa_log("Failed to create thread.");
@@ -2414,6 +3189,9 @@ pa_sink *pa_alsa_sink_new(pa_module *m, pa_modargs *ma, const char*driver, pa_ca
 
     pa_sink_put(u->sink);
 
+    for (i = 0; i < u->n_splits; i++)
+        pa_sink_put(u->splits[i].sink);
+
     if (profile_set)
         pa_alsa_profile_set_free(profile_set);
 
@@ -2432,8 +3210,13 @@ fail:
 }
 
 static void userdata_free(struct userdata *u) {
+    unsigned i;
+
     pa_assert(u);
 
+    for (i = 0; i < u->n_splits; i++)
+        pa_sink_unlink(u->splits[i].sink);
+
     if (u->sink)
         pa_sink_unlink(u->sink);
 
@@ -2442,8 +3225,18 @@ static void userdata_free(struct userdata *u) {
         pa_thread_free(u->thread);
     }
 
+    if (u->render_pool)
+        pa_render_pool_free(u->render_pool);
+
+    if (u->arena)
+        pa_memarena_free(u->arena);
+
     pa_thread_mq_done(&u->thread_mq);
 
+    for (i = 0; i < u->n_splits; i++)
+        pa_sink_unref(u->splits[i].sink);
+    pa_xfree(u->splits);
+
     if (u->sink)
         pa_sink_unref(u->sink);
 
@@ -2464,6 +3257,9 @@ static void userdata_free(struct userdata *u) {
         snd_pcm_close(u->pcm_handle);
     }
 
+    if (u->idle_pcm_handle)
+        snd_pcm_close(u->idle_pcm_handle);
+
     if (u->mixer_fdl)
         pa_alsa_fdlist_free(u->mixer_fdl);
 
@@ -2476,6 +3272,9 @@ static void userdata_free(struct userdata *u) {
     if (u->smoother)
         pa_smoother_free(u->smoother);
 
+    if (u->status)
+        snd_pcm_status_free(u->status);
+
     if (u->formats)
         pa_idxset_free(u->formats, (pa_free_cb_t) pa_format_info_free);
 
@@ -2488,6 +3287,7 @@ static void userdata_free(struct userdata *u) {
     pa_xfree(u->device_name);
     pa_xfree(u->control_device);
     pa_xfree(u->paths_dir);
+    pa_xfree(u->cpu_affinity);
     pa_xfree(u);
 }
 
@@ -49,6 +49,7 @@
 #include <pulsecore/thread-mq.h>
 #include <pulsecore/rtpoll.h>
 #include <pulsecore/time-smoother.h>
+#include <pulsecore/trace.h>
 
 #include <modules/reserve-wrap.h>
 
@@ -67,6 +68,9 @@
 #define TSCHED_WATERMARK_VERIFY_AFTER_USEC (20*PA_USEC_PER_SEC)    /* 20s */
 #define TSCHED_WATERMARK_INC_THRESHOLD_USEC (0*PA_USEC_PER_MSEC)   /* 0ms */
 #define TSCHED_WATERMARK_DEC_THRESHOLD_USEC (100*PA_USEC_PER_MSEC) /* 100ms */
+#define TSCHED_WATERMARK_JITTER_VERIFY_AFTER_USEC (2*PA_USEC_PER_SEC) /* 2s */
+#define TSCHED_WATERMARK_JITTER_PERMILLE 990                       /* 99% */
+#define TSCHED_WATERMARK_JITTER_FACTOR 2                           /* 2x */
 #define TSCHED_WATERMARK_STEP_USEC (10*PA_USEC_PER_MSEC)           /* 10ms */
 
 #define TSCHED_MIN_SLEEP_USEC (10*PA_USEC_PER_MSEC)                /* 10ms */
@@ -78,6 +82,8 @@
 #define SMOOTHER_MIN_INTERVAL (2*PA_USEC_PER_MSEC)                 /* 2ms */
 #define SMOOTHER_MAX_INTERVAL (200*PA_USEC_PER_MSEC)               /* 200ms */
 
+#define STATUS_IOCTLS_INTERVAL_USEC (10*PA_USEC_PER_SEC)           /* 10s */
+
 #define VOLUME_ACCURACY (PA_VOLUME_NORM/100)
 
 struct userdata {
@@ -88,6 +94,7 @@ struct userdata {
     pa_thread *thread;
     pa_thread_mq thread_mq;
     pa_rtpoll *rtpoll;
+    char *cpu_affinity;
 
     snd_pcm_t *pcm_handle;
 
@@ -120,6 +127,9 @@ struct userdata {
     pa_usec_t min_latency_ref;
     pa_usec_t tsched_watermark_usec;
 
+    pa_alsa_jitter jitter;
+    size_t jitter_watermark;
+
     char *device_name;  /* name of the PCM device */
     char *control_device; /* name of the control device */
 
@@ -134,6 +144,16 @@ struct userdata {
     pa_usec_t smoother_interval;
     pa_usec_t last_smoother_update;
 
+    /* PCM status snapshot of the current IO thread iteration */
+    snd_pcm_status_t *status;
+    pa_bool_t status_valid;
+    snd_pcm_sframes_t status_delay;
+    uint64_t status_read_count;
+    pa_usec_t status_time;
+
+    unsigned status_ioctls;
+    pa_usec_t status_ioctls_since;
+
     pa_reserve_wrapper *reserve;
     pa_hook_slot *reserve_slot;
     pa_reserve_monitor_wrapper *monitor;
@@ -143,6 +163,11 @@ struct userdata {
     pa_alsa_ucm_mapping_context *ucm_context;
 };
 
+enum {
+    SOURCE_MESSAGE_UPDATE_JITTER = PA_SOURCE_MESSAGE_MAX,
+    SOURCE_MESSAGE_UPDATE_STATUS_IOCTLS
+};
+
 static void userdata_free(struct userdata *u);
 
 static pa_hook_result_t reserve_cb(pa_reserve_wrapper *r, void *forced, struct userdata *u) {
@@ -358,6 +383,9 @@ static void decrease_watermark(struct userdata *u) {
     else
         u->tsched_watermark = PA_MAX(u->tsched_watermark / 2, u->tsched_watermark - u->watermark_dec_step);
 
+    /* Never go below what the measured wakeup delays ask for */
+    u->tsched_watermark = PA_MAX(u->tsched_watermark, u->jitter_watermark);
+
     fix_tsched_watermark(u);
 
     if (old_watermark != u->tsched_watermark)
@@ -367,7 +395,39 @@ static void decrease_watermark(struct userdata *u) {
     /* We don't change the latency range*/
 
 restart:
-    u->watermark_dec_not_before = now + TSCHED_WATERMARK_VERIFY_AFTER_USEC;
+    u->watermark_dec_not_before = now + (u->jitter_watermark > 0 ?
+                                         TSCHED_WATERMARK_JITTER_VERIFY_AFTER_USEC :
+                                         TSCHED_WATERMARK_VERIFY_AFTER_USEC);
+}
+
+/* Called from IO context */
+static void update_jitter(struct userdata *u, pa_usec_t delay) {
+    pa_usec_t p;
+    size_t old_watermark;
+
+    pa_assert(u);
+    pa_assert(u->use_tsched);
+
+    if (pa_alsa_jitter_add(&u->jitter, delay))
+        pa_asyncmsgq_post(u->thread_mq.outq, PA_MSGOBJECT(u->source), SOURCE_MESSAGE_UPDATE_JITTER,
+                          pa_xnewdup(pa_alsa_jitter, &u->jitter, 1), 0, NULL, pa_xfree);
+
+    if ((p = pa_alsa_jitter_percentile(&u->jitter, TSCHED_WATERMARK_JITTER_PERMILLE)) <= 0)
+        return;
+
+    u->jitter_watermark = pa_usec_to_bytes(p * TSCHED_WATERMARK_JITTER_FACTOR, &u->source->sample_spec);
+
+    if (u->jitter_watermark <= u->tsched_watermark)
+        return;
+
+    old_watermark = u->tsched_watermark;
+    u->tsched_watermark = u->jitter_watermark;
+    fix_tsched_watermark(u);
+
+    if (old_watermark != u->tsched_watermark)
+        pa_log_info("Increasing wakeup watermark to %0.2f ms to cover wakeup delays of %0.2f ms",
+                    (double) u->tsched_watermark_usec / PA_USEC_PER_MSEC,
+                    (double) p / PA_USEC_PER_MSEC);
 }
 
 static void hw_sleep_time(struct userdata *u, pa_usec_t *sleep_usec, pa_usec_t*process_usec) {
@@ -409,8 +469,12 @@ static int try_recover(struct userdata *u, const char *call, int err) {
 
     pa_assert(err != -EAGAIN);
 
-    if (err == -EPIPE)
+    PA_TRACE2(alsa_source_xrun, u->source->index, err);
+
+    if (err == -EPIPE) {
         pa_log_debug("%s: Buffer overrun!", call);
+        u->source->thread_info.counters.xruns++;
+    }
 
     if (err == -ESTRPIPE)
         pa_log_debug("%s: System suspended!", call);
@@ -421,9 +485,48 @@ static int try_recover(struct userdata *u, const char *call, int err) {
     }
 
     u->first = TRUE;
+    u->status_valid = FALSE;
     return 0;
 }
 
+/* Called from IO context */
+static void count_status_ioctl(struct userdata *u) {
+    pa_usec_t now;
+
+    u->status_ioctls++;
+
+    now = pa_rtclock_now();
+
+    if (u->status_ioctls_since <= 0)
+        u->status_ioctls_since = now;
+    else if (now >= u->status_ioctls_since + STATUS_IOCTLS_INTERVAL_USEC) {
+        int64_t rate;
+
+        rate = (int64_t) (((uint64_t) u->status_ioctls * PA_USEC_PER_SEC) / (now - u->status_ioctls_since));
+        pa_asyncmsgq_post(u->thread_mq.outq, PA_MSGOBJECT(u->source), SOURCE_MESSAGE_UPDATE_STATUS_IOCTLS, NULL, rate, NULL, NULL);
+
+        u->status_ioctls = 0;
+        u->status_ioctls_since = now;
+    }
+}
+
+/* Called from IO context. Returns avail, or a negative error code. */
+static snd_pcm_sframes_t update_status(struct userdata *u) {
+    int err;
+
+    u->status_valid = FALSE;
+    count_status_ioctl(u);
+
+    if (PA_UNLIKELY((err = pa_alsa_safe_delay(u->pcm_handle, u->status, &u->status_delay, u->hwbuf_size, &u->source->sample_spec, TRUE)) < 0))
+        return err;
+
+    u->status_read_count = u->read_count;
+    u->status_time = pa_rtclock_now();
+    u->status_valid = TRUE;
+
+    return pa_alsa_safe_avail_update(u->pcm_handle, u->hwbuf_size, &u->source->sample_spec);
+}
+
 static size_t check_left_to_record(struct userdata *u, size_t n_bytes, pa_bool_t on_timeout) {
     size_t left_to_record;
     size_t rec_space = u->hwbuf_size - u->hwbuf_unused;
@@ -495,7 +598,12 @@ static int mmap_read(struct userdata *u, pa_usec_t *sleep_usec, pa_bool_t polled
         int r;
         pa_bool_t after_avail = TRUE;
 
-        if (PA_UNLIKELY((n = pa_alsa_safe_avail(u->pcm_handle, u->hwbuf_size, &u->source->sample_spec)) < 0)) {
+        if (j == 0)
+            n = update_status(u);
+        else
+            n = pa_alsa_safe_avail_update(u->pcm_handle, u->hwbuf_size, &u->source->sample_spec);
+
+        if (PA_UNLIKELY(n < 0)) {
 
             if ((r = try_recover(u, "snd_pcm_avail", (int) n)) == 0)
                 continue;
@@ -656,7 +764,12 @@ static int unix_read(struct userdata *u, pa_usec_t *sleep_usec, pa_bool_t polled
         int r;
         pa_bool_t after_avail = TRUE;
 
-        if (PA_UNLIKELY((n = pa_alsa_safe_avail(u->pcm_handle, u->hwbuf_size, &u->source->sample_spec)) < 0)) {
+        if (j == 0)
+            n = update_status(u);
+        else
+            n = pa_alsa_safe_avail_update(u->pcm_handle, u->hwbuf_size, &u->source->sample_spec);
+
+        if (PA_UNLIKELY(n < 0)) {
 
             if ((r = try_recover(u, "snd_pcm_avail", (int) n)) == 0)
                 continue;
@@ -773,34 +886,45 @@ static void update_smoother(struct userdata *u) {
     uint64_t position;
     int err;
     pa_usec_t now1 = 0, now2;
-    snd_pcm_status_t *status;
+    uint64_t read_count;
     snd_htimestamp_t htstamp = { 0, 0 };
 
-    snd_pcm_status_alloca(&status);
-
     pa_assert(u);
     pa_assert(u->pcm_handle);
 
     /* Let's update the time smoother */
 
-    if (PA_UNLIKELY((err = pa_alsa_safe_delay(u->pcm_handle, status, &delay, u->hwbuf_size, &u->source->sample_spec, TRUE)) < 0)) {
-        pa_log_warn("Failed to get delay: %s", pa_alsa_strerror(err));
-        return;
+    if (!u->status_valid) {
+        count_status_ioctl(u);
+
+        if (PA_UNLIKELY((err = pa_alsa_safe_delay(u->pcm_handle, u->status, &u->status_delay, u->hwbuf_size, &u->source->sample_spec, TRUE)) < 0)) {
+            pa_log_warn("Failed to get delay: %s", pa_alsa_strerror(err));
+            return;
+        }
+
+        u->status_read_count = u->read_count;
+        u->status_time = pa_rtclock_now();
     }
 
-    snd_pcm_status_get_htstamp(status, &htstamp);
+    u->status_valid = FALSE;
+
+    delay = u->status_delay;
+    read_count = u->status_read_count;
+
+    snd_pcm_status_get_htstamp(u->status, &htstamp);
     now1 = pa_timespec_load(&htstamp);
 
-    /* Hmm, if the timestamp is 0, then it wasn't set and we take the current time */
+    /* Hmm, if the timestamp is 0, then it wasn't set and we take the
+     * time the status was queried */
     if (now1 <= 0)
-        now1 = pa_rtclock_now();
+        now1 = u->status_time;
 
     /* check if the time since the last update is bigger than the interval */
     if (u->last_smoother_update > 0)
         if (u->last_smoother_update + u->smoother_interval > now1)
             return;
 
-    position = u->read_count + ((uint64_t) delay * (uint64_t) u->frame_size);
+    position = read_count + ((uint64_t) delay * (uint64_t) u->frame_size);
     now2 = pa_bytes_to_usec(position, &u->source->sample_spec);
 
     pa_smoother_put(u->smoother, now1, now2);
@@ -923,6 +1047,9 @@ static void reset_watermark(struct userdata *u, size_t tsched_watermark, pa_samp
     u->watermark_inc_threshold = pa_usec_to_bytes_round_up(TSCHED_WATERMARK_INC_THRESHOLD_USEC, &u->source->sample_spec);
     u->watermark_dec_threshold = pa_usec_to_bytes_round_up(TSCHED_WATERMARK_DEC_THRESHOLD_USEC, &u->source->sample_spec);
 
+    pa_alsa_jitter_reset(&u->jitter);
+    u->jitter_watermark = 0;
+
     fix_min_sleep_wakeup(u);
     fix_tsched_watermark(u);
 
@@ -1044,6 +1171,39 @@ static int source_process_msg(pa_msgobject *o, int code, void *data, int64_t off
             return 0;
         }
 
+        case SOURCE_MESSAGE_UPDATE_JITTER: {
+            pa_alsa_jitter *j = data;
+            pa_proplist *pl;
+            char *t;
+
+            /* Posted by the IO thread, handled in the main context */
+
+            pl = pa_proplist_new();
+
+            t = pa_alsa_jitter_to_string(j);
+            pa_proplist_sets(pl, "alsa.wakeup_jitter", t);
+            pa_xfree(t);
+
+            pa_proplist_setf(pl, "alsa.wakeup_jitter.p99_usec", "%llu",
+                             (unsigned long long) pa_alsa_jitter_percentile(j, 990));
+
+            pa_source_update_proplist(u->source, PA_UPDATE_REPLACE, pl);
+            pa_proplist_free(pl);
+
+            return 0;
+        }
+
+        case SOURCE_MESSAGE_UPDATE_STATUS_IOCTLS: {
+            pa_proplist *pl;
+
+            pl = pa_proplist_new();
+            pa_proplist_setf(pl, "alsa.status_ioctls_per_second", "%lli", (long long) offset);
+            pa_source_update_proplist(u->source, PA_UPDATE_REPLACE, pl);
+            pa_proplist_free(pl);
+
+            return 0;
+        }
+
         case PA_SOURCE_MESSAGE_SET_STATE:
 
             switch ((pa_source_state_t) PA_PTR_TO_UINT(data)) {
@@ -1446,7 +1606,10 @@ static void thread_func(void *userdata) {
     pa_log_debug("Thread starting up");
 
     if (u->core->realtime_scheduling)
-        pa_make_realtime(u->core->realtime_priority);
+        pa_source_make_realtime_within_thread(u->source, u->core->realtime_priority);
+
+    if (u->cpu_affinity)
+        pa_set_cpu_affinity(u->cpu_affinity);
 
     pa_thread_mq_install(&u->thread_mq);
 
@@ -1483,9 +1646,13 @@ static void thread_func(void *userdata) {
 
 /*             pa_log_debug("work_done = %i", work_done); */
 
-            if (work_done)
+            if (work_done) {
                 update_smoother(u);
 
+                /* Let the main thread read the latency without asking us */
+                pa_source_publish_latency(u->source, source_get_latency(u));
+            }
+
             if (u->use_tsched) {
                 pa_usec_t cusec;
 
@@ -1502,6 +1669,13 @@ static void thread_func(void *userdata) {
 
                 /* We don't trust the conversion, so we wake up whatever comes first */
                 rtpoll_sleep = PA_MIN(sleep_usec, cusec);
+
+                /* Join a wakeup of the other devices on this clock if
+                 * it is shortly before ours, reading a little less */
+                if (u->source->clock_domain) {
+                    pa_usec_t now = pa_rtclock_now();
+                    rtpoll_sleep = pa_source_align_wakeup_within_thread(u->source, now + rtpoll_sleep, rtpoll_sleep / 4) - now;
+                }
             }
         }
 
@@ -1528,7 +1702,7 @@ static void thread_func(void *userdata) {
             goto fail;
 
         if (rtpoll_sleep > 0) {
-            real_sleep = pa_rtclock_now() - real_sleep;
+            real_sleep = pa_rtpoll_now(u->rtpoll) - real_sleep;
 #ifdef DEBUG_TIMING
             pa_log_debug("Expected sleep: %0.2fms, real sleep: %0.2fms (diff %0.2f ms)",
                 (double) rtpoll_sleep / PA_USEC_PER_MSEC, (double) real_sleep / PA_USEC_PER_MSEC,
@@ -1538,6 +1712,9 @@ static void thread_func(void *userdata) {
                 pa_log_info("Scheduling delay of %0.2f ms > %0.2f ms, you might want to investigate this to improve latency...",
                     (double) (real_sleep - rtpoll_sleep) / PA_USEC_PER_MSEC,
                     (double) (u->tsched_watermark_usec) / PA_USEC_PER_MSEC);
+
+            if (u->use_tsched && real_sleep >= rtpoll_sleep)
+                update_jitter(u, real_sleep - rtpoll_sleep);
         }
 
         if (u->source->flags & PA_SOURCE_DEFERRED_VOLUME)
@@ -1730,7 +1907,7 @@ static int setup_mixer(struct userdata *u, pa_bool_t ignore_dB) {
 pa_source *pa_alsa_source_new(pa_module *m, pa_modargs *ma, const char*driver, pa_card *card, pa_alsa_mapping *mapping) {
 
     struct userdata *u = NULL;
-    const char *dev_id = NULL, *key, *mod_name;
+    const char *dev_id = NULL, *key, *mod_name, *card_index;
     pa_sample_spec ss;
     char *thread_name = NULL;
     uint32_t alternate_sample_rate;
@@ -1821,6 +1998,11 @@ pa_source *pa_alsa_source_new(pa_module *m, pa_modargs *ma, const char*driver, p
     u->rtpoll = pa_rtpoll_new();
     pa_thread_mq_init(&u->thread_mq, m->core->mainloop, u->rtpoll);
 
+    if (pa_modargs_get_cpu_affinity(ma, m->core->default_cpu_affinity, &u->cpu_affinity) < 0) {
+        pa_log("Failed to parse cpu_affinity or numa_node argument.");
+        goto fail;
+    }
+
     u->smoother = pa_smoother_new(
             SMOOTHER_ADJUST_USEC,
             SMOOTHER_WINDOW_USEC,
@@ -1831,6 +2013,8 @@ pa_source *pa_alsa_source_new(pa_module *m, pa_modargs *ma, const char*driver, p
             TRUE);
     u->smoother_interval = SMOOTHER_MIN_INTERVAL;
 
+    pa_assert_se(snd_pcm_status_malloc(&u->status) >= 0);
+
     /* use ucm */
     if (mapping && mapping->ucm_context.ucm)
         u->ucm_context = &mapping->ucm_context;
@@ -1978,6 +2162,14 @@ pa_source *pa_alsa_source_new(pa_module *m, pa_modargs *ma, const char*driver, p
     }
 
     pa_alsa_init_description(data.proplist);
+    pa_source_new_data_set_cpu_affinity(&data, u->cpu_affinity);
+
+    /* All devices of a sound card run from its clock */
+    if (u->use_tsched && (card_index = pa_proplist_gets(data.proplist, "alsa.card"))) {
+        char *clock_domain = pa_sprintf_malloc("alsa-card-%s", card_index);
+        pa_source_new_data_set_clock_domain(&data, clock_domain);
+        pa_xfree(clock_domain);
+    }
 
     if (u->control_device)
         pa_alsa_init_proplist_ctl(data.proplist, u->control_device);
@@ -2149,6 +2341,9 @@ static void userdata_free(struct userdata *u) {
     if (u->smoother)
         pa_smoother_free(u->smoother);
 
+    if (u->status)
+        snd_pcm_status_free(u->status);
+
     if (u->rates)
         pa_xfree(u->rates);
 
@@ -2158,6 +2353,7 @@ static void userdata_free(struct userdata *u) {
     pa_xfree(u->device_name);
     pa_xfree(u->control_device);
     pa_xfree(u->paths_dir);
+    pa_xfree(u->cpu_affinity);
     pa_xfree(u);
 }
 
@@ -734,7 +734,7 @@ static int ucm_port_contains(const char *port_name, const char *dev_name, bool i
     port_name += is_sink ? strlen(PA_UCM_PRE_TAG_OUTPUT) : strlen(PA_UCM_PRE_TAG_INPUT);
 
     while ((r = pa_split_in_place(port_name, "+", &len, &state))) {
-        if (!strncmp(r, dev_name, len)) {
+        if (!strncmp(r, dev_name, len) && dev_name[len] == 0) {
             ret = 1;
             break;
         }
@@ -935,6 +935,14 @@ int pa_alsa_ucm_set_profile(pa_alsa_ucm_config *ucm, const char *new_profile, co
     else
         return ret;
 
+    /* Changing the verb disables all devices of the old one */
+    if (ucm->active_verb) {
+        pa_alsa_ucm_device *d;
+
+        PA_LLIST_FOREACH(d, ucm->active_verb->devices)
+            d->enabled = false;
+    }
+
     /* change verb */
     pa_log_info("Set UCM verb to %s", profile);
     if ((snd_use_case_set(ucm->ucm_mgr, "_verb", profile)) < 0) {
@@ -957,11 +965,8 @@ int pa_alsa_ucm_set_profile(pa_alsa_ucm_config *ucm, const char *new_profile, co
 }
 
 int pa_alsa_ucm_set_port(pa_alsa_ucm_mapping_context *context, pa_device_port *port, bool is_sink) {
-    int i;
     int ret = 0;
     pa_alsa_ucm_config *ucm;
-    const char **enable_devs;
-    int enable_num = 0;
     uint32_t idx;
     pa_alsa_ucm_device *dev;
 
@@ -970,34 +975,38 @@ int pa_alsa_ucm_set_port(pa_alsa_ucm_mapping_context *context, pa_device_port *p
     ucm = context->ucm;
     pa_assert(ucm->ucm_mgr);
 
-    enable_devs = pa_xnew(const char *, pa_idxset_size(context->ucm_devices));
-
-    /* first disable then enable */
+    /* Only touch the devices whose state changes, first disable then
+     * enable */
     PA_IDXSET_FOREACH(dev, context->ucm_devices, idx) {
         const char *dev_name = pa_proplist_gets(dev->proplist, PA_ALSA_PROP_UCM_NAME);
 
-        if (ucm_port_contains(port->name, dev_name, is_sink))
-            enable_devs[enable_num++] = dev_name;
-        else {
-            pa_log_debug("Disable ucm device %s", dev_name);
-            if (snd_use_case_set(ucm->ucm_mgr, "_disdev", dev_name) > 0) {
-                pa_log("Failed to disable ucm device %s", dev_name);
-                ret = -1;
-                break;
-            }
+        if (!dev->enabled || ucm_port_contains(port->name, dev_name, is_sink))
+            continue;
+
+        pa_log_debug("Disable ucm device %s", dev_name);
+        if (snd_use_case_set(ucm->ucm_mgr, "_disdev", dev_name) < 0) {
+            pa_log("Failed to disable ucm device %s", dev_name);
+            return -1;
         }
+
+        dev->enabled = false;
     }
 
-    for (i = 0; i < enable_num; i++) {
-        pa_log_debug("Enable ucm device %s", enable_devs[i]);
-        if (snd_use_case_set(ucm->ucm_mgr, "_enadev", enable_devs[i]) < 0) {
-            pa_log("Failed to enable ucm device %s", enable_devs[i]);
+    PA_IDXSET_FOREACH(dev, context->ucm_devices, idx) {
+        const char *dev_name = pa_proplist_gets(dev->proplist, PA_ALSA_PROP_UCM_NAME);
+
+        if (dev->enabled || !ucm_port_contains(port->name, dev_name, is_sink))
+            continue;
+
+        pa_log_debug("Enable ucm device %s", dev_name);
+        if (snd_use_case_set(ucm->ucm_mgr, "_enadev", dev_name) < 0) {
+            pa_log("Failed to enable ucm device %s", dev_name);
             ret = -1;
             break;
         }
-    }
 
-    pa_xfree(enable_devs);
+        dev->enabled = true;
+    }
 
     return ret;
 }
@@ -130,6 +130,10 @@ struct pa_alsa_ucm_device {
 
     pa_alsa_jack *input_jack;
     pa_alsa_jack *output_jack;
+
+    /* Whether the device is enabled in the active verb, so that port
+     * switches only run the sequences of the devices that change */
+    bool enabled;
 };
 
 struct pa_alsa_ucm_modifier {
@@ -42,6 +42,7 @@
 #include <pulsecore/thread.h>
 #include <pulsecore/conf-parser.h>
 #include <pulsecore/core-rtclock.h>
+#include <pulsecore/strbuf.h>
 
 #include "alsa-util.h"
 #include "alsa-mixer.h"
@@ -392,8 +393,9 @@ success:
     if (_use_tsched) {
         unsigned int no_wakeup;
         /* see if period wakeups were disabled */
-        snd_pcm_hw_params_get_period_wakeup(pcm_handle, hwparams, &no_wakeup);
-        if (no_wakeup == 0)
+        if (snd_pcm_hw_params_get_period_wakeup(pcm_handle, hwparams, &no_wakeup) < 0)
+            pa_log_info("Cannot determine whether ALSA period wakeups are disabled");
+        else if (no_wakeup == 0)
             pa_log_info("ALSA period wakeups disabled");
         else
             pa_log_info("ALSA period wakeups were not disabled");
@@ -986,6 +988,16 @@ void pa_alsa_init_proplist_pcm(pa_core *c, pa_proplist *p, snd_pcm_t *pcm) {
 
         if ((bits = snd_pcm_hw_params_get_sbits(hwparams)) >= 0)
             pa_proplist_setf(p, "alsa.resolution_bits", "%i", bits);
+
+#if (SND_LIB_VERSION >= ((1<<16)|(0<<8)|24)) /* API additions in 1.0.24 */
+        {
+            unsigned int wakeup;
+
+            /* Tells whether we are woken up by the timer only */
+            if (snd_pcm_hw_params_get_period_wakeup(pcm, hwparams, &wakeup) >= 0)
+                pa_proplist_sets(p, "alsa.period_wakeups", pa_yes_no(wakeup));
+        }
+#endif
     }
 
     if ((err = snd_pcm_info(pcm, info)) < 0)
@@ -1102,19 +1114,12 @@ pa_rtpoll_item* pa_alsa_build_pollfd(snd_pcm_t *pcm, pa_rtpoll *rtpoll) {
     return item;
 }
 
-snd_pcm_sframes_t pa_alsa_safe_avail(snd_pcm_t *pcm, size_t hwbuf_size, const pa_sample_spec *ss) {
-    snd_pcm_sframes_t n;
+static snd_pcm_sframes_t check_avail(snd_pcm_t *pcm, snd_pcm_sframes_t n, size_t hwbuf_size, const pa_sample_spec *ss) {
     size_t k;
 
-    pa_assert(pcm);
-    pa_assert(hwbuf_size > 0);
-    pa_assert(ss);
-
     /* Some ALSA driver expose weird bugs, let's inform the user about
      * what is going on */
 
-    n = snd_pcm_avail(pcm);
-
     if (n <= 0)
         return n;
 
@@ -1141,6 +1146,25 @@ snd_pcm_sframes_t pa_alsa_safe_avail(snd_pcm_t *pcm, size_t hwbuf_size, const pa
     return n;
 }
 
+snd_pcm_sframes_t pa_alsa_safe_avail(snd_pcm_t *pcm, size_t hwbuf_size, const pa_sample_spec *ss) {
+    pa_assert(pcm);
+    pa_assert(hwbuf_size > 0);
+    pa_assert(ss);
+
+    return check_avail(pcm, snd_pcm_avail(pcm), hwbuf_size, ss);
+}
+
+/* Like pa_alsa_safe_avail(), but doesn't synchronize with the hardware,
+ * i.e. relies on the position the last snd_pcm_status() or
+ * snd_pcm_avail() call determined. Usually no syscall at all. */
+snd_pcm_sframes_t pa_alsa_safe_avail_update(snd_pcm_t *pcm, size_t hwbuf_size, const pa_sample_spec *ss) {
+    pa_assert(pcm);
+    pa_assert(hwbuf_size > 0);
+    pa_assert(ss);
+
+    return check_avail(pcm, snd_pcm_avail_update(pcm), hwbuf_size, ss);
+}
+
 int pa_alsa_safe_delay(snd_pcm_t *pcm, snd_pcm_status_t *status, snd_pcm_sframes_t *delay, size_t hwbuf_size, const pa_sample_spec *ss,
                        pa_bool_t capture) {
     ssize_t k;
@@ -1640,3 +1664,79 @@ int pa_alsa_get_hdmi_eld(snd_hctl_t *hctl, int device, pa_hdmi_eld *eld) {
 
     return 0;
 }
+
+#define JITTER_MIN_USEC 125
+#define JITTER_MIN_SAMPLES 64
+#define JITTER_DECAY_SAMPLES 1024
+
+static pa_usec_t jitter_bucket_limit(unsigned i) {
+    return (pa_usec_t) JITTER_MIN_USEC << i;
+}
+
+void pa_alsa_jitter_reset(pa_alsa_jitter *j) {
+    pa_assert(j);
+
+    memset(j, 0, sizeof(*j));
+}
+
+pa_bool_t pa_alsa_jitter_add(pa_alsa_jitter *j, pa_usec_t delay) {
+    unsigned i;
+
+    pa_assert(j);
+
+    for (i = 0; i < PA_ALSA_JITTER_BUCKETS - 1; i++)
+        if (delay < jitter_bucket_limit(i))
+            break;
+
+    j->buckets[i]++;
+
+    if (++j->n < JITTER_DECAY_SAMPLES)
+        return FALSE;
+
+    /* Halve everything so that old samples fade out and the histogram
+     * follows changes in system load */
+    j->n = 0;
+    for (i = 0; i < PA_ALSA_JITTER_BUCKETS; i++) {
+        j->buckets[i] /= 2;
+        j->n += j->buckets[i];
+    }
+
+    return TRUE;
+}
+
+pa_usec_t pa_alsa_jitter_percentile(const pa_alsa_jitter *j, unsigned permille) {
+    unsigned i, sum = 0, wanted;
+
+    pa_assert(j);
+    pa_assert(permille <= 1000);
+
+    if (j->n < JITTER_MIN_SAMPLES)
+        return 0;
+
+    wanted = (unsigned) (((uint64_t) j->n * permille + 999) / 1000);
+
+    for (i = 0; i < PA_ALSA_JITTER_BUCKETS - 1; i++)
+        if ((sum += j->buckets[i]) >= wanted)
+            break;
+
+    /* We only know the bucket, hence report its upper limit */
+    return jitter_bucket_limit(i);
+}
+
+char *pa_alsa_jitter_to_string(const pa_alsa_jitter *j) {
+    pa_strbuf *buf;
+    unsigned i;
+
+    pa_assert(j);
+
+    buf = pa_strbuf_new();
+
+    for (i = 0; i < PA_ALSA_JITTER_BUCKETS; i++)
+        pa_strbuf_printf(buf, "%s%s%llu:%u",
+                         i > 0 ? " " : "",
+                         i < PA_ALSA_JITTER_BUCKETS - 1 ? "<" : ">=",
+                         (unsigned long long) jitter_bucket_limit(i < PA_ALSA_JITTER_BUCKETS - 1 ? i : i - 1),
+                         j->buckets[i]);
+
+    return pa_strbuf_tostring_free(buf);
+}
@@ -125,6 +125,7 @@ int pa_alsa_recover_from_poll(snd_pcm_t *pcm, int revents);
 pa_rtpoll_item* pa_alsa_build_pollfd(snd_pcm_t *pcm, pa_rtpoll *rtpoll);
 
 snd_pcm_sframes_t pa_alsa_safe_avail(snd_pcm_t *pcm, size_t hwbuf_size, const pa_sample_spec *ss);
+snd_pcm_sframes_t pa_alsa_safe_avail_update(snd_pcm_t *pcm, size_t hwbuf_size, const pa_sample_spec *ss);
 int pa_alsa_safe_delay(snd_pcm_t *pcm, snd_pcm_status_t *status, snd_pcm_sframes_t *delay, size_t hwbuf_size, const pa_sample_spec *ss, pa_bool_t capture);
 int pa_alsa_safe_mmap_begin(snd_pcm_t *pcm, const snd_pcm_channel_area_t **areas, snd_pcm_uframes_t *offset, snd_pcm_uframes_t *frames, size_t hwbuf_size, const pa_sample_spec *ss);
 
@@ -154,4 +155,26 @@ struct pa_hdmi_eld {
 
 int pa_alsa_get_hdmi_eld(snd_hctl_t *hctl, int device, pa_hdmi_eld *eld);
 
+/* Histogram of how late the IO thread wakes up after its timer
+ * expired. Bucket 0 counts delays below 125us, each further bucket
+ * doubles the limit and the last one takes everything beyond. */
+#define PA_ALSA_JITTER_BUCKETS 16
+
+typedef struct pa_alsa_jitter pa_alsa_jitter;
+struct pa_alsa_jitter {
+    unsigned buckets[PA_ALSA_JITTER_BUCKETS];
+    unsigned n;
+};
+
+void pa_alsa_jitter_reset(pa_alsa_jitter *j);
+
+/* Returns TRUE whenever the histogram has been aged, which happens
+ * every few hundred samples and is a good time to publish it */
+pa_bool_t pa_alsa_jitter_add(pa_alsa_jitter *j, pa_usec_t delay);
+
+/* Returns 0 as long as there are too few samples to tell */
+pa_usec_t pa_alsa_jitter_percentile(const pa_alsa_jitter *j, unsigned permille);
+
+char *pa_alsa_jitter_to_string(const pa_alsa_jitter *j);
+
 #endif
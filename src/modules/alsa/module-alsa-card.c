@@ -71,6 +71,15 @@ PA_MODULE_USAGE(
         "profile_set=<profile set configuration file> "
         "paths_dir=<directory containing the path configuration files> "
         "use_ucm=<load use case manager> "
+        "probe_cache=<remember which profiles the card supports?> "
+        "reprobe=<ignore the remembered profiles and probe again?> "
+        "render_threads=<number of extra threads to peek the sink inputs in parallel on> "
+        "split_channels=<expose every group of this many channels of a sink as a sink of its own> "
+        "soft_suspend=<keep the sink devices open and configured while suspended for idleness?> "
+        "float_mixing=<mix in float on sinks and convert only the final mix to the device format?> "
+        "dither=<add dither when converting the float mix to 16 bits or less?> "
+        "cpu_affinity=<CPUs to run the IO threads on> "
+        "numa_node=<NUMA node to run the IO threads on> "
 );
 
 static const char* const valid_modargs[] = {
@@ -98,6 +107,15 @@ static const char* const valid_modargs[] = {
     "profile_set",
     "paths_dir",
     "use_ucm",
+    "probe_cache",
+    "reprobe",
+    "render_threads",
+    "split_channels",
+    "soft_suspend",
+    "float_mixing",
+    "dither",
+    "cpu_affinity",
+    "numa_node",
     NULL
 };
 
@@ -604,7 +622,7 @@ static pa_hook_result_t source_output_unlink_hook_callback(pa_core *c, pa_source
 int pa__init(pa_module *m) {
     pa_card_new_data data;
     pa_modargs *ma;
-    pa_bool_t ignore_dB = FALSE;
+    pa_bool_t ignore_dB = FALSE, probe_cache = TRUE, reprobe = FALSE;
     struct userdata *u;
     pa_reserve_wrapper *reserve = NULL;
     const char *description;
@@ -626,6 +644,12 @@ int pa__init(pa_module *m) {
         goto fail;
     }
 
+    if (pa_modargs_get_value_boolean(ma, "probe_cache", &probe_cache) < 0 ||
+        pa_modargs_get_value_boolean(ma, "reprobe", &reprobe) < 0) {
+        pa_log("Failed to parse probe_cache or reprobe argument.");
+        goto fail;
+    }
+
     m->userdata = u = pa_xnew0(struct userdata, 1);
     u->core = m->core;
     u->module = m;
@@ -683,7 +707,9 @@ int pa__init(pa_module *m) {
             fn = pa_xstrdup(pa_modargs_get_value(ma, "profile_set", NULL));
         }
 
-        u->profile_set = pa_alsa_profile_set_new(fn, &u->core->default_channel_map);
+        /* module-udev-detect may have probed the card for us already */
+        if (!(u->profile_set = pa_alsa_profile_set_unstash(m->core, u->device_id, fn, ignore_dB)))
+            u->profile_set = pa_alsa_profile_set_new(fn, &u->core->default_channel_map);
         pa_xfree(fn);
     }
 
@@ -692,6 +718,10 @@ int pa__init(pa_module *m) {
 
     u->profile_set->ignore_dB = ignore_dB;
 
+    /* UCM profiles are not probed by opening PCMs */
+    u->profile_set->probe_cache = probe_cache && !u->use_ucm;
+    u->profile_set->reprobe = reprobe;
+
     pa_alsa_profile_set_probe(u->profile_set, u->device_id, &m->core->default_sample_spec, m->core->default_n_fragments, m->core->default_fragment_size_msec);
     pa_alsa_profile_set_dump(u->profile_set);
 
@@ -60,7 +60,14 @@ PA_MODULE_USAGE(
         "deferred_volume=<Synchronize software and hardware volume changes to avoid momentary jumps?> "
         "deferred_volume_safety_margin=<usec adjustment depending on volume direction> "
         "deferred_volume_extra_delay=<usec adjustment to HW volume changes> "
-        "fixed_latency_range=<disable latency range changes on underrun?>");
+        "fixed_latency_range=<disable latency range changes on underrun?> "
+        "render_threads=<number of extra threads to peek the inputs in parallel on> "
+        "split_channels=<expose every group of this many channels as a sink of its own> "
+        "soft_suspend=<keep the device open and configured while suspended for idleness?> "
+        "float_mixing=<mix in float and convert only the final mix to the device format?> "
+        "dither=<add dither when converting the float mix to 16 bits or less?> "
+        "cpu_affinity=<CPUs to run the IO thread on> "
+        "numa_node=<NUMA node to run the IO thread on>");
 
 static const char* const valid_modargs[] = {
     "name",
@@ -87,6 +94,13 @@ static const char* const valid_modargs[] = {
     "deferred_volume_safety_margin",
     "deferred_volume_extra_delay",
     "fixed_latency_range",
+    "render_threads",
+    "split_channels",
+    "soft_suspend",
+    "float_mixing",
+    "dither",
+    "cpu_affinity",
+    "numa_node",
     NULL
 };
 
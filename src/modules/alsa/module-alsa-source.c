@@ -68,7 +68,9 @@ PA_MODULE_USAGE(
         "deferred_volume=<Synchronize software and hardware volume changes to avoid momentary jumps?> "
         "deferred_volume_safety_margin=<usec adjustment depending on volume direction> "
         "deferred_volume_extra_delay=<usec adjustment to HW volume changes> "
-        "fixed_latency_range=<disable latency range changes on overrun?>");
+        "fixed_latency_range=<disable latency range changes on overrun?> "
+        "cpu_affinity=<CPUs to run the IO thread on> "
+        "numa_node=<NUMA node to run the IO thread on>");
 
 static const char* const valid_modargs[] = {
     "name",
@@ -94,6 +96,8 @@ static const char* const valid_modargs[] = {
     "deferred_volume_safety_margin",
     "deferred_volume_extra_delay",
     "fixed_latency_range",
+    "cpu_affinity",
+    "numa_node",
     NULL
 };
 
@@ -26,6 +26,7 @@
 #include <pulse/xmalloc.h>
 
 #include <pulsecore/core-util.h>
+#include <pulsecore/endianmacros.h>
 #include <pulsecore/shared.h>
 #include <pulsecore/dbus-shared.h>
 
@@ -36,6 +37,7 @@
 #define HFP_HS_ENDPOINT "/MediaEndpoint/HFPHS"
 #define A2DP_SOURCE_ENDPOINT "/MediaEndpoint/A2DPSource"
 #define A2DP_SINK_ENDPOINT "/MediaEndpoint/A2DPSink"
+#define A2DP_SOURCE_APTX_ENDPOINT "/MediaEndpoint/A2DPSourceAptX"
 
 #define ENDPOINT_INTROSPECT_XML                                         \
     DBUS_INTROSPECT_1_0_XML_DOCTYPE_DECL_NODE                           \
@@ -867,6 +869,9 @@ static void register_endpoint(pa_bluetooth_discovery *y, const char *path, const
     uint8_t codec = 0;
     const char *interface = y->version == BLUEZ_VERSION_4 ? "org.bluez.Media" : "org.bluez.Media1";
 
+    if (pa_streq(endpoint, A2DP_SOURCE_APTX_ENDPOINT))
+        codec = A2DP_CODEC_VENDOR;
+
     pa_log_debug("Registering %s on adapter %s.", endpoint, path);
 
     pa_assert_se(m = dbus_message_new_method_call("org.bluez", path, interface, "RegisterEndpoint"));
@@ -886,6 +891,16 @@ static void register_endpoint(pa_bluetooth_discovery *y, const char *path, const
     if (pa_streq(uuid, HFP_AG_UUID) || pa_streq(uuid, HFP_HS_UUID)) {
         uint8_t capability = 0;
         pa_dbus_append_basic_array_variant_dict_entry(&d, "Capabilities", DBUS_TYPE_BYTE, &capability, 1);
+    } else if (pa_streq(endpoint, A2DP_SOURCE_APTX_ENDPOINT)) {
+        a2dp_aptx_t capabilities;
+
+        capabilities.info.vendor_id = PA_UINT32_TO_LE(APTX_VENDOR_ID);
+        capabilities.info.codec_id = PA_UINT16_TO_LE(APTX_CODEC_ID);
+        capabilities.channel_mode = APTX_CHANNEL_MODE_STEREO;
+        capabilities.frequency = APTX_SAMPLING_FREQ_16000 | APTX_SAMPLING_FREQ_32000 |
+                                 APTX_SAMPLING_FREQ_44100 | APTX_SAMPLING_FREQ_48000;
+
+        pa_dbus_append_basic_array_variant_dict_entry(&d, "Capabilities", DBUS_TYPE_BYTE, &capabilities, sizeof(capabilities));
     } else {
         a2dp_sbc_t capabilities;
 
@@ -909,6 +924,10 @@ static void register_endpoint(pa_bluetooth_discovery *y, const char *path, const
 }
 
 static void register_adapter_endpoints(pa_bluetooth_discovery *y, const char *path) {
+#ifdef HAVE_OPENAPTX
+    /* First, so that BlueZ prefers it where the headset supports it */
+    register_endpoint(y, path, A2DP_SOURCE_APTX_ENDPOINT, A2DP_SOURCE_UUID);
+#endif
     register_endpoint(y, path, A2DP_SOURCE_ENDPOINT, A2DP_SOURCE_UUID);
     register_endpoint(y, path, A2DP_SINK_ENDPOINT, A2DP_SINK_UUID);
 
@@ -1611,7 +1630,7 @@ static int setup_dbus(pa_bluetooth_discovery *y) {
 }
 
 static pa_bluetooth_transport *transport_new(pa_bluetooth_device *d, const char *owner, const char *path, enum profile p,
-                                             const uint8_t *config, int size) {
+                                             uint8_t codec, const uint8_t *config, int size) {
     pa_bluetooth_transport *t;
 
     t = pa_xnew0(pa_bluetooth_transport, 1);
@@ -1619,6 +1638,7 @@ static pa_bluetooth_transport *transport_new(pa_bluetooth_device *d, const char
     t->owner = pa_xstrdup(owner);
     t->path = pa_xstrdup(path);
     t->profile = p;
+    t->codec = codec;
     t->config_size = size;
 
     if (size > 0) {
@@ -1641,6 +1661,7 @@ static DBusMessage *endpoint_set_configuration(DBusConnection *conn, DBusMessage
     const char *sender, *path, *dev_path = NULL, *uuid = NULL;
     uint8_t *config = NULL;
     int size = 0;
+    uint8_t codec = 0;
     bool nrec = false;
     enum profile p;
     DBusMessageIter args, props;
@@ -1696,6 +1717,11 @@ static DBusMessage *endpoint_set_configuration(DBusConnection *conn, DBusMessage
 
             dbus_message_iter_get_basic(&value, &tmp_boolean);
             nrec = tmp_boolean;
+        } else if (strcasecmp(key, "Codec") == 0) {
+            if (var != DBUS_TYPE_BYTE)
+                goto fail;
+
+            dbus_message_iter_get_basic(&value, &codec);
         } else if (strcasecmp(key, "Configuration") == 0) {
             DBusMessageIter array;
             if (var != DBUS_TYPE_ARRAY)
@@ -1718,7 +1744,10 @@ static DBusMessage *endpoint_set_configuration(DBusConnection *conn, DBusMessage
         p = PROFILE_HFGW;
     else if (dbus_message_has_path(m, A2DP_SOURCE_ENDPOINT))
         p = PROFILE_A2DP;
-    else
+    else if (dbus_message_has_path(m, A2DP_SOURCE_APTX_ENDPOINT)) {
+        p = PROFILE_A2DP;
+        codec = A2DP_CODEC_VENDOR;
+    } else
         p = PROFILE_A2DP_SOURCE;
 
     if (d->transports[p] != NULL) {
@@ -1730,7 +1759,7 @@ static DBusMessage *endpoint_set_configuration(DBusConnection *conn, DBusMessage
 
     sender = dbus_message_get_sender(m);
 
-    t = transport_new(d, sender, path, p, config, size);
+    t = transport_new(d, sender, path, p, codec, config, size);
     if (nrec)
         t->nrec = nrec;
 
@@ -1840,6 +1869,59 @@ static uint8_t a2dp_default_bitpool(uint8_t freq, uint8_t mode) {
     }
 }
 
+static DBusMessage *select_aptx_configuration(pa_bluetooth_discovery *y, DBusMessage *m, const a2dp_aptx_t *cap, int size) {
+    a2dp_aptx_t config;
+    uint8_t *pconf = (uint8_t *) &config;
+    DBusMessage *r;
+    unsigned i;
+
+    static const struct {
+        uint32_t rate;
+        uint8_t cap;
+    } freq_table[] = {
+        { 16000U, APTX_SAMPLING_FREQ_16000 },
+        { 32000U, APTX_SAMPLING_FREQ_32000 },
+        { 44100U, APTX_SAMPLING_FREQ_44100 },
+        { 48000U, APTX_SAMPLING_FREQ_48000 }
+    };
+
+    if (size != sizeof(config) ||
+        PA_UINT32_FROM_LE(cap->info.vendor_id) != APTX_VENDOR_ID ||
+        PA_UINT16_FROM_LE(cap->info.codec_id) != APTX_CODEC_ID ||
+        !(cap->channel_mode & APTX_CHANNEL_MODE_STEREO)) {
+        pa_log("Can't use these aptX capabilities");
+        goto fail;
+    }
+
+    memset(&config, 0, sizeof(config));
+    config.info = cap->info;
+    config.channel_mode = APTX_CHANNEL_MODE_STEREO;
+
+    /* Same as for SBC: the lowest rate at least as high as ours, or else
+     * the highest one */
+    for (i = 0; i < PA_ELEMENTSOF(freq_table); i++)
+        if (cap->frequency & freq_table[i].cap) {
+            config.frequency = freq_table[i].cap;
+
+            if (freq_table[i].rate >= y->core->default_sample_spec.rate)
+                break;
+        }
+
+    if (!config.frequency) {
+        pa_log("Not suitable sample rate");
+        goto fail;
+    }
+
+    pa_assert_se(r = dbus_message_new_method_return(m));
+    pa_assert_se(dbus_message_append_args(r, DBUS_TYPE_ARRAY, DBUS_TYPE_BYTE, &pconf, size, DBUS_TYPE_INVALID));
+
+    return r;
+
+fail:
+    pa_assert_se(r = dbus_message_new_error(m, "org.bluez.Error.InvalidArguments", "Unable to select configuration"));
+    return r;
+}
+
 static DBusMessage *endpoint_select_configuration(DBusConnection *c, DBusMessage *m, void *userdata) {
     pa_bluetooth_discovery *y = userdata;
     a2dp_sbc_t *cap, config;
@@ -1869,6 +1951,9 @@ static DBusMessage *endpoint_select_configuration(DBusConnection *c, DBusMessage
     if (dbus_message_has_path(m, HFP_AG_ENDPOINT) || dbus_message_has_path(m, HFP_HS_ENDPOINT))
         goto done;
 
+    if (dbus_message_has_path(m, A2DP_SOURCE_APTX_ENDPOINT))
+        return select_aptx_configuration(y, m, (a2dp_aptx_t *) cap, size);
+
     pa_assert(size == sizeof(config));
 
     memset(&config, 0, sizeof(config));
@@ -1979,7 +2064,7 @@ static DBusHandlerResult endpoint_handler(DBusConnection *c, DBusMessage *m, voi
     dbus_error_init(&e);
 
     if (!pa_streq(path, A2DP_SOURCE_ENDPOINT) && !pa_streq(path, A2DP_SINK_ENDPOINT) && !pa_streq(path, HFP_AG_ENDPOINT) &&
-        !pa_streq(path, HFP_HS_ENDPOINT))
+        !pa_streq(path, HFP_HS_ENDPOINT) && !pa_streq(path, A2DP_SOURCE_APTX_ENDPOINT))
         return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
 
     interface = y->version == BLUEZ_VERSION_4 ? "org.bluez.MediaEndpoint" : "org.bluez.MediaEndpoint1";
@@ -2077,6 +2162,9 @@ pa_bluetooth_discovery* pa_bluetooth_discovery_get(pa_core *c) {
     pa_assert_se(dbus_connection_register_object_path(conn, HFP_HS_ENDPOINT, &vtable_endpoint, y));
     pa_assert_se(dbus_connection_register_object_path(conn, A2DP_SOURCE_ENDPOINT, &vtable_endpoint, y));
     pa_assert_se(dbus_connection_register_object_path(conn, A2DP_SINK_ENDPOINT, &vtable_endpoint, y));
+#ifdef HAVE_OPENAPTX
+    pa_assert_se(dbus_connection_register_object_path(conn, A2DP_SOURCE_APTX_ENDPOINT, &vtable_endpoint, y));
+#endif
 
     init_bluez(y);
 
@@ -2126,6 +2214,9 @@ void pa_bluetooth_discovery_unref(pa_bluetooth_discovery *y) {
         dbus_connection_unregister_object_path(pa_dbus_connection_get(y->connection), HFP_HS_ENDPOINT);
         dbus_connection_unregister_object_path(pa_dbus_connection_get(y->connection), A2DP_SOURCE_ENDPOINT);
         dbus_connection_unregister_object_path(pa_dbus_connection_get(y->connection), A2DP_SINK_ENDPOINT);
+#ifdef HAVE_OPENAPTX
+        dbus_connection_unregister_object_path(pa_dbus_connection_get(y->connection), A2DP_SOURCE_APTX_ENDPOINT);
+#endif
         pa_dbus_remove_matches(
             pa_dbus_connection_get(y->connection),
             "type='signal',sender='org.freedesktop.DBus',interface='org.freedesktop.DBus',member='NameOwnerChanged'"
@@ -45,6 +45,10 @@
 
 #define HSP_MAX_GAIN 15
 
+/* Audio codec IDs of the Hands-Free Profile 1.6 */
+#define HFP_AUDIO_CODEC_CVSD    0x01
+#define HFP_AUDIO_CODEC_MSBC    0x02
+
 typedef struct pa_bluetooth_uuid pa_bluetooth_uuid;
 typedef struct pa_bluetooth_device pa_bluetooth_device;
 typedef struct pa_bluetooth_discovery pa_bluetooth_discovery;
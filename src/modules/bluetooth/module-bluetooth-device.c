@@ -27,6 +27,7 @@
 #include <string.h>
 #include <errno.h>
 #include <math.h>
+#include <sys/ioctl.h>
 #include <linux/sockios.h>
 #include <arpa/inet.h>
 
@@ -41,6 +42,8 @@
 #include <pulsecore/core-rtclock.h>
 #include <pulsecore/core-util.h>
 #include <pulsecore/core-error.h>
+#include <pulsecore/asyncq.h>
+#include <pulsecore/fdsem.h>
 #include <pulsecore/shared.h>
 #include <pulsecore/socket-util.h>
 #include <pulsecore/thread.h>
@@ -52,6 +55,10 @@
 
 #include <sbc/sbc.h>
 
+#ifdef HAVE_OPENAPTX
+#include <openaptx.h>
+#endif
+
 #include "module-bluetooth-device-symdef.h"
 #include "a2dp-codecs.h"
 #include "rtp.h"
@@ -59,6 +66,26 @@
 
 #define BITPOOL_DEC_LIMIT 32
 #define BITPOOL_DEC_STEP 5
+#define BITPOOL_INC_STEP 1
+
+/* The bitpool controller looks at the worst send queue fill and lag seen
+ * during each period. It steps up again only after the link was fine
+ * for a while, so it does not oscillate around the limit. */
+#define BITPOOL_PERIOD_USEC (1*PA_USEC_PER_SEC)
+#define BITPOOL_INC_AFTER_USEC (10*PA_USEC_PER_SEC)
+#define BITPOOL_LAG_HIGH_USEC (40*PA_USEC_PER_MSEC)
+#define BITPOOL_LAG_LOW_USEC (10*PA_USEC_PER_MSEC)
+
+#define A2DP_BITPOOL_PROPERTY "bluetooth.a2dp.bitpool"
+#define CODEC_PROPERTY "bluetooth.codec"
+
+/* mSBC frames on the SCO link: 120 samples of 16 kHz mono go into 57 bytes
+ * of SBC, behind a two byte H2 header and followed by one byte of padding */
+#define MSBC_PCM_SIZE 240
+#define MSBC_FRAME_SIZE 57
+#define MSBC_PACKET_SIZE 60
+#define MSBC_H2_ID0 0x01
+#define MSBC_SYNC_WORD 0xAD
 
 PA_MODULE_AUTHOR("Joao Paulo Rechi Vita");
 PA_MODULE_DESCRIPTION("Bluetooth audio sink and source");
@@ -102,17 +129,107 @@ static const char* const valid_modargs[] = {
     NULL
 };
 
+/* Encoded A2DP packets wait here until the socket takes them */
+#define A2DP_PACKETS_MAX 4
+
+/* Wakeups without congestion before the render-ahead depth shrinks again */
+#define A2DP_PACKETS_DECAY 500
+
+/* SCO packets are left to queue up in the socket and are moved this many
+ * at a time, instead of waking up for every single one of them */
+#define HSP_PACKETS_MAX 4
+
+struct a2dp_packet {
+    void *data;
+    size_t size;                         /* Size of the allocated data */
+    size_t length;                       /* Bytes of RTP packet in data */
+    size_t pcm_length;                   /* Bytes of audio that went into it */
+};
+
+struct userdata;
+
+/* A codec for the A2DP audio stream. Whatever is configured for the
+ * transport picks one of these, the rest of the A2DP code only talks to
+ * the codec through it. */
+struct a2dp_codec {
+    const char *name;
+    uint8_t id;                          /* A2DP_CODEC_* */
+    bool rtp;                            /* Whether packets start with RTP headers */
+    size_t delay;                        /* Frames the codec delays the audio by */
+
+    /* Called from main context. Sets up the codec and the sample spec
+     * from the negotiated configuration. */
+    int (*config)(struct userdata *u, const uint8_t *config, int size);
+
+    /* The rest is run from the IO thread. How much audio goes into one
+     * packet of the given link MTU. */
+    size_t (*get_block_size)(struct userdata *u, size_t link_mtu);
+
+    /* Encode one block of audio into a packet payload, returns the
+     * bytes written to dst or -1 */
+    ssize_t (*encode)(struct userdata *u, const void *src, size_t src_size, void *dst, size_t dst_size, unsigned *frame_count);
+
+    /* The other way round, returns the bytes of audio written to dst or
+     * -1. NULL if the codec is only used for playback. */
+    ssize_t (*decode)(struct userdata *u, const void *src, size_t src_size, void *dst, size_t dst_size);
+};
+
+/* Packets from an A2DP source wait this many deep for the decoder, and
+ * as many decoded blocks for the IO thread */
+#define A2DP_DECODE_QUEUE 64
+
+/* A packet on its way through the decoder: the IO thread fills in the
+ * encoded data and when it arrived, the decoder swaps in the audio and
+ * where it ends in the stream. A chunk without memblock stops the
+ * decoder. */
+struct a2dp_rx {
+    pa_memchunk chunk;
+    pa_usec_t tstamp;
+    pa_usec_t position;
+};
+
+/* Decodes what an A2DP source sends in a thread of its own, so that the
+ * IO thread can keep draining the socket */
+struct a2dp_decoder {
+    struct userdata *u;
+    pa_thread *thread;
+
+    pa_asyncq *packets;                  /* IO thread -> decoder */
+    pa_asyncq *decoded;                  /* decoder -> IO thread */
+    pa_fdsem *fdsem;                     /* Wakes up the IO thread for decoded */
+    pa_rtpoll_item *rtpoll_item;
+
+    /* Only touched by the decoder thread */
+    bool have_timestamp;
+    uint32_t last_timestamp;
+    uint64_t position;                   /* Frames from the first packet on */
+};
+
 struct a2dp_info {
+    const struct a2dp_codec *codec;
+    struct a2dp_decoder *decoder;
+
     sbc_t sbc;                           /* Codec data */
     bool sbc_initialized;                /* Keep track if the encoder is initialized */
     size_t codesize, frame_length;       /* SBC Codesize, frame_length. We simply cache those values here */
 
-    void* buffer;                        /* Codec transfer buffer */
-    size_t buffer_size;                  /* Size of the buffer */
-
     uint16_t seq_num;                    /* Cumulative packet sequence */
     uint8_t min_bitpool;
     uint8_t max_bitpool;
+
+#ifdef HAVE_OPENAPTX
+    struct aptx_context *aptx;
+#endif
+
+    struct a2dp_packet packets[A2DP_PACKETS_MAX];
+    unsigned first_packet, n_packets;    /* Ring of packets not sent yet */
+    unsigned packets_target;             /* How many to encode ahead */
+    unsigned n_uncongested;
+
+    pa_usec_t period_start;              /* Bitpool controller state */
+    pa_usec_t good_since;
+    size_t max_outq;
+    pa_usec_t max_lag;
 };
 
 struct hsp_info {
@@ -120,6 +237,18 @@ struct hsp_info {
     void (*sco_sink_set_volume)(pa_sink *s);
     pa_source *sco_source;
     void (*sco_source_set_volume)(pa_source *s);
+
+    bool msbc;                           /* Wideband speech instead of CVSD */
+    bool msbc_initialized;
+    sbc_t msbc_encoder, msbc_decoder;
+    unsigned msbc_seq;                   /* Counts the H2 headers we send */
+
+    uint8_t msbc_out[2 * MSBC_PACKET_SIZE];
+    size_t msbc_out_length;              /* Encoded, not written yet */
+    uint8_t msbc_in[2 * MSBC_PACKET_SIZE];
+    size_t msbc_in_length;               /* Read, not decoded yet */
+
+    pa_usec_t next_read_at;              /* Input isn't polled for before */
 };
 
 struct bluetooth_msg {
@@ -193,6 +322,7 @@ struct userdata {
 
 enum {
     BLUETOOTH_MESSAGE_IO_THREAD_FAILED,
+    BLUETOOTH_MESSAGE_BITPOOL_CHANGED,
     BLUETOOTH_MESSAGE_MAX
 };
 
@@ -207,6 +337,332 @@ enum {
 
 static int init_profile(struct userdata *u);
 
+/* Run from main thread */
+static int sbc_config(struct userdata *u, const uint8_t *c, int size) {
+    struct a2dp_info *a2dp = &u->a2dp;
+    const a2dp_sbc_t *config;
+
+    if (size != sizeof(*config)) {
+        pa_log_error("Invalid SBC configuration");
+        return -1;
+    }
+
+    config = (const a2dp_sbc_t *) c;
+
+    u->sample_spec.format = PA_SAMPLE_S16LE;
+
+    if (a2dp->sbc_initialized)
+        sbc_reinit(&a2dp->sbc, 0);
+    else
+        sbc_init(&a2dp->sbc, 0);
+    a2dp->sbc_initialized = true;
+
+    switch (config->frequency) {
+        case SBC_SAMPLING_FREQ_16000:
+            a2dp->sbc.frequency = SBC_FREQ_16000;
+            u->sample_spec.rate = 16000U;
+            break;
+        case SBC_SAMPLING_FREQ_32000:
+            a2dp->sbc.frequency = SBC_FREQ_32000;
+            u->sample_spec.rate = 32000U;
+            break;
+        case SBC_SAMPLING_FREQ_44100:
+            a2dp->sbc.frequency = SBC_FREQ_44100;
+            u->sample_spec.rate = 44100U;
+            break;
+        case SBC_SAMPLING_FREQ_48000:
+            a2dp->sbc.frequency = SBC_FREQ_48000;
+            u->sample_spec.rate = 48000U;
+            break;
+        default:
+            pa_assert_not_reached();
+    }
+
+    switch (config->channel_mode) {
+        case SBC_CHANNEL_MODE_MONO:
+            a2dp->sbc.mode = SBC_MODE_MONO;
+            u->sample_spec.channels = 1;
+            break;
+        case SBC_CHANNEL_MODE_DUAL_CHANNEL:
+            a2dp->sbc.mode = SBC_MODE_DUAL_CHANNEL;
+            u->sample_spec.channels = 2;
+            break;
+        case SBC_CHANNEL_MODE_STEREO:
+            a2dp->sbc.mode = SBC_MODE_STEREO;
+            u->sample_spec.channels = 2;
+            break;
+        case SBC_CHANNEL_MODE_JOINT_STEREO:
+            a2dp->sbc.mode = SBC_MODE_JOINT_STEREO;
+            u->sample_spec.channels = 2;
+            break;
+        default:
+            pa_assert_not_reached();
+    }
+
+    switch (config->allocation_method) {
+        case SBC_ALLOCATION_SNR:
+            a2dp->sbc.allocation = SBC_AM_SNR;
+            break;
+        case SBC_ALLOCATION_LOUDNESS:
+            a2dp->sbc.allocation = SBC_AM_LOUDNESS;
+            break;
+        default:
+            pa_assert_not_reached();
+    }
+
+    switch (config->subbands) {
+        case SBC_SUBBANDS_4:
+            a2dp->sbc.subbands = SBC_SB_4;
+            break;
+        case SBC_SUBBANDS_8:
+            a2dp->sbc.subbands = SBC_SB_8;
+            break;
+        default:
+            pa_assert_not_reached();
+    }
+
+    switch (config->block_length) {
+        case SBC_BLOCK_LENGTH_4:
+            a2dp->sbc.blocks = SBC_BLK_4;
+            break;
+        case SBC_BLOCK_LENGTH_8:
+            a2dp->sbc.blocks = SBC_BLK_8;
+            break;
+        case SBC_BLOCK_LENGTH_12:
+            a2dp->sbc.blocks = SBC_BLK_12;
+            break;
+        case SBC_BLOCK_LENGTH_16:
+            a2dp->sbc.blocks = SBC_BLK_16;
+            break;
+        default:
+            pa_assert_not_reached();
+    }
+
+    a2dp->min_bitpool = config->min_bitpool;
+    a2dp->max_bitpool = config->max_bitpool;
+
+    /* Set minimum bitpool for source to get the maximum possible block_size */
+    a2dp->sbc.bitpool = u->profile == PROFILE_A2DP ? a2dp->max_bitpool : a2dp->min_bitpool;
+    a2dp->codesize = sbc_get_codesize(&a2dp->sbc);
+    a2dp->frame_length = sbc_get_frame_length(&a2dp->sbc);
+
+    pa_log_info("SBC parameters:\n\tallocation=%u\n\tsubbands=%u\n\tblocks=%u\n\tbitpool=%u\n",
+                a2dp->sbc.allocation, a2dp->sbc.subbands, a2dp->sbc.blocks, a2dp->sbc.bitpool);
+
+    return 0;
+}
+
+/* Run from IO thread */
+static size_t sbc_get_block_size(struct userdata *u, size_t link_mtu) {
+    return (link_mtu - sizeof(struct rtp_header) - sizeof(struct rtp_payload))
+        / u->a2dp.frame_length * u->a2dp.codesize;
+}
+
+/* Run from IO thread */
+static ssize_t sbc_encode_block(struct userdata *u, const void *src, size_t src_size, void *dst, size_t dst_size,
+                                unsigned *frame_count) {
+    struct a2dp_info *a2dp = &u->a2dp;
+    const void *p = src;
+    void *d = dst;
+    size_t to_encode = src_size, to_write = dst_size;
+
+    *frame_count = 0;
+
+    while (PA_LIKELY(to_encode > 0 && to_write > 0)) {
+        ssize_t written;
+        ssize_t encoded;
+
+        encoded = sbc_encode(&a2dp->sbc,
+                             p, to_encode,
+                             d, to_write,
+                             &written);
+
+        if (PA_UNLIKELY(encoded <= 0)) {
+            pa_log_error("SBC encoding error (%li)", (long) encoded);
+            return -1;
+        }
+
+/*         pa_log_debug("SBC: encoded: %lu; written: %lu", (unsigned long) encoded, (unsigned long) written); */
+/*         pa_log_debug("SBC: codesize: %lu; frame_length: %lu", (unsigned long) a2dp->codesize, (unsigned long) a2dp->frame_length); */
+
+        pa_assert_fp((size_t) encoded <= to_encode);
+        pa_assert_fp((size_t) encoded == a2dp->codesize);
+
+        pa_assert_fp((size_t) written <= to_write);
+        pa_assert_fp((size_t) written == a2dp->frame_length);
+
+        p = (const uint8_t*) p + encoded;
+        to_encode -= encoded;
+
+        d = (uint8_t*) d + written;
+        to_write -= written;
+
+        (*frame_count)++;
+    }
+
+    pa_assert(to_encode == 0);
+
+    PA_ONCE_BEGIN {
+        pa_log_debug("Using SBC encoder implementation: %s", pa_strnull(sbc_get_implementation_info(&a2dp->sbc)));
+    } PA_ONCE_END;
+
+    return (uint8_t*) d - (uint8_t*) dst;
+}
+
+/* Run from IO thread */
+static ssize_t sbc_decode_block(struct userdata *u, const void *src, size_t src_size, void *dst, size_t dst_size) {
+    struct a2dp_info *a2dp = &u->a2dp;
+    const void *p = src;
+    void *d = dst;
+    size_t to_decode = src_size, to_write = dst_size;
+
+    while (PA_LIKELY(to_decode > 0)) {
+        size_t written;
+        ssize_t decoded;
+
+        decoded = sbc_decode(&a2dp->sbc,
+                             p, to_decode,
+                             d, to_write,
+                             &written);
+
+        if (PA_UNLIKELY(decoded <= 0)) {
+            pa_log_error("SBC decoding error (%li)", (long) decoded);
+            return -1;
+        }
+
+/*         pa_log_debug("SBC: decoded: %lu; written: %lu", (unsigned long) decoded, (unsigned long) written); */
+/*         pa_log_debug("SBC: frame_length: %lu; codesize: %lu", (unsigned long) a2dp->frame_length, (unsigned long) a2dp->codesize); */
+
+        /* Reset frame length, it can be changed due to bitpool change */
+        a2dp->frame_length = sbc_get_frame_length(&a2dp->sbc);
+
+        pa_assert_fp((size_t) decoded <= to_decode);
+        pa_assert_fp((size_t) decoded == a2dp->frame_length);
+
+        pa_assert_fp((size_t) written == a2dp->codesize);
+
+        p = (const uint8_t*) p + decoded;
+        to_decode -= decoded;
+
+        d = (uint8_t*) d + written;
+        to_write -= written;
+    }
+
+    return (uint8_t*) d - (uint8_t*) dst;
+}
+
+static const struct a2dp_codec sbc_codec = {
+    .name = "sbc",
+    .id = A2DP_CODEC_SBC,
+    .rtp = true,
+    .delay = 0,                          /* Part of FIXED_LATENCY_*_A2DP already */
+    .config = sbc_config,
+    .get_block_size = sbc_get_block_size,
+    .encode = sbc_encode_block,
+    .decode = sbc_decode_block,
+};
+
+#ifdef HAVE_OPENAPTX
+
+/* aptX turns four stereo frames of S24LE into four bytes, and sends
+ * them without any RTP framing */
+#define APTX_PCM_GROUP 24
+#define APTX_CODE_GROUP 4
+
+/* Run from main thread */
+static int aptx_config(struct userdata *u, const uint8_t *c, int size) {
+    struct a2dp_info *a2dp = &u->a2dp;
+    const a2dp_aptx_t *config;
+
+    if (size != sizeof(*config)) {
+        pa_log_error("Invalid aptX configuration");
+        return -1;
+    }
+
+    config = (const a2dp_aptx_t *) c;
+
+    switch (config->frequency) {
+        case APTX_SAMPLING_FREQ_16000:
+            u->sample_spec.rate = 16000U;
+            break;
+        case APTX_SAMPLING_FREQ_32000:
+            u->sample_spec.rate = 32000U;
+            break;
+        case APTX_SAMPLING_FREQ_44100:
+            u->sample_spec.rate = 44100U;
+            break;
+        case APTX_SAMPLING_FREQ_48000:
+            u->sample_spec.rate = 48000U;
+            break;
+        default:
+            pa_log_error("Invalid aptX sample rate");
+            return -1;
+    }
+
+    u->sample_spec.format = PA_SAMPLE_S24LE;
+    u->sample_spec.channels = 2;
+
+    if (a2dp->aptx)
+        aptx_reset(a2dp->aptx);
+    else if (!(a2dp->aptx = aptx_init(0))) {
+        pa_log_error("Failed to set up the aptX encoder");
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Run from IO thread */
+static size_t aptx_get_block_size(struct userdata *u, size_t link_mtu) {
+    return link_mtu / APTX_CODE_GROUP * APTX_PCM_GROUP;
+}
+
+/* Run from IO thread */
+static ssize_t aptx_encode_block(struct userdata *u, const void *src, size_t src_size, void *dst, size_t dst_size,
+                                 unsigned *frame_count) {
+    size_t encoded, written;
+
+    encoded = aptx_encode(u->a2dp.aptx, src, src_size, dst, dst_size, &written);
+
+    if (PA_UNLIKELY(encoded != src_size)) {
+        pa_log_error("aptX encoding error (%lu of %lu bytes)", (unsigned long) encoded, (unsigned long) src_size);
+        return -1;
+    }
+
+    *frame_count = 0;
+
+    return (ssize_t) written;
+}
+
+static const struct a2dp_codec aptx_codec = {
+    .name = "aptx",
+    .id = A2DP_CODEC_VENDOR,
+    .rtp = false,
+    .delay = 90,
+    .config = aptx_config,
+    .get_block_size = aptx_get_block_size,
+    .encode = aptx_encode_block,
+    .decode = NULL,
+};
+
+#endif
+
+/* Run from IO thread */
+static pa_usec_t a2dp_codec_latency(struct userdata *u) {
+    return pa_bytes_to_usec(u->a2dp.codec->delay * pa_frame_size(&u->sample_spec), &u->sample_spec);
+}
+
+/* from IO thread */
+static size_t a2dp_queued_bytes(struct userdata *u) {
+    size_t n = 0;
+    unsigned i;
+
+    for (i = 0; i < u->a2dp.n_packets; i++)
+        n += u->a2dp.packets[(u->a2dp.first_packet + i) % A2DP_PACKETS_MAX].pcm_length;
+
+    return n;
+}
+
 /* from IO thread */
 static void a2dp_set_bitpool(struct userdata *u, uint8_t bitpool) {
     struct a2dp_info *a2dp;
@@ -230,33 +686,39 @@ static void a2dp_set_bitpool(struct userdata *u, uint8_t bitpool) {
 
     pa_log_debug("Bitpool has changed to %u", a2dp->sbc.bitpool);
 
-    u->read_block_size =
-        (u->read_link_mtu - sizeof(struct rtp_header) - sizeof(struct rtp_payload))
-        / a2dp->frame_length * a2dp->codesize;
+    pa_asyncmsgq_post(pa_thread_mq_get()->outq, PA_MSGOBJECT(u->msg), BLUETOOTH_MESSAGE_BITPOOL_CHANGED, NULL, bitpool, NULL, NULL);
 
-    u->write_block_size =
-        (u->write_link_mtu - sizeof(struct rtp_header) - sizeof(struct rtp_payload))
-        / a2dp->frame_length * a2dp->codesize;
+    u->read_block_size = a2dp->codec->get_block_size(u, u->read_link_mtu);
+    u->write_block_size = a2dp->codec->get_block_size(u, u->write_link_mtu);
 
     pa_sink_set_max_request_within_thread(u->sink, u->write_block_size);
     pa_sink_set_fixed_latency_within_thread(u->sink,
-            FIXED_LATENCY_PLAYBACK_A2DP + pa_bytes_to_usec(u->write_block_size, &u->sample_spec));
+            FIXED_LATENCY_PLAYBACK_A2DP + a2dp_codec_latency(u) + pa_bytes_to_usec(u->write_block_size, &u->sample_spec));
+}
+
+/* How long SCO input may queue up in the socket before it is read */
+static pa_usec_t hsp_batch_usec(struct userdata *u) {
+    /* The write block is the audio that one packet carries */
+    return (HSP_PACKETS_MAX - 1) * pa_bytes_to_usec(u->write_block_size, &u->sample_spec);
 }
 
 /* from IO thread, except in SCO over PCM */
 static void bt_transport_config_mtu(struct userdata *u) {
+    pa_usec_t codec_latency = 0;
+
     /* Calculate block sizes */
-    if (u->profile == PROFILE_HSP || u->profile == PROFILE_HFGW) {
+    if (u->hsp.msbc) {
+        /* Audio bytes that one SCO packet carries. The attached buffers
+         * hold at most two frames, so packets are never longer than one. */
+        u->read_block_size = 2 * MSBC_PCM_SIZE;
+        u->write_block_size = PA_MIN(u->write_link_mtu, (size_t) MSBC_PACKET_SIZE) * MSBC_PCM_SIZE / MSBC_PACKET_SIZE;
+    } else if (u->profile == PROFILE_HSP || u->profile == PROFILE_HFGW) {
         u->read_block_size = u->read_link_mtu;
         u->write_block_size = u->write_link_mtu;
     } else {
-        u->read_block_size =
-            (u->read_link_mtu - sizeof(struct rtp_header) - sizeof(struct rtp_payload))
-            / u->a2dp.frame_length * u->a2dp.codesize;
-
-        u->write_block_size =
-            (u->write_link_mtu - sizeof(struct rtp_header) - sizeof(struct rtp_payload))
-            / u->a2dp.frame_length * u->a2dp.codesize;
+        u->read_block_size = u->a2dp.codec->get_block_size(u, u->read_link_mtu);
+        u->write_block_size = u->a2dp.codec->get_block_size(u, u->write_link_mtu);
+        codec_latency = a2dp_codec_latency(u);
     }
 
     if (USE_SCO_OVER_PCM(u))
@@ -267,16 +729,168 @@ static void bt_transport_config_mtu(struct userdata *u) {
         pa_sink_set_fixed_latency_within_thread(u->sink,
                                                 (u->profile == PROFILE_A2DP ?
                                                  FIXED_LATENCY_PLAYBACK_A2DP : FIXED_LATENCY_PLAYBACK_HSP) +
+                                                codec_latency +
                                                 pa_bytes_to_usec(u->write_block_size, &u->sample_spec));
     }
 
     if (u->source)
         pa_source_set_fixed_latency_within_thread(u->source,
                                                   (u->profile == PROFILE_A2DP_SOURCE ?
-                                                   FIXED_LATENCY_RECORD_A2DP : FIXED_LATENCY_RECORD_HSP) +
+                                                   FIXED_LATENCY_RECORD_A2DP : FIXED_LATENCY_RECORD_HSP + hsp_batch_usec(u)) +
+                                                  codec_latency +
                                                   pa_bytes_to_usec(u->read_block_size, &u->sample_spec));
 }
 
+static void a2dp_rx_free(struct a2dp_rx *rx) {
+    if (rx->chunk.memblock)
+        pa_memblock_unref(rx->chunk.memblock);
+
+    pa_xfree(rx);
+}
+
+static struct a2dp_rx *a2dp_rx_new(void) {
+    struct a2dp_rx *rx;
+
+    rx = pa_xnew0(struct a2dp_rx, 1);
+    pa_memchunk_reset(&rx->chunk);
+
+    return rx;
+}
+
+/* Run from decoder thread. Where the audio of this packet ends, by the
+ * RTP clock of the sender if there is one. */
+static pa_usec_t a2dp_decoder_position(struct a2dp_decoder *d, const void *packet, size_t decoded) {
+    struct userdata *u = d->u;
+    uint64_t start;
+
+    if (u->a2dp.codec->rtp) {
+        uint32_t timestamp = ntohl(((const struct rtp_header *) packet)->timestamp);
+
+        /* Ignore timestamps going backwards, as after a reset of the sender */
+        if (d->have_timestamp && (int32_t) (timestamp - d->last_timestamp) > 0)
+            d->position += (uint32_t) (timestamp - d->last_timestamp);
+
+        d->have_timestamp = true;
+        d->last_timestamp = timestamp;
+
+        start = d->position;
+    } else {
+        start = d->position;
+        d->position += decoded / pa_frame_size(&u->sample_spec);
+    }
+
+    return pa_bytes_to_usec(start * pa_frame_size(&u->sample_spec) + decoded, &u->sample_spec);
+}
+
+static void a2dp_decoder_thread_func(void *userdata) {
+    struct a2dp_decoder *d = userdata;
+    struct userdata *u = d->u;
+    size_t header_size;
+
+    header_size = u->a2dp.codec->rtp ? sizeof(struct rtp_header) + sizeof(struct rtp_payload) : 0;
+
+    for (;;) {
+        struct a2dp_rx *rx;
+        pa_memchunk pcm;
+        const uint8_t *p;
+        void *q;
+        ssize_t decoded;
+
+        pa_assert_se(rx = pa_asyncq_pop(d->packets, true));
+
+        if (!rx->chunk.memblock) {
+            a2dp_rx_free(rx);
+            break;
+        }
+
+        if (rx->chunk.length < header_size) {
+            pa_log_warn("Packet too short for its header: %zu", rx->chunk.length);
+            a2dp_rx_free(rx);
+            continue;
+        }
+
+        pcm.memblock = pa_memblock_new(u->core->mempool, u->read_block_size);
+        pcm.index = 0;
+
+        p = pa_memblock_acquire_chunk(&rx->chunk);
+        q = pa_memblock_acquire(pcm.memblock);
+        decoded = u->a2dp.codec->decode(u, p + header_size, rx->chunk.length - header_size, q, pa_memblock_get_length(pcm.memblock));
+
+        if (PA_LIKELY(decoded >= 0))
+            rx->position = a2dp_decoder_position(d, p, (size_t) decoded);
+
+        pa_memblock_release(pcm.memblock);
+        pa_memblock_release(rx->chunk.memblock);
+
+        pa_memblock_unref(rx->chunk.memblock);
+        rx->chunk = pcm;
+        rx->chunk.length = decoded > 0 ? (size_t) decoded : 0;
+
+        /* A broken packet costs us its audio, not the stream */
+        if (decoded <= 0 || pa_asyncq_push(d->decoded, rx, false) < 0) {
+            if (decoded > 0)
+                pa_log_debug("IO thread is behind, dropping decoded audio");
+
+            a2dp_rx_free(rx);
+            continue;
+        }
+
+        pa_fdsem_post(d->fdsem);
+    }
+}
+
+/* Run from IO thread */
+static struct a2dp_decoder *a2dp_decoder_new(struct userdata *u) {
+    struct a2dp_decoder *d;
+
+    d = pa_xnew0(struct a2dp_decoder, 1);
+    d->u = u;
+
+    if (!(d->packets = pa_asyncq_new(A2DP_DECODE_QUEUE)) ||
+        !(d->decoded = pa_asyncq_new(A2DP_DECODE_QUEUE)) ||
+        !(d->fdsem = pa_fdsem_new()))
+        goto fail;
+
+    if (!(d->thread = pa_thread_new("bluetooth-decode", a2dp_decoder_thread_func, d)))
+        goto fail;
+
+    d->rtpoll_item = pa_rtpoll_item_new_fdsem(u->rtpoll, PA_RTPOLL_NORMAL, d->fdsem);
+
+    return d;
+
+fail:
+    pa_log_error("Failed to start the decoder thread");
+
+    if (d->fdsem)
+        pa_fdsem_free(d->fdsem);
+    if (d->decoded)
+        pa_asyncq_free(d->decoded, NULL);
+    if (d->packets)
+        pa_asyncq_free(d->packets, NULL);
+
+    pa_xfree(d);
+
+    return NULL;
+}
+
+/* Run from IO thread, or from the main thread once that has stopped */
+static void a2dp_decoder_free(struct a2dp_decoder *d) {
+    pa_assert(d);
+
+    /* Never blocks for long, the decoder doesn't wait for anything but
+     * this queue */
+    pa_assert_se(pa_asyncq_push(d->packets, a2dp_rx_new(), true) == 0);
+    pa_thread_free(d->thread);
+
+    pa_rtpoll_item_free(d->rtpoll_item);
+
+    pa_asyncq_free(d->packets, (pa_free_cb_t) a2dp_rx_free);
+    pa_asyncq_free(d->decoded, (pa_free_cb_t) a2dp_rx_free);
+    pa_fdsem_free(d->fdsem);
+
+    pa_xfree(d);
+}
+
 /* from IO thread, except in SCO over PCM */
 
 static void setup_stream(struct userdata *u) {
@@ -296,8 +910,17 @@ static void setup_stream(struct userdata *u) {
 
     pa_log_debug("Stream properly set up, we're ready to roll!");
 
-    if (u->profile == PROFILE_A2DP)
+    if (u->profile == PROFILE_A2DP && u->a2dp.codec->id == A2DP_CODEC_SBC) {
         a2dp_set_bitpool(u, u->a2dp.max_bitpool);
+        u->a2dp.period_start = 0;
+    }
+
+    u->hsp.msbc_seq = 0;
+    u->hsp.msbc_out_length = u->hsp.msbc_in_length = 0;
+    u->hsp.next_read_at = 0;
+
+    if (u->profile == PROFILE_A2DP_SOURCE)
+        u->a2dp.decoder = a2dp_decoder_new(u);
 
     u->rtpoll_item = pa_rtpoll_item_new(u->rtpoll, PA_RTPOLL_NEVER, 1);
     pollfd = pa_rtpoll_item_get_pollfd(u->rtpoll_item, NULL);
@@ -339,6 +962,14 @@ static void teardown_stream(struct userdata *u) {
         pa_memchunk_reset(&u->write_memchunk);
     }
 
+    /* Encoded for the old MTU, and too late by now anyway */
+    u->a2dp.first_packet = u->a2dp.n_packets = 0;
+
+    if (u->a2dp.decoder) {
+        a2dp_decoder_free(u->a2dp.decoder);
+        u->a2dp.decoder = NULL;
+    }
+
     pa_log_debug("Audio stream torn down");
 }
 
@@ -432,14 +1063,14 @@ static int sink_process_msg(pa_msgobject *o, int code, void *data, int64_t offse
                 pa_usec_t wi, ri;
 
                 ri = pa_smoother_get(u->read_smoother, pa_rtclock_now());
-                wi = pa_bytes_to_usec(u->write_index + u->write_block_size, &u->sample_spec);
+                wi = pa_bytes_to_usec(u->write_index + u->write_block_size + a2dp_queued_bytes(u), &u->sample_spec);
 
                 *((pa_usec_t*) data) = wi > ri ? wi - ri : 0;
             } else {
                 pa_usec_t ri, wi;
 
                 ri = pa_rtclock_now() - u->started_at;
-                wi = pa_bytes_to_usec(u->write_index, &u->sample_spec);
+                wi = pa_bytes_to_usec(u->write_index + a2dp_queued_bytes(u), &u->sample_spec);
 
                 *((pa_usec_t*) data) = wi > ri ? wi - ri : 0;
             }
@@ -540,18 +1171,201 @@ static int device_process_msg(pa_msgobject *obj, int code, void *data, int64_t o
             pa_assert_se(pa_card_set_profile(u->card, "off", false) >= 0);
             break;
         }
+
+        case BLUETOOTH_MESSAGE_BITPOOL_CHANGED: {
+            pa_proplist *p;
+            pa_sink *sink;
+            uint32_t idx;
+
+            p = pa_proplist_new();
+            pa_proplist_setf(p, A2DP_BITPOOL_PROPERTY, "%u", (unsigned) offset);
+
+            PA_IDXSET_FOREACH(sink, u->card->sinks, idx)
+                if (PA_SINK_IS_LINKED(sink->state))
+                    pa_sink_update_proplist(sink, PA_UPDATE_REPLACE, p);
+
+            pa_proplist_free(p);
+            break;
+        }
     }
     return 0;
 }
 
-/* Run from IO thread */
-static int hsp_process_render(struct userdata *u) {
+/* Run from IO thread. Sends one SCO packet of mSBC, encoding as many
+ * frames as that takes. Returns 1 if it was sent. */
+static int msbc_process_render(struct userdata *u) {
+    static const uint8_t h2_id1[] = { 0x08, 0x38, 0xc8, 0xf8 };
+    struct hsp_info *hsp = &u->hsp;
+    size_t packet_size;
+
+    packet_size = PA_MIN(u->write_link_mtu, (size_t) MSBC_PACKET_SIZE);
+
+    while (hsp->msbc_out_length < packet_size) {
+        pa_memchunk memchunk;
+        uint8_t *d;
+        const void *p;
+        ssize_t encoded, written;
+
+        pa_sink_render_full(u->sink, MSBC_PCM_SIZE, &memchunk);
+        pa_assert(memchunk.length == MSBC_PCM_SIZE);
+
+        d = hsp->msbc_out + hsp->msbc_out_length;
+        d[0] = MSBC_H2_ID0;
+        d[1] = h2_id1[hsp->msbc_seq++ % PA_ELEMENTSOF(h2_id1)];
+
+        p = pa_memblock_acquire_chunk(&memchunk);
+        encoded = sbc_encode(&hsp->msbc_encoder, p, memchunk.length, d + 2, MSBC_FRAME_SIZE, &written);
+        pa_memblock_release(memchunk.memblock);
+        pa_memblock_unref(memchunk.memblock);
+
+        if (PA_UNLIKELY(encoded != MSBC_PCM_SIZE || written != MSBC_FRAME_SIZE)) {
+            pa_log_error("mSBC encoding error (%li)", (long) encoded);
+            return -1;
+        }
+
+        d[2 + MSBC_FRAME_SIZE] = 0;
+        hsp->msbc_out_length += MSBC_PACKET_SIZE;
+    }
+
+    for (;;) {
+        ssize_t l;
+
+        l = pa_write(u->stream_fd, hsp->msbc_out, packet_size, &u->stream_write_type);
+
+        pa_assert(l != 0);
+
+        if (l < 0) {
+
+            if (errno == EINTR)
+                /* Retry right away if we got interrupted */
+                continue;
+
+            else if (errno == EAGAIN)
+                /* Hmm, apparently the socket was not writable, give up for now */
+                return 0;
+
+            pa_log_error("Failed to write data to SCO socket: %s", pa_cstrerror(errno));
+            u->sink->thread_info.counters.xruns++;
+            return -1;
+        }
+
+        if ((size_t) l != packet_size) {
+            pa_log_error("Wrote memory block to socket only partially! %llu written, wanted to write %llu.",
+                        (unsigned long long) l,
+                        (unsigned long long) packet_size);
+            return -1;
+        }
+
+        break;
+    }
+
+    hsp->msbc_out_length -= packet_size;
+    memmove(hsp->msbc_out, hsp->msbc_out + packet_size, hsp->msbc_out_length);
+
+    /* Counted in audio, like everything else that paces the IO thread */
+    u->write_index += (uint64_t) u->write_block_size;
+
+    return 1;
+}
+
+/* Run from IO thread. Packets don't need to line up with frames, so
+ * this collects them and looks for the H2 headers to find the frames. */
+static int msbc_process_push(struct userdata *u) {
+    struct hsp_info *hsp = &u->hsp;
+    pa_memchunk memchunk;
+    pa_usec_t tstamp;
+    uint8_t *d;
+    size_t i, to_write;
+    ssize_t l;
+
+    for (;;) {
+        l = pa_read(u->stream_fd, hsp->msbc_in + hsp->msbc_in_length,
+                    sizeof(hsp->msbc_in) - hsp->msbc_in_length, &u->stream_write_type);
+
+        if (l <= 0) {
+
+            if (l < 0 && errno == EINTR)
+                /* Retry right away if we got interrupted */
+                continue;
+
+            else if (l < 0 && errno == EAGAIN)
+                /* Hmm, apparently the socket was not readable, give up for now. */
+                return 0;
+
+            pa_log_error("Failed to read data from SCO socket: %s", l < 0 ? pa_cstrerror(errno) : "EOF");
+            return -1;
+        }
+
+        break;
+    }
+
+    hsp->msbc_in_length += (size_t) l;
+    tstamp = pa_rtclock_now();
+
+    memchunk.memblock = pa_memblock_new(u->core->mempool, u->read_block_size);
+    memchunk.index = memchunk.length = 0;
+
+    d = pa_memblock_acquire(memchunk.memblock);
+    to_write = pa_memblock_get_length(memchunk.memblock);
+
+    i = 0;
+    while (i + MSBC_PACKET_SIZE <= hsp->msbc_in_length && to_write >= MSBC_PCM_SIZE) {
+        const uint8_t *p = hsp->msbc_in + i;
+        size_t written;
+        ssize_t decoded;
+
+        if (p[0] != MSBC_H2_ID0 || (p[1] & 0x0f) != 0x08 || p[2] != MSBC_SYNC_WORD) {
+            i++;
+            continue;
+        }
+
+        decoded = sbc_decode(&hsp->msbc_decoder, p + 2, MSBC_FRAME_SIZE, d, to_write, &written);
+
+        /* Keep the clock going over a broken frame */
+        if (PA_UNLIKELY(decoded != MSBC_FRAME_SIZE || written != MSBC_PCM_SIZE)) {
+            pa_log_debug("Dropping broken mSBC frame");
+            memset(d, 0, MSBC_PCM_SIZE);
+        }
+
+        d += MSBC_PCM_SIZE;
+        to_write -= MSBC_PCM_SIZE;
+        memchunk.length += MSBC_PCM_SIZE;
+
+        i += MSBC_PACKET_SIZE;
+    }
+
+    pa_memblock_release(memchunk.memblock);
+
+    /* Less than a frame is left, which might still be the start of one */
+    hsp->msbc_in_length -= i;
+    memmove(hsp->msbc_in, hsp->msbc_in + i, hsp->msbc_in_length);
+
+    if (memchunk.length > 0) {
+        u->read_index += (uint64_t) memchunk.length;
+
+        pa_smoother_put(u->read_smoother, tstamp, pa_bytes_to_usec(u->read_index, &u->sample_spec));
+        pa_smoother_resume(u->read_smoother, tstamp, true);
+
+        pa_source_post(u->source, &memchunk);
+    }
+
+    pa_memblock_unref(memchunk.memblock);
+
+    /* Audio bytes this packet stood for, to pace the writes */
+    return (int) ((size_t) l * MSBC_PCM_SIZE / MSBC_PACKET_SIZE);
+}
+
+/* Run from IO thread. Sends one SCO packet, returns 1 if it was sent. */
+static int hsp_render_packet(struct userdata *u) {
     int ret = 0;
 
     pa_assert(u);
     pa_assert(u->profile == PROFILE_HSP || u->profile == PROFILE_HFGW);
     pa_assert(u->sink);
 
+    if (u->hsp.msbc)
+        return msbc_process_render(u);
+
     /* First, render some data */
     if (!u->write_memchunk.memblock)
         pa_sink_render_full(u->sink, u->write_block_size, &u->write_memchunk);
@@ -583,6 +1397,7 @@ static int hsp_process_render(struct userdata *u) {
                 break;
 
             pa_log_error("Failed to write data to SCO socket: %s", pa_cstrerror(errno));
+            u->sink->thread_info.counters.xruns++;
             ret = -1;
             break;
         }
@@ -608,8 +1423,8 @@ static int hsp_process_render(struct userdata *u) {
     return ret;
 }
 
-/* Run from IO thread */
-static int hsp_process_push(struct userdata *u) {
+/* Run from IO thread. Reads one SCO packet, returns its size in audio. */
+static int hsp_push_packet(struct userdata *u) {
     int ret = 0;
     pa_memchunk memchunk;
 
@@ -618,6 +1433,9 @@ static int hsp_process_push(struct userdata *u) {
     pa_assert(u->source);
     pa_assert(u->read_smoother);
 
+    if (u->hsp.msbc)
+        return msbc_process_push(u);
+
     memchunk.memblock = pa_memblock_new(u->core->mempool, u->read_block_size);
     memchunk.index = memchunk.length = 0;
 
@@ -705,114 +1523,218 @@ static int hsp_process_push(struct userdata *u) {
     return ret;
 }
 
-/* Run from IO thread */
-static void a2dp_prepare_buffer(struct userdata *u) {
-    size_t min_buffer_size = PA_MAX(u->read_link_mtu, u->write_link_mtu);
+/* Run from IO thread. Sends up to n packets, as many as the socket has
+ * room for. Returns the number sent. */
+static int hsp_process_render(struct userdata *u, unsigned n) {
+    unsigned i;
 
-    pa_assert(u);
+    for (i = 0; i < n; i++) {
+        int r;
 
-    if (u->a2dp.buffer_size >= min_buffer_size)
-        return;
+        if ((r = hsp_render_packet(u)) < 0)
+            return -1;
+
+        if (r == 0)
+            break;
+    }
 
-    u->a2dp.buffer_size = 2 * min_buffer_size;
-    pa_xfree(u->a2dp.buffer);
-    u->a2dp.buffer = pa_xmalloc(u->a2dp.buffer_size);
+    return (int) i;
+}
+
+/* Run from IO thread. Reads everything that queued up in the socket.
+ * Returns its size in audio. */
+static int hsp_process_push(struct userdata *u) {
+    int n = 0;
+    unsigned i;
+
+    for (i = 0; i < HSP_PACKETS_MAX * 2; i++) {
+        int r;
+
+        if ((r = hsp_push_packet(u)) < 0)
+            return -1;
+
+        if (r == 0)
+            break;
+
+        n += r;
+    }
+
+    return n;
 }
 
 /* Run from IO thread */
-static int a2dp_process_render(struct userdata *u) {
+static int a2dp_encode_packet(struct userdata *u) {
     struct a2dp_info *a2dp;
+    struct a2dp_packet *packet;
     struct rtp_header *header;
     struct rtp_payload *payload;
-    size_t nbytes;
-    void *d;
+    pa_memchunk memchunk;
     const void *p;
-    size_t to_write, to_encode;
+    size_t header_size;
+    ssize_t written;
     unsigned frame_count;
-    int ret = 0;
+    uint64_t timestamp;
 
     pa_assert(u);
-    pa_assert(u->profile == PROFILE_A2DP);
-    pa_assert(u->sink);
 
-    /* First, render some data */
-    if (!u->write_memchunk.memblock)
-        pa_sink_render_full(u->sink, u->write_block_size, &u->write_memchunk);
+    a2dp = &u->a2dp;
+    pa_assert(a2dp->n_packets < A2DP_PACKETS_MAX);
+
+    packet = &a2dp->packets[(a2dp->first_packet + a2dp->n_packets) % A2DP_PACKETS_MAX];
+
+    if (packet->size < u->write_link_mtu) {
+        packet->size = u->write_link_mtu;
+        pa_xfree(packet->data);
+        packet->data = pa_xmalloc(packet->size);
+    }
+
+    /* Where this packet starts, behind the ones still queued */
+    timestamp = (u->write_index + a2dp_queued_bytes(u)) / pa_frame_size(&u->sample_spec);
+
+    pa_sink_render_full(u->sink, u->write_block_size, &memchunk);
+    pa_assert(memchunk.length == u->write_block_size);
+
+    header = packet->data;
+    payload = (struct rtp_payload*) ((uint8_t*) packet->data + sizeof(*header));
+    header_size = a2dp->codec->rtp ? sizeof(*header) + sizeof(*payload) : 0;
+
+    /* Try to create a packet of the full MTU */
+
+    p = (const uint8_t *) pa_memblock_acquire_chunk(&memchunk);
+    written = a2dp->codec->encode(u, p, memchunk.length,
+                                  (uint8_t*) packet->data + header_size, packet->size - header_size,
+                                  &frame_count);
+    pa_memblock_release(memchunk.memblock);
+    pa_memblock_unref(memchunk.memblock);
+
+    if (written < 0)
+        return -1;
+
+    if (a2dp->codec->rtp) {
+        memset(packet->data, 0, header_size);
+        header->v = 2;
+        header->pt = 1;
+        header->sequence_number = htons(a2dp->seq_num++);
+        header->timestamp = htonl((uint32_t) timestamp);
+        header->ssrc = htonl(1);
+        payload->frame_count = frame_count;
+    }
+
+    packet->length = header_size + (size_t) written;
+    packet->pcm_length = memchunk.length;
+
+    a2dp->n_packets++;
+
+    return 0;
+}
+
+/* Run from IO thread */
+static void a2dp_adjust_packets_target(struct userdata *u, bool congested) {
+    struct a2dp_info *a2dp = &u->a2dp;
+
+    if (congested) {
+        a2dp->n_uncongested = 0;
+
+        if (a2dp->packets_target < A2DP_PACKETS_MAX) {
+            a2dp->packets_target++;
+            pa_log_debug("Link congested, encoding %u packets ahead", a2dp->packets_target);
+        }
+
+    } else if (++a2dp->n_uncongested >= A2DP_PACKETS_DECAY) {
+        a2dp->n_uncongested = 0;
+
+        if (a2dp->packets_target > 1) {
+            a2dp->packets_target--;
+            pa_log_debug("Link is fine again, encoding %u packets ahead", a2dp->packets_target);
+        }
+    }
+}
 
-    pa_assert(u->write_memchunk.length == u->write_block_size);
+/* Run from IO thread */
+static void a2dp_control_bitpool(struct userdata *u) {
+    struct a2dp_info *a2dp = &u->a2dp;
+    pa_usec_t now;
+    int outq;
 
-    a2dp_prepare_buffer(u);
+    /* Only SBC has a bitpool to turn */
+    if (a2dp->codec->id != A2DP_CODEC_SBC)
+        return;
 
-    a2dp = &u->a2dp;
-    header = a2dp->buffer;
-    payload = (struct rtp_payload*) ((uint8_t*) a2dp->buffer + sizeof(*header));
+    now = pa_rtclock_now();
 
-    frame_count = 0;
+    if (a2dp->period_start <= 0) {
+        a2dp->period_start = a2dp->good_since = now;
+        a2dp->max_outq = 0;
+        a2dp->max_lag = 0;
+    }
 
-    /* Try to create a packet of the full MTU */
+    /* Data the kernel could not hand to the adapter yet */
+    if (ioctl(u->stream_fd, SIOCOUTQ, &outq) >= 0 && outq > 0)
+        a2dp->max_outq = PA_MAX(a2dp->max_outq, (size_t) outq);
 
-    p = (const uint8_t *) pa_memblock_acquire_chunk(&u->write_memchunk);
-    to_encode = u->write_memchunk.length;
+    if (u->started_at > 0) {
+        pa_usec_t time_passed, audio_sent;
 
-    d = (uint8_t*) a2dp->buffer + sizeof(*header) + sizeof(*payload);
-    to_write = a2dp->buffer_size - sizeof(*header) - sizeof(*payload);
+        time_passed = now - u->started_at;
+        audio_sent = pa_bytes_to_usec(u->write_index, &u->sample_spec);
 
-    while (PA_LIKELY(to_encode > 0 && to_write > 0)) {
-        ssize_t written;
-        ssize_t encoded;
+        if (time_passed > audio_sent)
+            a2dp->max_lag = PA_MAX(a2dp->max_lag, time_passed - audio_sent);
+    }
 
-        encoded = sbc_encode(&a2dp->sbc,
-                             p, to_encode,
-                             d, to_write,
-                             &written);
+    if (now - a2dp->period_start < BITPOOL_PERIOD_USEC)
+        return;
 
-        if (PA_UNLIKELY(encoded <= 0)) {
-            pa_log_error("SBC encoding error (%li)", (long) encoded);
-            pa_memblock_release(u->write_memchunk.memblock);
-            return -1;
-        }
+    if (a2dp->max_outq > 2 * u->write_link_mtu || a2dp->max_lag > BITPOOL_LAG_HIGH_USEC) {
+        pa_log_debug("Send queue at %lu bytes, %llu us behind, lowering bitpool",
+                     (unsigned long) a2dp->max_outq, (unsigned long long) a2dp->max_lag);
 
-/*         pa_log_debug("SBC: encoded: %lu; written: %lu", (unsigned long) encoded, (unsigned long) written); */
-/*         pa_log_debug("SBC: codesize: %lu; frame_length: %lu", (unsigned long) a2dp->codesize, (unsigned long) a2dp->frame_length); */
+        if (a2dp->sbc.bitpool > a2dp->min_bitpool)
+            a2dp_set_bitpool(u, (uint8_t) PA_MAX((int) a2dp->sbc.bitpool - BITPOOL_DEC_STEP, (int) a2dp->min_bitpool));
 
-        pa_assert_fp((size_t) encoded <= to_encode);
-        pa_assert_fp((size_t) encoded == a2dp->codesize);
+        a2dp->good_since = now;
 
-        pa_assert_fp((size_t) written <= to_write);
-        pa_assert_fp((size_t) written == a2dp->frame_length);
+    } else if (a2dp->max_outq > u->write_link_mtu || a2dp->max_lag > BITPOOL_LAG_LOW_USEC)
+        /* Not bad enough to go down, not good enough to go up */
+        a2dp->good_since = now;
 
-        p = (const uint8_t*) p + encoded;
-        to_encode -= encoded;
+    else if (now - a2dp->good_since >= BITPOOL_INC_AFTER_USEC) {
 
-        d = (uint8_t*) d + written;
-        to_write -= written;
+        if (a2dp->sbc.bitpool < a2dp->max_bitpool)
+            a2dp_set_bitpool(u, (uint8_t) PA_MIN((int) a2dp->sbc.bitpool + BITPOOL_INC_STEP, (int) a2dp->max_bitpool));
 
-        frame_count++;
+        a2dp->good_since = now;
     }
 
-    pa_memblock_release(u->write_memchunk.memblock);
+    a2dp->period_start = now;
+    a2dp->max_outq = 0;
+    a2dp->max_lag = 0;
+}
 
-    pa_assert(to_encode == 0);
+/* Run from IO thread. Sends up to n packets, returns how many it sent */
+static int a2dp_process_render(struct userdata *u, unsigned n) {
+    struct a2dp_info *a2dp;
+    int ret = 0;
 
-    PA_ONCE_BEGIN {
-        pa_log_debug("Using SBC encoder implementation: %s", pa_strnull(sbc_get_implementation_info(&a2dp->sbc)));
-    } PA_ONCE_END;
+    pa_assert(u);
+    pa_assert(u->profile == PROFILE_A2DP);
+    pa_assert(u->sink);
 
-    /* write it to the fifo */
-    memset(a2dp->buffer, 0, sizeof(*header) + sizeof(*payload));
-    header->v = 2;
-    header->pt = 1;
-    header->sequence_number = htons(a2dp->seq_num++);
-    header->timestamp = htonl(u->write_index / pa_frame_size(&u->sample_spec));
-    header->ssrc = htonl(1);
-    payload->frame_count = frame_count;
+    a2dp = &u->a2dp;
 
-    nbytes = (uint8_t*) d - (uint8_t*) a2dp->buffer;
+    if (a2dp->packets_target <= 0)
+        a2dp->packets_target = 1;
 
-    for (;;) {
+    while (n > 0) {
+        struct a2dp_packet *packet;
         ssize_t l;
 
-        l = pa_write(u->stream_fd, a2dp->buffer, nbytes, &u->stream_write_type);
+        if (a2dp->n_packets <= 0 && a2dp_encode_packet(u) < 0)
+            return -1;
+
+        packet = &a2dp->packets[a2dp->first_packet];
+
+        l = pa_write(u->stream_fd, packet->data, packet->length, &u->stream_write_type);
 
         pa_assert(l != 0);
 
@@ -822,67 +1744,71 @@ static int a2dp_process_render(struct userdata *u) {
                 /* Retry right away if we got interrupted */
                 continue;
 
-            else if (errno == EAGAIN)
-                /* Hmm, apparently the socket was not writable, give up for now */
+            else if (errno == EAGAIN) {
+                /* The socket is full, the packet stays queued for the
+                 * next POLLOUT */
+                if (ret > 0)
+                    a2dp_adjust_packets_target(u, true);
                 break;
+            }
 
             pa_log_error("Failed to write data to socket: %s", pa_cstrerror(errno));
-            ret = -1;
-            break;
+            u->sink->thread_info.counters.xruns++;
+            return -1;
         }
 
-        pa_assert((size_t) l <= nbytes);
+        pa_assert((size_t) l <= packet->length);
 
-        if ((size_t) l != nbytes) {
+        if ((size_t) l != packet->length) {
             pa_log_warn("Wrote memory block to socket only partially! %llu written, wanted to write %llu.",
                         (unsigned long long) l,
-                        (unsigned long long) nbytes);
-            ret = -1;
-            break;
+                        (unsigned long long) packet->length);
+            return -1;
         }
 
-        u->write_index += (uint64_t) u->write_memchunk.length;
-        pa_memblock_unref(u->write_memchunk.memblock);
-        pa_memchunk_reset(&u->write_memchunk);
-
-        ret = 1;
+        u->write_index += (uint64_t) packet->pcm_length;
+        a2dp->first_packet = (a2dp->first_packet + 1) % A2DP_PACKETS_MAX;
+        a2dp->n_packets--;
 
-        break;
+        ret++;
+        n--;
     }
 
+    if (n <= 0)
+        a2dp_adjust_packets_target(u, false);
+
+    a2dp_control_bitpool(u);
+
+    /* Get the next packets ready while the link is busy sending these */
+    while (a2dp->n_packets < a2dp->packets_target)
+        if (a2dp_encode_packet(u) < 0)
+            return -1;
+
     return ret;
 }
 
+/* Run from IO thread. Only reads the packets, a2dp_process_decoded()
+ * posts them once the decoder is done. */
 static int a2dp_process_push(struct userdata *u) {
-    int ret = 0;
-    pa_memchunk memchunk;
+    struct a2dp_rx *rx;
+    void *p;
+    ssize_t l;
 
     pa_assert(u);
     pa_assert(u->profile == PROFILE_A2DP_SOURCE);
     pa_assert(u->source);
     pa_assert(u->read_smoother);
 
-    memchunk.memblock = pa_memblock_new(u->core->mempool, u->read_block_size);
-    memchunk.index = memchunk.length = 0;
-
-    for (;;) {
-        bool found_tstamp = false;
-        pa_usec_t tstamp;
-        struct a2dp_info *a2dp;
-        struct rtp_header *header;
-        struct rtp_payload *payload;
-        const void *p;
-        void *d;
-        ssize_t l;
-        size_t to_write, to_decode;
-
-        a2dp_prepare_buffer(u);
+    if (!u->a2dp.decoder)
+        return -1;
 
-        a2dp = &u->a2dp;
-        header = a2dp->buffer;
-        payload = (struct rtp_payload*) ((uint8_t*) a2dp->buffer + sizeof(*header));
+    rx = a2dp_rx_new();
+    rx->chunk.memblock = pa_memblock_new(u->core->mempool, u->read_link_mtu);
 
-        l = pa_read(u->stream_fd, a2dp->buffer, a2dp->buffer_size, &u->stream_write_type);
+    for (;;) {
+        p = pa_memblock_acquire(rx->chunk.memblock);
+        l = pa_read(u->stream_fd, p, pa_memblock_get_length(rx->chunk.memblock), &u->stream_write_type);
+        pa_memblock_release(rx->chunk.memblock);
 
         if (l <= 0) {
 
@@ -890,81 +1816,51 @@ static int a2dp_process_push(struct userdata *u) {
                 /* Retry right away if we got interrupted */
                 continue;
 
-            else if (l < 0 && errno == EAGAIN)
+            a2dp_rx_free(rx);
+
+            if (l < 0 && errno == EAGAIN)
                 /* Hmm, apparently the socket was not readable, give up for now. */
-                break;
+                return 0;
 
             pa_log_error("Failed to read data from socket: %s", l < 0 ? pa_cstrerror(errno) : "EOF");
-            ret = -1;
-            break;
-        }
-
-        pa_assert((size_t) l <= a2dp->buffer_size);
-
-        u->read_index += (uint64_t) l;
-
-        /* TODO: get timestamp from rtp */
-        if (!found_tstamp) {
-            /* pa_log_warn("Couldn't find SO_TIMESTAMP data in auxiliary recvmsg() data!"); */
-            tstamp = pa_rtclock_now();
+            return -1;
         }
 
-        pa_smoother_put(u->read_smoother, tstamp, pa_bytes_to_usec(u->read_index, &u->sample_spec));
-        pa_smoother_resume(u->read_smoother, tstamp, true);
-
-        p = (uint8_t*) a2dp->buffer + sizeof(*header) + sizeof(*payload);
-        to_decode = l - sizeof(*header) - sizeof(*payload);
-
-        d = pa_memblock_acquire(memchunk.memblock);
-        to_write = memchunk.length = pa_memblock_get_length(memchunk.memblock);
-
-        while (PA_LIKELY(to_decode > 0)) {
-            size_t written;
-            ssize_t decoded;
-
-            decoded = sbc_decode(&a2dp->sbc,
-                                 p, to_decode,
-                                 d, to_write,
-                                 &written);
-
-            if (PA_UNLIKELY(decoded <= 0)) {
-                pa_log_error("SBC decoding error (%li)", (long) decoded);
-                pa_memblock_release(memchunk.memblock);
-                pa_memblock_unref(memchunk.memblock);
-                return -1;
-            }
+        break;
+    }
 
-/*             pa_log_debug("SBC: decoded: %lu; written: %lu", (unsigned long) decoded, (unsigned long) written); */
-/*             pa_log_debug("SBC: frame_length: %lu; codesize: %lu", (unsigned long) a2dp->frame_length, (unsigned long) a2dp->codesize); */
+    rx->chunk.length = (size_t) l;
+    rx->tstamp = pa_rtclock_now();
 
-            /* Reset frame length, it can be changed due to bitpool change */
-            a2dp->frame_length = sbc_get_frame_length(&a2dp->sbc);
+    if (pa_asyncq_push(u->a2dp.decoder->packets, rx, false) < 0) {
+        pa_log_debug("Decoder is behind, dropping packet");
+        a2dp_rx_free(rx);
+    }
 
-            pa_assert_fp((size_t) decoded <= to_decode);
-            pa_assert_fp((size_t) decoded == a2dp->frame_length);
+    return (int) l;
+}
 
-            pa_assert_fp((size_t) written == a2dp->codesize);
+/* Run from IO thread */
+static void a2dp_process_decoded(struct userdata *u) {
+    struct a2dp_rx *rx;
 
-            p = (const uint8_t*) p + decoded;
-            to_decode -= decoded;
+    pa_assert(u);
+    pa_assert(u->source);
 
-            d = (uint8_t*) d + written;
-            to_write -= written;
-        }
+    if (!u->a2dp.decoder)
+        return;
 
-        memchunk.length -= to_write;
+    while ((rx = pa_asyncq_pop(u->a2dp.decoder->decoded, false))) {
 
-        pa_memblock_release(memchunk.memblock);
+        /* The sender's clock over ours, for the latency */
+        pa_smoother_put(u->read_smoother, rx->tstamp, rx->position);
+        pa_smoother_resume(u->read_smoother, rx->tstamp, true);
 
-        pa_source_post(u->source, &memchunk);
+        u->read_index += (uint64_t) rx->chunk.length;
+        pa_source_post(u->source, &rx->chunk);
 
-        ret = l;
-        break;
+        a2dp_rx_free(rx);
     }
-
-    pa_memblock_unref(memchunk.memblock);
-
-    return ret;
 }
 
 static void a2dp_reduce_bitpool(struct userdata *u) {
@@ -975,6 +1871,9 @@ static void a2dp_reduce_bitpool(struct userdata *u) {
 
     a2dp = &u->a2dp;
 
+    if (a2dp->codec->id != A2DP_CODEC_SBC)
+        return;
+
     /* Check if bitpool is already at its limit */
     if (a2dp->sbc.bitpool <= BITPOOL_DEC_LIMIT)
         return;
@@ -985,6 +1884,9 @@ static void a2dp_reduce_bitpool(struct userdata *u) {
         bitpool = BITPOOL_DEC_LIMIT;
 
     a2dp_set_bitpool(u, bitpool);
+
+    /* Don't let the controller undo this right away */
+    a2dp->good_since = pa_rtclock_now();
 }
 
 static void thread_func(void *userdata) {
@@ -1010,17 +1912,21 @@ static void thread_func(void *userdata) {
     for (;;) {
         struct pollfd *pollfd;
         int ret;
-        bool disable_timer = true;
+        bool disable_timer = true, read_now;
 
         pollfd = u->rtpoll_item ? pa_rtpoll_item_get_pollfd(u->rtpoll_item, NULL) : NULL;
 
         if (u->source && PA_SOURCE_IS_LINKED(u->source->thread_info.state)) {
 
             /* We should send two blocks to the device before we expect
-             * a response. */
+             * a response. SCO input is read in batches, so there the
+             * output needs to stay ahead by a whole batch. */
 
             if (u->write_index == 0 && u->read_index <= 0)
-                do_write = 2;
+                do_write = u->profile == PROFILE_A2DP_SOURCE ? 2 : HSP_PACKETS_MAX;
+
+            if (u->profile == PROFILE_A2DP_SOURCE)
+                a2dp_process_decoded(u);
 
             if (pollfd && (pollfd->revents & POLLIN)) {
                 int n_read;
@@ -1033,6 +1939,9 @@ static void thread_func(void *userdata) {
                 if (n_read < 0)
                     goto io_fail;
 
+                if (n_read > 0 && (u->profile == PROFILE_HSP || u->profile == PROFILE_HFGW))
+                    u->hsp.next_read_at = pa_rtpoll_now(u->rtpoll) + hsp_batch_usec(u);
+
                 /* We just read something, so we are supposed to write something, too */
                 pending_read_bytes += n_read;
                 do_write += pending_read_bytes / u->write_block_size;
@@ -1080,14 +1989,27 @@ static void thread_func(void *userdata) {
                                 pa_sink_render_full(u->sink, skip_bytes, &tmp);
                                 pa_memblock_unref(tmp.memblock);
                                 u->write_index += skip_bytes;
+                                u->sink->thread_info.counters.xruns++;
 
-                                if (u->profile == PROFILE_A2DP)
+                                if (u->profile == PROFILE_A2DP) {
                                     a2dp_reduce_bitpool(u);
+                                    a2dp_adjust_packets_target(u, true);
+                                }
                             }
                         }
 
                         do_write = 1;
                         pending_read_bytes = 0;
+
+                        /* When behind, send what is due in one go */
+                        if (u->profile == PROFILE_A2DP) {
+                            pa_usec_t block_usec = pa_bytes_to_usec(u->write_block_size, &u->sample_spec);
+
+                            audio_to_send = PA_MIN(audio_to_send, MAX_PLAYBACK_CATCH_UP_USEC);
+
+                            if (block_usec > 0)
+                                do_write = PA_CLAMP_UNLIKELY((unsigned) (audio_to_send / block_usec), 1U, (unsigned) A2DP_PACKETS_MAX);
+                        }
                     }
                 }
 
@@ -1098,10 +2020,10 @@ static void thread_func(void *userdata) {
                         u->started_at = pa_rtclock_now();
 
                     if (u->profile == PROFILE_A2DP) {
-                        if ((n_written = a2dp_process_render(u)) < 0)
+                        if ((n_written = a2dp_process_render(u, do_write)) < 0)
                             goto io_fail;
                     } else {
-                        if ((n_written = hsp_process_render(u)) < 0)
+                        if ((n_written = hsp_process_render(u, do_write)) < 0)
                             goto io_fail;
                     }
 
@@ -1133,13 +2055,23 @@ static void thread_func(void *userdata) {
             }
         }
 
+        read_now = u->source && PA_SOURCE_IS_LINKED(u->source->thread_info.state);
+
+        /* Let the next SCO packets queue up in the socket */
+        if (read_now && disable_timer && (u->profile == PROFILE_HSP || u->profile == PROFILE_HFGW) &&
+            pa_rtpoll_now(u->rtpoll) < u->hsp.next_read_at) {
+            pa_rtpoll_set_timer_absolute(u->rtpoll, u->hsp.next_read_at);
+            disable_timer = false;
+            read_now = false;
+        }
+
         if (disable_timer)
             pa_rtpoll_set_timer_disabled(u->rtpoll);
 
         /* Hmm, nothing to do. Let's sleep */
         if (pollfd)
             pollfd->events = (short) (((u->sink && PA_SINK_IS_LINKED(u->sink->thread_info.state) && !writable) ? POLLOUT : 0) |
-                                      (u->source && PA_SOURCE_IS_LINKED(u->source->thread_info.state) ? POLLIN : 0));
+                                      (read_now ? POLLIN : 0));
 
         if ((ret = pa_rtpoll_run(u->rtpoll, true)) < 0) {
             pa_log_debug("pa_rtpoll_run failed with: %d", ret);
@@ -1556,6 +2488,13 @@ static int add_sink(struct userdata *u) {
         pa_proplist_sets(data.proplist, "bluetooth.protocol", pa_bt_profile_to_string(u->profile));
         if (u->profile == PROFILE_HSP)
             pa_proplist_sets(data.proplist, PA_PROP_DEVICE_INTENDED_ROLES, "phone");
+        if (u->profile == PROFILE_A2DP) {
+            pa_proplist_sets(data.proplist, CODEC_PROPERTY, u->a2dp.codec->name);
+
+            if (u->a2dp.codec->id == A2DP_CODEC_SBC)
+                pa_proplist_setf(data.proplist, A2DP_BITPOOL_PROPERTY, "%u", u->a2dp.sbc.bitpool);
+        } else if (u->profile == PROFILE_HSP || u->profile == PROFILE_HFGW)
+            pa_proplist_sets(data.proplist, CODEC_PROPERTY, u->hsp.msbc ? "msbc" : "cvsd");
         data.card = u->card;
         data.name = get_name("sink", u->modargs, u->address, &b);
         data.namereg_fail = b;
@@ -1683,124 +2622,96 @@ static int add_source(struct userdata *u) {
     return 0;
 }
 
-static void bt_transport_config_a2dp(struct userdata *u) {
+static const struct a2dp_codec *a2dp_codecs[] = {
+    &sbc_codec,
+#ifdef HAVE_OPENAPTX
+    &aptx_codec,
+#endif
+};
+
+/* Run from main thread */
+static int bt_transport_config_a2dp(struct userdata *u) {
     const pa_bluetooth_transport *t;
-    struct a2dp_info *a2dp = &u->a2dp;
-    a2dp_sbc_t *config;
+    unsigned i;
 
     t = u->transport;
     pa_assert(t);
 
-    config = (a2dp_sbc_t *) t->config;
-
-    u->sample_spec.format = PA_SAMPLE_S16LE;
-
-    if (a2dp->sbc_initialized)
-        sbc_reinit(&a2dp->sbc, 0);
-    else
-        sbc_init(&a2dp->sbc, 0);
-    a2dp->sbc_initialized = true;
-
-    switch (config->frequency) {
-        case SBC_SAMPLING_FREQ_16000:
-            a2dp->sbc.frequency = SBC_FREQ_16000;
-            u->sample_spec.rate = 16000U;
-            break;
-        case SBC_SAMPLING_FREQ_32000:
-            a2dp->sbc.frequency = SBC_FREQ_32000;
-            u->sample_spec.rate = 32000U;
-            break;
-        case SBC_SAMPLING_FREQ_44100:
-            a2dp->sbc.frequency = SBC_FREQ_44100;
-            u->sample_spec.rate = 44100U;
-            break;
-        case SBC_SAMPLING_FREQ_48000:
-            a2dp->sbc.frequency = SBC_FREQ_48000;
-            u->sample_spec.rate = 48000U;
+    for (i = 0; i < PA_ELEMENTSOF(a2dp_codecs); i++)
+        if (a2dp_codecs[i]->id == t->codec)
             break;
-        default:
-            pa_assert_not_reached();
-    }
 
-    switch (config->channel_mode) {
-        case SBC_CHANNEL_MODE_MONO:
-            a2dp->sbc.mode = SBC_MODE_MONO;
-            u->sample_spec.channels = 1;
-            break;
-        case SBC_CHANNEL_MODE_DUAL_CHANNEL:
-            a2dp->sbc.mode = SBC_MODE_DUAL_CHANNEL;
-            u->sample_spec.channels = 2;
-            break;
-        case SBC_CHANNEL_MODE_STEREO:
-            a2dp->sbc.mode = SBC_MODE_STEREO;
-            u->sample_spec.channels = 2;
-            break;
-        case SBC_CHANNEL_MODE_JOINT_STEREO:
-            a2dp->sbc.mode = SBC_MODE_JOINT_STEREO;
-            u->sample_spec.channels = 2;
-            break;
-        default:
-            pa_assert_not_reached();
+    if (i >= PA_ELEMENTSOF(a2dp_codecs)) {
+        pa_log_error("Transport %s uses unsupported codec %u", t->path, t->codec);
+        return -1;
     }
 
-    switch (config->allocation_method) {
-        case SBC_ALLOCATION_SNR:
-            a2dp->sbc.allocation = SBC_AM_SNR;
-            break;
-        case SBC_ALLOCATION_LOUDNESS:
-            a2dp->sbc.allocation = SBC_AM_LOUDNESS;
-            break;
-        default:
-            pa_assert_not_reached();
+    if (u->profile == PROFILE_A2DP_SOURCE && !a2dp_codecs[i]->decode) {
+        pa_log_error("Can't decode %s", a2dp_codecs[i]->name);
+        return -1;
     }
 
-    switch (config->subbands) {
-        case SBC_SUBBANDS_4:
-            a2dp->sbc.subbands = SBC_SB_4;
-            break;
-        case SBC_SUBBANDS_8:
-            a2dp->sbc.subbands = SBC_SB_8;
-            break;
-        default:
-            pa_assert_not_reached();
+    u->a2dp.codec = a2dp_codecs[i];
+    pa_log_info("Using codec %s", u->a2dp.codec->name);
+
+    return u->a2dp.codec->config(u, t->config, t->config_size);
+}
+
+/* Run from main thread */
+static int bt_transport_config_msbc(struct userdata *u) {
+#ifdef HAVE_MSBC
+    struct hsp_info *hsp = &u->hsp;
+
+    if (hsp->msbc_initialized) {
+        sbc_finish(&hsp->msbc_encoder);
+        sbc_finish(&hsp->msbc_decoder);
     }
 
-    switch (config->block_length) {
-        case SBC_BLOCK_LENGTH_4:
-            a2dp->sbc.blocks = SBC_BLK_4;
-            break;
-        case SBC_BLOCK_LENGTH_8:
-            a2dp->sbc.blocks = SBC_BLK_8;
-            break;
-        case SBC_BLOCK_LENGTH_12:
-            a2dp->sbc.blocks = SBC_BLK_12;
-            break;
-        case SBC_BLOCK_LENGTH_16:
-            a2dp->sbc.blocks = SBC_BLK_16;
-            break;
-        default:
-            pa_assert_not_reached();
+    hsp->msbc_initialized = false;
+
+    if (sbc_init_msbc(&hsp->msbc_encoder, 0) < 0)
+        goto fail;
+
+    if (sbc_init_msbc(&hsp->msbc_decoder, 0) < 0) {
+        sbc_finish(&hsp->msbc_encoder);
+        goto fail;
     }
 
-    a2dp->min_bitpool = config->min_bitpool;
-    a2dp->max_bitpool = config->max_bitpool;
+    pa_assert(sbc_get_codesize(&hsp->msbc_encoder) == MSBC_PCM_SIZE);
+    pa_assert(sbc_get_frame_length(&hsp->msbc_encoder) == MSBC_FRAME_SIZE);
 
-    /* Set minimum bitpool for source to get the maximum possible block_size */
-    a2dp->sbc.bitpool = u->profile == PROFILE_A2DP ? a2dp->max_bitpool : a2dp->min_bitpool;
-    a2dp->codesize = sbc_get_codesize(&a2dp->sbc);
-    a2dp->frame_length = sbc_get_frame_length(&a2dp->sbc);
+    hsp->msbc = hsp->msbc_initialized = true;
+    u->sample_spec.rate = 16000;
 
-    pa_log_info("SBC parameters:\n\tallocation=%u\n\tsubbands=%u\n\tblocks=%u\n\tbitpool=%u\n",
-                a2dp->sbc.allocation, a2dp->sbc.subbands, a2dp->sbc.blocks, a2dp->sbc.bitpool);
+    pa_log_info("Using codec msbc");
+
+    return 0;
+
+fail:
+    pa_log_error("Failed to set up the mSBC codec");
+#else
+    pa_log_error("Transport %s uses mSBC, which the SBC library does not support", u->transport->path);
+#endif
+
+    return -1;
 }
 
-static void bt_transport_config(struct userdata *u) {
+/* Run from main thread */
+static int bt_transport_config(struct userdata *u) {
+    u->hsp.msbc = false;
+
     if (u->profile == PROFILE_HSP || u->profile == PROFILE_HFGW) {
         u->sample_spec.format = PA_SAMPLE_S16LE;
         u->sample_spec.channels = 1;
         u->sample_spec.rate = 8000;
-    } else
-        bt_transport_config_a2dp(u);
+
+        if (u->transport->codec == HFP_AUDIO_CODEC_MSBC)
+            return bt_transport_config_msbc(u);
+
+        return 0;
+    }
+
+    return bt_transport_config_a2dp(u);
 }
 
 /* Run from main thread */
@@ -1839,9 +2750,7 @@ static int setup_transport(struct userdata *u) {
     else if (bt_transport_acquire(u, false) < 0)
         return -1; /* We need to fail here until the interactions with module-suspend-on-idle and alike get improved */
 
-    bt_transport_config(u);
-
-    return 0;
+    return bt_transport_config(u);
 }
 
 /* Run from main thread */
@@ -1893,6 +2802,12 @@ static void stop_thread(struct userdata *u) {
         u->rtpoll_item = NULL;
     }
 
+    /* Has an item on the rtpoll, so it can't wait for the transport */
+    if (u->a2dp.decoder) {
+        a2dp_decoder_free(u->a2dp.decoder);
+        u->a2dp.decoder = NULL;
+    }
+
     if (u->rtpoll) {
         pa_thread_mq_done(&u->thread_mq);
 
@@ -2555,6 +3470,7 @@ int pa__get_n_used(pa_module *m) {
 
 void pa__done(pa_module *m) {
     struct userdata *u;
+    unsigned i;
 
     pa_assert(m);
 
@@ -2596,11 +3512,21 @@ void pa__done(pa_module *m) {
     if (u->card)
         pa_card_free(u->card);
 
-    if (u->a2dp.buffer)
-        pa_xfree(u->a2dp.buffer);
+    for (i = 0; i < A2DP_PACKETS_MAX; i++)
+        pa_xfree(u->a2dp.packets[i].data);
 
     sbc_finish(&u->a2dp.sbc);
 
+#ifdef HAVE_OPENAPTX
+    if (u->a2dp.aptx)
+        aptx_finish(u->a2dp.aptx);
+#endif
+
+    if (u->hsp.msbc_initialized) {
+        sbc_finish(&u->hsp.msbc_encoder);
+        sbc_finish(&u->hsp.msbc_decoder);
+    }
+
     if (u->modargs)
         pa_modargs_free(u->modargs);
 
@@ -39,7 +39,7 @@ static void handle_get_sinks(DBusConnection *conn, DBusMessage *msg, void *userd
 static void handle_get_sources(DBusConnection *conn, DBusMessage *msg, void *userdata);
 static void handle_get_priority(DBusConnection *conn, DBusMessage *msg, void *userdata);
 
-static void handle_get_all(DBusConnection *conn, DBusMessage *msg, void *userdata);
+static void append_all(DBusMessageIter *dict_iter, void *userdata);
 
 struct pa_dbusiface_card_profile {
     uint32_t index;
@@ -73,7 +73,8 @@ static pa_dbus_interface_info profile_interface_info = {
     .n_method_handlers = 0,
     .property_handlers = property_handlers,
     .n_property_handlers = PROPERTY_HANDLER_MAX,
-    .get_all_properties_cb = handle_get_all,
+    .get_all_properties_cb = NULL,
+    .append_all_properties_cb = append_all,
     .signals = NULL,
     .n_signals = 0
 };
@@ -147,39 +148,26 @@ static void handle_get_priority(DBusConnection *conn, DBusMessage *msg, void *us
     pa_dbus_send_basic_variant_reply(conn, msg, DBUS_TYPE_UINT32, &priority);
 }
 
-static void handle_get_all(DBusConnection *conn, DBusMessage *msg, void *userdata) {
+/* Profiles don't change, so the cached reply is never invalidated */
+static void append_all(DBusMessageIter *dict_iter, void *userdata) {
     pa_dbusiface_card_profile *p = userdata;
-    DBusMessage *reply = NULL;
-    DBusMessageIter msg_iter;
-    DBusMessageIter dict_iter;
     dbus_uint32_t sinks = 0;
     dbus_uint32_t sources = 0;
     dbus_uint32_t priority = 0;
 
-    pa_assert(conn);
-    pa_assert(msg);
+    pa_assert(dict_iter);
     pa_assert(p);
 
     sinks = p->profile->n_sinks;
     sources = p->profile->n_sources;
     priority = p->profile->priority;
 
-    pa_assert_se((reply = dbus_message_new_method_return(msg)));
-
-    dbus_message_iter_init_append(reply, &msg_iter);
-    pa_assert_se(dbus_message_iter_open_container(&msg_iter, DBUS_TYPE_ARRAY, "{sv}", &dict_iter));
-
-    pa_dbus_append_basic_variant_dict_entry(&dict_iter, property_handlers[PROPERTY_HANDLER_INDEX].property_name, DBUS_TYPE_UINT32, &p->index);
-    pa_dbus_append_basic_variant_dict_entry(&dict_iter, property_handlers[PROPERTY_HANDLER_NAME].property_name, DBUS_TYPE_STRING, &p->profile->name);
-    pa_dbus_append_basic_variant_dict_entry(&dict_iter, property_handlers[PROPERTY_HANDLER_DESCRIPTION].property_name, DBUS_TYPE_STRING, &p->profile->description);
-    pa_dbus_append_basic_variant_dict_entry(&dict_iter, property_handlers[PROPERTY_HANDLER_SINKS].property_name, DBUS_TYPE_UINT32, &sinks);
-    pa_dbus_append_basic_variant_dict_entry(&dict_iter, property_handlers[PROPERTY_HANDLER_SOURCES].property_name, DBUS_TYPE_UINT32, &sources);
-    pa_dbus_append_basic_variant_dict_entry(&dict_iter, property_handlers[PROPERTY_HANDLER_PRIORITY].property_name, DBUS_TYPE_UINT32, &priority);
-
-    pa_assert_se(dbus_message_iter_close_container(&msg_iter, &dict_iter));
-
-    pa_assert_se(dbus_connection_send(conn, reply, NULL));
-    dbus_message_unref(reply);
+    pa_dbus_append_basic_variant_dict_entry(dict_iter, property_handlers[PROPERTY_HANDLER_INDEX].property_name, DBUS_TYPE_UINT32, &p->index);
+    pa_dbus_append_basic_variant_dict_entry(dict_iter, property_handlers[PROPERTY_HANDLER_NAME].property_name, DBUS_TYPE_STRING, &p->profile->name);
+    pa_dbus_append_basic_variant_dict_entry(dict_iter, property_handlers[PROPERTY_HANDLER_DESCRIPTION].property_name, DBUS_TYPE_STRING, &p->profile->description);
+    pa_dbus_append_basic_variant_dict_entry(dict_iter, property_handlers[PROPERTY_HANDLER_SINKS].property_name, DBUS_TYPE_UINT32, &sinks);
+    pa_dbus_append_basic_variant_dict_entry(dict_iter, property_handlers[PROPERTY_HANDLER_SOURCES].property_name, DBUS_TYPE_UINT32, &sources);
+    pa_dbus_append_basic_variant_dict_entry(dict_iter, property_handlers[PROPERTY_HANDLER_PRIORITY].property_name, DBUS_TYPE_UINT32, &priority);
 }
 
 pa_dbusiface_card_profile *pa_dbusiface_card_profile_new(
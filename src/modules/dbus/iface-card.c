@@ -46,7 +46,7 @@ static void handle_get_active_profile(DBusConnection *conn, DBusMessage *msg, vo
 static void handle_set_active_profile(DBusConnection *conn, DBusMessage *msg, DBusMessageIter *iter, void *userdata);
 static void handle_get_property_list(DBusConnection *conn, DBusMessage *msg, void *userdata);
 
-static void handle_get_all(DBusConnection *conn, DBusMessage *msg, void *userdata);
+static void append_all(DBusMessageIter *dict_iter, void *userdata);
 
 static void handle_get_profile_by_name(DBusConnection *conn, DBusMessage *msg, void *userdata);
 
@@ -61,6 +61,10 @@ struct pa_dbusiface_card {
     pa_proplist *proplist;
 
     pa_hook_slot *card_profile_added_slot;
+    pa_hook_slot *sink_put_slot;
+    pa_hook_slot *sink_unlink_slot;
+    pa_hook_slot *source_put_slot;
+    pa_hook_slot *source_unlink_slot;
 
     pa_dbus_protocol *dbus_protocol;
     pa_subscription *subscription;
@@ -129,7 +133,8 @@ static pa_dbus_interface_info card_interface_info = {
     .n_method_handlers = METHOD_HANDLER_MAX,
     .property_handlers = property_handlers,
     .n_property_handlers = PROPERTY_HANDLER_MAX,
-    .get_all_properties_cb = handle_get_all,
+    .get_all_properties_cb = NULL,
+    .append_all_properties_cb = append_all,
     .signals = signals,
     .n_signals = SIGNAL_MAX
 };
@@ -355,11 +360,8 @@ static void handle_get_property_list(DBusConnection *conn, DBusMessage *msg, voi
     pa_dbus_send_proplist_variant_reply(conn, msg, c->proplist);
 }
 
-static void handle_get_all(DBusConnection *conn, DBusMessage *msg, void *userdata) {
+static void append_all(DBusMessageIter *dict_iter, void *userdata) {
     pa_dbusiface_card *c = userdata;
-    DBusMessage *reply = NULL;
-    DBusMessageIter msg_iter;
-    DBusMessageIter dict_iter;
     dbus_uint32_t idx;
     const char *owner_module = NULL;
     const char **sinks = NULL;
@@ -370,8 +372,7 @@ static void handle_get_all(DBusConnection *conn, DBusMessage *msg, void *userdat
     unsigned n_profiles = 0;
     const char *active_profile = NULL;
 
-    pa_assert(conn);
-    pa_assert(msg);
+    pa_assert(dict_iter);
     pa_assert(c);
 
     idx = c->card->index;
@@ -382,30 +383,19 @@ static void handle_get_all(DBusConnection *conn, DBusMessage *msg, void *userdat
     profiles = get_profiles(c, &n_profiles);
     active_profile = pa_dbusiface_card_profile_get_path(pa_hashmap_get(c->profiles, c->active_profile->name));
 
-    pa_assert_se((reply = dbus_message_new_method_return(msg)));
-
-    dbus_message_iter_init_append(reply, &msg_iter);
-    pa_assert_se(dbus_message_iter_open_container(&msg_iter, DBUS_TYPE_ARRAY, "{sv}", &dict_iter));
-
-    pa_dbus_append_basic_variant_dict_entry(&dict_iter, property_handlers[PROPERTY_HANDLER_INDEX].property_name, DBUS_TYPE_UINT32, &idx);
-    pa_dbus_append_basic_variant_dict_entry(&dict_iter, property_handlers[PROPERTY_HANDLER_NAME].property_name, DBUS_TYPE_STRING, &c->card->name);
-    pa_dbus_append_basic_variant_dict_entry(&dict_iter, property_handlers[PROPERTY_HANDLER_DRIVER].property_name, DBUS_TYPE_STRING, &c->card->driver);
+    pa_dbus_append_basic_variant_dict_entry(dict_iter, property_handlers[PROPERTY_HANDLER_INDEX].property_name, DBUS_TYPE_UINT32, &idx);
+    pa_dbus_append_basic_variant_dict_entry(dict_iter, property_handlers[PROPERTY_HANDLER_NAME].property_name, DBUS_TYPE_STRING, &c->card->name);
+    pa_dbus_append_basic_variant_dict_entry(dict_iter, property_handlers[PROPERTY_HANDLER_DRIVER].property_name, DBUS_TYPE_STRING, &c->card->driver);
 
     if (owner_module)
-        pa_dbus_append_basic_variant_dict_entry(&dict_iter, property_handlers[PROPERTY_HANDLER_OWNER_MODULE].property_name, DBUS_TYPE_OBJECT_PATH, &owner_module);
-
-    pa_dbus_append_basic_array_variant_dict_entry(&dict_iter, property_handlers[PROPERTY_HANDLER_SINKS].property_name, DBUS_TYPE_OBJECT_PATH, sinks, n_sinks);
-    pa_dbus_append_basic_array_variant_dict_entry(&dict_iter, property_handlers[PROPERTY_HANDLER_SOURCES].property_name, DBUS_TYPE_OBJECT_PATH, sources, n_sources);
-    pa_dbus_append_basic_array_variant_dict_entry(&dict_iter, property_handlers[PROPERTY_HANDLER_PROFILES].property_name, DBUS_TYPE_OBJECT_PATH, profiles, n_profiles);
-    pa_dbus_append_basic_variant_dict_entry(&dict_iter, property_handlers[PROPERTY_HANDLER_ACTIVE_PROFILE].property_name, DBUS_TYPE_OBJECT_PATH, &active_profile);
-
-    pa_dbus_append_proplist_variant_dict_entry(&dict_iter, property_handlers[PROPERTY_HANDLER_PROPERTY_LIST].property_name, c->proplist);
+        pa_dbus_append_basic_variant_dict_entry(dict_iter, property_handlers[PROPERTY_HANDLER_OWNER_MODULE].property_name, DBUS_TYPE_OBJECT_PATH, &owner_module);
 
-    pa_assert_se(dbus_message_iter_close_container(&msg_iter, &dict_iter));
+    pa_dbus_append_basic_array_variant_dict_entry(dict_iter, property_handlers[PROPERTY_HANDLER_SINKS].property_name, DBUS_TYPE_OBJECT_PATH, sinks, n_sinks);
+    pa_dbus_append_basic_array_variant_dict_entry(dict_iter, property_handlers[PROPERTY_HANDLER_SOURCES].property_name, DBUS_TYPE_OBJECT_PATH, sources, n_sources);
+    pa_dbus_append_basic_array_variant_dict_entry(dict_iter, property_handlers[PROPERTY_HANDLER_PROFILES].property_name, DBUS_TYPE_OBJECT_PATH, profiles, n_profiles);
+    pa_dbus_append_basic_variant_dict_entry(dict_iter, property_handlers[PROPERTY_HANDLER_ACTIVE_PROFILE].property_name, DBUS_TYPE_OBJECT_PATH, &active_profile);
 
-    pa_assert_se(dbus_connection_send(conn, reply, NULL));
-
-    dbus_message_unref(reply);
+    pa_dbus_append_proplist_variant_dict_entry(dict_iter, property_handlers[PROPERTY_HANDLER_PROPERTY_LIST].property_name, c->proplist);
 
     pa_xfree(sinks);
     pa_xfree(sources);
@@ -450,6 +440,8 @@ static void subscription_cb(pa_core *core, pa_subscription_event_type_t t, uint3
     if ((t & PA_SUBSCRIPTION_EVENT_TYPE_MASK) != PA_SUBSCRIPTION_EVENT_CHANGE)
         return;
 
+    pa_dbus_protocol_invalidate_properties(c->dbus_protocol, c->path, PA_DBUSIFACE_CARD_INTERFACE);
+
     if (c->active_profile != c->card->active_profile) {
         const char *object_path;
 
@@ -497,6 +489,8 @@ static pa_hook_result_t card_profile_added_cb(void *hook_data, void *call_data,
     p = pa_dbusiface_card_profile_new(c, core, profile, c->next_profile_index++);
     pa_assert_se(pa_hashmap_put(c->profiles, pa_dbusiface_card_profile_get_name(p), p) >= 0);
 
+    pa_dbus_protocol_invalidate_properties(c->dbus_protocol, c->path, PA_DBUSIFACE_CARD_INTERFACE);
+
     /* Send D-Bus signal */
     object_path = pa_dbusiface_card_profile_get_path(p);
 
@@ -511,6 +505,27 @@ static pa_hook_result_t card_profile_added_cb(void *hook_data, void *call_data,
     return PA_HOOK_OK;
 }
 
+/* The Sinks and Sources properties change with these */
+static pa_hook_result_t sink_changed_cb(void *hook_data, void *call_data, void *slot_data) {
+    pa_sink *sink = call_data;
+    pa_dbusiface_card *c = slot_data;
+
+    if (sink->card == c->card)
+        pa_dbus_protocol_invalidate_properties(c->dbus_protocol, c->path, PA_DBUSIFACE_CARD_INTERFACE);
+
+    return PA_HOOK_OK;
+}
+
+static pa_hook_result_t source_changed_cb(void *hook_data, void *call_data, void *slot_data) {
+    pa_source *source = call_data;
+    pa_dbusiface_card *c = slot_data;
+
+    if (source->card == c->card)
+        pa_dbus_protocol_invalidate_properties(c->dbus_protocol, c->path, PA_DBUSIFACE_CARD_INTERFACE);
+
+    return PA_HOOK_OK;
+}
+
 pa_dbusiface_card *pa_dbusiface_card_new(pa_dbusiface_core *core, pa_card *card) {
     pa_dbusiface_card *c = NULL;
     pa_card_profile *profile;
@@ -539,6 +554,10 @@ pa_dbusiface_card *pa_dbusiface_card_new(pa_dbusiface_core *core, pa_card *card)
 
     c->card_profile_added_slot = pa_hook_connect(&card->core->hooks[PA_CORE_HOOK_CARD_PROFILE_ADDED], PA_HOOK_NORMAL,
                                                  card_profile_added_cb, c);
+    c->sink_put_slot = pa_hook_connect(&card->core->hooks[PA_CORE_HOOK_SINK_PUT], PA_HOOK_NORMAL, sink_changed_cb, c);
+    c->sink_unlink_slot = pa_hook_connect(&card->core->hooks[PA_CORE_HOOK_SINK_UNLINK], PA_HOOK_NORMAL, sink_changed_cb, c);
+    c->source_put_slot = pa_hook_connect(&card->core->hooks[PA_CORE_HOOK_SOURCE_PUT], PA_HOOK_NORMAL, source_changed_cb, c);
+    c->source_unlink_slot = pa_hook_connect(&card->core->hooks[PA_CORE_HOOK_SOURCE_UNLINK], PA_HOOK_NORMAL, source_changed_cb, c);
 
     return c;
 }
@@ -549,6 +568,10 @@ void pa_dbusiface_card_free(pa_dbusiface_card *c) {
     pa_assert_se(pa_dbus_protocol_remove_interface(c->dbus_protocol, c->path, card_interface_info.name) >= 0);
 
     pa_hook_slot_free(c->card_profile_added_slot);
+    pa_hook_slot_free(c->sink_put_slot);
+    pa_hook_slot_free(c->sink_unlink_slot);
+    pa_hook_slot_free(c->source_put_slot);
+    pa_hook_slot_free(c->source_unlink_slot);
 
     pa_hashmap_free(c->profiles, (pa_free_cb_t) pa_dbusiface_card_profile_free);
     pa_proplist_free(c->proplist);
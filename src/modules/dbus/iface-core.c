@@ -44,6 +44,7 @@
 #include "iface-memstats.h"
 #include "iface-module.h"
 #include "iface-sample.h"
+#include "iface-stats.h"
 #include "iface-stream.h"
 
 #include "iface-core.h"
@@ -119,6 +120,7 @@ struct pa_dbusiface_core {
     pa_hook_slot *extension_unregistered_slot;
 
     pa_dbusiface_memstats *memstats;
+    pa_dbusiface_stats *stats;
 };
 
 enum property_handler_index {
@@ -2048,6 +2050,7 @@ pa_dbusiface_core *pa_dbusiface_core_new(pa_core *core) {
                                                                    extension_unregistered_cb,
                                                                    c);
     c->memstats = pa_dbusiface_memstats_new(c, core);
+    c->stats = pa_dbusiface_stats_new(c, core);
 
     if (c->fallback_sink)
         pa_sink_ref(c->fallback_sink);
@@ -2114,6 +2117,7 @@ void pa_dbusiface_core_free(pa_dbusiface_core *c) {
     pa_hook_slot_free(c->extension_registered_slot);
     pa_hook_slot_free(c->extension_unregistered_slot);
     pa_dbusiface_memstats_free(c->memstats);
+    pa_dbusiface_stats_free(c->stats);
 
     if (c->fallback_sink)
         pa_sink_unref(c->fallback_sink);
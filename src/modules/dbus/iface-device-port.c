@@ -37,7 +37,7 @@ static void handle_get_name(DBusConnection *conn, DBusMessage *msg, void *userda
 static void handle_get_description(DBusConnection *conn, DBusMessage *msg, void *userdata);
 static void handle_get_priority(DBusConnection *conn, DBusMessage *msg, void *userdata);
 
-static void handle_get_all(DBusConnection *conn, DBusMessage *msg, void *userdata);
+static void append_all(DBusMessageIter *dict_iter, void *userdata);
 
 struct pa_dbusiface_device_port {
     uint32_t index;
@@ -67,7 +67,8 @@ static pa_dbus_interface_info port_interface_info = {
     .n_method_handlers = 0,
     .property_handlers = property_handlers,
     .n_property_handlers = PROPERTY_HANDLER_MAX,
-    .get_all_properties_cb = handle_get_all,
+    .get_all_properties_cb = NULL,
+    .append_all_properties_cb = append_all,
     .signals = NULL,
     .n_signals = 0
 };
@@ -115,33 +116,20 @@ static void handle_get_priority(DBusConnection *conn, DBusMessage *msg, void *us
     pa_dbus_send_basic_variant_reply(conn, msg, DBUS_TYPE_UINT32, &priority);
 }
 
-static void handle_get_all(DBusConnection *conn, DBusMessage *msg, void *userdata) {
+/* Ports don't change, so the cached reply is never invalidated */
+static void append_all(DBusMessageIter *dict_iter, void *userdata) {
     pa_dbusiface_device_port *p = userdata;
-    DBusMessage *reply = NULL;
-    DBusMessageIter msg_iter;
-    DBusMessageIter dict_iter;
     dbus_uint32_t priority = 0;
 
-    pa_assert(conn);
-    pa_assert(msg);
+    pa_assert(dict_iter);
     pa_assert(p);
 
     priority = p->port->priority;
 
-    pa_assert_se((reply = dbus_message_new_method_return(msg)));
-
-    dbus_message_iter_init_append(reply, &msg_iter);
-    pa_assert_se(dbus_message_iter_open_container(&msg_iter, DBUS_TYPE_ARRAY, "{sv}", &dict_iter));
-
-    pa_dbus_append_basic_variant_dict_entry(&dict_iter, property_handlers[PROPERTY_HANDLER_INDEX].property_name, DBUS_TYPE_UINT32, &p->index);
-    pa_dbus_append_basic_variant_dict_entry(&dict_iter, property_handlers[PROPERTY_HANDLER_NAME].property_name, DBUS_TYPE_STRING, &p->port->name);
-    pa_dbus_append_basic_variant_dict_entry(&dict_iter, property_handlers[PROPERTY_HANDLER_DESCRIPTION].property_name, DBUS_TYPE_STRING, &p->port->description);
-    pa_dbus_append_basic_variant_dict_entry(&dict_iter, property_handlers[PROPERTY_HANDLER_PRIORITY].property_name, DBUS_TYPE_UINT32, &priority);
-
-    pa_assert_se(dbus_message_iter_close_container(&msg_iter, &dict_iter));
-
-    pa_assert_se(dbus_connection_send(conn, reply, NULL));
-    dbus_message_unref(reply);
+    pa_dbus_append_basic_variant_dict_entry(dict_iter, property_handlers[PROPERTY_HANDLER_INDEX].property_name, DBUS_TYPE_UINT32, &p->index);
+    pa_dbus_append_basic_variant_dict_entry(dict_iter, property_handlers[PROPERTY_HANDLER_NAME].property_name, DBUS_TYPE_STRING, &p->port->name);
+    pa_dbus_append_basic_variant_dict_entry(dict_iter, property_handlers[PROPERTY_HANDLER_DESCRIPTION].property_name, DBUS_TYPE_STRING, &p->port->description);
+    pa_dbus_append_basic_variant_dict_entry(dict_iter, property_handlers[PROPERTY_HANDLER_PRIORITY].property_name, DBUS_TYPE_UINT32, &priority);
 }
 
 pa_dbusiface_device_port *pa_dbusiface_device_port_new(
@@ -1115,7 +1115,7 @@ static void subscription_cb(pa_core *c, pa_subscription_event_type_t t, uint32_t
                                               DBUS_TYPE_ARRAY, DBUS_TYPE_UINT32, &volume_ptr, d->volume.channels,
                                               DBUS_TYPE_INVALID));
 
-        pa_dbus_protocol_send_signal(d->dbus_protocol, signal_msg);
+        pa_dbus_protocol_send_signal_batched(d->dbus_protocol, signal_msg);
         dbus_message_unref(signal_msg);
         signal_msg = NULL;
     }
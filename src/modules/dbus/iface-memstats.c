@@ -25,9 +25,11 @@
 
 #include <dbus/dbus.h>
 
+#include <pulsecore/client.h>
 #include <pulsecore/core-scache.h>
 #include <pulsecore/core-util.h>
 #include <pulsecore/dbus-util.h>
+#include <pulsecore/module.h>
 #include <pulsecore/protocol-dbus.h>
 
 #include "iface-memstats.h"
@@ -39,9 +41,15 @@ static void handle_get_current_memblocks_size(DBusConnection *conn, DBusMessage
 static void handle_get_accumulated_memblocks(DBusConnection *conn, DBusMessage *msg, void *userdata);
 static void handle_get_accumulated_memblocks_size(DBusConnection *conn, DBusMessage *msg, void *userdata);
 static void handle_get_sample_cache_size(DBusConnection *conn, DBusMessage *msg, void *userdata);
+static void handle_get_page_size(DBusConnection *conn, DBusMessage *msg, void *userdata);
+static void handle_get_locked(DBusConnection *conn, DBusMessage *msg, void *userdata);
 
 static void handle_get_all(DBusConnection *conn, DBusMessage *msg, void *userdata);
 
+static void handle_get_core_memory(DBusConnection *conn, DBusMessage *msg, void *userdata);
+static void handle_get_module_memory(DBusConnection *conn, DBusMessage *msg, void *userdata);
+static void handle_get_client_memory(DBusConnection *conn, DBusMessage *msg, void *userdata);
+
 struct pa_dbusiface_memstats {
     pa_core *core;
     char *path;
@@ -54,6 +62,8 @@ enum property_handler_index {
     PROPERTY_HANDLER_ACCUMULATED_MEMBLOCKS,
     PROPERTY_HANDLER_ACCUMULATED_MEMBLOCKS_SIZE,
     PROPERTY_HANDLER_SAMPLE_CACHE_SIZE,
+    PROPERTY_HANDLER_PAGE_SIZE,
+    PROPERTY_HANDLER_LOCKED,
     PROPERTY_HANDLER_MAX
 };
 
@@ -62,13 +72,44 @@ static pa_dbus_property_handler property_handlers[PROPERTY_HANDLER_MAX] = {
     [PROPERTY_HANDLER_CURRENT_MEMBLOCKS_SIZE]     = { .property_name = "CurrentMemblocksSize",     .type = "u", .get_cb = handle_get_current_memblocks_size,     .set_cb = NULL },
     [PROPERTY_HANDLER_ACCUMULATED_MEMBLOCKS]      = { .property_name = "AccumulatedMemblocks",     .type = "u", .get_cb = handle_get_accumulated_memblocks,      .set_cb = NULL },
     [PROPERTY_HANDLER_ACCUMULATED_MEMBLOCKS_SIZE] = { .property_name = "AccumulatedMemblocksSize", .type = "u", .get_cb = handle_get_accumulated_memblocks_size, .set_cb = NULL },
-    [PROPERTY_HANDLER_SAMPLE_CACHE_SIZE]          = { .property_name = "SampleCacheSize",          .type = "u", .get_cb = handle_get_sample_cache_size,          .set_cb = NULL }
+    [PROPERTY_HANDLER_SAMPLE_CACHE_SIZE]          = { .property_name = "SampleCacheSize",          .type = "u", .get_cb = handle_get_sample_cache_size,          .set_cb = NULL },
+    [PROPERTY_HANDLER_PAGE_SIZE]                  = { .property_name = "PageSize",                 .type = "u", .get_cb = handle_get_page_size,                  .set_cb = NULL },
+    [PROPERTY_HANDLER_LOCKED]                     = { .property_name = "Locked",                   .type = "b", .get_cb = handle_get_locked,                     .set_cb = NULL }
+};
+
+enum method_handler_index {
+    METHOD_HANDLER_GET_CORE_MEMORY,
+    METHOD_HANDLER_GET_MODULE_MEMORY,
+    METHOD_HANDLER_GET_CLIENT_MEMORY,
+    METHOD_HANDLER_MAX
+};
+
+static pa_dbus_arg_info get_core_memory_args[] = { { "memory", "a{st}", "out" } };
+static pa_dbus_arg_info get_module_memory_args[] = { { "index", "u", "in" }, { "memory", "a{st}", "out" } };
+static pa_dbus_arg_info get_client_memory_args[] = { { "index", "u", "in" }, { "memory", "a{st}", "out" } };
+
+static pa_dbus_method_handler method_handlers[METHOD_HANDLER_MAX] = {
+    [METHOD_HANDLER_GET_CORE_MEMORY] = {
+        .method_name = "GetCoreMemory",
+        .arguments = get_core_memory_args,
+        .n_arguments = sizeof(get_core_memory_args) / sizeof(pa_dbus_arg_info),
+        .receive_cb = handle_get_core_memory },
+    [METHOD_HANDLER_GET_MODULE_MEMORY] = {
+        .method_name = "GetModuleMemory",
+        .arguments = get_module_memory_args,
+        .n_arguments = sizeof(get_module_memory_args) / sizeof(pa_dbus_arg_info),
+        .receive_cb = handle_get_module_memory },
+    [METHOD_HANDLER_GET_CLIENT_MEMORY] = {
+        .method_name = "GetClientMemory",
+        .arguments = get_client_memory_args,
+        .n_arguments = sizeof(get_client_memory_args) / sizeof(pa_dbus_arg_info),
+        .receive_cb = handle_get_client_memory }
 };
 
 static pa_dbus_interface_info memstats_interface_info = {
     .name = PA_DBUSIFACE_MEMSTATS_INTERFACE,
-    .method_handlers = NULL,
-    .n_method_handlers = 0,
+    .method_handlers = method_handlers,
+    .n_method_handlers = METHOD_HANDLER_MAX,
     .property_handlers = property_handlers,
     .n_property_handlers = PROPERTY_HANDLER_MAX,
     .get_all_properties_cb = handle_get_all,
@@ -153,6 +194,32 @@ static void handle_get_sample_cache_size(DBusConnection *conn, DBusMessage *msg,
     pa_dbus_send_basic_variant_reply(conn, msg, DBUS_TYPE_UINT32, &sample_cache_size);
 }
 
+static void handle_get_page_size(DBusConnection *conn, DBusMessage *msg, void *userdata) {
+    pa_dbusiface_memstats *m = userdata;
+    dbus_uint32_t page_size;
+
+    pa_assert(conn);
+    pa_assert(msg);
+    pa_assert(m);
+
+    page_size = (dbus_uint32_t) pa_mempool_get_page_size(m->core->mempool);
+
+    pa_dbus_send_basic_variant_reply(conn, msg, DBUS_TYPE_UINT32, &page_size);
+}
+
+static void handle_get_locked(DBusConnection *conn, DBusMessage *msg, void *userdata) {
+    pa_dbusiface_memstats *m = userdata;
+    dbus_bool_t locked;
+
+    pa_assert(conn);
+    pa_assert(msg);
+    pa_assert(m);
+
+    locked = pa_mempool_is_locked(m->core->mempool);
+
+    pa_dbus_send_basic_variant_reply(conn, msg, DBUS_TYPE_BOOLEAN, &locked);
+}
+
 static void handle_get_all(DBusConnection *conn, DBusMessage *msg, void *userdata) {
     pa_dbusiface_memstats *m = userdata;
     const pa_mempool_stat *stat;
@@ -161,6 +228,8 @@ static void handle_get_all(DBusConnection *conn, DBusMessage *msg, void *userdat
     dbus_uint32_t accumulated_memblocks;
     dbus_uint32_t accumulated_memblocks_size;
     dbus_uint32_t sample_cache_size;
+    dbus_uint32_t page_size;
+    dbus_bool_t locked;
     DBusMessage *reply = NULL;
     DBusMessageIter msg_iter;
     DBusMessageIter dict_iter;
@@ -176,6 +245,8 @@ static void handle_get_all(DBusConnection *conn, DBusMessage *msg, void *userdat
     accumulated_memblocks = pa_atomic_load(&stat->n_accumulated);
     accumulated_memblocks_size = pa_atomic_load(&stat->accumulated_size);
     sample_cache_size = pa_scache_total_size(m->core);
+    page_size = (dbus_uint32_t) pa_mempool_get_page_size(m->core->mempool);
+    locked = pa_mempool_is_locked(m->core->mempool);
 
     pa_assert_se((reply = dbus_message_new_method_return(msg)));
 
@@ -187,6 +258,44 @@ static void handle_get_all(DBusConnection *conn, DBusMessage *msg, void *userdat
     pa_dbus_append_basic_variant_dict_entry(&dict_iter, property_handlers[PROPERTY_HANDLER_ACCUMULATED_MEMBLOCKS].property_name, DBUS_TYPE_UINT32, &accumulated_memblocks);
     pa_dbus_append_basic_variant_dict_entry(&dict_iter, property_handlers[PROPERTY_HANDLER_ACCUMULATED_MEMBLOCKS_SIZE].property_name, DBUS_TYPE_UINT32, &accumulated_memblocks_size);
     pa_dbus_append_basic_variant_dict_entry(&dict_iter, property_handlers[PROPERTY_HANDLER_SAMPLE_CACHE_SIZE].property_name, DBUS_TYPE_UINT32, &sample_cache_size);
+    pa_dbus_append_basic_variant_dict_entry(&dict_iter, property_handlers[PROPERTY_HANDLER_PAGE_SIZE].property_name, DBUS_TYPE_UINT32, &page_size);
+    pa_dbus_append_basic_variant_dict_entry(&dict_iter, property_handlers[PROPERTY_HANDLER_LOCKED].property_name, DBUS_TYPE_BOOLEAN, &locked);
+
+    pa_assert_se(dbus_message_iter_close_container(&msg_iter, &dict_iter));
+
+    pa_assert_se(dbus_connection_send(conn, reply, NULL));
+
+    dbus_message_unref(reply);
+}
+
+static void send_memory_reply(DBusConnection *conn, DBusMessage *msg, pa_memowner *owner) {
+    DBusMessage *reply = NULL;
+    DBusMessageIter msg_iter;
+    DBusMessageIter dict_iter;
+    uint64_t values[PA_MEMOWNER_STAT_MAX];
+    unsigned k;
+
+    pa_assert(conn);
+    pa_assert(msg);
+    pa_assert(owner);
+
+    pa_memowner_get_all(owner, values);
+
+    pa_assert_se((reply = dbus_message_new_method_return(msg)));
+
+    dbus_message_iter_init_append(reply, &msg_iter);
+    pa_assert_se(dbus_message_iter_open_container(&msg_iter, DBUS_TYPE_ARRAY, "{st}", &dict_iter));
+
+    for (k = 0; k < PA_MEMOWNER_STAT_MAX; k++) {
+        DBusMessageIter entry_iter;
+        const char *name = pa_memowner_stat_to_string(k);
+        dbus_uint64_t value = values[k];
+
+        pa_assert_se(dbus_message_iter_open_container(&dict_iter, DBUS_TYPE_DICT_ENTRY, NULL, &entry_iter));
+        pa_assert_se(dbus_message_iter_append_basic(&entry_iter, DBUS_TYPE_STRING, &name));
+        pa_assert_se(dbus_message_iter_append_basic(&entry_iter, DBUS_TYPE_UINT64, &value));
+        pa_assert_se(dbus_message_iter_close_container(&dict_iter, &entry_iter));
+    }
 
     pa_assert_se(dbus_message_iter_close_container(&msg_iter, &dict_iter));
 
@@ -195,6 +304,54 @@ static void handle_get_all(DBusConnection *conn, DBusMessage *msg, void *userdat
     dbus_message_unref(reply);
 }
 
+static void handle_get_core_memory(DBusConnection *conn, DBusMessage *msg, void *userdata) {
+    pa_dbusiface_memstats *m = userdata;
+
+    pa_assert(conn);
+    pa_assert(msg);
+    pa_assert(m);
+
+    send_memory_reply(conn, msg, m->core->memowner);
+}
+
+static void handle_get_module_memory(DBusConnection *conn, DBusMessage *msg, void *userdata) {
+    pa_dbusiface_memstats *m = userdata;
+    dbus_uint32_t idx;
+    pa_module *module;
+
+    pa_assert(conn);
+    pa_assert(msg);
+    pa_assert(m);
+
+    pa_assert_se(dbus_message_get_args(msg, NULL, DBUS_TYPE_UINT32, &idx, DBUS_TYPE_INVALID));
+
+    if (!(module = pa_idxset_get_by_index(m->core->modules, idx))) {
+        pa_dbus_send_error(conn, msg, PA_DBUS_ERROR_NOT_FOUND, "%u: No such module.", idx);
+        return;
+    }
+
+    send_memory_reply(conn, msg, module->memowner);
+}
+
+static void handle_get_client_memory(DBusConnection *conn, DBusMessage *msg, void *userdata) {
+    pa_dbusiface_memstats *m = userdata;
+    dbus_uint32_t idx;
+    pa_client *client;
+
+    pa_assert(conn);
+    pa_assert(msg);
+    pa_assert(m);
+
+    pa_assert_se(dbus_message_get_args(msg, NULL, DBUS_TYPE_UINT32, &idx, DBUS_TYPE_INVALID));
+
+    if (!(client = pa_idxset_get_by_index(m->core->clients, idx))) {
+        pa_dbus_send_error(conn, msg, PA_DBUS_ERROR_NOT_FOUND, "%u: No such client.", idx);
+        return;
+    }
+
+    send_memory_reply(conn, msg, client->memowner);
+}
+
 pa_dbusiface_memstats *pa_dbusiface_memstats_new(pa_dbusiface_core *dbus_core, pa_core *core) {
     pa_dbusiface_memstats *m;
 
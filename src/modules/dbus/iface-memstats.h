@@ -26,6 +26,12 @@
  *
  * See http://pulseaudio.org/wiki/DBusInterface for the Memstats interface
  * documentation.
+ *
+ * On top of that GetCoreMemory(), GetModuleMemory() and GetClientMemory()
+ * tell what is charged to the core, or to the module or client with the
+ * given index, see pa_memowner. They return a dictionary from the value
+ * name ("allocated", "allocated-bytes", "imported", "imported-bytes",
+ * "exported", "exported-bytes") to the value.
  */
 
 #include <pulsecore/core.h>
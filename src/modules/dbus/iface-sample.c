@@ -53,7 +53,7 @@ static void handle_get_duration(DBusConnection *conn, DBusMessage *msg, void *us
 static void handle_get_bytes(DBusConnection *conn, DBusMessage *msg, void *userdata);
 static void handle_get_property_list(DBusConnection *conn, DBusMessage *msg, void *userdata);
 
-static void handle_get_all(DBusConnection *conn, DBusMessage *msg, void *userdata);
+static void append_all(DBusMessageIter *dict_iter, void *userdata);
 
 static void handle_play(DBusConnection *conn, DBusMessage *msg, void *userdata);
 static void handle_play_to_sink(DBusConnection *conn, DBusMessage *msg, void *userdata);
@@ -131,7 +131,8 @@ static pa_dbus_interface_info sample_interface_info = {
     .n_method_handlers = METHOD_HANDLER_MAX,
     .property_handlers = property_handlers,
     .n_property_handlers = PROPERTY_HANDLER_MAX,
-    .get_all_properties_cb = handle_get_all,
+    .get_all_properties_cb = NULL,
+    .append_all_properties_cb = append_all,
     .signals = signals,
     .n_signals = SIGNAL_MAX
 };
@@ -287,11 +288,8 @@ static void handle_get_property_list(DBusConnection *conn, DBusMessage *msg, voi
     pa_dbus_send_proplist_variant_reply(conn, msg, s->proplist);
 }
 
-static void handle_get_all(DBusConnection *conn, DBusMessage *msg, void *userdata) {
+static void append_all(DBusMessageIter *dict_iter, void *userdata) {
     pa_dbusiface_sample *s = userdata;
-    DBusMessage *reply = NULL;
-    DBusMessageIter msg_iter;
-    DBusMessageIter dict_iter;
     dbus_uint32_t idx = 0;
     dbus_uint32_t sample_format = 0;
     dbus_uint32_t sample_rate = 0;
@@ -301,8 +299,7 @@ static void handle_get_all(DBusConnection *conn, DBusMessage *msg, void *userdat
     dbus_uint32_t bytes = 0;
     unsigned i = 0;
 
-    pa_assert(conn);
-    pa_assert(msg);
+    pa_assert(dict_iter);
     pa_assert(s);
 
     idx = s->sample->index;
@@ -319,33 +316,24 @@ static void handle_get_all(DBusConnection *conn, DBusMessage *msg, void *userdat
             default_volume[i] = s->sample->volume.values[i];
     }
 
-    pa_assert_se((reply = dbus_message_new_method_return(msg)));
-
-    dbus_message_iter_init_append(reply, &msg_iter);
-    pa_assert_se(dbus_message_iter_open_container(&msg_iter, DBUS_TYPE_ARRAY, "{sv}", &dict_iter));
-
-    pa_dbus_append_basic_variant_dict_entry(&dict_iter, property_handlers[PROPERTY_HANDLER_INDEX].property_name, DBUS_TYPE_UINT32, &idx);
-    pa_dbus_append_basic_variant_dict_entry(&dict_iter, property_handlers[PROPERTY_HANDLER_NAME].property_name, DBUS_TYPE_STRING, &s->sample->name);
+    pa_dbus_append_basic_variant_dict_entry(dict_iter, property_handlers[PROPERTY_HANDLER_INDEX].property_name, DBUS_TYPE_UINT32, &idx);
+    pa_dbus_append_basic_variant_dict_entry(dict_iter, property_handlers[PROPERTY_HANDLER_NAME].property_name, DBUS_TYPE_STRING, &s->sample->name);
 
     if (s->sample->memchunk.memblock) {
-        pa_dbus_append_basic_variant_dict_entry(&dict_iter, property_handlers[PROPERTY_HANDLER_SAMPLE_FORMAT].property_name, DBUS_TYPE_UINT32, &sample_format);
-        pa_dbus_append_basic_variant_dict_entry(&dict_iter, property_handlers[PROPERTY_HANDLER_SAMPLE_RATE].property_name, DBUS_TYPE_UINT32, &sample_rate);
-        pa_dbus_append_basic_array_variant_dict_entry(&dict_iter, property_handlers[PROPERTY_HANDLER_CHANNELS].property_name, DBUS_TYPE_UINT32, channels, s->sample->channel_map.channels);
+        pa_dbus_append_basic_variant_dict_entry(dict_iter, property_handlers[PROPERTY_HANDLER_SAMPLE_FORMAT].property_name, DBUS_TYPE_UINT32, &sample_format);
+        pa_dbus_append_basic_variant_dict_entry(dict_iter, property_handlers[PROPERTY_HANDLER_SAMPLE_RATE].property_name, DBUS_TYPE_UINT32, &sample_rate);
+        pa_dbus_append_basic_array_variant_dict_entry(dict_iter, property_handlers[PROPERTY_HANDLER_CHANNELS].property_name, DBUS_TYPE_UINT32, channels, s->sample->channel_map.channels);
     }
 
     if (s->sample->volume_is_set)
-        pa_dbus_append_basic_array_variant_dict_entry(&dict_iter, property_handlers[PROPERTY_HANDLER_DEFAULT_VOLUME].property_name, DBUS_TYPE_UINT32, default_volume, s->sample->volume.channels);
+        pa_dbus_append_basic_array_variant_dict_entry(dict_iter, property_handlers[PROPERTY_HANDLER_DEFAULT_VOLUME].property_name, DBUS_TYPE_UINT32, default_volume, s->sample->volume.channels);
 
     if (s->sample->memchunk.memblock) {
-        pa_dbus_append_basic_variant_dict_entry(&dict_iter, property_handlers[PROPERTY_HANDLER_DURATION].property_name, DBUS_TYPE_UINT64, &duration);
-        pa_dbus_append_basic_variant_dict_entry(&dict_iter, property_handlers[PROPERTY_HANDLER_BYTES].property_name, DBUS_TYPE_UINT32, &bytes);
+        pa_dbus_append_basic_variant_dict_entry(dict_iter, property_handlers[PROPERTY_HANDLER_DURATION].property_name, DBUS_TYPE_UINT64, &duration);
+        pa_dbus_append_basic_variant_dict_entry(dict_iter, property_handlers[PROPERTY_HANDLER_BYTES].property_name, DBUS_TYPE_UINT32, &bytes);
     }
 
-    pa_dbus_append_proplist_variant_dict_entry(&dict_iter, property_handlers[PROPERTY_HANDLER_PROPERTY_LIST].property_name, s->proplist);
-
-    pa_assert_se(dbus_message_iter_close_container(&msg_iter, &dict_iter));
-    pa_assert_se(dbus_connection_send(conn, reply, NULL));
-    dbus_message_unref(reply);
+    pa_dbus_append_proplist_variant_dict_entry(dict_iter, property_handlers[PROPERTY_HANDLER_PROPERTY_LIST].property_name, s->proplist);
 }
 
 static void handle_play(DBusConnection *conn, DBusMessage *msg, void *userdata) {
@@ -463,6 +451,9 @@ static void subscription_cb(pa_core *c, pa_subscription_event_type_t t, uint32_t
     if ((t & PA_SUBSCRIPTION_EVENT_TYPE_MASK) != PA_SUBSCRIPTION_EVENT_CHANGE)
         return;
 
+    /* The sample may have been replaced with different data */
+    pa_dbus_protocol_invalidate_properties(s->dbus_protocol, s->path, PA_DBUSIFACE_SAMPLE_INTERFACE);
+
     if (!pa_proplist_equal(s->proplist, s->sample->proplist)) {
         DBusMessageIter msg_iter;
 
@@ -0,0 +1,509 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <dbus/dbus.h>
+
+#include <pulsecore/core-util.h>
+#include <pulsecore/dbus-util.h>
+#include <pulsecore/io-counters.h>
+#include <pulsecore/namereg.h>
+#include <pulsecore/protocol-dbus.h>
+#include <pulsecore/render-stats.h>
+#include <pulsecore/sink-input.h>
+#include <pulsecore/source-output.h>
+
+#include "iface-stats.h"
+
+#define OBJECT_NAME "stats"
+
+static void handle_get_enabled(DBusConnection *conn, DBusMessage *msg, void *userdata);
+
+static void handle_get_all(DBusConnection *conn, DBusMessage *msg, void *userdata);
+
+static void handle_get_sink_stats(DBusConnection *conn, DBusMessage *msg, void *userdata);
+static void handle_get_source_stats(DBusConnection *conn, DBusMessage *msg, void *userdata);
+static void handle_get_sink_counters(DBusConnection *conn, DBusMessage *msg, void *userdata);
+static void handle_get_source_counters(DBusConnection *conn, DBusMessage *msg, void *userdata);
+static void handle_get_playback_stream_counters(DBusConnection *conn, DBusMessage *msg, void *userdata);
+static void handle_get_record_stream_counters(DBusConnection *conn, DBusMessage *msg, void *userdata);
+static void handle_reset_counters(DBusConnection *conn, DBusMessage *msg, void *userdata);
+static void handle_get_main_thread_usage(DBusConnection *conn, DBusMessage *msg, void *userdata);
+
+struct pa_dbusiface_stats {
+    pa_core *core;
+    char *path;
+    pa_dbus_protocol *dbus_protocol;
+};
+
+enum property_handler_index {
+    PROPERTY_HANDLER_ENABLED,
+    PROPERTY_HANDLER_MAX
+};
+
+static pa_dbus_property_handler property_handlers[PROPERTY_HANDLER_MAX] = {
+    [PROPERTY_HANDLER_ENABLED] = { .property_name = "Enabled", .type = "b", .get_cb = handle_get_enabled, .set_cb = NULL }
+};
+
+enum method_handler_index {
+    METHOD_HANDLER_GET_SINK_STATS,
+    METHOD_HANDLER_GET_SOURCE_STATS,
+    METHOD_HANDLER_GET_SINK_COUNTERS,
+    METHOD_HANDLER_GET_SOURCE_COUNTERS,
+    METHOD_HANDLER_GET_PLAYBACK_STREAM_COUNTERS,
+    METHOD_HANDLER_GET_RECORD_STREAM_COUNTERS,
+    METHOD_HANDLER_RESET_COUNTERS,
+    METHOD_HANDLER_GET_MAIN_THREAD_USAGE,
+    METHOD_HANDLER_MAX
+};
+
+static pa_dbus_arg_info get_sink_stats_args[] = { { "name", "s", "in" }, { "stats", "a{s(utta(tu))}", "out" } };
+static pa_dbus_arg_info get_source_stats_args[] = { { "name", "s", "in" }, { "stats", "a{s(utta(tu))}", "out" } };
+static pa_dbus_arg_info get_sink_counters_args[] = { { "name", "s", "in" }, { "counters", "a{st}", "out" } };
+static pa_dbus_arg_info get_source_counters_args[] = { { "name", "s", "in" }, { "counters", "a{st}", "out" } };
+static pa_dbus_arg_info get_playback_stream_counters_args[] = { { "index", "u", "in" }, { "counters", "a{st}", "out" } };
+static pa_dbus_arg_info get_record_stream_counters_args[] = { { "index", "u", "in" }, { "counters", "a{st}", "out" } };
+static pa_dbus_arg_info get_main_thread_usage_args[] = { { "usage", "a(susttt)", "out" } };
+
+static pa_dbus_method_handler method_handlers[METHOD_HANDLER_MAX] = {
+    [METHOD_HANDLER_GET_SINK_STATS] = {
+        .method_name = "GetSinkStats",
+        .arguments = get_sink_stats_args,
+        .n_arguments = sizeof(get_sink_stats_args) / sizeof(pa_dbus_arg_info),
+        .receive_cb = handle_get_sink_stats },
+    [METHOD_HANDLER_GET_SOURCE_STATS] = {
+        .method_name = "GetSourceStats",
+        .arguments = get_source_stats_args,
+        .n_arguments = sizeof(get_source_stats_args) / sizeof(pa_dbus_arg_info),
+        .receive_cb = handle_get_source_stats },
+    [METHOD_HANDLER_GET_SINK_COUNTERS] = {
+        .method_name = "GetSinkCounters",
+        .arguments = get_sink_counters_args,
+        .n_arguments = sizeof(get_sink_counters_args) / sizeof(pa_dbus_arg_info),
+        .receive_cb = handle_get_sink_counters },
+    [METHOD_HANDLER_GET_SOURCE_COUNTERS] = {
+        .method_name = "GetSourceCounters",
+        .arguments = get_source_counters_args,
+        .n_arguments = sizeof(get_source_counters_args) / sizeof(pa_dbus_arg_info),
+        .receive_cb = handle_get_source_counters },
+    [METHOD_HANDLER_GET_PLAYBACK_STREAM_COUNTERS] = {
+        .method_name = "GetPlaybackStreamCounters",
+        .arguments = get_playback_stream_counters_args,
+        .n_arguments = sizeof(get_playback_stream_counters_args) / sizeof(pa_dbus_arg_info),
+        .receive_cb = handle_get_playback_stream_counters },
+    [METHOD_HANDLER_GET_RECORD_STREAM_COUNTERS] = {
+        .method_name = "GetRecordStreamCounters",
+        .arguments = get_record_stream_counters_args,
+        .n_arguments = sizeof(get_record_stream_counters_args) / sizeof(pa_dbus_arg_info),
+        .receive_cb = handle_get_record_stream_counters },
+    [METHOD_HANDLER_RESET_COUNTERS] = {
+        .method_name = "ResetCounters",
+        .arguments = NULL,
+        .n_arguments = 0,
+        .receive_cb = handle_reset_counters },
+    [METHOD_HANDLER_GET_MAIN_THREAD_USAGE] = {
+        .method_name = "GetMainThreadUsage",
+        .arguments = get_main_thread_usage_args,
+        .n_arguments = sizeof(get_main_thread_usage_args) / sizeof(pa_dbus_arg_info),
+        .receive_cb = handle_get_main_thread_usage }
+};
+
+static pa_dbus_interface_info stats_interface_info = {
+    .name = PA_DBUSIFACE_STATS_INTERFACE,
+    .method_handlers = method_handlers,
+    .n_method_handlers = METHOD_HANDLER_MAX,
+    .property_handlers = property_handlers,
+    .n_property_handlers = PROPERTY_HANDLER_MAX,
+    .get_all_properties_cb = handle_get_all,
+    .signals = NULL,
+    .n_signals = 0
+};
+
+static void handle_get_enabled(DBusConnection *conn, DBusMessage *msg, void *userdata) {
+    pa_dbusiface_stats *s = userdata;
+    dbus_bool_t enabled;
+
+    pa_assert(conn);
+    pa_assert(msg);
+    pa_assert(s);
+
+    enabled = s->core->render_stats;
+
+    pa_dbus_send_basic_variant_reply(conn, msg, DBUS_TYPE_BOOLEAN, &enabled);
+}
+
+static void handle_get_all(DBusConnection *conn, DBusMessage *msg, void *userdata) {
+    pa_dbusiface_stats *s = userdata;
+    dbus_bool_t enabled;
+    DBusMessage *reply = NULL;
+    DBusMessageIter msg_iter;
+    DBusMessageIter dict_iter;
+
+    pa_assert(conn);
+    pa_assert(msg);
+    pa_assert(s);
+
+    enabled = s->core->render_stats;
+
+    pa_assert_se((reply = dbus_message_new_method_return(msg)));
+
+    dbus_message_iter_init_append(reply, &msg_iter);
+    pa_assert_se(dbus_message_iter_open_container(&msg_iter, DBUS_TYPE_ARRAY, "{sv}", &dict_iter));
+
+    pa_dbus_append_basic_variant_dict_entry(&dict_iter, property_handlers[PROPERTY_HANDLER_ENABLED].property_name, DBUS_TYPE_BOOLEAN, &enabled);
+
+    pa_assert_se(dbus_message_iter_close_container(&msg_iter, &dict_iter));
+
+    pa_assert_se(dbus_connection_send(conn, reply, NULL));
+
+    dbus_message_unref(reply);
+}
+
+static void append_histogram(DBusMessageIter *iter, const pa_render_histogram *h) {
+    DBusMessageIter struct_iter;
+    DBusMessageIter array_iter;
+    dbus_uint32_t n;
+    dbus_uint64_t sum, max;
+    unsigned k;
+
+    pa_assert(iter);
+    pa_assert(h);
+
+    n = h->n;
+    sum = h->sum;
+    max = h->max;
+
+    pa_assert_se(dbus_message_iter_open_container(iter, DBUS_TYPE_STRUCT, NULL, &struct_iter));
+    pa_assert_se(dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT32, &n));
+    pa_assert_se(dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64, &sum));
+    pa_assert_se(dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64, &max));
+
+    pa_assert_se(dbus_message_iter_open_container(&struct_iter, DBUS_TYPE_ARRAY, "(tu)", &array_iter));
+
+    for (k = 0; k < PA_RENDER_HISTOGRAM_BUCKETS; k++) {
+        DBusMessageIter bucket_iter;
+        dbus_uint64_t limit;
+        dbus_uint32_t count;
+
+        if ((count = h->buckets[k]) <= 0)
+            continue;
+
+        limit = pa_render_histogram_bucket_limit(k);
+
+        pa_assert_se(dbus_message_iter_open_container(&array_iter, DBUS_TYPE_STRUCT, NULL, &bucket_iter));
+        pa_assert_se(dbus_message_iter_append_basic(&bucket_iter, DBUS_TYPE_UINT64, &limit));
+        pa_assert_se(dbus_message_iter_append_basic(&bucket_iter, DBUS_TYPE_UINT32, &count));
+        pa_assert_se(dbus_message_iter_close_container(&array_iter, &bucket_iter));
+    }
+
+    pa_assert_se(dbus_message_iter_close_container(&struct_iter, &array_iter));
+    pa_assert_se(dbus_message_iter_close_container(iter, &struct_iter));
+}
+
+static void send_stats_reply(DBusConnection *conn, DBusMessage *msg, const pa_render_stats *stats) {
+    DBusMessage *reply = NULL;
+    DBusMessageIter msg_iter;
+    DBusMessageIter dict_iter;
+    unsigned k;
+
+    pa_assert(conn);
+    pa_assert(msg);
+    pa_assert(stats);
+
+    pa_assert_se((reply = dbus_message_new_method_return(msg)));
+
+    dbus_message_iter_init_append(reply, &msg_iter);
+    pa_assert_se(dbus_message_iter_open_container(&msg_iter, DBUS_TYPE_ARRAY, "{s(utta(tu))}", &dict_iter));
+
+    for (k = 0; k < PA_RENDER_STAT_MAX; k++) {
+        DBusMessageIter entry_iter;
+        const char *name = pa_render_stat_to_string(k);
+
+        pa_assert_se(dbus_message_iter_open_container(&dict_iter, DBUS_TYPE_DICT_ENTRY, NULL, &entry_iter));
+        pa_assert_se(dbus_message_iter_append_basic(&entry_iter, DBUS_TYPE_STRING, &name));
+        append_histogram(&entry_iter, &stats->histograms[k]);
+        pa_assert_se(dbus_message_iter_close_container(&dict_iter, &entry_iter));
+    }
+
+    pa_assert_se(dbus_message_iter_close_container(&msg_iter, &dict_iter));
+
+    pa_assert_se(dbus_connection_send(conn, reply, NULL));
+
+    dbus_message_unref(reply);
+}
+
+static void handle_get_sink_stats(DBusConnection *conn, DBusMessage *msg, void *userdata) {
+    pa_dbusiface_stats *s = userdata;
+    char *sink_name;
+    pa_sink *sink;
+
+    pa_assert(conn);
+    pa_assert(msg);
+    pa_assert(s);
+
+    pa_assert_se(dbus_message_get_args(msg, NULL, DBUS_TYPE_STRING, &sink_name, DBUS_TYPE_INVALID));
+
+    if (!(sink = pa_namereg_get(s->core, sink_name, PA_NAMEREG_SINK))) {
+        pa_dbus_send_error(conn, msg, PA_DBUS_ERROR_NOT_FOUND, "%s: No such sink.", sink_name);
+        return;
+    }
+
+    if (!sink->render_stats) {
+        pa_dbus_send_error(conn, msg, PA_DBUS_ERROR_NOT_FOUND, "%s: No render statistics, enable-render-stats is not set.", sink_name);
+        return;
+    }
+
+    send_stats_reply(conn, msg, sink->render_stats);
+}
+
+static void handle_get_source_stats(DBusConnection *conn, DBusMessage *msg, void *userdata) {
+    pa_dbusiface_stats *s = userdata;
+    char *source_name;
+    pa_source *source;
+
+    pa_assert(conn);
+    pa_assert(msg);
+    pa_assert(s);
+
+    pa_assert_se(dbus_message_get_args(msg, NULL, DBUS_TYPE_STRING, &source_name, DBUS_TYPE_INVALID));
+
+    if (!(source = pa_namereg_get(s->core, source_name, PA_NAMEREG_SOURCE))) {
+        pa_dbus_send_error(conn, msg, PA_DBUS_ERROR_NOT_FOUND, "%s: No such source.", source_name);
+        return;
+    }
+
+    if (!source->render_stats) {
+        pa_dbus_send_error(conn, msg, PA_DBUS_ERROR_NOT_FOUND, "%s: No render statistics, enable-render-stats is not set.", source_name);
+        return;
+    }
+
+    send_stats_reply(conn, msg, source->render_stats);
+}
+
+static void send_counters_reply(DBusConnection *conn, DBusMessage *msg, const pa_io_counters *counters) {
+    DBusMessage *reply = NULL;
+    DBusMessageIter msg_iter;
+    DBusMessageIter dict_iter;
+    uint64_t values[PA_IO_COUNTERS_MAX];
+    unsigned k;
+
+    pa_assert(conn);
+    pa_assert(msg);
+    pa_assert(counters);
+
+    pa_io_counters_get_all(counters, values);
+
+    pa_assert_se((reply = dbus_message_new_method_return(msg)));
+
+    dbus_message_iter_init_append(reply, &msg_iter);
+    pa_assert_se(dbus_message_iter_open_container(&msg_iter, DBUS_TYPE_ARRAY, "{st}", &dict_iter));
+
+    for (k = 0; k < PA_IO_COUNTERS_MAX; k++) {
+        DBusMessageIter entry_iter;
+        const char *name = pa_io_counter_to_string(k);
+        dbus_uint64_t value = values[k];
+
+        pa_assert_se(dbus_message_iter_open_container(&dict_iter, DBUS_TYPE_DICT_ENTRY, NULL, &entry_iter));
+        pa_assert_se(dbus_message_iter_append_basic(&entry_iter, DBUS_TYPE_STRING, &name));
+        pa_assert_se(dbus_message_iter_append_basic(&entry_iter, DBUS_TYPE_UINT64, &value));
+        pa_assert_se(dbus_message_iter_close_container(&dict_iter, &entry_iter));
+    }
+
+    pa_assert_se(dbus_message_iter_close_container(&msg_iter, &dict_iter));
+
+    pa_assert_se(dbus_connection_send(conn, reply, NULL));
+
+    dbus_message_unref(reply);
+}
+
+static void handle_get_sink_counters(DBusConnection *conn, DBusMessage *msg, void *userdata) {
+    pa_dbusiface_stats *s = userdata;
+    char *sink_name;
+    pa_sink *sink;
+
+    pa_assert(conn);
+    pa_assert(msg);
+    pa_assert(s);
+
+    pa_assert_se(dbus_message_get_args(msg, NULL, DBUS_TYPE_STRING, &sink_name, DBUS_TYPE_INVALID));
+
+    if (!(sink = pa_namereg_get(s->core, sink_name, PA_NAMEREG_SINK))) {
+        pa_dbus_send_error(conn, msg, PA_DBUS_ERROR_NOT_FOUND, "%s: No such sink.", sink_name);
+        return;
+    }
+
+    send_counters_reply(conn, msg, &sink->thread_info.counters);
+}
+
+static void handle_get_source_counters(DBusConnection *conn, DBusMessage *msg, void *userdata) {
+    pa_dbusiface_stats *s = userdata;
+    char *source_name;
+    pa_source *source;
+
+    pa_assert(conn);
+    pa_assert(msg);
+    pa_assert(s);
+
+    pa_assert_se(dbus_message_get_args(msg, NULL, DBUS_TYPE_STRING, &source_name, DBUS_TYPE_INVALID));
+
+    if (!(source = pa_namereg_get(s->core, source_name, PA_NAMEREG_SOURCE))) {
+        pa_dbus_send_error(conn, msg, PA_DBUS_ERROR_NOT_FOUND, "%s: No such source.", source_name);
+        return;
+    }
+
+    send_counters_reply(conn, msg, &source->thread_info.counters);
+}
+
+static void handle_get_playback_stream_counters(DBusConnection *conn, DBusMessage *msg, void *userdata) {
+    pa_dbusiface_stats *s = userdata;
+    dbus_uint32_t idx;
+    pa_sink_input *i;
+
+    pa_assert(conn);
+    pa_assert(msg);
+    pa_assert(s);
+
+    pa_assert_se(dbus_message_get_args(msg, NULL, DBUS_TYPE_UINT32, &idx, DBUS_TYPE_INVALID));
+
+    if (!(i = pa_idxset_get_by_index(s->core->sink_inputs, idx))) {
+        pa_dbus_send_error(conn, msg, PA_DBUS_ERROR_NOT_FOUND, "%u: No such playback stream.", idx);
+        return;
+    }
+
+    send_counters_reply(conn, msg, &i->thread_info.counters);
+}
+
+static void handle_get_record_stream_counters(DBusConnection *conn, DBusMessage *msg, void *userdata) {
+    pa_dbusiface_stats *s = userdata;
+    dbus_uint32_t idx;
+    pa_source_output *o;
+
+    pa_assert(conn);
+    pa_assert(msg);
+    pa_assert(s);
+
+    pa_assert_se(dbus_message_get_args(msg, NULL, DBUS_TYPE_UINT32, &idx, DBUS_TYPE_INVALID));
+
+    if (!(o = pa_idxset_get_by_index(s->core->source_outputs, idx))) {
+        pa_dbus_send_error(conn, msg, PA_DBUS_ERROR_NOT_FOUND, "%u: No such record stream.", idx);
+        return;
+    }
+
+    send_counters_reply(conn, msg, &o->thread_info.counters);
+}
+
+static void handle_reset_counters(DBusConnection *conn, DBusMessage *msg, void *userdata) {
+    pa_dbusiface_stats *s = userdata;
+    pa_sink *sink;
+    pa_source *source;
+    uint32_t idx;
+
+    pa_assert(conn);
+    pa_assert(msg);
+    pa_assert(s);
+
+    PA_IDXSET_FOREACH(sink, s->core->sinks, idx)
+        pa_sink_reset_counters(sink);
+
+    PA_IDXSET_FOREACH(source, s->core->sources, idx)
+        pa_source_reset_counters(source);
+
+    pa_dbus_send_empty_reply(conn, msg);
+}
+
+static void handle_get_main_thread_usage(DBusConnection *conn, DBusMessage *msg, void *userdata) {
+    pa_dbusiface_stats *s = userdata;
+    DBusMessage *reply = NULL;
+    DBusMessageIter msg_iter;
+    DBusMessageIter array_iter;
+    pa_core_cpu_usage *u;
+    unsigned n, k;
+
+    pa_assert(conn);
+    pa_assert(msg);
+    pa_assert(s);
+
+    u = pa_core_get_cpu_usage(s->core, &n);
+
+    pa_assert_se((reply = dbus_message_new_method_return(msg)));
+
+    dbus_message_iter_init_append(reply, &msg_iter);
+    pa_assert_se(dbus_message_iter_open_container(&msg_iter, DBUS_TYPE_ARRAY, "(susttt)", &array_iter));
+
+    for (k = 0; k < n; k++) {
+        DBusMessageIter struct_iter;
+        dbus_uint32_t index = u[k].index;
+        dbus_uint64_t usec = pa_cpu_account_get_usec(u[k].account);
+        dbus_uint64_t max_usec = pa_cpu_account_get_max_usec(u[k].account);
+        dbus_uint64_t dispatched = pa_cpu_account_get_dispatched(u[k].account);
+
+        pa_assert_se(dbus_message_iter_open_container(&array_iter, DBUS_TYPE_STRUCT, NULL, &struct_iter));
+        pa_assert_se(dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING, &u[k].type));
+        pa_assert_se(dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT32, &index));
+        pa_assert_se(dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_STRING, &u[k].name));
+        pa_assert_se(dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64, &usec));
+        pa_assert_se(dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64, &max_usec));
+        pa_assert_se(dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64, &dispatched));
+        pa_assert_se(dbus_message_iter_close_container(&array_iter, &struct_iter));
+    }
+
+    pa_assert_se(dbus_message_iter_close_container(&msg_iter, &array_iter));
+
+    pa_assert_se(dbus_connection_send(conn, reply, NULL));
+
+    dbus_message_unref(reply);
+    pa_xfree(u);
+}
+
+pa_dbusiface_stats *pa_dbusiface_stats_new(pa_dbusiface_core *dbus_core, pa_core *core) {
+    pa_dbusiface_stats *s;
+
+    pa_assert(dbus_core);
+    pa_assert(core);
+
+    s = pa_xnew(pa_dbusiface_stats, 1);
+    s->core = core;
+    s->path = pa_sprintf_malloc("%s/%s", PA_DBUS_CORE_OBJECT_PATH, OBJECT_NAME);
+    s->dbus_protocol = pa_dbus_protocol_get(core);
+
+    pa_assert_se(pa_dbus_protocol_add_interface(s->dbus_protocol, s->path, &stats_interface_info, s) >= 0);
+
+    return s;
+}
+
+void pa_dbusiface_stats_free(pa_dbusiface_stats *s) {
+    pa_assert(s);
+
+    pa_assert_se(pa_dbus_protocol_remove_interface(s->dbus_protocol, s->path, stats_interface_info.name) >= 0);
+
+    pa_xfree(s->path);
+
+    pa_dbus_protocol_unref(s->dbus_protocol);
+
+    pa_xfree(s);
+}
+
+const char *pa_dbusiface_stats_get_path(pa_dbusiface_stats *s) {
+    pa_assert(s);
+
+    return s->path;
+}
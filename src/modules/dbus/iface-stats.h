@@ -0,0 +1,61 @@
+#ifndef foodbusifacestatshfoo
+#define foodbusifacestatshfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+/* This object implements the D-Bus interface org.PulseAudio.Core1.Stats.
+ *
+ * It gives access to the render-cycle histograms of the sinks and
+ * sources, which are only kept when enable-render-stats is set in
+ * daemon.conf. GetSinkStats() and GetSourceStats() take a device name
+ * and return a dictionary from the histogram name ("cycle", "peek",
+ * "resample", "wakeup-lateness") to a struct of the number of samples,
+ * their sum and maximum in usec, and an array of the non-empty buckets
+ * as pairs of the bucket's exclusive upper limit in usec and count.
+ *
+ * The error counters are always kept. GetSinkCounters() and
+ * GetSourceCounters() take a device name, GetPlaybackStreamCounters()
+ * and GetRecordStreamCounters() a stream index, and return a dictionary
+ * from the counter name ("xruns", "underruns", "overflows", "rewinds",
+ * "rewind-bytes", "max-render-usec") to its value. ResetCounters()
+ * resets the counters of all devices and streams.
+ *
+ * GetMainThreadUsage() returns how much time the main thread spent in
+ * the mainloop callbacks of the core, each module and each client,
+ * busiest first, as an array of structs of the type ("core", "module"
+ * or "client"), the index (-1 for the core), the name, the total and
+ * the longest stretch in usec, and the number of callbacks dispatched.
+ */
+
+#include <pulsecore/core.h>
+#include <pulsecore/protocol-dbus.h>
+
+#include "iface-core.h"
+
+#define PA_DBUSIFACE_STATS_INTERFACE PA_DBUS_CORE_INTERFACE ".Stats"
+
+typedef struct pa_dbusiface_stats pa_dbusiface_stats;
+
+pa_dbusiface_stats *pa_dbusiface_stats_new(pa_dbusiface_core *dbus_core, pa_core *core);
+void pa_dbusiface_stats_free(pa_dbusiface_stats *s);
+
+const char *pa_dbusiface_stats_get_path(pa_dbusiface_stats *s);
+
+#endif
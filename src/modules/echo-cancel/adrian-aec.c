@@ -67,6 +67,128 @@ static REAL dotp_sse(REAL a[], REAL b[])
 #endif
 }
 
+/* Tap weight update of the previous sample fused with the dot product
+ * of this one, so w is walked only once per sample. The operations are
+ * those of separate update and dotp() calls, in the same order. */
+static REAL update_dotp(REAL w[], REAL xf[], REAL mikro_ef, REAL x[])
+{
+  REAL sum0 = 0.0f, sum1 = 0.0f;
+  int j;
+
+  for (j = 0; j < NLMS_LEN; j += 2) {
+    w[j] += mikro_ef * xf[j];
+    w[j + 1] += mikro_ef * xf[j + 1];
+    sum0 += w[j] * x[j];
+    sum1 += w[j + 1] * x[j + 1];
+  }
+  return sum0 + sum1;
+}
+
+static REAL update_dotp_sse(REAL w[], REAL xf[], REAL mikro_ef, REAL x[])
+{
+#ifdef __SSE__
+  int j;
+  REAL sum;
+  __m128 acc = _mm_setzero_ps(), m = _mm_set1_ps(mikro_ef);
+
+  for (j=0;j<NLMS_LEN;j+=8)
+  {
+    __m128 w0 = _mm_add_ps(_mm_load_ps(w+j), _mm_mul_ps(m, _mm_loadu_ps(xf+j)));
+    __m128 w1 = _mm_add_ps(_mm_load_ps(w+j+4), _mm_mul_ps(m, _mm_loadu_ps(xf+j+4)));
+
+    _mm_store_ps(w+j, w0);
+    _mm_store_ps(w+j+4, w1);
+    acc = _mm_add_ps(acc, _mm_mul_ps(w0, _mm_loadu_ps(x+j)));
+    acc = _mm_add_ps(acc, _mm_mul_ps(w1, _mm_loadu_ps(x+j+4)));
+  }
+  acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+  acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 0x55));
+  _mm_store_ss(&sum, acc);
+
+  return sum;
+#else
+  return update_dotp(w, xf, mikro_ef, x);
+#endif
+}
+
+// update tap weights (filter learning)
+static void AEC_update(AEC *a, REAL xf[], REAL mikro_ef)
+{
+#ifdef DISABLE_ORC
+  int i;
+  for (i = 0; i < NLMS_LEN; i += 2) {
+    // optimize: partial loop unrolling
+    a->w[i] += mikro_ef * xf[i];
+    a->w[i + 1] += mikro_ef * xf[i + 1];
+  }
+#else
+  update_tap_weights(a->w, xf, mikro_ef, NLMS_LEN);
+#endif
+}
+
+/* The 300Hz cut-off of n <= AEC_BLOCK samples in place. The filter has
+ * no feedback, so the SSE version computes four outputs at once, each
+ * with the operations of the plain version in the same order. */
+static void highpass(FIR_HP_300Hz *f, REAL buf[], int n)
+{
+  REAL z[35 + AEC_BLOCK];
+  int i, j;
+
+  memcpy(z, f->z, sizeof(f->z));
+  memcpy(z + 35, buf, n * sizeof(REAL));
+
+  for (i = 0; i < n; i++) {
+    const REAL *in = z + 35 + i;        // in[-j] is the input j samples ago
+    REAL sum0 = 0.0, sum1 = 0.0;
+
+    for (j = 0; j < 36; j += 2) {
+      // optimize: partial loop unrolling
+      sum0 += FIR_HP_300Hz_a[j] * in[-j];
+      sum1 += FIR_HP_300Hz_a[j + 1] * in[-j - 1];
+    }
+    buf[i] = sum0 + sum1;
+  }
+
+  memcpy(f->z, z + n, sizeof(f->z));
+}
+
+static void highpass_sse(FIR_HP_300Hz *f, REAL buf[], int n)
+{
+#ifdef __SSE__
+  REAL z[35 + AEC_BLOCK];
+  int i, j;
+
+  memcpy(z, f->z, sizeof(f->z));
+  memcpy(z + 35, buf, n * sizeof(REAL));
+
+  for (i = 0; i + 4 <= n; i += 4) {
+    const REAL *in = z + 35 + i;
+    __m128 sum0 = _mm_setzero_ps(), sum1 = _mm_setzero_ps();
+
+    for (j = 0; j < 36; j += 2) {
+      sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_set1_ps(FIR_HP_300Hz_a[j]), _mm_loadu_ps(in - j)));
+      sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_set1_ps(FIR_HP_300Hz_a[j + 1]), _mm_loadu_ps(in - j - 1)));
+    }
+    _mm_storeu_ps(buf + i, _mm_add_ps(sum0, sum1));
+  }
+
+  for (; i < n; i++) {
+    const REAL *in = z + 35 + i;
+    REAL sum0 = 0.0, sum1 = 0.0;
+
+    for (j = 0; j < 36; j += 2) {
+      sum0 += FIR_HP_300Hz_a[j] * in[-j];
+      sum1 += FIR_HP_300Hz_a[j + 1] * in[-j - 1];
+    }
+    buf[i] = sum0 + sum1;
+  }
+
+  memcpy(f->z, z + n, sizeof(f->z));
+#else
+  highpass(f, buf, n);
+#endif
+}
+
 
 AEC* AEC_init(int RATE, int have_vector)
 {
@@ -90,10 +212,14 @@ AEC* AEC_init(int RATE, int have_vector)
       /* Get a 16-byte aligned location */
       a->w = (REAL *) (((uintptr_t) a->w_arr) - (((uintptr_t) a->w_arr) % 16) + 16);
       a->dotp = dotp_sse;
+      a->update_dotp = update_dotp_sse;
+      a->highpass = highpass_sse;
   } else {
       /* We don't care about alignment, just use the array as-is */
       a->w = a->w_arr;
       a->dotp = dotp;
+      a->update_dotp = update_dotp;
+      a->highpass = highpass;
   }
 
   return a;
@@ -168,6 +294,7 @@ static void AEC_leaky(AEC *a)
       --(a->hangover);
       // My Leaky NLMS is to erase vector w when hangover expires
       memset(a->w_arr, 0, sizeof(a->w_arr));
+      a->pending = 0;
     }
   }
 }
@@ -191,7 +318,15 @@ static REAL AEC_nlms_pw(AEC *a, REAL d, REAL x_, float stepsize)
   // calculate error value
   // (mic signal - estimated mic signal from spk signal)
   e = d;
-  if (a->hangover > 0) {
+  if (a->pending) {
+    // optimize: the update of the last sample goes along with the dotp
+    if (a->hangover > 0) {
+      e -= a->update_dotp(a->w, a->xf + a->j + 1, a->pending_mikro_ef, a->x + a->j);
+    } else {
+      AEC_update(a, a->xf + a->j + 1, a->pending_mikro_ef);
+    }
+    a->pending = 0;
+  } else if (a->hangover > 0) {
     e -= a->dotp(a->w, a->x + a->j);
   }
   ef = IIR1_highpass(a->Fe, e);     // pre-whitening of e
@@ -200,23 +335,19 @@ static REAL AEC_nlms_pw(AEC *a, REAL d, REAL x_, float stepsize)
   a->dotp_xf_xf += (a->xf[a->j] * a->xf[a->j] - a->xf[a->j + NLMS_LEN - 1] * a->xf[a->j + NLMS_LEN - 1]);
 
   if (stepsize > 0.0f) {
-    // calculate variable step size
-    REAL mikro_ef = stepsize * ef / a->dotp_xf_xf;
-
-#ifdef DISABLE_ORC
-    // update tap weights (filter learning)
-    int i;
-    for (i = 0; i < NLMS_LEN; i += 2) {
-      // optimize: partial loop unrolling
-      a->w[i] += mikro_ef * a->xf[i + a->j];
-      a->w[i + 1] += mikro_ef * a->xf[i + a->j + 1];
-    }
-#else
-    update_tap_weights(a->w, &a->xf[a->j], mikro_ef, NLMS_LEN);
-#endif
+    // calculate variable step size, the tap weights are updated with the
+    // next sample
+    a->pending_mikro_ef = stepsize * ef / a->dotp_xf_xf;
+    a->pending = 1;
   }
 
   if (--(a->j) < 0) {
+    // xf is about to move, so do the update now
+    if (a->pending) {
+      AEC_update(a, a->xf + a->j + 1, a->pending_mikro_ef);
+      a->pending = 0;
+    }
+
     // optimize: decrease number of memory copies
     a->j = NLMS_EXT;
     memmove(a->x + a->j + 1, a->x, (NLMS_LEN - 1) * sizeof(REAL));
@@ -243,7 +374,7 @@ int AEC_doAEC(AEC *a, int d_, int x_)
   d = IIR_HP_highpass(a->acMic, d);
 
   // Mic Highpass Filter - cut-off below 300Hz
-  d = FIR_HP_300Hz_highpass(a->cutoff, d);
+  a->highpass(a->cutoff, &d, 1);
 
   // Amplify, for e.g. Soundcards with -6dB max. volume
   d *= a->gain;
@@ -281,3 +412,41 @@ int AEC_doAEC(AEC *a, int d_, int x_)
 
   return (int) d;
 }
+
+
+void AEC_doAEC_block(AEC *a, const int16_t *d_, const int16_t *x_, int16_t *out, int n)
+{
+  REAL d[AEC_BLOCK], x[AEC_BLOCK];
+  int i, k;
+
+  for (i = 0; i < n; i += AEC_BLOCK) {
+    int len = PA_MIN(n - i, AEC_BLOCK);
+
+    // The highpass filters do not depend on the echo cancellation, so
+    // they are run over the block before it
+    for (k = 0; k < len; k++) {
+      // Mic and Spk Highpass Filter - to remove DC
+      d[k] = IIR_HP_highpass(a->acMic, (REAL) d_[i + k]);
+      x[k] = IIR_HP_highpass(a->acSpk, (REAL) x_[i + k]);
+    }
+
+    // Mic Highpass Filter - cut-off below 300Hz
+    a->highpass(a->cutoff, d, len);
+
+    for (k = 0; k < len; k++) {
+      // Amplify, for e.g. Soundcards with -6dB max. volume
+      REAL e = d[k] * a->gain;
+
+      // Double Talk Detector
+      a->stepsize = AEC_dtd(a, e, x[k]);
+
+      // Leaky (ageing of vector w)
+      AEC_leaky(a);
+
+      // Acoustic Echo Cancellation
+      e = AEC_nlms_pw(a, e, x[k], a->stepsize);
+
+      out[i + k] = (int16_t) (int) e;
+    }
+  }
+}
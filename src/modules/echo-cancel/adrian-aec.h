@@ -174,7 +174,22 @@ public:
  * www.dsptutor.freeuk.com/KaiserFilterDesign/KaiserFilterDesign.html
  */
 struct FIR_HP_300Hz {
-  REAL z[36];
+  REAL z[35];                   // the last 35 input samples, oldest first
+};
+
+static const REAL FIR_HP_300Hz_a[36] = {
+  // Kaiser Window FIR Filter, Filter type: High pass
+  // Passband: 150.0 - 4000.0 Hz, Order: 34
+  // Transition band: 34.0 Hz, Stopband attenuation: 10.0 dB
+  -0.016165324, -0.017454365, -0.01871232, -0.019931411,
+  -0.021104068, -0.022222936, -0.02328091, -0.024271343,
+  -0.025187887, -0.02602462, -0.026776174, -0.027437767,
+  -0.028004972, -0.028474221, -0.028842418, -0.029107114,
+  -0.02926664, 0.8524841, -0.02926664, -0.029107114,
+  -0.028842418, -0.028474221, -0.028004972, -0.027437767,
+  -0.026776174, -0.02602462, -0.025187887, -0.024271343,
+  -0.02328091, -0.022222936, -0.021104068, -0.019931411,
+  -0.01871232, -0.017454365, -0.016165324, 0.0
 };
 
 static  FIR_HP_300Hz* FIR_HP_300Hz_init(void) {
@@ -182,34 +197,6 @@ static  FIR_HP_300Hz* FIR_HP_300Hz_init(void) {
     memset(ret, 0, sizeof(FIR_HP_300Hz));
     return ret;
   }
-
-static  REAL FIR_HP_300Hz_highpass(FIR_HP_300Hz *f, REAL in) {
-    REAL sum0 = 0.0, sum1 = 0.0;
-    int j;
-    const REAL a[36] = {
-      // Kaiser Window FIR Filter, Filter type: High pass
-      // Passband: 150.0 - 4000.0 Hz, Order: 34
-      // Transition band: 34.0 Hz, Stopband attenuation: 10.0 dB
-      -0.016165324, -0.017454365, -0.01871232, -0.019931411,
-      -0.021104068, -0.022222936, -0.02328091, -0.024271343,
-      -0.025187887, -0.02602462, -0.026776174, -0.027437767,
-      -0.028004972, -0.028474221, -0.028842418, -0.029107114,
-      -0.02926664, 0.8524841, -0.02926664, -0.029107114,
-      -0.028842418, -0.028474221, -0.028004972, -0.027437767,
-      -0.026776174, -0.02602462, -0.025187887, -0.024271343,
-      -0.02328091, -0.022222936, -0.021104068, -0.019931411,
-      -0.01871232, -0.017454365, -0.016165324, 0.0
-    };
-    memmove(f->z + 1, f->z, 35 * sizeof(REAL));
-    f->z[0] = in;
-
-    for (j = 0; j < 36; j += 2) {
-      // optimize: partial loop unrolling
-      sum0 += a[j] * f->z[j];
-      sum1 += a[j + 1] * f->z[j + 1];
-    }
-    return sum0 + sum1;
-  }
 #endif
 
 typedef struct IIR1 IIR1;
@@ -292,6 +279,9 @@ public:
 // block size in taps to optimize DTD calculation
 #define DTD_LEN   16
 
+// samples that are prefiltered at once by AEC_doAEC_block()
+#define AEC_BLOCK 64
+
 typedef struct AEC AEC;
 
 struct AEC {
@@ -311,6 +301,8 @@ struct AEC {
   REAL w_arr[NLMS_LEN + (16 / sizeof(REAL))]; // tap weights
   REAL *w;                      // this will be a 16-byte aligned pointer into w_arr
   int j;                        // optimize: less memory copies
+  int pending;                  // optimize: the last w update is not done yet
+  REAL pending_mikro_ef;        // and has this step size
   double dotp_xf_xf;            // double to avoid loss of precision
   float delta;                  // noise floor to stabilize NLMS
 
@@ -328,6 +320,8 @@ struct AEC {
 
   // vfuncs that are picked based on processor features available
   REAL (*dotp) (REAL[], REAL[]);
+  REAL (*update_dotp) (REAL[], REAL[], REAL, REAL[]);
+  void (*highpass) (FIR_HP_300Hz*, REAL[], int);
 };
 
 /* Double-Talk Detector
@@ -361,6 +355,14 @@ void AEC_done(AEC *a);
  */
   int AEC_doAEC(AEC *a, int d_, int x_);
 
+/* The same for a block of samples
+ * in   d:  microphone signal with echo
+ * in   x:  loudspeaker signal
+ * out  out: echo cancelled microphone signal
+ * in   n:  number of samples
+ */
+  void AEC_doAEC_block(AEC *a, const int16_t *d, const int16_t *x, int16_t *out, int n);
+
 PA_GCC_UNUSED static  float AEC_getambient(AEC *a) {
     return a->dfast;
   }
@@ -102,14 +102,9 @@ fail:
 }
 
 void pa_adrian_ec_run(pa_echo_canceller *ec, const uint8_t *rec, const uint8_t *play, uint8_t *out) {
-    unsigned int i;
-
-    for (i = 0; i < ec->params.priv.adrian.blocksize; i += 2) {
-        /* We know it's S16NE mono data */
-        int r = *(int16_t *)(rec + i);
-        int p = *(int16_t *)(play + i);
-        *(int16_t *)(out + i) = (int16_t) AEC_doAEC(ec->params.priv.adrian.aec, r, p);
-    }
+    /* We know it's S16NE mono data */
+    AEC_doAEC_block(ec->params.priv.adrian.aec, (const int16_t *) rec, (const int16_t *) play, (int16_t *) out,
+                    ec->params.priv.adrian.blocksize / 2);
 }
 
 void pa_adrian_ec_done(pa_echo_canceller *ec) {
@@ -30,3 +30,4 @@ typedef struct AEC AEC;
 AEC* AEC_init(int RATE, int have_vector);
 void AEC_done(AEC *a);
 int AEC_doAEC(AEC *a, int d_, int x_);
+void AEC_doAEC_block(AEC *a, const int16_t *d_, const int16_t *x_, int16_t *out, int n);
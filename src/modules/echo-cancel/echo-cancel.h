@@ -53,6 +53,8 @@ struct pa_echo_canceller_params {
         struct {
             SpeexEchoState *state;
             SpeexPreprocessState *pp_state;
+            /* With threads > 1, one canceller per channel instead */
+            struct pa_speex_split *split;
         } speex;
 #endif
 #ifdef HAVE_ADRIAN_EC
@@ -69,6 +71,11 @@ struct pa_echo_canceller_params {
             uint32_t blocksize;
             pa_sample_spec sample_spec;
             pa_bool_t agc;
+#ifdef HAVE_WEBRTC_FLOAT
+            /* Deinterleaved blocks, only used with more than one channel */
+            float *rec_buffer[PA_CHANNELS_MAX];
+            float *play_buffer[PA_CHANNELS_MAX];
+#endif
         } webrtc;
 #endif
         /* each canceller-specific structure goes here */
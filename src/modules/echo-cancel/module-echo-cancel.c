@@ -40,9 +40,12 @@
 #include <pulse/rtclock.h>
 
 #include <pulsecore/i18n.h>
+#include <pulsecore/asyncq.h>
 #include <pulsecore/atomic.h>
+#include <pulsecore/flist.h>
 #include <pulsecore/macro.h>
 #include <pulsecore/namereg.h>
+#include <pulsecore/poll.h>
 #include <pulsecore/sink.h>
 #include <pulsecore/module.h>
 #include <pulsecore/core-rtclock.h>
@@ -52,6 +55,7 @@
 #include <pulsecore/rtpoll.h>
 #include <pulsecore/sample-util.h>
 #include <pulsecore/ltdl-helper.h>
+#include <pulsecore/thread.h>
 
 #include "module-echo-cancel-symdef.h"
 
@@ -77,6 +81,7 @@ PA_MODULE_USAGE(
           "save_aec=<save AEC data in /tmp> "
           "autoloaded=<set if this module is being loaded automatically> "
           "use_volume_sharing=<yes or no> "
+          "aec_thread=<run the canceller in its own thread, yes or no> "
         ));
 
 /* NOTE: Make sure the enum and ec_table are maintained in the correct order */
@@ -142,6 +147,11 @@ static const pa_echo_canceller ec_table[] = {
 #define DEFAULT_ADJUST_TOLERANCE (5*PA_USEC_PER_MSEC)
 #define DEFAULT_SAVE_AEC FALSE
 #define DEFAULT_AUTOLOADED FALSE
+#define DEFAULT_AEC_THREAD FALSE
+
+/* How many blocks may be queued up for the canceller thread before the
+ * source I/O thread waits for it */
+#define WORKER_MAX_PENDING 16
 
 #define MEMBLOCKQ_MAXLENGTH (16*1024*1024)
 
@@ -176,6 +186,14 @@ static const pa_echo_canceller ec_table[] = {
  *    be before capture and the difference should not be bigger than one frame
  *    size. We would ideally like to resample the sink_input but most driver
  *    don't give enough accuracy to be able to do that right now.
+ *
+ * With aec_thread=yes the canceller itself is run in a separate real-time
+ * thread, so that a slow canceller does not hold up the other outputs of
+ * the source master. The source I/O thread still does all the alignment,
+ * and hands fixed blocks of capture and playback data to the canceller
+ * thread through lock-free queues. The canceled blocks come back the same
+ * way and are posted on the source from the source I/O thread. This adds
+ * one block of latency, which we report on the source.
  */
 
 struct userdata;
@@ -202,6 +220,30 @@ struct snapshot {
     size_t plen;
 };
 
+/* One block of work for the canceller thread */
+struct ec_job {
+    pa_memchunk rchunk, pchunk, cchunk;
+    pa_bool_t quit;
+
+    /* The capture volume as seen by the canceller while running this block */
+    pa_cvolume volume;
+    pa_bool_t volume_changed;
+};
+
+struct ec_worker {
+    pa_thread *thread;
+    pa_asyncq *requests; /* source I/O thread -> canceller thread */
+    pa_asyncq *results;  /* canceller thread -> source I/O thread */
+    pa_flist *free_jobs;
+    pa_rtpoll_item *rtpoll_item;
+
+    /* Only accessed from the source I/O thread */
+    unsigned pending;
+
+    /* Only accessed from the canceller thread */
+    struct ec_job *current;
+};
+
 struct userdata {
     pa_core *core;
     pa_module *module;
@@ -252,6 +294,9 @@ struct userdata {
 
     pa_bool_t use_volume_sharing;
 
+    /* NULL if the canceller runs in the source I/O thread */
+    struct ec_worker *worker;
+
     struct {
         pa_cvolume current_volume;
     } thread_info;
@@ -277,6 +322,7 @@ static const char* const valid_modargs[] = {
     "save_aec",
     "autoloaded",
     "use_volume_sharing",
+    "aec_thread",
     NULL
 };
 
@@ -419,7 +465,9 @@ static int source_process_msg_cb(pa_msgobject *o, int code, void *data, int64_t
                 /* Add the latency internal to our source output on top */
                 pa_bytes_to_usec(pa_memblockq_get_length(u->source_output->thread_info.delay_memblockq), &u->source_output->source->sample_spec) +
                 /* and the buffering we do on the source */
-                pa_bytes_to_usec(u->source_output_blocksize, &u->source_output->source->sample_spec);
+                pa_bytes_to_usec(u->source_output_blocksize, &u->source_output->source->sample_spec) +
+                /* plus the block that is in the canceller thread */
+                (u->worker ? pa_bytes_to_usec(u->source_output_blocksize, &u->source_output->source->sample_spec) : 0);
 
             return 0;
 
@@ -805,6 +853,219 @@ static void do_push_drift_comp(struct userdata *u) {
     }
 }
 
+/* Cancels the echo from one block of capture data.
+ *
+ * Called from source I/O thread context, or from the canceller thread when
+ * that is used. */
+static void run_block(struct userdata *u, pa_memchunk *rchunk, pa_memchunk *pchunk, pa_memchunk *cchunk) {
+    uint8_t *rdata, *pdata, *cdata;
+    int unused PA_GCC_UNUSED;
+
+    rdata = pa_memblock_acquire(rchunk->memblock);
+    rdata += rchunk->index;
+    pdata = pa_memblock_acquire(pchunk->memblock);
+    pdata += pchunk->index;
+    cdata = pa_memblock_acquire(cchunk->memblock);
+
+    if (u->save_aec) {
+        if (u->captured_file)
+            unused = fwrite(rdata, 1, u->source_output_blocksize, u->captured_file);
+        if (u->played_file)
+            unused = fwrite(pdata, 1, u->sink_blocksize, u->played_file);
+    }
+
+    /* perform echo cancellation */
+    u->ec->run(u->ec, rdata, pdata, cdata);
+
+    if (u->save_aec) {
+        if (u->canceled_file)
+            unused = fwrite(cdata, 1, u->source_blocksize, u->canceled_file);
+    }
+
+    pa_memblock_release(cchunk->memblock);
+    pa_memblock_release(pchunk->memblock);
+    pa_memblock_release(rchunk->memblock);
+}
+
+/* Called from canceller thread context. */
+static void worker_thread_func(void *userdata) {
+    struct userdata *u = userdata;
+    struct ec_worker *w = u->worker;
+    struct ec_job *j;
+
+    pa_log_debug("Canceller thread starting up");
+
+    if (u->core->realtime_scheduling)
+        pa_make_realtime(u->core->realtime_priority);
+
+    for (;;) {
+        pa_assert_se(j = pa_asyncq_pop(w->requests, TRUE));
+
+        if (j->quit) {
+            pa_asyncq_push(w->results, j, TRUE);
+            break;
+        }
+
+        w->current = j;
+        run_block(u, &j->rchunk, &j->pchunk, &j->cchunk);
+        w->current = NULL;
+
+        pa_asyncq_push(w->results, j, TRUE);
+    }
+
+    pa_log_debug("Canceller thread shutting down");
+}
+
+static void free_job(struct ec_worker *w, struct ec_job *j) {
+    if (j->rchunk.memblock)
+        pa_memblock_unref(j->rchunk.memblock);
+    if (j->pchunk.memblock)
+        pa_memblock_unref(j->pchunk.memblock);
+    if (j->cchunk.memblock)
+        pa_memblock_unref(j->cchunk.memblock);
+
+    pa_memzero(j, sizeof(*j));
+
+    if (pa_flist_push(w->free_jobs, j) < 0)
+        pa_xfree(j);
+}
+
+static void post_capture_volume(struct userdata *u, pa_cvolume *v);
+
+/* Posts the blocks the canceller thread is done with. If wait is TRUE,
+ * waits until all queued blocks have been processed.
+ *
+ * Called from source I/O thread context. */
+static pa_bool_t worker_collect(struct userdata *u, pa_bool_t wait) {
+    struct ec_worker *w = u->worker;
+    struct ec_job *j;
+    pa_bool_t collected = FALSE;
+
+    while (w->pending > 0 && (j = pa_asyncq_pop(w->results, wait))) {
+        w->pending--;
+        collected = TRUE;
+
+        if (j->volume_changed)
+            post_capture_volume(u, &j->volume);
+
+        /* forward the (echo-canceled) data to the virtual source */
+        if (PA_SOURCE_IS_LINKED(u->source->thread_info.state))
+            pa_source_post(u->source, &j->cchunk);
+
+        free_job(w, j);
+    }
+
+    return collected;
+}
+
+/* Called from source I/O thread context. */
+static void worker_submit(struct userdata *u, pa_memchunk *rchunk, pa_memchunk *pchunk, pa_memchunk *cchunk) {
+    struct ec_worker *w = u->worker;
+    struct ec_job *j;
+
+    /* Don't let the backlog grow without bounds if the canceller can't keep
+     * up, the queues are of limited size */
+    if (w->pending >= WORKER_MAX_PENDING) {
+        pa_log_debug("Canceller thread is falling behind, waiting for it");
+
+        while (w->pending >= WORKER_MAX_PENDING)
+            worker_collect(u, TRUE);
+    }
+
+    if (!(j = pa_flist_pop(w->free_jobs)))
+        j = pa_xnew0(struct ec_job, 1);
+
+    j->rchunk = *rchunk;
+    j->pchunk = *pchunk;
+    j->cchunk = *cchunk;
+    j->volume = u->thread_info.current_volume;
+
+    pa_assert_se(pa_asyncq_push(w->requests, j, FALSE) == 0);
+    w->pending++;
+}
+
+/* Called from source I/O thread context. */
+static int worker_rtpoll_before_cb(pa_rtpoll_item *i) {
+    struct userdata *u;
+
+    pa_assert_se(u = pa_rtpoll_item_get_userdata(i));
+
+    if (pa_asyncq_read_before_poll(u->worker->results) < 0)
+        return 1; /* 1 means immediate restart of the loop */
+
+    return 0;
+}
+
+/* Called from source I/O thread context. */
+static void worker_rtpoll_after_cb(pa_rtpoll_item *i) {
+    struct userdata *u;
+
+    pa_assert_se(u = pa_rtpoll_item_get_userdata(i));
+
+    pa_asyncq_read_after_poll(u->worker->results);
+}
+
+/* Called from source I/O thread context. */
+static int worker_rtpoll_work_cb(pa_rtpoll_item *i) {
+    struct userdata *u;
+
+    pa_assert_se(u = pa_rtpoll_item_get_userdata(i));
+
+    return worker_collect(u, FALSE) ? 1 : 0;
+}
+
+/* Called from main context. */
+static int start_worker(struct userdata *u) {
+    struct ec_worker *w;
+
+    pa_assert(u);
+    pa_assert(!u->worker);
+
+    u->worker = w = pa_xnew0(struct ec_worker, 1);
+    w->requests = pa_asyncq_new(0);
+    w->results = pa_asyncq_new(0);
+    w->free_jobs = pa_flist_new(0);
+
+    if (!(w->thread = pa_thread_new("echo-cancel", worker_thread_func, u))) {
+        pa_log("Failed to create canceller thread.");
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Called from main context, after the source output has been unlinked. */
+static void stop_worker(struct userdata *u) {
+    struct ec_worker *w;
+    struct ec_job *j;
+
+    pa_assert(u);
+
+    if (!(w = u->worker))
+        return;
+
+    if (w->thread) {
+        j = pa_xnew0(struct ec_job, 1);
+        j->quit = TRUE;
+        pa_asyncq_push(w->requests, j, TRUE);
+
+        pa_thread_free(w->thread);
+    }
+
+    /* Everything still queued up is dropped */
+    while ((j = pa_asyncq_pop(w->requests, FALSE)))
+        free_job(w, j);
+    while ((j = pa_asyncq_pop(w->results, FALSE)))
+        free_job(w, j);
+
+    pa_asyncq_free(w->requests, NULL);
+    pa_asyncq_free(w->results, NULL);
+    pa_flist_free(w->free_jobs, pa_xfree);
+
+    pa_xfree(w);
+    u->worker = NULL;
+}
+
 /* This one's simpler than the drift compensation case -- we just iterate over
  * the capture buffer, and pass the canceller blocksize bytes of playback and
  * capture data.
@@ -813,8 +1074,6 @@ static void do_push_drift_comp(struct userdata *u) {
 static void do_push(struct userdata *u) {
     size_t rlen, plen;
     pa_memchunk rchunk, pchunk, cchunk;
-    uint8_t *rdata, *pdata, *cdata;
-    int unused PA_GCC_UNUSED;
 
     rlen = pa_memblockq_get_length(u->source_memblockq);
     plen = pa_memblockq_get_length(u->sink_memblockq);
@@ -829,49 +1088,33 @@ static void do_push(struct userdata *u) {
         if (plen < u->sink_blocksize)
             pa_memblockq_seek(u->sink_memblockq, u->sink_blocksize - plen, PA_SEEK_RELATIVE, true);
 
-        rdata = pa_memblock_acquire(rchunk.memblock);
-        rdata += rchunk.index;
-        pdata = pa_memblock_acquire(pchunk.memblock);
-        pdata += pchunk.index;
-
         cchunk.index = 0;
         cchunk.length = u->source_blocksize;
         cchunk.memblock = pa_memblock_new(u->source->core->mempool, cchunk.length);
-        cdata = pa_memblock_acquire(cchunk.memblock);
-
-        if (u->save_aec) {
-            if (u->captured_file)
-                unused = fwrite(rdata, 1, u->source_output_blocksize, u->captured_file);
-            if (u->played_file)
-                unused = fwrite(pdata, 1, u->sink_blocksize, u->played_file);
-        }
-
-        /* perform echo cancellation */
-        u->ec->run(u->ec, rdata, pdata, cdata);
-
-        if (u->save_aec) {
-            if (u->canceled_file)
-                unused = fwrite(cdata, 1, u->source_blocksize, u->canceled_file);
-        }
-
-        pa_memblock_release(cchunk.memblock);
-        pa_memblock_release(pchunk.memblock);
-        pa_memblock_release(rchunk.memblock);
 
         /* drop consumed source samples */
         pa_memblockq_drop(u->source_memblockq, u->source_output_blocksize);
-        pa_memblock_unref(rchunk.memblock);
         rlen -= u->source_output_blocksize;
 
         /* drop consumed sink samples */
         pa_memblockq_drop(u->sink_memblockq, u->sink_blocksize);
-        pa_memblock_unref(pchunk.memblock);
 
         if (plen >= u->sink_blocksize)
             plen -= u->sink_blocksize;
         else
             plen = 0;
 
+        if (u->worker) {
+            /* The canceller thread takes over our references */
+            worker_submit(u, &rchunk, &pchunk, &cchunk);
+            continue;
+        }
+
+        run_block(u, &rchunk, &pchunk, &cchunk);
+
+        pa_memblock_unref(pchunk.memblock);
+        pa_memblock_unref(rchunk.memblock);
+
         /* forward the (echo-canceled) data to the virtual source */
         pa_source_post(u->source, &cchunk);
         pa_memblock_unref(cchunk.memblock);
@@ -895,10 +1138,17 @@ static void source_output_push_cb(pa_source_output *o, const pa_memchunk *chunk)
 
     if (PA_UNLIKELY(u->source->thread_info.state != PA_SOURCE_RUNNING ||
                     u->sink->thread_info.state != PA_SINK_RUNNING)) {
+        /* Keep the order of whatever the canceller is still working on */
+        if (u->worker)
+            worker_collect(u, TRUE);
+
         pa_source_post(u->source, chunk);
         return;
     }
 
+    if (u->worker)
+        worker_collect(u, FALSE);
+
     /* handle queued messages, do any message sending of our own */
     while (pa_asyncmsgq_process_one(u->asyncmsgq) > 0)
         ;
@@ -928,6 +1178,9 @@ static void source_output_push_cb(pa_source_output *o, const pa_memchunk *chunk)
         to_skip -= to_skip % u->source_output_blocksize;
 
         if (to_skip) {
+            if (u->worker)
+                worker_collect(u, TRUE);
+
             pa_memblockq_peek_fixed_size(u->source_memblockq, to_skip, &rchunk);
             pa_source_post(u->source, &rchunk);
 
@@ -1265,6 +1518,21 @@ static void source_output_attach_cb(pa_source_output *o) {
             o->source->thread_info.rtpoll,
             PA_RTPOLL_LATE,
             u->asyncmsgq);
+
+    if (u->worker) {
+        struct pollfd *pollfd;
+
+        u->worker->rtpoll_item = pa_rtpoll_item_new(o->source->thread_info.rtpoll, PA_RTPOLL_LATE, 1);
+
+        pollfd = pa_rtpoll_item_get_pollfd(u->worker->rtpoll_item, NULL);
+        pollfd->fd = pa_asyncq_read_fd(u->worker->results);
+        pollfd->events = POLLIN;
+
+        pa_rtpoll_item_set_before_callback(u->worker->rtpoll_item, worker_rtpoll_before_cb);
+        pa_rtpoll_item_set_after_callback(u->worker->rtpoll_item, worker_rtpoll_after_cb);
+        pa_rtpoll_item_set_work_callback(u->worker->rtpoll_item, worker_rtpoll_work_cb);
+        pa_rtpoll_item_set_userdata(u->worker->rtpoll_item, u);
+    }
 }
 
 /* Called from sink I/O thread context. */
@@ -1308,6 +1576,17 @@ static void source_output_detach_cb(pa_source_output *o) {
     pa_source_output_assert_io_context(o);
     pa_assert_se(u = o->userdata);
 
+    if (u->worker) {
+        /* Whatever is still in the canceller thread belongs to this
+         * thread's source master */
+        worker_collect(u, TRUE);
+
+        if (u->worker->rtpoll_item) {
+            pa_rtpoll_item_free(u->worker->rtpoll_item);
+            u->worker->rtpoll_item = NULL;
+        }
+    }
+
     pa_source_detach_within_thread(u->source);
     pa_source_set_rtpoll(u->source, NULL);
 
@@ -1554,19 +1833,39 @@ static int canceller_process_msg_cb(pa_msgobject *o, int code, void *userdata, i
     return 0;
 }
 
-/* Called by the canceller, so source I/O thread context. */
+/* Called from source I/O thread context. */
+static void post_capture_volume(struct userdata *u, pa_cvolume *v) {
+    if (!pa_cvolume_equal(&u->thread_info.current_volume, v)) {
+        pa_cvolume *vol = pa_xnewdup(pa_cvolume, v, 1);
+
+        pa_asyncmsgq_post(pa_thread_mq_get()->outq, PA_MSGOBJECT(u->ec->msg), ECHO_CANCELLER_MESSAGE_SET_VOLUME, vol, 0, NULL,
+                pa_xfree);
+    }
+}
+
+/* Called by the canceller, so source I/O thread or canceller thread
+ * context. In the latter case the volume travels with the block. */
 void pa_echo_canceller_get_capture_volume(pa_echo_canceller *ec, pa_cvolume *v) {
-    *v = ec->msg->userdata->thread_info.current_volume;
+    struct userdata *u = ec->msg->userdata;
+
+    if (u->worker && u->worker->current)
+        *v = u->worker->current->volume;
+    else
+        *v = u->thread_info.current_volume;
 }
 
-/* Called by the canceller, so source I/O thread context. */
+/* Called by the canceller, so source I/O thread or canceller thread
+ * context. */
 void pa_echo_canceller_set_capture_volume(pa_echo_canceller *ec, pa_cvolume *v) {
-    if (!pa_cvolume_equal(&ec->msg->userdata->thread_info.current_volume, v)) {
-        pa_cvolume *vol = pa_xnewdup(pa_cvolume, v, 1);
+    struct userdata *u = ec->msg->userdata;
 
-        pa_asyncmsgq_post(pa_thread_mq_get()->outq, PA_MSGOBJECT(ec->msg), ECHO_CANCELLER_MESSAGE_SET_VOLUME, vol, 0, NULL,
-                pa_xfree);
+    if (u->worker && u->worker->current) {
+        u->worker->current->volume = *v;
+        u->worker->current->volume_changed = TRUE;
+        return;
     }
+
+    post_capture_volume(u, v);
 }
 
 uint32_t pa_echo_canceller_blocksize_power2(unsigned rate, unsigned ms) {
@@ -1657,6 +1956,7 @@ int pa__init(pa_module*m) {
     pa_memchunk silence;
     uint32_t temp;
     uint32_t nframes = 0;
+    pa_bool_t aec_thread;
 
     pa_assert(m);
 
@@ -1740,6 +2040,12 @@ int pa__init(pa_module*m) {
         goto fail;
     }
 
+    aec_thread = DEFAULT_AEC_THREAD;
+    if (pa_modargs_get_value_boolean(ma, "aec_thread", &aec_thread) < 0) {
+        pa_log("Failed to parse aec_thread value");
+        goto fail;
+    }
+
     if (init_common(ma, u, &source_ss, &source_map) < 0)
         goto fail;
 
@@ -1770,6 +2076,13 @@ int pa__init(pa_module*m) {
     if (u->ec->params.drift_compensation)
         pa_assert(u->ec->set_drift);
 
+    if (aec_thread) {
+        if (u->ec->params.drift_compensation)
+            pa_log_warn("Drift compensation needs the canceller in the source I/O thread, ignoring aec_thread");
+        else if (start_worker(u) < 0)
+            goto fail;
+    }
+
     /* Create source */
     pa_source_new_data_init(&source_data);
     source_data.driver = __FILE__;
@@ -2057,6 +2370,8 @@ void pa__done(pa_module*m) {
     if (u->sink)
         pa_sink_unref(u->sink);
 
+    stop_worker(u);
+
     if (u->source_memblockq)
         pa_memblockq_free(u->source_memblockq);
     if (u->sink_memblockq)
@@ -25,8 +25,12 @@
 #include <config.h>
 #endif
 
+#include <pulse/xmalloc.h>
+
 #include <pulsecore/core-util.h>
 #include <pulsecore/modargs.h>
+#include <pulsecore/semaphore.h>
+#include <pulsecore/thread.h>
 #include "echo-cancel.h"
 
 /* should be between 10-20 ms */
@@ -37,6 +41,7 @@
 #define DEFAULT_DENOISE_ENABLED TRUE
 #define DEFAULT_ECHO_SUPPRESS_ENABLED TRUE
 #define DEFAULT_ECHO_SUPPRESS_ATTENUATION 0
+#define DEFAULT_THREADS 1
 
 static const char* const valid_modargs[] = {
     "frame_size_ms",
@@ -46,6 +51,7 @@ static const char* const valid_modargs[] = {
     "echo_suppress",
     "echo_suppress_attenuation",
     "echo_suppress_attenuation_active",
+    "threads",
     NULL
 };
 
@@ -60,6 +66,208 @@ static void pa_speex_ec_fixate_spec(pa_sample_spec *rec_ss, pa_channel_map *rec_
     *rec_map = *out_map;
 }
 
+/* With threads > 1 every capture channel gets its own canceller, which
+ * sees all the playback channels, and its own preprocessor. The channels
+ * are spread over the calling thread and threads - 1 workers, which are
+ * started for every block and waited for before returning. */
+
+struct speex_channel {
+    SpeexEchoState *state;
+    SpeexPreprocessState *pp_state;
+    spx_int16_t *rec, *out;
+};
+
+struct speex_worker {
+    struct pa_speex_split *split;
+    pa_thread *thread;
+    pa_semaphore *start;
+    unsigned first, n_channels;
+};
+
+struct pa_speex_split {
+    pa_core *core;
+    unsigned channels, nframes;
+    struct speex_channel channel[PA_CHANNELS_MAX];
+
+    unsigned n_workers;
+    struct speex_worker worker[PA_CHANNELS_MAX];
+    pa_semaphore *done;
+    pa_bool_t quit;
+
+    /* The block being processed */
+    const spx_int16_t *rec, *play;
+    spx_int16_t *out;
+};
+
+/* Called from the thread running the canceller or a worker thread. */
+static void split_run_worker(struct speex_worker *w) {
+    struct pa_speex_split *s = w->split;
+    unsigned c, i;
+
+    for (c = w->first; c < w->first + w->n_channels; c++) {
+        struct speex_channel *ch = &s->channel[c];
+
+        for (i = 0; i < s->nframes; i++)
+            ch->rec[i] = s->rec[i * s->channels + c];
+
+        speex_echo_cancellation(ch->state, ch->rec, s->play, ch->out);
+
+        if (ch->pp_state)
+            speex_preprocess_run(ch->pp_state, ch->out);
+
+        for (i = 0; i < s->nframes; i++)
+            s->out[i * s->channels + c] = ch->out[i];
+    }
+}
+
+/* Called from worker thread context. */
+static void split_thread_func(void *userdata) {
+    struct speex_worker *w = userdata;
+
+    if (w->split->core->realtime_scheduling)
+        pa_make_realtime(w->split->core->realtime_priority);
+
+    for (;;) {
+        pa_semaphore_wait(w->start);
+
+        if (w->split->quit)
+            break;
+
+        split_run_worker(w);
+        pa_semaphore_post(w->split->done);
+    }
+}
+
+static void split_free(struct pa_speex_split *s) {
+    unsigned i;
+
+    s->quit = TRUE;
+
+    for (i = 1; i < s->n_workers; i++) {
+        if (s->worker[i].thread) {
+            pa_semaphore_post(s->worker[i].start);
+            pa_thread_free(s->worker[i].thread);
+        }
+
+        if (s->worker[i].start)
+            pa_semaphore_free(s->worker[i].start);
+    }
+
+    if (s->done)
+        pa_semaphore_free(s->done);
+
+    for (i = 0; i < s->channels; i++) {
+        if (s->channel[i].pp_state)
+            speex_preprocess_state_destroy(s->channel[i].pp_state);
+        if (s->channel[i].state)
+            speex_echo_state_destroy(s->channel[i].state);
+
+        pa_xfree(s->channel[i].rec);
+        pa_xfree(s->channel[i].out);
+    }
+
+    pa_xfree(s);
+}
+
+static struct pa_speex_split *split_new(pa_core *c, unsigned channels, unsigned threads, uint32_t nframes, int rate, uint32_t filter_size_ms) {
+    struct pa_speex_split *s;
+    unsigned i, first = 0;
+
+    s = pa_xnew0(struct pa_speex_split, 1);
+    s->core = c;
+    s->channels = channels;
+    s->nframes = nframes;
+
+    for (i = 0; i < channels; i++) {
+        if (!(s->channel[i].state = speex_echo_state_init_mc(nframes, (rate * filter_size_ms) / 1000, 1, channels)))
+            goto fail;
+
+        speex_echo_ctl(s->channel[i].state, SPEEX_ECHO_SET_SAMPLING_RATE, &rate);
+
+        s->channel[i].rec = pa_xnew(spx_int16_t, nframes);
+        s->channel[i].out = pa_xnew(spx_int16_t, nframes);
+    }
+
+    /* Spread the channels as evenly as possible */
+    for (i = 0; i < threads; i++) {
+        s->worker[i].split = s;
+        s->worker[i].first = first;
+        s->worker[i].n_channels = (channels - first) / (threads - i);
+        first += s->worker[i].n_channels;
+    }
+
+    return s;
+
+fail:
+    split_free(s);
+    return NULL;
+}
+
+/* Worker 0 is the thread running the canceller itself. */
+static pa_bool_t split_start(struct pa_speex_split *s, unsigned threads) {
+    s->done = pa_semaphore_new(0);
+
+    for (s->n_workers = 1; s->n_workers < threads; s->n_workers++) {
+        struct speex_worker *w = &s->worker[s->n_workers];
+
+        w->start = pa_semaphore_new(0);
+
+        if (!(w->thread = pa_thread_new("echo-cancel-speex", split_thread_func, w))) {
+            pa_log("Failed to create speex worker thread.");
+            s->n_workers++;
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+/* Called from the thread running the canceller. */
+static void split_run(struct pa_speex_split *s, const uint8_t *rec, const uint8_t *play, uint8_t *out) {
+    unsigned i;
+
+    s->rec = (const spx_int16_t *) rec;
+    s->play = (const spx_int16_t *) play;
+    s->out = (spx_int16_t *) out;
+
+    for (i = 1; i < s->n_workers; i++)
+        pa_semaphore_post(s->worker[i].start);
+
+    split_run_worker(&s->worker[0]);
+
+    for (i = 1; i < s->n_workers; i++)
+        pa_semaphore_wait(s->done);
+}
+
+static SpeexPreprocessState *preprocessor_new(uint32_t nframes, uint32_t rate, SpeexEchoState *state, pa_bool_t agc, pa_bool_t denoise,
+                                              pa_bool_t echo_suppress, int32_t echo_suppress_attenuation,
+                                              int32_t echo_suppress_attenuation_active) {
+    SpeexPreprocessState *pp_state;
+    spx_int32_t tmp;
+
+    pp_state = speex_preprocess_state_init(nframes, rate);
+
+    tmp = agc;
+    speex_preprocess_ctl(pp_state, SPEEX_PREPROCESS_SET_AGC, &tmp);
+
+    tmp = denoise;
+    speex_preprocess_ctl(pp_state, SPEEX_PREPROCESS_SET_DENOISE, &tmp);
+
+    if (echo_suppress) {
+        if (echo_suppress_attenuation)
+            speex_preprocess_ctl(pp_state, SPEEX_PREPROCESS_SET_ECHO_SUPPRESS, &echo_suppress_attenuation);
+
+        if (echo_suppress_attenuation_active) {
+            speex_preprocess_ctl(pp_state, SPEEX_PREPROCESS_SET_ECHO_SUPPRESS_ACTIVE,
+                                 &echo_suppress_attenuation_active);
+        }
+
+        speex_preprocess_ctl(pp_state, SPEEX_PREPROCESS_SET_ECHO_STATE, state);
+    }
+
+    return pp_state;
+}
+
 static pa_bool_t pa_speex_ec_preprocessor_init(pa_echo_canceller *ec, pa_sample_spec *out_ss, uint32_t nframes, pa_modargs *ma) {
     pa_bool_t agc;
     pa_bool_t denoise;
@@ -106,33 +314,24 @@ static pa_bool_t pa_speex_ec_preprocessor_init(pa_echo_canceller *ec, pa_sample_
     }
 
     if (agc || denoise || echo_suppress) {
-        spx_int32_t tmp;
-
-        if (out_ss->channels != 1) {
-            pa_log("AGC, denoising and echo suppression only work with channels=1");
-            goto fail;
-        }
-
-        ec->params.priv.speex.pp_state = speex_preprocess_state_init(nframes, out_ss->rate);
-
-        tmp = agc;
-        speex_preprocess_ctl(ec->params.priv.speex.pp_state, SPEEX_PREPROCESS_SET_AGC, &tmp);
-
-        tmp = denoise;
-        speex_preprocess_ctl(ec->params.priv.speex.pp_state, SPEEX_PREPROCESS_SET_DENOISE, &tmp);
-
-        if (echo_suppress) {
-            if (echo_suppress_attenuation)
-                speex_preprocess_ctl(ec->params.priv.speex.pp_state, SPEEX_PREPROCESS_SET_ECHO_SUPPRESS,
-                                     &echo_suppress_attenuation);
-
-            if (echo_suppress_attenuation_active) {
-                speex_preprocess_ctl(ec->params.priv.speex.pp_state, SPEEX_PREPROCESS_SET_ECHO_SUPPRESS_ACTIVE,
-                                     &echo_suppress_attenuation_active);
+        struct pa_speex_split *split = ec->params.priv.speex.split;
+
+        if (split) {
+            unsigned i;
+
+            for (i = 0; i < split->channels; i++)
+                split->channel[i].pp_state = preprocessor_new(nframes, out_ss->rate, split->channel[i].state, agc, denoise,
+                                                              echo_suppress, echo_suppress_attenuation,
+                                                              echo_suppress_attenuation_active);
+        } else {
+            if (out_ss->channels != 1) {
+                pa_log("AGC, denoising and echo suppression only work with channels=1 or threads > 1");
+                goto fail;
             }
 
-            speex_preprocess_ctl(ec->params.priv.speex.pp_state, SPEEX_PREPROCESS_SET_ECHO_STATE,
-                                 ec->params.priv.speex.state);
+            ec->params.priv.speex.pp_state = preprocessor_new(nframes, out_ss->rate, ec->params.priv.speex.state, agc, denoise,
+                                                              echo_suppress, echo_suppress_attenuation,
+                                                              echo_suppress_attenuation_active);
         }
 
         pa_log_info("Loaded speex preprocessor with params: agc=%s, denoise=%s, echo_suppress=%s", pa_yes_no(agc),
@@ -152,7 +351,7 @@ pa_bool_t pa_speex_ec_init(pa_core *c, pa_echo_canceller *ec,
                            pa_sample_spec *out_ss, pa_channel_map *out_map,
                            uint32_t *nframes, const char *args) {
     int rate;
-    uint32_t frame_size_ms, filter_size_ms;
+    uint32_t frame_size_ms, filter_size_ms, threads;
     pa_modargs *ma;
 
     if (!(ma = pa_modargs_new(args, valid_modargs))) {
@@ -172,28 +371,50 @@ pa_bool_t pa_speex_ec_init(pa_core *c, pa_echo_canceller *ec,
         goto fail;
     }
 
+    threads = DEFAULT_THREADS;
+    if (pa_modargs_get_value_u32(ma, "threads", &threads) < 0 || threads < 1 || threads > PA_CHANNELS_MAX) {
+        pa_log("Invalid threads specification");
+        goto fail;
+    }
+
     pa_speex_ec_fixate_spec(rec_ss, rec_map, play_ss, play_map, out_ss, out_map);
 
     rate = out_ss->rate;
     *nframes = pa_echo_canceller_blocksize_power2(rate, frame_size_ms);
 
     pa_log_debug ("Using nframes %d, channels %d, rate %d", *nframes, out_ss->channels, out_ss->rate);
-    ec->params.priv.speex.state = speex_echo_state_init_mc(*nframes, (rate * filter_size_ms) / 1000, out_ss->channels, out_ss->channels);
+    threads = PA_MIN(threads, out_ss->channels);
 
-    if (!ec->params.priv.speex.state)
-        goto fail;
+    if (threads > 1) {
+        pa_log_debug("Running one canceller per channel in %u threads", threads);
 
-    speex_echo_ctl(ec->params.priv.speex.state, SPEEX_ECHO_SET_SAMPLING_RATE, &rate);
+        if (!(ec->params.priv.speex.split = split_new(c, out_ss->channels, threads, *nframes, rate, filter_size_ms)))
+            goto fail;
+    } else {
+        ec->params.priv.speex.state = speex_echo_state_init_mc(*nframes, (rate * filter_size_ms) / 1000, out_ss->channels, out_ss->channels);
+
+        if (!ec->params.priv.speex.state)
+            goto fail;
+
+        speex_echo_ctl(ec->params.priv.speex.state, SPEEX_ECHO_SET_SAMPLING_RATE, &rate);
+    }
 
     if (!pa_speex_ec_preprocessor_init(ec, out_ss, *nframes, ma))
         goto fail;
 
+    if (ec->params.priv.speex.split && !split_start(ec->params.priv.speex.split, threads))
+        goto fail;
+
     pa_modargs_free(ma);
     return TRUE;
 
 fail:
     if (ma)
         pa_modargs_free(ma);
+    if (ec->params.priv.speex.split) {
+        split_free(ec->params.priv.speex.split);
+        ec->params.priv.speex.split = NULL;
+    }
     if (ec->params.priv.speex.pp_state) {
         speex_preprocess_state_destroy(ec->params.priv.speex.pp_state);
         ec->params.priv.speex.pp_state = NULL;
@@ -206,6 +427,11 @@ fail:
 }
 
 void pa_speex_ec_run(pa_echo_canceller *ec, const uint8_t *rec, const uint8_t *play, uint8_t *out) {
+    if (ec->params.priv.speex.split) {
+        split_run(ec->params.priv.speex.split, rec, play, out);
+        return;
+    }
+
     speex_echo_cancellation(ec->params.priv.speex.state, (const spx_int16_t *) rec, (const spx_int16_t *) play,
                             (spx_int16_t *) out);
 
@@ -215,6 +441,11 @@ void pa_speex_ec_run(pa_echo_canceller *ec, const uint8_t *rec, const uint8_t *p
 }
 
 void pa_speex_ec_done(pa_echo_canceller *ec) {
+    if (ec->params.priv.speex.split) {
+        split_free(ec->params.priv.speex.split);
+        ec->params.priv.speex.split = NULL;
+    }
+
     if (ec->params.priv.speex.pp_state) {
         speex_preprocess_state_destroy(ec->params.priv.speex.pp_state);
         ec->params.priv.speex.pp_state = NULL;
@@ -30,6 +30,7 @@
 PA_C_DECL_BEGIN
 #include <pulsecore/core-util.h>
 #include <pulsecore/modargs.h>
+#include <pulsecore/sample-util.h>
 
 #include <pulse/timeval.h>
 #include "echo-cancel.h"
@@ -155,9 +156,23 @@ pa_bool_t pa_webrtc_ec_init(pa_core *c, pa_echo_canceller *ec,
         }
     }
 
+#ifdef HAVE_WEBRTC_FLOAT
+    /* The float interface only knows about mono and stereo */
+    if (out_ss->channels > 2) {
+        pa_log("WebRTC canceller only supports mono or stereo");
+        goto fail;
+    }
+#endif
+
     apm = webrtc::AudioProcessing::Create(0);
 
+#ifdef HAVE_WEBRTC_FLOAT
+    /* Float devices need no conversion then, and mono blocks are passed
+     * to the library without any copying */
+    out_ss->format = PA_SAMPLE_FLOAT32NE;
+#else
     out_ss->format = PA_SAMPLE_S16NE;
+#endif
     *play_ss = *out_ss;
     /* FIXME: the implementation actually allows a different number of
      * source/sink channels. Do we want to support that? */
@@ -220,6 +235,15 @@ pa_bool_t pa_webrtc_ec_init(pa_core *c, pa_echo_canceller *ec,
     ec->params.priv.webrtc.blocksize = (uint64_t)pa_bytes_per_second(out_ss) * BLOCK_SIZE_US / PA_USEC_PER_SEC;
     *nframes = ec->params.priv.webrtc.blocksize / pa_frame_size(out_ss);
 
+#ifdef HAVE_WEBRTC_FLOAT
+    if (out_ss->channels > 1) {
+        for (unsigned i = 0; i < out_ss->channels; i++) {
+            ec->params.priv.webrtc.rec_buffer[i] = pa_xnew(float, *nframes);
+            ec->params.priv.webrtc.play_buffer[i] = pa_xnew(float, *nframes);
+        }
+    }
+#endif
+
     pa_modargs_free(ma);
     return TRUE;
 
@@ -232,6 +256,66 @@ fail:
     return FALSE;
 }
 
+#ifdef HAVE_WEBRTC_FLOAT
+static webrtc::AudioProcessing::ChannelLayout channel_layout(const pa_sample_spec *ss) {
+    return ss->channels == 1 ? webrtc::AudioProcessing::kMono : webrtc::AudioProcessing::kStereo;
+}
+
+void pa_webrtc_ec_play(pa_echo_canceller *ec, const uint8_t *play) {
+    webrtc::AudioProcessing *apm = (webrtc::AudioProcessing*)ec->params.priv.webrtc.apm;
+    const pa_sample_spec *ss = &ec->params.priv.webrtc.sample_spec;
+    unsigned n = ec->params.priv.webrtc.blocksize / pa_frame_size(ss);
+    const float *buf[PA_CHANNELS_MAX];
+
+    if (ss->channels == 1)
+        buf[0] = (const float *) play;
+    else {
+        pa_deinterleave(play, (void **) ec->params.priv.webrtc.play_buffer, ss->channels, sizeof(float), n);
+
+        for (unsigned c = 0; c < ss->channels; c++)
+            buf[c] = ec->params.priv.webrtc.play_buffer[c];
+    }
+
+    apm->AnalyzeReverseStream(buf, n, ss->rate, channel_layout(ss));
+}
+
+void pa_webrtc_ec_record(pa_echo_canceller *ec, const uint8_t *rec, uint8_t *out) {
+    webrtc::AudioProcessing *apm = (webrtc::AudioProcessing*)ec->params.priv.webrtc.apm;
+    const pa_sample_spec *ss = &ec->params.priv.webrtc.sample_spec;
+    unsigned n = ec->params.priv.webrtc.blocksize / pa_frame_size(ss);
+    const float *src[PA_CHANNELS_MAX];
+    float *dst[PA_CHANNELS_MAX];
+    pa_cvolume v;
+
+    if (ss->channels == 1) {
+        src[0] = (const float *) rec;
+        dst[0] = (float *) out;
+    } else {
+        /* Processed in place in our deinterleaved buffers */
+        pa_deinterleave(rec, (void **) ec->params.priv.webrtc.rec_buffer, ss->channels, sizeof(float), n);
+
+        for (unsigned c = 0; c < ss->channels; c++)
+            src[c] = dst[c] = ec->params.priv.webrtc.rec_buffer[c];
+    }
+
+    if (ec->params.priv.webrtc.agc) {
+        pa_cvolume_init(&v);
+        pa_echo_canceller_get_capture_volume(ec, &v);
+        apm->gain_control()->set_stream_analog_level(pa_cvolume_avg(&v));
+    }
+
+    apm->set_stream_delay_ms(0);
+    apm->ProcessStream(src, n, ss->rate, channel_layout(ss), ss->rate, channel_layout(ss), dst);
+
+    if (ec->params.priv.webrtc.agc) {
+        pa_cvolume_set(&v, ss->channels, apm->gain_control()->stream_analog_level());
+        pa_echo_canceller_set_capture_volume(ec, &v);
+    }
+
+    if (ss->channels > 1)
+        pa_interleave((const void **) ec->params.priv.webrtc.rec_buffer, ss->channels, out, sizeof(float), n);
+}
+#else
 void pa_webrtc_ec_play(pa_echo_canceller *ec, const uint8_t *play) {
     webrtc::AudioProcessing *apm = (webrtc::AudioProcessing*)ec->params.priv.webrtc.apm;
     webrtc::AudioFrame play_frame;
@@ -272,6 +356,7 @@ void pa_webrtc_ec_record(pa_echo_canceller *ec, const uint8_t *rec, uint8_t *out
 
     memcpy(out, out_frame._payloadData, ec->params.priv.webrtc.blocksize);
 }
+#endif
 
 void pa_webrtc_ec_set_drift(pa_echo_canceller *ec, float drift) {
     webrtc::AudioProcessing *apm = (webrtc::AudioProcessing*)ec->params.priv.webrtc.apm;
@@ -290,4 +375,13 @@ void pa_webrtc_ec_done(pa_echo_canceller *ec) {
         webrtc::AudioProcessing::Destroy((webrtc::AudioProcessing*)ec->params.priv.webrtc.apm);
         ec->params.priv.webrtc.apm = NULL;
     }
+
+#ifdef HAVE_WEBRTC_FLOAT
+    for (unsigned c = 0; c < PA_CHANNELS_MAX; c++) {
+        pa_xfree(ec->params.priv.webrtc.rec_buffer[c]);
+        ec->params.priv.webrtc.rec_buffer[c] = NULL;
+        pa_xfree(ec->params.priv.webrtc.play_buffer[c]);
+        ec->params.priv.webrtc.play_buffer[c] = NULL;
+    }
+#endif
 }
@@ -0,0 +1,58 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <immintrin.h>
+
+#include "equalizer-sink-avx2.h"
+
+void pa_equalizer_apply_window_avx2(float *dst, const float *src, const float *W, float X, size_t n) {
+    const __m256 x = _mm256_set1_ps(X);
+    size_t j;
+
+    for (j = 0; j + 8 <= n; j += 8) {
+        __m256 w = _mm256_mul_ps(x, _mm256_loadu_ps(W + j));
+
+        _mm256_storeu_ps(dst + j, _mm256_mul_ps(w, _mm256_loadu_ps(src + j)));
+    }
+
+    for (; j < n; j++)
+        dst[j] = X * W[j] * src[j];
+}
+
+/* The filter is purely magnitude based, so every gain is applied to both
+ * halves of its complex bin: four bins per vector */
+void pa_equalizer_apply_filter_avx2(float *bins, const float *H, size_t n) {
+    const __m256i spread = _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3);
+    size_t j;
+
+    for (j = 0; j + 4 <= n; j += 4) {
+        __m256 h = _mm256_permutevar8x32_ps(_mm256_castps128_ps256(_mm_loadu_ps(H + j)), spread);
+
+        _mm256_storeu_ps(bins + 2 * j, _mm256_mul_ps(_mm256_loadu_ps(bins + 2 * j), h));
+    }
+
+    for (; j < n; j++) {
+        bins[2 * j] *= H[j];
+        bins[2 * j + 1] *= H[j];
+    }
+}
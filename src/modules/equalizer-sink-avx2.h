@@ -0,0 +1,31 @@
+#ifndef fooequalizersinkavx2hfoo
+#define fooequalizersinkavx2hfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <stddef.h>
+
+/* AVX2 versions of the per-window loops of module-equalizer-sink, built
+ * with -mavx2 and only to be called after checking the CPU flags */
+
+void pa_equalizer_apply_window_avx2(float *dst, const float *src, const float *W, float X, size_t n);
+void pa_equalizer_apply_filter_avx2(float *bins, const float *H, size_t n);
+
+#endif
@@ -0,0 +1,151 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core-util.h>
+#include <pulsecore/hashmap.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/refcnt.h>
+#include <pulsecore/shared.h>
+
+#include "fftw-plan-cache.h"
+
+#define SHARED_NAME "fftw-plan-cache"
+#define WISDOM_FILE "fftw-wisdom"
+
+struct pa_fftw_plan_cache {
+    PA_REFCNT_DECLARE;
+    pa_core *core;
+
+    /* (size << 1 | inverse) -> fftwf_plan */
+    pa_hashmap *plans;
+};
+
+static void load_wisdom(void) {
+    char *fn;
+
+    if (!(fn = pa_state_path(WISDOM_FILE, TRUE)))
+        return;
+
+    if (fftwf_import_wisdom_from_filename(fn))
+        pa_log_debug("Loaded FFTW wisdom from %s.", fn);
+
+    pa_xfree(fn);
+}
+
+static void save_wisdom(void) {
+    char *fn;
+
+    if (!(fn = pa_state_path(WISDOM_FILE, TRUE)))
+        return;
+
+    if (!fftwf_export_wisdom_to_filename(fn))
+        pa_log_warn("Failed to save FFTW wisdom to %s.", fn);
+
+    pa_xfree(fn);
+}
+
+pa_fftw_plan_cache* pa_fftw_plan_cache_get(pa_core *c) {
+    pa_fftw_plan_cache *cache;
+
+    pa_assert(c);
+
+    if ((cache = pa_shared_get(c, SHARED_NAME))) {
+        pa_assert(PA_REFCNT_VALUE(cache) >= 1);
+        PA_REFCNT_INC(cache);
+
+        return cache;
+    }
+
+    cache = pa_xnew0(pa_fftw_plan_cache, 1);
+    PA_REFCNT_INIT(cache);
+    cache->core = c;
+    cache->plans = pa_hashmap_new(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func);
+
+    pa_assert_se(pa_shared_set(c, SHARED_NAME, cache) >= 0);
+
+    load_wisdom();
+
+    return cache;
+}
+
+void pa_fftw_plan_cache_unref(pa_fftw_plan_cache *cache) {
+    pa_assert(cache);
+    pa_assert(PA_REFCNT_VALUE(cache) >= 1);
+
+    if (PA_REFCNT_DEC(cache) > 0)
+        return;
+
+    pa_assert_se(pa_shared_remove(cache->core, SHARED_NAME) >= 0);
+
+    pa_hashmap_free(cache->plans, (pa_free_cb_t) fftwf_destroy_plan);
+    pa_xfree(cache);
+}
+
+static fftwf_plan get_plan(pa_fftw_plan_cache *cache, unsigned n, pa_bool_t inverse) {
+    fftwf_plan plan;
+    void *key;
+    float *t;
+    fftwf_complex *f;
+
+    pa_assert(cache);
+    pa_assert(PA_REFCNT_VALUE(cache) >= 1);
+    pa_assert(n > 0);
+
+    key = PA_UINT_TO_PTR(n << 1 | (inverse ? 1 : 0));
+
+    if ((plan = pa_hashmap_get(cache->plans, key)))
+        return plan;
+
+    /* Measuring scribbles over the buffers, so plan on scratch ones. With
+     * wisdom from an earlier run this returns right away. */
+    pa_assert_se(t = fftwf_malloc(n * sizeof(float)));
+    pa_assert_se(f = fftwf_malloc((n / 2 + 1) * sizeof(fftwf_complex)));
+
+    if (inverse)
+        plan = fftwf_plan_dft_c2r_1d(n, f, t, FFTW_MEASURE);
+    else
+        plan = fftwf_plan_dft_r2c_1d(n, t, f, FFTW_MEASURE);
+
+    fftwf_free(f);
+    fftwf_free(t);
+
+    pa_assert(plan);
+    pa_assert_se(pa_hashmap_put(cache->plans, key, plan) >= 0);
+
+    pa_log_debug("Created %s FFTW plan of size %u.", inverse ? "inverse" : "forward", n);
+
+    save_wisdom();
+
+    return plan;
+}
+
+fftwf_plan pa_fftw_plan_cache_r2c(pa_fftw_plan_cache *cache, unsigned n) {
+    return get_plan(cache, n, FALSE);
+}
+
+fftwf_plan pa_fftw_plan_cache_c2r(pa_fftw_plan_cache *cache, unsigned n) {
+    return get_plan(cache, n, TRUE);
+}
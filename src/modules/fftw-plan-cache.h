@@ -0,0 +1,41 @@
+#ifndef foofftwplancachehfoo
+#define foofftwplancachehfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <fftw3.h>
+
+#include <pulsecore/core.h>
+
+/* FFTW plans shared by all modules of a core. The plans are out-of-place
+ * and must be run with fftwf_execute_dft_r2c() and fftwf_execute_dft_c2r()
+ * on buffers from fftwf_malloc(). They remain owned by the cache, and the
+ * wisdom gathered while measuring them is kept in the state directory.
+ * Only to be used from the main thread. */
+
+typedef struct pa_fftw_plan_cache pa_fftw_plan_cache;
+
+pa_fftw_plan_cache* pa_fftw_plan_cache_get(pa_core *c);
+void pa_fftw_plan_cache_unref(pa_fftw_plan_cache *cache);
+
+fftwf_plan pa_fftw_plan_cache_r2c(pa_fftw_plan_cache *cache, unsigned n);
+fftwf_plan pa_fftw_plan_cache_c2r(pa_fftw_plan_cache *cache, unsigned n);
+
+#endif
@@ -34,6 +34,8 @@
 #include <pulse/xmalloc.h>
 
 #include <pulsecore/sink.h>
+#include <pulsecore/atomic.h>
+#include <pulsecore/fdsem.h>
 #include <pulsecore/module.h>
 #include <pulsecore/core-util.h>
 #include <pulsecore/modargs.h>
@@ -56,6 +58,11 @@
  * should hopefully not be that expensive if RT scheduling is
  * enabled. A better fix would only be possible with additional event
  * source support in JACK.
+ *
+ * With ring_periods= set, the RT thread instead renders that many
+ * periods ahead into a lock-free ring, and the JACK thread just takes
+ * the next one from it without waiting for anybody. That costs the
+ * latency of the periods in the ring.
  */
 
 PA_MODULE_AUTHOR("Lennart Poettering");
@@ -69,9 +76,16 @@ PA_MODULE_USAGE(
         "client_name=<jack client name> "
         "channels=<number of channels> "
         "channel_map=<channel map> "
-        "connect=<connect ports?>");
+        "connect=<connect ports?> "
+        "ring_periods=<periods to render ahead of JACK, 0 to render on request>");
 
 #define DEFAULT_SINK_NAME "jack_out"
+#define RING_PERIODS_MAX 8
+
+struct ring_slot {
+    pa_memchunk chunk;
+    jack_nframes_t nframes;
+};
 
 struct userdata {
     pa_core *core;
@@ -95,6 +109,16 @@ struct userdata {
     jack_nframes_t frames_in_buffer;
     jack_nframes_t saved_frame_time;
     pa_bool_t saved_frame_time_valid;
+
+    /* Filled by the RT thread, emptied by the JACK thread. The counters
+     * only ever go up, the slot is the counter modulo n_ring. */
+    unsigned n_ring;
+    struct ring_slot ring[RING_PERIODS_MAX];
+    pa_atomic_t ring_read, ring_write;
+    pa_atomic_t ring_frame_time;
+    pa_fdsem *ring_fdsem;                /* Posted by JACK after taking a period */
+    pa_rtpoll_item *ring_rtpoll_item;
+    jack_nframes_t period;               /* RT thread only */
 };
 
 static const char* const valid_modargs[] = {
@@ -105,6 +129,7 @@ static const char* const valid_modargs[] = {
     "channels",
     "channel_map",
     "connect",
+    "ring_periods",
     NULL
 };
 
@@ -159,6 +184,9 @@ static int sink_process_msg(pa_msgobject *o, int code, void *data, int64_t offse
             return 0;
 
         case SINK_MESSAGE_BUFFER_SIZE:
+            /* Periods already in the ring have the old size, JACK plays
+             * silence instead of them */
+            u->period = (jack_nframes_t) offset;
             pa_sink_set_max_request_within_thread(u->sink, (size_t) offset * pa_frame_size(&u->sink->sample_spec));
             return 0;
 
@@ -175,6 +203,16 @@ static int sink_process_msg(pa_msgobject *o, int code, void *data, int64_t offse
             jack_port_get_latency_range(u->port[0], JackPlaybackLatency, &r);
             l = r.max + u->frames_in_buffer;
 
+            if (u->n_ring > 0) {
+                unsigned queued;
+
+                queued = (unsigned) pa_atomic_load(&u->ring_write) - (unsigned) pa_atomic_load(&u->ring_read);
+                l += queued * u->period;
+
+                u->saved_frame_time = (jack_nframes_t) pa_atomic_load(&u->ring_frame_time);
+                u->saved_frame_time_valid = u->saved_frame_time > 0;
+            }
+
             if (u->saved_frame_time_valid) {
                 /* Adjust the worst case latency by the time that
                  * passed since we last handed data to JACK */
@@ -196,6 +234,67 @@ static int sink_process_msg(pa_msgobject *o, int code, void *data, int64_t offse
     return pa_sink_process_msg(o, code, data, offset, memchunk);
 }
 
+/* Called from the RT thread. Renders periods until the ring is full. */
+static void ring_fill(struct userdata *u) {
+    unsigned w;
+
+    if (u->sink->thread_info.state != PA_SINK_RUNNING)
+        return;
+
+    while ((w = (unsigned) pa_atomic_load(&u->ring_write)) - (unsigned) pa_atomic_load(&u->ring_read) < u->n_ring) {
+        struct ring_slot *slot = &u->ring[w % u->n_ring];
+
+        /* JACK is done with this one */
+        if (slot->chunk.memblock)
+            pa_memblock_unref(slot->chunk.memblock);
+
+        pa_sink_render_full(u->sink, u->period * pa_frame_size(&u->sink->sample_spec), &slot->chunk);
+        slot->nframes = u->period;
+
+        pa_atomic_inc(&u->ring_write);
+    }
+
+    u->frames_in_buffer = u->period;
+}
+
+/* Called from the JACK thread. Plays the next period of the ring, or
+ * silence if there is none. */
+static void ring_process(struct userdata *u, jack_nframes_t nframes) {
+    unsigned r, c;
+    pa_bool_t played = FALSE;
+
+    r = (unsigned) pa_atomic_load(&u->ring_read);
+
+    if (r != (unsigned) pa_atomic_load(&u->ring_write)) {
+        struct ring_slot *slot = &u->ring[r % u->n_ring];
+
+        if (slot->nframes == nframes) {
+            void *p;
+
+            p = pa_memblock_acquire_chunk(&slot->chunk);
+            pa_deinterleave(p, u->buffer, u->channels, sizeof(float), (unsigned) nframes);
+            pa_memblock_release(slot->chunk.memblock);
+
+            played = TRUE;
+        }
+
+        pa_atomic_inc(&u->ring_read);
+        pa_fdsem_post(u->ring_fdsem);
+    }
+
+    if (!played) {
+        pa_sample_spec ss;
+
+        ss = u->sink->sample_spec;
+        ss.channels = 1;
+
+        for (c = 0; c < u->channels; c++)
+            pa_silence_memory(u->buffer[c], (size_t) nframes * pa_sample_size(&ss), &ss);
+    }
+
+    pa_atomic_store(&u->ring_frame_time, (int) jack_frame_time(u->client));
+}
+
 /* JACK Callback: This is called when JACK needs some data */
 static int jack_process(jack_nframes_t nframes, void *arg) {
     struct userdata *u = arg;
@@ -203,11 +302,16 @@ static int jack_process(jack_nframes_t nframes, void *arg) {
     jack_nframes_t frame_time;
     pa_assert(u);
 
-    /* We just forward the request to our other RT thread */
-
     for (c = 0; c < u->channels; c++)
         pa_assert_se(u->buffer[c] = jack_port_get_buffer(u->port[c], nframes));
 
+    if (u->n_ring > 0) {
+        ring_process(u, nframes);
+        return 0;
+    }
+
+    /* We just forward the request to our other RT thread */
+
     frame_time = jack_frame_time(u->client);
 
     pa_assert_se(pa_asyncmsgq_send(u->jack_msgq, PA_MSGOBJECT(u->sink), SINK_MESSAGE_RENDER, &frame_time, nframes, NULL) == 0);
@@ -232,6 +336,9 @@ static void thread_func(void *userdata) {
         if (PA_UNLIKELY(u->sink->thread_info.rewind_requested))
             pa_sink_process_rewind(u->sink, 0);
 
+        if (u->n_ring > 0)
+            ring_fill(u);
+
         if ((ret = pa_rtpoll_run(u->rtpoll, TRUE)) < 0)
             goto fail;
 
@@ -292,7 +399,7 @@ int pa__init(pa_module*m) {
     pa_modargs *ma = NULL;
     jack_status_t status;
     const char *server_name, *client_name;
-    uint32_t channels = 0;
+    uint32_t channels = 0, n_ring = 0;
     pa_bool_t do_connect = TRUE;
     unsigned i;
     const char **ports = NULL, **p;
@@ -314,6 +421,11 @@ int pa__init(pa_module*m) {
         goto fail;
     }
 
+    if (pa_modargs_get_value_u32(ma, "ring_periods", &n_ring) < 0 || n_ring > RING_PERIODS_MAX) {
+        pa_log("Failed to parse ring_periods= argument.");
+        goto fail;
+    }
+
     server_name = pa_modargs_get_value(ma, "server_name", NULL);
     client_name = pa_modargs_get_value(ma, "client_name", "PulseAudio JACK Sink");
 
@@ -334,6 +446,16 @@ int pa__init(pa_module*m) {
      * anything else */
     u->rtpoll_item = pa_rtpoll_item_new_asyncmsgq_read(u->rtpoll, PA_RTPOLL_EARLY-1, u->jack_msgq);
 
+    if ((u->n_ring = n_ring) > 0) {
+        if (!(u->ring_fdsem = pa_fdsem_new())) {
+            pa_log("Failed to create fdsem.");
+            goto fail;
+        }
+
+        /* Refilling the ring is just as urgent */
+        u->ring_rtpoll_item = pa_rtpoll_item_new_fdsem(u->rtpoll, PA_RTPOLL_EARLY-1, u->ring_fdsem);
+    }
+
     if (!(u->client = jack_client_open(client_name, server_name ? JackServerName : JackNullOption, &status, server_name))) {
         pa_log("jack_client_open() failed.");
         goto fail;
@@ -413,6 +535,7 @@ int pa__init(pa_module*m) {
     pa_sink_set_asyncmsgq(u->sink, u->thread_mq.inq);
     pa_sink_set_rtpoll(u->sink, u->rtpoll);
     pa_sink_set_max_request(u->sink, jack_get_buffer_size(u->client) * pa_frame_size(&u->sink->sample_spec));
+    u->period = jack_get_buffer_size(u->client);
 
     jack_set_process_callback(u->client, jack_process, u);
     jack_on_shutdown(u->client, jack_shutdown, u);
@@ -480,6 +603,7 @@ int pa__get_n_used(pa_module *m) {
 
 void pa__done(pa_module*m) {
     struct userdata *u;
+    unsigned i;
 
     pa_assert(m);
 
@@ -505,6 +629,16 @@ void pa__done(pa_module*m) {
     if (u->rtpoll_item)
         pa_rtpoll_item_free(u->rtpoll_item);
 
+    if (u->ring_rtpoll_item)
+        pa_rtpoll_item_free(u->ring_rtpoll_item);
+
+    if (u->ring_fdsem)
+        pa_fdsem_free(u->ring_fdsem);
+
+    for (i = 0; i < RING_PERIODS_MAX; i++)
+        if (u->ring[i].chunk.memblock)
+            pa_memblock_unref(u->ring[i].chunk.memblock);
+
     if (u->jack_msgq)
         pa_asyncmsgq_unref(u->jack_msgq);
 
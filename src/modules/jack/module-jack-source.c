@@ -34,6 +34,8 @@
 #include <pulse/xmalloc.h>
 
 #include <pulsecore/source.h>
+#include <pulsecore/atomic.h>
+#include <pulsecore/fdsem.h>
 #include <pulsecore/module.h>
 #include <pulsecore/core-util.h>
 #include <pulsecore/modargs.h>
@@ -46,7 +48,9 @@
 #include "module-jack-source-symdef.h"
 
 /* See module-jack-sink for a few comments how this module basically
- * works */
+ * works. With ring_periods= the JACK thread interleaves into blocks the
+ * RT thread has set aside in a lock-free ring, instead of allocating one
+ * and posting it for each period. */
 
 PA_MODULE_AUTHOR("Lennart Poettering");
 PA_MODULE_DESCRIPTION("JACK Source");
@@ -59,9 +63,16 @@ PA_MODULE_USAGE(
         "client_name=<jack client name> "
         "channels=<number of channels> "
         "channel_map=<channel map> "
-        "connect=<connect ports?>");
+        "connect=<connect ports?> "
+        "ring_periods=<periods JACK may get ahead of us, 0 to post each one>");
 
 #define DEFAULT_SOURCE_NAME "jack_in"
+#define RING_PERIODS_MAX 8
+
+struct ring_slot {
+    pa_memchunk chunk;
+    jack_nframes_t frame_time;
+};
 
 struct userdata {
     pa_core *core;
@@ -82,6 +93,14 @@ struct userdata {
 
     jack_nframes_t saved_frame_time;
     pa_bool_t saved_frame_time_valid;
+
+    /* Filled by the JACK thread, emptied by the RT thread. The counters
+     * only ever go up, the slot is the counter modulo n_ring. */
+    unsigned n_ring;
+    struct ring_slot ring[RING_PERIODS_MAX];
+    pa_atomic_t ring_read, ring_write;
+    pa_fdsem *ring_fdsem;                /* Posted by JACK after filling a slot */
+    pa_rtpoll_item *ring_rtpoll_item;
 };
 
 static const char* const valid_modargs[] = {
@@ -92,6 +111,7 @@ static const char* const valid_modargs[] = {
     "channels",
     "channel_map",
     "connect",
+    "ring_periods",
     NULL
 };
 
@@ -152,6 +172,59 @@ static int source_process_msg(pa_msgobject *o, int code, void *data, int64_t off
     return pa_source_process_msg(o, code, data, offset, chunk);
 }
 
+/* Called from the RT thread. Posts what JACK has put into the ring, and
+ * hands the slots back with fresh blocks. */
+static void ring_drain(struct userdata *u) {
+    unsigned r;
+
+    while ((r = (unsigned) pa_atomic_load(&u->ring_read)) != (unsigned) pa_atomic_load(&u->ring_write)) {
+        struct ring_slot *slot = &u->ring[r % u->n_ring];
+
+        if (u->source->thread_info.state == PA_SOURCE_RUNNING)
+            pa_source_post(u->source, &slot->chunk);
+
+        u->saved_frame_time = slot->frame_time;
+        u->saved_frame_time_valid = TRUE;
+
+        /* The source outputs might still hold on to the old one */
+        pa_memblock_unref(slot->chunk.memblock);
+        slot->chunk.memblock = pa_memblock_new(u->core->mempool, (size_t) -1);
+
+        pa_atomic_inc(&u->ring_read);
+    }
+}
+
+/* Called from the JACK thread */
+static void ring_process(struct userdata *u, const void *buffer[], jack_nframes_t nframes) {
+    struct ring_slot *slot;
+    unsigned w;
+    size_t length;
+    void *p;
+
+    w = (unsigned) pa_atomic_load(&u->ring_write);
+
+    /* With the RT thread that far behind, the period is lost either way */
+    if (w - (unsigned) pa_atomic_load(&u->ring_read) >= u->n_ring)
+        return;
+
+    slot = &u->ring[w % u->n_ring];
+    length = nframes * pa_frame_size(&u->source->sample_spec);
+
+    if (length > pa_memblock_get_length(slot->chunk.memblock))
+        return;
+
+    p = pa_memblock_acquire(slot->chunk.memblock);
+    pa_interleave(buffer, u->channels, p, sizeof(float), nframes);
+    pa_memblock_release(slot->chunk.memblock);
+
+    slot->chunk.index = 0;
+    slot->chunk.length = length;
+    slot->frame_time = jack_frame_time(u->client);
+
+    pa_atomic_inc(&u->ring_write);
+    pa_fdsem_post(u->ring_fdsem);
+}
+
 static int jack_process(jack_nframes_t nframes, void *arg) {
     unsigned c;
     struct userdata *u = arg;
@@ -165,6 +238,11 @@ static int jack_process(jack_nframes_t nframes, void *arg) {
     for (c = 0; c < u->channels; c++)
         pa_assert_se(buffer[c] = jack_port_get_buffer(u->port[c], nframes));
 
+    if (u->n_ring > 0) {
+        ring_process(u, buffer, nframes);
+        return 0;
+    }
+
     /* We interleave the data and pass it on to the other RT thread */
 
     pa_memchunk_reset(&chunk);
@@ -198,6 +276,9 @@ static void thread_func(void *userdata) {
     for (;;) {
         int ret;
 
+        if (u->n_ring > 0)
+            ring_drain(u);
+
         if ((ret = pa_rtpoll_run(u->rtpoll, TRUE)) < 0)
             goto fail;
 
@@ -246,7 +327,7 @@ int pa__init(pa_module*m) {
     pa_modargs *ma = NULL;
     jack_status_t status;
     const char *server_name, *client_name;
-    uint32_t channels = 0;
+    uint32_t channels = 0, n_ring = 0;
     pa_bool_t do_connect = TRUE;
     unsigned i;
     const char **ports = NULL, **p;
@@ -268,6 +349,11 @@ int pa__init(pa_module*m) {
         goto fail;
     }
 
+    if (pa_modargs_get_value_u32(ma, "ring_periods", &n_ring) < 0 || n_ring > RING_PERIODS_MAX) {
+        pa_log("Failed to parse ring_periods= argument.");
+        goto fail;
+    }
+
     server_name = pa_modargs_get_value(ma, "server_name", NULL);
     client_name = pa_modargs_get_value(ma, "client_name", "PulseAudio JACK Source");
 
@@ -281,6 +367,21 @@ int pa__init(pa_module*m) {
     u->jack_msgq = pa_asyncmsgq_new(0);
     u->rtpoll_item = pa_rtpoll_item_new_asyncmsgq_read(u->rtpoll, PA_RTPOLL_EARLY-1, u->jack_msgq);
 
+    if ((u->n_ring = n_ring) > 0) {
+        if (!(u->ring_fdsem = pa_fdsem_new())) {
+            pa_log("Failed to create fdsem.");
+            goto fail;
+        }
+
+        u->ring_rtpoll_item = pa_rtpoll_item_new_fdsem(u->rtpoll, PA_RTPOLL_EARLY-1, u->ring_fdsem);
+
+        /* Blocks of the maximum size, so that they fit any JACK buffer size */
+        for (i = 0; i < u->n_ring; i++) {
+            u->ring[i].chunk.memblock = pa_memblock_new(u->core->mempool, (size_t) -1);
+            u->ring[i].chunk.index = u->ring[i].chunk.length = 0;
+        }
+    }
+
     if (!(u->client = jack_client_open(client_name, server_name ? JackServerName : JackNullOption, &status, server_name))) {
         pa_log("jack_client_open() failed.");
         goto fail;
@@ -426,6 +527,7 @@ int pa__get_n_used(pa_module *m) {
 
 void pa__done(pa_module*m) {
     struct userdata *u;
+    unsigned i;
     pa_assert(m);
 
     if (!(u = m->userdata))
@@ -450,6 +552,16 @@ void pa__done(pa_module*m) {
     if (u->rtpoll_item)
         pa_rtpoll_item_free(u->rtpoll_item);
 
+    if (u->ring_rtpoll_item)
+        pa_rtpoll_item_free(u->ring_rtpoll_item);
+
+    if (u->ring_fdsem)
+        pa_fdsem_free(u->ring_fdsem);
+
+    for (i = 0; i < RING_PERIODS_MAX; i++)
+        if (u->ring[i].chunk.memblock)
+            pa_memblock_unref(u->ring[i].chunk.memblock);
+
     if (u->jack_msgq)
         pa_asyncmsgq_unref(u->jack_msgq);
 
@@ -0,0 +1,58 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <immintrin.h>
+
+#include "latency-test-avx2.h"
+
+/* Eight neighbouring lags at a time, so every marker sample is
+ * broadcast once and multiplied with an unaligned window of the
+ * recording. Even and odd marker samples go to separate accumulators to
+ * keep two additions in flight. */
+void pa_latency_test_correlate_avx2(float *dst, const float *x, size_t n_lags, const float *marker, size_t n_marker) {
+    size_t l, j;
+
+    for (l = 0; l + 8 <= n_lags; l += 8) {
+        __m256 even = _mm256_setzero_ps();
+        __m256 odd = _mm256_setzero_ps();
+
+        for (j = 0; j + 2 <= n_marker; j += 2) {
+            even = _mm256_add_ps(even, _mm256_mul_ps(_mm256_set1_ps(marker[j]), _mm256_loadu_ps(x + l + j)));
+            odd = _mm256_add_ps(odd, _mm256_mul_ps(_mm256_set1_ps(marker[j + 1]), _mm256_loadu_ps(x + l + j + 1)));
+        }
+
+        if (j < n_marker)
+            even = _mm256_add_ps(even, _mm256_mul_ps(_mm256_set1_ps(marker[j]), _mm256_loadu_ps(x + l + j)));
+
+        _mm256_storeu_ps(dst + l, _mm256_add_ps(even, odd));
+    }
+
+    for (; l < n_lags; l++) {
+        float sum = 0.0f;
+
+        for (j = 0; j < n_marker; j++)
+            sum += x[l + j] * marker[j];
+
+        dst[l] = sum;
+    }
+}
@@ -0,0 +1,30 @@
+#ifndef foolatencytestavx2hfoo
+#define foolatencytestavx2hfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <stddef.h>
+
+/* AVX2 version of the cross-correlation of module-latency-test, built
+ * with -mavx2 and only to be called after checking the CPU flags */
+
+void pa_latency_test_correlate_avx2(float *dst, const float *x, size_t n_lags, const float *marker, size_t n_marker);
+
+#endif
@@ -29,6 +29,7 @@
 #include <config.h>
 #endif
 
+#include <pulse/timeval.h>
 #include <pulse/xmalloc.h>
 
 #include <pulsecore/sink.h>
@@ -45,6 +46,8 @@
 #include <pulsecore/thread.h>
 #include <pulsecore/thread-mq.h>
 #include <pulsecore/i18n.h>
+#include <pulsecore/atomic.h>
+#include <pulsecore/fdsem.h>
 
 #include <CoreAudio/CoreAudio.h>
 #include <CoreAudio/CoreAudioTypes.h>
@@ -53,17 +56,21 @@
 #include "module-coreaudio-device-symdef.h"
 
 #define DEFAULT_FRAMES_PER_IOPROC 512
+#define DEFAULT_RING_PERIODS 2
+#define RING_PERIODS_MAX 8
 
 PA_MODULE_AUTHOR("Daniel Mack");
 PA_MODULE_DESCRIPTION("CoreAudio device");
 PA_MODULE_VERSION(PACKAGE_VERSION);
 PA_MODULE_LOAD_ONCE(FALSE);
 PA_MODULE_USAGE("object_id=<the CoreAudio device id> "
-                "ioproc_frames=<audio frames per IOProc call> ");
+                "ioproc_frames=<audio frames per IOProc call, follows the requested latency if unset> "
+                "ring_periods=<IOProc periods rendered ahead, 0 to render in the IOProc> ");
 
 static const char* const valid_modargs[] = {
     "object_id",
     "ioproc_frames",
+    "ring_periods",
     NULL
 };
 
@@ -95,6 +102,18 @@ struct userdata {
 
     AudioStreamBasicDescription stream_description;
 
+    /* The IOProc buffer size. Unless ioproc_frames= fixes it, it is
+     * negotiated from the requested latency in the IO thread. */
+    UInt32 frames, frames_min, frames_max;
+    pa_bool_t fixed_frames;
+
+    /* With ring_periods= the IOProc only copies between the device and
+     * the rings of the streams, which the IO thread keeps filled and
+     * drained. It posts ring_fdsem after each call. */
+    unsigned n_ring;
+    pa_fdsem *ring_fdsem;
+    pa_rtpoll_item *ring_rtpoll_item;
+
     PA_LLIST_HEAD(coreaudio_sink, sinks);
     PA_LLIST_HEAD(coreaudio_source, sources);
 };
@@ -110,6 +129,10 @@ struct coreaudio_sink {
     pa_channel_map map;
     pa_sample_spec ss;
 
+    /* The counters only ever go up, the slot is the counter modulo n_ring */
+    pa_memchunk ring[RING_PERIODS_MAX];
+    pa_atomic_t ring_read, ring_write;
+
     PA_LLIST_FIELDS(coreaudio_sink);
 };
 
@@ -124,6 +147,10 @@ struct coreaudio_source {
     pa_channel_map map;
     pa_sample_spec ss;
 
+    /* The counters only ever go up, the slot is the counter modulo n_ring */
+    pa_memchunk ring[RING_PERIODS_MAX];
+    pa_atomic_t ring_read, ring_write;
+
     PA_LLIST_FIELDS(coreaudio_source);
 };
 
@@ -131,6 +158,61 @@ static int card_set_profile(pa_card *c, pa_card_profile *new_profile) {
     return 0;
 }
 
+/* Called from the IOProc. Plays what the IO thread has rendered ahead,
+ * silence if it fell behind or the buffer size has just changed. */
+static void sink_ring_process(coreaudio_sink *sink, AudioBuffer *buf) {
+    struct userdata *u = sink->userdata;
+    pa_memchunk *chunk;
+    unsigned r;
+    void *p;
+
+    r = (unsigned) pa_atomic_load(&sink->ring_read);
+
+    if (r == (unsigned) pa_atomic_load(&sink->ring_write)) {
+        memset(buf->mData, 0, buf->mDataByteSize);
+        return;
+    }
+
+    chunk = &sink->ring[r % u->n_ring];
+
+    if (chunk->length == buf->mDataByteSize) {
+        p = pa_memblock_acquire(chunk->memblock);
+        memcpy(buf->mData, (uint8_t*) p + chunk->index, chunk->length);
+        pa_memblock_release(chunk->memblock);
+    } else
+        memset(buf->mData, 0, buf->mDataByteSize);
+
+    pa_atomic_inc(&sink->ring_read);
+}
+
+/* Called from the IOProc */
+static void source_ring_process(coreaudio_source *source, const AudioBuffer *buf) {
+    struct userdata *u = source->userdata;
+    pa_memchunk *chunk;
+    unsigned w;
+    void *p;
+
+    w = (unsigned) pa_atomic_load(&source->ring_write);
+
+    /* With the IO thread that far behind, the period is lost either way */
+    if (w - (unsigned) pa_atomic_load(&source->ring_read) >= u->n_ring)
+        return;
+
+    chunk = &source->ring[w % u->n_ring];
+
+    if (buf->mDataByteSize > pa_memblock_get_length(chunk->memblock))
+        return;
+
+    p = pa_memblock_acquire(chunk->memblock);
+    memcpy(p, buf->mData, buf->mDataByteSize);
+    pa_memblock_release(chunk->memblock);
+
+    chunk->index = 0;
+    chunk->length = buf->mDataByteSize;
+
+    pa_atomic_inc(&source->ring_write);
+}
+
 static OSStatus io_render_proc (AudioDeviceID          device,
                                 const AudioTimeStamp  *now,
                                 const AudioBufferList *inputData,
@@ -143,6 +225,21 @@ static OSStatus io_render_proc (AudioDeviceID          device,
     pa_assert(u);
     pa_assert(device == u->object_id);
 
+    if (u->n_ring > 0) {
+        coreaudio_sink *sink = u->sinks;
+        coreaudio_source *source = u->sources;
+        UInt32 i;
+
+        for (i = 0; outputData && i < outputData->mNumberBuffers && sink; i++, sink = sink->next)
+            sink_ring_process(sink, outputData->mBuffers + i);
+
+        for (i = 0; inputData && i < inputData->mNumberBuffers && source; i++, source = source->next)
+            source_ring_process(source, inputData->mBuffers + i);
+
+        pa_fdsem_post(u->ring_fdsem);
+        return 0;
+    }
+
     u->render_input_data = inputData;
     u->render_output_data = outputData;
 
@@ -253,6 +350,123 @@ static pa_usec_t get_latency_us(pa_object *o) {
     return pa_bytes_to_usec(total * pa_frame_size(ss), ss);
 }
 
+/* Called from IO context. What sits in the ring on top of the device latency. */
+static pa_usec_t ring_latency_us(struct userdata *u, pa_atomic_t *ring_read, pa_atomic_t *ring_write, const pa_sample_spec *ss) {
+    unsigned n;
+
+    if (u->n_ring == 0)
+        return 0;
+
+    n = (unsigned) pa_atomic_load(ring_write) - (unsigned) pa_atomic_load(ring_read);
+
+    return pa_bytes_to_usec((uint64_t) n * u->frames * pa_frame_size(ss), ss);
+}
+
+/* Called from IO context */
+static void sink_ring_fill(coreaudio_sink *sink) {
+    struct userdata *u = sink->userdata;
+    size_t length;
+    unsigned w;
+
+    length = u->frames * pa_frame_size(&sink->ss);
+
+    /* The IOProc only touches the slots between read and write */
+    while ((w = (unsigned) pa_atomic_load(&sink->ring_write)) - (unsigned) pa_atomic_load(&sink->ring_read) < u->n_ring) {
+        pa_memchunk *chunk = &sink->ring[w % u->n_ring];
+
+        if (chunk->memblock)
+            pa_memblock_unref(chunk->memblock);
+
+        pa_sink_render_full(sink->pa_sink, length, chunk);
+        pa_atomic_inc(&sink->ring_write);
+    }
+}
+
+/* Called from IO context. Posts what the IOProc has put into the ring,
+ * and hands the slots back with fresh blocks. */
+static void source_ring_drain(coreaudio_source *source) {
+    struct userdata *u = source->userdata;
+    unsigned r;
+
+    while ((r = (unsigned) pa_atomic_load(&source->ring_read)) != (unsigned) pa_atomic_load(&source->ring_write)) {
+        pa_memchunk *chunk = &source->ring[r % u->n_ring];
+
+        if (PA_SOURCE_IS_OPENED(source->pa_source->thread_info.state))
+            pa_source_post(source->pa_source, chunk);
+
+        /* The source outputs might still hold on to the old one */
+        pa_memblock_unref(chunk->memblock);
+        chunk->memblock = pa_memblock_new(u->module->core->mempool, (size_t) -1);
+
+        pa_atomic_inc(&source->ring_read);
+    }
+}
+
+/* Called from IO context. The IOProc serves all streams of the device,
+ * so its buffer size follows the lowest latency any of them asks for. */
+static void update_buffer_frame_size(struct userdata *u) {
+    coreaudio_sink *ca_sink;
+    coreaudio_source *ca_source;
+    pa_usec_t latency = (pa_usec_t) -1, l;
+    UInt32 frames;
+    OSStatus err;
+    AudioObjectPropertyAddress property_address;
+
+    pa_assert(u);
+
+    if (u->fixed_frames)
+        return;
+
+    PA_LLIST_FOREACH(ca_sink, u->sinks)
+        if ((l = pa_sink_get_requested_latency_within_thread(ca_sink->pa_sink)) != (pa_usec_t) -1)
+            latency = PA_MIN(latency, l);
+
+    PA_LLIST_FOREACH(ca_source, u->sources)
+        if ((l = pa_source_get_requested_latency_within_thread(ca_source->pa_source)) != (pa_usec_t) -1)
+            latency = PA_MIN(latency, l);
+
+    /* The IOProc buffer and the ring together make up the latency */
+    if (latency == (pa_usec_t) -1)
+        frames = DEFAULT_FRAMES_PER_IOPROC;
+    else
+        frames = (UInt32) ((double) (latency / (u->n_ring + 1)) * u->stream_description.mSampleRate / PA_USEC_PER_SEC);
+
+    frames = PA_CLAMP(frames, u->frames_min, u->frames_max);
+
+    if (frames == u->frames)
+        return;
+
+    property_address.mSelector = kAudioDevicePropertyBufferFrameSize;
+    property_address.mScope = kAudioObjectPropertyScopeGlobal;
+    property_address.mElement = kAudioObjectPropertyElementMaster;
+
+    err = AudioObjectSetPropertyData(u->object_id, &property_address, 0, NULL, sizeof(frames), &frames);
+    if (err) {
+        pa_log_warn("Failed to set buffer frame size to %u (err = %08x).", (unsigned int) frames, (int) err);
+        return;
+    }
+
+    pa_log_debug("%u frames per IOProc", (unsigned int) frames);
+    u->frames = frames;
+
+    PA_LLIST_FOREACH(ca_sink, u->sinks)
+        pa_sink_set_max_request_within_thread(ca_sink->pa_sink, u->frames * pa_frame_size(&ca_sink->ss));
+}
+
+/* Called from IO context */
+static void sink_update_requested_latency_cb(pa_sink *s) {
+    coreaudio_sink *sink = s->userdata;
+
+    update_buffer_frame_size(sink->userdata);
+}
+
+/* Called from IO context */
+static void source_update_requested_latency_cb(pa_source *s) {
+    coreaudio_source *source = s->userdata;
+
+    update_buffer_frame_size(source->userdata);
+}
+
 static void ca_device_check_device_state(struct userdata *u) {
     coreaudio_sink *ca_sink;
     coreaudio_source *ca_source;
@@ -306,7 +520,7 @@ static int sink_process_msg(pa_msgobject *o, int code, void *data, int64_t offse
         }
 
         case PA_SINK_MESSAGE_GET_LATENCY: {
-            *((pa_usec_t *) data) = get_latency_us(PA_OBJECT(o));
+            *((pa_usec_t *) data) = get_latency_us(PA_OBJECT(o)) + ring_latency_us(u, &sink->ring_read, &sink->ring_write, &sink->ss);
             return 0;
         }
     }
@@ -344,7 +558,7 @@ static int source_process_msg(pa_msgobject *o, int code, void *data, int64_t off
         }
 
         case PA_SOURCE_MESSAGE_GET_LATENCY: {
-            *((pa_usec_t *) data) = get_latency_us(PA_OBJECT(o));
+            *((pa_usec_t *) data) = get_latency_us(PA_OBJECT(o)) + ring_latency_us(u, &source->ring_read, &source->ring_write, &source->ss);
             return 0;
         }
     }
@@ -389,6 +603,9 @@ static int ca_device_create_sink(pa_module *m, AudioBuffer *buf, int channel_idx
     pa_strbuf *strbuf;
     AudioObjectPropertyAddress property_address;
 
+    if (!u->fixed_frames)
+        flags |= PA_SINK_DYNAMIC_LATENCY;
+
     ca_sink = pa_xnew0(coreaudio_sink, 1);
     ca_sink->map.channels = buf->mNumberChannels;
     ca_sink->ss.channels = buf->mNumberChannels;
@@ -458,9 +675,16 @@ static int ca_device_create_sink(pa_module *m, AudioBuffer *buf, int channel_idx
     sink->parent.process_msg = sink_process_msg;
     sink->userdata = ca_sink;
     sink->set_state = ca_sink_set_state;
+    sink->update_requested_latency = sink_update_requested_latency_cb;
 
     pa_sink_set_asyncmsgq(sink, u->thread_mq.inq);
     pa_sink_set_rtpoll(sink, u->rtpoll);
+    pa_sink_set_max_request(sink, u->frames * pa_frame_size(&ca_sink->ss));
+
+    if (!u->fixed_frames)
+        pa_sink_set_latency_range(sink,
+                                  pa_bytes_to_usec((uint64_t) u->frames_min * (u->n_ring + 1) * pa_frame_size(&ca_sink->ss), &ca_sink->ss),
+                                  pa_bytes_to_usec((uint64_t) u->frames_max * (u->n_ring + 1) * pa_frame_size(&ca_sink->ss), &ca_sink->ss));
 
     ca_sink->pa_sink = sink;
     ca_sink->userdata = u;
@@ -507,6 +731,9 @@ static int ca_device_create_source(pa_module *m, AudioBuffer *buf, int channel_i
     pa_strbuf *strbuf;
     AudioObjectPropertyAddress property_address;
 
+    if (!u->fixed_frames)
+        flags |= PA_SOURCE_DYNAMIC_LATENCY;
+
     ca_source = pa_xnew0(coreaudio_source, 1);
     ca_source->map.channels = buf->mNumberChannels;
     ca_source->ss.channels = buf->mNumberChannels;
@@ -576,10 +803,20 @@ static int ca_device_create_source(pa_module *m, AudioBuffer *buf, int channel_i
     source->parent.process_msg = source_process_msg;
     source->userdata = ca_source;
     source->set_state = ca_source_set_state;
+    source->update_requested_latency = source_update_requested_latency_cb;
 
     pa_source_set_asyncmsgq(source, u->thread_mq.inq);
     pa_source_set_rtpoll(source, u->rtpoll);
 
+    if (!u->fixed_frames)
+        pa_source_set_latency_range(source,
+                                    pa_bytes_to_usec((uint64_t) u->frames_min * (u->n_ring + 1) * pa_frame_size(&ca_source->ss), &ca_source->ss),
+                                    pa_bytes_to_usec((uint64_t) u->frames_max * (u->n_ring + 1) * pa_frame_size(&ca_source->ss), &ca_source->ss));
+
+    /* Blocks of the maximum size, so that they fit any IOProc buffer size */
+    for (i = 0; i < u->n_ring; i++)
+        ca_source->ring[i].memblock = pa_memblock_new(m->core->mempool, (size_t) -1);
+
     ca_source->pa_source = source;
     ca_source->userdata = u;
 
@@ -671,6 +908,7 @@ static void thread_func(void *userdata) {
 
     for (;;) {
         coreaudio_sink *ca_sink;
+        coreaudio_source *ca_source;
         int ret;
 
         PA_LLIST_FOREACH(ca_sink, u->sinks) {
@@ -678,6 +916,15 @@ static void thread_func(void *userdata) {
                 pa_sink_process_rewind(ca_sink->pa_sink, 0);
         }
 
+        if (u->n_ring > 0) {
+            PA_LLIST_FOREACH(ca_sink, u->sinks)
+                if (PA_SINK_IS_OPENED(ca_sink->pa_sink->thread_info.state))
+                    sink_ring_fill(ca_sink);
+
+            PA_LLIST_FOREACH(ca_source, u->sources)
+                source_ring_drain(ca_source);
+        }
+
         ret = pa_rtpoll_run(u->rtpoll, TRUE);
 
         if (ret < 0)
@@ -699,7 +946,7 @@ finish:
 
 int pa__init(pa_module *m) {
     OSStatus err;
-    UInt32 size, frames;
+    UInt32 size;
     struct userdata *u = NULL;
     pa_modargs *ma = NULL;
     char tmp[64];
@@ -708,6 +955,7 @@ int pa__init(pa_module *m) {
     coreaudio_sink *ca_sink;
     coreaudio_source *ca_source;
     AudioObjectPropertyAddress property_address;
+    AudioValueRange range;
 
     pa_assert(m);
 
@@ -767,11 +1015,48 @@ int pa__init(pa_module *m) {
     u->card->userdata = u;
     u->card->set_profile = card_set_profile;
 
+    u->n_ring = DEFAULT_RING_PERIODS;
+    if (pa_modargs_get_value_u32(ma, "ring_periods", &u->n_ring) < 0 || u->n_ring > RING_PERIODS_MAX) {
+        pa_log("Failed to parse ring_periods= argument.");
+        goto fail;
+    }
+
+    /* set number of frames in IOProc */
+    u->frames = DEFAULT_FRAMES_PER_IOPROC;
+    u->fixed_frames = !!pa_modargs_get_value(ma, "ioproc_frames", NULL);
+    pa_modargs_get_value_u32(ma, "ioproc_frames", (unsigned int *) &u->frames);
+
+    property_address.mSelector = kAudioDevicePropertyBufferFrameSizeRange;
+    size = sizeof(range);
+    err = AudioObjectGetPropertyData(u->object_id, &property_address, 0, NULL, &size, &range);
+    if (!err && range.mMinimum >= 1 && range.mMaximum >= range.mMinimum) {
+        u->frames_min = (UInt32) range.mMinimum;
+        u->frames_max = (UInt32) range.mMaximum;
+        u->frames = PA_CLAMP(u->frames, u->frames_min, u->frames_max);
+    } else {
+        pa_log_warn("Failed to get buffer frame size range, not following the requested latency.");
+        u->frames_min = u->frames_max = u->frames;
+        u->fixed_frames = TRUE;
+    }
+
+    property_address.mSelector = kAudioDevicePropertyBufferFrameSize;
+    AudioObjectSetPropertyData(u->object_id, &property_address, 0, NULL, sizeof(u->frames), &u->frames);
+    pa_log_debug("%u frames per IOProc, %u to %u if negotiated", (unsigned int) u->frames, (unsigned int) u->frames_min, (unsigned int) u->frames_max);
+
     u->rtpoll = pa_rtpoll_new();
     pa_thread_mq_init(&u->thread_mq, m->core->mainloop, u->rtpoll);
     u->async_msgq = pa_asyncmsgq_new(0);
     pa_rtpoll_item_new_asyncmsgq_read(u->rtpoll, PA_RTPOLL_EARLY-1, u->async_msgq);
 
+    if (u->n_ring > 0) {
+        if (!(u->ring_fdsem = pa_fdsem_new())) {
+            pa_log("Failed to create fdsem.");
+            goto fail;
+        }
+
+        u->ring_rtpoll_item = pa_rtpoll_item_new_fdsem(u->rtpoll, PA_RTPOLL_EARLY-1, u->ring_fdsem);
+    }
+
     PA_LLIST_HEAD_INIT(coreaudio_sink, u->sinks);
 
     /* create sinks */
@@ -793,14 +1078,6 @@ int pa__init(pa_module *m) {
 
     AudioObjectAddPropertyListener(u->object_id, &property_address, ca_stream_format_changed, u);
 
-    /* set number of frames in IOProc */
-    frames = DEFAULT_FRAMES_PER_IOPROC;
-    pa_modargs_get_value_u32(ma, "ioproc_frames", (unsigned int *) &frames);
-
-    property_address.mSelector = kAudioDevicePropertyBufferFrameSize;
-    AudioObjectSetPropertyData(u->object_id, &property_address, 0, NULL, sizeof(frames), &frames);
-    pa_log_debug("%u frames per IOProc\n", (unsigned int) frames);
-
     /* create one ioproc for both directions */
     err = AudioDeviceCreateIOProcID(u->object_id, io_render_proc, u, &u->proc_id);
     if (err) {
@@ -832,6 +1109,7 @@ void pa__done(pa_module *m) {
     struct userdata *u;
     coreaudio_sink *ca_sink;
     coreaudio_source *ca_source;
+    unsigned i;
     AudioObjectPropertyAddress property_address;
 
     pa_assert(m);
@@ -849,6 +1127,12 @@ void pa__done(pa_module *m) {
         if (ca_source->pa_source)
             pa_source_unlink(ca_source->pa_source);
 
+    /* The IOProc uses the streams and, in ring mode, their blocks */
+    if (u->proc_id) {
+        AudioDeviceStop(u->object_id, u->proc_id);
+        AudioDeviceDestroyIOProcID(u->object_id, u->proc_id);
+    }
+
     if (u->thread) {
         pa_asyncmsgq_send(u->thread_mq.inq, NULL, PA_MESSAGE_SHUTDOWN, NULL, 0, NULL);
         pa_thread_free(u->thread);
@@ -863,6 +1147,10 @@ void pa__done(pa_module *m) {
         if (ca_sink->pa_sink)
             pa_sink_unref(ca_sink->pa_sink);
 
+        for (i = 0; i < RING_PERIODS_MAX; i++)
+            if (ca_sink->ring[i].memblock)
+                pa_memblock_unref(ca_sink->ring[i].memblock);
+
         pa_xfree(ca_sink->name);
         pa_xfree(ca_sink);
         ca_sink = next;
@@ -875,22 +1163,27 @@ void pa__done(pa_module *m) {
         if (ca_source->pa_source)
             pa_source_unref(ca_source->pa_source);
 
+        for (i = 0; i < RING_PERIODS_MAX; i++)
+            if (ca_source->ring[i].memblock)
+                pa_memblock_unref(ca_source->ring[i].memblock);
+
         pa_xfree(ca_source->name);
         pa_xfree(ca_source);
         ca_source = next;
     }
 
-    if (u->proc_id) {
-        AudioDeviceStop(u->object_id, u->proc_id);
-        AudioDeviceDestroyIOProcID(u->object_id, u->proc_id);
-    }
-
     property_address.mSelector = kAudioDevicePropertyStreamFormat;
     property_address.mScope = kAudioObjectPropertyScopeGlobal;
     property_address.mElement = kAudioObjectPropertyElementMaster;
 
     AudioObjectRemovePropertyListener(kAudioObjectSystemObject, &property_address, ca_stream_format_changed, u);
 
+    if (u->ring_rtpoll_item)
+        pa_rtpoll_item_free(u->ring_rtpoll_item);
+
+    if (u->ring_fdsem)
+        pa_fdsem_free(u->ring_fdsem);
+
     pa_xfree(u->device_name);
     pa_xfree(u->vendor_name);
     pa_rtpoll_free(u->rtpoll);
@@ -44,6 +44,7 @@
 #include <pulsecore/card.h>
 #include <pulsecore/namereg.h>
 #include <pulsecore/database.h>
+#include <pulsecore/database-flusher.h>
 #include <pulsecore/tagstruct.h>
 
 #include "module-card-restore-symdef.h"
@@ -53,7 +54,6 @@ PA_MODULE_DESCRIPTION("Automatically restore profile of cards");
 PA_MODULE_VERSION(PACKAGE_VERSION);
 PA_MODULE_LOAD_ONCE(TRUE);
 
-#define SAVE_INTERVAL (10 * PA_USEC_PER_SEC)
 
 static const char* const valid_modargs[] = {
     NULL
@@ -66,7 +66,7 @@ struct userdata {
     pa_hook_slot *card_put_hook_slot;
     pa_hook_slot *card_profile_hook_slot;
     pa_hook_slot *port_offset_hook_slot;
-    pa_time_event *save_time_event;
+    pa_database_flusher *flusher;
     pa_database *database;
     bool hooks_connected;
 };
@@ -84,26 +84,8 @@ struct entry {
     pa_hashmap *ports; /* Port name -> struct port_info */
 };
 
-static void save_time_callback(pa_mainloop_api*a, pa_time_event* e, const struct timeval *t, void *userdata) {
-    struct userdata *u = userdata;
-
-    pa_assert(a);
-    pa_assert(e);
-    pa_assert(u);
-
-    pa_assert(e == u->save_time_event);
-    u->core->mainloop->time_free(u->save_time_event);
-    u->save_time_event = NULL;
-
-    pa_database_sync(u->database);
-    pa_log_info("Synced.");
-}
-
 static void trigger_save(struct userdata *u) {
-    if (u->save_time_event)
-        return;
-
-    u->save_time_event = pa_core_rttime_new(u->core, pa_rtclock_now() + SAVE_INTERVAL, save_time_callback, u);
+    pa_database_flusher_schedule(u->flusher, u->database);
 }
 
 static struct entry* entry_new(void) {
@@ -500,6 +482,8 @@ int pa__init(pa_module*m) {
         goto fail;
     }
 
+    u->flusher = pa_database_flusher_get(m->core);
+
     pa_log_info("Successfully opened database file '%s'.", fname);
     pa_xfree(fname);
 
@@ -530,8 +514,12 @@ void pa__done(pa_module*m) {
         pa_hook_slot_free(u->port_offset_hook_slot);
     }
 
-    if (u->save_time_event)
-        u->core->mainloop->time_free(u->save_time_event);
+    if (u->flusher) {
+        if (u->database)
+            pa_database_flusher_remove(u->flusher, u->database);
+
+        pa_database_flusher_unref(u->flusher);
+    }
 
     if (u->database)
         pa_database_close(u->database);
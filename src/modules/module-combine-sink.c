@@ -36,6 +36,8 @@
 #include <pulsecore/sink.h>
 #include <pulsecore/sink-input.h>
 #include <pulsecore/memblockq.h>
+#include <pulsecore/resampler.h>
+#include <pulsecore/sample-util.h>
 #include <pulsecore/log.h>
 #include <pulsecore/core-rtclock.h>
 #include <pulsecore/core-util.h>
@@ -57,7 +59,7 @@ PA_MODULE_USAGE(
         "sink_name=<name for the sink> "
         "sink_properties=<properties for the sink> "
         "slaves=<slave sinks> "
-        "adjust_time=<how often to readjust rates in s> "
+        "adjust_time=<time in s within which latency differences are corrected> "
         "resample_method=<method> "
         "format=<sample format> "
         "rate=<sample rate> "
@@ -72,6 +74,10 @@ PA_MODULE_USAGE(
 
 #define BLOCK_USEC (PA_USEC_PER_MSEC * 200)
 
+#define ADJUST_INTERVAL_USEC (PA_USEC_PER_SEC)
+#define LATENCY_MEASURE_USEC (PA_USEC_PER_MSEC * 100)
+#define LATENCY_FILTER_USEC (PA_USEC_PER_SEC * 2)
+
 static const char* const valid_modargs[] = {
     "sink_name",
     "sink_properties",
@@ -85,11 +91,42 @@ static const char* const valid_modargs[] = {
     NULL
 };
 
+/* Outputs with the same sample spec and channel map on the same card
+ * share one resampler in the sink thread, and are handed the very same
+ * memblocks. Since they should share the clock too, they also share the
+ * rate adjustment. */
+struct group {
+    struct userdata *userdata;
+
+    pa_sample_spec sample_spec;
+    pa_channel_map channel_map;
+    pa_card *card;
+
+    /* Managed in main context */
+    unsigned n_outputs;
+
+    /* Converts from the spec of the combined sink to ours, run in IO
+     * thread context */
+    pa_resampler *resampler;
+
+    struct {
+        uint64_t serial;
+        pa_memchunk chunk;
+
+        uint32_t rate;
+        pa_usec_t latency_sum;
+        unsigned n_latency;
+    } thread_info;
+
+    PA_LLIST_FIELDS(struct group);
+};
+
 struct output {
     struct userdata *userdata;
 
     pa_sink *sink;
     pa_sink_input *sink_input;
+    struct group *group;
     pa_bool_t ignore_state_change;
 
     pa_asyncmsgq *inq,    /* Message queue from the sink thread to this sink input */
@@ -99,8 +136,14 @@ struct output {
 
     pa_memblockq *memblockq;
 
-    /* For communication of the stream latencies to the main thread */
-    pa_usec_t total_latency;
+    /* For communication of the stream latencies to the sink thread,
+     * measured and smoothed by the thread of the output */
+    pa_atomic_t total_latency, sink_latency;
+
+    struct {
+        pa_usec_t last_measure;
+        double total_latency, sink_latency;
+    } thread_info;
 
     /* For communication of the stream parameters to the sink thread */
     pa_atomic_t max_request;
@@ -118,7 +161,6 @@ struct userdata {
     pa_thread_mq thread_mq;
     pa_rtpoll *rtpoll;
 
-    pa_time_event *time_event;
     pa_usec_t adjust_time;
 
     pa_bool_t automatic;
@@ -133,9 +175,12 @@ struct userdata {
     pa_usec_t block_usec;
 
     pa_idxset* outputs; /* managed in main context */
+    PA_LLIST_HEAD(struct group, groups); /* managed in main context */
 
     struct {
         PA_LLIST_HEAD(struct output, active_outputs); /* managed in IO thread context */
+        uint64_t render_serial;
+        pa_usec_t next_adjust;
         pa_atomic_t running;  /* we cache that value here, so that every thread can query it cheaply */
         pa_usec_t timestamp;
         pa_bool_t in_null_mode;
@@ -148,7 +193,6 @@ enum {
     SINK_MESSAGE_ADD_OUTPUT = PA_SINK_MESSAGE_MAX,
     SINK_MESSAGE_REMOVE_OUTPUT,
     SINK_MESSAGE_NEED,
-    SINK_MESSAGE_UPDATE_LATENCY,
     SINK_MESSAGE_UPDATE_MAX_REQUEST,
     SINK_MESSAGE_UPDATE_REQUESTED_LATENCY
 };
@@ -162,101 +206,112 @@ static void output_enable(struct output *o);
 static void output_free(struct output *o);
 static int output_create_sink_input(struct output *o);
 
-static void adjust_rates(struct userdata *u) {
+/* Called from IO thread context */
+static void update_smoother(struct userdata *u, pa_usec_t now, pa_usec_t latency) {
+    pa_usec_t y;
+
+    y = pa_bytes_to_usec(u->thread_info.counter, &u->sink->sample_spec);
+
+    if (y > latency)
+        y -= latency;
+    else
+        y = 0;
+
+    pa_smoother_put(u->thread_info.smoother, now, y);
+}
+
+/* Called from IO thread context. Works only with the latencies the
+ * outputs measured in their own threads, so that nobody has to wait
+ * for anybody. */
+static void adjust_rates(struct userdata *u, pa_usec_t now) {
     struct output *o;
     pa_usec_t max_sink_latency = 0, min_total_latency = (pa_usec_t) -1, target_latency, avg_total_latency = 0;
     uint32_t base_rate;
-    uint32_t idx;
     unsigned n = 0;
 
     pa_assert(u);
-    pa_sink_assert_ref(u->sink);
 
-    if (pa_idxset_size(u->outputs) <= 0)
+    if (now < u->thread_info.next_adjust)
         return;
 
-    if (!PA_SINK_IS_OPENED(pa_sink_get_state(u->sink)))
-        return;
+    u->thread_info.next_adjust = now + ADJUST_INTERVAL_USEC;
 
-    PA_IDXSET_FOREACH(o, u->outputs, idx) {
-        pa_usec_t sink_latency;
+    PA_LLIST_FOREACH(o, u->thread_info.active_outputs) {
+        o->group->thread_info.latency_sum = 0;
+        o->group->thread_info.n_latency = 0;
+    }
 
-        if (!o->sink_input || !PA_SINK_IS_OPENED(pa_sink_get_state(o->sink)))
+    PA_LLIST_FOREACH(o, u->thread_info.active_outputs) {
+        int total_latency, sink_latency;
+
+        if ((total_latency = pa_atomic_load(&o->total_latency)) < 0)
             continue;
 
-        o->total_latency = pa_sink_input_get_latency(o->sink_input, &sink_latency);
-        o->total_latency += sink_latency;
+        sink_latency = pa_atomic_load(&o->sink_latency);
 
-        if (sink_latency > max_sink_latency)
-            max_sink_latency = sink_latency;
+        if ((pa_usec_t) sink_latency > max_sink_latency)
+            max_sink_latency = (pa_usec_t) sink_latency;
 
-        if (min_total_latency == (pa_usec_t) -1 || o->total_latency < min_total_latency)
-            min_total_latency = o->total_latency;
+        if (min_total_latency == (pa_usec_t) -1 || (pa_usec_t) total_latency < min_total_latency)
+            min_total_latency = (pa_usec_t) total_latency;
 
-        avg_total_latency += o->total_latency;
+        avg_total_latency += (pa_usec_t) total_latency;
         n++;
 
-        pa_log_debug("[%s] total=%0.2fms sink=%0.2fms ", o->sink->name, (double) o->total_latency / PA_USEC_PER_MSEC, (double) sink_latency / PA_USEC_PER_MSEC);
+        o->group->thread_info.latency_sum += (pa_usec_t) total_latency;
+        o->group->thread_info.n_latency++;
 
-        if (o->total_latency > 10*PA_USEC_PER_SEC)
-            pa_log_warn("[%s] Total latency of output is very high (%0.2fms), most likely the audio timing in one of your drivers is broken.", o->sink->name, (double) o->total_latency / PA_USEC_PER_MSEC);
+        if ((pa_usec_t) total_latency > 10*PA_USEC_PER_SEC)
+            pa_log_warn("[%s] Total latency of output is very high (%0.2fms), most likely the audio timing in one of your drivers is broken.", o->sink->name, (double) total_latency / PA_USEC_PER_MSEC);
     }
 
-    if (min_total_latency == (pa_usec_t) -1)
+    if (n <= 0)
         return;
 
     avg_total_latency /= n;
+    update_smoother(u, now, avg_total_latency);
 
-    target_latency = max_sink_latency > min_total_latency ? max_sink_latency : min_total_latency;
-
-    pa_log_info("[%s] avg total latency is %0.2f msec.", u->sink->name, (double) avg_total_latency / PA_USEC_PER_MSEC);
-    pa_log_info("[%s] target latency is %0.2f msec.", u->sink->name, (double) target_latency / PA_USEC_PER_MSEC);
+    if (u->adjust_time <= 0)
+        return;
 
+    target_latency = max_sink_latency > min_total_latency ? max_sink_latency : min_total_latency;
     base_rate = u->sink->sample_spec.rate;
 
-    PA_IDXSET_FOREACH(o, u->outputs, idx) {
+    PA_LLIST_FOREACH(o, u->thread_info.active_outputs) {
+        struct group *g = o->group;
         uint32_t new_rate = base_rate;
-        uint32_t current_rate = o->sink_input->sample_spec.rate;
+        uint32_t current_rate = g->thread_info.rate;
+        pa_usec_t latency;
 
-        if (!o->sink_input || !PA_SINK_IS_OPENED(pa_sink_get_state(o->sink)))
+        /* Every group is handled by its first output, the outputs of a
+         * group cannot be adjusted individually, follow their average */
+        if (g->thread_info.n_latency <= 0)
             continue;
 
-        if (o->total_latency != target_latency)
-            new_rate += (uint32_t) (((double) o->total_latency - (double) target_latency) / (double) u->adjust_time * (double) new_rate);
+        latency = g->thread_info.latency_sum / g->thread_info.n_latency;
+        g->thread_info.n_latency = 0;
+
+        /* Correct the latency difference within adjust_time */
+        if (latency != target_latency)
+            new_rate += (uint32_t) (((double) latency - (double) target_latency) / (double) u->adjust_time * (double) new_rate + 0.5);
 
         if (new_rate < (uint32_t) (base_rate*0.8) || new_rate > (uint32_t) (base_rate*1.25)) {
-            pa_log_warn("[%s] sample rates too different, not adjusting (%u vs. %u).", o->sink_input->sink->name, base_rate, new_rate);
+            pa_log_warn("[%s] sample rates too different, not adjusting (%u vs. %u).", o->sink->name, base_rate, new_rate);
             new_rate = base_rate;
         } else {
-            if (base_rate < new_rate + 20 && new_rate < base_rate + 20)
-              new_rate = base_rate;
             /* Do the adjustment in small steps; 2‰ can be considered inaudible */
-            if (new_rate < (uint32_t) (current_rate*0.998) || new_rate > (uint32_t) (current_rate*1.002)) {
-                pa_log_info("[%s] new rate of %u Hz not within 2‰ of %u Hz, forcing smaller adjustment", o->sink_input->sink->name, new_rate, current_rate);
+            if (new_rate < (uint32_t) (current_rate*0.998) || new_rate > (uint32_t) (current_rate*1.002))
                 new_rate = PA_CLAMP(new_rate, (uint32_t) (current_rate*0.998), (uint32_t) (current_rate*1.002));
-            }
-            pa_log_info("[%s] new rate is %u Hz; ratio is %0.3f; latency is %0.2f msec.", o->sink_input->sink->name, new_rate, (double) new_rate / base_rate, (double) o->total_latency / PA_USEC_PER_MSEC);
         }
-        pa_sink_input_set_rate(o->sink_input, new_rate);
-    }
 
-    pa_asyncmsgq_send(u->sink->asyncmsgq, PA_MSGOBJECT(u->sink), SINK_MESSAGE_UPDATE_LATENCY, NULL, (int64_t) avg_total_latency, NULL);
-}
-
-static void time_callback(pa_mainloop_api *a, pa_time_event *e, const struct timeval *t, void *userdata) {
-    struct userdata *u = userdata;
-
-    pa_assert(u);
-    pa_assert(a);
-    pa_assert(u->time_event == e);
+        if (new_rate == current_rate)
+            continue;
 
-    adjust_rates(u);
+        pa_log_debug("[%s] new rate is %u Hz; ratio is %0.4f; latency is %0.2f msec, target is %0.2f msec.", o->sink->name, new_rate, (double) new_rate / base_rate, (double) latency / PA_USEC_PER_MSEC, (double) target_latency / PA_USEC_PER_MSEC);
 
-    if (pa_sink_get_state(u->sink) == PA_SINK_SUSPENDED) {
-        u->core->mainloop->time_free(e);
-        u->time_event = NULL;
-    } else
-        pa_core_rttime_restart(u->core, e, pa_rtclock_now() + u->adjust_time);
+        g->thread_info.rate = new_rate;
+        pa_resampler_set_input_rate(g->resampler, new_rate);
+    }
 }
 
 static void process_render_null(struct userdata *u, pa_usec_t now) {
@@ -316,7 +371,7 @@ static void thread_func(void *userdata) {
         if (u->sink->thread_info.state == PA_SINK_RUNNING && !u->thread_info.active_outputs) {
             pa_usec_t now;
 
-            now = pa_rtclock_now();
+            now = pa_rtpoll_now(u->rtpoll);
 
             if (!u->thread_info.in_null_mode || u->thread_info.timestamp <= now)
                 process_render_null(u, now);
@@ -366,6 +421,9 @@ static void render_memblock(struct userdata *u, struct output *o, size_t length)
     while (pa_asyncmsgq_process_one(o->inq) > 0)
         ;
 
+    /* The request is in the spec of the output, translate it into ours */
+    length = pa_resampler_request(o->group->resampler, length);
+
     /* Ok, now let's prepare some data if we really have to */
     while (!pa_memblockq_is_readable(o->memblockq)) {
         struct output *j;
@@ -375,19 +433,39 @@ static void render_memblock(struct userdata *u, struct output *o, size_t length)
         pa_sink_render(u->sink, length, &chunk);
 
         u->thread_info.counter += chunk.length;
+        u->thread_info.render_serial++;
 
-        /* OK, let's send this data to the other threads */
+        /* OK, let's convert this data once for every group, and send
+         * it to the other threads */
         PA_LLIST_FOREACH(j, u->thread_info.active_outputs) {
-            if (j == o)
+            struct group *g = j->group;
+
+            if (g->thread_info.serial != u->thread_info.render_serial) {
+                g->thread_info.serial = u->thread_info.render_serial;
+                pa_resampler_run(g->resampler, &chunk, &g->thread_info.chunk);
+            }
+
+            /* The resampler might have held everything back */
+            if (g->thread_info.chunk.length <= 0)
                 continue;
 
-            pa_asyncmsgq_post(j->inq, PA_MSGOBJECT(j->sink_input), SINK_INPUT_MESSAGE_POST, NULL, 0, &chunk, NULL);
+            if (j == o)
+                /* And place it directly into the requesting output's queue */
+                pa_memblockq_push_align(o->memblockq, &g->thread_info.chunk);
+            else
+                pa_asyncmsgq_post(j->inq, PA_MSGOBJECT(j->sink_input), SINK_INPUT_MESSAGE_POST, NULL, 0, &g->thread_info.chunk, NULL);
         }
 
-        /* And place it directly into the requesting output's queue */
-        pa_memblockq_push_align(o->memblockq, &chunk);
+        PA_LLIST_FOREACH(j, u->thread_info.active_outputs)
+            if (j->group->thread_info.chunk.memblock) {
+                pa_memblock_unref(j->group->thread_info.chunk.memblock);
+                pa_memchunk_reset(&j->group->thread_info.chunk);
+            }
+
         pa_memblock_unref(chunk.memblock);
     }
+
+    adjust_rates(u, pa_rtclock_now());
 }
 
 /* Called from I/O thread context */
@@ -411,6 +489,50 @@ static void request_memblock(struct output *o, size_t length) {
         pa_asyncmsgq_send(o->outq, PA_MSGOBJECT(o->userdata->sink), SINK_MESSAGE_NEED, o, (int64_t) length, NULL);
 }
 
+/* Called from I/O thread context */
+static void reset_latency(struct output *o) {
+    pa_assert(o);
+
+    o->thread_info.last_measure = 0;
+    pa_atomic_store(&o->total_latency, -1);
+    pa_atomic_store(&o->sink_latency, -1);
+}
+
+/* Called from I/O thread context */
+static void measure_latency(struct output *o) {
+    pa_sink_input *i;
+    pa_usec_t now, sink_latency, total_latency;
+
+    pa_assert(o);
+    pa_sink_input_assert_ref(i = o->sink_input);
+
+    now = pa_rtclock_now();
+
+    if (o->thread_info.last_measure > 0 && now < o->thread_info.last_measure + LATENCY_MEASURE_USEC)
+        return;
+
+    sink_latency = pa_sink_get_latency_within_thread(i->sink);
+    total_latency = sink_latency +
+        pa_bytes_to_usec(pa_memblockq_get_length(o->memblockq), &i->sample_spec) +
+        pa_bytes_to_usec(pa_memblockq_get_length(i->thread_info.render_memblockq), &i->sink->sample_spec);
+
+    /* Smooth out the jitter of the wakeups */
+    if (o->thread_info.last_measure <= 0) {
+        o->thread_info.sink_latency = (double) sink_latency;
+        o->thread_info.total_latency = (double) total_latency;
+    } else {
+        double w = PA_MIN((double) (now - o->thread_info.last_measure) / LATENCY_FILTER_USEC, 1.0);
+
+        o->thread_info.sink_latency += w * ((double) sink_latency - o->thread_info.sink_latency);
+        o->thread_info.total_latency += w * ((double) total_latency - o->thread_info.total_latency);
+    }
+
+    o->thread_info.last_measure = now;
+
+    pa_atomic_store(&o->sink_latency, (int) (o->thread_info.sink_latency + 0.5));
+    pa_atomic_store(&o->total_latency, (int) (o->thread_info.total_latency + 0.5));
+}
+
 /* Called from I/O thread context */
 static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk) {
     struct output *o;
@@ -433,6 +555,8 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk
 
     pa_memblockq_drop(o->memblockq, chunk->length);
 
+    measure_latency(o);
+
     return 0;
 }
 
@@ -515,6 +639,8 @@ static void sink_input_attach_cb(pa_sink_input *i) {
 
     pa_sink_input_request_rewind(i, 0, FALSE, TRUE, TRUE);
 
+    reset_latency(o);
+
     pa_atomic_store(&o->max_request, (int) pa_sink_input_get_max_request(i));
 
     c = pa_sink_get_requested_latency_within_thread(i->sink);
@@ -542,6 +668,18 @@ static void sink_input_detach_cb(pa_sink_input *i) {
     }
 }
 
+/* Called from I/O thread context */
+static void sink_input_suspend_within_thread_cb(pa_sink_input *i, pa_bool_t b) {
+    struct output *o;
+
+    pa_sink_input_assert_ref(i);
+    pa_assert_se(o = i->userdata);
+
+    /* A suspended sink has no latency worth following */
+    if (b)
+        reset_latency(o);
+}
+
 /* Called from main context */
 static void sink_input_kill_cb(pa_sink_input *i) {
     struct output *o;
@@ -566,7 +704,7 @@ static int sink_input_process_msg(pa_msgobject *obj, int code, void *data, int64
             *r = pa_bytes_to_usec(pa_memblockq_get_length(o->memblockq), &o->sink_input->sample_spec);
 
             /* Fall through, the default handler will add in the extra
-             * latency added by the resampler */
+             * latency of the render queue */
             break;
         }
 
@@ -608,9 +746,6 @@ static void unsuspend(struct userdata *u) {
     PA_IDXSET_FOREACH(o, u->outputs, idx)
         output_enable(o);
 
-    if (!u->time_event)
-        u->time_event = pa_core_rttime_new(u->core, pa_rtclock_now() + u->adjust_time, time_callback, u);
-
     pa_log_info("Resumed successfully...");
 }
 
@@ -784,21 +919,6 @@ static int sink_process_msg(pa_msgobject *o, int code, void *data, int64_t offse
             render_memblock(u, (struct output*) data, (size_t) offset);
             return 0;
 
-        case SINK_MESSAGE_UPDATE_LATENCY: {
-            pa_usec_t x, y, latency = (pa_usec_t) offset;
-
-            x = pa_rtclock_now();
-            y = pa_bytes_to_usec(u->thread_info.counter, &u->sink->sample_spec);
-
-            if (y > latency)
-                y -= latency;
-            else
-                y = 0;
-
-            pa_smoother_put(u->thread_info.smoother, x, y);
-            return 0;
-        }
-
         case SINK_MESSAGE_UPDATE_MAX_REQUEST:
             update_max_request(u);
             break;
@@ -846,31 +966,119 @@ static void update_description(struct userdata *u) {
     pa_xfree(t);
 }
 
+/* Called from main context */
+static struct group *group_get(struct userdata *u, pa_sink *sink) {
+    struct group *g;
+
+    pa_assert(u);
+    pa_sink_assert_ref(sink);
+
+    /* Sinks without a card might be driven by just about any clock */
+    if (sink->card)
+        PA_LLIST_FOREACH(g, u->groups)
+            if (g->card == sink->card &&
+                pa_sample_spec_equal(&g->sample_spec, &sink->sample_spec) &&
+                pa_channel_map_equal(&g->channel_map, &sink->channel_map)) {
+                g->n_outputs++;
+                return g;
+            }
+
+    g = pa_xnew0(struct group, 1);
+    g->userdata = u;
+    g->sample_spec = sink->sample_spec;
+    g->channel_map = sink->channel_map;
+    g->card = sink->card;
+    g->thread_info.rate = u->sink->sample_spec.rate;
+
+    if (!(g->resampler = pa_resampler_new(
+                  u->core->mempool,
+                  &u->sink->sample_spec,
+                  &u->sink->channel_map,
+                  &g->sample_spec,
+                  &g->channel_map,
+                  u->resample_method,
+                  PA_RESAMPLER_VARIABLE_RATE))) {
+        pa_xfree(g);
+        return NULL;
+    }
+
+    g->n_outputs = 1;
+    PA_LLIST_PREPEND(struct group, u->groups, g);
+
+    return g;
+}
+
+/* Called from main context, after the output has been removed from the IO thread */
+static void group_release(struct group *g) {
+    struct userdata *u;
+
+    pa_assert(g);
+    pa_assert(g->n_outputs > 0);
+    pa_assert_se(u = g->userdata);
+
+    if (--g->n_outputs > 0)
+        return;
+
+    PA_LLIST_REMOVE(struct group, u->groups, g);
+
+    if (g->thread_info.chunk.memblock)
+        pa_memblock_unref(g->thread_info.chunk.memblock);
+
+    pa_resampler_free(g->resampler);
+    pa_xfree(g);
+}
+
 static int output_create_sink_input(struct output *o) {
     pa_sink_input_new_data data;
+    pa_memchunk silence;
 
     pa_assert(o);
 
     if (o->sink_input)
         return 0;
 
+    pa_assert(!o->group);
+
+    if (!(o->group = group_get(o->userdata, o->sink)))
+        return -1;
+
+    /* The data is already converted to the spec of the sink when it
+     * reaches us, so the sink input passes it through unchanged */
+    pa_silence_memchunk_get(&o->userdata->core->silence_cache, o->userdata->core->mempool, &silence, &o->group->sample_spec, 0);
+    o->memblockq = pa_memblockq_new(
+            "module-combine-sink output memblockq",
+            0,
+            MEMBLOCKQ_MAXLENGTH,
+            MEMBLOCKQ_MAXLENGTH,
+            &o->group->sample_spec,
+            1,
+            0,
+            0,
+            &silence);
+    pa_memblock_unref(silence.memblock);
+
     pa_sink_input_new_data_init(&data);
     pa_sink_input_new_data_set_sink(&data, o->sink, FALSE);
     data.driver = __FILE__;
     pa_proplist_setf(data.proplist, PA_PROP_MEDIA_NAME, "Simultaneous output on %s", pa_strnull(pa_proplist_gets(o->sink->proplist, PA_PROP_DEVICE_DESCRIPTION)));
     pa_proplist_sets(data.proplist, PA_PROP_MEDIA_ROLE, "filter");
-    pa_sink_input_new_data_set_sample_spec(&data, &o->userdata->sink->sample_spec);
-    pa_sink_input_new_data_set_channel_map(&data, &o->userdata->sink->channel_map);
+    pa_sink_input_new_data_set_sample_spec(&data, &o->group->sample_spec);
+    pa_sink_input_new_data_set_channel_map(&data, &o->group->channel_map);
     data.module = o->userdata->module;
     data.resample_method = o->userdata->resample_method;
-    data.flags = PA_SINK_INPUT_VARIABLE_RATE|PA_SINK_INPUT_DONT_MOVE|PA_SINK_INPUT_NO_CREATE_ON_SUSPEND;
+    data.flags = PA_SINK_INPUT_DONT_MOVE|PA_SINK_INPUT_NO_CREATE_ON_SUSPEND;
 
     pa_sink_input_new(&o->sink_input, o->userdata->core, &data);
 
     pa_sink_input_new_data_done(&data);
 
-    if (!o->sink_input)
+    if (!o->sink_input) {
+        pa_memblockq_free(o->memblockq);
+        o->memblockq = NULL;
+        group_release(o->group);
+        o->group = NULL;
         return -1;
+    }
 
     o->sink_input->parent.process_msg = sink_input_process_msg;
     o->sink_input->pop = sink_input_pop_cb;
@@ -880,6 +1088,7 @@ static int output_create_sink_input(struct output *o) {
     o->sink_input->update_sink_requested_latency = sink_input_update_sink_requested_latency_cb;
     o->sink_input->attach = sink_input_attach_cb;
     o->sink_input->detach = sink_input_detach_cb;
+    o->sink_input->suspend_within_thread = sink_input_suspend_within_thread_cb;
     o->sink_input->kill = sink_input_kill_cb;
     o->sink_input->userdata = o;
 
@@ -901,16 +1110,8 @@ static struct output *output_new(struct userdata *u, pa_sink *sink) {
     o->inq = pa_asyncmsgq_new(0);
     o->outq = pa_asyncmsgq_new(0);
     o->sink = sink;
-    o->memblockq = pa_memblockq_new(
-            "module-combine-sink output memblockq",
-            0,
-            MEMBLOCKQ_MAXLENGTH,
-            MEMBLOCKQ_MAXLENGTH,
-            &u->sink->sample_spec,
-            1,
-            0,
-            0,
-            &u->sink->silence);
+    pa_atomic_store(&o->total_latency, -1);
+    pa_atomic_store(&o->sink_latency, -1);
 
     pa_assert_se(pa_idxset_put(u->outputs, o, NULL) == 0);
     update_description(u);
@@ -941,9 +1142,6 @@ static void output_free(struct output *o) {
     if (o->outq)
         pa_asyncmsgq_unref(o->outq);
 
-    if (o->memblockq)
-        pa_memblockq_free(o->memblockq);
-
     pa_xfree(o);
 }
 
@@ -1000,9 +1198,13 @@ static void output_disable(struct output *o) {
     o->sink_input = NULL;
 
     /* Finally, drop all queued data */
-    pa_memblockq_flush_write(o->memblockq, TRUE);
     pa_asyncmsgq_flush(o->inq, FALSE);
     pa_asyncmsgq_flush(o->outq, FALSE);
+    pa_memblockq_free(o->memblockq);
+    o->memblockq = NULL;
+
+    group_release(o->group);
+    o->group = NULL;
 }
 
 /* Called from main context */
@@ -1349,9 +1551,6 @@ int pa__init(pa_module*m) {
     PA_IDXSET_FOREACH(o, u->outputs, idx)
         output_verify(o);
 
-    if (u->adjust_time > 0)
-        u->time_event = pa_core_rttime_new(m->core, pa_rtclock_now() + u->adjust_time, time_callback, u);
-
     pa_modargs_free(ma);
 
     return 0;
@@ -1404,9 +1603,6 @@ void pa__done(pa_module*m) {
     if (u->rtpoll)
         pa_rtpoll_free(u->rtpoll);
 
-    if (u->time_event)
-        u->core->mainloop->time_free(u->time_event);
-
     if (u->thread_info.smoother)
         pa_smoother_free(u->thread_info.smoother);
 
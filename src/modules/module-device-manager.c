@@ -49,6 +49,7 @@
 #include <pulsecore/pstream.h>
 #include <pulsecore/pstream-util.h>
 #include <pulsecore/database.h>
+#include <pulsecore/database-flusher.h>
 #include <pulsecore/tagstruct.h>
 
 #include "module-device-manager-symdef.h"
@@ -62,7 +63,6 @@ PA_MODULE_USAGE(
     "on_hotplug=<When new device becomes available, recheck streams?> "
     "on_rescue=<When device becomes unavailable, recheck streams?>");
 
-#define SAVE_INTERVAL (10 * PA_USEC_PER_SEC)
 #define DUMP_DATABASE
 
 static const char* const valid_modargs[] = {
@@ -114,7 +114,7 @@ struct userdata {
         *sink_unlink_hook_slot,
         *source_unlink_hook_slot,
         *connection_unlink_hook_slot;
-    pa_time_event *save_time_event;
+    pa_database_flusher *flusher;
     pa_database *database;
 
     pa_native_protocol *protocol;
@@ -126,6 +126,16 @@ struct userdata {
 
     role_indexes_t preferred_sinks;
     role_indexes_t preferred_sources;
+
+    /* The priorities of all devices in the database, by device name,
+     * so that routing doesn't have to go through the whole database */
+    pa_hashmap *sink_priorities;
+    pa_hashmap *source_priorities;
+};
+
+struct priority {
+    char *device;
+    role_indexes_t priority;
 };
 
 #define ENTRY_VERSION 1
@@ -155,37 +165,19 @@ static void dump_database(struct userdata *);
 #endif
 static void notify_subscribers(struct userdata *);
 
-static void save_time_callback(pa_mainloop_api*a, pa_time_event* e, const struct timeval *t, void *userdata) {
-    struct userdata *u = userdata;
+static void trigger_save(struct userdata *u) {
 
-    pa_assert(a);
-    pa_assert(e);
     pa_assert(u);
 
-    pa_assert(e == u->save_time_event);
-    u->core->mainloop->time_free(u->save_time_event);
-    u->save_time_event = NULL;
+    notify_subscribers(u);
 
-    pa_database_sync(u->database);
-    pa_log_info("Synced.");
+    pa_database_flusher_schedule(u->flusher, u->database);
 
 #ifdef DUMP_DATABASE
     dump_database(u);
 #endif
 }
 
-static void trigger_save(struct userdata *u) {
-
-    pa_assert(u);
-
-    notify_subscribers(u);
-
-    if (u->save_time_event)
-        return;
-
-    u->save_time_event = pa_core_rttime_new(u->core, pa_rtclock_now() + SAVE_INTERVAL, save_time_callback, u);
-}
-
 static struct entry* entry_new(void) {
     struct entry *r = pa_xnew0(struct entry, 1);
     r->version = ENTRY_VERSION;
@@ -200,6 +192,56 @@ static void entry_free(struct entry* e) {
     pa_xfree(e);
 }
 
+static pa_hashmap *get_priorities(struct userdata *u, const char *name, const char **device) {
+    pa_assert(u);
+    pa_assert(name);
+
+    if (pa_startswith(name, "sink:")) {
+        *device = name + 5;
+        return u->sink_priorities;
+    }
+
+    if (pa_startswith(name, "source:")) {
+        *device = name + 7;
+        return u->source_priorities;
+    }
+
+    return NULL;
+}
+
+static void priority_free(struct priority *p) {
+    pa_assert(p);
+
+    pa_xfree(p->device);
+    pa_xfree(p);
+}
+
+static void priorities_set(struct userdata *u, const char *name, const struct entry *e) {
+    pa_hashmap *h;
+    struct priority *p;
+    const char *device;
+
+    if (!(h = get_priorities(u, name, &device)))
+        return;
+
+    if (!(p = pa_hashmap_get(h, device))) {
+        p = pa_xnew(struct priority, 1);
+        p->device = pa_xstrdup(device);
+        pa_hashmap_put(h, p->device, p);
+    }
+
+    memcpy(p->priority, e->priority, sizeof(p->priority));
+}
+
+static void priorities_unset(struct userdata *u, const char *name) {
+    pa_hashmap *h;
+    struct priority *p;
+    const char *device;
+
+    if ((h = get_priorities(u, name, &device)) && (p = pa_hashmap_remove(h, device)))
+        priority_free(p);
+}
+
 static pa_bool_t entry_write(struct userdata *u, const char *name, const struct entry *e) {
     pa_tagstruct *t;
     pa_datum key, data;
@@ -226,6 +268,9 @@ static pa_bool_t entry_write(struct userdata *u, const char *name, const struct
 
     pa_tagstruct_free(t);
 
+    if (r)
+        priorities_set(u, name, e);
+
     return r;
 }
 
@@ -494,36 +539,16 @@ static inline struct entry *load_or_initialize_entry(struct userdata *u, struct
     } else {
         /* This is a new device, so make sure we write it's priority list correctly */
         role_indexes_t max_priority;
-        pa_datum key;
-        pa_bool_t done;
+        struct priority *p;
+        void *state;
 
         pa_zero(max_priority);
-        done = !pa_database_first(u->database, &key, NULL);
 
-        /* Find all existing devices with the same prefix so we calculate the current max priority for each role */
-        while (!done) {
-            pa_datum next_key;
-
-            done = !pa_database_next(u->database, &key, &next_key, NULL);
-
-            if (key.size > strlen(prefix) && strncmp(key.data, prefix, strlen(prefix)) == 0) {
-                char *name2;
-                struct entry *e;
-
-                name2 = pa_xstrndup(key.data, key.size);
-
-                if ((e = entry_read(u, name2))) {
-                    for (uint32_t i = 0; i < NUM_ROLES; ++i) {
-                        max_priority[i] = PA_MAX(max_priority[i], e->priority[i]);
-                    }
-
-                    entry_free(e);
-                }
-
-                pa_xfree(name2);
+        /* Go through all existing devices of the same kind so we calculate the current max priority for each role */
+        PA_HASHMAP_FOREACH(p, pa_streq(prefix, "sink:") ? u->sink_priorities : u->source_priorities, state) {
+            for (uint32_t i = 0; i < NUM_ROLES; ++i) {
+                max_priority[i] = PA_MAX(max_priority[i], p->priority[i]);
             }
-            pa_datum_free(&key);
-            key = next_key;
         }
 
         /* Actually initialise our entry now we've calculated it */
@@ -546,96 +571,66 @@ static uint32_t get_role_index(const char* role) {
     return PA_INVALID_INDEX;
 }
 
+static uint32_t get_stream_role_index(pa_proplist *p) {
+    const char *role;
+
+    pa_assert(p);
+
+    if (!(role = pa_proplist_gets(p, PA_PROP_MEDIA_ROLE)))
+        return get_role_index("none");
+
+    return get_role_index(role);
+}
+
 static void update_highest_priority_device_indexes(struct userdata *u, const char *prefix, void *ignore_device) {
     role_indexes_t *indexes, highest_priority_available;
-    pa_datum key;
-    pa_bool_t done, sink_mode;
+    pa_hashmap *priorities;
+    struct priority *p;
+    void *state;
+    pa_bool_t sink_mode;
 
     pa_assert(u);
     pa_assert(prefix);
 
     sink_mode = pa_streq(prefix, "sink:");
 
-    if (sink_mode)
+    if (sink_mode) {
         indexes = &u->preferred_sinks;
-    else
+        priorities = u->sink_priorities;
+    } else {
         indexes = &u->preferred_sources;
+        priorities = u->source_priorities;
+    }
 
     for (uint32_t i = 0; i < NUM_ROLES; ++i) {
         (*indexes)[i] = PA_INVALID_INDEX;
     }
     pa_zero(highest_priority_available);
 
-    done = !pa_database_first(u->database, &key, NULL);
-
-    /* Find all existing devices with the same prefix so we find the highest priority device for each role */
-    while (!done) {
-        pa_datum next_key;
+    /* Go through all known devices of this kind that are currently
+     * available to find the highest priority one for each role */
+    PA_HASHMAP_FOREACH(p, priorities, state) {
+        void *device;
+        uint32_t idx;
 
-        done = !pa_database_next(u->database, &key, &next_key, NULL);
+        if (!(device = pa_namereg_get(u->core, p->device, sink_mode ? PA_NAMEREG_SINK : PA_NAMEREG_SOURCE)))
+            continue;
 
-        if (key.size > strlen(prefix) && strncmp(key.data, prefix, strlen(prefix)) == 0) {
-            char *name, *device_name;
-            struct entry *e;
-
-            name = pa_xstrndup(key.data, key.size);
-            pa_assert_se(device_name = get_name(name, prefix));
-
-            if ((e = entry_read(u, name))) {
-                for (uint32_t i = 0; i < NUM_ROLES; ++i) {
-                    if (!highest_priority_available[i] || e->priority[i] < highest_priority_available[i]) {
-                        /* We've found a device with a higher priority than that we've currently got,
-                           so see if it is currently available or not and update our list */
-                        uint32_t idx;
-                        pa_bool_t found = FALSE;
-
-                        if (sink_mode) {
-                            pa_sink *sink;
-
-                            PA_IDXSET_FOREACH(sink, u->core->sinks, idx) {
-                                if ((pa_sink*) ignore_device == sink)
-                                    continue;
-                                if (pa_streq(sink->name, device_name)) {
-                                    found = TRUE;
-                                    idx = sink->index; /* Is this needed? */
-                                    break;
-                                }
-                            }
-                        } else {
-                            pa_source *source;
-
-                            PA_IDXSET_FOREACH(source, u->core->sources, idx) {
-                                if ((pa_source*) ignore_device == source)
-                                    continue;
-                                if (pa_streq(source->name, device_name)) {
-                                    found = TRUE;
-                                    idx = source->index; /* Is this needed? */
-                                    break;
-                                }
-                            }
-                        }
-                        if (found) {
-                            highest_priority_available[i] = e->priority[i];
-                            (*indexes)[i] = idx;
-                        }
+        if (device == ignore_device)
+            continue;
 
-                    }
-                }
+        idx = sink_mode ? ((pa_sink*) device)->index : ((pa_source*) device)->index;
 
-                entry_free(e);
+        for (uint32_t i = 0; i < NUM_ROLES; ++i) {
+            if (!highest_priority_available[i] || p->priority[i] < highest_priority_available[i]) {
+                highest_priority_available[i] = p->priority[i];
+                (*indexes)[i] = idx;
             }
-
-            pa_xfree(name);
-            pa_xfree(device_name);
         }
-
-        pa_datum_free(&key);
-        key = next_key;
     }
 }
 
 static void route_sink_input(struct userdata *u, pa_sink_input *si) {
-    const char *role;
     uint32_t role_index, device_index;
     pa_sink *sink;
 
@@ -655,11 +650,7 @@ static void route_sink_input(struct userdata *u, pa_sink_input *si) {
     if (!PA_SINK_INPUT_IS_LINKED(pa_sink_input_get_state(si)))
         return;
 
-    if (!(role = pa_proplist_gets(si->proplist, PA_PROP_MEDIA_ROLE)))
-        role_index = get_role_index("none");
-    else
-        role_index = get_role_index(role);
-
+    role_index = get_stream_role_index(si->proplist);
     if (PA_INVALID_INDEX == role_index)
         return;
 
@@ -676,6 +667,7 @@ static void route_sink_input(struct userdata *u, pa_sink_input *si) {
 
 static pa_hook_result_t route_sink_inputs(struct userdata *u, pa_sink *ignore_sink) {
     pa_sink_input *si;
+    role_indexes_t old;
     uint32_t idx;
 
     pa_assert(u);
@@ -683,17 +675,23 @@ static pa_hook_result_t route_sink_inputs(struct userdata *u, pa_sink *ignore_si
     if (!u->do_routing)
         return PA_HOOK_OK;
 
+    memcpy(old, u->preferred_sinks, sizeof(old));
     update_highest_priority_device_indexes(u, "sink:", ignore_sink);
 
+    /* Only the streams of the roles whose preferred sink changed need to
+     * move, and those on a sink that is going away */
     PA_IDXSET_FOREACH(si, u->core->sink_inputs, idx) {
-        route_sink_input(u, si);
+        uint32_t role_index = get_stream_role_index(si->proplist);
+
+        if ((ignore_sink && si->sink == ignore_sink) ||
+            (role_index != PA_INVALID_INDEX && old[role_index] != u->preferred_sinks[role_index]))
+            route_sink_input(u, si);
     }
 
     return PA_HOOK_OK;
 }
 
 static void route_source_output(struct userdata *u, pa_source_output *so) {
-    const char *role;
     uint32_t role_index, device_index;
     pa_source *source;
 
@@ -716,11 +714,7 @@ static void route_source_output(struct userdata *u, pa_source_output *so) {
     if (!PA_SOURCE_OUTPUT_IS_LINKED(pa_source_output_get_state(so)))
         return;
 
-    if (!(role = pa_proplist_gets(so->proplist, PA_PROP_MEDIA_ROLE)))
-        role_index = get_role_index("none");
-    else
-        role_index = get_role_index(role);
-
+    role_index = get_stream_role_index(so->proplist);
     if (PA_INVALID_INDEX == role_index)
         return;
 
@@ -737,6 +731,7 @@ static void route_source_output(struct userdata *u, pa_source_output *so) {
 
 static pa_hook_result_t route_source_outputs(struct userdata *u, pa_source* ignore_source) {
     pa_source_output *so;
+    role_indexes_t old;
     uint32_t idx;
 
     pa_assert(u);
@@ -744,10 +739,16 @@ static pa_hook_result_t route_source_outputs(struct userdata *u, pa_source* igno
     if (!u->do_routing)
         return PA_HOOK_OK;
 
+    memcpy(old, u->preferred_sources, sizeof(old));
     update_highest_priority_device_indexes(u, "source:", ignore_source);
 
+    /* Like for the sink inputs */
     PA_IDXSET_FOREACH(so, u->core->source_outputs, idx) {
-        route_source_output(u, so);
+        uint32_t role_index = get_stream_role_index(so->proplist);
+
+        if ((ignore_source && so->source == ignore_source) ||
+            (role_index != PA_INVALID_INDEX && old[role_index] != u->preferred_sources[role_index]))
+            route_source_output(u, so);
     }
 
     return PA_HOOK_OK;
@@ -1244,6 +1245,7 @@ static int extension_cb(pa_native_protocol *p, pa_module *m, pa_native_connectio
 
         /** @todo: Reindex the priorities */
         pa_database_unset(u->database, &key);
+        priorities_unset(u, name);
       }
 
       trigger_save(u);
@@ -1496,6 +1498,36 @@ static pa_hook_result_t connection_unlink_hook_cb(pa_native_protocol *p, pa_nati
     return PA_HOOK_OK;
 }
 
+/* Reads the priorities of all devices in the database once, from then
+ * on entry_write() keeps them up to date */
+static void load_priorities(struct userdata *u) {
+    pa_datum key;
+    pa_bool_t done;
+
+    pa_assert(u);
+
+    done = !pa_database_first(u->database, &key, NULL);
+
+    while (!done) {
+        pa_datum next_key;
+        char *name;
+        struct entry *e;
+
+        done = !pa_database_next(u->database, &key, &next_key, NULL);
+
+        name = pa_xstrndup(key.data, key.size);
+
+        if ((e = entry_read(u, name))) {
+            priorities_set(u, name, e);
+            entry_free(e);
+        }
+
+        pa_xfree(name);
+        pa_datum_free(&key);
+        key = next_key;
+    }
+}
+
 struct prioritised_indexes {
     uint32_t index;
     int32_t priority;
@@ -1532,6 +1564,8 @@ int pa__init(pa_module*m) {
     u->on_hotplug = on_hotplug;
     u->on_rescue = on_rescue;
     u->subscribed = pa_idxset_new(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func);
+    u->sink_priorities = pa_hashmap_new(pa_idxset_string_hash_func, pa_idxset_string_compare_func);
+    u->source_priorities = pa_hashmap_new(pa_idxset_string_hash_func, pa_idxset_string_compare_func);
 
     u->protocol = pa_native_protocol_get(m->core);
     pa_native_protocol_install_ext(u->protocol, m, extension_cb);
@@ -1570,9 +1604,13 @@ int pa__init(pa_module*m) {
         goto fail;
     }
 
+    u->flusher = pa_database_flusher_get(m->core);
+
     pa_log_info("Successfully opened database file '%s'.", fname);
     pa_xfree(fname);
 
+    load_priorities(u);
+
     /* Attempt to inject the devices into the list in priority order */
     total_devices = PA_MAX(pa_idxset_size(m->core->sinks), pa_idxset_size(m->core->sources));
     if (total_devices > 0 && total_devices < 128) {
@@ -1685,8 +1723,12 @@ void pa__done(pa_module*m) {
     if (u->connection_unlink_hook_slot)
         pa_hook_slot_free(u->connection_unlink_hook_slot);
 
-    if (u->save_time_event)
-        u->core->mainloop->time_free(u->save_time_event);
+    if (u->flusher) {
+        if (u->database)
+            pa_database_flusher_remove(u->flusher, u->database);
+
+        pa_database_flusher_unref(u->flusher);
+    }
 
     if (u->database)
         pa_database_close(u->database);
@@ -1699,5 +1741,10 @@ void pa__done(pa_module*m) {
     if (u->subscribed)
         pa_idxset_free(u->subscribed, NULL);
 
+    if (u->sink_priorities)
+        pa_hashmap_free(u->sink_priorities, (pa_free_cb_t) priority_free);
+    if (u->source_priorities)
+        pa_hashmap_free(u->source_priorities, (pa_free_cb_t) priority_free);
+
     pa_xfree(u);
 }
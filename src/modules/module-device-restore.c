@@ -52,6 +52,7 @@
 #include <pulsecore/pstream.h>
 #include <pulsecore/pstream-util.h>
 #include <pulsecore/database.h>
+#include <pulsecore/database-flusher.h>
 #include <pulsecore/tagstruct.h>
 
 #include "module-device-restore-symdef.h"
@@ -66,7 +67,6 @@ PA_MODULE_USAGE(
         "restore_muted=<Save/restore muted states?> "
         "restore_formats=<Save/restore saved formats?>");
 
-#define SAVE_INTERVAL (10 * PA_USEC_PER_SEC)
 
 static const char* const valid_modargs[] = {
     "restore_volume",
@@ -89,7 +89,7 @@ struct userdata {
         *source_fixate_hook_slot,
         *source_port_hook_slot,
         *connection_unlink_hook_slot;
-    pa_time_event *save_time_event;
+    pa_database_flusher *flusher;
     pa_database *database;
 
     pa_native_protocol *protocol;
@@ -130,21 +130,6 @@ struct perportentry {
     pa_idxset *formats;
 };
 
-static void save_time_callback(pa_mainloop_api*a, pa_time_event* e, const struct timeval *t, void *userdata) {
-    struct userdata *u = userdata;
-
-    pa_assert(a);
-    pa_assert(e);
-    pa_assert(u);
-
-    pa_assert(e == u->save_time_event);
-    u->core->mainloop->time_free(u->save_time_event);
-    u->save_time_event = NULL;
-
-    pa_database_sync(u->database);
-    pa_log_info("Synced.");
-}
-
 static void trigger_save(struct userdata *u, pa_device_type_t type, uint32_t sink_idx) {
     pa_native_connection *c;
     uint32_t idx;
@@ -166,10 +151,7 @@ static void trigger_save(struct userdata *u, pa_device_type_t type, uint32_t sin
         }
     }
 
-    if (u->save_time_event)
-        return;
-
-    u->save_time_event = pa_core_rttime_new(u->core, pa_rtclock_now() + SAVE_INTERVAL, save_time_callback, u);
+    pa_database_flusher_schedule(u->flusher, u->database);
 }
 
 #ifdef ENABLE_LEGACY_DATABASE_ENTRY_FORMAT
@@ -1272,6 +1254,8 @@ int pa__init(pa_module*m) {
         goto fail;
     }
 
+    u->flusher = pa_database_flusher_get(m->core);
+
     pa_log_info("Successfully opened database file '%s'.", fname);
     pa_xfree(fname);
 
@@ -1322,8 +1306,12 @@ void pa__done(pa_module*m) {
     if (u->connection_unlink_hook_slot)
         pa_hook_slot_free(u->connection_unlink_hook_slot);
 
-    if (u->save_time_event)
-        u->core->mainloop->time_free(u->save_time_event);
+    if (u->flusher) {
+        if (u->database)
+            pa_database_flusher_remove(u->flusher, u->database);
+
+        pa_database_flusher_unref(u->flusher);
+    }
 
     if (u->database)
         pa_database_close(u->database);
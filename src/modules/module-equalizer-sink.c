@@ -37,12 +37,6 @@
 #include <string.h>
 #include <stdint.h>
 
-//#undef __SSE2__
-#ifdef __SSE2__
-#include <xmmintrin.h>
-#include <emmintrin.h>
-#endif
-
 #include <fftw3.h>
 
 #include <pulse/xmalloc.h>
@@ -59,13 +53,20 @@
 #include <pulsecore/log.h>
 #include <pulsecore/rtpoll.h>
 #include <pulsecore/sample-util.h>
+#include <pulsecore/semaphore.h>
 #include <pulsecore/shared.h>
+#include <pulsecore/thread.h>
 #include <pulsecore/idxset.h>
 #include <pulsecore/strlist.h>
 #include <pulsecore/database.h>
 #include <pulsecore/protocol-dbus.h>
 #include <pulsecore/dbus-util.h>
 
+#include "fftw-plan-cache.h"
+#ifdef HAVE_AVX2
+#include "equalizer-sink-avx2.h"
+#endif
+
 #include "module-equalizer-sink-symdef.h"
 
 PA_MODULE_AUTHOR("Jason Newton");
@@ -82,11 +83,26 @@ PA_MODULE_USAGE(
           "channel_map=<channel map> "
           "autoloaded=<set if this module is being loaded automatically> "
           "use_volume_sharing=<yes or no> "
+          "helper_threads=<number of threads sharing the per-channel work> "
          ));
 
 #define MEMBLOCKQ_MAXLENGTH (16*1024*1024)
 #define DEFAULT_AUTOLOADED FALSE
 
+struct userdata;
+
+/* Takes every (n_workers + 1)-th channel, starting at index + 1, off the
+ * IO thread */
+struct worker {
+    struct userdata *u;
+    unsigned index;
+    pa_thread *thread;
+    pa_semaphore *start;
+
+    float *work_buffer;
+    fftwf_complex *output_window;
+};
+
 struct userdata {
     pa_module *module;
     pa_sink *sink;
@@ -111,7 +127,16 @@ struct userdata {
     float *W;//windowing function (time domain)
     float *work_buffer, **input, **overlap_accum;
     fftwf_complex *output_window;
+    pa_fftw_plan_cache *plan_cache;
     fftwf_plan forward_plan, inverse_plan;
+    void (*apply_window)(float *dst, const float *src, const float *W, float X, size_t n);
+    void (*apply_filter)(float *bins, const float *H, size_t n);
+
+    struct worker *workers;
+    unsigned n_workers;
+    pa_semaphore *workers_done;
+    pa_bool_t workers_quit;
+    size_t iterations;
     //size_t samplings;
 
     float **Xs;
@@ -124,6 +149,9 @@ struct userdata {
     pa_memblockq *output_q;
     pa_bool_t first_iteration;
 
+    /* How much silent input went through the filter in a row */
+    size_t silence_bytes;
+
     pa_dbus_protocol *dbus_protocol;
     char *dbus_path;
 
@@ -141,6 +169,7 @@ static const char* const valid_modargs[] = {
     "channel_map",
     "autoloaded",
     "use_volume_sharing",
+    "helper_threads",
     NULL
 };
 
@@ -349,8 +378,19 @@ static void sink_set_mute_cb(pa_sink *s) {
     pa_sink_input_set_mute(u->sink_input, s->muted, s->save_muted);
 }
 
-#if 1
-//reference implementation
+static void apply_window_c(float * restrict dst, const float * restrict src, const float * restrict W, float X, size_t n) {
+    for(size_t j = 0; j < n; ++j)
+        dst[j] = X * W[j] * src[j];
+}
+
+//bins are interleaved real and imaginary parts
+static void apply_filter_c(float * restrict bins, const float * restrict H, size_t n) {
+    for(size_t j = 0; j < n; ++j) {
+        bins[2 * j] *= H[j];
+        bins[2 * j + 1] *= H[j];
+    }
+}
+
 static void dsp_logic(
     float * restrict dst,//used as a temp array too, needs to be fft_length!
     float * restrict src,/*input data w/ overlap at start,
@@ -361,146 +401,33 @@ static void dsp_logic(
     const float * restrict H,//The freq. magnitude scalers filter
     const float * restrict W,//The windowing function
     fftwf_complex * restrict output_window,//The transformed windowed src
+    size_t samples_gathered,
     struct userdata *u) {
 
     //use a linear-phase sliding STFT and overlap-add method (for each channel)
     //window the data
-    for(size_t j = 0; j < u->window_size; ++j) {
-        dst[j] = X * W[j] * src[j];
-    }
+    u->apply_window(dst, src, W, X, u->window_size);
     //zero pad the remaining fft window
     memset(dst + u->window_size, 0, (u->fft_size - u->window_size) * sizeof(float));
     //Processing is done here!
     //do fft
     fftwf_execute_dft_r2c(u->forward_plan, dst, output_window);
     //perform filtering
-    for(size_t j = 0; j < FILTER_SIZE(u); ++j) {
-        u->output_window[j][0] *= H[j];
-        u->output_window[j][1] *= H[j];
-    }
+    u->apply_filter((float *) output_window, H, FILTER_SIZE(u));
     //inverse fft
     fftwf_execute_dft_c2r(u->inverse_plan, output_window, dst);
-    ////debug: tests overlapping add
-    ////and negates ALL PREVIOUS processing
-    ////yields a perfect reconstruction if COLA is held
-    //for(size_t j = 0; j < u->window_size; ++j) {
-    //    u->work_buffer[j] = u->W[j] * u->input[c][j];
-    //}
 
     //overlap add and preserve overlap component from this window (linear phase)
     for(size_t j = 0; j < u->overlap_size; ++j) {
-        u->work_buffer[j] += overlap[j];
+        dst[j] += overlap[j];
         overlap[j] = dst[u->R + j];
     }
-    ////debug: tests if basic buffering works
-    ////shouldn't modify the signal AT ALL (beyond roundoff)
-    //for(size_t j = 0; j < u->window_size;++j) {
-    //    u->work_buffer[j] = u->input[c][j];
-    //}
 
     //preserve the needed input for the next window's overlap
     memmove(src, src + u->R,
-        (u->samples_gathered - u->R) * sizeof(float)
+        (samples_gathered - u->R) * sizeof(float)
     );
 }
-#else
-typedef float v4sf __attribute__ ((__aligned__(v_size * sizeof(float))));
-typedef union float_vector {
-    float f[v_size];
-    v4sf v;
-    __m128 m;
-} float_vector_t;
-
-//regardless of sse enabled, the loops in here assume
-//16 byte aligned addresses and memory allocations divisible by v_size
-static void dsp_logic(
-    float * restrict dst,//used as a temp array too, needs to be fft_length!
-    float * restrict src,/*input data w/ overlap at start,
-                               *automatically cycled in routine
-                               */
-    float * restrict overlap,//The size of the overlap
-    const float X,//multiplier
-    const float * restrict H,//The freq. magnitude scalers filter
-    const float * restrict W,//The windowing function
-    fftwf_complex * restrict output_window,//The transformed windowed src
-    struct userdata *u) {//Collection of constants
-    const size_t overlap_size = PA_ROUND_UP(u->overlap_size, v_size);
-    float_vector_t x;
-    x.f[0] = x.f[1] = x.f[2] = x.f[3] = X;
-
-    //assert(u->samples_gathered >= u->R);
-    //use a linear-phase sliding STFT and overlap-add method
-    for(size_t j = 0; j < u->window_size; j += v_size) {
-        //dst[j] = W[j] * src[j];
-        float_vector_t *d = (float_vector_t*) (dst + j);
-        float_vector_t *w = (float_vector_t*) (W + j);
-        float_vector_t *s = (float_vector_t*) (src + j);
-//#if __SSE2__
-        d->m = _mm_mul_ps(x.m, _mm_mul_ps(w->m, s->m));
-//        d->v = x->v * w->v * s->v;
-//#endif
-    }
-    //zero pad the remaining fft window
-    memset(dst + u->window_size, 0, (u->fft_size - u->window_size) * sizeof(float));
-
-    //Processing is done here!
-    //do fft
-    fftwf_execute_dft_r2c(u->forward_plan, dst, output_window);
-    //perform filtering - purely magnitude based
-    for(size_t j = 0; j < FILTER_SIZE; j += v_size / 2) {
-        //output_window[j][0]*=H[j];
-        //output_window[j][1]*=H[j];
-        float_vector_t *d = (float_vector_t*)( ((float *) output_window) + 2 * j);
-        float_vector_t h;
-        h.f[0] = h.f[1] = H[j];
-        h.f[2] = h.f[3] = H[j + 1];
-//#if __SSE2__
-        d->m = _mm_mul_ps(d->m, h.m);
-//#else
-//        d->v = d->v * h.v;
-//#endif
-    }
-
-    //inverse fft
-    fftwf_execute_dft_c2r(u->inverse_plan, output_window, dst);
-
-    ////debug: tests overlapping add
-    ////and negates ALL PREVIOUS processing
-    ////yields a perfect reconstruction if COLA is held
-    //for(size_t j = 0; j < u->window_size; ++j) {
-    //    dst[j] = W[j] * src[j];
-    //}
-
-    //overlap add and preserve overlap component from this window (linear phase)
-    for(size_t j = 0; j < overlap_size; j += v_size) {
-        //dst[j]+=overlap[j];
-        //overlap[j]+=dst[j+R];
-        float_vector_t *d = (float_vector_t*)(dst + j);
-        float_vector_t *o = (float_vector_t*)(overlap + j);
-//#if __SSE2__
-        d->m = _mm_add_ps(d->m, o->m);
-        o->m = ((float_vector_t*)(dst + u->R + j))->m;
-//#else
-//        d->v = d->v + o->v;
-//        o->v = ((float_vector_t*)(dst + u->R + j))->v;
-//#endif
-    }
-    //memcpy(overlap, dst+u->R, u->overlap_size * sizeof(float)); //overlap preserve (debug)
-    //zero out the bit beyond the real overlap so we don't add garbage next iteration
-    memset(overlap + u->overlap_size, 0, overlap_size - u->overlap_size);
-
-    ////debug: tests if basic buffering works
-    ////shouldn't modify the signal AT ALL (beyond roundoff)
-    //for(size_t j = 0; j < u->window_size; ++j) {
-    //    dst[j] = src[j];
-    //}
-
-    //preserve the needed input for the next window's overlap
-    memmove(src, src + u->R,
-        (u->samples_gathered - u->R) * sizeof(float)
-    );
-}
-#endif
 
 static void flatten_to_memblockq(struct userdata *u) {
     size_t mbs = pa_mempool_block_size_max(u->sink->core->mempool);
@@ -521,53 +448,158 @@ static void flatten_to_memblockq(struct userdata *u) {
     }
 }
 
-static void process_samples(struct userdata *u) {
+/* Runs all pending windows of one group of channels. Called from the IO
+ * thread and the helper threads, each with its own scratch buffers. */
+static void process_channels(struct userdata *u, unsigned group, float *work_buffer, fftwf_complex *output_window) {
     size_t fs = pa_frame_size(&(u->sink->sample_spec));
     unsigned a_i;
     float *H, X;
-    size_t iterations, offset;
-    pa_assert(u->samples_gathered >= u->window_size);
-    iterations = (u->samples_gathered - u->overlap_size) / u->R;
-    //make sure there is enough buffer memory allocated
-    if (iterations * u->R * fs > u->output_buffer_max_length) {
-        u->output_buffer_max_length = iterations * u->R * fs;
-        pa_xfree(u->output_buffer);
-        u->output_buffer = pa_xmalloc(u->output_buffer_max_length);
-    }
-    u->output_buffer_length = iterations * u->R * fs;
 
-    for(size_t iter = 0; iter < iterations; ++iter) {
-        offset = iter * u->R * fs;
-        for(size_t c = 0;c < u->channels; c++) {
+    for(size_t c = group; c < u->channels; c += u->n_workers + 1) {
+        size_t samples_gathered = u->samples_gathered;
+
+        for(size_t iter = 0; iter < u->iterations; ++iter) {
+            size_t offset = iter * u->R * fs;
+
             a_i = pa_aupdate_read_begin(u->a_H[c]);
             X = u->Xs[c][a_i];
             H = u->Hs[c][a_i];
             dsp_logic(
-                u->work_buffer,
+                work_buffer,
                 u->input[c],
                 u->overlap_accum[c],
                 X,
                 H,
                 u->W,
-                u->output_window,
+                output_window,
+                samples_gathered,
                 u
             );
             pa_aupdate_read_end(u->a_H[c]);
-            if (u->first_iteration) {
+            if (u->first_iteration && iter == 0) {
                 /* The windowing function will make the audio ramped in, as a cheap fix we can
                  * undo the windowing (for non-zero window values)
                  */
                 for(size_t i = 0; i < u->overlap_size; ++i) {
-                    u->work_buffer[i] = u->W[i] <= FLT_EPSILON ? u->work_buffer[i] : u->work_buffer[i] / u->W[i];
+                    work_buffer[i] = u->W[i] <= FLT_EPSILON ? work_buffer[i] : work_buffer[i] / u->W[i];
                 }
             }
-            pa_sample_clamp(PA_SAMPLE_FLOAT32NE, (uint8_t *) (((float *)u->output_buffer) + c) + offset, fs, u->work_buffer, sizeof(float), u->R);
+            pa_sample_clamp(PA_SAMPLE_FLOAT32NE, (uint8_t *) (((float *)u->output_buffer) + c) + offset, fs, work_buffer, sizeof(float), u->R);
+            samples_gathered -= u->R;
         }
-        if (u->first_iteration) {
-            u->first_iteration = FALSE;
+    }
+}
+
+static void worker_thread_func(void *userdata) {
+    struct worker *w = userdata;
+    struct userdata *u = w->u;
+
+    if (u->module->core->realtime_scheduling)
+        pa_make_realtime(u->module->core->realtime_priority);
+
+    for (;;) {
+        pa_semaphore_wait(w->start);
+
+        if (u->workers_quit)
+            break;
+
+        process_channels(u, w->index + 1, w->work_buffer, w->output_window);
+        pa_semaphore_post(u->workers_done);
+    }
+}
+
+static int start_workers(struct userdata *u, unsigned n) {
+    pa_assert(u);
+
+    n = PA_MIN(n, (unsigned) u->channels - 1);
+    if (n == 0)
+        return 0;
+
+    u->workers = pa_xnew0(struct worker, n);
+    u->workers_done = pa_semaphore_new(0);
+
+    for(unsigned i = 0; i < n; ++i) {
+        struct worker *w = &u->workers[i];
+        char *t;
+
+        w->u = u;
+        w->index = i;
+        w->start = pa_semaphore_new(0);
+        w->work_buffer = alloc(u->fft_size, sizeof(float));
+        w->output_window = alloc(FILTER_SIZE(u), sizeof(fftwf_complex));
+
+        t = pa_sprintf_malloc("equalizer-%u", i);
+        w->thread = pa_thread_new(t, worker_thread_func, w);
+        pa_xfree(t);
+
+        if (!w->thread) {
+            pa_log("Failed to create helper thread.");
+            pa_semaphore_free(w->start);
+            fftwf_free(w->work_buffer);
+            fftwf_free(w->output_window);
+            return -1;
         }
-        u->samples_gathered -= u->R;
+
+        u->n_workers++;
+    }
+
+    pa_log_debug("Sharing the work of %zu channels with %u helper threads.", u->channels, u->n_workers);
+
+    return 0;
+}
+
+static void stop_workers(struct userdata *u) {
+    pa_assert(u);
+
+    u->workers_quit = TRUE;
+
+    for(unsigned i = 0; i < u->n_workers; ++i)
+        pa_semaphore_post(u->workers[i].start);
+
+    for(unsigned i = 0; i < u->n_workers; ++i) {
+        struct worker *w = &u->workers[i];
+
+        pa_thread_free(w->thread);
+        pa_semaphore_free(w->start);
+        fftwf_free(w->work_buffer);
+        fftwf_free(w->output_window);
+    }
+
+    if (u->workers_done)
+        pa_semaphore_free(u->workers_done);
+
+    pa_xfree(u->workers);
+    u->workers = NULL;
+    u->n_workers = 0;
+}
+
+static void process_samples(struct userdata *u) {
+    size_t fs = pa_frame_size(&(u->sink->sample_spec));
+    size_t iterations;
+    pa_assert(u->samples_gathered >= u->window_size);
+    iterations = (u->samples_gathered - u->overlap_size) / u->R;
+    //make sure there is enough buffer memory allocated
+    if (iterations * u->R * fs > u->output_buffer_max_length) {
+        u->output_buffer_max_length = iterations * u->R * fs;
+        pa_xfree(u->output_buffer);
+        u->output_buffer = pa_xmalloc(u->output_buffer_max_length);
     }
+    u->output_buffer_length = iterations * u->R * fs;
+    u->iterations = iterations;
+
+    //hand the other channel groups to the helpers and join them before
+    //the result is queued
+    for(unsigned w = 0; w < u->n_workers; ++w)
+        pa_semaphore_post(u->workers[w].start);
+
+    process_channels(u, 0, u->work_buffer, u->output_window);
+
+    for(unsigned w = 0; w < u->n_workers; ++w)
+        pa_semaphore_wait(u->workers_done);
+
+    if (iterations > 0)
+        u->first_iteration = FALSE;
+    u->samples_gathered -= iterations * u->R;
     flatten_to_memblockq(u);
 }
 
@@ -632,6 +664,27 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk
     /* Hmm, process any rewind request that might be queued up */
     pa_sink_process_rewind(u->sink, 0);
 
+    /* Once a window and its overlap worth of silence has been filtered
+     * all buffers are zero, so more silence passes through unchanged */
+    if (u->silence_bytes >= (u->fft_size + u->R) * fs) {
+        while (pa_memblockq_peek(u->input_q, &tchunk) < 0) {
+            pa_sink_render_full(u->sink, PA_MIN(nbytes, mbs), &tchunk);
+            pa_memblockq_push(u->input_q, &tchunk);
+            pa_memblock_unref(tchunk.memblock);
+        }
+
+        if (pa_memblock_is_silence(tchunk.memblock)) {
+            pa_memblock_unref(tchunk.memblock);
+
+            pa_silence_memchunk_get(&u->sink->core->silence_cache, u->sink->core->mempool, chunk, &i->sample_spec,
+                                    PA_MAX(PA_MIN(nbytes, tchunk.length) / fs * fs, fs));
+            pa_memblockq_drop(u->input_q, chunk->length);
+            return 0;
+        }
+
+        pa_memblock_unref(tchunk.memblock);
+    }
+
     //pa_log_debug("start output-buffered %ld, input-buffered %ld, requested %ld",buffered_samples,u->samples_gathered,samples_requested);
     //pa_rtclock_get(&start);
     do{
@@ -654,6 +707,11 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk
         //pa_rtclock_get(start);
        // pa_log_debug("buffering %ld bytes", tchunk.length);
         input_buffer(u, &tchunk);
+
+        if (pa_memblock_is_silence(tchunk.memblock))
+            u->silence_bytes += tchunk.length;
+        else
+            u->silence_bytes = 0;
         //pa_rtclock_get(&end);
         //pa_log_debug("Took %0.5f seconds to setup", pa_timeval_diff(end, start) / (double) PA_USEC_PER_SEC);
         pa_memblock_unref(tchunk.memblock);
@@ -741,6 +799,7 @@ static void sink_input_process_rewind_cb(pa_sink_input *i, size_t nbytes) {
             //invalidate the output q
             pa_memblockq_seek(u->input_q, - (int64_t) amount, PA_SEEK_RELATIVE, TRUE);
             pa_log("Resetting filter");
+            u->silence_bytes = 0;
             //reset_filter(u); //this is the "proper" thing to do...
         }
     }
@@ -1093,6 +1152,7 @@ int pa__init(pa_module*m) {
     float *H;
     unsigned a_i;
     pa_bool_t use_volume_sharing = TRUE;
+    uint32_t helper_threads = 0;
 
     pa_assert(m);
 
@@ -1121,6 +1181,11 @@ int pa__init(pa_module*m) {
         goto fail;
     }
 
+    if (pa_modargs_get_value_u32(ma, "helper_threads", &helper_threads) < 0) {
+        pa_log("helper_threads= expects a number");
+        goto fail;
+    }
+
     u = pa_xnew0(struct userdata, 1);
     u->module = m;
     m->userdata = u;
@@ -1157,12 +1222,25 @@ int pa__init(pa_module*m) {
         u->overlap_accum[c] = alloc(u->overlap_size, sizeof(float));
     }
     u->output_window = alloc(FILTER_SIZE(u), sizeof(fftwf_complex));
-    u->forward_plan = fftwf_plan_dft_r2c_1d(u->fft_size, u->work_buffer, u->output_window, FFTW_ESTIMATE);
-    u->inverse_plan = fftwf_plan_dft_c2r_1d(u->fft_size, u->output_window, u->work_buffer, FFTW_ESTIMATE);
+    u->plan_cache = pa_fftw_plan_cache_get(m->core);
+    u->forward_plan = pa_fftw_plan_cache_r2c(u->plan_cache, u->fft_size);
+    u->inverse_plan = pa_fftw_plan_cache_c2r(u->plan_cache, u->fft_size);
+
+    u->apply_window = apply_window_c;
+    u->apply_filter = apply_filter_c;
+#ifdef HAVE_AVX2
+    if (m->core->cpu_info.cpu_type == PA_CPU_X86 && (m->core->cpu_info.flags.x86 & PA_CPU_X86_AVX2)) {
+        u->apply_window = pa_equalizer_apply_window_avx2;
+        u->apply_filter = pa_equalizer_apply_filter_avx2;
+    }
+#endif
 
     hanning_window(u->W, u->window_size);
     u->first_iteration = TRUE;
 
+    if (start_workers(u, helper_threads) < 0)
+        goto fail;
+
     u->base_profiles = pa_xnew0(char *, u->channels);
     for (c = 0; c < u->channels; ++c)
         u->base_profiles[c] = pa_xstrdup("default");
@@ -1334,12 +1412,14 @@ void pa__done(pa_module*m) {
     if (u->sink)
         pa_sink_unref(u->sink);
 
+    stop_workers(u);
+
     pa_xfree(u->output_buffer);
     pa_memblockq_free(u->output_q);
     pa_memblockq_free(u->input_q);
 
-    fftwf_destroy_plan(u->inverse_plan);
-    fftwf_destroy_plan(u->forward_plan);
+    if (u->plan_cache)
+        pa_fftw_plan_cache_unref(u->plan_cache);
     pa_xfree(u->output_window);
     for (c = 0; c < u->channels; ++c) {
         pa_aupdate_free(u->a_H[c]);
@@ -0,0 +1,1704 @@
+/***
+    This file is part of PulseAudio.
+
+    PulseAudio is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published
+    by the Free Software Foundation; either version 2.1 of the License,
+    or (at your option) any later version.
+
+    PulseAudio is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with PulseAudio; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+    USA.
+***/
+
+/* Runs a whole chain of filters inside a single virtual sink. Stacking
+ * the equivalent filter sinks costs a sink, a sink input, a memblockq
+ * and a rewind for every stage, here all nodes work one after the other
+ * on the same deinterleaved float buffers.
+ *
+ * With source_master= the same chain runs inside a virtual source
+ * instead. Stacked filter sources copy and allocate a block in every
+ * stage, here each captured chunk is deinterleaved once, goes through
+ * all nodes and ends up in the one block that is posted.
+ *
+ * The graph is a '|' separated list of nodes, each of them a ':'
+ * separated list of the node type and its parameters:
+ *
+ *   gain:<dB>
+ *   biquad:<lowpass|highpass|bandpass|notch|peaking|lowshelf|highshelf>:<frequency>[:<Q>[:<gain in dB>]]
+ *   ladspa:<plugin>:<label>[:<comma separated control values>]
+ *
+ * Remapping (as done by module-remap-sink) happens on the way to the
+ * master, see master_channel_map. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <math.h>
+
+#include <pulse/gccmacro.h>
+#include <pulse/timeval.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/i18n.h>
+#include <pulsecore/namereg.h>
+#include <pulsecore/sink.h>
+#include <pulsecore/source.h>
+#include <pulsecore/module.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/modargs.h>
+#include <pulsecore/log.h>
+#include <pulsecore/rtpoll.h>
+#include <pulsecore/sample-util.h>
+#include <pulsecore/ltdl-helper.h>
+
+#include "module-filter-graph-symdef.h"
+#include "ladspa.h"
+
+PA_MODULE_AUTHOR("PulseAudio contributors");
+PA_MODULE_DESCRIPTION(_("Filter graph sink or source"));
+PA_MODULE_VERSION(PACKAGE_VERSION);
+PA_MODULE_LOAD_ONCE(FALSE);
+PA_MODULE_USAGE(
+        _("sink_name=<name for the sink> "
+          "sink_properties=<properties for the sink> "
+          "sink_master=<name of sink to filter> "
+          "source_name=<name for the source> "
+          "source_properties=<properties for the source> "
+          "source_master=<name of source to filter, instead of a sink> "
+          "graph=<'|' separated list of filter nodes> "
+          "rate=<sample rate> "
+          "channels=<number of channels> "
+          "channel_map=<channel map> "
+          "master_channel_map=<channel map of the stream to the master> "
+          "use_volume_sharing=<yes or no> "
+          "force_flat_volume=<yes or no> "
+          "autoloaded=<set if this module is being loaded automatically> "
+        ));
+
+#define MEMBLOCKQ_MAXLENGTH (16*1024*1024)
+
+/* The work buffers hold this many frames, longer requests are processed
+ * in several passes */
+#define WORK_FRAMES 1024
+
+#define DEFAULT_AUTOLOADED FALSE
+
+/* Biquads ring for a while, we consider them quiet after a second */
+#define BIQUAD_TAIL_MSEC 1000
+
+struct node {
+    char *description;
+
+    /* Process frames of every channel in place */
+    void (*run)(struct node *n, float **buffer, unsigned channels, unsigned frames);
+    /* Drop all history, called after rewinds */
+    void (*reset)(struct node *n, unsigned channels);
+    void (*done)(struct node *n, unsigned channels);
+
+    /* How many frames of output unsilent input causes, (size_t) -1 if
+     * that is unknown */
+    size_t tail;
+
+    union {
+        float gain;
+
+        struct {
+            float b0, b1, b2, a1, a2;
+            float z1[PA_CHANNELS_MAX], z2[PA_CHANNELS_MAX];
+        } biquad;
+
+        struct {
+            lt_dlhandle dl;
+            const LADSPA_Descriptor *descriptor;
+            LADSPA_Handle handle[PA_CHANNELS_MAX];
+            unsigned n_instances, ports_per_instance;
+            LADSPA_Data *control;
+            /* For plugins that cannot work in place */
+            LADSPA_Data *scratch[PA_CHANNELS_MAX];
+            /* All control outputs go here, we don't care about them */
+            LADSPA_Data control_out;
+        } ladspa;
+    } data;
+};
+
+struct userdata {
+    pa_module *module;
+
+    pa_bool_t autoloaded;
+
+    /* Either these */
+    pa_sink *sink;
+    pa_sink_input *sink_input;
+
+    pa_memblockq *memblockq;
+
+    /* Or these */
+    pa_source *source;
+    pa_source_output *source_output;
+
+    pa_bool_t auto_desc;
+    unsigned channels;
+
+    struct node *nodes;
+    unsigned n_nodes;
+
+    /* Shared by all nodes */
+    float *buffer[PA_CHANNELS_MAX];
+
+    size_t silence_tail, silence_bytes;
+};
+
+static const char* const valid_modargs[] = {
+    "sink_name",
+    "sink_properties",
+    "sink_master",
+    "source_name",
+    "source_properties",
+    "source_master",
+    "graph",
+    "rate",
+    "channels",
+    "channel_map",
+    "master_channel_map",
+    "use_volume_sharing",
+    "force_flat_volume",
+    "autoloaded",
+    NULL
+};
+
+static void gain_run(struct node *n, float **buffer, unsigned channels, unsigned frames) {
+    unsigned c, i;
+
+    for (c = 0; c < channels; c++)
+        for (i = 0; i < frames; i++)
+            buffer[c][i] *= n->data.gain;
+}
+
+static int gain_init(struct node *n, const pa_sample_spec *ss, char **args, unsigned n_args) {
+    double db;
+
+    if (n_args != 1 || pa_atod(args[0], &db) < 0) {
+        pa_log("gain expects the gain in dB.");
+        return -1;
+    }
+
+    n->data.gain = (float) pow(10.0, db / 20.0);
+    n->run = gain_run;
+    n->tail = 0;
+
+    return 0;
+}
+
+/* Transposed direct form II */
+static void biquad_run(struct node *n, float **buffer, unsigned channels, unsigned frames) {
+    unsigned c, i;
+    const float b0 = n->data.biquad.b0, b1 = n->data.biquad.b1, b2 = n->data.biquad.b2;
+    const float a1 = n->data.biquad.a1, a2 = n->data.biquad.a2;
+
+    for (c = 0; c < channels; c++) {
+        float z1 = n->data.biquad.z1[c], z2 = n->data.biquad.z2[c];
+        float *b = buffer[c];
+
+        for (i = 0; i < frames; i++) {
+            float x = b[i], y;
+
+            y = b0 * x + z1;
+            z1 = b1 * x - a1 * y + z2;
+            z2 = b2 * x - a2 * y;
+            b[i] = y;
+        }
+
+        n->data.biquad.z1[c] = z1;
+        n->data.biquad.z2[c] = z2;
+    }
+}
+
+static void biquad_reset(struct node *n, unsigned channels) {
+    memset(n->data.biquad.z1, 0, sizeof(n->data.biquad.z1));
+    memset(n->data.biquad.z2, 0, sizeof(n->data.biquad.z2));
+}
+
+/* The coefficients follow Robert Bristow-Johnson's audio EQ cookbook */
+static int biquad_init(struct node *n, const pa_sample_spec *ss, char **args, unsigned n_args) {
+    double f, q = M_SQRT1_2, db = 0, w, alpha, cw, a, b0, b1, b2, a0, a1, a2;
+    const char *type;
+
+    if (n_args < 2 || n_args > 4 ||
+        pa_atod(args[1], &f) < 0 ||
+        (n_args > 2 && pa_atod(args[2], &q) < 0) ||
+        (n_args > 3 && pa_atod(args[3], &db) < 0)) {
+        pa_log("biquad expects a type, a frequency and optionally Q and a gain in dB.");
+        return -1;
+    }
+
+    if (f <= 0 || f >= ss->rate / 2.0 || q <= 0) {
+        pa_log("biquad frequency or Q out of range.");
+        return -1;
+    }
+
+    type = args[0];
+    w = 2.0 * M_PI * f / ss->rate;
+    cw = cos(w);
+    alpha = sin(w) / (2.0 * q);
+    a = pow(10.0, db / 40.0);
+
+    if (pa_streq(type, "lowpass")) {
+        b0 = (1 - cw) / 2; b1 = 1 - cw; b2 = (1 - cw) / 2;
+        a0 = 1 + alpha; a1 = -2 * cw; a2 = 1 - alpha;
+    } else if (pa_streq(type, "highpass")) {
+        b0 = (1 + cw) / 2; b1 = -(1 + cw); b2 = (1 + cw) / 2;
+        a0 = 1 + alpha; a1 = -2 * cw; a2 = 1 - alpha;
+    } else if (pa_streq(type, "bandpass")) {
+        b0 = alpha; b1 = 0; b2 = -alpha;
+        a0 = 1 + alpha; a1 = -2 * cw; a2 = 1 - alpha;
+    } else if (pa_streq(type, "notch")) {
+        b0 = 1; b1 = -2 * cw; b2 = 1;
+        a0 = 1 + alpha; a1 = -2 * cw; a2 = 1 - alpha;
+    } else if (pa_streq(type, "peaking")) {
+        b0 = 1 + alpha * a; b1 = -2 * cw; b2 = 1 - alpha * a;
+        a0 = 1 + alpha / a; a1 = -2 * cw; a2 = 1 - alpha / a;
+    } else if (pa_streq(type, "lowshelf") || pa_streq(type, "highshelf")) {
+        double s = 2 * sqrt(a) * alpha, k = pa_streq(type, "lowshelf") ? 1 : -1;
+
+        b0 = a * ((a + 1) - k * (a - 1) * cw + s);
+        b1 = 2 * k * a * ((a - 1) - k * (a + 1) * cw);
+        b2 = a * ((a + 1) - k * (a - 1) * cw - s);
+        a0 = (a + 1) + k * (a - 1) * cw + s;
+        a1 = -2 * k * ((a - 1) + k * (a + 1) * cw);
+        a2 = (a + 1) + k * (a - 1) * cw - s;
+    } else {
+        pa_log("Unknown biquad type '%s'.", type);
+        return -1;
+    }
+
+    n->data.biquad.b0 = (float) (b0 / a0);
+    n->data.biquad.b1 = (float) (b1 / a0);
+    n->data.biquad.b2 = (float) (b2 / a0);
+    n->data.biquad.a1 = (float) (a1 / a0);
+    n->data.biquad.a2 = (float) (a2 / a0);
+
+    n->run = biquad_run;
+    n->reset = biquad_reset;
+    n->tail = pa_usec_to_bytes(BIQUAD_TAIL_MSEC * PA_USEC_PER_MSEC, ss) / pa_frame_size(ss);
+
+    return 0;
+}
+
+static void ladspa_run(struct node *n, float **buffer, unsigned channels, unsigned frames) {
+    const LADSPA_Descriptor *d = n->data.ladspa.descriptor;
+    unsigned h;
+
+    for (h = 0; h < n->data.ladspa.n_instances; h++)
+        d->run(n->data.ladspa.handle[h], frames);
+
+    if (n->data.ladspa.scratch[0]) {
+        unsigned c;
+
+        for (c = 0; c < channels; c++)
+            memcpy(buffer[c], n->data.ladspa.scratch[c], frames * sizeof(float));
+    }
+}
+
+static void ladspa_reset(struct node *n, unsigned channels) {
+    const LADSPA_Descriptor *d = n->data.ladspa.descriptor;
+    unsigned h;
+
+    for (h = 0; h < n->data.ladspa.n_instances; h++) {
+        if (d->deactivate)
+            d->deactivate(n->data.ladspa.handle[h]);
+        if (d->activate)
+            d->activate(n->data.ladspa.handle[h]);
+    }
+}
+
+static void ladspa_done(struct node *n, unsigned channels) {
+    const LADSPA_Descriptor *d = n->data.ladspa.descriptor;
+    unsigned h, c;
+
+    if (d)
+        for (h = 0; h < n->data.ladspa.n_instances; h++) {
+            if (!n->data.ladspa.handle[h])
+                continue;
+
+            if (d->deactivate)
+                d->deactivate(n->data.ladspa.handle[h]);
+            d->cleanup(n->data.ladspa.handle[h]);
+        }
+
+    for (c = 0; c < channels; c++)
+        pa_xfree(n->data.ladspa.scratch[c]);
+
+    pa_xfree(n->data.ladspa.control);
+
+    if (n->data.ladspa.dl)
+        lt_dlclose(n->data.ladspa.dl);
+}
+
+/* Plugins with one input and one output are run once per channel,
+ * plugins with as many inputs and outputs as we have channels once for
+ * all of them */
+static int ladspa_init(struct node *n, const pa_sample_spec *ss, char **args, unsigned n_args, float **buffer) {
+    LADSPA_Descriptor_Function descriptor_func;
+    const LADSPA_Descriptor *d;
+    unsigned long p, j, n_input = 0, n_output = 0, n_control = 0;
+    const char *e, *state = NULL;
+    char *v;
+    unsigned h, c;
+
+    n->run = ladspa_run;
+    n->reset = ladspa_reset;
+    n->done = ladspa_done;
+    n->tail = (size_t) -1;
+
+    if (n_args < 2 || n_args > 3) {
+        pa_log("ladspa expects a plugin, a label and optionally control values.");
+        return -1;
+    }
+
+    if (!(e = getenv("LADSPA_PATH")))
+        e = LADSPA_PATH;
+
+    if (!(n->data.ladspa.dl = pa_dlopenext_in_path(args[0], e))) {
+        pa_log("Failed to load LADSPA plugin: %s", lt_dlerror());
+        return -1;
+    }
+
+    if (!(descriptor_func = (LADSPA_Descriptor_Function) pa_load_sym(n->data.ladspa.dl, NULL, "ladspa_descriptor"))) {
+        pa_log("LADSPA module lacks ladspa_descriptor() symbol.");
+        return -1;
+    }
+
+    for (j = 0;; j++) {
+
+        if (!(d = descriptor_func(j))) {
+            pa_log("Failed to find plugin label '%s' in plugin '%s'.", args[1], args[0]);
+            return -1;
+        }
+
+        if (pa_streq(d->Label, args[1]))
+            break;
+    }
+
+    for (p = 0; p < d->PortCount; p++) {
+        if (LADSPA_IS_PORT_AUDIO(d->PortDescriptors[p])) {
+            if (LADSPA_IS_PORT_INPUT(d->PortDescriptors[p]))
+                n_input++;
+            else if (LADSPA_IS_PORT_OUTPUT(d->PortDescriptors[p]))
+                n_output++;
+        } else if (LADSPA_IS_PORT_CONTROL(d->PortDescriptors[p]) && LADSPA_IS_PORT_INPUT(d->PortDescriptors[p]))
+            n_control++;
+    }
+
+    if (n_input == 0 || n_input != n_output || (n_input != 1 && n_input != ss->channels)) {
+        pa_log("Plugin '%s' has %lu inputs and %lu outputs, that does not fit %u channels.", d->Label, n_input, n_output, ss->channels);
+        return -1;
+    }
+
+    n->data.ladspa.ports_per_instance = (unsigned) n_input;
+    n->data.ladspa.n_instances = ss->channels / (unsigned) n_input;
+
+    if (n_control > 0) {
+        n->data.ladspa.control = pa_xnew0(LADSPA_Data, (unsigned) n_control);
+
+        j = 0;
+        while (n_args > 2 && (v = pa_split(args[2], ",", &state))) {
+            double f;
+
+            if (j >= n_control || pa_atod(v, &f) < 0) {
+                pa_log("Invalid control value '%s' for plugin '%s'.", v, d->Label);
+                pa_xfree(v);
+                return -1;
+            }
+
+            n->data.ladspa.control[j++] = (LADSPA_Data) f;
+            pa_xfree(v);
+        }
+
+        if (j != n_control) {
+            pa_log("Plugin '%s' needs %lu control values.", d->Label, n_control);
+            return -1;
+        }
+    }
+
+    if (LADSPA_IS_INPLACE_BROKEN(d->Properties))
+        for (c = 0; c < ss->channels; c++)
+            n->data.ladspa.scratch[c] = pa_xnew(float, WORK_FRAMES);
+
+    n->data.ladspa.descriptor = d;
+
+    for (h = 0; h < n->data.ladspa.n_instances; h++) {
+        unsigned long in = 0, out = 0, ctl = 0;
+        unsigned first = h * n->data.ladspa.ports_per_instance;
+
+        if (!(n->data.ladspa.handle[h] = d->instantiate(d, ss->rate))) {
+            pa_log("Failed to instantiate plugin '%s'.", d->Label);
+            return -1;
+        }
+
+        for (p = 0; p < d->PortCount; p++) {
+            LADSPA_PortDescriptor pd = d->PortDescriptors[p];
+
+            if (LADSPA_IS_PORT_AUDIO(pd) && LADSPA_IS_PORT_INPUT(pd))
+                d->connect_port(n->data.ladspa.handle[h], p, buffer[first + in++]);
+            else if (LADSPA_IS_PORT_AUDIO(pd) && LADSPA_IS_PORT_OUTPUT(pd)) {
+                unsigned k = first + (unsigned) out++;
+
+                d->connect_port(n->data.ladspa.handle[h], p, n->data.ladspa.scratch[k] ? n->data.ladspa.scratch[k] : buffer[k]);
+            } else if (LADSPA_IS_PORT_CONTROL(pd) && LADSPA_IS_PORT_INPUT(pd))
+                d->connect_port(n->data.ladspa.handle[h], p, &n->data.ladspa.control[ctl++]);
+            else
+                d->connect_port(n->data.ladspa.handle[h], p, &n->data.ladspa.control_out);
+        }
+
+        if (d->activate)
+            d->activate(n->data.ladspa.handle[h]);
+    }
+
+    pa_log_debug("Running %u instances of LADSPA plugin %s (%s).", n->data.ladspa.n_instances, d->Label, d->Name);
+
+    return 0;
+}
+
+static int node_init(struct node *n, const pa_sample_spec *ss, const char *description, float **buffer) {
+    char *args[8];
+    unsigned n_args = 0, k;
+    const char *state = NULL;
+    char *a, *type;
+    int r;
+
+    pa_assert(n);
+    pa_assert(description);
+
+    n->description = pa_xstrdup(description);
+
+    if (!(type = pa_split(description, ":", &state))) {
+        pa_log("Empty filter node.");
+        return -1;
+    }
+
+    while ((a = pa_split(description, ":", &state))) {
+        if (n_args >= PA_ELEMENTSOF(args)) {
+            pa_xfree(a);
+            r = -1;
+            pa_log("Too many parameters for filter node '%s'.", description);
+            goto finish;
+        }
+
+        args[n_args++] = a;
+    }
+
+    if (pa_streq(type, "gain"))
+        r = gain_init(n, ss, args, n_args);
+    else if (pa_streq(type, "biquad"))
+        r = biquad_init(n, ss, args, n_args);
+    else if (pa_streq(type, "ladspa"))
+        r = ladspa_init(n, ss, args, n_args, buffer);
+    else {
+        pa_log("Unknown filter node type '%s'.", type);
+        r = -1;
+    }
+
+finish:
+    for (k = 0; k < n_args; k++)
+        pa_xfree(args[k]);
+    pa_xfree(type);
+
+    return r;
+}
+
+static void node_done(struct node *n, unsigned channels) {
+    pa_assert(n);
+
+    if (n->done)
+        n->done(n, channels);
+
+    pa_xfree(n->description);
+}
+
+/* Called from I/O thread context */
+static void reset_nodes(struct userdata *u) {
+    unsigned k;
+
+    for (k = 0; k < u->n_nodes; k++)
+        if (u->nodes[k].reset)
+            u->nodes[k].reset(&u->nodes[k], u->channels);
+}
+
+/* Called from I/O thread context */
+static int sink_process_msg_cb(pa_msgobject *o, int code, void *data, int64_t offset, pa_memchunk *chunk) {
+    struct userdata *u = PA_SINK(o)->userdata;
+
+    switch (code) {
+
+        case PA_SINK_MESSAGE_GET_LATENCY:
+
+            /* The sink is _put() before the sink input is, so let's
+             * make sure we don't access it in that time. Also, the
+             * sink input is first shut down, the sink second. */
+            if (!PA_SINK_IS_LINKED(u->sink->thread_info.state) ||
+                !PA_SINK_INPUT_IS_LINKED(u->sink_input->thread_info.state)) {
+                *((pa_usec_t*) data) = 0;
+                return 0;
+            }
+
+            *((pa_usec_t*) data) =
+
+                /* Get the latency of the master sink */
+                pa_sink_get_latency_within_thread(u->sink_input->sink) +
+
+                /* Add the latency internal to our sink input on top */
+                pa_bytes_to_usec(pa_memblockq_get_length(u->sink_input->thread_info.render_memblockq), &u->sink_input->sink->sample_spec);
+
+            return 0;
+    }
+
+    return pa_sink_process_msg(o, code, data, offset, chunk);
+}
+
+/* Called from main context */
+static int sink_set_state_cb(pa_sink *s, pa_sink_state_t state) {
+    struct userdata *u;
+
+    pa_sink_assert_ref(s);
+    pa_assert_se(u = s->userdata);
+
+    if (!PA_SINK_IS_LINKED(state) ||
+        !PA_SINK_INPUT_IS_LINKED(pa_sink_input_get_state(u->sink_input)))
+        return 0;
+
+    pa_sink_input_cork(u->sink_input, state == PA_SINK_SUSPENDED);
+    return 0;
+}
+
+/* Called from I/O thread context */
+static void sink_request_rewind_cb(pa_sink *s) {
+    struct userdata *u;
+
+    pa_sink_assert_ref(s);
+    pa_assert_se(u = s->userdata);
+
+    if (!PA_SINK_IS_LINKED(u->sink->thread_info.state) ||
+        !PA_SINK_INPUT_IS_LINKED(u->sink_input->thread_info.state))
+        return;
+
+    /* Just hand this one over to the master sink */
+    pa_sink_input_request_rewind(u->sink_input,
+                                 s->thread_info.rewind_nbytes +
+                                 pa_memblockq_get_length(u->memblockq), TRUE, FALSE, FALSE);
+}
+
+/* Called from I/O thread context */
+static void sink_update_requested_latency_cb(pa_sink *s) {
+    struct userdata *u;
+
+    pa_sink_assert_ref(s);
+    pa_assert_se(u = s->userdata);
+
+    if (!PA_SINK_IS_LINKED(u->sink->thread_info.state) ||
+        !PA_SINK_INPUT_IS_LINKED(u->sink_input->thread_info.state))
+        return;
+
+    /* Just hand this one over to the master sink */
+    pa_sink_input_set_requested_latency_within_thread(
+            u->sink_input,
+            pa_sink_get_requested_latency_within_thread(s));
+}
+
+/* Called from main context */
+static void sink_set_volume_cb(pa_sink *s) {
+    struct userdata *u;
+
+    pa_sink_assert_ref(s);
+    pa_assert_se(u = s->userdata);
+
+    if (!PA_SINK_IS_LINKED(pa_sink_get_state(s)) ||
+        !PA_SINK_INPUT_IS_LINKED(pa_sink_input_get_state(u->sink_input)))
+        return;
+
+    pa_sink_input_set_volume(u->sink_input, &s->real_volume, s->save_volume, TRUE);
+}
+
+/* Called from main context */
+static void sink_set_mute_cb(pa_sink *s) {
+    struct userdata *u;
+
+    pa_sink_assert_ref(s);
+    pa_assert_se(u = s->userdata);
+
+    if (!PA_SINK_IS_LINKED(pa_sink_get_state(s)) ||
+        !PA_SINK_INPUT_IS_LINKED(pa_sink_input_get_state(u->sink_input)))
+        return;
+
+    pa_sink_input_set_mute(u->sink_input, s->muted, s->save_muted);
+}
+
+/* Called from I/O thread context. Processes up to nbytes into chunk. If
+ * into is TRUE chunk describes memory we shall write to, otherwise a new
+ * block is allocated. */
+static void process_chunk(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk, pa_bool_t into) {
+    struct userdata *u;
+    float *src, *dst;
+    size_t fs;
+    unsigned n, offset;
+    pa_memchunk tchunk;
+
+    pa_assert_se(u = i->userdata);
+
+    /* Hmm, process any rewind request that might be queued up */
+    pa_sink_process_rewind(u->sink, 0);
+
+    while (pa_memblockq_peek(u->memblockq, &tchunk) < 0) {
+        pa_memchunk nchunk;
+
+        pa_sink_render(u->sink, nbytes, &nchunk);
+        pa_memblockq_push(u->memblockq, &nchunk);
+        pa_memblock_unref(nchunk.memblock);
+    }
+
+    tchunk.length = PA_MIN(nbytes, tchunk.length);
+    pa_assert(tchunk.length > 0);
+
+    fs = pa_frame_size(&i->sample_spec);
+    n = (unsigned) (tchunk.length / fs);
+
+    pa_assert(n > 0);
+
+    /* Once the input has been silent for longer than any node remembers,
+     * the output is silent too */
+    if (!pa_memblock_is_silence(tchunk.memblock))
+        u->silence_bytes = 0;
+    else if (u->silence_bytes >= u->silence_tail) {
+        pa_memblock_unref(tchunk.memblock);
+
+        if (into) {
+            chunk->length = n*fs;
+            pa_silence_memchunk(chunk, &i->sample_spec);
+        } else
+            pa_silence_memchunk_get(&i->sink->core->silence_cache, i->sink->core->mempool, chunk, &i->sample_spec, n*fs);
+
+        pa_memblockq_drop(u->memblockq, chunk->length);
+        return;
+    } else
+        u->silence_bytes += n*fs;
+
+    if (!into) {
+        chunk->index = 0;
+        chunk->memblock = pa_memblock_new(i->sink->core->mempool, n*fs);
+    }
+    chunk->length = n*fs;
+
+    pa_memblockq_drop(u->memblockq, chunk->length);
+
+    src = pa_memblock_acquire_chunk(&tchunk);
+    dst = pa_memblock_acquire_chunk(chunk);
+
+    for (offset = 0; offset < n; offset += WORK_FRAMES) {
+        unsigned frames = PA_MIN(n - offset, WORK_FRAMES), k;
+
+        pa_deinterleave(src + offset * u->channels, (void**) u->buffer, u->channels, sizeof(float), frames);
+
+        for (k = 0; k < u->n_nodes; k++)
+            u->nodes[k].run(&u->nodes[k], u->buffer, u->channels, frames);
+
+        pa_interleave((const void**) u->buffer, u->channels, dst + offset * u->channels, sizeof(float), frames);
+    }
+
+    pa_memblock_release(tchunk.memblock);
+    pa_memblock_release(chunk->memblock);
+
+    pa_memblock_unref(tchunk.memblock);
+}
+
+/* Called from I/O thread context */
+static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk) {
+    pa_sink_input_assert_ref(i);
+    pa_assert(chunk);
+
+    process_chunk(i, nbytes, chunk, FALSE);
+    return 0;
+}
+
+/* Called from I/O thread context. Used instead of pop() when our output
+ * can go to the master sink unmodified, which then hands us its own
+ * buffer to write to. */
+static int sink_input_pop_into_cb(pa_sink_input *i, pa_memchunk *target) {
+    pa_sink_input_assert_ref(i);
+    pa_assert(target);
+
+    process_chunk(i, target->length, target, TRUE);
+    return 0;
+}
+
+/* Called from I/O thread context */
+static void sink_input_process_rewind_cb(pa_sink_input *i, size_t nbytes) {
+    struct userdata *u;
+    size_t amount = 0;
+
+    pa_sink_input_assert_ref(i);
+    pa_assert_se(u = i->userdata);
+
+    if (u->sink->thread_info.rewind_nbytes > 0) {
+        size_t max_rewrite;
+
+        max_rewrite = nbytes + pa_memblockq_get_length(u->memblockq);
+        amount = PA_MIN(u->sink->thread_info.rewind_nbytes, max_rewrite);
+        u->sink->thread_info.rewind_nbytes = 0;
+
+        if (amount > 0) {
+            pa_memblockq_seek(u->memblockq, - (int64_t) amount, PA_SEEK_RELATIVE, TRUE);
+
+            /* One rewind for the whole graph */
+            reset_nodes(u);
+            u->silence_bytes = 0;
+        }
+    }
+
+    pa_sink_process_rewind(u->sink, amount);
+    pa_memblockq_rewind(u->memblockq, nbytes);
+}
+
+/* Called from I/O thread context */
+static void sink_input_update_max_rewind_cb(pa_sink_input *i, size_t nbytes) {
+    struct userdata *u;
+
+    pa_sink_input_assert_ref(i);
+    pa_assert_se(u = i->userdata);
+
+    pa_memblockq_set_maxrewind(u->memblockq, nbytes);
+    pa_sink_set_max_rewind_within_thread(u->sink, nbytes);
+}
+
+/* Called from I/O thread context */
+static void sink_input_update_max_request_cb(pa_sink_input *i, size_t nbytes) {
+    struct userdata *u;
+
+    pa_sink_input_assert_ref(i);
+    pa_assert_se(u = i->userdata);
+
+    pa_sink_set_max_request_within_thread(u->sink, nbytes);
+}
+
+/* Called from I/O thread context */
+static void sink_input_update_sink_latency_range_cb(pa_sink_input *i) {
+    struct userdata *u;
+
+    pa_sink_input_assert_ref(i);
+    pa_assert_se(u = i->userdata);
+
+    pa_sink_set_latency_range_within_thread(u->sink, i->sink->thread_info.min_latency, i->sink->thread_info.max_latency);
+}
+
+/* Called from I/O thread context */
+static void sink_input_update_sink_fixed_latency_cb(pa_sink_input *i) {
+    struct userdata *u;
+
+    pa_sink_input_assert_ref(i);
+    pa_assert_se(u = i->userdata);
+
+    pa_sink_set_fixed_latency_within_thread(u->sink, i->sink->thread_info.fixed_latency);
+}
+
+/* Called from I/O thread context */
+static void sink_input_detach_cb(pa_sink_input *i) {
+    struct userdata *u;
+
+    pa_sink_input_assert_ref(i);
+    pa_assert_se(u = i->userdata);
+
+    pa_sink_detach_within_thread(u->sink);
+
+    pa_sink_set_rtpoll(u->sink, NULL);
+}
+
+/* Called from I/O thread context */
+static void sink_input_attach_cb(pa_sink_input *i) {
+    struct userdata *u;
+
+    pa_sink_input_assert_ref(i);
+    pa_assert_se(u = i->userdata);
+
+    pa_sink_set_rtpoll(u->sink, i->sink->thread_info.rtpoll);
+    pa_sink_set_latency_range_within_thread(u->sink, i->sink->thread_info.min_latency, i->sink->thread_info.max_latency);
+    pa_sink_set_fixed_latency_within_thread(u->sink, i->sink->thread_info.fixed_latency);
+    pa_sink_set_max_request_within_thread(u->sink, pa_sink_input_get_max_request(i));
+    pa_sink_set_max_rewind_within_thread(u->sink, pa_sink_input_get_max_rewind(i));
+
+    pa_sink_attach_within_thread(u->sink);
+}
+
+/* Called from main context */
+static void sink_input_kill_cb(pa_sink_input *i) {
+    struct userdata *u;
+
+    pa_sink_input_assert_ref(i);
+    pa_assert_se(u = i->userdata);
+
+    /* The order here matters! We first kill the sink input, followed
+     * by the sink. That means the sink callbacks must be protected
+     * against an unconnected sink input! */
+    pa_sink_input_unlink(u->sink_input);
+    pa_sink_unlink(u->sink);
+
+    pa_sink_input_unref(u->sink_input);
+    u->sink_input = NULL;
+
+    pa_sink_unref(u->sink);
+    u->sink = NULL;
+
+    pa_module_unload_request(u->module, TRUE);
+}
+
+/* Called from IO thread context */
+static void sink_input_state_change_cb(pa_sink_input *i, pa_sink_input_state_t state) {
+    struct userdata *u;
+
+    pa_sink_input_assert_ref(i);
+    pa_assert_se(u = i->userdata);
+
+    /* If we are added for the first time, ask for a rewinding so that
+     * we are heard right-away. */
+    if (PA_SINK_INPUT_IS_LINKED(state) &&
+        i->thread_info.state == PA_SINK_INPUT_INIT) {
+        pa_log_debug("Requesting rewind due to state change.");
+        pa_sink_input_request_rewind(i, 0, FALSE, TRUE, TRUE);
+    }
+}
+
+/* Called from main context */
+static pa_bool_t sink_input_may_move_to_cb(pa_sink_input *i, pa_sink *dest) {
+    struct userdata *u;
+
+    pa_sink_input_assert_ref(i);
+    pa_assert_se(u = i->userdata);
+
+    if (u->autoloaded)
+        return FALSE;
+
+    return u->sink != dest;
+}
+
+/* Called from main context */
+static void sink_input_moving_cb(pa_sink_input *i, pa_sink *dest) {
+    struct userdata *u;
+
+    pa_sink_input_assert_ref(i);
+    pa_assert_se(u = i->userdata);
+
+    if (dest) {
+        pa_sink_set_asyncmsgq(u->sink, dest->asyncmsgq);
+        pa_sink_update_flags(u->sink, PA_SINK_LATENCY|PA_SINK_DYNAMIC_LATENCY, dest->flags);
+    } else
+        pa_sink_set_asyncmsgq(u->sink, NULL);
+
+    if (u->auto_desc && dest) {
+        const char *z;
+        pa_proplist *pl;
+
+        pl = pa_proplist_new();
+        z = pa_proplist_gets(dest->proplist, PA_PROP_DEVICE_DESCRIPTION);
+        pa_proplist_setf(pl, PA_PROP_DEVICE_DESCRIPTION, "Filtered %s", z ? z : dest->name);
+
+        pa_sink_update_proplist(u->sink, PA_UPDATE_REPLACE, pl);
+        pa_proplist_free(pl);
+    }
+}
+
+/* Called from main context */
+static void sink_input_volume_changed_cb(pa_sink_input *i) {
+    struct userdata *u;
+
+    pa_sink_input_assert_ref(i);
+    pa_assert_se(u = i->userdata);
+
+    pa_sink_volume_changed(u->sink, &i->volume);
+}
+
+/* Called from main context */
+static void sink_input_mute_changed_cb(pa_sink_input *i) {
+    struct userdata *u;
+
+    pa_sink_input_assert_ref(i);
+    pa_assert_se(u = i->userdata);
+
+    pa_sink_mute_changed(u->sink, i->muted);
+}
+
+/* Called from I/O thread context */
+static int source_process_msg_cb(pa_msgobject *o, int code, void *data, int64_t offset, pa_memchunk *chunk) {
+    struct userdata *u = PA_SOURCE(o)->userdata;
+
+    switch (code) {
+
+        case PA_SOURCE_MESSAGE_GET_LATENCY:
+
+            /* The source is _put() before the source output is, so let's
+             * make sure we don't access it in that time. Also, the
+             * source output is first shut down, the source second. */
+            if (!PA_SOURCE_IS_LINKED(u->source->thread_info.state) ||
+                !PA_SOURCE_OUTPUT_IS_LINKED(u->source_output->thread_info.state)) {
+                *((pa_usec_t*) data) = 0;
+                return 0;
+            }
+
+            *((pa_usec_t*) data) =
+
+                /* Get the latency of the master source */
+                pa_source_get_latency_within_thread(u->source_output->source) +
+
+                /* Add the latency internal to our source output on top */
+                pa_bytes_to_usec(pa_memblockq_get_length(u->source_output->thread_info.delay_memblockq), &u->source_output->source->sample_spec);
+
+            return 0;
+    }
+
+    return pa_source_process_msg(o, code, data, offset, chunk);
+}
+
+/* Called from main context */
+static int source_set_state_cb(pa_source *s, pa_source_state_t state) {
+    struct userdata *u;
+
+    pa_source_assert_ref(s);
+    pa_assert_se(u = s->userdata);
+
+    if (!PA_SOURCE_IS_LINKED(state) ||
+        !PA_SOURCE_OUTPUT_IS_LINKED(pa_source_output_get_state(u->source_output)))
+        return 0;
+
+    pa_source_output_cork(u->source_output, state == PA_SOURCE_SUSPENDED);
+    return 0;
+}
+
+/* Called from I/O thread context */
+static void source_update_requested_latency_cb(pa_source *s) {
+    struct userdata *u;
+
+    pa_source_assert_ref(s);
+    pa_assert_se(u = s->userdata);
+
+    if (!PA_SOURCE_IS_LINKED(u->source->thread_info.state) ||
+        !PA_SOURCE_OUTPUT_IS_LINKED(u->source_output->thread_info.state))
+        return;
+
+    /* Just hand this one over to the master source */
+    pa_source_output_set_requested_latency_within_thread(
+            u->source_output,
+            pa_source_get_requested_latency_within_thread(s));
+}
+
+/* Called from main context */
+static void source_set_volume_cb(pa_source *s) {
+    struct userdata *u;
+
+    pa_source_assert_ref(s);
+    pa_assert_se(u = s->userdata);
+
+    if (!PA_SOURCE_IS_LINKED(pa_source_get_state(s)) ||
+        !PA_SOURCE_OUTPUT_IS_LINKED(pa_source_output_get_state(u->source_output)))
+        return;
+
+    pa_source_output_set_volume(u->source_output, &s->real_volume, s->save_volume, TRUE);
+}
+
+/* Called from main context */
+static void source_set_mute_cb(pa_source *s) {
+    struct userdata *u;
+
+    pa_source_assert_ref(s);
+    pa_assert_se(u = s->userdata);
+
+    if (!PA_SOURCE_IS_LINKED(pa_source_get_state(s)) ||
+        !PA_SOURCE_OUTPUT_IS_LINKED(pa_source_output_get_state(u->source_output)))
+        return;
+
+    pa_source_output_set_mute(u->source_output, s->muted, s->save_muted);
+}
+
+/* Called from I/O thread context. The captured data goes through all
+ * nodes on its way from the master's chunk to the one single block we
+ * post. */
+static void source_output_push_cb(pa_source_output *o, const pa_memchunk *chunk) {
+    struct userdata *u;
+    float *src, *dst;
+    size_t fs;
+    unsigned n, offset;
+    pa_memchunk tchunk;
+
+    pa_source_output_assert_ref(o);
+    pa_source_output_assert_io_context(o);
+    pa_assert_se(u = o->userdata);
+
+    if (!PA_SOURCE_OUTPUT_IS_LINKED(pa_source_output_get_state(u->source_output))) {
+        pa_log("push when no link?");
+        return;
+    }
+
+    fs = pa_frame_size(&o->sample_spec);
+    n = (unsigned) (chunk->length / fs);
+
+    if (n <= 0)
+        return;
+
+    /* Once the input has been silent for longer than any node remembers,
+     * the output is the very same silence */
+    if (!pa_memblock_is_silence(chunk->memblock))
+        u->silence_bytes = 0;
+    else if (u->silence_bytes >= u->silence_tail) {
+        pa_source_post(u->source, chunk);
+        return;
+    } else
+        u->silence_bytes += n*fs;
+
+    tchunk.index = 0;
+    tchunk.length = n*fs;
+    tchunk.memblock = pa_memblock_new(o->source->core->mempool, tchunk.length);
+
+    src = pa_memblock_acquire_chunk(chunk);
+    dst = pa_memblock_acquire_chunk(&tchunk);
+
+    for (offset = 0; offset < n; offset += WORK_FRAMES) {
+        unsigned frames = PA_MIN(n - offset, WORK_FRAMES), k;
+
+        pa_deinterleave(src + offset * u->channels, (void**) u->buffer, u->channels, sizeof(float), frames);
+
+        for (k = 0; k < u->n_nodes; k++)
+            u->nodes[k].run(&u->nodes[k], u->buffer, u->channels, frames);
+
+        pa_interleave((const void**) u->buffer, u->channels, dst + offset * u->channels, sizeof(float), frames);
+    }
+
+    pa_memblock_release(chunk->memblock);
+    pa_memblock_release(tchunk.memblock);
+
+    pa_source_post(u->source, &tchunk);
+    pa_memblock_unref(tchunk.memblock);
+}
+
+/* Called from I/O thread context */
+static void source_output_process_rewind_cb(pa_source_output *o, size_t nbytes) {
+    struct userdata *u;
+
+    pa_source_output_assert_ref(o);
+    pa_source_output_assert_io_context(o);
+    pa_assert_se(u = o->userdata);
+
+    /* The data is overwritten with new captures, whatever the nodes
+     * remember about it is stale now */
+    reset_nodes(u);
+    u->silence_bytes = 0;
+
+    pa_source_process_rewind(u->source, nbytes);
+}
+
+/* Called from I/O thread context */
+static void source_output_update_max_rewind_cb(pa_source_output *o, size_t nbytes) {
+    struct userdata *u;
+
+    pa_source_output_assert_ref(o);
+    pa_assert_se(u = o->userdata);
+
+    pa_source_set_max_rewind_within_thread(u->source, nbytes);
+}
+
+/* Called from I/O thread context */
+static void source_output_update_source_latency_range_cb(pa_source_output *o) {
+    struct userdata *u;
+
+    pa_source_output_assert_ref(o);
+    pa_assert_se(u = o->userdata);
+
+    pa_source_set_latency_range_within_thread(u->source, o->source->thread_info.min_latency, o->source->thread_info.max_latency);
+}
+
+/* Called from I/O thread context */
+static void source_output_update_source_fixed_latency_cb(pa_source_output *o) {
+    struct userdata *u;
+
+    pa_source_output_assert_ref(o);
+    pa_assert_se(u = o->userdata);
+
+    pa_source_set_fixed_latency_within_thread(u->source, o->source->thread_info.fixed_latency);
+}
+
+/* Called from I/O thread context */
+static void source_output_detach_cb(pa_source_output *o) {
+    struct userdata *u;
+
+    pa_source_output_assert_ref(o);
+    pa_source_output_assert_io_context(o);
+    pa_assert_se(u = o->userdata);
+
+    pa_source_detach_within_thread(u->source);
+
+    pa_source_set_rtpoll(u->source, NULL);
+}
+
+/* Called from I/O thread context */
+static void source_output_attach_cb(pa_source_output *o) {
+    struct userdata *u;
+
+    pa_source_output_assert_ref(o);
+    pa_source_output_assert_io_context(o);
+    pa_assert_se(u = o->userdata);
+
+    pa_source_set_rtpoll(u->source, o->source->thread_info.rtpoll);
+    pa_source_set_latency_range_within_thread(u->source, o->source->thread_info.min_latency, o->source->thread_info.max_latency);
+    pa_source_set_fixed_latency_within_thread(u->source, o->source->thread_info.fixed_latency);
+    pa_source_set_max_rewind_within_thread(u->source, pa_source_output_get_max_rewind(o));
+
+    pa_source_attach_within_thread(u->source);
+}
+
+/* Called from main context */
+static void source_output_kill_cb(pa_source_output *o) {
+    struct userdata *u;
+
+    pa_source_output_assert_ref(o);
+    pa_assert_se(u = o->userdata);
+
+    /* The order here matters! We first kill the source output, followed
+     * by the source. That means the source callbacks must be protected
+     * against an unconnected source output! */
+    pa_source_output_unlink(u->source_output);
+    pa_source_unlink(u->source);
+
+    pa_source_output_unref(u->source_output);
+    u->source_output = NULL;
+
+    pa_source_unref(u->source);
+    u->source = NULL;
+
+    pa_module_unload_request(u->module, TRUE);
+}
+
+/* Called from main context */
+static pa_bool_t source_output_may_move_to_cb(pa_source_output *o, pa_source *dest) {
+    struct userdata *u;
+
+    pa_source_output_assert_ref(o);
+    pa_assert_se(u = o->userdata);
+
+    if (u->autoloaded)
+        return FALSE;
+
+    return u->source != dest;
+}
+
+/* Called from main context */
+static void source_output_moving_cb(pa_source_output *o, pa_source *dest) {
+    struct userdata *u;
+
+    pa_source_output_assert_ref(o);
+    pa_assert_se(u = o->userdata);
+
+    if (dest) {
+        pa_source_set_asyncmsgq(u->source, dest->asyncmsgq);
+        pa_source_update_flags(u->source, PA_SOURCE_LATENCY|PA_SOURCE_DYNAMIC_LATENCY, dest->flags);
+    } else
+        pa_source_set_asyncmsgq(u->source, NULL);
+
+    if (u->auto_desc && dest) {
+        const char *z;
+        pa_proplist *pl;
+
+        pl = pa_proplist_new();
+        z = pa_proplist_gets(dest->proplist, PA_PROP_DEVICE_DESCRIPTION);
+        pa_proplist_setf(pl, PA_PROP_DEVICE_DESCRIPTION, "Filtered %s", z ? z : dest->name);
+
+        pa_source_update_proplist(u->source, PA_UPDATE_REPLACE, pl);
+        pa_proplist_free(pl);
+    }
+}
+
+/* Called from main context */
+static void source_output_volume_changed_cb(pa_source_output *o) {
+    struct userdata *u;
+
+    pa_source_output_assert_ref(o);
+    pa_assert_se(u = o->userdata);
+
+    pa_source_volume_changed(u->source, &o->volume);
+}
+
+/* Called from main context */
+static void source_output_mute_changed_cb(pa_source_output *o) {
+    struct userdata *u;
+
+    pa_source_output_assert_ref(o);
+    pa_assert_se(u = o->userdata);
+
+    pa_source_mute_changed(u->source, o->muted);
+}
+
+static int load_graph(struct userdata *u, const pa_sample_spec *ss, const char *graph) {
+    const char *state = NULL;
+    char *d;
+    unsigned k;
+
+    pa_assert(u);
+    pa_assert(graph);
+
+    u->silence_tail = 0;
+
+    while ((d = pa_split(graph, "|", &state))) {
+        char *s = pa_strip(d);
+        struct node *n;
+
+        if (!*s) {
+            pa_xfree(d);
+            continue;
+        }
+
+        u->nodes = pa_xrenew(struct node, u->nodes, u->n_nodes + 1);
+        n = &u->nodes[u->n_nodes++];
+        memset(n, 0, sizeof(*n));
+
+        if (node_init(n, ss, s, u->buffer) < 0) {
+            pa_log("Failed to set up filter node '%s'.", s);
+            pa_xfree(d);
+            return -1;
+        }
+
+        pa_xfree(d);
+    }
+
+    if (u->n_nodes <= 0) {
+        pa_log("The filter graph is empty.");
+        return -1;
+    }
+
+    for (k = 0; k < u->n_nodes; k++) {
+        pa_log_debug("Filter node %u: %s", k, u->nodes[k].description);
+
+        if (u->nodes[k].tail == (size_t) -1) {
+            u->silence_tail = (size_t) -1;
+            break;
+        }
+
+        u->silence_tail += u->nodes[k].tail * pa_frame_size(ss);
+    }
+
+    return 0;
+}
+
+/* Sets up the work buffers and the nodes for the sample spec of the
+ * filter */
+static int setup_graph(struct userdata *u, const pa_sample_spec *ss, const char *graph) {
+    unsigned c;
+
+    u->channels = ss->channels;
+
+    for (c = 0; c < u->channels; c++)
+        u->buffer[c] = pa_xnew(float, WORK_FRAMES);
+
+    return load_graph(u, ss, graph);
+}
+
+static int init_sink(struct userdata *u, pa_modargs *ma, const char *graph, pa_bool_t use_volume_sharing, pa_bool_t force_flat_volume) {
+    pa_module *m = u->module;
+    pa_sample_spec ss;
+    pa_channel_map map, stream_map;
+    pa_sink *master;
+    pa_sink_input_new_data sink_input_data;
+    pa_sink_new_data sink_data;
+    pa_memchunk silence;
+
+    if (!(master = pa_namereg_get(m->core, pa_modargs_get_value(ma, "sink_master", NULL), PA_NAMEREG_SINK))) {
+        pa_log("Master sink not found");
+        return -1;
+    }
+
+    pa_assert(master);
+
+    ss = master->sample_spec;
+    ss.format = PA_SAMPLE_FLOAT32;
+    map = master->channel_map;
+    if (pa_modargs_get_sample_spec_and_channel_map(ma, &ss, &map, PA_CHANNEL_MAP_DEFAULT) < 0) {
+        pa_log("Invalid sample format specification or channel map");
+        return -1;
+    }
+
+    stream_map = map;
+    if (pa_modargs_get_channel_map(ma, "master_channel_map", &stream_map) < 0) {
+        pa_log("Invalid master channel map");
+        return -1;
+    }
+
+    if (stream_map.channels != ss.channels) {
+        pa_log("Number of channels doesn't match");
+        return -1;
+    }
+
+    if (setup_graph(u, &ss, graph) < 0)
+        return -1;
+
+    /* Create sink */
+    pa_sink_new_data_init(&sink_data);
+    sink_data.driver = __FILE__;
+    sink_data.module = m;
+    if (!(sink_data.name = pa_xstrdup(pa_modargs_get_value(ma, "sink_name", NULL))))
+        sink_data.name = pa_sprintf_malloc("%s.filter-graph", master->name);
+    pa_sink_new_data_set_sample_spec(&sink_data, &ss);
+    pa_sink_new_data_set_channel_map(&sink_data, &map);
+    pa_proplist_sets(sink_data.proplist, PA_PROP_DEVICE_MASTER_DEVICE, master->name);
+    pa_proplist_sets(sink_data.proplist, PA_PROP_DEVICE_CLASS, "filter");
+    pa_proplist_sets(sink_data.proplist, "device.filter_graph.graph", graph);
+
+    if (pa_modargs_get_proplist(ma, "sink_properties", sink_data.proplist, PA_UPDATE_REPLACE) < 0) {
+        pa_log("Invalid properties");
+        pa_sink_new_data_done(&sink_data);
+        return -1;
+    }
+
+    if ((u->auto_desc = !pa_proplist_contains(sink_data.proplist, PA_PROP_DEVICE_DESCRIPTION))) {
+        const char *z;
+
+        z = pa_proplist_gets(master->proplist, PA_PROP_DEVICE_DESCRIPTION);
+        pa_proplist_setf(sink_data.proplist, PA_PROP_DEVICE_DESCRIPTION, "Filtered %s", z ? z : master->name);
+    }
+
+    u->sink = pa_sink_new(m->core, &sink_data, (master->flags & (PA_SINK_LATENCY|PA_SINK_DYNAMIC_LATENCY))
+                                               | (use_volume_sharing ? PA_SINK_SHARE_VOLUME_WITH_MASTER : 0));
+    pa_sink_new_data_done(&sink_data);
+
+    if (!u->sink) {
+        pa_log("Failed to create sink.");
+        return -1;
+    }
+
+    u->sink->parent.process_msg = sink_process_msg_cb;
+    u->sink->set_state = sink_set_state_cb;
+    u->sink->update_requested_latency = sink_update_requested_latency_cb;
+    u->sink->request_rewind = sink_request_rewind_cb;
+    pa_sink_set_set_mute_callback(u->sink, sink_set_mute_cb);
+    if (!use_volume_sharing) {
+        pa_sink_set_set_volume_callback(u->sink, sink_set_volume_cb);
+        pa_sink_enable_decibel_volume(u->sink, TRUE);
+    }
+    /* Normally this flag would be enabled automatically be we can force it. */
+    if (force_flat_volume)
+        u->sink->flags |= PA_SINK_FLAT_VOLUME;
+    u->sink->userdata = u;
+
+    pa_sink_set_asyncmsgq(u->sink, master->asyncmsgq);
+
+    /* Create sink input */
+    pa_sink_input_new_data_init(&sink_input_data);
+    sink_input_data.driver = __FILE__;
+    sink_input_data.module = m;
+    pa_sink_input_new_data_set_sink(&sink_input_data, master, FALSE);
+    sink_input_data.origin_sink = u->sink;
+    pa_proplist_setf(sink_input_data.proplist, PA_PROP_MEDIA_NAME, "Filter Graph Stream from %s", pa_proplist_gets(u->sink->proplist, PA_PROP_DEVICE_DESCRIPTION));
+    pa_proplist_sets(sink_input_data.proplist, PA_PROP_MEDIA_ROLE, "filter");
+    pa_sink_input_new_data_set_sample_spec(&sink_input_data, &ss);
+    pa_sink_input_new_data_set_channel_map(&sink_input_data, &stream_map);
+
+    /* Like module-remap-sink, an explicit master channel map is a
+     * relabelling of the channels, not a request to remix them */
+    if (!pa_channel_map_equal(&stream_map, &map))
+        sink_input_data.flags |= PA_SINK_INPUT_NO_REMIX;
+
+    pa_sink_input_new(&u->sink_input, m->core, &sink_input_data);
+    pa_sink_input_new_data_done(&sink_input_data);
+
+    if (!u->sink_input)
+        return -1;
+
+    u->sink_input->pop = sink_input_pop_cb;
+    u->sink_input->pop_into = sink_input_pop_into_cb;
+    u->sink_input->process_rewind = sink_input_process_rewind_cb;
+    u->sink_input->update_max_rewind = sink_input_update_max_rewind_cb;
+    u->sink_input->update_max_request = sink_input_update_max_request_cb;
+    u->sink_input->update_sink_latency_range = sink_input_update_sink_latency_range_cb;
+    u->sink_input->update_sink_fixed_latency = sink_input_update_sink_fixed_latency_cb;
+    u->sink_input->kill = sink_input_kill_cb;
+    u->sink_input->attach = sink_input_attach_cb;
+    u->sink_input->detach = sink_input_detach_cb;
+    u->sink_input->state_change = sink_input_state_change_cb;
+    u->sink_input->may_move_to = sink_input_may_move_to_cb;
+    u->sink_input->moving = sink_input_moving_cb;
+    u->sink_input->volume_changed = use_volume_sharing ? NULL : sink_input_volume_changed_cb;
+    u->sink_input->mute_changed = sink_input_mute_changed_cb;
+    u->sink_input->userdata = u;
+
+    u->sink->input_to_master = u->sink_input;
+
+    pa_sink_input_get_silence(u->sink_input, &silence);
+    u->memblockq = pa_memblockq_new("module-filter-graph memblockq", 0, MEMBLOCKQ_MAXLENGTH, 0, &ss, 1, 1, 0, &silence);
+    pa_memblock_unref(silence.memblock);
+
+    pa_sink_put(u->sink);
+    pa_sink_input_put(u->sink_input);
+
+    return 0;
+}
+
+/* The capture side equivalent of init_sink(). Capture chains don't need
+ * a memblockq of their own, every chunk the master posts is processed
+ * right away. */
+static int init_source(struct userdata *u, pa_modargs *ma, const char *graph, pa_bool_t use_volume_sharing, pa_bool_t force_flat_volume) {
+    pa_module *m = u->module;
+    pa_sample_spec ss;
+    pa_channel_map map, stream_map;
+    pa_source *master;
+    pa_source_output_new_data source_output_data;
+    pa_source_new_data source_data;
+
+    if (!(master = pa_namereg_get(m->core, pa_modargs_get_value(ma, "source_master", NULL), PA_NAMEREG_SOURCE))) {
+        pa_log("Master source not found");
+        return -1;
+    }
+
+    ss = master->sample_spec;
+    ss.format = PA_SAMPLE_FLOAT32;
+    map = master->channel_map;
+    if (pa_modargs_get_sample_spec_and_channel_map(ma, &ss, &map, PA_CHANNEL_MAP_DEFAULT) < 0) {
+        pa_log("Invalid sample format specification or channel map");
+        return -1;
+    }
+
+    stream_map = map;
+    if (pa_modargs_get_channel_map(ma, "master_channel_map", &stream_map) < 0) {
+        pa_log("Invalid master channel map");
+        return -1;
+    }
+
+    if (stream_map.channels != ss.channels) {
+        pa_log("Number of channels doesn't match");
+        return -1;
+    }
+
+    if (setup_graph(u, &ss, graph) < 0)
+        return -1;
+
+    /* Create source */
+    pa_source_new_data_init(&source_data);
+    source_data.driver = __FILE__;
+    source_data.module = m;
+    if (!(source_data.name = pa_xstrdup(pa_modargs_get_value(ma, "source_name", NULL))))
+        source_data.name = pa_sprintf_malloc("%s.filter-graph", master->name);
+    pa_source_new_data_set_sample_spec(&source_data, &ss);
+    pa_source_new_data_set_channel_map(&source_data, &map);
+    pa_proplist_sets(source_data.proplist, PA_PROP_DEVICE_MASTER_DEVICE, master->name);
+    pa_proplist_sets(source_data.proplist, PA_PROP_DEVICE_CLASS, "filter");
+    pa_proplist_sets(source_data.proplist, "device.filter_graph.graph", graph);
+
+    if (pa_modargs_get_proplist(ma, "source_properties", source_data.proplist, PA_UPDATE_REPLACE) < 0) {
+        pa_log("Invalid properties");
+        pa_source_new_data_done(&source_data);
+        return -1;
+    }
+
+    if ((u->auto_desc = !pa_proplist_contains(source_data.proplist, PA_PROP_DEVICE_DESCRIPTION))) {
+        const char *z;
+
+        z = pa_proplist_gets(master->proplist, PA_PROP_DEVICE_DESCRIPTION);
+        pa_proplist_setf(source_data.proplist, PA_PROP_DEVICE_DESCRIPTION, "Filtered %s", z ? z : master->name);
+    }
+
+    u->source = pa_source_new(m->core, &source_data, (master->flags & (PA_SOURCE_LATENCY|PA_SOURCE_DYNAMIC_LATENCY))
+                                                     | (use_volume_sharing ? PA_SOURCE_SHARE_VOLUME_WITH_MASTER : 0));
+    pa_source_new_data_done(&source_data);
+
+    if (!u->source) {
+        pa_log("Failed to create source.");
+        return -1;
+    }
+
+    u->source->parent.process_msg = source_process_msg_cb;
+    u->source->set_state = source_set_state_cb;
+    u->source->update_requested_latency = source_update_requested_latency_cb;
+    pa_source_set_set_mute_callback(u->source, source_set_mute_cb);
+    if (!use_volume_sharing) {
+        pa_source_set_set_volume_callback(u->source, source_set_volume_cb);
+        pa_source_enable_decibel_volume(u->source, TRUE);
+    }
+    /* Normally this flag would be enabled automatically be we can force it. */
+    if (force_flat_volume)
+        u->source->flags |= PA_SOURCE_FLAT_VOLUME;
+    u->source->userdata = u;
+
+    pa_source_set_asyncmsgq(u->source, master->asyncmsgq);
+
+    /* Create source output */
+    pa_source_output_new_data_init(&source_output_data);
+    source_output_data.driver = __FILE__;
+    source_output_data.module = m;
+    pa_source_output_new_data_set_source(&source_output_data, master, FALSE);
+    source_output_data.destination_source = u->source;
+    pa_proplist_setf(source_output_data.proplist, PA_PROP_MEDIA_NAME, "Filter Graph Stream to %s", pa_proplist_gets(u->source->proplist, PA_PROP_DEVICE_DESCRIPTION));
+    pa_proplist_sets(source_output_data.proplist, PA_PROP_MEDIA_ROLE, "filter");
+    pa_source_output_new_data_set_sample_spec(&source_output_data, &ss);
+    pa_source_output_new_data_set_channel_map(&source_output_data, &stream_map);
+
+    /* Like module-remap-source, an explicit master channel map is a
+     * relabelling of the channels, not a request to remix them */
+    if (!pa_channel_map_equal(&stream_map, &map))
+        source_output_data.flags |= PA_SOURCE_OUTPUT_NO_REMIX;
+
+    pa_source_output_new(&u->source_output, m->core, &source_output_data);
+    pa_source_output_new_data_done(&source_output_data);
+
+    if (!u->source_output)
+        return -1;
+
+    u->source_output->push = source_output_push_cb;
+    u->source_output->process_rewind = source_output_process_rewind_cb;
+    u->source_output->update_max_rewind = source_output_update_max_rewind_cb;
+    u->source_output->update_source_latency_range = source_output_update_source_latency_range_cb;
+    u->source_output->update_source_fixed_latency = source_output_update_source_fixed_latency_cb;
+    u->source_output->kill = source_output_kill_cb;
+    u->source_output->attach = source_output_attach_cb;
+    u->source_output->detach = source_output_detach_cb;
+    u->source_output->may_move_to = source_output_may_move_to_cb;
+    u->source_output->moving = source_output_moving_cb;
+    u->source_output->volume_changed = use_volume_sharing ? NULL : source_output_volume_changed_cb;
+    u->source_output->mute_changed = source_output_mute_changed_cb;
+    u->source_output->userdata = u;
+
+    u->source->output_from_master = u->source_output;
+
+    pa_source_put(u->source);
+    pa_source_output_put(u->source_output);
+
+    return 0;
+}
+
+int pa__init(pa_module*m) {
+    struct userdata *u;
+    pa_modargs *ma;
+    pa_bool_t use_volume_sharing = TRUE;
+    pa_bool_t force_flat_volume = FALSE;
+    const char *graph;
+
+    pa_assert(m);
+
+    if (!(ma = pa_modargs_new(m->argument, valid_modargs))) {
+        pa_log("Failed to parse module arguments.");
+        goto fail;
+    }
+
+    if (pa_modargs_get_value(ma, "sink_master", NULL) && pa_modargs_get_value(ma, "source_master", NULL)) {
+        pa_log("Only one of sink_master= and source_master= may be given.");
+        goto fail;
+    }
+
+    if (!(graph = pa_modargs_get_value(ma, "graph", NULL))) {
+        pa_log("Missing filter graph.");
+        goto fail;
+    }
+
+    if (pa_modargs_get_value_boolean(ma, "use_volume_sharing", &use_volume_sharing) < 0) {
+        pa_log("use_volume_sharing= expects a boolean argument");
+        goto fail;
+    }
+
+    if (pa_modargs_get_value_boolean(ma, "force_flat_volume", &force_flat_volume) < 0) {
+        pa_log("force_flat_volume= expects a boolean argument");
+        goto fail;
+    }
+
+    if (use_volume_sharing && force_flat_volume) {
+        pa_log("Flat volume can't be forced when using volume sharing.");
+        goto fail;
+    }
+
+    u = pa_xnew0(struct userdata, 1);
+    u->module = m;
+    m->userdata = u;
+
+    u->autoloaded = DEFAULT_AUTOLOADED;
+    if (pa_modargs_get_value_boolean(ma, "autoloaded", &u->autoloaded) < 0) {
+        pa_log("Failed to parse autoloaded value");
+        goto fail;
+    }
+
+    /* Without source_master= we filter a sink, the default one if no
+     * sink_master= is given either */
+    if (pa_modargs_get_value(ma, "source_master", NULL)) {
+        if (init_source(u, ma, graph, use_volume_sharing, force_flat_volume) < 0)
+            goto fail;
+    } else if (init_sink(u, ma, graph, use_volume_sharing, force_flat_volume) < 0)
+        goto fail;
+
+    pa_modargs_free(ma);
+
+    return 0;
+
+fail:
+    if (ma)
+        pa_modargs_free(ma);
+
+    pa__done(m);
+
+    return -1;
+}
+
+int pa__get_n_used(pa_module *m) {
+    struct userdata *u;
+
+    pa_assert(m);
+    pa_assert_se(u = m->userdata);
+
+    if (u->source)
+        return pa_source_linked_by(u->source);
+
+    return pa_sink_linked_by(u->sink);
+}
+
+void pa__done(pa_module*m) {
+    struct userdata *u;
+    unsigned k, c;
+
+    pa_assert(m);
+
+    if (!(u = m->userdata))
+        return;
+
+    /* See comments in sink_input_kill_cb() and source_output_kill_cb()
+     * above regarding destruction order! */
+
+    if (u->sink_input)
+        pa_sink_input_unlink(u->sink_input);
+
+    if (u->sink)
+        pa_sink_unlink(u->sink);
+
+    if (u->sink_input)
+        pa_sink_input_unref(u->sink_input);
+
+    if (u->sink)
+        pa_sink_unref(u->sink);
+
+    if (u->source_output)
+        pa_source_output_unlink(u->source_output);
+
+    if (u->source)
+        pa_source_unlink(u->source);
+
+    if (u->source_output)
+        pa_source_output_unref(u->source_output);
+
+    if (u->source)
+        pa_source_unref(u->source);
+
+    if (u->memblockq)
+        pa_memblockq_free(u->memblockq);
+
+    for (k = 0; k < u->n_nodes; k++)
+        node_done(&u->nodes[k], u->channels);
+    pa_xfree(u->nodes);
+
+    for (c = 0; c < u->channels; c++)
+        pa_xfree(u->buffer[c]);
+
+    pa_xfree(u);
+}
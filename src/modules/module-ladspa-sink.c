@@ -28,6 +28,7 @@
 
 #include <math.h>
 
+#include <pulse/timeval.h>
 #include <pulse/xmalloc.h>
 
 #include <pulsecore/i18n.h>
@@ -61,30 +62,50 @@ PA_MODULE_USAGE(
       "rate=<sample rate> "
       "channels=<number of channels> "
       "channel_map=<input channel map> "
-      "plugin=<ladspa plugin name> "
-      "label=<ladspa plugin label> "
-      "control=<comma separated list of input control values> "
+      "plugin=<ladspa plugin name, or ';' separated list of names for a chain> "
+      "label=<ladspa plugin label, or ';' separated list of labels> "
+      "control=<comma separated list of input control values, ';' between plugins> "
       "input_ladspaport_map=<comma separated list of input LADSPA port names> "
-      "output_ladspaport_map=<comma separated list of output LADSPA port names> "));
+      "output_ladspaport_map=<comma separated list of output LADSPA port names> "
+      "tail_msec=<how long the plugin keeps producing sound after its input turned silent> "));
 
 #define MEMBLOCKQ_MAXLENGTH (16*1024*1024)
+#define DEFAULT_TAIL_MSEC 1000
 
 /* PLEASE NOTICE: The PortAudio ports and the LADSPA ports are two different concepts.
 They are not related and where possible the names of the LADSPA port variables contains "ladspa" to avoid confusion */
 
+/* One plugin of the chain. It is instantiated once for every group of
+ * max_ladspaport_count channels. */
+struct plugin {
+    lt_dlhandle dl;
+    const LADSPA_Descriptor *descriptor;
+    LADSPA_Handle handle[PA_CHANNELS_MAX];
+    unsigned long max_ladspaport_count, input_count, output_count, n_instances;
+    LADSPA_Data *control;
+    long unsigned n_control;
+    pa_bool_t *use_default;
+};
+
 struct userdata {
     pa_module *module;
 
     pa_sink *sink;
     pa_sink_input *sink_input;
 
-    const LADSPA_Descriptor *descriptor;
-    LADSPA_Handle handle[PA_CHANNELS_MAX];
-    unsigned long max_ladspaport_count, input_count, output_count, channels;
-    LADSPA_Data **input, **output;
+    /* The plugins are run one after the other, all of them on the same
+     * deinterleaved buffers */
+    struct plugin *plugins;
+    unsigned n_plugins;
+
+    unsigned long channels;
+    LADSPA_Data *buffer[PA_CHANNELS_MAX];
     size_t block_size;
-    LADSPA_Data *control;
-    long unsigned n_control;
+
+    /* Plugins that cannot process in place write their output here and
+     * it is copied back after each run */
+    LADSPA_Data **scratch;
+    unsigned long n_scratch;
 
     /* This is a dummy buffer. Every port must be connected, but we don't care
     about control out ports. We connect them all to this single buffer. */
@@ -92,9 +113,11 @@ struct userdata {
 
     pa_memblockq *memblockq;
 
-    pa_bool_t *use_default;
     pa_sample_spec ss;
 
+    /* After this much silent input the plugin is not run anymore */
+    size_t silence_tail, silence_bytes;
+
 #ifdef HAVE_DBUS
     pa_dbus_protocol *dbus_protocol;
     char *dbus_path;
@@ -116,6 +139,7 @@ static const char* const valid_modargs[] = {
     "control",
     "input_ladspaport_map",
     "output_ladspaport_map",
+    "tail_msec",
     NULL
 };
 
@@ -124,7 +148,7 @@ enum {
    LADSPA_SINK_MESSAGE_UPDATE_PARAMETERS = PA_SINK_MESSAGE_MAX
 };
 
-static int write_control_parameters(struct userdata *u, double *control_values, pa_bool_t *use_default);
+static int write_control_parameters(struct userdata *u, struct plugin *p, double *control_values, pa_bool_t *use_default);
 static void connect_control_ports(struct userdata *u);
 
 #ifdef HAVE_DBUS
@@ -144,6 +168,7 @@ static void get_algorithm_parameters(DBusConnection *conn, DBusMessage *msg, voi
     DBusMessage *reply = NULL;
     DBusMessageIter msg_iter, struct_iter;
     unsigned long i;
+    struct plugin *p;
     double *control;
     dbus_bool_t *use_default;
 
@@ -156,17 +181,20 @@ static void get_algorithm_parameters(DBusConnection *conn, DBusMessage *msg, voi
 
     dbus_message_iter_open_container(&msg_iter, DBUS_TYPE_STRUCT, NULL, &struct_iter);
 
+    /* Only the first plugin of a chain is exposed */
+    p = &u->plugins[0];
+
     /* copying because of the D-Bus type mapping */
-    control = pa_xnew(double, u->n_control);
-    use_default = pa_xnew(dbus_bool_t, u->n_control);
+    control = pa_xnew(double, p->n_control);
+    use_default = pa_xnew(dbus_bool_t, p->n_control);
 
-    for (i = 0; i < u->n_control; i++) {
-        control[i] = (double) u->control[i];
-        use_default[i] = u->use_default[i];
+    for (i = 0; i < p->n_control; i++) {
+        control[i] = (double) p->control[i];
+        use_default[i] = p->use_default[i];
     }
 
-    pa_dbus_append_basic_array(&struct_iter, DBUS_TYPE_DOUBLE, control, u->n_control);
-    pa_dbus_append_basic_array(&struct_iter, DBUS_TYPE_BOOLEAN, use_default, u->n_control);
+    pa_dbus_append_basic_array(&struct_iter, DBUS_TYPE_DOUBLE, control, p->n_control);
+    pa_dbus_append_basic_array(&struct_iter, DBUS_TYPE_BOOLEAN, use_default, p->n_control);
 
     dbus_message_iter_close_container(&msg_iter, &struct_iter);
 
@@ -186,11 +214,14 @@ static void set_algorithm_parameters(DBusConnection *conn, DBusMessage *msg, DBu
     dbus_bool_t *read_defaults = NULL;
     pa_bool_t *use_defaults = NULL;
     unsigned long i;
+    struct plugin *p;
 
     pa_assert(conn);
     pa_assert(msg);
     pa_assert_se(u = _u);
 
+    p = &u->plugins[0];
+
     /* The property we are expecting has signature (adab), meaning that it's a
        struct of two arrays, the first containing doubles and the second containing
        booleans. The first array has the algorithm configuration values and the
@@ -211,16 +242,16 @@ static void set_algorithm_parameters(DBusConnection *conn, DBusMessage *msg, DBu
     n_dbus_control = n_control; /* handle the unsignedness */
     n_dbus_use_default = n_use_default;
 
-    if (n_dbus_control != u->n_control || n_dbus_use_default != u->n_control) {
-        pa_dbus_send_error(conn, msg, DBUS_ERROR_INVALID_ARGS, "Wrong number of array values (expected %lu)", u->n_control);
+    if (n_dbus_control != p->n_control || n_dbus_use_default != p->n_control) {
+        pa_dbus_send_error(conn, msg, DBUS_ERROR_INVALID_ARGS, "Wrong number of array values (expected %lu)", p->n_control);
         return;
     }
 
     use_defaults = pa_xnew(pa_bool_t, n_control);
-    for (i = 0; i < u->n_control; i++)
+    for (i = 0; i < p->n_control; i++)
         use_defaults[i] = read_defaults[i];
 
-    if (write_control_parameters(u, read_values, use_defaults) < 0) {
+    if (write_control_parameters(u, p, read_values, use_defaults) < 0) {
         pa_log_warn("Failed writing control parameters");
         goto error;
     }
@@ -254,11 +285,14 @@ static void ladspa_get_all(DBusConnection *conn, DBusMessage *msg, void *_u) {
     double *control;
     dbus_bool_t *use_default;
     long unsigned i;
+    struct plugin *p;
 
     pa_assert(conn);
     pa_assert(msg);
     pa_assert_se(u = _u);
 
+    p = &u->plugins[0];
+
     pa_assert_se((reply = dbus_message_new_method_return(msg)));
 
     /* Currently, on this interface, only a single property is returned. */
@@ -271,16 +305,16 @@ static void ladspa_get_all(DBusConnection *conn, DBusMessage *msg, void *_u) {
     pa_assert_se(dbus_message_iter_open_container(&dict_entry_iter, DBUS_TYPE_VARIANT, "(adab)", &variant_iter));
     pa_assert_se(dbus_message_iter_open_container(&variant_iter, DBUS_TYPE_STRUCT, NULL, &struct_iter));
 
-    control = pa_xnew(double, u->n_control);
-    use_default = pa_xnew(dbus_bool_t, u->n_control);
+    control = pa_xnew(double, p->n_control);
+    use_default = pa_xnew(dbus_bool_t, p->n_control);
 
-    for (i = 0; i < u->n_control; i++) {
-        control[i] = (double) u->control[i];
-        use_default[i] = u->use_default[i];
+    for (i = 0; i < p->n_control; i++) {
+        control[i] = (double) p->control[i];
+        use_default[i] = p->use_default[i];
     }
 
-    pa_dbus_append_basic_array(&struct_iter, DBUS_TYPE_DOUBLE, control, u->n_control);
-    pa_dbus_append_basic_array(&struct_iter, DBUS_TYPE_BOOLEAN, use_default, u->n_control);
+    pa_dbus_append_basic_array(&struct_iter, DBUS_TYPE_DOUBLE, control, p->n_control);
+    pa_dbus_append_basic_array(&struct_iter, DBUS_TYPE_BOOLEAN, use_default, p->n_control);
 
     pa_assert_se(dbus_message_iter_close_container(&variant_iter, &struct_iter));
     pa_assert_se(dbus_message_iter_close_container(&dict_entry_iter, &variant_iter));
@@ -437,16 +471,15 @@ static void sink_set_mute_cb(pa_sink *s) {
     pa_sink_input_set_mute(u->sink_input, s->muted, s->save_muted);
 }
 
-/* Called from I/O thread context */
-static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk) {
+/* Called from I/O thread context. If into is TRUE the output is written
+ * to the memory described by chunk, otherwise a new block is allocated. */
+static void process_chunk(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk, pa_bool_t into) {
     struct userdata *u;
     float *src, *dst;
     size_t fs;
-    unsigned n, h, c;
+    unsigned n, h, c, k;
     pa_memchunk tchunk;
 
-    pa_sink_input_assert_ref(i);
-    pa_assert(chunk);
     pa_assert_se(u = i->userdata);
 
     /* Hmm, process any rewind request that might be queued up */
@@ -468,28 +501,74 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk
 
     pa_assert(n > 0);
 
-    chunk->index = 0;
+    if (!pa_memblock_is_silence(tchunk.memblock))
+        u->silence_bytes = 0;
+    else if (u->silence_bytes >= u->silence_tail) {
+        pa_memblock_unref(tchunk.memblock);
+
+        if (into) {
+            chunk->length = n*fs;
+            pa_silence_memchunk(chunk, &i->sample_spec);
+        } else
+            pa_silence_memchunk_get(&i->sink->core->silence_cache, i->sink->core->mempool, chunk, &i->sample_spec, n*fs);
+
+        pa_memblockq_drop(u->memblockq, chunk->length);
+        return;
+    } else
+        u->silence_bytes += n*fs;
+
+    if (!into) {
+        chunk->index = 0;
+        chunk->memblock = pa_memblock_new(i->sink->core->mempool, n*fs);
+    }
     chunk->length = n*fs;
-    chunk->memblock = pa_memblock_new(i->sink->core->mempool, chunk->length);
 
     pa_memblockq_drop(u->memblockq, chunk->length);
 
     src = pa_memblock_acquire_chunk(&tchunk);
-    dst = pa_memblock_acquire(chunk->memblock);
-
-    for (h = 0; h < (u->channels / u->max_ladspaport_count); h++) {
-        for (c = 0; c < u->input_count; c++)
-            pa_sample_clamp(PA_SAMPLE_FLOAT32NE, u->input[c], sizeof(float), src+ h*u->max_ladspaport_count + c, u->channels*sizeof(float), n);
-        u->descriptor->run(u->handle[h], n);
-        for (c = 0; c < u->output_count; c++)
-            pa_sample_clamp(PA_SAMPLE_FLOAT32NE, dst + h*u->max_ladspaport_count + c, u->channels*sizeof(float), u->output[c], sizeof(float), n);
+    dst = pa_memblock_acquire_chunk(chunk);
+
+    /* Deinterleave once, run the whole chain on the channel buffers and
+     * interleave once */
+    for (c = 0; c < u->channels; c++)
+        pa_sample_clamp(PA_SAMPLE_FLOAT32NE, u->buffer[c], sizeof(float), src + c, u->channels*sizeof(float), n);
+
+    for (k = 0; k < u->n_plugins; k++) {
+        struct plugin *p = &u->plugins[k];
+
+        for (h = 0; h < p->n_instances; h++) {
+            p->descriptor->run(p->handle[h], n);
+
+            if (LADSPA_IS_INPLACE_BROKEN(p->descriptor->Properties))
+                for (c = 0; c < p->output_count; c++)
+                    memcpy(u->buffer[h*p->max_ladspaport_count + c], u->scratch[c], n*sizeof(float));
+        }
     }
 
+    for (c = 0; c < u->channels; c++)
+        pa_sample_clamp(PA_SAMPLE_FLOAT32NE, dst + c, u->channels*sizeof(float), u->buffer[c], sizeof(float), n);
+
     pa_memblock_release(tchunk.memblock);
     pa_memblock_release(chunk->memblock);
 
     pa_memblock_unref(tchunk.memblock);
+}
 
+/* Called from I/O thread context */
+static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk) {
+    pa_sink_input_assert_ref(i);
+    pa_assert(chunk);
+
+    process_chunk(i, nbytes, chunk, FALSE);
+    return 0;
+}
+
+/* Called from I/O thread context */
+static int sink_input_pop_into_cb(pa_sink_input *i, pa_memchunk *target) {
+    pa_sink_input_assert_ref(i);
+    pa_assert(target);
+
+    process_chunk(i, target->length, target, TRUE);
     return 0;
 }
 
@@ -509,19 +588,25 @@ static void sink_input_process_rewind_cb(pa_sink_input *i, size_t nbytes) {
         u->sink->thread_info.rewind_nbytes = 0;
 
         if (amount > 0) {
-            unsigned c;
+            unsigned k, c;
 
             pa_memblockq_seek(u->memblockq, - (int64_t) amount, PA_SEEK_RELATIVE, TRUE);
 
             pa_log_debug("Resetting plugin");
 
-            /* Reset the plugin */
-            if (u->descriptor->deactivate)
-                for (c = 0; c < (u->channels / u->max_ladspaport_count); c++)
-                    u->descriptor->deactivate(u->handle[c]);
-            if (u->descriptor->activate)
-                for (c = 0; c < (u->channels / u->max_ladspaport_count); c++)
-                    u->descriptor->activate(u->handle[c]);
+            u->silence_bytes = 0;
+
+            /* Reset the plugins */
+            for (k = 0; k < u->n_plugins; k++) {
+                struct plugin *p = &u->plugins[k];
+
+                if (p->descriptor->deactivate)
+                    for (c = 0; c < p->n_instances; c++)
+                        p->descriptor->deactivate(p->handle[c]);
+                if (p->descriptor->activate)
+                    for (c = 0; c < p->n_instances; c++)
+                        p->descriptor->activate(p->handle[c]);
+            }
         }
     }
 
@@ -678,23 +763,23 @@ static void sink_input_mute_changed_cb(pa_sink_input *i) {
     pa_sink_mute_changed(u->sink, i->muted);
 }
 
-static int parse_control_parameters(struct userdata *u, const char *cdata, double *read_values, pa_bool_t *use_default) {
+static int parse_control_parameters(struct plugin *pl, const char *cdata, double *read_values, pa_bool_t *use_default) {
     unsigned long p = 0;
     const char *state = NULL;
     char *k;
 
     pa_assert(read_values);
     pa_assert(use_default);
-    pa_assert(u);
+    pa_assert(pl);
 
-    pa_log_debug("Trying to read %lu control values", u->n_control);
+    pa_log_debug("Trying to read %lu control values", pl->n_control);
 
-    if (!cdata && u->n_control > 0)
+    if (!cdata && pl->n_control > 0)
         return -1;
 
     pa_log_debug("cdata: '%s'", cdata);
 
-    while ((k = pa_split(cdata, ",", &state)) && p < u->n_control) {
+    while ((k = pa_split(cdata, ",", &state)) && p < pl->n_control) {
         double f;
 
         if (*k == 0) {
@@ -721,19 +806,19 @@ static int parse_control_parameters(struct userdata *u, const char *cdata, doubl
     /* The previous loop doesn't take the last control value into account
        if it is left empty, so we do it here. */
     if (*cdata == 0 || cdata[strlen(cdata) - 1] == ',') {
-        if (p < u->n_control)
+        if (p < pl->n_control)
             use_default[p] = TRUE;
         p++;
     }
 
-    if (p > u->n_control || k) {
-        pa_log("Too many control values passed, %lu expected.", u->n_control);
+    if (p > pl->n_control || k) {
+        pa_log("Too many control values passed, %lu expected.", pl->n_control);
         pa_xfree(k);
         goto fail;
     }
 
-    if (p < u->n_control) {
-        pa_log("Not enough control values passed, %lu expected, %lu passed.", u->n_control, p);
+    if (p < pl->n_control) {
+        pa_log("Not enough control values passed, %lu expected, %lu passed.", pl->n_control, p);
         goto fail;
     }
 
@@ -743,35 +828,45 @@ fail:
     return -1;
 }
 
-static void connect_control_ports(struct userdata *u) {
+static void connect_plugin_control_ports(struct userdata *u, struct plugin *pl) {
     unsigned long p = 0, h = 0, c;
     const LADSPA_Descriptor *d;
 
     pa_assert(u);
-    pa_assert_se(d = u->descriptor);
+    pa_assert(pl);
+    pa_assert_se(d = pl->descriptor);
 
     for (p = 0; p < d->PortCount; p++) {
         if (!LADSPA_IS_PORT_CONTROL(d->PortDescriptors[p]))
             continue;
 
         if (LADSPA_IS_PORT_OUTPUT(d->PortDescriptors[p])) {
-            for (c = 0; c < (u->channels / u->max_ladspaport_count); c++)
-                d->connect_port(u->handle[c], p, &u->control_out);
+            for (c = 0; c < pl->n_instances; c++)
+                d->connect_port(pl->handle[c], p, &u->control_out);
             continue;
         }
 
         /* input control port */
 
-        pa_log_debug("Binding %f to port %s", u->control[h], d->PortNames[p]);
+        pa_log_debug("Binding %f to port %s", pl->control[h], d->PortNames[p]);
 
-        for (c = 0; c < (u->channels / u->max_ladspaport_count); c++)
-            d->connect_port(u->handle[c], p, &u->control[h]);
+        for (c = 0; c < pl->n_instances; c++)
+            d->connect_port(pl->handle[c], p, &pl->control[h]);
 
         h++;
     }
 }
 
-static int validate_control_parameters(struct userdata *u, double *control_values, pa_bool_t *use_default) {
+static void connect_control_ports(struct userdata *u) {
+    unsigned k;
+
+    pa_assert(u);
+
+    for (k = 0; k < u->n_plugins; k++)
+        connect_plugin_control_ports(u, &u->plugins[k]);
+}
+
+static int validate_control_parameters(struct userdata *u, struct plugin *pl, double *control_values, pa_bool_t *use_default) {
     unsigned long p = 0, h = 0;
     const LADSPA_Descriptor *d;
     pa_sample_spec ss;
@@ -779,7 +874,8 @@ static int validate_control_parameters(struct userdata *u, double *control_value
     pa_assert(control_values);
     pa_assert(use_default);
     pa_assert(u);
-    pa_assert_se(d = u->descriptor);
+    pa_assert(pl);
+    pa_assert_se(d = pl->descriptor);
 
     ss = u->ss;
 
@@ -834,7 +930,7 @@ static int validate_control_parameters(struct userdata *u, double *control_value
     return 0;
 }
 
-static int write_control_parameters(struct userdata *u, double *control_values, pa_bool_t *use_default) {
+static int write_control_parameters(struct userdata *u, struct plugin *pl, double *control_values, pa_bool_t *use_default) {
     unsigned long p = 0, h = 0, c;
     const LADSPA_Descriptor *d;
     pa_sample_spec ss;
@@ -842,11 +938,12 @@ static int write_control_parameters(struct userdata *u, double *control_values,
     pa_assert(control_values);
     pa_assert(use_default);
     pa_assert(u);
-    pa_assert_se(d = u->descriptor);
+    pa_assert(pl);
+    pa_assert_se(d = pl->descriptor);
 
     ss = u->ss;
 
-    if (validate_control_parameters(u, control_values, use_default) < 0)
+    if (validate_control_parameters(u, pl, control_values, use_default) < 0)
         return -1;
 
     /* p iterates over all ports, h is the control port iterator */
@@ -858,8 +955,8 @@ static int write_control_parameters(struct userdata *u, double *control_values,
             continue;
 
         if (LADSPA_IS_PORT_OUTPUT(d->PortDescriptors[p])) {
-            for (c = 0; c < (u->channels / u->max_ladspaport_count); c++)
-                d->connect_port(u->handle[c], p, &u->control_out);
+            for (c = 0; c < pl->n_instances; c++)
+                d->connect_port(pl->handle[c], p, &u->control_out);
             continue;
         }
 
@@ -878,48 +975,48 @@ static int write_control_parameters(struct userdata *u, double *control_values,
             switch (hint & LADSPA_HINT_DEFAULT_MASK) {
 
             case LADSPA_HINT_DEFAULT_MINIMUM:
-                u->control[h] = lower;
+                pl->control[h] = lower;
                 break;
 
             case LADSPA_HINT_DEFAULT_MAXIMUM:
-                u->control[h] = upper;
+                pl->control[h] = upper;
                 break;
 
             case LADSPA_HINT_DEFAULT_LOW:
                 if (LADSPA_IS_HINT_LOGARITHMIC(hint))
-                    u->control[h] = (LADSPA_Data) exp(log(lower) * 0.75 + log(upper) * 0.25);
+                    pl->control[h] = (LADSPA_Data) exp(log(lower) * 0.75 + log(upper) * 0.25);
                 else
-                    u->control[h] = (LADSPA_Data) (lower * 0.75 + upper * 0.25);
+                    pl->control[h] = (LADSPA_Data) (lower * 0.75 + upper * 0.25);
                 break;
 
             case LADSPA_HINT_DEFAULT_MIDDLE:
                 if (LADSPA_IS_HINT_LOGARITHMIC(hint))
-                    u->control[h] = (LADSPA_Data) exp(log(lower) * 0.5 + log(upper) * 0.5);
+                    pl->control[h] = (LADSPA_Data) exp(log(lower) * 0.5 + log(upper) * 0.5);
                 else
-                    u->control[h] = (LADSPA_Data) (lower * 0.5 + upper * 0.5);
+                    pl->control[h] = (LADSPA_Data) (lower * 0.5 + upper * 0.5);
                 break;
 
             case LADSPA_HINT_DEFAULT_HIGH:
                 if (LADSPA_IS_HINT_LOGARITHMIC(hint))
-                    u->control[h] = (LADSPA_Data) exp(log(lower) * 0.25 + log(upper) * 0.75);
+                    pl->control[h] = (LADSPA_Data) exp(log(lower) * 0.25 + log(upper) * 0.75);
                 else
-                    u->control[h] = (LADSPA_Data) (lower * 0.25 + upper * 0.75);
+                    pl->control[h] = (LADSPA_Data) (lower * 0.25 + upper * 0.75);
                 break;
 
             case LADSPA_HINT_DEFAULT_0:
-                u->control[h] = 0;
+                pl->control[h] = 0;
                 break;
 
             case LADSPA_HINT_DEFAULT_1:
-                u->control[h] = 1;
+                pl->control[h] = 1;
                 break;
 
             case LADSPA_HINT_DEFAULT_100:
-                u->control[h] = 100;
+                pl->control[h] = 100;
                 break;
 
             case LADSPA_HINT_DEFAULT_440:
-                u->control[h] = 440;
+                pl->control[h] = 440;
                 break;
 
             default:
@@ -928,10 +1025,10 @@ static int write_control_parameters(struct userdata *u, double *control_values,
         }
         else {
             if (LADSPA_IS_HINT_INTEGER(hint)) {
-                u->control[h] = roundf(control_values[h]);
+                pl->control[h] = roundf(control_values[h]);
             }
             else {
-                u->control[h] = control_values[h];
+                pl->control[h] = control_values[h];
             }
         }
 
@@ -939,109 +1036,67 @@ static int write_control_parameters(struct userdata *u, double *control_values,
     }
 
     /* set the use_default array to the user data */
-    memcpy(u->use_default, use_default, u->n_control * sizeof(u->use_default[0]));
+    memcpy(pl->use_default, use_default, pl->n_control * sizeof(pl->use_default[0]));
 
     return 0;
 }
 
-int pa__init(pa_module*m) {
-    struct userdata *u;
-    pa_sample_spec ss;
-    pa_channel_map map;
-    pa_modargs *ma;
-    char *t;
-    pa_sink *master;
-    pa_sink_input_new_data sink_input_data;
-    pa_sink_new_data sink_data;
-    const char *plugin, *label, *input_ladspaport_map, *output_ladspaport_map;
-    LADSPA_Descriptor_Function descriptor_func;
-    unsigned long input_ladspaport[PA_CHANNELS_MAX], output_ladspaport[PA_CHANNELS_MAX];
-    const char *e, *cdata;
-    const LADSPA_Descriptor *d;
-    unsigned long p, h, j, n_control, c;
-
-    pa_assert(m);
-
-    pa_assert_cc(sizeof(LADSPA_Data) == sizeof(float));
-
-    if (!(ma = pa_modargs_new(m->argument, valid_modargs))) {
-        pa_log("Failed to parse module arguments.");
-        goto fail;
-    }
-
-    if (!(master = pa_namereg_get(m->core, pa_modargs_get_value(ma, "master", NULL), PA_NAMEREG_SINK))) {
-        pa_log("Master sink not found");
-        goto fail;
-    }
-
-    ss = master->sample_spec;
-    ss.format = PA_SAMPLE_FLOAT32;
-    map = master->channel_map;
-    if (pa_modargs_get_sample_spec_and_channel_map(ma, &ss, &map, PA_CHANNEL_MAP_DEFAULT) < 0) {
-        pa_log("Invalid sample format specification or channel map");
-        goto fail;
-    }
+/* Returns the n-th of the ';' separated entries of s. Entries may be
+ * empty, missing ones are returned as NULL. */
+static char *get_chain_entry(const char *s, unsigned n) {
+    if (!s)
+        return NULL;
 
-    if (!(plugin = pa_modargs_get_value(ma, "plugin", NULL))) {
-        pa_log("Missing LADSPA plugin name");
-        goto fail;
+    for (; n > 0; n--) {
+        if (!(s = strchr(s, ';')))
+            return NULL;
+        s++;
     }
 
-    if (!(label = pa_modargs_get_value(ma, "label", NULL))) {
-        pa_log("Missing LADSPA plugin label");
-        goto fail;
-    }
-
-    if (!(input_ladspaport_map = pa_modargs_get_value(ma, "input_ladspaport_map", NULL)))
-        pa_log_debug("Using default input ladspa port mapping");
+    return pa_xstrndup(s, strcspn(s, ";"));
+}
 
-    if (!(output_ladspaport_map = pa_modargs_get_value(ma, "output_ladspaport_map", NULL)))
-        pa_log_debug("Using default output ladspa port mapping");
+static int load_plugin(struct userdata *u, struct plugin *pl, const char *plugin, const char *label,
+                       const char *input_ladspaport_map, const char *output_ladspaport_map, const char *cdata) {
+    LADSPA_Descriptor_Function descriptor_func;
+    unsigned long input_ladspaport[PA_CHANNELS_MAX], output_ladspaport[PA_CHANNELS_MAX];
+    const char *e;
+    const LADSPA_Descriptor *d;
+    unsigned long p, h, j, n_control, c;
+    LADSPA_Data **output;
 
-    cdata = pa_modargs_get_value(ma, "control", NULL);
+    pa_assert(u);
+    pa_assert(pl);
+    pa_assert(plugin);
+    pa_assert(label);
 
-    u = pa_xnew0(struct userdata, 1);
-    u->module = m;
-    m->userdata = u;
-    u->memblockq = pa_memblockq_new("module-ladspa-sink memblockq", 0, MEMBLOCKQ_MAXLENGTH, 0, &ss, 1, 1, 0, NULL);
-    u->max_ladspaport_count = 1; /*to avoid division by zero etc. in pa__done when failing before this value has been set*/
-    u->channels = 0;
-    u->input = NULL;
-    u->output = NULL;
-    u->ss = ss;
+    pl->max_ladspaport_count = 1; /*to avoid division by zero etc. in pa__done when failing before this value has been set*/
 
     if (!(e = getenv("LADSPA_PATH")))
         e = LADSPA_PATH;
 
-    /* FIXME: This is not exactly thread safe */
-    t = pa_xstrdup(lt_dlgetsearchpath());
-    lt_dlsetsearchpath(e);
-    m->dl = lt_dlopenext(plugin);
-    lt_dlsetsearchpath(t);
-    pa_xfree(t);
-
-    if (!m->dl) {
+    if (!(pl->dl = pa_dlopenext_in_path(plugin, e))) {
         pa_log("Failed to load LADSPA plugin: %s", lt_dlerror());
-        goto fail;
+        return -1;
     }
 
-    if (!(descriptor_func = (LADSPA_Descriptor_Function) pa_load_sym(m->dl, NULL, "ladspa_descriptor"))) {
+    if (!(descriptor_func = (LADSPA_Descriptor_Function) pa_load_sym(pl->dl, NULL, "ladspa_descriptor"))) {
         pa_log("LADSPA module lacks ladspa_descriptor() symbol.");
-        goto fail;
+        return -1;
     }
 
     for (j = 0;; j++) {
 
         if (!(d = descriptor_func(j))) {
             pa_log("Failed to find plugin label '%s' in plugin '%s'.", label, plugin);
-            goto fail;
+            return -1;
         }
 
         if (pa_streq(d->Label, label))
             break;
     }
 
-    u->descriptor = d;
+    pl->descriptor = d;
 
     pa_log_debug("Module: %s", plugin);
     pa_log_debug("Label: %s", d->Label);
@@ -1051,7 +1106,6 @@ int pa__init(pa_module*m) {
     pa_log_debug("Copyright: %s", d->Copyright);
 
     n_control = 0;
-    u->channels = ss.channels;
 
     /*
     * Enumerate ladspa ports
@@ -1061,12 +1115,12 @@ int pa__init(pa_module*m) {
         if (LADSPA_IS_PORT_AUDIO(d->PortDescriptors[p])) {
             if (LADSPA_IS_PORT_INPUT(d->PortDescriptors[p])) {
                 pa_log_debug("Port %lu is input: %s", p, d->PortNames[p]);
-                input_ladspaport[u->input_count] = p;
-                u->input_count++;
+                input_ladspaport[pl->input_count] = p;
+                pl->input_count++;
             } else if (LADSPA_IS_PORT_OUTPUT(d->PortDescriptors[p])) {
                 pa_log_debug("Port %lu is output: %s", p, d->PortNames[p]);
-                output_ladspaport[u->output_count] = p;
-                u->output_count++;
+                output_ladspaport[pl->output_count] = p;
+                pl->output_count++;
             }
         } else if (LADSPA_IS_PORT_CONTROL(d->PortDescriptors[p]) && LADSPA_IS_PORT_INPUT(d->PortDescriptors[p])) {
             pa_log_debug("Port %lu is control: %s", p, d->PortNames[p]);
@@ -1076,18 +1130,20 @@ int pa__init(pa_module*m) {
         /* XXX: Has anyone ever seen an in-place plugin with non-equal number of input and output ports? */
         /* Could be if the plugin is for up-mixing stereo to 5.1 channels */
         /* Or if the plugin is down-mixing 5.1 to two channel stereo or binaural encoded signal */
-        if (u->input_count > u->max_ladspaport_count)
-            u->max_ladspaport_count = u->input_count;
+        if (pl->input_count > pl->max_ladspaport_count)
+            pl->max_ladspaport_count = pl->input_count;
         else
-            u->max_ladspaport_count = u->output_count;
+            pl->max_ladspaport_count = pl->output_count;
     }
 
-    if (u->channels % u->max_ladspaport_count) {
+    if (u->channels % pl->max_ladspaport_count) {
         pa_log("Cannot handle non-integral number of plugins required for given number of channels");
-        goto fail;
+        return -1;
     }
 
-    pa_log_debug("Will run %lu plugin instances", u->channels / u->max_ladspaport_count);
+    pl->n_instances = u->channels / pl->max_ladspaport_count;
+
+    pa_log_debug("Will run %lu plugin instances", pl->n_instances);
 
     /* Parse data for input ladspa port map */
     if (input_ladspaport_map) {
@@ -1095,10 +1151,10 @@ int pa__init(pa_module*m) {
         char *pname;
         c = 0;
         while ((pname = pa_split(input_ladspaport_map, ",", &state))) {
-            if (c == u->input_count) {
+            if (c == pl->input_count) {
                 pa_log("Too many ports in input ladspa port map");
                 pa_xfree(pname);
-                goto fail;
+                return -1;
             }
 
             for (p = 0; p < d->PortCount; p++) {
@@ -1108,7 +1164,7 @@ int pa__init(pa_module*m) {
                     } else {
                         pa_log("Port %s is not an audio input ladspa port", pname);
                         pa_xfree(pname);
-                        goto fail;
+                        return -1;
                     }
                 }
             }
@@ -1123,10 +1179,10 @@ int pa__init(pa_module*m) {
         char *pname;
         c = 0;
         while ((pname = pa_split(output_ladspaport_map, ",", &state))) {
-            if (c == u->output_count) {
+            if (c == pl->output_count) {
                 pa_log("Too many ports in output ladspa port map");
                 pa_xfree(pname);
-                goto fail;
+                return -1;
             }
             for (p = 0; p < d->PortCount; p++) {
                 if (pa_streq(d->PortNames[p], pname)) {
@@ -1135,7 +1191,7 @@ int pa__init(pa_module*m) {
                     } else {
                         pa_log("Port %s is not an output ladspa port", pname);
                         pa_xfree(pname);
-                        goto fail;
+                        return -1;
                     }
                 }
             }
@@ -1144,66 +1200,183 @@ int pa__init(pa_module*m) {
         }
     }
 
-    u->block_size = pa_frame_align(pa_mempool_block_size_max(m->core->mempool), &ss);
-
-    /* Create buffers */
+    /* Run in place on the channel buffers unless the plugin cannot do that */
     if (LADSPA_IS_INPLACE_BROKEN(d->Properties)) {
-        u->input = (LADSPA_Data**) pa_xnew(LADSPA_Data*, (unsigned) u->input_count);
-        for (c = 0; c < u->input_count; c++)
-            u->input[c] = (LADSPA_Data*) pa_xnew(uint8_t, (unsigned) u->block_size);
-        u->output = (LADSPA_Data**) pa_xnew(LADSPA_Data*, (unsigned) u->output_count);
-        for (c = 0; c < u->output_count; c++)
-            u->output[c] = (LADSPA_Data*) pa_xnew(uint8_t, (unsigned) u->block_size);
-    } else {
-        u->input = (LADSPA_Data**) pa_xnew(LADSPA_Data*, (unsigned) u->max_ladspaport_count);
-        for (c = 0; c < u->max_ladspaport_count; c++)
-            u->input[c] = (LADSPA_Data*) pa_xnew(uint8_t, (unsigned) u->block_size);
-        u->output = u->input;
-    }
+        if (pl->output_count > u->n_scratch) {
+            u->scratch = pa_xrenew(LADSPA_Data*, u->scratch, pl->output_count);
+            for (c = u->n_scratch; c < pl->output_count; c++)
+                u->scratch[c] = (LADSPA_Data*) pa_xnew(uint8_t, (unsigned) (u->block_size / u->channels));
+            u->n_scratch = pl->output_count;
+        }
+
+        output = u->scratch;
+    } else
+        output = NULL;
+
     /* Initialize plugin instances */
-    for (h = 0; h < (u->channels / u->max_ladspaport_count); h++) {
-        if (!(u->handle[h] = d->instantiate(d, ss.rate))) {
+    for (h = 0; h < pl->n_instances; h++) {
+        LADSPA_Data **buffer = u->buffer + h * pl->max_ladspaport_count;
+
+        if (!(pl->handle[h] = d->instantiate(d, u->ss.rate))) {
             pa_log("Failed to instantiate plugin %s with label %s", plugin, d->Label);
-            goto fail;
+            return -1;
         }
 
-        for (c = 0; c < u->input_count; c++)
-            d->connect_port(u->handle[h], input_ladspaport[c], u->input[c]);
-        for (c = 0; c < u->output_count; c++)
-            d->connect_port(u->handle[h], output_ladspaport[c], u->output[c]);
+        for (c = 0; c < pl->input_count; c++)
+            d->connect_port(pl->handle[h], input_ladspaport[c], buffer[c]);
+        for (c = 0; c < pl->output_count; c++)
+            d->connect_port(pl->handle[h], output_ladspaport[c], output ? output[c] : buffer[c]);
     }
 
-    u->n_control = n_control;
+    pl->n_control = n_control;
 
-    if (u->n_control > 0) {
+    if (pl->n_control > 0) {
         double *control_values;
         pa_bool_t *use_default;
 
         /* temporary storage for parser */
-        control_values = pa_xnew(double, (unsigned) u->n_control);
-        use_default = pa_xnew(pa_bool_t, (unsigned) u->n_control);
+        control_values = pa_xnew(double, (unsigned) pl->n_control);
+        use_default = pa_xnew(pa_bool_t, (unsigned) pl->n_control);
 
         /* real storage */
-        u->control = pa_xnew(LADSPA_Data, (unsigned) u->n_control);
-        u->use_default = pa_xnew(pa_bool_t, (unsigned) u->n_control);
+        pl->control = pa_xnew(LADSPA_Data, (unsigned) pl->n_control);
+        pl->use_default = pa_xnew(pa_bool_t, (unsigned) pl->n_control);
 
-        if ((parse_control_parameters(u, cdata, control_values, use_default) < 0) ||
-            (write_control_parameters(u, control_values, use_default) < 0)) {
+        if ((parse_control_parameters(pl, cdata, control_values, use_default) < 0) ||
+            (write_control_parameters(u, pl, control_values, use_default) < 0)) {
             pa_xfree(control_values);
             pa_xfree(use_default);
 
             pa_log("Failed to parse, validate or set control parameters");
 
-            goto fail;
+            return -1;
         }
-        connect_control_ports(u);
+        connect_plugin_control_ports(u, pl);
         pa_xfree(control_values);
         pa_xfree(use_default);
     }
 
     if (d->activate)
-        for (c = 0; c < (u->channels / u->max_ladspaport_count); c++)
-            d->activate(u->handle[c]);
+        for (c = 0; c < pl->n_instances; c++)
+            d->activate(pl->handle[c]);
+
+    return 0;
+}
+
+int pa__init(pa_module*m) {
+    struct userdata *u;
+    pa_sample_spec ss;
+    pa_channel_map map;
+    pa_modargs *ma;
+    pa_sink *master;
+    pa_sink_input_new_data sink_input_data;
+    pa_sink_new_data sink_data;
+    const char *plugin, *label, *input_ladspaport_map, *output_ladspaport_map;
+    const char *cdata, *e;
+    const LADSPA_Descriptor *d;
+    char *first_plugin = NULL;
+    unsigned n, c;
+    uint32_t tail_msec;
+
+    pa_assert(m);
+
+    pa_assert_cc(sizeof(LADSPA_Data) == sizeof(float));
+
+    if (!(ma = pa_modargs_new(m->argument, valid_modargs))) {
+        pa_log("Failed to parse module arguments.");
+        goto fail;
+    }
+
+    if (!(master = pa_namereg_get(m->core, pa_modargs_get_value(ma, "master", NULL), PA_NAMEREG_SINK))) {
+        pa_log("Master sink not found");
+        goto fail;
+    }
+
+    ss = master->sample_spec;
+    ss.format = PA_SAMPLE_FLOAT32;
+    map = master->channel_map;
+    if (pa_modargs_get_sample_spec_and_channel_map(ma, &ss, &map, PA_CHANNEL_MAP_DEFAULT) < 0) {
+        pa_log("Invalid sample format specification or channel map");
+        goto fail;
+    }
+
+    if (!(plugin = pa_modargs_get_value(ma, "plugin", NULL))) {
+        pa_log("Missing LADSPA plugin name");
+        goto fail;
+    }
+
+    if (!(label = pa_modargs_get_value(ma, "label", NULL))) {
+        pa_log("Missing LADSPA plugin label");
+        goto fail;
+    }
+
+    if (!(input_ladspaport_map = pa_modargs_get_value(ma, "input_ladspaport_map", NULL)))
+        pa_log_debug("Using default input ladspa port mapping");
+
+    if (!(output_ladspaport_map = pa_modargs_get_value(ma, "output_ladspaport_map", NULL)))
+        pa_log_debug("Using default output ladspa port mapping");
+
+    cdata = pa_modargs_get_value(ma, "control", NULL);
+
+    tail_msec = DEFAULT_TAIL_MSEC;
+    if (pa_modargs_get_value_u32(ma, "tail_msec", &tail_msec) < 0) {
+        pa_log("Invalid tail_msec value");
+        goto fail;
+    }
+
+    u = pa_xnew0(struct userdata, 1);
+    u->module = m;
+    m->userdata = u;
+    u->memblockq = pa_memblockq_new("module-ladspa-sink memblockq", 0, MEMBLOCKQ_MAXLENGTH, 0, &ss, 1, 1, 0, NULL);
+    u->ss = ss;
+    u->channels = ss.channels;
+    u->silence_tail = pa_usec_to_bytes(tail_msec * PA_USEC_PER_MSEC, &ss);
+
+    /* All plugins of the chain work on the same deinterleaved buffers */
+    u->block_size = pa_frame_align(pa_mempool_block_size_max(m->core->mempool), &ss);
+    for (c = 0; c < u->channels; c++)
+        u->buffer[c] = (LADSPA_Data*) pa_xnew(uint8_t, (unsigned) (u->block_size / u->channels));
+
+    for (n = 1, e = plugin; (e = strchr(e, ';')); e++)
+        n++;
+
+    u->plugins = pa_xnew0(struct plugin, n);
+
+    for (; u->n_plugins < n; u->n_plugins++) {
+        char *p, *l, *k;
+        int r;
+
+        p = get_chain_entry(plugin, u->n_plugins);
+        l = get_chain_entry(label, u->n_plugins);
+
+        /* With a single plugin the control string is passed on as it is,
+         * so that an empty one keeps meaning "all defaults" */
+        k = n > 1 ? get_chain_entry(cdata, u->n_plugins) : pa_xstrdup(cdata);
+
+        if (!l) {
+            pa_log("Missing LADSPA plugin label for plugin %s", p);
+            r = -1;
+        } else
+            r = load_plugin(u, &u->plugins[u->n_plugins], p, l,
+                            u->n_plugins == 0 ? input_ladspaport_map : NULL,
+                            u->n_plugins == 0 ? output_ladspaport_map : NULL,
+                            k);
+
+        if (u->n_plugins == 0)
+            first_plugin = pa_xstrdup(p);
+
+        pa_xfree(p);
+        pa_xfree(l);
+        pa_xfree(k);
+
+        if (r < 0) {
+            /* Let pa__done() clean up whatever was loaded */
+            u->n_plugins++;
+            goto fail;
+        }
+    }
+
+    d = u->plugins[0].descriptor;
 
     /* Create sink */
     pa_sink_new_data_init(&sink_data);
@@ -1215,7 +1388,7 @@ int pa__init(pa_module*m) {
     pa_sink_new_data_set_channel_map(&sink_data, &map);
     pa_proplist_sets(sink_data.proplist, PA_PROP_DEVICE_MASTER_DEVICE, master->name);
     pa_proplist_sets(sink_data.proplist, PA_PROP_DEVICE_CLASS, "filter");
-    pa_proplist_sets(sink_data.proplist, "device.ladspa.module", plugin);
+    pa_proplist_sets(sink_data.proplist, "device.ladspa.module", first_plugin);
     pa_proplist_sets(sink_data.proplist, "device.ladspa.label", d->Label);
     pa_proplist_sets(sink_data.proplist, "device.ladspa.name", d->Name);
     pa_proplist_sets(sink_data.proplist, "device.ladspa.maker", d->Maker);
@@ -1271,6 +1444,7 @@ int pa__init(pa_module*m) {
         goto fail;
 
     u->sink_input->pop = sink_input_pop_cb;
+    u->sink_input->pop_into = sink_input_pop_into_cb;
     u->sink_input->process_rewind = sink_input_process_rewind_cb;
     u->sink_input->update_max_rewind = sink_input_update_max_rewind_cb;
     u->sink_input->update_max_request = sink_input_update_max_request_cb;
@@ -1294,6 +1468,7 @@ int pa__init(pa_module*m) {
 #endif
 
     pa_modargs_free(ma);
+    pa_xfree(first_plugin);
 
     return 0;
 
@@ -1301,6 +1476,8 @@ fail:
     if (ma)
         pa_modargs_free(ma);
 
+    pa_xfree(first_plugin);
+
     pa__done(m);
 
     return -1;
@@ -1317,7 +1494,7 @@ int pa__get_n_used(pa_module *m) {
 
 void pa__done(pa_module*m) {
     struct userdata *u;
-    unsigned c;
+    unsigned k, c;
 
     pa_assert(m);
 
@@ -1343,37 +1520,35 @@ void pa__done(pa_module*m) {
     if (u->sink)
         pa_sink_unref(u->sink);
 
-    for (c = 0; c < (u->channels / u->max_ladspaport_count); c++) {
-        if (u->handle[c]) {
-            if (u->descriptor->deactivate)
-                u->descriptor->deactivate(u->handle[c]);
-            u->descriptor->cleanup(u->handle[c]);
-        }
-    }
+    for (k = 0; k < u->n_plugins; k++) {
+        struct plugin *pl = &u->plugins[k];
 
-    if (u->output == u->input) {
-        if (u->input != NULL) {
-            for (c = 0; c < u->max_ladspaport_count; c++)
-                pa_xfree(u->input[c]);
-            pa_xfree(u->input);
-        }
-    } else {
-        if (u->input != NULL) {
-            for (c = 0; c < u->input_count; c++)
-                pa_xfree(u->input[c]);
-            pa_xfree(u->input);
-        }
-        if (u->output != NULL) {
-            for (c = 0; c < u->output_count; c++)
-                pa_xfree(u->output[c]);
-            pa_xfree(u->output);
+        for (c = 0; c < pl->n_instances; c++) {
+            if (pl->handle[c]) {
+                if (pl->descriptor->deactivate)
+                    pl->descriptor->deactivate(pl->handle[c]);
+                pl->descriptor->cleanup(pl->handle[c]);
+            }
         }
+
+        pa_xfree(pl->control);
+        pa_xfree(pl->use_default);
+
+        if (pl->dl)
+            lt_dlclose(pl->dl);
     }
 
+    pa_xfree(u->plugins);
+
+    for (c = 0; c < u->channels; c++)
+        pa_xfree(u->buffer[c]);
+
+    for (c = 0; c < u->n_scratch; c++)
+        pa_xfree(u->scratch[c]);
+    pa_xfree(u->scratch);
+
     if (u->memblockq)
         pa_memblockq_free(u->memblockq);
 
-    pa_xfree(u->control);
-    pa_xfree(u->use_default);
     pa_xfree(u);
 }
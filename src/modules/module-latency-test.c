@@ -0,0 +1,753 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <math.h>
+
+#include <pulse/xmalloc.h>
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
+
+#include <pulsecore/sink-input.h>
+#include <pulsecore/source-output.h>
+#include <pulsecore/module.h>
+#include <pulsecore/modargs.h>
+#include <pulsecore/namereg.h>
+#include <pulsecore/log.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/atomic.h>
+#include <pulsecore/thread-mq.h>
+
+#ifdef HAVE_AVX2
+#include "latency-test-avx2.h"
+#endif
+
+#include "module-latency-test-symdef.h"
+
+PA_MODULE_AUTHOR("PulseAudio contributors");
+PA_MODULE_DESCRIPTION("Measures the latency of a sink through a loopback source");
+PA_MODULE_VERSION(PACKAGE_VERSION);
+PA_MODULE_LOAD_ONCE(FALSE);
+PA_MODULE_USAGE(
+        "sink=<sink to test> "
+        "source=<source that hears the sink, defaults to its monitor> "
+        "interval=<seconds between measurements, 0 to measure once and unload> "
+        "max_latency_msec=<longest delay to look for>");
+
+/* Silence played before the marker, so that the sink is running when
+ * the marker is rendered */
+#define LEAD_MSEC 200
+
+/* The marker is a linear chirp with short fades */
+#define MARKER_MSEC 50
+#define MARKER_FADE_MSEC 5
+#define MARKER_AMPLITUDE 0.5
+
+#define DEFAULT_MAX_LATENCY_MSEC 1000
+
+/* Extra recording to cover the chunk the marker starts in */
+#define RECORD_SLACK_MSEC 100
+
+/* How long a measurement may take beyond the recording itself */
+#define TIMEOUT_USEC (3*PA_USEC_PER_SEC)
+
+/* Below this normalized correlation the marker counts as not found */
+#define MIN_CORRELATION 0.3
+
+#define PROP_STATUS "latency_test.status"
+#define PROP_SOURCE "latency_test.source"
+#define PROP_MEASURED "latency_test.measured_usec"
+#define PROP_REPORTED "latency_test.reported_usec"
+#define PROP_SINK_LATENCY "latency_test.sink_latency_usec"
+#define PROP_SOURCE_LATENCY "latency_test.source_latency_usec"
+#define PROP_DISCREPANCY "latency_test.discrepancy_usec"
+#define PROP_CORRELATION "latency_test.correlation"
+
+typedef void (*correlate_func_t)(float *dst, const float *x, size_t n_lags, const float *marker, size_t n_marker);
+
+struct userdata {
+    pa_core *core;
+    pa_module *module;
+
+    char *sink_name, *source_name;
+    pa_usec_t interval;
+    pa_usec_t max_latency;
+
+    correlate_func_t correlate;
+
+    /* The next measurement, or the timeout of the running one */
+    pa_time_event *time_event;
+
+    pa_sink_input *sink_input;
+    pa_source_output *source_output;
+    pa_bool_t monitor;
+
+    /* The played signal, output thread only */
+    pa_memchunk play;
+    size_t play_index;
+    size_t marker_index;
+    pa_bool_t marker_stamped;
+    pa_usec_t marker_time;
+    pa_usec_t sink_latency;
+
+    /* Set by the output thread once the marker was rendered */
+    pa_atomic_t marker_played;
+
+    /* The recording, input thread only until record_done is set */
+    float *record;
+    size_t record_length, record_index;
+    pa_bool_t record_done;
+    int64_t anchor_base, anchor_sum;
+    pa_usec_t source_latency_sum;
+    unsigned n_pushes;
+
+    /* The marker at the rate of the source */
+    float *marker;
+    size_t n_marker;
+
+    struct {
+        pa_bool_t marker_stamped;
+        pa_usec_t marker_time;
+        pa_usec_t sink_latency;
+    } snapshot;
+};
+
+static const char* const valid_modargs[] = {
+    "sink",
+    "source",
+    "interval",
+    "max_latency_msec",
+    NULL,
+};
+
+enum {
+    SINK_INPUT_MESSAGE_SNAPSHOT = PA_SINK_INPUT_MESSAGE_MAX
+};
+
+enum {
+    SOURCE_OUTPUT_MESSAGE_RECORD_DONE = PA_SOURCE_OUTPUT_MESSAGE_MAX
+};
+
+static void correlate_c(float *dst, const float *x, size_t n_lags, const float *marker, size_t n_marker) {
+    size_t l, j;
+
+    for (l = 0; l < n_lags; l++) {
+        float sum = 0.0f;
+
+        for (j = 0; j < n_marker; j++)
+            sum += x[l + j] * marker[j];
+
+        dst[l] = sum;
+    }
+}
+
+/* The chirp is defined by time, so it can be generated for the sink
+ * and for the source even if they run at different rates */
+static void generate_marker(float *m, size_t n, uint32_t rate) {
+    double f0 = 200.0, f1 = PA_MIN(8000.0, rate * 0.4);
+    double T = (double) n / rate;
+    size_t fade = (size_t) rate * MARKER_FADE_MSEC / 1000;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        double t = (double) i / rate;
+        double v = MARKER_AMPLITUDE * sin(2 * M_PI * (f0 * t + (f1 - f0) * t * t / (2 * T)));
+
+        if (i < fade)
+            v *= 0.5 - 0.5 * cos(M_PI * i / fade);
+        else if (n - 1 - i < fade)
+            v *= 0.5 - 0.5 * cos(M_PI * (n - 1 - i) / fade);
+
+        m[i] = (float) v;
+    }
+}
+
+static void time_callback(pa_mainloop_api *a, pa_time_event *e, const struct timeval *t, void *userdata);
+
+/* Called from main context */
+static void schedule(struct userdata *u, pa_usec_t usec) {
+    pa_assert(u);
+
+    if (u->time_event)
+        pa_core_rttime_restart(u->core, u->time_event, pa_rtclock_now() + usec);
+    else
+        u->time_event = pa_core_rttime_new(u->core, pa_rtclock_now() + usec, time_callback, u);
+}
+
+/* Called from main context */
+static void teardown(struct userdata *u) {
+    pa_assert(u);
+    pa_assert_ctl_context();
+
+    /* Messages still queued for the streams must not find us */
+    if (u->source_output) {
+        pa_source_output_unlink(u->source_output);
+        u->source_output->userdata = NULL;
+        pa_source_output_unref(u->source_output);
+        u->source_output = NULL;
+    }
+
+    if (u->sink_input) {
+        pa_sink_input_unlink(u->sink_input);
+        u->sink_input->userdata = NULL;
+        pa_sink_input_unref(u->sink_input);
+        u->sink_input = NULL;
+    }
+
+    if (u->play.memblock) {
+        pa_memblock_unref(u->play.memblock);
+        pa_memchunk_reset(&u->play);
+    }
+
+    pa_xfree(u->record);
+    u->record = NULL;
+
+    pa_xfree(u->marker);
+    u->marker = NULL;
+}
+
+/* Called from main context */
+static void publish(pa_sink *s, pa_proplist *p, const char *status) {
+    pa_proplist_sets(p, PROP_STATUS, status);
+    pa_sink_update_proplist(s, PA_UPDATE_REPLACE, p);
+}
+
+/* Called from main context */
+static void measurement_done(struct userdata *u) {
+    pa_assert(u);
+
+    teardown(u);
+
+    if (u->interval > 0)
+        schedule(u, u->interval);
+    else
+        pa_module_unload_request(u->module, TRUE);
+}
+
+/* Called from main context */
+static void measurement_failed(struct userdata *u, const char *status) {
+    pa_proplist *p;
+
+    pa_assert(u);
+
+    pa_log_info("Latency test of sink %s failed: %s", u->sink_input->sink->name, status);
+
+    p = pa_proplist_new();
+    publish(u->sink_input->sink, p, status);
+    pa_proplist_free(p);
+
+    measurement_done(u);
+}
+
+/* Locates the marker in the recording and compares its delay with the
+ * reported latencies. The recording starts with the first chunk pushed
+ * after the marker was rendered. The newest sample of each chunk left
+ * the source when the chunk was pushed, less the source latency, so
+ * every push gives an estimate of when the first sample of the
+ * recording arrived. These estimates are averaged to even out the
+ * scheduling jitter.
+ *
+ * The monitor source gets the data when it is rendered, not when it is
+ * played, so the sink latency is not part of the expected delay then,
+ * and only the software path is checked. A physical loopback source
+ * checks the device latencies as well.
+ *
+ * Called from main context */
+static void evaluate(struct userdata *u) {
+    pa_sink *s;
+    size_t n_lags, l, best = 0;
+    float *corr;
+    double marker_energy = 0, energy = 0, best_norm = 0, frac = 0;
+    double anchor, source_latency, arrival, measured, reported, discrepancy;
+    uint32_t rate;
+    pa_proplist *p;
+
+    pa_assert(u);
+    pa_assert_ctl_context();
+
+    pa_asyncmsgq_send(u->sink_input->sink->asyncmsgq, PA_MSGOBJECT(u->sink_input), SINK_INPUT_MESSAGE_SNAPSHOT, NULL, 0, NULL);
+
+    if (!u->snapshot.marker_stamped || u->n_pushes <= 0) {
+        measurement_failed(u, "no-data");
+        return;
+    }
+
+    s = u->sink_input->sink;
+    rate = u->source_output->sample_spec.rate;
+    n_lags = u->record_length - u->n_marker + 1;
+    corr = pa_xnew(float, n_lags);
+
+    u->correlate(corr, u->record, n_lags, u->marker, u->n_marker);
+
+    for (l = 0; l < u->n_marker; l++) {
+        marker_energy += (double) u->marker[l] * u->marker[l];
+        energy += (double) u->record[l] * u->record[l];
+    }
+
+    for (l = 0; l < n_lags; l++) {
+        double norm;
+
+        if (l > 0)
+            energy += (double) u->record[l + u->n_marker - 1] * u->record[l + u->n_marker - 1] -
+                (double) u->record[l - 1] * u->record[l - 1];
+
+        if (energy <= 0)
+            continue;
+
+        /* The path may invert the signal */
+        norm = fabs(corr[l]) / sqrt(energy * marker_energy);
+
+        if (norm > best_norm) {
+            best_norm = norm;
+            best = l;
+        }
+    }
+
+    /* Parabolic interpolation between the neighbouring lags */
+    if (best > 0 && best + 1 < n_lags) {
+        double a = fabs(corr[best - 1]), b = fabs(corr[best]), c = fabs(corr[best + 1]);
+
+        if (a - 2 * b + c != 0)
+            frac = PA_CLAMP(0.5 * (a - c) / (a - 2 * b + c), -0.5, 0.5);
+    }
+
+    pa_xfree(corr);
+
+    p = pa_proplist_new();
+    pa_proplist_sets(p, PROP_SOURCE, u->source_output->source->name);
+    pa_proplist_setf(p, PROP_CORRELATION, "%0.2f", best_norm);
+
+    if (best_norm < MIN_CORRELATION) {
+        pa_log_info("Latency test of sink %s failed: the marker was not found, best correlation %0.2f",
+                    s->name, best_norm);
+        publish(s, p, "no-marker");
+        pa_proplist_free(p);
+        measurement_done(u);
+        return;
+    }
+
+    anchor = (double) u->anchor_base + (double) u->anchor_sum / u->n_pushes;
+    source_latency = (double) u->source_latency_sum / u->n_pushes;
+
+    arrival = anchor + (best + frac) * PA_USEC_PER_SEC / rate;
+    measured = arrival - (double) u->snapshot.marker_time;
+    reported = (u->monitor ? 0 : (double) u->snapshot.sink_latency) + source_latency;
+    discrepancy = measured - reported;
+
+    pa_log_info("Latency test of sink %s through source %s: measured %0.2f ms, reported %0.2f ms (sink %0.2f ms%s, source %0.2f ms), off by %+0.2f ms",
+                s->name, u->source_output->source->name,
+                measured / PA_USEC_PER_MSEC, reported / PA_USEC_PER_MSEC,
+                (double) u->snapshot.sink_latency / PA_USEC_PER_MSEC, u->monitor ? " not included for the monitor" : "",
+                source_latency / PA_USEC_PER_MSEC, discrepancy / PA_USEC_PER_MSEC);
+
+    pa_proplist_setf(p, PROP_MEASURED, "%lli", (long long) llrint(measured));
+    pa_proplist_setf(p, PROP_REPORTED, "%lli", (long long) llrint(reported));
+    pa_proplist_setf(p, PROP_SINK_LATENCY, "%llu", (unsigned long long) u->snapshot.sink_latency);
+    pa_proplist_setf(p, PROP_SOURCE_LATENCY, "%lli", (long long) llrint(source_latency));
+    pa_proplist_setf(p, PROP_DISCREPANCY, "%lli", (long long) llrint(discrepancy));
+    publish(s, p, "ok");
+    pa_proplist_free(p);
+
+    measurement_done(u);
+}
+
+/* Called from output thread context */
+static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk) {
+    struct userdata *u;
+
+    pa_sink_input_assert_ref(i);
+    pa_sink_input_assert_io_context(i);
+    pa_assert_se(u = i->userdata);
+    pa_assert(chunk);
+
+    /* Silence from here on */
+    if (u->play_index >= u->play.length)
+        return -1;
+
+    *chunk = u->play;
+    pa_memblock_ref(chunk->memblock);
+
+    chunk->index += u->play_index;
+    chunk->length = PA_MIN(u->play.length - u->play_index, nbytes);
+
+    /* Whatever the sink renders now is played after its current
+     * latency */
+    if (!u->marker_stamped && u->marker_index >= u->play_index && u->marker_index < u->play_index + chunk->length) {
+        u->marker_time = pa_rtclock_now() + pa_bytes_to_usec(u->marker_index - u->play_index, &i->sample_spec);
+        u->sink_latency = pa_sink_get_latency_within_thread(i->sink);
+        u->marker_stamped = TRUE;
+
+        pa_atomic_store(&u->marker_played, 1);
+    }
+
+    u->play_index += chunk->length;
+
+    return 0;
+}
+
+/* Called from output thread context */
+static void sink_input_process_rewind_cb(pa_sink_input *i, size_t nbytes) {
+    struct userdata *u;
+
+    pa_sink_input_assert_ref(i);
+    pa_sink_input_assert_io_context(i);
+    pa_assert_se(u = i->userdata);
+
+    u->play_index = PA_CLIP_SUB(PA_MIN(u->play_index, u->play.length), nbytes);
+
+    /* The marker will be rendered again */
+    if (u->play_index <= u->marker_index)
+        u->marker_stamped = FALSE;
+}
+
+/* Called from output thread context */
+static int sink_input_process_msg_cb(pa_msgobject *obj, int code, void *data, int64_t offset, pa_memchunk *chunk) {
+    struct userdata *u = PA_SINK_INPUT(obj)->userdata;
+
+    switch (code) {
+
+        case SINK_INPUT_MESSAGE_SNAPSHOT:
+
+            u->snapshot.marker_stamped = u->marker_stamped;
+            u->snapshot.marker_time = u->marker_time;
+            u->snapshot.sink_latency = u->sink_latency;
+
+            return 0;
+    }
+
+    return pa_sink_input_process_msg(obj, code, data, offset, chunk);
+}
+
+/* Called from main context */
+static void sink_input_kill_cb(pa_sink_input *i) {
+    struct userdata *u;
+
+    pa_sink_input_assert_ref(i);
+    pa_assert_ctl_context();
+    pa_assert_se(u = i->userdata);
+
+    measurement_failed(u, "aborted");
+}
+
+/* Called from input thread context */
+static void source_output_push_cb(pa_source_output *o, const pa_memchunk *chunk) {
+    struct userdata *u;
+    pa_usec_t now;
+    size_t n;
+    void *p;
+
+    pa_source_output_assert_ref(o);
+    pa_source_output_assert_io_context(o);
+    pa_assert_se(u = o->userdata);
+
+    if (u->record_done || !pa_atomic_load(&u->marker_played))
+        return;
+
+    now = pa_rtclock_now();
+
+    n = PA_MIN(chunk->length / sizeof(float), u->record_length - u->record_index);
+
+    p = pa_memblock_acquire(chunk->memblock);
+    memcpy(u->record + u->record_index, (uint8_t*) p + chunk->index, n * sizeof(float));
+    pa_memblock_release(chunk->memblock);
+
+    u->record_index += n;
+
+    /* When the first sample of the recording would have arrived, going
+     * by this push, relative to the first push to stay in range */
+    if (u->n_pushes <= 0)
+        u->anchor_base = (int64_t) now - (int64_t) (u->record_index * PA_USEC_PER_SEC / o->sample_spec.rate);
+
+    u->anchor_sum += (int64_t) now - (int64_t) (u->record_index * PA_USEC_PER_SEC / o->sample_spec.rate) - u->anchor_base;
+    u->source_latency_sum += pa_source_get_latency_within_thread(o->source);
+    u->n_pushes++;
+
+    if (u->record_index >= u->record_length) {
+        u->record_done = TRUE;
+        pa_asyncmsgq_post(pa_thread_mq_get()->outq, PA_MSGOBJECT(o), SOURCE_OUTPUT_MESSAGE_RECORD_DONE, NULL, 0, NULL, NULL);
+    }
+}
+
+/* Called from input thread context */
+static void source_output_process_rewind_cb(pa_source_output *o, size_t nbytes) {
+    struct userdata *u;
+
+    pa_source_output_assert_ref(o);
+    pa_source_output_assert_io_context(o);
+    pa_assert_se(u = o->userdata);
+
+    /* The monitor rewinds with the sink, the data will be pushed again */
+    if (!u->record_done)
+        u->record_index = PA_CLIP_SUB(u->record_index, nbytes / sizeof(float));
+}
+
+/* Called from input thread context, except RECORD_DONE */
+static int source_output_process_msg_cb(pa_msgobject *obj, int code, void *data, int64_t offset, pa_memchunk *chunk) {
+    struct userdata *u = PA_SOURCE_OUTPUT(obj)->userdata;
+
+    switch (code) {
+
+        case SOURCE_OUTPUT_MESSAGE_RECORD_DONE:
+
+            /* This message is sent from the IO thread to the main
+             * thread, and might arrive after we gave up */
+            pa_assert_ctl_context();
+
+            if (u && u->source_output == PA_SOURCE_OUTPUT(obj))
+                evaluate(u);
+
+            return 0;
+    }
+
+    return pa_source_output_process_msg(obj, code, data, offset, chunk);
+}
+
+/* Called from main context */
+static void source_output_kill_cb(pa_source_output *o) {
+    struct userdata *u;
+
+    pa_source_output_assert_ref(o);
+    pa_assert_ctl_context();
+    pa_assert_se(u = o->userdata);
+
+    measurement_failed(u, "aborted");
+}
+
+/* Called from main context */
+static void start_measurement(struct userdata *u) {
+    pa_sink *sink;
+    pa_source *source;
+    pa_sink_input_new_data sink_input_data;
+    pa_source_output_new_data source_output_data;
+    pa_sample_spec ss;
+    pa_channel_map map;
+    size_t n_play;
+    float *p;
+
+    pa_assert(u);
+    pa_assert(!u->sink_input);
+
+    if (!(sink = pa_namereg_get(u->core, u->sink_name, PA_NAMEREG_SINK))) {
+        pa_log("No such sink %s.", pa_strnull(u->sink_name));
+        goto fail;
+    }
+
+    if (u->source_name) {
+        if (!(source = pa_namereg_get(u->core, u->source_name, PA_NAMEREG_SOURCE))) {
+            pa_log("No such source %s.", u->source_name);
+            goto fail;
+        }
+    } else
+        source = sink->monitor_source;
+
+    u->monitor = source->monitor_of == sink;
+
+    pa_channel_map_init_mono(&map);
+    ss.format = PA_SAMPLE_FLOAT32NE;
+    ss.channels = 1;
+
+    /* Play at the rate of the sink */
+    ss.rate = sink->sample_spec.rate;
+    n_play = (size_t) ss.rate * (LEAD_MSEC + MARKER_MSEC) / 1000;
+
+    u->play.memblock = pa_memblock_new(u->core->mempool, n_play * sizeof(float));
+    u->play.index = 0;
+    u->play.length = n_play * sizeof(float);
+    u->play_index = 0;
+    u->marker_index = (size_t) ss.rate * LEAD_MSEC / 1000 * sizeof(float);
+    u->marker_stamped = FALSE;
+    pa_atomic_store(&u->marker_played, 0);
+
+    p = pa_memblock_acquire(u->play.memblock);
+    memset(p, 0, u->marker_index);
+    generate_marker(p + u->marker_index / sizeof(float), n_play - u->marker_index / sizeof(float), ss.rate);
+    pa_memblock_release(u->play.memblock);
+
+    pa_sink_input_new_data_init(&sink_input_data);
+    sink_input_data.driver = __FILE__;
+    sink_input_data.module = u->module;
+    pa_sink_input_new_data_set_sink(&sink_input_data, sink, FALSE);
+    pa_proplist_setf(sink_input_data.proplist, PA_PROP_MEDIA_NAME, "Latency test of %s",
+                     pa_strnull(pa_proplist_gets(sink->proplist, PA_PROP_DEVICE_DESCRIPTION)));
+    pa_proplist_sets(sink_input_data.proplist, PA_PROP_MEDIA_ROLE, "test");
+    pa_sink_input_new_data_set_sample_spec(&sink_input_data, &ss);
+    pa_sink_input_new_data_set_channel_map(&sink_input_data, &map);
+    sink_input_data.flags = PA_SINK_INPUT_DONT_MOVE;
+
+    pa_sink_input_new(&u->sink_input, u->core, &sink_input_data);
+    pa_sink_input_new_data_done(&sink_input_data);
+
+    if (!u->sink_input)
+        goto fail;
+
+    u->sink_input->parent.process_msg = sink_input_process_msg_cb;
+    u->sink_input->pop = sink_input_pop_cb;
+    u->sink_input->process_rewind = sink_input_process_rewind_cb;
+    u->sink_input->kill = sink_input_kill_cb;
+    u->sink_input->userdata = u;
+
+    /* Record at the rate of the source */
+    ss.rate = source->sample_spec.rate;
+
+    u->n_marker = (size_t) ss.rate * MARKER_MSEC / 1000;
+    u->marker = pa_xnew(float, u->n_marker);
+    generate_marker(u->marker, u->n_marker, ss.rate);
+
+    u->record_length = (size_t) ss.rate * (u->max_latency / PA_USEC_PER_MSEC + MARKER_MSEC + RECORD_SLACK_MSEC) / 1000;
+    u->record = pa_xnew0(float, u->record_length);
+    u->record_index = 0;
+    u->record_done = FALSE;
+    u->anchor_base = u->anchor_sum = 0;
+    u->source_latency_sum = 0;
+    u->n_pushes = 0;
+
+    pa_source_output_new_data_init(&source_output_data);
+    source_output_data.driver = __FILE__;
+    source_output_data.module = u->module;
+    pa_source_output_new_data_set_source(&source_output_data, source, FALSE);
+    pa_proplist_setf(source_output_data.proplist, PA_PROP_MEDIA_NAME, "Latency test of %s",
+                     pa_strnull(pa_proplist_gets(sink->proplist, PA_PROP_DEVICE_DESCRIPTION)));
+    pa_proplist_sets(source_output_data.proplist, PA_PROP_MEDIA_ROLE, "test");
+    pa_source_output_new_data_set_sample_spec(&source_output_data, &ss);
+    pa_source_output_new_data_set_channel_map(&source_output_data, &map);
+    source_output_data.flags = PA_SOURCE_OUTPUT_DONT_MOVE;
+
+    pa_source_output_new(&u->source_output, u->core, &source_output_data);
+    pa_source_output_new_data_done(&source_output_data);
+
+    if (!u->source_output)
+        goto fail;
+
+    u->source_output->parent.process_msg = source_output_process_msg_cb;
+    u->source_output->push = source_output_push_cb;
+    u->source_output->process_rewind = source_output_process_rewind_cb;
+    u->source_output->kill = source_output_kill_cb;
+    u->source_output->userdata = u;
+
+    pa_source_output_put(u->source_output);
+    pa_sink_input_put(u->sink_input);
+
+    pa_log_debug("Testing the latency of sink %s through source %s.", sink->name, source->name);
+
+    schedule(u, (pa_usec_t) (LEAD_MSEC + MARKER_MSEC) * PA_USEC_PER_MSEC + u->max_latency + TIMEOUT_USEC);
+    return;
+
+fail:
+    measurement_done(u);
+}
+
+/* Called from main context */
+static void time_callback(pa_mainloop_api *a, pa_time_event *e, const struct timeval *t, void *userdata) {
+    struct userdata *u = userdata;
+
+    pa_assert(u);
+    pa_assert(a);
+    pa_assert(u->time_event == e);
+
+    u->core->mainloop->time_restart(u->time_event, NULL);
+
+    if (u->sink_input)
+        measurement_failed(u, "timeout");
+    else
+        start_measurement(u);
+}
+
+int pa__init(pa_module *m) {
+    pa_modargs *ma = NULL;
+    struct userdata *u;
+    uint32_t interval_sec = 0, max_latency_msec = DEFAULT_MAX_LATENCY_MSEC;
+
+    pa_assert(m);
+
+    if (!(ma = pa_modargs_new(m->argument, valid_modargs))) {
+        pa_log("Failed to parse module arguments");
+        goto fail;
+    }
+
+    if (pa_modargs_get_value_u32(ma, "interval", &interval_sec) < 0) {
+        pa_log("Failed to parse interval value");
+        goto fail;
+    }
+
+    if (pa_modargs_get_value_u32(ma, "max_latency_msec", &max_latency_msec) < 0 || max_latency_msec < 1 || max_latency_msec > 10000) {
+        pa_log("Invalid max_latency_msec specification");
+        goto fail;
+    }
+
+    m->userdata = u = pa_xnew0(struct userdata, 1);
+    u->core = m->core;
+    u->module = m;
+    u->sink_name = pa_xstrdup(pa_modargs_get_value(ma, "sink", NULL));
+    u->source_name = pa_xstrdup(pa_modargs_get_value(ma, "source", NULL));
+    u->interval = (pa_usec_t) interval_sec * PA_USEC_PER_SEC;
+    u->max_latency = (pa_usec_t) max_latency_msec * PA_USEC_PER_MSEC;
+
+    u->correlate = correlate_c;
+#ifdef HAVE_AVX2
+    if (m->core->cpu_info.cpu_type == PA_CPU_X86 && (m->core->cpu_info.flags.x86 & PA_CPU_X86_AVX2))
+        u->correlate = pa_latency_test_correlate_avx2;
+#endif
+
+    if (!pa_namereg_get(m->core, u->sink_name, PA_NAMEREG_SINK)) {
+        pa_log("No such sink.");
+        goto fail;
+    }
+
+    if (u->source_name && !pa_namereg_get(m->core, u->source_name, PA_NAMEREG_SOURCE)) {
+        pa_log("No such source.");
+        goto fail;
+    }
+
+    /* Not right away, the module might be loaded before its devices are
+     * running */
+    schedule(u, PA_USEC_PER_SEC);
+
+    pa_modargs_free(ma);
+    return 0;
+
+fail:
+    if (ma)
+        pa_modargs_free(ma);
+
+    pa__done(m);
+
+    return -1;
+}
+
+void pa__done(pa_module*m) {
+    struct userdata *u;
+
+    pa_assert(m);
+
+    if (!(u = m->userdata))
+        return;
+
+    teardown(u);
+
+    if (u->time_event)
+        u->core->mainloop->time_free(u->time_event);
+
+    pa_xfree(u->sink_name);
+    pa_xfree(u->source_name);
+    pa_xfree(u);
+}
@@ -25,6 +25,7 @@
 #endif
 
 #include <stdio.h>
+#include <math.h>
 
 #include <pulse/xmalloc.h>
 
@@ -47,7 +48,7 @@ PA_MODULE_LOAD_ONCE(FALSE);
 PA_MODULE_USAGE(
         "source=<source to connect to> "
         "sink=<sink to connect to> "
-        "adjust_time=<how often to readjust rates in s> "
+        "adjust_time=<time constant of the rate adjustment in s, 0 to disable> "
         "latency_msec=<latency in ms> "
         "format=<sample format> "
         "rate=<sample rate> "
@@ -65,6 +66,17 @@ PA_MODULE_USAGE(
 
 #define DEFAULT_ADJUST_TIME_USEC (10*PA_USEC_PER_SEC)
 
+/* How often the latency is measured and the rate updated */
+#define CONTROL_INTERVAL_USEC (100*PA_USEC_PER_MSEC)
+
+/* Time constant of the low-pass filter that smoothes the latency
+ * measurements, which jitter by up to a period of either device */
+#define LATENCY_FILTER_USEC (1*PA_USEC_PER_SEC)
+
+/* Never deviate further than 2‰ from the base rate, which can be
+ * considered inaudible */
+#define MAX_RATE_DEVIATION 0.002
+
 struct userdata {
     pa_core *core;
     pa_module *module;
@@ -80,6 +92,16 @@ struct userdata {
     pa_time_event *time_event;
     pa_usec_t adjust_time;
 
+    /* State of the rate controller, main context only */
+    struct {
+        pa_usec_t last;          /* time of the previous run */
+        pa_usec_t last_log;
+        double error;            /* filtered latency error in usec */
+        double integral;         /* accumulated relative rate correction */
+        double residual;         /* fractional Hz not applied yet */
+        pa_bool_t primed;
+    } control;
+
     int64_t recv_counter;
     int64_t send_counter;
 
@@ -170,10 +192,27 @@ static void teardown(struct userdata *u) {
 }
 
 /* Called from main context */
+static void reset_controller(struct userdata *u) {
+    pa_assert(u);
+
+    pa_memzero(&u->control, sizeof(u->control));
+}
+
+/* The end-to-end latency is kept at the requested value by a PI controller
+ * on the rate of the sink input. It runs every CONTROL_INTERVAL_USEC on a
+ * filtered latency error. The proportional part corrects an error within
+ * roughly adjust_time, the integral part learns the clock drift between the
+ * two devices; the gains are chosen for a critically damped loop. The
+ * resampler only takes whole Hz, so the remainder of the fractional rate is
+ * carried over to the next run, which makes the average rate exact.
+ *
+ * Called from main context */
 static void adjust_rates(struct userdata *u) {
-    size_t buffer, fs;
+    size_t buffer;
     uint32_t old_rate, base_rate, new_rate;
-    pa_usec_t buffer_latency;
+    pa_usec_t buffer_latency, now;
+    int64_t latency;
+    double dt, kp, ki, correction, rate;
 
     pa_assert(u);
     pa_assert_ctl_context();
@@ -188,46 +227,70 @@ static void adjust_rates(struct userdata *u) {
     if (u->latency_snapshot.recv_counter <= u->latency_snapshot.send_counter)
         buffer += (size_t) (u->latency_snapshot.send_counter - u->latency_snapshot.recv_counter);
     else
-        buffer += PA_CLIP_SUB(buffer, (size_t) (u->latency_snapshot.recv_counter - u->latency_snapshot.send_counter));
+        buffer = PA_CLIP_SUB(buffer, (size_t) (u->latency_snapshot.recv_counter - u->latency_snapshot.send_counter));
 
     buffer_latency = pa_bytes_to_usec(buffer, &u->sink_input->sample_spec);
+    latency = (int64_t) (u->latency_snapshot.sink_latency + buffer_latency + u->latency_snapshot.source_latency);
 
-    pa_log_debug("Loopback overall latency is %0.2f ms + %0.2f ms + %0.2f ms = %0.2f ms",
-                (double) u->latency_snapshot.sink_latency / PA_USEC_PER_MSEC,
-                (double) buffer_latency / PA_USEC_PER_MSEC,
-                (double) u->latency_snapshot.source_latency / PA_USEC_PER_MSEC,
-                ((double) u->latency_snapshot.sink_latency + buffer_latency + u->latency_snapshot.source_latency) / PA_USEC_PER_MSEC);
-
-    pa_log_debug("Should buffer %zu bytes, buffered at minimum %zu bytes",
-                u->latency_snapshot.max_request*2,
-                u->latency_snapshot.min_memblockq_length);
-
-    fs = pa_frame_size(&u->sink_input->sample_spec);
+    now = pa_rtclock_now();
     old_rate = u->sink_input->sample_spec.rate;
     base_rate = u->source_output->sample_spec.rate;
 
-    if (u->latency_snapshot.min_memblockq_length < u->latency_snapshot.max_request*2)
-        new_rate = base_rate - (((u->latency_snapshot.max_request*2 - u->latency_snapshot.min_memblockq_length) / fs) *PA_USEC_PER_SEC)/u->adjust_time;
-    else
-        new_rate = base_rate + (((u->latency_snapshot.min_memblockq_length - u->latency_snapshot.max_request*2) / fs) *PA_USEC_PER_SEC)/u->adjust_time;
-
-    if (new_rate < (uint32_t) (base_rate*0.8) || new_rate > (uint32_t) (base_rate*1.25)) {
-        pa_log_warn("Sample rates too different, not adjusting (%u vs. %u).", base_rate, new_rate);
-        new_rate = base_rate;
-    } else {
-        if (base_rate < new_rate + 20 && new_rate < base_rate + 20)
-          new_rate = base_rate;
-        /* Do the adjustment in small steps; 2‰ can be considered inaudible */
-        if (new_rate < (uint32_t) (old_rate*0.998) || new_rate > (uint32_t) (old_rate*1.002)) {
-            pa_log_info("New rate of %u Hz not within 2‰ of %u Hz, forcing smaller adjustment", new_rate, old_rate);
-            new_rate = PA_CLAMP(new_rate, (uint32_t) (old_rate*0.998), (uint32_t) (old_rate*1.002));
-        }
+    if (!u->control.primed) {
+        u->control.error = (double) (latency - (int64_t) u->latency);
+        u->control.residual = 0;
+        u->control.integral = (double) old_rate / base_rate - 1.0;
+        u->control.last = u->control.last_log = now;
+        u->control.primed = TRUE;
+        goto finish;
     }
 
-    pa_sink_input_set_rate(u->sink_input, new_rate);
-    pa_log_debug("[%s] Updated sampling rate to %lu Hz.", u->sink_input->sink->name, (unsigned long) new_rate);
+    dt = (double) (now - u->control.last);
+    u->control.last = now;
 
-    pa_core_rttime_restart(u->core, u->time_event, pa_rtclock_now() + u->adjust_time);
+    /* Smooth out the jitter of the device latencies */
+    u->control.error += (latency - (int64_t) u->latency - u->control.error) * dt / (dt + LATENCY_FILTER_USEC);
+
+    kp = 1.0 / u->adjust_time;
+    ki = kp * kp / 4;
+
+    /* If the queue ran dry the requested latency is too low for these
+     * devices, so don't drain it any faster */
+    if (u->latency_snapshot.min_memblockq_length > 0 || u->control.error < 0)
+        u->control.integral += ki * u->control.error * dt;
+
+    u->control.integral = PA_CLAMP(u->control.integral, -MAX_RATE_DEVIATION, MAX_RATE_DEVIATION);
+
+    correction = kp * u->control.error + u->control.integral;
+    correction = PA_CLAMP(correction, -MAX_RATE_DEVIATION, MAX_RATE_DEVIATION);
+
+    if (u->latency_snapshot.min_memblockq_length == 0)
+        correction = PA_MIN(correction, 0);
+
+    /* A higher sink input rate drains the queue faster */
+    rate = base_rate * (1.0 + correction) + u->control.residual;
+    new_rate = (uint32_t) lrint(rate);
+    u->control.residual = rate - new_rate;
+
+    if (new_rate != old_rate)
+        pa_sink_input_set_rate(u->sink_input, new_rate);
+
+    if (now - u->control.last_log >= u->adjust_time) {
+        u->control.last_log = now;
+
+        pa_log_debug("Loopback overall latency is %0.2f ms + %0.2f ms + %0.2f ms = %0.2f ms, %+0.2f ms off target after filtering",
+                     (double) u->latency_snapshot.sink_latency / PA_USEC_PER_MSEC,
+                     (double) buffer_latency / PA_USEC_PER_MSEC,
+                     (double) u->latency_snapshot.source_latency / PA_USEC_PER_MSEC,
+                     (double) latency / PA_USEC_PER_MSEC,
+                     u->control.error / PA_USEC_PER_MSEC);
+
+        pa_log_debug("[%s] Running at %0.2f Hz for %u Hz (drift estimate %+0.1f ppm).",
+                     u->sink_input->sink->name, base_rate * (1.0 + correction), base_rate, u->control.integral * 1e6);
+    }
+
+finish:
+    pa_core_rttime_restart(u->core, u->time_event, now + CONTROL_INTERVAL_USEC);
 }
 
 /* Called from main context */
@@ -247,7 +310,8 @@ static void enable_adjust_timer(struct userdata *u, bool enable) {
         if (u->time_event || u->adjust_time <= 0)
             return;
 
-        u->time_event = pa_core_rttime_new(u->module->core, pa_rtclock_now() + u->adjust_time, time_callback, u);
+        reset_controller(u);
+        u->time_event = pa_core_rttime_new(u->module->core, pa_rtclock_now() + CONTROL_INTERVAL_USEC, time_callback, u);
     } else {
         if (!u->time_event)
             return;
@@ -419,6 +483,9 @@ static void source_output_moving_cb(pa_source_output *o, pa_source *dest) {
 
     pa_sink_input_update_proplist(u->sink_input, PA_UPDATE_REPLACE, p);
     pa_proplist_free(p);
+
+    /* The drift towards the new source has to be learned again */
+    reset_controller(u);
 }
 
 /* Called from main thread */
@@ -684,6 +751,9 @@ static void sink_input_moving_cb(pa_sink_input *i, pa_sink *dest) {
 
     pa_source_output_update_proplist(u->source_output, PA_UPDATE_REPLACE, p);
     pa_proplist_free(p);
+
+    /* The drift towards the new sink has to be learned again */
+    reset_controller(u);
 }
 
 /* Called from main thread */
@@ -949,6 +1019,7 @@ int pa__init(pa_module *m) {
             0,                      /* maxrewind */
             &silence);              /* silence frame */
     pa_memblock_unref(silence.memblock);
+    pa_memblockq_set_ring(u->memblockq, TRUE);
 
     u->asyncmsgq = pa_asyncmsgq_new(0);
 
@@ -42,6 +42,9 @@
 #include <pulsecore/thread.h>
 #include <pulsecore/thread-mq.h>
 #include <pulsecore/rtpoll.h>
+#include <pulsecore/memarena.h>
+#include <pulsecore/render-pool.h>
+#include <pulsecore/io-executor.h>
 
 #include "module-null-sink-symdef.h"
 
@@ -55,7 +58,12 @@ PA_MODULE_USAGE(
         "format=<sample format> "
         "rate=<sample rate> "
         "channels=<number of channels> "
-        "channel_map=<channel map>");
+        "channel_map=<channel map> "
+        "render_threads=<number of extra threads to peek the inputs in parallel on> "
+        "cpu_affinity=<CPUs to run the IO thread on> "
+        "numa_node=<NUMA node to run the IO thread on> "
+        "shared_thread=<run on a shared IO thread instead of an own one?> "
+        "clock_domain=<align the wakeups with the other devices of this clock domain>");
 
 #define DEFAULT_SINK_NAME "null"
 #define BLOCK_USEC (PA_USEC_PER_SEC * 2)
@@ -68,6 +76,11 @@ struct userdata {
     pa_thread *thread;
     pa_thread_mq thread_mq;
     pa_rtpoll *rtpoll;
+    pa_io_executor *executor;
+    pa_io_executor_item *executor_item;
+    pa_render_pool *render_pool;
+    pa_memarena *arena;
+    char *cpu_affinity;
 
     pa_usec_t block_usec;
     pa_usec_t timestamp;
@@ -80,6 +93,11 @@ static const char* const valid_modargs[] = {
     "rate",
     "channels",
     "channel_map",
+    "render_threads",
+    "cpu_affinity",
+    "numa_node",
+    "shared_thread",
+    "clock_domain",
     NULL
 };
 
@@ -193,6 +211,36 @@ static void process_render(struct userdata *u, pa_usec_t now) {
     }
 
 /*     pa_log_debug("Ate in sum %lu bytes (of %lu)", (unsigned long) ate, (unsigned long) nbytes); */
+
+    pa_sink_publish_latency(u->sink, u->timestamp > now ? u->timestamp - now : 0ULL);
+}
+
+/* Returns when to be called again */
+static pa_usec_t process(struct userdata *u, pa_usec_t now) {
+    pa_assert(u);
+
+    if (PA_UNLIKELY(u->sink->thread_info.rewind_requested))
+        process_rewind(u, now);
+
+    if (!PA_SINK_IS_OPENED(u->sink->thread_info.state))
+        return (pa_usec_t) -1;
+
+    /* Render some data and drop it immediately */
+    if (u->timestamp <= now)
+        process_render(u, now);
+
+    return u->timestamp;
+}
+
+static pa_usec_t executor_cb(pa_io_executor_item *i, pa_usec_t now, void *userdata) {
+    return process(userdata, now);
+}
+
+/* How much earlier than needed we may wake up to join another wakeup
+ * of the clock domain. What is due within that is rendered right
+ * away. */
+static pa_usec_t wakeup_slack(struct userdata *u) {
+    return u->sink->clock_domain ? u->block_usec / 4 : 0;
 }
 
 static void thread_func(void *userdata) {
@@ -204,27 +252,26 @@ static void thread_func(void *userdata) {
 
     pa_thread_mq_install(&u->thread_mq);
 
-    u->timestamp = pa_rtclock_now();
+    if (u->cpu_affinity)
+        pa_set_cpu_affinity(u->cpu_affinity);
+
+    pa_memarena_set_thread(u->arena);
 
     for (;;) {
-        pa_usec_t now = 0;
+        pa_usec_t now = 0, next;
         int ret;
 
         if (PA_SINK_IS_OPENED(u->sink->thread_info.state))
-            now = pa_rtclock_now();
+            now = pa_rtpoll_now(u->rtpoll) + wakeup_slack(u);
 
-        if (PA_UNLIKELY(u->sink->thread_info.rewind_requested))
-            process_rewind(u, now);
-
-        /* Render some data and drop it immediately */
-        if (PA_SINK_IS_OPENED(u->sink->thread_info.state)) {
-            if (u->timestamp <= now)
-                process_render(u, now);
-
-            pa_rtpoll_set_timer_absolute(u->rtpoll, u->timestamp);
-        } else
+        if ((next = process(u, now)) != (pa_usec_t) -1)
+            pa_rtpoll_set_timer_absolute(u->rtpoll, pa_sink_align_wakeup_within_thread(u->sink, next, wakeup_slack(u)));
+        else
             pa_rtpoll_set_timer_disabled(u->rtpoll);
 
+        /* Whatever was rendered in this iteration is gone by now */
+        pa_memarena_reset(u->arena);
+
         /* Hmm, nothing to do. Let's sleep */
         if ((ret = pa_rtpoll_run(u->rtpoll, TRUE)) < 0)
             goto fail;
@@ -240,6 +287,7 @@ fail:
     pa_asyncmsgq_wait_for(u->thread_mq.inq, PA_MESSAGE_SHUTDOWN);
 
 finish:
+    pa_memarena_set_thread(NULL);
     pa_log_debug("Thread shutting down");
 }
 
@@ -250,6 +298,9 @@ int pa__init(pa_module*m) {
     pa_modargs *ma = NULL;
     pa_sink_new_data data;
     size_t nbytes;
+    uint32_t render_threads = 0;
+    pa_bool_t shared_thread = FALSE;
+    pa_thread_mq *thread_mq;
 
     pa_assert(m);
 
@@ -265,11 +316,24 @@ int pa__init(pa_module*m) {
         goto fail;
     }
 
+    if (pa_modargs_get_value_u32(ma, "render_threads", &render_threads) < 0) {
+        pa_log("Failed to parse render_threads argument.");
+        goto fail;
+    }
+
+    if (pa_modargs_get_value_boolean(ma, "shared_thread", &shared_thread) < 0) {
+        pa_log("Failed to parse shared_thread argument.");
+        goto fail;
+    }
+
     m->userdata = u = pa_xnew0(struct userdata, 1);
     u->core = m->core;
     u->module = m;
-    u->rtpoll = pa_rtpoll_new();
-    pa_thread_mq_init(&u->thread_mq, m->core->mainloop, u->rtpoll);
+
+    if (pa_modargs_get_cpu_affinity(ma, m->core->default_cpu_affinity, &u->cpu_affinity) < 0) {
+        pa_log("Failed to parse cpu_affinity or numa_node argument.");
+        goto fail;
+    }
 
     pa_sink_new_data_init(&data);
     data.driver = __FILE__;
@@ -279,6 +343,8 @@ int pa__init(pa_module*m) {
     pa_sink_new_data_set_channel_map(&data, &map);
     pa_proplist_sets(data.proplist, PA_PROP_DEVICE_DESCRIPTION, _("Null Output"));
     pa_proplist_sets(data.proplist, PA_PROP_DEVICE_CLASS, "abstract");
+    pa_sink_new_data_set_cpu_affinity(&data, u->cpu_affinity);
+    pa_sink_new_data_set_clock_domain(&data, pa_modargs_get_value(ma, "clock_domain", NULL));
 
     if (pa_modargs_get_proplist(ma, "sink_properties", data.proplist, PA_UPDATE_REPLACE) < 0) {
         pa_log("Invalid properties");
@@ -298,17 +364,49 @@ int pa__init(pa_module*m) {
     u->sink->update_requested_latency = sink_update_requested_latency_cb;
     u->sink->userdata = u;
 
-    pa_sink_set_asyncmsgq(u->sink, u->thread_mq.inq);
-    pa_sink_set_rtpoll(u->sink, u->rtpoll);
+    u->timestamp = pa_rtclock_now();
+
+    if (shared_thread) {
+        if (pa_modargs_get_value(ma, "cpu_affinity", NULL) || pa_modargs_get_value(ma, "numa_node", NULL))
+            pa_log_warn("The shared IO threads are not bound to the given CPUs.");
+
+        u->executor = pa_io_executor_get(m->core);
+
+        if (!(u->executor_item = pa_io_executor_item_new(u->executor, m, executor_cb, u)))
+            goto fail;
+
+        thread_mq = pa_io_executor_item_get_thread_mq(u->executor_item);
+        pa_sink_set_rtpoll(u->sink, pa_io_executor_item_get_rtpoll(u->executor_item));
+    } else {
+        u->rtpoll = pa_rtpoll_new();
+        pa_thread_mq_init(&u->thread_mq, m->core->mainloop, u->rtpoll);
+
+        thread_mq = &u->thread_mq;
+        pa_sink_set_rtpoll(u->sink, u->rtpoll);
+    }
+
+    pa_sink_set_asyncmsgq(u->sink, thread_mq->inq);
+
+    if (render_threads > 0) {
+        if (!(u->render_pool = pa_render_pool_new("null-sink-render", render_threads, thread_mq,
+                                                  m->core->realtime_scheduling, m->core->realtime_priority)))
+            goto fail;
+
+        pa_sink_set_render_pool(u->sink, u->render_pool);
+    }
 
     u->block_usec = BLOCK_USEC;
     nbytes = pa_usec_to_bytes(u->block_usec, &u->sink->sample_spec);
     pa_sink_set_max_rewind(u->sink, nbytes);
     pa_sink_set_max_request(u->sink, nbytes);
 
-    if (!(u->thread = pa_thread_new("null-sink", thread_func, u))) {
-        pa_log("Failed to create thread.");
-        goto fail;
+    if (!shared_thread) {
+        u->arena = pa_memarena_new(m->core->mempool, 8 * pa_mempool_block_size_max(m->core->mempool));
+
+        if (!(u->thread = pa_thread_new("null-sink", thread_func, u))) {
+            pa_log("Failed to create thread.");
+            goto fail;
+        }
     }
 
     pa_sink_set_latency_range(u->sink, 0, BLOCK_USEC);
@@ -353,13 +451,27 @@ void pa__done(pa_module*m) {
         pa_thread_free(u->thread);
     }
 
-    pa_thread_mq_done(&u->thread_mq);
+    if (u->executor_item)
+        pa_io_executor_item_free(u->executor_item);
+
+    if (u->render_pool)
+        pa_render_pool_free(u->render_pool);
+
+    if (u->rtpoll)
+        pa_thread_mq_done(&u->thread_mq);
+
+    if (u->executor)
+        pa_io_executor_unref(u->executor);
 
     if (u->sink)
         pa_sink_unref(u->sink);
 
+    if (u->arena)
+        pa_memarena_free(u->arena);
+
     if (u->rtpoll)
         pa_rtpoll_free(u->rtpoll);
 
+    pa_xfree(u->cpu_affinity);
     pa_xfree(u);
 }
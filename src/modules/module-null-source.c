@@ -34,6 +34,7 @@
 #include <pulse/xmalloc.h>
 
 #include <pulsecore/core-util.h>
+#include <pulsecore/io-executor.h>
 #include <pulsecore/log.h>
 #include <pulsecore/macro.h>
 #include <pulsecore/modargs.h>
@@ -56,7 +57,11 @@ PA_MODULE_USAGE(
         "source_name=<name of source> "
         "channel_map=<channel map> "
         "description=<description for the source> "
-        "latency_time=<latency time in ms>");
+        "latency_time=<latency time in ms> "
+        "cpu_affinity=<CPUs to run the IO thread on> "
+        "numa_node=<NUMA node to run the IO thread on> "
+        "shared_thread=<run on a shared IO thread instead of an own one?> "
+        "clock_domain=<align the wakeups with the other devices of this clock domain>");
 
 #define DEFAULT_SOURCE_NAME "source.null"
 #define DEFAULT_LATENCY_TIME 20
@@ -70,6 +75,9 @@ struct userdata {
     pa_thread *thread;
     pa_thread_mq thread_mq;
     pa_rtpoll *rtpoll;
+    pa_io_executor *executor;
+    pa_io_executor_item *executor_item;
+    char *cpu_affinity;
 
     size_t block_size;
 
@@ -86,6 +94,10 @@ static const char* const valid_modargs[] = {
     "channel_map",
     "description",
     "latency_time",
+    "cpu_affinity",
+    "numa_node",
+    "shared_thread",
+    "clock_domain",
     NULL
 };
 
@@ -123,6 +135,33 @@ static void source_update_requested_latency_cb(pa_source *s) {
     u->block_usec = pa_source_get_requested_latency_within_thread(s);
 }
 
+/* Returns when to be called again */
+static pa_usec_t process(struct userdata *u, pa_usec_t now) {
+    pa_memchunk chunk;
+
+    pa_assert(u);
+
+    if (!PA_SOURCE_IS_OPENED(u->source->thread_info.state))
+        return (pa_usec_t) -1;
+
+    /* Generate some null data */
+    if ((chunk.length = pa_usec_to_bytes(now - u->timestamp, &u->source->sample_spec)) > 0) {
+
+        chunk.memblock = pa_memblock_new(u->core->mempool, (size_t) -1); /* or chunk.length? */
+        chunk.index = 0;
+        pa_source_post(u->source, &chunk);
+        pa_memblock_unref(chunk.memblock);
+
+        u->timestamp = now;
+    }
+
+    return u->timestamp + u->latency_time * PA_USEC_PER_MSEC;
+}
+
+static pa_usec_t executor_cb(pa_io_executor_item *i, pa_usec_t now, void *userdata) {
+    return process(userdata, now);
+}
+
 static void thread_func(void *userdata) {
     struct userdata *u = userdata;
 
@@ -132,30 +171,18 @@ static void thread_func(void *userdata) {
 
     pa_thread_mq_install(&u->thread_mq);
 
-    u->timestamp = pa_rtclock_now();
+    if (u->cpu_affinity)
+        pa_set_cpu_affinity(u->cpu_affinity);
 
     for (;;) {
+        pa_usec_t next;
         int ret;
 
-        /* Generate some null data */
-        if (PA_SOURCE_IS_OPENED(u->source->thread_info.state)) {
-            pa_usec_t now;
-            pa_memchunk chunk;
-
-            now = pa_rtclock_now();
-
-            if ((chunk.length = pa_usec_to_bytes(now - u->timestamp, &u->source->sample_spec)) > 0) {
-
-                chunk.memblock = pa_memblock_new(u->core->mempool, (size_t) -1); /* or chunk.length? */
-                chunk.index = 0;
-                pa_source_post(u->source, &chunk);
-                pa_memblock_unref(chunk.memblock);
-
-                u->timestamp = now;
-            }
-
-            pa_rtpoll_set_timer_absolute(u->rtpoll, u->timestamp + u->latency_time * PA_USEC_PER_MSEC);
-        } else
+        /* Waking up early just posts a little less data, so a quarter
+         * of the latency may be given up for joining the clock domain */
+        if ((next = process(u, pa_rtpoll_now(u->rtpoll))) != (pa_usec_t) -1)
+            pa_rtpoll_set_timer_absolute(u->rtpoll, pa_source_align_wakeup_within_thread(u->source, next, u->latency_time * PA_USEC_PER_MSEC / 4));
+        else
             pa_rtpoll_set_timer_disabled(u->rtpoll);
 
         /* Hmm, nothing to do. Let's sleep */
@@ -183,6 +210,7 @@ int pa__init(pa_module*m) {
     pa_modargs *ma = NULL;
     pa_source_new_data data;
     uint32_t latency_time = DEFAULT_LATENCY_TIME;
+    pa_bool_t shared_thread = FALSE;
 
     pa_assert(m);
 
@@ -198,11 +226,19 @@ int pa__init(pa_module*m) {
         goto fail;
     }
 
+    if (pa_modargs_get_value_boolean(ma, "shared_thread", &shared_thread) < 0) {
+        pa_log("Failed to parse shared_thread argument.");
+        goto fail;
+    }
+
     m->userdata = u = pa_xnew0(struct userdata, 1);
     u->core = m->core;
     u->module = m;
-    u->rtpoll = pa_rtpoll_new();
-    pa_thread_mq_init(&u->thread_mq, m->core->mainloop, u->rtpoll);
+
+    if (pa_modargs_get_cpu_affinity(ma, m->core->default_cpu_affinity, &u->cpu_affinity) < 0) {
+        pa_log("Failed to parse cpu_affinity or numa_node argument.");
+        goto fail;
+    }
 
     pa_source_new_data_init(&data);
     data.driver = __FILE__;
@@ -212,6 +248,8 @@ int pa__init(pa_module*m) {
     pa_source_new_data_set_channel_map(&data, &map);
     pa_proplist_sets(data.proplist, PA_PROP_DEVICE_DESCRIPTION, pa_modargs_get_value(ma, "description", "Null Input"));
     pa_proplist_sets(data.proplist, PA_PROP_DEVICE_CLASS, "abstract");
+    pa_source_new_data_set_cpu_affinity(&data, u->cpu_affinity);
+    pa_source_new_data_set_clock_domain(&data, pa_modargs_get_value(ma, "clock_domain", NULL));
 
     u->source = pa_source_new(m->core, &data, PA_SOURCE_LATENCY | PA_SOURCE_DYNAMIC_LATENCY);
     pa_source_new_data_done(&data);
@@ -232,18 +270,36 @@ int pa__init(pa_module*m) {
     u->source->update_requested_latency = source_update_requested_latency_cb;
     u->source->userdata = u;
 
-    pa_source_set_asyncmsgq(u->source, u->thread_mq.inq);
-    pa_source_set_rtpoll(u->source, u->rtpoll);
-
     pa_source_set_latency_range(u->source, 0, MAX_LATENCY_USEC);
     u->block_usec = u->source->thread_info.max_latency;
 
     u->source->thread_info.max_rewind =
         pa_usec_to_bytes(u->block_usec, &u->source->sample_spec);
 
-    if (!(u->thread = pa_thread_new("null-source", thread_func, u))) {
-        pa_log("Failed to create thread.");
-        goto fail;
+    u->timestamp = pa_rtclock_now();
+
+    if (shared_thread) {
+        if (pa_modargs_get_value(ma, "cpu_affinity", NULL) || pa_modargs_get_value(ma, "numa_node", NULL))
+            pa_log_warn("The shared IO threads are not bound to the given CPUs.");
+
+        u->executor = pa_io_executor_get(m->core);
+
+        if (!(u->executor_item = pa_io_executor_item_new(u->executor, m, executor_cb, u)))
+            goto fail;
+
+        pa_source_set_asyncmsgq(u->source, pa_io_executor_item_get_thread_mq(u->executor_item)->inq);
+        pa_source_set_rtpoll(u->source, pa_io_executor_item_get_rtpoll(u->executor_item));
+    } else {
+        u->rtpoll = pa_rtpoll_new();
+        pa_thread_mq_init(&u->thread_mq, m->core->mainloop, u->rtpoll);
+
+        pa_source_set_asyncmsgq(u->source, u->thread_mq.inq);
+        pa_source_set_rtpoll(u->source, u->rtpoll);
+
+        if (!(u->thread = pa_thread_new("null-source", thread_func, u))) {
+            pa_log("Failed to create thread.");
+            goto fail;
+        }
     }
 
     pa_source_put(u->source);
@@ -277,7 +333,14 @@ void pa__done(pa_module*m) {
         pa_thread_free(u->thread);
     }
 
-    pa_thread_mq_done(&u->thread_mq);
+    if (u->executor_item)
+        pa_io_executor_item_free(u->executor_item);
+
+    if (u->rtpoll)
+        pa_thread_mq_done(&u->thread_mq);
+
+    if (u->executor)
+        pa_io_executor_unref(u->executor);
 
     if (u->source)
         pa_source_unref(u->source);
@@ -285,5 +348,6 @@ void pa__done(pa_module*m) {
     if (u->rtpoll)
         pa_rtpoll_free(u->rtpoll);
 
+    pa_xfree(u->cpu_affinity);
     pa_xfree(u);
 }
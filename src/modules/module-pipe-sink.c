@@ -31,6 +31,10 @@
 #include <unistd.h>
 #include <sys/ioctl.h>
 
+#ifdef HAVE_VMSPLICE
+#include <sys/uio.h>
+#endif
+
 #ifdef HAVE_SYS_FILIO_H
 #include <sys/filio.h>
 #endif
@@ -47,6 +51,7 @@
 #include <pulsecore/thread-mq.h>
 #include <pulsecore/rtpoll.h>
 #include <pulsecore/poll.h>
+#include <pulsecore/memblockq.h>
 
 #include "module-pipe-sink-symdef.h"
 
@@ -61,11 +66,16 @@ PA_MODULE_USAGE(
         "format=<sample format> "
         "rate=<sample rate> "
         "channels=<number of channels> "
-        "channel_map=<channel map>");
+        "channel_map=<channel map> "
+        "use_vmsplice=<map the rendered data into the FIFO instead of copying it?>");
 
 #define DEFAULT_FILE_NAME "fifo_output"
 #define DEFAULT_SINK_NAME "fifo_output"
 
+/* More than any pipe can hold, the reader can grow it up to
+ * /proc/sys/fs/pipe-max-size */
+#define SPLICED_MAX (16*1024*1024)
+
 struct userdata {
     pa_core *core;
     pa_module *module;
@@ -83,6 +93,12 @@ struct userdata {
     pa_rtpoll_item *rtpoll_item;
 
     int write_type;
+
+    /* The pages of these blocks are still referenced from the pipe, so
+     * they must neither be freed nor reused until the reader is past
+     * them */
+    pa_bool_t use_vmsplice;
+    pa_memblockq *spliced;
 };
 
 static const char* const valid_modargs[] = {
@@ -93,6 +109,7 @@ static const char* const valid_modargs[] = {
     "rate",
     "channels",
     "channel_map",
+    "use_vmsplice",
     NULL
 };
 
@@ -121,9 +138,57 @@ static int sink_process_msg(pa_msgobject *o, int code, void *data, int64_t offse
     return pa_sink_process_msg(o, code, data, offset, chunk);
 }
 
+#ifdef HAVE_VMSPLICE
+static void reclaim_spliced(struct userdata *u) {
+    size_t length, n = 0;
+    int l;
+
+    if (!u->spliced)
+        return;
+
+    /* Everything but the last n bytes has been read already */
+    if (ioctl(u->fd, FIONREAD, &l) >= 0 && l > 0)
+        n = (size_t) l;
+
+    length = pa_memblockq_get_length(u->spliced);
+
+    if (length > n)
+        pa_memblockq_drop(u->spliced, length - n);
+}
+
+static ssize_t splice_chunk(struct userdata *u, const uint8_t *p, size_t length) {
+    struct iovec iov;
+    ssize_t l;
+    size_t n;
+
+    n = SPLICED_MAX - pa_memblockq_get_length(u->spliced);
+
+    /* Can't keep track of more, so copy this time */
+    if (n <= 0)
+        return pa_write(u->fd, p, length, &u->write_type);
+
+    iov.iov_base = (void*) p;
+    iov.iov_len = PA_MIN(length, n);
+
+    if ((l = vmsplice(u->fd, &iov, 1, SPLICE_F_NONBLOCK)) > 0) {
+        pa_memchunk chunk;
+
+        chunk = u->memchunk;
+        chunk.length = (size_t) l;
+        pa_assert_se(pa_memblockq_push(u->spliced, &chunk) >= 0);
+    }
+
+    return l;
+}
+#endif
+
 static int process_render(struct userdata *u) {
     pa_assert(u);
 
+#ifdef HAVE_VMSPLICE
+    reclaim_spliced(u);
+#endif
+
     if (u->memchunk.length <= 0)
         pa_sink_render(u->sink, pa_pipe_buf(u->fd), &u->memchunk);
 
@@ -134,7 +199,12 @@ static int process_render(struct userdata *u) {
         void *p;
 
         p = pa_memblock_acquire(u->memchunk.memblock);
-        l = pa_write(u->fd, (uint8_t*) p + u->memchunk.index, u->memchunk.length, &u->write_type);
+#ifdef HAVE_VMSPLICE
+        if (u->spliced)
+            l = splice_chunk(u, (uint8_t*) p + u->memchunk.index, u->memchunk.length);
+        else
+#endif
+            l = pa_write(u->fd, (uint8_t*) p + u->memchunk.index, u->memchunk.length, &u->write_type);
         pa_memblock_release(u->memchunk.memblock);
 
         pa_assert(l != 0);
@@ -252,6 +322,26 @@ int pa__init(pa_module *m) {
     pa_thread_mq_init(&u->thread_mq, m->core->mainloop, u->rtpoll);
     u->write_type = 0;
 
+    if (pa_modargs_get_value_boolean(ma, "use_vmsplice", &u->use_vmsplice) < 0) {
+        pa_log("use_vmsplice= expects a boolean argument.");
+        goto fail;
+    }
+
+#ifdef HAVE_VMSPLICE
+    if (u->use_vmsplice) {
+        static const pa_sample_spec byte_spec = {
+            .format = PA_SAMPLE_U8,
+            .rate = 8000,
+            .channels = 1
+        };
+
+        u->spliced = pa_memblockq_new("module-pipe-sink spliced", 0, SPLICED_MAX, 0, &byte_spec, 0, 0, 0, NULL);
+    }
+#else
+    if (u->use_vmsplice)
+        pa_log_warn("vmsplice() is not available, copying the data instead.");
+#endif
+
     u->filename = pa_runtime_path(pa_modargs_get_value(ma, "file", DEFAULT_FILE_NAME));
 
     if (mkfifo(u->filename, 0666) < 0) {
@@ -364,6 +454,9 @@ void pa__done(pa_module *m) {
     if (u->memchunk.memblock)
         pa_memblock_unref(u->memchunk.memblock);
 
+    if (u->spliced)
+        pa_memblockq_free(u->spliced);
+
     if (u->rtpoll_item)
         pa_rtpoll_item_free(u->rtpoll_item);
 
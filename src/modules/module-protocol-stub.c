@@ -111,7 +111,7 @@
 #  define TCPWRAP_SERVICE "pulseaudio-native"
 #  define IPV4_PORT PA_NATIVE_DEFAULT_PORT
 #  define UNIX_SOCKET PA_NATIVE_DEFAULT_UNIX_SOCKET
-#  define MODULE_ARGUMENTS_COMMON "cookie", "auth-cookie", "auth-cookie-enabled", "auth-anonymous",
+#  define MODULE_ARGUMENTS_COMMON "cookie", "auth-cookie", "auth-cookie-enabled", "auth-anonymous", "io-threads",
 
 #  ifdef USE_TCP_SOCKETS
 #    include "module-native-protocol-tcp-symdef.h"
@@ -134,6 +134,7 @@
   PA_MODULE_USAGE("auth-anonymous=<don't check for cookies?> "
                   "auth-cookie=<path to cookie file> "
                   "auth-cookie-enabled=<enable cookie authentication?> "
+                  "io-threads=<number of threads reading from the clients> "
                   AUTH_USAGE
                   SOCKET_USAGE);
 #elif defined(USE_PROTOCOL_ESOUND)
@@ -349,14 +350,19 @@ int pa__init(pa_module*m) {
     }
 #  endif
 
-    if ((r = pa_unix_socket_remove_stale(u->socket_path)) < 0) {
-        pa_log("Failed to remove stale UNIX socket '%s': %s", u->socket_path, pa_cstrerror(errno));
-        goto fail;
-    } else if (r > 0)
-        pa_log_info("Removed stale UNIX socket '%s'.", u->socket_path);
+    /* The daemon we replaced might have left its socket to us, which
+     * then is still listening and hence not stale */
+    if (!(u->socket_server_unix = pa_socket_server_new_unix_handoff(m->core->mainloop, u->socket_path))) {
 
-    if (!(u->socket_server_unix = pa_socket_server_new_unix(m->core->mainloop, u->socket_path)))
-        goto fail;
+        if ((r = pa_unix_socket_remove_stale(u->socket_path)) < 0) {
+            pa_log("Failed to remove stale UNIX socket '%s': %s", u->socket_path, pa_cstrerror(errno));
+            goto fail;
+        } else if (r > 0)
+            pa_log_info("Removed stale UNIX socket '%s'.", u->socket_path);
+
+        if (!(u->socket_server_unix = pa_socket_server_new_unix(m->core->mainloop, u->socket_path)))
+            goto fail;
+    }
 
     pa_socket_server_set_callback(u->socket_server_unix, socket_server_on_connection_cb, u);
 
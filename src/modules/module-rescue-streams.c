@@ -83,8 +83,10 @@ static pa_sink* find_evacuation_sink(pa_core *c, pa_sink_input *i, pa_sink *skip
 }
 
 static pa_hook_result_t sink_unlink_hook_callback(pa_core *c, pa_sink *sink, void* userdata) {
-    pa_sink_input *i;
+    pa_sink_input *i, **inputs;
+    pa_sink **targets;
     uint32_t idx;
+    unsigned n = 0, k;
 
     pa_assert(c);
     pa_assert(sink);
@@ -98,20 +100,43 @@ static pa_hook_result_t sink_unlink_hook_callback(pa_core *c, pa_sink *sink, voi
         return PA_HOOK_OK;
     }
 
-    PA_IDXSET_FOREACH(i, sink->inputs, idx) {
-        pa_sink *target;
+    /* The streams are moved in one batch per target sink, so that each
+     * of the sinks only needs to rewind once */
+    inputs = pa_xnew(pa_sink_input*, pa_idxset_size(sink->inputs));
+    targets = pa_xnew(pa_sink*, pa_idxset_size(sink->inputs));
 
-        if (!(target = find_evacuation_sink(c, i, sink)))
+    PA_IDXSET_FOREACH(i, sink->inputs, idx) {
+        if (!(targets[n] = find_evacuation_sink(c, i, sink)))
             continue;
 
-        if (pa_sink_input_move_to(i, target, FALSE) < 0)
-            pa_log_info("Failed to move sink input %u \"%s\" to %s.", i->index,
-                        pa_strnull(pa_proplist_gets(i->proplist, PA_PROP_APPLICATION_NAME)), target->name);
-        else
-            pa_log_info("Successfully moved sink input %u \"%s\" to %s.", i->index,
-                        pa_strnull(pa_proplist_gets(i->proplist, PA_PROP_APPLICATION_NAME)), target->name);
+        inputs[n++] = i;
+    }
+
+    for (k = 0; k < n; k++) {
+        pa_sink *target = targets[k];
+        unsigned j, m = 0, moved;
+
+        /* Collect all streams for this target at position k */
+        for (j = k; j < n; j++)
+            if (targets[j] == target) {
+                pa_sink_input *t = inputs[j];
+
+                inputs[j] = inputs[k + m];
+                targets[j] = targets[k + m];
+                inputs[k + m] = t;
+                targets[k + m] = target;
+                m++;
+            }
+
+        moved = pa_sink_input_move_many_to(inputs + k, m, target, FALSE);
+        pa_log_info("Moved %u of %u sink inputs to %s.", moved, m, target->name);
+
+        k += m - 1;
     }
 
+    pa_xfree(inputs);
+    pa_xfree(targets);
+
     return PA_HOOK_OK;
 }
 
@@ -23,6 +23,7 @@
 #include <config.h>
 #endif
 
+#include <pulse/timeval.h>
 #include <pulse/volume.h>
 #include <pulse/xmalloc.h>
 
@@ -44,14 +45,18 @@ PA_MODULE_USAGE(
         "trigger_roles=<Comma separated list of roles which will trigger a ducking> "
         "ducking_roles=<Comma separated list of roles which will be ducked> "
         "global=<Should we operate globally or only inside the same device?>"
-        "volume=<Volume for the attenuated streams. Default: -20dB"
+        "volume=<Volume for the attenuated streams. Default: -20dB> "
+        "fade_time=<Time in ms to fade streams down and up again. Default: 250>"
 );
 
+#define DEFAULT_FADE_TIME_MSEC 250
+
 static const char* const valid_modargs[] = {
     "trigger_roles",
     "ducking_roles",
     "global",
     "volume",
+    "fade_time",
     NULL
 };
 
@@ -63,6 +68,7 @@ struct userdata {
     pa_idxset *ducked_inputs;
     bool global;
     pa_volume_t volume;
+    pa_usec_t fade_time;
     pa_hook_slot
         *sink_input_put_slot,
         *sink_input_unlink_slot,
@@ -126,17 +132,13 @@ static void apply_ducking_to_sink(struct userdata *u, pa_sink *s, pa_sink_input
 
         i = pa_idxset_get_by_data(u->ducked_inputs, j, NULL);
         if (duck && !i) {
-            pa_cvolume vol;
-            vol.channels = 1;
-            vol.values[0] = u->volume;
-
             pa_log_debug("Found a '%s' stream that should be ducked.", ducking_role);
-            pa_sink_input_add_volume_factor(j, u->name, &vol);
+            pa_sink_input_set_volume_ramp(j, u->volume, u->fade_time);
             pa_idxset_put(u->ducked_inputs, j, NULL);
         } else if (!duck && i) { /* This stream should not longer be ducked */
             pa_log_debug("Found a '%s' stream that should be unducked", ducking_role);
             pa_idxset_remove_by_data(u->ducked_inputs, j, NULL);
-            pa_sink_input_remove_volume_factor(j, u->name);
+            pa_sink_input_set_volume_ramp(j, PA_VOLUME_NORM, u->fade_time);
         }
     }
 }
@@ -203,6 +205,7 @@ int pa__init(pa_module *m) {
     pa_modargs *ma = NULL;
     struct userdata *u;
     const char *roles;
+    uint32_t fade_time;
 
     pa_assert(m);
 
@@ -265,6 +268,13 @@ int pa__init(pa_module *m) {
         goto fail;
     }
 
+    fade_time = DEFAULT_FADE_TIME_MSEC;
+    if (pa_modargs_get_value_u32(ma, "fade_time", &fade_time) < 0) {
+        pa_log("Failed to parse fade_time parameter");
+        goto fail;
+    }
+    u->fade_time = fade_time * PA_USEC_PER_MSEC;
+
     u->sink_input_put_slot = pa_hook_connect(&m->core->hooks[PA_CORE_HOOK_SINK_INPUT_PUT], PA_HOOK_LATE, (pa_hook_cb_t) sink_input_put_cb, u);
     u->sink_input_unlink_slot = pa_hook_connect(&m->core->hooks[PA_CORE_HOOK_SINK_INPUT_UNLINK], PA_HOOK_LATE, (pa_hook_cb_t) sink_input_unlink_cb, u);
     u->sink_input_move_start_slot = pa_hook_connect(&m->core->hooks[PA_CORE_HOOK_SINK_INPUT_MOVE_START], PA_HOOK_LATE, (pa_hook_cb_t) sink_input_move_start_cb, u);
@@ -300,7 +310,7 @@ void pa__done(pa_module *m) {
 
     if (u->ducked_inputs) {
         while ((i = pa_idxset_steal_first(u->ducked_inputs, NULL)))
-            pa_sink_input_remove_volume_factor(i, u->name);
+            pa_sink_input_set_volume_ramp(i, PA_VOLUME_NORM, 0);
 
         pa_idxset_free(u->ducked_inputs, NULL);
     }
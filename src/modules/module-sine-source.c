@@ -40,6 +40,7 @@
 #include <pulsecore/thread.h>
 #include <pulsecore/thread-mq.h>
 #include <pulsecore/rtpoll.h>
+#include <pulsecore/io-executor.h>
 
 #include "module-sine-source-symdef.h"
 
@@ -51,7 +52,8 @@ PA_MODULE_USAGE(
         "source_name=<name for the source> "
         "source_properties=<properties for the source> "
         "rate=<sample rate> "
-        "frequency=<frequency in Hz>");
+        "frequency=<frequency in Hz> "
+        "shared_thread=<run on a shared IO thread instead of an own one?>");
 
 #define DEFAULT_SOURCE_NAME "sine_input"
 #define BLOCK_USEC (PA_USEC_PER_SEC * 2)
@@ -64,6 +66,8 @@ struct userdata {
     pa_thread *thread;
     pa_thread_mq thread_mq;
     pa_rtpoll *rtpoll;
+    pa_io_executor *executor;
+    pa_io_executor_item *executor_item;
 
     pa_memchunk memchunk;
     size_t peek_index;
@@ -77,6 +81,7 @@ static const char* const valid_modargs[] = {
     "source_properties",
     "rate",
     "frequency",
+    "shared_thread",
     NULL
 };
 
@@ -151,6 +156,23 @@ static void process_render(struct userdata *u, pa_usec_t now) {
     }
 }
 
+/* Returns when to be called again */
+static pa_usec_t process(struct userdata *u, pa_usec_t now) {
+    pa_assert(u);
+
+    if (!PA_SOURCE_IS_OPENED(u->source->thread_info.state))
+        return (pa_usec_t) -1;
+
+    if (u->timestamp <= now)
+        process_render(u, now);
+
+    return u->timestamp;
+}
+
+static pa_usec_t executor_cb(pa_io_executor_item *i, pa_usec_t now, void *userdata) {
+    return process(userdata, now);
+}
+
 static void thread_func(void *userdata) {
     struct userdata *u = userdata;
 
@@ -160,21 +182,13 @@ static void thread_func(void *userdata) {
 
     pa_thread_mq_install(&u->thread_mq);
 
-    u->timestamp = pa_rtclock_now();
-
     for (;;) {
+        pa_usec_t next;
         int ret;
 
-        if (PA_SOURCE_IS_OPENED(u->source->thread_info.state)) {
-            pa_usec_t now;
-
-            now = pa_rtclock_now();
-
-            if (u->timestamp <= now)
-                process_render(u, now);
-
-            pa_rtpoll_set_timer_absolute(u->rtpoll, u->timestamp);
-        } else
+        if ((next = process(u, pa_rtpoll_now(u->rtpoll))) != (pa_usec_t) -1)
+            pa_rtpoll_set_timer_absolute(u->rtpoll, next);
+        else
             pa_rtpoll_set_timer_disabled(u->rtpoll);
 
         /* Hmm, nothing to do. Let's sleep */
@@ -201,6 +215,7 @@ int pa__init(pa_module*m) {
     pa_source_new_data data;
     uint32_t frequency;
     pa_sample_spec ss;
+    pa_bool_t shared_thread = FALSE;
 
     pa_assert(m);
 
@@ -224,11 +239,14 @@ int pa__init(pa_module*m) {
         goto fail;
     }
 
+    if (pa_modargs_get_value_boolean(ma, "shared_thread", &shared_thread) < 0) {
+        pa_log("Failed to parse shared_thread argument.");
+        goto fail;
+    }
+
     m->userdata = u = pa_xnew0(struct userdata, 1);
     u->core = m->core;
     u->module = m;
-    u->rtpoll = pa_rtpoll_new();
-    pa_thread_mq_init(&u->thread_mq, m->core->mainloop, u->rtpoll);
 
     u->peek_index = 0;
     pa_memchunk_sine(&u->memchunk, m->core->mempool, ss.rate, frequency);
@@ -262,13 +280,29 @@ int pa__init(pa_module*m) {
 
     u->block_usec = BLOCK_USEC;
 
-    pa_source_set_asyncmsgq(u->source, u->thread_mq.inq);
-    pa_source_set_rtpoll(u->source, u->rtpoll);
     pa_source_set_fixed_latency(u->source, u->block_usec);
 
-    if (!(u->thread = pa_thread_new("sine-source", thread_func, u))) {
-        pa_log("Failed to create thread.");
-        goto fail;
+    u->timestamp = pa_rtclock_now();
+
+    if (shared_thread) {
+        u->executor = pa_io_executor_get(m->core);
+
+        if (!(u->executor_item = pa_io_executor_item_new(u->executor, m, executor_cb, u)))
+            goto fail;
+
+        pa_source_set_asyncmsgq(u->source, pa_io_executor_item_get_thread_mq(u->executor_item)->inq);
+        pa_source_set_rtpoll(u->source, pa_io_executor_item_get_rtpoll(u->executor_item));
+    } else {
+        u->rtpoll = pa_rtpoll_new();
+        pa_thread_mq_init(&u->thread_mq, m->core->mainloop, u->rtpoll);
+
+        pa_source_set_asyncmsgq(u->source, u->thread_mq.inq);
+        pa_source_set_rtpoll(u->source, u->rtpoll);
+
+        if (!(u->thread = pa_thread_new("sine-source", thread_func, u))) {
+            pa_log("Failed to create thread.");
+            goto fail;
+        }
     }
 
     pa_source_put(u->source);
@@ -311,7 +345,14 @@ void pa__done(pa_module*m) {
         pa_thread_free(u->thread);
     }
 
-    pa_thread_mq_done(&u->thread_mq);
+    if (u->executor_item)
+        pa_io_executor_item_free(u->executor_item);
+
+    if (u->rtpoll)
+        pa_thread_mq_done(&u->thread_mq);
+
+    if (u->executor)
+        pa_io_executor_unref(u->executor);
 
     if (u->source)
         pa_source_unref(u->source);
@@ -50,6 +50,7 @@
 #include <pulsecore/pstream.h>
 #include <pulsecore/pstream-util.h>
 #include <pulsecore/database.h>
+#include <pulsecore/database-flusher.h>
 #include <pulsecore/tagstruct.h>
 #include <pulsecore/proplist-util.h>
 
@@ -72,7 +73,6 @@ PA_MODULE_USAGE(
         "on_rescue=<When device becomes unavailable, recheck streams?> "
         "fallback_table=<filename>");
 
-#define SAVE_INTERVAL (10 * PA_USEC_PER_SEC)
 #define IDENTIFICATION_PROPERTY "module-stream-restore.id"
 
 #define DEFAULT_FALLBACK_FILE PA_DEFAULT_CONFIG_DIR"/stream-restore.table"
@@ -104,9 +104,14 @@ struct userdata {
         *sink_unlink_hook_slot,
         *source_unlink_hook_slot,
         *connection_unlink_hook_slot;
-    pa_time_event *save_time_event;
+    pa_database_flusher *flusher;
     pa_database* database;
 
+    /* Decoded entries by name, so that new streams need neither a
+     * database lookup nor a tagstruct. Dropped whenever the database
+     * entry changes. */
+    pa_hashmap *entry_cache;
+
     pa_bool_t restore_device:1;
     pa_bool_t restore_volume:1;
     pa_bool_t restore_muted:1;
@@ -149,6 +154,7 @@ static void entry_free(struct entry *e);
 static struct entry *entry_read(struct userdata *u, const char *name);
 static pa_bool_t entry_write(struct userdata *u, const char *name, const struct entry *e, pa_bool_t replace);
 static struct entry* entry_copy(const struct entry *e);
+static void entry_forget(struct userdata *u, const char *name);
 static void entry_apply(struct userdata *u, const char *name, struct entry *e);
 static void trigger_save(struct userdata *u);
 
@@ -945,6 +951,7 @@ static void handle_entry_remove(DBusConnection *conn, DBusMessage *msg, void *us
     key.size = strlen(de->entry_name);
 
     pa_assert_se(pa_database_unset(de->userdata->database, &key) == 0);
+    entry_forget(de->userdata, de->entry_name);
 
     send_entry_removed_signal(de);
     trigger_save(de->userdata);
@@ -957,21 +964,6 @@ static void handle_entry_remove(DBusConnection *conn, DBusMessage *msg, void *us
 
 #endif /* HAVE_DBUS */
 
-static void save_time_callback(pa_mainloop_api*a, pa_time_event* e, const struct timeval *t, void *userdata) {
-    struct userdata *u = userdata;
-
-    pa_assert(a);
-    pa_assert(e);
-    pa_assert(u);
-
-    pa_assert(e == u->save_time_event);
-    u->core->mainloop->time_free(u->save_time_event);
-    u->save_time_event = NULL;
-
-    pa_database_sync(u->database);
-    pa_log_info("Synced.");
-}
-
 static struct entry* entry_new(void) {
     struct entry *r = pa_xnew0(struct entry, 1);
     r->version = ENTRY_VERSION;
@@ -986,6 +978,29 @@ static void entry_free(struct entry* e) {
     pa_xfree(e);
 }
 
+struct cached_entry {
+    char *name;
+    struct entry *entry;
+};
+
+static void cached_entry_free(struct cached_entry *c) {
+    pa_assert(c);
+
+    entry_free(c->entry);
+    pa_xfree(c->name);
+    pa_xfree(c);
+}
+
+static void entry_forget(struct userdata *u, const char *name) {
+    struct cached_entry *c;
+
+    pa_assert(u);
+    pa_assert(name);
+
+    if ((c = pa_hashmap_remove(u->entry_cache, name)))
+        cached_entry_free(c);
+}
+
 static pa_bool_t entry_write(struct userdata *u, const char *name, const struct entry *e, pa_bool_t replace) {
     pa_tagstruct *t;
     pa_datum key, data;
@@ -1016,6 +1031,9 @@ static pa_bool_t entry_write(struct userdata *u, const char *name, const struct
 
     pa_tagstruct_free(t);
 
+    if (r)
+        entry_forget(u, name);
+
     return r;
 }
 
@@ -1115,10 +1133,14 @@ static struct entry *entry_read(struct userdata *u, const char *name) {
     struct entry *e = NULL;
     pa_tagstruct *t = NULL;
     const char *device, *card;
+    struct cached_entry *c;
 
     pa_assert(u);
     pa_assert(name);
 
+    if ((c = pa_hashmap_get(u->entry_cache, name)))
+        return entry_copy(c->entry);
+
     key.data = (char*) name;
     key.size = strlen(name);
 
@@ -1174,6 +1196,11 @@ static struct entry *entry_read(struct userdata *u, const char *name) {
     pa_tagstruct_free(t);
     pa_datum_free(&data);
 
+    c = pa_xnew(struct cached_entry, 1);
+    c->name = pa_xstrdup(name);
+    c->entry = entry_copy(e);
+    pa_assert_se(pa_hashmap_put(u->entry_cache, c->name, c) >= 0);
+
     return e;
 
 fail:
@@ -1214,10 +1241,7 @@ static void trigger_save(struct userdata *u) {
         pa_pstream_send_tagstruct(pa_native_connection_get_pstream(c), t);
     }
 
-    if (u->save_time_event)
-        return;
-
-    u->save_time_event = pa_core_rttime_new(u->core, pa_rtclock_now() + SAVE_INTERVAL, save_time_callback, u);
+    pa_database_flusher_schedule(u->flusher, u->database);
 }
 
 static pa_bool_t entries_equal(const struct entry *a, const struct entry *b) {
@@ -2101,6 +2125,7 @@ static int extension_cb(pa_native_protocol *p, pa_module *m, pa_native_connectio
                 }
 #endif
                 pa_database_clear(u->database);
+                pa_hashmap_remove_all(u->entry_cache, (pa_free_cb_t) cached_entry_free);
             }
 
             while (!pa_tagstruct_eof(t)) {
@@ -2217,6 +2242,7 @@ static int extension_cb(pa_native_protocol *p, pa_module *m, pa_native_connectio
                 key.size = strlen(name);
 
                 pa_database_unset(u->database, &key);
+                entry_forget(u, name);
             }
 
             trigger_save(u);
@@ -2336,6 +2362,7 @@ static void clean_up_db(struct userdata *u) {
         pa_log_debug("Removing an invalid entry: %s", item->entry_name);
 
         pa_assert_se(pa_database_unset(u->database, &key) >= 0);
+        entry_forget(u, item->entry_name);
         trigger_save(u);
 
         PA_LLIST_REMOVE(struct clean_up_item, to_be_removed, item);
@@ -2399,6 +2426,7 @@ int pa__init(pa_module*m) {
     u->on_hotplug = on_hotplug;
     u->on_rescue = on_rescue;
     u->subscribed = pa_idxset_new(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func);
+    u->entry_cache = pa_hashmap_new(pa_idxset_string_hash_func, pa_idxset_string_compare_func);
 
     u->protocol = pa_native_protocol_get(m->core);
     pa_native_protocol_install_ext(u->protocol, m, extension_cb);
@@ -2439,6 +2467,8 @@ int pa__init(pa_module*m) {
         goto fail;
     }
 
+    u->flusher = pa_database_flusher_get(m->core);
+
     pa_log_info("Successfully opened database file '%s'.", fname);
     pa_xfree(fname);
 
@@ -2536,8 +2566,12 @@ void pa__done(pa_module*m) {
     if (u->connection_unlink_hook_slot)
         pa_hook_slot_free(u->connection_unlink_hook_slot);
 
-    if (u->save_time_event)
-        u->core->mainloop->time_free(u->save_time_event);
+    if (u->flusher) {
+        if (u->database)
+            pa_database_flusher_remove(u->flusher, u->database);
+
+        pa_database_flusher_unref(u->flusher);
+    }
 
     if (u->database)
         pa_database_close(u->database);
@@ -2550,5 +2584,8 @@ void pa__done(pa_module*m) {
     if (u->subscribed)
         pa_idxset_free(u->subscribed, NULL);
 
+    if (u->entry_cache)
+        pa_hashmap_free(u->entry_cache, (pa_free_cb_t) cached_entry_free);
+
     pa_xfree(u);
 }
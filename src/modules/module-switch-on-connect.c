@@ -53,8 +53,9 @@ struct userdata {
 };
 
 static pa_hook_result_t sink_put_hook_callback(pa_core *c, pa_sink *sink, void* userdata) {
-    pa_sink_input *i;
+    pa_sink_input *i, **inputs;
     uint32_t idx;
+    unsigned n = 0, moved;
     pa_sink *def;
     const char *s;
 
@@ -86,18 +87,22 @@ static pa_hook_result_t sink_put_hook_callback(pa_core *c, pa_sink *sink, void*
         return PA_HOOK_OK;
     }
 
+    /* All of them go in one batch, so that both sinks only need to
+     * rewind once */
+    inputs = pa_xnew(pa_sink_input*, pa_idxset_size(def->inputs));
+
     PA_IDXSET_FOREACH(i, def->inputs, idx) {
         if (i->save_sink || !PA_SINK_INPUT_IS_LINKED(i->state))
             continue;
 
-        if (pa_sink_input_move_to(i, sink, FALSE) < 0)
-            pa_log_info("Failed to move sink input %u \"%s\" to %s.", i->index,
-                        pa_strnull(pa_proplist_gets(i->proplist, PA_PROP_APPLICATION_NAME)), sink->name);
-        else
-            pa_log_info("Successfully moved sink input %u \"%s\" to %s.", i->index,
-                        pa_strnull(pa_proplist_gets(i->proplist, PA_PROP_APPLICATION_NAME)), sink->name);
+        inputs[n++] = i;
     }
 
+    moved = pa_sink_input_move_many_to(inputs, n, sink, FALSE);
+    pa_log_info("Moved %u of %u sink inputs to %s.", moved, n, sink->name);
+
+    pa_xfree(inputs);
+
     return PA_HOOK_OK;
 }
 
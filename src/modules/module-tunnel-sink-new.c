@@ -39,6 +39,7 @@
 #include <pulsecore/thread-mq.h>
 #include <pulsecore/rtpoll.h>
 #include <pulsecore/poll.h>
+#include <pulsecore/time-smoother.h>
 
 #include "module-tunnel-sink-new-symdef.h"
 
@@ -52,8 +53,13 @@ PA_MODULE_USAGE(_("sink_name=<name of sink>"));
 
 #define MEMBLOCKQ_MAXLENGTH (16*1024*1024)
 
+/* The smoother interpolates between timing updates, so they can be rare */
+#define LATENCY_INTERVAL (10*PA_USEC_PER_SEC)
+
 /* libpulse callbacks */
 static void stream_state_callback(pa_stream *stream, void *userdata);
+static void stream_write_callback(pa_stream *stream, size_t nbytes, void *userdata);
+static void stream_latency_update_callback(pa_stream *stream, void *userdata);
 static void context_state_callback(pa_context *c, void *userdata);
 
 struct userdata {
@@ -77,6 +83,16 @@ struct userdata {
     pa_stream *stream;
 
     bool connected;
+
+    /* Only used in the IO thread */
+    size_t requested_bytes;
+    int64_t counter;
+    pa_smoother *smoother;
+
+    /* Only used in the main thread */
+    size_t in_flight; /* credit passed to the IO thread, not written yet */
+    int64_t written;
+    pa_time_event *time_event;
 };
 
 static const char* const valid_modargs[] = {
@@ -88,9 +104,28 @@ static const char* const valid_modargs[] = {
 
 enum {
     SINK_MESSAGE_PASS_SOCKET = PA_SINK_MESSAGE_MAX,
-    SINK_MESSAGE_RIP_SOCKET
+    SINK_MESSAGE_RIP_SOCKET,
+    SINK_MESSAGE_REQUEST,
+    SINK_MESSAGE_POST,
+    SINK_MESSAGE_UPDATE_LATENCY
 };
 
+/* Called from IO thread context */
+static void send_data(struct userdata *u) {
+    pa_assert(u);
+
+    while (u->requested_bytes > 0) {
+        pa_memchunk memchunk;
+
+        pa_sink_render(u->sink, u->requested_bytes, &memchunk);
+        pa_asyncmsgq_post(u->thread_mq.outq, PA_MSGOBJECT(u->sink), SINK_MESSAGE_POST, NULL, 0, &memchunk, NULL);
+        pa_memblock_unref(memchunk.memblock);
+
+        u->requested_bytes -= memchunk.length;
+        u->counter += (int64_t) memchunk.length;
+    }
+}
+
 static void thread_func(void *userdata) {
     struct userdata *u = userdata;
 
@@ -100,65 +135,19 @@ static void thread_func(void *userdata) {
 
     pa_thread_mq_install(&u->thread_mq);
 
-    u->timestamp = pa_rtclock_now();
-
-    for(;;)
-    {
+    for (;;) {
         int ret;
-        const void *p;
-        pa_usec_t now = 0;
-
-        size_t writeable = 0;
 
         if (PA_UNLIKELY(u->sink->thread_info.rewind_requested))
             pa_sink_process_rewind(u->sink, 0);
 
-        if (PA_SINK_IS_OPENED(u->sink->thread_info.state))
-            now = pa_rtclock_now();
-
-        if (u->connected &&
-                PA_STREAM_IS_GOOD(pa_stream_get_state(u->stream)) &&
-                PA_SINK_IS_OPENED(u->sink->thread_info.state)) {
-            /* TODO: use IS_RUNNING + cork stream */
-
-            if (pa_stream_is_corked(u->stream)) {
-                pa_stream_cork(u->stream, 0, NULL, NULL);
-            } else {
-                writeable = pa_stream_writable_size(u->stream);
-                if (writeable > 0) {
-                    if (u->memchunk.length <= 0)
-                        pa_sink_render(u->sink, writeable, &u->memchunk);
-
-                    pa_assert(u->memchunk.length > 0);
-
-
-                    /* we have new data to write */
-                    p = (const uint8_t *) pa_memblock_acquire(u->memchunk.memblock);
-                    ret = pa_stream_write(u->stream,
-                                        ((uint8_t*) p + u->memchunk.index),         /**< The data to write */
-                                        u->memchunk.length,            /**< The length of the data to write in bytes */
-                                        NULL,     /**< A cleanup routine for the data or NULL to request an internal copy */
-                                        0,          /**< Offset for seeking, must be 0 for upload streams */
-                                        PA_SEEK_RELATIVE      /**< Seek mode, must be PA_SEEK_RELATIVE for upload streams */
-                                        );
-                    pa_memblock_release(u->memchunk.memblock);
-                    pa_memblock_unref(u->memchunk.memblock);
-                    pa_memchunk_reset(&u->memchunk);
-
-                    if (ret != 0) {
-                        /* TODO: we should consider a state change or is that already done ? */
-                        pa_log_warn("Could not write data into the stream ... ret = %i", ret);
-                    }
-                }
-            }
-        }
         if ((ret = pa_rtpoll_run(u->rtpoll, TRUE)) < 0)
             goto fail;
 
         if (ret == 0)
             goto finish;
-
     }
+
 fail:
     /* If this was no regular exit from the loop we have to continue
      * processing messages until we received PA_MESSAGE_SHUTDOWN */
@@ -176,6 +165,13 @@ static void stream_state_callback(pa_stream *stream, void *userdata) {
     pa_assert(stream == u->stream);
 
     switch(pa_stream_get_state(stream)) {
+        case PA_STREAM_READY:
+            /* The sink might have changed its state while we connected */
+            if (!!pa_stream_is_corked(stream) == !!PA_SINK_IS_OPENED(pa_sink_get_state(u->sink)))
+                pa_stream_cork(stream, !PA_SINK_IS_OPENED(pa_sink_get_state(u->sink)), NULL, NULL);
+
+            pa_stream_update_timing_info(stream, NULL, NULL);
+            break;
         case PA_STREAM_FAILED:
             pa_log_debug("Context failed.");
             pa_stream_unref(stream);
@@ -192,6 +188,61 @@ static void stream_state_callback(pa_stream *stream, void *userdata) {
     }
 }
 
+/* Called from main context. The server grants credit with its requests,
+ * only that much is rendered and in as few blocks as possible. */
+static void stream_write_callback(pa_stream *stream, size_t nbytes, void *userdata) {
+    struct userdata *u = userdata;
+    size_t n;
+
+    pa_assert(u);
+    pa_assert(stream == u->stream);
+
+    if (nbytes <= u->in_flight)
+        return;
+
+    n = nbytes - u->in_flight;
+    u->in_flight += n;
+
+    pa_asyncmsgq_post(u->thread_mq.inq, PA_MSGOBJECT(u->sink), SINK_MESSAGE_REQUEST, NULL, (int64_t) n, NULL, NULL);
+}
+
+/* Called from main context */
+static void stream_latency_update_callback(pa_stream *stream, void *userdata) {
+    struct userdata *u = userdata;
+    pa_usec_t latency, played;
+    int negative;
+
+    pa_assert(u);
+    pa_assert(stream == u->stream);
+
+    if (pa_stream_get_latency(stream, &latency, &negative) < 0)
+        return;
+
+    /* Tell the IO thread how much of what we wrote has been played */
+    played = pa_bytes_to_usec((uint64_t) u->written, &u->sink->sample_spec);
+
+    if (negative)
+        played += latency;
+    else
+        played = played > latency ? played - latency : 0;
+
+    pa_asyncmsgq_send(u->thread_mq.inq, PA_MSGOBJECT(u->sink), SINK_MESSAGE_UPDATE_LATENCY, NULL, (int64_t) played, NULL);
+}
+
+/* Called from main context */
+static void timeout_callback(pa_mainloop_api *m, pa_time_event *e, const struct timeval *t, void *userdata) {
+    struct userdata *u = userdata;
+
+    pa_assert(m);
+    pa_assert(e);
+    pa_assert(u);
+
+    if (u->stream && pa_stream_get_state(u->stream) == PA_STREAM_READY)
+        pa_stream_update_timing_info(u->stream, NULL, NULL);
+
+    pa_core_rttime_restart(u->module->core, e, pa_rtclock_now() + LATENCY_INTERVAL);
+}
+
 static void context_state_callback(pa_context *c, void *userdata) {
     struct userdata *u = userdata;
 
@@ -233,10 +284,12 @@ static void context_state_callback(pa_context *c, void *userdata) {
             bufferattr.tlength = (uint32_t) - 1;
 
             pa_stream_set_state_callback(u->stream, stream_state_callback, userdata);
+            pa_stream_set_write_callback(u->stream, stream_write_callback, userdata);
+            pa_stream_set_latency_update_callback(u->stream, stream_latency_update_callback, userdata);
             pa_stream_connect_playback(u->stream,
                                        NULL,
                                        &bufferattr,
-                                       PA_STREAM_START_CORKED | PA_STREAM_AUTO_TIMING_UPDATE,
+                                       PA_SINK_IS_OPENED(pa_sink_get_state(u->sink)) ? 0 : PA_STREAM_START_CORKED,
                                        NULL,
                                        NULL);
 
@@ -261,39 +314,116 @@ static void context_state_callback(pa_context *c, void *userdata) {
     }
 }
 
+/* This function is called from IO context -- except when it is not. */
 static int sink_process_msg_cb(pa_msgobject *o, int code, void *data, int64_t offset, pa_memchunk *chunk) {
     struct userdata *u = PA_SINK(o)->userdata;
 
     switch (code) {
 
-        case PA_SINK_MESSAGE_GET_LATENCY: {
-            int negative;
-            pa_usec_t remote_latency;
+        case PA_SINK_MESSAGE_SET_STATE: {
+            int r;
 
-            if (!PA_SINK_IS_LINKED(u->sink->thread_info.state)) {
-                *((pa_usec_t*) data) = 0;
-                return 0;
-            }
+            if ((r = pa_sink_process_msg(o, code, data, offset, chunk)) >= 0) {
 
-            if(pa_stream_get_latency(u->stream, &remote_latency, &negative) < 0) {
-                *((pa_usec_t*) data) = 0;
-                return 0;
+                if (PA_SINK_IS_OPENED(u->sink->thread_info.state)) {
+                    pa_smoother_resume(u->smoother, pa_rtclock_now(), TRUE);
+                    send_data(u);
+                } else
+                    pa_smoother_pause(u->smoother, pa_rtclock_now());
             }
 
-            *((pa_usec_t*) data) =
-                /* Add the latency from libpulse */
-                remote_latency;
-                /* do we have to add more latency here ? */
+            return r;
+        }
+
+        case PA_SINK_MESSAGE_GET_LATENCY: {
+            pa_usec_t yl, yr, *usec = data;
+
+            yl = pa_bytes_to_usec((uint64_t) u->counter, &u->sink->sample_spec);
+            yr = pa_smoother_get(u->smoother, pa_rtclock_now());
+
+            *usec = yl > yr ? yl - yr : 0;
             return 0;
         }
+
         case SINK_MESSAGE_PASS_SOCKET: {
             u->connected = true;
             return 0;
         }
+
+        case SINK_MESSAGE_REQUEST:
+
+            pa_assert(offset > 0);
+            u->requested_bytes += (size_t) offset;
+
+            if (PA_SINK_IS_OPENED(u->sink->thread_info.state))
+                send_data(u);
+
+            return 0;
+
+        case SINK_MESSAGE_UPDATE_LATENCY:
+
+            pa_smoother_put(u->smoother, pa_rtclock_now(), (pa_usec_t) offset);
+            return 0;
+
+        case SINK_MESSAGE_POST: {
+            const void *p;
+
+            /* Delivered to us from the IO thread, but dispatched in the
+             * main context where libpulse lives */
+
+            u->in_flight -= PA_MIN(u->in_flight, chunk->length);
+
+            if (!u->stream || pa_stream_get_state(u->stream) != PA_STREAM_READY)
+                return 0;
+
+            p = pa_memblock_acquire(chunk->memblock);
+
+            if (pa_stream_write(u->stream, (const uint8_t*) p + chunk->index, chunk->length, NULL, 0, PA_SEEK_RELATIVE) < 0)
+                pa_log_warn("Could not write data into the stream.");
+            else
+                u->written += (int64_t) chunk->length;
+
+            pa_memblock_release(chunk->memblock);
+            return 0;
+        }
     }
+
     return pa_sink_process_msg(o, code, data, offset, chunk);
 }
 
+/* Called from main context */
+static int sink_set_state_cb(pa_sink *s, pa_sink_state_t state) {
+    struct userdata *u;
+
+    pa_sink_assert_ref(s);
+    u = s->userdata;
+
+    if (!u->stream || pa_stream_get_state(u->stream) != PA_STREAM_READY)
+        return 0;
+
+    switch ((pa_sink_state_t) state) {
+
+        case PA_SINK_SUSPENDED:
+            pa_stream_cork(u->stream, 1, NULL, NULL);
+            break;
+
+        case PA_SINK_IDLE:
+        case PA_SINK_RUNNING:
+            if (pa_stream_is_corked(u->stream)) {
+                pa_stream_cork(u->stream, 0, NULL, NULL);
+                pa_stream_update_timing_info(u->stream, NULL, NULL);
+            }
+            break;
+
+        case PA_SINK_UNLINKED:
+        case PA_SINK_INIT:
+        case PA_SINK_INVALID_STATE:
+            ;
+    }
+
+    return 0;
+}
+
 int pa__init(pa_module*m) {
     struct userdata *u = NULL;
     pa_modargs *ma = NULL;
@@ -329,6 +459,14 @@ int pa__init(pa_module*m) {
     pa_memchunk_reset(&u->memchunk);
     u->rtpoll = pa_rtpoll_new();
     pa_thread_mq_init(&u->thread_mq, m->core->mainloop, u->rtpoll);
+    u->smoother = pa_smoother_new(
+            PA_USEC_PER_SEC,
+            PA_USEC_PER_SEC*2,
+            TRUE,
+            TRUE,
+            10,
+            pa_rtclock_now(),
+            TRUE);
 
     /* Create sink */
     pa_sink_new_data_init(&sink_data);
@@ -360,6 +498,7 @@ int pa__init(pa_module*m) {
 
     /* callbacks */
     u->sink->parent.process_msg = sink_process_msg_cb;
+    u->sink->set_state = sink_set_state_cb;
 
 
     /* set thread queue */
@@ -400,6 +539,8 @@ int pa__init(pa_module*m) {
         goto fail;
     }
 
+    u->time_event = pa_core_rttime_new(m->core, pa_rtclock_now() + LATENCY_INTERVAL, timeout_callback, u);
+
     if (!(u->thread = pa_thread_new("tunnelstream-sink", thread_func, u))) {
         pa_log("Failed to create thread.");
         goto fail;
@@ -440,6 +581,9 @@ void pa__done(pa_module*m) {
 
     pa_thread_mq_done(&u->thread_mq);
 
+    if (u->time_event)
+        u->module->core->mainloop->time_free(u->time_event);
+
     if (u->stream)
         pa_stream_disconnect(u->stream);
 
@@ -455,5 +599,8 @@ void pa__done(pa_module*m) {
     if (u->sink)
         pa_sink_unref(u->sink);
 
+    if (u->smoother)
+        pa_smoother_free(u->smoother);
+
     pa_xfree(u);
 }
@@ -31,6 +31,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#if defined(TUNNEL_SINK) && defined(HAVE_OPUS)
+#include <opus_multistream.h>
+#endif
+
 #include <pulse/rtclock.h>
 #include <pulse/timeval.h>
 #include <pulse/util.h>
@@ -72,7 +76,9 @@ PA_MODULE_USAGE(
         "format=<sample format> "
         "channels=<number of channels> "
         "rate=<sample rate> "
-        "channel_map=<channel map>");
+        "channel_map=<channel map> "
+        "codec=<pcm or opus> "
+        "bitrate=<opus bitrate in bit/s>");
 #else
 PA_MODULE_DESCRIPTION("Tunnel module for sources");
 PA_MODULE_USAGE(
@@ -101,6 +107,8 @@ static const char* const valid_modargs[] = {
     "sink_name",
     "sink_properties",
     "sink",
+    "codec",
+    "bitrate",
 #else
     "source_name",
     "source_properties",
@@ -122,12 +130,19 @@ enum {
     SINK_MESSAGE_REQUEST = PA_SINK_MESSAGE_MAX,
     SINK_MESSAGE_REMOTE_SUSPEND,
     SINK_MESSAGE_UPDATE_LATENCY,
-    SINK_MESSAGE_POST
+    SINK_MESSAGE_POST,
+#ifdef HAVE_OPUS
+    SINK_MESSAGE_CODEC_READY
+#endif
 };
 
 #define DEFAULT_TLENGTH_MSEC 150
 #define DEFAULT_MINREQ_MSEC 25
 
+#define OPUS_FRAME_MSEC 20
+/* Worst case of one 20ms frame per stream, with self-delimiting framing */
+#define OPUS_STREAM_PACKET_MAX 1280
+
 #else
 
 enum {
@@ -142,6 +157,7 @@ enum {
 
 #ifdef TUNNEL_SINK
 static void command_request(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
+static void command_request_batch(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
 static void command_started(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
 #endif
 static void command_subscribe_event(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
@@ -155,6 +171,7 @@ static void command_stream_buffer_attr_changed(pa_pdispatch *pd, uint32_t comman
 static const pa_pdispatch_cb_t command_table[PA_COMMAND_MAX] = {
 #ifdef TUNNEL_SINK
     [PA_COMMAND_REQUEST] = command_request,
+    [PA_COMMAND_REQUEST_BATCH] = command_request_batch,
     [PA_COMMAND_STARTED] = command_started,
 #endif
     [PA_COMMAND_SUBSCRIBE_EVENT] = command_subscribe_event,
@@ -190,6 +207,19 @@ struct userdata {
     char *sink_name;
     pa_sink *sink;
     size_t requested_bytes;
+#ifdef HAVE_OPUS
+    OpusMSEncoder *opus_encoder;
+    int opus_streams, opus_coupled_streams;
+    unsigned char opus_mapping[PA_CHANNELS_MAX];
+    size_t opus_frame_bytes, opus_packet_max;
+    uint32_t codec_request; /* bytes requested on stream creation */
+    pa_usec_t codec_delay_usec; /* maintained in the main thread */
+
+    /* Only used in the IO thread */
+    pa_bool_t codec_pending, codec_active;
+    uint8_t *opus_pcm;
+    size_t opus_pcm_length;
+#endif
 #else
     char *source_name;
     pa_source *source;
@@ -459,15 +489,92 @@ static void stream_suspend_within_thread(struct userdata *u, pa_bool_t suspend)
 
 #ifdef TUNNEL_SINK
 
+#ifdef HAVE_OPUS
+/* Called from IO thread context */
+static void encode_frame(struct userdata *u) {
+    const pa_sample_spec *ss = &u->sink->sample_spec;
+    int frames = (int) (u->opus_frame_bytes / pa_frame_size(ss));
+    pa_memchunk memchunk;
+    uint8_t *d;
+    opus_int32 r;
+
+    memchunk.memblock = pa_memblock_new(u->core->mempool, 2 + u->opus_packet_max);
+    memchunk.index = 0;
+
+    d = pa_memblock_acquire(memchunk.memblock);
+
+    if (ss->format == PA_SAMPLE_FLOAT32NE)
+        r = opus_multistream_encode_float(u->opus_encoder, (const float*) u->opus_pcm, frames, d + 2, (opus_int32) u->opus_packet_max);
+    else
+        r = opus_multistream_encode(u->opus_encoder, (const opus_int16*) u->opus_pcm, frames, d + 2, (opus_int32) u->opus_packet_max);
+
+    if (r > 0) {
+        d[0] = (uint8_t) (r >> 8);
+        d[1] = (uint8_t) r;
+    }
+
+    pa_memblock_release(memchunk.memblock);
+
+    if (r > 0) {
+        memchunk.length = 2 + (size_t) r;
+
+        /* The offset tells the main thread how much audio this is */
+        pa_asyncmsgq_post(u->thread_mq.outq, PA_MSGOBJECT(u->sink), SINK_MESSAGE_POST, NULL, (int64_t) u->opus_frame_bytes, &memchunk, NULL);
+    } else
+        pa_log_debug("Failed to encode Opus frame: %s", opus_strerror(r));
+
+    pa_memblock_unref(memchunk.memblock);
+}
+
+/* Called from IO thread context */
+static void encode_data(struct userdata *u, const pa_memchunk *memchunk) {
+    const uint8_t *d;
+    size_t n;
+
+    d = (const uint8_t*) pa_memblock_acquire(memchunk->memblock) + memchunk->index;
+    n = memchunk->length;
+
+    while (n > 0) {
+        size_t l;
+
+        l = PA_MIN(n, u->opus_frame_bytes - u->opus_pcm_length);
+        memcpy(u->opus_pcm + u->opus_pcm_length, d, l);
+        u->opus_pcm_length += l;
+        d += l;
+        n -= l;
+
+        if (u->opus_pcm_length == u->opus_frame_bytes) {
+            encode_frame(u);
+            u->opus_pcm_length = 0;
+        }
+    }
+
+    pa_memblock_release(memchunk->memblock);
+}
+#endif
+
 /* Called from IO thread context */
 static void send_data(struct userdata *u) {
     pa_assert(u);
 
+#ifdef HAVE_OPUS
+    /* Hold the data back until we know how the server wants it */
+    if (u->codec_pending)
+        return;
+#endif
+
     while (u->requested_bytes > 0) {
         pa_memchunk memchunk;
 
         pa_sink_render(u->sink, u->requested_bytes, &memchunk);
-        pa_asyncmsgq_post(u->thread_mq.outq, PA_MSGOBJECT(u->sink), SINK_MESSAGE_POST, NULL, 0, &memchunk, NULL);
+
+#ifdef HAVE_OPUS
+        if (u->codec_active)
+            encode_data(u, &memchunk);
+        else
+#endif
+            pa_asyncmsgq_post(u->thread_mq.outq, PA_MSGOBJECT(u->sink), SINK_MESSAGE_POST, NULL, (int64_t) memchunk.length, &memchunk, NULL);
+
         pa_memblock_unref(memchunk.memblock);
 
         u->requested_bytes -= memchunk.length;
@@ -527,6 +634,11 @@ static int sink_process_msg(pa_msgobject *o, int code, void *data, int64_t offse
 
             y = pa_bytes_to_usec((uint64_t) u->counter, &u->sink->sample_spec);
 
+#ifdef HAVE_OPUS
+            /* What waits for a complete Opus frame hasn't been sent yet */
+            offset += (int64_t) pa_bytes_to_usec((uint64_t) u->opus_pcm_length, &u->sink->sample_spec);
+#endif
+
             if (y > (pa_usec_t) offset)
                 y -= (pa_usec_t) offset;
             else
@@ -549,9 +661,22 @@ static int sink_process_msg(pa_msgobject *o, int code, void *data, int64_t offse
 
             pa_pstream_send_memblock(u->pstream, u->channel, 0, PA_SEEK_RELATIVE, chunk);
 
-            u->counter_delta += (int64_t) chunk->length;
+            /* offset is the length of the uncompressed data */
+            u->counter_delta += offset;
+
+            return 0;
+
+#ifdef HAVE_OPUS
+        case SINK_MESSAGE_CODEC_READY:
+
+            u->codec_pending = FALSE;
+            u->codec_active = !!PA_PTR_TO_UINT(data);
+
+            if (PA_SINK_IS_OPENED(u->sink->thread_info.state))
+                send_data(u);
 
             return 0;
+#endif
     }
 
     return pa_sink_process_msg(o, code, data, offset, chunk);
@@ -747,6 +872,36 @@ fail:
     pa_module_unload_request(u->module, TRUE);
 }
 
+/* Called from main context */
+static void command_request_batch(pa_pdispatch *pd, uint32_t command,  uint32_t tag, pa_tagstruct *t, void *userdata) {
+    struct userdata *u = userdata;
+
+    pa_assert(pd);
+    pa_assert(command == PA_COMMAND_REQUEST_BATCH);
+    pa_assert(t);
+    pa_assert(u);
+    pa_assert(u->pdispatch == pd);
+
+    while (!pa_tagstruct_eof(t)) {
+        uint32_t bytes, channel;
+
+        if (pa_tagstruct_getu32(t, &channel) < 0 ||
+            pa_tagstruct_getu32(t, &bytes) < 0) {
+            pa_log("Invalid protocol reply");
+            pa_module_unload_request(u->module, TRUE);
+            return;
+        }
+
+        if (channel != u->channel) {
+            pa_log("Received data for invalid channel");
+            pa_module_unload_request(u->module, TRUE);
+            return;
+        }
+
+        pa_asyncmsgq_post(u->sink->asyncmsgq, PA_MSGOBJECT(u->sink), SINK_MESSAGE_REQUEST, NULL, bytes, NULL, NULL);
+    }
+}
+
 #endif
 
 /* Called from main context */
@@ -819,6 +974,11 @@ static void stream_get_latency_callback(pa_pdispatch *pd, uint32_t command, uint
 #ifdef TUNNEL_SINK
     delay = (int64_t) sink_usec;
     ss = &u->sink->sample_spec;
+
+#ifdef HAVE_OPUS
+    /* The decoder lags behind what we encoded by the codec delay */
+    delay += (int64_t) u->codec_delay_usec;
+#endif
 #else
     delay = (int64_t) source_usec;
     ss = &u->source->sample_spec;
@@ -1433,6 +1593,75 @@ static void start_subscribe(struct userdata *u) {
     pa_pstream_send_tagstruct(u->pstream, t);
 }
 
+#if defined(TUNNEL_SINK) && defined(HAVE_OPUS)
+/* Called from main context */
+static void codec_callback(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    struct userdata *u = userdata;
+    pa_bool_t active = FALSE;
+
+    pa_assert(pd);
+    pa_assert(u);
+    pa_assert(u->pdispatch == pd);
+
+    if (command == PA_COMMAND_REPLY) {
+        opus_int32 lookahead = 0;
+
+        if (!pa_tagstruct_eof(t)) {
+            pa_log("Invalid reply. (Set codec)");
+            pa_module_unload_request(u->module, TRUE);
+            return;
+        }
+
+        opus_multistream_encoder_ctl(u->opus_encoder, OPUS_GET_LOOKAHEAD(&lookahead));
+        u->codec_delay_usec = pa_bytes_to_usec((uint64_t) lookahead * pa_frame_size(&u->sink->sample_spec), &u->sink->sample_spec);
+
+        pa_log_info("Sending Opus compressed audio, codec delay is %0.2f ms.", (double) u->codec_delay_usec / PA_USEC_PER_MSEC);
+        active = TRUE;
+
+    } else if (command == PA_COMMAND_ERROR)
+        pa_log_info("Server doesn't accept Opus, sending uncompressed audio.");
+    else {
+        pa_log("Protocol error.");
+        pa_module_unload_request(u->module, TRUE);
+        return;
+    }
+
+    pa_asyncmsgq_post(u->sink->asyncmsgq, PA_MSGOBJECT(u->sink), SINK_MESSAGE_CODEC_READY, PA_UINT_TO_PTR(active), 0, NULL, NULL);
+    pa_asyncmsgq_post(u->sink->asyncmsgq, PA_MSGOBJECT(u->sink), SINK_MESSAGE_REQUEST, NULL, u->codec_request, NULL, NULL);
+}
+
+/* Called from main context */
+static void request_codec(struct userdata *u, uint32_t bytes) {
+    pa_tagstruct *t;
+    uint32_t tag;
+
+    pa_assert(u);
+    pa_assert(u->opus_encoder);
+
+    if (u->version < 30) {
+        pa_log_info("Server is too old for compressed audio, sending uncompressed audio.");
+
+        pa_asyncmsgq_post(u->sink->asyncmsgq, PA_MSGOBJECT(u->sink), SINK_MESSAGE_CODEC_READY, PA_UINT_TO_PTR(FALSE), 0, NULL, NULL);
+        pa_asyncmsgq_post(u->sink->asyncmsgq, PA_MSGOBJECT(u->sink), SINK_MESSAGE_REQUEST, NULL, bytes, NULL, NULL);
+        return;
+    }
+
+    u->codec_request = bytes;
+
+    t = pa_tagstruct_new(NULL, 0);
+    pa_tagstruct_putu32(t, PA_COMMAND_SET_PLAYBACK_STREAM_CODEC);
+    pa_tagstruct_putu32(t, tag = u->ctag++);
+    pa_tagstruct_putu32(t, u->channel);
+    pa_tagstruct_puts(t, "opus");
+    pa_tagstruct_putu8(t, (uint8_t) u->opus_streams);
+    pa_tagstruct_putu8(t, (uint8_t) u->opus_coupled_streams);
+    pa_tagstruct_put_arbitrary(t, u->opus_mapping, u->sink->sample_spec.channels);
+    pa_pstream_send_tagstruct(u->pstream, t);
+
+    pa_pdispatch_register_reply(u->pdispatch, tag, DEFAULT_TIMEOUT, codec_callback, u, NULL);
+}
+#endif
+
 /* Called from main context */
 static void create_stream_callback(pa_pdispatch *pd, uint32_t command,  uint32_t tag, pa_tagstruct *t, void *userdata) {
     struct userdata *u = userdata;
@@ -1535,6 +1764,13 @@ static void create_stream_callback(pa_pdispatch *pd, uint32_t command,  uint32_t
     pa_log_debug("Stream created.");
 
 #ifdef TUNNEL_SINK
+#ifdef HAVE_OPUS
+    if (u->opus_encoder) {
+        request_codec(u, bytes);
+        return;
+    }
+#endif
+
     pa_asyncmsgq_post(u->sink->asyncmsgq, PA_MSGOBJECT(u->sink), SINK_MESSAGE_REQUEST, NULL, bytes, NULL, NULL);
 #endif
 
@@ -1632,6 +1868,12 @@ static void setup_complete_callback(pa_pdispatch *pd, uint32_t command, uint32_t
     u->tlength = (uint32_t) pa_usec_to_bytes(PA_USEC_PER_MSEC * DEFAULT_TLENGTH_MSEC, &u->sink->sample_spec);
     u->minreq = (uint32_t) pa_usec_to_bytes(PA_USEC_PER_MSEC * DEFAULT_MINREQ_MSEC, &u->sink->sample_spec);
     u->prebuf = u->tlength;
+#ifdef HAVE_OPUS
+    /* A partial Opus frame is held back until it is complete, so don't
+     * let the server wait for a completely filled buffer */
+    if (u->opus_encoder)
+        u->prebuf -= (uint32_t) u->opus_frame_bytes;
+#endif
 #else
     u->fragsize = (uint32_t) pa_usec_to_bytes(PA_USEC_PER_MSEC * DEFAULT_FRAGSIZE_MSEC, &u->source->sample_spec);
 #endif
@@ -1903,6 +2145,10 @@ int pa__init(pa_module*m) {
     char *dn = NULL;
 #ifdef TUNNEL_SINK
     pa_sink_new_data data;
+    const char *codec;
+#ifdef HAVE_OPUS
+    pa_bool_t opus = FALSE;
+#endif
 #else
     pa_source_new_data data;
 #endif
@@ -1963,6 +2209,57 @@ int pa__init(pa_module*m) {
         goto fail;
     }
 
+#ifdef TUNNEL_SINK
+    if ((codec = pa_modargs_get_value(ma, "codec", NULL)) && !pa_streq(codec, "pcm")) {
+        if (!pa_streq(codec, "opus")) {
+            pa_log("Unsupported codec %s.", codec);
+            goto fail;
+        }
+
+#ifdef HAVE_OPUS
+        opus = TRUE;
+#else
+        pa_log("Opus support not available.");
+        goto fail;
+#endif
+    }
+
+#ifdef HAVE_OPUS
+    if (opus) {
+        uint32_t bitrate = 0;
+        int err;
+
+        if (ss.format != PA_SAMPLE_FLOAT32NE && ss.format != PA_SAMPLE_S16NE)
+            ss.format = PA_SAMPLE_FLOAT32NE;
+
+        if (ss.rate != 8000 && ss.rate != 12000 && ss.rate != 16000 && ss.rate != 24000 && ss.rate != 48000)
+            ss.rate = 48000;
+
+        if (pa_modargs_get_value_u32(ma, "bitrate", &bitrate) < 0 || (bitrate > 0 && (bitrate < 500 || bitrate > 512000 * ss.channels))) {
+            pa_log("Invalid bitrate.");
+            goto fail;
+        }
+
+        /* Without knowing the channel order, code the channels separately
+         * for more than two */
+        if (!(u->opus_encoder = opus_multistream_surround_encoder_create((opus_int32) ss.rate, ss.channels, ss.channels > 2 ? 255 : 0,
+                                                                         &u->opus_streams, &u->opus_coupled_streams, u->opus_mapping,
+                                                                         OPUS_APPLICATION_AUDIO, &err))) {
+            pa_log("Failed to create Opus encoder: %s", opus_strerror(err));
+            goto fail;
+        }
+
+        if (bitrate > 0)
+            opus_multistream_encoder_ctl(u->opus_encoder, OPUS_SET_BITRATE((opus_int32) bitrate));
+
+        u->opus_frame_bytes = pa_usec_to_bytes(OPUS_FRAME_MSEC * PA_USEC_PER_MSEC, &ss);
+        u->opus_packet_max = OPUS_STREAM_PACKET_MAX * (size_t) u->opus_streams;
+        u->opus_pcm = pa_xmalloc(u->opus_frame_bytes);
+        u->codec_pending = TRUE;
+    }
+#endif
+#endif
+
     if (!(u->client = pa_socket_client_new_string(m->core->mainloop, TRUE, u->server_name, PA_NATIVE_DEFAULT_PORT))) {
         pa_log("Failed to connect to server '%s'", u->server_name);
         goto fail;
@@ -2154,6 +2451,12 @@ void pa__done(pa_module*m) {
 #endif
 
 #ifdef TUNNEL_SINK
+#ifdef HAVE_OPUS
+    if (u->opus_encoder)
+        opus_multistream_encoder_destroy(u->opus_encoder);
+    pa_xfree(u->opus_pcm);
+#endif
+
     pa_xfree(u->sink_name);
 #else
     pa_xfree(u->source_name);
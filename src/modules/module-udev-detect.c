@@ -37,6 +37,13 @@
 #include <pulsecore/namereg.h>
 #include <pulsecore/ratelimit.h>
 #include <pulsecore/strbuf.h>
+#include <pulsecore/strlist.h>
+#include <pulsecore/thread.h>
+#include <pulsecore/llist.h>
+
+#ifdef HAVE_ALSA
+#include "alsa/alsa-util.h"
+#endif
 
 #include "module-udev-detect-symdef.h"
 
@@ -59,6 +66,10 @@ struct device {
     char *args;
     uint32_t module;
     pa_ratelimit ratelimit;
+
+    /* The card showed up while we were running, so whatever was cached
+     * about it from a previous run may be out of date */
+    pa_bool_t reprobe;
 };
 
 struct userdata {
@@ -337,11 +348,20 @@ static void verify_access(struct userdata *u, struct device *d) {
                  * failure or a "fatal" failure. */
 
                 if (pa_ratelimit_test(&d->ratelimit, PA_LOG_DEBUG)) {
-                    pa_log_debug("Loading module-alsa-card with arguments '%s'", d->args);
-                    m = pa_module_load(u->core, "module-alsa-card", d->args);
+                    char *args;
+
+                    if (d->reprobe)
+                        args = pa_sprintf_malloc("%s reprobe=yes", d->args);
+                    else
+                        args = pa_xstrdup(d->args);
+
+                    pa_log_debug("Loading module-alsa-card with arguments '%s'", args);
+                    m = pa_module_load(u->core, "module-alsa-card", args);
+                    pa_xfree(args);
 
                     if (m) {
                         d->module = m->index;
+                        d->reprobe = FALSE;
                         pa_log_info("Card %s (%s) module loaded.", d->path, d->card_name);
                     } else
                         pa_log_info("Card %s (%s) failed to load module.", d->path, d->card_name);
@@ -366,7 +386,7 @@ static void verify_access(struct userdata *u, struct device *d) {
     }
 }
 
-static void card_changed(struct userdata *u, struct udev_device *dev) {
+static void card_changed(struct userdata *u, struct udev_device *dev, pa_bool_t hotplug) {
     struct device *d;
     const char *path;
     const char *t;
@@ -389,6 +409,7 @@ static void card_changed(struct userdata *u, struct udev_device *dev) {
     d = pa_xnew0(struct device, 1);
     d->path = pa_xstrdup(path);
     d->module = PA_INVALID_INDEX;
+    d->reprobe = hotplug;
     PA_INIT_RATELIMIT(d->ratelimit, 10*PA_USEC_PER_SEC, 5);
 
     if (!(t = udev_device_get_property_value(dev, "PULSE_NAME")))
@@ -469,7 +490,7 @@ static void process_device(struct userdata *u, struct udev_device *dev) {
     if (action && pa_streq(action, "remove"))
         remove_card(u, dev);
     else if ((!action || pa_streq(action, "change")) && udev_device_get_property_value(dev, "SOUND_INITIALIZED"))
-        card_changed(u, dev);
+        card_changed(u, dev, !!action);
 
     /* For an explanation why we don't look for 'add' events here
      * have a look into /lib/udev/rules.d/78-sound-card.rules! */
@@ -490,6 +511,134 @@ static void process_path(struct userdata *u, const char *path) {
     udev_device_unref(dev);
 }
 
+#ifdef HAVE_ALSA
+
+/* Loading module-alsa-card blocks until all profiles of the card have
+ * been probed. When we start up with many cards we hence probe them all
+ * concurrently first and hand the results to module-alsa-card, which
+ * then only has to create the card and its sinks and sources on the
+ * main thread. */
+
+struct probe {
+    char *device_id;
+    char *profile_set_name;
+    pa_alsa_profile_set *profile_set;
+    pa_thread *thread;
+    const pa_core *core;
+
+    PA_LLIST_FIELDS(struct probe);
+};
+
+static void probe_thread(void *userdata) {
+    struct probe *p = userdata;
+
+    /* The core defaults are not changed while we are running */
+    pa_alsa_profile_set_probe(p->profile_set, p->device_id,
+                              &p->core->default_sample_spec,
+                              p->core->default_n_fragments,
+                              p->core->default_fragment_size_msec);
+}
+
+static struct probe *probe_new(struct userdata *u, const char *path) {
+    struct udev_device *dev;
+    struct probe *p = NULL;
+    const char *id, *t;
+    char *cd;
+
+    if (!(id = path_get_card_id(path)))
+        return NULL;
+
+    if (!(dev = udev_device_new_from_syspath(u->udev, path)))
+        return NULL;
+
+    /* Same checks as for loading the module, see process_device() and
+     * verify_access() */
+    if (udev_device_get_property_value(dev, "PULSE_IGNORE") ||
+        ((t = udev_device_get_property_value(dev, "SOUND_CLASS")) && pa_streq(t, "modem")) ||
+        !udev_device_get_property_value(dev, "SOUND_INITIALIZED"))
+        goto finish;
+
+    cd = pa_sprintf_malloc("/dev/snd/controlC%s", id);
+    if (access(cd, R_OK|W_OK) < 0 || is_card_busy(id)) {
+        pa_xfree(cd);
+        goto finish;
+    }
+    pa_xfree(cd);
+
+    p = pa_xnew0(struct probe, 1);
+    p->device_id = pa_xstrdup(id);
+    p->profile_set_name = pa_xstrdup(udev_device_get_property_value(dev, "PULSE_PROFILE_SET"));
+    p->core = u->core;
+
+    if (!(p->profile_set = pa_alsa_profile_set_new(p->profile_set_name, &u->core->default_channel_map)))
+        goto fail;
+
+    p->profile_set->ignore_dB = u->ignore_dB;
+    p->profile_set->probe_cache = TRUE;
+
+    if (!(p->thread = pa_thread_new("alsa-probe", probe_thread, p))) {
+        pa_alsa_profile_set_free(p->profile_set);
+        goto fail;
+    }
+
+    goto finish;
+
+fail:
+    pa_xfree(p->device_id);
+    pa_xfree(p->profile_set_name);
+    pa_xfree(p);
+    p = NULL;
+
+finish:
+    udev_device_unref(dev);
+    return p;
+}
+
+/* Returns the ids of the cards we probed */
+static pa_strlist *probe_cards(struct userdata *u, struct udev_list_entry *first) {
+    PA_LLIST_HEAD(struct probe, probes);
+    struct udev_list_entry *item;
+    struct probe *p;
+    pa_strlist *ids = NULL;
+
+    PA_LLIST_HEAD_INIT(struct probe, probes);
+
+    udev_list_entry_foreach(item, first)
+        if ((p = probe_new(u, udev_list_entry_get_name(item))))
+            PA_LLIST_PREPEND(struct probe, probes, p);
+
+    while ((p = probes)) {
+        PA_LLIST_REMOVE(struct probe, probes, p);
+
+        pa_thread_free(p->thread);
+
+        pa_alsa_profile_set_stash(u->core, p->device_id, p->profile_set_name, p->profile_set);
+        ids = pa_strlist_prepend(ids, p->device_id);
+
+        pa_xfree(p->device_id);
+        pa_xfree(p->profile_set_name);
+        pa_xfree(p);
+    }
+
+    return ids;
+}
+
+/* Drops whatever module-alsa-card did not pick up */
+static void probe_cards_done(struct userdata *u, pa_strlist *ids) {
+    char *id;
+
+    while ((ids = pa_strlist_pop(ids, &id))) {
+        pa_alsa_profile_set *ps;
+
+        if ((ps = pa_alsa_profile_set_unstash(u->core, id, NULL, u->ignore_dB)))
+            pa_alsa_profile_set_free(ps);
+
+        pa_xfree(id);
+    }
+}
+
+#endif
+
 static void monitor_cb(
         pa_mainloop_api*a,
         pa_io_event* e,
@@ -687,6 +836,9 @@ int pa__init(pa_module *m) {
     pa_modargs *ma;
     struct udev_enumerate *enumerate = NULL;
     struct udev_list_entry *item = NULL, *first = NULL;
+#ifdef HAVE_ALSA
+    pa_strlist *probed;
+#endif
     int fd;
     pa_bool_t use_tsched = TRUE, fixed_latency_range = FALSE, ignore_dB = FALSE, deferred_volume = m->core->deferred_volume;
     bool use_ucm = true;
@@ -793,9 +945,20 @@ int pa__init(pa_module *m) {
     }
 
     first = udev_enumerate_get_list_entry(enumerate);
+
+#ifdef HAVE_ALSA
+    pa_alsa_refcnt_inc();
+    probed = probe_cards(u, first);
+#endif
+
     udev_list_entry_foreach(item, first)
         process_path(u, udev_list_entry_get_name(item));
 
+#ifdef HAVE_ALSA
+    probe_cards_done(u, probed);
+    pa_alsa_refcnt_dec();
+#endif
+
     udev_enumerate_unref(enumerate);
 
     pa_log_info("Found %u cards.", pa_hashmap_size(u->devices));
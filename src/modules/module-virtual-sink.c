@@ -70,6 +70,8 @@ struct userdata {
 
     pa_bool_t auto_desc;
     unsigned channels;
+
+    size_t silence_tail, silence_bytes;
 };
 
 static const char* const valid_modargs[] = {
@@ -192,8 +194,10 @@ static void sink_set_mute_cb(pa_sink *s) {
     pa_sink_input_set_mute(u->sink_input, s->muted, s->save_muted);
 }
 
-/* Called from I/O thread context */
-static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk) {
+/* Called from I/O thread context. Processes up to nbytes into chunk. If
+ * into is TRUE chunk describes memory we shall write to, otherwise a new
+ * block is allocated. */
+static void process_chunk(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk, pa_bool_t into) {
     struct userdata *u;
     float *src, *dst;
     size_t fs;
@@ -201,8 +205,6 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk
     pa_memchunk tchunk;
     pa_usec_t current_latency PA_GCC_UNUSED;
 
-    pa_sink_input_assert_ref(i);
-    pa_assert(chunk);
     pa_assert_se(u = i->userdata);
 
     /* Hmm, process any rewind request that might be queued up */
@@ -230,14 +232,35 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk
 
     pa_assert(n > 0);
 
-    chunk->index = 0;
+    /* ONCE THE INPUT HAS BEEN SILENT FOR LONGER THAN YOUR FILTER
+     * REMEMBERS THE OUTPUT IS SILENT TOO, SO WE PASS ON THE SHARED
+     * SILENCE BLOCK WITHOUT PROCESSING ANYTHING. SEE (9) */
+    if (!pa_memblock_is_silence(tchunk.memblock))
+        u->silence_bytes = 0;
+    else if (u->silence_bytes >= u->silence_tail) {
+        pa_memblock_unref(tchunk.memblock);
+
+        if (into) {
+            chunk->length = n*fs;
+            pa_silence_memchunk(chunk, &i->sample_spec);
+        } else
+            pa_silence_memchunk_get(&i->sink->core->silence_cache, i->sink->core->mempool, chunk, &i->sample_spec, n*fs);
+
+        pa_memblockq_drop(u->memblockq, chunk->length);
+        return;
+    } else
+        u->silence_bytes += n*fs;
+
+    if (!into) {
+        chunk->index = 0;
+        chunk->memblock = pa_memblock_new(i->sink->core->mempool, n*fs);
+    }
     chunk->length = n*fs;
-    chunk->memblock = pa_memblock_new(i->sink->core->mempool, chunk->length);
 
     pa_memblockq_drop(u->memblockq, chunk->length);
 
     src = pa_memblock_acquire_chunk(&tchunk);
-    dst = pa_memblock_acquire(chunk->memblock);
+    dst = pa_memblock_acquire_chunk(chunk);
 
     /* (3) PUT YOUR CODE HERE TO DO SOMETHING WITH THE DATA */
 
@@ -261,7 +284,25 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk
 
         /* Add the latency internal to our sink input on top */
         pa_bytes_to_usec(pa_memblockq_get_length(i->thread_info.render_memblockq), &i->sink->sample_spec);
+}
 
+/* Called from I/O thread context */
+static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk) {
+    pa_sink_input_assert_ref(i);
+    pa_assert(chunk);
+
+    process_chunk(i, nbytes, chunk, FALSE);
+    return 0;
+}
+
+/* Called from I/O thread context. Used instead of pop() when our output
+ * can go to the master sink unmodified, which then hands us its own
+ * buffer to write to. */
+static int sink_input_pop_into_cb(pa_sink_input *i, pa_memchunk *target) {
+    pa_sink_input_assert_ref(i);
+    pa_assert(target);
+
+    process_chunk(i, target->length, target, TRUE);
     return 0;
 }
 
@@ -284,6 +325,7 @@ static void sink_input_process_rewind_cb(pa_sink_input *i, size_t nbytes) {
             pa_memblockq_seek(u->memblockq, - (int64_t) amount, PA_SEEK_RELATIVE, TRUE);
 
             /* (5) PUT YOUR CODE HERE TO RESET YOUR FILTER  */
+            u->silence_bytes = 0;
         }
     }
 
@@ -586,6 +628,7 @@ int pa__init(pa_module*m) {
         goto fail;
 
     u->sink_input->pop = sink_input_pop_cb;
+    u->sink_input->pop_into = sink_input_pop_into_cb;
     u->sink_input->process_rewind = sink_input_process_rewind_cb;
     u->sink_input->update_max_rewind = sink_input_update_max_rewind_cb;
     u->sink_input->update_max_request = sink_input_update_max_request_cb;
@@ -608,6 +651,11 @@ int pa__init(pa_module*m) {
 
     /* (9) INITIALIZE ANYTHING ELSE YOU NEED HERE */
 
+    /* This is how many bytes of silent input it takes until your
+     * filter produces silence. Copying the data has no history at
+     * all. */
+    u->silence_tail = 0;
+
     pa_sink_put(u->sink);
     pa_sink_input_put(u->sink_input);
 
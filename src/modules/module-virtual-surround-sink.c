@@ -43,6 +43,10 @@
 
 #include <math.h>
 
+#ifdef HAVE_FFTW
+#include "fftw-plan-cache.h"
+#endif
+
 #include "module-virtual-surround-sink-symdef.h"
 
 PA_MODULE_AUTHOR("Niels Ole Salscheider");
@@ -64,6 +68,14 @@ PA_MODULE_USAGE(
 
 #define MEMBLOCKQ_MAXLENGTH (16*1024*1024)
 
+/* Impulse responses up to this length are folded directly in the time
+ * domain, longer ones are convolved block-wise via FFT */
+#define TIME_DOMAIN_MAX_SAMPLES 32
+
+/* Partition length of the FFT convolution, which is also the latency that
+ * it adds */
+#define FFT_BLOCK_MAX 128
+
 struct userdata {
     pa_module *module;
 
@@ -89,6 +101,41 @@ struct userdata {
 
     float *input_buffer;
     int input_buffer_offset;
+
+    /* Once the input buffer holds nothing but silence we don't need to
+     * fold it anymore */
+    size_t silence_tail, silence_bytes;
+
+    /* Latency added by the convolution, in bytes of the sink */
+    size_t filter_latency;
+
+#ifdef HAVE_FFTW
+    /* Uniformly partitioned overlap-save convolution: the impulse response
+     * is cut into partitions of fft_block samples whose spectra are
+     * multiplied with the spectra of the last fft_partitions input blocks */
+    pa_bool_t use_fft;
+    unsigned fft_block, fft_partitions, fft_bins;
+
+    float *fft_time;
+    fftwf_complex *fft_freq;
+    pa_fftw_plan_cache *plan_cache;
+    fftwf_plan forward_plan, inverse_plan;
+
+    /* [ear][channel][partition][bin], already scaled for the inverse FFT */
+    fftwf_complex *hrir_spectra;
+
+    /* Spectra of the most recent input blocks, [channel][slot][bin] with
+     * the newest one at slot fdl_position */
+    fftwf_complex *fdl;
+    unsigned fdl_position;
+
+    /* Previous and current input block of each channel, and the stereo
+     * output of the previous block which is played while the current one
+     * is being filled */
+    float *fft_window;
+    float *fft_output;
+    unsigned fft_fill;
+#endif
 };
 
 static const char* const valid_modargs[] = {
@@ -128,7 +175,10 @@ static int sink_process_msg_cb(pa_msgobject *o, int code, void *data, int64_t of
                 pa_sink_get_latency_within_thread(u->sink_input->sink) +
 
                 /* Add the latency internal to our sink input on top */
-                pa_bytes_to_usec(pa_memblockq_get_length(u->sink_input->thread_info.render_memblockq), &u->sink_input->sink->sample_spec);
+                pa_bytes_to_usec(pa_memblockq_get_length(u->sink_input->thread_info.render_memblockq), &u->sink_input->sink->sample_spec) +
+
+                /* And the delay of the convolution itself */
+                pa_bytes_to_usec(u->filter_latency, &u->sink->sample_spec);
 
             return 0;
     }
@@ -213,6 +263,122 @@ static void sink_set_mute_cb(pa_sink *s) {
     pa_sink_input_set_mute(u->sink_input, s->muted, s->save_muted);
 }
 
+/* Called from I/O thread context */
+static void convolve_time_domain(struct userdata *u, const float *src, float *dst, unsigned n) {
+    unsigned j, k, l;
+    float sum_right, sum_left;
+    float current_sample;
+
+    for (l = 0; l < n; l++) {
+        memcpy(((char*) u->input_buffer) + u->input_buffer_offset * u->sink_fs, ((const char *) src) + l * u->sink_fs, u->sink_fs);
+
+        sum_right = 0;
+        sum_left = 0;
+
+        /* fold the input buffer with the impulse response */
+        for (j = 0; j < u->hrir_samples; j++) {
+            for (k = 0; k < u->channels; k++) {
+                current_sample = u->input_buffer[((u->input_buffer_offset + j) % u->hrir_samples) * u->channels + k];
+
+                sum_left += current_sample * u->hrir_data[j * u->hrir_channels + u->mapping_left[k]];
+                sum_right += current_sample * u->hrir_data[j * u->hrir_channels + u->mapping_right[k]];
+            }
+        }
+
+        dst[2 * l] = PA_CLAMP_UNLIKELY(sum_left, -1.0f, 1.0f);
+        dst[2 * l + 1] = PA_CLAMP_UNLIKELY(sum_right, -1.0f, 1.0f);
+
+        u->input_buffer_offset--;
+        if (u->input_buffer_offset < 0)
+            u->input_buffer_offset += u->hrir_samples;
+    }
+}
+
+#ifdef HAVE_FFTW
+/* Called from I/O thread context */
+static void fft_process_block(struct userdata *u) {
+    unsigned ear, k, p, b;
+    unsigned block = u->fft_block, partitions = u->fft_partitions, bins = u->fft_bins;
+
+    /* Transform the window of every channel into a new slot of the
+     * delay line, then slide the window by one block */
+    for (k = 0; k < u->channels; k++) {
+        float *window = u->fft_window + 2 * block * k;
+
+        memcpy(u->fft_time, window, 2 * block * sizeof(float));
+        fftwf_execute_dft_r2c(u->forward_plan, u->fft_time, u->fft_freq);
+        memcpy(u->fdl + (k * partitions + u->fdl_position) * bins, u->fft_freq, bins * sizeof(fftwf_complex));
+
+        memcpy(window, window + block, block * sizeof(float));
+    }
+
+    for (ear = 0; ear < 2; ear++) {
+        fftwf_complex *acc = u->fft_freq;
+
+        memset(acc, 0, bins * sizeof(fftwf_complex));
+
+        /* Partition p of the impulse response meets the input block from p
+         * blocks ago, all channels are summed up in the frequency domain */
+        for (k = 0; k < u->channels; k++) {
+            for (p = 0; p < partitions; p++) {
+                const fftwf_complex *x = u->fdl + (k * partitions + (u->fdl_position + p) % partitions) * bins;
+                const fftwf_complex *h = u->hrir_spectra + ((ear * u->channels + k) * partitions + p) * bins;
+
+                for (b = 0; b < bins; b++) {
+                    acc[b][0] += x[b][0] * h[b][0] - x[b][1] * h[b][1];
+                    acc[b][1] += x[b][0] * h[b][1] + x[b][1] * h[b][0];
+                }
+            }
+        }
+
+        fftwf_execute_dft_c2r(u->inverse_plan, u->fft_freq, u->fft_time);
+
+        /* Only the second half is free of circular wrap-around */
+        for (b = 0; b < block; b++)
+            u->fft_output[2 * b + ear] = u->fft_time[block + b];
+    }
+
+    u->fdl_position = (u->fdl_position + partitions - 1) % partitions;
+}
+
+/* Called from I/O thread context */
+static void convolve_fft(struct userdata *u, const float *src, float *dst, unsigned n) {
+    unsigned k, l;
+
+    for (l = 0; l < n; l++) {
+        for (k = 0; k < u->channels; k++)
+            u->fft_window[2 * u->fft_block * k + u->fft_block + u->fft_fill] = src[l * u->channels + k];
+
+        dst[2 * l] = PA_CLAMP_UNLIKELY(u->fft_output[2 * u->fft_fill], -1.0f, 1.0f);
+        dst[2 * l + 1] = PA_CLAMP_UNLIKELY(u->fft_output[2 * u->fft_fill + 1], -1.0f, 1.0f);
+
+        if (++u->fft_fill >= u->fft_block) {
+            fft_process_block(u);
+            u->fft_fill = 0;
+        }
+    }
+}
+#endif
+
+/* Called from I/O thread context */
+static void reset_filter(struct userdata *u) {
+#ifdef HAVE_FFTW
+    if (u->use_fft) {
+        memset(u->fft_window, 0, 2 * u->fft_block * u->channels * sizeof(float));
+        memset(u->fft_output, 0, 2 * u->fft_block * sizeof(float));
+        memset(u->fdl, 0, u->channels * u->fft_partitions * u->fft_bins * sizeof(fftwf_complex));
+        u->fdl_position = 0;
+        u->fft_fill = 0;
+    } else
+#endif
+    {
+        memset(u->input_buffer, 0, u->hrir_samples * u->sink_fs);
+        u->input_buffer_offset = 0;
+    }
+
+    u->silence_bytes = 0;
+}
+
 /* Called from I/O thread context */
 static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk) {
     struct userdata *u;
@@ -220,10 +386,6 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk
     unsigned n;
     pa_memchunk tchunk;
 
-    unsigned j, k, l;
-    float sum_right, sum_left;
-    float current_sample;
-
     pa_sink_input_assert_ref(i);
     pa_assert(chunk);
     pa_assert_se(u = i->userdata);
@@ -246,6 +408,17 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk
 
     pa_assert(n > 0);
 
+    if (!pa_memblock_is_silence(tchunk.memblock))
+        u->silence_bytes = 0;
+    else if (u->silence_bytes >= u->silence_tail) {
+        pa_memblock_unref(tchunk.memblock);
+
+        pa_silence_memchunk_get(&i->sink->core->silence_cache, i->sink->core->mempool, chunk, &i->sample_spec, n * u->fs);
+        pa_memblockq_drop(u->memblockq, chunk->length / u->fs * u->sink_fs);
+        return 0;
+    } else
+        u->silence_bytes += n * u->sink_fs;
+
     chunk->index = 0;
     chunk->length = n * u->fs;
     chunk->memblock = pa_memblock_new(i->sink->core->mempool, chunk->length);
@@ -255,29 +428,12 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk
     src = pa_memblock_acquire_chunk(&tchunk);
     dst = pa_memblock_acquire(chunk->memblock);
 
-    for (l = 0; l < n; l++) {
-        memcpy(((char*) u->input_buffer) + u->input_buffer_offset * u->sink_fs, ((char *) src) + l * u->sink_fs, u->sink_fs);
-
-        sum_right = 0;
-        sum_left = 0;
-
-        /* fold the input buffer with the impulse response */
-        for (j = 0; j < u->hrir_samples; j++) {
-            for (k = 0; k < u->channels; k++) {
-                current_sample = u->input_buffer[((u->input_buffer_offset + j) % u->hrir_samples) * u->channels + k];
-
-                sum_left += current_sample * u->hrir_data[j * u->hrir_channels + u->mapping_left[k]];
-                sum_right += current_sample * u->hrir_data[j * u->hrir_channels + u->mapping_right[k]];
-            }
-        }
-
-        dst[2 * l] = PA_CLAMP_UNLIKELY(sum_left, -1.0f, 1.0f);
-        dst[2 * l + 1] = PA_CLAMP_UNLIKELY(sum_right, -1.0f, 1.0f);
-
-        u->input_buffer_offset--;
-        if (u->input_buffer_offset < 0)
-            u->input_buffer_offset += u->hrir_samples;
-    }
+#ifdef HAVE_FFTW
+    if (u->use_fft)
+        convolve_fft(u, src, dst, n);
+    else
+#endif
+        convolve_time_domain(u, src, dst, n);
 
     pa_memblock_release(tchunk.memblock);
     pa_memblock_release(chunk->memblock);
@@ -306,8 +462,7 @@ static void sink_input_process_rewind_cb(pa_sink_input *i, size_t nbytes) {
             pa_memblockq_seek(u->memblockq, - (int64_t) amount, PA_SEEK_RELATIVE, TRUE);
 
             /* Reset the input buffer */
-            memset(u->input_buffer, 0, u->hrir_samples * u->sink_fs);
-            u->input_buffer_offset = 0;
+            reset_filter(u);
         }
     }
 
@@ -519,6 +674,56 @@ static pa_channel_position_t mirror_channel(pa_channel_position_t channel) {
     }
 }
 
+#ifdef HAVE_FFTW
+/* Called from main context */
+static void fft_init(struct userdata *u) {
+    unsigned ear, k, p, j;
+    float scale;
+
+    u->fft_block = 1;
+    while (u->fft_block < u->hrir_samples && u->fft_block < FFT_BLOCK_MAX)
+        u->fft_block <<= 1;
+
+    u->fft_partitions = (u->hrir_samples + u->fft_block - 1) / u->fft_block;
+    u->fft_bins = u->fft_block + 1;
+
+    pa_assert_se(u->fft_time = fftwf_malloc(2 * u->fft_block * sizeof(float)));
+    pa_assert_se(u->fft_freq = fftwf_malloc(u->fft_bins * sizeof(fftwf_complex)));
+    u->plan_cache = pa_fftw_plan_cache_get(u->module->core);
+    u->forward_plan = pa_fftw_plan_cache_r2c(u->plan_cache, 2 * u->fft_block);
+    u->inverse_plan = pa_fftw_plan_cache_c2r(u->plan_cache, 2 * u->fft_block);
+
+    u->hrir_spectra = pa_xnew(fftwf_complex, 2 * u->channels * u->fft_partitions * u->fft_bins);
+    u->fdl = pa_xnew0(fftwf_complex, u->channels * u->fft_partitions * u->fft_bins);
+    u->fft_window = pa_xnew0(float, 2 * u->fft_block * u->channels);
+    u->fft_output = pa_xnew0(float, 2 * u->fft_block);
+
+    /* FFTW does not normalize, so fold that into the filter */
+    scale = 1.0f / (2 * u->fft_block);
+
+    for (ear = 0; ear < 2; ear++) {
+        for (k = 0; k < u->channels; k++) {
+            unsigned hrir_channel = ear == 0 ? u->mapping_left[k] : u->mapping_right[k];
+
+            for (p = 0; p < u->fft_partitions; p++) {
+                memset(u->fft_time, 0, 2 * u->fft_block * sizeof(float));
+
+                for (j = 0; j < u->fft_block && p * u->fft_block + j < u->hrir_samples; j++)
+                    u->fft_time[j] = u->hrir_data[(p * u->fft_block + j) * u->hrir_channels + hrir_channel] * scale;
+
+                fftwf_execute_dft_r2c(u->forward_plan, u->fft_time, u->fft_freq);
+                memcpy(u->hrir_spectra + ((ear * u->channels + k) * u->fft_partitions + p) * u->fft_bins,
+                       u->fft_freq, u->fft_bins * sizeof(fftwf_complex));
+            }
+        }
+    }
+
+    u->use_fft = TRUE;
+
+    pa_log_debug("Convolving %u hrir samples in %u partitions of %u samples.", u->hrir_samples, u->fft_partitions, u->fft_block);
+}
+#endif
+
 int pa__init(pa_module*m) {
     struct userdata *u;
     pa_sample_spec ss, sink_input_ss;
@@ -713,10 +918,12 @@ int pa__init(pa_module*m) {
                                  PA_RESAMPLER_SRC_SINC_BEST_QUALITY, PA_RESAMPLER_NO_REMAP);
 
     u->hrir_samples = hrir_temp_chunk.length / pa_frame_size(&hrir_temp_ss) * hrir_ss.rate / hrir_temp_ss.rate;
+#ifndef HAVE_FFTW
     if (u->hrir_samples > 64) {
         u->hrir_samples = 64;
         pa_log("The (resampled) hrir contains more than 64 samples. Only the first 64 samples will be used to limit processor usage.");
     }
+#endif
 
     hrir_total_length = u->hrir_samples * pa_frame_size(&hrir_ss);
     u->hrir_channels = hrir_ss.channels;
@@ -737,10 +944,10 @@ int pa__init(pa_module*m) {
             hrir_data = (float *) pa_memblock_acquire(hrir_temp_chunk_resampled.memblock);
 
             if (hrir_total_length - hrir_copied_length >= hrir_temp_chunk_resampled.length) {
-                memcpy(u->hrir_data + hrir_copied_length, hrir_data, hrir_temp_chunk_resampled.length);
+                memcpy((char *) u->hrir_data + hrir_copied_length, hrir_data, hrir_temp_chunk_resampled.length);
                 hrir_copied_length += hrir_temp_chunk_resampled.length;
             } else {
-                memcpy(u->hrir_data + hrir_copied_length, hrir_data, hrir_total_length - hrir_copied_length);
+                memcpy((char *) u->hrir_data + hrir_copied_length, hrir_data, hrir_total_length - hrir_copied_length);
                 hrir_copied_length = hrir_total_length;
             }
 
@@ -806,8 +1013,21 @@ int pa__init(pa_module*m) {
         }
     }
 
-    u->input_buffer = pa_xmalloc0(u->hrir_samples * u->sink_fs);
-    u->input_buffer_offset = 0;
+#ifdef HAVE_FFTW
+    if (u->hrir_samples > TIME_DOMAIN_MAX_SAMPLES) {
+        fft_init(u);
+
+        /* Output lags one block behind, and the delay line only runs dry
+         * once all partitions have seen a silent block */
+        u->filter_latency = u->fft_block * u->sink_fs;
+        u->silence_tail = (u->fft_partitions + 2) * u->fft_block * u->sink_fs;
+    } else
+#endif
+    {
+        u->input_buffer = pa_xmalloc0(u->hrir_samples * u->sink_fs);
+        u->input_buffer_offset = 0;
+        u->silence_tail = u->hrir_samples * u->sink_fs;
+    }
 
     pa_sink_put(u->sink);
     pa_sink_input_put(u->sink_input);
@@ -871,6 +1091,19 @@ void pa__done(pa_module*m) {
     if (u->input_buffer)
         pa_xfree(u->input_buffer);
 
+#ifdef HAVE_FFTW
+    if (u->use_fft) {
+        pa_fftw_plan_cache_unref(u->plan_cache);
+        fftwf_free(u->fft_freq);
+        fftwf_free(u->fft_time);
+
+        pa_xfree(u->hrir_spectra);
+        pa_xfree(u->fdl);
+        pa_xfree(u->fft_window);
+        pa_xfree(u->fft_output);
+    }
+#endif
+
     if (u->mapping_left)
         pa_xfree(u->mapping_left);
     if (u->mapping_right)
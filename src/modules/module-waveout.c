@@ -57,11 +57,15 @@ PA_MODULE_USAGE(
     "channels=<number of channels> "
     "channel_map=<channel map> "
     "fragments=<number of fragments> "
-    "fragment_size=<fragment size>");
+    "fragment_size=<fragment size> "
+    "tsched=<size the playback fragments by the requested latency?> "
+    "tsched_buffer_size=<playback buffer size when clients accept high latency>");
 
 #define DEFAULT_SINK_NAME "wave_output"
 #define DEFAULT_SOURCE_NAME "wave_input"
 
+#define DEFAULT_TSCHED_BUFFER_USEC (2*PA_USEC_PER_SEC)             /* 2s    -- Overall buffer size */
+
 #define WAVEOUT_MAX_VOLUME 0xFFFF
 
 struct userdata {
@@ -76,6 +80,12 @@ struct userdata {
 
     uint32_t fragments, fragment_size;
 
+    /* With tsched the playback fragments are sized between the two, so
+     * that fragments * fragment_size follows the requested latency. The
+     * recording fragments always have the minimum size. */
+    pa_bool_t use_tsched;
+    uint32_t min_fragment_size, max_fragment_size;
+
     uint32_t free_ofrags, free_ifrags;
 
     DWORD written_bytes;
@@ -104,9 +114,29 @@ static const char* const valid_modargs[] = {
     "rate",
     "channels",
     "channel_map",
+    "tsched",
+    "tsched_buffer_size",
     NULL
 };
 
+/* Wake up often enough for whichever side has the shorter fragments */
+static void update_poll_timeout(struct userdata *u) {
+    pa_usec_t t;
+
+    pa_assert(u);
+    pa_assert(u->sink || u->source);
+
+    u->poll_timeout = (pa_usec_t) -1;
+
+    if (u->sink)
+        u->poll_timeout = pa_bytes_to_usec(u->fragments * u->fragment_size / 10, &u->sink->sample_spec);
+
+    if (u->source) {
+        t = pa_bytes_to_usec(u->fragments * u->min_fragment_size / 10, &u->source->sample_spec);
+        u->poll_timeout = PA_MIN(u->poll_timeout, t);
+    }
+}
+
 static void do_write(struct userdata *u) {
     uint32_t free_frags;
     pa_memchunk memchunk;
@@ -183,6 +213,41 @@ static void do_write(struct userdata *u) {
     }
 }
 
+/* Called from IO context. waveOut cannot take back single blocks, so all
+ * that has not been played yet is dropped and rendered again. */
+static void process_rewind(struct userdata *u) {
+    size_t rewind_nbytes = 0;
+    MMTIME mmt;
+
+    pa_assert(u);
+
+    if (!PA_SINK_IS_OPENED(u->sink->thread_info.state) || u->sink->thread_info.rewind_nbytes == 0) {
+        pa_sink_process_rewind(u->sink, 0);
+        return;
+    }
+
+    pa_log_debug("Requested to rewind %lu bytes.", (unsigned long) u->sink->thread_info.rewind_nbytes);
+
+    memset(&mmt, 0, sizeof(mmt));
+    mmt.wType = TIME_BYTES;
+    if (waveOutGetPosition(u->hwo, &mmt, sizeof(mmt)) == MMSYSERR_NOERROR && mmt.wType == TIME_BYTES &&
+        u->written_bytes > mmt.u.cb)
+        rewind_nbytes = pa_frame_align(u->written_bytes - mmt.u.cb, &u->sink->sample_spec);
+
+    if (rewind_nbytes > 0) {
+        /* Marks everything queued as done and resets the position. The
+         * next write starts playback again. */
+        waveOutReset(u->hwo);
+        u->written_bytes = 0;
+        u->sink_underflow = 1;
+
+        pa_log_debug("Rewound %lu bytes.", (unsigned long) rewind_nbytes);
+    } else
+        pa_log_debug("Mhmm, actually there is nothing to rewind.");
+
+    pa_sink_process_rewind(u->sink, rewind_nbytes);
+}
+
 static void do_read(struct userdata *u) {
     uint32_t free_frags;
     pa_memchunk memchunk;
@@ -257,7 +322,7 @@ static void thread_func(void *userdata) {
 
         if (u->sink) {
             if (PA_UNLIKELY(u->sink->thread_info.rewind_requested))
-                pa_sink_process_rewind(u->sink, 0);
+                process_rewind(u);
 
             if (PA_SINK_IS_OPENED(u->sink->thread_info.state)) {
                 do_write(u);
@@ -354,7 +419,7 @@ static pa_usec_t source_get_latency(struct userdata *u) {
     free_frags = u->free_ifrags;
     LeaveCriticalSection(&u->crit);
 
-    r += pa_bytes_to_usec((free_frags + 1) * u->fragment_size, &u->source->sample_spec);
+    r += pa_bytes_to_usec((free_frags + 1) * u->min_fragment_size, &u->source->sample_spec);
 
     return r;
 }
@@ -401,6 +466,40 @@ static int process_msg(pa_msgobject *o, int code, void *data, int64_t offset, pa
     return -1;
 }
 
+/* Called from IO context */
+static void sink_update_requested_latency_cb(pa_sink *s) {
+    struct userdata *u = s->userdata;
+    pa_usec_t latency;
+    uint32_t old_fragment_size;
+
+    pa_assert(u);
+    pa_assert(u->use_tsched);
+
+    old_fragment_size = u->fragment_size;
+
+    if ((latency = pa_sink_get_requested_latency_within_thread(s)) == (pa_usec_t) -1)
+        u->fragment_size = u->max_fragment_size;
+    else {
+        u->fragment_size = (uint32_t) pa_usec_to_bytes(latency, &s->sample_spec) / u->fragments;
+        u->fragment_size = PA_CLAMP(u->fragment_size, u->min_fragment_size, u->max_fragment_size);
+        u->fragment_size = (uint32_t) pa_frame_align(u->fragment_size, &s->sample_spec);
+    }
+
+    if (u->fragment_size == old_fragment_size)
+        return;
+
+    pa_log_debug("Fragment size now %u bytes (%0.2f ms).", u->fragment_size,
+                 (double) pa_bytes_to_usec(u->fragment_size, &s->sample_spec) / PA_USEC_PER_MSEC);
+
+    update_poll_timeout(u);
+    pa_sink_set_max_request_within_thread(s, u->fragments * u->fragment_size);
+
+    /* What is queued now was sized for a longer latency than the one we
+     * just got asked for */
+    if (u->fragment_size < old_fragment_size)
+        pa_sink_request_rewind(s, (size_t) -1);
+}
+
 static void sink_get_volume_cb(pa_sink *s) {
     struct userdata *u = s->userdata;
     WAVEOUTCAPS caps;
@@ -499,7 +598,8 @@ int pa__init(pa_module *m) {
     WAVEOUTCAPS pwoc;
     MMRESULT result;
     int nfrags, frag_size;
-    pa_bool_t record = TRUE, playback = TRUE;
+    uint32_t tsched_size;
+    pa_bool_t record = TRUE, playback = TRUE, use_tsched = TRUE;
     unsigned int device;
     pa_sample_spec ss;
     pa_channel_map map;
@@ -567,6 +667,13 @@ int pa__init(pa_module *m) {
     if (ss_to_waveformat(&ss, &wf) < 0)
         goto fail;
 
+    tsched_size = (uint32_t) pa_usec_to_bytes(DEFAULT_TSCHED_BUFFER_USEC, &ss);
+    if (pa_modargs_get_value_boolean(ma, "tsched", &use_tsched) < 0 ||
+        pa_modargs_get_value_u32(ma, "tsched_buffer_size", &tsched_size) < 0) {
+        pa_log("failed to parse tsched arguments");
+        goto fail;
+    }
+
     u = pa_xmalloc(sizeof(struct userdata));
 
     if (record) {
@@ -634,10 +741,12 @@ int pa__init(pa_module *m) {
         pa_sink_new_data_set_channel_map(&data, &map);
         pa_sink_new_data_set_name(&data, pa_modargs_get_value(ma, "sink_name", DEFAULT_SINK_NAME));
         pa_proplist_setf(data.proplist, PA_PROP_DEVICE_DESCRIPTION, "WaveOut on %s", device_name);
-        u->sink = pa_sink_new(m->core, &data, PA_SINK_HARDWARE|PA_SINK_LATENCY);
+        u->sink = pa_sink_new(m->core, &data, PA_SINK_HARDWARE|PA_SINK_LATENCY|(use_tsched ? PA_SINK_DYNAMIC_LATENCY : 0));
         pa_sink_new_data_done(&data);
 
         pa_assert(u->sink);
+        if (use_tsched)
+            u->sink->update_requested_latency = sink_update_requested_latency_cb;
         pa_sink_set_get_volume_callback(u->sink, sink_get_volume_cb);
         pa_sink_set_set_volume_callback(u->sink, sink_set_volume_cb);
         u->sink->userdata = u;
@@ -655,12 +764,21 @@ int pa__init(pa_module *m) {
     u->fragments = nfrags;
     u->free_ifrags = u->fragments;
     u->free_ofrags = u->fragments;
-    u->fragment_size = frag_size - (frag_size % pa_frame_size(&ss));
+    u->min_fragment_size = frag_size - (frag_size % pa_frame_size(&ss));
+
+    /* Without clients asking for less, play from few large fragments */
+    u->use_tsched = use_tsched && u->sink;
+    if (u->use_tsched)
+        u->max_fragment_size = PA_MAX(u->min_fragment_size, (uint32_t) pa_frame_align(tsched_size / u->fragments, &ss));
+    else
+        u->max_fragment_size = u->min_fragment_size;
+
+    u->fragment_size = u->max_fragment_size;
 
     u->written_bytes = 0;
     u->sink_underflow = 1;
 
-    u->poll_timeout = pa_bytes_to_usec(u->fragments * u->fragment_size / 10, &ss);
+    update_poll_timeout(u);
     pa_log_debug("Poll timeout = %.1f ms", (double) u->poll_timeout / PA_USEC_PER_MSEC);
 
     u->cur_ihdr = 0;
@@ -670,11 +788,11 @@ int pa__init(pa_module *m) {
     u->ohdrs = pa_xmalloc0(sizeof(WAVEHDR) * u->fragments);
     pa_assert(u->ohdrs);
     for (i = 0; i < u->fragments; i++) {
-        u->ihdrs[i].dwBufferLength = u->fragment_size;
-        u->ohdrs[i].dwBufferLength = u->fragment_size;
-        u->ihdrs[i].lpData = pa_xmalloc(u->fragment_size);
+        u->ihdrs[i].dwBufferLength = u->min_fragment_size;
+        u->ohdrs[i].dwBufferLength = u->max_fragment_size;
+        u->ihdrs[i].lpData = pa_xmalloc(u->min_fragment_size);
         pa_assert(u->ihdrs);
-        u->ohdrs[i].lpData = pa_xmalloc(u->fragment_size);
+        u->ohdrs[i].lpData = pa_xmalloc(u->max_fragment_size);
         pa_assert(u->ohdrs);
     }
 
@@ -691,6 +809,13 @@ int pa__init(pa_module *m) {
     if (u->sink) {
         pa_sink_set_asyncmsgq(u->sink, u->thread_mq.inq);
         pa_sink_set_rtpoll(u->sink, u->rtpoll);
+        pa_sink_set_max_request(u->sink, u->fragments * u->fragment_size);
+        pa_sink_set_max_rewind(u->sink, u->fragments * u->max_fragment_size);
+
+        if (u->use_tsched)
+            pa_sink_set_latency_range(u->sink,
+                                      pa_bytes_to_usec(u->fragments * u->min_fragment_size, &ss),
+                                      pa_bytes_to_usec(u->fragments * u->max_fragment_size, &ss));
     }
     if (u->source) {
         pa_source_set_asyncmsgq(u->source, u->thread_mq.inq);
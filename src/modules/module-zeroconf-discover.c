@@ -36,6 +36,8 @@
 #include <avahi-common/malloc.h>
 
 #include <pulse/xmalloc.h>
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
 
 #include <pulsecore/core-util.h>
 #include <pulsecore/log.h>
@@ -54,15 +56,26 @@ PA_MODULE_LOAD_ONCE(TRUE);
 #define SERVICE_TYPE_SINK "_pulse-sink._tcp"
 #define SERVICE_TYPE_SOURCE "_non-monitor._sub._pulse-source._tcp"
 
+/* How long a tunnel is kept after its service disappeared. Services come
+ * and go with interfaces, mDNS cache expiry and Avahi restarts, and each
+ * new tunnel costs a connection and an authentication handshake. */
+#define TUNNEL_LINGER_USEC (15*PA_USEC_PER_SEC)
+
 static const char* const valid_modargs[] = {
     NULL
 };
 
+/* One per service, no matter on how many interfaces and over which
+ * protocols it is seen, so that there is only one tunnel for it */
 struct tunnel {
-    AvahiIfIndex interface;
-    AvahiProtocol protocol;
+    struct userdata *userdata;
     char *name, *type, *domain;
+
+    unsigned n_seen;
+    AvahiServiceResolver *resolver;
     uint32_t module_index;
+
+    pa_time_event *linger_event;
 };
 
 struct userdata {
@@ -79,8 +92,6 @@ static unsigned tunnel_hash(const void *p) {
     const struct tunnel *t = p;
 
     return
-        (unsigned) t->interface +
-        (unsigned) t->protocol +
         pa_idxset_string_hash_func(t->name) +
         pa_idxset_string_hash_func(t->type) +
         pa_idxset_string_hash_func(t->domain);
@@ -90,10 +101,6 @@ static int tunnel_compare(const void *a, const void *b) {
     const struct tunnel *ta = a, *tb = b;
     int r;
 
-    if (ta->interface != tb->interface)
-        return 1;
-    if (ta->protocol != tb->protocol)
-        return 1;
     if ((r = strcmp(ta->name, tb->name)))
         return r;
     if ((r = strcmp(ta->type, tb->type)))
@@ -104,23 +111,29 @@ static int tunnel_compare(const void *a, const void *b) {
     return 0;
 }
 
-static struct tunnel *tunnel_new(
-        AvahiIfIndex interface, AvahiProtocol protocol,
-        const char *name, const char *type, const char *domain) {
-
+static struct tunnel *tunnel_new(struct userdata *u, const char *name, const char *type, const char *domain) {
     struct tunnel *t;
     t = pa_xnew(struct tunnel, 1);
-    t->interface = interface;
-    t->protocol = protocol;
+    t->userdata = u;
     t->name = pa_xstrdup(name);
     t->type = pa_xstrdup(type);
     t->domain = pa_xstrdup(domain);
+    t->n_seen = 0;
+    t->resolver = NULL;
     t->module_index = PA_IDXSET_INVALID;
+    t->linger_event = NULL;
     return t;
 }
 
 static void tunnel_free(struct tunnel *t) {
     pa_assert(t);
+
+    if (t->resolver)
+        avahi_service_resolver_free(t->resolver);
+
+    if (t->linger_event)
+        t->userdata->core->mainloop->time_free(t->linger_event);
+
     pa_xfree(t->name);
     pa_xfree(t->type);
     pa_xfree(t->domain);
@@ -137,12 +150,14 @@ static void resolver_cb(
         AvahiLookupResultFlags flags,
         void *userdata) {
 
-    struct userdata *u = userdata;
-    struct tunnel *tnl;
+    struct tunnel *tnl = userdata;
+    struct userdata *u;
 
-    pa_assert(u);
+    pa_assert(tnl);
+    pa_assert(tnl->resolver == r);
 
-    tnl = tunnel_new(interface, protocol, name, type, domain);
+    u = tnl->userdata;
+    tnl->resolver = NULL;
 
     if (event != AVAHI_RESOLVER_FOUND)
         pa_log("Resolving of '%s' failed: %s", name, avahi_strerror(avahi_client_errno(u->client)));
@@ -229,11 +244,8 @@ static void resolver_cb(
 
         pa_log_debug("Loading %s with arguments '%s'", module_name, args);
 
-        if ((m = pa_module_load(u->core, module_name, args))) {
+        if ((m = pa_module_load(u->core, module_name, args)))
             tnl->module_index = m->index;
-            pa_hashmap_put(u->tunnels, tnl, tnl);
-            tnl = NULL;
-        }
 
         pa_xfree(module_name);
         pa_xfree(dname);
@@ -244,9 +256,40 @@ static void resolver_cb(
 finish:
 
     avahi_service_resolver_free(r);
+}
+
+static void linger_cb(pa_mainloop_api *a, pa_time_event *e, const struct timeval *t, void *userdata) {
+    struct tunnel *tnl = userdata;
+    struct userdata *u;
 
-    if (tnl)
-        tunnel_free(tnl);
+    pa_assert(tnl);
+
+    u = tnl->userdata;
+
+    pa_log_debug("Service '%s' is still gone, removing its tunnel.", tnl->name);
+
+    pa_module_unload_request_by_index(u->core, tnl->module_index, TRUE);
+    pa_hashmap_remove(u->tunnels, tnl);
+    tunnel_free(tnl);
+}
+
+/* The service is not seen anywhere anymore */
+static void tunnel_lost(struct tunnel *t) {
+    struct userdata *u;
+
+    pa_assert(t);
+    pa_assert(t->n_seen == 0);
+
+    u = t->userdata;
+
+    if (t->module_index == PA_IDXSET_INVALID) {
+        pa_hashmap_remove(u->tunnels, t);
+        tunnel_free(t);
+        return;
+    }
+
+    if (!t->linger_event)
+        t->linger_event = pa_core_rttime_new(u->core, pa_rtclock_now() + TUNNEL_LINGER_USEC, linger_cb, t);
 }
 
 static void browser_cb(
@@ -258,36 +301,65 @@ static void browser_cb(
         void *userdata) {
 
     struct userdata *u = userdata;
-    struct tunnel *t;
+    struct tunnel key, *t;
 
     pa_assert(u);
 
     if (flags & AVAHI_LOOKUP_RESULT_LOCAL)
         return;
 
-    t = tunnel_new(interface, protocol, name, type, domain);
+    key.name = (char*) name;
+    key.type = (char*) type;
+    key.domain = (char*) domain;
 
     if (event == AVAHI_BROWSER_NEW) {
 
-        if (!pa_hashmap_get(u->tunnels, t))
-            if (!(avahi_service_resolver_new(u->client, interface, protocol, name, type, domain, AVAHI_PROTO_UNSPEC, 0, resolver_cb, u)))
-                pa_log("avahi_service_resolver_new() failed: %s", avahi_strerror(avahi_client_errno(u->client)));
+        if (!(t = pa_hashmap_get(u->tunnels, &key))) {
+            t = tunnel_new(u, name, type, domain);
+            pa_hashmap_put(u->tunnels, t, t);
+        }
 
-        /* We ignore the returned resolver object here, since the we don't
-         * need to attach any special data to it, and we can still destroy
-         * it from the callback */
+        t->n_seen++;
+
+        if (t->linger_event) {
+            pa_log_debug("Service '%s' is back, keeping its tunnel.", name);
+            u->core->mainloop->time_free(t->linger_event);
+            t->linger_event = NULL;
+        }
+
+        /* Resolved once, whatever other interfaces it shows up on while
+         * that is going on or after */
+        if (t->module_index == PA_IDXSET_INVALID && !t->resolver)
+            if (!(t->resolver = avahi_service_resolver_new(u->client, interface, protocol, name, type, domain, AVAHI_PROTO_UNSPEC, 0, resolver_cb, t)))
+                pa_log("avahi_service_resolver_new() failed: %s", avahi_strerror(avahi_client_errno(u->client)));
 
     } else if (event == AVAHI_BROWSER_REMOVE) {
-        struct tunnel *t2;
 
-        if ((t2 = pa_hashmap_get(u->tunnels, t))) {
-            pa_module_unload_request_by_index(u->core, t2->module_index, TRUE);
-            pa_hashmap_remove(u->tunnels, t2);
-            tunnel_free(t2);
-        }
+        if ((t = pa_hashmap_get(u->tunnels, &key)) && t->n_seen > 0)
+            if (--t->n_seen == 0)
+                tunnel_lost(t);
     }
+}
+
+/* The browsers are gone, so are the removal events. Whatever the new
+ * ones find again within the linger time keeps its tunnel. */
+static void forget_seen_tunnels(struct userdata *u) {
+    struct tunnel *t;
+    void *state;
+
+    pa_assert(u);
+
+    PA_HASHMAP_FOREACH(t, u->tunnels, state) {
+        if (t->resolver) {
+            avahi_service_resolver_free(t->resolver);
+            t->resolver = NULL;
+        }
 
-    tunnel_free(t);
+        if (t->n_seen > 0) {
+            t->n_seen = 0;
+            tunnel_lost(t);
+        }
+    }
 }
 
 static void client_callback(AvahiClient *c, AvahiClientState state, void *userdata) {
@@ -361,6 +433,7 @@ static void client_callback(AvahiClient *c, AvahiClientState state, void *userda
                 u->source_browser = NULL;
             }
 
+            forget_seen_tunnels(u);
             break;
 
         default: ;
@@ -412,12 +485,7 @@ void pa__done(pa_module*m) {
     if (!(u = m->userdata))
         return;
 
-    if (u->client)
-        avahi_client_free(u->client);
-
-    if (u->avahi_poll)
-        pa_avahi_poll_free(u->avahi_poll);
-
+    /* The resolvers go with the client */
     if (u->tunnels) {
         struct tunnel *t;
 
@@ -429,5 +497,11 @@ void pa__done(pa_module*m) {
         pa_hashmap_free(u->tunnels, NULL);
     }
 
+    if (u->client)
+        avahi_client_free(u->client);
+
+    if (u->avahi_poll)
+        pa_avahi_poll_free(u->avahi_poll);
+
     pa_xfree(u);
 }
@@ -36,13 +36,17 @@
 #include <pulse/xmalloc.h>
 #include <pulse/util.h>
 #include <pulse/thread-mainloop.h>
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
 
 #include <pulsecore/parseaddr.h>
 #include <pulsecore/sink.h>
 #include <pulsecore/source.h>
 #include <pulsecore/native-common.h>
 #include <pulsecore/core-util.h>
+#include <pulsecore/core-rtclock.h>
 #include <pulsecore/log.h>
+#include <pulsecore/llist.h>
 #include <pulsecore/dynarray.h>
 #include <pulsecore/modargs.h>
 #include <pulsecore/avahi-wrap.h>
@@ -65,6 +69,9 @@ PA_MODULE_LOAD_ONCE(TRUE);
 #define SERVICE_SUBTYPE_SOURCE_MONITOR "_monitor._sub."SERVICE_TYPE_SOURCE
 #define SERVICE_SUBTYPE_SOURCE_NON_MONITOR "_non-monitor._sub."SERVICE_TYPE_SOURCE
 
+/* How long device changes are collected before they are published */
+#define PUBLISH_DELAY_USEC (250*PA_USEC_PER_MSEC)
+
 /*
  * Note: Because the core avahi-client calls result in synchronous D-Bus
  * communication, calling any of those functions in the PA mainloop context
@@ -118,6 +125,13 @@ struct service {
     pa_sample_spec ss;
     pa_channel_map cm;
     pa_proplist *proplist;
+
+    /* The TXT record as published, NULL if the service has to be added
+     * to the entry group again */
+    AvahiStringList *txt;
+
+    bool pending;
+    PA_LLIST_FIELDS(struct service);
 };
 
 struct userdata {
@@ -138,6 +152,11 @@ struct userdata {
 
     AvahiEntryGroup *main_entry_group;
 
+    /* Services to publish once the event fires, protect with mainloop lock */
+    PA_LLIST_HEAD(struct service, pending);
+    pa_time_event *publish_event;
+    bool publish_scheduled;
+
     pa_hook_slot *sink_new_slot, *source_new_slot, *sink_unlink_slot, *source_unlink_slot, *sink_changed_slot, *source_changed_slot;
 
     pa_native_protocol *native;
@@ -203,6 +222,45 @@ static AvahiStringList* txt_record_server_data(pa_core *c, AvahiStringList *l) {
 
 static void publish_service(pa_mainloop_api *api, void *service);
 
+/* Runs in Avahi mainloop context */
+static AvahiStringList* txt_record_service_data(struct service *s) {
+    AvahiStringList *txt = NULL;
+    char cm[PA_CHANNEL_MAP_SNPRINT_MAX];
+    const char *t;
+
+    const char * const subtype_text[] = {
+        [SUBTYPE_HARDWARE] = "hardware",
+        [SUBTYPE_VIRTUAL] = "virtual",
+        [SUBTYPE_MONITOR] = "monitor"
+    };
+
+    pa_assert(s);
+
+    txt = txt_record_server_data(s->userdata->core, txt);
+
+    txt = avahi_string_list_add_pair(txt, "device", s->name);
+    txt = avahi_string_list_add_printf(txt, "rate=%u", s->ss.rate);
+    txt = avahi_string_list_add_printf(txt, "channels=%u", s->ss.channels);
+    txt = avahi_string_list_add_pair(txt, "format", pa_sample_format_to_string(s->ss.format));
+    txt = avahi_string_list_add_pair(txt, "channel_map", pa_channel_map_snprint(cm, sizeof(cm), &s->cm));
+    txt = avahi_string_list_add_pair(txt, "subtype", subtype_text[s->subtype]);
+
+    if ((t = pa_proplist_gets(s->proplist, PA_PROP_DEVICE_DESCRIPTION)))
+        txt = avahi_string_list_add_pair(txt, "description", t);
+    if ((t = pa_proplist_gets(s->proplist, PA_PROP_DEVICE_ICON_NAME)))
+        txt = avahi_string_list_add_pair(txt, "icon-name", t);
+    if ((t = pa_proplist_gets(s->proplist, PA_PROP_DEVICE_VENDOR_NAME)))
+        txt = avahi_string_list_add_pair(txt, "vendor-name", t);
+    if ((t = pa_proplist_gets(s->proplist, PA_PROP_DEVICE_PRODUCT_NAME)))
+        txt = avahi_string_list_add_pair(txt, "product-name", t);
+    if ((t = pa_proplist_gets(s->proplist, PA_PROP_DEVICE_CLASS)))
+        txt = avahi_string_list_add_pair(txt, "class", t);
+    if ((t = pa_proplist_gets(s->proplist, PA_PROP_DEVICE_FORM_FACTOR)))
+        txt = avahi_string_list_add_pair(txt, "form-factor", t);
+
+    return txt;
+}
+
 /* Runs in Avahi mainloop context */
 static void service_entry_group_callback(AvahiEntryGroup *g, AvahiEntryGroupState state, void *userdata) {
     struct service *s = userdata;
@@ -223,6 +281,9 @@ static void service_entry_group_callback(AvahiEntryGroup *g, AvahiEntryGroupStat
             pa_xfree(s->service_name);
             s->service_name = t;
 
+            avahi_string_list_free(s->txt);
+            s->txt = NULL;
+
             publish_service(NULL, s);
             break;
         }
@@ -233,6 +294,9 @@ static void service_entry_group_callback(AvahiEntryGroup *g, AvahiEntryGroupStat
             avahi_entry_group_free(g);
             s->entry_group = NULL;
 
+            avahi_string_list_free(s->txt);
+            s->txt = NULL;
+
             break;
         }
 
@@ -274,20 +338,43 @@ static void publish_service(pa_mainloop_api *api PA_GCC_UNUSED, void *service) {
     struct service *s = (struct service *) service;
     int r = -1;
     AvahiStringList *txt = NULL;
-    char cm[PA_CHANNEL_MAP_SNPRINT_MAX];
-    const char *t;
-
-    const char * const subtype_text[] = {
-        [SUBTYPE_HARDWARE] = "hardware",
-        [SUBTYPE_VIRTUAL] = "virtual",
-        [SUBTYPE_MONITOR] = "monitor"
-    };
 
     pa_assert(s);
 
     if (!s->userdata->client || avahi_client_get_state(s->userdata->client) != AVAHI_CLIENT_S_RUNNING)
         return;
 
+    txt = txt_record_service_data(s);
+
+    /* Most changes are to the properties only. The TXT record can be
+     * replaced in place, without withdrawing the service and probing for
+     * its name again, and if it's still the same nothing needs to go out
+     * at all. */
+    if (s->entry_group && s->txt) {
+        if (avahi_string_list_equal(txt, s->txt)) {
+            r = 0;
+            goto finish;
+        }
+
+        if (avahi_entry_group_update_service_txt_strlst(
+                    s->entry_group,
+                    AVAHI_IF_UNSPEC, AVAHI_PROTO_UNSPEC,
+                    0,
+                    s->service_name,
+                    s->service_type,
+                    NULL,
+                    txt) >= 0) {
+
+            pa_log_debug("Updated TXT record of %s.", s->service_name);
+            goto published;
+        }
+
+        pa_log_debug("avahi_entry_group_update_service_txt_strlst(): %s", avahi_strerror(avahi_client_errno(s->userdata->client)));
+    }
+
+    avahi_string_list_free(s->txt);
+    s->txt = NULL;
+
     if (!s->entry_group) {
         if (!(s->entry_group = avahi_entry_group_new(s->userdata->client, service_entry_group_callback, s))) {
             pa_log("avahi_entry_group_new(): %s", avahi_strerror(avahi_client_errno(s->userdata->client)));
@@ -296,28 +383,6 @@ static void publish_service(pa_mainloop_api *api PA_GCC_UNUSED, void *service) {
     } else
         avahi_entry_group_reset(s->entry_group);
 
-    txt = txt_record_server_data(s->userdata->core, txt);
-
-    txt = avahi_string_list_add_pair(txt, "device", s->name);
-    txt = avahi_string_list_add_printf(txt, "rate=%u", s->ss.rate);
-    txt = avahi_string_list_add_printf(txt, "channels=%u", s->ss.channels);
-    txt = avahi_string_list_add_pair(txt, "format", pa_sample_format_to_string(s->ss.format));
-    txt = avahi_string_list_add_pair(txt, "channel_map", pa_channel_map_snprint(cm, sizeof(cm), &s->cm));
-    txt = avahi_string_list_add_pair(txt, "subtype", subtype_text[s->subtype]);
-
-    if ((t = pa_proplist_gets(s->proplist, PA_PROP_DEVICE_DESCRIPTION)))
-        txt = avahi_string_list_add_pair(txt, "description", t);
-    if ((t = pa_proplist_gets(s->proplist, PA_PROP_DEVICE_ICON_NAME)))
-        txt = avahi_string_list_add_pair(txt, "icon-name", t);
-    if ((t = pa_proplist_gets(s->proplist, PA_PROP_DEVICE_VENDOR_NAME)))
-        txt = avahi_string_list_add_pair(txt, "vendor-name", t);
-    if ((t = pa_proplist_gets(s->proplist, PA_PROP_DEVICE_PRODUCT_NAME)))
-        txt = avahi_string_list_add_pair(txt, "product-name", t);
-    if ((t = pa_proplist_gets(s->proplist, PA_PROP_DEVICE_CLASS)))
-        txt = avahi_string_list_add_pair(txt, "class", t);
-    if ((t = pa_proplist_gets(s->proplist, PA_PROP_DEVICE_FORM_FACTOR)))
-        txt = avahi_string_list_add_pair(txt, "form-factor", t);
-
     if (avahi_entry_group_add_service_strlst(
                 s->entry_group,
                 AVAHI_IF_UNSPEC, AVAHI_PROTO_UNSPEC,
@@ -367,9 +432,13 @@ static void publish_service(pa_mainloop_api *api PA_GCC_UNUSED, void *service) {
         goto finish;
     }
 
-    r = 0;
     pa_log_debug("Successfully created entry group for %s.", s->service_name);
 
+published:
+    s->txt = txt;
+    txt = NULL;
+    r = 0;
+
 finish:
 
     /* Remove this service */
@@ -392,13 +461,21 @@ static struct service *get_service(struct userdata *u, pa_object *device) {
 
     pa_threaded_mainloop_lock(u->mainloop);
 
-    if ((s = pa_hashmap_get(u->services, device)))
+    if ((s = pa_hashmap_get(u->services, device))) {
+        /* Pick up whatever changed */
+        pa_xfree(s->name);
+        pa_proplist_free(s->proplist);
+        get_service_data(s, device);
         goto out;
+    }
 
     s = pa_xnew(struct service, 1);
     s->key = device;
     s->userdata = u;
     s->entry_group = NULL;
+    s->txt = NULL;
+    s->pending = false;
+    PA_LLIST_INIT(struct service, s);
 
     get_service_data(s, device);
 
@@ -430,6 +507,10 @@ static void service_free(struct service *s) {
         avahi_entry_group_free(s->entry_group);
     }
 
+    if (s->pending)
+        PA_LLIST_REMOVE(struct service, s->userdata->pending, s);
+
+    avahi_string_list_free(s->txt);
     pa_xfree(s->service_name);
 
     pa_xfree(s->name);
@@ -451,6 +532,44 @@ static pa_bool_t shall_ignore(pa_object *o) {
     pa_assert_not_reached();
 }
 
+/* Runs in Avahi mainloop context */
+static void publish_pending_cb(pa_mainloop_api *a, pa_time_event *e, const struct timeval *t, void *userdata) {
+    struct userdata *u = userdata;
+    struct service *s;
+
+    pa_assert(u);
+
+    u->publish_scheduled = false;
+
+    while ((s = u->pending)) {
+        PA_LLIST_REMOVE(struct service, u->pending, s);
+        s->pending = false;
+
+        publish_service(NULL, s);
+    }
+}
+
+/* Runs in PA mainloop context, with the Avahi mainloop locked. Changes
+ * tend to come in bursts, a profile switch touches all devices of a card
+ * for example, so they are collected for a moment and then published in
+ * one go from the Avahi mainloop. */
+static void schedule_publish(struct userdata *u, struct service *s) {
+    struct timeval tv;
+
+    pa_assert(u);
+    pa_assert(s);
+
+    if (!s->pending) {
+        s->pending = true;
+        PA_LLIST_PREPEND(struct service, u->pending, s);
+    }
+
+    if (!u->publish_scheduled) {
+        u->publish_scheduled = true;
+        u->api->time_restart(u->publish_event, pa_timeval_rtstore(&tv, pa_rtclock_now() + PUBLISH_DELAY_USEC, TRUE));
+    }
+}
+
 /* Runs in PA mainloop context */
 static pa_hook_result_t device_new_or_changed_cb(pa_core *c, pa_object *o, struct userdata *u) {
     pa_assert(c);
@@ -458,7 +577,7 @@ static pa_hook_result_t device_new_or_changed_cb(pa_core *c, pa_object *o, struc
 
     if (!shall_ignore(o)) {
         pa_threaded_mainloop_lock(u->mainloop);
-        pa_mainloop_api_once(u->api, publish_service, get_service(u, o));
+        schedule_publish(u, get_service(u, o));
         pa_threaded_mainloop_unlock(u->mainloop);
     }
 
@@ -580,14 +699,14 @@ static int publish_all_services(struct userdata *u) {
     for (sink = PA_SINK(pa_idxset_first(u->core->sinks, &idx)); sink; sink = PA_SINK(pa_idxset_next(u->core->sinks, &idx)))
         if (!shall_ignore(PA_OBJECT(sink))) {
             pa_threaded_mainloop_lock(u->mainloop);
-            pa_mainloop_api_once(u->api, publish_service, get_service(u, PA_OBJECT(sink)));
+            schedule_publish(u, get_service(u, PA_OBJECT(sink)));
             pa_threaded_mainloop_unlock(u->mainloop);
         }
 
     for (source = PA_SOURCE(pa_idxset_first(u->core->sources, &idx)); source; source = PA_SOURCE(pa_idxset_next(u->core->sources, &idx)))
         if (!shall_ignore(PA_OBJECT(source))) {
             pa_threaded_mainloop_lock(u->mainloop);
-            pa_mainloop_api_once(u->api, publish_service, get_service(u, PA_OBJECT(source)));
+            schedule_publish(u, get_service(u, PA_OBJECT(source)));
             pa_threaded_mainloop_unlock(u->mainloop);
         }
 
@@ -610,6 +729,9 @@ static void unpublish_all_services(struct userdata *u, pa_bool_t rem) {
     pa_log_debug("Unpublishing services in Zeroconf");
 
     while ((s = pa_hashmap_iterate(u->services, &state, NULL))) {
+        avahi_string_list_free(s->txt);
+        s->txt = NULL;
+
         if (s->entry_group) {
             if (rem) {
                 pa_log_debug("Removing entry group for %s.", s->service_name);
@@ -756,6 +878,10 @@ int pa__init(pa_module*m) {
 
     u->main_entry_group = NULL;
 
+    PA_LLIST_HEAD_INIT(struct service, u->pending);
+    u->publish_event = u->api->time_new(u->api, NULL, publish_pending_cb, u);
+    u->publish_scheduled = false;
+
     un = pa_get_user_name_malloc();
     hn = pa_get_host_name_malloc();
     u->service_name = pa_truncate_utf8(pa_sprintf_malloc("%s@%s", un, hn), AVAHI_LABEL_MAX-1);
@@ -788,6 +914,8 @@ static void client_free(pa_mainloop_api *api PA_GCC_UNUSED, void *userdata) {
 
     pa_hashmap_free(u->services, (pa_free_cb_t) service_free);
 
+    u->api->time_free(u->publish_event);
+
     if (u->main_entry_group)
         avahi_entry_group_free(u->main_entry_group);
 
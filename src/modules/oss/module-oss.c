@@ -52,8 +52,11 @@
 
 #include <pulse/xmalloc.h>
 #include <pulse/util.h>
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
 
 #include <pulsecore/core-error.h>
+#include <pulsecore/core-rtclock.h>
 #include <pulsecore/thread.h>
 #include <pulsecore/sink.h>
 #include <pulsecore/source.h>
@@ -66,6 +69,7 @@
 #include <pulsecore/thread-mq.h>
 #include <pulsecore/rtpoll.h>
 #include <pulsecore/poll.h>
+#include <pulsecore/time-smoother.h>
 
 #if defined(__NetBSD__) && !defined(SNDCTL_DSP_GETODELAY)
 #include <sys/audioio.h>
@@ -93,13 +97,34 @@ PA_MODULE_USAGE(
         "channel_map=<channel map> "
         "fragments=<number of fragments> "
         "fragment_size=<fragment size> "
-        "mmap=<enable memory mapping?>");
+        "mmap=<enable memory mapping?> "
+        "tsched=<enable system timer based scheduling mode?> "
+        "tsched_buffer_size=<buffer size when using timer based scheduling> "
+        "tsched_buffer_watermark=<lower fill watermark>");
 #ifdef __linux__
 PA_MODULE_DEPRECATED("Please use module-alsa-card instead of module-oss!");
 #endif
 
 #define DEFAULT_DEVICE "/dev/dsp"
 
+#define DEFAULT_TSCHED_BUFFER_USEC (2*PA_USEC_PER_SEC)             /* 2s    -- Overall buffer size */
+#define DEFAULT_TSCHED_WATERMARK_USEC (20*PA_USEC_PER_MSEC)        /* 20ms  -- Fill up when only this much is left in the buffer */
+
+#define TSCHED_WATERMARK_INC_STEP_USEC (10*PA_USEC_PER_MSEC)       /* 10ms  -- On underrun, increase watermark by this */
+#define TSCHED_WATERMARK_DEC_STEP_USEC (5*PA_USEC_PER_MSEC)        /* 5ms   -- When everything's great, decrease watermark by this */
+#define TSCHED_WATERMARK_VERIFY_AFTER_USEC (20*PA_USEC_PER_SEC)    /* 20s   -- How long after a drop out recheck if things are good now */
+#define TSCHED_WATERMARK_INC_THRESHOLD_USEC (0*PA_USEC_PER_MSEC)   /* 0ms   -- If the buffer level ever below this threshold, increase the watermark */
+#define TSCHED_WATERMARK_DEC_THRESHOLD_USEC (100*PA_USEC_PER_MSEC) /* 100ms -- If the buffer level didn't drop below this threshold in the verification time, decrease the watermark */
+
+#define TSCHED_MIN_SLEEP_USEC (10*PA_USEC_PER_MSEC)                /* 10ms  -- Sleep at least 10ms on each iteration */
+#define TSCHED_MIN_WAKEUP_USEC (4*PA_USEC_PER_MSEC)                /* 4ms   -- Wakeup at least this long before the buffer runs empty*/
+
+#define SMOOTHER_WINDOW_USEC  (10*PA_USEC_PER_SEC)                 /* 10s   -- smoother windows size */
+#define SMOOTHER_ADJUST_USEC  (1*PA_USEC_PER_SEC)                  /* 1s    -- smoother adjust time */
+
+#define SMOOTHER_MIN_INTERVAL (2*PA_USEC_PER_MSEC)                 /* 2ms   -- min smoother update interval */
+#define SMOOTHER_MAX_INTERVAL (200*PA_USEC_PER_MSEC)               /* 200ms -- max smoother update interval */
+
 struct userdata {
     pa_core *core;
     pa_module *module;
@@ -136,6 +161,24 @@ struct userdata {
 
     int in_mmap_saved_nfrags, out_mmap_saved_nfrags;
 
+    /* Timer based scheduling of the mmap playback path */
+    pa_bool_t use_tsched;
+    pa_bool_t out_first;
+    uint64_t out_write_count, out_play_count;
+    uint32_t out_last_bytes;
+
+    size_t out_hwbuf_unused;
+    size_t tsched_watermark;
+    size_t min_sleep, min_wakeup;
+    size_t watermark_inc_step, watermark_dec_step;
+    size_t watermark_inc_threshold, watermark_dec_threshold;
+    pa_usec_t tsched_watermark_usec;
+    pa_usec_t watermark_dec_not_before;
+
+    pa_smoother *smoother;
+    pa_usec_t smoother_interval;
+    pa_usec_t last_smoother_update;
+
     pa_rtpoll_item *rtpoll_item;
 };
 
@@ -154,6 +197,9 @@ static const char* const valid_modargs[] = {
     "channels",
     "channel_map",
     "mmap",
+    "tsched",
+    "tsched_buffer_size",
+    "tsched_buffer_watermark",
     NULL
 };
 
@@ -194,6 +240,15 @@ static int trigger(struct userdata *u, pa_bool_t quick) {
             pa_silence_memory(u->out_mmap, u->out_hwbuf_size, &u->sink->sample_spec);
         }
 
+        /* Playback starts over from a silent buffer, find our position
+         * in it again with the next write */
+        if (u->use_tsched && (!quick || !(enable_bits & PCM_ENABLE_OUTPUT))) {
+            if (!u->out_first)
+                pa_smoother_pause(u->smoother, pa_rtclock_now());
+
+            u->out_first = TRUE;
+        }
+
     } else {
 
         if (enable_bits)
@@ -407,6 +462,384 @@ static pa_usec_t mmap_source_get_latency(struct userdata *u) {
     return pa_bytes_to_usec(n, &u->source->sample_spec);
 }
 
+static void fix_min_sleep_wakeup(struct userdata *u) {
+    size_t max_use, max_use_2;
+
+    pa_assert(u);
+    pa_assert(u->use_tsched);
+
+    max_use = u->out_hwbuf_size - u->out_hwbuf_unused;
+    max_use_2 = pa_frame_align(max_use/2, &u->sink->sample_spec);
+
+    u->min_sleep = pa_usec_to_bytes(TSCHED_MIN_SLEEP_USEC, &u->sink->sample_spec);
+    u->min_sleep = PA_CLAMP(u->min_sleep, u->frame_size, max_use_2);
+
+    u->min_wakeup = pa_usec_to_bytes(TSCHED_MIN_WAKEUP_USEC, &u->sink->sample_spec);
+    u->min_wakeup = PA_CLAMP(u->min_wakeup, u->frame_size, max_use_2);
+}
+
+static void fix_tsched_watermark(struct userdata *u) {
+    size_t max_use;
+    pa_assert(u);
+    pa_assert(u->use_tsched);
+
+    max_use = u->out_hwbuf_size - u->out_hwbuf_unused;
+
+    if (u->tsched_watermark > max_use - u->min_sleep)
+        u->tsched_watermark = max_use - u->min_sleep;
+
+    if (u->tsched_watermark < u->min_wakeup)
+        u->tsched_watermark = u->min_wakeup;
+
+    u->tsched_watermark_usec = pa_bytes_to_usec(u->tsched_watermark, &u->sink->sample_spec);
+}
+
+static void increase_watermark(struct userdata *u) {
+    size_t old_watermark;
+    pa_usec_t old_min_latency, new_min_latency;
+
+    pa_assert(u);
+    pa_assert(u->use_tsched);
+
+    /* First, just try to increase the watermark */
+    old_watermark = u->tsched_watermark;
+    u->tsched_watermark = PA_MIN(u->tsched_watermark * 2, u->tsched_watermark + u->watermark_inc_step);
+    fix_tsched_watermark(u);
+
+    if (old_watermark != u->tsched_watermark) {
+        pa_log_info("Increasing wakeup watermark to %0.2f ms",
+                    (double) u->tsched_watermark_usec / PA_USEC_PER_MSEC);
+        return;
+    }
+
+    /* Hmm, we cannot increase the watermark any further, hence let's
+       raise the latency */
+    old_min_latency = u->sink->thread_info.min_latency;
+    new_min_latency = PA_MIN(old_min_latency * 2, old_min_latency + TSCHED_WATERMARK_INC_STEP_USEC);
+    new_min_latency = PA_MIN(new_min_latency, u->sink->thread_info.max_latency);
+
+    if (old_min_latency != new_min_latency) {
+        pa_log_info("Increasing minimal latency to %0.2f ms",
+                    (double) new_min_latency / PA_USEC_PER_MSEC);
+
+        pa_sink_set_latency_range_within_thread(u->sink, new_min_latency, u->sink->thread_info.max_latency);
+    }
+}
+
+static void decrease_watermark(struct userdata *u) {
+    size_t old_watermark;
+    pa_usec_t now;
+
+    pa_assert(u);
+    pa_assert(u->use_tsched);
+
+    now = pa_rtclock_now();
+
+    if (u->watermark_dec_not_before <= 0)
+        goto restart;
+
+    if (u->watermark_dec_not_before > now)
+        return;
+
+    old_watermark = u->tsched_watermark;
+
+    if (u->tsched_watermark < u->watermark_dec_step)
+        u->tsched_watermark = u->tsched_watermark / 2;
+    else
+        u->tsched_watermark = PA_MAX(u->tsched_watermark / 2, u->tsched_watermark - u->watermark_dec_step);
+
+    fix_tsched_watermark(u);
+
+    if (old_watermark != u->tsched_watermark)
+        pa_log_info("Decreasing wakeup watermark to %0.2f ms",
+                    (double) u->tsched_watermark_usec / PA_USEC_PER_MSEC);
+
+    /* We don't change the latency range*/
+
+restart:
+    u->watermark_dec_not_before = now + TSCHED_WATERMARK_VERIFY_AFTER_USEC;
+}
+
+static void hw_sleep_time(struct userdata *u, pa_usec_t *sleep_usec, pa_usec_t*process_usec) {
+    pa_usec_t usec, wm;
+
+    pa_assert(sleep_usec);
+    pa_assert(process_usec);
+
+    pa_assert(u);
+    pa_assert(u->use_tsched);
+
+    usec = pa_sink_get_requested_latency_within_thread(u->sink);
+
+    if (usec == (pa_usec_t) -1)
+        usec = pa_bytes_to_usec(u->out_hwbuf_size, &u->sink->sample_spec);
+
+    wm = u->tsched_watermark_usec;
+
+    if (wm > usec)
+        wm = usec/2;
+
+    *sleep_usec = usec - wm;
+    *process_usec = wm;
+}
+
+/* Called from IO context */
+static void update_hwbuf_unused(struct userdata *u) {
+    pa_usec_t latency;
+
+    pa_assert(u);
+    pa_assert(u->use_tsched);
+
+    /* Use the full buffer if no one asked us for anything specific */
+    u->out_hwbuf_unused = 0;
+
+    if ((latency = pa_sink_get_requested_latency_within_thread(u->sink)) != (pa_usec_t) -1) {
+        size_t b;
+
+        pa_log_debug("Latency set to %0.2fms", (double) latency / PA_USEC_PER_MSEC);
+
+        b = pa_usec_to_bytes(latency, &u->sink->sample_spec);
+
+        /* We need at least one sample in our buffer */
+
+        if (PA_UNLIKELY(b < u->frame_size))
+            b = u->frame_size;
+
+        u->out_hwbuf_unused = PA_LIKELY(b < u->out_hwbuf_size) ? (u->out_hwbuf_size - b) : 0;
+    }
+
+    fix_min_sleep_wakeup(u);
+    fix_tsched_watermark(u);
+
+    pa_log_debug("hwbuf_unused=%lu", (unsigned long) u->out_hwbuf_unused);
+
+    pa_sink_set_max_request_within_thread(u->sink, u->out_hwbuf_size - u->out_hwbuf_unused);
+    pa_sink_set_max_rewind_within_thread(u->sink, u->out_hwbuf_size);
+}
+
+/* Called from main context when creating the sink */
+static void reset_watermark(struct userdata *u, size_t tsched_watermark, pa_sample_spec *ss) {
+    u->tsched_watermark = pa_usec_to_bytes_round_up(pa_bytes_to_usec_round_up(tsched_watermark, ss),
+                                                    &u->sink->sample_spec);
+
+    u->watermark_inc_step = pa_usec_to_bytes(TSCHED_WATERMARK_INC_STEP_USEC, &u->sink->sample_spec);
+    u->watermark_dec_step = pa_usec_to_bytes(TSCHED_WATERMARK_DEC_STEP_USEC, &u->sink->sample_spec);
+
+    u->watermark_inc_threshold = pa_usec_to_bytes_round_up(TSCHED_WATERMARK_INC_THRESHOLD_USEC, &u->sink->sample_spec);
+    u->watermark_dec_threshold = pa_usec_to_bytes_round_up(TSCHED_WATERMARK_DEC_THRESHOLD_USEC, &u->sink->sample_spec);
+
+    fix_min_sleep_wakeup(u);
+    fix_tsched_watermark(u);
+
+    /* The fragment the hardware is working on cannot be refilled, so
+     * never ask for less than two */
+    pa_sink_set_latency_range(u->sink,
+                              pa_bytes_to_usec(2 * u->out_fragment_size, &u->sink->sample_spec),
+                              pa_bytes_to_usec(u->out_hwbuf_size, &u->sink->sample_spec));
+
+    pa_log_info("Time scheduling watermark is %0.2fms",
+                (double) u->tsched_watermark_usec / PA_USEC_PER_MSEC);
+}
+
+/* Called from IO context */
+static int mmap_update_position(struct userdata *u) {
+    struct count_info info;
+
+    pa_assert(u);
+
+    if (ioctl(u->fd, SNDCTL_DSP_GETOPTR, &info) < 0) {
+        pa_log("SNDCTL_DSP_GETOPTR: %s", pa_cstrerror(errno));
+        return -1;
+    }
+
+    /* The byte counter of the driver is an int and wraps around, only
+     * the progress since the last query counts. Before the first write
+     * we start counting at the position in the buffer, so that the
+     * counters map onto it. */
+    if (!u->out_first)
+        u->out_play_count += (uint32_t) info.bytes - u->out_last_bytes;
+    else
+        u->out_play_count = (uint64_t) info.ptr;
+
+    u->out_last_bytes = (uint32_t) info.bytes;
+
+    return 0;
+}
+
+/* Called from IO context. Unlike mmap_write() this is not bound to
+ * fragments, it keeps the buffer filled up to the requested latency and
+ * tells when the fill level will have dropped to the watermark. */
+static int mmap_tsched_write(struct userdata *u, pa_usec_t *sleep_usec, pa_bool_t on_timeout) {
+    pa_bool_t work_done = FALSE, underrun = FALSE;
+    pa_usec_t max_sleep_usec = 0, process_usec = 0;
+    size_t left_to_play;
+
+    pa_assert(u);
+    pa_assert(u->sink);
+    pa_assert(u->use_tsched);
+
+    hw_sleep_time(u, &max_sleep_usec, &process_usec);
+
+    if (mmap_update_position(u) < 0)
+        return -1;
+
+    if (u->out_first || u->out_play_count >= u->out_write_count) {
+
+        /* Either the buffer is all silence or we got a dropout and the
+         * hardware went on playing whatever was left in it. Go on
+         * writing right after the fragment it is working on. */
+        if (!u->out_first) {
+            if (pa_log_ratelimit(PA_LOG_INFO))
+                pa_log_info("Underrun!");
+
+            underrun = TRUE;
+        }
+
+        u->out_write_count = u->out_play_count + u->out_fragment_size;
+        u->out_write_count -= u->out_write_count % u->frame_size;
+    }
+
+    left_to_play = (size_t) (u->out_write_count - u->out_play_count);
+
+    if (!u->out_first) {
+        pa_bool_t reset_not_before = TRUE;
+
+        if (underrun || left_to_play < u->watermark_inc_threshold)
+            increase_watermark(u);
+        else if (left_to_play > u->watermark_dec_threshold) {
+            reset_not_before = FALSE;
+
+            /* We decrease the watermark only if have actually been
+             * woken up by a timeout. If something else woke us up it's
+             * too easy to fulfill the deadlines... */
+
+            if (on_timeout)
+                decrease_watermark(u);
+        }
+
+        if (reset_not_before)
+            u->watermark_dec_not_before = 0;
+    }
+
+    /* We won't fill up the playback buffer before at least half the
+     * sleep time is over because otherwise we might ask for more data
+     * from the clients then they expect. */
+    if (u->out_first ||
+        pa_bytes_to_usec(left_to_play, &u->sink->sample_spec) <= process_usec+max_sleep_usec/2) {
+        size_t n_bytes, max_block;
+
+        n_bytes = u->out_hwbuf_size > left_to_play ? u->out_hwbuf_size - left_to_play : 0;
+        n_bytes = n_bytes > u->out_hwbuf_unused ? pa_frame_align(n_bytes - u->out_hwbuf_unused, &u->sink->sample_spec) : 0;
+
+        /* Make sure that if these memblocks need to be copied they will fit into one slot */
+        max_block = pa_frame_align(pa_mempool_block_size_max(u->core->mempool), &u->sink->sample_spec);
+
+        while (n_bytes > 0) {
+            pa_memchunk chunk;
+            size_t offset, l;
+
+            /* The free space may be split over the end of the buffer */
+            offset = (size_t) (u->out_write_count % u->out_hwbuf_size);
+            l = PA_MIN(n_bytes, u->out_hwbuf_size - offset);
+            l = PA_MIN(l, max_block);
+
+            chunk.memblock = pa_memblock_new_fixed(u->core->mempool, (uint8_t*) u->out_mmap + offset, l, TRUE);
+            chunk.length = l;
+            chunk.index = 0;
+
+            pa_sink_render_into_full(u->sink, &chunk);
+            pa_memblock_unref_fixed(chunk.memblock);
+
+            u->out_write_count += l;
+            left_to_play += l;
+            n_bytes -= l;
+            work_done = TRUE;
+        }
+    }
+
+    *sleep_usec = pa_bytes_to_usec(left_to_play, &u->sink->sample_spec);
+
+    if (*sleep_usec > u->tsched_watermark_usec)
+        *sleep_usec -= u->tsched_watermark_usec;
+    else
+        *sleep_usec = 0;
+
+    return work_done ? 1 : 0;
+}
+
+/* Called from IO context */
+static int process_rewind(struct userdata *u) {
+    size_t rewind_nbytes, limit_nbytes = 0;
+
+    pa_assert(u);
+    pa_assert(u->use_tsched);
+
+    if (!PA_SINK_IS_OPENED(u->sink->thread_info.state) || u->out_first) {
+        pa_sink_process_rewind(u->sink, 0);
+        return 0;
+    }
+
+    rewind_nbytes = u->sink->thread_info.rewind_nbytes;
+
+    pa_log_debug("Requested to rewind %lu bytes.", (unsigned long) rewind_nbytes);
+
+    if (mmap_update_position(u) < 0)
+        return -1;
+
+    /* The hardware may already have fetched the fragment it is playing,
+     * leave that alone */
+    if (u->out_write_count > u->out_play_count + u->out_fragment_size)
+        limit_nbytes = (size_t) (u->out_write_count - u->out_play_count - u->out_fragment_size);
+
+    rewind_nbytes = pa_frame_align(PA_MIN(rewind_nbytes, limit_nbytes), &u->sink->sample_spec);
+
+    if (rewind_nbytes > 0) {
+        u->out_write_count -= rewind_nbytes;
+        pa_log_debug("Rewound %lu bytes.", (unsigned long) rewind_nbytes);
+    } else
+        pa_log_debug("Mhmm, actually there is nothing to rewind.");
+
+    pa_sink_process_rewind(u->sink, rewind_nbytes);
+    return 0;
+}
+
+/* Called from IO context */
+static void update_smoother(struct userdata *u) {
+    pa_usec_t now;
+
+    pa_assert(u);
+
+    now = pa_rtclock_now();
+
+    /* check if the time since the last update is bigger than the interval */
+    if (u->last_smoother_update > 0)
+        if (u->last_smoother_update + u->smoother_interval > now)
+            return;
+
+    pa_smoother_put(u->smoother, now, pa_bytes_to_usec(u->out_play_count, &u->sink->sample_spec));
+
+    u->last_smoother_update = now;
+    /* exponentially increase the update interval up to the MAX limit */
+    u->smoother_interval = PA_MIN (u->smoother_interval * 2, SMOOTHER_MAX_INTERVAL);
+}
+
+static pa_usec_t tsched_sink_get_latency(struct userdata *u) {
+    int64_t delay;
+    pa_usec_t now1, now2;
+
+    pa_assert(u);
+
+    if (u->out_first)
+        return 0;
+
+    now1 = pa_rtclock_now();
+    now2 = pa_smoother_get(u->smoother, now1);
+
+    delay = (int64_t) pa_bytes_to_usec(u->out_write_count, &u->sink->sample_spec) - (int64_t) now2;
+
+    return delay >= 0 ? (pa_usec_t) delay : 0;
+}
+
 static pa_usec_t io_sink_get_latency(struct userdata *u) {
     pa_usec_t r = 0;
 
@@ -494,6 +927,13 @@ static int suspend(struct userdata *u) {
 
     pa_log_info("Suspending...");
 
+    if (u->use_tsched) {
+        if (!u->out_first)
+            pa_smoother_pause(u->smoother, pa_rtclock_now());
+
+        u->out_first = TRUE;
+    }
+
     if (u->out_mmap_memblocks) {
         unsigned i;
         for (i = 0; i < u->out_nfrags; i++)
@@ -655,7 +1095,9 @@ static int sink_process_msg(pa_msgobject *o, int code, void *data, int64_t offse
             pa_usec_t r = 0;
 
             if (u->fd >= 0) {
-                if (u->use_mmap)
+                if (u->use_tsched)
+                    r = tsched_sink_get_latency(u);
+                else if (u->use_mmap)
                     r = mmap_sink_get_latency(u);
                 else
                     r = io_sink_get_latency(u);
@@ -811,6 +1253,27 @@ static int source_process_msg(pa_msgobject *o, int code, void *data, int64_t off
     return ret;
 }
 
+/* Called from IO context */
+static void sink_update_requested_latency_cb(pa_sink *s) {
+    struct userdata *u = s->userdata;
+    size_t before;
+
+    pa_assert(u);
+    pa_assert(u->use_tsched); /* only when timer scheduling is used
+                               * we can dynamically adjust the
+                               * latency */
+
+    before = u->out_hwbuf_unused;
+    update_hwbuf_unused(u);
+
+    /* If we use a smaller part of the buffer now, drop what is queued
+     * beyond it, so that the new latency applies right away */
+    if (u->out_hwbuf_unused > before) {
+        pa_log_debug("Requesting rewind due to latency change.");
+        pa_sink_request_rewind(u->sink, (size_t) -1);
+    }
+}
+
 static void sink_get_volume(pa_sink *s) {
     struct userdata *u;
 
@@ -899,17 +1362,54 @@ static void thread_func(void *userdata) {
 
     for (;;) {
         int ret;
+        pa_usec_t rtpoll_sleep = 0;
 
 /*        pa_log("loop");    */
 
-        if (PA_UNLIKELY(u->sink && u->sink->thread_info.rewind_requested))
-            pa_sink_process_rewind(u->sink, 0);
+        if (PA_UNLIKELY(u->sink && u->sink->thread_info.rewind_requested)) {
+            if (u->use_tsched) {
+                if (process_rewind(u) < 0)
+                    goto fail;
+            } else
+                pa_sink_process_rewind(u->sink, 0);
+        }
 
         /* Render some data and write it to the dsp */
 
         if (u->sink && PA_SINK_IS_OPENED(u->sink->thread_info.state) && ((revents & POLLOUT) || u->use_mmap || u->use_getospace)) {
 
-            if (u->use_mmap) {
+            if (u->use_tsched) {
+                pa_usec_t sleep_usec = 0, cusec;
+
+                if ((ret = mmap_tsched_write(u, &sleep_usec, pa_rtpoll_timer_elapsed(u->rtpoll))) < 0)
+                    goto fail;
+
+                revents &= ~POLLOUT;
+
+                if (ret > 0 && u->out_first) {
+                    pa_log_info("Starting playback.");
+
+                    pa_smoother_reset(u->smoother, pa_rtclock_now(), FALSE);
+                    u->smoother_interval = SMOOTHER_MIN_INTERVAL;
+                    u->last_smoother_update = 0;
+
+                    u->out_first = FALSE;
+                }
+
+                if (!u->out_first) {
+                    update_smoother(u);
+
+                    /* Let the main thread read the latency without asking us */
+                    pa_sink_publish_latency(u->sink, tsched_sink_get_latency(u));
+                }
+
+                /* Convert from the sound card time domain to the
+                 * system time domain. We don't trust the conversion,
+                 * so we wake up whatever comes first */
+                cusec = pa_smoother_translate(u->smoother, pa_rtclock_now(), sleep_usec);
+                rtpoll_sleep = PA_MAX(PA_MIN(sleep_usec, cusec), 1U);
+
+            } else if (u->use_mmap) {
 
                 if ((ret = mmap_write(u)) < 0)
                     goto fail;
@@ -1119,15 +1619,22 @@ static void thread_func(void *userdata) {
 
 /*         pa_log("loop2 revents=%i", revents); */
 
+        if (rtpoll_sleep > 0)
+            pa_rtpoll_set_timer_relative(u->rtpoll, rtpoll_sleep);
+        else
+            pa_rtpoll_set_timer_disabled(u->rtpoll);
+
         if (u->rtpoll_item) {
             struct pollfd *pollfd;
 
             pa_assert(u->fd >= 0);
 
+            /* With timer scheduling the device does not wake us up for
+             * playback, only the timer does */
             pollfd = pa_rtpoll_item_get_pollfd(u->rtpoll_item, NULL);
             pollfd->events = (short)
                 (((u->source && PA_SOURCE_IS_OPENED(u->source->thread_info.state)) ? POLLIN : 0) |
-                 ((u->sink && PA_SINK_IS_OPENED(u->sink->thread_info.state)) ? POLLOUT : 0));
+                 ((u->sink && PA_SINK_IS_OPENED(u->sink->thread_info.state) && !u->use_tsched) ? POLLOUT : 0));
         }
 
         /* Hmm, nothing to do. Let's sleep */
@@ -1170,8 +1677,9 @@ int pa__init(pa_module*m) {
     int fd = -1;
     int nfrags, orig_frag_size, frag_size;
     int mode, caps;
-    pa_bool_t record = TRUE, playback = TRUE, use_mmap = TRUE;
-    pa_sample_spec ss;
+    pa_bool_t record = TRUE, playback = TRUE, use_mmap = TRUE, use_tsched = TRUE;
+    uint32_t tsched_size, tsched_watermark;
+    pa_sample_spec ss, requested_ss;
     pa_channel_map map;
     pa_modargs *ma = NULL;
     char hwdesc[64];
@@ -1221,6 +1729,21 @@ int pa__init(pa_module*m) {
         goto fail;
     }
 
+    requested_ss = ss;
+    tsched_size = (uint32_t) pa_usec_to_bytes(DEFAULT_TSCHED_BUFFER_USEC, &ss);
+    tsched_watermark = (uint32_t) pa_usec_to_bytes(DEFAULT_TSCHED_WATERMARK_USEC, &ss);
+
+    if (pa_modargs_get_value_boolean(ma, "tsched", &use_tsched) < 0) {
+        pa_log("Failed to parse tsched argument.");
+        goto fail;
+    }
+
+    if (pa_modargs_get_value_u32(ma, "tsched_buffer_size", &tsched_size) < 0 ||
+        pa_modargs_get_value_u32(ma, "tsched_buffer_watermark", &tsched_watermark) < 0) {
+        pa_log("Failed to parse tsched_buffer_size/tsched_buffer_watermark arguments.");
+        goto fail;
+    }
+
     if ((fd = pa_oss_open(dev = pa_modargs_get_value(ma, "device", DEFAULT_DEVICE), &mode, &caps)) < 0)
         goto fail;
 
@@ -1234,6 +1757,16 @@ int pa__init(pa_module*m) {
         use_mmap = FALSE;
     }
 
+    if (use_tsched && (!use_mmap || mode == O_RDONLY || !pa_rtclock_hrtimer())) {
+        pa_log_info("Cannot enable timer-based scheduling, falling back to sound IRQ scheduling.");
+        use_tsched = FALSE;
+    }
+
+    /* With timer scheduling the wakeups don't depend on the fragment
+     * size, so ask for a large buffer unless told otherwise */
+    if (use_tsched && !pa_modargs_get_value(ma, "fragments", NULL))
+        nfrags = PA_MAX((int) (tsched_size / (uint32_t) frag_size), 2);
+
     if (pa_oss_get_hw_description(dev, hwdesc, sizeof(hwdesc)) >= 0)
         pa_log_info("Hardware name is '%s'.", hwdesc);
     else
@@ -1271,6 +1804,8 @@ int pa__init(pa_module*m) {
     u->out_fragment_size = u->in_fragment_size = (uint32_t) (u->frag_size = frag_size);
     u->orig_frag_size = orig_frag_size;
     u->use_mmap = use_mmap;
+    u->use_tsched = use_tsched;
+    u->out_first = TRUE;
     u->rtpoll = pa_rtpoll_new();
     pa_thread_mq_init(&u->thread_mq, m->core->mainloop, u->rtpoll);
     u->rtpoll_item = NULL;
@@ -1373,6 +1908,11 @@ int pa__init(pa_module*m) {
             }
         }
 
+        if (u->use_tsched && (!use_mmap || u->out_hwbuf_size % u->frame_size != 0)) {
+            pa_log_info("Playback buffer not usable for timer-based scheduling, falling back to sound IRQ scheduling.");
+            u->use_tsched = FALSE;
+        }
+
         if ((name = pa_modargs_get_value(ma, "sink_name", NULL)))
             namereg_fail = TRUE;
         else {
@@ -1400,7 +1940,7 @@ int pa__init(pa_module*m) {
             goto fail;
         }
 
-        u->sink = pa_sink_new(m->core, &sink_new_data, PA_SINK_HARDWARE|PA_SINK_LATENCY);
+        u->sink = pa_sink_new(m->core, &sink_new_data, PA_SINK_HARDWARE|PA_SINK_LATENCY|(u->use_tsched ? PA_SINK_DYNAMIC_LATENCY : 0));
         pa_sink_new_data_done(&sink_new_data);
         pa_xfree(name_buf);
 
@@ -1414,12 +1954,29 @@ int pa__init(pa_module*m) {
 
         pa_sink_set_asyncmsgq(u->sink, u->thread_mq.inq);
         pa_sink_set_rtpoll(u->sink, u->rtpoll);
-        pa_sink_set_fixed_latency(u->sink, pa_bytes_to_usec(u->out_hwbuf_size, &u->sink->sample_spec));
         u->sink->refresh_volume = TRUE;
 
         pa_sink_set_max_request(u->sink, u->out_hwbuf_size);
 
-        if (use_mmap)
+        if (u->use_tsched) {
+            u->sink->update_requested_latency = sink_update_requested_latency_cb;
+
+            u->smoother = pa_smoother_new(
+                    SMOOTHER_ADJUST_USEC,
+                    SMOOTHER_WINDOW_USEC,
+                    TRUE,
+                    TRUE,
+                    5,
+                    pa_rtclock_now(),
+                    TRUE);
+            u->smoother_interval = SMOOTHER_MIN_INTERVAL;
+
+            reset_watermark(u, tsched_watermark, &requested_ss);
+            pa_sink_set_max_rewind(u->sink, u->out_hwbuf_size);
+        } else
+            pa_sink_set_fixed_latency(u->sink, pa_bytes_to_usec(u->out_hwbuf_size, &u->sink->sample_spec));
+
+        if (use_mmap && !u->use_tsched)
             u->out_mmap_memblocks = pa_xnew0(pa_memblock*, u->out_nfrags);
     }
 
@@ -1565,6 +2122,9 @@ void pa__done(pa_module*m) {
     if (u->out_mmap && u->out_mmap != MAP_FAILED)
         munmap(u->out_mmap, u->out_hwbuf_size);
 
+    if (u->smoother)
+        pa_smoother_free(u->smoother);
+
     if (u->fd >= 0)
         pa_close(u->fd);
 
@@ -43,6 +43,7 @@
 #include <pulse/xmalloc.h>
 
 #include <pulsecore/core-error.h>
+#include <pulsecore/llist.h>
 #include <pulsecore/sink.h>
 #include <pulsecore/module.h>
 #include <pulsecore/core-util.h>
@@ -67,13 +68,33 @@ PA_MODULE_LOAD_ONCE(FALSE);
 PA_MODULE_USAGE(
         "sink_name=<name for the sink> "
         "sink_properties=<properties for the sink> "
-        "server=<address>  "
+        "server=<address, or comma separated addresses of a group>  "
         "format=<sample format> "
         "rate=<sample rate> "
         "channels=<number of channels>");
 
 #define DEFAULT_SINK_NAME "raop"
 
+struct userdata;
+
+/* All receivers of a sink share one key, so every block is encoded and
+ * encrypted once and then written to each of them */
+struct receiver {
+    struct userdata *userdata;
+    char *server;
+    pa_raop_client *raop;
+
+    int fd;
+    pa_rtpoll_item *rtpoll_item;
+    int write_type;
+
+    /* How much of the current encoded block has been written, only used
+     * from the IO thread */
+    size_t index;
+
+    PA_LLIST_FIELDS(struct receiver);
+};
+
 struct userdata {
     pa_core *core;
     pa_module *module;
@@ -81,7 +102,6 @@ struct userdata {
 
     pa_thread_mq thread_mq;
     pa_rtpoll *rtpoll;
-    pa_rtpoll_item *rtpoll_item;
     pa_thread *thread;
 
     pa_memchunk raw_memchunk;
@@ -99,14 +119,13 @@ struct userdata {
     int32_t rate;
 
     pa_smoother *smoother;
-    int fd;
 
-    int64_t offset;
+    int64_t offset, encoded_offset;
     int64_t encoding_overhead;
     int32_t next_encoding_overhead;
     double encoding_ratio;
 
-    pa_raop_client *raop;
+    PA_LLIST_HEAD(struct receiver, receivers);
 
     size_t block_size;
 };
@@ -132,13 +151,16 @@ static void sink_set_volume_cb(pa_sink *);
 static void on_connection(int fd, void*userdata) {
     int so_sndbuf = 0;
     socklen_t sl = sizeof(int);
-    struct userdata *u = userdata;
-    pa_assert(u);
+    struct receiver *r = userdata;
+    struct userdata *u;
+
+    pa_assert(r);
+    pa_assert_se(u = r->userdata);
 
-    pa_assert(u->fd < 0);
-    u->fd = fd;
+    pa_assert(r->fd < 0);
+    r->fd = fd;
 
-    if (getsockopt(u->fd, SOL_SOCKET, SO_SNDBUF, &so_sndbuf, &sl) < 0)
+    if (getsockopt(r->fd, SOL_SOCKET, SO_SNDBUF, &so_sndbuf, &sl) < 0)
         pa_log_warn("getsockopt(SO_SNDBUF) failed: %s", pa_cstrerror(errno));
     else {
         pa_log_debug("SO_SNDBUF is %zu.", (size_t) so_sndbuf);
@@ -148,22 +170,35 @@ static void on_connection(int fd, void*userdata) {
     /* Set the initial volume */
     sink_set_volume_cb(u->sink);
 
-    pa_log_debug("Connection authenticated, handing fd to IO thread...");
+    pa_log_debug("Connection to %s authenticated, handing fd to IO thread...", r->server);
 
-    pa_asyncmsgq_post(u->thread_mq.inq, PA_MSGOBJECT(u->sink), SINK_MESSAGE_PASS_SOCKET, NULL, 0, NULL, NULL);
+    pa_asyncmsgq_post(u->thread_mq.inq, PA_MSGOBJECT(u->sink), SINK_MESSAGE_PASS_SOCKET, r, 0, NULL, NULL);
 }
 
 static void on_close(void*userdata) {
-    struct userdata *u = userdata;
-    pa_assert(u);
+    struct receiver *r = userdata;
+
+    pa_assert(r);
+
+    pa_log_debug("Connection to %s closed, informing IO thread...", r->server);
+
+    pa_asyncmsgq_post(r->userdata->thread_mq.inq, PA_MSGOBJECT(r->userdata->sink), SINK_MESSAGE_RIP_SOCKET, r, 0, NULL, NULL);
+}
 
-    pa_log_debug("Connection closed, informing IO thread...");
+/* Called from IO thread context */
+static pa_bool_t any_receiver_connected(struct userdata *u) {
+    struct receiver *r;
 
-    pa_asyncmsgq_post(u->thread_mq.inq, PA_MSGOBJECT(u->sink), SINK_MESSAGE_RIP_SOCKET, NULL, 0, NULL, NULL);
+    PA_LLIST_FOREACH(r, u->receivers)
+        if (r->rtpoll_item)
+            return TRUE;
+
+    return FALSE;
 }
 
 static int sink_process_msg(pa_msgobject *o, int code, void *data, int64_t offset, pa_memchunk *chunk) {
     struct userdata *u = PA_SINK(o)->userdata;
+    struct receiver *r;
 
     switch (code) {
 
@@ -177,9 +212,9 @@ static int sink_process_msg(pa_msgobject *o, int code, void *data, int64_t offse
                     pa_smoother_pause(u->smoother, pa_rtclock_now());
 
                     /* Issue a FLUSH if we are connected */
-                    if (u->fd >= 0) {
-                        pa_raop_flush(u->raop);
-                    }
+                    PA_LLIST_FOREACH(r, u->receivers)
+                        if (r->fd >= 0)
+                            pa_raop_flush(r->raop);
                     break;
 
                 case PA_SINK_IDLE:
@@ -190,10 +225,11 @@ static int sink_process_msg(pa_msgobject *o, int code, void *data, int64_t offse
 
                         /* The connection can be closed when idle, so check to
                            see if we need to reestablish it */
-                        if (u->fd < 0)
-                            pa_raop_connect(u->raop);
-                        else
-                            pa_raop_flush(u->raop);
+                        PA_LLIST_FOREACH(r, u->receivers)
+                            if (r->fd < 0)
+                                pa_raop_connect(r->raop);
+                            else
+                                pa_raop_flush(r->raop);
                     }
 
                     break;
@@ -219,37 +255,44 @@ static int sink_process_msg(pa_msgobject *o, int code, void *data, int64_t offse
         case SINK_MESSAGE_PASS_SOCKET: {
             struct pollfd *pollfd;
 
-            pa_assert(!u->rtpoll_item);
+            pa_assert_se(r = data);
+            pa_assert(!r->rtpoll_item);
 
-            u->rtpoll_item = pa_rtpoll_item_new(u->rtpoll, PA_RTPOLL_NEVER, 1);
-            pollfd = pa_rtpoll_item_get_pollfd(u->rtpoll_item, NULL);
-            pollfd->fd = u->fd;
+            r->rtpoll_item = pa_rtpoll_item_new(u->rtpoll, PA_RTPOLL_NEVER, 1);
+            pollfd = pa_rtpoll_item_get_pollfd(r->rtpoll_item, NULL);
+            pollfd->fd = r->fd;
             pollfd->events = POLLOUT;
             /*pollfd->events = */pollfd->revents = 0;
 
+            /* Never start in the middle of a block, join with the next one */
+            r->index = u->encoded_memchunk.length;
+
             if (u->sink->thread_info.state == PA_SINK_SUSPENDED) {
                 /* Our stream has been suspended so we just flush it.... */
-                pa_raop_flush(u->raop);
+                pa_raop_flush(r->raop);
             }
             return 0;
         }
 
         case SINK_MESSAGE_RIP_SOCKET: {
-            if (u->fd >= 0) {
-                pa_close(u->fd);
-                u->fd = -1;
+            pa_assert_se(r = data);
+
+            if (r->fd >= 0) {
+                pa_close(r->fd);
+                r->fd = -1;
             } else
                 /* FIXME */
                 pa_log("We should not get to this state. Cannot rip socket if not connected.");
 
-            if (u->sink->thread_info.state == PA_SINK_SUSPENDED) {
+            if (r->rtpoll_item)
+                pa_rtpoll_item_free(r->rtpoll_item);
+            r->rtpoll_item = NULL;
 
+            if (u->sink->thread_info.state == PA_SINK_SUSPENDED)
                 pa_log_debug("RTSP control connection closed, but we're suspended so let's not worry about it... we'll open it again later");
-
-                if (u->rtpoll_item)
-                    pa_rtpoll_item_free(u->rtpoll_item);
-                u->rtpoll_item = NULL;
-            } else {
+            else if (any_receiver_connected(u))
+                pa_log_warn("Lost connection to %s, continuing with the other receivers.", r->server);
+            else {
                 /* Question: is this valid here: or should we do some sort of:
                    return pa_sink_process_msg(PA_MSGOBJECT(u->core), PA_CORE_MESSAGE_UNLOAD_MODULE, u->module, 0, NULL);
                    ?? */
@@ -264,6 +307,7 @@ static int sink_process_msg(pa_msgobject *o, int code, void *data, int64_t offse
 
 static void sink_set_volume_cb(pa_sink *s) {
     struct userdata *u = s->userdata;
+    struct receiver *r;
     pa_cvolume hw;
     pa_volume_t v;
     char t[PA_CVOLUME_SNPRINT_MAX];
@@ -290,25 +334,51 @@ static void sink_set_volume_cb(pa_sink *s) {
     pa_log_debug("Calculated software volume: %s", pa_cvolume_snprint(t, sizeof(t), &s->soft_volume));
 
     /* Any necessary software volume manipulation is done so set
-       our hw volume (or v as a single value) on the device */
-    pa_raop_client_set_volume(u->raop, v);
+       our hw volume (or v as a single value) on the devices */
+    PA_LLIST_FOREACH(r, u->receivers)
+        pa_raop_client_set_volume(r->raop, v);
 }
 
 static void sink_set_mute_cb(pa_sink *s) {
     struct userdata *u = s->userdata;
+    struct receiver *r;
 
     pa_assert(u);
 
     if (s->muted) {
-        pa_raop_client_set_volume(u->raop, PA_VOLUME_MUTED);
+        PA_LLIST_FOREACH(r, u->receivers)
+            pa_raop_client_set_volume(r->raop, PA_VOLUME_MUTED);
     } else {
         sink_set_volume_cb(s);
     }
 }
 
+/* Called from IO thread context. All receivers share the key, so any
+ * connected one does the encoding. */
+static pa_raop_client* get_encoder(struct userdata *u) {
+    struct receiver *r;
+
+    PA_LLIST_FOREACH(r, u->receivers)
+        if (r->rtpoll_item && r->fd >= 0)
+            return r->raop;
+
+    return NULL;
+}
+
+/* Called from IO thread context. The next block is only encoded when every
+ * receiver got all of the current one, which keeps them in step. */
+static pa_bool_t block_done(struct userdata *u) {
+    struct receiver *r;
+
+    PA_LLIST_FOREACH(r, u->receivers)
+        if (r->rtpoll_item && r->index < u->encoded_memchunk.length)
+            return FALSE;
+
+    return TRUE;
+}
+
 static void thread_func(void *userdata) {
     struct userdata *u = userdata;
-    int write_type = 0;
     pa_memchunk silence;
     uint32_t silence_overhead = 0;
     double silence_ratio = 0;
@@ -325,77 +395,99 @@ static void thread_func(void *userdata) {
     pa_memchunk_reset(&silence);
 
     for (;;) {
+        struct receiver *r;
         int ret;
 
         if (PA_UNLIKELY(u->sink->thread_info.rewind_requested))
             pa_sink_process_rewind(u->sink, 0);
 
-        if (u->rtpoll_item) {
-            struct pollfd *pollfd;
-            pollfd = pa_rtpoll_item_get_pollfd(u->rtpoll_item, NULL);
-
-            /* Render some data and write it to the fifo */
-            if (/*PA_SINK_IS_OPENED(u->sink->thread_info.state) && */pollfd->revents) {
-                pa_usec_t usec;
-                int64_t n;
-                void *p;
-
-                if (!silence.memblock) {
-                    pa_memchunk silence_tmp;
-
-                    pa_memchunk_reset(&silence_tmp);
-                    silence_tmp.memblock = pa_memblock_new(u->core->mempool, 4096);
-                    silence_tmp.length = 4096;
-                    p = pa_memblock_acquire(silence_tmp.memblock);
-                      memset(p, 0, 4096);
-                    pa_memblock_release(silence_tmp.memblock);
-                    pa_raop_client_encode_sample(u->raop, &silence_tmp, &silence);
-                    pa_assert(0 == silence_tmp.length);
-                    silence_overhead = silence_tmp.length - 4096;
-                    silence_ratio = silence_tmp.length / 4096;
-                    pa_memblock_unref(silence_tmp.memblock);
-                }
+        if (any_receiver_connected(u)) {
+            pa_raop_client *encoder = get_encoder(u);
+            pa_usec_t usec;
+            int64_t n;
+            size_t written;
+            void *p;
+
+            pa_assert(encoder);
+
+            if (!silence.memblock) {
+                pa_memchunk silence_tmp;
+
+                pa_memchunk_reset(&silence_tmp);
+                silence_tmp.memblock = pa_memblock_new(u->core->mempool, 4096);
+                silence_tmp.length = 4096;
+                p = pa_memblock_acquire(silence_tmp.memblock);
+                  memset(p, 0, 4096);
+                pa_memblock_release(silence_tmp.memblock);
+                pa_raop_client_encode_sample(encoder, &silence_tmp, &silence);
+                pa_assert(0 == silence_tmp.length);
+                silence_overhead = silence_tmp.length - 4096;
+                silence_ratio = silence_tmp.length / 4096;
+                pa_memblock_unref(silence_tmp.memblock);
+            }
 
-                for (;;) {
-                    ssize_t l;
+            for (;;) {
+                pa_bool_t pending = FALSE;
 
-                    if (u->encoded_memchunk.length <= 0) {
-                        if (u->encoded_memchunk.memblock)
-                            pa_memblock_unref(u->encoded_memchunk.memblock);
-                        if (PA_SINK_IS_OPENED(u->sink->thread_info.state)) {
-                            size_t rl;
-
-                            /* We render real data */
-                            if (u->raw_memchunk.length <= 0) {
-                                if (u->raw_memchunk.memblock)
-                                    pa_memblock_unref(u->raw_memchunk.memblock);
-                                pa_memchunk_reset(&u->raw_memchunk);
-
-                                /* Grab unencoded data */
-                                pa_sink_render(u->sink, u->block_size, &u->raw_memchunk);
-                            }
-                            pa_assert(u->raw_memchunk.length > 0);
-
-                            /* Encode it */
-                            rl = u->raw_memchunk.length;
-                            u->encoding_overhead += u->next_encoding_overhead;
-                            pa_raop_client_encode_sample(u->raop, &u->raw_memchunk, &u->encoded_memchunk);
-                            u->next_encoding_overhead = (u->encoded_memchunk.length - (rl - u->raw_memchunk.length));
-                            u->encoding_ratio = u->encoded_memchunk.length / (rl - u->raw_memchunk.length);
-                        } else {
-                            /* We render some silence into our memchunk */
-                            memcpy(&u->encoded_memchunk, &silence, sizeof(pa_memchunk));
-                            pa_memblock_ref(silence.memblock);
+                if (block_done(u)) {
+                    if (u->encoded_memchunk.memblock) {
+                        /* we've completely written the encoded data, so update our overhead */
+                        u->encoded_offset += (int64_t) u->encoded_memchunk.length;
+                        u->encoding_overhead += u->next_encoding_overhead;
+                        pa_memblock_unref(u->encoded_memchunk.memblock);
+                    }
+
+                    if (PA_SINK_IS_OPENED(u->sink->thread_info.state)) {
+                        size_t rl;
+
+                        /* We render real data */
+                        if (u->raw_memchunk.length <= 0) {
+                            if (u->raw_memchunk.memblock)
+                                pa_memblock_unref(u->raw_memchunk.memblock);
+                            pa_memchunk_reset(&u->raw_memchunk);
 
-                            /* Calculate/store some values to be used with the smoother */
-                            u->next_encoding_overhead = silence_overhead;
-                            u->encoding_ratio = silence_ratio;
+                            /* Grab unencoded data */
+                            pa_sink_render(u->sink, u->block_size, &u->raw_memchunk);
                         }
+                        pa_assert(u->raw_memchunk.length > 0);
+
+                        /* Encode it, once for all receivers */
+                        rl = u->raw_memchunk.length;
+                        pa_raop_client_encode_sample(encoder, &u->raw_memchunk, &u->encoded_memchunk);
+                        u->next_encoding_overhead = (u->encoded_memchunk.length - (rl - u->raw_memchunk.length));
+                        u->encoding_ratio = u->encoded_memchunk.length / (rl - u->raw_memchunk.length);
+                    } else {
+                        /* We render some silence into our memchunk */
+                        memcpy(&u->encoded_memchunk, &silence, sizeof(pa_memchunk));
+                        pa_memblock_ref(silence.memblock);
+
+                        /* Calculate/store some values to be used with the smoother */
+                        u->next_encoding_overhead = silence_overhead;
+                        u->encoding_ratio = silence_ratio;
                     }
                     pa_assert(u->encoded_memchunk.length > 0);
 
+                    PA_LLIST_FOREACH(r, u->receivers)
+                        r->index = 0;
+                }
+
+                PA_LLIST_FOREACH(r, u->receivers) {
+                    struct pollfd *pollfd;
+                    ssize_t l;
+
+                    if (!r->rtpoll_item || r->index >= u->encoded_memchunk.length)
+                        continue;
+
+                    pollfd = pa_rtpoll_item_get_pollfd(r->rtpoll_item, NULL);
+
+                    if (!pollfd->revents) {
+                        /* Wait until this one can take more */
+                        pending = TRUE;
+                        continue;
+                    }
+
                     p = pa_memblock_acquire(u->encoded_memchunk.memblock);
-                    l = pa_write(u->fd, (uint8_t*) p + u->encoded_memchunk.index, u->encoded_memchunk.length, &write_type);
+                    l = pa_write(r->fd, (uint8_t*) p + u->encoded_memchunk.index + r->index, u->encoded_memchunk.length - r->index, &r->write_type);
                     pa_memblock_release(u->encoded_memchunk.memblock);
 
                     pa_assert(l != 0);
@@ -408,61 +500,70 @@ static void thread_func(void *userdata) {
 
                             /* OK, we filled all socket buffers up
                              * now. */
-                            goto filled_up;
+                            pollfd->revents = 0;
+                            pending = TRUE;
 
                         } else {
-                            pa_log("Failed to write data to FIFO: %s", pa_cstrerror(errno));
+                            pa_log("Failed to write data to %s: %s", r->server, pa_cstrerror(errno));
                             goto fail;
                         }
 
                     } else {
-                        u->offset += l;
-
-                        u->encoded_memchunk.index += l;
-                        u->encoded_memchunk.length -= l;
-
-                        pollfd->revents = 0;
-
-                        if (u->encoded_memchunk.length > 0) {
-                            /* we've completely written the encoded data, so update our overhead */
-                            u->encoding_overhead += u->next_encoding_overhead;
+                        r->index += (size_t) l;
 
+                        if (r->index < u->encoded_memchunk.length) {
                             /* OK, we wrote less that we asked for,
                              * hence we can assume that the socket
                              * buffers are full now */
-                            goto filled_up;
+                            pollfd->revents = 0;
+                            pending = TRUE;
                         }
                     }
                 }
 
-            filled_up:
+                if (pending)
+                    break;
+            }
+
+            /* At this spot we know that the socket buffers are
+             * fully filled up. This is the best time to estimate
+             * the playback position of the server. With several
+             * receivers the one that lags behind counts. */
 
-                /* At this spot we know that the socket buffers are
-                 * fully filled up. This is the best time to estimate
-                 * the playback position of the server */
+            written = u->encoded_memchunk.length;
+            PA_LLIST_FOREACH(r, u->receivers)
+                if (r->rtpoll_item)
+                    written = PA_MIN(written, r->index);
 
-                n = u->offset - u->encoding_overhead;
+            u->offset = u->encoded_offset + (int64_t) written;
+            n = u->offset - u->encoding_overhead;
 
 #ifdef SIOCOUTQ
-                {
-                    int l;
-                    if (ioctl(u->fd, SIOCOUTQ, &l) >= 0 && l > 0)
-                        n -= (l / u->encoding_ratio);
-                }
+            {
+                int l, queued = 0;
+
+                PA_LLIST_FOREACH(r, u->receivers)
+                    if (r->rtpoll_item && ioctl(r->fd, SIOCOUTQ, &l) >= 0 && l > queued)
+                        queued = l;
+
+                if (queued > 0)
+                    n -= (queued / u->encoding_ratio);
+            }
 #endif
 
-                usec = pa_bytes_to_usec(n, &u->sink->sample_spec);
+            usec = pa_bytes_to_usec(n, &u->sink->sample_spec);
 
-                if (usec > u->latency)
-                    usec -= u->latency;
-                else
-                    usec = 0;
+            if (usec > u->latency)
+                usec -= u->latency;
+            else
+                usec = 0;
 
-                pa_smoother_put(u->smoother, pa_rtclock_now(), usec);
-            }
+            pa_smoother_put(u->smoother, pa_rtclock_now(), usec);
 
             /* Hmm, nothing to do. Let's sleep */
-            pollfd->events = POLLOUT; /*PA_SINK_IS_OPENED(u->sink->thread_info.state)  ? POLLOUT : 0;*/
+            PA_LLIST_FOREACH(r, u->receivers)
+                if (r->rtpoll_item)
+                    pa_rtpoll_item_get_pollfd(r->rtpoll_item, NULL)->events = POLLOUT; /*PA_SINK_IS_OPENED(u->sink->thread_info.state)  ? POLLOUT : 0;*/
         }
 
         if ((ret = pa_rtpoll_run(u->rtpoll, TRUE)) < 0)
@@ -471,22 +572,31 @@ static void thread_func(void *userdata) {
         if (ret == 0)
             goto finish;
 
-        if (u->rtpoll_item) {
+        PA_LLIST_FOREACH(r, u->receivers) {
             struct pollfd* pollfd;
 
-            pollfd = pa_rtpoll_item_get_pollfd(u->rtpoll_item, NULL);
+            if (!r->rtpoll_item)
+                continue;
+
+            pollfd = pa_rtpoll_item_get_pollfd(r->rtpoll_item, NULL);
 
             if (pollfd->revents & ~POLLOUT) {
                 if (u->sink->thread_info.state != PA_SINK_SUSPENDED) {
-                    pa_log("FIFO shutdown.");
-                    goto fail;
+                    pa_log("FIFO shutdown on %s.", r->server);
+
+                    pa_rtpoll_item_free(r->rtpoll_item);
+                    r->rtpoll_item = NULL;
+
+                    if (!any_receiver_connected(u))
+                        goto fail;
+
+                    continue;
                 }
 
                 /* We expect this to happen on occasion if we are not sending data.
                    It's perfectly natural and normal and natural */
-                if (u->rtpoll_item)
-                    pa_rtpoll_item_free(u->rtpoll_item);
-                u->rtpoll_item = NULL;
+                pa_rtpoll_item_free(r->rtpoll_item);
+                r->rtpoll_item = NULL;
             }
         }
     }
@@ -507,7 +617,9 @@ int pa__init(pa_module*m) {
     struct userdata *u = NULL;
     pa_sample_spec ss;
     pa_modargs *ma = NULL;
-    const char *server;
+    const char *server, *state = NULL;
+    char *address;
+    struct receiver *r, *last = NULL;
     pa_sink_new_data data;
 
     pa_assert(m);
@@ -533,7 +645,7 @@ int pa__init(pa_module*m) {
     u->core = m->core;
     u->module = m;
     m->userdata = u;
-    u->fd = -1;
+    PA_LLIST_HEAD_INIT(struct receiver, u->receivers);
     u->smoother = pa_smoother_new(
             PA_USEC_PER_SEC,
             PA_USEC_PER_SEC*2,
@@ -544,14 +656,13 @@ int pa__init(pa_module*m) {
             FALSE);
     pa_memchunk_reset(&u->raw_memchunk);
     pa_memchunk_reset(&u->encoded_memchunk);
-    u->offset = 0;
+    u->offset = u->encoded_offset = 0;
     u->encoding_overhead = 0;
     u->next_encoding_overhead = 0;
     u->encoding_ratio = 1.0;
 
     u->rtpoll = pa_rtpoll_new();
     pa_thread_mq_init(&u->thread_mq, m->core->mainloop, u->rtpoll);
-    u->rtpoll_item = NULL;
 
     /*u->format =
         (ss.format == PA_SAMPLE_U8 ? ESD_BITS8 : ESD_BITS16) |
@@ -602,13 +713,32 @@ int pa__init(pa_module*m) {
     pa_sink_set_asyncmsgq(u->sink, u->thread_mq.inq);
     pa_sink_set_rtpoll(u->sink, u->rtpoll);
 
-    if (!(u->raop = pa_raop_client_new(u->core, server))) {
-        pa_log("Failed to connect to server.");
-        goto fail;
+    while ((address = pa_split(server, ",", &state))) {
+        r = pa_xnew0(struct receiver, 1);
+        r->userdata = u;
+        r->server = address;
+        r->fd = -1;
+
+        if (last)
+            PA_LLIST_INSERT_AFTER(struct receiver, u->receivers, last, r);
+        else
+            PA_LLIST_PREPEND(struct receiver, u->receivers, r);
+
+        if (!(r->raop = last ? pa_raop_client_new_with_key(u->core, address, last->raop) : pa_raop_client_new(u->core, address))) {
+            pa_log("Failed to connect to server %s.", address);
+            goto fail;
+        }
+
+        pa_raop_client_set_callback(r->raop, on_connection, r);
+        pa_raop_client_set_closed_callback(r->raop, on_close, r);
+
+        last = r;
     }
 
-    pa_raop_client_set_callback(u->raop, on_connection, u);
-    pa_raop_client_set_closed_callback(u->raop, on_close, u);
+    if (!u->receivers) {
+        pa_log("No server argument given.");
+        goto fail;
+    }
 
     if (!(u->thread = pa_thread_new("raop-sink", thread_func, u))) {
         pa_log("Failed to create thread.");
@@ -641,6 +771,7 @@ int pa__get_n_used(pa_module *m) {
 
 void pa__done(pa_module*m) {
     struct userdata *u;
+    struct receiver *r;
     pa_assert(m);
 
     if (!(u = m->userdata))
@@ -659,8 +790,21 @@ void pa__done(pa_module*m) {
     if (u->sink)
         pa_sink_unref(u->sink);
 
-    if (u->rtpoll_item)
-        pa_rtpoll_item_free(u->rtpoll_item);
+    while ((r = u->receivers)) {
+        PA_LLIST_REMOVE(struct receiver, u->receivers, r);
+
+        if (r->rtpoll_item)
+            pa_rtpoll_item_free(r->rtpoll_item);
+
+        if (r->raop)
+            pa_raop_client_free(r->raop);
+
+        if (r->fd >= 0)
+            pa_close(r->fd);
+
+        pa_xfree(r->server);
+        pa_xfree(r);
+    }
 
     if (u->rtpoll)
         pa_rtpoll_free(u->rtpoll);
@@ -671,17 +815,11 @@ void pa__done(pa_module*m) {
     if (u->encoded_memchunk.memblock)
         pa_memblock_unref(u->encoded_memchunk.memblock);
 
-    if (u->raop)
-        pa_raop_client_free(u->raop);
-
     pa_xfree(u->read_data);
     pa_xfree(u->write_data);
 
     if (u->smoother)
         pa_smoother_free(u->smoother);
 
-    if (u->fd >= 0)
-        pa_close(u->fd);
-
     pa_xfree(u);
 }
@@ -37,6 +37,7 @@
 #include <openssl/err.h>
 #include <openssl/rand.h>
 #include <openssl/aes.h>
+#include <openssl/evp.h>
 #include <openssl/rsa.h>
 #include <openssl/engine.h>
 
@@ -44,6 +45,7 @@
 
 #include <pulsecore/core-error.h>
 #include <pulsecore/core-util.h>
+#include <pulsecore/endianmacros.h>
 #include <pulsecore/iochannel.h>
 #include <pulsecore/socket-util.h>
 #include <pulsecore/log.h>
@@ -81,9 +83,8 @@ struct pa_raop_client {
     uint8_t jack_status;
 
     /* Encryption Related bits */
-    AES_KEY aes;
+    EVP_CIPHER_CTX *aes_ctx;
     uint8_t aes_iv[AES_CHUNKSIZE]; /* initialization vector for aes-cbc */
-    uint8_t aes_nv[AES_CHUNKSIZE]; /* next vector for aes-cbc */
     uint8_t aes_key[AES_CHUNKSIZE]; /* key for aes-cbc */
 
     pa_socket_client *sc;
@@ -98,58 +99,49 @@ struct pa_raop_client {
     void* closed_userdata;
 };
 
-/**
- * Function to write bits into a buffer.
- * @param buffer Handle to the buffer. It will be incremented if new data requires it.
- * @param bit_pos A pointer to a position buffer to keep track the current write location (0 for MSB, 7 for LSB)
- * @param size A pointer to the byte size currently written. This allows the calling function to do simple buffer overflow checks
- * @param data The data to write
- * @param data_bit_len The number of bits from data to write
- */
-static inline void bit_writer(uint8_t **buffer, uint8_t *bit_pos, int *size, uint8_t data, uint8_t data_bit_len) {
-    int bits_left, bit_overflow;
-    uint8_t bit_data;
-
-    if (!data_bit_len)
-        return;
+/* Packs bit fields MSB first into a buffer, a 32 bit word at a time */
+struct bit_writer {
+    uint8_t *buffer;
+    uint64_t bits;
+    unsigned n_bits;
+};
 
-    /* If bit pos is zero, we will definately use at least one bit from the current byte so size increments. */
-    if (!*bit_pos)
-        *size += 1;
-
-    /* Calc the number of bits left in the current byte of buffer */
-    bits_left = 7 - *bit_pos  + 1;
-    /* Calc the overflow of bits in relation to how much space we have left... */
-    bit_overflow = bits_left - data_bit_len;
-    if (bit_overflow >= 0) {
-        /* We can fit the new data in our current byte */
-        /* As we write from MSB->LSB we need to left shift by the overflow amount */
-        bit_data = data << bit_overflow;
-        if (*bit_pos)
-            **buffer |= bit_data;
-        else
-            **buffer = bit_data;
-        /* If our data fits exactly into the current byte, we need to increment our pointer */
-        if (0 == bit_overflow) {
-            /* Do not increment size as it will be incremented on next call as bit_pos is zero */
-            *buffer += 1;
-            *bit_pos = 0;
-        } else {
-            *bit_pos += data_bit_len;
-        }
-    } else {
-        /* bit_overflow is negative, there for we will need a new byte from our buffer */
-        /* Firstly fill up what's left in the current byte */
-        bit_data = data >> -bit_overflow;
-        **buffer |= bit_data;
-        /* Increment our buffer pointer and size counter*/
-        *buffer += 1;
-        *size += 1;
-        **buffer = data << (8 + bit_overflow);
-        *bit_pos = -bit_overflow;
+static inline void bit_writer_init(struct bit_writer *w, uint8_t *buffer) {
+    w->buffer = buffer;
+    w->bits = 0;
+    w->n_bits = 0;
+}
+
+/* Writes the lowest len bits of data, len is at most 32 */
+static inline void bit_writer_put(struct bit_writer *w, uint32_t data, unsigned len) {
+    pa_assert(len <= 32);
+
+    w->bits = (w->bits << len) | (data & (uint32_t) (((uint64_t) 1 << len) - 1));
+    w->n_bits += len;
+
+    if (w->n_bits >= 32) {
+        uint32_t word;
+
+        w->n_bits -= 32;
+        word = PA_UINT32_TO_BE((uint32_t) (w->bits >> w->n_bits));
+        memcpy(w->buffer, &word, sizeof(word));
+        w->buffer += sizeof(word);
     }
 }
 
+/* Writes out what is left, padded with zeros. Returns the number of bytes
+ * written since bit_writer_init(). */
+static inline size_t bit_writer_finish(struct bit_writer *w, uint8_t *start) {
+    while (w->n_bits > 0) {
+        unsigned n = PA_MIN(w->n_bits, 8U);
+
+        *(w->buffer++) = (uint8_t) ((w->bits >> (w->n_bits - n)) << (8 - n));
+        w->n_bits -= n;
+    }
+
+    return (size_t) (w->buffer - start);
+}
+
 static int rsa_encrypt(uint8_t *text, int len, uint8_t *res) {
     const char n[] =
         "59dE8qLieItsH1WgjrcFRKj6eUWqi+bGLOX1HL3U3GhC/j0Qg90u3sG/1CUtwC"
@@ -175,23 +167,24 @@ static int rsa_encrypt(uint8_t *text, int len, uint8_t *res) {
     return size;
 }
 
+/* Each packet is encrypted on its own with the same IV, whatever doesn't
+ * fill a complete block stays in the clear */
 static int aes_encrypt(pa_raop_client* c, uint8_t *data, int size) {
-    uint8_t *buf;
-    int i=0, j;
+    int len = size - size % AES_CHUNKSIZE;
 
     pa_assert(c);
+    pa_assert(c->aes_ctx);
 
-    memcpy(c->aes_nv, c->aes_iv, AES_CHUNKSIZE);
-    while (i+AES_CHUNKSIZE <= size) {
-        buf = data + i;
-        for (j=0; j<AES_CHUNKSIZE; ++j)
-            buf[j] ^= c->aes_nv[j];
+    if (len <= 0)
+        return 0;
 
-        AES_encrypt(buf, buf, &c->aes);
-        memcpy(c->aes_nv, buf, AES_CHUNKSIZE);
-        i += AES_CHUNKSIZE;
+    if (!EVP_EncryptInit_ex(c->aes_ctx, NULL, NULL, NULL, c->aes_iv) ||
+        !EVP_EncryptUpdate(c->aes_ctx, data, &len, data, len)) {
+        pa_log("AES encryption failed.");
+        return -1;
     }
-    return i;
+
+    return len;
 }
 
 static inline void rtrimchar(char *str, char rc) {
@@ -365,9 +358,9 @@ static void rtsp_cb(pa_rtsp_client *rtsp, pa_rtsp_state state, pa_headerlist* he
     }
 }
 
-pa_raop_client* pa_raop_client_new(pa_core *core, const char* host) {
+static pa_raop_client* client_new(pa_core *core, const char* host, const pa_raop_client *key_from) {
     pa_parsed_address a;
-    pa_raop_client* c = pa_xnew0(pa_raop_client, 1);
+    pa_raop_client* c;
 
     pa_assert(core);
     pa_assert(host);
@@ -375,6 +368,8 @@ pa_raop_client* pa_raop_client_new(pa_core *core, const char* host) {
     if (pa_parse_address(host, &a) < 0 || a.type == PA_PARSED_ADDRESS_UNIX)
         return NULL;
 
+    c = pa_xnew0(pa_raop_client, 1);
+
     c->core = core;
     c->fd = -1;
 
@@ -384,6 +379,16 @@ pa_raop_client* pa_raop_client_new(pa_core *core, const char* host) {
     else
         c->port = RAOP_PORT;
 
+    /* The key is kept across reconnections, so that clients sharing it
+     * stay in sync */
+    if (key_from) {
+        memcpy(c->aes_iv, key_from->aes_iv, sizeof(c->aes_iv));
+        memcpy(c->aes_key, key_from->aes_key, sizeof(c->aes_key));
+    } else {
+        pa_random(c->aes_iv, sizeof(c->aes_iv));
+        pa_random(c->aes_key, sizeof(c->aes_key));
+    }
+
     if (pa_raop_connect(c)) {
         pa_raop_client_free(c);
         return NULL;
@@ -391,6 +396,16 @@ pa_raop_client* pa_raop_client_new(pa_core *core, const char* host) {
     return c;
 }
 
+pa_raop_client* pa_raop_client_new(pa_core *core, const char* host) {
+    return client_new(core, host, NULL);
+}
+
+pa_raop_client* pa_raop_client_new_with_key(pa_core *core, const char* host, const pa_raop_client *key_from) {
+    pa_assert(key_from);
+
+    return client_new(core, host, key_from);
+}
+
 void pa_raop_client_free(pa_raop_client* c) {
     pa_assert(c);
 
@@ -398,6 +413,8 @@ void pa_raop_client_free(pa_raop_client* c) {
         pa_rtsp_client_free(c->rtsp);
     if (c->sid)
         pa_xfree(c->sid);
+    if (c->aes_ctx)
+        EVP_CIPHER_CTX_free(c->aes_ctx);
     pa_xfree(c->host);
     pa_xfree(c);
 }
@@ -420,10 +437,17 @@ int pa_raop_connect(pa_raop_client* c) {
     c->rtsp = pa_rtsp_client_new(c->core->mainloop, c->host, c->port, "iTunes/4.6 (Macintosh; U; PPC Mac OS X 10.3)");
 
     /* Initialise the AES encryption system */
-    pa_random(c->aes_iv, sizeof(c->aes_iv));
-    pa_random(c->aes_key, sizeof(c->aes_key));
-    memcpy(c->aes_nv, c->aes_iv, sizeof(c->aes_nv));
-    AES_set_encrypt_key(c->aes_key, 128, &c->aes);
+    if (!c->aes_ctx && !(c->aes_ctx = EVP_CIPHER_CTX_new())) {
+        pa_log("Failed to allocate AES context.");
+        return -1;
+    }
+
+    /* Set up the key schedule once, each packet only resets the IV */
+    if (!EVP_EncryptInit_ex(c->aes_ctx, EVP_aes_128_cbc(), NULL, c->aes_key, c->aes_iv) ||
+        !EVP_CIPHER_CTX_set_padding(c->aes_ctx, 0)) {
+        pa_log("Failed to set up AES encryption.");
+        return -1;
+    }
 
     /* Generate random instance id */
     pa_random(&rand_data, sizeof(rand_data));
@@ -466,11 +490,11 @@ int pa_raop_client_set_volume(pa_raop_client* c, pa_volume_t volume) {
 int pa_raop_client_encode_sample(pa_raop_client* c, pa_memchunk* raw, pa_memchunk* encoded) {
     uint16_t len;
     size_t bufmax;
-    uint8_t *bp, bpos;
-    uint8_t *ibp, *maxibp;
-    int size;
-    uint8_t *b, *p;
-    uint32_t bsize;
+    struct bit_writer w;
+    const uint8_t *ibp, *p;
+    size_t size;
+    uint8_t *b;
+    uint32_t bsize, i;
     size_t length;
     static uint8_t header[] = {
         0x24, 0x00, 0x00, 0x00,
@@ -499,35 +523,30 @@ int pa_raop_client_encode_sample(pa_raop_client* c, pa_memchunk* raw, pa_memchun
     memcpy(b, header, header_size);
 
     /* Now write the actual samples */
-    bp = b + header_size;
-    size = bpos = 0;
-    bit_writer(&bp,&bpos,&size,1,3); /* channel=1, stereo */
-    bit_writer(&bp,&bpos,&size,0,4); /* unknown */
-    bit_writer(&bp,&bpos,&size,0,8); /* unknown */
-    bit_writer(&bp,&bpos,&size,0,4); /* unknown */
-    bit_writer(&bp,&bpos,&size,1,1); /* hassize */
-    bit_writer(&bp,&bpos,&size,0,2); /* unused */
-    bit_writer(&bp,&bpos,&size,1,1); /* is-not-compressed */
+    bit_writer_init(&w, b + header_size);
+    bit_writer_put(&w, 1, 3); /* channel=1, stereo */
+    bit_writer_put(&w, 0, 4); /* unknown */
+    bit_writer_put(&w, 0, 8); /* unknown */
+    bit_writer_put(&w, 0, 4); /* unknown */
+    bit_writer_put(&w, 1, 1); /* hassize */
+    bit_writer_put(&w, 0, 2); /* unused */
+    bit_writer_put(&w, 1, 1); /* is-not-compressed */
 
     /* size of data, integer, big endian */
-    bit_writer(&bp,&bpos,&size,(bsize>>24)&0xff,8);
-    bit_writer(&bp,&bpos,&size,(bsize>>16)&0xff,8);
-    bit_writer(&bp,&bpos,&size,(bsize>>8)&0xff,8);
-    bit_writer(&bp,&bpos,&size,(bsize)&0xff,8);
-
-    ibp = p = pa_memblock_acquire(raw->memblock);
-    maxibp = p + raw->length - 4;
-    while (ibp <= maxibp) {
-        /* Byte swap stereo data */
-        bit_writer(&bp,&bpos,&size,*(ibp+1),8);
-        bit_writer(&bp,&bpos,&size,*(ibp+0),8);
-        bit_writer(&bp,&bpos,&size,*(ibp+3),8);
-        bit_writer(&bp,&bpos,&size,*(ibp+2),8);
-        ibp += 4;
-        raw->index += 4;
-        raw->length -= 4;
-    }
+    bit_writer_put(&w, bsize, 32);
+
+    p = pa_memblock_acquire(raw->memblock);
+    ibp = p + raw->index;
+
+    /* Byte swap stereo data, a frame at a time */
+    for (i = 0; i < bsize; i++, ibp += 4)
+        bit_writer_put(&w, (uint32_t) ibp[1] << 24 | (uint32_t) ibp[0] << 16 | (uint32_t) ibp[3] << 8 | ibp[2], 32);
+
     pa_memblock_release(raw->memblock);
+    raw->index += length;
+    raw->length -= length;
+
+    size = bit_writer_finish(&w, b + header_size);
     encoded->length = header_size + size;
 
     /* store the length (endian swapped: make this better) */
@@ -536,7 +555,7 @@ int pa_raop_client_encode_sample(pa_raop_client* c, pa_memchunk* raw, pa_memchun
     *(b + 3) = len & 0xff;
 
     /* encrypt our data */
-    aes_encrypt(c, (b + header_size), size);
+    aes_encrypt(c, (b + header_size), (int) size);
 
     /* We're done with the chunk */
     pa_memblock_release(encoded->memblock);
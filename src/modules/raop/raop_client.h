@@ -27,6 +27,9 @@
 typedef struct pa_raop_client pa_raop_client;
 
 pa_raop_client* pa_raop_client_new(pa_core *core, const char* host);
+/* Encrypts with the same key as key_from, so data encoded by one of the
+ * two clients can be sent to both */
+pa_raop_client* pa_raop_client_new_with_key(pa_core *core, const char* host, const pa_raop_client *key_from);
 void pa_raop_client_free(pa_raop_client* c);
 
 int pa_raop_connect(pa_raop_client* c);
@@ -32,6 +32,10 @@
 #include <unistd.h>
 #include <math.h>
 
+#ifdef HAVE_OPUS
+#include <opus_multistream.h>
+#endif
+
 #include <pulse/rtclock.h>
 #include <pulse/timeval.h>
 #include <pulse/xmalloc.h>
@@ -53,6 +57,7 @@
 #include <pulsecore/atomic.h>
 #include <pulsecore/once.h>
 #include <pulsecore/poll.h>
+#include <pulsecore/thread-mq.h>
 #include <pulsecore/arpa-inet.h>
 
 #include "module-rtp-recv-symdef.h"
@@ -68,6 +73,8 @@ PA_MODULE_LOAD_ONCE(FALSE);
 PA_MODULE_USAGE(
         "sink=<name of the sink> "
         "sap_address=<multicast address to listen on> "
+        "latency_msec=<maximum latency of the jitter buffer> "
+        "sync_clock=<realtime or a PTP clock device, to play latency_msec after the sender captured the audio> "
 );
 
 #define SAP_PORT 9875
@@ -77,10 +84,17 @@ PA_MODULE_USAGE(
 #define DEATH_TIMEOUT 20
 #define RATE_UPDATE_INTERVAL (5*PA_USEC_PER_SEC)
 #define LATENCY_USEC (500*PA_USEC_PER_MSEC)
+#define JITTER_MULTIPLIER 4
+#define TARGET_DECAY_USEC (30*PA_USEC_PER_SEC)
+#define SYNC_MAX_REPORT_ERROR_USEC (50*PA_USEC_PER_MSEC)
+#define SYNC_TOLERANCE_USEC (2*PA_USEC_PER_MSEC)
+#define SYNC_REALIGN_USEC (50*PA_USEC_PER_MSEC)
 
 static const char* const valid_modargs[] = {
     "sink",
     "sap_address",
+    "latency_msec",
+    "sync_clock",
     NULL
 };
 
@@ -96,8 +110,12 @@ struct session {
     uint32_t offset;
 
     struct pa_sdp_info sdp_info;
+    size_t frame_size;
 
     pa_rtp_context rtp_context;
+#ifdef HAVE_OPUS
+    OpusMSDecoder *opus_decoder;
+#endif
 
     pa_rtpoll_item *rtpoll_item;
 
@@ -105,6 +123,28 @@ struct session {
 
     pa_usec_t intended_latency;
     pa_usec_t sink_latency;
+    pa_usec_t max_latency;
+
+    /* Jitter buffer state, only accessed from the I/O thread */
+    pa_usec_t last_arrival;
+    uint32_t last_rtp_timestamp;
+    double jitter;
+    double target_latency;
+    pa_bool_t in_underrun;
+    pa_memchunk last_packet;
+
+    uint16_t base_sequence, max_sequence;
+    uint32_t sequence_cycles;
+    uint64_t n_received, n_concealed, n_underruns;
+
+    /* Synchronized playback, only accessed from the I/O thread. The
+     * sender reports map the RTP timestamps to the reference clock, the
+     * mapping is smoothed with an alpha-beta filter. */
+    int rtcp_fd;
+    pa_bool_t have_sender_report, sync_align, sync_late;
+    pa_usec_t sync_ref;
+    uint32_t sync_timestamp;
+    double sync_usec_per_frame;
 
     pa_usec_t last_rate_update;
     pa_usec_t last_latency;
@@ -122,12 +162,20 @@ struct userdata {
     pa_time_event *check_death_event;
 
     char *sink_name;
+    pa_usec_t latency;
+
+    pa_bool_t sync;
+    pa_rtp_clock clock;
 
     PA_LLIST_HEAD(struct session, sessions);
     pa_hashmap *by_origin;
     int n_sessions;
 };
 
+enum {
+    SINK_INPUT_MESSAGE_UPDATE_STATS = PA_SINK_INPUT_MESSAGE_MAX
+};
+
 static void session_free(struct session *s);
 
 /* Called from I/O thread context */
@@ -141,6 +189,15 @@ static int sink_input_process_msg(pa_msgobject *o, int code, void *data, int64_t
             /* Fall through, the default handler will add in the extra
              * latency added by the resampler */
             break;
+
+        case SINK_INPUT_MESSAGE_UPDATE_STATS:
+            /* This message is sent from the IO thread to the main
+             * thread, the proplist is freed by the queue */
+
+            pa_assert_ctl_context();
+
+            pa_sink_input_update_proplist(s->sink_input, PA_UPDATE_REPLACE, data);
+            return 0;
     }
 
     return pa_sink_input_process_msg(o, code, data, offset, chunk);
@@ -203,34 +260,285 @@ static void sink_input_suspend_within_thread(pa_sink_input* i, pa_bool_t b) {
 }
 
 /* Called from I/O thread context */
-static int rtpoll_work_cb(pa_rtpoll_item *i) {
-    pa_memchunk chunk;
-    int64_t k, j, delta;
-    struct timeval now = { 0, 0 };
-    struct session *s;
-    struct pollfd *p;
+static void reset_jitter_buffer(struct session *s) {
+    s->jitter = 0;
+    s->in_underrun = FALSE;
 
-    pa_assert_se(s = pa_rtpoll_item_get_userdata(i));
+    s->base_sequence = s->max_sequence = s->rtp_context.sequence;
+    s->sequence_cycles = 0;
+    s->n_received = s->n_concealed = s->n_underruns = 0;
+
+    if (s->last_packet.memblock) {
+        pa_memblock_unref(s->last_packet.memblock);
+        pa_memchunk_reset(&s->last_packet);
+    }
+
+#ifdef HAVE_OPUS
+    if (s->opus_decoder)
+        opus_multistream_decoder_ctl(s->opus_decoder, OPUS_RESET_STATE);
+#endif
+}
+
+#ifdef HAVE_OPUS
+/* Called from I/O thread context */
+static int decode_packet(struct session *s, pa_memchunk *chunk) {
+    pa_memchunk decoded;
+    const uint8_t *d;
+    int frames;
+
+    d = pa_memblock_acquire_chunk(chunk);
+
+    if ((frames = opus_packet_get_nb_samples(d, (opus_int32) chunk->length, (opus_int32) s->sdp_info.sample_spec.rate)) > 0) {
+        decoded.memblock = pa_memblock_new(s->userdata->module->core->mempool, (size_t) frames * s->frame_size);
+        decoded.index = 0;
 
-    p = pa_rtpoll_item_get_pollfd(i, NULL);
+        frames = opus_multistream_decode_float(s->opus_decoder, d, (opus_int32) chunk->length,
+                                               pa_memblock_acquire(decoded.memblock), frames, 0);
+        pa_memblock_release(decoded.memblock);
 
-    if (p->revents & (POLLERR|POLLNVAL|POLLHUP|POLLOUT)) {
-        pa_log("poll() signalled bad revents.");
+        if (frames > 0)
+            decoded.length = (size_t) frames * s->frame_size;
+        else
+            pa_memblock_unref(decoded.memblock);
+    }
+
+    pa_memblock_release(chunk->memblock);
+    pa_memblock_unref(chunk->memblock);
+    pa_memchunk_reset(chunk);
+
+    if (frames <= 0) {
+        pa_log_warn("Failed to decode Opus packet: %s", opus_strerror(frames));
         return -1;
     }
 
-    if ((p->revents & POLLIN) == 0)
+    *chunk = decoded;
+    return 0;
+}
+#endif
+
+/* Called from I/O thread context. Fills in for a packet that got lost and
+ * returns the number of frames pushed. */
+static int64_t conceal_packet(struct session *s) {
+    int64_t frames = (int64_t) (s->last_packet.length / s->frame_size);
+
+#ifdef HAVE_OPUS
+    if (s->opus_decoder) {
+        pa_memchunk chunk;
+        int r;
+
+        /* Let the decoder extrapolate from what it has seen so far */
+        chunk.memblock = pa_memblock_new(s->userdata->module->core->mempool, s->last_packet.length);
+        chunk.index = 0;
+
+        r = opus_multistream_decode_float(s->opus_decoder, NULL, 0, pa_memblock_acquire(chunk.memblock), (int) frames, 0);
+        pa_memblock_release(chunk.memblock);
+
+        chunk.length = r > 0 ? (size_t) r * s->frame_size : 0;
+        frames = r > 0 && pa_memblockq_push(s->memblockq, &chunk) >= 0 ? r : -1;
+        pa_memblock_unref(chunk.memblock);
+
+        return frames;
+    }
+#endif
+
+    if (pa_memblockq_push(s->memblockq, &s->last_packet) < 0)
+        return -1;
+
+    return frames;
+}
+
+/* Called from I/O thread context */
+static void update_sequence(struct session *s) {
+    uint16_t seq = s->rtp_context.sequence;
+
+    /* Late and duplicate packets don't move the highest sequence number */
+    if ((uint16_t) (seq - s->max_sequence) < 0x8000) {
+        if (seq < s->max_sequence)
+            s->sequence_cycles += 0x10000;
+
+        s->max_sequence = seq;
+    }
+
+    s->n_received++;
+}
+
+/* Called from I/O thread context */
+static void update_jitter(struct session *s, pa_usec_t arrival, pa_usec_t duration) {
+    double target;
+    uint64_t underrun_for;
+
+    /* Interarrival jitter as defined in RFC 3550 section 6.4.1, in usec
+     * instead of timestamp units */
+    if (s->n_received > 1) {
+        double d;
+
+        d = (double) arrival - (double) s->last_arrival -
+            (double) (int32_t) (s->rtp_context.timestamp - s->last_rtp_timestamp) * PA_USEC_PER_SEC / s->sdp_info.sample_spec.rate;
+        s->jitter += (fabs(d) - s->jitter) / 16;
+    }
+
+    s->last_arrival = arrival;
+    s->last_rtp_timestamp = s->rtp_context.timestamp;
+
+    /* Keep enough data queued to ride out the jitter. The target grows at
+     * once and shrinks slowly, so that bursts of jitter don't cause a
+     * dropout each time. */
+    target = (double) (s->sink_latency*2 + duration) + JITTER_MULTIPLIER * s->jitter;
+    target = PA_MIN(target, (double) s->max_latency);
+
+    if (target > s->target_latency)
+        s->target_latency = target;
+    else
+        s->target_latency -= (s->target_latency - target) * (double) duration / TARGET_DECAY_USEC;
+
+    /* An underrun means the jitter was underestimated, make some room */
+    underrun_for = s->sink_input->thread_info.underrun_for;
+
+    if (underrun_for > 0 && underrun_for != (uint64_t) -1) {
+        if (!s->in_underrun) {
+            s->in_underrun = TRUE;
+            s->n_underruns++;
+            s->target_latency = PA_MIN(s->target_latency * 1.5, (double) s->max_latency);
+        }
+    } else
+        s->in_underrun = FALSE;
+
+    s->intended_latency = PA_MAX((pa_usec_t) s->target_latency, s->sink_latency*2);
+
+    /* After an underrun, wait for the queue to fill up to the new target */
+    pa_memblockq_set_prebuf(s->memblockq, pa_usec_to_bytes(s->intended_latency - s->sink_latency, &s->sink_input->sample_spec));
+}
+
+/* Called from I/O thread context */
+static void post_stats(struct session *s, pa_usec_t latency) {
+    pa_proplist *p;
+    int64_t expected, lost;
+
+    expected = (int64_t) s->sequence_cycles + (int64_t) s->max_sequence - (int64_t) s->base_sequence + 1;
+    lost = PA_MAX(expected - (int64_t) s->n_received, 0);
+
+    p = pa_proplist_new();
+    pa_proplist_setf(p, "rtp.jitter_usec", "%llu", (unsigned long long) s->jitter);
+    pa_proplist_setf(p, "rtp.latency_usec", "%llu", (unsigned long long) latency);
+    pa_proplist_setf(p, "rtp.target_latency_usec", "%llu", (unsigned long long) s->intended_latency);
+    pa_proplist_setf(p, "rtp.packets_received", "%llu", (unsigned long long) s->n_received);
+    pa_proplist_setf(p, "rtp.packets_lost", "%llu", (unsigned long long) lost);
+    pa_proplist_setf(p, "rtp.packets_concealed", "%llu", (unsigned long long) s->n_concealed);
+    pa_proplist_setf(p, "rtp.underruns", "%llu", (unsigned long long) s->n_underruns);
+
+    pa_asyncmsgq_post(pa_thread_mq_get()->outq, PA_MSGOBJECT(s->sink_input), SINK_INPUT_MESSAGE_UPDATE_STATS, p, 0, NULL, (pa_free_cb_t) pa_proplist_free);
+}
+
+/* Called from I/O thread context. How long it takes until the frame at
+ * the write index of the queue is played. */
+static pa_usec_t queue_latency(struct session *s) {
+    pa_usec_t wi, ri, render_delay, sink_delay;
+
+    wi = pa_bytes_to_usec((uint64_t) pa_memblockq_get_write_index(s->memblockq), &s->sink_input->sample_spec);
+    ri = pa_bytes_to_usec((uint64_t) pa_memblockq_get_read_index(s->memblockq), &s->sink_input->sample_spec);
+
+    pa_log_debug("wi=%lu ri=%lu", (unsigned long) wi, (unsigned long) ri);
+
+    sink_delay = pa_sink_get_latency_within_thread(s->sink_input->sink);
+    render_delay = pa_bytes_to_usec(pa_memblockq_get_length(s->sink_input->thread_info.render_memblockq), &s->sink_input->sink->sample_spec);
+
+    if (ri > render_delay+sink_delay)
+        ri -= render_delay+sink_delay;
+    else
+        ri = 0;
+
+    if (wi < ri)
         return 0;
 
-    p->revents = 0;
+    return wi - ri;
+}
+
+/* Called from I/O thread context */
+static void update_sender_report(struct session *s) {
+    pa_rtcp_sender_report sr;
+
+    if (pa_rtcp_recv_sender_report(s->rtcp_fd, &sr) < 0 || !s->first_packet || sr.ssrc != s->ssrc)
+        return;
+
+    if (s->have_sender_report) {
+        int32_t frames = (int32_t) (sr.rtp_timestamp - s->sync_timestamp);
+        double predicted, error;
+
+        predicted = (double) frames * s->sync_usec_per_frame;
+        error = (double) sr.ref_usec - (double) s->sync_ref - predicted;
+
+        if (frames > 0 && fabs(error) < SYNC_MAX_REPORT_ERROR_USEC) {
+            s->sync_ref = (pa_usec_t) ((double) s->sync_ref + predicted + error / 8);
+            s->sync_usec_per_frame += error / 128 / frames;
+            s->sync_timestamp = sr.rtp_timestamp;
+            return;
+        }
+
+        /* The sender was suspended or its clock was stepped */
+        pa_log_info("Sender report off by %0.2f ms, resynchronizing", error / PA_USEC_PER_MSEC);
+    }
+
+    s->have_sender_report = TRUE;
+    s->sync_align = TRUE;
+    s->sync_ref = sr.ref_usec;
+    s->sync_timestamp = sr.rtp_timestamp;
+    s->sync_usec_per_frame = (double) PA_USEC_PER_SEC / s->sdp_info.sample_spec.rate;
+}
+
+/* Called from I/O thread context. Fixes the latency so that the frame at
+ * the write index is played latency_msec after the sender captured it. The
+ * rate adjustment then keeps the queue at that latency. */
+static void update_sync(struct session *s) {
+    int64_t target, error;
+
+    target = (int64_t) s->sync_ref + (int64_t) ((double) (int32_t) (s->offset - s->sync_timestamp) * s->sync_usec_per_frame) +
+        (int64_t) s->userdata->latency - (int64_t) pa_rtp_clock_now(&s->userdata->clock);
+
+    if (target < (int64_t) s->sink_latency*2) {
+        if (!s->sync_late)
+            pa_log_warn("Stream '%s' arrives too late to be played in sync, latency_msec= needs to be at least %0.0f ms higher.",
+                        pa_strnull(s->sdp_info.session_name), (double) ((int64_t) s->sink_latency*2 - target) / PA_USEC_PER_MSEC + 1);
+
+        s->sync_late = TRUE;
+        target = (int64_t) s->sink_latency*2;
+    } else
+        s->sync_late = FALSE;
+
+    s->intended_latency = (pa_usec_t) target;
+    pa_memblockq_set_prebuf(s->memblockq, pa_usec_to_bytes(s->intended_latency - s->sink_latency, &s->sink_input->sample_spec));
+
+    if (!s->sync_align)
+        return;
+
+    s->sync_align = FALSE;
+
+    /* Jump to the presentation time by padding the queue with silence or
+     * dropping what is played too late */
+    error = target - (int64_t) queue_latency(s);
+
+    if (error > (int64_t) SYNC_TOLERANCE_USEC)
+        pa_memblockq_seek(s->memblockq, (int64_t) pa_usec_to_bytes((pa_usec_t) error, &s->sink_input->sample_spec), PA_SEEK_RELATIVE, TRUE);
+    else if (error < -(int64_t) SYNC_TOLERANCE_USEC)
+        pa_memblockq_drop(s->memblockq, PA_MIN(pa_usec_to_bytes((pa_usec_t) -error, &s->sink_input->sample_spec), pa_memblockq_get_length(s->memblockq)));
+    else
+        return;
+
+    pa_log_debug("Realigned stream '%s' by %0.2f ms", pa_strnull(s->sdp_info.session_name), (double) error / PA_USEC_PER_MSEC);
+}
+
+/* Called from I/O thread context */
+static pa_bool_t process_packet(struct session *s) {
+    pa_memchunk chunk;
+    int64_t k, j, delta;
+    struct timeval now = { 0, 0 };
 
     if (pa_rtp_recv(&s->rtp_context, &chunk, s->userdata->module->core->mempool, &now) < 0)
-        return 0;
+        return FALSE;
 
     if (s->sdp_info.payload != s->rtp_context.payload ||
         !PA_SINK_IS_OPENED(s->sink_input->sink->thread_info.state)) {
         pa_memblock_unref(chunk.memblock);
-        return 0;
+        return FALSE;
     }
 
     if (!s->first_packet) {
@@ -241,13 +549,29 @@ static int rtpoll_work_cb(pa_rtpoll_item *i) {
 
         if (s->ssrc == s->userdata->module->core->cookie)
             pa_log_warn("Detected RTP packet loop!");
+
+        reset_jitter_buffer(s);
+        s->have_sender_report = FALSE;
     } else {
         if (s->ssrc != s->rtp_context.ssrc) {
             pa_memblock_unref(chunk.memblock);
-            return 0;
+            return FALSE;
         }
     }
 
+#ifdef HAVE_OPUS
+    if (s->opus_decoder && decode_packet(s, &chunk) < 0)
+        return FALSE;
+#endif
+
+    if (now.tv_sec == 0) {
+        PA_ONCE_BEGIN {
+            pa_log_warn("Using artificial time instead of timestamp");
+        } PA_ONCE_END;
+        pa_rtclock_get(&now);
+    } else
+        pa_rtclock_from_wallclock(&now);
+
     /* Check whether there was a timestamp overflow */
     k = (int64_t) s->rtp_context.timestamp - (int64_t) s->offset;
     j = (int64_t) 0x100000000LL - (int64_t) s->offset + (int64_t) s->rtp_context.timestamp;
@@ -257,15 +581,24 @@ static int rtpoll_work_cb(pa_rtpoll_item *i) {
     else
         delta = j;
 
-    pa_memblockq_seek(s->memblockq, delta * (int64_t) s->rtp_context.frame_size, PA_SEEK_RELATIVE, TRUE);
+    /* Conceal a single lost packet, by repeating the one before it or with
+     * the Opus decoder. Should the lost packet still arrive in time it
+     * replaces the concealment. */
+    if (s->last_packet.memblock &&
+        s->rtp_context.sequence == (uint16_t) (s->max_sequence + 2) &&
+        delta == (int64_t) (s->last_packet.length / s->frame_size)) {
+        int64_t n;
+
+        if ((n = conceal_packet(s)) > 0) {
+            delta -= n;
+            s->n_concealed++;
+        }
+    }
 
-    if (now.tv_sec == 0) {
-        PA_ONCE_BEGIN {
-            pa_log_warn("Using artificial time instead of timestamp");
-        } PA_ONCE_END;
-        pa_rtclock_get(&now);
-    } else
-        pa_rtclock_from_wallclock(&now);
+    pa_memblockq_seek(s->memblockq, delta * (int64_t) s->frame_size, PA_SEEK_RELATIVE, TRUE);
+
+    update_sequence(s);
+    update_jitter(s, pa_timeval_load(&now), pa_bytes_to_usec(chunk.length, &s->sdp_info.sample_spec));
 
     if (pa_memblockq_push(s->memblockq, &chunk) < 0) {
         pa_log_warn("Queue overrun");
@@ -274,15 +607,21 @@ static int rtpoll_work_cb(pa_rtpoll_item *i) {
 
 /*     pa_log("blocks in q: %u", pa_memblockq_get_nblocks(s->memblockq)); */
 
-    pa_memblock_unref(chunk.memblock);
+    if (s->last_packet.memblock)
+        pa_memblock_unref(s->last_packet.memblock);
+
+    s->last_packet = chunk;
 
     /* The next timestamp we expect */
-    s->offset = s->rtp_context.timestamp + (uint32_t) (chunk.length / s->rtp_context.frame_size);
+    s->offset = s->rtp_context.timestamp + (uint32_t) (chunk.length / s->frame_size);
+
+    if (s->have_sender_report)
+        update_sync(s);
 
     pa_atomic_store(&s->timestamp, (int) now.tv_sec);
 
     if (s->last_rate_update + RATE_UPDATE_INTERVAL < pa_timeval_load(&now)) {
-        pa_usec_t wi, ri, render_delay, sink_delay = 0, latency;
+        pa_usec_t latency;
         uint32_t base_rate = s->sink_input->sink->sample_spec.rate;
         uint32_t current_rate = s->sink_input->sample_spec.rate;
         uint32_t new_rate;
@@ -290,23 +629,7 @@ static int rtpoll_work_cb(pa_rtpoll_item *i) {
 
         pa_log_debug("Updating sample rate");
 
-        wi = pa_bytes_to_usec((uint64_t) pa_memblockq_get_write_index(s->memblockq), &s->sink_input->sample_spec);
-        ri = pa_bytes_to_usec((uint64_t) pa_memblockq_get_read_index(s->memblockq), &s->sink_input->sample_spec);
-
-        pa_log_debug("wi=%lu ri=%lu", (unsigned long) wi, (unsigned long) ri);
-
-        sink_delay = pa_sink_get_latency_within_thread(s->sink_input->sink);
-        render_delay = pa_bytes_to_usec(pa_memblockq_get_length(s->sink_input->thread_info.render_memblockq), &s->sink_input->sink->sample_spec);
-
-        if (ri > render_delay+sink_delay)
-            ri -= render_delay+sink_delay;
-        else
-            ri = 0;
-
-        if (wi < ri)
-            latency = 0;
-        else
-            latency = wi - ri;
+        latency = queue_latency(s);
 
         pa_log_debug("Write index deviates by %0.2f ms, expected %0.2f ms", (double) latency/PA_USEC_PER_MSEC, (double) s->intended_latency/PA_USEC_PER_MSEC);
 
@@ -350,6 +673,11 @@ static int rtpoll_work_cb(pa_rtpoll_item *i) {
         new_rate = (uint32_t) ((double) (RATE_UPDATE_INTERVAL + latency/4 - s->intended_latency/4) / (double) RATE_UPDATE_INTERVAL * s->avg_estimated_rate);
         s->last_latency = latency;
 
+        /* Leave small deviations from the presentation time to the rate
+         * adjustment, which takes a while for bigger ones */
+        if (s->have_sender_report && (latency > s->intended_latency + SYNC_REALIGN_USEC || latency + SYNC_REALIGN_USEC < s->intended_latency))
+            s->sync_align = TRUE;
+
         if (new_rate < (uint32_t) (base_rate*0.8) || new_rate > (uint32_t) (base_rate*1.25)) {
             pa_log_warn("Sample rates too different, not adjusting (%u vs. %u).", base_rate, new_rate);
             new_rate = base_rate;
@@ -370,9 +698,52 @@ static int rtpoll_work_cb(pa_rtpoll_item *i) {
 
         pa_log_debug("Updated sampling rate to %lu Hz.", (unsigned long) s->sink_input->sample_spec.rate);
 
+        post_stats(s, latency);
+
         s->last_rate_update = pa_timeval_load(&now);
     }
 
+    return TRUE;
+}
+
+/* Called from I/O thread context */
+static int rtpoll_work_cb(pa_rtpoll_item *i) {
+    struct session *s;
+    struct pollfd *p;
+    unsigned n, k;
+    pa_bool_t processed = FALSE;
+
+    pa_assert_se(s = pa_rtpoll_item_get_userdata(i));
+
+    p = pa_rtpoll_item_get_pollfd(i, &n);
+
+    for (k = 0; k < n; k++)
+        if (p[k].revents & (POLLERR|POLLNVAL|POLLHUP|POLLOUT)) {
+            pa_log("poll() signalled bad revents.");
+            return -1;
+        }
+
+    /* Take the sender reports first, so that the packets that came with
+     * them are already placed with the new mapping */
+    if (n > 1 && (p[1].revents & POLLIN)) {
+        p[1].revents = 0;
+        update_sender_report(s);
+    }
+
+    if ((p->revents & POLLIN) == 0)
+        return 0;
+
+    p->revents = 0;
+
+    /* Handle every packet of the batch read by pa_rtp_recv() */
+    do {
+        if (process_packet(s))
+            processed = TRUE;
+    } while (pa_rtp_recv_pending(&s->rtp_context));
+
+    if (!processed)
+        return 0;
+
     if (pa_memblockq_is_readable(s->memblockq) &&
         s->sink_input->thread_info.underrun_for > 0) {
         pa_log_debug("Requesting rewind due to end of underrun");
@@ -393,12 +764,18 @@ static void sink_input_attach(pa_sink_input *i) {
     pa_assert_se(s = i->userdata);
 
     pa_assert(!s->rtpoll_item);
-    s->rtpoll_item = pa_rtpoll_item_new(i->sink->thread_info.rtpoll, PA_RTPOLL_LATE, 1);
+    s->rtpoll_item = pa_rtpoll_item_new(i->sink->thread_info.rtpoll, PA_RTPOLL_LATE, s->rtcp_fd >= 0 ? 2 : 1);
 
     p = pa_rtpoll_item_get_pollfd(s->rtpoll_item, NULL);
-    p->fd = s->rtp_context.fd;
-    p->events = POLLIN;
-    p->revents = 0;
+    p[0].fd = s->rtp_context.fd;
+    p[0].events = POLLIN;
+    p[0].revents = 0;
+
+    if (s->rtcp_fd >= 0) {
+        p[1].fd = s->rtcp_fd;
+        p[1].events = POLLIN;
+        p[1].revents = 0;
+    }
 
     pa_rtpoll_item_set_work_callback(s->rtpoll_item, rtpoll_work_cb);
     pa_rtpoll_item_set_userdata(s->rtpoll_item, s);
@@ -507,17 +884,51 @@ static struct session *session_new(struct userdata *u, const pa_sdp_info *sdp_in
     s->userdata = u;
     s->first_packet = FALSE;
     s->sdp_info = *sdp_info;
+    s->frame_size = pa_frame_size(&sdp_info->sample_spec);
     s->rtpoll_item = NULL;
-    s->intended_latency = LATENCY_USEC;
+    s->rtcp_fd = -1;
+    s->max_latency = u->latency;
+    s->intended_latency = u->latency;
     s->last_rate_update = pa_timeval_load(&now);
-    s->last_latency = LATENCY_USEC;
+    s->last_latency = u->latency;
     s->estimated_rate = (double) sink->sample_spec.rate;
     s->avg_estimated_rate = (double) sink->sample_spec.rate;
     pa_atomic_store(&s->timestamp, (int) now.tv_sec);
 
+    if (sdp_info->is_opus) {
+#ifdef HAVE_OPUS
+        int err;
+
+        if (!(s->opus_decoder = opus_multistream_decoder_create((opus_int32) sdp_info->sample_spec.rate, sdp_info->sample_spec.channels,
+                                                                sdp_info->opus.streams, sdp_info->opus.coupled_streams,
+                                                                sdp_info->opus.mapping, &err))) {
+            pa_log("Failed to create Opus decoder: %s", opus_strerror(err));
+            goto fail;
+        }
+#else
+        pa_log("Opus support not available.");
+        goto fail;
+#endif
+    }
+
     if ((fd = mcast_socket((const struct sockaddr*) &sdp_info->sa, sdp_info->salen)) < 0)
         goto fail;
 
+    /* The sender reports come in on the port after the RTP one */
+    if (u->sync) {
+        struct sockaddr_storage sa = sdp_info->sa;
+
+        if (sa.ss_family == AF_INET)
+            ((struct sockaddr_in*) &sa)->sin_port = htons((uint16_t) (ntohs(((struct sockaddr_in*) &sa)->sin_port) + 1));
+#ifdef HAVE_IPV6
+        else
+            ((struct sockaddr_in6*) &sa)->sin6_port = htons((uint16_t) (ntohs(((struct sockaddr_in6*) &sa)->sin6_port) + 1));
+#endif
+
+        if ((s->rtcp_fd = mcast_socket((const struct sockaddr*) &sa, sdp_info->salen)) < 0)
+            goto fail;
+    }
+
     pa_sink_input_new_data_init(&data);
     pa_sink_input_new_data_set_sink(&data, sink, FALSE);
     data.driver = __FILE__;
@@ -534,6 +945,11 @@ static struct session *session_new(struct userdata *u, const pa_sdp_info *sdp_in
     pa_proplist_setf(data.proplist, "rtp.payload", "%u", (unsigned) sdp_info->payload);
     data.module = u->module;
     pa_sink_input_new_data_set_sample_spec(&data, &sdp_info->sample_spec);
+    if (sdp_info->is_opus && sdp_info->sample_spec.channels > 2) {
+        pa_channel_map map;
+
+        pa_sink_input_new_data_set_channel_map(&data, pa_rtp_opus_channel_map_init(&map, sdp_info->sample_spec.channels));
+    }
     data.flags = PA_SINK_INPUT_VARIABLE_RATE;
 
     pa_sink_input_new(&s->sink_input, u->module->core, &data);
@@ -562,6 +978,11 @@ static struct session *session_new(struct userdata *u, const pa_sdp_info *sdp_in
     if (s->intended_latency < s->sink_latency*2)
         s->intended_latency = s->sink_latency*2;
 
+    /* Start out with the full latency and shrink it as soon as the jitter
+     * is known */
+    s->max_latency = s->intended_latency;
+    s->target_latency = (double) s->intended_latency;
+
     s->memblockq = pa_memblockq_new(
             "module-rtp-recv memblockq",
             0,
@@ -575,7 +996,8 @@ static struct session *session_new(struct userdata *u, const pa_sdp_info *sdp_in
 
     pa_memblock_unref(silence.memblock);
 
-    pa_rtp_context_init_recv(&s->rtp_context, fd, pa_frame_size(&s->sdp_info.sample_spec));
+    /* Opus packets only become frames once they are decoded */
+    pa_rtp_context_init_recv(&s->rtp_context, fd, s->sdp_info.is_opus ? 1 : s->frame_size);
 
     pa_hashmap_put(s->userdata->by_origin, s->sdp_info.origin, s);
     u->n_sessions++;
@@ -588,6 +1010,14 @@ static struct session *session_new(struct userdata *u, const pa_sdp_info *sdp_in
     return s;
 
 fail:
+#ifdef HAVE_OPUS
+    if (s && s->opus_decoder)
+        opus_multistream_decoder_destroy(s->opus_decoder);
+#endif
+
+    if (s && s->rtcp_fd >= 0)
+        pa_close(s->rtcp_fd);
+
     pa_xfree(s);
 
     if (fd >= 0)
@@ -608,10 +1038,21 @@ static void session_free(struct session *s) {
     pa_assert(s->userdata->n_sessions >= 1);
     s->userdata->n_sessions--;
 
+    if (s->last_packet.memblock)
+        pa_memblock_unref(s->last_packet.memblock);
+
     pa_memblockq_free(s->memblockq);
     pa_sdp_info_destroy(&s->sdp_info);
     pa_rtp_context_destroy(&s->rtp_context);
 
+    if (s->rtcp_fd >= 0)
+        pa_close(s->rtcp_fd);
+
+#ifdef HAVE_OPUS
+    if (s->opus_decoder)
+        opus_multistream_decoder_destroy(s->opus_decoder);
+#endif
+
     pa_xfree(s);
 }
 
@@ -693,11 +1134,15 @@ int pa__init(pa_module*m) {
 #endif
     struct sockaddr *sa;
     socklen_t salen;
-    const char *sap_address;
+    const char *sap_address, *sync_clock;
+    pa_rtp_clock clock;
+    uint32_t latency_msec;
     int fd = -1;
 
     pa_assert(m);
 
+    clock.fd = -1;
+
     if (!(ma = pa_modargs_new(m->argument, valid_modargs))) {
         pa_log("failed to parse module arguments");
         goto fail;
@@ -705,6 +1150,15 @@ int pa__init(pa_module*m) {
 
     sap_address = pa_modargs_get_value(ma, "sap_address", DEFAULT_SAP_ADDRESS);
 
+    latency_msec = LATENCY_USEC / PA_USEC_PER_MSEC;
+    if (pa_modargs_get_value_u32(ma, "latency_msec", &latency_msec) < 0 || latency_msec < 1 || latency_msec > 10000) {
+        pa_log("Invalid latency specification");
+        goto fail;
+    }
+
+    if ((sync_clock = pa_modargs_get_value(ma, "sync_clock", NULL)) && pa_rtp_clock_open(&clock, sync_clock) < 0)
+        goto fail;
+
     if (inet_pton(AF_INET, sap_address, &sa4.sin_addr) > 0) {
         sa4.sin_family = AF_INET;
         sa4.sin_port = htons(SAP_PORT);
@@ -729,6 +1183,9 @@ int pa__init(pa_module*m) {
     u->module = m;
     u->core = m->core;
     u->sink_name = pa_xstrdup(pa_modargs_get_value(ma, "sink", NULL));
+    u->latency = (pa_usec_t) latency_msec * PA_USEC_PER_MSEC;
+    u->sync = !!sync_clock;
+    u->clock = clock;
 
     u->sap_event = m->core->mainloop->io_new(m->core->mainloop, fd, PA_IO_EVENT_INPUT, sap_event_cb, u);
     pa_sap_context_init_recv(&u->sap_context, fd);
@@ -750,6 +1207,8 @@ fail:
     if (fd >= 0)
         pa_close(fd);
 
+    pa_rtp_clock_close(&clock);
+
     return -1;
 }
 
@@ -772,6 +1231,8 @@ void pa__done(pa_module*m) {
     if (u->by_origin)
         pa_hashmap_free(u->by_origin, (pa_free_cb_t) session_free);
 
+    pa_rtp_clock_close(&u->clock);
+
     pa_xfree(u->sink_name);
     pa_xfree(u);
 }
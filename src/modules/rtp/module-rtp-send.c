@@ -27,8 +27,13 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <errno.h>
+#include <string.h>
 #include <unistd.h>
 
+#ifdef HAVE_OPUS
+#include <opus_multistream.h>
+#endif
+
 #include <pulse/rtclock.h>
 #include <pulse/timeval.h>
 #include <pulse/util.h>
@@ -68,7 +73,11 @@ PA_MODULE_USAGE(
         "port=<port number> "
         "mtu=<maximum transfer unit> "
         "loop=<loopback to local host?> "
-        "ttl=<ttl value>"
+        "ttl=<ttl value> "
+        "codec=<pcm or opus> "
+        "bitrate=<Opus bitrate in bit/s> "
+        "frame_msec=<Opus frame duration in ms: 5, 10, 20, 40 or 60> "
+        "sync_clock=<realtime or a PTP clock device, to send RTCP sender reports for synchronized playback>"
 );
 
 #define DEFAULT_PORT 46000
@@ -79,6 +88,9 @@ PA_MODULE_USAGE(
 #define MEMBLOCKQ_MAXLENGTH (1024*170)
 #define DEFAULT_MTU 1280
 #define SAP_INTERVAL (5*PA_USEC_PER_SEC)
+#define OPUS_RATE 48000
+#define DEFAULT_OPUS_FRAME_MSEC 10
+#define SENDER_REPORT_INTERVAL (PA_USEC_PER_SEC)
 
 static const char* const valid_modargs[] = {
     "source",
@@ -92,6 +104,10 @@ static const char* const valid_modargs[] = {
     "mtu" ,
     "loop",
     "ttl",
+    "codec",
+    "bitrate",
+    "frame_msec",
+    "sync_clock",
     NULL
 };
 
@@ -106,6 +122,18 @@ struct userdata {
     size_t mtu;
 
     pa_time_event *sap_event;
+
+    /* RTCP sender reports, only sent if sync_clock= is set */
+    int rtcp_fd;
+    pa_rtp_clock clock;
+    pa_usec_t next_sender_report;
+
+#ifdef HAVE_OPUS
+    OpusMSEncoder *opus_encoder;
+    unsigned opus_frames;
+    float *opus_buffer;
+    uint8_t *opus_packet;
+#endif
 };
 
 /* Called from I/O thread context */
@@ -125,6 +153,62 @@ static int source_output_process_msg(pa_msgobject *o, int code, void *data, int6
     return pa_source_output_process_msg(o, code, data, offset, chunk);
 }
 
+#ifdef HAVE_OPUS
+/* Called from I/O thread context */
+static void send_opus(struct userdata *u) {
+    size_t frame_bytes = u->opus_frames * pa_frame_size(&u->source_output->sample_spec);
+
+    while (pa_memblockq_get_length(u->memblockq) >= frame_bytes) {
+        size_t n = 0;
+        opus_int32 k;
+
+        /* The encoder wants the whole frame in one piece */
+        while (n < frame_bytes) {
+            pa_memchunk chunk;
+            size_t l;
+
+            pa_assert_se(pa_memblockq_peek(u->memblockq, &chunk) >= 0);
+
+            l = PA_MIN(chunk.length, frame_bytes - n);
+            memcpy((uint8_t*) u->opus_buffer + n, pa_memblock_acquire_chunk(&chunk), l);
+            pa_memblock_release(chunk.memblock);
+            pa_memblock_unref(chunk.memblock);
+
+            pa_memblockq_drop(u->memblockq, l);
+            n += l;
+        }
+
+        if ((k = opus_multistream_encode_float(u->opus_encoder, u->opus_buffer, (int) u->opus_frames, u->opus_packet, (opus_int32) u->mtu)) < 0) {
+            pa_log_warn("Failed to encode Opus frame: %s", opus_strerror(k));
+            continue;
+        }
+
+        pa_rtp_send_packet(&u->rtp_context, u->opus_packet, (size_t) k, u->opus_frames);
+    }
+}
+#endif
+
+/* Called from I/O thread context. Tells the receivers which RTP timestamp
+ * the frame the source is capturing right now will get, so that they can
+ * map the stream to the reference clock. */
+static void send_sender_report(struct userdata *u) {
+    const pa_sample_spec *ss = &u->source_output->sample_spec;
+    pa_usec_t now, latency;
+    uint32_t timestamp;
+
+    if (u->rtcp_fd < 0 || (now = pa_rtclock_now()) < u->next_sender_report)
+        return;
+
+    /* Everything still queued here or in the source is older */
+    latency = pa_bytes_to_usec(pa_memblockq_get_length(u->memblockq), ss) +
+        pa_source_get_latency_within_thread(u->source_output->source);
+    timestamp = u->rtp_context.timestamp + (uint32_t) (latency * ss->rate / PA_USEC_PER_SEC);
+
+    pa_rtcp_send_sender_report(&u->rtp_context, u->rtcp_fd, pa_rtp_clock_now(&u->clock), timestamp);
+
+    u->next_sender_report = now + SENDER_REPORT_INTERVAL;
+}
+
 /* Called from I/O thread context */
 static void source_output_push(pa_source_output *o, const pa_memchunk *chunk) {
     struct userdata *u;
@@ -136,7 +220,14 @@ static void source_output_push(pa_source_output *o, const pa_memchunk *chunk) {
         return;
     }
 
-    pa_rtp_send(&u->rtp_context, u->mtu, u->memblockq);
+#ifdef HAVE_OPUS
+    if (u->opus_encoder)
+        send_opus(u);
+    else
+#endif
+        pa_rtp_send(&u->rtp_context, u->mtu, u->memblockq);
+
+    send_sender_report(u);
 }
 
 /* Called from main context */
@@ -172,13 +263,13 @@ int pa__init(pa_module*m) {
     uint32_t port = DEFAULT_PORT, mtu;
     uint32_t ttl = DEFAULT_TTL;
     sa_family_t af;
-    int fd = -1, sap_fd = -1;
+    int fd = -1, sap_fd = -1, rtcp_fd = -1;
     pa_source *s;
     pa_sample_spec ss;
     pa_channel_map cm;
-    struct sockaddr_in dst_sa4, dst_sap_sa4, src_sa4, src_sap_sa4;
+    struct sockaddr_in dst_sa4, dst_sap_sa4, dst_rtcp_sa4, src_sa4, src_sap_sa4;
 #ifdef HAVE_IPV6
-    struct sockaddr_in6 dst_sa6, dst_sap_sa6, src_sa6, src_sap_sa6;
+    struct sockaddr_in6 dst_sa6, dst_sap_sa6, dst_rtcp_sa6, src_sa6, src_sap_sa6;
 #endif
     struct sockaddr_storage sa_dst;
     pa_source_output *o = NULL;
@@ -189,9 +280,21 @@ int pa__init(pa_module*m) {
     char hn[128], *n;
     pa_bool_t loop = FALSE;
     pa_source_output_new_data data;
+    const char *codec;
+    pa_bool_t opus = FALSE;
+    pa_sdp_opus_info opus_info;
+    pa_usec_t latency;
+    const char *sync_clock;
+    pa_rtp_clock clock;
+#ifdef HAVE_OPUS
+    OpusMSEncoder *enc = NULL;
+    uint32_t frame_msec = DEFAULT_OPUS_FRAME_MSEC, bitrate = 0;
+#endif
 
     pa_assert(m);
 
+    clock.fd = -1;
+
     if (!(ma = pa_modargs_new(m->argument, valid_modargs))) {
         pa_log("Failed to parse module arguments");
         goto fail;
@@ -207,6 +310,20 @@ int pa__init(pa_module*m) {
         goto fail;
     }
 
+    codec = pa_modargs_get_value(ma, "codec", "pcm");
+
+    if (pa_streq(codec, "opus")) {
+#ifdef HAVE_OPUS
+        opus = TRUE;
+#else
+        pa_log("Opus support not available.");
+        goto fail;
+#endif
+    } else if (!pa_streq(codec, "pcm")) {
+        pa_log("Invalid codec '%s'.", codec);
+        goto fail;
+    }
+
     ss = s->sample_spec;
     pa_rtp_sample_spec_fixup(&ss);
     cm = s->channel_map;
@@ -215,23 +332,70 @@ int pa__init(pa_module*m) {
         goto fail;
     }
 
-    if (!pa_rtp_sample_spec_valid(&ss)) {
+    if (opus) {
+        /* RFC 7587 fixes the clock rate at 48 kHz */
+        ss.format = PA_SAMPLE_FLOAT32NE;
+        ss.rate = OPUS_RATE;
+    } else if (!pa_rtp_sample_spec_valid(&ss)) {
         pa_log("Specified sample type not compatible with RTP");
         goto fail;
     }
 
-    if (ss.channels != cm.channels)
+    if (opus && ss.channels > 2)
+        pa_rtp_opus_channel_map_init(&cm, ss.channels);
+    else if (ss.channels != cm.channels)
         pa_channel_map_init_auto(&cm, ss.channels, PA_CHANNEL_MAP_AIFF);
 
-    payload = pa_rtp_payload_from_sample_spec(&ss);
+    /* Opus uses a dynamic payload type */
+    payload = opus ? 127 : pa_rtp_payload_from_sample_spec(&ss);
 
-    mtu = (uint32_t) pa_frame_align(DEFAULT_MTU, &ss);
+    mtu = opus ? DEFAULT_MTU : (uint32_t) pa_frame_align(DEFAULT_MTU, &ss);
 
-    if (pa_modargs_get_value_u32(ma, "mtu", &mtu) < 0 || mtu < 1 || mtu % pa_frame_size(&ss) != 0) {
+    if (pa_modargs_get_value_u32(ma, "mtu", &mtu) < 0 || mtu < 1 || (!opus && mtu % pa_frame_size(&ss) != 0)) {
         pa_log("Invalid MTU.");
         goto fail;
     }
 
+    latency = pa_bytes_to_usec(mtu, &ss);
+
+#ifdef HAVE_OPUS
+    if (opus) {
+        int family, streams, coupled, err;
+
+        if (pa_modargs_get_value_u32(ma, "frame_msec", &frame_msec) < 0 ||
+            (frame_msec != 5 && frame_msec != 10 && frame_msec != 20 && frame_msec != 40 && frame_msec != 60)) {
+            pa_log("frame_msec= expects one of 5, 10, 20, 40 or 60.");
+            goto fail;
+        }
+
+        if (pa_modargs_get_value_u32(ma, "bitrate", &bitrate) < 0) {
+            pa_log("Failed to parse \"bitrate\" parameter.");
+            goto fail;
+        }
+
+        /* Mono and stereo are a single stream, up to 7.1 the channels are
+         * coupled after their positions and beyond that they are coded
+         * one by one */
+        family = ss.channels <= 2 ? 0 : (ss.channels <= 8 ? 1 : 255);
+
+        pa_zero(opus_info);
+        if (!(enc = opus_multistream_surround_encoder_create(OPUS_RATE, ss.channels, family, &streams, &coupled, opus_info.mapping, OPUS_APPLICATION_AUDIO, &err))) {
+            pa_log("Failed to create Opus encoder: %s", opus_strerror(err));
+            goto fail;
+        }
+
+        opus_info.streams = (uint8_t) streams;
+        opus_info.coupled_streams = (uint8_t) coupled;
+
+        if (bitrate > 0 && (err = opus_multistream_encoder_ctl(enc, OPUS_SET_BITRATE((opus_int32) bitrate))) != OPUS_OK) {
+            pa_log("Invalid Opus bitrate %u: %s", bitrate, opus_strerror(err));
+            goto fail;
+        }
+
+        latency = frame_msec * PA_USEC_PER_MSEC;
+    }
+#endif
+
     port = DEFAULT_PORT + ((uint32_t) (rand() % 512) << 1);
     if (pa_modargs_get_value_u32(ma, "port", &port) < 0 || port < 1 || port > 0xFFFF) {
         pa_log("port= expects a numerical argument between 1 and 65535.");
@@ -241,6 +405,17 @@ int pa__init(pa_module*m) {
     if (port & 1)
         pa_log_warn("Port number not even as suggested in RFC3550!");
 
+    /* RTCP goes to the port after the RTP one */
+    if ((sync_clock = pa_modargs_get_value(ma, "sync_clock", NULL))) {
+        if (port >= 0xFFFF) {
+            pa_log("No port left for RTCP after port %u.", port);
+            goto fail;
+        }
+
+        if (pa_rtp_clock_open(&clock, sync_clock) < 0)
+            goto fail;
+    }
+
     if (pa_modargs_get_value_u32(ma, "ttl", &ttl) < 0 || ttl < 1 || ttl > 0xFF) {
         pa_log("ttl= expects a numerical argument between 1 and 255.");
         goto fail;
@@ -272,12 +447,16 @@ int pa__init(pa_module*m) {
         dst_sa4.sin_port = htons((uint16_t) port);
         dst_sap_sa4 = dst_sa4;
         dst_sap_sa4.sin_port = htons(SAP_PORT);
+        dst_rtcp_sa4 = dst_sa4;
+        dst_rtcp_sa4.sin_port = htons((uint16_t) (port + 1));
 #ifdef HAVE_IPV6
     } else if (inet_pton(AF_INET6, dst_addr, &dst_sa6.sin6_addr) > 0) {
         dst_sa6.sin6_family = af = AF_INET6;
         dst_sa6.sin6_port = htons((uint16_t) port);
         dst_sap_sa6 = dst_sa6;
         dst_sap_sa6.sin6_port = htons(SAP_PORT);
+        dst_rtcp_sa6 = dst_sa6;
+        dst_rtcp_sa6.sin6_port = htons((uint16_t) (port + 1));
 #endif
     } else {
         pa_log("Invalid destination '%s'", dst_addr);
@@ -334,9 +513,29 @@ int pa__init(pa_module*m) {
 #endif
     }
 
+    if (sync_clock) {
+        if ((rtcp_fd = pa_socket_cloexec(af, SOCK_DGRAM, 0)) < 0) {
+            pa_log("socket() failed: %s", pa_cstrerror(errno));
+            goto fail;
+        }
+
+        if (af == AF_INET && (bind(rtcp_fd, (struct sockaddr*) &src_sa4, sizeof(src_sa4)) < 0 ||
+                              connect(rtcp_fd, (struct sockaddr*) &dst_rtcp_sa4, sizeof(dst_rtcp_sa4)) < 0)) {
+            pa_log("Failed to set up RTCP socket: %s", pa_cstrerror(errno));
+            goto fail;
+#ifdef HAVE_IPV6
+        } else if (af == AF_INET6 && (bind(rtcp_fd, (struct sockaddr*) &src_sa6, sizeof(src_sa6)) < 0 ||
+                                      connect(rtcp_fd, (struct sockaddr*) &dst_rtcp_sa6, sizeof(dst_rtcp_sa6)) < 0)) {
+            pa_log("Failed to set up RTCP socket: %s", pa_cstrerror(errno));
+            goto fail;
+#endif
+        }
+    }
+
     j = !!loop;
     if (setsockopt(fd, IPPROTO_IP, IP_MULTICAST_LOOP, &j, sizeof(j)) < 0 ||
-        setsockopt(sap_fd, IPPROTO_IP, IP_MULTICAST_LOOP, &j, sizeof(j)) < 0) {
+        setsockopt(sap_fd, IPPROTO_IP, IP_MULTICAST_LOOP, &j, sizeof(j)) < 0 ||
+        (rtcp_fd >= 0 && setsockopt(rtcp_fd, IPPROTO_IP, IP_MULTICAST_LOOP, &j, sizeof(j)) < 0)) {
         pa_log("IP_MULTICAST_LOOP failed: %s", pa_cstrerror(errno));
         goto fail;
     }
@@ -353,6 +552,11 @@ int pa__init(pa_module*m) {
             pa_log("IP_MULTICAST_TTL (sap) failed: %s", pa_cstrerror(errno));
             goto fail;
         }
+
+        if (rtcp_fd >= 0 && setsockopt(rtcp_fd, IPPROTO_IP, IP_MULTICAST_TTL, &_ttl, sizeof(_ttl)) < 0) {
+            pa_log("IP_MULTICAST_TTL (rtcp) failed: %s", pa_cstrerror(errno));
+            goto fail;
+        }
     }
 
     /* If the socket queue is full, let's drop packets */
@@ -366,6 +570,8 @@ int pa__init(pa_module*m) {
     pa_proplist_setf(data.proplist, "rtp.mtu", "%lu", (unsigned long) mtu);
     pa_proplist_setf(data.proplist, "rtp.port", "%lu", (unsigned long) port);
     pa_proplist_setf(data.proplist, "rtp.ttl", "%lu", (unsigned long) ttl);
+    if (sync_clock)
+        pa_proplist_sets(data.proplist, "rtp.sync_clock", sync_clock);
     data.driver = __FILE__;
     data.module = m;
     pa_source_output_new_data_set_source(&data, s, FALSE);
@@ -386,11 +592,24 @@ int pa__init(pa_module*m) {
     o->kill = source_output_kill;
 
     pa_log_info("Configured source latency of %llu ms.",
-                (unsigned long long) pa_source_output_set_requested_latency(o, pa_bytes_to_usec(mtu, &o->sample_spec)) / PA_USEC_PER_MSEC);
+                (unsigned long long) pa_source_output_set_requested_latency(o, latency) / PA_USEC_PER_MSEC);
 
     m->userdata = o->userdata = u = pa_xnew(struct userdata, 1);
     u->module = m;
     u->source_output = o;
+    u->rtcp_fd = rtcp_fd;
+    u->clock = clock;
+    u->next_sender_report = 0;
+    rtcp_fd = -1;
+    clock.fd = -1;
+
+#ifdef HAVE_OPUS
+    u->opus_encoder = enc;
+    u->opus_frames = frame_msec * OPUS_RATE / 1000;
+    u->opus_buffer = enc ? pa_xnew(float, u->opus_frames * ss.channels) : NULL;
+    u->opus_packet = enc ? pa_xmalloc(mtu) : NULL;
+    enc = NULL;
+#endif
 
     u->memblockq = pa_memblockq_new(
             "module-rtp-send memblockq",
@@ -414,13 +633,13 @@ int pa__init(pa_module*m) {
         p = pa_sdp_build(af,
                      (void*) &((struct sockaddr_in*) &sa_dst)->sin_addr,
                      (void*) &dst_sa4.sin_addr,
-                     n, (uint16_t) port, payload, &ss);
+                     n, (uint16_t) port, payload, &ss, opus ? &opus_info : NULL);
 #ifdef HAVE_IPV6
     } else {
         p = pa_sdp_build(af,
                      (void*) &((struct sockaddr_in6*) &sa_dst)->sin6_addr,
                      (void*) &dst_sa6.sin6_addr,
-                     n, (uint16_t) port, payload, &ss);
+                     n, (uint16_t) port, payload, &ss, opus ? &opus_info : NULL);
 #endif
     }
 
@@ -430,6 +649,8 @@ int pa__init(pa_module*m) {
     pa_sap_context_init_send(&u->sap_context, sap_fd, p);
 
     pa_log_info("RTP stream initialized with mtu %u on %s:%u from %s ttl=%u, SSRC=0x%08x, payload=%u, initial sequence #%u", mtu, dst_addr, port, src_addr, ttl, u->rtp_context.ssrc, payload, u->rtp_context.sequence);
+    if (u->rtcp_fd >= 0)
+        pa_log_info("Sending RTCP sender reports to port %u against the %s clock", port + 1, sync_clock);
     pa_log_info("SDP-Data:\n%s\nEOF", p);
 
     pa_sap_send(&u->sap_context, 0);
@@ -452,6 +673,16 @@ fail:
     if (sap_fd >= 0)
         pa_close(sap_fd);
 
+    if (rtcp_fd >= 0)
+        pa_close(rtcp_fd);
+
+    pa_rtp_clock_close(&clock);
+
+#ifdef HAVE_OPUS
+    if (enc)
+        opus_multistream_encoder_destroy(enc);
+#endif
+
     if (o) {
         pa_source_output_unlink(o);
         pa_source_output_unref(o);
@@ -483,5 +714,18 @@ void pa__done(pa_module*m) {
     if (u->memblockq)
         pa_memblockq_free(u->memblockq);
 
+    if (u->rtcp_fd >= 0)
+        pa_close(u->rtcp_fd);
+
+    pa_rtp_clock_close(&u->clock);
+
+#ifdef HAVE_OPUS
+    if (u->opus_encoder)
+        opus_multistream_encoder_destroy(u->opus_encoder);
+
+    pa_xfree(u->opus_buffer);
+    pa_xfree(u->opus_packet);
+#endif
+
     pa_xfree(u);
 }
@@ -27,6 +27,7 @@
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/ioctl.h>
 
 #ifdef HAVE_SYS_FILIO_H
@@ -37,6 +38,8 @@
 #include <sys/uio.h>
 #endif
 
+#include <pulse/timeval.h>
+
 #include <pulsecore/core-error.h>
 #include <pulsecore/log.h>
 #include <pulsecore/macro.h>
@@ -55,18 +58,102 @@ pa_rtp_context* pa_rtp_context_init_send(pa_rtp_context *c, int fd, uint32_t ssr
     c->ssrc = ssrc ? ssrc : (uint32_t) (rand()*rand());
     c->payload = (uint8_t) (payload & 127U);
     c->frame_size = frame_size;
+    c->n_packets = c->n_octets = 0;
 
     pa_memchunk_reset(&c->memchunk);
+    c->n_recv = c->recv_idx = 0;
 
     return c;
 }
 
 #define MAX_IOVECS 16
 
-int pa_rtp_send(pa_rtp_context *c, size_t size, pa_memblockq *q) {
+#ifdef HAVE_SENDMMSG
+#define MAX_PACKETS 32
+#else
+#define MAX_PACKETS 1
+#endif
+
+struct packet {
+    uint32_t header[3];
     struct iovec iov[MAX_IOVECS];
     pa_memblock* mb[MAX_IOVECS];
-    int iov_idx = 1;
+    unsigned n_iov;
+};
+
+static void fill_header(pa_rtp_context *c, struct packet *p) {
+    p->header[0] = htonl(((uint32_t) 2 << 30) | ((uint32_t) c->payload << 16) | ((uint32_t) c->sequence));
+    p->header[1] = htonl(c->timestamp);
+    p->header[2] = htonl(c->ssrc);
+
+    p->iov[0].iov_base = (void*) p->header;
+    p->iov[0].iov_len = sizeof(p->header);
+}
+
+static void fill_msghdr(struct msghdr *m, struct iovec *iov, size_t n_iov, void *aux, size_t aux_len) {
+    m->msg_name = NULL;
+    m->msg_namelen = 0;
+    m->msg_iov = iov;
+    m->msg_iovlen = n_iov;
+    m->msg_control = aux;
+    m->msg_controllen = aux_len;
+    m->msg_flags = 0;
+}
+
+/* Sends the packets with as few system calls as possible and releases
+ * their memory blocks. Packets that don't fit into the socket queue are
+ * dropped. */
+static int send_packets(pa_rtp_context *c, struct packet *p, unsigned n_packets) {
+    unsigned i, j, sent = 0;
+    int r = 0;
+#ifdef HAVE_SENDMMSG
+    struct mmsghdr m[MAX_PACKETS];
+
+    for (i = 0; i < n_packets; i++) {
+        fill_msghdr(&m[i].msg_hdr, p[i].iov, p[i].n_iov, NULL, 0);
+        m[i].msg_len = 0;
+    }
+
+    while (sent < n_packets) {
+        /* sendmmsg() stops at the first failing packet and returns the
+         * number of packets sent before it, so the error is only reported
+         * by the next call. */
+        if ((r = sendmmsg(c->fd, m + sent, n_packets - sent, MSG_DONTWAIT)) < 0)
+            break;
+
+        sent += (unsigned) r;
+    }
+#else
+    struct msghdr m;
+
+    for (; sent < n_packets; sent++) {
+        fill_msghdr(&m, p[sent].iov, p[sent].n_iov, NULL, 0);
+
+        if ((r = sendmsg(c->fd, &m, MSG_DONTWAIT)) < 0)
+            break;
+    }
+#endif
+
+    for (i = 0; i < n_packets; i++)
+        for (j = 1; j < p[i].n_iov; j++)
+            if (p[i].mb[j]) {
+                pa_memblock_release(p[i].mb[j]);
+                pa_memblock_unref(p[i].mb[j]);
+            }
+
+    if (r < 0) {
+        if (errno != EAGAIN && errno != EINTR) /* If the queue is full, just ignore it */
+            pa_log("sendmsg() failed: %s", pa_cstrerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+int pa_rtp_send(pa_rtp_context *c, size_t size, pa_memblockq *q) {
+    struct packet packets[MAX_PACKETS];
+    struct packet *p = packets;
+    unsigned n_packets = 0;
     size_t n = 0;
 
     pa_assert(c);
@@ -76,6 +163,8 @@ int pa_rtp_send(pa_rtp_context *c, size_t size, pa_memblockq *q) {
     if (pa_memblockq_get_length(q) < size)
         return 0;
 
+    p->n_iov = 1;
+
     for (;;) {
         int r;
         pa_memchunk chunk;
@@ -88,10 +177,10 @@ int pa_rtp_send(pa_rtp_context *c, size_t size, pa_memblockq *q) {
 
             pa_assert(chunk.memblock);
 
-            iov[iov_idx].iov_base = pa_memblock_acquire_chunk(&chunk);
-            iov[iov_idx].iov_len = k;
-            mb[iov_idx] = chunk.memblock;
-            iov_idx ++;
+            p->iov[p->n_iov].iov_base = pa_memblock_acquire_chunk(&chunk);
+            p->iov[p->n_iov].iov_len = k;
+            p->mb[p->n_iov] = chunk.memblock;
+            p->n_iov ++;
 
             n += k;
             pa_memblockq_drop(q, k);
@@ -99,58 +188,94 @@ int pa_rtp_send(pa_rtp_context *c, size_t size, pa_memblockq *q) {
 
         pa_assert(n % c->frame_size == 0);
 
-        if (r < 0 || n >= size || iov_idx >= MAX_IOVECS) {
-            uint32_t header[3];
-            struct msghdr m;
-            ssize_t k;
-            int i;
+        if (r < 0 || n >= size || p->n_iov >= MAX_IOVECS) {
+            pa_bool_t done;
 
             if (n > 0) {
-                header[0] = htonl(((uint32_t) 2 << 30) | ((uint32_t) c->payload << 16) | ((uint32_t) c->sequence));
-                header[1] = htonl(c->timestamp);
-                header[2] = htonl(c->ssrc);
-
-                iov[0].iov_base = (void*)header;
-                iov[0].iov_len = sizeof(header);
-
-                m.msg_name = NULL;
-                m.msg_namelen = 0;
-                m.msg_iov = iov;
-                m.msg_iovlen = (size_t) iov_idx;
-                m.msg_control = NULL;
-                m.msg_controllen = 0;
-                m.msg_flags = 0;
-
-                k = sendmsg(c->fd, &m, MSG_DONTWAIT);
-
-                for (i = 1; i < iov_idx; i++) {
-                    pa_memblock_release(mb[i]);
-                    pa_memblock_unref(mb[i]);
-                }
-
+                fill_header(c, p);
+                n_packets++;
                 c->sequence++;
-            } else
-                k = 0;
+                c->n_packets++;
+                c->n_octets += (uint32_t) n;
+            }
 
             c->timestamp += (unsigned) (n/c->frame_size);
 
-            if (k < 0) {
-                if (errno != EAGAIN && errno != EINTR) /* If the queue is full, just ignore it */
-                    pa_log("sendmsg() failed: %s", pa_cstrerror(errno));
-                return -1;
+            done = r < 0 || pa_memblockq_get_length(q) < size;
+
+            /* Queue up the packets and hand them to the kernel in one go */
+            if (n_packets >= MAX_PACKETS || (done && n_packets > 0)) {
+                if (send_packets(c, packets, n_packets) < 0)
+                    return -1;
+
+                n_packets = 0;
             }
 
-            if (r < 0 || pa_memblockq_get_length(q) < size)
+            if (done)
                 break;
 
             n = 0;
-            iov_idx = 1;
+            p = packets + n_packets;
+            p->n_iov = 1;
         }
     }
 
     return 0;
 }
 
+int pa_rtp_send_packet(pa_rtp_context *c, const void *data, size_t length, unsigned frames) {
+    struct packet p;
+
+    pa_assert(c);
+    pa_assert(data);
+    pa_assert(length > 0);
+
+    fill_header(c, &p);
+    p.iov[1].iov_base = (void*) data;
+    p.iov[1].iov_len = length;
+    p.mb[1] = NULL;
+    p.n_iov = 2;
+
+    c->sequence++;
+    c->timestamp += frames;
+    c->n_packets++;
+    c->n_octets += (uint32_t) length;
+
+    return send_packets(c, &p, 1);
+}
+
+/* Seconds from 1900, where NTP timestamps start, to 1970 */
+#define NTP_EPOCH_OFFSET 2208988800ULL
+
+#define RTCP_SR 200
+
+int pa_rtcp_send_sender_report(pa_rtp_context *c, int fd, pa_usec_t ref_usec, uint32_t rtp_timestamp) {
+    uint32_t sr[7];
+    uint64_t frac;
+
+    pa_assert(c);
+    pa_assert(fd >= 0);
+
+    frac = ((ref_usec % PA_USEC_PER_SEC) << 32) / PA_USEC_PER_SEC;
+
+    /* RFC 3550 section 6.4.1, without any reception report blocks */
+    sr[0] = htonl(((uint32_t) 2 << 30) | ((uint32_t) RTCP_SR << 16) | (uint32_t) (PA_ELEMENTSOF(sr) - 1));
+    sr[1] = htonl(c->ssrc);
+    sr[2] = htonl((uint32_t) (ref_usec / PA_USEC_PER_SEC + NTP_EPOCH_OFFSET));
+    sr[3] = htonl((uint32_t) frac);
+    sr[4] = htonl(rtp_timestamp);
+    sr[5] = htonl(c->n_packets);
+    sr[6] = htonl(c->n_octets);
+
+    if (send(fd, sr, sizeof(sr), MSG_DONTWAIT) < 0) {
+        if (errno != EAGAIN && errno != EINTR)
+            pa_log("send() failed: %s", pa_cstrerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
 pa_rtp_context* pa_rtp_context_init_recv(pa_rtp_context *c, int fd, size_t frame_size) {
     pa_assert(c);
 
@@ -158,80 +283,189 @@ pa_rtp_context* pa_rtp_context_init_recv(pa_rtp_context *c, int fd, size_t frame
     c->frame_size = frame_size;
 
     pa_memchunk_reset(&c->memchunk);
+    c->n_recv = c->recv_idx = 0;
+
     return c;
 }
 
-int pa_rtp_recv(pa_rtp_context *c, pa_memchunk *chunk, pa_mempool *pool, struct timeval *tstamp) {
+#ifdef HAVE_RECVMMSG
+#define RECV_BATCH PA_RTP_RECV_BATCH
+#else
+#define RECV_BATCH 1
+#endif
+
+/* Room left for every packet of a batch, unless the first one is bigger */
+#define RECV_SLOT_SIZE 1500
+
+static void drop_pending(pa_rtp_context *c) {
+    for (; c->recv_idx < c->n_recv; c->recv_idx++)
+        pa_memblock_unref(c->recv_chunks[c->recv_idx].memblock);
+
+    c->n_recv = c->recv_idx = 0;
+}
+
+/* Reads all packets that are queued on the socket, up to RECV_BATCH, with
+ * a single system call. The packets are stored one after another in
+ * c->memchunk and are parsed when they are handed out. */
+static int recv_packets(pa_rtp_context *c, pa_mempool *pool) {
     int size;
-    struct msghdr m;
-    struct cmsghdr *cm;
-    struct iovec iov;
-    uint32_t header;
-    unsigned cc;
+    size_t slot;
+    unsigned i, n, n_read = 0;
+    uint8_t *d;
+    struct iovec iov[RECV_BATCH];
+    union {
+        struct cmsghdr cm;
+        uint8_t data[128];
+    } aux[RECV_BATCH];
+    struct msghdr *m[RECV_BATCH];
+    size_t len[RECV_BATCH];
+#ifdef HAVE_RECVMMSG
+    struct mmsghdr mm[RECV_BATCH];
+    int r;
+#else
+    struct msghdr mm[1];
     ssize_t r;
-    uint8_t aux[1024];
-    pa_bool_t found_tstamp = FALSE;
+#endif
 
-    pa_assert(c);
-    pa_assert(chunk);
-
-    pa_memchunk_reset(chunk);
+    drop_pending(c);
 
     if (ioctl(c->fd, FIONREAD, &size) < 0) {
         pa_log_warn("FIONREAD failed: %s", pa_cstrerror(errno));
-        goto fail;
+        return -1;
     }
 
     if (size <= 0)
-        return 0;
+        return -1;
 
-    if (c->memchunk.length < (unsigned) size) {
+    /* FIONREAD only tells the size of the first packet, the others of a
+     * stream are normally as large */
+    slot = PA_MAX((size_t) size, (size_t) RECV_SLOT_SIZE);
+
+    if (c->memchunk.length < slot * RECV_BATCH) {
         size_t l;
 
         if (c->memchunk.memblock)
             pa_memblock_unref(c->memchunk.memblock);
 
-        l = PA_MAX((size_t) size, pa_mempool_block_size_max(pool));
+        l = PA_MAX(slot * RECV_BATCH, pa_mempool_block_size_max(pool));
 
         c->memchunk.memblock = pa_memblock_new(pool, l);
         c->memchunk.index = 0;
         c->memchunk.length = pa_memblock_get_length(c->memchunk.memblock);
     }
 
-    pa_assert(c->memchunk.length >= (size_t) size);
+    pa_assert(c->memchunk.length >= slot * RECV_BATCH);
+
+    d = pa_memblock_acquire_chunk(&c->memchunk);
+
+    for (i = 0; i < RECV_BATCH; i++) {
+        iov[i].iov_base = d + i * slot;
+        iov[i].iov_len = slot;
 
-    chunk->memblock = pa_memblock_ref(c->memchunk.memblock);
-    chunk->index = c->memchunk.index;
+#ifdef HAVE_RECVMMSG
+        m[i] = &mm[i].msg_hdr;
+        mm[i].msg_len = 0;
+#else
+        m[i] = &mm[i];
+#endif
+        fill_msghdr(m[i], &iov[i], 1, &aux[i], sizeof(aux[i]));
+    }
 
-    iov.iov_base = pa_memblock_acquire_chunk(chunk);
-    iov.iov_len = (size_t) size;
+#ifdef HAVE_RECVMMSG
+    /* Don't wait for the batch to fill up, only take what is there */
+    if ((r = recvmmsg(c->fd, mm, RECV_BATCH, MSG_DONTWAIT, NULL)) > 0) {
+        for (i = 0; i < (unsigned) r; i++)
+            len[i] = mm[i].msg_len;
 
-    m.msg_name = NULL;
-    m.msg_namelen = 0;
-    m.msg_iov = &iov;
-    m.msg_iovlen = 1;
-    m.msg_control = aux;
-    m.msg_controllen = sizeof(aux);
-    m.msg_flags = 0;
+        n_read = (unsigned) r;
+    }
+#else
+    if ((r = recvmsg(c->fd, mm, MSG_DONTWAIT)) > 0) {
+        len[0] = (size_t) r;
+        n_read = 1;
+    }
+#endif
 
-    r = recvmsg(c->fd, &m, 0);
-    pa_memblock_release(chunk->memblock);
+    pa_memblock_release(c->memchunk.memblock);
 
-    if (r != size) {
+    if (r <= 0) {
         if (r < 0 && errno != EAGAIN && errno != EINTR)
-            pa_log_warn("recvmsg() failed: %s", r < 0 ? pa_cstrerror(errno) : "size mismatch");
+            pa_log_warn("recvmsg() failed: %s", pa_cstrerror(errno));
 
-        goto fail;
+        return -1;
+    }
+
+    for (i = 0, n = 0; i < n_read; i++) {
+        struct cmsghdr *cm;
+        pa_bool_t found_tstamp = FALSE;
+
+        if (m[i]->msg_flags & MSG_TRUNC) {
+            pa_log_warn("RTP packet too large, dropping.");
+            continue;
+        }
+
+        c->recv_chunks[n].memblock = pa_memblock_ref(c->memchunk.memblock);
+        c->recv_chunks[n].index = c->memchunk.index + i * slot;
+        c->recv_chunks[n].length = len[i];
+
+        for (cm = CMSG_FIRSTHDR(m[i]); cm; cm = CMSG_NXTHDR(m[i], cm))
+            if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_TIMESTAMP) {
+                memcpy(&c->recv_tstamps[n], CMSG_DATA(cm), sizeof(struct timeval));
+                found_tstamp = TRUE;
+                break;
+            }
+
+        if (!found_tstamp) {
+            pa_log_warn("Couldn't find SCM_TIMESTAMP data in auxiliary recvmsg() data!");
+            pa_zero(c->recv_tstamps[n]);
+        }
+
+        n++;
+    }
+
+    c->n_recv = n;
+
+    c->memchunk.index += n_read * slot;
+    c->memchunk.length -= n_read * slot;
+
+    if (c->memchunk.length <= 0) {
+        pa_memblock_unref(c->memchunk.memblock);
+        pa_memchunk_reset(&c->memchunk);
     }
 
-    if (size < 12) {
+    return 0;
+}
+
+int pa_rtp_recv(pa_rtp_context *c, pa_memchunk *chunk, pa_mempool *pool, struct timeval *tstamp) {
+    uint32_t header;
+    unsigned cc;
+    uint8_t *d;
+
+    pa_assert(c);
+    pa_assert(chunk);
+    pa_assert(tstamp);
+
+    pa_memchunk_reset(chunk);
+
+    if (!pa_rtp_recv_pending(c))
+        if (recv_packets(c, pool) < 0 || !pa_rtp_recv_pending(c))
+            return -1;
+
+    *chunk = c->recv_chunks[c->recv_idx];
+    *tstamp = c->recv_tstamps[c->recv_idx];
+    pa_memchunk_reset(&c->recv_chunks[c->recv_idx]);
+    c->recv_idx++;
+
+    if (chunk->length < 12) {
         pa_log_warn("RTP packet too short.");
         goto fail;
     }
 
-    memcpy(&header, iov.iov_base, sizeof(uint32_t));
-    memcpy(&c->timestamp, (uint8_t*) iov.iov_base + 4, sizeof(uint32_t));
-    memcpy(&c->ssrc, (uint8_t*) iov.iov_base + 8, sizeof(uint32_t));
+    d = pa_memblock_acquire_chunk(chunk);
+    memcpy(&header, d, sizeof(uint32_t));
+    memcpy(&c->timestamp, d + 4, sizeof(uint32_t));
+    memcpy(&c->ssrc, d + 8, sizeof(uint32_t));
+    pa_memblock_release(chunk->memblock);
 
     header = ntohl(header);
     c->timestamp = ntohl(c->timestamp);
@@ -256,48 +490,34 @@ int pa_rtp_recv(pa_rtp_context *c, pa_memchunk *chunk, pa_mempool *pool, struct
     c->payload = (uint8_t) ((header >> 16) & 127U);
     c->sequence = (uint16_t) (header & 0xFFFFU);
 
-    if (12 + cc*4 > (unsigned) size) {
+    if (12 + cc*4 > chunk->length) {
         pa_log_warn("RTP packet too short. (CSRC)");
         goto fail;
     }
 
     chunk->index += 12 + cc*4;
-    chunk->length = (size_t) size - 12 + cc*4;
+    chunk->length -= 12 + cc*4;
 
     if (chunk->length % c->frame_size != 0) {
         pa_log_warn("Bad RTP packet size.");
         goto fail;
     }
 
-    c->memchunk.index = chunk->index + chunk->length;
-    c->memchunk.length = pa_memblock_get_length(c->memchunk.memblock) - c->memchunk.index;
-
-    if (c->memchunk.length <= 0) {
-        pa_memblock_unref(c->memchunk.memblock);
-        pa_memchunk_reset(&c->memchunk);
-    }
-
-    for (cm = CMSG_FIRSTHDR(&m); cm; cm = CMSG_NXTHDR(&m, cm))
-        if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_TIMESTAMP) {
-            memcpy(tstamp, CMSG_DATA(cm), sizeof(struct timeval));
-            found_tstamp = TRUE;
-            break;
-        }
-
-    if (!found_tstamp) {
-        pa_log_warn("Couldn't find SCM_TIMESTAMP data in auxiliary recvmsg() data!");
-        pa_zero(*tstamp);
-    }
-
     return 0;
 
 fail:
-    if (chunk->memblock)
-        pa_memblock_unref(chunk->memblock);
+    pa_memblock_unref(chunk->memblock);
+    pa_memchunk_reset(chunk);
 
     return -1;
 }
 
+pa_bool_t pa_rtp_recv_pending(pa_rtp_context *c) {
+    pa_assert(c);
+
+    return c->recv_idx < c->n_recv;
+}
+
 uint8_t pa_rtp_payload_from_sample_spec(const pa_sample_spec *ss) {
     pa_assert(ss);
 
@@ -376,10 +596,158 @@ void pa_rtp_context_destroy(pa_rtp_context *c) {
 
     pa_assert_se(pa_close(c->fd) == 0);
 
+    drop_pending(c);
+
     if (c->memchunk.memblock)
         pa_memblock_unref(c->memchunk.memblock);
 }
 
+int pa_rtcp_recv_sender_report(int fd, pa_rtcp_sender_report *sr) {
+    uint32_t buf[384];
+    ssize_t r;
+    int ret = -1;
+
+    pa_assert(fd >= 0);
+    pa_assert(sr);
+
+    while ((r = recv(fd, buf, sizeof(buf), MSG_DONTWAIT)) >= 0) {
+        size_t n = (size_t) r / 4, i = 0;
+
+        /* Walk the packets of the compound packet */
+        while (i < n) {
+            uint32_t h = ntohl(buf[i]);
+            size_t len = (h & 0xFFFFU) + 1;
+
+            if ((h >> 30) != 2 || i + len > n)
+                break;
+
+            if (((h >> 16) & 0xFFU) == RTCP_SR && len >= 7) {
+                uint64_t secs = ntohl(buf[i+2]), frac = ntohl(buf[i+3]);
+
+                /* The seconds wrap around in 2036 */
+                if (secs < NTP_EPOCH_OFFSET)
+                    secs += 0x100000000ULL;
+
+                sr->ssrc = ntohl(buf[i+1]);
+                sr->ref_usec = (secs - NTP_EPOCH_OFFSET) * PA_USEC_PER_SEC + ((frac * PA_USEC_PER_SEC + 0x80000000ULL) >> 32);
+                sr->rtp_timestamp = ntohl(buf[i+4]);
+                ret = 0;
+            }
+
+            i += len;
+        }
+    }
+
+    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        pa_log_warn("recv() failed: %s", pa_cstrerror(errno));
+
+    return ret;
+}
+
+#ifdef HAVE_CLOCK_GETTIME
+/* The dynamic POSIX clock of a character device, see clock_getres(2) */
+#define FD_TO_CLOCKID(fd) ((~(clockid_t) (fd) << 3) | 3)
+#endif
+
+int pa_rtp_clock_open(pa_rtp_clock *c, const char *name) {
+    pa_assert(c);
+    pa_assert(name);
+
+    c->fd = -1;
+
+    if (pa_streq(name, "realtime")) {
+#ifdef HAVE_CLOCK_GETTIME
+        c->id = CLOCK_REALTIME;
+#endif
+        return 0;
+    }
+
+#ifdef HAVE_CLOCK_GETTIME
+    if (name[0] == '/') {
+        struct timespec ts;
+
+        if ((c->fd = pa_open_cloexec(name, O_RDONLY, 0)) < 0) {
+            pa_log("Failed to open clock %s: %s", name, pa_cstrerror(errno));
+            return -1;
+        }
+
+        c->id = FD_TO_CLOCKID(c->fd);
+
+        if (clock_gettime(c->id, &ts) < 0) {
+            pa_log("%s is not a PTP clock: %s", name, pa_cstrerror(errno));
+            pa_rtp_clock_close(c);
+            return -1;
+        }
+
+        return 0;
+    }
+#endif
+
+    pa_log("Unsupported reference clock '%s'.", name);
+    return -1;
+}
+
+void pa_rtp_clock_close(pa_rtp_clock *c) {
+    pa_assert(c);
+
+    if (c->fd >= 0)
+        pa_close(c->fd);
+
+    c->fd = -1;
+}
+
+pa_usec_t pa_rtp_clock_now(pa_rtp_clock *c) {
+    struct timeval tv;
+#ifdef HAVE_CLOCK_GETTIME
+    struct timespec ts;
+#endif
+
+    pa_assert(c);
+
+#ifdef HAVE_CLOCK_GETTIME
+    if (clock_gettime(c->id, &ts) == 0)
+        return (pa_usec_t) ts.tv_sec * PA_USEC_PER_SEC + (pa_usec_t) ts.tv_nsec / PA_NSEC_PER_USEC;
+#endif
+
+    return pa_timeval_load(pa_gettimeofday(&tv));
+}
+
+pa_channel_map* pa_rtp_opus_channel_map_init(pa_channel_map *m, unsigned channels) {
+    static const pa_channel_position_t vorbis[8][8] = {
+        { PA_CHANNEL_POSITION_MONO },
+        { PA_CHANNEL_POSITION_FRONT_LEFT, PA_CHANNEL_POSITION_FRONT_RIGHT },
+        { PA_CHANNEL_POSITION_FRONT_LEFT, PA_CHANNEL_POSITION_FRONT_CENTER, PA_CHANNEL_POSITION_FRONT_RIGHT },
+        { PA_CHANNEL_POSITION_FRONT_LEFT, PA_CHANNEL_POSITION_FRONT_RIGHT,
+          PA_CHANNEL_POSITION_REAR_LEFT, PA_CHANNEL_POSITION_REAR_RIGHT },
+        { PA_CHANNEL_POSITION_FRONT_LEFT, PA_CHANNEL_POSITION_FRONT_CENTER, PA_CHANNEL_POSITION_FRONT_RIGHT,
+          PA_CHANNEL_POSITION_REAR_LEFT, PA_CHANNEL_POSITION_REAR_RIGHT },
+        { PA_CHANNEL_POSITION_FRONT_LEFT, PA_CHANNEL_POSITION_FRONT_CENTER, PA_CHANNEL_POSITION_FRONT_RIGHT,
+          PA_CHANNEL_POSITION_REAR_LEFT, PA_CHANNEL_POSITION_REAR_RIGHT, PA_CHANNEL_POSITION_LFE },
+        { PA_CHANNEL_POSITION_FRONT_LEFT, PA_CHANNEL_POSITION_FRONT_CENTER, PA_CHANNEL_POSITION_FRONT_RIGHT,
+          PA_CHANNEL_POSITION_SIDE_LEFT, PA_CHANNEL_POSITION_SIDE_RIGHT, PA_CHANNEL_POSITION_REAR_CENTER,
+          PA_CHANNEL_POSITION_LFE },
+        { PA_CHANNEL_POSITION_FRONT_LEFT, PA_CHANNEL_POSITION_FRONT_CENTER, PA_CHANNEL_POSITION_FRONT_RIGHT,
+          PA_CHANNEL_POSITION_SIDE_LEFT, PA_CHANNEL_POSITION_SIDE_RIGHT,
+          PA_CHANNEL_POSITION_REAR_LEFT, PA_CHANNEL_POSITION_REAR_RIGHT, PA_CHANNEL_POSITION_LFE }
+    };
+    unsigned c;
+
+    pa_assert(m);
+    pa_assert(channels > 0);
+
+    /* Beyond 8 channels the streams carry no positions */
+    if (channels > 8)
+        return pa_channel_map_init_auto(m, channels, PA_CHANNEL_MAP_AUX);
+
+    pa_channel_map_init(m);
+    m->channels = (uint8_t) channels;
+
+    for (c = 0; c < channels; c++)
+        m->map[c] = vorbis[channels - 1][c];
+
+    return m;
+}
+
 const char* pa_rtp_format_to_string(pa_sample_format_t f) {
     switch (f) {
         case PA_SAMPLE_S16BE:
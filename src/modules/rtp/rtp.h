@@ -25,9 +25,17 @@
 #include <inttypes.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/time.h>
+#include <time.h>
+#include <pulse/channelmap.h>
+#include <pulse/sample.h>
+
 #include <pulsecore/memblockq.h>
 #include <pulsecore/memchunk.h>
 
+/* Maximum number of packets read from the socket at once */
+#define PA_RTP_RECV_BATCH 16
+
 typedef struct pa_rtp_context {
     int fd;
     uint16_t sequence;
@@ -37,6 +45,14 @@ typedef struct pa_rtp_context {
     size_t frame_size;
 
     pa_memchunk memchunk;
+
+    /* What has been sent so far, for the RTCP sender reports */
+    uint32_t n_packets, n_octets;
+
+    /* Packets of the last read that haven't been returned yet */
+    pa_memchunk recv_chunks[PA_RTP_RECV_BATCH];
+    struct timeval recv_tstamps[PA_RTP_RECV_BATCH];
+    unsigned n_recv, recv_idx;
 } pa_rtp_context;
 
 pa_rtp_context* pa_rtp_context_init_send(pa_rtp_context *c, int fd, uint32_t ssrc, uint8_t payload, size_t frame_size);
@@ -45,17 +61,65 @@ pa_rtp_context* pa_rtp_context_init_send(pa_rtp_context *c, int fd, uint32_t ssr
  * guarantee that the current read index doesn't point to a hole. */
 int pa_rtp_send(pa_rtp_context *c, size_t size, pa_memblockq *q);
 
+/* Sends a single packet of already encoded data that lasts the given
+ * number of frames */
+int pa_rtp_send_packet(pa_rtp_context *c, const void *data, size_t length, unsigned frames);
+
+/* Sends an RTCP sender report on fd, saying that the frame with the RTP
+ * timestamp rtp_timestamp was captured at ref_usec on the reference
+ * clock */
+int pa_rtcp_send_sender_report(pa_rtp_context *c, int fd, pa_usec_t ref_usec, uint32_t rtp_timestamp);
+
 pa_rtp_context* pa_rtp_context_init_recv(pa_rtp_context *c, int fd, size_t frame_size);
+
+/* Returns the next packet, reading a new batch from the socket only once
+ * all packets of the previous one have been returned. Returns a negative
+ * value if no valid packet was available. */
 int pa_rtp_recv(pa_rtp_context *c, pa_memchunk *chunk, pa_mempool *pool, struct timeval *tstamp);
 
+/* Whether pa_rtp_recv() can return more packets without reading from the
+ * socket */
+pa_bool_t pa_rtp_recv_pending(pa_rtp_context *c);
+
 void pa_rtp_context_destroy(pa_rtp_context *c);
 
+typedef struct pa_rtcp_sender_report {
+    uint32_t ssrc;
+    pa_usec_t ref_usec;
+    uint32_t rtp_timestamp;
+} pa_rtcp_sender_report;
+
+/* Reads all RTCP packets queued on fd and returns the last sender report
+ * among them. Returns a negative value if there was none. */
+int pa_rtcp_recv_sender_report(int fd, pa_rtcp_sender_report *sr);
+
+/* The clock that senders and receivers of synchronized streams share,
+ * either CLOCK_REALTIME disciplined by NTP or PTP, or a PTP hardware
+ * clock */
+typedef struct pa_rtp_clock {
+    int fd;
+#ifdef HAVE_CLOCK_GETTIME
+    clockid_t id;
+#endif
+} pa_rtp_clock;
+
+/* name is "realtime" or the path of a PTP clock device like /dev/ptp0 */
+int pa_rtp_clock_open(pa_rtp_clock *c, const char *name);
+void pa_rtp_clock_close(pa_rtp_clock *c);
+
+/* The time of the reference clock in usec since 1970 */
+pa_usec_t pa_rtp_clock_now(pa_rtp_clock *c);
+
 pa_sample_spec* pa_rtp_sample_spec_fixup(pa_sample_spec *ss);
 int pa_rtp_sample_spec_valid(const pa_sample_spec *ss);
 
 uint8_t pa_rtp_payload_from_sample_spec(const pa_sample_spec *ss);
 pa_sample_spec *pa_rtp_sample_spec_from_payload(uint8_t payload, pa_sample_spec *ss);
 
+/* The channel order of Opus streams with more than two channels, which is
+ * that of Vorbis (RFC 7845 section 5.1.1.2) */
+pa_channel_map* pa_rtp_opus_channel_map_init(pa_channel_map *m, unsigned channels);
+
 const char* pa_rtp_format_to_string(pa_sample_format_t f);
 pa_sample_format_t pa_rtp_string_to_format(const char *s);
 
@@ -37,14 +37,38 @@
 #include <pulsecore/log.h>
 #include <pulsecore/macro.h>
 #include <pulsecore/arpa-inet.h>
+#include <pulsecore/strbuf.h>
 
 #include "sdp.h"
 #include "rtp.h"
 
-char *pa_sdp_build(int af, const void *src, const void *dst, const char *name, uint16_t port, uint8_t payload, const pa_sample_spec *ss) {
+/* Opus streams are described as in RFC 7587, and those with more than two
+ * channels with the "multiopus" encoding that is also understood by
+ * GStreamer and WebRTC */
+static char *build_opus_fmtp(uint8_t payload, const pa_sample_spec *ss, const pa_sdp_opus_info *opus) {
+    pa_strbuf *buf;
+    unsigned c;
+
+    if (ss->channels <= 2)
+        return pa_sprintf_malloc("a=fmtp:%i sprop-stereo=%i\n", payload, ss->channels == 2);
+
+    buf = pa_strbuf_new();
+    pa_strbuf_printf(buf, "a=fmtp:%i num_streams=%u;coupled_streams=%u;channel_mapping=",
+                     payload, opus->streams, opus->coupled_streams);
+
+    for (c = 0; c < ss->channels; c++)
+        pa_strbuf_printf(buf, c > 0 ? ",%u" : "%u", opus->mapping[c]);
+
+    pa_strbuf_puts(buf, "\n");
+
+    return pa_strbuf_tostring_free(buf);
+}
+
+char *pa_sdp_build(int af, const void *src, const void *dst, const char *name, uint16_t port, uint8_t payload, const pa_sample_spec *ss, const pa_sdp_opus_info *opus) {
     uint32_t ntp;
     char buf_src[64], buf_dst[64], un[64];
-    const char *u, *f;
+    const char *u;
+    char *rtpmap, *fmtp, *r;
 
     pa_assert(src);
     pa_assert(dst);
@@ -55,7 +79,20 @@ char *pa_sdp_build(int af, const void *src, const void *dst, const char *name, u
     pa_assert(af == AF_INET);
 #endif
 
-    pa_assert_se(f = pa_rtp_format_to_string(ss->format));
+    if (opus) {
+        if (ss->channels <= 2)
+            rtpmap = pa_sprintf_malloc("opus/%u/2", ss->rate);
+        else
+            rtpmap = pa_sprintf_malloc("multiopus/%u/%u", ss->rate, ss->channels);
+
+        fmtp = build_opus_fmtp(payload, ss, opus);
+    } else {
+        const char *f;
+
+        pa_assert_se(f = pa_rtp_format_to_string(ss->format));
+        rtpmap = pa_sprintf_malloc("%s/%u/%u", f, ss->rate, ss->channels);
+        fmtp = NULL;
+    }
 
     if (!(u = pa_get_user_name(un, sizeof(un))))
         u = "-";
@@ -65,7 +102,7 @@ char *pa_sdp_build(int af, const void *src, const void *dst, const char *name, u
     pa_assert_se(inet_ntop(af, src, buf_src, sizeof(buf_src)));
     pa_assert_se(inet_ntop(af, dst, buf_dst, sizeof(buf_dst)));
 
-    return pa_sprintf_malloc(
+    r = pa_sprintf_malloc(
             PA_SDP_HEADER
             "o=%s %lu 0 IN %s %s\n"
             "s=%s\n"
@@ -73,14 +110,21 @@ char *pa_sdp_build(int af, const void *src, const void *dst, const char *name, u
             "t=%lu 0\n"
             "a=recvonly\n"
             "m=audio %u RTP/AVP %i\n"
-            "a=rtpmap:%i %s/%u/%u\n"
+            "a=rtpmap:%i %s\n"
+            "%s"
             "a=type:broadcast\n",
             u, (unsigned long) ntp, af == AF_INET ? "IP4" : "IP6", buf_src,
             name,
             af == AF_INET ? "IP4" : "IP6", buf_dst,
             (unsigned long) ntp,
             port, payload,
-            payload, f, ss->rate, ss->channels);
+            payload, rtpmap,
+            fmtp ? fmtp : "");
+
+    pa_xfree(rtpmap);
+    pa_xfree(fmtp);
+
+    return r;
 }
 
 static pa_sample_spec *parse_sdp_sample_spec(pa_sample_spec *ss, char *c) {
@@ -118,9 +162,98 @@ static pa_sample_spec *parse_sdp_sample_spec(pa_sample_spec *ss, char *c) {
     return ss;
 }
 
+static pa_bool_t parse_sdp_opus(pa_sdp_info *i, char *c) {
+    unsigned rate, channels;
+
+    pa_assert(i);
+    pa_assert(c);
+
+    if (sscanf(c, "opus/%u/%u", &rate, &channels) == 2) {
+        /* Always signalled as two channels, the fmtp line tells whether
+         * it's really stereo */
+        if (channels != 2)
+            return FALSE;
+
+        i->opus.streams = 1;
+        i->opus.coupled_streams = 1;
+        i->opus.mapping[0] = 0;
+        i->opus.mapping[1] = 1;
+    } else if (sscanf(c, "multiopus/%u/%u", &rate, &channels) == 2) {
+        if (channels <= 2 || channels > PA_CHANNELS_MAX)
+            return FALSE;
+
+        /* Filled in from the fmtp line */
+        i->opus.streams = 0;
+    } else
+        return FALSE;
+
+    if (rate != 48000)
+        return FALSE;
+
+    i->is_opus = TRUE;
+    i->sample_spec.format = PA_SAMPLE_FLOAT32NE;
+    i->sample_spec.rate = rate;
+    i->sample_spec.channels = (uint8_t) channels;
+
+    return TRUE;
+}
+
+static pa_bool_t parse_sdp_opus_fmtp(pa_sdp_info *i, const char *fmtp) {
+    const char *state = NULL;
+    char *p;
+    unsigned n_mapping = 0;
+
+    pa_assert(i);
+
+    if (fmtp) {
+        while ((p = pa_split(fmtp, ";", &state))) {
+            char *k = p + strspn(p, " ");
+            uint32_t v;
+
+            if (pa_startswith(k, "sprop-stereo=")) {
+                if (i->sample_spec.channels <= 2 && pa_streq(k + 13, "0")) {
+                    i->sample_spec.channels = 1;
+                    i->opus.coupled_streams = 0;
+                }
+            } else if (pa_startswith(k, "num_streams=")) {
+                if (pa_atou(k + 12, &v) >= 0 && v > 0 && v <= 255)
+                    i->opus.streams = (uint8_t) v;
+            } else if (pa_startswith(k, "coupled_streams=")) {
+                if (pa_atou(k + 16, &v) >= 0 && v <= 255)
+                    i->opus.coupled_streams = (uint8_t) v;
+            } else if (pa_startswith(k, "channel_mapping=")) {
+                const char *mstate = NULL;
+                char *m;
+
+                while ((m = pa_split(k + 16, ",", &mstate))) {
+                    if (n_mapping < PA_CHANNELS_MAX && pa_atou(m, &v) >= 0 && v <= 255)
+                        i->opus.mapping[n_mapping] = (uint8_t) v;
+
+                    n_mapping++;
+                    pa_xfree(m);
+                }
+            }
+
+            pa_xfree(p);
+        }
+    }
+
+    if (i->sample_spec.channels <= 2)
+        return TRUE;
+
+    if (i->opus.streams == 0 ||
+        i->opus.coupled_streams > i->opus.streams ||
+        i->opus.streams + i->opus.coupled_streams > 255 ||
+        n_mapping != i->sample_spec.channels)
+        return FALSE;
+
+    return TRUE;
+}
+
 pa_sdp_info *pa_sdp_parse(const char *t, pa_sdp_info *i, int is_goodbye) {
     uint16_t port = 0;
     pa_bool_t ss_valid = FALSE;
+    char *fmtp = NULL;
 
     pa_assert(t);
     pa_assert(i);
@@ -128,6 +261,7 @@ pa_sdp_info *pa_sdp_parse(const char *t, pa_sdp_info *i, int is_goodbye) {
     i->origin = i->session_name = NULL;
     i->salen = 0;
     i->payload = 255;
+    i->is_opus = FALSE;
 
     if (!pa_startswith(t, PA_SDP_HEADER)) {
         pa_log("Failed to parse SDP data: invalid header.");
@@ -226,11 +360,21 @@ pa_sdp_info *pa_sdp_parse(const char *t, pa_sdp_info *i, int is_goodbye) {
 
                         c[strcspn(c, "\n")] = 0;
 
-                        if (parse_sdp_sample_spec(&i->sample_spec, c))
+                        if (parse_sdp_sample_spec(&i->sample_spec, c) || parse_sdp_opus(i, c))
                             ss_valid = TRUE;
                     }
                 }
             }
+        } else if (pa_startswith(t, "a=fmtp:")) {
+
+            if (i->payload <= 127) {
+                int _payload, n;
+
+                if (sscanf(t+7, "%i %n", &_payload, &n) == 1 && _payload == i->payload && (size_t) (7 + n) < l) {
+                    pa_xfree(fmtp);
+                    fmtp = pa_xstrndup(t + 7 + n, l - 7 - (size_t) n);
+                }
+            }
         }
 
         t += l;
@@ -244,6 +388,13 @@ pa_sdp_info *pa_sdp_parse(const char *t, pa_sdp_info *i, int is_goodbye) {
         goto fail;
     }
 
+    if (!is_goodbye && i->is_opus && !parse_sdp_opus_fmtp(i, fmtp)) {
+        pa_log("Failed to parse SDP data: bad Opus parameters.");
+        goto fail;
+    }
+
+    pa_xfree(fmtp);
+
     if (((struct sockaddr*) &i->sa)->sa_family == AF_INET)
         ((struct sockaddr_in*) &i->sa)->sin_port = htons(port);
     else
@@ -254,6 +405,7 @@ pa_sdp_info *pa_sdp_parse(const char *t, pa_sdp_info *i, int is_goodbye) {
 fail:
     pa_xfree(i->origin);
     pa_xfree(i->session_name);
+    pa_xfree(fmtp);
 
     return NULL;
 }
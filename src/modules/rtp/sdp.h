@@ -28,8 +28,18 @@
 
 #include <pulse/sample.h>
 
+#include <pulsecore/macro.h>
+
 #define PA_SDP_HEADER "v=0\n"
 
+/* How the channels of an Opus stream are spread over its Opus streams, as
+ * for opus_multistream_decoder_create() */
+typedef struct pa_sdp_opus_info {
+    uint8_t streams;
+    uint8_t coupled_streams;
+    uint8_t mapping[PA_CHANNELS_MAX];
+} pa_sdp_opus_info;
+
 typedef struct pa_sdp_info {
     char *origin;
     char *session_name;
@@ -39,9 +49,14 @@ typedef struct pa_sdp_info {
 
     pa_sample_spec sample_spec;
     uint8_t payload;
+
+    /* For Opus streams sample_spec is what the decoder produces */
+    pa_bool_t is_opus;
+    pa_sdp_opus_info opus;
 } pa_sdp_info;
 
-char *pa_sdp_build(int af, const void *src, const void *dst, const char *name, uint16_t port, uint8_t payload, const pa_sample_spec *ss);
+/* Pass opus for Opus streams, NULL for uncompressed ones */
+char *pa_sdp_build(int af, const void *src, const void *dst, const char *name, uint16_t port, uint8_t payload, const pa_sample_spec *ss, const pa_sdp_opus_info *opus);
 
 pa_sdp_info *pa_sdp_parse(const char *t, pa_sdp_info *info, int is_goodbye);
 
@@ -32,6 +32,7 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <limits.h>
+#include <stddef.h>
 #include <sys/ioctl.h>
 #include <poll.h>
 #include <time.h>
@@ -67,7 +68,8 @@ PA_MODULE_USAGE(
         "format=<sample format> "
         "rate=<sample rate>"
         "channels=<number of channels> "
-        "channel_map=<channel map>");
+        "channel_map=<channel map> "
+        "ring_pages=<number of pages shared with the backend>");
 
 #define DEFAULT_SINK_NAME "xenpv_output"
 #define DEFAULT_FILE_NAME "xenpv_output"
@@ -108,25 +110,28 @@ struct userdata {
     pa_thread_mq thread_mq;
     pa_rtpoll *rtpoll;
 
-    pa_memchunk memchunk;
-
-    pa_rtpoll_item *rtpoll_item;
-
-    int write_type;
+    /* Ring space in use may grow up to this after underruns */
+    size_t ring_capacity;
+    pa_bool_t ring_started;
 };
 
 pa_sample_spec ss;
 pa_channel_map map;
 
-/* just to test non- frame-aligned size */
-#define BUFSIZE 2047
+#define XEN_PAGE_SIZE 4096
+#define DEFAULT_RING_PAGES 1
+#define RING_PAGES_MAX 16
 
+/* Spans ring_pages contiguous pages, the data continues past the first
+ * one. The backend maps them in the order of the published refs. */
 struct ring {
     uint32_t cons_indx, prod_indx;
     uint32_t usable_buffer_space; /* kept here for convenience */
-    uint8_t buffer[BUFSIZE];
+    uint8_t buffer[];
 } *ioring;
 
+#define RING_HEADER_SIZE offsetof(struct ring, buffer)
+
 static const char* const valid_modargs[] = {
     "sink_name",
     "sink_properties",
@@ -135,6 +140,7 @@ static const char* const valid_modargs[] = {
     "rate",
     "channels",
     "channel_map",
+    "ring_pages",
     NULL
 };
 
@@ -143,12 +149,12 @@ xc_interface* xch;
 xc_evtchn* xce;
 evtchn_port_or_error_t xen_evtchn_port;
 static struct xs_handle *xsh;
-struct ioctl_gntalloc_alloc_gref gref;
+struct ioctl_gntalloc_alloc_gref *gref;
+static uint32_t ring_pages = DEFAULT_RING_PAGES;
 
 static int register_backend_state_watch(void);
 static int wait_for_backend_state_change(void);
-static int alloc_gref(struct ioctl_gntalloc_alloc_gref *gref, void **addr);
-static int ring_write(struct ring *r, void *src, int length);
+static int alloc_gref(uint32_t n_pages, struct ioctl_gntalloc_alloc_gref **gref, void **addr);
 static int publish_spec(pa_sample_spec *ss);
 static int read_backend_default_spec(pa_sample_spec *ss);
 static int publish_param(const char *paramname, const char *value);
@@ -240,8 +246,13 @@ int (*state_callbacks[9])(void) = {
 
 static void xen_cleanup() {
     char keybuf[64];
-    /*XXX hardcoded*/
-    munmap((void*)gref.index, 4096);
+
+    if (ioring)
+        munmap(ioring, ring_pages * XEN_PAGE_SIZE);
+    ioring = NULL;
+
+    pa_xfree(gref);
+    gref = NULL;
 
     set_state(XenbusStateClosing);
     /* send one last event to unblock the backend */
@@ -257,6 +268,13 @@ static void xen_cleanup() {
     xs_daemon_close(xsh);
 }
 
+/* Called from IO context */
+static size_t ring_filled(void) {
+    uint32_t size = ioring->usable_buffer_space;
+
+    return (ioring->prod_indx + size - ioring->cons_indx) % size;
+}
+
 static int sink_process_msg(pa_msgobject *o, int code, void *data, int64_t offset, pa_memchunk *chunk) {
     struct userdata *u = PA_SINK(o)->userdata;
 
@@ -265,7 +283,8 @@ static int sink_process_msg(pa_msgobject *o, int code, void *data, int64_t offse
         case PA_SINK_MESSAGE_GET_LATENCY: {
             size_t n = 0;
 
-            n += u->memchunk.length;
+            if (PA_SINK_IS_OPENED(u->sink->thread_info.state))
+                n += ring_filled();
 
             *((pa_usec_t*) data) = pa_bytes_to_usec(n, &u->sink->sample_spec);
             return 0;
@@ -275,50 +294,81 @@ static int sink_process_msg(pa_msgobject *o, int code, void *data, int64_t offse
     return pa_sink_process_msg(o, code, data, offset, chunk);
 }
 
+/* Called from IO context. The backend ran dry, so use more of the shared
+ * pages. An empty ring has prod_indx == cons_indx below the old size,
+ * which stays valid for the larger one. */
+static void ring_grow(struct userdata *u) {
+    size_t size;
+
+    size = PA_MIN(u->ring_capacity, (size_t) ioring->usable_buffer_space * 2);
+
+    if (size <= ioring->usable_buffer_space)
+        return;
+
+    pa_log_debug("Backend underrun, growing ring from %lu to %lu bytes.",
+                 (unsigned long) ioring->usable_buffer_space, (unsigned long) size);
+
+    ioring->usable_buffer_space = (uint32_t) size;
+
+    pa_sink_set_max_request_within_thread(u->sink, size);
+    pa_sink_set_fixed_latency_within_thread(u->sink, pa_bytes_to_usec(size, &u->sink->sample_spec));
+}
+
+/* Called from IO context. Render straight into the shared pages. */
+static void render_into_ring(struct userdata *u, size_t offset, size_t length) {
+    pa_memchunk chunk;
+
+    chunk.memblock = pa_memblock_new_fixed(u->core->mempool, ioring->buffer + offset, length, FALSE);
+    chunk.index = 0;
+    chunk.length = length;
+
+    pa_sink_render_into_full(u->sink, &chunk);
+
+    pa_memblock_unref_fixed(chunk.memblock);
+}
+
 static int process_render(struct userdata *u) {
+    size_t fs, size, filled, n, l;
+    uint32_t prod;
+
     pa_assert(u);
 
-    if (u->memchunk.length <= 0)
-        pa_sink_render(u->sink, ioring->usable_buffer_space, &u->memchunk);
+    fs = pa_frame_size(&u->sink->sample_spec);
 
-    pa_assert(u->memchunk.length > 0);
+    filled = ring_filled();
 
-    xc_evtchn_notify(xce, xen_evtchn_port);
-    for (;;) {
-        ssize_t l;
-        void *p;
+    if (filled == 0 && u->ring_started)
+        ring_grow(u);
 
-        p = pa_memblock_acquire(u->memchunk.memblock);
-        /* xen: write data to ring buffer & notify backend */
-        l = ring_write(ioring, (uint8_t*)p + u->memchunk.index, u->memchunk.length);
+    size = ioring->usable_buffer_space;
+    prod = ioring->prod_indx;
 
-        pa_memblock_release(u->memchunk.memblock);
+    /* Keep a frame free so that a full ring can be told from an empty
+     * one. The backend may consume partial frames, we never write them. */
+    if (filled + fs > size)
+        return 0;
 
-        pa_assert(l != 0);
+    n = pa_frame_align(size - filled - fs, &u->sink->sample_spec);
 
-        if (l < 0) {
-            if (errno == EINTR)
-                continue;
-            else if (errno == EAGAIN)
-                return 0;
-            else {
-                pa_log("Failed to write data to FIFO: %s", pa_cstrerror(errno));
-                return -1;
-            }
+    if (n <= 0)
+        return 0;
 
-        } else {
+    /* The free space may be split over the end of the buffer */
+    l = PA_MIN(n, size - prod);
+    render_into_ring(u, prod, l);
 
-            u->memchunk.index += (size_t) l;
-            u->memchunk.length -= (size_t) l;
+    if (n > l)
+        render_into_ring(u, 0, n - l);
 
-            if (u->memchunk.length <= 0) {
-                pa_memblock_unref(u->memchunk.memblock);
-                pa_memchunk_reset(&u->memchunk);
-            }
-        }
+    /* The data has to be there before the backend sees the new index */
+    __sync_synchronize();
+    ioring->prod_indx = (uint32_t) ((prod + n) % size);
 
-        return 0;
-    }
+    /* One notification for everything written in this period */
+    xc_evtchn_notify(xce, xen_evtchn_port);
+    u->ring_started = TRUE;
+
+    return 0;
 }
 
 static void thread_func(void *userdata) {
@@ -331,40 +381,28 @@ static void thread_func(void *userdata) {
     pa_thread_mq_install(&u->thread_mq);
 
     for(;;) {
-        struct pollfd *pollfd;
         int ret;
 
-        pollfd = pa_rtpoll_item_get_pollfd(u->rtpoll_item, NULL);
-
         if (PA_UNLIKELY(u->sink->thread_info.rewind_requested))
             pa_sink_process_rewind(u->sink, 0);
 
-        /* Render some data and write it to the fifo */
+        /* Render some data into the ring and sleep until the backend
+         * has played half of what is queued there */
         if (PA_SINK_IS_OPENED(u->sink->thread_info.state)) {
-            if (pollfd->revents) {
-                if (process_render(u) < 0)
-                    goto fail;
+            if (process_render(u) < 0)
+                goto fail;
 
-                pollfd->revents = 0;
-            }
+            pa_rtpoll_set_timer_relative(u->rtpoll, pa_bytes_to_usec(ring_filled(), &u->sink->sample_spec) / 2);
+        } else {
+            u->ring_started = FALSE;
+            pa_rtpoll_set_timer_disabled(u->rtpoll);
         }
 
-        /* Hmm, nothing to do. Let's sleep */
-
-        pollfd->events = (short) (u->sink->thread_info.state == PA_SINK_RUNNING ? POLLOUT : 0);
-
         if ((ret = pa_rtpoll_run(u->rtpoll, TRUE)) < 0)
             goto fail;
 
         if (ret == 0)
             goto finish;
-
-        pollfd = pa_rtpoll_item_get_pollfd(u->rtpoll_item, NULL);
-
-        if (pollfd->revents & ~POLLOUT) {
-            pa_log("FIFO shutdown.");
-            goto fail;
-        }
     }
 
 fail:
@@ -386,6 +424,7 @@ int pa__init(pa_module*m) {
     int backend_state;
     int ret;
     char strbuf[100];
+    uint32_t i;
 
     pa_assert(m);
 
@@ -403,6 +442,11 @@ int pa__init(pa_module*m) {
         return 1;
     }
 
+    if (pa_modargs_get_value_u32(ma, "ring_pages", &ring_pages) < 0 || ring_pages < 1 || ring_pages > RING_PAGES_MAX) {
+        pa_log("Invalid ring_pages value, must be between 1 and %u", RING_PAGES_MAX);
+        goto fail;
+    }
+
     /* Xen Basic init */
     xsh = xs_domain_open();
     if (xsh==NULL) {
@@ -430,7 +474,7 @@ int pa__init(pa_module*m) {
     }
 
     /* get grant reference & map locally */
-    if (alloc_gref(&gref, (void**)&ioring)) {
+    if (alloc_gref(ring_pages, &gref, (void**)&ioring)) {
        pa_log("alloc_gref failed");
     };
     device_id = 0; /* hardcoded for now */
@@ -440,7 +484,14 @@ int pa__init(pa_module*m) {
     };
 
     publish_param_int("event-channel", xen_evtchn_port);
-    publish_param_int("ring-ref", gref.gref_ids[0]);
+    publish_param_int("ring-ref", gref->gref_ids[0]);
+    publish_param_int("ring-pages", ring_pages);
+    for (i = 1; i < ring_pages; i++) {
+        char key[16];
+
+        pa_snprintf(key, sizeof(key), "ring-ref%u", i);
+        publish_param_int(key, gref->gref_ids[i]);
+    }
 
     /* let's ask for something absurd and deal with rejection */
     ss.rate = 192000;
@@ -474,14 +525,13 @@ int pa__init(pa_module*m) {
     u->core = m->core;
     u->module = m;
     m->userdata = u;
-    pa_memchunk_reset(&u->memchunk);
     u->rtpoll = pa_rtpoll_new();
     pa_thread_mq_init(&u->thread_mq, m->core->mainloop, u->rtpoll);
-    u->write_type = 0;
 
-    /* init ring buffer */
+    /* init ring buffer, start with the first page and grow from there */
+    u->ring_capacity = pa_frame_align(ring_pages * XEN_PAGE_SIZE - RING_HEADER_SIZE, &ss);
     ioring->prod_indx = ioring->cons_indx = 0;
-    ioring->usable_buffer_space = BUFSIZE - BUFSIZE % pa_frame_size(&ss);
+    ioring->usable_buffer_space = (uint32_t) pa_frame_align(XEN_PAGE_SIZE - RING_HEADER_SIZE, &ss);
 
     pa_sink_new_data_init(&data);
     data.driver = __FILE__;
@@ -514,8 +564,6 @@ int pa__init(pa_module*m) {
     pa_sink_set_max_request(u->sink, ioring->usable_buffer_space);
     pa_sink_set_fixed_latency(u->sink, pa_bytes_to_usec(ioring->usable_buffer_space, &u->sink->sample_spec));
 
-    u->rtpoll_item = pa_rtpoll_item_new(u->rtpoll, PA_RTPOLL_NEVER, 1);
-
     if (!(u->thread = pa_thread_new("xenpv-sink", thread_func, u))) {
         pa_log("Failed to create thread.");
         goto fail;
@@ -566,12 +614,6 @@ void pa__done(pa_module*m) {
     if (u->sink)
         pa_sink_unref(u->sink);
 
-    if (u->memchunk.memblock)
-       pa_memblock_unref(u->memchunk.memblock);
-
-    if (u->rtpoll_item)
-        pa_rtpoll_item_free(u->rtpoll_item);
-
     if (u->rtpoll)
         pa_rtpoll_free(u->rtpoll);
 
@@ -581,7 +623,8 @@ void pa__done(pa_module*m) {
 
 }
 
-static int alloc_gref(struct ioctl_gntalloc_alloc_gref *gref_, void **addr) {
+static int alloc_gref(uint32_t n_pages, struct ioctl_gntalloc_alloc_gref **gref_ret, void **addr) {
+    struct ioctl_gntalloc_alloc_gref *gref_;
     int alloc_fd, dev_fd, rv;
 
     alloc_fd = open("/dev/xen/gntalloc", O_RDWR);
@@ -596,10 +639,14 @@ static int alloc_gref(struct ioctl_gntalloc_alloc_gref *gref_, void **addr) {
         return 1;
     }
 
+    /* one grant ref per page */
+    gref_ = pa_xmalloc0(sizeof(*gref_) + (n_pages - 1) * sizeof(gref_->gref_ids[0]));
+    *gref_ret = gref_;
+
     /* use dom0 */
     gref_->domid = 0;
     gref_->flags = GNTALLOC_FLAG_WRITABLE;
-    gref_->count = 1;
+    gref_->count = n_pages;
 
     rv = ioctl(alloc_fd, IOCTL_GNTALLOC_ALLOC_GREF, gref_);
     if (rv) {
@@ -608,7 +655,7 @@ static int alloc_gref(struct ioctl_gntalloc_alloc_gref *gref_, void **addr) {
     }
 
     /*addr=NULL(default),length, prot,             flags,    fd,         offset*/
-    *addr = mmap(0, 4096, PROT_READ|PROT_WRITE, MAP_SHARED, alloc_fd, gref_->index);
+    *addr = mmap(0, n_pages * XEN_PAGE_SIZE, PROT_READ|PROT_WRITE, MAP_SHARED, alloc_fd, gref_->index);
     if (*addr == MAP_FAILED) {
         *addr = 0;
         pa_log_debug("Xen audio sink: mmap'ing shared page failed\n");
@@ -635,43 +682,6 @@ static int alloc_gref(struct ioctl_gntalloc_alloc_gref *gref_, void **addr) {
     return rv;
 }
 
-#define RING_FREE_BYTES ((r->usable_buffer_space - (r->prod_indx-r->cons_indx) -1) % r->usable_buffer_space)
-static int ring_write(struct ring *r, void *src, int length) {
-    int full = 0;
-    for (;;) {
-        /* free space may be split over the end of the buffer */
-        int first_chunk_size = (r->usable_buffer_space-r->prod_indx);
-        int second_chunk_size = (r->cons_indx>=r->prod_indx)? (r->cons_indx) : 0;
-        int l, fl, sl;
-
-        /* full? */
-        if (RING_FREE_BYTES==0) {
-            /*XXX hardcoded*/
-            if (full>=100) {
-                errno = EINTR;
-                return -1;
-            }
-            /*XXX hardcoded */
-            usleep(1000);
-            /* should return in 100ms max; definitely not midstream */
-            full++;
-            continue;
-        }
-
-        /* calculate lengths in case of a split buffer */
-        l = PA_MIN((int)RING_FREE_BYTES, length);
-        fl = PA_MIN(l, first_chunk_size);
-        sl = PA_MIN(l-fl, second_chunk_size);
-
-        memcpy(r->buffer+r->prod_indx, src, fl);
-        if (sl)
-            memcpy(r->buffer, ((char*)src)+fl, sl);
-        r->prod_indx = (r->prod_indx+fl+sl) % r->usable_buffer_space;
-
-        return sl+fl;
-    }
-}
-
 static int publish_param(const char *paramname, const char *value) {
     char keybuf[128], valbuf[32];
 
@@ -75,6 +75,7 @@ void pa_command_extension(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_t
 
 static const pa_pdispatch_cb_t command_table[PA_COMMAND_MAX] = {
     [PA_COMMAND_REQUEST] = pa_command_request,
+    [PA_COMMAND_REQUEST_BATCH] = pa_command_request_batch,
     [PA_COMMAND_OVERFLOW] = pa_command_overflow_or_underflow,
     [PA_COMMAND_UNDERFLOW] = pa_command_overflow_or_underflow,
     [PA_COMMAND_PLAYBACK_STREAM_KILLED] = pa_command_stream_killed,
@@ -84,6 +85,8 @@ static const pa_pdispatch_cb_t command_table[PA_COMMAND_MAX] = {
     [PA_COMMAND_PLAYBACK_STREAM_SUSPENDED] = pa_command_stream_suspended,
     [PA_COMMAND_RECORD_STREAM_SUSPENDED] = pa_command_stream_suspended,
     [PA_COMMAND_STARTED] = pa_command_stream_started,
+    [PA_COMMAND_PLAYBACK_STREAM_TIMING] = pa_command_stream_timing,
+    [PA_COMMAND_SINK_LEVELS] = pa_command_sink_levels,
     [PA_COMMAND_SUBSCRIBE_EVENT] = pa_command_subscribe_event,
     [PA_COMMAND_EXTENSION] = pa_command_extension,
     [PA_COMMAND_PLAYBACK_STREAM_EVENT] = pa_command_stream_event,
@@ -111,9 +114,15 @@ static void reset_callbacks(pa_context *c) {
     c->subscribe_callback = NULL;
     c->subscribe_userdata = NULL;
 
+    c->cache_callback = NULL;
+    c->cache_userdata = NULL;
+
     c->event_callback = NULL;
     c->event_userdata = NULL;
 
+    c->sink_levels_callback = NULL;
+    c->sink_levels_userdata = NULL;
+
     c->ext_device_manager.callback = NULL;
     c->ext_device_manager.userdata = NULL;
 
@@ -202,11 +211,22 @@ static void context_unlink(pa_context *c) {
     while (c->operations)
         pa_operation_cancel(c->operations);
 
+    if (c->timing_batch_event) {
+        c->mainloop->defer_free(c->timing_batch_event);
+        c->timing_batch_event = NULL;
+    }
+
     if (c->pdispatch) {
         pa_pdispatch_unref(c->pdispatch);
         c->pdispatch = NULL;
     }
 
+    /* Only after the replies it is waiting for are gone */
+    if (c->cache) {
+        pa_context_cache_free(c->cache);
+        c->cache = NULL;
+    }
+
     if (c->pstream) {
         pa_pstream_unlink(c->pstream);
         pa_pstream_unref(c->pstream);
@@ -257,6 +277,7 @@ static void context_free(pa_context *c) {
         pa_proplist_free(c->proplist);
 
     pa_xfree(c->server);
+    pa_xfree(c->cached_server);
     pa_xfree(c);
 }
 
@@ -408,6 +429,124 @@ int pa_context_handle_error(pa_context *c, uint32_t command, pa_tagstruct *t, pa
     return 0;
 }
 
+static void server_cache_load(pa_context *c) {
+    char *fn, line[1024];
+    FILE *f;
+
+    pa_assert(!c->cached_server);
+
+    if (!(fn = pa_runtime_path(PA_NATIVE_CLIENT_CACHE_FILE)))
+        return;
+
+    f = pa_fopen_cloexec(fn, "r");
+    pa_xfree(fn);
+
+    if (!f)
+        return;
+
+    /* A single line: protocol version and server address */
+    if (fgets(line, sizeof(line), f)) {
+        char *e;
+        uint32_t version;
+
+        line[strcspn(line, "\r\n")] = 0;
+
+        if ((e = strchr(line, ' ')) && e[1]) {
+            *e = 0;
+
+            if (pa_atou(line, &version) >= 0) {
+                c->cached_version = version;
+                c->cached_server = pa_xstrdup(e + 1);
+            }
+        }
+    }
+
+    fclose(f);
+}
+
+static void server_cache_save(pa_context *c) {
+    char *fn, *tmp;
+    FILE *f;
+
+    if (!(fn = pa_runtime_path(PA_NATIVE_CLIENT_CACHE_FILE)))
+        return;
+
+    /* Other clients might be reading it right now */
+    tmp = pa_sprintf_malloc("%s.%lu", fn, (unsigned long) getpid());
+
+    if ((f = pa_fopen_cloexec(tmp, "w"))) {
+        fprintf(f, "%u %s\n", c->version, c->server);
+
+        if (fclose(f) != 0 || rename(tmp, fn) < 0) {
+            pa_log_debug("Failed to write %s: %s", fn, pa_cstrerror(errno));
+            unlink(tmp);
+        }
+    }
+
+    pa_xfree(tmp);
+    pa_xfree(fn);
+}
+
+static void server_cache_drop(pa_context *c) {
+    char *fn;
+
+    if ((fn = pa_runtime_path(PA_NATIVE_CLIENT_CACHE_FILE))) {
+        unlink(fn);
+        pa_xfree(fn);
+    }
+
+    pa_xfree(c->cached_server);
+    c->cached_server = NULL;
+    c->cached_server_first = FALSE;
+}
+
+static void setup_complete_callback(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
+
+/* The format is chosen by the version of the server, which might only
+ * be known from the cache yet */
+static void send_client_name(pa_context *c, uint32_t version) {
+    pa_tagstruct *t;
+    uint32_t tag;
+
+    t = pa_tagstruct_command(c, PA_COMMAND_SET_CLIENT_NAME, &tag);
+
+    if (version >= 13) {
+        pa_init_proplist(c->proplist);
+        pa_tagstruct_put_proplist(t, c->proplist);
+    } else
+        pa_tagstruct_puts(t, pa_proplist_gets(c->proplist, PA_PROP_APPLICATION_NAME));
+
+    pa_pstream_send_tagstruct(c->pstream, t);
+    pa_pdispatch_register_reply(c->pdispatch, tag, DEFAULT_TIMEOUT, setup_complete_callback, c, NULL);
+}
+
+static int try_next_connection(pa_context *c);
+
+/* The server will choke on the name we sent along, so drop this
+ * connection and go through the handshake with the same server again,
+ * waiting for its version this time */
+static void restart_unpipelined(pa_context *c) {
+    pa_assert(c->name_pipelined);
+
+    pa_log_debug("Server version changed, connecting again without pipelining.");
+
+    server_cache_drop(c);
+    c->name_pipelined = FALSE;
+
+    pa_pdispatch_unref(c->pdispatch);
+    c->pdispatch = NULL;
+
+    pa_pstream_unlink(c->pstream);
+    pa_pstream_unref(c->pstream);
+    c->pstream = NULL;
+
+    c->server_list = pa_strlist_prepend(c->server_list, c->server);
+
+    pa_context_set_state(c, PA_CONTEXT_CONNECTING);
+
+    try_next_connection(c);
+}
+
 static void setup_complete_callback(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
     pa_context *c = userdata;
 
@@ -424,7 +563,6 @@ static void setup_complete_callback(pa_pdispatch *pd, uint32_t command, uint32_t
 
     switch(c->state) {
         case PA_CONTEXT_AUTHORIZING: {
-            pa_tagstruct *reply;
             pa_bool_t shm_on_remote = FALSE;
 
             if (pa_tagstruct_getu32(t, &c->version) < 0 ||
@@ -470,16 +608,17 @@ static void setup_complete_callback(pa_pdispatch *pd, uint32_t command, uint32_t
             pa_log_debug("Negotiated SHM: %s", pa_yes_no(c->do_shm));
             pa_pstream_enable_shm(c->pstream, c->do_shm);
 
-            reply = pa_tagstruct_command(c, PA_COMMAND_SET_CLIENT_NAME, &tag);
+            if (c->do_shm && c->version >= 29)
+                pa_pstream_enable_memfd(c->pstream);
 
-            if (c->version >= 13) {
-                pa_init_proplist(c->proplist);
-                pa_tagstruct_put_proplist(reply, c->proplist);
-            } else
-                pa_tagstruct_puts(reply, pa_proplist_gets(c->proplist, PA_PROP_APPLICATION_NAME));
-
-            pa_pstream_send_tagstruct(c->pstream, reply);
-            pa_pdispatch_register_reply(c->pdispatch, tag, DEFAULT_TIMEOUT, setup_complete_callback, c, NULL);
+            if (!c->name_pipelined)
+                send_client_name(c, c->version);
+            else if (c->version < 13) {
+                /* The server changed under our feet and cannot parse
+                 * what we sent */
+                restart_unpipelined(c);
+                goto finish;
+            }
 
             pa_context_set_state(c, PA_CONTEXT_SETTING_NAME);
             break;
@@ -494,6 +633,12 @@ static void setup_complete_callback(pa_pdispatch *pd, uint32_t command, uint32_t
                 goto finish;
             }
 
+            /* Only the default lookup is cached, an explicitly chosen
+             * server must not become the default for others */
+            if (!c->server_specified &&
+                (!c->cached_server || !pa_streq(c->cached_server, c->server) || c->cached_version != c->version))
+                server_cache_save(c);
+
             pa_context_set_state(c, PA_CONTEXT_READY);
             break;
 
@@ -558,6 +703,17 @@ static void setup_context(pa_context *c, pa_iochannel *io) {
 
     pa_pdispatch_register_reply(c->pdispatch, tag, DEFAULT_TIMEOUT, setup_complete_callback, c, NULL);
 
+    /* If we talked to this server before, we know which format it
+     * expects the name in and can send it right behind the
+     * authentication, saving a round trip */
+    c->name_pipelined =
+        c->cached_server_first &&
+        c->cached_server && pa_streq(c->cached_server, c->server) &&
+        c->cached_version >= 13;
+
+    if (c->name_pipelined)
+        send_client_name(c, c->cached_version);
+
     pa_context_set_state(c, PA_CONTEXT_AUTHORIZING);
 
     pa_context_unref(c);
@@ -889,6 +1045,8 @@ int pa_context_connect(
     c->server_specified = !!server;
     pa_assert(!c->server_list);
 
+    server_cache_load(c);
+
     if (server) {
         if (!(c->server_list = pa_strlist_parse(server))) {
             pa_context_fail(c, PA_ERR_INVALIDSERVER);
@@ -923,6 +1081,10 @@ int pa_context_connect(
 
         /* The user instance via PF_LOCAL */
         c->server_list = prepend_per_user(c->server_list);
+
+        /* The cache doesn't change the order in which servers are
+         * tried. It only tells us what to expect from the first one. */
+        c->cached_server_first = c->cached_server && pa_streq(c->cached_server, pa_strlist_data(c->server_list));
     }
 
     /* Set up autospawning */
@@ -319,11 +319,35 @@ typedef enum pa_stream_flags {
      * consider absolute when the sink is in flat volume mode,
      * relative otherwise. \since 0.9.20 */
 
-    PA_STREAM_PASSTHROUGH = 0x80000U
+    PA_STREAM_PASSTHROUGH = 0x80000U,
     /**< Used to tag content that will be rendered by passthrough sinks.
      * The data will be left as is and not reformatted, resampled.
      * \since 1.0 */
 
+    PA_STREAM_SHM_RING = 0x100000U,
+    /**< Write playback data into a ring buffer in shared memory that
+     * the server reads from directly, instead of sending a memory
+     * block for every write. Saves the per-write protocol overhead for
+     * low latency clients. Only relative writes without offset are
+     * possible then, and pa_stream_writable_size() is limited by the
+     * free space in the ring. Falls back silently to the normal mode if
+     * the server or the connection does not support it, e.g. without
+     * SHM. \since 5.0 */
+
+    PA_STREAM_RT_WRITE = 0x200000U,
+    /**< Allow pa_stream_write_rt() and pa_stream_writable_size_rt()
+     * for this playback stream, which may be called from a real-time
+     * thread without taking the threaded main loop lock. \since 5.0 */
+
+    PA_STREAM_ADAPTIVE_LATENCY = 0x400000U
+    /**< Let the server grow tlength and minreq of this playback
+     * stream whenever it runs dry, and shrink them slowly back towards
+     * the requested values while the application keeps up. tlength
+     * grows up to maxlength if one was requested, and up to four
+     * times the initial tlength otherwise. The new values are
+     * announced through the buffer attribute callback. Ignored by
+     * servers that don't support it. \since 5.0 */
+
 } pa_stream_flags_t;
 
 /** \cond fulldocs */
@@ -352,6 +376,9 @@ typedef enum pa_stream_flags {
 #define PA_STREAM_FAIL_ON_SUSPEND PA_STREAM_FAIL_ON_SUSPEND
 #define PA_STREAM_RELATIVE_VOLUME PA_STREAM_RELATIVE_VOLUME
 #define PA_STREAM_PASSTHROUGH PA_STREAM_PASSTHROUGH
+#define PA_STREAM_SHM_RING PA_STREAM_SHM_RING
+#define PA_STREAM_RT_WRITE PA_STREAM_RT_WRITE
+#define PA_STREAM_ADAPTIVE_LATENCY PA_STREAM_ADAPTIVE_LATENCY
 
 /** \endcond */
 
@@ -28,11 +28,13 @@
 #include <pulse/stream.h>
 #include <pulse/operation.h>
 #include <pulse/subscribe.h>
+#include <pulse/introspect.h>
 #include <pulse/ext-device-manager.h>
 #include <pulse/ext-device-restore.h>
 #include <pulse/ext-stream-restore.h>
 
 #include <pulsecore/socket-client.h>
+#include <pulsecore/atomic.h>
 #include <pulsecore/pstream.h>
 #include <pulsecore/pdispatch.h>
 #include <pulsecore/llist.h>
@@ -43,6 +45,7 @@
 #include <pulsecore/hashmap.h>
 #include <pulsecore/refcnt.h>
 #include <pulsecore/time-smoother.h>
+#include <pulsecore/shmring.h>
 #ifdef HAVE_DBUS
 #include <pulsecore/dbus-util.h>
 #endif
@@ -51,6 +54,9 @@
 
 #define DEFAULT_TIMEOUT (30)
 
+/* Defined in introspect.c */
+typedef struct pa_context_cache pa_context_cache;
+
 struct pa_context {
     PA_REFCNT_DECLARE;
 
@@ -70,6 +76,9 @@ struct pa_context {
     PA_LLIST_HEAD(pa_stream, streams);
     PA_LLIST_HEAD(pa_operation, operations);
 
+    /* Sends the timing queries of all playback streams at once */
+    pa_defer_event *timing_batch_event;
+
     uint32_t version;
     uint32_t ctag;
     uint32_t csyncid;
@@ -80,8 +89,12 @@ struct pa_context {
     void *state_userdata;
     pa_context_subscribe_cb_t subscribe_callback;
     void *subscribe_userdata;
+    pa_context_subscribe_cb_t cache_callback;
+    void *cache_userdata;
     pa_context_event_cb_t event_callback;
     void *event_userdata;
+    pa_sink_levels_cb_t sink_levels_callback;
+    void *sink_levels_userdata;
 
     pa_mempool *mempool;
 
@@ -92,16 +105,28 @@ struct pa_context {
     pa_bool_t do_autospawn:1;
     pa_bool_t use_rtclock:1;
     pa_bool_t filter_added:1;
+    pa_bool_t name_pipelined:1;
+    pa_bool_t cached_server_first:1;
     pa_spawn_api spawn_api;
 
     pa_strlist *server_list;
 
     char *server;
 
+    /* What the last successful connection went to, from the runtime
+     * directory */
+    char *cached_server;
+    uint32_t cached_version;
+
     pa_client_conf *conf;
 
     uint32_t client_index;
 
+    /* What the application subscribed to. The object cache might have
+     * subscribed the server to more than that. */
+    pa_subscription_mask_t subscribe_mask;
+    pa_context_cache *cache;
+
     /* Extension specific data */
     struct {
         pa_ext_device_manager_subscribe_cb_t callback;
@@ -155,6 +180,8 @@ struct pa_stream {
     pa_bool_t corked:1;
     pa_bool_t timing_info_valid:1;
     pa_bool_t auto_timing_update_requested:1;
+    pa_bool_t timing_batch_pending:1;
+    pa_bool_t timing_push:1;
 
     uint32_t channel;
     uint32_t syncid;
@@ -171,6 +198,24 @@ struct pa_stream {
     void *write_data;
     int64_t latest_underrun_at_index;
 
+    /* With PA_STREAM_SHM_RING, once the server accepted the ring all
+     * data goes through it. write_ring_data is what
+     * pa_stream_begin_write() returned from the ring. */
+    pa_shmring *shm_ring;
+    pa_bool_t shm_ring_active;
+    pa_io_event *shm_ring_event;
+    void *write_ring_data;
+    size_t write_ring_length;
+
+    /* With PA_STREAM_RT_WRITE, pa_stream_write_rt() fills rt_ring from
+     * any one thread and posts rt_fdsem. The main loop moves the data on
+     * as the server asks for it. rt_active is only set while the stream
+     * is ready. */
+    pa_shmring *rt_ring;
+    pa_fdsem *rt_fdsem;
+    pa_io_event *rt_event;
+    pa_atomic_t rt_active;
+
     /* recording */
     pa_memchunk peek_memchunk;
     void *peek_data;
@@ -194,6 +239,9 @@ struct pa_stream {
     pa_time_event *auto_timing_update_event;
     pa_usec_t auto_timing_interval_usec;
 
+    /* Tag of the last batched timing query this stream was part of */
+    uint32_t timing_batch_tag;
+
     pa_smoother *smoother;
 
     /* Callbacks */
@@ -241,12 +289,23 @@ struct pa_operation {
 };
 
 void pa_command_request(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
+void pa_command_request_batch(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
 void pa_command_stream_killed(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
 void pa_command_subscribe_event(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
+
+/* The events the object cache needs, and how it follows them */
+#define PA_CONTEXT_CACHE_SUBSCRIPTION_MASK                             \
+    (PA_SUBSCRIPTION_MASK_SINK|PA_SUBSCRIPTION_MASK_SOURCE|             \
+     PA_SUBSCRIPTION_MASK_SINK_INPUT|PA_SUBSCRIPTION_MASK_SOURCE_OUTPUT| \
+     PA_SUBSCRIPTION_MASK_CARD)
+void pa_context_cache_handle_event(pa_context *c, pa_subscription_event_type_t e, uint32_t idx);
+void pa_context_cache_free(pa_context_cache *cache);
 void pa_command_overflow_or_underflow(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
 void pa_command_stream_suspended(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
 void pa_command_stream_moved(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
 void pa_command_stream_started(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
+void pa_command_stream_timing(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
+void pa_command_sink_levels(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
 void pa_command_stream_event(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
 void pa_command_client_event(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
 void pa_command_stream_buffer_attr(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
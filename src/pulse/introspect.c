@@ -24,6 +24,9 @@
 #include <config.h>
 #endif
 
+#include <stddef.h>
+#include <string.h>
+
 #include <pulse/context.h>
 #include <pulse/xmalloc.h>
 #include <pulse/fork-detect.h>
@@ -59,10 +62,34 @@ static void context_stat_callback(pa_pdispatch *pd, uint32_t command, uint32_t t
                pa_tagstruct_getu32(t, &i.memblock_total_size) < 0 ||
                pa_tagstruct_getu32(t, &i.memblock_allocated) < 0 ||
                pa_tagstruct_getu32(t, &i.memblock_allocated_size) < 0 ||
-               pa_tagstruct_getu32(t, &i.scache_size) < 0 ||
-               !pa_tagstruct_eof(t)) {
+               pa_tagstruct_getu32(t, &i.scache_size) < 0) {
         pa_context_fail(o->context, PA_ERR_PROTOCOL);
         goto finish;
+    } else {
+        if (o->context->version >= 29) {
+            pa_bool_t locked;
+
+            if (pa_tagstruct_getu32(t, &i.mempool_page_size) < 0 ||
+                pa_tagstruct_get_boolean(t, &locked) < 0) {
+                pa_context_fail(o->context, PA_ERR_PROTOCOL);
+                goto finish;
+            }
+
+            i.mempool_locked = (int) locked;
+        }
+
+        if (o->context->version >= 30) {
+            if (pa_tagstruct_getu64(t, &i.memory_trimmed) < 0 ||
+                pa_tagstruct_getu32(t, &i.memory_trims) < 0) {
+                pa_context_fail(o->context, PA_ERR_PROTOCOL);
+                goto finish;
+            }
+        }
+
+        if (!pa_tagstruct_eof(t)) {
+            pa_context_fail(o->context, PA_ERR_PROTOCOL);
+            goto finish;
+        }
     }
 
     if (o->callback) {
@@ -81,6 +108,27 @@ pa_operation* pa_context_stat(pa_context *c, pa_stat_info_cb_t cb, void *userdat
 
 /*** Server Info ***/
 
+static int read_server_info(pa_context *c, pa_tagstruct *t, pa_server_info *i) {
+    pa_zero(*i);
+
+    if (pa_tagstruct_gets(t, &i->server_name) < 0 ||
+        pa_tagstruct_gets(t, &i->server_version) < 0 ||
+        pa_tagstruct_gets(t, &i->user_name) < 0 ||
+        pa_tagstruct_gets(t, &i->host_name) < 0 ||
+        pa_tagstruct_get_sample_spec(t, &i->sample_spec) < 0 ||
+        pa_tagstruct_gets(t, &i->default_sink_name) < 0 ||
+        pa_tagstruct_gets(t, &i->default_source_name) < 0 ||
+        pa_tagstruct_getu32(t, &i->cookie) < 0 ||
+        (c->version >= 15 &&
+         pa_tagstruct_get_channel_map(t, &i->channel_map) < 0))
+        return -1;
+
+    if (c->version < 15)
+        pa_channel_map_init_extend(&i->channel_map, i->sample_spec.channels, PA_CHANNEL_MAP_DEFAULT);
+
+    return 0;
+}
+
 static void context_get_server_info_callback(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
     pa_operation *o = userdata;
     pa_server_info i, *p = &i;
@@ -99,25 +147,13 @@ static void context_get_server_info_callback(pa_pdispatch *pd, uint32_t command,
             goto finish;
 
         p = NULL;
-    } else if (pa_tagstruct_gets(t, &i.server_name) < 0 ||
-               pa_tagstruct_gets(t, &i.server_version) < 0 ||
-               pa_tagstruct_gets(t, &i.user_name) < 0 ||
-               pa_tagstruct_gets(t, &i.host_name) < 0 ||
-               pa_tagstruct_get_sample_spec(t, &i.sample_spec) < 0 ||
-               pa_tagstruct_gets(t, &i.default_sink_name) < 0 ||
-               pa_tagstruct_gets(t, &i.default_source_name) < 0 ||
-               pa_tagstruct_getu32(t, &i.cookie) < 0 ||
-               (o->context->version >= 15 &&
-                pa_tagstruct_get_channel_map(t, &i.channel_map) < 0) ||
+    } else if (read_server_info(o->context, t, &i) < 0 ||
                !pa_tagstruct_eof(t)) {
 
         pa_context_fail(o->context, PA_ERR_PROTOCOL);
         goto finish;
     }
 
-    if (p && o->context->version < 15)
-        pa_channel_map_init_extend(&i.channel_map, i.sample_spec.channels, PA_CHANNEL_MAP_DEFAULT);
-
     if (o->callback) {
         pa_server_info_cb_t cb = (pa_server_info_cb_t) o->callback;
         cb(o->context, p, o->userdata);
@@ -134,19 +170,130 @@ pa_operation* pa_context_get_server_info(pa_context *c, pa_server_info_cb_t cb,
 
 /*** Sink Info ***/
 
+static void sink_info_free(pa_sink_info *i) {
+    uint32_t j;
+
+    if (i->formats) {
+        for (j = 0; j < i->n_formats; j++)
+            pa_format_info_free(i->formats[j]);
+        pa_xfree(i->formats);
+    }
+    if (i->ports) {
+        pa_xfree(i->ports[0]);
+        pa_xfree(i->ports);
+    }
+    if (i->proplist)
+        pa_proplist_free(i->proplist);
+}
+
+/* Reads one entry of a sink info reply. Even on failure i needs to be freed
+ * with sink_info_free() afterwards. */
+static int read_sink_info(pa_context *c, pa_tagstruct *t, pa_sink_info *i) {
+    pa_bool_t mute = FALSE;
+    uint32_t flags;
+    uint32_t state = PA_SINK_INVALID_STATE;
+    const char *ap = NULL;
+    uint32_t j;
+
+    pa_zero(*i);
+    i->proplist = pa_proplist_new();
+    i->base_volume = PA_VOLUME_NORM;
+    i->n_volume_steps = PA_VOLUME_NORM+1;
+    i->card = PA_INVALID_INDEX;
+
+    if (pa_tagstruct_getu32(t, &i->index) < 0 ||
+        pa_tagstruct_gets(t, &i->name) < 0 ||
+        pa_tagstruct_gets(t, &i->description) < 0 ||
+        pa_tagstruct_get_sample_spec(t, &i->sample_spec) < 0 ||
+        pa_tagstruct_get_channel_map(t, &i->channel_map) < 0 ||
+        pa_tagstruct_getu32(t, &i->owner_module) < 0 ||
+        pa_tagstruct_get_cvolume(t, &i->volume) < 0 ||
+        pa_tagstruct_get_boolean(t, &mute) < 0 ||
+        pa_tagstruct_getu32(t, &i->monitor_source) < 0 ||
+        pa_tagstruct_gets(t, &i->monitor_source_name) < 0 ||
+        pa_tagstruct_get_usec(t, &i->latency) < 0 ||
+        pa_tagstruct_gets(t, &i->driver) < 0 ||
+        pa_tagstruct_getu32(t, &flags) < 0 ||
+        (c->version >= 13 &&
+         (pa_tagstruct_get_proplist(t, i->proplist) < 0 ||
+          pa_tagstruct_get_usec(t, &i->configured_latency) < 0)) ||
+        (c->version >= 15 &&
+         (pa_tagstruct_get_volume(t, &i->base_volume) < 0 ||
+          pa_tagstruct_getu32(t, &state) < 0 ||
+          pa_tagstruct_getu32(t, &i->n_volume_steps) < 0 ||
+          pa_tagstruct_getu32(t, &i->card) < 0)) ||
+        (c->version >= 16 &&
+         (pa_tagstruct_getu32(t, &i->n_ports))))
+        return -1;
+
+    if (c->version >= 16) {
+        if (i->n_ports > 0) {
+            i->ports = pa_xnew(pa_sink_port_info*, i->n_ports+1);
+            i->ports[0] = pa_xnew(pa_sink_port_info, i->n_ports);
+
+            for (j = 0; j < i->n_ports; j++) {
+                i->ports[j] = &i->ports[0][j];
+
+                if (pa_tagstruct_gets(t, &i->ports[j]->name) < 0 ||
+                    pa_tagstruct_gets(t, &i->ports[j]->description) < 0 ||
+                    pa_tagstruct_getu32(t, &i->ports[j]->priority) < 0)
+                    return -1;
+
+                i->ports[j]->available = PA_PORT_AVAILABLE_UNKNOWN;
+                if (c->version >= 24) {
+                    uint32_t av;
+                    if (pa_tagstruct_getu32(t, &av) < 0 || av > PA_PORT_AVAILABLE_YES)
+                        return -1;
+                    i->ports[j]->available = av;
+                }
+            }
+
+            i->ports[j] = NULL;
+        }
+
+        if (pa_tagstruct_gets(t, &ap) < 0)
+            return -1;
+
+        if (ap) {
+            for (j = 0; j < i->n_ports; j++)
+                if (pa_streq(i->ports[j]->name, ap)) {
+                    i->active_port = i->ports[j];
+                    break;
+                }
+        }
+    }
+
+    if (c->version >= 21) {
+        uint8_t n_formats;
+        if (pa_tagstruct_getu8(t, &n_formats) < 0 || n_formats < 1)
+            return -1;
+
+        i->formats = pa_xnew0(pa_format_info*, n_formats);
+
+        for (j = 0; j < n_formats; j++) {
+            i->n_formats++;
+            i->formats[j] = pa_format_info_new();
+
+            if (pa_tagstruct_get_format_info(t, i->formats[j]) < 0)
+                return -1;
+        }
+    }
+
+    i->mute = (int) mute;
+    i->flags = (pa_sink_flags_t) flags;
+    i->state = (pa_sink_state_t) state;
+
+    return 0;
+}
+
 static void context_get_sink_info_callback(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
     pa_operation *o = userdata;
     int eol = 1;
-    pa_sink_info i;
-    uint32_t j;
 
     pa_assert(pd);
     pa_assert(o);
     pa_assert(PA_REFCNT_VALUE(o) >= 1);
 
-    /* For safety in case someone use fail: outside the while loop below */
-    pa_zero(i);
-
     if (!o->context)
         goto finish;
 
@@ -158,120 +305,20 @@ static void context_get_sink_info_callback(pa_pdispatch *pd, uint32_t command, u
     } else {
 
         while (!pa_tagstruct_eof(t)) {
-            pa_bool_t mute;
-            uint32_t flags;
-            uint32_t state;
-            const char *ap = NULL;
-
-            pa_zero(i);
-            i.proplist = pa_proplist_new();
-            i.base_volume = PA_VOLUME_NORM;
-            i.n_volume_steps = PA_VOLUME_NORM+1;
-            mute = FALSE;
-            state = PA_SINK_INVALID_STATE;
-            i.card = PA_INVALID_INDEX;
-
-            if (pa_tagstruct_getu32(t, &i.index) < 0 ||
-                pa_tagstruct_gets(t, &i.name) < 0 ||
-                pa_tagstruct_gets(t, &i.description) < 0 ||
-                pa_tagstruct_get_sample_spec(t, &i.sample_spec) < 0 ||
-                pa_tagstruct_get_channel_map(t, &i.channel_map) < 0 ||
-                pa_tagstruct_getu32(t, &i.owner_module) < 0 ||
-                pa_tagstruct_get_cvolume(t, &i.volume) < 0 ||
-                pa_tagstruct_get_boolean(t, &mute) < 0 ||
-                pa_tagstruct_getu32(t, &i.monitor_source) < 0 ||
-                pa_tagstruct_gets(t, &i.monitor_source_name) < 0 ||
-                pa_tagstruct_get_usec(t, &i.latency) < 0 ||
-                pa_tagstruct_gets(t, &i.driver) < 0 ||
-                pa_tagstruct_getu32(t, &flags) < 0 ||
-                (o->context->version >= 13 &&
-                 (pa_tagstruct_get_proplist(t, i.proplist) < 0 ||
-                  pa_tagstruct_get_usec(t, &i.configured_latency) < 0)) ||
-                (o->context->version >= 15 &&
-                 (pa_tagstruct_get_volume(t, &i.base_volume) < 0 ||
-                  pa_tagstruct_getu32(t, &state) < 0 ||
-                  pa_tagstruct_getu32(t, &i.n_volume_steps) < 0 ||
-                  pa_tagstruct_getu32(t, &i.card) < 0)) ||
-                (o->context->version >= 16 &&
-                 (pa_tagstruct_getu32(t, &i.n_ports)))) {
-
-                goto fail;
-            }
-
-            if (o->context->version >= 16) {
-                if (i.n_ports > 0) {
-                    i.ports = pa_xnew(pa_sink_port_info*, i.n_ports+1);
-                    i.ports[0] = pa_xnew(pa_sink_port_info, i.n_ports);
-
-                    for (j = 0; j < i.n_ports; j++) {
-                        i.ports[j] = &i.ports[0][j];
-
-                        if (pa_tagstruct_gets(t, &i.ports[j]->name) < 0 ||
-                            pa_tagstruct_gets(t, &i.ports[j]->description) < 0 ||
-                            pa_tagstruct_getu32(t, &i.ports[j]->priority) < 0) {
+            pa_sink_info i;
 
-                            goto fail;
-                        }
-
-                        i.ports[j]->available = PA_PORT_AVAILABLE_UNKNOWN;
-                        if (o->context->version >= 24) {
-                            uint32_t av;
-                            if (pa_tagstruct_getu32(t, &av) < 0 || av > PA_PORT_AVAILABLE_YES)
-                                goto fail;
-                            i.ports[j]->available = av;
-                        }
-                    }
-
-                    i.ports[j] = NULL;
-                }
-
-                if (pa_tagstruct_gets(t, &ap) < 0)
-                    goto fail;
-
-                if (ap) {
-                    for (j = 0; j < i.n_ports; j++)
-                        if (pa_streq(i.ports[j]->name, ap)) {
-                            i.active_port = i.ports[j];
-                            break;
-                        }
-                }
-            }
-
-            if (o->context->version >= 21) {
-                uint8_t n_formats;
-                if (pa_tagstruct_getu8(t, &n_formats) < 0 || n_formats < 1)
-                    goto fail;
-
-                i.formats = pa_xnew0(pa_format_info*, n_formats);
-
-                for (j = 0; j < n_formats; j++) {
-                    i.n_formats++;
-                    i.formats[j] = pa_format_info_new();
-
-                    if (pa_tagstruct_get_format_info(t, i.formats[j]) < 0)
-                        goto fail;
-                }
+            if (read_sink_info(o->context, t, &i) < 0) {
+                pa_context_fail(o->context, PA_ERR_PROTOCOL);
+                sink_info_free(&i);
+                goto finish;
             }
 
-            i.mute = (int) mute;
-            i.flags = (pa_sink_flags_t) flags;
-            i.state = (pa_sink_state_t) state;
-
             if (o->callback) {
                 pa_sink_info_cb_t cb = (pa_sink_info_cb_t) o->callback;
                 cb(o->context, &i, 0, o->userdata);
             }
 
-            if (i.formats) {
-                for (j = 0; j < i.n_formats; j++)
-                    pa_format_info_free(i.formats[j]);
-                pa_xfree(i.formats);
-            }
-            if (i.ports) {
-                pa_xfree(i.ports[0]);
-                pa_xfree(i.ports);
-            }
-            pa_proplist_free(i.proplist);
+            sink_info_free(&i);
         }
     }
 
@@ -283,25 +330,6 @@ static void context_get_sink_info_callback(pa_pdispatch *pd, uint32_t command, u
 finish:
     pa_operation_done(o);
     pa_operation_unref(o);
-    return;
-
-fail:
-    pa_assert(i.proplist);
-
-    pa_context_fail(o->context, PA_ERR_PROTOCOL);
-
-    if (i.formats) {
-        for (j = 0; j < i.n_formats; j++)
-            pa_format_info_free(i.formats[j]);
-        pa_xfree(i.formats);
-    }
-    if (i.ports) {
-        pa_xfree(i.ports[0]);
-        pa_xfree(i.ports);
-    }
-    pa_proplist_free(i.proplist);
-
-    goto finish;
 }
 
 pa_operation* pa_context_get_sink_info_list(pa_context *c, pa_sink_info_cb_t cb, void *userdata) {
@@ -405,19 +433,26 @@ pa_operation* pa_context_set_sink_port_by_name(pa_context *c, const char *name,
     return o;
 }
 
-/*** Source info ***/
+/*** Sink levels ***/
 
-static void context_get_source_info_callback(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+static int read_sink_levels(pa_tagstruct *t, pa_sink_levels_info *i) {
+    if (pa_tagstruct_getu32(t, &i->index) < 0 ||
+        pa_tagstruct_get_cvolume(t, &i->peak) < 0 ||
+        pa_tagstruct_get_cvolume(t, &i->rms) < 0 ||
+        !pa_tagstruct_eof(t))
+        return -1;
+
+    return 0;
+}
+
+static void context_get_sink_levels_callback(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
     pa_operation *o = userdata;
-    int eol = 1;
-    pa_source_info i;
-    uint32_t j;
+    pa_sink_levels_info i, *p = &i;
 
     pa_assert(pd);
     pa_assert(o);
     pa_assert(PA_REFCNT_VALUE(o) >= 1);
 
-    /* For safety in case someone use fail: outside the while loop below */
     pa_zero(i);
 
     if (!o->context)
@@ -427,124 +462,258 @@ static void context_get_source_info_callback(pa_pdispatch *pd, uint32_t command,
         if (pa_context_handle_error(o->context, command, t, FALSE) < 0)
             goto finish;
 
-        eol = -1;
-    } else {
+        p = NULL;
+    } else if (read_sink_levels(t, &i) < 0) {
+        pa_context_fail(o->context, PA_ERR_PROTOCOL);
+        goto finish;
+    }
 
-        while (!pa_tagstruct_eof(t)) {
-            pa_bool_t mute;
-            uint32_t flags;
-            uint32_t state;
-            const char *ap;
-
-            pa_zero(i);
-            i.proplist = pa_proplist_new();
-            i.base_volume = PA_VOLUME_NORM;
-            i.n_volume_steps = PA_VOLUME_NORM+1;
-            mute = FALSE;
-            state = PA_SOURCE_INVALID_STATE;
-            i.card = PA_INVALID_INDEX;
-
-            if (pa_tagstruct_getu32(t, &i.index) < 0 ||
-                pa_tagstruct_gets(t, &i.name) < 0 ||
-                pa_tagstruct_gets(t, &i.description) < 0 ||
-                pa_tagstruct_get_sample_spec(t, &i.sample_spec) < 0 ||
-                pa_tagstruct_get_channel_map(t, &i.channel_map) < 0 ||
-                pa_tagstruct_getu32(t, &i.owner_module) < 0 ||
-                pa_tagstruct_get_cvolume(t, &i.volume) < 0 ||
-                pa_tagstruct_get_boolean(t, &mute) < 0 ||
-                pa_tagstruct_getu32(t, &i.monitor_of_sink) < 0 ||
-                pa_tagstruct_gets(t, &i.monitor_of_sink_name) < 0 ||
-                pa_tagstruct_get_usec(t, &i.latency) < 0 ||
-                pa_tagstruct_gets(t, &i.driver) < 0 ||
-                pa_tagstruct_getu32(t, &flags) < 0 ||
-                (o->context->version >= 13 &&
-                 (pa_tagstruct_get_proplist(t, i.proplist) < 0 ||
-                  pa_tagstruct_get_usec(t, &i.configured_latency) < 0)) ||
-                (o->context->version >= 15 &&
-                 (pa_tagstruct_get_volume(t, &i.base_volume) < 0 ||
-                  pa_tagstruct_getu32(t, &state) < 0 ||
-                  pa_tagstruct_getu32(t, &i.n_volume_steps) < 0 ||
-                  pa_tagstruct_getu32(t, &i.card) < 0)) ||
-                (o->context->version >= 16 &&
-                 (pa_tagstruct_getu32(t, &i.n_ports)))) {
-
-                goto fail;
-            }
+    if (o->callback) {
+        pa_sink_levels_cb_t cb = (pa_sink_levels_cb_t) o->callback;
+        cb(o->context, p, o->userdata);
+    }
 
-            if (o->context->version >= 16) {
-                if (i.n_ports > 0) {
-                    i.ports = pa_xnew(pa_source_port_info*, i.n_ports+1);
-                    i.ports[0] = pa_xnew(pa_source_port_info, i.n_ports);
+finish:
+    pa_operation_done(o);
+    pa_operation_unref(o);
+}
 
-                    for (j = 0; j < i.n_ports; j++) {
-                        i.ports[j] = &i.ports[0][j];
+pa_operation* pa_context_get_sink_levels(pa_context *c, uint32_t idx, pa_sink_levels_cb_t cb, void *userdata) {
+    pa_tagstruct *t;
+    pa_operation *o;
+    uint32_t tag;
 
-                        if (pa_tagstruct_gets(t, &i.ports[j]->name) < 0 ||
-                            pa_tagstruct_gets(t, &i.ports[j]->description) < 0 ||
-                            pa_tagstruct_getu32(t, &i.ports[j]->priority) < 0) {
+    pa_assert(c);
+    pa_assert(PA_REFCNT_VALUE(c) >= 1);
+    pa_assert(cb);
 
-                            goto fail;
-                        }
+    PA_CHECK_VALIDITY_RETURN_NULL(c, !pa_detect_fork(), PA_ERR_FORKED);
+    PA_CHECK_VALIDITY_RETURN_NULL(c, c->state == PA_CONTEXT_READY, PA_ERR_BADSTATE);
+    PA_CHECK_VALIDITY_RETURN_NULL(c, idx != PA_INVALID_INDEX, PA_ERR_INVALID);
+    PA_CHECK_VALIDITY_RETURN_NULL(c, c->version >= 30, PA_ERR_NOTSUPPORTED);
 
-                        i.ports[j]->available = PA_PORT_AVAILABLE_UNKNOWN;
-                        if (o->context->version >= 24) {
-                            uint32_t av;
-                            if (pa_tagstruct_getu32(t, &av) < 0 || av > PA_PORT_AVAILABLE_YES)
-                                goto fail;
-                            i.ports[j]->available = av;
-                        }
-                    }
+    o = pa_operation_new(c, NULL, (pa_operation_cb_t) cb, userdata);
 
-                    i.ports[j] = NULL;
-                }
+    t = pa_tagstruct_command(c, PA_COMMAND_GET_SINK_LEVELS, &tag);
+    pa_tagstruct_putu32(t, idx);
+    pa_pstream_send_tagstruct(c->pstream, t);
+    pa_pdispatch_register_reply(c->pdispatch, tag, DEFAULT_TIMEOUT, context_get_sink_levels_callback, pa_operation_ref(o), (pa_free_cb_t) pa_operation_unref);
 
-                if (pa_tagstruct_gets(t, &ap) < 0)
-                    goto fail;
+    return o;
+}
 
-                if (ap) {
-                    for (j = 0; j < i.n_ports; j++)
-                        if (pa_streq(i.ports[j]->name, ap)) {
-                            i.active_port = i.ports[j];
-                            break;
-                        }
-                }
-            }
+pa_operation* pa_context_subscribe_sink_levels(pa_context *c, uint32_t idx, pa_usec_t interval, pa_context_success_cb_t cb, void *userdata) {
+    pa_tagstruct *t;
+    pa_operation *o;
+    uint32_t tag;
+
+    pa_assert(c);
+    pa_assert(PA_REFCNT_VALUE(c) >= 1);
+
+    PA_CHECK_VALIDITY_RETURN_NULL(c, !pa_detect_fork(), PA_ERR_FORKED);
+    PA_CHECK_VALIDITY_RETURN_NULL(c, c->state == PA_CONTEXT_READY, PA_ERR_BADSTATE);
+    PA_CHECK_VALIDITY_RETURN_NULL(c, idx != PA_INVALID_INDEX, PA_ERR_INVALID);
+    PA_CHECK_VALIDITY_RETURN_NULL(c, c->version >= 30, PA_ERR_NOTSUPPORTED);
+
+    o = pa_operation_new(c, NULL, (pa_operation_cb_t) cb, userdata);
+
+    t = pa_tagstruct_command(c, PA_COMMAND_SET_SINK_LEVELS_PUSH, &tag);
+    pa_tagstruct_putu32(t, idx);
+    pa_tagstruct_put_usec(t, interval);
+    pa_pstream_send_tagstruct(c->pstream, t);
+    pa_pdispatch_register_reply(c->pdispatch, tag, DEFAULT_TIMEOUT, pa_context_simple_ack_callback, pa_operation_ref(o), (pa_free_cb_t) pa_operation_unref);
+
+    return o;
+}
+
+void pa_context_set_sink_levels_callback(pa_context *c, pa_sink_levels_cb_t cb, void *userdata) {
+    pa_assert(c);
+    pa_assert(PA_REFCNT_VALUE(c) >= 1);
+
+    if (c->state == PA_CONTEXT_TERMINATED || c->state == PA_CONTEXT_FAILED)
+        return;
+
+    c->sink_levels_callback = cb;
+    c->sink_levels_userdata = userdata;
+}
+
+void pa_command_sink_levels(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    pa_context *c = userdata;
+    pa_sink_levels_info i;
+
+    pa_assert(pd);
+    pa_assert(command == PA_COMMAND_SINK_LEVELS);
+    pa_assert(t);
+    pa_assert(c);
+    pa_assert(PA_REFCNT_VALUE(c) >= 1);
+
+    pa_context_ref(c);
 
-            if (o->context->version >= 22) {
-                uint8_t n_formats;
-                if (pa_tagstruct_getu8(t, &n_formats) < 0 || n_formats < 1)
-                    goto fail;
+    pa_zero(i);
+
+    if (c->version < 30 || read_sink_levels(t, &i) < 0) {
+        pa_context_fail(c, PA_ERR_PROTOCOL);
+        goto finish;
+    }
+
+    if (c->sink_levels_callback)
+        c->sink_levels_callback(c, &i, c->sink_levels_userdata);
+
+finish:
+    pa_context_unref(c);
+}
 
-                i.formats = pa_xnew0(pa_format_info*, n_formats);
+/*** Source info ***/
+
+static void source_info_free(pa_source_info *i) {
+    uint32_t j;
+
+    if (i->formats) {
+        for (j = 0; j < i->n_formats; j++)
+            pa_format_info_free(i->formats[j]);
+        pa_xfree(i->formats);
+    }
+    if (i->ports) {
+        pa_xfree(i->ports[0]);
+        pa_xfree(i->ports);
+    }
+    if (i->proplist)
+        pa_proplist_free(i->proplist);
+}
 
-                for (j = 0; j < n_formats; j++) {
-                    i.n_formats++;
-                    i.formats[j] = pa_format_info_new();
+/* Reads one entry of a source info reply. Even on failure i needs to be freed
+ * with source_info_free() afterwards. */
+static int read_source_info(pa_context *c, pa_tagstruct *t, pa_source_info *i) {
+    pa_bool_t mute = FALSE;
+    uint32_t flags;
+    uint32_t state = PA_SOURCE_INVALID_STATE;
+    const char *ap = NULL;
+    uint32_t j;
 
-                    if (pa_tagstruct_get_format_info(t, i.formats[j]) < 0)
-                        goto fail;
+    pa_zero(*i);
+    i->proplist = pa_proplist_new();
+    i->base_volume = PA_VOLUME_NORM;
+    i->n_volume_steps = PA_VOLUME_NORM+1;
+    i->card = PA_INVALID_INDEX;
+
+    if (pa_tagstruct_getu32(t, &i->index) < 0 ||
+        pa_tagstruct_gets(t, &i->name) < 0 ||
+        pa_tagstruct_gets(t, &i->description) < 0 ||
+        pa_tagstruct_get_sample_spec(t, &i->sample_spec) < 0 ||
+        pa_tagstruct_get_channel_map(t, &i->channel_map) < 0 ||
+        pa_tagstruct_getu32(t, &i->owner_module) < 0 ||
+        pa_tagstruct_get_cvolume(t, &i->volume) < 0 ||
+        pa_tagstruct_get_boolean(t, &mute) < 0 ||
+        pa_tagstruct_getu32(t, &i->monitor_of_sink) < 0 ||
+        pa_tagstruct_gets(t, &i->monitor_of_sink_name) < 0 ||
+        pa_tagstruct_get_usec(t, &i->latency) < 0 ||
+        pa_tagstruct_gets(t, &i->driver) < 0 ||
+        pa_tagstruct_getu32(t, &flags) < 0 ||
+        (c->version >= 13 &&
+         (pa_tagstruct_get_proplist(t, i->proplist) < 0 ||
+          pa_tagstruct_get_usec(t, &i->configured_latency) < 0)) ||
+        (c->version >= 15 &&
+         (pa_tagstruct_get_volume(t, &i->base_volume) < 0 ||
+          pa_tagstruct_getu32(t, &state) < 0 ||
+          pa_tagstruct_getu32(t, &i->n_volume_steps) < 0 ||
+          pa_tagstruct_getu32(t, &i->card) < 0)) ||
+        (c->version >= 16 &&
+         (pa_tagstruct_getu32(t, &i->n_ports))))
+        return -1;
+
+    if (c->version >= 16) {
+        if (i->n_ports > 0) {
+            i->ports = pa_xnew(pa_source_port_info*, i->n_ports+1);
+            i->ports[0] = pa_xnew(pa_source_port_info, i->n_ports);
+
+            for (j = 0; j < i->n_ports; j++) {
+                i->ports[j] = &i->ports[0][j];
+
+                if (pa_tagstruct_gets(t, &i->ports[j]->name) < 0 ||
+                    pa_tagstruct_gets(t, &i->ports[j]->description) < 0 ||
+                    pa_tagstruct_getu32(t, &i->ports[j]->priority) < 0)
+                    return -1;
+
+                i->ports[j]->available = PA_PORT_AVAILABLE_UNKNOWN;
+                if (c->version >= 24) {
+                    uint32_t av;
+                    if (pa_tagstruct_getu32(t, &av) < 0 || av > PA_PORT_AVAILABLE_YES)
+                        return -1;
+                    i->ports[j]->available = av;
                 }
             }
 
-            i.mute = (int) mute;
-            i.flags = (pa_source_flags_t) flags;
-            i.state = (pa_source_state_t) state;
+            i->ports[j] = NULL;
+        }
+
+        if (pa_tagstruct_gets(t, &ap) < 0)
+            return -1;
+
+        if (ap) {
+            for (j = 0; j < i->n_ports; j++)
+                if (pa_streq(i->ports[j]->name, ap)) {
+                    i->active_port = i->ports[j];
+                    break;
+                }
+        }
+    }
+
+    if (c->version >= 22) {
+        uint8_t n_formats;
+        if (pa_tagstruct_getu8(t, &n_formats) < 0 || n_formats < 1)
+            return -1;
+
+        i->formats = pa_xnew0(pa_format_info*, n_formats);
+
+        for (j = 0; j < n_formats; j++) {
+            i->n_formats++;
+            i->formats[j] = pa_format_info_new();
+
+            if (pa_tagstruct_get_format_info(t, i->formats[j]) < 0)
+                return -1;
+        }
+    }
+
+    i->mute = (int) mute;
+    i->flags = (pa_source_flags_t) flags;
+    i->state = (pa_source_state_t) state;
+
+    return 0;
+}
+
+static void context_get_source_info_callback(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    pa_operation *o = userdata;
+    int eol = 1;
+
+    pa_assert(pd);
+    pa_assert(o);
+    pa_assert(PA_REFCNT_VALUE(o) >= 1);
+
+    if (!o->context)
+        goto finish;
+
+    if (command != PA_COMMAND_REPLY) {
+        if (pa_context_handle_error(o->context, command, t, FALSE) < 0)
+            goto finish;
+
+        eol = -1;
+    } else {
+
+        while (!pa_tagstruct_eof(t)) {
+            pa_source_info i;
+
+            if (read_source_info(o->context, t, &i) < 0) {
+                pa_context_fail(o->context, PA_ERR_PROTOCOL);
+                source_info_free(&i);
+                goto finish;
+            }
 
             if (o->callback) {
                 pa_source_info_cb_t cb = (pa_source_info_cb_t) o->callback;
                 cb(o->context, &i, 0, o->userdata);
             }
 
-            if (i.formats) {
-                for (j = 0; j < i.n_formats; j++)
-                    pa_format_info_free(i.formats[j]);
-                pa_xfree(i.formats);
-            }
-            if (i.ports) {
-                pa_xfree(i.ports[0]);
-                pa_xfree(i.ports);
-            }
-            pa_proplist_free(i.proplist);
+            source_info_free(&i);
         }
     }
 
@@ -556,25 +725,6 @@ static void context_get_source_info_callback(pa_pdispatch *pd, uint32_t command,
 finish:
     pa_operation_done(o);
     pa_operation_unref(o);
-    return;
-
-fail:
-    pa_assert(i.proplist);
-
-    pa_context_fail(o->context, PA_ERR_PROTOCOL);
-
-    if (i.formats) {
-        for (j = 0; j < i.n_formats; j++)
-            pa_format_info_free(i.formats[j]);
-        pa_xfree(i.formats);
-    }
-    if (i.ports) {
-        pa_xfree(i.ports[0]);
-        pa_xfree(i.ports);
-    }
-    pa_proplist_free(i.proplist);
-
-    goto finish;
 }
 
 pa_operation* pa_context_get_source_info_list(pa_context *c, pa_source_info_cb_t cb, void *userdata) {
@@ -680,6 +830,25 @@ pa_operation* pa_context_set_source_port_by_name(pa_context *c, const char *name
 
 /*** Client info ***/
 
+static void client_info_free(pa_client_info *i) {
+    if (i->proplist)
+        pa_proplist_free(i->proplist);
+}
+
+static int read_client_info(pa_context *c, pa_tagstruct *t, pa_client_info *i) {
+    pa_zero(*i);
+    i->proplist = pa_proplist_new();
+
+    if (pa_tagstruct_getu32(t, &i->index) < 0 ||
+        pa_tagstruct_gets(t, &i->name) < 0 ||
+        pa_tagstruct_getu32(t, &i->owner_module) < 0 ||
+        pa_tagstruct_gets(t, &i->driver) < 0 ||
+        (c->version >= 13 && pa_tagstruct_get_proplist(t, i->proplist) < 0))
+        return -1;
+
+    return 0;
+}
+
 static void context_get_client_info_callback(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
     pa_operation *o = userdata;
     int eol = 1;
@@ -701,17 +870,9 @@ static void context_get_client_info_callback(pa_pdispatch *pd, uint32_t command,
         while (!pa_tagstruct_eof(t)) {
             pa_client_info i;
 
-            pa_zero(i);
-            i.proplist = pa_proplist_new();
-
-            if (pa_tagstruct_getu32(t, &i.index) < 0 ||
-                pa_tagstruct_gets(t, &i.name) < 0 ||
-                pa_tagstruct_getu32(t, &i.owner_module) < 0 ||
-                pa_tagstruct_gets(t, &i.driver) < 0 ||
-                (o->context->version >= 13 && pa_tagstruct_get_proplist(t, i.proplist) < 0)) {
-
+            if (read_client_info(o->context, t, &i) < 0) {
                 pa_context_fail(o->context, PA_ERR_PROTOCOL);
-                pa_proplist_free(i.proplist);
+                client_info_free(&i);
                 goto finish;
             }
 
@@ -720,7 +881,7 @@ static void context_get_client_info_callback(pa_pdispatch *pd, uint32_t command,
                 cb(o->context, &i, 0, o->userdata);
             }
 
-            pa_proplist_free(i.proplist);
+            client_info_free(&i);
         }
     }
 
@@ -857,90 +1018,85 @@ static int fill_card_port_info(pa_context *context, pa_tagstruct* t, pa_card_inf
     return 0;
 }
 
-static void context_get_card_info_callback(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
-    pa_operation *o = userdata;
-    int eol = 1;
-    pa_card_info i;
+static int read_card_info(pa_context *c, pa_tagstruct *t, pa_card_info *i) {
+    uint32_t j;
+    const char*ap;
 
-    pa_assert(pd);
-    pa_assert(o);
-    pa_assert(PA_REFCNT_VALUE(o) >= 1);
+    pa_zero(*i);
 
-    if (!o->context)
-        goto finish;
+    if (pa_tagstruct_getu32(t, &i->index) < 0 ||
+        pa_tagstruct_gets(t, &i->name) < 0 ||
+        pa_tagstruct_getu32(t, &i->owner_module) < 0 ||
+        pa_tagstruct_gets(t, &i->driver) < 0 ||
+        pa_tagstruct_getu32(t, &i->n_profiles) < 0)
+        return -1;
 
-    if (command != PA_COMMAND_REPLY) {
-        if (pa_context_handle_error(o->context, command, t, FALSE) < 0)
-            goto finish;
+    if (i->n_profiles > 0) {
+        i->profiles = pa_xnew0(pa_card_profile_info, i->n_profiles+1);
 
-        eol = -1;
-    } else {
+        for (j = 0; j < i->n_profiles; j++) {
 
-        while (!pa_tagstruct_eof(t)) {
-            uint32_t j;
-            const char*ap;
+            if (pa_tagstruct_gets(t, &i->profiles[j].name) < 0 ||
+                pa_tagstruct_gets(t, &i->profiles[j].description) < 0 ||
+                pa_tagstruct_getu32(t, &i->profiles[j].n_sinks) < 0 ||
+                pa_tagstruct_getu32(t, &i->profiles[j].n_sources) < 0 ||
+                pa_tagstruct_getu32(t, &i->profiles[j].priority) < 0)
+                return -1;
+        }
 
-            pa_zero(i);
+        /* Terminate with an extra NULL entry, just to make sure */
+        i->profiles[j].name = NULL;
+        i->profiles[j].description = NULL;
+    }
 
-            if (pa_tagstruct_getu32(t, &i.index) < 0 ||
-                pa_tagstruct_gets(t, &i.name) < 0 ||
-                pa_tagstruct_getu32(t, &i.owner_module) < 0 ||
-                pa_tagstruct_gets(t, &i.driver) < 0 ||
-                pa_tagstruct_getu32(t, &i.n_profiles) < 0) {
+    i->proplist = pa_proplist_new();
 
-                pa_context_fail(o->context, PA_ERR_PROTOCOL);
-                card_info_free(&i);
-                goto finish;
+    if (pa_tagstruct_gets(t, &ap) < 0 ||
+        pa_tagstruct_get_proplist(t, i->proplist) < 0)
+        return -1;
+
+    if (ap) {
+        for (j = 0; j < i->n_profiles; j++)
+            if (pa_streq(i->profiles[j].name, ap)) {
+                i->active_profile = &i->profiles[j];
+                break;
             }
+    }
 
-            if (i.n_profiles > 0) {
-                i.profiles = pa_xnew0(pa_card_profile_info, i.n_profiles+1);
+    if (c->version >= 26)
+        if (fill_card_port_info(c, t, i) < 0)
+            return -1;
 
-                for (j = 0; j < i.n_profiles; j++) {
+    return 0;
+}
+
+static void context_get_card_info_callback(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    pa_operation *o = userdata;
+    int eol = 1;
 
-                    if (pa_tagstruct_gets(t, &i.profiles[j].name) < 0 ||
-                        pa_tagstruct_gets(t, &i.profiles[j].description) < 0 ||
-                        pa_tagstruct_getu32(t, &i.profiles[j].n_sinks) < 0 ||
-                        pa_tagstruct_getu32(t, &i.profiles[j].n_sources) < 0 ||
-                        pa_tagstruct_getu32(t, &i.profiles[j].priority) < 0) {
+    pa_assert(pd);
+    pa_assert(o);
+    pa_assert(PA_REFCNT_VALUE(o) >= 1);
 
-                        pa_context_fail(o->context, PA_ERR_PROTOCOL);
-                        card_info_free(&i);
-                        goto finish;
-                    }
-                }
+    if (!o->context)
+        goto finish;
 
-                /* Terminate with an extra NULL entry, just to make sure */
-                i.profiles[j].name = NULL;
-                i.profiles[j].description = NULL;
-            }
+    if (command != PA_COMMAND_REPLY) {
+        if (pa_context_handle_error(o->context, command, t, FALSE) < 0)
+            goto finish;
 
-            i.proplist = pa_proplist_new();
+        eol = -1;
+    } else {
 
-            if (pa_tagstruct_gets(t, &ap) < 0 ||
-                pa_tagstruct_get_proplist(t, i.proplist) < 0) {
+        while (!pa_tagstruct_eof(t)) {
+            pa_card_info i;
 
+            if (read_card_info(o->context, t, &i) < 0) {
                 pa_context_fail(o->context, PA_ERR_PROTOCOL);
                 card_info_free(&i);
                 goto finish;
             }
 
-            if (ap) {
-                for (j = 0; j < i.n_profiles; j++)
-                    if (pa_streq(i.profiles[j].name, ap)) {
-                        i.active_profile = &i.profiles[j];
-                        break;
-                    }
-            }
-
-            if (o->context->version >= 26) {
-                if (fill_card_port_info(o->context, t, &i) < 0) {
-                    pa_context_fail(o->context, PA_ERR_PROTOCOL);
-                    card_info_free(&i);
-                    goto finish;
-                }
-            }
-
             if (o->callback) {
                 pa_card_info_cb_t cb = (pa_card_info_cb_t) o->callback;
                 cb(o->context, &i, 0, o->userdata);
@@ -1068,6 +1224,30 @@ pa_operation* pa_context_set_card_profile_by_name(pa_context *c, const char *nam
 
 /*** Module info ***/
 
+static void module_info_free(pa_module_info *i) {
+    if (i->proplist)
+        pa_proplist_free(i->proplist);
+}
+
+static int read_module_info(pa_context *c, pa_tagstruct *t, pa_module_info *i) {
+    pa_bool_t auto_unload = FALSE;
+
+    pa_zero(*i);
+    i->proplist = pa_proplist_new();
+
+    if (pa_tagstruct_getu32(t, &i->index) < 0 ||
+        pa_tagstruct_gets(t, &i->name) < 0 ||
+        pa_tagstruct_gets(t, &i->argument) < 0 ||
+        pa_tagstruct_getu32(t, &i->n_used) < 0 ||
+        (c->version < 15 && pa_tagstruct_get_boolean(t, &auto_unload) < 0) ||
+        (c->version >= 15 && pa_tagstruct_get_proplist(t, i->proplist) < 0))
+        return -1;
+
+    i->auto_unload = (int) auto_unload;
+
+    return 0;
+}
+
 static void context_get_module_info_callback(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
     pa_operation *o = userdata;
     int eol = 1;
@@ -1088,29 +1268,19 @@ static void context_get_module_info_callback(pa_pdispatch *pd, uint32_t command,
 
         while (!pa_tagstruct_eof(t)) {
             pa_module_info i;
-            pa_bool_t auto_unload = FALSE;
-
-            pa_zero(i);
-            i.proplist = pa_proplist_new();
 
-            if (pa_tagstruct_getu32(t, &i.index) < 0 ||
-                pa_tagstruct_gets(t, &i.name) < 0 ||
-                pa_tagstruct_gets(t, &i.argument) < 0 ||
-                pa_tagstruct_getu32(t, &i.n_used) < 0 ||
-                (o->context->version < 15 && pa_tagstruct_get_boolean(t, &auto_unload) < 0) ||
-                (o->context->version >= 15 && pa_tagstruct_get_proplist(t, i.proplist) < 0)) {
+            if (read_module_info(o->context, t, &i) < 0) {
                 pa_context_fail(o->context, PA_ERR_PROTOCOL);
+                module_info_free(&i);
                 goto finish;
             }
 
-            i.auto_unload = (int) auto_unload;
-
             if (o->callback) {
                 pa_module_info_cb_t cb = (pa_module_info_cb_t) o->callback;
                 cb(o->context, &i, 0, o->userdata);
             }
 
-            pa_proplist_free(i.proplist);
+            module_info_free(&i);
         }
     }
 
@@ -1153,6 +1323,48 @@ pa_operation* pa_context_get_module_info_list(pa_context *c, pa_module_info_cb_t
 
 /*** Sink input info ***/
 
+static void sink_input_info_free(pa_sink_input_info *i) {
+    if (i->proplist)
+        pa_proplist_free(i->proplist);
+    if (i->format)
+        pa_format_info_free(i->format);
+}
+
+static int read_sink_input_info(pa_context *c, pa_tagstruct *t, pa_sink_input_info *i) {
+    pa_bool_t mute = FALSE, corked = FALSE, has_volume = FALSE, volume_writable = TRUE;
+
+    pa_zero(*i);
+    i->proplist = pa_proplist_new();
+    i->format = pa_format_info_new();
+
+    if (pa_tagstruct_getu32(t, &i->index) < 0 ||
+        pa_tagstruct_gets(t, &i->name) < 0 ||
+        pa_tagstruct_getu32(t, &i->owner_module) < 0 ||
+        pa_tagstruct_getu32(t, &i->client) < 0 ||
+        pa_tagstruct_getu32(t, &i->sink) < 0 ||
+        pa_tagstruct_get_sample_spec(t, &i->sample_spec) < 0 ||
+        pa_tagstruct_get_channel_map(t, &i->channel_map) < 0 ||
+        pa_tagstruct_get_cvolume(t, &i->volume) < 0 ||
+        pa_tagstruct_get_usec(t, &i->buffer_usec) < 0 ||
+        pa_tagstruct_get_usec(t, &i->sink_usec) < 0 ||
+        pa_tagstruct_gets(t, &i->resample_method) < 0 ||
+        pa_tagstruct_gets(t, &i->driver) < 0 ||
+        (c->version >= 11 && pa_tagstruct_get_boolean(t, &mute) < 0) ||
+        (c->version >= 13 && pa_tagstruct_get_proplist(t, i->proplist) < 0) ||
+        (c->version >= 19 && pa_tagstruct_get_boolean(t, &corked) < 0) ||
+        (c->version >= 20 && (pa_tagstruct_get_boolean(t, &has_volume) < 0 ||
+                              pa_tagstruct_get_boolean(t, &volume_writable) < 0)) ||
+        (c->version >= 21 && pa_tagstruct_get_format_info(t, i->format) < 0))
+        return -1;
+
+    i->mute = (int) mute;
+    i->corked = (int) corked;
+    i->has_volume = (int) has_volume;
+    i->volume_writable = (int) volume_writable;
+
+    return 0;
+}
+
 static void context_get_sink_input_info_callback(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
     pa_operation *o = userdata;
     int eol = 1;
@@ -1173,49 +1385,19 @@ static void context_get_sink_input_info_callback(pa_pdispatch *pd, uint32_t comm
 
         while (!pa_tagstruct_eof(t)) {
             pa_sink_input_info i;
-            pa_bool_t mute = FALSE, corked = FALSE, has_volume = FALSE, volume_writable = TRUE;
-
-            pa_zero(i);
-            i.proplist = pa_proplist_new();
-            i.format = pa_format_info_new();
-
-            if (pa_tagstruct_getu32(t, &i.index) < 0 ||
-                pa_tagstruct_gets(t, &i.name) < 0 ||
-                pa_tagstruct_getu32(t, &i.owner_module) < 0 ||
-                pa_tagstruct_getu32(t, &i.client) < 0 ||
-                pa_tagstruct_getu32(t, &i.sink) < 0 ||
-                pa_tagstruct_get_sample_spec(t, &i.sample_spec) < 0 ||
-                pa_tagstruct_get_channel_map(t, &i.channel_map) < 0 ||
-                pa_tagstruct_get_cvolume(t, &i.volume) < 0 ||
-                pa_tagstruct_get_usec(t, &i.buffer_usec) < 0 ||
-                pa_tagstruct_get_usec(t, &i.sink_usec) < 0 ||
-                pa_tagstruct_gets(t, &i.resample_method) < 0 ||
-                pa_tagstruct_gets(t, &i.driver) < 0 ||
-                (o->context->version >= 11 && pa_tagstruct_get_boolean(t, &mute) < 0) ||
-                (o->context->version >= 13 && pa_tagstruct_get_proplist(t, i.proplist) < 0) ||
-                (o->context->version >= 19 && pa_tagstruct_get_boolean(t, &corked) < 0) ||
-                (o->context->version >= 20 && (pa_tagstruct_get_boolean(t, &has_volume) < 0 ||
-                                               pa_tagstruct_get_boolean(t, &volume_writable) < 0)) ||
-                (o->context->version >= 21 && pa_tagstruct_get_format_info(t, i.format) < 0)) {
 
+            if (read_sink_input_info(o->context, t, &i) < 0) {
                 pa_context_fail(o->context, PA_ERR_PROTOCOL);
-                pa_proplist_free(i.proplist);
-                pa_format_info_free(i.format);
+                sink_input_info_free(&i);
                 goto finish;
             }
 
-            i.mute = (int) mute;
-            i.corked = (int) corked;
-            i.has_volume = (int) has_volume;
-            i.volume_writable = (int) volume_writable;
-
             if (o->callback) {
                 pa_sink_input_info_cb_t cb = (pa_sink_input_info_cb_t) o->callback;
                 cb(o->context, &i, 0, o->userdata);
             }
 
-            pa_proplist_free(i.proplist);
-            pa_format_info_free(i.format);
+            sink_input_info_free(&i);
         }
     }
 
@@ -1258,6 +1440,48 @@ pa_operation* pa_context_get_sink_input_info_list(pa_context *c, void (*cb)(pa_c
 
 /*** Source output info ***/
 
+static void source_output_info_free(pa_source_output_info *i) {
+    if (i->proplist)
+        pa_proplist_free(i->proplist);
+    if (i->format)
+        pa_format_info_free(i->format);
+}
+
+static int read_source_output_info(pa_context *c, pa_tagstruct *t, pa_source_output_info *i) {
+    pa_bool_t mute = FALSE, corked = FALSE, has_volume = FALSE, volume_writable = TRUE;
+
+    pa_zero(*i);
+    i->proplist = pa_proplist_new();
+    i->format = pa_format_info_new();
+
+    if (pa_tagstruct_getu32(t, &i->index) < 0 ||
+        pa_tagstruct_gets(t, &i->name) < 0 ||
+        pa_tagstruct_getu32(t, &i->owner_module) < 0 ||
+        pa_tagstruct_getu32(t, &i->client) < 0 ||
+        pa_tagstruct_getu32(t, &i->source) < 0 ||
+        pa_tagstruct_get_sample_spec(t, &i->sample_spec) < 0 ||
+        pa_tagstruct_get_channel_map(t, &i->channel_map) < 0 ||
+        pa_tagstruct_get_usec(t, &i->buffer_usec) < 0 ||
+        pa_tagstruct_get_usec(t, &i->source_usec) < 0 ||
+        pa_tagstruct_gets(t, &i->resample_method) < 0 ||
+        pa_tagstruct_gets(t, &i->driver) < 0 ||
+        (c->version >= 13 && pa_tagstruct_get_proplist(t, i->proplist) < 0) ||
+        (c->version >= 19 && pa_tagstruct_get_boolean(t, &corked) < 0) ||
+        (c->version >= 22 && (pa_tagstruct_get_cvolume(t, &i->volume) < 0 ||
+                              pa_tagstruct_get_boolean(t, &mute) < 0 ||
+                              pa_tagstruct_get_boolean(t, &has_volume) < 0 ||
+                              pa_tagstruct_get_boolean(t, &volume_writable) < 0 ||
+                              pa_tagstruct_get_format_info(t, i->format) < 0)))
+        return -1;
+
+    i->mute = (int) mute;
+    i->corked = (int) corked;
+    i->has_volume = (int) has_volume;
+    i->volume_writable = (int) volume_writable;
+
+    return 0;
+}
+
 static void context_get_source_output_info_callback(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
     pa_operation *o = userdata;
     int eol = 1;
@@ -1278,49 +1502,19 @@ static void context_get_source_output_info_callback(pa_pdispatch *pd, uint32_t c
 
         while (!pa_tagstruct_eof(t)) {
             pa_source_output_info i;
-            pa_bool_t mute = FALSE, corked = FALSE, has_volume = FALSE, volume_writable = TRUE;
-
-            pa_zero(i);
-            i.proplist = pa_proplist_new();
-            i.format = pa_format_info_new();
-
-            if (pa_tagstruct_getu32(t, &i.index) < 0 ||
-                pa_tagstruct_gets(t, &i.name) < 0 ||
-                pa_tagstruct_getu32(t, &i.owner_module) < 0 ||
-                pa_tagstruct_getu32(t, &i.client) < 0 ||
-                pa_tagstruct_getu32(t, &i.source) < 0 ||
-                pa_tagstruct_get_sample_spec(t, &i.sample_spec) < 0 ||
-                pa_tagstruct_get_channel_map(t, &i.channel_map) < 0 ||
-                pa_tagstruct_get_usec(t, &i.buffer_usec) < 0 ||
-                pa_tagstruct_get_usec(t, &i.source_usec) < 0 ||
-                pa_tagstruct_gets(t, &i.resample_method) < 0 ||
-                pa_tagstruct_gets(t, &i.driver) < 0 ||
-                (o->context->version >= 13 && pa_tagstruct_get_proplist(t, i.proplist) < 0) ||
-                (o->context->version >= 19 && pa_tagstruct_get_boolean(t, &corked) < 0) ||
-                (o->context->version >= 22 && (pa_tagstruct_get_cvolume(t, &i.volume) < 0 ||
-                                               pa_tagstruct_get_boolean(t, &mute) < 0 ||
-                                               pa_tagstruct_get_boolean(t, &has_volume) < 0 ||
-                                               pa_tagstruct_get_boolean(t, &volume_writable) < 0 ||
-                                               pa_tagstruct_get_format_info(t, i.format) < 0))) {
 
+            if (read_source_output_info(o->context, t, &i) < 0) {
                 pa_context_fail(o->context, PA_ERR_PROTOCOL);
-                pa_proplist_free(i.proplist);
-                pa_format_info_free(i.format);
+                source_output_info_free(&i);
                 goto finish;
             }
 
-            i.mute = (int) mute;
-            i.corked = (int) corked;
-            i.has_volume = (int) has_volume;
-            i.volume_writable = (int) volume_writable;
-
             if (o->callback) {
                 pa_source_output_info_cb_t cb = (pa_source_output_info_cb_t) o->callback;
                 cb(o->context, &i, 0, o->userdata);
             }
 
-            pa_proplist_free(i.proplist);
-            pa_format_info_free(i.format);
+            source_output_info_free(&i);
         }
     }
 
@@ -1664,6 +1858,34 @@ pa_operation* pa_context_set_source_output_mute(pa_context *c, uint32_t idx, int
 
 /** Sample Cache **/
 
+static void sample_info_free(pa_sample_info *i) {
+    if (i->proplist)
+        pa_proplist_free(i->proplist);
+}
+
+static int read_sample_info(pa_context *c, pa_tagstruct *t, pa_sample_info *i) {
+    pa_bool_t lazy = FALSE;
+
+    pa_zero(*i);
+    i->proplist = pa_proplist_new();
+
+    if (pa_tagstruct_getu32(t, &i->index) < 0 ||
+        pa_tagstruct_gets(t, &i->name) < 0 ||
+        pa_tagstruct_get_cvolume(t, &i->volume) < 0 ||
+        pa_tagstruct_get_usec(t, &i->duration) < 0 ||
+        pa_tagstruct_get_sample_spec(t, &i->sample_spec) < 0 ||
+        pa_tagstruct_get_channel_map(t, &i->channel_map) < 0 ||
+        pa_tagstruct_getu32(t, &i->bytes) < 0 ||
+        pa_tagstruct_get_boolean(t, &lazy) < 0 ||
+        pa_tagstruct_gets(t, &i->filename) < 0 ||
+        (c->version >= 13 && pa_tagstruct_get_proplist(t, i->proplist) < 0))
+        return -1;
+
+    i->lazy = (int) lazy;
+
+    return 0;
+}
+
 static void context_get_sample_info_callback(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
     pa_operation *o = userdata;
     int eol = 1;
@@ -1684,34 +1906,19 @@ static void context_get_sample_info_callback(pa_pdispatch *pd, uint32_t command,
 
         while (!pa_tagstruct_eof(t)) {
             pa_sample_info i;
-            pa_bool_t lazy = FALSE;
-
-            pa_zero(i);
-            i.proplist = pa_proplist_new();
-
-            if (pa_tagstruct_getu32(t, &i.index) < 0 ||
-                pa_tagstruct_gets(t, &i.name) < 0 ||
-                pa_tagstruct_get_cvolume(t, &i.volume) < 0 ||
-                pa_tagstruct_get_usec(t, &i.duration) < 0 ||
-                pa_tagstruct_get_sample_spec(t, &i.sample_spec) < 0 ||
-                pa_tagstruct_get_channel_map(t, &i.channel_map) < 0 ||
-                pa_tagstruct_getu32(t, &i.bytes) < 0 ||
-                pa_tagstruct_get_boolean(t, &lazy) < 0 ||
-                pa_tagstruct_gets(t, &i.filename) < 0 ||
-                (o->context->version >= 13 && pa_tagstruct_get_proplist(t, i.proplist) < 0)) {
 
+            if (read_sample_info(o->context, t, &i) < 0) {
                 pa_context_fail(o->context, PA_ERR_PROTOCOL);
+                sample_info_free(&i);
                 goto finish;
             }
 
-            i.lazy = (int) lazy;
-
             if (o->callback) {
                 pa_sample_info_cb_t cb = (pa_sample_info_cb_t) o->callback;
                 cb(o->context, &i, 0, o->userdata);
             }
 
-            pa_proplist_free(i.proplist);
+            sample_info_free(&i);
         }
     }
 
@@ -1897,6 +2104,611 @@ pa_operation* pa_context_set_port_latency_offset(pa_context *c, const char *card
     return o;
 }
 
+/*** Server snapshot ***/
+
+typedef int (*read_info_cb_t)(pa_context *c, pa_tagstruct *t, void *i);
+typedef void (*free_info_cb_t)(void *i);
+
+/* Reads one section of a snapshot reply: the number of entries, followed
+ * by the entries in the same format as in the list replies */
+static int read_info_array(pa_context *c, pa_tagstruct *t, size_t size, read_info_cb_t read_cb, free_info_cb_t free_cb, void **array, uint32_t *n) {
+    uint32_t count, allocated = 0;
+
+    if (pa_tagstruct_getu32(t, &count) < 0)
+        return -1;
+
+    while (*n < count) {
+        uint8_t *i;
+
+        /* Don't trust the count for allocating, grow as we go */
+        if (*n >= allocated) {
+            allocated = PA_MAX(16U, allocated * 2);
+            *array = pa_xrealloc(*array, allocated * size);
+        }
+
+        i = (uint8_t*) *array + *n * size;
+
+        if (read_cb(c, t, i) < 0) {
+            free_cb(i);
+            return -1;
+        }
+
+        (*n)++;
+    }
+
+    return 0;
+}
+
+static void free_info_array(const void *array, size_t size, uint32_t n, free_info_cb_t free_cb) {
+    uint32_t j;
+
+    for (j = 0; j < n; j++)
+        free_cb((uint8_t*) array + j * size);
+
+    pa_xfree((void*) array);
+}
+
+#define READ_INFO_ARRAY(c, t, type, array, n)                           \
+    read_info_array(c, t, sizeof(pa_##type##_info),                     \
+                    (read_info_cb_t) read_##type##_info,                \
+                    (free_info_cb_t) type##_info_free,                  \
+                    (void**) &(array), &(n))
+
+#define FREE_INFO_ARRAY(type, array, n)                                 \
+    free_info_array(array, sizeof(pa_##type##_info), n, (free_info_cb_t) type##_info_free)
+
+static void context_get_server_snapshot_callback(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    pa_operation *o = userdata;
+    pa_server_snapshot s, *p = &s;
+    pa_server_info server;
+
+    pa_assert(pd);
+    pa_assert(o);
+    pa_assert(PA_REFCNT_VALUE(o) >= 1);
+
+    pa_zero(s);
+
+    if (!o->context)
+        goto finish;
+
+    if (command != PA_COMMAND_REPLY) {
+        if (pa_context_handle_error(o->context, command, t, FALSE) < 0)
+            goto finish;
+
+        p = NULL;
+    } else if (read_server_info(o->context, t, &server) < 0 ||
+               READ_INFO_ARRAY(o->context, t, sink, s.sinks, s.n_sinks) < 0 ||
+               READ_INFO_ARRAY(o->context, t, source, s.sources, s.n_sources) < 0 ||
+               READ_INFO_ARRAY(o->context, t, sink_input, s.sink_inputs, s.n_sink_inputs) < 0 ||
+               READ_INFO_ARRAY(o->context, t, source_output, s.source_outputs, s.n_source_outputs) < 0 ||
+               READ_INFO_ARRAY(o->context, t, client, s.clients, s.n_clients) < 0 ||
+               READ_INFO_ARRAY(o->context, t, module, s.modules, s.n_modules) < 0 ||
+               READ_INFO_ARRAY(o->context, t, card, s.cards, s.n_cards) < 0 ||
+               READ_INFO_ARRAY(o->context, t, sample, s.samples, s.n_samples) < 0 ||
+               !pa_tagstruct_eof(t)) {
+
+        pa_context_fail(o->context, PA_ERR_PROTOCOL);
+        goto finish;
+    }
+
+    s.server = &server;
+
+    if (o->callback) {
+        pa_server_snapshot_cb_t cb = (pa_server_snapshot_cb_t) o->callback;
+        cb(o->context, p, o->userdata);
+    }
+
+finish:
+    FREE_INFO_ARRAY(sink, s.sinks, s.n_sinks);
+    FREE_INFO_ARRAY(source, s.sources, s.n_sources);
+    FREE_INFO_ARRAY(sink_input, s.sink_inputs, s.n_sink_inputs);
+    FREE_INFO_ARRAY(source_output, s.source_outputs, s.n_source_outputs);
+    FREE_INFO_ARRAY(client, s.clients, s.n_clients);
+    FREE_INFO_ARRAY(module, s.modules, s.n_modules);
+    FREE_INFO_ARRAY(card, s.cards, s.n_cards);
+    FREE_INFO_ARRAY(sample, s.samples, s.n_samples);
+
+    pa_operation_done(o);
+    pa_operation_unref(o);
+}
+
+pa_operation* pa_context_get_server_snapshot(pa_context *c, pa_server_snapshot_cb_t cb, void *userdata) {
+    pa_assert(c);
+    pa_assert(PA_REFCNT_VALUE(c) >= 1);
+
+    PA_CHECK_VALIDITY_RETURN_NULL(c, c->version >= 30, PA_ERR_NOTSUPPORTED);
+
+    return pa_context_send_simple_command(c, PA_COMMAND_GET_SERVER_SNAPSHOT, context_get_server_snapshot_callback, (pa_operation_cb_t) cb, userdata);
+}
+
+/*** Object cache ***/
+
+enum {
+    CACHE_SINK,
+    CACHE_SOURCE,
+    CACHE_SINK_INPUT,
+    CACHE_SOURCE_OUTPUT,
+    CACHE_CARD,
+    CACHE_MAX
+};
+
+typedef void (*info_cb_t)(pa_context *c, const void *i, int eol, void *userdata);
+
+struct cache_type {
+    pa_subscription_event_type_t facility;
+    uint32_t command;
+    pa_bool_t by_name;
+    size_t size;
+    size_t index_offset;
+    size_t name_offset;
+    read_info_cb_t read_cb;
+    free_info_cb_t free_cb;
+};
+
+#define CACHE_TYPE(f, cmd, by_name, type)                               \
+    { PA_SUBSCRIPTION_EVENT_##f, PA_COMMAND_##cmd, by_name,             \
+      sizeof(pa_##type##_info),                                         \
+      offsetof(pa_##type##_info, index),                                \
+      offsetof(pa_##type##_info, name),                                 \
+      (read_info_cb_t) read_##type##_info,                              \
+      (free_info_cb_t) type##_info_free }
+
+static const struct cache_type cache_types[CACHE_MAX] = {
+    [CACHE_SINK] = CACHE_TYPE(SINK, GET_SINK_INFO, TRUE, sink),
+    [CACHE_SOURCE] = CACHE_TYPE(SOURCE, GET_SOURCE_INFO, TRUE, source),
+    [CACHE_SINK_INPUT] = CACHE_TYPE(SINK_INPUT, GET_SINK_INPUT_INFO, FALSE, sink_input),
+    [CACHE_SOURCE_OUTPUT] = CACHE_TYPE(SOURCE_OUTPUT, GET_SOURCE_OUTPUT_INFO, FALSE, source_output),
+    [CACHE_CARD] = CACHE_TYPE(CARD, GET_CARD_INFO, TRUE, card),
+};
+
+/* The strings of the info point into the packet, which holds a copy of
+ * the serialized entry */
+struct cache_entry {
+    pa_packet *packet;
+    unsigned type;
+    void *info;
+};
+
+/* Per pending info request: one that arrived while the request was
+ * underway needs another one */
+#define REQUEST_PENDING PA_UINT_TO_PTR(1)
+#define REQUEST_DIRTY PA_UINT_TO_PTR(2)
+
+struct cache_request {
+    pa_context *context;
+    unsigned type;
+    uint32_t index;
+};
+
+struct pa_context_cache {
+    pa_bool_t ready;
+    pa_hashmap *entries[CACHE_MAX];
+    pa_hashmap *requests[CACHE_MAX];
+};
+
+#define INFO_INDEX(type, i) (*(uint32_t*) ((uint8_t*) (i) + cache_types[type].index_offset))
+#define INFO_NAME(type, i) (*(const char**) ((uint8_t*) (i) + cache_types[type].name_offset))
+
+static void cache_entry_free(struct cache_entry *e) {
+    pa_assert(e);
+
+    cache_types[e->type].free_cb(e->info);
+    pa_xfree(e->info);
+    pa_packet_unref(e->packet);
+    pa_xfree(e);
+}
+
+/* Reads one entry and keeps a copy of it. The entry is parsed twice,
+ * once to find out how long it is, and once again from the copy. */
+static struct cache_entry* cache_entry_read(pa_context *c, unsigned type, pa_tagstruct *t) {
+    const struct cache_type *ct = &cache_types[type];
+    struct cache_entry *e;
+    pa_tagstruct *copy;
+    const uint8_t *d;
+    size_t start, l;
+    int r;
+
+    start = pa_tagstruct_get_read_index(t);
+
+    e = pa_xnew0(struct cache_entry, 1);
+    e->type = type;
+    e->info = pa_xmalloc0(ct->size);
+
+    r = ct->read_cb(c, t, e->info);
+    ct->free_cb(e->info);
+
+    if (r < 0) {
+        pa_xfree(e->info);
+        pa_xfree(e);
+        return NULL;
+    }
+
+    d = pa_tagstruct_get_read_data(t, start, &l);
+    e->packet = pa_packet_new(l);
+    memcpy(e->packet->data, d, l);
+
+    memset(e->info, 0, ct->size);
+    copy = pa_tagstruct_new(e->packet->data, l);
+    pa_assert_se(ct->read_cb(c, copy, e->info) >= 0);
+    pa_tagstruct_free(copy);
+
+    return e;
+}
+
+/* Returns TRUE if the object was known already */
+static pa_bool_t cache_entry_put(pa_context_cache *cache, struct cache_entry *e) {
+    struct cache_entry *old;
+    uint32_t idx;
+
+    idx = INFO_INDEX(e->type, e->info);
+
+    if ((old = pa_hashmap_remove(cache->entries[e->type], PA_UINT32_TO_PTR(idx))))
+        cache_entry_free(old);
+
+    pa_assert_se(pa_hashmap_put(cache->entries[e->type], PA_UINT32_TO_PTR(idx), e) == 0);
+
+    return !!old;
+}
+
+static void cache_request_info(pa_context *c, unsigned type, uint32_t idx);
+
+static void cache_info_callback(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    struct cache_request *r = userdata;
+    pa_context *c = r->context;
+    pa_context_cache *cache = c->cache;
+    struct cache_entry *e;
+    pa_bool_t dirty;
+    void *state;
+
+    pa_assert(pd);
+
+    if (!cache)
+        return;
+
+    state = pa_hashmap_remove(cache->requests[r->type], PA_UINT32_TO_PTR(r->index));
+    dirty = state == REQUEST_DIRTY;
+
+    pa_context_ref(c);
+
+    /* An error means that the object is gone already, the removal event
+     * is on its way then */
+    if (command == PA_COMMAND_REPLY) {
+        pa_subscription_event_type_t ev;
+
+        if (!(e = cache_entry_read(c, r->type, t)) ||
+            INFO_INDEX(r->type, e->info) != r->index ||
+            !pa_tagstruct_eof(t)) {
+
+            if (e)
+                cache_entry_free(e);
+
+            pa_context_fail(c, PA_ERR_PROTOCOL);
+            goto finish;
+        }
+
+        ev = cache_entry_put(cache, e) ? PA_SUBSCRIPTION_EVENT_CHANGE : PA_SUBSCRIPTION_EVENT_NEW;
+
+        if (c->cache_callback)
+            c->cache_callback(c, cache_types[r->type].facility | ev, r->index, c->cache_userdata);
+    }
+
+    if (dirty && c->cache && c->state == PA_CONTEXT_READY)
+        cache_request_info(c, r->type, r->index);
+
+finish:
+    pa_context_unref(c);
+}
+
+static void cache_request_info(pa_context *c, unsigned type, uint32_t idx) {
+    struct cache_request *r;
+    pa_tagstruct *t;
+    uint32_t tag;
+
+    pa_assert(c->cache);
+
+    if (pa_hashmap_get(c->cache->requests[type], PA_UINT32_TO_PTR(idx))) {
+        pa_hashmap_remove(c->cache->requests[type], PA_UINT32_TO_PTR(idx));
+        pa_hashmap_put(c->cache->requests[type], PA_UINT32_TO_PTR(idx), REQUEST_DIRTY);
+        return;
+    }
+
+    pa_hashmap_put(c->cache->requests[type], PA_UINT32_TO_PTR(idx), REQUEST_PENDING);
+
+    r = pa_xnew(struct cache_request, 1);
+    r->context = c;
+    r->type = type;
+    r->index = idx;
+
+    t = pa_tagstruct_command(c, cache_types[type].command, &tag);
+    pa_tagstruct_putu32(t, idx);
+    if (cache_types[type].by_name)
+        pa_tagstruct_puts(t, NULL);
+    pa_pstream_send_tagstruct(c->pstream, t);
+    pa_pdispatch_register_reply(c->pdispatch, tag, DEFAULT_TIMEOUT, cache_info_callback, r, pa_xfree);
+}
+
+void pa_context_cache_handle_event(pa_context *c, pa_subscription_event_type_t e, uint32_t idx) {
+    pa_subscription_event_type_t facility;
+    unsigned type;
+
+    pa_assert(c);
+
+    /* Anything before the snapshot is part of it already */
+    if (!c->cache || !c->cache->ready)
+        return;
+
+    facility = e & PA_SUBSCRIPTION_EVENT_FACILITY_MASK;
+
+    for (type = 0; type < CACHE_MAX; type++)
+        if (cache_types[type].facility == facility)
+            break;
+
+    if (type >= CACHE_MAX)
+        return;
+
+    if ((e & PA_SUBSCRIPTION_EVENT_TYPE_MASK) == PA_SUBSCRIPTION_EVENT_REMOVE) {
+        struct cache_entry *entry;
+
+        if (!(entry = pa_hashmap_remove(c->cache->entries[type], PA_UINT32_TO_PTR(idx))))
+            return;
+
+        cache_entry_free(entry);
+
+        if (c->cache_callback)
+            c->cache_callback(c, e, idx, c->cache_userdata);
+
+        return;
+    }
+
+    cache_request_info(c, type, idx);
+}
+
+/* Reads a section of the snapshot, either into the cache or over it */
+static int cache_read_section(pa_context *c, pa_tagstruct *t, unsigned type) {
+    uint32_t count, j;
+
+    if (pa_tagstruct_getu32(t, &count) < 0)
+        return -1;
+
+    for (j = 0; j < count; j++) {
+        struct cache_entry *e;
+
+        if (!(e = cache_entry_read(c, type, t)))
+            return -1;
+
+        cache_entry_put(c->cache, e);
+    }
+
+    return 0;
+}
+
+static void context_enable_cache_callback(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    pa_operation *o = userdata;
+    pa_server_info server;
+    pa_client_info *clients = NULL;
+    pa_module_info *modules = NULL;
+    uint32_t n_clients = 0, n_modules = 0;
+    int success = 1;
+
+    pa_assert(pd);
+    pa_assert(o);
+    pa_assert(PA_REFCNT_VALUE(o) >= 1);
+
+    if (!o->context || !o->context->cache)
+        goto finish;
+
+    if (command != PA_COMMAND_REPLY) {
+        if (pa_context_handle_error(o->context, command, t, FALSE) < 0)
+            goto finish;
+
+        pa_context_cache_free(o->context->cache);
+        o->context->cache = NULL;
+        success = 0;
+
+    } else if (read_server_info(o->context, t, &server) < 0 ||
+               cache_read_section(o->context, t, CACHE_SINK) < 0 ||
+               cache_read_section(o->context, t, CACHE_SOURCE) < 0 ||
+               cache_read_section(o->context, t, CACHE_SINK_INPUT) < 0 ||
+               cache_read_section(o->context, t, CACHE_SOURCE_OUTPUT) < 0 ||
+               READ_INFO_ARRAY(o->context, t, client, clients, n_clients) < 0 ||
+               READ_INFO_ARRAY(o->context, t, module, modules, n_modules) < 0 ||
+               cache_read_section(o->context, t, CACHE_CARD) < 0) {
+
+        pa_context_fail(o->context, PA_ERR_PROTOCOL);
+        goto finish;
+    } else
+        o->context->cache->ready = TRUE;
+
+    /* The sample cache entries that follow are not of interest */
+
+    if (o->callback) {
+        pa_context_success_cb_t cb = (pa_context_success_cb_t) o->callback;
+        cb(o->context, success, o->userdata);
+    }
+
+finish:
+    FREE_INFO_ARRAY(client, clients, n_clients);
+    FREE_INFO_ARRAY(module, modules, n_modules);
+
+    pa_operation_done(o);
+    pa_operation_unref(o);
+}
+
+void pa_context_cache_free(pa_context_cache *cache) {
+    unsigned type;
+
+    pa_assert(cache);
+
+    for (type = 0; type < CACHE_MAX; type++) {
+        pa_hashmap_free(cache->entries[type], (pa_free_cb_t) cache_entry_free);
+        pa_hashmap_free(cache->requests[type], NULL);
+    }
+
+    pa_xfree(cache);
+}
+
+pa_operation* pa_context_enable_cache(pa_context *c, pa_context_success_cb_t cb, void *userdata) {
+    pa_context_cache *cache;
+    pa_operation *o;
+    pa_tagstruct *t;
+    uint32_t tag;
+    unsigned type;
+
+    pa_assert(c);
+    pa_assert(PA_REFCNT_VALUE(c) >= 1);
+
+    PA_CHECK_VALIDITY_RETURN_NULL(c, !pa_detect_fork(), PA_ERR_FORKED);
+    PA_CHECK_VALIDITY_RETURN_NULL(c, c->state == PA_CONTEXT_READY, PA_ERR_BADSTATE);
+    PA_CHECK_VALIDITY_RETURN_NULL(c, !c->cache, PA_ERR_EXIST);
+    PA_CHECK_VALIDITY_RETURN_NULL(c, c->version >= 30, PA_ERR_NOTSUPPORTED);
+
+    c->cache = cache = pa_xnew0(pa_context_cache, 1);
+
+    for (type = 0; type < CACHE_MAX; type++) {
+        cache->entries[type] = pa_hashmap_new(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func);
+        cache->requests[type] = pa_hashmap_new(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func);
+    }
+
+    /* Subscribe first, so that nothing gets lost between the snapshot
+     * and the first event */
+    o = pa_operation_new(c, NULL, NULL, NULL);
+
+    t = pa_tagstruct_command(c, PA_COMMAND_SUBSCRIBE, &tag);
+    pa_tagstruct_putu32(t, c->subscribe_mask | PA_CONTEXT_CACHE_SUBSCRIPTION_MASK);
+    pa_pstream_send_tagstruct(c->pstream, t);
+    pa_pdispatch_register_reply(c->pdispatch, tag, DEFAULT_TIMEOUT, pa_context_simple_ack_callback, pa_operation_ref(o), (pa_free_cb_t) pa_operation_unref);
+
+    pa_operation_unref(o);
+
+    o = pa_operation_new(c, NULL, (pa_operation_cb_t) cb, userdata);
+
+    t = pa_tagstruct_command(c, PA_COMMAND_GET_SERVER_SNAPSHOT, &tag);
+    pa_pstream_send_tagstruct(c->pstream, t);
+    pa_pdispatch_register_reply(c->pdispatch, tag, DEFAULT_TIMEOUT, context_enable_cache_callback, pa_operation_ref(o), (pa_free_cb_t) pa_operation_unref);
+
+    return o;
+}
+
+void pa_context_set_cache_callback(pa_context *c, pa_context_subscribe_cb_t cb, void *userdata) {
+    pa_assert(c);
+    pa_assert(PA_REFCNT_VALUE(c) >= 1);
+
+    if (c->state == PA_CONTEXT_TERMINATED || c->state == PA_CONTEXT_FAILED)
+        return;
+
+    c->cache_callback = cb;
+    c->cache_userdata = userdata;
+}
+
+static const void* cache_get_by_index(pa_context *c, unsigned type, uint32_t idx) {
+    struct cache_entry *e;
+
+    pa_assert(c);
+    pa_assert(PA_REFCNT_VALUE(c) >= 1);
+
+    PA_CHECK_VALIDITY_RETURN_NULL(c, !pa_detect_fork(), PA_ERR_FORKED);
+    PA_CHECK_VALIDITY_RETURN_NULL(c, c->cache && c->cache->ready, PA_ERR_BADSTATE);
+
+    if (!(e = pa_hashmap_get(c->cache->entries[type], PA_UINT32_TO_PTR(idx)))) {
+        pa_context_set_error(c, PA_ERR_NOENTITY);
+        return NULL;
+    }
+
+    return e->info;
+}
+
+static const void* cache_get_by_name(pa_context *c, unsigned type, const char *name) {
+    struct cache_entry *e;
+    void *state;
+
+    pa_assert(c);
+    pa_assert(PA_REFCNT_VALUE(c) >= 1);
+
+    PA_CHECK_VALIDITY_RETURN_NULL(c, !pa_detect_fork(), PA_ERR_FORKED);
+    PA_CHECK_VALIDITY_RETURN_NULL(c, c->cache && c->cache->ready, PA_ERR_BADSTATE);
+    PA_CHECK_VALIDITY_RETURN_NULL(c, name && *name, PA_ERR_INVALID);
+
+    PA_HASHMAP_FOREACH(e, c->cache->entries[type], state)
+        if (pa_streq(INFO_NAME(type, e->info), name))
+            return e->info;
+
+    pa_context_set_error(c, PA_ERR_NOENTITY);
+    return NULL;
+}
+
+static int cache_get_list(pa_context *c, unsigned type, info_cb_t cb, void *userdata) {
+    struct cache_entry *e;
+    void *state;
+
+    pa_assert(c);
+    pa_assert(PA_REFCNT_VALUE(c) >= 1);
+    pa_assert(cb);
+
+    PA_CHECK_VALIDITY(c, !pa_detect_fork(), PA_ERR_FORKED);
+    PA_CHECK_VALIDITY(c, c->cache && c->cache->ready, PA_ERR_BADSTATE);
+
+    /* The callback must not run the main loop, so nothing can change
+     * while we iterate */
+    PA_HASHMAP_FOREACH(e, c->cache->entries[type], state)
+        cb(c, e->info, 0, userdata);
+
+    cb(c, NULL, 1, userdata);
+
+    return 0;
+}
+
+const pa_sink_info* pa_context_cache_get_sink_info_by_index(pa_context *c, uint32_t idx) {
+    return cache_get_by_index(c, CACHE_SINK, idx);
+}
+
+const pa_sink_info* pa_context_cache_get_sink_info_by_name(pa_context *c, const char *name) {
+    return cache_get_by_name(c, CACHE_SINK, name);
+}
+
+int pa_context_cache_get_sink_info_list(pa_context *c, pa_sink_info_cb_t cb, void *userdata) {
+    return cache_get_list(c, CACHE_SINK, (info_cb_t) cb, userdata);
+}
+
+const pa_source_info* pa_context_cache_get_source_info_by_index(pa_context *c, uint32_t idx) {
+    return cache_get_by_index(c, CACHE_SOURCE, idx);
+}
+
+const pa_source_info* pa_context_cache_get_source_info_by_name(pa_context *c, const char *name) {
+    return cache_get_by_name(c, CACHE_SOURCE, name);
+}
+
+int pa_context_cache_get_source_info_list(pa_context *c, pa_source_info_cb_t cb, void *userdata) {
+    return cache_get_list(c, CACHE_SOURCE, (info_cb_t) cb, userdata);
+}
+
+const pa_sink_input_info* pa_context_cache_get_sink_input_info(pa_context *c, uint32_t idx) {
+    return cache_get_by_index(c, CACHE_SINK_INPUT, idx);
+}
+
+int pa_context_cache_get_sink_input_info_list(pa_context *c, pa_sink_input_info_cb_t cb, void *userdata) {
+    return cache_get_list(c, CACHE_SINK_INPUT, (info_cb_t) cb, userdata);
+}
+
+const pa_source_output_info* pa_context_cache_get_source_output_info(pa_context *c, uint32_t idx) {
+    return cache_get_by_index(c, CACHE_SOURCE_OUTPUT, idx);
+}
+
+int pa_context_cache_get_source_output_info_list(pa_context *c, pa_source_output_info_cb_t cb, void *userdata) {
+    return cache_get_list(c, CACHE_SOURCE_OUTPUT, (info_cb_t) cb, userdata);
+}
+
+const pa_card_info* pa_context_cache_get_card_info_by_index(pa_context *c, uint32_t idx) {
+    return cache_get_by_index(c, CACHE_CARD, idx);
+}
+
+const pa_card_info* pa_context_cache_get_card_info_by_name(pa_context *c, const char *name) {
+    return cache_get_by_name(c, CACHE_CARD, name);
+}
+
+int pa_context_cache_get_card_info_list(pa_context *c, pa_card_info_cb_t cb, void *userdata) {
+    return cache_get_list(c, CACHE_CARD, (info_cb_t) cb, userdata);
+}
+
 /*** Autoload stuff ***/
 
 PA_WARN_REFERENCE(pa_context_get_autoload_info_by_name, "Module auto-loading no longer supported.");
@@ -32,6 +32,7 @@
 #include <pulse/channelmap.h>
 #include <pulse/volume.h>
 #include <pulse/proplist.h>
+#include <pulse/subscribe.h>
 #include <pulse/format.h>
 #include <pulse/version.h>
 
@@ -74,6 +75,14 @@
  * pa_context_get_server_info() provides access to a pa_server_info structure
  * containing all of these.
  *
+ * \subsection snapshot_subsec Server Snapshot
+ *
+ * pa_context_get_server_snapshot() fetches the server information and all
+ * sinks, sources, sink inputs, source outputs, clients, modules, cards and
+ * cached samples in one go, as a pa_server_snapshot structure. All of them
+ * are taken at the same point in time, which makes this the cheapest way for
+ * monitoring tools to keep track of a busy server.
+ *
  * \subsection memstat_subsec Memory Usage
  *
  * Statistics about memory usage can be fetched using pa_context_stat(),
@@ -271,6 +280,41 @@ pa_operation* pa_context_set_sink_port_by_index(pa_context *c, uint32_t idx, con
 /** Change the profile of a sink. \since 0.9.15 */
 pa_operation* pa_context_set_sink_port_by_name(pa_context *c, const char*name, const char*port, pa_context_success_cb_t cb, void *userdata);
 
+/** The levels of what a sink plays, per channel in the order of its
+ * channel map. They are given as software volumes, so that
+ * PA_VOLUME_NORM is full scale. Use pa_sw_volume_to_linear() or
+ * pa_sw_volume_to_dB() to drive a meter with them. Please note that
+ * this structure can be extended as part of evolutionary API updates
+ * at any time in any new release. \since 5.0 */
+typedef struct pa_sink_levels_info {
+    uint32_t index;                  /**< Index of the sink */
+    pa_cvolume peak;                 /**< Highest absolute sample value */
+    pa_cvolume rms;                  /**< Root mean square of the samples */
+} pa_sink_levels_info;
+
+/** Callback prototype for pa_context_get_sink_levels() and
+ * pa_context_set_sink_levels_callback(). \since 5.0 */
+typedef void (*pa_sink_levels_cb_t)(pa_context *c, const pa_sink_levels_info *i, void *userdata);
+
+/** Get the levels of a sink, measured by the server, without
+ * recording from its monitor. Each query covers the time since the
+ * previous one, at most the last 320 ms. The server only measures
+ * while somebody asks, so the first query after a while reports
+ * silence. i is NULL if the query failed. Requires a server with
+ * protocol version 30 or newer. \since 5.0 */
+pa_operation* pa_context_get_sink_levels(pa_context *c, uint32_t idx, pa_sink_levels_cb_t cb, void *userdata);
+
+/** Have the server send the levels of a sink every interval
+ * microseconds, to the callback set with
+ * pa_context_set_sink_levels_callback(). The interval is clamped to
+ * 10 ms to 320 ms, 0 stops sending them. Requires a server with
+ * protocol version 30 or newer. \since 5.0 */
+pa_operation* pa_context_subscribe_sink_levels(pa_context *c, uint32_t idx, pa_usec_t interval, pa_context_success_cb_t cb, void *userdata);
+
+/** Set the callback for the levels sent on behalf of
+ * pa_context_subscribe_sink_levels(). \since 5.0 */
+void pa_context_set_sink_levels_callback(pa_context *c, pa_sink_levels_cb_t cb, void *userdata);
+
 /** @} */
 
 /** @{ \name Sources */
@@ -623,6 +667,10 @@ typedef struct pa_stat_info {
     uint32_t memblock_allocated;       /**< Allocated memory blocks during the whole lifetime of the daemon. */
     uint32_t memblock_allocated_size;  /**< Total size of all memory blocks allocated during the whole lifetime of the daemon. */
     uint32_t scache_size;              /**< Total size of all sample cache entries. */
+    uint32_t mempool_page_size;        /**< Size of the pages backing the memory pool of the daemon, 0 if unknown. \since 5.0 */
+    int mempool_locked;                /**< Non-zero if the memory pool of the daemon is locked into memory. \since 5.0 */
+    uint64_t memory_trimmed;           /**< Total size of the memory the daemon gave back to the system when trimming it after being idle. \since 5.0 */
+    uint32_t memory_trims;             /**< How often the daemon trimmed its memory after being idle. \since 5.0 */
 } pa_stat_info;
 
 /** Callback prototype for pa_context_stat() */
@@ -665,6 +713,85 @@ pa_operation* pa_context_get_sample_info_list(pa_context *c, pa_sample_info_cb_t
 
 /** @} */
 
+/** @{ \name Server Snapshot */
+
+/** All objects of the server at one point in time, as returned by
+ * pa_context_get_server_snapshot(). The arrays are only valid during the
+ * duration of the callback. Please note that this structure can be
+ * extended as part of evolutionary API updates at any time in any new
+ * release. \since 5.0 */
+typedef struct pa_server_snapshot {
+    const pa_server_info *server;                 /**< Server information */
+    const pa_sink_info *sinks;                    /**< All sinks */
+    uint32_t n_sinks;                             /**< Number of entries in sinks */
+    const pa_source_info *sources;                /**< All sources */
+    uint32_t n_sources;                           /**< Number of entries in sources */
+    const pa_sink_input_info *sink_inputs;        /**< All sink inputs */
+    uint32_t n_sink_inputs;                       /**< Number of entries in sink_inputs */
+    const pa_source_output_info *source_outputs;  /**< All source outputs */
+    uint32_t n_source_outputs;                    /**< Number of entries in source_outputs */
+    const pa_client_info *clients;                /**< All clients */
+    uint32_t n_clients;                           /**< Number of entries in clients */
+    const pa_module_info *modules;                /**< All modules */
+    uint32_t n_modules;                           /**< Number of entries in modules */
+    const pa_card_info *cards;                    /**< All cards */
+    uint32_t n_cards;                             /**< Number of entries in cards */
+    const pa_sample_info *samples;                /**< All sample cache entries */
+    uint32_t n_samples;                           /**< Number of entries in samples */
+} pa_server_snapshot;
+
+/** Callback prototype for pa_context_get_server_snapshot(). s is NULL if
+ * the query failed. \since 5.0 */
+typedef void (*pa_server_snapshot_cb_t) (pa_context *c, const pa_server_snapshot *s, void *userdata);
+
+/** Get a consistent snapshot of all sinks, sources, streams, clients,
+ * modules, cards and cached samples of the server in a single round
+ * trip. Requires a server with protocol version 30 or newer. \since 5.0 */
+pa_operation* pa_context_get_server_snapshot(pa_context *c, pa_server_snapshot_cb_t cb, void *userdata);
+
+/** @} */
+
+/** @{ \name Object Cache */
+
+/** Keep a local copy of all sinks, sources, sink inputs, source
+ * outputs and cards. The cache is filled from a server snapshot and
+ * kept up to date from subscription events, fetching only the objects
+ * that changed. The callback is called once the snapshot arrived. The
+ * object cache subscribes to the events it needs by itself, the
+ * subscription callback still only gets what was passed to
+ * pa_context_subscribe(). Requires a server with protocol version 30
+ * or newer. \since 5.0 */
+pa_operation* pa_context_enable_cache(pa_context *c, pa_context_success_cb_t cb, void *userdata);
+
+/** Set the callback that is called whenever an object in the cache
+ * has been added, changed or removed. The event and index are passed
+ * like for the subscription callback. \since 5.0 */
+void pa_context_set_cache_callback(pa_context *c, pa_context_subscribe_cb_t cb, void *userdata);
+
+/** Look up objects in the cache without a round trip to the server.
+ * The returned structures stay valid only until control returns to the
+ * main loop. Returns NULL if there is no such object or the cache is
+ * not ready yet. \since 5.0 */
+const pa_sink_info* pa_context_cache_get_sink_info_by_index(pa_context *c, uint32_t idx);
+const pa_sink_info* pa_context_cache_get_sink_info_by_name(pa_context *c, const char *name);
+const pa_source_info* pa_context_cache_get_source_info_by_index(pa_context *c, uint32_t idx);
+const pa_source_info* pa_context_cache_get_source_info_by_name(pa_context *c, const char *name);
+const pa_sink_input_info* pa_context_cache_get_sink_input_info(pa_context *c, uint32_t idx);
+const pa_source_output_info* pa_context_cache_get_source_output_info(pa_context *c, uint32_t idx);
+const pa_card_info* pa_context_cache_get_card_info_by_index(pa_context *c, uint32_t idx);
+const pa_card_info* pa_context_cache_get_card_info_by_name(pa_context *c, const char *name);
+
+/** Call the callback for all objects of a kind in the cache, right
+ * away, followed by a call with eol set. Returns a negative error code
+ * if the cache is not ready. \since 5.0 */
+int pa_context_cache_get_sink_info_list(pa_context *c, pa_sink_info_cb_t cb, void *userdata);
+int pa_context_cache_get_source_info_list(pa_context *c, pa_source_info_cb_t cb, void *userdata);
+int pa_context_cache_get_sink_input_info_list(pa_context *c, pa_sink_input_info_cb_t cb, void *userdata);
+int pa_context_cache_get_source_output_info_list(pa_context *c, pa_source_output_info_cb_t cb, void *userdata);
+int pa_context_cache_get_card_info_list(pa_context *c, pa_card_info_cb_t cb, void *userdata);
+
+/** @} */
+
 /** \cond fulldocs */
 
 /** @{ \name Autoload Entries */
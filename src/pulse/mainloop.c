@@ -34,6 +34,10 @@
 #include <pulsecore/pipe.h>
 #endif
 
+#ifdef HAVE_EPOLL
+#include <sys/epoll.h>
+#endif
+
 #include <pulse/rtclock.h>
 #include <pulse/timeval.h>
 #include <pulse/xmalloc.h>
@@ -48,6 +52,11 @@
 #include <pulsecore/socket.h>
 #include <pulsecore/macro.h>
 
+#ifdef HAVE_EPOLL
+#include <pulsecore/hashmap.h>
+#include <pulsecore/idxset.h>
+#endif
+
 #include "mainloop.h"
 #include "internal.h"
 
@@ -72,8 +81,15 @@ struct pa_time_event {
 
     pa_bool_t enabled:1;
     pa_bool_t use_rtclock:1;
+    pa_bool_t expired:1;
     pa_usec_t time;
 
+    /* Position in the timer heap, valid while enabled */
+    unsigned heap_idx;
+
+    /* Used by dispatch_timeout() to queue up the elapsed events */
+    pa_time_event *next_expired;
+
     pa_time_event_cb_t callback;
     void *userdata;
     pa_time_event_destroy_cb_t destroy_callback;
@@ -107,7 +123,10 @@ struct pa_mainloop {
     unsigned max_pollfds, n_pollfds;
 
     pa_usec_t prepared_timeout;
-    pa_time_event *cached_next_time_event;
+
+    /* The enabled time events as binary min-heap, ordered by time */
+    pa_time_event **time_heap;
+    unsigned n_time_heap, max_time_heap;
 
     pa_mainloop_api api;
 
@@ -129,6 +148,17 @@ struct pa_mainloop {
     pa_poll_func poll_func;
     void *poll_func_userdata;
     int poll_func_ret;
+
+#ifdef HAVE_EPOLL
+    /* When epoll_fd is valid all io events are registered with it
+     * persistently and pollfds is not used. A custom poll function is
+     * then handed the epoll fd only. */
+    int epoll_fd;
+    struct pollfd epoll_pollfd;
+    pa_hashmap *epoll_io_events;
+    struct epoll_event *epoll_events;
+    unsigned max_epoll_events;
+#endif
 };
 
 static short map_flags_to_libc(pa_io_event_flags_t flags) {
@@ -147,6 +177,146 @@ static pa_io_event_flags_t map_flags_from_libc(short flags) {
         (flags & POLLHUP ? PA_IO_EVENT_HANGUP : 0);
 }
 
+static pa_bool_t epoll_enabled(pa_mainloop *m) {
+#ifdef HAVE_EPOLL
+    return m->epoll_fd >= 0;
+#else
+    return FALSE;
+#endif
+}
+
+#ifdef HAVE_EPOLL
+
+static uint32_t map_flags_to_epoll(pa_io_event_flags_t flags) {
+    return
+        (flags & PA_IO_EVENT_INPUT ? EPOLLIN : 0) |
+        (flags & PA_IO_EVENT_OUTPUT ? EPOLLOUT : 0) |
+        (flags & PA_IO_EVENT_ERROR ? EPOLLERR : 0) |
+        (flags & PA_IO_EVENT_HANGUP ? EPOLLHUP : 0);
+}
+
+static pa_io_event_flags_t map_flags_from_epoll(uint32_t flags) {
+    return
+        (flags & EPOLLIN ? PA_IO_EVENT_INPUT : 0) |
+        (flags & EPOLLOUT ? PA_IO_EVENT_OUTPUT : 0) |
+        (flags & EPOLLERR ? PA_IO_EVENT_ERROR : 0) |
+        (flags & EPOLLHUP ? PA_IO_EVENT_HANGUP : 0);
+}
+
+/* Switch back to poll() for good, used when epoll cannot handle an fd,
+ * e.g. because it is a regular file or shared by two io events */
+static void epoll_disable(pa_mainloop *m) {
+    pa_assert(m);
+
+    if (m->epoll_fd < 0)
+        return;
+
+    pa_close(m->epoll_fd);
+    m->epoll_fd = -1;
+
+    pa_hashmap_free(m->epoll_io_events, NULL);
+    m->epoll_io_events = NULL;
+
+    pa_xfree(m->epoll_events);
+    m->epoll_events = NULL;
+    m->max_epoll_events = 0;
+
+    m->rebuild_pollfds = TRUE;
+}
+
+static void epoll_init(pa_mainloop *m) {
+    struct epoll_event ev;
+
+    pa_assert(m);
+
+    if ((m->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        pa_log_debug("epoll_create1() failed, using poll(): %s", pa_cstrerror(errno));
+        return;
+    }
+
+    /* Registrations are identified by fd, not by io event, so that a
+     * stale registration can never lead to a freed io event */
+    pa_zero(ev);
+    ev.events = EPOLLIN;
+    ev.data.fd = m->wakeup_pipe[0];
+
+    if (epoll_ctl(m->epoll_fd, EPOLL_CTL_ADD, m->wakeup_pipe[0], &ev) < 0) {
+        pa_log_debug("epoll_ctl() failed, using poll(): %s", pa_cstrerror(errno));
+        pa_close(m->epoll_fd);
+        m->epoll_fd = -1;
+        return;
+    }
+
+    m->epoll_pollfd.fd = m->epoll_fd;
+    m->epoll_pollfd.events = POLLIN;
+
+    m->epoll_io_events = pa_hashmap_new(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func);
+
+    m->max_epoll_events = 32;
+    m->epoll_events = pa_xnew(struct epoll_event, m->max_epoll_events);
+}
+
+static void epoll_add(pa_mainloop *m, pa_io_event *e) {
+    struct epoll_event ev;
+
+    if (m->epoll_fd < 0)
+        return;
+
+    pa_zero(ev);
+    ev.events = map_flags_to_epoll(e->events);
+    ev.data.fd = e->fd;
+
+    if (epoll_ctl(m->epoll_fd, EPOLL_CTL_ADD, e->fd, &ev) < 0) {
+        pa_log_debug("Cannot add fd %i to epoll, falling back to poll(): %s", e->fd, pa_cstrerror(errno));
+        epoll_disable(m);
+        return;
+    }
+
+    /* If there was an io event for this fd already, its fd must have
+     * been closed without freeing the event, since otherwise the add
+     * would have failed. The new event takes over the fd. */
+    pa_hashmap_remove(m->epoll_io_events, PA_INT_TO_PTR(e->fd));
+    pa_assert_se(pa_hashmap_put(m->epoll_io_events, PA_INT_TO_PTR(e->fd), e) == 0);
+
+    if (m->n_io_events + 1 > m->max_epoll_events) {
+        m->max_epoll_events = (m->n_io_events + 1) * 2;
+        m->epoll_events = pa_xrenew(struct epoll_event, m->epoll_events, m->max_epoll_events);
+    }
+}
+
+static void epoll_modify(pa_mainloop *m, pa_io_event *e) {
+    struct epoll_event ev;
+
+    if (m->epoll_fd < 0)
+        return;
+
+    pa_zero(ev);
+    ev.events = map_flags_to_epoll(e->events);
+    ev.data.fd = e->fd;
+
+    if (epoll_ctl(m->epoll_fd, EPOLL_CTL_MOD, e->fd, &ev) < 0) {
+        pa_log_debug("Cannot modify fd %i in epoll, falling back to poll(): %s", e->fd, pa_cstrerror(errno));
+        epoll_disable(m);
+    }
+}
+
+static void epoll_remove(pa_mainloop *m, pa_io_event *e) {
+
+    if (m->epoll_fd < 0)
+        return;
+
+    /* Somebody else took over the fd number already */
+    if (pa_hashmap_get(m->epoll_io_events, PA_INT_TO_PTR(e->fd)) != e)
+        return;
+
+    pa_hashmap_remove(m->epoll_io_events, PA_INT_TO_PTR(e->fd));
+
+    /* Fails if the fd has been closed already, which is fine */
+    epoll_ctl(m->epoll_fd, EPOLL_CTL_DEL, e->fd, NULL);
+}
+
+#endif
+
 /* IO events */
 static pa_io_event* mainloop_io_new(
         pa_mainloop_api *a,
@@ -179,6 +349,10 @@ static pa_io_event* mainloop_io_new(
     m->rebuild_pollfds = TRUE;
     m->n_io_events ++;
 
+#ifdef HAVE_EPOLL
+    epoll_add(m, e);
+#endif
+
     pa_mainloop_wakeup(m);
 
     return e;
@@ -198,6 +372,10 @@ static void mainloop_io_enable(pa_io_event *e, pa_io_event_flags_t events) {
     else
         e->mainloop->rebuild_pollfds = TRUE;
 
+#ifdef HAVE_EPOLL
+    epoll_modify(e->mainloop, e);
+#endif
+
     pa_mainloop_wakeup(e->mainloop);
 }
 
@@ -211,6 +389,10 @@ static void mainloop_io_free(pa_io_event *e) {
     e->mainloop->n_io_events --;
     e->mainloop->rebuild_pollfds = TRUE;
 
+#ifdef HAVE_EPOLL
+    epoll_remove(e->mainloop, e);
+#endif
+
     pa_mainloop_wakeup(e->mainloop);
 }
 
@@ -308,6 +490,82 @@ static pa_usec_t make_rt(const struct timeval *tv, pa_bool_t *use_rtclock) {
     return pa_timeval_load(&ttv);
 }
 
+static void time_heap_set(pa_mainloop *m, unsigned idx, pa_time_event *e) {
+    m->time_heap[idx] = e;
+    e->heap_idx = idx;
+}
+
+static void time_heap_sift_up(pa_mainloop *m, unsigned idx) {
+    pa_time_event *e = m->time_heap[idx];
+
+    while (idx > 0) {
+        unsigned parent = (idx - 1) / 2;
+
+        if (m->time_heap[parent]->time <= e->time)
+            break;
+
+        time_heap_set(m, idx, m->time_heap[parent]);
+        idx = parent;
+    }
+
+    time_heap_set(m, idx, e);
+}
+
+static void time_heap_sift_down(pa_mainloop *m, unsigned idx) {
+    pa_time_event *e = m->time_heap[idx];
+
+    for (;;) {
+        unsigned child = 2 * idx + 1;
+
+        if (child >= m->n_time_heap)
+            break;
+
+        if (child + 1 < m->n_time_heap && m->time_heap[child + 1]->time < m->time_heap[child]->time)
+            child++;
+
+        if (e->time <= m->time_heap[child]->time)
+            break;
+
+        time_heap_set(m, idx, m->time_heap[child]);
+        idx = child;
+    }
+
+    time_heap_set(m, idx, e);
+}
+
+/* Call after the time of the event at idx changed */
+static void time_heap_update(pa_mainloop *m, unsigned idx) {
+    pa_assert(idx < m->n_time_heap);
+
+    if (idx > 0 && m->time_heap[(idx - 1) / 2]->time > m->time_heap[idx]->time)
+        time_heap_sift_up(m, idx);
+    else
+        time_heap_sift_down(m, idx);
+}
+
+static void time_heap_insert(pa_mainloop *m, pa_time_event *e) {
+
+    if (m->n_time_heap >= m->max_time_heap) {
+        m->max_time_heap = m->max_time_heap ? m->max_time_heap * 2 : 32;
+        m->time_heap = pa_xrenew(pa_time_event*, m->time_heap, m->max_time_heap);
+    }
+
+    time_heap_set(m, m->n_time_heap++, e);
+    time_heap_sift_up(m, e->heap_idx);
+}
+
+static void time_heap_remove(pa_mainloop *m, pa_time_event *e) {
+    unsigned idx = e->heap_idx;
+
+    pa_assert(idx < m->n_time_heap);
+    pa_assert(m->time_heap[idx] == e);
+
+    if (idx < --m->n_time_heap) {
+        time_heap_set(m, idx, m->time_heap[m->n_time_heap]);
+        time_heap_update(m, idx);
+    }
+}
+
 static pa_time_event* mainloop_time_new(
         pa_mainloop_api *a,
         const struct timeval *tv,
@@ -336,13 +594,7 @@ static pa_time_event* mainloop_time_new(
         e->use_rtclock = use_rtclock;
 
         m->n_enabled_time_events++;
-
-        if (m->cached_next_time_event) {
-            pa_assert(m->cached_next_time_event->enabled);
-
-            if (t < m->cached_next_time_event->time)
-                m->cached_next_time_event = e;
-        }
+        time_heap_insert(m, e);
     }
 
     e->callback = callback;
@@ -366,26 +618,30 @@ static void mainloop_time_restart(pa_time_event *e, const struct timeval *tv) {
 
     t = make_rt(tv, &use_rtclock);
 
+    /* If dispatch_timeout() is about to call this event, it won't now */
+    e->expired = FALSE;
+
     valid = (t != PA_USEC_INVALID);
     if (e->enabled && !valid) {
         pa_assert(e->mainloop->n_enabled_time_events > 0);
         e->mainloop->n_enabled_time_events--;
+        time_heap_remove(e->mainloop, e);
     } else if (!e->enabled && valid)
         e->mainloop->n_enabled_time_events++;
 
-    if ((e->enabled = valid)) {
+    if (valid) {
         e->time = t;
         e->use_rtclock = use_rtclock;
-        pa_mainloop_wakeup(e->mainloop);
-    }
 
-    if (e->mainloop->cached_next_time_event && e->enabled) {
-        pa_assert(e->mainloop->cached_next_time_event->enabled);
+        if (e->enabled)
+            time_heap_update(e->mainloop, e->heap_idx);
+        else
+            time_heap_insert(e->mainloop, e);
 
-        if (t < e->mainloop->cached_next_time_event->time)
-            e->mainloop->cached_next_time_event = e;
-    } else if (e->mainloop->cached_next_time_event == e)
-        e->mainloop->cached_next_time_event = NULL;
+        e->enabled = TRUE;
+        pa_mainloop_wakeup(e->mainloop);
+    } else
+        e->enabled = FALSE;
 }
 
 static void mainloop_time_free(pa_time_event *e) {
@@ -393,17 +649,16 @@ static void mainloop_time_free(pa_time_event *e) {
     pa_assert(!e->dead);
 
     e->dead = TRUE;
+    e->expired = FALSE;
     e->mainloop->time_events_please_scan ++;
 
     if (e->enabled) {
         pa_assert(e->mainloop->n_enabled_time_events > 0);
         e->mainloop->n_enabled_time_events--;
+        time_heap_remove(e->mainloop, e);
         e->enabled = FALSE;
     }
 
-    if (e->mainloop->cached_next_time_event == e)
-        e->mainloop->cached_next_time_event = NULL;
-
     /* no wakeup needed here. Think about it! */
 }
 
@@ -473,6 +728,10 @@ pa_mainloop *pa_mainloop_new(void) {
 
     m->poll_func_ret = -1;
 
+#ifdef HAVE_EPOLL
+    epoll_init(m);
+#endif
+
     return m;
 }
 
@@ -523,6 +782,7 @@ static void cleanup_time_events(pa_mainloop *m, pa_bool_t force) {
             if (!e->dead && e->enabled) {
                 pa_assert(m->n_enabled_time_events > 0);
                 m->n_enabled_time_events--;
+                time_heap_remove(m, e);
                 e->enabled = FALSE;
             }
 
@@ -576,6 +836,11 @@ void pa_mainloop_free(pa_mainloop *m) {
     cleanup_time_events(m, TRUE);
 
     pa_xfree(m->pollfds);
+    pa_xfree(m->time_heap);
+
+#ifdef HAVE_EPOLL
+    epoll_disable(m);
+#endif
 
     pa_close_pipe(m->wakeup_pipe);
 
@@ -662,6 +927,36 @@ static unsigned dispatch_pollfds(pa_mainloop *m) {
     return r;
 }
 
+#ifdef HAVE_EPOLL
+static unsigned dispatch_epoll(pa_mainloop *m) {
+    unsigned r = 0;
+    int k;
+
+    pa_assert(m->poll_func_ret > 0);
+
+    for (k = 0; k < m->poll_func_ret; k++) {
+        pa_io_event *e;
+
+        /* One of the callbacks might have made us fall back to poll() */
+        if (m->quit || !epoll_enabled(m))
+            break;
+
+        /* The wakeup pipe, or freed by one of the callbacks before */
+        if (!(e = pa_hashmap_get(m->epoll_io_events, PA_INT_TO_PTR(m->epoll_events[k].data.fd))))
+            continue;
+
+        pa_assert(!e->dead);
+
+        pa_assert(e->callback);
+
+        e->callback(&m->api, e, e->fd, map_flags_from_epoll(m->epoll_events[k].events), e->userdata);
+        r++;
+    }
+
+    return r;
+}
+#endif
+
 static unsigned dispatch_defer(pa_mainloop *m) {
     pa_defer_event *e;
     unsigned r = 0;
@@ -686,28 +981,9 @@ static unsigned dispatch_defer(pa_mainloop *m) {
 }
 
 static pa_time_event* find_next_time_event(pa_mainloop *m) {
-    pa_time_event *t, *n = NULL;
     pa_assert(m);
 
-    if (m->cached_next_time_event)
-        return m->cached_next_time_event;
-
-    PA_LLIST_FOREACH(t, m->time_events) {
-
-        if (t->dead || !t->enabled)
-            continue;
-
-        if (!n || t->time < n->time) {
-            n = t;
-
-            /* Shortcut for time == 0 */
-            if (n->time == 0)
-                break;
-        }
-    }
-
-    m->cached_next_time_event = n;
-    return n;
+    return m->n_time_heap > 0 ? m->time_heap[0] : NULL;
 }
 
 static pa_usec_t calc_next_timeout(pa_mainloop *m) {
@@ -731,7 +1007,7 @@ static pa_usec_t calc_next_timeout(pa_mainloop *m) {
 }
 
 static unsigned dispatch_timeout(pa_mainloop *m) {
-    pa_time_event *e;
+    pa_time_event *e, *expired = NULL, **tail = &expired;
     pa_usec_t now;
     unsigned r = 0;
     pa_assert(m);
@@ -741,25 +1017,45 @@ static unsigned dispatch_timeout(pa_mainloop *m) {
 
     now = pa_rtclock_now();
 
-    PA_LLIST_FOREACH(e, m->time_events) {
+    /* First take all elapsed events out of the heap and disable them,
+     * so that events re-enabled from within a callback are left for
+     * the next iteration */
+    while ((e = find_next_time_event(m)) && e->time <= now) {
+        time_heap_remove(m, e);
 
-        if (m->quit)
-            break;
+        pa_assert(m->n_enabled_time_events > 0);
+        m->n_enabled_time_events--;
+        e->enabled = FALSE;
 
-        if (e->dead || !e->enabled)
-            continue;
+        e->expired = TRUE;
+        e->next_expired = NULL;
+        *tail = e;
+        tail = &e->next_expired;
+    }
 
-        if (e->time <= now) {
-            struct timeval tv;
-            pa_assert(e->callback);
+    while ((e = expired)) {
+        struct timeval tv;
 
-            /* Disable time event */
-            mainloop_time_restart(e, NULL);
+        expired = e->next_expired;
 
-            e->callback(&m->api, e, pa_timeval_rtstore(&tv, e->time, e->use_rtclock), e->userdata);
+        /* Restarted or freed by one of the callbacks before */
+        if (!e->expired)
+            continue;
+
+        e->expired = FALSE;
 
-            r++;
+        if (m->quit) {
+            /* Leave it for later */
+            m->n_enabled_time_events++;
+            e->enabled = TRUE;
+            time_heap_insert(m, e);
+            continue;
         }
+
+        pa_assert(e->callback);
+        e->callback(&m->api, e, pa_timeval_rtstore(&tv, e->time, e->use_rtclock), e->userdata);
+
+        r++;
     }
 
     return r;
@@ -799,7 +1095,7 @@ int pa_mainloop_prepare(pa_mainloop *m, int timeout) {
 
     if (m->n_enabled_defer_events <= 0) {
 
-        if (m->rebuild_pollfds)
+        if (m->rebuild_pollfds && !epoll_enabled(m))
             rebuild_pollfds(m);
 
         m->prepared_timeout = calc_next_timeout(m);
@@ -842,6 +1138,30 @@ int pa_mainloop_poll(pa_mainloop *m) {
 
     if (m->n_enabled_defer_events )
         m->poll_func_ret = 0;
+#ifdef HAVE_EPOLL
+    else if (epoll_enabled(m)) {
+        int timeout = usec_to_timeout(m->prepared_timeout);
+
+        /* With a custom poll function we wait for the epoll fd to
+         * become readable first and then collect the events */
+        if (m->poll_func) {
+            m->epoll_pollfd.revents = 0;
+
+            if ((m->poll_func_ret = m->poll_func(&m->epoll_pollfd, 1, timeout, m->poll_func_userdata)) > 0)
+                timeout = 0;
+        }
+
+        if (!m->poll_func || m->poll_func_ret > 0)
+            m->poll_func_ret = epoll_wait(m->epoll_fd, m->epoll_events, (int) m->max_epoll_events, timeout);
+
+        if (m->poll_func_ret < 0) {
+            if (errno == EINTR)
+                m->poll_func_ret = 0;
+            else
+                pa_log("epoll_wait(): %s", pa_cstrerror(errno));
+        }
+    }
+#endif
     else {
         pa_assert(!m->rebuild_pollfds);
 
@@ -899,8 +1219,14 @@ int pa_mainloop_dispatch(pa_mainloop *m) {
         if (m->quit)
             goto quit;
 
-        if (m->poll_func_ret > 0)
-            dispatched += dispatch_pollfds(m);
+        if (m->poll_func_ret > 0) {
+#ifdef HAVE_EPOLL
+            if (epoll_enabled(m))
+                dispatched += dispatch_epoll(m);
+            else
+#endif
+                dispatched += dispatch_pollfds(m);
+        }
     }
 
     if (m->quit)
@@ -125,7 +125,10 @@ void pa_mainloop_wakeup(pa_mainloop *m);
 /** Generic prototype of a poll() like function */
 typedef int (*pa_poll_func)(struct pollfd *ufds, unsigned long nfds, int timeout, void*userdata);
 
-/** Change the poll() implementation */
+/** Change the poll() implementation. On systems where the main loop
+ * is based on epoll the function is passed a single file descriptor,
+ * the epoll file descriptor, which becomes readable when any of the
+ * registered file descriptors is ready. */
 void pa_mainloop_set_poll_func(pa_mainloop *m, pa_poll_func poll_func, void *userdata);
 
 PA_C_DECL_END
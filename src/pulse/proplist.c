@@ -32,6 +32,8 @@
 #include <pulsecore/hashmap.h>
 #include <pulsecore/strbuf.h>
 #include <pulsecore/core-util.h>
+#include <pulsecore/once.h>
+#include <pulsecore/refcnt.h>
 
 #include "proplist.h"
 
@@ -44,6 +46,213 @@ struct property {
 #define MAKE_HASHMAP(p) ((pa_hashmap*) (p))
 #define MAKE_PROPLIST(p) ((pa_proplist*) (p))
 
+/* Keys and values never change once they are stored in a property. They
+ * are reference counted, so that pa_proplist_copy() and
+ * pa_proplist_update() can share them instead of duplicating every
+ * string, e.g. when a stream inherits the properties of its client.
+ * Setting a property always swaps in a new value. */
+struct shared {
+    PA_REFCNT_DECLARE;
+};
+
+#define SHARED_DATA(s) ((void*) ((uint8_t*) (s) + PA_ALIGN(sizeof(struct shared))))
+#define DATA_SHARED(d) ((struct shared*) ((uint8_t*) (d) - PA_ALIGN(sizeof(struct shared))))
+
+/* The well-known keys are interned: properties using them point into
+ * this table rather than to a copy of the key, which gives them a
+ * precomputed hash and makes comparing them a pointer comparison. */
+static const char atoms[][32] = {
+    PA_PROP_MEDIA_NAME,
+    PA_PROP_MEDIA_TITLE,
+    PA_PROP_MEDIA_ARTIST,
+    PA_PROP_MEDIA_COPYRIGHT,
+    PA_PROP_MEDIA_SOFTWARE,
+    PA_PROP_MEDIA_LANGUAGE,
+    PA_PROP_MEDIA_FILENAME,
+    PA_PROP_MEDIA_ICON,
+    PA_PROP_MEDIA_ICON_NAME,
+    PA_PROP_MEDIA_ROLE,
+    PA_PROP_FILTER_WANT,
+    PA_PROP_FILTER_APPLY,
+    PA_PROP_FILTER_SUPPRESS,
+    PA_PROP_EVENT_ID,
+    PA_PROP_EVENT_DESCRIPTION,
+    PA_PROP_EVENT_MOUSE_X,
+    PA_PROP_EVENT_MOUSE_Y,
+    PA_PROP_EVENT_MOUSE_HPOS,
+    PA_PROP_EVENT_MOUSE_VPOS,
+    PA_PROP_EVENT_MOUSE_BUTTON,
+    PA_PROP_WINDOW_NAME,
+    PA_PROP_WINDOW_ID,
+    PA_PROP_WINDOW_ICON,
+    PA_PROP_WINDOW_ICON_NAME,
+    PA_PROP_WINDOW_X,
+    PA_PROP_WINDOW_Y,
+    PA_PROP_WINDOW_WIDTH,
+    PA_PROP_WINDOW_HEIGHT,
+    PA_PROP_WINDOW_HPOS,
+    PA_PROP_WINDOW_VPOS,
+    PA_PROP_WINDOW_DESKTOP,
+    PA_PROP_WINDOW_X11_DISPLAY,
+    PA_PROP_WINDOW_X11_SCREEN,
+    PA_PROP_WINDOW_X11_MONITOR,
+    PA_PROP_WINDOW_X11_XID,
+    PA_PROP_APPLICATION_NAME,
+    PA_PROP_APPLICATION_ID,
+    PA_PROP_APPLICATION_VERSION,
+    PA_PROP_APPLICATION_ICON,
+    PA_PROP_APPLICATION_ICON_NAME,
+    PA_PROP_APPLICATION_LANGUAGE,
+    PA_PROP_APPLICATION_PROCESS_ID,
+    PA_PROP_APPLICATION_PROCESS_BINARY,
+    PA_PROP_APPLICATION_PROCESS_USER,
+    PA_PROP_APPLICATION_PROCESS_HOST,
+    PA_PROP_APPLICATION_PROCESS_MACHINE_ID,
+    PA_PROP_APPLICATION_PROCESS_SESSION_ID,
+    PA_PROP_DEVICE_STRING,
+    PA_PROP_DEVICE_API,
+    PA_PROP_DEVICE_DESCRIPTION,
+    PA_PROP_DEVICE_BUS_PATH,
+    PA_PROP_DEVICE_SERIAL,
+    PA_PROP_DEVICE_VENDOR_ID,
+    PA_PROP_DEVICE_VENDOR_NAME,
+    PA_PROP_DEVICE_PRODUCT_ID,
+    PA_PROP_DEVICE_PRODUCT_NAME,
+    PA_PROP_DEVICE_CLASS,
+    PA_PROP_DEVICE_FORM_FACTOR,
+    PA_PROP_DEVICE_BUS,
+    PA_PROP_DEVICE_ICON,
+    PA_PROP_DEVICE_ICON_NAME,
+    PA_PROP_DEVICE_ACCESS_MODE,
+    PA_PROP_DEVICE_MASTER_DEVICE,
+    PA_PROP_DEVICE_BUFFERING_BUFFER_SIZE,
+    PA_PROP_DEVICE_BUFFERING_FRAGMENT_SIZE,
+    PA_PROP_DEVICE_PROFILE_NAME,
+    PA_PROP_DEVICE_INTENDED_ROLES,
+    PA_PROP_DEVICE_PROFILE_DESCRIPTION,
+    PA_PROP_DEVICE_CPU_AFFINITY,
+    PA_PROP_DEVICE_NUMA_NODE,
+    PA_PROP_MODULE_AUTHOR,
+    PA_PROP_MODULE_DESCRIPTION,
+    PA_PROP_MODULE_USAGE,
+    PA_PROP_MODULE_VERSION,
+    PA_PROP_FORMAT_SAMPLE_FORMAT,
+    PA_PROP_FORMAT_RATE,
+    PA_PROP_FORMAT_CHANNELS,
+    PA_PROP_FORMAT_CHANNEL_MAP
+};
+
+#define N_ATOMS PA_ELEMENTSOF(atoms)
+#define ATOM_TABLE_SIZE 256
+
+/* Open addressing, index + 1 into atoms, 0 if unused */
+static uint8_t atom_table[ATOM_TABLE_SIZE];
+static unsigned atom_hash[N_ATOMS];
+
+static void atoms_init(void) {
+    PA_ONCE_BEGIN {
+        unsigned i, j;
+
+        pa_assert_cc(N_ATOMS < ATOM_TABLE_SIZE / 2);
+
+        for (i = 0; i < N_ATOMS; i++) {
+            atom_hash[i] = pa_idxset_string_hash_func(atoms[i]);
+
+            for (j = atom_hash[i]; atom_table[j % ATOM_TABLE_SIZE]; j++)
+                ;
+
+            atom_table[j % ATOM_TABLE_SIZE] = (uint8_t) (i + 1);
+        }
+    } PA_ONCE_END;
+}
+
+static pa_bool_t is_atom(const void *p) {
+    return (uintptr_t) p - (uintptr_t) atoms < sizeof(atoms);
+}
+
+static const char *atom_lookup(const char *key, unsigned hash) {
+    unsigned j;
+
+    atoms_init();
+
+    for (j = hash; atom_table[j % ATOM_TABLE_SIZE]; j++) {
+        unsigned i = atom_table[j % ATOM_TABLE_SIZE] - 1U;
+
+        if (atom_hash[i] == hash && strcmp(atoms[i], key) == 0)
+            return atoms[i];
+    }
+
+    return NULL;
+}
+
+static unsigned key_hash_func(const void *p) {
+    /* Atoms only end up in a hashmap after atoms_init() ran */
+    if (is_atom(p))
+        return atom_hash[((const char*) p - atoms[0]) / sizeof(atoms[0])];
+
+    return pa_idxset_string_hash_func(p);
+}
+
+static int key_compare_func(const void *a, const void *b) {
+    if (a == b)
+        return 0;
+
+    return strcmp(a, b);
+}
+
+static void *shared_new(size_t size) {
+    struct shared *s;
+
+    s = pa_xmalloc(PA_ALIGN(sizeof(struct shared)) + size);
+    PA_REFCNT_INIT(s);
+
+    return SHARED_DATA(s);
+}
+
+/* Always adds a trailing NUL byte */
+static void *shared_memdup(const void *data, size_t nbytes) {
+    char *d = shared_new(nbytes + 1);
+
+    if (nbytes > 0)
+        memcpy(d, data, nbytes);
+    d[nbytes] = 0;
+
+    return d;
+}
+
+static void *shared_strndup(const char *s, size_t l) {
+    const char *e;
+
+    if ((e = memchr(s, 0, l)))
+        l = (size_t) (e - s);
+
+    return shared_memdup(s, l);
+}
+
+static void *shared_ref(void *d) {
+    if (!is_atom(d))
+        PA_REFCNT_INC(DATA_SHARED(d));
+
+    return d;
+}
+
+static void shared_unref(void *d) {
+    if (is_atom(d))
+        return;
+
+    if (PA_REFCNT_DEC(DATA_SHARED(d)) <= 0)
+        pa_xfree(DATA_SHARED(d));
+}
+
+static char *intern_key(const char *key) {
+    const char *a;
+
+    if ((a = atom_lookup(key, pa_idxset_string_hash_func(key))))
+        return (char*) a;
+
+    return shared_memdup(key, strlen(key));
+}
+
 int pa_proplist_key_valid(const char *key) {
 
     if (!pa_ascii_valid(key))
@@ -58,13 +267,29 @@ int pa_proplist_key_valid(const char *key) {
 static void property_free(struct property *prop) {
     pa_assert(prop);
 
-    pa_xfree(prop->key);
-    pa_xfree(prop->value);
+    shared_unref(prop->key);
+    shared_unref(prop->value);
     pa_xfree(prop);
 }
 
+/* Takes over the reference to value */
+static void proplist_put(pa_proplist *p, const char *key, void *value, size_t nbytes) {
+    struct property *prop;
+
+    if ((prop = pa_hashmap_get(MAKE_HASHMAP(p), key)))
+        shared_unref(prop->value);
+    else {
+        prop = pa_xnew(struct property, 1);
+        prop->key = intern_key(key);
+        pa_hashmap_put(MAKE_HASHMAP(p), prop->key, prop);
+    }
+
+    prop->value = value;
+    prop->nbytes = nbytes;
+}
+
 pa_proplist* pa_proplist_new(void) {
-    return MAKE_PROPLIST(pa_hashmap_new(pa_idxset_string_hash_func, pa_idxset_string_compare_func));
+    return MAKE_PROPLIST(pa_hashmap_new(key_hash_func, key_compare_func));
 }
 
 void pa_proplist_free(pa_proplist* p) {
@@ -75,8 +300,7 @@ void pa_proplist_free(pa_proplist* p) {
 
 /** Will accept only valid UTF-8 */
 int pa_proplist_sets(pa_proplist *p, const char *key, const char *value) {
-    struct property *prop;
-    pa_bool_t add = FALSE;
+    size_t l;
 
     pa_assert(p);
     pa_assert(key);
@@ -85,26 +309,14 @@ int pa_proplist_sets(pa_proplist *p, const char *key, const char *value) {
     if (!pa_proplist_key_valid(key) || !pa_utf8_valid(value))
         return -1;
 
-    if (!(prop = pa_hashmap_get(MAKE_HASHMAP(p), key))) {
-        prop = pa_xnew(struct property, 1);
-        prop->key = pa_xstrdup(key);
-        add = TRUE;
-    } else
-        pa_xfree(prop->value);
-
-    prop->value = pa_xstrdup(value);
-    prop->nbytes = strlen(value)+1;
-
-    if (add)
-        pa_hashmap_put(MAKE_HASHMAP(p), prop->key, prop);
+    l = strlen(value);
+    proplist_put(p, key, shared_memdup(value, l), l+1);
 
     return 0;
 }
 
 /** Will accept only valid UTF-8 */
 static int proplist_setn(pa_proplist *p, const char *key, size_t key_length, const char *value, size_t value_length) {
-    struct property *prop;
-    pa_bool_t add = FALSE;
     char *k, *v;
 
     pa_assert(p);
@@ -112,28 +324,16 @@ static int proplist_setn(pa_proplist *p, const char *key, size_t key_length, con
     pa_assert(value);
 
     k = pa_xstrndup(key, key_length);
-    v = pa_xstrndup(value, value_length);
+    v = shared_strndup(value, value_length);
 
     if (!pa_proplist_key_valid(k) || !pa_utf8_valid(v)) {
         pa_xfree(k);
-        pa_xfree(v);
+        shared_unref(v);
         return -1;
     }
 
-    if (!(prop = pa_hashmap_get(MAKE_HASHMAP(p), k))) {
-        prop = pa_xnew(struct property, 1);
-        prop->key = k;
-        add = TRUE;
-    } else {
-        pa_xfree(prop->value);
-        pa_xfree(k);
-    }
-
-    prop->value = v;
-    prop->nbytes = strlen(v)+1;
-
-    if (add)
-        pa_hashmap_put(MAKE_HASHMAP(p), prop->key, prop);
+    proplist_put(p, k, v, strlen(v)+1);
+    pa_xfree(k);
 
     return 0;
 }
@@ -154,8 +354,6 @@ int pa_proplist_setp(pa_proplist *p, const char *pair) {
 }
 
 static int proplist_sethex(pa_proplist *p, const char *key, size_t key_length, const char *value, size_t value_length) {
-    struct property *prop;
-    pa_bool_t add = FALSE;
     char *k, *v;
     uint8_t *d;
     size_t dn;
@@ -172,41 +370,28 @@ static int proplist_sethex(pa_proplist *p, const char *key, size_t key_length, c
     }
 
     v = pa_xstrndup(value, value_length);
-    d = pa_xmalloc(value_length*2+1);
+    d = shared_new(value_length*2+1);
 
     if ((dn = pa_parsehex(v, d, value_length*2)) == (size_t) -1) {
         pa_xfree(k);
         pa_xfree(v);
-        pa_xfree(d);
+        shared_unref(d);
         return -1;
     }
 
     pa_xfree(v);
 
-    if (!(prop = pa_hashmap_get(MAKE_HASHMAP(p), k))) {
-        prop = pa_xnew(struct property, 1);
-        prop->key = k;
-        add = TRUE;
-    } else {
-        pa_xfree(prop->value);
-        pa_xfree(k);
-    }
-
     d[dn] = 0;
-    prop->value = d;
-    prop->nbytes = dn;
-
-    if (add)
-        pa_hashmap_put(MAKE_HASHMAP(p), prop->key, prop);
+    proplist_put(p, k, d, dn);
+    pa_xfree(k);
 
     return 0;
 }
 
 /** Will accept only valid UTF-8 */
 int pa_proplist_setf(pa_proplist *p, const char *key, const char *format, ...) {
-    struct property *prop;
-    pa_bool_t add = FALSE;
     va_list ap;
+    size_t l;
     char *v;
 
     pa_assert(p);
@@ -223,18 +408,9 @@ int pa_proplist_setf(pa_proplist *p, const char *key, const char *format, ...) {
     if (!pa_utf8_valid(v))
         goto fail;
 
-    if (!(prop = pa_hashmap_get(MAKE_HASHMAP(p), key))) {
-        prop = pa_xnew(struct property, 1);
-        prop->key = pa_xstrdup(key);
-        add = TRUE;
-    } else
-        pa_xfree(prop->value);
-
-    prop->value = v;
-    prop->nbytes = strlen(v)+1;
-
-    if (add)
-        pa_hashmap_put(MAKE_HASHMAP(p), prop->key, prop);
+    l = strlen(v);
+    proplist_put(p, key, shared_memdup(v, l), l+1);
+    pa_xfree(v);
 
     return 0;
 
@@ -244,9 +420,6 @@ fail:
 }
 
 int pa_proplist_set(pa_proplist *p, const char *key, const void *data, size_t nbytes) {
-    struct property *prop;
-    pa_bool_t add = FALSE;
-
     pa_assert(p);
     pa_assert(key);
     pa_assert(data || nbytes == 0);
@@ -254,21 +427,7 @@ int pa_proplist_set(pa_proplist *p, const char *key, const void *data, size_t nb
     if (!pa_proplist_key_valid(key))
         return -1;
 
-    if (!(prop = pa_hashmap_get(MAKE_HASHMAP(p), key))) {
-        prop = pa_xnew(struct property, 1);
-        prop->key = pa_xstrdup(key);
-        add = TRUE;
-    } else
-        pa_xfree(prop->value);
-
-    prop->value = pa_xmalloc(nbytes+1);
-    if (nbytes > 0)
-        memcpy(prop->value, data, nbytes);
-    ((char*) prop->value)[nbytes] = 0;
-    prop->nbytes = nbytes;
-
-    if (add)
-        pa_hashmap_put(MAKE_HASHMAP(p), prop->key, prop);
+    proplist_put(p, key, shared_memdup(data, nbytes), nbytes);
 
     return 0;
 }
@@ -321,7 +480,7 @@ int pa_proplist_get(pa_proplist *p, const char *key, const void **data, size_t *
 }
 
 void pa_proplist_update(pa_proplist *p, pa_update_mode_t mode, const pa_proplist *other) {
-    struct property *prop;
+    struct property *prop, *q;
     void *state = NULL;
 
     pa_assert(p);
@@ -335,10 +494,21 @@ void pa_proplist_update(pa_proplist *p, pa_update_mode_t mode, const pa_proplist
      * that's ok, because we don't modify the hashmap contents. */
     while ((prop = pa_hashmap_iterate(MAKE_HASHMAP(other), &state, NULL))) {
 
-        if (mode == PA_UPDATE_MERGE && pa_proplist_contains(p, prop->key))
-            continue;
+        if ((q = pa_hashmap_get(MAKE_HASHMAP(p), prop->key))) {
 
-        pa_assert_se(pa_proplist_set(p, prop->key, prop->value, prop->nbytes) == 0);
+            if (mode == PA_UPDATE_MERGE || q->value == prop->value)
+                continue;
+
+            shared_unref(q->value);
+        } else {
+            q = pa_xnew(struct property, 1);
+            q->key = shared_ref(prop->key);
+            pa_hashmap_put(MAKE_HASHMAP(p), q->key, q);
+        }
+
+        /* Share the value rather than copying it */
+        q->value = shared_ref(prop->value);
+        q->nbytes = prop->nbytes;
     }
 }
 
@@ -702,6 +872,9 @@ int pa_proplist_equal(pa_proplist *a, pa_proplist *b) {
         if (a_prop->nbytes != b_prop->nbytes)
             return 0;
 
+        if (a_prop->value == b_prop->value)
+            continue;
+
         if (memcmp(a_prop->value, b_prop->value, a_prop->nbytes) != 0)
             return 0;
     }
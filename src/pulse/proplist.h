@@ -245,6 +245,15 @@ PA_C_DECL_BEGIN
 /** For devices: human readable one-line description of the profile this device is in. E.g. "Analog Stereo", ... */
 #define PA_PROP_DEVICE_PROFILE_DESCRIPTION     "device.profile.description"
 
+/** For devices: the CPUs the IO thread of the device is bound to, in the usual "0-3,8" notation. \since 5.0 */
+#define PA_PROP_DEVICE_CPU_AFFINITY            "device.cpu_affinity"
+
+/** For devices: the NUMA node the IO thread of the device and its memory are placed on, integer formatted as string. \since 5.0 */
+#define PA_PROP_DEVICE_NUMA_NODE               "device.numa_node"
+
+/** For devices: the name of the clock domain of the device. The IO threads of devices that are driven by the same clock align their wakeups. \since 5.0 */
+#define PA_PROP_DEVICE_CLOCK_DOMAIN            "device.clock_domain"
+
 /** For modules: the author's name, formatted as UTF-8 string. E.g. "Lennart Poettering" */
 #define PA_PROP_MODULE_AUTHOR                  "module.author"
 
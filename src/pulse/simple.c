@@ -42,10 +42,16 @@ struct pa_simple {
     pa_context *context;
     pa_stream *stream;
     pa_stream_direction_t direction;
+    pa_simple_flags_t flags;
 
     const void *read_data;
     size_t read_index, read_length;
 
+    /* With PA_SIMPLE_BATCH_WRITES. Only touched by the caller's thread,
+     * so filling it needs no lock. */
+    uint8_t *write_buffer;
+    size_t write_length, write_size;
+
     int operation_success;
 };
 
@@ -147,7 +153,24 @@ pa_simple* pa_simple_new(
         const pa_buffer_attr *attr,
         int *rerror) {
 
+    return pa_simple_new_ext(server, name, dir, dev, stream_name, ss, map, attr, 0, PA_SIMPLE_NOFLAGS, rerror);
+}
+
+pa_simple* pa_simple_new_ext(
+        const char *server,
+        const char *name,
+        pa_stream_direction_t dir,
+        const char *dev,
+        const char *stream_name,
+        const pa_sample_spec *ss,
+        const pa_channel_map *map,
+        const pa_buffer_attr *attr,
+        pa_usec_t latency,
+        pa_simple_flags_t flags,
+        int *rerror) {
+
     pa_simple *p;
+    pa_buffer_attr a;
     int error = PA_ERR_INTERNAL, r;
 
     CHECK_VALIDITY_RETURN_ANY(rerror, !server || *server, PA_ERR_INVALID, NULL);
@@ -155,9 +178,32 @@ pa_simple* pa_simple_new(
     CHECK_VALIDITY_RETURN_ANY(rerror, !dev || *dev, PA_ERR_INVALID, NULL);
     CHECK_VALIDITY_RETURN_ANY(rerror, ss && pa_sample_spec_valid(ss), PA_ERR_INVALID, NULL);
     CHECK_VALIDITY_RETURN_ANY(rerror, !map || (pa_channel_map_valid(map) && map->channels == ss->channels), PA_ERR_INVALID, NULL)
+    CHECK_VALIDITY_RETURN_ANY(rerror, !(flags & ~PA_SIMPLE_BATCH_WRITES), PA_ERR_INVALID, NULL);
+    CHECK_VALIDITY_RETURN_ANY(rerror, !(flags & PA_SIMPLE_BATCH_WRITES) || dir == PA_STREAM_PLAYBACK, PA_ERR_INVALID, NULL);
+
+    /* The latency only fills in what the caller left to the server */
+    if (latency > 0) {
+        if (attr)
+            a = *attr;
+        else {
+            a.maxlength = (uint32_t) -1;
+            a.tlength = (uint32_t) -1;
+            a.prebuf = (uint32_t) -1;
+            a.minreq = (uint32_t) -1;
+            a.fragsize = (uint32_t) -1;
+        }
+
+        if (dir == PA_STREAM_PLAYBACK && a.tlength == (uint32_t) -1)
+            a.tlength = (uint32_t) pa_usec_to_bytes(latency, ss);
+        else if (dir == PA_STREAM_RECORD && a.fragsize == (uint32_t) -1)
+            a.fragsize = (uint32_t) pa_usec_to_bytes(latency, ss);
+
+        attr = &a;
+    }
 
     p = pa_xnew0(pa_simple, 1);
     p->direction = dir;
+    p->flags = flags;
 
     if (!(p->mainloop = pa_threaded_mainloop_new()))
         goto fail;
@@ -237,6 +283,13 @@ pa_simple* pa_simple_new(
         pa_threaded_mainloop_wait(p->mainloop);
     }
 
+    /* One request worth of data is what the server asks for at a time
+     * anyway */
+    if (flags & PA_SIMPLE_BATCH_WRITES) {
+        p->write_size = PA_MAX(pa_stream_get_buffer_attr(p->stream)->minreq, (uint32_t) pa_frame_size(ss));
+        p->write_buffer = pa_xmalloc(p->write_size);
+    }
+
     pa_threaded_mainloop_unlock(p->mainloop);
 
     return p;
@@ -268,41 +321,95 @@ void pa_simple_free(pa_simple *s) {
     if (s->mainloop)
         pa_threaded_mainloop_free(s->mainloop);
 
+    pa_xfree(s->write_buffer);
     pa_xfree(s);
 }
 
-int pa_simple_write(pa_simple *p, const void*data, size_t length, int *rerror) {
-    pa_assert(p);
-
-    CHECK_VALIDITY_RETURN_ANY(rerror, p->direction == PA_STREAM_PLAYBACK, PA_ERR_BADSTATE, -1);
-    CHECK_VALIDITY_RETURN_ANY(rerror, data, PA_ERR_INVALID, -1);
-    CHECK_VALIDITY_RETURN_ANY(rerror, length > 0, PA_ERR_INVALID, -1);
-
-    pa_threaded_mainloop_lock(p->mainloop);
-
-    CHECK_DEAD_GOTO(p, rerror, unlock_and_fail);
-
+/* Called with the lock held */
+static int stream_write(pa_simple *p, const void *data, size_t length, int *rerror) {
     while (length > 0) {
         size_t l;
         int r;
 
         while (!(l = pa_stream_writable_size(p->stream))) {
             pa_threaded_mainloop_wait(p->mainloop);
-            CHECK_DEAD_GOTO(p, rerror, unlock_and_fail);
+            CHECK_DEAD_GOTO(p, rerror, fail);
         }
 
-        CHECK_SUCCESS_GOTO(p, rerror, l != (size_t) -1, unlock_and_fail);
+        CHECK_SUCCESS_GOTO(p, rerror, l != (size_t) -1, fail);
 
         if (l > length)
             l = length;
 
         r = pa_stream_write(p->stream, data, l, NULL, 0LL, PA_SEEK_RELATIVE);
-        CHECK_SUCCESS_GOTO(p, rerror, r >= 0, unlock_and_fail);
+        CHECK_SUCCESS_GOTO(p, rerror, r >= 0, fail);
+
+        data = (const uint8_t*) data + l;
+        length -= l;
+    }
+
+    return 0;
+
+fail:
+    return -1;
+}
+
+/* Called with the lock held */
+static int flush_write_buffer(pa_simple *p, int *rerror) {
+    size_t l;
+
+    if (!p->write_length)
+        return 0;
+
+    l = p->write_length;
+    p->write_length = 0;
+
+    return stream_write(p, p->write_buffer, l, rerror);
+}
+
+int pa_simple_write(pa_simple *p, const void*data, size_t length, int *rerror) {
+    pa_assert(p);
+
+    CHECK_VALIDITY_RETURN_ANY(rerror, p->direction == PA_STREAM_PLAYBACK, PA_ERR_BADSTATE, -1);
+    CHECK_VALIDITY_RETURN_ANY(rerror, data, PA_ERR_INVALID, -1);
+    CHECK_VALIDITY_RETURN_ANY(rerror, length > 0, PA_ERR_INVALID, -1);
+
+    /* As long as it fits there is no need to bother the main loop */
+    if (p->write_buffer && p->write_length + length < p->write_size) {
+        memcpy(p->write_buffer + p->write_length, data, length);
+        p->write_length += length;
+        return 0;
+    }
+
+    pa_threaded_mainloop_lock(p->mainloop);
+
+    CHECK_DEAD_GOTO(p, rerror, unlock_and_fail);
+
+    if (p->write_buffer) {
+        size_t l;
+
+        /* Top up the buffer and pass it on in one go */
+        l = p->write_size - p->write_length;
+        memcpy(p->write_buffer + p->write_length, data, l);
+        p->write_length += l;
 
         data = (const uint8_t*) data + l;
         length -= l;
+
+        if (flush_write_buffer(p, rerror) < 0)
+            goto unlock_and_fail;
+
+        /* Keep a small tail for the next call */
+        if (length < p->write_size) {
+            memcpy(p->write_buffer, data, length);
+            p->write_length = length;
+            length = 0;
+        }
     }
 
+    if (length > 0 && stream_write(p, data, length, rerror) < 0)
+        goto unlock_and_fail;
+
     pa_threaded_mainloop_unlock(p->mainloop);
     return 0;
 
@@ -311,6 +418,56 @@ unlock_and_fail:
     return -1;
 }
 
+/* Called with the lock held. Wait until there is a fragment to read
+ * from. */
+static int read_wait(pa_simple *p, int *rerror) {
+    while (!p->read_data) {
+        int r;
+
+        r = pa_stream_peek(p->stream, &p->read_data, &p->read_length);
+        CHECK_SUCCESS_GOTO(p, rerror, r == 0, fail);
+
+        if (p->read_length <= 0) {
+            pa_threaded_mainloop_wait(p->mainloop);
+            CHECK_DEAD_GOTO(p, rerror, fail);
+        } else if (!p->read_data) {
+            /* There's a hole in the stream, skip it. We could generate
+             * silence, but that wouldn't work for compressed streams. */
+            r = pa_stream_drop(p->stream);
+            CHECK_SUCCESS_GOTO(p, rerror, r == 0, fail);
+        } else
+            p->read_index = 0;
+    }
+
+    return 0;
+
+fail:
+    return -1;
+}
+
+/* Called with the lock held */
+static int read_advance(pa_simple *p, size_t l, int *rerror) {
+    int r;
+
+    p->read_index += l;
+    p->read_length -= l;
+
+    if (p->read_length > 0)
+        return 0;
+
+    r = pa_stream_drop(p->stream);
+    p->read_data = NULL;
+    p->read_length = 0;
+    p->read_index = 0;
+
+    CHECK_SUCCESS_GOTO(p, rerror, r == 0, fail);
+
+    return 0;
+
+fail:
+    return -1;
+}
+
 int pa_simple_read(pa_simple *p, void*data, size_t length, int *rerror) {
     pa_assert(p);
 
@@ -325,23 +482,8 @@ int pa_simple_read(pa_simple *p, void*data, size_t length, int *rerror) {
     while (length > 0) {
         size_t l;
 
-        while (!p->read_data) {
-            int r;
-
-            r = pa_stream_peek(p->stream, &p->read_data, &p->read_length);
-            CHECK_SUCCESS_GOTO(p, rerror, r == 0, unlock_and_fail);
-
-            if (p->read_length <= 0) {
-                pa_threaded_mainloop_wait(p->mainloop);
-                CHECK_DEAD_GOTO(p, rerror, unlock_and_fail);
-            } else if (!p->read_data) {
-                /* There's a hole in the stream, skip it. We could generate
-                 * silence, but that wouldn't work for compressed streams. */
-                r = pa_stream_drop(p->stream);
-                CHECK_SUCCESS_GOTO(p, rerror, r == 0, unlock_and_fail);
-            } else
-                p->read_index = 0;
-        }
+        if (read_wait(p, rerror) < 0)
+            goto unlock_and_fail;
 
         l = p->read_length < length ? p->read_length : length;
         memcpy(data, (const uint8_t*) p->read_data+p->read_index, l);
@@ -349,20 +491,58 @@ int pa_simple_read(pa_simple *p, void*data, size_t length, int *rerror) {
         data = (uint8_t*) data + l;
         length -= l;
 
-        p->read_index += l;
-        p->read_length -= l;
+        if (read_advance(p, l, rerror) < 0)
+            goto unlock_and_fail;
+    }
 
-        if (!p->read_length) {
-            int r;
+    pa_threaded_mainloop_unlock(p->mainloop);
+    return 0;
 
-            r = pa_stream_drop(p->stream);
-            p->read_data = NULL;
-            p->read_length = 0;
-            p->read_index = 0;
+unlock_and_fail:
+    pa_threaded_mainloop_unlock(p->mainloop);
+    return -1;
+}
 
-            CHECK_SUCCESS_GOTO(p, rerror, r == 0, unlock_and_fail);
-        }
-    }
+int pa_simple_peek(pa_simple *p, const void **data, size_t *length, int *rerror) {
+    pa_assert(p);
+
+    CHECK_VALIDITY_RETURN_ANY(rerror, p->direction == PA_STREAM_RECORD, PA_ERR_BADSTATE, -1);
+    CHECK_VALIDITY_RETURN_ANY(rerror, data, PA_ERR_INVALID, -1);
+    CHECK_VALIDITY_RETURN_ANY(rerror, length, PA_ERR_INVALID, -1);
+
+    pa_threaded_mainloop_lock(p->mainloop);
+
+    CHECK_DEAD_GOTO(p, rerror, unlock_and_fail);
+
+    if (read_wait(p, rerror) < 0)
+        goto unlock_and_fail;
+
+    /* The fragment stays referenced by the stream until we drop it, so
+     * it may be used without the lock */
+    *data = (const uint8_t*) p->read_data + p->read_index;
+    *length = p->read_length;
+
+    pa_threaded_mainloop_unlock(p->mainloop);
+    return 0;
+
+unlock_and_fail:
+    pa_threaded_mainloop_unlock(p->mainloop);
+    return -1;
+}
+
+int pa_simple_drop(pa_simple *p, size_t length, int *rerror) {
+    pa_assert(p);
+
+    CHECK_VALIDITY_RETURN_ANY(rerror, p->direction == PA_STREAM_RECORD, PA_ERR_BADSTATE, -1);
+    CHECK_VALIDITY_RETURN_ANY(rerror, p->read_data, PA_ERR_BADSTATE, -1);
+    CHECK_VALIDITY_RETURN_ANY(rerror, length > 0 && length <= p->read_length, PA_ERR_INVALID, -1);
+
+    pa_threaded_mainloop_lock(p->mainloop);
+
+    CHECK_DEAD_GOTO(p, rerror, unlock_and_fail);
+
+    if (read_advance(p, length, rerror) < 0)
+        goto unlock_and_fail;
 
     pa_threaded_mainloop_unlock(p->mainloop);
     return 0;
@@ -392,6 +572,9 @@ int pa_simple_drain(pa_simple *p, int *rerror) {
     pa_threaded_mainloop_lock(p->mainloop);
     CHECK_DEAD_GOTO(p, rerror, unlock_and_fail);
 
+    if (flush_write_buffer(p, rerror) < 0)
+        goto unlock_and_fail;
+
     o = pa_stream_drain(p->stream, success_cb, p);
     CHECK_SUCCESS_GOTO(p, rerror, o, unlock_and_fail);
 
@@ -428,6 +611,8 @@ int pa_simple_flush(pa_simple *p, int *rerror) {
     pa_threaded_mainloop_lock(p->mainloop);
     CHECK_DEAD_GOTO(p, rerror, unlock_and_fail);
 
+    p->write_length = 0;
+
     o = pa_stream_flush(p->stream, success_cb, p);
     CHECK_SUCCESS_GOTO(p, rerror, o, unlock_and_fail);
 
@@ -474,9 +659,15 @@ pa_usec_t pa_simple_get_latency(pa_simple *p, int *rerror) {
         pa_threaded_mainloop_wait(p->mainloop);
     }
 
+    if (negative)
+        t = 0;
+
+    /* What we are still holding back comes on top */
+    t += pa_bytes_to_usec(p->write_length, pa_stream_get_sample_spec(p->stream));
+
     pa_threaded_mainloop_unlock(p->mainloop);
 
-    return negative ? 0 : t;
+    return t;
 
 unlock_and_fail:
 
@@ -76,6 +76,20 @@
  * system calls. The main difference is that they're called pa_simple_read()
  * and pa_simple_write(). Note that these operations always block.
  *
+ * pa_simple_peek() and pa_simple_drop() read recorded data without
+ * copying it: pa_simple_peek() returns a pointer to the next fragment
+ * received from the server, which stays valid until it is dropped.
+ *
+ * \section ext_sec Latency and batching
+ *
+ * pa_simple_new_ext() takes a target latency, which sets the target
+ * length of the playback buffer resp. the fragment size of a recording
+ * stream unless explicit buffering attributes are given. With
+ * PA_SIMPLE_BATCH_WRITES small writes are collected on the client side
+ * and only passed on once a full request has been gathered, or on
+ * pa_simple_drain(). This saves locking and waking up the connection
+ * for every call, at the expense of up to one request of added latency.
+ *
  * \section ctrl_sec Buffer control
  *
  * If a playback stream is used then a few other operations are available:
@@ -115,6 +129,16 @@ PA_C_DECL_BEGIN
  * An opaque simple connection object */
 typedef struct pa_simple pa_simple;
 
+/** Flags for pa_simple_new_ext(). \since 5.0 */
+typedef enum pa_simple_flags {
+    PA_SIMPLE_NOFLAGS = 0x0000U,
+    /**< Flag to pass when no specific options are needed */
+
+    PA_SIMPLE_BATCH_WRITES = 0x0001U
+    /**< Collect written data on the client side and pass it on a
+     * request at a time. Only for playback. */
+} pa_simple_flags_t;
+
 /** Create a new connection to the server. */
 pa_simple* pa_simple_new(
     const char *server,                 /**< Server name, or NULL for default */
@@ -128,10 +152,27 @@ pa_simple* pa_simple_new(
     int *error                          /**< A pointer where the error code is stored when the routine returns NULL. It is OK to pass NULL here. */
     );
 
+/** Create a new connection to the server, asking for the specified
+ * latency. \since 5.0 */
+pa_simple* pa_simple_new_ext(
+    const char *server,                 /**< Server name, or NULL for default */
+    const char *name,                   /**< A descriptive name for this client (application name, ...) */
+    pa_stream_direction_t dir,          /**< Open this stream for recording or playback? */
+    const char *dev,                    /**< Sink (resp. source) name, or NULL for default */
+    const char *stream_name,            /**< A descriptive name for this stream (application name, song title, ...) */
+    const pa_sample_spec *ss,           /**< The sample type to use */
+    const pa_channel_map *map,          /**< The channel map to use, or NULL for default */
+    const pa_buffer_attr *attr,         /**< Buffering attributes, or NULL for default */
+    pa_usec_t latency,                  /**< Target latency, used for tlength (resp. fragsize) if attr leaves it at -1. 0 for the default. */
+    pa_simple_flags_t flags,            /**< Additional options */
+    int *error                          /**< A pointer where the error code is stored when the routine returns NULL. It is OK to pass NULL here. */
+    );
+
 /** Close and free the connection to the server. The connection object becomes invalid when this is called. */
 void pa_simple_free(pa_simple *s);
 
-/** Write some data to the server. */
+/** Write some data to the server. With PA_SIMPLE_BATCH_WRITES the
+ * data may be held back until more is written. */
 int pa_simple_write(pa_simple *s, const void *data, size_t bytes, int *error);
 
 /** Wait until all data already written is played by the daemon. */
@@ -140,6 +181,16 @@ int pa_simple_drain(pa_simple *s, int *error);
 /** Read some data from the server. */
 int pa_simple_read(pa_simple *s, void *data, size_t bytes, int *error);
 
+/** Wait for recorded data and return a pointer to it, without copying
+ * it. The data stays valid until it has been dropped with
+ * pa_simple_drop(), or pa_simple_read() has been called. \since 5.0 */
+int pa_simple_peek(pa_simple *s, const void **data, size_t *bytes, int *error);
+
+/** Drop the specified number of bytes from the data returned by
+ * pa_simple_peek(). bytes may be less than returned, the rest is
+ * returned again by the next pa_simple_peek(). \since 5.0 */
+int pa_simple_drop(pa_simple *s, size_t bytes, int *error);
+
 /** Return the playback latency. */
 pa_usec_t pa_simple_get_latency(pa_simple *s, int *error);
 
@@ -49,6 +49,10 @@
 #define AUTO_TIMING_INTERVAL_START_USEC (10*PA_USEC_PER_MSEC)
 #define AUTO_TIMING_INTERVAL_END_USEC (1500*PA_USEC_PER_MSEC)
 
+/* How far the read index may drift from what we extrapolate before the
+ * server sends new timing info by itself */
+#define TIMING_PUSH_THRESHOLD_USEC (2*PA_USEC_PER_MSEC)
+
 #define SMOOTHER_ADJUST_TIME (1000*PA_USEC_PER_MSEC)
 #define SMOOTHER_HISTORY_TIME (5000*PA_USEC_PER_MSEC)
 #define SMOOTHER_MIN_HISTORY (4)
@@ -174,6 +178,17 @@ static pa_stream *pa_stream_new_with_proplist_internal(
     s->write_memblock = NULL;
     s->write_data = NULL;
 
+    s->shm_ring = NULL;
+    s->shm_ring_active = FALSE;
+    s->shm_ring_event = NULL;
+    s->write_ring_data = NULL;
+    s->write_ring_length = 0;
+
+    s->rt_ring = NULL;
+    s->rt_fdsem = NULL;
+    s->rt_event = NULL;
+    pa_atomic_store(&s->rt_active, 0);
+
     pa_memchunk_reset(&s->peek_memchunk);
     s->peek_data = NULL;
     s->record_memblockq = NULL;
@@ -193,6 +208,9 @@ static pa_stream *pa_stream_new_with_proplist_internal(
     s->auto_timing_update_event = NULL;
     s->auto_timing_update_requested = FALSE;
     s->auto_timing_interval_usec = AUTO_TIMING_INTERVAL_START_USEC;
+    s->timing_batch_pending = FALSE;
+    s->timing_batch_tag = 0;
+    s->timing_push = FALSE;
 
     reset_callbacks(s);
 
@@ -238,6 +256,25 @@ pa_stream *pa_stream_new_extended(
     return pa_stream_new_with_proplist_internal(c, name, NULL, NULL, formats, n_formats, p);
 }
 
+static void shm_ring_free(pa_stream *s) {
+    pa_assert(s);
+
+    if (s->shm_ring_event) {
+        pa_assert(s->mainloop);
+        s->mainloop->io_free(s->shm_ring_event);
+        s->shm_ring_event = NULL;
+    }
+
+    if (s->shm_ring) {
+        pa_shmring_free(s->shm_ring);
+        s->shm_ring = NULL;
+    }
+
+    s->shm_ring_active = FALSE;
+    s->write_ring_data = NULL;
+    s->write_ring_length = 0;
+}
+
 static void stream_unlink(pa_stream *s) {
     pa_operation *o, *n;
     pa_assert(s);
@@ -275,6 +312,17 @@ static void stream_unlink(pa_stream *s) {
         s->mainloop->time_free(s->auto_timing_update_event);
     }
 
+    shm_ring_free(s);
+
+    /* The ring itself stays around until the stream is freed, the RT
+     * thread might still be looking at it */
+    if (s->rt_event) {
+        pa_assert(s->mainloop);
+        pa_atomic_dec(&s->rt_active);
+        s->mainloop->io_free(s->rt_event);
+        s->rt_event = NULL;
+    }
+
     reset_callbacks(s);
 }
 
@@ -300,6 +348,12 @@ static void stream_free(pa_stream *s) {
     if (s->record_memblockq)
         pa_memblockq_free(s->record_memblockq);
 
+    if (s->rt_ring)
+        pa_shmring_free(s->rt_ring);
+
+    if (s->rt_fdsem)
+        pa_fdsem_free(s->rt_fdsem);
+
     if (s->proplist)
         pa_proplist_free(s->proplist);
 
@@ -376,6 +430,8 @@ void pa_stream_set_state(pa_stream *s, pa_stream_state_t st) {
     pa_stream_unref(s);
 }
 
+static void timing_batch_cb(pa_mainloop_api *m, pa_defer_event *e, void *userdata);
+
 static void request_auto_timing_update(pa_stream *s, pa_bool_t force) {
     pa_assert(s);
     pa_assert(PA_REFCNT_VALUE(s) >= 1);
@@ -384,6 +440,20 @@ static void request_auto_timing_update(pa_stream *s, pa_bool_t force) {
         return;
 
     if (s->state == PA_STREAM_READY &&
+        (force || !s->auto_timing_update_requested) &&
+        s->direction == PA_STREAM_PLAYBACK && s->context->version >= 30) {
+
+        /* Newer servers take the queries of all playback streams in one
+         * go, which is sent from timing_batch_cb() */
+        if (!s->context->timing_batch_event)
+            s->context->timing_batch_event = s->mainloop->defer_new(s->mainloop, timing_batch_cb, s->context);
+
+        s->mainloop->defer_enable(s->context->timing_batch_event, 1);
+
+        s->timing_batch_pending = TRUE;
+        s->auto_timing_update_requested = TRUE;
+
+    } else if (s->state == PA_STREAM_READY &&
         (force || !s->auto_timing_update_requested)) {
         pa_operation *o;
 
@@ -579,7 +649,7 @@ void pa_command_stream_moved(pa_pdispatch *pd, uint32_t command, uint32_t tag, p
 
     s->suspended = suspended;
 
-    if ((s->flags & PA_STREAM_AUTO_TIMING_UPDATE) && !suspended && !s->auto_timing_update_event) {
+    if ((s->flags & PA_STREAM_AUTO_TIMING_UPDATE) && !suspended && !s->auto_timing_update_event && !s->timing_push) {
         s->auto_timing_interval_usec = AUTO_TIMING_INTERVAL_START_USEC;
         s->auto_timing_update_event = pa_context_rttime_new(s->context, pa_rtclock_now() + s->auto_timing_interval_usec, &auto_timing_update_callback, s);
         request_auto_timing_update(s, TRUE);
@@ -703,7 +773,7 @@ void pa_command_stream_suspended(pa_pdispatch *pd, uint32_t command, uint32_t ta
 
     s->suspended = suspended;
 
-    if ((s->flags & PA_STREAM_AUTO_TIMING_UPDATE) && !suspended && !s->auto_timing_update_event) {
+    if ((s->flags & PA_STREAM_AUTO_TIMING_UPDATE) && !suspended && !s->auto_timing_update_event && !s->timing_push) {
         s->auto_timing_interval_usec = AUTO_TIMING_INTERVAL_START_USEC;
         s->auto_timing_update_event = pa_context_rttime_new(s->context, pa_rtclock_now() + s->auto_timing_interval_usec, &auto_timing_update_callback, s);
         request_auto_timing_update(s, TRUE);
@@ -812,8 +882,59 @@ finish:
         pa_proplist_free(pl);
 }
 
-void pa_command_request(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+/* Pass on what pa_stream_write_rt() queued, as far as the server asked
+ * for it */
+static void rt_write_drain(pa_stream *s) {
+    pa_assert(s);
+
+    if (!s->rt_event)
+        return;
+
+    pa_stream_ref(s);
+
+    while (s->state == PA_STREAM_READY && s->rt_event) {
+        const void *d;
+        size_t l, n;
+
+        if ((n = pa_stream_writable_size(s)) <= 0 || n == (size_t) -1)
+            break;
+
+        if (!(d = pa_shmring_peek(s->rt_ring, &l)))
+            break;
+
+        l = PA_MIN(l, n);
+
+        if (pa_stream_write(s, d, l, NULL, 0, PA_SEEK_RELATIVE) < 0)
+            break;
+
+        pa_shmring_drop(s->rt_ring, l);
+    }
+
+    pa_stream_unref(s);
+}
+
+static void stream_request_bytes(pa_context *c, uint32_t channel, uint32_t bytes) {
     pa_stream *s;
+
+    if (!(s = pa_hashmap_get(c->playback_streams, PA_UINT32_TO_PTR(channel))))
+        return;
+
+    if (s->state != PA_STREAM_READY)
+        return;
+
+    s->requested_bytes += bytes;
+
+#ifdef STREAM_DEBUG
+    pa_log_debug("got request for %lli, now at %lli", (long long) bytes, (long long) s->requested_bytes);
+#endif
+
+    rt_write_drain(s);
+
+    if (s->requested_bytes > 0 && s->write_callback)
+        s->write_callback(s, (size_t) s->requested_bytes, s->write_userdata);
+}
+
+void pa_command_request(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
     pa_context *c = userdata;
     uint32_t bytes, channel;
 
@@ -832,20 +953,34 @@ void pa_command_request(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tag
         goto finish;
     }
 
-    if (!(s = pa_hashmap_get(c->playback_streams, PA_UINT32_TO_PTR(channel))))
-        goto finish;
+    stream_request_bytes(c, channel, bytes);
 
-    if (s->state != PA_STREAM_READY)
-        goto finish;
+finish:
+    pa_context_unref(c);
+}
 
-    s->requested_bytes += bytes;
+void pa_command_request_batch(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    pa_context *c = userdata;
 
-#ifdef STREAM_DEBUG
-    pa_log_debug("got request for %lli, now at %lli", (long long) bytes, (long long) s->requested_bytes);
-#endif
+    pa_assert(pd);
+    pa_assert(command == PA_COMMAND_REQUEST_BATCH);
+    pa_assert(t);
+    pa_assert(c);
+    pa_assert(PA_REFCNT_VALUE(c) >= 1);
 
-    if (s->requested_bytes > 0 && s->write_callback)
-        s->write_callback(s, (size_t) s->requested_bytes, s->write_userdata);
+    pa_context_ref(c);
+
+    while (!pa_tagstruct_eof(t)) {
+        uint32_t bytes, channel;
+
+        if (pa_tagstruct_getu32(t, &channel) < 0 ||
+            pa_tagstruct_getu32(t, &bytes) < 0) {
+            pa_context_fail(c, PA_ERR_PROTOCOL);
+            goto finish;
+        }
+
+        stream_request_bytes(c, channel, bytes);
+    }
 
 finish:
     pa_context_unref(c);
@@ -960,11 +1095,257 @@ static void auto_timing_update_callback(pa_mainloop_api *m, pa_time_event *e, co
     pa_stream_unref(s);
 }
 
+/* Call the write callback for as long as the server freed space in the
+ * SHM ring meanwhile, then sleep on the fdsem again */
+static void shm_ring_dispatch(pa_stream *s) {
+    pa_fdsem *f;
+
+    pa_assert(s);
+    pa_assert(s->shm_ring_active);
+
+    pa_stream_ref(s);
+
+    f = pa_shmring_get_fdsem(s->shm_ring);
+
+    for (;;) {
+        size_t l;
+
+        rt_write_drain(s);
+
+        if (s->write_callback && (l = pa_stream_writable_size(s)) > 0)
+            s->write_callback(s, l, s->write_userdata);
+
+        /* The callback might have disconnected us */
+        if (!s->shm_ring_active || pa_fdsem_before_poll(f) >= 0)
+            break;
+    }
+
+    pa_stream_unref(s);
+}
+
+static void shm_ring_event_cb(pa_mainloop_api *m, pa_io_event *e, int fd, pa_io_event_flags_t events, void *userdata) {
+    pa_stream *s = userdata;
+
+    pa_assert(s);
+    pa_assert(PA_REFCNT_VALUE(s) >= 1);
+    pa_assert(s->shm_ring_event == e);
+
+    pa_fdsem_after_poll(pa_shmring_get_fdsem(s->shm_ring));
+    shm_ring_dispatch(s);
+}
+
+static void shm_ring_setup_callback(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    pa_stream *s = userdata;
+
+    pa_assert(pd);
+    pa_assert(s);
+    pa_assert(PA_REFCNT_VALUE(s) >= 1);
+
+    pa_stream_ref(s);
+
+    /* Disconnected in the meantime */
+    if (!s->context || !s->shm_ring)
+        goto finish;
+
+    if (command != PA_COMMAND_REPLY) {
+        if (pa_context_handle_error(s->context, command, t, FALSE) < 0)
+            goto finish;
+
+        pa_log_debug("Server refused the SHM ring, sending memblocks.");
+        shm_ring_free(s);
+        goto finish;
+    }
+
+    if (!pa_tagstruct_eof(t)) {
+        pa_context_fail(s->context, PA_ERR_PROTOCOL);
+        goto finish;
+    }
+
+    /* Everything we write from now on is queued behind the memblocks we
+     * sent so far */
+    s->shm_ring_active = TRUE;
+    s->shm_ring_event = s->mainloop->io_new(s->mainloop, pa_fdsem_get(pa_shmring_get_fdsem(s->shm_ring)), PA_IO_EVENT_INPUT, shm_ring_event_cb, s);
+
+    if (s->state == PA_STREAM_READY)
+        shm_ring_dispatch(s);
+
+finish:
+    pa_stream_unref(s);
+}
+
+/* Hand a SHM ring for the stream data over to the server. Until it
+ * replies we go on sending memblocks. */
+static void shm_ring_setup(pa_stream *s) {
+    pa_tagstruct *t;
+    uint32_t tag;
+    int fds[2];
+
+    pa_assert(s);
+    pa_assert(!s->shm_ring);
+
+    /* The descriptors can only be passed along if memfd has been
+     * enabled for the connection */
+    if (s->context->version < 30 || !s->context->do_shm) {
+        pa_log_debug("SHM ring not supported by the connection, sending memblocks.");
+        return;
+    }
+
+    if (!(s->shm_ring = pa_shmring_new(s->buffer_attr.tlength))) {
+        pa_log_debug("Failed to create SHM ring, sending memblocks.");
+        return;
+    }
+
+    t = pa_tagstruct_command(s->context, PA_COMMAND_SET_PLAYBACK_STREAM_SHM_RING, &tag);
+    pa_tagstruct_putu32(t, s->channel);
+
+    pa_shmring_get_fds(s->shm_ring, fds);
+    pa_pstream_send_tagstruct_with_fds(s->context->pstream, t, fds, 2);
+    pa_pdispatch_register_reply(s->context->pdispatch, tag, DEFAULT_TIMEOUT, shm_ring_setup_callback, pa_stream_ref(s), (pa_free_cb_t) pa_stream_unref);
+}
+
+static void timing_push_setup_callback(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    pa_stream *s = userdata;
+
+    pa_assert(pd);
+    pa_assert(s);
+    pa_assert(PA_REFCNT_VALUE(s) >= 1);
+
+    if (!s->context || s->state != PA_STREAM_READY)
+        return;
+
+    if (command != PA_COMMAND_REPLY) {
+        if (pa_context_handle_error(s->context, command, t, FALSE) < 0)
+            return;
+
+        pa_log_debug("Server refused to push timing info, polling.");
+        return;
+    }
+
+    if (!pa_tagstruct_eof(t)) {
+        pa_context_fail(s->context, PA_ERR_PROTOCOL);
+        return;
+    }
+
+    /* From now on the server tells us when our extrapolation goes
+     * wrong, no need to ask it periodically anymore */
+    s->timing_push = TRUE;
+
+    if (s->auto_timing_update_event) {
+        s->mainloop->time_free(s->auto_timing_update_event);
+        s->auto_timing_update_event = NULL;
+    }
+}
+
+/* Ask the server to send new timing info whenever the stream does not
+ * play like stream_apply_timing_reply() extrapolated. Until it replies
+ * we go on polling. */
+static void timing_push_setup(pa_stream *s) {
+    pa_tagstruct *t;
+    uint32_t tag;
+
+    pa_assert(s);
+
+    if (s->context->version < 30)
+        return;
+
+    t = pa_tagstruct_command(s->context, PA_COMMAND_SET_PLAYBACK_STREAM_TIMING_PUSH, &tag);
+    pa_tagstruct_putu32(t, s->channel);
+    pa_tagstruct_put_usec(t, TIMING_PUSH_THRESHOLD_USEC);
+    pa_pstream_send_tagstruct(s->context->pstream, t);
+    pa_pdispatch_register_reply(s->context->pdispatch, tag, DEFAULT_TIMEOUT, timing_push_setup_callback, pa_stream_ref(s), (pa_free_cb_t) pa_stream_unref);
+}
+
+static void adaptive_latency_setup_callback(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    pa_stream *s = userdata;
+
+    pa_assert(pd);
+    pa_assert(s);
+    pa_assert(PA_REFCNT_VALUE(s) >= 1);
+
+    if (!s->context || s->state != PA_STREAM_READY)
+        return;
+
+    if (command != PA_COMMAND_REPLY) {
+        if (pa_context_handle_error(s->context, command, t, FALSE) < 0)
+            return;
+
+        pa_log_debug("Server refused to adapt the latency.");
+        return;
+    }
+
+    if (!pa_tagstruct_eof(t))
+        pa_context_fail(s->context, PA_ERR_PROTOCOL);
+}
+
+/* The server picks the upper bound from the buffer attributes we asked
+ * for */
+static void adaptive_latency_setup(pa_stream *s) {
+    pa_tagstruct *t;
+    uint32_t tag;
+
+    pa_assert(s);
+
+    if (s->context->version < 30)
+        return;
+
+    t = pa_tagstruct_command(s->context, PA_COMMAND_SET_PLAYBACK_STREAM_ADAPTIVE_LATENCY, &tag);
+    pa_tagstruct_putu32(t, s->channel);
+    pa_tagstruct_putu32(t, (uint32_t) -1);
+    pa_pstream_send_tagstruct(s->context->pstream, t);
+    pa_pdispatch_register_reply(s->context->pdispatch, tag, DEFAULT_TIMEOUT, adaptive_latency_setup_callback, pa_stream_ref(s), (pa_free_cb_t) pa_stream_unref);
+}
+
+static void rt_event_cb(pa_mainloop_api *m, pa_io_event *e, int fd, pa_io_event_flags_t events, void *userdata) {
+    pa_stream *s = userdata;
+
+    pa_assert(s);
+    pa_assert(PA_REFCNT_VALUE(s) >= 1);
+    pa_assert(s->rt_event == e);
+
+    pa_fdsem_after_poll(s->rt_fdsem);
+
+    pa_stream_ref(s);
+
+    do {
+        rt_write_drain(s);
+    } while (s->rt_event && pa_fdsem_before_poll(s->rt_fdsem) < 0);
+
+    pa_stream_unref(s);
+}
+
+/* Called before the stream becomes ready, so that the RT thread finds
+ * everything in place once rt_active is set */
+static void rt_write_setup(pa_stream *s) {
+    pa_assert(s);
+    pa_assert(!s->rt_ring);
+
+    if (!(s->rt_ring = pa_shmring_new_private(s->buffer_attr.tlength)) ||
+        !(s->rt_fdsem = pa_fdsem_new())) {
+        pa_log_warn("Failed to allocate the real-time write buffer.");
+        return;
+    }
+
+    s->rt_event = s->mainloop->io_new(s->mainloop, pa_fdsem_get(s->rt_fdsem), PA_IO_EVENT_INPUT, rt_event_cb, s);
+    pa_assert_se(pa_fdsem_before_poll(s->rt_fdsem) >= 0);
+
+    /* Also a barrier */
+    pa_atomic_inc(&s->rt_active);
+}
+
 static void create_stream_complete(pa_stream *s) {
     pa_assert(s);
     pa_assert(PA_REFCNT_VALUE(s) >= 1);
     pa_assert(s->state == PA_STREAM_CREATING);
 
+    if (s->direction == PA_STREAM_PLAYBACK && (s->flags & PA_STREAM_SHM_RING))
+        shm_ring_setup(s);
+
+    if (s->direction == PA_STREAM_PLAYBACK && (s->flags & PA_STREAM_RT_WRITE))
+        rt_write_setup(s);
+
+    if (s->direction == PA_STREAM_PLAYBACK && (s->flags & PA_STREAM_ADAPTIVE_LATENCY))
+        adaptive_latency_setup(s);
+
     pa_stream_set_state(s, PA_STREAM_READY);
 
     if (s->requested_bytes > 0 && s->write_callback)
@@ -975,6 +1356,11 @@ static void create_stream_complete(pa_stream *s) {
         pa_assert(!s->auto_timing_update_event);
         s->auto_timing_update_event = pa_context_rttime_new(s->context, pa_rtclock_now() + s->auto_timing_interval_usec, &auto_timing_update_callback, s);
 
+        /* Ahead of the first query, which the server then starts
+         * pushing from */
+        if (s->direction == PA_STREAM_PLAYBACK)
+            timing_push_setup(s);
+
         request_auto_timing_update(s, TRUE);
     }
 
@@ -1213,7 +1599,10 @@ static int create_stream(
                                               PA_STREAM_START_UNMUTED|
                                               PA_STREAM_FAIL_ON_SUSPEND|
                                               PA_STREAM_RELATIVE_VOLUME|
-                                              PA_STREAM_PASSTHROUGH)), PA_ERR_INVALID);
+                                              PA_STREAM_PASSTHROUGH|
+                                              PA_STREAM_SHM_RING|
+                                              PA_STREAM_RT_WRITE|
+                                              PA_STREAM_ADAPTIVE_LATENCY)), PA_ERR_INVALID);
 
     PA_CHECK_VALIDITY(s->context, s->context->version >= 12 || !(flags & PA_STREAM_VARIABLE_RATE), PA_ERR_NOTSUPPORTED);
     PA_CHECK_VALIDITY(s->context, s->context->version >= 13 || !(flags & PA_STREAM_PEAK_DETECT), PA_ERR_NOTSUPPORTED);
@@ -1224,6 +1613,7 @@ static int create_stream(
      * client development easier */
 
     PA_CHECK_VALIDITY(s->context, direction == PA_STREAM_RECORD || !(flags & (PA_STREAM_PEAK_DETECT)), PA_ERR_INVALID);
+    PA_CHECK_VALIDITY(s->context, direction == PA_STREAM_PLAYBACK || !(flags & (PA_STREAM_SHM_RING|PA_STREAM_RT_WRITE|PA_STREAM_ADAPTIVE_LATENCY)), PA_ERR_INVALID);
     PA_CHECK_VALIDITY(s->context, !volume || s->n_formats || (pa_sample_spec_valid(&s->sample_spec) && volume->channels == s->sample_spec.channels), PA_ERR_INVALID);
     PA_CHECK_VALIDITY(s->context, !sync_stream || (direction == PA_STREAM_PLAYBACK && sync_stream->direction == PA_STREAM_PLAYBACK), PA_ERR_INVALID);
     PA_CHECK_VALIDITY(s->context, (flags & (PA_STREAM_ADJUST_LATENCY|PA_STREAM_EARLY_REQUESTS)) != (PA_STREAM_ADJUST_LATENCY|PA_STREAM_EARLY_REQUESTS), PA_ERR_INVALID);
@@ -1408,6 +1798,24 @@ int pa_stream_connect_record(
     return create_stream(PA_STREAM_RECORD, s, dev, attr, flags, NULL, NULL);
 }
 
+/* The free space of the SHM ring, limited to what the server asked
+ * for as target length */
+static size_t shm_ring_writable_size(pa_stream *s) {
+    size_t l, fs;
+
+    pa_assert(s->shm_ring_active);
+
+    l = pa_shmring_get_length(s->shm_ring);
+    fs = pa_frame_size(&s->sample_spec);
+
+    if (l >= s->buffer_attr.tlength)
+        return 0;
+
+    l = PA_MIN(pa_shmring_get_size(s->shm_ring) - l, s->buffer_attr.tlength - l);
+
+    return (l / fs) * fs;
+}
+
 int pa_stream_begin_write(
         pa_stream *s,
         void **data,
@@ -1433,16 +1841,47 @@ int pa_stream_begin_write(
             *nbytes = m;
     }
 
-    if (!s->write_memblock) {
-        s->write_memblock = pa_memblock_new(s->context->mempool, *nbytes);
-        s->write_data = pa_memblock_acquire(s->write_memblock);
-    }
+    if (s->shm_ring_active && !s->write_memblock) {
+        size_t l, fs;
+        void *d;
 
-    *data = s->write_data;
-    *nbytes = pa_memblock_get_length(s->write_memblock);
+        fs = pa_frame_size(&s->sample_spec);
 
-    return 0;
-}
+        /* Hand out the ring itself if the free space does not wrap
+         * before the first frame */
+        if ((d = pa_shmring_begin_write(s->shm_ring, &l)) && l >= fs) {
+            l = PA_MIN(l, shm_ring_writable_size(s));
+
+            if (*nbytes != (size_t) -1)
+                l = PA_MIN(l, *nbytes);
+
+            l = (l / fs) * fs;
+
+            if (l > 0) {
+                s->write_ring_data = d;
+                s->write_ring_length = l;
+
+                *data = d;
+                *nbytes = l;
+
+                return 0;
+            }
+        }
+    }
+
+    s->write_ring_data = NULL;
+    s->write_ring_length = 0;
+
+    if (!s->write_memblock) {
+        s->write_memblock = pa_memblock_new(s->context->mempool, *nbytes);
+        s->write_data = pa_memblock_acquire(s->write_memblock);
+    }
+
+    *data = s->write_data;
+    *nbytes = pa_memblock_get_length(s->write_memblock);
+
+    return 0;
+}
 
 int pa_stream_cancel_write(
         pa_stream *s) {
@@ -1453,7 +1892,13 @@ int pa_stream_cancel_write(
     PA_CHECK_VALIDITY(s->context, !pa_detect_fork(), PA_ERR_FORKED);
     PA_CHECK_VALIDITY(s->context, s->state == PA_STREAM_READY, PA_ERR_BADSTATE);
     PA_CHECK_VALIDITY(s->context, s->direction == PA_STREAM_PLAYBACK || s->direction == PA_STREAM_UPLOAD, PA_ERR_BADSTATE);
-    PA_CHECK_VALIDITY(s->context, s->write_memblock, PA_ERR_BADSTATE);
+    PA_CHECK_VALIDITY(s->context, s->write_memblock || s->write_ring_data, PA_ERR_BADSTATE);
+
+    if (s->write_ring_data) {
+        s->write_ring_data = NULL;
+        s->write_ring_length = 0;
+        return 0;
+    }
 
     pa_assert(s->write_data);
 
@@ -1465,6 +1910,50 @@ int pa_stream_cancel_write(
     return 0;
 }
 
+/* Update the request and the write index after data has been sent */
+static void stream_account_write(pa_stream *s, size_t length, int64_t offset, pa_seek_mode_t seek) {
+    /* This is obviously wrong since we ignore the seeking index . But
+     * that's OK, the server side applies the same error */
+    s->requested_bytes -= (seek == PA_SEEK_RELATIVE ? offset : 0) + (int64_t) length;
+
+#ifdef STREAM_DEBUG
+    pa_log_debug("wrote %lli, now at %lli", (long long) length, (long long) s->requested_bytes);
+#endif
+
+    if (s->direction == PA_STREAM_PLAYBACK) {
+
+        /* Update latency request correction */
+        if (s->write_index_corrections[s->current_write_index_correction].valid) {
+
+            if (seek == PA_SEEK_ABSOLUTE) {
+                s->write_index_corrections[s->current_write_index_correction].corrupt = FALSE;
+                s->write_index_corrections[s->current_write_index_correction].absolute = TRUE;
+                s->write_index_corrections[s->current_write_index_correction].value = offset + (int64_t) length;
+            } else if (seek == PA_SEEK_RELATIVE) {
+                if (!s->write_index_corrections[s->current_write_index_correction].corrupt)
+                    s->write_index_corrections[s->current_write_index_correction].value += offset + (int64_t) length;
+            } else
+                s->write_index_corrections[s->current_write_index_correction].corrupt = TRUE;
+        }
+
+        /* Update the write index in the already available latency data */
+        if (s->timing_info_valid) {
+
+            if (seek == PA_SEEK_ABSOLUTE) {
+                s->timing_info.write_index_corrupt = FALSE;
+                s->timing_info.write_index = offset + (int64_t) length;
+            } else if (seek == PA_SEEK_RELATIVE) {
+                if (!s->timing_info.write_index_corrupt)
+                    s->timing_info.write_index += offset + (int64_t) length;
+            } else
+                s->timing_info.write_index_corrupt = TRUE;
+        }
+
+        if (!s->timing_info_valid || s->timing_info.write_index_corrupt)
+            request_auto_timing_update(s, TRUE);
+    }
+}
+
 int pa_stream_write(
         pa_stream *s,
         const void *data,
@@ -1487,9 +1976,48 @@ int pa_stream_write(
                       ((data >= s->write_data) &&
                        ((const char*) data + length <= (const char*) s->write_data + pa_memblock_get_length(s->write_memblock))),
                       PA_ERR_INVALID);
-    PA_CHECK_VALIDITY(s->context, !free_cb || !s->write_memblock, PA_ERR_INVALID);
+    PA_CHECK_VALIDITY(s->context,
+                      !s->write_ring_data ||
+                      ((data >= s->write_ring_data) &&
+                       ((const char*) data + length <= (const char*) s->write_ring_data + s->write_ring_length)),
+                      PA_ERR_INVALID);
+    PA_CHECK_VALIDITY(s->context, !free_cb || (!s->write_memblock && !s->write_ring_data), PA_ERR_INVALID);
 
-    if (s->write_memblock) {
+    if (s->shm_ring_active) {
+        /* The ring has no room for seeks */
+        PA_CHECK_VALIDITY(s->context, seek == PA_SEEK_RELATIVE && offset == 0, PA_ERR_NOTSUPPORTED);
+        PA_CHECK_VALIDITY(s->context, length <= shm_ring_writable_size(s), PA_ERR_TOOLARGE);
+    }
+
+    if (s->write_ring_data) {
+
+        /* pa_stream_write_begin() handed out the ring */
+
+        if (data != s->write_ring_data)
+            memmove(s->write_ring_data, data, length);
+
+        s->write_ring_data = NULL;
+        s->write_ring_length = 0;
+
+        pa_shmring_end_write(s->shm_ring, length);
+
+    } else if (s->shm_ring_active) {
+
+        pa_assert_se(pa_shmring_write(s->shm_ring, data, length) == length);
+
+        /* The block might have been handed out before the ring was set
+         * up */
+        if (s->write_memblock) {
+            pa_memblock_release(s->write_memblock);
+            pa_memblock_unref(s->write_memblock);
+            s->write_memblock = NULL;
+            s->write_data = NULL;
+        }
+
+        if (free_cb)
+            free_cb((void*) data);
+
+    } else if (s->write_memblock) {
         pa_memchunk chunk;
 
         /* pa_stream_write_begin() was called before */
@@ -1548,47 +2076,95 @@ int pa_stream_write(
             free_cb((void*) data);
     }
 
-    /* This is obviously wrong since we ignore the seeking index . But
-     * that's OK, the server side applies the same error */
-    s->requested_bytes -= (seek == PA_SEEK_RELATIVE ? offset : 0) + (int64_t) length;
+    stream_account_write(s, length, offset, seek);
 
-#ifdef STREAM_DEBUG
-    pa_log_debug("wrote %lli, now at %lli", (long long) length, (long long) s->requested_bytes);
-#endif
+    return 0;
+}
 
-    if (s->direction == PA_STREAM_PLAYBACK) {
+int pa_stream_writev(pa_stream *s, const pa_stream_iovec *iov, unsigned n, pa_usec_t play_at) {
+    size_t length = 0, l;
+    int64_t offset = 0;
+    pa_seek_mode_t seek = PA_SEEK_RELATIVE;
+    unsigned k;
 
-        /* Update latency request correction */
-        if (s->write_index_corrections[s->current_write_index_correction].valid) {
+    pa_assert(s);
+    pa_assert(PA_REFCNT_VALUE(s) >= 1);
 
-            if (seek == PA_SEEK_ABSOLUTE) {
-                s->write_index_corrections[s->current_write_index_correction].corrupt = FALSE;
-                s->write_index_corrections[s->current_write_index_correction].absolute = TRUE;
-                s->write_index_corrections[s->current_write_index_correction].value = offset + (int64_t) length;
-            } else if (seek == PA_SEEK_RELATIVE) {
-                if (!s->write_index_corrections[s->current_write_index_correction].corrupt)
-                    s->write_index_corrections[s->current_write_index_correction].value += offset + (int64_t) length;
-            } else
-                s->write_index_corrections[s->current_write_index_correction].corrupt = TRUE;
-        }
+    PA_CHECK_VALIDITY(s->context, !pa_detect_fork(), PA_ERR_FORKED);
+    PA_CHECK_VALIDITY(s->context, s->state == PA_STREAM_READY, PA_ERR_BADSTATE);
+    PA_CHECK_VALIDITY(s->context, s->direction == PA_STREAM_PLAYBACK || s->direction == PA_STREAM_UPLOAD, PA_ERR_BADSTATE);
+    PA_CHECK_VALIDITY(s->context, !s->write_memblock && !s->write_ring_data, PA_ERR_BADSTATE);
+    PA_CHECK_VALIDITY(s->context, iov && n > 0, PA_ERR_INVALID);
+    PA_CHECK_VALIDITY(s->context, s->direction == PA_STREAM_PLAYBACK || play_at == PA_USEC_INVALID, PA_ERR_INVALID);
 
-        /* Update the write index in the already available latency data */
-        if (s->timing_info_valid) {
+    for (k = 0; k < n; k++) {
+        PA_CHECK_VALIDITY(s->context, iov[k].data || iov[k].length == 0, PA_ERR_INVALID);
+        length += iov[k].length;
+    }
 
-            if (seek == PA_SEEK_ABSOLUTE) {
-                s->timing_info.write_index_corrupt = FALSE;
-                s->timing_info.write_index = offset + (int64_t) length;
-            } else if (seek == PA_SEEK_RELATIVE) {
-                if (!s->timing_info.write_index_corrupt)
-                    s->timing_info.write_index += offset + (int64_t) length;
-            } else
-                s->timing_info.write_index_corrupt = TRUE;
-        }
+    PA_CHECK_VALIDITY(s->context, length > 0, PA_ERR_INVALID);
 
-        if (!s->timing_info_valid || s->timing_info.write_index_corrupt)
-            request_auto_timing_update(s, TRUE);
+    /* The stream time is the position in the stream, so the data simply
+     * goes to the matching write index */
+    if (play_at != PA_USEC_INVALID) {
+        offset = (int64_t) pa_usec_to_bytes(play_at, &s->sample_spec);
+        seek = PA_SEEK_ABSOLUTE;
     }
 
+    if (s->shm_ring_active) {
+        PA_CHECK_VALIDITY(s->context, seek == PA_SEEK_RELATIVE, PA_ERR_NOTSUPPORTED);
+        PA_CHECK_VALIDITY(s->context, length <= shm_ring_writable_size(s), PA_ERR_TOOLARGE);
+
+        for (k = 0; k < n; k++)
+            if (iov[k].length > 0)
+                pa_assert_se(pa_shmring_write(s->shm_ring, iov[k].data, iov[k].length) == iov[k].length);
+
+    } else {
+        pa_seek_mode_t t_seek = seek;
+        int64_t t_offset = offset;
+        size_t t_length = length, skip = 0;
+
+        /* Gather the buffers into as few blocks as possible, which are
+         * sent as one frame each */
+        k = 0;
+        while (t_length > 0) {
+            pa_memchunk chunk;
+            uint8_t *d;
+
+            chunk.index = 0;
+            chunk.length = PA_MIN(t_length, pa_mempool_block_size_max(s->context->mempool));
+            chunk.memblock = pa_memblock_new(s->context->mempool, chunk.length);
+
+            d = pa_memblock_acquire(chunk.memblock);
+
+            for (l = 0; l < chunk.length;) {
+                size_t m;
+
+                pa_assert(k < n);
+
+                m = PA_MIN(iov[k].length - skip, chunk.length - l);
+                memcpy(d + l, (const uint8_t*) iov[k].data + skip, m);
+                l += m;
+
+                if ((skip += m) >= iov[k].length) {
+                    skip = 0;
+                    k++;
+                }
+            }
+
+            pa_memblock_release(chunk.memblock);
+
+            pa_pstream_send_memblock(s->context->pstream, s->channel, t_offset, t_seek, &chunk);
+            pa_memblock_unref(chunk.memblock);
+
+            t_offset = 0;
+            t_seek = PA_SEEK_RELATIVE;
+            t_length -= chunk.length;
+        }
+    }
+
+    stream_account_write(s, length, offset, seek);
+
     return 0;
 }
 
@@ -1662,9 +2238,54 @@ size_t pa_stream_writable_size(pa_stream *s) {
     PA_CHECK_VALIDITY_RETURN_ANY(s->context, s->state == PA_STREAM_READY, PA_ERR_BADSTATE, (size_t) -1);
     PA_CHECK_VALIDITY_RETURN_ANY(s->context, s->direction != PA_STREAM_RECORD, PA_ERR_BADSTATE, (size_t) -1);
 
+    if (s->shm_ring_active)
+        return shm_ring_writable_size(s);
+
     return s->requested_bytes > 0 ? (size_t) s->requested_bytes : 0;
 }
 
+/* Called from any thread, never takes a lock and never touches the
+ * context */
+int pa_stream_write_rt(pa_stream *s, const void *data, size_t length) {
+    size_t fs;
+
+    pa_assert(s);
+    pa_assert(PA_REFCNT_VALUE(s) >= 1);
+    pa_assert(data);
+
+    if (pa_atomic_load(&s->rt_active) <= 0)
+        return -PA_ERR_BADSTATE;
+
+    fs = pa_frame_size(&s->sample_spec);
+
+    if (length % fs != 0)
+        return -PA_ERR_INVALID;
+
+    if (length > pa_stream_writable_size_rt(s))
+        return -PA_ERR_TOOLARGE;
+
+    pa_assert_se(pa_shmring_write(s->rt_ring, data, length) == length);
+    pa_fdsem_post(s->rt_fdsem);
+
+    return 0;
+}
+
+/* Called from any thread */
+size_t pa_stream_writable_size_rt(pa_stream *s) {
+    size_t l, fs;
+
+    pa_assert(s);
+    pa_assert(PA_REFCNT_VALUE(s) >= 1);
+
+    if (pa_atomic_load(&s->rt_active) <= 0)
+        return (size_t) -1;
+
+    fs = pa_frame_size(&s->sample_spec);
+    l = pa_shmring_get_size(s->rt_ring) - pa_shmring_get_length(s->rt_ring);
+
+    return (l / fs) * fs;
+}
+
 size_t pa_stream_readable_size(pa_stream *s) {
     pa_assert(s);
     pa_assert(PA_REFCNT_VALUE(s) >= 1);
@@ -1768,180 +2389,228 @@ static pa_usec_t calc_time(pa_stream *s, pa_bool_t ignore_transport) {
     return usec;
 }
 
-static void stream_get_timing_info_callback(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
-    pa_operation *o = userdata;
-    struct timeval local, remote, now;
-    pa_timing_info *i;
-    pa_bool_t playing = FALSE;
-    uint64_t underrun_for = 0, playing_for = 0;
+/* One timing reply of the server as sent in reply to
+ * PA_COMMAND_GET_(PLAYBACK|RECORD)_LATENCY */
+struct timing_reply {
+    pa_usec_t sink_usec, source_usec;
+    pa_bool_t playing;
+    struct timeval local, remote;
+    int64_t write_index, read_index;
+    uint64_t underrun_for, playing_for;
+};
+
+static int parse_timing_reply(pa_context *c, pa_stream_direction_t direction, pa_tagstruct *t, struct timing_reply *r) {
+    pa_zero(*r);
+
+    if (pa_tagstruct_get_usec(t, &r->sink_usec) < 0 ||
+        pa_tagstruct_get_usec(t, &r->source_usec) < 0 ||
+        pa_tagstruct_get_boolean(t, &r->playing) < 0 ||
+        pa_tagstruct_get_timeval(t, &r->local) < 0 ||
+        pa_tagstruct_get_timeval(t, &r->remote) < 0 ||
+        pa_tagstruct_gets64(t, &r->write_index) < 0 ||
+        pa_tagstruct_gets64(t, &r->read_index) < 0)
+        return -1;
+
+    if (c->version >= 13 &&
+        direction == PA_STREAM_PLAYBACK)
+        if (pa_tagstruct_getu64(t, &r->underrun_for) < 0 ||
+            pa_tagstruct_getu64(t, &r->playing_for) < 0)
+            return -1;
 
-    pa_assert(pd);
-    pa_assert(o);
-    pa_assert(PA_REFCNT_VALUE(o) >= 1);
+    return 0;
+}
 
-    if (!o->context || !o->stream)
-        goto finish;
+/* Update the timing info of the stream from a reply to the query with the
+ * specified tag, or from timing info the server pushed by itself */
+static void stream_apply_timing_reply(pa_stream *s, const struct timing_reply *r, uint32_t tag, pa_bool_t pushed) {
+    struct timeval now;
+    pa_timing_info *i = &s->timing_info;
 
-    i = &o->stream->timing_info;
+    s->timing_info_valid = TRUE;
+    i->read_index_corrupt = FALSE;
 
-    o->stream->timing_info_valid = FALSE;
-    i->write_index_corrupt = TRUE;
-    i->read_index_corrupt = TRUE;
+    /* The server does not know about what we wrote since the last
+     * query, so we keep our own write index for pushed info */
+    if (!pushed) {
+        i->write_index_corrupt = FALSE;
+        i->write_index = r->write_index;
+    }
 
-    if (command != PA_COMMAND_REPLY) {
-        if (pa_context_handle_error(o->context, command, t, FALSE) < 0)
-            goto finish;
+    i->sink_usec = r->sink_usec;
+    i->source_usec = r->source_usec;
+    i->read_index = r->read_index;
 
-    } else {
+    i->playing = (int) r->playing;
+    i->since_underrun = (int64_t) (r->playing ? r->playing_for : r->underrun_for);
 
-        if (pa_tagstruct_get_usec(t, &i->sink_usec) < 0 ||
-            pa_tagstruct_get_usec(t, &i->source_usec) < 0 ||
-            pa_tagstruct_get_boolean(t, &playing) < 0 ||
-            pa_tagstruct_get_timeval(t, &local) < 0 ||
-            pa_tagstruct_get_timeval(t, &remote) < 0 ||
-            pa_tagstruct_gets64(t, &i->write_index) < 0 ||
-            pa_tagstruct_gets64(t, &i->read_index) < 0) {
+    pa_gettimeofday(&now);
 
-            pa_context_fail(o->context, PA_ERR_PROTOCOL);
-            goto finish;
+    /* Calculate timestamps */
+    if (pushed) {
+        /* Both timestamps are the server's, we only learn how long it
+         * took to get here if the clocks are synchronized */
+        if (pa_timeval_cmp(&r->remote, &now) <= 0) {
+            i->transport_usec = pa_timeval_diff(&now, &r->remote);
+            i->synchronized_clocks = TRUE;
+            i->timestamp = r->remote;
+        } else {
+            i->synchronized_clocks = FALSE;
+            i->timestamp = now;
+            pa_timeval_sub(&i->timestamp, i->transport_usec);
         }
 
-        if (o->context->version >= 13 &&
-            o->stream->direction == PA_STREAM_PLAYBACK)
-            if (pa_tagstruct_getu64(t, &underrun_for) < 0 ||
-                pa_tagstruct_getu64(t, &playing_for) < 0) {
+    } else if (pa_timeval_cmp(&r->local, &r->remote) <= 0 && pa_timeval_cmp(&r->remote, &now) <= 0) {
+        /* local and remote seem to have synchronized clocks */
 
-                pa_context_fail(o->context, PA_ERR_PROTOCOL);
-                goto finish;
-            }
+        if (s->direction == PA_STREAM_PLAYBACK)
+            i->transport_usec = pa_timeval_diff(&r->remote, &r->local);
+        else
+            i->transport_usec = pa_timeval_diff(&now, &r->remote);
 
-        if (!pa_tagstruct_eof(t)) {
-            pa_context_fail(o->context, PA_ERR_PROTOCOL);
-            goto finish;
+        i->synchronized_clocks = TRUE;
+        i->timestamp = r->remote;
+    } else {
+        /* clocks are not synchronized, let's estimate latency then */
+        i->transport_usec = pa_timeval_diff(&now, &r->local)/2;
+        i->synchronized_clocks = FALSE;
+        i->timestamp = r->local;
+        pa_timeval_add(&i->timestamp, i->transport_usec);
+    }
+
+    /* Invalidate read and write indexes if necessary */
+    if (!pushed && tag < s->read_index_not_before)
+        i->read_index_corrupt = TRUE;
+
+    if (!pushed && tag < s->write_index_not_before)
+        i->write_index_corrupt = TRUE;
+
+    if (s->direction == PA_STREAM_PLAYBACK && !pushed) {
+        /* Write index correction */
+
+        int n, j;
+        uint32_t ctag = tag;
+
+        /* Go through the saved correction values and add up the
+         * total correction.*/
+        for (n = 0, j = s->current_write_index_correction+1;
+             n < PA_MAX_WRITE_INDEX_CORRECTIONS;
+             n++, j = (j + 1) % PA_MAX_WRITE_INDEX_CORRECTIONS) {
+
+            /* Step over invalid data or out-of-date data */
+            if (!s->write_index_corrections[j].valid ||
+                s->write_index_corrections[j].tag < ctag)
+                continue;
+
+            /* Make sure that everything is in order */
+            ctag = s->write_index_corrections[j].tag+1;
+
+            /* Now fix the write index */
+            if (s->write_index_corrections[j].corrupt) {
+                /* A corrupting seek was made */
+                i->write_index_corrupt = TRUE;
+            } else if (s->write_index_corrections[j].absolute) {
+                /* An absolute seek was made */
+                i->write_index = s->write_index_corrections[j].value;
+                i->write_index_corrupt = FALSE;
+            } else if (!i->write_index_corrupt) {
+                /* A relative seek was made */
+                i->write_index += s->write_index_corrections[j].value;
+            }
         }
-        o->stream->timing_info_valid = TRUE;
-        i->write_index_corrupt = FALSE;
-        i->read_index_corrupt = FALSE;
 
-        i->playing = (int) playing;
-        i->since_underrun = (int64_t) (playing ? playing_for : underrun_for);
+        /* Clear old correction entries */
+        for (n = 0; n < PA_MAX_WRITE_INDEX_CORRECTIONS; n++) {
+            if (!s->write_index_corrections[n].valid)
+                continue;
 
-        pa_gettimeofday(&now);
+            if (s->write_index_corrections[n].tag <= tag)
+                s->write_index_corrections[n].valid = FALSE;
+        }
+    }
 
-        /* Calculate timestamps */
-        if (pa_timeval_cmp(&local, &remote) <= 0 && pa_timeval_cmp(&remote, &now) <= 0) {
-            /* local and remote seem to have synchronized clocks */
+    if (s->direction == PA_STREAM_RECORD) {
+        /* Read index correction */
 
-            if (o->stream->direction == PA_STREAM_PLAYBACK)
-                i->transport_usec = pa_timeval_diff(&remote, &local);
-            else
-                i->transport_usec = pa_timeval_diff(&now, &remote);
+        if (!i->read_index_corrupt)
+            i->read_index -= (int64_t) pa_memblockq_get_length(s->record_memblockq);
+    }
 
-            i->synchronized_clocks = TRUE;
-            i->timestamp = remote;
-        } else {
-            /* clocks are not synchronized, let's estimate latency then */
-            i->transport_usec = pa_timeval_diff(&now, &local)/2;
-            i->synchronized_clocks = FALSE;
-            i->timestamp = local;
-            pa_timeval_add(&i->timestamp, i->transport_usec);
-        }
+    /* Update smoother if we're not corked */
+    if (s->smoother && !s->corked) {
+        pa_usec_t u, x;
 
-        /* Invalidate read and write indexes if necessary */
-        if (tag < o->stream->read_index_not_before)
-            i->read_index_corrupt = TRUE;
+        u = x = pa_rtclock_now() - i->transport_usec;
 
-        if (tag < o->stream->write_index_not_before)
-            i->write_index_corrupt = TRUE;
+        if (s->direction == PA_STREAM_PLAYBACK && s->context->version >= 13) {
+            pa_usec_t su;
 
-        if (o->stream->direction == PA_STREAM_PLAYBACK) {
-            /* Write index correction */
-
-            int n, j;
-            uint32_t ctag = tag;
-
-            /* Go through the saved correction values and add up the
-             * total correction.*/
-            for (n = 0, j = o->stream->current_write_index_correction+1;
-                 n < PA_MAX_WRITE_INDEX_CORRECTIONS;
-                 n++, j = (j + 1) % PA_MAX_WRITE_INDEX_CORRECTIONS) {
-
-                /* Step over invalid data or out-of-date data */
-                if (!o->stream->write_index_corrections[j].valid ||
-                    o->stream->write_index_corrections[j].tag < ctag)
-                    continue;
-
-                /* Make sure that everything is in order */
-                ctag = o->stream->write_index_corrections[j].tag+1;
-
-                /* Now fix the write index */
-                if (o->stream->write_index_corrections[j].corrupt) {
-                    /* A corrupting seek was made */
-                    i->write_index_corrupt = TRUE;
-                } else if (o->stream->write_index_corrections[j].absolute) {
-                    /* An absolute seek was made */
-                    i->write_index = o->stream->write_index_corrections[j].value;
-                    i->write_index_corrupt = FALSE;
-                } else if (!i->write_index_corrupt) {
-                    /* A relative seek was made */
-                    i->write_index += o->stream->write_index_corrections[j].value;
-                }
-            }
+            /* If we weren't playing then it will take some time
+             * until the audio will actually come out through the
+             * speakers. Since we follow that timing here, we need
+             * to try to fix this up */
 
-            /* Clear old correction entries */
-            for (n = 0; n < PA_MAX_WRITE_INDEX_CORRECTIONS; n++) {
-                if (!o->stream->write_index_corrections[n].valid)
-                    continue;
+            su = pa_bytes_to_usec((uint64_t) i->since_underrun, &s->sample_spec);
 
-                if (o->stream->write_index_corrections[n].tag <= tag)
-                    o->stream->write_index_corrections[n].valid = FALSE;
-            }
+            if (su < i->sink_usec)
+                x += i->sink_usec - su;
         }
 
-        if (o->stream->direction == PA_STREAM_RECORD) {
-            /* Read index correction */
+        if (!i->playing)
+            pa_smoother_pause(s->smoother, x);
 
-            if (!i->read_index_corrupt)
-                i->read_index -= (int64_t) pa_memblockq_get_length(o->stream->record_memblockq);
-        }
+        /* Update the smoother */
+        if ((s->direction == PA_STREAM_PLAYBACK && !i->read_index_corrupt) ||
+            (s->direction == PA_STREAM_RECORD && !i->write_index_corrupt))
+            pa_smoother_put(s->smoother, u, calc_time(s, TRUE));
 
-        /* Update smoother if we're not corked */
-        if (o->stream->smoother && !o->stream->corked) {
-            pa_usec_t u, x;
+        if (i->playing)
+            pa_smoother_resume(s->smoother, x, TRUE);
+    }
+}
 
-            u = x = pa_rtclock_now() - i->transport_usec;
+static void stream_invalidate_timing_info(pa_stream *s) {
+    s->timing_info_valid = FALSE;
+    s->timing_info.write_index_corrupt = TRUE;
+    s->timing_info.read_index_corrupt = TRUE;
+}
 
-            if (o->stream->direction == PA_STREAM_PLAYBACK && o->context->version >= 13) {
-                pa_usec_t su;
+static void stream_timing_info_done(pa_stream *s) {
+    s->auto_timing_update_requested = FALSE;
 
-                /* If we weren't playing then it will take some time
-                 * until the audio will actually come out through the
-                 * speakers. Since we follow that timing here, we need
-                 * to try to fix this up */
+    if (s->latency_update_callback)
+        s->latency_update_callback(s, s->latency_update_userdata);
+}
 
-                su = pa_bytes_to_usec((uint64_t) i->since_underrun, &o->stream->sample_spec);
+static void stream_get_timing_info_callback(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    pa_operation *o = userdata;
+    struct timing_reply r;
 
-                if (su < i->sink_usec)
-                    x += i->sink_usec - su;
-            }
+    pa_assert(pd);
+    pa_assert(o);
+    pa_assert(PA_REFCNT_VALUE(o) >= 1);
+
+    if (!o->context || !o->stream)
+        goto finish;
+
+    stream_invalidate_timing_info(o->stream);
 
-            if (!i->playing)
-                pa_smoother_pause(o->stream->smoother, x);
+    if (command != PA_COMMAND_REPLY) {
+        if (pa_context_handle_error(o->context, command, t, FALSE) < 0)
+            goto finish;
 
-            /* Update the smoother */
-            if ((o->stream->direction == PA_STREAM_PLAYBACK && !i->read_index_corrupt) ||
-                (o->stream->direction == PA_STREAM_RECORD && !i->write_index_corrupt))
-                pa_smoother_put(o->stream->smoother, u, calc_time(o->stream, TRUE));
+    } else {
+
+        if (parse_timing_reply(o->context, o->stream->direction, t, &r) < 0 ||
+            !pa_tagstruct_eof(t)) {
 
-            if (i->playing)
-                pa_smoother_resume(o->stream->smoother, x, TRUE);
+            pa_context_fail(o->context, PA_ERR_PROTOCOL);
+            goto finish;
         }
-    }
 
-    o->stream->auto_timing_update_requested = FALSE;
+        stream_apply_timing_reply(o->stream, &r, tag, FALSE);
+    }
 
-    if (o->stream->latency_update_callback)
-        o->stream->latency_update_callback(o->stream, o->stream->latency_update_userdata);
+    stream_timing_info_done(o->stream);
 
     if (o->callback && o->stream && o->stream->state == PA_STREAM_READY) {
         pa_stream_success_cb_t cb = (pa_stream_success_cb_t) o->callback;
@@ -1954,6 +2623,72 @@ finish:
     pa_operation_unref(o);
 }
 
+void pa_command_stream_timing(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    pa_context *c = userdata;
+    pa_stream *s;
+    uint32_t channel;
+    struct timing_reply r;
+
+    pa_assert(pd);
+    pa_assert(command == PA_COMMAND_PLAYBACK_STREAM_TIMING);
+    pa_assert(t);
+    pa_assert(c);
+    pa_assert(PA_REFCNT_VALUE(c) >= 1);
+
+    pa_context_ref(c);
+
+    if (c->version < 30) {
+        pa_context_fail(c, PA_ERR_PROTOCOL);
+        goto finish;
+    }
+
+    if (pa_tagstruct_getu32(t, &channel) < 0 ||
+        parse_timing_reply(c, PA_STREAM_PLAYBACK, t, &r) < 0 ||
+        !pa_tagstruct_eof(t)) {
+        pa_context_fail(c, PA_ERR_PROTOCOL);
+        goto finish;
+    }
+
+    if (!(s = pa_hashmap_get(c->playback_streams, PA_UINT32_TO_PTR(channel))))
+        goto finish;
+
+    if (s->state != PA_STREAM_READY || !s->timing_push)
+        goto finish;
+
+    /* A query on its way makes up for this one, and without valid info
+     * there is nothing to correct */
+    if (!s->timing_info_valid || s->timing_info.read_index_corrupt || s->auto_timing_update_requested)
+        goto finish;
+
+    stream_apply_timing_reply(s, &r, tag, TRUE);
+
+    if (s->latency_update_callback)
+        s->latency_update_callback(s, s->latency_update_userdata);
+
+finish:
+    pa_context_unref(c);
+}
+
+/* Returns the slot for the write index correction of a new timing query,
+ * or -1 if there are too many outstanding ones */
+static int next_write_index_correction(pa_stream *s) {
+    int cidx = (s->current_write_index_correction + 1) % PA_MAX_WRITE_INDEX_CORRECTIONS;
+
+    return s->write_index_corrections[cidx].valid ? -1 : cidx;
+}
+
+static void start_write_index_correction(pa_stream *s, int cidx, uint32_t tag) {
+    /* Fill in initial correction data */
+
+    s->current_write_index_correction = cidx;
+
+    s->write_index_corrections[cidx].valid = TRUE;
+    s->write_index_corrections[cidx].absolute = FALSE;
+    s->write_index_corrections[cidx].corrupt = FALSE;
+    s->write_index_corrections[cidx].tag = tag;
+    s->write_index_corrections[cidx].value = 0;
+}
+
 pa_operation* pa_stream_update_timing_info(pa_stream *s, pa_stream_success_cb_t cb, void *userdata) {
     uint32_t tag;
     pa_operation *o;
@@ -1970,10 +2705,10 @@ pa_operation* pa_stream_update_timing_info(pa_stream *s, pa_stream_success_cb_t
 
     if (s->direction == PA_STREAM_PLAYBACK) {
         /* Find a place to store the write_index correction data for this entry */
-        cidx = (s->current_write_index_correction + 1) % PA_MAX_WRITE_INDEX_CORRECTIONS;
+        cidx = next_write_index_correction(s);
 
         /* Check if we could allocate a correction slot. If not, there are too many outstanding queries */
-        PA_CHECK_VALIDITY_RETURN_NULL(s->context, !s->write_index_corrections[cidx].valid, PA_ERR_INTERNAL);
+        PA_CHECK_VALIDITY_RETURN_NULL(s->context, cidx >= 0, PA_ERR_INTERNAL);
     }
     o = pa_operation_new(s->context, s, (pa_operation_cb_t) cb, userdata);
 
@@ -1987,19 +2722,128 @@ pa_operation* pa_stream_update_timing_info(pa_stream *s, pa_stream_success_cb_t
     pa_pstream_send_tagstruct(s->context->pstream, t);
     pa_pdispatch_register_reply(s->context->pdispatch, tag, DEFAULT_TIMEOUT, stream_get_timing_info_callback, pa_operation_ref(o), (pa_free_cb_t) pa_operation_unref);
 
-    if (s->direction == PA_STREAM_PLAYBACK) {
-        /* Fill in initial correction data */
+    if (s->direction == PA_STREAM_PLAYBACK)
+        start_write_index_correction(s, cidx, tag);
+
+    return o;
+}
 
-        s->current_write_index_correction = cidx;
+static void timing_batch_reply_cb(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    pa_context *c = userdata;
+    pa_stream *s;
+    uint32_t n, i;
+    void *state;
 
-        s->write_index_corrections[cidx].valid = TRUE;
-        s->write_index_corrections[cidx].absolute = FALSE;
-        s->write_index_corrections[cidx].corrupt = FALSE;
-        s->write_index_corrections[cidx].tag = tag;
-        s->write_index_corrections[cidx].value = 0;
+    pa_assert(pd);
+    pa_assert(c);
+    pa_assert(PA_REFCNT_VALUE(c) >= 1);
+
+    pa_context_ref(c);
+
+    if (command != PA_COMMAND_REPLY) {
+        if (pa_context_handle_error(c, command, t, FALSE) < 0)
+            goto finish;
+
+        PA_HASHMAP_FOREACH(s, c->playback_streams, state)
+            if (s->auto_timing_update_requested && s->timing_batch_tag == tag) {
+                stream_invalidate_timing_info(s);
+                stream_timing_info_done(s);
+            }
+
+        goto finish;
     }
 
-    return o;
+    if (pa_tagstruct_getu32(t, &n) < 0)
+        goto fail;
+
+    for (i = 0; i < n; i++) {
+        uint32_t channel;
+        pa_bool_t found;
+        struct timing_reply r;
+
+        if (pa_tagstruct_getu32(t, &channel) < 0 ||
+            pa_tagstruct_get_boolean(t, &found) < 0)
+            goto fail;
+
+        if (found && parse_timing_reply(c, PA_STREAM_PLAYBACK, t, &r) < 0)
+            goto fail;
+
+        /* The stream might have gone away in the meantime */
+        if (!(s = pa_hashmap_get(c->playback_streams, PA_UINT32_TO_PTR(channel))) ||
+            s->timing_batch_tag != tag)
+            continue;
+
+        stream_invalidate_timing_info(s);
+
+        if (found)
+            stream_apply_timing_reply(s, &r, tag, FALSE);
+
+        stream_timing_info_done(s);
+    }
+
+    if (!pa_tagstruct_eof(t))
+        goto fail;
+
+    goto finish;
+
+fail:
+    pa_context_fail(c, PA_ERR_PROTOCOL);
+
+finish:
+    pa_context_unref(c);
+}
+
+static void timing_batch_cb(pa_mainloop_api *m, pa_defer_event *e, void *userdata) {
+    pa_context *c = userdata;
+    pa_tagstruct *t = NULL;
+    pa_stream *s;
+    struct timeval now;
+    uint32_t tag = 0, n = 0;
+    void *state;
+
+    pa_assert(c);
+    pa_assert(c->timing_batch_event == e);
+
+    m->defer_enable(e, 0);
+
+    /* Streams with too many outstanding queries are skipped for now */
+    PA_HASHMAP_FOREACH(s, c->playback_streams, state)
+        if (s->timing_batch_pending && s->state == PA_STREAM_READY && next_write_index_correction(s) >= 0)
+            n++;
+
+    if (n > 0) {
+        t = pa_tagstruct_command(c, PA_COMMAND_GET_PLAYBACK_LATENCY_BATCH, &tag);
+        pa_tagstruct_put_timeval(t, pa_gettimeofday(&now));
+        pa_tagstruct_putu32(t, n);
+    }
+
+    PA_HASHMAP_FOREACH(s, c->playback_streams, state) {
+        int cidx;
+
+        if (!s->timing_batch_pending)
+            continue;
+
+        s->timing_batch_pending = FALSE;
+
+        if (s->state != PA_STREAM_READY || (cidx = next_write_index_correction(s)) < 0) {
+            s->auto_timing_update_requested = FALSE;
+            continue;
+        }
+
+#ifdef STREAM_DEBUG
+        pa_log_debug("Automatically requesting new timing data");
+#endif
+
+        pa_tagstruct_putu32(t, s->channel);
+        start_write_index_correction(s, cidx, tag);
+        s->timing_batch_tag = tag;
+    }
+
+    if (n <= 0)
+        return;
+
+    pa_pstream_send_tagstruct(c->pstream, t);
+    pa_pdispatch_register_reply(c->pdispatch, tag, DEFAULT_TIMEOUT, timing_batch_reply_cb, c, NULL);
 }
 
 void pa_stream_disconnect_callback(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
@@ -2516,6 +3360,34 @@ int pa_stream_get_latency(pa_stream *s, pa_usec_t *r_usec, int *negative) {
     return 0;
 }
 
+int pa_stream_get_time_error(pa_stream *s, pa_usec_t *r_usec) {
+    pa_usec_t usec;
+
+    pa_assert(s);
+    pa_assert(PA_REFCNT_VALUE(s) >= 1);
+    pa_assert(r_usec);
+
+    PA_CHECK_VALIDITY(s->context, !pa_detect_fork(), PA_ERR_FORKED);
+    PA_CHECK_VALIDITY(s->context, s->state == PA_STREAM_READY, PA_ERR_BADSTATE);
+    PA_CHECK_VALIDITY(s->context, s->direction != PA_STREAM_UPLOAD, PA_ERR_BADSTATE);
+    PA_CHECK_VALIDITY(s->context, s->timing_info_valid, PA_ERR_NODATA);
+    PA_CHECK_VALIDITY(s->context, s->direction != PA_STREAM_PLAYBACK || !s->timing_info.read_index_corrupt, PA_ERR_NODATA);
+    PA_CHECK_VALIDITY(s->context, s->direction != PA_STREAM_RECORD || !s->timing_info.write_index_corrupt, PA_ERR_NODATA);
+
+    /* The transport time is all we see of the delay of an update. With
+     * pushes the server keeps the rest within the threshold, otherwise
+     * the drift grows with the age of the last update and this is only
+     * a guess. */
+    if (s->timing_push)
+        usec = TIMING_PUSH_THRESHOLD_USEC + s->timing_info.transport_usec;
+    else
+        usec = s->timing_info.transport_usec + pa_timeval_age(&s->timing_info.timestamp);
+
+    *r_usec = usec;
+
+    return 0;
+}
+
 const pa_timing_info* pa_stream_get_timing_info(pa_stream *s) {
     pa_assert(s);
     pa_assert(PA_REFCNT_VALUE(s) >= 1);
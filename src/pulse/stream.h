@@ -272,6 +272,12 @@
  * you to monitor the current playback time/latency very precisely and
  * very frequently without requiring a network round trip every time.
  *
+ * Newer servers do without the periodic updates for playback streams
+ * with PA_STREAM_AUTO_TIMING_UPDATE: the server sends new timing info
+ * on its own whenever playback deviates from what the client
+ * extrapolates. pa_stream_get_time_error() tells how far off the
+ * extrapolated time may be.
+ *
  * \section flow_sec Overflow and underflow
  *
  * Even with the best precautions, buffers will sometime over - or
@@ -533,6 +539,28 @@ int pa_stream_write(
         int64_t offset,          /**< Offset for seeking, must be 0 for upload streams */
         pa_seek_mode_t seek      /**< Seek mode, must be PA_SEEK_RELATIVE for upload streams */);
 
+/** A buffer for pa_stream_writev(). \since 5.0 */
+typedef struct pa_stream_iovec {
+    const void *data;            /**< The data to write */
+    size_t length;               /**< The length of the data in bytes */
+} pa_stream_iovec;
+
+/** Write the data of several buffers at once (for playback and upload
+ * streams). The buffers are gathered into a single block, or as few as
+ * the block size of the memory pool allows, so this is cheaper than
+ * writing them one by one. The data is always copied.
+ *
+ * If \a play_at is not PA_USEC_INVALID the data is placed at that
+ * stream time, as returned by pa_stream_get_time(), i.e. at the
+ * matching absolute write index. Otherwise it is appended at the
+ * current write index. Not available for pa_stream_begin_write()
+ * buffers. \since 5.0 */
+int pa_stream_writev(
+        pa_stream *p                 /**< The stream to use */,
+        const pa_stream_iovec *iov   /**< The buffers to write */,
+        unsigned n                   /**< The number of buffers */,
+        pa_usec_t play_at            /**< The stream time to play the data at, or PA_USEC_INVALID */);
+
 /** Read the next fragment from the buffer (for recording streams).
  * If there is data at the current read index, \a data will point to
  * the actual data and \a nbytes will contain the size of the data in
@@ -564,6 +592,23 @@ size_t pa_stream_writable_size(pa_stream *p);
 /** Return the number of bytes that may be read using pa_stream_peek(). */
 size_t pa_stream_readable_size(pa_stream *p);
 
+/** Write data to a playback stream that was connected with
+ * PA_STREAM_RT_WRITE. Unlike all other functions this one may be called
+ * without holding the threaded main loop lock, from one thread at a
+ * time. It never blocks or allocates memory: the data is copied into a
+ * lock-free buffer which is passed on to the server by the main loop
+ * thread as the server asks for it. \a nbytes must be a multiple of
+ * the frame size and not exceed pa_stream_writable_size_rt(). Do not
+ * mix this with pa_stream_write() on the same stream. Returns a
+ * negative error code on failure, but does not set the error of the
+ * context. \since 5.0 */
+int pa_stream_write_rt(pa_stream *p, const void *data, size_t nbytes);
+
+/** Return the number of bytes that may be written using
+ * pa_stream_write_rt(), or (size_t) -1 if the stream is not ready. May
+ * be called without holding the threaded main loop lock. \since 5.0 */
+size_t pa_stream_writable_size_rt(pa_stream *p);
+
 /** Drain a playback stream.  Use this for notification when the
  * playback buffer is empty after playing all the audio in the buffer.
  * Please note that only one drain operation per stream may be issued
@@ -715,6 +760,12 @@ int pa_stream_get_time(pa_stream *s, pa_usec_t *r_usec);
  * pa_stream_get_time(). */
 int pa_stream_get_latency(pa_stream *s, pa_usec_t *r_usec, int *negative);
 
+/** Return an estimate of how far the time returned by
+ * pa_stream_get_time() may be off. If the server pushes timing info
+ * for the stream this is a bound, otherwise it grows with the age of
+ * the last timing update. Fails like pa_stream_get_time(). \since 5.0 */
+int pa_stream_get_time_error(pa_stream *s, pa_usec_t *r_usec);
+
 /** Return the latest raw timing data structure. The returned pointer
  * refers to an internal read-only instance of the timing
  * structure. The user should make a copy of this structure if he
@@ -51,7 +51,10 @@ void pa_command_subscribe_event(pa_pdispatch *pd, uint32_t command, uint32_t tag
         goto finish;
     }
 
-    if (c->subscribe_callback)
+    pa_context_cache_handle_event(c, e, idx);
+
+    /* The cache might have asked for more than the application */
+    if (c->subscribe_callback && (c->subscribe_mask & (1U << (e & PA_SUBSCRIPTION_EVENT_FACILITY_MASK))))
         c->subscribe_callback(c, e, idx, c->subscribe_userdata);
 
 finish:
@@ -68,10 +71,39 @@ pa_operation* pa_context_subscribe(pa_context *c, pa_subscription_mask_t m, pa_c
 
     PA_CHECK_VALIDITY_RETURN_NULL(c, c->state == PA_CONTEXT_READY, PA_ERR_BADSTATE);
 
+    c->subscribe_mask = m;
+
     o = pa_operation_new(c, NULL, (pa_operation_cb_t) cb, userdata);
 
     t = pa_tagstruct_command(c, PA_COMMAND_SUBSCRIBE, &tag);
-    pa_tagstruct_putu32(t, m);
+    pa_tagstruct_putu32(t, c->cache ? m | PA_CONTEXT_CACHE_SUBSCRIPTION_MASK : m);
+    pa_pstream_send_tagstruct(c->pstream, t);
+    pa_pdispatch_register_reply(c->pdispatch, tag, DEFAULT_TIMEOUT, pa_context_simple_ack_callback, pa_operation_ref(o), (pa_free_cb_t) pa_operation_unref);
+
+    return o;
+}
+
+pa_operation* pa_context_subscribe_filter(pa_context *c, pa_subscription_event_type_t facility, const uint32_t *idx, unsigned n, pa_context_success_cb_t cb, void *userdata) {
+    pa_operation *o;
+    pa_tagstruct *t;
+    uint32_t tag;
+    unsigned i;
+
+    pa_assert(c);
+    pa_assert(PA_REFCNT_VALUE(c) >= 1);
+
+    PA_CHECK_VALIDITY_RETURN_NULL(c, c->state == PA_CONTEXT_READY, PA_ERR_BADSTATE);
+    PA_CHECK_VALIDITY_RETURN_NULL(c, (facility & ~PA_SUBSCRIPTION_EVENT_FACILITY_MASK) == 0, PA_ERR_INVALID);
+    PA_CHECK_VALIDITY_RETURN_NULL(c, idx || n == 0, PA_ERR_INVALID);
+    PA_CHECK_VALIDITY_RETURN_NULL(c, c->version >= 30, PA_ERR_NOTSUPPORTED);
+
+    o = pa_operation_new(c, NULL, (pa_operation_cb_t) cb, userdata);
+
+    t = pa_tagstruct_command(c, PA_COMMAND_SUBSCRIBE_FILTER, &tag);
+    pa_tagstruct_putu32(t, facility);
+    pa_tagstruct_putu32(t, n);
+    for (i = 0; i < n; i++)
+        pa_tagstruct_putu32(t, idx[i]);
     pa_pstream_send_tagstruct(c->pstream, t);
     pa_pdispatch_register_reply(c->pdispatch, tag, DEFAULT_TIMEOUT, pa_context_simple_ack_callback, pa_operation_ref(o), (pa_free_cb_t) pa_operation_unref);
 
@@ -41,7 +41,8 @@
  *
  * The application sets the notification mask using pa_context_subscribe()
  * and the function that will be called whenever a notification occurs using
- * pa_context_set_subscribe_callback().
+ * pa_context_set_subscribe_callback(). With pa_context_subscribe_filter()
+ * the events of a facility can further be limited to a few objects.
  *
  * The callback will be called with a \ref pa_subscription_event_type_t
  * representing the event that caused the callback. Clients can examine what
@@ -77,6 +78,15 @@ typedef void (*pa_context_subscribe_cb_t)(pa_context *c, pa_subscription_event_t
 /** Enable event notification */
 pa_operation* pa_context_subscribe(pa_context *c, pa_subscription_mask_t m, pa_context_success_cb_t cb, void *userdata);
 
+/** Only receive events of the given facility (one of the
+ * PA_SUBSCRIPTION_EVENT_SINK, ... values) about the n objects with the
+ * listed indexes. The events are dropped by the server already. Pass n = 0
+ * to receive the events about all objects of the facility again. Filters
+ * need an active subscription, they are kept when the mask is changed with
+ * pa_context_subscribe() and cleared when subscribing to
+ * PA_SUBSCRIPTION_MASK_NULL. \since 5.0 */
+pa_operation* pa_context_subscribe_filter(pa_context *c, pa_subscription_event_type_t facility, const uint32_t *idx, unsigned n, pa_context_success_cb_t cb, void *userdata);
+
 /** Set the context specific call back function that is called whenever the state of the daemon changes */
 void pa_context_set_subscribe_callback(pa_context *c, pa_context_subscribe_cb_t cb, void *userdata);
 
@@ -222,20 +222,15 @@ pa_volume_t pa_sw_volume_divide(pa_volume_t a, pa_volume_t b) {
     return (pa_volume_t) (((uint64_t) a * (uint64_t) PA_VOLUME_NORM + (uint64_t) b / 2ULL) / (uint64_t) b);
 }
 
-/* Amplitude, not power */
-static double linear_to_dB(double v) {
-    return 20.0 * log10(v);
-}
-
-static double dB_to_linear(double v) {
-    return pow(10.0, v / 20.0);
-}
+/* With the cubic mapping below volume and dB relate as
+ * dB = 20*log10((v/PA_VOLUME_NORM)^3) = 60*log10(v/PA_VOLUME_NORM), which
+ * saves us going through the linear factor and its cube root. */
 
 pa_volume_t pa_sw_volume_from_dB(double dB) {
     if (isinf(dB) < 0 || dB <= PA_DECIBEL_MININFTY)
         return PA_VOLUME_MUTED;
 
-    return pa_sw_volume_from_linear(dB_to_linear(dB));
+    return (pa_volume_t) PA_CLAMP_VOLUME((uint64_t) lround(pow(10.0, dB / 60.0) * PA_VOLUME_NORM));
 }
 
 double pa_sw_volume_to_dB(pa_volume_t v) {
@@ -245,7 +240,10 @@ double pa_sw_volume_to_dB(pa_volume_t v) {
     if (v <= PA_VOLUME_MUTED)
         return PA_DECIBEL_MININFTY;
 
-    return linear_to_dB(pa_sw_volume_to_linear(v));
+    if (v == PA_VOLUME_NORM)
+        return 0.0;
+
+    return 60.0 * log10((double) v / PA_VOLUME_NORM);
 }
 
 pa_volume_t pa_sw_volume_from_linear(double v) {
@@ -253,6 +251,9 @@ pa_volume_t pa_sw_volume_from_linear(double v) {
     if (v <= 0.0)
         return PA_VOLUME_MUTED;
 
+    if (v == 1.0)
+        return PA_VOLUME_NORM;
+
     /*
      * We use a cubic mapping here, as suggested and discussed here:
      *
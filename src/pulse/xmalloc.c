@@ -32,6 +32,7 @@
 #include <pulse/gccmacro.h>
 #include <pulsecore/core-util.h>
 #include <pulsecore/macro.h>
+#include <pulsecore/rtcheck.h>
 
 #include "xmalloc.h"
 
@@ -61,6 +62,7 @@ void* pa_xmalloc(size_t size) {
     void *p;
     pa_assert(size > 0);
     pa_assert(size < MAX_ALLOC_SIZE);
+    pa_rtcheck(PA_RTCHECK_ALLOC);
 
     if (!(p = malloc(size)))
         oom();
@@ -72,6 +74,7 @@ void* pa_xmalloc0(size_t size) {
     void *p;
     pa_assert(size > 0);
     pa_assert(size < MAX_ALLOC_SIZE);
+    pa_rtcheck(PA_RTCHECK_ALLOC);
 
     if (!(p = calloc(1, size)))
         oom();
@@ -83,6 +86,7 @@ void *pa_xrealloc(void *ptr, size_t size) {
     void *p;
     pa_assert(size > 0);
     pa_assert(size < MAX_ALLOC_SIZE);
+    pa_rtcheck(PA_RTCHECK_ALLOC);
 
     if (!(p = realloc(ptr, size)))
         oom();
@@ -127,6 +131,8 @@ void pa_xfree(void *p) {
     if (!p)
         return;
 
+    pa_rtcheck(PA_RTCHECK_ALLOC);
+
     saved_errno = errno;
     free(p);
     errno = saved_errno;
@@ -32,8 +32,10 @@
 #include <pulsecore/log.h>
 #include <pulsecore/semaphore.h>
 #include <pulsecore/macro.h>
-#include <pulsecore/mutex.h>
+#include <pulsecore/atomic.h>
+#include <pulsecore/fdsem.h>
 #include <pulsecore/flist.h>
+#include <pulsecore/trace.h>
 
 #include "asyncmsgq.h"
 
@@ -41,6 +43,7 @@ PA_STATIC_FLIST_DECLARE(asyncmsgq, 0, pa_xfree);
 PA_STATIC_FLIST_DECLARE(semaphores, 0, (void(*)(void*)) pa_semaphore_free);
 
 struct asyncmsgq_item {
+    pa_atomic_ptr_t next;
     int code;
     pa_msgobject *object;
     void *userdata;
@@ -51,10 +54,26 @@ struct asyncmsgq_item {
     int ret;
 };
 
+/* The messages are kept in an intrusive multiple-producer/single-consumer
+ * linked list (D. Vyukov's algorithm). Writers only swap the tail pointer
+ * and then link the previous tail to their item, so they never block each
+ * other and never block the reader. The reader owns the head pointer. A
+ * stub item is used to keep the list non-empty. The list is unbounded,
+ * hence pushing never fails and never needs to wait for the reader. */
+
 struct pa_asyncmsgq {
     PA_REFCNT_DECLARE;
-    pa_asyncq *asyncq;
-    pa_mutex *mutex; /* only for the writer side */
+
+    pa_atomic_ptr_t tail; /* for the writers */
+    struct asyncmsgq_item *head; /* for the reader */
+    struct asyncmsgq_item stub;
+
+    /* Posted whenever a message was queued */
+    pa_fdsem *read_fdsem;
+
+    /* Never posted, since the queue cannot overrun. Kept so that the
+     * write side API continues to have something to poll on. */
+    pa_fdsem *write_fdsem;
 
     struct asyncmsgq_item *current;
 };
@@ -62,21 +81,99 @@ struct pa_asyncmsgq {
 pa_asyncmsgq *pa_asyncmsgq_new(unsigned size) {
     pa_asyncmsgq *a;
 
+    /* The queue is unbounded, size is ignored */
+
     a = pa_xnew(pa_asyncmsgq, 1);
 
     PA_REFCNT_INIT(a);
-    pa_assert_se(a->asyncq = pa_asyncq_new(size));
-    pa_assert_se(a->mutex = pa_mutex_new(FALSE, TRUE));
+    pa_atomic_ptr_store(&a->stub.next, NULL);
+    pa_atomic_ptr_store(&a->tail, &a->stub);
+    a->head = &a->stub;
+    pa_assert_se(a->read_fdsem = pa_fdsem_new());
+    pa_assert_se(a->write_fdsem = pa_fdsem_new());
     a->current = NULL;
 
     return a;
 }
 
+static void link_item(pa_asyncmsgq *a, struct asyncmsgq_item *i) {
+    struct asyncmsgq_item *prev;
+
+    pa_atomic_ptr_store(&i->next, NULL);
+
+    do {
+        prev = pa_atomic_ptr_load(&a->tail);
+    } while (!pa_atomic_ptr_cmpxchg(&a->tail, prev, i));
+
+    /* Until this store the item is not visible to the reader */
+    pa_atomic_ptr_store(&prev->next, i);
+}
+
+static void push(pa_asyncmsgq *a, struct asyncmsgq_item *i) {
+    link_item(a, i);
+    pa_fdsem_post(a->read_fdsem);
+}
+
+/* Returns NULL if the queue is empty, or if a writer is in the middle of
+ * linking the next item. In the latter case that writer will post the
+ * fdsem once it is done, so the reader is woken up again. */
+static struct asyncmsgq_item *pop(pa_asyncmsgq *a) {
+    struct asyncmsgq_item *head, *next;
+
+    head = a->head;
+    next = pa_atomic_ptr_load(&head->next);
+
+    if (head == &a->stub) {
+        if (!next)
+            return NULL;
+
+        a->head = head = next;
+        next = pa_atomic_ptr_load(&head->next);
+    }
+
+    if (next) {
+        a->head = next;
+        return head;
+    }
+
+    if (head != pa_atomic_ptr_load(&a->tail))
+        return NULL;
+
+    /* head is the last item, put the stub behind it so that we can
+     * detach it */
+    link_item(a, &a->stub);
+
+    if ((next = pa_atomic_ptr_load(&head->next))) {
+        a->head = next;
+        return head;
+    }
+
+    return NULL;
+}
+
+/* Whether pop() would return an item right now */
+static pa_bool_t can_pop(pa_asyncmsgq *a) {
+    struct asyncmsgq_item *head, *next;
+
+    head = a->head;
+    next = pa_atomic_ptr_load(&head->next);
+
+    if (head == &a->stub) {
+        if (!next)
+            return FALSE;
+
+        head = next;
+        next = pa_atomic_ptr_load(&head->next);
+    }
+
+    return next || head == pa_atomic_ptr_load(&a->tail);
+}
+
 static void asyncmsgq_free(pa_asyncmsgq *a) {
     struct asyncmsgq_item *i;
     pa_assert(a);
 
-    while ((i = pa_asyncq_pop(a->asyncq, FALSE))) {
+    while ((i = pop(a))) {
 
         pa_assert(!i->semaphore);
 
@@ -93,8 +190,8 @@ static void asyncmsgq_free(pa_asyncmsgq *a) {
             pa_xfree(i);
     }
 
-    pa_asyncq_free(a->asyncq, NULL);
-    pa_mutex_free(a->mutex);
+    pa_fdsem_free(a->read_fdsem);
+    pa_fdsem_free(a->write_fdsem);
     pa_xfree(a);
 }
 
@@ -112,6 +209,21 @@ void pa_asyncmsgq_unref(pa_asyncmsgq* q) {
         asyncmsgq_free(q);
 }
 
+void pa_asyncmsgq_reserve(unsigned n) {
+    struct asyncmsgq_item *i;
+
+    /* The list is shared by all queues, so the items reserved for one
+     * of them also serve the others */
+    while (n-- > 0) {
+        i = pa_xnew(struct asyncmsgq_item, 1);
+
+        if (pa_flist_push(PA_STATIC_FLIST_GET(asyncmsgq), i) < 0) {
+            pa_xfree(i);
+            break;
+        }
+    }
+}
+
 void pa_asyncmsgq_post(pa_asyncmsgq *a, pa_msgobject *object, int code, const void *userdata, int64_t offset, const pa_memchunk *chunk, pa_free_cb_t free_cb) {
     struct asyncmsgq_item *i;
     pa_assert(PA_REFCNT_VALUE(a) > 0);
@@ -132,16 +244,15 @@ void pa_asyncmsgq_post(pa_asyncmsgq *a, pa_msgobject *object, int code, const vo
         pa_memchunk_reset(&i->memchunk);
     i->semaphore = NULL;
 
-    /* This mutex makes the queue multiple-writer safe. This lock is only used on the writing side */
-    pa_mutex_lock(a->mutex);
-    pa_asyncq_post(a->asyncq, i);
-    pa_mutex_unlock(a->mutex);
+    push(a, i);
 }
 
 int pa_asyncmsgq_send(pa_asyncmsgq *a, pa_msgobject *object, int code, const void *userdata, int64_t offset, const pa_memchunk *chunk) {
     struct asyncmsgq_item i;
     pa_assert(PA_REFCNT_VALUE(a) > 0);
 
+    PA_TRACE2(asyncmsgq_send, a, code);
+
     i.code = code;
     i.object = object;
     i.userdata = (void*) userdata;
@@ -159,10 +270,7 @@ int pa_asyncmsgq_send(pa_asyncmsgq *a, pa_msgobject *object, int code, const voi
 
     pa_assert_se(i.semaphore);
 
-    /* This mutex makes the queue multiple-writer safe. This lock is only used on the writing side */
-    pa_mutex_lock(a->mutex);
-    pa_assert_se(pa_asyncq_push(a->asyncq, &i, TRUE) == 0);
-    pa_mutex_unlock(a->mutex);
+    push(a, &i);
 
     pa_semaphore_wait(i.semaphore);
 
@@ -176,9 +284,14 @@ int pa_asyncmsgq_get(pa_asyncmsgq *a, pa_msgobject **object, int *code, void **u
     pa_assert(PA_REFCNT_VALUE(a) > 0);
     pa_assert(!a->current);
 
-    if (!(a->current = pa_asyncq_pop(a->asyncq, wait_op))) {
-/*         pa_log("failure"); */
-        return -1;
+    while (!(a->current = pop(a))) {
+
+        if (!wait_op) {
+/*             pa_log("failure"); */
+            return -1;
+        }
+
+        pa_fdsem_wait(a->read_fdsem);
     }
 
 /*     pa_log("success"); */
@@ -272,6 +385,8 @@ int pa_asyncmsgq_process_one(pa_asyncmsgq *a) {
     if (pa_asyncmsgq_get(a, &object, &code, &data, &offset, &chunk, FALSE) < 0)
         return 0;
 
+    PA_TRACE2(asyncmsgq_process_one, a, code);
+
     pa_asyncmsgq_ref(a);
     ret = pa_asyncmsgq_dispatch(object, code, data, offset, &chunk);
     pa_asyncmsgq_done(a, ret);
@@ -283,37 +398,41 @@ int pa_asyncmsgq_process_one(pa_asyncmsgq *a) {
 int pa_asyncmsgq_read_fd(pa_asyncmsgq *a) {
     pa_assert(PA_REFCNT_VALUE(a) > 0);
 
-    return pa_asyncq_read_fd(a->asyncq);
+    return pa_fdsem_get(a->read_fdsem);
 }
 
 int pa_asyncmsgq_read_before_poll(pa_asyncmsgq *a) {
     pa_assert(PA_REFCNT_VALUE(a) > 0);
 
-    return pa_asyncq_read_before_poll(a->asyncq);
+    for (;;) {
+        if (can_pop(a))
+            return -1;
+
+        if (pa_fdsem_before_poll(a->read_fdsem) >= 0)
+            return 0;
+    }
 }
 
 void pa_asyncmsgq_read_after_poll(pa_asyncmsgq *a) {
     pa_assert(PA_REFCNT_VALUE(a) > 0);
 
-    pa_asyncq_read_after_poll(a->asyncq);
+    pa_fdsem_after_poll(a->read_fdsem);
 }
 
 int pa_asyncmsgq_write_fd(pa_asyncmsgq *a) {
     pa_assert(PA_REFCNT_VALUE(a) > 0);
 
-    return pa_asyncq_write_fd(a->asyncq);
+    return pa_fdsem_get(a->write_fdsem);
 }
 
 void pa_asyncmsgq_write_before_poll(pa_asyncmsgq *a) {
     pa_assert(PA_REFCNT_VALUE(a) > 0);
 
-    pa_asyncq_write_before_poll(a->asyncq);
+    /* Nothing is ever postponed on the writer side */
 }
 
 void pa_asyncmsgq_write_after_poll(pa_asyncmsgq *a) {
     pa_assert(PA_REFCNT_VALUE(a) > 0);
-
-    pa_asyncq_write_after_poll(a->asyncq);
 }
 
 int pa_asyncmsgq_dispatch(pa_msgobject *object, int code, void *userdata, int64_t offset, pa_memchunk *memchunk) {
@@ -28,13 +28,13 @@
 #include <pulsecore/memchunk.h>
 #include <pulsecore/msgobject.h>
 
-/* A simple asynchronous message queue, based on pa_asyncq. In
- * contrast to pa_asyncq this one is multiple-writer safe, though
- * still not multiple-reader safe. This queue is intended to be used
- * for controlling real-time threads from normal-priority
- * threads. Multiple-writer-safety is accomplished by using a mutex on
- * the writer side. This queue is thus not useful for communication
- * between several real-time threads.
+/* A simple asynchronous message queue. In contrast to pa_asyncq this
+ * one is multiple-writer safe, though still not multiple-reader
+ * safe. This queue is intended to be used for controlling real-time
+ * threads from normal-priority threads. Both sides are lock-free:
+ * writers append to a linked list with atomic operations and never
+ * wait for each other or for the reader. The queue is unbounded, the
+ * size passed to pa_asyncmsgq_new() is ignored.
  *
  * The queue takes messages consisting of:
  *    "Object" for which this messages is intended (may be NULL)
@@ -57,6 +57,10 @@ pa_asyncmsgq* pa_asyncmsgq_ref(pa_asyncmsgq *q);
 
 void pa_asyncmsgq_unref(pa_asyncmsgq* q);
 
+/* Preallocates n message items, so that posting from a realtime
+ * thread doesn't need to allocate as long as the reader keeps up. */
+void pa_asyncmsgq_reserve(unsigned n);
+
 void pa_asyncmsgq_post(pa_asyncmsgq *q, pa_msgobject *object, int code, const void *userdata, int64_t offset, const pa_memchunk *memchunk, pa_free_cb_t userdata_free_cb);
 int pa_asyncmsgq_send(pa_asyncmsgq *q, pa_msgobject *object, int code, const void *userdata, int64_t offset, const pa_memchunk *memchunk);
 
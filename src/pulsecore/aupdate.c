@@ -47,7 +47,7 @@ pa_aupdate *pa_aupdate_new(void) {
 
     a = pa_xnew(pa_aupdate, 1);
     pa_atomic_store(&a->read_lock, 0);
-    a->write_lock = pa_mutex_new(FALSE, FALSE);
+    a->write_lock = pa_mutex_new(FALSE, TRUE);
     a->semaphore = pa_semaphore_new(0);
 
     return a;
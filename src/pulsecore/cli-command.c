@@ -38,6 +38,8 @@
 
 #include <pulse/xmalloc.h>
 #include <pulse/error.h>
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
 
 #include <pulsecore/module.h>
 #include <pulsecore/sink.h>
@@ -58,6 +60,7 @@
 #include <pulsecore/core-error.h>
 #include <pulsecore/modinfo.h>
 #include <pulsecore/dynarray.h>
+#include <pulsecore/flist.h>
 
 #include "cli-command.h"
 
@@ -74,6 +77,8 @@ struct command {
 #define META_IFEXISTS ".ifexists"
 #define META_ELSE ".else"
 #define META_ENDIF ".endif"
+#define META_PARALLEL ".parallel"
+#define META_ENDPARALLEL ".endparallel"
 
 enum {
     IFSTATE_NONE = -1,
@@ -92,6 +97,7 @@ static int pa_cli_command_sources(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, p
 static int pa_cli_command_sink_inputs(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, pa_bool_t *fail);
 static int pa_cli_command_source_outputs(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, pa_bool_t *fail);
 static int pa_cli_command_stat(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, pa_bool_t *fail);
+static int pa_cli_command_main_thread_usage(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, pa_bool_t *fail);
 static int pa_cli_command_info(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, pa_bool_t *fail);
 static int pa_cli_command_load(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, pa_bool_t *fail);
 static int pa_cli_command_unload(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, pa_bool_t *fail);
@@ -123,6 +129,7 @@ static int pa_cli_command_vacuum(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, pa
 static int pa_cli_command_suspend_sink(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, pa_bool_t *fail);
 static int pa_cli_command_suspend_source(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, pa_bool_t *fail);
 static int pa_cli_command_suspend(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, pa_bool_t *fail);
+static int pa_cli_command_reset_counters(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, pa_bool_t *fail);
 static int pa_cli_command_log_target(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, pa_bool_t *fail);
 static int pa_cli_command_log_level(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, pa_bool_t *fail);
 static int pa_cli_command_log_meta(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, pa_bool_t *fail);
@@ -137,6 +144,7 @@ static int pa_cli_command_sink_port(pa_core *c, pa_tokenizer *t, pa_strbuf *buf,
 static int pa_cli_command_source_port(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, pa_bool_t *fail);
 static int pa_cli_command_port_offset(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, pa_bool_t *fail);
 static int pa_cli_command_dump_volumes(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, pa_bool_t *fail);
+static int pa_cli_command_restart(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, pa_bool_t *fail);
 
 /* A method table for all available commands */
 
@@ -150,6 +158,7 @@ static const struct command commands[] = {
     { "list-sink-inputs",        pa_cli_command_sink_inputs,        "List sink inputs",             1 },
     { "list-source-outputs",     pa_cli_command_source_outputs,     "List source outputs",          1 },
     { "stat",                    pa_cli_command_stat,               "Show memory block statistics", 1 },
+    { "list-main-thread-usage",  pa_cli_command_main_thread_usage,  "List the main thread time used by the core, modules and clients", 1 },
     { "info",                    pa_cli_command_info,               "Show comprehensive status",    1 },
     { "ls",                      pa_cli_command_info,               NULL,                           1 },
     { "list",                    pa_cli_command_info,               NULL,                           1 },
@@ -173,6 +182,7 @@ static const struct command commands[] = {
     { "suspend-sink",            pa_cli_command_suspend_sink,       "Suspend sink (args: index|name, bool)", 3},
     { "suspend-source",          pa_cli_command_suspend_source,     "Suspend source (args: index|name, bool)", 3},
     { "suspend",                 pa_cli_command_suspend,            "Suspend all sinks and all sources (args: bool)", 2},
+    { "reset-counters",          pa_cli_command_reset_counters,     "Reset the error counters of all sinks, sources and streams", 1},
     { "move-sink-input",         pa_cli_command_move_sink_input,    "Move sink input to another sink (args: index, sink)", 3},
     { "move-source-output",      pa_cli_command_move_source_output, "Move source output to another source (args: index, source)", 3},
     { "update-sink-proplist",    pa_cli_command_update_sink_proplist, "Update the properties of a sink (args: index|name, properties)", 3},
@@ -198,6 +208,7 @@ static const struct command commands[] = {
     { "dump-volumes",            pa_cli_command_dump_volumes,       "Debug: Show the state of all volumes", 1 },
     { "shared",                  pa_cli_command_list_shared_props,  "Debug: Show shared properties", 1},
     { "exit",                    pa_cli_command_exit,               "Terminate the daemon",         1 },
+    { "restart",                 pa_cli_command_restart,            "Restart the daemon, keeping its sockets and device state", 1 },
     { "vacuum",                  pa_cli_command_vacuum,             NULL, 1},
     { NULL, NULL, NULL, 0 }
 };
@@ -226,6 +237,18 @@ static int pa_cli_command_exit(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, pa_b
     return 0;
 }
 
+static int pa_cli_command_restart(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, pa_bool_t *fail) {
+    pa_core_assert_ref(c);
+    pa_assert(t);
+    pa_assert(buf);
+    pa_assert(fail);
+
+    if (pa_core_restart(c) < 0)
+        pa_strbuf_puts(buf, "Not allowed to restart daemon.\n");
+
+    return 0;
+}
+
 static int pa_cli_command_help(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, pa_bool_t *fail) {
     const struct command*command;
 
@@ -345,6 +368,7 @@ static int pa_cli_command_stat(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, pa_b
     char cm[PA_CHANNEL_MAP_SNPRINT_MAX];
     char bytes[PA_BYTES_SNPRINT_MAX];
     const pa_mempool_stat *mstat;
+    char *owner;
     unsigned k;
     pa_sink *def_sink;
     pa_source *def_source;
@@ -381,6 +405,27 @@ static int pa_cli_command_stat(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, pa_b
                      (unsigned) pa_atomic_load(&mstat->n_exported),
                      pa_bytes_snprint(bytes, sizeof(bytes), (unsigned) pa_atomic_load(&mstat->exported_size)));
 
+    /* What the modules and clients hold is listed with them */
+    owner = pa_memowner_to_string(c->memowner);
+    pa_strbuf_printf(buf, "Memory charged to the core: %s\n", owner);
+    pa_xfree(owner);
+
+    pa_strbuf_printf(buf, "Memory pool slot cache hits: %u, misses: %u.\n",
+                     (unsigned) pa_atomic_load(&mstat->n_slot_cache_hits),
+                     (unsigned) pa_atomic_load(&mstat->n_slot_cache_misses));
+
+    pa_strbuf_printf(buf, "Memory pool page size: %s, locked: %s.\n",
+                     pa_bytes_snprint(bytes, sizeof(bytes), (unsigned) pa_mempool_get_page_size(c->mempool)),
+                     pa_yes_no(pa_mempool_is_locked(c->mempool)));
+
+    pa_strbuf_printf(buf, "Memory given back by idle trimming: %s in %u runs.\n",
+                     pa_bytes_snprint(bytes, sizeof(bytes), (unsigned) c->memory_trimmed),
+                     (unsigned) c->n_memory_trims);
+
+    pa_flist_dump_stats(buf);
+
+    pa_strbuf_printf(buf, "Log messages dropped: %u\n", pa_log_get_dropped());
+
     pa_strbuf_printf(buf, "Total sample cache size: %s.\n",
                      pa_bytes_snprint(bytes, sizeof(bytes), (unsigned) pa_scache_total_size(c)));
 
@@ -407,6 +452,20 @@ static int pa_cli_command_stat(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, pa_b
     return 0;
 }
 
+static int pa_cli_command_main_thread_usage(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, pa_bool_t *fail) {
+    char *s;
+
+    pa_core_assert_ref(c);
+    pa_assert(t);
+    pa_assert(buf);
+    pa_assert(fail);
+
+    pa_assert_se(s = pa_cpu_usage_to_string(c));
+    pa_strbuf_puts(buf, s);
+    pa_xfree(s);
+    return 0;
+}
+
 static int pa_cli_command_info(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, pa_bool_t *fail) {
     pa_core_assert_ref(c);
     pa_assert(t);
@@ -1498,6 +1557,25 @@ static int pa_cli_command_suspend(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, p
     return 0;
 }
 
+static int pa_cli_command_reset_counters(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, pa_bool_t *fail) {
+    pa_sink *sink;
+    pa_source *source;
+    uint32_t idx;
+
+    pa_core_assert_ref(c);
+    pa_assert(t);
+    pa_assert(buf);
+    pa_assert(fail);
+
+    PA_IDXSET_FOREACH(sink, c->sinks, idx)
+        pa_sink_reset_counters(sink);
+
+    PA_IDXSET_FOREACH(source, c->sources, idx)
+        pa_source_reset_counters(source);
+
+    return 0;
+}
+
 static int pa_cli_command_log_target(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, pa_bool_t *fail) {
     const char *m;
     pa_log_target *log_target = NULL;
@@ -1867,6 +1945,52 @@ static int pa_cli_command_dump(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, pa_b
     return 0;
 }
 
+void pa_cli_command_dump_state(pa_core *c, pa_strbuf *buf) {
+    pa_card *card;
+    pa_sink *sink;
+    pa_source *source;
+    uint32_t idx;
+
+    pa_core_assert_ref(c);
+    pa_assert(buf);
+
+    /* The profiles first, they decide which devices there are */
+    PA_IDXSET_FOREACH(card, c->cards, idx)
+        if (card->active_profile)
+            pa_strbuf_printf(buf, "set-card-profile %s %s\n", card->name, card->active_profile->name);
+
+    /* A single channel volume scales the device, keeping its balance.
+     * Devices suspended for other reasons than the user's will know
+     * by themselves whether that still holds. */
+    PA_IDXSET_FOREACH(sink, c->sinks, idx) {
+        if (sink->active_port)
+            pa_strbuf_printf(buf, "set-sink-port %s %s\n", sink->name, sink->active_port->name);
+
+        pa_strbuf_printf(buf, "set-sink-volume %s 0x%03x\n", sink->name, pa_cvolume_max(pa_sink_get_volume(sink, FALSE)));
+        pa_strbuf_printf(buf, "set-sink-mute %s %s\n", sink->name, pa_yes_no(pa_sink_get_mute(sink, FALSE)));
+
+        if (sink->suspend_cause & PA_SUSPEND_USER)
+            pa_strbuf_printf(buf, "suspend-sink %s yes\n", sink->name);
+    }
+
+    PA_IDXSET_FOREACH(source, c->sources, idx) {
+        if (source->active_port)
+            pa_strbuf_printf(buf, "set-source-port %s %s\n", source->name, source->active_port->name);
+
+        pa_strbuf_printf(buf, "set-source-volume %s 0x%03x\n", source->name, pa_cvolume_max(pa_source_get_volume(source, FALSE)));
+        pa_strbuf_printf(buf, "set-source-mute %s %s\n", source->name, pa_yes_no(pa_source_get_mute(source, FALSE)));
+
+        if (source->suspend_cause & PA_SUSPEND_USER)
+            pa_strbuf_printf(buf, "suspend-source %s yes\n", source->name);
+    }
+
+    if ((sink = pa_namereg_get_default_sink(c)))
+        pa_strbuf_printf(buf, "set-default-sink %s\n", sink->name);
+
+    if ((source = pa_namereg_get_default_source(c)))
+        pa_strbuf_printf(buf, "set-default-source %s\n", source->name);
+}
+
 static int pa_cli_command_dump_volumes(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, pa_bool_t *fail) {
     pa_sink *s;
     pa_source *so;
@@ -1923,6 +2047,38 @@ static int pa_cli_command_dump_volumes(pa_core *c, pa_tokenizer *t, pa_strbuf *b
     return 0;
 }
 
+static const struct {
+    const char *name;
+    pa_cli_text_list_t list;
+} list_commands[] = {
+    { "list-modules",        PA_CLI_TEXT_MODULES },
+    { "list-cards",          PA_CLI_TEXT_CARDS },
+    { "list-sinks",          PA_CLI_TEXT_SINKS },
+    { "list-sources",        PA_CLI_TEXT_SOURCES },
+    { "list-clients",        PA_CLI_TEXT_CLIENTS },
+    { "list-sink-inputs",    PA_CLI_TEXT_SINK_INPUTS },
+    { "list-source-outputs", PA_CLI_TEXT_SOURCE_OUTPUTS },
+    { "list-samples",        PA_CLI_TEXT_SAMPLES },
+};
+
+pa_cli_text_cursor *pa_cli_command_get_list_cursor(pa_core *c, const char *s) {
+    const char *cs;
+    size_t l;
+    unsigned i;
+
+    pa_assert(c);
+    pa_assert(s);
+
+    cs = s+strspn(s, whitespace);
+    l = strcspn(cs, whitespace);
+
+    for (i = 0; i < PA_ELEMENTSOF(list_commands); i++)
+        if (strlen(list_commands[i].name) == l && !strncmp(cs, list_commands[i].name, l))
+            return pa_cli_text_cursor_new(c, list_commands[i].list);
+
+    return NULL;
+}
+
 int pa_cli_command_execute_line_stateful(pa_core *c, const char *s, pa_strbuf *buf, pa_bool_t *fail, int *ifstate) {
     const char *cs;
 
@@ -1951,6 +2107,11 @@ int pa_cli_command_execute_line_stateful(pa_core *c, const char *s, pa_strbuf *b
             } else
                 *ifstate = IFSTATE_NONE;
             return 0;
+        } else if (!strcmp(cs, META_PARALLEL) || !strcmp(cs, META_ENDPARALLEL)) {
+            /* Blocks are handled by execute_script_line(), we only end up
+             * here on the interactive command line */
+            pa_strbuf_printf(buf, "Meta command %s is not valid in this context\n", cs);
+            return -1;
         }
         if (ifstate && *ifstate == IFSTATE_FALSE)
             return 0;
@@ -2125,11 +2286,195 @@ int pa_cli_command_execute_line(pa_core *c, const char *s, pa_strbuf *buf, pa_bo
     return pa_cli_command_execute_line_stateful(c, s, buf, fail, NULL);
 }
 
+/* Asks the kernel to read the file into the page cache in the
+ * background. Returns FALSE if it doesn't exist. */
+static pa_bool_t prefetch_file(const char *fn) {
+    int fd;
+
+    if ((fd = pa_open_cloexec(fn, O_RDONLY, 0)) < 0)
+        return FALSE;
+
+#ifdef HAVE_POSIX_FADVISE
+    {
+        int r;
+
+        if ((r = posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED)) != 0)
+            pa_log_debug("POSIX_FADV_WILLNEED on '%s' failed: %s", fn, pa_cstrerror(r));
+        else
+            pa_log_debug("Prefetching '%s'", fn);
+    }
+#endif
+
+    pa_close(fd);
+    return TRUE;
+}
+
+/* Looks for the shared object of the module the same way
+ * lt_dlopenext() will, and prefetches it */
+static void prefetch_module(const char *name) {
+    const char *paths, *state = NULL;
+    char *p;
+
+    if (name[0] == PA_PATH_SEP_CHAR) {
+        char *fn;
+
+        if (prefetch_file(name))
+            return;
+
+        fn = pa_sprintf_malloc("%s.so", name);
+        prefetch_file(fn);
+        pa_xfree(fn);
+        return;
+    }
+
+    if (!(paths = lt_dlgetsearchpath()))
+        return;
+
+    while ((p = pa_split(paths, ":", &state))) {
+        char *fn;
+        pa_bool_t found;
+
+        fn = pa_sprintf_malloc("%s" PA_PATH_SEP "%s.so", p, name);
+        found = prefetch_file(fn);
+        pa_xfree(fn);
+
+        if (!found && PA_UNLIKELY(pa_run_from_build_tree())) {
+            /* If run from the build tree, search in <path>/.libs as well */
+            fn = pa_sprintf_malloc("%s" PA_PATH_SEP ".libs" PA_PATH_SEP "%s.so", p, name);
+            found = prefetch_file(fn);
+            pa_xfree(fn);
+        }
+
+        pa_xfree(p);
+
+        if (found)
+            break;
+    }
+}
+
+static int execute_timed_line(pa_core *c, const char *s, pa_strbuf *buf, pa_bool_t *fail, int *ifstate) {
+    const char *cs;
+    pa_usec_t t;
+    int r;
+
+    cs = s+strspn(s, whitespace);
+
+    if (!c->log_startup_timing || *cs == '#' || !*cs)
+        return pa_cli_command_execute_line_stateful(c, s, buf, fail, ifstate);
+
+    t = pa_rtclock_now();
+    r = pa_cli_command_execute_line_stateful(c, s, buf, fail, ifstate);
+    pa_log_notice("Startup: %0.1f ms for '%s'", (double) (pa_rtclock_now() - t) / PA_USEC_PER_MSEC, cs);
+
+    return r;
+}
+
+/* Runs the lines collected between .parallel and .endparallel. The
+ * module shared objects are all prefetched first, so that the disk
+ * reads overlap. The modules themselves are loaded one after the other
+ * from the main thread, since neither pa__init() nor the core are
+ * thread safe, and dlopen() is serialized internally anyway. */
+static int execute_parallel_block(pa_core *c, pa_dynarray *lines, pa_strbuf *buf, pa_bool_t *fail, int *ifstate) {
+    unsigned i, n;
+    pa_usec_t t;
+    int ret = 0;
+
+    t = pa_rtclock_now();
+    n = pa_dynarray_size(lines);
+
+    for (i = 0; i < n; i++) {
+        const char *cs = pa_dynarray_get(lines, i);
+        size_t l;
+
+        cs += strspn(cs, whitespace);
+        l = strcspn(cs, whitespace);
+
+        if (l == sizeof("load-module")-1 && !strncmp(cs, "load-module", l)) {
+            pa_tokenizer *tok = pa_tokenizer_new(cs, 3);
+            const char *name;
+
+            if ((name = pa_tokenizer_get(tok, 1)))
+                prefetch_module(name);
+
+            pa_tokenizer_free(tok);
+        }
+    }
+
+    for (i = 0; i < n; i++)
+        if (execute_timed_line(c, pa_dynarray_get(lines, i), buf, fail, ifstate) < 0 && *fail) {
+            ret = -1;
+            break;
+        }
+
+    if (c->log_startup_timing)
+        pa_log_notice("Startup: %0.1f ms for %s block of %u lines", (double) (pa_rtclock_now() - t) / PA_USEC_PER_MSEC, META_PARALLEL, n);
+
+    return ret;
+}
+
+/* Like pa_cli_command_execute_line_stateful() but for lines of a
+ * script, where .parallel blocks are allowed. *block is the block
+ * being collected, or NULL. */
+static int execute_script_line(pa_core *c, const char *s, pa_strbuf *buf, pa_bool_t *fail, int *ifstate, pa_dynarray **block) {
+    const char *cs;
+    int r;
+
+    cs = s+strspn(s, whitespace);
+
+    if (!strcmp(cs, META_PARALLEL)) {
+        if (*block) {
+            pa_strbuf_printf(buf, "Nested %s blocks not supported\n", cs);
+            return -1;
+        }
+
+        *block = pa_dynarray_new(pa_xfree);
+        return 0;
+
+    } else if (!strcmp(cs, META_ENDPARALLEL)) {
+        if (!*block) {
+            pa_strbuf_printf(buf, "Meta command %s is not valid in this context\n", cs);
+            return -1;
+        }
+
+        r = execute_parallel_block(c, *block, buf, fail, ifstate);
+        pa_dynarray_free(*block);
+        *block = NULL;
+        return r;
+
+    } else if (*block) {
+        pa_dynarray_append(*block, pa_xstrdup(s));
+        return 0;
+    }
+
+    return execute_timed_line(c, s, buf, fail, ifstate);
+}
+
+/* Called at the end of a script */
+static int finish_script(pa_core *c, pa_strbuf *buf, pa_bool_t *fail, int *ifstate, pa_dynarray **block) {
+    int r;
+
+    if (!*block)
+        return 0;
+
+    pa_strbuf_printf(buf, "Missing %s\n", META_ENDPARALLEL);
+    if (*fail)
+        r = -1;
+    else
+        r = execute_parallel_block(c, *block, buf, fail, ifstate);
+
+    pa_dynarray_free(*block);
+    *block = NULL;
+
+    return r;
+}
+
 int pa_cli_command_execute_file_stream(pa_core *c, FILE *f, pa_strbuf *buf, pa_bool_t *fail) {
     char line[2048];
     int ifstate = IFSTATE_NONE;
+    pa_dynarray *block = NULL;
     int ret = -1;
     pa_bool_t _fail = TRUE;
+    pa_usec_t t;
 
     pa_assert(c);
     pa_assert(f);
@@ -2138,16 +2483,26 @@ int pa_cli_command_execute_file_stream(pa_core *c, FILE *f, pa_strbuf *buf, pa_b
     if (!fail)
         fail = &_fail;
 
+    t = pa_rtclock_now();
+
     while (fgets(line, sizeof(line), f)) {
         pa_strip_nl(line);
 
-        if (pa_cli_command_execute_line_stateful(c, line, buf, fail, &ifstate) < 0 && *fail)
+        if (execute_script_line(c, line, buf, fail, &ifstate, &block) < 0 && *fail)
             goto fail;
     }
 
+    if (finish_script(c, buf, fail, &ifstate, &block) < 0 && *fail)
+        goto fail;
+
+    if (c->log_startup_timing)
+        pa_log_notice("Startup: %0.1f ms for the whole script", (double) (pa_rtclock_now() - t) / PA_USEC_PER_MSEC);
+
     ret = 0;
 
 fail:
+    if (block)
+        pa_dynarray_free(block);
 
     return ret;
 }
@@ -2184,6 +2539,7 @@ fail:
 int pa_cli_command_execute(pa_core *c, const char *s, pa_strbuf *buf, pa_bool_t *fail) {
     const char *p;
     int ifstate = IFSTATE_NONE;
+    pa_dynarray *block = NULL;
     pa_bool_t _fail = TRUE;
 
     pa_assert(c);
@@ -2198,9 +2554,9 @@ int pa_cli_command_execute(pa_core *c, const char *s, pa_strbuf *buf, pa_bool_t
         size_t l = strcspn(p, linebreak);
         char *line = pa_xstrndup(p, l);
 
-        if (pa_cli_command_execute_line_stateful(c, line, buf, fail, &ifstate) < 0 && *fail) {
+        if (execute_script_line(c, line, buf, fail, &ifstate, &block) < 0 && *fail) {
             pa_xfree(line);
-            return -1;
+            goto fail;
         }
         pa_xfree(line);
 
@@ -2208,5 +2564,14 @@ int pa_cli_command_execute(pa_core *c, const char *s, pa_strbuf *buf, pa_bool_t
         p += strspn(p, linebreak);
     }
 
+    if (finish_script(c, buf, fail, &ifstate, &block) < 0 && *fail)
+        goto fail;
+
     return 0;
+
+fail:
+    if (block)
+        pa_dynarray_free(block);
+
+    return -1;
 }
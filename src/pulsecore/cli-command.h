@@ -24,6 +24,7 @@
 
 #include <pulsecore/strbuf.h>
 #include <pulsecore/core.h>
+#include <pulsecore/cli-text.h>
 
 /* Execute a single CLI command. Write the results to the string
  * buffer *buf. If *fail is non-zero the function will return -1 when
@@ -40,6 +41,16 @@ int pa_cli_command_execute_file_stream(pa_core *c, FILE *f, pa_strbuf *buf, pa_b
 /* Split the specified string into lines and run pa_cli_command_execute_line() for each. */
 int pa_cli_command_execute(pa_core *c, const char *s, pa_strbuf *buf, pa_bool_t *fail);
 
+/* If s is one of the list-* commands, return a cursor that produces
+ * its output piecemeal, otherwise NULL */
+pa_cli_text_cursor *pa_cli_command_get_list_cursor(pa_core *c, const char *s);
+
+/* Write the commands that bring the cards and devices into their
+ * current state to buf: profiles, ports, volumes, mutes, suspends by
+ * the user and the defaults. Unlike the "dump" command this loads no
+ * modules, to be run after the startup script of a restarted daemon. */
+void pa_cli_command_dump_state(pa_core *c, pa_strbuf *buf);
+
 /* Same as pa_cli_command_execute_line() but also take ifstate var. */
 int pa_cli_command_execute_line_stateful(pa_core *c, const char *s, pa_strbuf *buf, pa_bool_t *fail, int *ifstate);
 
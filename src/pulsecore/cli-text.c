@@ -41,66 +41,56 @@
 
 #include "cli-text.h"
 
-char *pa_module_list_to_string(pa_core *c) {
-    pa_strbuf *s;
-    pa_module *m;
-    uint32_t idx = PA_IDXSET_INVALID;
-    pa_assert(c);
-
-    s = pa_strbuf_new();
-
-    pa_strbuf_printf(s, "%u module(s) loaded.\n", pa_idxset_size(c->modules));
-
-    PA_IDXSET_FOREACH(m, c->modules, idx) {
-        char *t;
-
-        pa_strbuf_printf(s, "    index: %u\n"
-                         "\tname: <%s>\n"
-                         "\targument: <%s>\n"
-                         "\tused: %i\n"
-                         "\tload once: %s\n",
-                         m->index,
-                         m->name,
-                         pa_strempty(m->argument),
-                         pa_module_get_n_used(m),
-                         pa_yes_no(m->load_once));
-
-        t = pa_proplist_to_string_sep(m->proplist, "\n\t\t");
-        pa_strbuf_printf(s, "\tproperties:\n\t\t%s\n", t);
-        pa_xfree(t);
-    }
-
-    return pa_strbuf_tostring_free(s);
+static void append_module(pa_strbuf *s, pa_module *m) {
+    char *t;
+
+    pa_strbuf_printf(s, "    index: %u\n"
+                     "\tname: <%s>\n"
+                     "\targument: <%s>\n"
+                     "\tused: %i\n"
+                     "\tload once: %s\n",
+                     m->index,
+                     m->name,
+                     pa_strempty(m->argument),
+                     pa_module_get_n_used(m),
+                     pa_yes_no(m->load_once));
+
+    t = pa_memowner_to_string(m->memowner);
+    pa_strbuf_printf(s, "\tmemory: %s\n", t);
+    pa_xfree(t);
+
+    t = pa_cpu_account_to_string(m->cpu_account);
+    pa_strbuf_printf(s, "\tmain thread: %s\n", t);
+    pa_xfree(t);
+
+    t = pa_proplist_to_string_sep(m->proplist, "\n\t\t");
+    pa_strbuf_printf(s, "\tproperties:\n\t\t%s\n", t);
+    pa_xfree(t);
 }
 
-char *pa_client_list_to_string(pa_core *c) {
-    pa_strbuf *s;
-    pa_client *client;
-    uint32_t idx = PA_IDXSET_INVALID;
-    pa_assert(c);
-
-    s = pa_strbuf_new();
-
-    pa_strbuf_printf(s, "%u client(s) logged in.\n", pa_idxset_size(c->clients));
+static void append_client(pa_strbuf *s, pa_client *client) {
+    char *t;
+    pa_strbuf_printf(
+            s,
+            "    index: %u\n"
+            "\tdriver: <%s>\n",
+            client->index,
+            client->driver);
 
-    PA_IDXSET_FOREACH(client, c->clients, idx) {
-        char *t;
-        pa_strbuf_printf(
-                s,
-                "    index: %u\n"
-                "\tdriver: <%s>\n",
-                client->index,
-                client->driver);
+    if (client->module)
+        pa_strbuf_printf(s, "\towner module: %u\n", client->module->index);
 
-        if (client->module)
-            pa_strbuf_printf(s, "\towner module: %u\n", client->module->index);
+    t = pa_memowner_to_string(client->memowner);
+    pa_strbuf_printf(s, "\tmemory: %s\n", t);
+    pa_xfree(t);
 
-        t = pa_proplist_to_string_sep(client->proplist, "\n\t\t");
-        pa_strbuf_printf(s, "\tproperties:\n\t\t%s\n", t);
-        pa_xfree(t);
-    }
+    t = pa_cpu_account_to_string(client->cpu_account);
+    pa_strbuf_printf(s, "\tmain thread: %s\n", t);
+    pa_xfree(t);
 
-    return pa_strbuf_tostring_free(s);
+    t = pa_proplist_to_string_sep(client->proplist, "\n\t\t");
+    pa_strbuf_printf(s, "\tproperties:\n\t\t%s\n", t);
+    pa_xfree(t);
 }
 
 static const char *available_to_string(pa_available_t a) {
@@ -136,66 +126,53 @@ static void append_port_list(pa_strbuf *s, pa_hashmap *ports) {
     }
 }
 
-char *pa_card_list_to_string(pa_core *c) {
-    pa_strbuf *s;
-    pa_card *card;
-    uint32_t idx = PA_IDXSET_INVALID;
-    pa_assert(c);
-
-    s = pa_strbuf_new();
+static void append_card(pa_strbuf *s, pa_card *card) {
+    char *t;
+    pa_sink *sink;
+    pa_source *source;
+    uint32_t sidx;
+    pa_card_profile *profile;
+    void *state;
 
-    pa_strbuf_printf(s, "%u card(s) available.\n", pa_idxset_size(c->cards));
+    pa_strbuf_printf(
+            s,
+            "    index: %u\n"
+            "\tname: <%s>\n"
+            "\tdriver: <%s>\n",
+            card->index,
+            card->name,
+            card->driver);
 
-    PA_IDXSET_FOREACH(card, c->cards, idx) {
-        char *t;
-        pa_sink *sink;
-        pa_source *source;
-        uint32_t sidx;
-        pa_card_profile *profile;
-        void *state;
+    if (card->module)
+        pa_strbuf_printf(s, "\towner module: %u\n", card->module->index);
 
-        pa_strbuf_printf(
-                s,
-                "    index: %u\n"
-                "\tname: <%s>\n"
-                "\tdriver: <%s>\n",
-                card->index,
-                card->name,
-                card->driver);
-
-        if (card->module)
-            pa_strbuf_printf(s, "\towner module: %u\n", card->module->index);
-
-        t = pa_proplist_to_string_sep(card->proplist, "\n\t\t");
-        pa_strbuf_printf(s, "\tproperties:\n\t\t%s\n", t);
-        pa_xfree(t);
+    t = pa_proplist_to_string_sep(card->proplist, "\n\t\t");
+    pa_strbuf_printf(s, "\tproperties:\n\t\t%s\n", t);
+    pa_xfree(t);
 
-        pa_strbuf_puts(s, "\tprofiles:\n");
-        PA_HASHMAP_FOREACH(profile, card->profiles, state)
-            pa_strbuf_printf(s, "\t\t%s: %s (priority %u, available: %s)\n", profile->name, profile->description,
-                             profile->priority, available_to_string(profile->available));
+    pa_strbuf_puts(s, "\tprofiles:\n");
+    PA_HASHMAP_FOREACH(profile, card->profiles, state)
+        pa_strbuf_printf(s, "\t\t%s: %s (priority %u, available: %s)\n", profile->name, profile->description,
+                         profile->priority, available_to_string(profile->available));
 
-        pa_strbuf_printf(
-                s,
-                "\tactive profile: <%s>\n",
-                card->active_profile->name);
-
-        if (!pa_idxset_isempty(card->sinks)) {
-            pa_strbuf_puts(s, "\tsinks:\n");
-            PA_IDXSET_FOREACH(sink, card->sinks, sidx)
-                pa_strbuf_printf(s, "\t\t%s/#%u: %s\n", sink->name, sink->index, pa_strna(pa_proplist_gets(sink->proplist, PA_PROP_DEVICE_DESCRIPTION)));
-        }
+    pa_strbuf_printf(
+            s,
+            "\tactive profile: <%s>\n",
+            card->active_profile->name);
 
-        if (!pa_idxset_isempty(card->sources)) {
-            pa_strbuf_puts(s, "\tsources:\n");
-            PA_IDXSET_FOREACH(source, card->sources, sidx)
-                pa_strbuf_printf(s, "\t\t%s/#%u: %s\n", source->name, source->index, pa_strna(pa_proplist_gets(source->proplist, PA_PROP_DEVICE_DESCRIPTION)));
-        }
+    if (!pa_idxset_isempty(card->sinks)) {
+        pa_strbuf_puts(s, "\tsinks:\n");
+        PA_IDXSET_FOREACH(sink, card->sinks, sidx)
+            pa_strbuf_printf(s, "\t\t%s/#%u: %s\n", sink->name, sink->index, pa_strna(pa_proplist_gets(sink->proplist, PA_PROP_DEVICE_DESCRIPTION)));
+    }
 
-        append_port_list(s, card->ports);
+    if (!pa_idxset_isempty(card->sources)) {
+        pa_strbuf_puts(s, "\tsources:\n");
+        PA_IDXSET_FOREACH(source, card->sources, sidx)
+            pa_strbuf_printf(s, "\t\t%s/#%u: %s\n", source->name, source->index, pa_strna(pa_proplist_gets(source->proplist, PA_PROP_DEVICE_DESCRIPTION)));
     }
 
-    return pa_strbuf_tostring_free(s);
+    append_port_list(s, card->ports);
 }
 
 static const char *sink_state_to_string(pa_sink_state_t state) {
@@ -232,496 +209,694 @@ static const char *source_state_to_string(pa_source_state_t state) {
     }
 }
 
-char *pa_sink_list_to_string(pa_core *c) {
-    pa_strbuf *s;
-    pa_sink *sink, *default_sink;
-    uint32_t idx = PA_IDXSET_INVALID;
-    pa_assert(c);
+static void append_sink(pa_strbuf *s, pa_sink *sink) {
+    pa_sink *default_sink;
+    char ss[PA_SAMPLE_SPEC_SNPRINT_MAX],
+        cv[PA_CVOLUME_SNPRINT_MAX],
+        cvdb[PA_SW_CVOLUME_SNPRINT_DB_MAX],
+        v[PA_VOLUME_SNPRINT_MAX],
+        vdb[PA_SW_VOLUME_SNPRINT_DB_MAX],
+        cm[PA_CHANNEL_MAP_SNPRINT_MAX], *t;
+    const char *cmn;
+
+    default_sink = pa_namereg_get_default_sink(sink->core);
+    cmn = pa_channel_map_to_pretty_name(&sink->channel_map);
+
+    pa_strbuf_printf(
+        s,
+        "  %c index: %u\n"
+        "\tname: <%s>\n"
+        "\tdriver: <%s>\n"
+        "\tflags: %s%s%s%s%s%s%s%s\n"
+        "\tstate: %s\n"
+        "\tsuspend cause: %s%s%s%s\n"
+        "\tpriority: %u\n"
+        "\tvolume: %s%s%s\n"
+        "\t        balance %0.2f\n"
+        "\tbase volume: %s%s%s\n"
+        "\tvolume steps: %u\n"
+        "\tmuted: %s\n"
+        "\tcurrent latency: %0.2f ms\n"
+        "\tmax request: %lu KiB\n"
+        "\tmax rewind: %lu KiB\n"
+        "\tmonitor source: %u\n"
+        "\tsample spec: %s\n"
+        "\tchannel map: %s%s%s\n"
+        "\tused by: %u\n"
+        "\tlinked by: %u\n",
+        sink == default_sink ? '*' : ' ',
+        sink->index,
+        sink->name,
+        sink->driver,
+        sink->flags & PA_SINK_HARDWARE ? "HARDWARE " : "",
+        sink->flags & PA_SINK_NETWORK ? "NETWORK " : "",
+        sink->flags & PA_SINK_HW_MUTE_CTRL ? "HW_MUTE_CTRL " : "",
+        sink->flags & PA_SINK_HW_VOLUME_CTRL ? "HW_VOLUME_CTRL " : "",
+        sink->flags & PA_SINK_DECIBEL_VOLUME ? "DECIBEL_VOLUME " : "",
+        sink->flags & PA_SINK_LATENCY ? "LATENCY " : "",
+        sink->flags & PA_SINK_FLAT_VOLUME ? "FLAT_VOLUME " : "",
+        sink->flags & PA_SINK_DYNAMIC_LATENCY ? "DYNAMIC_LATENCY" : "",
+        sink_state_to_string(pa_sink_get_state(sink)),
+        sink->suspend_cause & PA_SUSPEND_USER ? "USER " : "",
+        sink->suspend_cause & PA_SUSPEND_APPLICATION ? "APPLICATION " : "",
+        sink->suspend_cause & PA_SUSPEND_IDLE ? "IDLE " : "",
+        sink->suspend_cause & PA_SUSPEND_SESSION ? "SESSION" : "",
+        sink->priority,
+        pa_cvolume_snprint(cv, sizeof(cv), pa_sink_get_volume(sink, FALSE)),
+        sink->flags & PA_SINK_DECIBEL_VOLUME ? "\n\t        " : "",
+        sink->flags & PA_SINK_DECIBEL_VOLUME ? pa_sw_cvolume_snprint_dB(cvdb, sizeof(cvdb), pa_sink_get_volume(sink, FALSE)) : "",
+        pa_cvolume_get_balance(pa_sink_get_volume(sink, FALSE), &sink->channel_map),
+        pa_volume_snprint(v, sizeof(v), sink->base_volume),
+        sink->flags & PA_SINK_DECIBEL_VOLUME ? "\n\t             " : "",
+        sink->flags & PA_SINK_DECIBEL_VOLUME ? pa_sw_volume_snprint_dB(vdb, sizeof(vdb), sink->base_volume) : "",
+        sink->n_volume_steps,
+        pa_yes_no(pa_sink_get_mute(sink, FALSE)),
+        (double) pa_sink_get_latency(sink) / (double) PA_USEC_PER_MSEC,
+        (unsigned long) pa_sink_get_max_request(sink) / 1024,
+        (unsigned long) pa_sink_get_max_rewind(sink) / 1024,
+        sink->monitor_source ? sink->monitor_source->index : PA_INVALID_INDEX,
+        pa_sample_spec_snprint(ss, sizeof(ss), &sink->sample_spec),
+        pa_channel_map_snprint(cm, sizeof(cm), &sink->channel_map),
+        cmn ? "\n\t             " : "",
+        cmn ? cmn : "",
+        pa_sink_used_by(sink),
+        pa_sink_linked_by(sink));
+
+    if (sink->flags & PA_SINK_DYNAMIC_LATENCY) {
+        pa_usec_t min_latency, max_latency;
+        pa_sink_get_latency_range(sink, &min_latency, &max_latency);
 
-    s = pa_strbuf_new();
+        pa_strbuf_printf(
+                s,
+                "\tconfigured latency: %0.2f ms; range is %0.2f .. %0.2f ms\n",
+                (double) pa_sink_get_requested_latency(sink) / (double) PA_USEC_PER_MSEC,
+                (double) min_latency / PA_USEC_PER_MSEC,
+                (double) max_latency / PA_USEC_PER_MSEC);
+    } else
+        pa_strbuf_printf(
+                s,
+                "\tfixed latency: %0.2f ms\n",
+                (double) pa_sink_get_fixed_latency(sink) / PA_USEC_PER_MSEC);
 
-    pa_strbuf_printf(s, "%u sink(s) available.\n", pa_idxset_size(c->sinks));
+    if (sink->card)
+        pa_strbuf_printf(s, "\tcard: %u <%s>\n", sink->card->index, sink->card->name);
+    if (sink->module)
+        pa_strbuf_printf(s, "\tmodule: %u\n", sink->module->index);
 
-    default_sink = pa_namereg_get_default_sink(c);
+    t = pa_proplist_to_string_sep(sink->proplist, "\n\t\t");
+    pa_strbuf_printf(s, "\tproperties:\n\t\t%s\n", t);
+    pa_xfree(t);
 
-    PA_IDXSET_FOREACH(sink, c->sinks, idx) {
-        char ss[PA_SAMPLE_SPEC_SNPRINT_MAX],
-            cv[PA_CVOLUME_SNPRINT_MAX],
-            cvdb[PA_SW_CVOLUME_SNPRINT_DB_MAX],
-            v[PA_VOLUME_SNPRINT_MAX],
-            vdb[PA_SW_VOLUME_SNPRINT_DB_MAX],
-            cm[PA_CHANNEL_MAP_SNPRINT_MAX], *t;
-        const char *cmn;
+    t = pa_io_counters_to_string(&sink->thread_info.counters);
+    pa_strbuf_printf(s, "\tcounters: %s\n", t);
+    pa_xfree(t);
+
+    if (sink->render_stats) {
+        t = pa_render_stats_to_string(sink->render_stats, "\t\t");
+        pa_strbuf_printf(s, "\trender statistics:\n%s", t);
+        pa_xfree(t);
+    }
 
-        cmn = pa_channel_map_to_pretty_name(&sink->channel_map);
+    append_port_list(s, sink->ports);
 
+    if (sink->active_port)
         pa_strbuf_printf(
-            s,
-            "  %c index: %u\n"
-            "\tname: <%s>\n"
-            "\tdriver: <%s>\n"
-            "\tflags: %s%s%s%s%s%s%s%s\n"
-            "\tstate: %s\n"
-            "\tsuspend cause: %s%s%s%s\n"
-            "\tpriority: %u\n"
-            "\tvolume: %s%s%s\n"
-            "\t        balance %0.2f\n"
-            "\tbase volume: %s%s%s\n"
-            "\tvolume steps: %u\n"
-            "\tmuted: %s\n"
-            "\tcurrent latency: %0.2f ms\n"
-            "\tmax request: %lu KiB\n"
-            "\tmax rewind: %lu KiB\n"
-            "\tmonitor source: %u\n"
-            "\tsample spec: %s\n"
-            "\tchannel map: %s%s%s\n"
-            "\tused by: %u\n"
-            "\tlinked by: %u\n",
-            sink == default_sink ? '*' : ' ',
-            sink->index,
-            sink->name,
-            sink->driver,
-            sink->flags & PA_SINK_HARDWARE ? "HARDWARE " : "",
-            sink->flags & PA_SINK_NETWORK ? "NETWORK " : "",
-            sink->flags & PA_SINK_HW_MUTE_CTRL ? "HW_MUTE_CTRL " : "",
-            sink->flags & PA_SINK_HW_VOLUME_CTRL ? "HW_VOLUME_CTRL " : "",
-            sink->flags & PA_SINK_DECIBEL_VOLUME ? "DECIBEL_VOLUME " : "",
-            sink->flags & PA_SINK_LATENCY ? "LATENCY " : "",
-            sink->flags & PA_SINK_FLAT_VOLUME ? "FLAT_VOLUME " : "",
-            sink->flags & PA_SINK_DYNAMIC_LATENCY ? "DYNAMIC_LATENCY" : "",
-            sink_state_to_string(pa_sink_get_state(sink)),
-            sink->suspend_cause & PA_SUSPEND_USER ? "USER " : "",
-            sink->suspend_cause & PA_SUSPEND_APPLICATION ? "APPLICATION " : "",
-            sink->suspend_cause & PA_SUSPEND_IDLE ? "IDLE " : "",
-            sink->suspend_cause & PA_SUSPEND_SESSION ? "SESSION" : "",
-            sink->priority,
-            pa_cvolume_snprint(cv, sizeof(cv), pa_sink_get_volume(sink, FALSE)),
-            sink->flags & PA_SINK_DECIBEL_VOLUME ? "\n\t        " : "",
-            sink->flags & PA_SINK_DECIBEL_VOLUME ? pa_sw_cvolume_snprint_dB(cvdb, sizeof(cvdb), pa_sink_get_volume(sink, FALSE)) : "",
-            pa_cvolume_get_balance(pa_sink_get_volume(sink, FALSE), &sink->channel_map),
-            pa_volume_snprint(v, sizeof(v), sink->base_volume),
-            sink->flags & PA_SINK_DECIBEL_VOLUME ? "\n\t             " : "",
-            sink->flags & PA_SINK_DECIBEL_VOLUME ? pa_sw_volume_snprint_dB(vdb, sizeof(vdb), sink->base_volume) : "",
-            sink->n_volume_steps,
-            pa_yes_no(pa_sink_get_mute(sink, FALSE)),
-            (double) pa_sink_get_latency(sink) / (double) PA_USEC_PER_MSEC,
-            (unsigned long) pa_sink_get_max_request(sink) / 1024,
-            (unsigned long) pa_sink_get_max_rewind(sink) / 1024,
-            sink->monitor_source ? sink->monitor_source->index : PA_INVALID_INDEX,
-            pa_sample_spec_snprint(ss, sizeof(ss), &sink->sample_spec),
-            pa_channel_map_snprint(cm, sizeof(cm), &sink->channel_map),
-            cmn ? "\n\t             " : "",
-            cmn ? cmn : "",
-            pa_sink_used_by(sink),
-            pa_sink_linked_by(sink));
-
-        if (sink->flags & PA_SINK_DYNAMIC_LATENCY) {
-            pa_usec_t min_latency, max_latency;
-            pa_sink_get_latency_range(sink, &min_latency, &max_latency);
-
-            pa_strbuf_printf(
-                    s,
-                    "\tconfigured latency: %0.2f ms; range is %0.2f .. %0.2f ms\n",
-                    (double) pa_sink_get_requested_latency(sink) / (double) PA_USEC_PER_MSEC,
-                    (double) min_latency / PA_USEC_PER_MSEC,
-                    (double) max_latency / PA_USEC_PER_MSEC);
-        } else
-            pa_strbuf_printf(
-                    s,
-                    "\tfixed latency: %0.2f ms\n",
-                    (double) pa_sink_get_fixed_latency(sink) / PA_USEC_PER_MSEC);
-
-        if (sink->card)
-            pa_strbuf_printf(s, "\tcard: %u <%s>\n", sink->card->index, sink->card->name);
-        if (sink->module)
-            pa_strbuf_printf(s, "\tmodule: %u\n", sink->module->index);
-
-        t = pa_proplist_to_string_sep(sink->proplist, "\n\t\t");
-        pa_strbuf_printf(s, "\tproperties:\n\t\t%s\n", t);
-        pa_xfree(t);
+                s,
+                "\tactive port: <%s>\n",
+                sink->active_port->name);
+}
 
-        append_port_list(s, sink->ports);
+static void append_source(pa_strbuf *s, pa_source *source) {
+    pa_source *default_source;
+    char ss[PA_SAMPLE_SPEC_SNPRINT_MAX],
+        cv[PA_CVOLUME_SNPRINT_MAX],
+        cvdb[PA_SW_CVOLUME_SNPRINT_DB_MAX],
+        v[PA_VOLUME_SNPRINT_MAX],
+        vdb[PA_SW_VOLUME_SNPRINT_DB_MAX],
+        cm[PA_CHANNEL_MAP_SNPRINT_MAX], *t;
+    const char *cmn;
+
+    default_source = pa_namereg_get_default_source(source->core);
+    cmn = pa_channel_map_to_pretty_name(&source->channel_map);
+
+    pa_strbuf_printf(
+        s,
+        "  %c index: %u\n"
+        "\tname: <%s>\n"
+        "\tdriver: <%s>\n"
+        "\tflags: %s%s%s%s%s%s%s\n"
+        "\tstate: %s\n"
+        "\tsuspend cause: %s%s%s%s\n"
+        "\tpriority: %u\n"
+        "\tvolume: %s%s%s\n"
+        "\t        balance %0.2f\n"
+        "\tbase volume: %s%s%s\n"
+        "\tvolume steps: %u\n"
+        "\tmuted: %s\n"
+        "\tcurrent latency: %0.2f ms\n"
+        "\tmax rewind: %lu KiB\n"
+        "\tsample spec: %s\n"
+        "\tchannel map: %s%s%s\n"
+        "\tused by: %u\n"
+        "\tlinked by: %u\n",
+        source == default_source ? '*' : ' ',
+        source->index,
+        source->name,
+        source->driver,
+        source->flags & PA_SOURCE_HARDWARE ? "HARDWARE " : "",
+        source->flags & PA_SOURCE_NETWORK ? "NETWORK " : "",
+        source->flags & PA_SOURCE_HW_MUTE_CTRL ? "HW_MUTE_CTRL " : "",
+        source->flags & PA_SOURCE_HW_VOLUME_CTRL ? "HW_VOLUME_CTRL " : "",
+        source->flags & PA_SOURCE_DECIBEL_VOLUME ? "DECIBEL_VOLUME " : "",
+        source->flags & PA_SOURCE_LATENCY ? "LATENCY " : "",
+        source->flags & PA_SOURCE_DYNAMIC_LATENCY ? "DYNAMIC_LATENCY" : "",
+        source_state_to_string(pa_source_get_state(source)),
+        source->suspend_cause & PA_SUSPEND_USER ? "USER " : "",
+        source->suspend_cause & PA_SUSPEND_APPLICATION ? "APPLICATION " : "",
+        source->suspend_cause & PA_SUSPEND_IDLE ? "IDLE " : "",
+        source->suspend_cause & PA_SUSPEND_SESSION ? "SESSION" : "",
+        source->priority,
+        pa_cvolume_snprint(cv, sizeof(cv), pa_source_get_volume(source, FALSE)),
+        source->flags & PA_SOURCE_DECIBEL_VOLUME ? "\n\t        " : "",
+        source->flags & PA_SOURCE_DECIBEL_VOLUME ? pa_sw_cvolume_snprint_dB(cvdb, sizeof(cvdb), pa_source_get_volume(source, FALSE)) : "",
+        pa_cvolume_get_balance(pa_source_get_volume(source, FALSE), &source->channel_map),
+        pa_volume_snprint(v, sizeof(v), source->base_volume),
+        source->flags & PA_SOURCE_DECIBEL_VOLUME ? "\n\t             " : "",
+        source->flags & PA_SOURCE_DECIBEL_VOLUME ? pa_sw_volume_snprint_dB(vdb, sizeof(vdb), source->base_volume) : "",
+        source->n_volume_steps,
+        pa_yes_no(pa_source_get_mute(source, FALSE)),
+        (double) pa_source_get_latency(source) / PA_USEC_PER_MSEC,
+        (unsigned long) pa_source_get_max_rewind(source) / 1024,
+        pa_sample_spec_snprint(ss, sizeof(ss), &source->sample_spec),
+        pa_channel_map_snprint(cm, sizeof(cm), &source->channel_map),
+        cmn ? "\n\t             " : "",
+        cmn ? cmn : "",
+        pa_source_used_by(source),
+        pa_source_linked_by(source));
+
+    if (source->flags & PA_SOURCE_DYNAMIC_LATENCY) {
+        pa_usec_t min_latency, max_latency;
+        pa_source_get_latency_range(source, &min_latency, &max_latency);
 
-        if (sink->active_port)
-            pa_strbuf_printf(
-                    s,
-                    "\tactive port: <%s>\n",
-                    sink->active_port->name);
+        pa_strbuf_printf(
+                s,
+                "\tconfigured latency: %0.2f ms; range is %0.2f .. %0.2f ms\n",
+                (double) pa_source_get_requested_latency(source) / PA_USEC_PER_MSEC,
+                (double) min_latency / PA_USEC_PER_MSEC,
+                (double) max_latency / PA_USEC_PER_MSEC);
+    } else
+        pa_strbuf_printf(
+                s,
+                "\tfixed latency: %0.2f ms\n",
+                (double) pa_source_get_fixed_latency(source) / PA_USEC_PER_MSEC);
+
+    if (source->monitor_of)
+        pa_strbuf_printf(s, "\tmonitor_of: %u\n", source->monitor_of->index);
+    if (source->card)
+        pa_strbuf_printf(s, "\tcard: %u <%s>\n", source->card->index, source->card->name);
+    if (source->module)
+        pa_strbuf_printf(s, "\tmodule: %u\n", source->module->index);
+
+    t = pa_proplist_to_string_sep(source->proplist, "\n\t\t");
+    pa_strbuf_printf(s, "\tproperties:\n\t\t%s\n", t);
+    pa_xfree(t);
+
+    t = pa_io_counters_to_string(&source->thread_info.counters);
+    pa_strbuf_printf(s, "\tcounters: %s\n", t);
+    pa_xfree(t);
+
+    if (source->render_stats) {
+        t = pa_render_stats_to_string(source->render_stats, "\t\t");
+        pa_strbuf_printf(s, "\trender statistics:\n%s", t);
+        pa_xfree(t);
     }
 
-    return pa_strbuf_tostring_free(s);
+    append_port_list(s, source->ports);
+
+    if (source->active_port)
+        pa_strbuf_printf(
+                s,
+                "\tactive port: <%s>\n",
+                source->active_port->name);
 }
 
-char *pa_source_list_to_string(pa_core *c) {
-    pa_strbuf *s;
-    pa_source *source, *default_source;
-    uint32_t idx = PA_IDXSET_INVALID;
-    pa_assert(c);
+static void append_source_output(pa_strbuf *s, pa_source_output *o) {
+    static const char* const state_table[] = {
+        [PA_SOURCE_OUTPUT_INIT] = "INIT",
+        [PA_SOURCE_OUTPUT_RUNNING] = "RUNNING",
+        [PA_SOURCE_OUTPUT_CORKED] = "CORKED",
+        [PA_SOURCE_OUTPUT_UNLINKED] = "UNLINKED"
+    };
+    char ss[PA_SAMPLE_SPEC_SNPRINT_MAX], cvdb[PA_SW_CVOLUME_SNPRINT_DB_MAX], cv[PA_CVOLUME_SNPRINT_MAX], cm[PA_CHANNEL_MAP_SNPRINT_MAX], *t, clt[28];
+    pa_usec_t l, cl;
+    const char *cmn;
+    pa_cvolume v;
+    char *volume_str = NULL;
+
+    cmn = pa_channel_map_to_pretty_name(&o->channel_map);
+
+    /* One round trip to the IO thread per output adds up, so the
+     * snapshots are good enough here */
+    l = pa_source_output_get_latency_nowait(o, &cl);
+
+    if (cl == (pa_usec_t) -1)
+        pa_snprintf(clt, sizeof(clt), "n/a");
+    else
+        pa_snprintf(clt, sizeof(clt), "%0.2f ms", (double) cl / PA_USEC_PER_MSEC);
+
+    pa_assert(o->source);
+
+    if (pa_source_output_is_volume_readable(o)) {
+        pa_source_output_get_volume(o, &v, TRUE);
+        volume_str = pa_sprintf_malloc("%s\n\t        %s\n\t        balance %0.2f",
+                                       pa_cvolume_snprint(cv, sizeof(cv), &v),
+                                       pa_sw_cvolume_snprint_dB(cvdb, sizeof(cvdb), &v),
+                                       pa_cvolume_get_balance(&v, &o->channel_map));
+    } else
+        volume_str = pa_xstrdup("n/a");
+
+    pa_strbuf_printf(
+        s,
+        "    index: %u\n"
+        "\tdriver: <%s>\n"
+        "\tflags: %s%s%s%s%s%s%s%s%s%s%s%s\n"
+        "\tstate: %s\n"
+        "\tsource: %u <%s>\n"
+        "\tvolume: %s\n"
+        "\tmuted: %s\n"
+        "\tcurrent latency: %0.2f ms\n"
+        "\trequested latency: %s\n"
+        "\tsample spec: %s\n"
+        "\tchannel map: %s%s%s\n"
+        "\tresample method: %s\n",
+        o->index,
+        o->driver,
+        o->flags & PA_SOURCE_OUTPUT_VARIABLE_RATE ? "VARIABLE_RATE " : "",
+        o->flags & PA_SOURCE_OUTPUT_DONT_MOVE ? "DONT_MOVE " : "",
+        o->flags & PA_SOURCE_OUTPUT_START_CORKED ? "START_CORKED " : "",
+        o->flags & PA_SOURCE_OUTPUT_NO_REMAP ? "NO_REMAP " : "",
+        o->flags & PA_SOURCE_OUTPUT_NO_REMIX ? "NO_REMIX " : "",
+        o->flags & PA_SOURCE_OUTPUT_FIX_FORMAT ? "FIX_FORMAT " : "",
+        o->flags & PA_SOURCE_OUTPUT_FIX_RATE ? "FIX_RATE " : "",
+        o->flags & PA_SOURCE_OUTPUT_FIX_CHANNELS ? "FIX_CHANNELS " : "",
+        o->flags & PA_SOURCE_OUTPUT_DONT_INHIBIT_AUTO_SUSPEND ? "DONT_INHIBIT_AUTO_SUSPEND " : "",
+        o->flags & PA_SOURCE_OUTPUT_NO_CREATE_ON_SUSPEND ? "NO_CREATE_ON_SUSPEND " : "",
+        o->flags & PA_SOURCE_OUTPUT_KILL_ON_SUSPEND ? "KILL_ON_SUSPEND " : "",
+        o->flags & PA_SOURCE_OUTPUT_PASSTHROUGH ? "PASSTHROUGH " : "",
+        state_table[pa_source_output_get_state(o)],
+        o->source->index, o->source->name,
+        volume_str,
+        pa_yes_no(pa_source_output_get_mute(o)),
+        (double) l / PA_USEC_PER_MSEC,
+        clt,
+        pa_sample_spec_snprint(ss, sizeof(ss), &o->sample_spec),
+        pa_channel_map_snprint(cm, sizeof(cm), &o->channel_map),
+        cmn ? "\n\t             " : "",
+        cmn ? cmn : "",
+        pa_resample_method_to_string(pa_source_output_get_resample_method(o)));
+
+    pa_xfree(volume_str);
+
+    if (o->module)
+        pa_strbuf_printf(s, "\towner module: %u\n", o->module->index);
+    if (o->client)
+        pa_strbuf_printf(s, "\tclient: %u <%s>\n", o->client->index, pa_strnull(pa_proplist_gets(o->client->proplist, PA_PROP_APPLICATION_NAME)));
+    if (o->direct_on_input)
+        pa_strbuf_printf(s, "\tdirect on input: %u\n", o->direct_on_input->index);
+
+    t = pa_proplist_to_string_sep(o->proplist, "\n\t\t");
+    pa_strbuf_printf(s, "\tproperties:\n\t\t%s\n", t);
+    pa_xfree(t);
+
+    t = pa_io_counters_to_string(&o->thread_info.counters);
+    pa_strbuf_printf(s, "\tcounters: %s\n", t);
+    pa_xfree(t);
+}
 
-    s = pa_strbuf_new();
+static void append_sink_input(pa_strbuf *s, pa_sink_input *i) {
+    static const char* const state_table[] = {
+        [PA_SINK_INPUT_INIT] = "INIT",
+        [PA_SINK_INPUT_RUNNING] = "RUNNING",
+        [PA_SINK_INPUT_DRAINED] = "DRAINED",
+        [PA_SINK_INPUT_CORKED] = "CORKED",
+        [PA_SINK_INPUT_UNLINKED] = "UNLINKED"
+    };
+    char ss[PA_SAMPLE_SPEC_SNPRINT_MAX], cvdb[PA_SW_CVOLUME_SNPRINT_DB_MAX], cv[PA_CVOLUME_SNPRINT_MAX], cm[PA_CHANNEL_MAP_SNPRINT_MAX], *t, clt[28];
+    char rh[PA_BYTES_SNPRINT_MAX], rhm[PA_BYTES_SNPRINT_MAX], rd[PA_BYTES_SNPRINT_MAX];
+    pa_usec_t l, cl;
+    const char *cmn;
+    pa_cvolume v;
+    char *volume_str = NULL;
+
+    cmn = pa_channel_map_to_pretty_name(&i->channel_map);
+
+    /* As for source outputs */
+    l = pa_sink_input_get_latency_nowait(i, &cl);
+
+    if (cl == (pa_usec_t) -1)
+        pa_snprintf(clt, sizeof(clt), "n/a");
+    else
+        pa_snprintf(clt, sizeof(clt), "%0.2f ms", (double) cl / PA_USEC_PER_MSEC);
+
+    pa_assert(i->sink);
+
+    if (pa_sink_input_is_volume_readable(i)) {
+        pa_sink_input_get_volume(i, &v, TRUE);
+        volume_str = pa_sprintf_malloc("%s\n\t        %s\n\t        balance %0.2f",
+                                       pa_cvolume_snprint(cv, sizeof(cv), &v),
+                                       pa_sw_cvolume_snprint_dB(cvdb, sizeof(cvdb), &v),
+                                       pa_cvolume_get_balance(&v, &i->channel_map));
+    } else
+        volume_str = pa_xstrdup("n/a");
+
+    pa_strbuf_printf(
+        s,
+        "    index: %u\n"
+        "\tdriver: <%s>\n"
+        "\tflags: %s%s%s%s%s%s%s%s%s%s%s%s%s\n"
+        "\tstate: %s\n"
+        "\tsink: %u <%s>\n"
+        "\tvolume: %s\n"
+        "\tmuted: %s\n"
+        "\tcurrent latency: %0.2f ms\n"
+        "\trequested latency: %s\n"
+        "\tsample spec: %s\n"
+        "\tchannel map: %s%s%s\n"
+        "\tresample method: %s\n",
+        i->index,
+        i->driver,
+        i->flags & PA_SINK_INPUT_VARIABLE_RATE ? "VARIABLE_RATE " : "",
+        i->flags & PA_SINK_INPUT_DONT_MOVE ? "DONT_MOVE " : "",
+        i->flags & PA_SINK_INPUT_START_CORKED ? "START_CORKED " : "",
+        i->flags & PA_SINK_INPUT_NO_REMAP ? "NO_REMAP " : "",
+        i->flags & PA_SINK_INPUT_NO_REMIX ? "NO_REMIX " : "",
+        i->flags & PA_SINK_INPUT_FIX_FORMAT ? "FIX_FORMAT " : "",
+        i->flags & PA_SINK_INPUT_FIX_RATE ? "FIX_RATE " : "",
+        i->flags & PA_SINK_INPUT_FIX_CHANNELS ? "FIX_CHANNELS " : "",
+        i->flags & PA_SINK_INPUT_DONT_INHIBIT_AUTO_SUSPEND ? "DONT_INHIBIT_AUTO_SUSPEND " : "",
+        i->flags & PA_SINK_INPUT_NO_CREATE_ON_SUSPEND ? "NO_CREATE_SUSPEND " : "",
+        i->flags & PA_SINK_INPUT_KILL_ON_SUSPEND ? "KILL_ON_SUSPEND " : "",
+        i->flags & PA_SINK_INPUT_PASSTHROUGH ? "PASSTHROUGH " : "",
+        i->flags & PA_SINK_INPUT_PARALLEL_PEEK ? "PARALLEL_PEEK " : "",
+        state_table[pa_sink_input_get_state(i)],
+        i->sink->index, i->sink->name,
+        volume_str,
+        pa_yes_no(pa_sink_input_get_mute(i)),
+        (double) l / PA_USEC_PER_MSEC,
+        clt,
+        pa_sample_spec_snprint(ss, sizeof(ss), &i->sample_spec),
+        pa_channel_map_snprint(cm, sizeof(cm), &i->channel_map),
+        cmn ? "\n\t             " : "",
+        cmn ? cmn : "",
+        pa_resample_method_to_string(pa_sink_input_get_resample_method(i)));
+
+    pa_xfree(volume_str);
+
+    if (i->module)
+        pa_strbuf_printf(s, "\tmodule: %u\n", i->module->index);
+    if (i->client)
+        pa_strbuf_printf(s, "\tclient: %u <%s>\n", i->client->index, pa_strnull(pa_proplist_gets(i->client->proplist, PA_PROP_APPLICATION_NAME)));
+
+    t = pa_proplist_to_string_sep(i->proplist, "\n\t\t");
+    pa_strbuf_printf(s, "\tproperties:\n\t\t%s\n", t);
+    pa_xfree(t);
+
+    t = pa_io_counters_to_string(&i->thread_info.counters);
+    pa_strbuf_printf(s, "\tcounters: %s\n", t);
+    pa_xfree(t);
+
+    pa_strbuf_printf(s, "\trender history: %s of %s kept, deepest rewind %s\n",
+                     pa_bytes_snprint(rh, sizeof(rh), (unsigned) i->thread_info.render_history),
+                     pa_bytes_snprint(rhm, sizeof(rhm), (unsigned) i->thread_info.render_history_max),
+                     pa_bytes_snprint(rd, sizeof(rd), (unsigned) PA_MAX(i->thread_info.rewind_depth, i->thread_info.rewind_depth_prev)));
+}
 
-    pa_strbuf_printf(s, "%u source(s) available.\n", pa_idxset_size(c->sources));
+static void append_scache_entry(pa_strbuf *s, pa_scache_entry *e) {
+    double l = 0;
+    char ss[PA_SAMPLE_SPEC_SNPRINT_MAX] = "n/a", cv[PA_CVOLUME_SNPRINT_MAX], cvdb[PA_SW_CVOLUME_SNPRINT_DB_MAX], cm[PA_CHANNEL_MAP_SNPRINT_MAX] = "n/a", *t;
+    const char *cmn;
 
-    default_source = pa_namereg_get_default_source(c);
+    cmn = pa_channel_map_to_pretty_name(&e->channel_map);
 
-    PA_IDXSET_FOREACH(source, c->sources, idx) {
-        char ss[PA_SAMPLE_SPEC_SNPRINT_MAX],
-            cv[PA_CVOLUME_SNPRINT_MAX],
-            cvdb[PA_SW_CVOLUME_SNPRINT_DB_MAX],
-            v[PA_VOLUME_SNPRINT_MAX],
-            vdb[PA_SW_VOLUME_SNPRINT_DB_MAX],
-            cm[PA_CHANNEL_MAP_SNPRINT_MAX], *t;
-        const char *cmn;
+    if (e->memchunk.memblock) {
+        pa_sample_spec_snprint(ss, sizeof(ss), &e->sample_spec);
+        pa_channel_map_snprint(cm, sizeof(cm), &e->channel_map);
+        l = (double) e->memchunk.length / (double) pa_bytes_per_second(&e->sample_spec);
+    }
 
-        cmn = pa_channel_map_to_pretty_name(&source->channel_map);
+    pa_strbuf_printf(
+        s,
+        "    name: <%s>\n"
+        "\tindex: %u\n"
+        "\tsample spec: %s\n"
+        "\tchannel map: %s%s%s\n"
+        "\tlength: %lu\n"
+        "\tduration: %0.1f s\n"
+        "\tvolume: %s\n"
+        "\t        %s\n"
+        "\t        balance %0.2f\n"
+        "\tlazy: %s\n"
+        "\tfilename: <%s>\n",
+        e->name,
+        e->index,
+        ss,
+        cm,
+        cmn ? "\n\t             " : "",
+        cmn ? cmn : "",
+        (long unsigned)(e->memchunk.memblock ? e->memchunk.length : 0),
+        l,
+        e->volume_is_set ? pa_cvolume_snprint(cv, sizeof(cv), &e->volume) : "n/a",
+        e->volume_is_set ? pa_sw_cvolume_snprint_dB(cvdb, sizeof(cvdb), &e->volume) : "n/a",
+        (e->memchunk.memblock && e->volume_is_set) ? pa_cvolume_get_balance(&e->volume, &e->channel_map) : 0.0f,
+        pa_yes_no(e->lazy),
+        e->filename ? e->filename : "n/a");
+
+    t = pa_proplist_to_string_sep(e->proplist, "\n\t\t");
+    pa_strbuf_printf(s, "\tproperties:\n\t\t%s\n", t);
+    pa_xfree(t);
+}
 
-        pa_strbuf_printf(
-            s,
-            "  %c index: %u\n"
-            "\tname: <%s>\n"
-            "\tdriver: <%s>\n"
-            "\tflags: %s%s%s%s%s%s%s\n"
-            "\tstate: %s\n"
-            "\tsuspend cause: %s%s%s%s\n"
-            "\tpriority: %u\n"
-            "\tvolume: %s%s%s\n"
-            "\t        balance %0.2f\n"
-            "\tbase volume: %s%s%s\n"
-            "\tvolume steps: %u\n"
-            "\tmuted: %s\n"
-            "\tcurrent latency: %0.2f ms\n"
-            "\tmax rewind: %lu KiB\n"
-            "\tsample spec: %s\n"
-            "\tchannel map: %s%s%s\n"
-            "\tused by: %u\n"
-            "\tlinked by: %u\n",
-            source == default_source ? '*' : ' ',
-            source->index,
-            source->name,
-            source->driver,
-            source->flags & PA_SOURCE_HARDWARE ? "HARDWARE " : "",
-            source->flags & PA_SOURCE_NETWORK ? "NETWORK " : "",
-            source->flags & PA_SOURCE_HW_MUTE_CTRL ? "HW_MUTE_CTRL " : "",
-            source->flags & PA_SOURCE_HW_VOLUME_CTRL ? "HW_VOLUME_CTRL " : "",
-            source->flags & PA_SOURCE_DECIBEL_VOLUME ? "DECIBEL_VOLUME " : "",
-            source->flags & PA_SOURCE_LATENCY ? "LATENCY " : "",
-            source->flags & PA_SOURCE_DYNAMIC_LATENCY ? "DYNAMIC_LATENCY" : "",
-            source_state_to_string(pa_source_get_state(source)),
-            source->suspend_cause & PA_SUSPEND_USER ? "USER " : "",
-            source->suspend_cause & PA_SUSPEND_APPLICATION ? "APPLICATION " : "",
-            source->suspend_cause & PA_SUSPEND_IDLE ? "IDLE " : "",
-            source->suspend_cause & PA_SUSPEND_SESSION ? "SESSION" : "",
-            source->priority,
-            pa_cvolume_snprint(cv, sizeof(cv), pa_source_get_volume(source, FALSE)),
-            source->flags & PA_SOURCE_DECIBEL_VOLUME ? "\n\t        " : "",
-            source->flags & PA_SOURCE_DECIBEL_VOLUME ? pa_sw_cvolume_snprint_dB(cvdb, sizeof(cvdb), pa_source_get_volume(source, FALSE)) : "",
-            pa_cvolume_get_balance(pa_source_get_volume(source, FALSE), &source->channel_map),
-            pa_volume_snprint(v, sizeof(v), source->base_volume),
-            source->flags & PA_SOURCE_DECIBEL_VOLUME ? "\n\t             " : "",
-            source->flags & PA_SOURCE_DECIBEL_VOLUME ? pa_sw_volume_snprint_dB(vdb, sizeof(vdb), source->base_volume) : "",
-            source->n_volume_steps,
-            pa_yes_no(pa_source_get_mute(source, FALSE)),
-            (double) pa_source_get_latency(source) / PA_USEC_PER_MSEC,
-            (unsigned long) pa_source_get_max_rewind(source) / 1024,
-            pa_sample_spec_snprint(ss, sizeof(ss), &source->sample_spec),
-            pa_channel_map_snprint(cm, sizeof(cm), &source->channel_map),
-            cmn ? "\n\t             " : "",
-            cmn ? cmn : "",
-            pa_source_used_by(source),
-            pa_source_linked_by(source));
-
-        if (source->flags & PA_SOURCE_DYNAMIC_LATENCY) {
-            pa_usec_t min_latency, max_latency;
-            pa_source_get_latency_range(source, &min_latency, &max_latency);
-
-            pa_strbuf_printf(
-                    s,
-                    "\tconfigured latency: %0.2f ms; range is %0.2f .. %0.2f ms\n",
-                    (double) pa_source_get_requested_latency(source) / PA_USEC_PER_MSEC,
-                    (double) min_latency / PA_USEC_PER_MSEC,
-                    (double) max_latency / PA_USEC_PER_MSEC);
-        } else
-            pa_strbuf_printf(
-                    s,
-                    "\tfixed latency: %0.2f ms\n",
-                    (double) pa_source_get_fixed_latency(source) / PA_USEC_PER_MSEC);
-
-        if (source->monitor_of)
-            pa_strbuf_printf(s, "\tmonitor_of: %u\n", source->monitor_of->index);
-        if (source->card)
-            pa_strbuf_printf(s, "\tcard: %u <%s>\n", source->card->index, source->card->name);
-        if (source->module)
-            pa_strbuf_printf(s, "\tmodule: %u\n", source->module->index);
-
-        t = pa_proplist_to_string_sep(source->proplist, "\n\t\t");
-        pa_strbuf_printf(s, "\tproperties:\n\t\t%s\n", t);
-        pa_xfree(t);
+struct pa_cli_text_cursor {
+    pa_core *core;
+    pa_cli_text_list_t list;
+    pa_bool_t header_done, started, done;
+    uint32_t idx;
+};
+
+static pa_idxset *cursor_idxset(pa_cli_text_cursor *cur) {
+    switch (cur->list) {
+        case PA_CLI_TEXT_MODULES:
+            return cur->core->modules;
+        case PA_CLI_TEXT_CLIENTS:
+            return cur->core->clients;
+        case PA_CLI_TEXT_CARDS:
+            return cur->core->cards;
+        case PA_CLI_TEXT_SINKS:
+            return cur->core->sinks;
+        case PA_CLI_TEXT_SOURCES:
+            return cur->core->sources;
+        case PA_CLI_TEXT_SINK_INPUTS:
+            return cur->core->sink_inputs;
+        case PA_CLI_TEXT_SOURCE_OUTPUTS:
+            return cur->core->source_outputs;
+        case PA_CLI_TEXT_SAMPLES:
+            return cur->core->scache;
+    }
 
-        append_port_list(s, source->ports);
+    pa_assert_not_reached();
+}
 
-        if (source->active_port)
-            pa_strbuf_printf(
-                    s,
-                    "\tactive port: <%s>\n",
-                    source->active_port->name);
+static void cursor_append_header(pa_cli_text_cursor *cur, pa_strbuf *s) {
+    pa_idxset *set = cursor_idxset(cur);
+    unsigned n = set ? pa_idxset_size(set) : 0;
+
+    switch (cur->list) {
+        case PA_CLI_TEXT_MODULES:
+            pa_strbuf_printf(s, "%u module(s) loaded.\n", n);
+            break;
+        case PA_CLI_TEXT_CLIENTS:
+            pa_strbuf_printf(s, "%u client(s) logged in.\n", n);
+            break;
+        case PA_CLI_TEXT_CARDS:
+            pa_strbuf_printf(s, "%u card(s) available.\n", n);
+            break;
+        case PA_CLI_TEXT_SINKS:
+            pa_strbuf_printf(s, "%u sink(s) available.\n", n);
+            break;
+        case PA_CLI_TEXT_SOURCES:
+            pa_strbuf_printf(s, "%u source(s) available.\n", n);
+            break;
+        case PA_CLI_TEXT_SINK_INPUTS:
+            pa_strbuf_printf(s, "%u sink input(s) available.\n", n);
+            break;
+        case PA_CLI_TEXT_SOURCE_OUTPUTS:
+            pa_strbuf_printf(s, "%u source output(s) available.\n", n);
+            break;
+        case PA_CLI_TEXT_SAMPLES:
+            pa_strbuf_printf(s, "%u cache entrie(s) available.\n", n);
+            break;
     }
+}
 
-    return pa_strbuf_tostring_free(s);
+static void cursor_append_entry(pa_cli_text_cursor *cur, pa_strbuf *s, void *e) {
+    switch (cur->list) {
+        case PA_CLI_TEXT_MODULES:
+            append_module(s, e);
+            break;
+        case PA_CLI_TEXT_CLIENTS:
+            append_client(s, e);
+            break;
+        case PA_CLI_TEXT_CARDS:
+            append_card(s, e);
+            break;
+        case PA_CLI_TEXT_SINKS:
+            append_sink(s, e);
+            break;
+        case PA_CLI_TEXT_SOURCES:
+            append_source(s, e);
+            break;
+        case PA_CLI_TEXT_SINK_INPUTS:
+            append_sink_input(s, e);
+            break;
+        case PA_CLI_TEXT_SOURCE_OUTPUTS:
+            append_source_output(s, e);
+            break;
+        case PA_CLI_TEXT_SAMPLES:
+            append_scache_entry(s, e);
+            break;
+    }
 }
 
-char *pa_source_output_list_to_string(pa_core *c) {
-    pa_strbuf *s;
-    pa_source_output *o;
-    uint32_t idx = PA_IDXSET_INVALID;
-    static const char* const state_table[] = {
-        [PA_SOURCE_OUTPUT_INIT] = "INIT",
-        [PA_SOURCE_OUTPUT_RUNNING] = "RUNNING",
-        [PA_SOURCE_OUTPUT_CORKED] = "CORKED",
-        [PA_SOURCE_OUTPUT_UNLINKED] = "UNLINKED"
-    };
+pa_cli_text_cursor *pa_cli_text_cursor_new(pa_core *c, pa_cli_text_list_t list) {
+    pa_cli_text_cursor *cur;
+
     pa_assert(c);
 
-    s = pa_strbuf_new();
+    cur = pa_xnew(pa_cli_text_cursor, 1);
+    cur->core = c;
+    cur->list = list;
+    cur->header_done = cur->started = cur->done = FALSE;
+    cur->idx = PA_IDXSET_INVALID;
 
-    pa_strbuf_printf(s, "%u source output(s) available.\n", pa_idxset_size(c->source_outputs));
+    return cur;
+}
 
-    PA_IDXSET_FOREACH(o, c->source_outputs, idx) {
-        char ss[PA_SAMPLE_SPEC_SNPRINT_MAX], cvdb[PA_SW_CVOLUME_SNPRINT_DB_MAX], cv[PA_CVOLUME_SNPRINT_MAX], cm[PA_CHANNEL_MAP_SNPRINT_MAX], *t, clt[28];
-        pa_usec_t cl;
-        const char *cmn;
-        pa_cvolume v;
-        char *volume_str = NULL;
+void pa_cli_text_cursor_free(pa_cli_text_cursor *cur) {
+    pa_assert(cur);
 
-        cmn = pa_channel_map_to_pretty_name(&o->channel_map);
+    pa_xfree(cur);
+}
 
-        if ((cl = pa_source_output_get_requested_latency(o)) == (pa_usec_t) -1)
-            pa_snprintf(clt, sizeof(clt), "n/a");
-        else
-            pa_snprintf(clt, sizeof(clt), "%0.2f ms", (double) cl / PA_USEC_PER_MSEC);
+pa_bool_t pa_cli_text_cursor_next(pa_cli_text_cursor *cur, pa_strbuf *s) {
+    pa_idxset *set;
+    void *e;
 
-        pa_assert(o->source);
+    pa_assert(cur);
+    pa_assert(s);
 
-        if (pa_source_output_is_volume_readable(o)) {
-            pa_source_output_get_volume(o, &v, TRUE);
-            volume_str = pa_sprintf_malloc("%s\n\t        %s\n\t        balance %0.2f",
-                                           pa_cvolume_snprint(cv, sizeof(cv), &v),
-                                           pa_sw_cvolume_snprint_dB(cvdb, sizeof(cvdb), &v),
-                                           pa_cvolume_get_balance(&v, &o->channel_map));
-        } else
-            volume_str = pa_xstrdup("n/a");
+    if (!cur->header_done) {
+        cursor_append_header(cur, s);
+        cur->header_done = TRUE;
+        return TRUE;
+    }
 
-        pa_strbuf_printf(
-            s,
-            "    index: %u\n"
-            "\tdriver: <%s>\n"
-            "\tflags: %s%s%s%s%s%s%s%s%s%s%s%s\n"
-            "\tstate: %s\n"
-            "\tsource: %u <%s>\n"
-            "\tvolume: %s\n"
-            "\tmuted: %s\n"
-            "\tcurrent latency: %0.2f ms\n"
-            "\trequested latency: %s\n"
-            "\tsample spec: %s\n"
-            "\tchannel map: %s%s%s\n"
-            "\tresample method: %s\n",
-            o->index,
-            o->driver,
-            o->flags & PA_SOURCE_OUTPUT_VARIABLE_RATE ? "VARIABLE_RATE " : "",
-            o->flags & PA_SOURCE_OUTPUT_DONT_MOVE ? "DONT_MOVE " : "",
-            o->flags & PA_SOURCE_OUTPUT_START_CORKED ? "START_CORKED " : "",
-            o->flags & PA_SOURCE_OUTPUT_NO_REMAP ? "NO_REMAP " : "",
-            o->flags & PA_SOURCE_OUTPUT_NO_REMIX ? "NO_REMIX " : "",
-            o->flags & PA_SOURCE_OUTPUT_FIX_FORMAT ? "FIX_FORMAT " : "",
-            o->flags & PA_SOURCE_OUTPUT_FIX_RATE ? "FIX_RATE " : "",
-            o->flags & PA_SOURCE_OUTPUT_FIX_CHANNELS ? "FIX_CHANNELS " : "",
-            o->flags & PA_SOURCE_OUTPUT_DONT_INHIBIT_AUTO_SUSPEND ? "DONT_INHIBIT_AUTO_SUSPEND " : "",
-            o->flags & PA_SOURCE_OUTPUT_NO_CREATE_ON_SUSPEND ? "NO_CREATE_ON_SUSPEND " : "",
-            o->flags & PA_SOURCE_OUTPUT_KILL_ON_SUSPEND ? "KILL_ON_SUSPEND " : "",
-            o->flags & PA_SOURCE_OUTPUT_PASSTHROUGH ? "PASSTHROUGH " : "",
-            state_table[pa_source_output_get_state(o)],
-            o->source->index, o->source->name,
-            volume_str,
-            pa_yes_no(pa_source_output_get_mute(o)),
-            (double) pa_source_output_get_latency(o, NULL) / PA_USEC_PER_MSEC,
-            clt,
-            pa_sample_spec_snprint(ss, sizeof(ss), &o->sample_spec),
-            pa_channel_map_snprint(cm, sizeof(cm), &o->channel_map),
-            cmn ? "\n\t             " : "",
-            cmn ? cmn : "",
-            pa_resample_method_to_string(pa_source_output_get_resample_method(o)));
-
-        pa_xfree(volume_str);
-
-        if (o->module)
-            pa_strbuf_printf(s, "\towner module: %u\n", o->module->index);
-        if (o->client)
-            pa_strbuf_printf(s, "\tclient: %u <%s>\n", o->client->index, pa_strnull(pa_proplist_gets(o->client->proplist, PA_PROP_APPLICATION_NAME)));
-        if (o->direct_on_input)
-            pa_strbuf_printf(s, "\tdirect on input: %u\n", o->direct_on_input->index);
-
-        t = pa_proplist_to_string_sep(o->proplist, "\n\t\t");
-        pa_strbuf_printf(s, "\tproperties:\n\t\t%s\n", t);
-        pa_xfree(t);
+    if (cur->done || !(set = cursor_idxset(cur)))
+        return FALSE;
+
+    /* Entries may come and go between two calls, so we continue from the
+     * first index after the last one we printed rather than keeping a
+     * pointer around */
+    if (!cur->started) {
+        e = pa_idxset_first(set, &cur->idx);
+        cur->started = TRUE;
+    } else
+        e = pa_idxset_next(set, &cur->idx);
+
+    if (!e) {
+        cur->done = TRUE;
+        return FALSE;
     }
 
-    return pa_strbuf_tostring_free(s);
+    cursor_append_entry(cur, s, e);
+    return TRUE;
 }
 
-char *pa_sink_input_list_to_string(pa_core *c) {
+static char *list_to_string(pa_core *c, pa_cli_text_list_t list) {
+    pa_cli_text_cursor *cur;
     pa_strbuf *s;
-    pa_sink_input *i;
-    uint32_t idx = PA_IDXSET_INVALID;
-    static const char* const state_table[] = {
-        [PA_SINK_INPUT_INIT] = "INIT",
-        [PA_SINK_INPUT_RUNNING] = "RUNNING",
-        [PA_SINK_INPUT_DRAINED] = "DRAINED",
-        [PA_SINK_INPUT_CORKED] = "CORKED",
-        [PA_SINK_INPUT_UNLINKED] = "UNLINKED"
-    };
 
     pa_assert(c);
+
     s = pa_strbuf_new();
+    cur = pa_cli_text_cursor_new(c, list);
 
-    pa_strbuf_printf(s, "%u sink input(s) available.\n", pa_idxset_size(c->sink_inputs));
+    while (pa_cli_text_cursor_next(cur, s))
+        ;
 
-    PA_IDXSET_FOREACH(i, c->sink_inputs, idx) {
-        char ss[PA_SAMPLE_SPEC_SNPRINT_MAX], cvdb[PA_SW_CVOLUME_SNPRINT_DB_MAX], cv[PA_CVOLUME_SNPRINT_MAX], cm[PA_CHANNEL_MAP_SNPRINT_MAX], *t, clt[28];
-        pa_usec_t cl;
-        const char *cmn;
-        pa_cvolume v;
-        char *volume_str = NULL;
+    pa_cli_text_cursor_free(cur);
 
-        cmn = pa_channel_map_to_pretty_name(&i->channel_map);
+    return pa_strbuf_tostring_free(s);
+}
 
-        if ((cl = pa_sink_input_get_requested_latency(i)) == (pa_usec_t) -1)
-            pa_snprintf(clt, sizeof(clt), "n/a");
-        else
-            pa_snprintf(clt, sizeof(clt), "%0.2f ms", (double) cl / PA_USEC_PER_MSEC);
+char *pa_module_list_to_string(pa_core *c) {
+    return list_to_string(c, PA_CLI_TEXT_MODULES);
+}
 
-        pa_assert(i->sink);
+char *pa_client_list_to_string(pa_core *c) {
+    return list_to_string(c, PA_CLI_TEXT_CLIENTS);
+}
 
-        if (pa_sink_input_is_volume_readable(i)) {
-            pa_sink_input_get_volume(i, &v, TRUE);
-            volume_str = pa_sprintf_malloc("%s\n\t        %s\n\t        balance %0.2f",
-                                           pa_cvolume_snprint(cv, sizeof(cv), &v),
-                                           pa_sw_cvolume_snprint_dB(cvdb, sizeof(cvdb), &v),
-                                           pa_cvolume_get_balance(&v, &i->channel_map));
-        } else
-            volume_str = pa_xstrdup("n/a");
+char *pa_card_list_to_string(pa_core *c) {
+    return list_to_string(c, PA_CLI_TEXT_CARDS);
+}
 
-        pa_strbuf_printf(
-            s,
-            "    index: %u\n"
-            "\tdriver: <%s>\n"
-            "\tflags: %s%s%s%s%s%s%s%s%s%s%s%s\n"
-            "\tstate: %s\n"
-            "\tsink: %u <%s>\n"
-            "\tvolume: %s\n"
-            "\tmuted: %s\n"
-            "\tcurrent latency: %0.2f ms\n"
-            "\trequested latency: %s\n"
-            "\tsample spec: %s\n"
-            "\tchannel map: %s%s%s\n"
-            "\tresample method: %s\n",
-            i->index,
-            i->driver,
-            i->flags & PA_SINK_INPUT_VARIABLE_RATE ? "VARIABLE_RATE " : "",
-            i->flags & PA_SINK_INPUT_DONT_MOVE ? "DONT_MOVE " : "",
-            i->flags & PA_SINK_INPUT_START_CORKED ? "START_CORKED " : "",
-            i->flags & PA_SINK_INPUT_NO_REMAP ? "NO_REMAP " : "",
-            i->flags & PA_SINK_INPUT_NO_REMIX ? "NO_REMIX " : "",
-            i->flags & PA_SINK_INPUT_FIX_FORMAT ? "FIX_FORMAT " : "",
-            i->flags & PA_SINK_INPUT_FIX_RATE ? "FIX_RATE " : "",
-            i->flags & PA_SINK_INPUT_FIX_CHANNELS ? "FIX_CHANNELS " : "",
-            i->flags & PA_SINK_INPUT_DONT_INHIBIT_AUTO_SUSPEND ? "DONT_INHIBIT_AUTO_SUSPEND " : "",
-            i->flags & PA_SINK_INPUT_NO_CREATE_ON_SUSPEND ? "NO_CREATE_SUSPEND " : "",
-            i->flags & PA_SINK_INPUT_KILL_ON_SUSPEND ? "KILL_ON_SUSPEND " : "",
-            i->flags & PA_SINK_INPUT_PASSTHROUGH ? "PASSTHROUGH " : "",
-            state_table[pa_sink_input_get_state(i)],
-            i->sink->index, i->sink->name,
-            volume_str,
-            pa_yes_no(pa_sink_input_get_mute(i)),
-            (double) pa_sink_input_get_latency(i, NULL) / PA_USEC_PER_MSEC,
-            clt,
-            pa_sample_spec_snprint(ss, sizeof(ss), &i->sample_spec),
-            pa_channel_map_snprint(cm, sizeof(cm), &i->channel_map),
-            cmn ? "\n\t             " : "",
-            cmn ? cmn : "",
-            pa_resample_method_to_string(pa_sink_input_get_resample_method(i)));
-
-        pa_xfree(volume_str);
-
-        if (i->module)
-            pa_strbuf_printf(s, "\tmodule: %u\n", i->module->index);
-        if (i->client)
-            pa_strbuf_printf(s, "\tclient: %u <%s>\n", i->client->index, pa_strnull(pa_proplist_gets(i->client->proplist, PA_PROP_APPLICATION_NAME)));
-
-        t = pa_proplist_to_string_sep(i->proplist, "\n\t\t");
-        pa_strbuf_printf(s, "\tproperties:\n\t\t%s\n", t);
-        pa_xfree(t);
-    }
+char *pa_sink_list_to_string(pa_core *c) {
+    return list_to_string(c, PA_CLI_TEXT_SINKS);
+}
 
-    return pa_strbuf_tostring_free(s);
+char *pa_source_list_to_string(pa_core *c) {
+    return list_to_string(c, PA_CLI_TEXT_SOURCES);
+}
+
+char *pa_sink_input_list_to_string(pa_core *c) {
+    return list_to_string(c, PA_CLI_TEXT_SINK_INPUTS);
+}
+
+char *pa_source_output_list_to_string(pa_core *c) {
+    return list_to_string(c, PA_CLI_TEXT_SOURCE_OUTPUTS);
 }
 
 char *pa_scache_list_to_string(pa_core *c) {
+    return list_to_string(c, PA_CLI_TEXT_SAMPLES);
+}
+
+char *pa_cpu_usage_to_string(pa_core *c) {
     pa_strbuf *s;
+    pa_core_cpu_usage *u;
+    unsigned n, k;
+
     pa_assert(c);
 
     s = pa_strbuf_new();
+    u = pa_core_get_cpu_usage(c, &n);
 
-    pa_strbuf_printf(s, "%u cache entrie(s) available.\n", c->scache ? pa_idxset_size(c->scache) : 0);
+    pa_strbuf_puts(s, "Main thread time spent in mainloop callbacks, busiest first:\n");
 
-    if (c->scache) {
-        pa_scache_entry *e;
-        uint32_t idx = PA_IDXSET_INVALID;
-
-        PA_IDXSET_FOREACH(e, c->scache, idx) {
-            double l = 0;
-            char ss[PA_SAMPLE_SPEC_SNPRINT_MAX] = "n/a", cv[PA_CVOLUME_SNPRINT_MAX], cvdb[PA_SW_CVOLUME_SNPRINT_DB_MAX], cm[PA_CHANNEL_MAP_SNPRINT_MAX] = "n/a", *t;
-            const char *cmn;
+    for (k = 0; k < n; k++) {
+        char *t;
 
-            cmn = pa_channel_map_to_pretty_name(&e->channel_map);
+        t = pa_cpu_account_to_string(u[k].account);
 
-            if (e->memchunk.memblock) {
-                pa_sample_spec_snprint(ss, sizeof(ss), &e->sample_spec);
-                pa_channel_map_snprint(cm, sizeof(cm), &e->channel_map);
-                l = (double) e->memchunk.length / (double) pa_bytes_per_second(&e->sample_spec);
-            }
+        if (u[k].index == PA_INVALID_INDEX)
+            pa_strbuf_printf(s, "    %s: %s\n", u[k].type, t);
+        else
+            pa_strbuf_printf(s, "    %s #%u <%s>: %s\n", u[k].type, u[k].index, u[k].name, t);
 
-            pa_strbuf_printf(
-                s,
-                "    name: <%s>\n"
-                "\tindex: %u\n"
-                "\tsample spec: %s\n"
-                "\tchannel map: %s%s%s\n"
-                "\tlength: %lu\n"
-                "\tduration: %0.1f s\n"
-                "\tvolume: %s\n"
-                "\t        %s\n"
-                "\t        balance %0.2f\n"
-                "\tlazy: %s\n"
-                "\tfilename: <%s>\n",
-                e->name,
-                e->index,
-                ss,
-                cm,
-                cmn ? "\n\t             " : "",
-                cmn ? cmn : "",
-                (long unsigned)(e->memchunk.memblock ? e->memchunk.length : 0),
-                l,
-                e->volume_is_set ? pa_cvolume_snprint(cv, sizeof(cv), &e->volume) : "n/a",
-                e->volume_is_set ? pa_sw_cvolume_snprint_dB(cvdb, sizeof(cvdb), &e->volume) : "n/a",
-                (e->memchunk.memblock && e->volume_is_set) ? pa_cvolume_get_balance(&e->volume, &e->channel_map) : 0.0f,
-                pa_yes_no(e->lazy),
-                e->filename ? e->filename : "n/a");
-
-            t = pa_proplist_to_string_sep(e->proplist, "\n\t\t");
-            pa_strbuf_printf(s, "\tproperties:\n\t\t%s\n", t);
-            pa_xfree(t);
-        }
+        pa_xfree(t);
     }
 
+    pa_xfree(u);
+
     return pa_strbuf_tostring_free(s);
 }
 
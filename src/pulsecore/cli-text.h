@@ -23,6 +23,7 @@
 ***/
 
 #include <pulsecore/core.h>
+#include <pulsecore/strbuf.h>
 
 /* Some functions to generate pretty formatted listings of
  * entities. The returned strings have to be freed manually. */
@@ -36,6 +37,32 @@ char *pa_client_list_to_string(pa_core *c);
 char *pa_module_list_to_string(pa_core *c);
 char *pa_scache_list_to_string(pa_core *c);
 
+typedef enum pa_cli_text_list {
+    PA_CLI_TEXT_MODULES,
+    PA_CLI_TEXT_CLIENTS,
+    PA_CLI_TEXT_CARDS,
+    PA_CLI_TEXT_SINKS,
+    PA_CLI_TEXT_SOURCES,
+    PA_CLI_TEXT_SINK_INPUTS,
+    PA_CLI_TEXT_SOURCE_OUTPUTS,
+    PA_CLI_TEXT_SAMPLES
+} pa_cli_text_list_t;
+
+/* The same listings one entry at a time, so that they can be written
+ * out as the connection drains instead of being built in one piece.
+ * The first call to pa_cli_text_cursor_next() appends the header line,
+ * every following one the next entry; it returns FALSE when there is
+ * nothing left. Entries added or removed in between are handled. */
+typedef struct pa_cli_text_cursor pa_cli_text_cursor;
+
+pa_cli_text_cursor *pa_cli_text_cursor_new(pa_core *c, pa_cli_text_list_t list);
+pa_bool_t pa_cli_text_cursor_next(pa_cli_text_cursor *cur, pa_strbuf *s);
+void pa_cli_text_cursor_free(pa_cli_text_cursor *cur);
+
+/* The main thread time of the core, the modules and the clients,
+ * busiest first */
+char *pa_cpu_usage_to_string(pa_core *c);
+
 char *pa_full_status_string(pa_core *c);
 
 #endif
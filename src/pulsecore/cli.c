@@ -56,6 +56,9 @@ struct pa_cli {
     int defer_kill;
 
     char *last_line;
+
+    /* The list-* command whose output is still being written */
+    pa_cli_text_cursor *cursor;
 };
 
 static void line_callback(pa_ioline *line, const char *s, void *userdata);
@@ -99,6 +102,7 @@ pa_cli* pa_cli_new(pa_core *core, pa_iochannel *io, pa_module *m) {
     c->defer_kill = 0;
 
     c->last_line = NULL;
+    c->cursor = NULL;
 
     return c;
 }
@@ -110,6 +114,10 @@ void pa_cli_free(pa_cli *c) {
     pa_ioline_unref(c->line);
     pa_client_free(c->client);
     pa_xfree(c->last_line);
+
+    if (c->cursor)
+        pa_cli_text_cursor_free(c->cursor);
+
     pa_xfree(c);
 }
 
@@ -127,6 +135,56 @@ static void client_kill(pa_client *client) {
         c->eof_callback(c, c->userdata);
 }
 
+static void command_done(pa_cli *c) {
+    pa_assert(c);
+
+    if (c->kill_requested) {
+        if (c->eof_callback)
+            c->eof_callback(c, c->userdata);
+    } else
+        pa_ioline_puts(c->line, PROMPT);
+}
+
+/* Write the next entry of a listing. The listings can be large, so
+ * rather than building them in one piece we hand them out one entry
+ * at a time whenever the previous one has been written. */
+static void write_listing(pa_cli *c) {
+    pa_strbuf *buf;
+    pa_bool_t more;
+    char *p;
+
+    pa_assert(c);
+    pa_assert(c->cursor);
+
+    pa_assert_se(buf = pa_strbuf_new());
+    c->defer_kill++;
+    more = pa_cli_text_cursor_next(c->cursor, buf);
+    c->defer_kill--;
+    pa_ioline_puts(c->line, p = pa_strbuf_tostring_free(buf));
+    pa_xfree(p);
+
+    if (more)
+        return;
+
+    pa_cli_text_cursor_free(c->cursor);
+    c->cursor = NULL;
+
+    pa_ioline_set_drain_callback(c->line, NULL, NULL);
+    pa_ioline_cork(c->line, FALSE);
+
+    command_done(c);
+}
+
+static void drain_callback(pa_ioline *line, void *userdata) {
+    pa_cli *c = userdata;
+
+    pa_assert(line);
+    pa_assert(c);
+
+    if (c->cursor)
+        write_listing(c);
+}
+
 static void line_callback(pa_ioline *line, const char *s, void *userdata) {
     pa_strbuf *buf;
     pa_cli *c = userdata;
@@ -152,6 +210,14 @@ static void line_callback(pa_ioline *line, const char *s, void *userdata) {
         c->last_line = pa_xstrdup(s);
     }
 
+    if (s && (c->cursor = pa_cli_command_get_list_cursor(c->core, s))) {
+        /* Don't take the next command before we are done with this one */
+        pa_ioline_cork(line, TRUE);
+        pa_ioline_set_drain_callback(line, drain_callback, c);
+        write_listing(c);
+        return;
+    }
+
     pa_assert_se(buf = pa_strbuf_new());
     c->defer_kill++;
     pa_cli_command_execute_line(c->core, s, buf, &c->fail);
@@ -159,11 +225,7 @@ static void line_callback(pa_ioline *line, const char *s, void *userdata) {
     pa_ioline_puts(line, p = pa_strbuf_tostring_free(buf));
     pa_xfree(p);
 
-    if (c->kill_requested) {
-        if (c->eof_callback)
-            c->eof_callback(c, c->userdata);
-    } else
-        pa_ioline_puts(line, PROMPT);
+    command_done(c);
 }
 
 void pa_cli_set_eof_callback(pa_cli *c, pa_cli_eof_cb_t cb, void *userdata) {
@@ -67,6 +67,8 @@ pa_client *pa_client_new(pa_core *core, pa_client_new_data *data) {
     c->proplist = pa_proplist_copy(data->proplist);
     c->driver = pa_xstrdup(pa_path_get_filename(data->driver));
     c->module = data->module;
+    c->memowner = pa_memowner_new();
+    c->cpu_account = pa_cpu_account_new();
 
     c->sink_inputs = pa_idxset_new(NULL, NULL);
     c->source_outputs = pa_idxset_new(NULL, NULL);
@@ -107,6 +109,8 @@ void pa_client_free(pa_client *c) {
     pa_assert(pa_idxset_isempty(c->source_outputs));
     pa_idxset_free(c->source_outputs, NULL);
 
+    pa_memowner_unref(c->memowner);
+    pa_cpu_account_unref(c->cpu_account);
     pa_proplist_free(c->proplist);
     pa_xfree(c->driver);
     pa_xfree(c);
@@ -45,6 +45,14 @@ struct pa_client {
     pa_idxset *sink_inputs;
     pa_idxset *source_outputs;
 
+    /* What the protocol allocates on behalf of the client is charged
+     * to this, see pa_memowner */
+    pa_memowner *memowner;
+
+    /* The same for the main thread time spent in mainloop callbacks,
+     * see pa_cpu_accounting */
+    pa_cpu_account *cpu_account;
+
     void *userdata;
 
     void (*kill)(pa_client *c);
@@ -0,0 +1,147 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pulse/rtclock.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/atomic.h>
+#include <pulsecore/core-rtclock.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/refcnt.h>
+#include <pulsecore/shared.h>
+
+#include "clock-domain.h"
+
+struct pa_clock_domain {
+    PA_REFCNT_DECLARE;
+
+    pa_core *core;
+    char *name;
+    char *shared_name;
+
+    /* The wakeups are stored relative to this, in usec, so that they
+     * fit into an atomic int. That wraps around after about 71
+     * minutes, which is fine as long as the wakeups are compared with
+     * each other and with the current time only. */
+    pa_usec_t epoch;
+    pa_atomic_t next_wakeup;
+};
+
+static uint32_t to_domain(pa_clock_domain *d, pa_usec_t t) {
+    return (uint32_t) (t - d->epoch);
+}
+
+pa_clock_domain* pa_clock_domain_get(pa_core *c, const char *name) {
+    pa_clock_domain *d;
+    char *shared_name;
+
+    pa_assert(c);
+    pa_assert(name);
+
+    shared_name = pa_sprintf_malloc("clock-domain-%s", name);
+
+    if ((d = pa_shared_get(c, shared_name))) {
+        pa_xfree(shared_name);
+        return pa_clock_domain_ref(d);
+    }
+
+    d = pa_xnew0(pa_clock_domain, 1);
+    PA_REFCNT_INIT(d);
+    d->core = c;
+    d->name = pa_xstrdup(name);
+    d->shared_name = shared_name;
+    d->epoch = pa_rtclock_now();
+    pa_atomic_store(&d->next_wakeup, 0);
+
+    pa_assert_se(pa_shared_set(c, d->shared_name, d) >= 0);
+
+    return d;
+}
+
+pa_clock_domain* pa_clock_domain_ref(pa_clock_domain *d) {
+    pa_assert(d);
+    pa_assert(PA_REFCNT_VALUE(d) >= 1);
+
+    PA_REFCNT_INC(d);
+
+    return d;
+}
+
+void pa_clock_domain_unref(pa_clock_domain *d) {
+    pa_assert(d);
+    pa_assert(PA_REFCNT_VALUE(d) >= 1);
+
+    if (PA_REFCNT_DEC(d) > 0)
+        return;
+
+    pa_assert_se(pa_shared_remove(d->core, d->shared_name) >= 0);
+
+    pa_xfree(d->name);
+    pa_xfree(d->shared_name);
+    pa_xfree(d);
+}
+
+const char *pa_clock_domain_get_name(pa_clock_domain *d) {
+    pa_assert(d);
+    pa_assert(PA_REFCNT_VALUE(d) >= 1);
+
+    return d->name;
+}
+
+pa_usec_t pa_clock_domain_align(pa_clock_domain *d, pa_usec_t deadline, pa_usec_t slack) {
+    pa_usec_t now;
+    uint32_t ours, now_d;
+
+    pa_assert(d);
+    pa_assert(PA_REFCNT_VALUE(d) >= 1);
+
+    now = pa_rtclock_now();
+
+    if (deadline <= now)
+        return deadline;
+
+    ours = to_domain(d, deadline);
+    now_d = to_domain(d, now);
+
+    for (;;) {
+        int old = pa_atomic_load(&d->next_wakeup);
+        uint32_t next = (uint32_t) old;
+        int32_t later = (int32_t) (ours - next);
+        pa_bool_t pending = (int32_t) (next - now_d) > 0;
+
+        if (pending && later >= 0) {
+
+            /* Somebody wakes up shortly before us, so do we */
+            if ((pa_usec_t) later <= slack)
+                return deadline - (pa_usec_t) later;
+
+            /* Too early for us, but it might suit the others */
+            return deadline;
+        }
+
+        /* Ours is the next wakeup of the domain now */
+        if (pa_atomic_cmpxchg(&d->next_wakeup, old, (int) ours))
+            return deadline;
+    }
+}
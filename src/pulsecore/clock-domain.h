@@ -0,0 +1,46 @@
+#ifndef fooclockdomainhfoo
+#define fooclockdomainhfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+/* A clock domain groups devices that are driven by the same clock,
+ * e.g. the sink and the source of one sound card. Their IO threads
+ * wake up at independent but similar times, which costs the CPU its
+ * idle states. Aligning a wakeup moves it back to a wakeup that
+ * another thread of the domain has already asked for, if that is at
+ * most slack earlier. So the threads end up waking up together. The
+ * domains are looked up by name and shared by all their users. */
+
+typedef struct pa_clock_domain pa_clock_domain;
+
+#include <pulsecore/core.h>
+
+pa_clock_domain* pa_clock_domain_get(pa_core *c, const char *name);
+pa_clock_domain* pa_clock_domain_ref(pa_clock_domain *d);
+void pa_clock_domain_unref(pa_clock_domain *d);
+
+const char *pa_clock_domain_get_name(pa_clock_domain *d);
+
+/* May be called from any thread, does not lock. Returns the absolute
+ * time to wake up at for a wakeup that is due at deadline, which is
+ * never later than deadline and never more than slack earlier. */
+pa_usec_t pa_clock_domain_align(pa_clock_domain *d, pa_usec_t deadline, pa_usec_t slack);
+
+#endif
@@ -26,6 +26,7 @@
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
+#include <sys/stat.h>
 
 #include <pulse/xmalloc.h>
 
@@ -33,6 +34,9 @@
 #include <pulsecore/log.h>
 #include <pulsecore/core-util.h>
 #include <pulsecore/macro.h>
+#include <pulsecore/mutex.h>
+#include <pulsecore/hashmap.h>
+#include <pulsecore/refcnt.h>
 
 #include "conf-parser.h"
 
@@ -79,93 +83,295 @@ static int proplist_assignment(pa_config_parser_state *state) {
     return 0;
 }
 
-/* Parse a variable assignment line */
-static int parse_line(pa_config_parser_state *state) {
-    char *c;
+/* A file is read and split into lines only once, and parsed again from
+ * that as long as it doesn't change. This matters for files that are
+ * parsed over and over, like the ALSA mixer paths, which are parsed for
+ * every card. The lines keep the resolved file names of .include
+ * directives, errors are only reported when the lines are applied, so
+ * that they show up for every parse. */
+
+enum line_type {
+    LINE_INCLUDE,
+    LINE_SECTION,
+    LINE_ASSIGNMENT,
+    LINE_BAD_SECTION,
+    LINE_NO_ASSIGNMENT
+};
+
+struct line {
+    enum line_type type;
+    unsigned lineno;
+    char *lvalue; /* The file name, section or lvalue */
+    char *rvalue;
+};
+
+typedef struct conf_file {
+    PA_REFCNT_DECLARE;
+
+    char *filename;
+
+    /* What the file looked like when it was read */
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    time_t mtime, ctime;
+
+    struct line *lines;
+    unsigned n_lines, n_allocated;
+} conf_file;
+
+static pa_static_mutex cache_mutex = PA_STATIC_MUTEX_INIT;
+static pa_hashmap *cache = NULL;
+
+static void conf_file_unref(conf_file *c) {
+    unsigned i;
+
+    pa_assert(c);
+    pa_assert(PA_REFCNT_VALUE(c) >= 1);
+
+    if (PA_REFCNT_DEC(c) > 0)
+        return;
+
+    for (i = 0; i < c->n_lines; i++) {
+        pa_xfree(c->lines[i].lvalue);
+        pa_xfree(c->lines[i].rvalue);
+    }
+
+    pa_xfree(c->lines);
+    pa_xfree(c->filename);
+    pa_xfree(c);
+}
+
+static void add_line(conf_file *c, enum line_type type, unsigned lineno, char *lvalue, char *rvalue) {
+    struct line *l;
+
+    if (c->n_lines >= c->n_allocated) {
+        c->n_allocated = PA_MAX(16U, c->n_allocated * 2);
+        c->lines = pa_xrenew(struct line, c->lines, c->n_allocated);
+    }
+
+    l = &c->lines[c->n_lines++];
+    l->type = type;
+    l->lineno = lineno;
+    l->lvalue = lvalue;
+    l->rvalue = rvalue;
+}
+
+/* Split one line up */
+static void read_line(conf_file *c, const char *filename, unsigned lineno, char *buf) {
+    char *b, *e;
 
-    state->lvalue = state->buf + strspn(state->buf, WHITESPACE);
+    b = buf + strspn(buf, WHITESPACE);
 
-    if ((c = strpbrk(state->lvalue, COMMENTS)))
-        *c = 0;
+    if ((e = strpbrk(b, COMMENTS)))
+        *e = 0;
 
-    if (!*state->lvalue)
-        return 0;
+    if (!*b)
+        return;
 
-    if (pa_startswith(state->lvalue, ".include ")) {
-        char *path = NULL, *fn;
-        int r;
+    if (pa_startswith(b, ".include ")) {
+        char *fn;
 
-        fn = pa_strip(state->lvalue + 9);
+        fn = pa_strip(b + 9);
         if (!pa_is_path_absolute(fn)) {
             const char *k;
-            if ((k = strrchr(state->filename, '/'))) {
-                char *dir = pa_xstrndup(state->filename, k - state->filename);
-                fn = path = pa_sprintf_malloc("%s" PA_PATH_SEP "%s", dir, fn);
+            if ((k = strrchr(filename, '/'))) {
+                char *dir = pa_xstrndup(filename, k - filename);
+                add_line(c, LINE_INCLUDE, lineno, pa_sprintf_malloc("%s" PA_PATH_SEP "%s", dir, fn), NULL);
                 pa_xfree(dir);
+                return;
             }
         }
 
-        r = pa_config_parse(fn, NULL, state->item_table, state->proplist, state->userdata);
-        pa_xfree(path);
-        return r;
+        add_line(c, LINE_INCLUDE, lineno, pa_xstrdup(fn), NULL);
+        return;
     }
 
-    if (*state->lvalue == '[') {
+    if (*b == '[') {
         size_t k;
 
-        k = strlen(state->lvalue);
+        k = strlen(b);
         pa_assert(k > 0);
 
-        if (state->lvalue[k-1] != ']') {
-            pa_log("[%s:%u] Invalid section header.", state->filename, state->lineno);
-            return -1;
-        }
+        if (b[k-1] != ']')
+            add_line(c, LINE_BAD_SECTION, lineno, NULL, NULL);
+        else
+            add_line(c, LINE_SECTION, lineno, pa_xstrndup(b + 1, k-2), NULL);
 
-        pa_xfree(state->section);
-        state->section = pa_xstrndup(state->lvalue + 1, k-2);
+        return;
+    }
 
-        if (pa_streq(state->section, "Properties")) {
-            if (!state->proplist) {
-                pa_log("[%s:%u] \"Properties\" section is not allowed in this file.", state->filename, state->lineno);
-                return -1;
-            }
+    if (!(e = strchr(b, '='))) {
+        add_line(c, LINE_NO_ASSIGNMENT, lineno, NULL, NULL);
+        return;
+    }
 
-            state->in_proplist = TRUE;
-        } else
-            state->in_proplist = FALSE;
+    *e = 0;
+    add_line(c, LINE_ASSIGNMENT, lineno, pa_xstrdup(pa_strip(b)), pa_xstrdup(pa_strip(e + 1)));
+}
 
-        return 0;
+/* Go through the file and split up each line */
+static conf_file *read_file(const char *filename, FILE *f) {
+    conf_file *c;
+    char buf[4096];
+    unsigned lineno = 0;
+    struct stat st;
+
+    c = pa_xnew0(conf_file, 1);
+    PA_REFCNT_INIT(c);
+    c->filename = pa_xstrdup(filename);
+
+    if (fstat(fileno(f), &st) >= 0) {
+        c->dev = st.st_dev;
+        c->ino = st.st_ino;
+        c->size = st.st_size;
+        c->mtime = st.st_mtime;
+        c->ctime = st.st_ctime;
     }
 
-    if (!(state->rvalue = strchr(state->lvalue, '='))) {
-        pa_log("[%s:%u] Missing '='.", state->filename, state->lineno);
-        return -1;
+    while (!feof(f)) {
+        if (!fgets(buf, sizeof(buf), f)) {
+            if (feof(f))
+                break;
+
+            pa_log_warn("Failed to read configuration file '%s': %s", filename, pa_cstrerror(errno));
+            conf_file_unref(c);
+            return NULL;
+        }
+
+        lineno++;
+        read_line(c, filename, lineno, buf);
+    }
+
+    return c;
+}
+
+/* Returns the lines of the file, from the cache if it didn't change
+ * since it was read. Returns NULL with errno set if it can't be read. */
+static conf_file *get_file(const char *filename) {
+    conf_file *c = NULL, *old;
+    struct stat st;
+    FILE *f;
+    pa_mutex *m;
+
+    if (stat(filename, &st) < 0)
+        return NULL;
+
+    m = pa_static_mutex_get(&cache_mutex, FALSE, FALSE);
+    pa_mutex_lock(m);
+
+    if (cache && (c = pa_hashmap_get(cache, filename))) {
+        if (c->dev == st.st_dev && c->ino == st.st_ino && c->size == st.st_size &&
+            c->mtime == st.st_mtime && c->ctime == st.st_ctime)
+            PA_REFCNT_INC(c);
+        else
+            c = NULL;
     }
 
-    *state->rvalue = 0;
-    state->rvalue++;
+    pa_mutex_unlock(m);
+
+    if (c)
+        return c;
+
+    if (!(f = pa_fopen_cloexec(filename, "r")))
+        return NULL;
+
+    c = read_file(filename, f);
+    fclose(f);
+
+    if (!c) {
+        errno = EIO;
+        return NULL;
+    }
+
+    pa_mutex_lock(m);
+
+    if (!cache)
+        cache = pa_hashmap_new(pa_idxset_string_hash_func, pa_idxset_string_compare_func);
+
+    /* Replaces the outdated version, or what another thread might have
+     * read in the meantime */
+    if ((old = pa_hashmap_remove(cache, filename)))
+        conf_file_unref(old);
 
-    state->lvalue = pa_strip(state->lvalue);
-    state->rvalue = pa_strip(state->rvalue);
+    PA_REFCNT_INC(c);
+    pa_hashmap_put(cache, c->filename, c);
 
-    if (state->in_proplist)
-        return proplist_assignment(state);
-    else
-        return normal_assignment(state);
+    pa_mutex_unlock(m);
+
+    return c;
+}
+
+/* Run one line through the parsers */
+static int apply_line(pa_config_parser_state *state, const struct line *l) {
+    state->lineno = l->lineno;
+
+    switch (l->type) {
+
+        case LINE_INCLUDE:
+            return pa_config_parse(l->lvalue, NULL, state->item_table, state->proplist, state->userdata);
+
+        case LINE_SECTION:
+            pa_xfree(state->section);
+            state->section = pa_xstrdup(l->lvalue);
+
+            if (pa_streq(state->section, "Properties")) {
+                if (!state->proplist) {
+                    pa_log("[%s:%u] \"Properties\" section is not allowed in this file.", state->filename, state->lineno);
+                    return -1;
+                }
+
+                state->in_proplist = TRUE;
+            } else
+                state->in_proplist = FALSE;
+
+            return 0;
+
+        case LINE_BAD_SECTION:
+            pa_log("[%s:%u] Invalid section header.", state->filename, state->lineno);
+            return -1;
+
+        case LINE_NO_ASSIGNMENT:
+            pa_log("[%s:%u] Missing '='.", state->filename, state->lineno);
+            return -1;
+
+        case LINE_ASSIGNMENT: {
+            size_t k;
+
+            /* The parsers may modify the values */
+            k = strlen(l->lvalue) + 1;
+            pa_assert(k + strlen(l->rvalue) + 1 <= sizeof(state->buf));
+            strcpy(state->buf, l->lvalue);
+            strcpy(state->buf + k, l->rvalue);
+
+            state->lvalue = state->buf;
+            state->rvalue = state->buf + k;
+
+            if (state->in_proplist)
+                return proplist_assignment(state);
+            else
+                return normal_assignment(state);
+        }
+    }
+
+    pa_assert_not_reached();
 }
 
 /* Go through the file and parse each line */
 int pa_config_parse(const char *filename, FILE *f, const pa_config_item *t, pa_proplist *proplist, void *userdata) {
     int r = -1;
-    pa_bool_t do_close = !f;
     pa_config_parser_state state;
+    conf_file *c;
+    unsigned i;
 
     pa_assert(filename);
     pa_assert(t);
 
     pa_zero(state);
 
-    if (!f && !(f = pa_fopen_cloexec(filename, "r"))) {
+    if (f)
+        c = read_file(filename, f);
+    else if (!(c = get_file(filename))) {
         if (errno == ENOENT) {
             pa_log_debug("Failed to open configuration file '%s': %s", filename, pa_cstrerror(errno));
             r = 0;
@@ -176,6 +382,9 @@ int pa_config_parse(const char *filename, FILE *f, const pa_config_item *t, pa_p
         goto finish;
     }
 
+    if (!c)
+        goto finish;
+
     state.filename = filename;
     state.item_table = t;
     state.userdata = userdata;
@@ -183,20 +392,9 @@ int pa_config_parse(const char *filename, FILE *f, const pa_config_item *t, pa_p
     if (proplist)
         state.proplist = pa_proplist_new();
 
-    while (!feof(f)) {
-        if (!fgets(state.buf, sizeof(state.buf), f)) {
-            if (feof(f))
-                break;
-
-            pa_log_warn("Failed to read configuration file '%s': %s", filename, pa_cstrerror(errno));
-            goto finish;
-        }
-
-        state.lineno++;
-
-        if (parse_line(&state) < 0)
+    for (i = 0; i < c->n_lines; i++)
+        if (apply_line(&state, &c->lines[i]) < 0)
             goto finish;
-    }
 
     if (proplist)
         pa_proplist_update(proplist, PA_UPDATE_REPLACE, state.proplist);
@@ -204,14 +402,14 @@ int pa_config_parse(const char *filename, FILE *f, const pa_config_item *t, pa_p
     r = 0;
 
 finish:
+    if (c)
+        conf_file_unref(c);
+
     if (state.proplist)
         pa_proplist_free(state.proplist);
 
     pa_xfree(state.section);
 
-    if (do_close && f)
-        fclose(f);
-
     return r;
 }
 
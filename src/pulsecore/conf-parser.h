@@ -69,7 +69,11 @@ struct pa_config_parser_state {
  * non-NULL, the parser will parse any section named "Properties" as
  * properties, and those properties will be merged into the given
  * proplist. If proplist is NULL, then sections named "Properties"
- * are not allowed at all in the configuration file. */
+ * are not allowed at all in the configuration file.
+ *
+ * Files opened by name are only read and split up into lines the first
+ * time, later calls parse them again from memory for as long as the
+ * file stays the same. */
 int pa_config_parse(const char *filename, FILE *f, const pa_config_item *t, pa_proplist *proplist, void *userdata);
 
 /* Generic parsers for integers, size_t, booleans and strings */
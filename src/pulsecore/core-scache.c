@@ -51,6 +51,8 @@
 
 #include <pulsecore/sink-input.h>
 #include <pulsecore/play-memchunk.h>
+#include <pulsecore/memblockq.h>
+#include <pulsecore/resampler.h>
 #include <pulsecore/core-subscribe.h>
 #include <pulsecore/namereg.h>
 #include <pulsecore/sound-file.h>
@@ -64,6 +66,134 @@
 
 #define UNLOAD_POLL_TIME (60 * PA_USEC_PER_SEC)
 
+/* Per sample, one for each sink it is commonly played on */
+#define RESAMPLED_MAX 4
+
+struct pa_scache_resampled {
+    uint32_t sink_index;
+    pa_sample_spec sample_spec;
+    pa_channel_map channel_map;
+    pa_memchunk memchunk;
+
+    PA_LLIST_FIELDS(struct pa_scache_resampled);
+};
+
+static void resampled_free(pa_scache_entry *e, struct pa_scache_resampled *r) {
+    PA_LLIST_REMOVE(struct pa_scache_resampled, e->resampled, r);
+    e->n_resampled--;
+
+    pa_memblock_unref(r->memchunk.memblock);
+    pa_xfree(r);
+}
+
+static void drop_resampled(pa_scache_entry *e) {
+    while (e->resampled)
+        resampled_free(e, e->resampled);
+}
+
+/* Convert the whole sample to the format of the sink once, so that
+ * playing it there needs no resampler. NULL if it can be played as it
+ * is, or cannot be converted. */
+static struct pa_scache_resampled* get_resampled(pa_scache_entry *e, pa_sink *sink) {
+    struct pa_scache_resampled *r;
+    pa_resampler *resampler;
+    pa_memblockq *q;
+    pa_memchunk in;
+    size_t max_block, fs, out_max;
+
+    if (pa_sample_spec_equal(&e->sample_spec, &sink->sample_spec) &&
+        pa_channel_map_equal(&e->channel_map, &sink->channel_map))
+        return NULL;
+
+    PA_LLIST_FOREACH(r, e->resampled)
+        if (r->sink_index == sink->index)
+            break;
+
+    if (r) {
+        if (pa_sample_spec_equal(&r->sample_spec, &sink->sample_spec) &&
+            pa_channel_map_equal(&r->channel_map, &sink->channel_map)) {
+
+            PA_LLIST_REMOVE(struct pa_scache_resampled, e->resampled, r);
+            PA_LLIST_PREPEND(struct pa_scache_resampled, e->resampled, r);
+            return r;
+        }
+
+        /* The sink changed its format */
+        resampled_free(e, r);
+    }
+
+    if (!(resampler = pa_resampler_new(
+                  e->core->mempool,
+                  &e->sample_spec, &e->channel_map,
+                  &sink->sample_spec, &sink->channel_map,
+                  e->core->resample_method,
+                  (e->core->disable_remixing ? PA_RESAMPLER_NO_REMIX : 0) |
+                  (e->core->disable_lfe_remixing ? PA_RESAMPLER_NO_LFE : 0))))
+        return NULL;
+
+    out_max = pa_resampler_result(resampler, e->memchunk.length);
+
+    if (out_max > PA_SCACHE_ENTRY_SIZE_MAX) {
+        pa_resampler_free(resampler);
+        return NULL;
+    }
+
+    fs = pa_frame_size(&e->sample_spec);
+    max_block = PA_MAX((pa_resampler_max_block_size(resampler) / fs) * fs, fs);
+
+    q = pa_memblockq_new("scache resampled q", 0, 2 * out_max + pa_frame_size(&sink->sample_spec), 0, &sink->sample_spec, 0, 1, 0, NULL);
+
+    in = e->memchunk;
+    while (in.length > 0) {
+        pa_memchunk piece, out;
+
+        piece = in;
+        piece.length = PA_MIN(in.length, max_block);
+
+        pa_resampler_run(resampler, &piece, &out);
+
+        if (out.memblock) {
+            pa_memblockq_push_align(q, &out);
+            pa_memblock_unref(out.memblock);
+        }
+
+        in.index += piece.length;
+        in.length -= piece.length;
+    }
+
+    pa_resampler_free(resampler);
+
+    if (pa_memblockq_get_length(q) <= 0) {
+        pa_memblockq_free(q);
+        return NULL;
+    }
+
+    r = pa_xnew(struct pa_scache_resampled, 1);
+    r->sink_index = sink->index;
+    r->sample_spec = sink->sample_spec;
+    r->channel_map = sink->channel_map;
+
+    /* One contiguous block, copied together if necessary */
+    pa_assert_se(pa_memblockq_peek_fixed_size(q, pa_memblockq_get_length(q), &r->memchunk) >= 0);
+    pa_memblockq_free(q);
+
+    PA_LLIST_PREPEND(struct pa_scache_resampled, e->resampled, r);
+    e->n_resampled++;
+
+    while (e->n_resampled > RESAMPLED_MAX) {
+        struct pa_scache_resampled *last;
+
+        for (last = e->resampled; last->next; last = last->next)
+            ;
+
+        resampled_free(e, last);
+    }
+
+    pa_log_debug("Converted sample \"%s\" for sink %s, %lu bytes.", e->name, sink->name, (unsigned long) r->memchunk.length);
+
+    return r;
+}
+
 static void timeout_callback(pa_mainloop_api *m, pa_time_event *e, const struct timeval *t, void *userdata) {
     pa_core *c = userdata;
 
@@ -83,6 +213,7 @@ static void free_entry(pa_scache_entry *e) {
     pa_subscription_post(e->core, PA_SUBSCRIPTION_EVENT_SAMPLE_CACHE|PA_SUBSCRIPTION_EVENT_REMOVE, e->index);
     pa_xfree(e->name);
     pa_xfree(e->filename);
+    drop_resampled(e);
     if (e->memchunk.memblock)
         pa_memblock_unref(e->memchunk.memblock);
     if (e->proplist)
@@ -97,6 +228,8 @@ static pa_scache_entry* scache_add_item(pa_core *c, const char *name) {
     pa_assert(name);
 
     if ((e = pa_namereg_get(c, name, PA_NAMEREG_SAMPLE))) {
+        drop_resampled(e);
+
         if (e->memchunk.memblock)
             pa_memblock_unref(e->memchunk.memblock);
 
@@ -117,6 +250,8 @@ static pa_scache_entry* scache_add_item(pa_core *c, const char *name) {
         e->name = pa_xstrdup(name);
         e->core = c;
         e->proplist = pa_proplist_new();
+        PA_LLIST_HEAD_INIT(struct pa_scache_resampled, e->resampled);
+        e->n_resampled = 0;
 
         pa_idxset_put(c->scache, e, &e->index);
 
@@ -220,7 +355,7 @@ int pa_scache_add_file(pa_core *c, const char *name, const char *filename, uint3
     p = pa_proplist_new();
     pa_proplist_sets(p, PA_PROP_MEDIA_FILENAME, filename);
 
-    if (pa_sound_file_load(c->mempool, filename, &ss, &map, &chunk, p) < 0) {
+    if (pa_sound_file_load_cached(c->mempool, filename, &ss, &map, &chunk, p) < 0) {
         pa_proplist_free(p);
         return -1;
     }
@@ -294,6 +429,7 @@ void pa_scache_free_all(pa_core *c) {
 
 int pa_scache_play_item(pa_core *c, const char *name, pa_sink *sink, pa_volume_t volume, pa_proplist *p, uint32_t *sink_input_idx) {
     pa_scache_entry *e;
+    struct pa_scache_resampled *resampled;
     pa_cvolume r;
     pa_proplist *merged;
     pa_bool_t pass_volume;
@@ -312,7 +448,7 @@ int pa_scache_play_item(pa_core *c, const char *name, pa_sink *sink, pa_volume_t
     if (e->lazy && !e->memchunk.memblock) {
         pa_channel_map old_channel_map = e->channel_map;
 
-        if (pa_sound_file_load(c->mempool, e->filename, &e->sample_spec, &e->channel_map, &e->memchunk, merged) < 0)
+        if (pa_sound_file_load_cached(c->mempool, e->filename, &e->sample_spec, &e->channel_map, &e->memchunk, merged) < 0)
             goto fail;
 
         pa_subscription_post(c, PA_SUBSCRIPTION_EVENT_SAMPLE_CACHE|PA_SUBSCRIPTION_EVENT_CHANGE, e->index);
@@ -347,12 +483,24 @@ int pa_scache_play_item(pa_core *c, const char *name, pa_sink *sink, pa_volume_t
     if (p)
         pa_proplist_update(merged, PA_UPDATE_REPLACE, p);
 
-    if (pa_play_memchunk(sink,
-                         &e->sample_spec, &e->channel_map,
-                         &e->memchunk,
-                         pass_volume ? &r : NULL,
-                         merged,
-                         PA_SINK_INPUT_NO_CREATE_ON_SUSPEND|PA_SINK_INPUT_KILL_ON_SUSPEND, sink_input_idx) < 0)
+    if ((resampled = get_resampled(e, sink))) {
+        if (pass_volume)
+            pa_cvolume_remap(&r, &e->channel_map, &resampled->channel_map);
+
+        if (pa_play_memchunk(sink,
+                             &resampled->sample_spec, &resampled->channel_map,
+                             &resampled->memchunk,
+                             pass_volume ? &r : NULL,
+                             merged,
+                             PA_SINK_INPUT_NO_CREATE_ON_SUSPEND|PA_SINK_INPUT_KILL_ON_SUSPEND, sink_input_idx) < 0)
+            goto fail;
+
+    } else if (pa_play_memchunk(sink,
+                                &e->sample_spec, &e->channel_map,
+                                &e->memchunk,
+                                pass_volume ? &r : NULL,
+                                merged,
+                                PA_SINK_INPUT_NO_CREATE_ON_SUSPEND|PA_SINK_INPUT_KILL_ON_SUSPEND, sink_input_idx) < 0)
         goto fail;
 
     pa_proplist_free(merged);
@@ -440,6 +588,7 @@ void pa_scache_unload_unused(pa_core *c) {
         if (e->last_used_time + c->scache_idle_time > now)
             continue;
 
+        drop_resampled(e);
         pa_memblock_unref(e->memchunk.memblock);
         pa_memchunk_reset(&e->memchunk);
 
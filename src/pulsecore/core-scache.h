@@ -24,6 +24,7 @@
 ***/
 
 #include <pulsecore/core.h>
+#include <pulsecore/llist.h>
 #include <pulsecore/memchunk.h>
 #include <pulsecore/sink.h>
 
@@ -41,6 +42,11 @@ typedef struct pa_scache_entry {
     pa_channel_map channel_map;
     pa_memchunk memchunk;
 
+    /* Copies of memchunk already converted to the format of the sinks
+     * it was played on, most recently used first */
+    PA_LLIST_HEAD(struct pa_scache_resampled, resampled);
+    unsigned n_resampled;
+
     char *filename;
 
     pa_bool_t lazy;
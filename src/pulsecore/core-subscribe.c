@@ -24,8 +24,10 @@
 #endif
 
 #include <stdio.h>
+#include <stdlib.h>
 
 #include <pulse/xmalloc.h>
+#include <pulse/rtclock.h>
 
 #include <pulsecore/log.h>
 #include <pulsecore/macro.h>
@@ -37,7 +39,24 @@
  * register a callback function that is called whenever an event
  * matching a subscription mask happens. The execution of the callback
  * function is postponed to the next main loop iteration, i.e. is not
- * called from within the stack frame the entity was created in. */
+ * called from within the stack frame the entity was created in.
+ *
+ * On top of the mask, the events of a facility may be restricted to a
+ * set of object indexes, so that they are dropped before the callback
+ * is even called.
+ *
+ * CHANGE events are rate limited: if one is posted less than
+ * subscription_change_interval after the last dispatch it is only
+ * queued, and flushed by a timer once the interval has passed. Since
+ * only one pending CHANGE event is kept per object, a volume slider
+ * drag results in one event per interval instead of one per step. */
+
+#define N_FACILITIES (PA_SUBSCRIPTION_EVENT_FACILITY_MASK+1)
+
+struct index_filter {
+    uint32_t *indexes; /* sorted, NULL if the facility is not filtered */
+    unsigned n_indexes;
+};
 
 struct pa_subscription {
     pa_core *core;
@@ -47,6 +66,8 @@ struct pa_subscription {
     void *userdata;
     pa_subscription_mask_t mask;
 
+    struct index_filter *filters; /* NULL as long as no filter was set */
+
     PA_LLIST_FIELDS(pa_subscription);
 };
 
@@ -75,11 +96,70 @@ pa_subscription* pa_subscription_new(pa_core *c, pa_subscription_mask_t m, pa_su
     s->callback = callback;
     s->userdata = userdata;
     s->mask = m;
+    s->filters = NULL;
 
     PA_LLIST_PREPEND(pa_subscription, c->subscriptions, s);
     return s;
 }
 
+/* Change the subscription mask, keeping the index filters */
+void pa_subscription_set_mask(pa_subscription *s, pa_subscription_mask_t m) {
+    pa_assert(s);
+    pa_assert(!s->dead);
+    pa_assert(m);
+
+    s->mask = m;
+}
+
+static int index_compare(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t*) a, y = *(const uint32_t*) b;
+
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+/* Only pass on events of the given facility that refer to one of the n
+ * object indexes. n == 0 lifts the restriction again */
+void pa_subscription_set_filter(pa_subscription *s, pa_subscription_event_type_t facility, const uint32_t *idx, unsigned n) {
+    struct index_filter *f;
+
+    pa_assert(s);
+    pa_assert(!s->dead);
+    pa_assert((facility & ~PA_SUBSCRIPTION_EVENT_FACILITY_MASK) == 0);
+    pa_assert(idx || n == 0);
+
+    if (!s->filters) {
+        if (n == 0)
+            return;
+
+        s->filters = pa_xnew0(struct index_filter, N_FACILITIES);
+    }
+
+    f = &s->filters[facility];
+
+    pa_xfree(f->indexes);
+    f->indexes = NULL;
+    f->n_indexes = n;
+
+    if (n > 0) {
+        f->indexes = pa_xnewdup(uint32_t, idx, n);
+        qsort(f->indexes, n, sizeof(uint32_t), index_compare);
+    }
+}
+
+static pa_bool_t filter_match(pa_subscription *s, pa_subscription_event_type_t t, uint32_t idx) {
+    struct index_filter *f;
+
+    if (!s->filters)
+        return TRUE;
+
+    f = &s->filters[t & PA_SUBSCRIPTION_EVENT_FACILITY_MASK];
+
+    if (!f->indexes)
+        return TRUE;
+
+    return !!bsearch(&idx, f->indexes, f->n_indexes, sizeof(uint32_t), index_compare);
+}
+
 /* Free a subscription object, effectively marking it for deletion */
 void pa_subscription_free(pa_subscription*s) {
     pa_assert(s);
@@ -94,6 +174,16 @@ static void free_subscription(pa_subscription *s) {
     pa_assert(s->core);
 
     PA_LLIST_REMOVE(pa_subscription, s->core->subscriptions, s);
+
+    if (s->filters) {
+        unsigned i;
+
+        for (i = 0; i < N_FACILITIES; i++)
+            pa_xfree(s->filters[i].indexes);
+
+        pa_xfree(s->filters);
+    }
+
     pa_xfree(s);
 }
 
@@ -122,6 +212,11 @@ void pa_subscription_free_all(pa_core *c) {
         c->mainloop->defer_free(c->subscription_defer_event);
         c->subscription_defer_event = NULL;
     }
+
+    if (c->subscription_time_event) {
+        c->mainloop->time_free(c->subscription_time_event);
+        c->subscription_time_event = NULL;
+    }
 }
 
 #ifdef DEBUG
@@ -163,6 +258,15 @@ static void defer_cb(pa_mainloop_api *m, pa_defer_event *de, void *userdata) {
 
     c->mainloop->defer_enable(c->subscription_defer_event, 0);
 
+    /* Held back CHANGE events are flushed right now as well */
+    if (c->subscription_time_event) {
+        c->mainloop->time_free(c->subscription_time_event);
+        c->subscription_time_event = NULL;
+    }
+
+    if (c->subscription_event_queue)
+        c->subscription_last_dispatch = pa_rtclock_now();
+
     /* Dispatch queued events */
 
     while (c->subscription_event_queue) {
@@ -170,7 +274,9 @@ static void defer_cb(pa_mainloop_api *m, pa_defer_event *de, void *userdata) {
 
         for (s = c->subscriptions; s; s = s->next) {
 
-            if (!s->dead && pa_subscription_match_flags(s->mask, e->type))
+            if (!s->dead &&
+                pa_subscription_match_flags(s->mask, e->type) &&
+                filter_match(s, e->type, e->index))
                 s->callback(c, e->type, e->index, s->userdata);
         }
 
@@ -203,6 +309,44 @@ static void sched_event(pa_core *c) {
     c->mainloop->defer_enable(c->subscription_defer_event, 1);
 }
 
+static void time_cb(pa_mainloop_api *m, pa_time_event *e, const struct timeval *t, void *userdata) {
+    pa_core *c = userdata;
+
+    pa_assert(c);
+    pa_assert(c->subscription_time_event == e);
+
+    c->mainloop->time_free(c->subscription_time_event);
+    c->subscription_time_event = NULL;
+
+    sched_event(c);
+}
+
+/* Like sched_event(), but waits for the rest of the rate limiting
+ * interval if we dispatched recently */
+static void sched_change_event(pa_core *c) {
+    pa_usec_t next;
+
+    pa_assert(c);
+
+    if (c->subscription_change_interval <= 0) {
+        sched_event(c);
+        return;
+    }
+
+    /* Already waiting */
+    if (c->subscription_time_event)
+        return;
+
+    next = c->subscription_last_dispatch + c->subscription_change_interval;
+
+    if (pa_rtclock_now() >= next) {
+        sched_event(c);
+        return;
+    }
+
+    c->subscription_time_event = pa_core_rttime_new(c, next, time_cb, c);
+}
+
 /* Append a new subscription event to the subscription event queue and schedule a main loop event */
 void pa_subscription_post(pa_core *c, pa_subscription_event_type_t t, uint32_t idx) {
     pa_subscription_event *e;
@@ -259,5 +403,8 @@ void pa_subscription_post(pa_core *c, pa_subscription_event_type_t t, uint32_t i
     dump_event("Queued", e);
 #endif
 
-    sched_event(c);
+    if ((t & PA_SUBSCRIPTION_EVENT_TYPE_MASK) == PA_SUBSCRIPTION_EVENT_CHANGE)
+        sched_change_event(c);
+    else
+        sched_event(c);
 }
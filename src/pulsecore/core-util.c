@@ -119,8 +119,10 @@
 
 #ifdef __linux__
 #include <sys/personality.h>
+#include <sys/syscall.h>
 #endif
 
+#include <pulse/timeval.h>
 #include <pulse/xmalloc.h>
 #include <pulse/util.h>
 #include <pulse/utf8.h>
@@ -830,6 +832,71 @@ int pa_make_realtime(int rtprio) {
     return -1;
 }
 
+#if defined(__linux__) && defined(__NR_sched_setattr)
+/* Not in every libc yet, see sched_setattr(2) */
+struct deadline_attr {
+    uint32_t size;
+    uint32_t sched_policy;
+    uint64_t sched_flags;
+    int32_t sched_nice;
+    uint32_t sched_priority;
+    uint64_t sched_runtime;
+    uint64_t sched_deadline;
+    uint64_t sched_period;
+};
+
+#define DEADLINE_POLICY 6
+#define DEADLINE_FLAG_RESET_ON_FORK 0x01
+#endif
+
+#define DEADLINE_PERIOD_MIN (PA_USEC_PER_MSEC)
+#define DEADLINE_PERIOD_MAX (PA_USEC_PER_SEC / 2)
+#define DEADLINE_RUNTIME_EXTRA (200)
+
+/* Switch the current thread to SCHED_DEADLINE, giving it runtime usec
+ * of CPU time every period usec, to be used up within that period.
+ * Calling it again changes the reservation. Unlike pa_make_realtime()
+ * this fails if the kernel's admission control doesn't accept the
+ * reservation, and there's no RealtimeKit fallback. */
+int pa_make_deadline(pa_usec_t runtime, pa_usec_t period) {
+#if defined(__linux__) && defined(__NR_sched_setattr)
+    struct deadline_attr attr;
+
+    pa_assert(runtime > 0);
+    pa_assert(runtime <= period);
+
+    pa_zero(attr);
+    attr.size = sizeof(attr);
+    attr.sched_policy = DEADLINE_POLICY;
+    attr.sched_flags = DEADLINE_FLAG_RESET_ON_FORK;
+    attr.sched_runtime = runtime * PA_NSEC_PER_USEC;
+    attr.sched_deadline = attr.sched_period = period * PA_NSEC_PER_USEC;
+
+    if (syscall(__NR_sched_setattr, 0, &attr, 0) < 0) {
+        pa_log_info("Failed to enable SCHED_DEADLINE scheduling: %s", pa_cstrerror(errno));
+        return -1;
+    }
+
+    pa_log_info("Successfully enabled SCHED_DEADLINE scheduling for thread, with %0.2f ms every %0.2f ms.",
+                (double) runtime / PA_USEC_PER_MSEC, (double) period / PA_USEC_PER_MSEC);
+    return 0;
+#else
+    errno = ENOTSUP;
+    pa_log_info("Failed to enable SCHED_DEADLINE scheduling: %s", pa_cstrerror(errno));
+    return -1;
+#endif
+}
+
+void pa_deadline_from_latency(pa_usec_t latency, pa_usec_t render_usec, pa_usec_t *runtime, pa_usec_t *period) {
+    pa_assert(runtime);
+    pa_assert(period);
+
+    /* The buffer is refilled well before it runs empty, and the
+     * wakeups for rewinds and messages have to fit in as well */
+    *period = PA_CLAMP(latency / 2, DEADLINE_PERIOD_MIN, DEADLINE_PERIOD_MAX);
+    *runtime = PA_CLAMP(render_usec * 4 + DEADLINE_RUNTIME_EXTRA, *period / 20, *period / 2);
+}
+
 #ifdef HAVE_SYS_RESOURCE_H
 static int set_nice(int nice_level) {
 #ifdef HAVE_DBUS
@@ -931,6 +998,166 @@ void pa_reset_priority(void) {
 #endif
 }
 
+#if defined(__linux__) && defined(HAVE_SCHED_H)
+/* Parses lists like "0-3,8" as used by the kernel and taskset */
+static int parse_cpu_list(const char *cpus, cpu_set_t *set) {
+    const char *p = cpus;
+
+    CPU_ZERO(set);
+
+    for (;;) {
+        char *e;
+        unsigned long a, b;
+
+        errno = 0;
+        a = strtoul(p, &e, 10);
+        if (errno != 0 || e == p || !isdigit(*p))
+            return -1;
+
+        b = a;
+        if (*e == '-') {
+            p = e + 1;
+            b = strtoul(p, &e, 10);
+            if (errno != 0 || e == p || !isdigit(*p) || b < a)
+                return -1;
+        }
+
+        if (b >= CPU_SETSIZE)
+            return -1;
+
+        for (; a <= b; a++)
+            CPU_SET(a, set);
+
+        if (*e == 0)
+            break;
+
+        if (*e != ',')
+            return -1;
+
+        p = e + 1;
+    }
+
+    return 0;
+}
+
+/* Returns the node of a CPU as found in sysfs */
+static int cpu_numa_node(unsigned cpu) {
+    char *fn;
+    DIR *d;
+    struct dirent *de;
+    int node = -1;
+
+    fn = pa_sprintf_malloc("/sys/devices/system/cpu/cpu%u", cpu);
+    d = opendir(fn);
+    pa_xfree(fn);
+
+    if (!d)
+        return -1;
+
+    while ((de = readdir(d))) {
+        int32_t n;
+
+        if (!pa_startswith(de->d_name, "node"))
+            continue;
+
+        if (pa_atoi(de->d_name + 4, &n) >= 0 && n >= 0) {
+            node = n;
+            break;
+        }
+    }
+
+    closedir(d);
+    return node;
+}
+#endif
+
+pa_bool_t pa_cpu_list_valid(const char *cpus) {
+#if defined(__linux__) && defined(HAVE_SCHED_H)
+    cpu_set_t set;
+
+    pa_assert(cpus);
+
+    return parse_cpu_list(cpus, &set) >= 0 && CPU_COUNT(&set) > 0;
+#else
+    return FALSE;
+#endif
+}
+
+int pa_set_cpu_affinity(const char *cpus) {
+#if defined(__linux__) && defined(HAVE_SCHED_H)
+    cpu_set_t set;
+
+    pa_assert(cpus);
+
+    if (parse_cpu_list(cpus, &set) < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* On Linux pid 0 refers to the calling thread, not the process */
+    if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+        pa_log_warn("Failed to bind thread to CPUs %s: %s", cpus, pa_cstrerror(errno));
+        return -1;
+    }
+
+    pa_log_info("Bound thread to CPUs %s.", cpus);
+    return 0;
+#else
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
+char *pa_numa_node_cpus(int node) {
+#ifdef __linux__
+    char *fn, *cpus;
+
+    pa_assert(node >= 0);
+
+    fn = pa_sprintf_malloc("/sys/devices/system/node/node%i/cpulist", node);
+    cpus = pa_read_line_from_file(fn);
+    pa_xfree(fn);
+
+    if (cpus && !pa_cpu_list_valid(cpus)) {
+        pa_xfree(cpus);
+        return NULL;
+    }
+
+    return cpus;
+#else
+    return NULL;
+#endif
+}
+
+int pa_cpu_list_numa_node(const char *cpus) {
+#if defined(__linux__) && defined(HAVE_SCHED_H)
+    cpu_set_t set;
+    unsigned cpu;
+    int node = -1;
+
+    pa_assert(cpus);
+
+    if (parse_cpu_list(cpus, &set) < 0)
+        return -1;
+
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        int n;
+
+        if (!CPU_ISSET(cpu, &set))
+            continue;
+
+        if ((n = cpu_numa_node(cpu)) < 0 || (node >= 0 && n != node))
+            return -1;
+
+        node = n;
+    }
+
+    return node;
+#else
+    return -1;
+#endif
+}
+
 int pa_match(const char *expr, const char *v) {
     int k;
     regex_t re;
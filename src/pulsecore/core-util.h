@@ -79,9 +79,24 @@ char *pa_strlcpy(char *b, const char *s, size_t l);
 char *pa_parent_dir(const char *fn);
 
 int pa_make_realtime(int rtprio);
+int pa_make_deadline(pa_usec_t runtime, pa_usec_t period);
+/* The reservation for an IO thread that has to refill a buffer of
+ * latency usec and has been measured to take up to render_usec for
+ * it, to be passed to pa_make_deadline() */
+void pa_deadline_from_latency(pa_usec_t latency, pa_usec_t render_usec, pa_usec_t *runtime, pa_usec_t *period);
 int pa_raise_priority(int nice_level);
 void pa_reset_priority(void);
 
+/* CPU lists are given in the usual "0-3,8" notation. */
+pa_bool_t pa_cpu_list_valid(const char *cpus);
+/* Binds the calling thread to the CPUs in the list */
+int pa_set_cpu_affinity(const char *cpus);
+/* Returns the CPUs of a NUMA node as a newly allocated list, or NULL */
+char *pa_numa_node_cpus(int node);
+/* Returns the NUMA node all CPUs of the list belong to, or -1 if they
+ * span several nodes or the system has no NUMA information */
+int pa_cpu_list_numa_node(const char *cpus);
+
 int pa_parse_boolean(const char *s) PA_GCC_PURE;
 
 int pa_parse_volume(const char *s, pa_volume_t *volume);
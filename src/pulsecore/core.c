@@ -28,15 +28,21 @@
 #include <stdio.h>
 #include <signal.h>
 
+#ifdef HAVE_MALLOC_TRIM
+#include <malloc.h>
+#endif
+
 #include <pulse/rtclock.h>
 #include <pulse/timeval.h>
 #include <pulse/xmalloc.h>
 
 #include <pulsecore/module.h>
+#include <pulsecore/client.h>
 #include <pulsecore/core-rtclock.h>
 #include <pulsecore/core-util.h>
 #include <pulsecore/core-scache.h>
 #include <pulsecore/core-subscribe.h>
+#include <pulsecore/flist.h>
 #include <pulsecore/random.h>
 #include <pulsecore/log.h>
 #include <pulsecore/macro.h>
@@ -63,7 +69,7 @@ static int core_process_msg(pa_msgobject *o, int code, void *userdata, int64_t o
 
 static void core_free(pa_object *o);
 
-pa_core* pa_core_new(pa_mainloop_api *m, pa_bool_t shared, size_t shm_size) {
+pa_core* pa_core_new(pa_mainloop_api *m, pa_bool_t shared, size_t shm_size, pa_shm_huge_pages_t shm_huge_pages, pa_bool_t lock_shm) {
     pa_core* c;
     pa_mempool *pool;
     int j;
@@ -71,14 +77,14 @@ pa_core* pa_core_new(pa_mainloop_api *m, pa_bool_t shared, size_t shm_size) {
     pa_assert(m);
 
     if (shared) {
-        if (!(pool = pa_mempool_new(shared, shm_size))) {
+        if (!(pool = pa_mempool_new_extended(shared, shm_size, shm_huge_pages, lock_shm))) {
             pa_log_warn("failed to allocate shared memory pool. Falling back to a normal memory pool.");
             shared = FALSE;
         }
     }
 
     if (!shared) {
-        if (!(pool = pa_mempool_new(shared, shm_size))) {
+        if (!(pool = pa_mempool_new_extended(shared, shm_size, shm_huge_pages, lock_shm))) {
             pa_log("pa_mempool_new() failed.");
             return NULL;
         }
@@ -89,7 +95,9 @@ pa_core* pa_core_new(pa_mainloop_api *m, pa_bool_t shared, size_t shm_size) {
     c->parent.process_msg = core_process_msg;
 
     c->state = PA_CORE_STARTUP;
-    c->mainloop = m;
+    c->cpu_account = pa_cpu_account_new();
+    c->cpu_accounting = pa_cpu_accounting_new(m, c->cpu_account);
+    c->mainloop = pa_cpu_accounting_get_api(c->cpu_accounting);
 
     c->clients = pa_idxset_new(NULL, NULL);
     c->cards = pa_idxset_new(NULL, NULL);
@@ -123,24 +131,39 @@ pa_core* pa_core_new(pa_mainloop_api *m, pa_bool_t shared, size_t shm_size) {
     PA_LLIST_HEAD_INIT(pa_subscription, c->subscriptions);
     PA_LLIST_HEAD_INIT(pa_subscription_event, c->subscription_event_queue);
     c->subscription_event_last = NULL;
+    c->subscription_change_interval = 0;
+    c->subscription_last_dispatch = 0;
+    c->subscription_time_event = NULL;
 
     c->mempool = pool;
+    c->memowner = pa_memowner_new();
+    pa_mempool_set_owner(c->mempool, c->memowner);
+    c->shm_size = shm_size;
+    c->shm_huge_pages = shm_huge_pages;
     pa_silence_cache_init(&c->silence_cache);
 
     c->exit_event = NULL;
+    c->memory_trim_event = NULL;
 
     c->exit_idle_time = -1;
     c->scache_idle_time = 20;
+    c->memory_trim_idle_time = -1;
+    c->memory_trimmed = 0;
+    c->n_memory_trims = 0;
 
     c->flat_volumes = TRUE;
     c->disallow_module_loading = FALSE;
     c->disallow_exit = FALSE;
     c->running_as_daemon = FALSE;
     c->realtime_scheduling = FALSE;
+    c->realtime_deadline = FALSE;
     c->realtime_priority = 5;
+    c->default_cpu_affinity = NULL;
     c->disable_remixing = FALSE;
     c->disable_lfe_remixing = FALSE;
     c->deferred_volume = TRUE;
+    c->render_stats = FALSE;
+    c->log_startup_timing = FALSE;
     c->resample_method = PA_RESAMPLER_SPEEX_FLOAT_BASE + 1;
 
     for (j = 0; j < PA_CORE_HOOK_MAX; j++)
@@ -204,15 +227,24 @@ static void core_free(pa_object *o) {
     if (c->exit_event)
         c->mainloop->time_free(c->exit_event);
 
+    if (c->memory_trim_event)
+        c->mainloop->time_free(c->memory_trim_event);
+
     pa_assert(!c->default_source);
     pa_assert(!c->default_sink);
 
     pa_silence_cache_done(&c->silence_cache);
     pa_mempool_free(c->mempool);
+    pa_memowner_unref(c->memowner);
+
+    pa_xfree(c->default_cpu_affinity);
 
     for (j = 0; j < PA_CORE_HOOK_MAX; j++)
         pa_hook_done(&c->hooks[j]);
 
+    pa_cpu_accounting_free(c->cpu_accounting);
+    pa_cpu_account_unref(c->cpu_account);
+
     pa_xfree(c);
 }
 
@@ -249,30 +281,107 @@ int pa_core_exit(pa_core *c, pa_bool_t force, int retval) {
     return 0;
 }
 
+int pa_core_restart(pa_core *c) {
+    pa_assert(c);
+
+    if (pa_core_exit(c, FALSE, 0) < 0)
+        return -1;
+
+    c->restart_requested = TRUE;
+    return 0;
+}
+
+static pa_bool_t is_idle(pa_core *c, pa_bool_t *no_streams) {
+    pa_sink *si;
+    pa_source *so;
+    uint32_t idx;
+
+    *no_streams = pa_idxset_isempty(c->sink_inputs) && pa_idxset_isempty(c->source_outputs);
+    if (*no_streams)
+        return TRUE;
+
+    PA_IDXSET_FOREACH(si, c->sinks, idx)
+        if (pa_sink_get_state(si) != PA_SINK_SUSPENDED)
+            return FALSE;
+
+    PA_IDXSET_FOREACH(so, c->sources, idx)
+        if (pa_source_get_state(so) != PA_SOURCE_SUSPENDED)
+            return FALSE;
+
+    return TRUE;
+}
+
+/* The resident set size, 0 if unknown */
+static uint64_t get_rss(void) {
+    char *line;
+    unsigned long long size, resident = 0;
+
+    if (!(line = pa_read_line_from_file("/proc/self/statm")))
+        return 0;
+
+    if (sscanf(line, "%llu %llu", &size, &resident) != 2)
+        resident = 0;
+
+    pa_xfree(line);
+
+    return (uint64_t) resident * (uint64_t) PA_PAGE_SIZE;
+}
+
+static void memory_trim_cb(pa_mainloop_api *m, pa_time_event *e, const struct timeval *t, void *userdata) {
+    pa_core *c = userdata;
+    pa_bool_t no_streams;
+    uint64_t before, after;
+    unsigned n;
+
+    pa_assert(c->memory_trim_event == e);
+
+    c->mainloop->time_free(c->memory_trim_event);
+    c->memory_trim_event = NULL;
+
+    if (!is_idle(c, &no_streams))
+        return;
+
+    before = get_rss();
+
+    pa_mempool_vacuum(c->mempool);
+    n = pa_flist_trim_all();
+#ifdef HAVE_MALLOC_TRIM
+    malloc_trim(0);
+#endif
+
+    after = get_rss();
+
+    if (before > after)
+        c->memory_trimmed += before - after;
+    c->n_memory_trims++;
+
+    pa_log_info("Idle for %i s, trimmed memory: %u free list entries freed, %llu bytes given back.",
+                c->memory_trim_idle_time, n, (unsigned long long) (before > after ? before - after : 0));
+}
+
 void pa_core_maybe_vacuum(pa_core *c) {
+    pa_bool_t no_streams;
+
     pa_assert(c);
 
-    if (pa_idxset_isempty(c->sink_inputs) && pa_idxset_isempty(c->source_outputs)) {
-        pa_log_debug("Hmm, no streams around, trying to vacuum.");
-        pa_mempool_vacuum(c->mempool);
-    } else {
-        pa_sink *si;
-        pa_source *so;
-        uint32_t idx;
-
-        idx = 0;
-        PA_IDXSET_FOREACH(si, c->sinks, idx)
-            if (pa_sink_get_state(si) != PA_SINK_SUSPENDED)
-                return;
-
-        idx = 0;
-        PA_IDXSET_FOREACH(so, c->sources, idx)
-            if (pa_source_get_state(so) != PA_SOURCE_SUSPENDED)
-                return;
+    if (!is_idle(c, &no_streams))
+        return;
 
+    if (no_streams)
+        pa_log_debug("Hmm, no streams around, trying to vacuum.");
+    else
         pa_log_info("All sinks and sources are suspended, vacuuming memory");
-        pa_mempool_vacuum(c->mempool);
-    }
+
+    pa_mempool_vacuum(c->mempool);
+
+    /* Trim for real once nothing happened for a while */
+    if (c->memory_trim_idle_time < 0)
+        return;
+
+    if (c->memory_trim_event)
+        pa_core_rttime_restart(c, c->memory_trim_event, pa_rtclock_now() + c->memory_trim_idle_time * PA_USEC_PER_SEC);
+    else
+        c->memory_trim_event = pa_core_rttime_new(c, pa_rtclock_now() + c->memory_trim_idle_time * PA_USEC_PER_SEC, memory_trim_cb, c);
 }
 
 pa_time_event* pa_core_rttime_new(pa_core *c, pa_usec_t usec, pa_time_event_cb_t cb, void *userdata) {
@@ -292,3 +401,50 @@ void pa_core_rttime_restart(pa_core *c, pa_time_event *e, pa_usec_t usec) {
 
     c->mainloop->time_restart(e, pa_timeval_rtstore(&tv, usec, TRUE));
 }
+
+static int cpu_usage_compare(const void *a, const void *b) {
+    pa_usec_t ua = pa_cpu_account_get_usec(((const pa_core_cpu_usage*) a)->account);
+    pa_usec_t ub = pa_cpu_account_get_usec(((const pa_core_cpu_usage*) b)->account);
+
+    return ua > ub ? -1 : (ua < ub ? 1 : 0);
+}
+
+pa_core_cpu_usage* pa_core_get_cpu_usage(pa_core *c, unsigned *n) {
+    pa_core_cpu_usage *u;
+    pa_module *m;
+    pa_client *client;
+    uint32_t idx;
+    unsigned k = 0;
+
+    pa_core_assert_ref(c);
+    pa_assert(n);
+
+    u = pa_xnew(pa_core_cpu_usage, 1 + pa_idxset_size(c->modules) + pa_idxset_size(c->clients));
+
+    u[k].type = "core";
+    u[k].index = PA_INVALID_INDEX;
+    u[k].name = "core";
+    u[k].account = c->cpu_account;
+    k++;
+
+    PA_IDXSET_FOREACH(m, c->modules, idx) {
+        u[k].type = "module";
+        u[k].index = m->index;
+        u[k].name = m->name;
+        u[k].account = m->cpu_account;
+        k++;
+    }
+
+    PA_IDXSET_FOREACH(client, c->clients, idx) {
+        u[k].type = "client";
+        u[k].index = client->index;
+        u[k].name = pa_strnull(pa_proplist_gets(client->proplist, PA_PROP_APPLICATION_NAME));
+        u[k].account = client->cpu_account;
+        k++;
+    }
+
+    qsort(u, k, sizeof(pa_core_cpu_usage), cpu_usage_compare);
+
+    *n = k;
+    return u;
+}
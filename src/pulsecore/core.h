@@ -25,6 +25,7 @@
 #include <pulse/mainloop-api.h>
 #include <pulse/sample.h>
 #include <pulsecore/cpu.h>
+#include <pulsecore/cpu-account.h>
 
 typedef struct pa_core pa_core;
 
@@ -136,7 +137,12 @@ struct pa_core {
      * PulseAudio. Not cryptographically secure in any way. */
     uint32_t cookie;
 
+    /* Wraps the mainloop passed to pa_core_new(), to charge the
+     * time spent in its callbacks to the core, modules and clients */
     pa_mainloop_api *mainloop;
+    pa_cpu_accounting *cpu_accounting;
+    /* What is charged to neither a module nor a client */
+    pa_cpu_account *cpu_account;
 
     /* idxset of all kinds of entities */
     pa_idxset *clients, *cards, *sinks, *sources, *sink_inputs, *source_outputs, *modules, *scache;
@@ -162,26 +168,52 @@ struct pa_core {
     PA_LLIST_HEAD(pa_subscription_event, subscription_event_queue);
     pa_subscription_event *subscription_event_last;
 
+    /* CHANGE events are dispatched at most once per interval, so that a
+     * burst of them is coalesced into one per object. 0 for no limit. */
+    pa_usec_t subscription_change_interval;
+    pa_usec_t subscription_last_dispatch;
+    pa_time_event *subscription_time_event;
+
     pa_mempool *mempool;
+    /* What is charged to neither a module nor a client */
+    pa_memowner *memowner;
+    size_t shm_size;
+    pa_shm_huge_pages_t shm_huge_pages;
     pa_silence_cache silence_cache;
 
     pa_time_event *exit_event;
     pa_time_event *scache_auto_unload_event;
+    pa_time_event *memory_trim_event;
+
+    int exit_idle_time, scache_idle_time, memory_trim_idle_time;
 
-    int exit_idle_time, scache_idle_time;
+    /* What idle-time trimming has given back to the system so far */
+    uint64_t memory_trimmed;
+    uint32_t n_memory_trims;
 
     pa_bool_t flat_volumes:1;
     pa_bool_t disallow_module_loading:1;
     pa_bool_t disallow_exit:1;
+    /* Set by pa_core_restart(), tells the daemon to execute itself anew
+     * once the main loop has quit */
+    pa_bool_t restart_requested:1;
     pa_bool_t running_as_daemon:1;
     pa_bool_t realtime_scheduling:1;
+    /* Prefer SCHED_DEADLINE for IO threads that know their period */
+    pa_bool_t realtime_deadline:1;
     pa_bool_t disable_remixing:1;
     pa_bool_t disable_lfe_remixing:1;
     pa_bool_t deferred_volume:1;
+    pa_bool_t render_stats:1;
+    /* Log how long each command of the startup script takes */
+    pa_bool_t log_startup_timing:1;
 
     pa_resample_method_t resample_method;
     int realtime_priority;
 
+    /* The CPUs IO threads are bound to unless configured otherwise, or NULL */
+    char *default_cpu_affinity;
+
     pa_server_type_t server_type;
     pa_cpu_info cpu_info;
 
@@ -197,17 +229,37 @@ enum {
     PA_CORE_MESSAGE_MAX
 };
 
-pa_core* pa_core_new(pa_mainloop_api *m, pa_bool_t shared, size_t shm_size);
+pa_core* pa_core_new(pa_mainloop_api *m, pa_bool_t shared, size_t shm_size, pa_shm_huge_pages_t shm_huge_pages, pa_bool_t lock_shm);
 
 /* Check whether no one is connected to this core */
 void pa_core_check_idle(pa_core *c);
 
 int pa_core_exit(pa_core *c, pa_bool_t force, int retval);
 
+/* Like pa_core_exit(), but the daemon then replaces itself with a new
+ * instance that takes over the listening sockets and the device
+ * state */
+int pa_core_restart(pa_core *c);
+
+/* Vacuums the memory pool if no streams are around or all devices are
+ * suspended. If that lasts for memory_trim_idle_time, the free lists
+ * and the heap are trimmed as well. */
 void pa_core_maybe_vacuum(pa_core *c);
 
 /* wrapper for c->mainloop->time_*() RT time events */
 pa_time_event* pa_core_rttime_new(pa_core *c, pa_usec_t usec, pa_time_event_cb_t cb, void *userdata);
 void pa_core_rttime_restart(pa_core *c, pa_time_event *e, pa_usec_t usec);
 
+typedef struct pa_core_cpu_usage {
+    const char *type; /* "core", "module" or "client" */
+    uint32_t index;   /* PA_INVALID_INDEX for the core */
+    const char *name;
+    pa_cpu_account *account;
+} pa_core_cpu_usage;
+
+/* Lists the main thread time of the core, all modules and all clients,
+ * busiest first. The entries are only valid until control returns to
+ * the main loop, free the array with pa_xfree(). */
+pa_core_cpu_usage* pa_core_get_cpu_usage(pa_core *c, unsigned *n);
+
 #endif
@@ -0,0 +1,494 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <time.h>
+
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core-rtclock.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/refcnt.h>
+
+#include "cpu-account.h"
+
+struct pa_cpu_account {
+    PA_REFCNT_DECLARE;
+
+    pa_usec_t usec;
+    pa_usec_t max_usec;
+    uint64_t n_dispatched;
+};
+
+struct pa_cpu_accounting {
+    PA_REFCNT_DECLARE;
+
+    /* What we hand out */
+    pa_mainloop_api api;
+
+    pa_mainloop_api *wrapped;
+
+    pa_cpu_account *fallback;
+
+    /* Not referenced, either the fallback or the account of the
+     * callback currently running */
+    pa_cpu_account *current;
+
+    /* While a callback runs, since when current is being charged */
+    pa_bool_t dispatching;
+    pa_usec_t mark;
+};
+
+/* Our own events, each wrapping one of the wrapped mainloop. Like
+ * glib-mainloop.c we define the opaque event types ourselves. */
+
+struct pa_io_event {
+    pa_cpu_accounting *accounting;
+    pa_cpu_account *account;
+    pa_io_event *wrapped;
+
+    pa_io_event_cb_t callback;
+    pa_io_event_destroy_cb_t destroy_callback;
+    void *userdata;
+};
+
+struct pa_time_event {
+    pa_cpu_accounting *accounting;
+    pa_cpu_account *account;
+    pa_time_event *wrapped;
+
+    pa_time_event_cb_t callback;
+    pa_time_event_destroy_cb_t destroy_callback;
+    void *userdata;
+};
+
+struct pa_defer_event {
+    pa_cpu_accounting *accounting;
+    pa_cpu_account *account;
+    pa_defer_event *wrapped;
+
+    pa_defer_event_cb_t callback;
+    pa_defer_event_destroy_cb_t destroy_callback;
+    void *userdata;
+};
+
+pa_cpu_account* pa_cpu_account_new(void) {
+    pa_cpu_account *a;
+
+    a = pa_xnew0(pa_cpu_account, 1);
+    PA_REFCNT_INIT(a);
+
+    return a;
+}
+
+pa_cpu_account* pa_cpu_account_ref(pa_cpu_account *a) {
+    pa_assert(a);
+    pa_assert(PA_REFCNT_VALUE(a) > 0);
+
+    PA_REFCNT_INC(a);
+    return a;
+}
+
+void pa_cpu_account_unref(pa_cpu_account *a) {
+    pa_assert(a);
+    pa_assert(PA_REFCNT_VALUE(a) > 0);
+
+    if (PA_REFCNT_DEC(a) > 0)
+        return;
+
+    pa_xfree(a);
+}
+
+pa_usec_t pa_cpu_account_get_usec(pa_cpu_account *a) {
+    pa_assert(a);
+
+    return a->usec;
+}
+
+pa_usec_t pa_cpu_account_get_max_usec(pa_cpu_account *a) {
+    pa_assert(a);
+
+    return a->max_usec;
+}
+
+uint64_t pa_cpu_account_get_dispatched(pa_cpu_account *a) {
+    pa_assert(a);
+
+    return a->n_dispatched;
+}
+
+char *pa_cpu_account_to_string(pa_cpu_account *a) {
+    pa_assert(a);
+
+    return pa_sprintf_malloc("%0.1f ms in %llu callbacks, at most %0.1f ms",
+                             (double) a->usec / PA_USEC_PER_MSEC,
+                             (unsigned long long) a->n_dispatched,
+                             (double) a->max_usec / PA_USEC_PER_MSEC);
+}
+
+static pa_usec_t now(void) {
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_THREAD_CPUTIME_ID)
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0)
+        return pa_timespec_load(&ts);
+#endif
+
+    return pa_rtclock_now();
+}
+
+static pa_cpu_accounting* accounting_ref(pa_cpu_accounting *c) {
+    pa_assert(c);
+    pa_assert(PA_REFCNT_VALUE(c) > 0);
+
+    PA_REFCNT_INC(c);
+    return c;
+}
+
+static void accounting_unref(pa_cpu_accounting *c) {
+    pa_assert(c);
+    pa_assert(PA_REFCNT_VALUE(c) > 0);
+
+    if (PA_REFCNT_DEC(c) > 0)
+        return;
+
+    pa_cpu_account_unref(c->fallback);
+    pa_xfree(c);
+}
+
+/* Charges the time since the last mark to the current account */
+static void charge(pa_cpu_accounting *c) {
+    pa_usec_t t, d;
+
+    t = now();
+    d = t > c->mark ? t - c->mark : 0;
+    c->mark = t;
+
+    c->current->usec += d;
+
+    if (d > c->current->max_usec)
+        c->current->max_usec = d;
+}
+
+/* Makes the account of the event current and starts the clock */
+static pa_cpu_account* dispatch_begin(pa_cpu_accounting *c, pa_cpu_account *a) {
+    pa_cpu_account *previous;
+
+    pa_assert(!c->dispatching);
+
+    /* The callback might free the event */
+    pa_cpu_account_ref(a);
+    a->n_dispatched++;
+
+    previous = c->current;
+    c->current = a;
+
+    c->dispatching = TRUE;
+    c->mark = now();
+
+    return previous;
+}
+
+static void dispatch_end(pa_cpu_accounting *c, pa_cpu_account *a, pa_cpu_account *previous) {
+    charge(c);
+
+    c->dispatching = FALSE;
+    c->current = previous;
+
+    pa_cpu_account_unref(a);
+}
+
+/* IO events */
+
+static void io_cb(pa_mainloop_api *m, pa_io_event *w, int fd, pa_io_event_flags_t events, void *userdata) {
+    pa_io_event *e = userdata;
+    pa_cpu_accounting *c;
+    pa_cpu_account *previous;
+
+    pa_assert(e);
+    c = e->accounting;
+
+    previous = dispatch_begin(c, e->account);
+    e->callback(&c->api, e, fd, events, e->userdata);
+    dispatch_end(c, e->account, previous);
+}
+
+static void io_destroy_cb(pa_mainloop_api *m, pa_io_event *w, void *userdata) {
+    pa_io_event *e = userdata;
+
+    pa_assert(e);
+
+    if (e->destroy_callback)
+        e->destroy_callback(&e->accounting->api, e, e->userdata);
+
+    pa_cpu_account_unref(e->account);
+    accounting_unref(e->accounting);
+    pa_xfree(e);
+}
+
+static pa_io_event* io_new(pa_mainloop_api *m, int fd, pa_io_event_flags_t events, pa_io_event_cb_t cb, void *userdata) {
+    pa_cpu_accounting *c;
+    pa_io_event *e;
+
+    pa_assert(m);
+    pa_assert_se(c = m->userdata);
+    pa_assert(cb);
+
+    e = pa_xnew0(pa_io_event, 1);
+    e->accounting = accounting_ref(c);
+    e->account = pa_cpu_account_ref(c->current);
+    e->callback = cb;
+    e->userdata = userdata;
+
+    pa_assert_se(e->wrapped = c->wrapped->io_new(c->wrapped, fd, events, io_cb, e));
+    c->wrapped->io_set_destroy(e->wrapped, io_destroy_cb);
+
+    return e;
+}
+
+static void io_enable(pa_io_event *e, pa_io_event_flags_t events) {
+    pa_assert(e);
+
+    e->accounting->wrapped->io_enable(e->wrapped, events);
+}
+
+static void io_free(pa_io_event *e) {
+    pa_assert(e);
+
+    /* We are freed from io_destroy_cb() */
+    e->accounting->wrapped->io_free(e->wrapped);
+}
+
+static void io_set_destroy(pa_io_event *e, pa_io_event_destroy_cb_t cb) {
+    pa_assert(e);
+
+    e->destroy_callback = cb;
+}
+
+/* Time events */
+
+static void time_cb(pa_mainloop_api *m, pa_time_event *w, const struct timeval *tv, void *userdata) {
+    pa_time_event *e = userdata;
+    pa_cpu_accounting *c;
+    pa_cpu_account *previous;
+
+    pa_assert(e);
+    c = e->accounting;
+
+    previous = dispatch_begin(c, e->account);
+    e->callback(&c->api, e, tv, e->userdata);
+    dispatch_end(c, e->account, previous);
+}
+
+static void time_destroy_cb(pa_mainloop_api *m, pa_time_event *w, void *userdata) {
+    pa_time_event *e = userdata;
+
+    pa_assert(e);
+
+    if (e->destroy_callback)
+        e->destroy_callback(&e->accounting->api, e, e->userdata);
+
+    pa_cpu_account_unref(e->account);
+    accounting_unref(e->accounting);
+    pa_xfree(e);
+}
+
+static pa_time_event* time_new(pa_mainloop_api *m, const struct timeval *tv, pa_time_event_cb_t cb, void *userdata) {
+    pa_cpu_accounting *c;
+    pa_time_event *e;
+
+    pa_assert(m);
+    pa_assert_se(c = m->userdata);
+    pa_assert(cb);
+
+    e = pa_xnew0(pa_time_event, 1);
+    e->accounting = accounting_ref(c);
+    e->account = pa_cpu_account_ref(c->current);
+    e->callback = cb;
+    e->userdata = userdata;
+
+    pa_assert_se(e->wrapped = c->wrapped->time_new(c->wrapped, tv, time_cb, e));
+    c->wrapped->time_set_destroy(e->wrapped, time_destroy_cb);
+
+    return e;
+}
+
+static void time_restart(pa_time_event *e, const struct timeval *tv) {
+    pa_assert(e);
+
+    e->accounting->wrapped->time_restart(e->wrapped, tv);
+}
+
+static void time_free(pa_time_event *e) {
+    pa_assert(e);
+
+    e->accounting->wrapped->time_free(e->wrapped);
+}
+
+static void time_set_destroy(pa_time_event *e, pa_time_event_destroy_cb_t cb) {
+    pa_assert(e);
+
+    e->destroy_callback = cb;
+}
+
+/* Deferred events */
+
+static void defer_cb(pa_mainloop_api *m, pa_defer_event *w, void *userdata) {
+    pa_defer_event *e = userdata;
+    pa_cpu_accounting *c;
+    pa_cpu_account *previous;
+
+    pa_assert(e);
+    c = e->accounting;
+
+    previous = dispatch_begin(c, e->account);
+    e->callback(&c->api, e, e->userdata);
+    dispatch_end(c, e->account, previous);
+}
+
+static void defer_destroy_cb(pa_mainloop_api *m, pa_defer_event *w, void *userdata) {
+    pa_defer_event *e = userdata;
+
+    pa_assert(e);
+
+    if (e->destroy_callback)
+        e->destroy_callback(&e->accounting->api, e, e->userdata);
+
+    pa_cpu_account_unref(e->account);
+    accounting_unref(e->accounting);
+    pa_xfree(e);
+}
+
+static pa_defer_event* defer_new(pa_mainloop_api *m, pa_defer_event_cb_t cb, void *userdata) {
+    pa_cpu_accounting *c;
+    pa_defer_event *e;
+
+    pa_assert(m);
+    pa_assert_se(c = m->userdata);
+    pa_assert(cb);
+
+    e = pa_xnew0(pa_defer_event, 1);
+    e->accounting = accounting_ref(c);
+    e->account = pa_cpu_account_ref(c->current);
+    e->callback = cb;
+    e->userdata = userdata;
+
+    pa_assert_se(e->wrapped = c->wrapped->defer_new(c->wrapped, defer_cb, e));
+    c->wrapped->defer_set_destroy(e->wrapped, defer_destroy_cb);
+
+    return e;
+}
+
+static void defer_enable(pa_defer_event *e, int b) {
+    pa_assert(e);
+
+    e->accounting->wrapped->defer_enable(e->wrapped, b);
+}
+
+static void defer_free(pa_defer_event *e) {
+    pa_assert(e);
+
+    e->accounting->wrapped->defer_free(e->wrapped);
+}
+
+static void defer_set_destroy(pa_defer_event *e, pa_defer_event_destroy_cb_t cb) {
+    pa_assert(e);
+
+    e->destroy_callback = cb;
+}
+
+static void quit(pa_mainloop_api *m, int retval) {
+    pa_cpu_accounting *c;
+
+    pa_assert(m);
+    pa_assert_se(c = m->userdata);
+
+    c->wrapped->quit(c->wrapped, retval);
+}
+
+static const pa_mainloop_api vtable = {
+    .userdata = NULL,
+
+    .io_new = io_new,
+    .io_enable = io_enable,
+    .io_free = io_free,
+    .io_set_destroy = io_set_destroy,
+
+    .time_new = time_new,
+    .time_restart = time_restart,
+    .time_free = time_free,
+    .time_set_destroy = time_set_destroy,
+
+    .defer_new = defer_new,
+    .defer_enable = defer_enable,
+    .defer_free = defer_free,
+    .defer_set_destroy = defer_set_destroy,
+
+    .quit = quit,
+};
+
+pa_cpu_accounting* pa_cpu_accounting_new(pa_mainloop_api *m, pa_cpu_account *a) {
+    pa_cpu_accounting *c;
+
+    pa_assert(m);
+    pa_assert(a);
+
+    c = pa_xnew0(pa_cpu_accounting, 1);
+    PA_REFCNT_INIT(c);
+
+    c->api = vtable;
+    c->api.userdata = c;
+    c->wrapped = m;
+    c->fallback = pa_cpu_account_ref(a);
+    c->current = a;
+
+    return c;
+}
+
+void pa_cpu_accounting_free(pa_cpu_accounting *c) {
+    pa_assert(c);
+
+    accounting_unref(c);
+}
+
+pa_mainloop_api* pa_cpu_accounting_get_api(pa_cpu_accounting *c) {
+    pa_assert(c);
+
+    return &c->api;
+}
+
+pa_cpu_account* pa_cpu_accounting_set_current(pa_cpu_accounting *c, pa_cpu_account *a) {
+    pa_cpu_account *previous;
+
+    pa_assert(c);
+
+    if (c->dispatching)
+        charge(c);
+
+    previous = c->current;
+    c->current = a ? a : c->fallback;
+
+    return previous;
+}
@@ -0,0 +1,70 @@
+#ifndef foopulsecpuaccounthfoo
+#define foopulsecpuaccounthfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <inttypes.h>
+
+#include <pulse/mainloop-api.h>
+#include <pulse/sample.h>
+
+/* Accounting of the time the main thread spends in mainloop
+ * callbacks. pa_cpu_accounting wraps a pa_mainloop_api. Every event
+ * created through the wrapper is charged to the account that is
+ * current when it is created, and while its callback runs, that
+ * account is current in turn. So events created from a callback
+ * belong to the same account as the event that called it. Making
+ * another account current from within a callback charges the rest of
+ * the time to that one, until the previous account is restored. The
+ * time is the CPU time of the thread where the platform allows
+ * measuring it, and wall clock time otherwise. */
+
+typedef struct pa_cpu_account pa_cpu_account;
+typedef struct pa_cpu_accounting pa_cpu_accounting;
+
+pa_cpu_account* pa_cpu_account_new(void);
+pa_cpu_account* pa_cpu_account_ref(pa_cpu_account *a);
+void pa_cpu_account_unref(pa_cpu_account *a);
+
+/* The total time charged, the longest stretch of it in one go, and
+ * how many callbacks of the account's events were dispatched */
+pa_usec_t pa_cpu_account_get_usec(pa_cpu_account *a);
+pa_usec_t pa_cpu_account_get_max_usec(pa_cpu_account *a);
+uint64_t pa_cpu_account_get_dispatched(pa_cpu_account *a);
+
+/* Returns a newly allocated string like "12.3 ms in 456 callbacks, at
+ * most 1.2 ms" */
+char *pa_cpu_account_to_string(pa_cpu_account *a);
+
+/* Events created while no other account was made current are charged
+ * to a. */
+pa_cpu_accounting* pa_cpu_accounting_new(pa_mainloop_api *m, pa_cpu_account *a);
+
+/* The wrapper stays around until the last event created through it is
+ * destroyed by the wrapped mainloop. */
+void pa_cpu_accounting_free(pa_cpu_accounting *c);
+
+pa_mainloop_api* pa_cpu_accounting_get_api(pa_cpu_accounting *c);
+
+/* Makes a current, or the fallback account if a is NULL. Returns the
+ * account that was current before, for restoring it. */
+pa_cpu_account* pa_cpu_accounting_set_current(pa_cpu_accounting *c, pa_cpu_account *a);
+
+#endif
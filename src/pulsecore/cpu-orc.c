@@ -35,6 +35,24 @@ pa_bool_t pa_cpu_init_orc(pa_cpu_info cpu_info) {
         pa_volume_func_init_orc();
         return TRUE;
     }
+
+    /* The hand-written NEON mixing and s16 conversions are faster than
+     * what Orc generates, and so is the ARMv6 svolume. Orc only fills in
+     * what NEON doesn't cover. */
+    if ((cpu_info.cpu_type == PA_CPU_ARM) && (cpu_info.flags.arm & PA_CPU_ARM_NEON)) {
+        pa_volume_float32_func_init_orc();
+        pa_remap_func_init_orc();
+        return TRUE;
+    }
+
+    /* Everywhere else Orc is the only vectorized code there is */
+    if (!((cpu_info.cpu_type == PA_CPU_ARM) && (cpu_info.flags.arm & PA_CPU_ARM_V6)))
+        pa_volume_func_init_orc();
+    pa_volume_float32_func_init_orc();
+    pa_mix_func_init_orc();
+    pa_convert_func_init_orc();
+    pa_remap_func_init_orc();
+    return TRUE;
 #endif
 
     return FALSE;
@@ -29,5 +29,9 @@
 pa_bool_t pa_cpu_init_orc(pa_cpu_info cpu_info);
 
 void pa_volume_func_init_orc(void);
+void pa_volume_float32_func_init_orc(void);
+void pa_mix_func_init_orc(void);
+void pa_convert_func_init_orc(void);
+void pa_remap_func_init_orc(void);
 
 #endif /* foocpuorchfoo */
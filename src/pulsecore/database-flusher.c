@@ -0,0 +1,289 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pulse/mainloop.h>
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core-rtclock.h>
+#include <pulsecore/idxset.h>
+#include <pulsecore/io-worker.h>
+#include <pulsecore/llist.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/refcnt.h>
+#include <pulsecore/shared.h>
+#include <pulsecore/thread.h>
+
+#include "database-flusher.h"
+
+#define SAVE_INTERVAL (10 * PA_USEC_PER_SEC)
+
+/* The snapshots of one timer run, written by the thread in one go */
+struct flush {
+    pa_database_flusher *flusher;
+
+    unsigned n;
+    pa_database **databases;
+    pa_database_snapshot **snapshots;
+
+    PA_LLIST_FIELDS(struct flush);
+};
+
+struct pa_database_flusher {
+    PA_REFCNT_DECLARE;
+
+    pa_core *core;
+
+    pa_idxset *scheduled;
+    pa_time_event *time_event;
+
+    /* Handed to the thread and not done yet */
+    PA_LLIST_HEAD(struct flush, flushes);
+
+    pa_mainloop *mainloop;
+    pa_io_worker *worker;
+    pa_thread *thread;
+};
+
+static void flush_free(struct flush *fl) {
+    pa_xfree(fl->databases);
+    pa_xfree(fl->snapshots);
+    pa_xfree(fl);
+}
+
+/* Called from main context */
+static void flush_done_cb(void *object, void *userdata) {
+    pa_database_flusher *f = object;
+    struct flush *fl = userdata;
+    unsigned i, n = 0;
+
+    pa_assert(f);
+    pa_assert(fl);
+
+    for (i = 0; i < fl->n; i++)
+        if (fl->databases[i]) {
+            pa_database_snapshot_done(fl->databases[i], fl->snapshots[i]);
+            n++;
+        }
+
+    PA_LLIST_REMOVE(struct flush, f->flushes, fl);
+    flush_free(fl);
+
+    pa_log_info("Synced %u database(s).", n);
+}
+
+/* Called from the flusher thread */
+static void flush_write_cb(void *object, void *userdata) {
+    struct flush *fl = object;
+    unsigned i;
+
+    pa_assert(fl);
+
+    for (i = 0; i < fl->n; i++)
+        pa_database_snapshot_write(fl->snapshots[i]);
+
+    pa_io_worker_post(fl->flusher->worker, flush_done_cb, fl->flusher, fl, NULL);
+}
+
+/* Called from the flusher thread */
+static void barrier_cb(void *object, void *userdata) {
+}
+
+/* Called from the flusher thread */
+static void quit_cb(void *object, void *userdata) {
+    pa_mainloop_quit(object, 0);
+}
+
+static void thread_func(void *userdata) {
+    pa_database_flusher *f = userdata;
+
+    pa_assert(f);
+
+    if (pa_mainloop_run(f->mainloop, NULL) < 0)
+        pa_log_error("Database flusher main loop failed.");
+}
+
+static void time_cb(pa_mainloop_api *a, pa_time_event *e, const struct timeval *t, void *userdata) {
+    pa_database_flusher *f = userdata;
+    struct flush *fl;
+    pa_database *db;
+
+    pa_assert(f);
+    pa_assert(e == f->time_event);
+
+    f->core->mainloop->time_free(f->time_event);
+    f->time_event = NULL;
+
+    fl = pa_xnew0(struct flush, 1);
+    fl->flusher = f;
+    fl->databases = pa_xnew(pa_database*, pa_idxset_size(f->scheduled));
+    fl->snapshots = pa_xnew(pa_database_snapshot*, pa_idxset_size(f->scheduled));
+
+    while ((db = pa_idxset_steal_first(f->scheduled, NULL))) {
+        pa_database_snapshot *s;
+
+        /* Nothing to write for this one */
+        if (!(s = pa_database_snapshot_new(db)))
+            continue;
+
+        fl->databases[fl->n] = db;
+        fl->snapshots[fl->n] = s;
+        fl->n++;
+    }
+
+    if (fl->n <= 0) {
+        flush_free(fl);
+        return;
+    }
+
+    PA_LLIST_PREPEND(struct flush, f->flushes, fl);
+    pa_io_worker_run(f->worker, flush_write_cb, fl, NULL);
+}
+
+static pa_database_flusher* database_flusher_new(pa_core *c) {
+    pa_database_flusher *f;
+
+    pa_assert(c);
+
+    f = pa_xnew0(pa_database_flusher, 1);
+    PA_REFCNT_INIT(f);
+    f->core = c;
+    f->scheduled = pa_idxset_new(NULL, NULL);
+    PA_LLIST_HEAD_INIT(struct flush, f->flushes);
+
+    f->mainloop = pa_mainloop_new();
+    f->worker = pa_io_worker_new(c->mainloop, pa_mainloop_get_api(f->mainloop));
+
+    /* Without the thread we can still sync, just not in the background */
+    if (!(f->thread = pa_thread_new("database-flush", thread_func, f)))
+        pa_log_warn("Failed to create database flusher thread, syncing from the main loop.");
+
+    pa_assert_se(pa_shared_set(c, "database-flusher", f) >= 0);
+
+    return f;
+}
+
+pa_database_flusher* pa_database_flusher_get(pa_core *c) {
+    pa_database_flusher *f;
+
+    if ((f = pa_shared_get(c, "database-flusher")))
+        return pa_database_flusher_ref(f);
+
+    return database_flusher_new(c);
+}
+
+pa_database_flusher* pa_database_flusher_ref(pa_database_flusher *f) {
+    pa_assert(f);
+    pa_assert(PA_REFCNT_VALUE(f) >= 1);
+
+    PA_REFCNT_INC(f);
+
+    return f;
+}
+
+void pa_database_flusher_unref(pa_database_flusher *f) {
+    struct flush *fl;
+
+    pa_assert(f);
+    pa_assert(PA_REFCNT_VALUE(f) >= 1);
+
+    if (PA_REFCNT_DEC(f) > 0)
+        return;
+
+    /* Every database has been removed by now */
+    pa_assert(pa_idxset_isempty(f->scheduled));
+
+    if (f->time_event)
+        f->core->mainloop->time_free(f->time_event);
+
+    if (f->thread) {
+        pa_io_worker_run(f->worker, quit_cb, f->mainloop, NULL);
+        pa_thread_free(f->thread);
+    }
+
+    pa_io_worker_free(f->worker);
+    pa_mainloop_free(f->mainloop);
+
+    while ((fl = f->flushes)) {
+        PA_LLIST_REMOVE(struct flush, f->flushes, fl);
+        flush_free(fl);
+    }
+
+    pa_idxset_free(f->scheduled, NULL);
+
+    pa_assert_se(pa_shared_remove(f->core, "database-flusher") >= 0);
+
+    pa_xfree(f);
+}
+
+void pa_database_flusher_schedule(pa_database_flusher *f, pa_database *db) {
+    pa_assert(f);
+    pa_assert(PA_REFCNT_VALUE(f) >= 1);
+    pa_assert(db);
+
+    if (!f->thread) {
+        pa_database_sync(db);
+        return;
+    }
+
+    pa_idxset_put(f->scheduled, db, NULL);
+
+    if (f->time_event)
+        return;
+
+    f->time_event = pa_core_rttime_new(f->core, pa_rtclock_now() + SAVE_INTERVAL, time_cb, f);
+}
+
+void pa_database_flusher_remove(pa_database_flusher *f, pa_database *db) {
+    struct flush *fl;
+    pa_bool_t pending = FALSE;
+    unsigned i;
+
+    pa_assert(f);
+    pa_assert(PA_REFCNT_VALUE(f) >= 1);
+    pa_assert(db);
+
+    pa_idxset_remove_by_data(f->scheduled, db, NULL);
+
+    PA_LLIST_FOREACH(fl, f->flushes)
+        for (i = 0; i < fl->n; i++)
+            if (fl->databases[i] == db)
+                pending = TRUE;
+
+    if (!pending)
+        return;
+
+    /* Once this has been run the thread is done with all snapshots that
+     * have been handed to it */
+    pa_io_worker_run_sync(f->worker, barrier_cb, NULL, NULL);
+
+    PA_LLIST_FOREACH(fl, f->flushes)
+        for (i = 0; i < fl->n; i++)
+            if (fl->databases[i] == db) {
+                pa_database_snapshot_done(db, fl->snapshots[i]);
+                fl->databases[i] = NULL;
+                fl->snapshots[i] = NULL;
+            }
+}
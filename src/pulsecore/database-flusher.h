@@ -0,0 +1,43 @@
+#ifndef foodatabaseflusherhfoo
+#define foodatabaseflusherhfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <pulsecore/core.h>
+#include <pulsecore/database.h>
+
+/* Syncs the databases of all restore modules from one shared thread.
+ * A scheduled database is synced a little later, together with all the
+ * others that have been scheduled in the meantime. Only the snapshot is
+ * taken on the main thread, the writing is done by the thread. */
+
+typedef struct pa_database_flusher pa_database_flusher;
+
+pa_database_flusher* pa_database_flusher_get(pa_core *c);
+pa_database_flusher* pa_database_flusher_ref(pa_database_flusher *f);
+void pa_database_flusher_unref(pa_database_flusher *f);
+
+void pa_database_flusher_schedule(pa_database_flusher *f, pa_database *db);
+
+/* Waits for the pending writes of db and forgets about it. To be called
+ * before the database is closed. */
+void pa_database_flusher_remove(pa_database_flusher *f, pa_database *db);
+
+#endif
@@ -24,9 +24,11 @@
 #endif
 
 #include <errno.h>
+#include <unistd.h>
 #include <gdbm.h>
 
 #include <pulse/xmalloc.h>
+#include <pulsecore/core-error.h>
 #include <pulsecore/core-util.h>
 #include <pulsecore/log.h>
 
@@ -247,3 +249,48 @@ int pa_database_sync(pa_database *db) {
     gdbm_sync(MAKE_GDBM_FILE(db));
     return 0;
 }
+
+/* gdbm writes through on every store, all that is left is the fsync() */
+struct pa_database_snapshot {
+    int fd;
+    int result;
+};
+
+pa_database_snapshot* pa_database_snapshot_new(pa_database *db) {
+    pa_database_snapshot *s;
+    int fd;
+
+    pa_assert(db);
+
+    if ((fd = dup(gdbm_fdesc(MAKE_GDBM_FILE(db)))) < 0) {
+        gdbm_sync(MAKE_GDBM_FILE(db));
+        return NULL;
+    }
+
+    pa_make_fd_cloexec(fd);
+
+    s = pa_xnew(pa_database_snapshot, 1);
+    s->fd = fd;
+    s->result = 0;
+
+    return s;
+}
+
+int pa_database_snapshot_write(pa_database_snapshot *s) {
+    pa_assert(s);
+
+    if (fsync(s->fd) < 0) {
+        pa_log_warn("fsync() failed: %s", pa_cstrerror(errno));
+        s->result = -1;
+    }
+
+    return s->result;
+}
+
+void pa_database_snapshot_done(pa_database *db, pa_database_snapshot *s) {
+    pa_assert(db);
+    pa_assert(s);
+
+    pa_close(s->fd);
+    pa_xfree(s);
+}
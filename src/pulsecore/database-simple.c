@@ -37,11 +37,28 @@
 
 #include "database.h"
 
+/* Changes are appended to a journal next to the database file on sync.
+ * The whole file is only rewritten once the journal has grown larger
+ * than the database itself. */
+#define JOURNAL_MIN_COMPACT_SIZE (64*1024)
+
+enum {
+    JOURNAL_SET = 1,
+    JOURNAL_UNSET = 2
+};
+
 typedef struct simple_data {
     char *filename;
     char *tmp_filename;
+    char *journal_filename;
     pa_hashmap *map;
     pa_bool_t read_only;
+
+    /* Keys changed since the last sync, as entries without data */
+    pa_hashmap *changes;
+    pa_bool_t compact;
+    long file_size;
+    long journal_size;
 } simple_data;
 
 typedef struct entry {
@@ -111,12 +128,26 @@ static void free_entry(entry *e) {
     }
 }
 
+static void mark_changed(simple_data *db, const pa_datum *key) {
+    pa_datum empty;
+    entry *c;
+
+    if (pa_hashmap_get(db->changes, key))
+        return;
+
+    pa_zero(empty);
+    c = new_entry(key, &empty);
+    pa_hashmap_put(db->changes, &c->key, c);
+}
+
 static int read_uint(FILE *f, uint32_t *res) {
     size_t items = 0;
     uint8_t values[4];
     uint32_t tmp;
     int i;
 
+    *res = 0;
+
     items = fread(&values, sizeof(values), sizeof(uint8_t), f);
 
     if (feof(f)) /* EOF */
@@ -224,6 +255,61 @@ static int fill_data(simple_data *db, FILE *f) {
     return pa_hashmap_size(db->map);
 }
 
+/* Applies the journal on top of what has been read from the database
+ * file. A record that is cut short was being written when we died and
+ * is ignored. */
+static void replay_journal(simple_data *db, FILE *f) {
+    unsigned n = 0;
+
+    for (;;) {
+        uint32_t op;
+        pa_datum key;
+        void *d;
+        ssize_t l;
+        entry *e;
+
+        if (read_uint(f, &op) <= 0)
+            break;
+
+        if (read_data(f, &d, &l) < 0)
+            break;
+
+        key.data = d;
+        key.size = (size_t) l;
+
+        if (op == JOURNAL_SET) {
+            if (read_data(f, &d, &l) < 0) {
+                pa_xfree(key.data);
+                break;
+            }
+
+            e = pa_xnew0(entry, 1);
+            e->key = key;
+            e->data.data = d;
+            e->data.size = (size_t) l;
+
+            free_entry(pa_hashmap_remove(db->map, &e->key));
+            pa_hashmap_put(db->map, &e->key, e);
+
+        } else if (op == JOURNAL_UNSET) {
+            free_entry(pa_hashmap_remove(db->map, &key));
+            pa_xfree(key.data);
+
+        } else {
+            pa_log_warn("Unknown record in journal %s, ignoring the rest.", db->journal_filename);
+            pa_xfree(key.data);
+            break;
+        }
+
+        n++;
+    }
+
+    db->journal_size = ftell(f);
+
+    if (n > 0)
+        pa_log_debug("Replayed %u records from journal %s.", n, db->journal_filename);
+}
+
 pa_database* pa_database_open(const char *fn, pa_bool_t for_write) {
     FILE *f;
     char *path;
@@ -241,10 +327,18 @@ pa_database* pa_database_open(const char *fn, pa_bool_t for_write) {
         db->map = pa_hashmap_new(hash_func, compare_func);
         db->filename = pa_xstrdup(path);
         db->tmp_filename = pa_sprintf_malloc(".%s.tmp", db->filename);
+        db->journal_filename = pa_sprintf_malloc("%s.journal", db->filename);
         db->read_only = !for_write;
+        db->changes = pa_hashmap_new(hash_func, compare_func);
 
         if (f) {
             fill_data(db, f);
+            db->file_size = ftell(f);
+            fclose(f);
+        }
+
+        if ((f = pa_fopen_cloexec(db->journal_filename, "r"))) {
+            replay_journal(db, f);
             fclose(f);
         }
     } else {
@@ -265,6 +359,8 @@ void pa_database_close(pa_database *database) {
     pa_database_sync(database);
     pa_xfree(db->filename);
     pa_xfree(db->tmp_filename);
+    pa_xfree(db->journal_filename);
+    pa_hashmap_free(db->changes, (pa_free_cb_t) free_entry);
     pa_hashmap_free(db->map, (pa_free_cb_t) free_entry);
     pa_xfree(db);
 }
@@ -308,6 +404,7 @@ int pa_database_set(pa_database *database, const pa_datum *key, const pa_datum*
         if (overwrite) {
             r = pa_hashmap_remove(db->map, key);
             pa_hashmap_put(db->map, &e->key, e);
+            mark_changed(db, key);
         } else {
             /* won't overwrite, so clean new entry */
             r = e;
@@ -315,7 +412,8 @@ int pa_database_set(pa_database *database, const pa_datum *key, const pa_datum*
         }
 
         free_entry(r);
-    }
+    } else
+        mark_changed(db, key);
 
     return ret;
 }
@@ -331,6 +429,7 @@ int pa_database_unset(pa_database *database, const pa_datum *key) {
     if (!e)
         return -1;
 
+    mark_changed(db, key);
     free_entry(e);
 
     return 0;
@@ -343,6 +442,10 @@ int pa_database_clear(pa_database *database) {
 
     pa_hashmap_remove_all(db->map, (pa_free_cb_t) free_entry);
 
+    /* Nothing of the old file survives, start from scratch */
+    pa_hashmap_remove_all(db->changes, (pa_free_cb_t) free_entry);
+    db->compact = TRUE;
+
     return 0;
 }
 
@@ -416,89 +519,209 @@ pa_datum* pa_database_next(pa_database *database, const pa_datum *key, pa_datum
     return next;
 }
 
-static int write_uint(FILE *f, const uint32_t num) {
-    size_t items;
+/* What a sync writes, taken on the main thread so that the writing
+ * itself does not need the database */
+struct pa_database_snapshot {
+    char *filename;
+    char *tmp_filename;
+    char *journal_filename;
+
+    /* Records to append to the journal */
+    uint8_t *journal;
+    size_t journal_length, journal_allocated;
+
+    /* The whole database, if it is to be rewritten */
+    pa_bool_t rewrite;
+    pa_bool_t drop_journal_first;
+    uint8_t *file;
+    size_t file_length, file_allocated;
+
+    int result;
+};
+
+static void append(uint8_t **buf, size_t *length, size_t *allocated, const void *p, size_t l) {
+    if (*length + l > *allocated) {
+        *allocated = PA_MAX(*length + l, *allocated * 2);
+        *buf = pa_xrealloc(*buf, *allocated);
+    }
+
+    memcpy(*buf + *length, p, l);
+    *length += l;
+}
+
+static void append_uint(uint8_t **buf, size_t *length, size_t *allocated, const uint32_t num) {
     uint8_t values[4];
     int i;
-    errno = 0;
 
     for (i = 0; i < 4; i++)
         values[i] = (num >> (i*8)) & 0xFF;
 
-    items = fwrite(&values, sizeof(values), sizeof(uint8_t), f);
-
-    if (ferror(f))
-        return -1;
+    append(buf, length, allocated, values, sizeof(values));
+}
 
-    return items;
+static void append_data(uint8_t **buf, size_t *length, size_t *allocated, const void *data, const size_t l) {
+    append_uint(buf, length, allocated, (uint32_t) l);
+    append(buf, length, allocated, data, l);
 }
 
-static int write_data(FILE *f, void *data, const size_t length) {
-    size_t items;
-    uint32_t len;
+static void append_entry(uint8_t **buf, size_t *length, size_t *allocated, const entry *e) {
+    pa_assert(e);
 
-    len = length;
-    if ((items = write_uint(f, len)) <= 0)
-        return -1;
+    append_data(buf, length, allocated, e->key.data, e->key.size);
+    append_data(buf, length, allocated, e->data.data, e->data.size);
+}
 
-    items = fwrite(data, length, 1, f);
+#define JOURNAL(s) &(s)->journal, &(s)->journal_length, &(s)->journal_allocated
+#define FILE_DATA(s) &(s)->file, &(s)->file_length, &(s)->file_allocated
 
-    if (ferror(f) || items != 1)
-        return -1;
-
-    return 0;
-}
+static int write_file(const char *fn, const char *mode, const void *data, size_t length) {
+    FILE *f;
 
-static int write_entry(FILE *f, const entry *e) {
-    pa_assert(f);
-    pa_assert(e);
+    errno = 0;
 
-    if (write_data(f, e->key.data, e->key.size) < 0)
+    if (!(f = pa_fopen_cloexec(fn, mode)))
         return -1;
-    if (write_data(f, e->data.data, e->data.size) < 0)
+
+    if (length > 0 && fwrite(data, length, 1, f) != 1) {
+        fclose(f);
         return -1;
+    }
 
-    return 0;
+    return fclose(f) == 0 ? 0 : -1;
 }
 
-int pa_database_sync(pa_database *database) {
+pa_database_snapshot* pa_database_snapshot_new(pa_database *database) {
     simple_data *db = (simple_data*)database;
-    FILE *f;
-    void *state;
-    entry *e;
+    pa_database_snapshot *s;
+    entry *c;
 
     pa_assert(db);
 
     if (db->read_only)
-        return 0;
+        return NULL;
 
-    errno = 0;
+    if (!db->compact && pa_hashmap_isempty(db->changes))
+        return NULL;
 
-    f = pa_fopen_cloexec(db->tmp_filename, "w");
+    s = pa_xnew0(pa_database_snapshot, 1);
+    s->filename = pa_xstrdup(db->filename);
+    s->tmp_filename = pa_xstrdup(db->tmp_filename);
+    s->journal_filename = pa_xstrdup(db->journal_filename);
+
+    /* Even if we rewrite right away the changes go to the journal first,
+     * so that the journal always matches the file that is about to
+     * replace the old one */
+    if (!db->compact) {
+        while ((c = pa_hashmap_steal_first(db->changes))) {
+            entry *e;
+
+            if ((e = pa_hashmap_get(db->map, &c->key))) {
+                append_uint(JOURNAL(s), JOURNAL_SET);
+                append_entry(JOURNAL(s), e);
+            } else {
+                append_uint(JOURNAL(s), JOURNAL_UNSET);
+                append_data(JOURNAL(s), c->key.data, c->key.size);
+            }
+
+            free_entry(c);
+        }
 
-    if (!f)
-        goto fail;
+        db->journal_size += (long) s->journal_length;
 
-    state = NULL;
-    while((e = pa_hashmap_iterate(db->map, &state, NULL))) {
-        if (write_entry(f, e) < 0) {
-            pa_log_warn("error while writing to file. %s", pa_cstrerror(errno));
-            goto fail;
-        }
+        if (db->journal_size <= PA_MAX(db->file_size, (long) JOURNAL_MIN_COMPACT_SIZE))
+            return s;
+    }
+
+    s->rewrite = TRUE;
+    s->drop_journal_first = db->compact;
+
+    {
+        void *state = NULL;
+        entry *e;
+
+        while ((e = pa_hashmap_iterate(db->map, &state, NULL)))
+            append_entry(FILE_DATA(s), e);
+    }
+
+    pa_hashmap_remove_all(db->changes, (pa_free_cb_t) free_entry);
+    db->file_size = (long) s->file_length;
+    db->journal_size = 0;
+    db->compact = FALSE;
+
+    return s;
+}
+
+int pa_database_snapshot_write(pa_database_snapshot *s) {
+    pa_assert(s);
+
+    if (s->journal_length > 0 && write_file(s->journal_filename, "a", s->journal, s->journal_length) < 0) {
+        pa_log_warn("error while writing to journal. %s", pa_cstrerror(errno));
+        s->result = -1;
     }
 
-    fclose(f);
-    f = NULL;
+    if (!s->rewrite)
+        return s->result;
+
+    /* If the journal is out of date (after a clear or a failed append)
+     * it must never be replayed on top of the new file. Losing it before
+     * the rename only takes us back to the last good state. */
+    if (s->drop_journal_first && unlink(s->journal_filename) < 0 && errno != ENOENT)
+        pa_log_warn("error while removing journal. %s", pa_cstrerror(errno));
+
+    if (write_file(s->tmp_filename, "w", s->file, s->file_length) < 0) {
+        pa_log_warn("error while writing to file. %s", pa_cstrerror(errno));
+        s->result = -1;
+        return s->result;
+    }
 
-    if (rename(db->tmp_filename, db->filename) < 0) {
+    if (rename(s->tmp_filename, s->filename) < 0) {
         pa_log_warn("error while renaming file. %s", pa_cstrerror(errno));
-        goto fail;
+        s->result = -1;
+        return s->result;
     }
 
-    return 0;
+    /* Otherwise the journal holds the state the file now has, so dying
+     * right here is harmless */
+    if (unlink(s->journal_filename) < 0 && errno != ENOENT)
+        pa_log_warn("error while removing journal. %s", pa_cstrerror(errno));
 
-fail:
-    if (f)
-        fclose(f);
-    return -1;
+    /* Whatever went wrong with the journal is fixed now */
+    s->result = 0;
+
+    return s->result;
+}
+
+void pa_database_snapshot_done(pa_database *database, pa_database_snapshot *s) {
+    simple_data *db = (simple_data*)database;
+
+    pa_assert(db);
+    pa_assert(s);
+
+    /* Some records might have made it into the journal, a rewrite is
+     * the only way to get rid of them */
+    if (s->result < 0)
+        db->compact = TRUE;
+
+    pa_xfree(s->filename);
+    pa_xfree(s->tmp_filename);
+    pa_xfree(s->journal_filename);
+    pa_xfree(s->journal);
+    pa_xfree(s->file);
+    pa_xfree(s);
+}
+
+int pa_database_sync(pa_database *database) {
+    simple_data *db = (simple_data*)database;
+    pa_database_snapshot *s;
+    int r;
+
+    pa_assert(db);
+
+    if (!(s = pa_database_snapshot_new(database)))
+        return 0;
+
+    r = pa_database_snapshot_write(s);
+    pa_database_snapshot_done(database, s);
+
+    return r;
 }
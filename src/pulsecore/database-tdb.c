@@ -250,3 +250,18 @@ int pa_database_sync(pa_database *db) {
 
     return 0;
 }
+
+/* tdb has nothing to sync, hence there are never any snapshots */
+pa_database_snapshot* pa_database_snapshot_new(pa_database *db) {
+    pa_assert(db);
+
+    return NULL;
+}
+
+int pa_database_snapshot_write(pa_database_snapshot *s) {
+    pa_assert_not_reached();
+}
+
+void pa_database_snapshot_done(pa_database *db, pa_database_snapshot *s) {
+    pa_assert_not_reached();
+}
@@ -58,4 +58,16 @@ pa_datum* pa_database_next(pa_database *db, const pa_datum *key, pa_datum *next,
 
 int pa_database_sync(pa_database *db);
 
+/* pa_database_sync() split up, so that the slow part can be done in
+ * another thread. pa_database_snapshot_new() takes what needs to be
+ * written, NULL if there is nothing. pa_database_snapshot_write() does
+ * not touch the database and may be called from any thread, snapshots
+ * of one database need to be written in order. pa_database_snapshot_done()
+ * passes the result back and frees the snapshot. */
+typedef struct pa_database_snapshot pa_database_snapshot;
+
+pa_database_snapshot* pa_database_snapshot_new(pa_database *db);
+int pa_database_snapshot_write(pa_database_snapshot *s);
+void pa_database_snapshot_done(pa_database *db, pa_database_snapshot *s);
+
 #endif
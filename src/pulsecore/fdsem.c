@@ -35,6 +35,7 @@
 #include <pulsecore/macro.h>
 #include <pulsecore/core-util.h>
 #include <pulsecore/core-error.h>
+#include <pulsecore/rtcheck.h>
 #include <pulse/xmalloc.h>
 
 #ifndef HAVE_PIPE
@@ -117,6 +118,7 @@ pa_fdsem *pa_fdsem_new_shm(pa_fdsem_data *data, int* event_fd) {
 
     f->fds[0] = f->fds[1] = -1;
     f->data = data;
+    *event_fd = f->efd;
 
     pa_atomic_store(&f->data->waiting, 0);
     pa_atomic_store(&f->data->signalled, 0);
@@ -230,6 +232,8 @@ void pa_fdsem_wait(pa_fdsem *f) {
     if (pa_atomic_cmpxchg(&f->data->signalled, 1, 0))
         return;
 
+    pa_rtcheck(PA_RTCHECK_WAIT);
+
     pa_atomic_inc(&f->data->waiting);
 
     while (!pa_atomic_cmpxchg(&f->data->signalled, 1, 0)) {
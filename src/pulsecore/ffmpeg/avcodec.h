@@ -67,10 +67,26 @@ static inline int av_clip(int a, int amin, int amax)
 
 struct AVResampleContext;
 struct AVResampleContext *av_resample_init(int out_rate, int in_rate, int filter_length, int log2_phase_count, int linear, double cutoff);
-int av_resample(struct AVResampleContext *c, short *dst, short *src, int *consumed, int src_size, int dst_size, int update_ctx);
+int av_resample(struct AVResampleContext *c, short *dst, short *src, int channels, int *consumed, int src_size, int dst_size, int update_ctx);
 void av_resample_compensate(struct AVResampleContext *c, int sample_delta, int compensation_distance);
 void av_resample_close(struct AVResampleContext *c);
 void av_build_filter(int16_t *filter, double factor, int tap_count, int phase_count, int scale, int type);
+int16_t *av_build_filter_bank(double factor, int filter_length, int phase_count);
+
+/* Filter banks are shared between all resample contexts with the same
+ * parameters. This cache lives in pulsecore/resampler.c and builds missing
+ * banks with av_build_filter_bank(). */
+int16_t *av_filter_bank_ref(double factor, int filter_length, int phase_count);
+void av_filter_bank_unref(int16_t *filter_bank);
+
+/* The inner product of filter_length taps of filter with as many frames
+ * of interleaved samples at src, for each channel. The sums are left in
+ * val, unscaled and with the same 32 bit wraparound as the C version. */
+#define AV_RESAMPLE_CHANNELS_MAX 8
+typedef void (*av_resample_filter_func_t)(const int16_t *filter, int filter_length, const int16_t *src, int32_t *val);
+
+av_resample_filter_func_t av_resample_get_filter_func(int channels);
+void av_resample_set_filter_func(int channels, av_resample_filter_func_t func);
 
 /*
  * crude lrintf for non-C99 systems.
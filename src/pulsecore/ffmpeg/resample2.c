@@ -175,6 +175,16 @@ void av_build_filter(FELEM *filter, double factor, int tap_count, int phase_coun
 #endif
 }
 
+FELEM *av_build_filter_bank(double factor, int filter_length, int phase_count){
+    FELEM *filter_bank= av_mallocz(filter_length*(phase_count+1)*sizeof(FELEM));
+
+    av_build_filter(filter_bank, factor, filter_length, phase_count, 1<<FILTER_SHIFT, WINDOW_TYPE);
+    memcpy(&filter_bank[filter_length*phase_count+1], filter_bank, (filter_length-1)*sizeof(FELEM));
+    filter_bank[filter_length*phase_count]= filter_bank[filter_length - 1];
+
+    return filter_bank;
+}
+
 AVResampleContext *av_resample_init(int out_rate, int in_rate, int filter_size, int phase_shift, int linear, double cutoff){
     AVResampleContext *c= av_mallocz(sizeof(AVResampleContext));
     double factor= FFMIN(out_rate * cutoff / in_rate, 1.0);
@@ -185,10 +195,7 @@ AVResampleContext *av_resample_init(int out_rate, int in_rate, int filter_size,
     c->linear= linear;
 
     c->filter_length= FFMAX((int)ceil(filter_size/factor), 1);
-    c->filter_bank= av_mallocz(c->filter_length*(phase_count+1)*sizeof(FELEM));
-    av_build_filter(c->filter_bank, factor, c->filter_length, phase_count, 1<<FILTER_SHIFT, WINDOW_TYPE);
-    memcpy(&c->filter_bank[c->filter_length*phase_count+1], c->filter_bank, (c->filter_length-1)*sizeof(FELEM));
-    c->filter_bank[c->filter_length*phase_count]= c->filter_bank[c->filter_length - 1];
+    c->filter_bank= av_filter_bank_ref(factor, c->filter_length, phase_count);
 
     c->src_incr= out_rate;
     c->ideal_dst_incr= c->dst_incr= in_rate * phase_count;
@@ -198,7 +205,7 @@ AVResampleContext *av_resample_init(int out_rate, int in_rate, int filter_size,
 }
 
 void av_resample_close(AVResampleContext *c){
-    av_freep(&c->filter_bank);
+    av_filter_bank_unref(c->filter_bank);
     av_freep(&c);
 }
 
@@ -208,13 +215,32 @@ void av_resample_compensate(AVResampleContext *c, int sample_delta, int compensa
     c->dst_incr = c->ideal_dst_incr - c->ideal_dst_incr * (int64_t)sample_delta / compensation_distance;
 }
 
-int av_resample(AVResampleContext *c, short *dst, short *src, int *consumed, int src_size, int dst_size, int update_ctx){
-    int dst_index, i;
+/* Optimized versions of the inner product for the common channel
+ * counts, see av_resample_set_filter_func() */
+static av_resample_filter_func_t filter_funcs[AV_RESAMPLE_CHANNELS_MAX + 1];
+
+av_resample_filter_func_t av_resample_get_filter_func(int channels){
+    if(channels < 1 || channels > AV_RESAMPLE_CHANNELS_MAX)
+        return NULL;
+    return filter_funcs[channels];
+}
+
+void av_resample_set_filter_func(int channels, av_resample_filter_func_t func){
+    assert(channels >= 1 && channels <= AV_RESAMPLE_CHANNELS_MAX);
+    filter_funcs[channels]= func;
+}
+
+/* src and dst are interleaved, src_size and dst_size count frames */
+int av_resample(AVResampleContext *c, short *dst, short *src, int channels, int *consumed, int src_size, int dst_size, int update_ctx){
+    int dst_index, i, ch;
     int index= c->index;
     int frac= c->frac;
     int dst_incr_frac= c->dst_incr % c->src_incr;
     int dst_incr=      c->dst_incr / c->src_incr;
     int compensation_distance= c->compensation_distance;
+    av_resample_filter_func_t filter_func= av_resample_get_filter_func(channels);
+
+    assert(channels >= 1 && channels <= AV_RESAMPLE_CHANNELS_MAX);
 
   if(compensation_distance == 0 && c->filter_length == 1 && c->phase_shift==0){
         int64_t index2= ((int64_t)index)<<32;
@@ -222,7 +248,8 @@ int av_resample(AVResampleContext *c, short *dst, short *src, int *consumed, int
         dst_size= FFMIN(dst_size, (src_size-1-index) * (int64_t)c->src_incr / c->dst_incr);
 
         for(dst_index=0; dst_index < dst_size; dst_index++){
-            dst[dst_index] = src[index2>>32];
+            for(ch=0; ch<channels; ch++)
+                dst[dst_index*channels + ch] = src[(index2>>32)*channels + ch];
             index2 += incr;
         }
         frac += dst_index * dst_incr_frac;
@@ -233,32 +260,49 @@ int av_resample(AVResampleContext *c, short *dst, short *src, int *consumed, int
     for(dst_index=0; dst_index < dst_size; dst_index++){
         FELEM *filter= c->filter_bank + c->filter_length*(index & c->phase_mask);
         int sample_index= index >> c->phase_shift;
-        FELEM2 val=0;
+        FELEM2 val[AV_RESAMPLE_CHANNELS_MAX];
 
         if(sample_index < 0){
-            for(i=0; i<c->filter_length; i++)
-                val += src[FFABS(sample_index + i) % src_size] * filter[i];
+            for(ch=0; ch<channels; ch++){
+                val[ch]=0;
+                for(i=0; i<c->filter_length; i++)
+                    val[ch] += src[(FFABS(sample_index + i) % src_size)*channels + ch] * filter[i];
+            }
         }else if(sample_index + c->filter_length > src_size){
             break;
         }else if(c->linear){
-            FELEM2 v2=0;
-            for(i=0; i<c->filter_length; i++){
-                val += src[sample_index + i] * (FELEM2)filter[i];
-                v2  += src[sample_index + i] * (FELEM2)filter[i + c->filter_length];
+            for(ch=0; ch<channels; ch++){
+                FELEM2 v2=0;
+                val[ch]=0;
+                for(i=0; i<c->filter_length; i++){
+                    val[ch] += src[(sample_index + i)*channels + ch] * (FELEM2)filter[i];
+                    v2  += src[(sample_index + i)*channels + ch] * (FELEM2)filter[i + c->filter_length];
+                }
+                val[ch]+=(v2-val[ch])*(FELEML)frac / c->src_incr;
             }
-            val+=(v2-val)*(FELEML)frac / c->src_incr;
+#ifndef CONFIG_RESAMPLE_HP
+        }else if(filter_func){
+            filter_func(filter, c->filter_length, src + sample_index*channels, val);
+#endif
         }else{
-            for(i=0; i<c->filter_length; i++){
-                val += src[sample_index + i] * (FELEM2)filter[i];
+            for(ch=0; ch<channels; ch++){
+                const short *s= src + sample_index*channels + ch;
+                val[ch]=0;
+                for(i=0; i<c->filter_length; i++, s+=channels){
+                    val[ch] += *s * (FELEM2)filter[i];
+                }
             }
         }
 
+        for(ch=0; ch<channels; ch++){
+            FELEM2 v= val[ch];
 #ifdef CONFIG_RESAMPLE_AUDIOPHILE_KIDDY_MODE
-        dst[dst_index] = av_clip_int16(lrintf(val));
+            dst[dst_index*channels + ch] = av_clip_int16(lrintf(v));
 #else
-        val = (val + (1<<(FILTER_SHIFT-1)))>>FILTER_SHIFT;
-        dst[dst_index] = (unsigned)(val + 32768) > 65535 ? (val>>31) ^ 32767 : val;
+            v = (v + (1<<(FILTER_SHIFT-1)))>>FILTER_SHIFT;
+            dst[dst_index*channels + ch] = (unsigned)(v + 32768) > 65535 ? (v>>31) ^ 32767 : v;
 #endif
+        }
 
         frac += dst_incr_frac;
         index += dst_incr;
@@ -0,0 +1,168 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pulsecore/macro.h>
+#include <pulsecore/log.h>
+
+#include "cpu-x86.h"
+#include "simd-x86.h"
+#include "ffmpeg/avcodec.h"
+
+/* The polyphase filter of the ffmpeg resampler, for interleaved s16
+ * frames. Eight taps are done per iteration, with the filter
+ * coefficients repeated to line up with the channels of the frames. The
+ * products are exact in 32 bit and the sums wrap around like those of
+ * the C version, so the results are bit-identical. */
+
+#define LOAD(p) _mm_loadu_si128((const __m128i*) (p))
+
+#define FILTER_TAIL(channels)                                           \
+    do {                                                                \
+        unsigned c;                                                     \
+                                                                        \
+        for (; i < filter_length; i++)                                  \
+            for (c = 0; c < (channels); c++)                            \
+                val[c] += (int32_t) src[i * (channels) + c] * filter[i]; \
+    } while (0)
+
+/* Adds the 32 bit products of the eight samples in s with the eight
+ * coefficients in f to acc */
+static inline __m128i mul_add_s16(__m128i acc, __m128i s, __m128i f) {
+    __m128i lo = _mm_mullo_epi16(s, f);
+    __m128i hi = _mm_mulhi_epi16(s, f);
+
+    acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(lo, hi));
+    return _mm_add_epi32(acc, _mm_unpackhi_epi16(lo, hi));
+}
+
+static inline int32_t sum_s32(__m128i v) {
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+
+    return _mm_cvtsi128_si32(v);
+}
+
+static void filter_ch1_sse2(const int16_t *filter, int filter_length, const int16_t *src, int32_t *val) {
+    __m128i acc = _mm_setzero_si128();
+    int i;
+
+    /* With a single channel neighbouring products can be summed right
+     * away */
+    for (i = 0; i + 8 <= filter_length; i += 8)
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(LOAD(src + i), LOAD(filter + i)));
+
+    val[0] = sum_s32(acc);
+
+    FILTER_TAIL(1);
+}
+
+static void filter_ch2_sse2(const int16_t *filter, int filter_length, const int16_t *src, int32_t *val) {
+    __m128i acc = _mm_setzero_si128();
+    int i;
+
+    for (i = 0; i + 8 <= filter_length; i += 8) {
+        __m128i f = LOAD(filter + i);
+
+        acc = mul_add_s16(acc, LOAD(src + i * 2), _mm_unpacklo_epi16(f, f));
+        acc = mul_add_s16(acc, LOAD(src + i * 2 + 8), _mm_unpackhi_epi16(f, f));
+    }
+
+    /* Left in the even lanes, right in the odd ones */
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+    val[0] = _mm_cvtsi128_si32(acc);
+    val[1] = _mm_cvtsi128_si32(_mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 1, 1, 1)));
+
+    FILTER_TAIL(2);
+}
+
+static void filter_ch4_sse2(const int16_t *filter, int filter_length, const int16_t *src, int32_t *val) {
+    PA_DECLARE_ALIGNED(16, int32_t, v[4]);
+    __m128i acc = _mm_setzero_si128();
+    int i;
+
+    for (i = 0; i + 8 <= filter_length; i += 8) {
+        __m128i f = LOAD(filter + i);
+        __m128i fa = _mm_unpacklo_epi16(f, f), fb = _mm_unpackhi_epi16(f, f);
+
+        acc = mul_add_s16(acc, LOAD(src + i * 4), _mm_unpacklo_epi32(fa, fa));
+        acc = mul_add_s16(acc, LOAD(src + i * 4 + 8), _mm_unpackhi_epi32(fa, fa));
+        acc = mul_add_s16(acc, LOAD(src + i * 4 + 16), _mm_unpacklo_epi32(fb, fb));
+        acc = mul_add_s16(acc, LOAD(src + i * 4 + 24), _mm_unpackhi_epi32(fb, fb));
+    }
+
+    _mm_store_si128((__m128i*) v, acc);
+    val[0] = v[0];
+    val[1] = v[1];
+    val[2] = v[2];
+    val[3] = v[3];
+
+    FILTER_TAIL(4);
+}
+
+/* One frame of eight channels per vector, the coefficient broadcast to
+ * all of them */
+#define FILTER_CH8_TAP(f, k, n)                                         \
+    do {                                                                \
+        __m128i _s = LOAD(src + (i + (n)) * 8);                         \
+        __m128i _f = _mm_shuffle_epi32((f), (k) * 0x55);                \
+        __m128i _lo = _mm_mullo_epi16(_s, _f);                          \
+        __m128i _hi = _mm_mulhi_epi16(_s, _f);                          \
+                                                                        \
+        acc0 = _mm_add_epi32(acc0, _mm_unpacklo_epi16(_lo, _hi));       \
+        acc1 = _mm_add_epi32(acc1, _mm_unpackhi_epi16(_lo, _hi));       \
+    } while (0)
+
+static void filter_ch8_sse2(const int16_t *filter, int filter_length, const int16_t *src, int32_t *val) {
+    PA_DECLARE_ALIGNED(16, int32_t, v[8]);
+    __m128i acc0 = _mm_setzero_si128(), acc1 = _mm_setzero_si128();
+    int i;
+
+    for (i = 0; i + 8 <= filter_length; i += 8) {
+        __m128i f = LOAD(filter + i);
+        __m128i fa = _mm_unpacklo_epi16(f, f), fb = _mm_unpackhi_epi16(f, f);
+
+        FILTER_CH8_TAP(fa, 0, 0);
+        FILTER_CH8_TAP(fa, 1, 1);
+        FILTER_CH8_TAP(fa, 2, 2);
+        FILTER_CH8_TAP(fa, 3, 3);
+        FILTER_CH8_TAP(fb, 0, 4);
+        FILTER_CH8_TAP(fb, 1, 5);
+        FILTER_CH8_TAP(fb, 2, 6);
+        FILTER_CH8_TAP(fb, 3, 7);
+    }
+
+    _mm_store_si128((__m128i*) v, acc0);
+    _mm_store_si128((__m128i*) (v + 4), acc1);
+    memcpy(val, v, sizeof(v));
+
+    FILTER_TAIL(8);
+}
+
+void pa_ffmpeg_func_init_sse2(pa_cpu_x86_flag_t flags) {
+    pa_log_info("Initialising SSE2 optimized ffmpeg resampler functions.");
+
+    av_resample_set_filter_func(1, filter_ch1_sse2);
+    av_resample_set_filter_func(2, filter_ch2_sse2);
+    av_resample_set_filter_func(4, filter_ch4_sse2);
+    av_resample_set_filter_func(8, filter_ch8_sse2);
+}
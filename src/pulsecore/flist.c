@@ -34,11 +34,19 @@
 #include <pulsecore/macro.h>
 #include <pulsecore/core-util.h>
 #include <pulsecore/macro.h>
+#include <pulsecore/mutex.h>
+#include <pulsecore/thread.h>
+#include <pulsecore/llist.h>
 
 #include "flist.h"
 
 #define FLIST_SIZE 256
 
+/* Size of the per-thread caches of cached free lists, and how many
+ * entries are moved between a cache and the shared list at once */
+#define FLIST_CACHE_SIZE 16
+#define FLIST_CACHE_BATCH 8
+
 /* Atomic table indices contain
    sign bit = if set, indicates empty/NULL value
    tag bits (to avoid the ABA problem)
@@ -53,10 +61,38 @@ struct pa_flist_elem {
 
 typedef struct pa_flist_elem pa_flist_elem;
 
+struct flist_cache {
+    pa_flist *flist;
+
+    unsigned n;
+    void *items[FLIST_CACHE_SIZE];
+
+    /* Not yet added to the statistics of the list */
+    unsigned n_hits_pending;
+
+    PA_LLIST_FIELDS(struct flist_cache);
+};
+
 struct pa_flist {
     char *name;
     unsigned size;
 
+    /* The caches of all threads that used this list, protected by the
+     * mutex. NULL if the list is not cached. */
+    pa_tls *caches_tls;
+    pa_mutex *mutex;
+    pa_free_cb_t free_cb;
+    PA_LLIST_HEAD(struct flist_cache, caches);
+
+    pa_atomic_t n_cache_hits;
+    pa_atomic_t n_cache_misses;
+    pa_atomic_t n_push_failed;
+    pa_atomic_t n_pop_empty;
+    pa_atomic_t n_stored;
+    pa_atomic_t max_stored;
+
+    PA_LLIST_FIELDS(pa_flist);
+
     pa_atomic_t current_tag;
     int index_mask;
     int tag_shift;
@@ -69,6 +105,10 @@ struct pa_flist {
     pa_flist_elem table[];
 };
 
+/* All free lists, for the statistics */
+static pa_static_mutex registry_mutex = PA_STATIC_MUTEX_INIT;
+static PA_LLIST_HEAD(pa_flist, registry) = NULL;
+
 /* Lock free pop from linked list stack */
 static pa_flist_elem *stack_pop(pa_flist *flist, pa_atomic_t *list) {
     pa_flist_elem *popped;
@@ -101,6 +141,51 @@ static void stack_push(pa_flist *flist, pa_atomic_t *list, pa_flist_elem *new_el
     } while (!pa_atomic_cmpxchg(list, next, newindex));
 }
 
+static int shared_push(pa_flist *l, void *p);
+
+/* Called when a thread that used the list exits */
+static void cache_free_cb(void *userdata) {
+    struct flist_cache *cache = userdata;
+    pa_flist *l;
+
+    pa_assert(cache);
+
+    l = cache->flist;
+
+    pa_mutex_lock(l->mutex);
+    PA_LLIST_REMOVE(struct flist_cache, l->caches, cache);
+    pa_mutex_unlock(l->mutex);
+
+    while (cache->n > 0) {
+        void *p = cache->items[--cache->n];
+
+        if (shared_push(l, p) < 0 && l->free_cb)
+            l->free_cb(p);
+    }
+
+    pa_atomic_add(&l->n_cache_hits, (int) cache->n_hits_pending);
+    pa_xfree(cache);
+}
+
+/* No lock necessary */
+static struct flist_cache *get_cache(pa_flist *l) {
+    struct flist_cache *cache;
+
+    if ((cache = pa_tls_get(l->caches_tls)))
+        return cache;
+
+    cache = pa_xnew0(struct flist_cache, 1);
+    cache->flist = l;
+
+    pa_mutex_lock(l->mutex);
+    PA_LLIST_PREPEND(struct flist_cache, l->caches, cache);
+    pa_mutex_unlock(l->mutex);
+
+    pa_tls_set(l->caches_tls, cache);
+
+    return cache;
+}
+
 pa_flist *pa_flist_new_with_name(unsigned size, const char *name) {
     pa_flist *l;
     unsigned i;
@@ -124,6 +209,11 @@ pa_flist *pa_flist_new_with_name(unsigned size, const char *name) {
     for (i=0; i < size; i++) {
         stack_push(l, &l->empty, &l->table[i]);
     }
+
+    pa_mutex_lock(pa_static_mutex_get(&registry_mutex, FALSE, TRUE));
+    PA_LLIST_PREPEND(pa_flist, registry, l);
+    pa_mutex_unlock(pa_static_mutex_get(&registry_mutex, FALSE, TRUE));
+
     return l;
 }
 
@@ -131,10 +221,50 @@ pa_flist *pa_flist_new(unsigned size) {
     return pa_flist_new_with_name(size, "unknown");
 }
 
+pa_flist *pa_flist_new_cached(unsigned size, const char *name, pa_free_cb_t free_cb) {
+    pa_flist *l;
+
+    l = pa_flist_new_with_name(size, name);
+    l->free_cb = free_cb;
+
+    /* Without a TLS key we simply work on the shared list */
+    if ((l->caches_tls = pa_tls_new(cache_free_cb)))
+        l->mutex = pa_mutex_new(FALSE, TRUE);
+
+    return l;
+}
+
 void pa_flist_free(pa_flist *l, pa_free_cb_t free_cb) {
     pa_assert(l);
     pa_assert(l->name);
 
+    pa_mutex_lock(pa_static_mutex_get(&registry_mutex, FALSE, TRUE));
+    PA_LLIST_REMOVE(pa_flist, registry, l);
+    pa_mutex_unlock(pa_static_mutex_get(&registry_mutex, FALSE, TRUE));
+
+    if (l->caches_tls) {
+        struct flist_cache *cache;
+
+        /* Deleting the key does not run the destructors, so we take care
+         * of the caches of the threads that are still around */
+        pa_tls_free(l->caches_tls);
+
+        while ((cache = l->caches)) {
+            PA_LLIST_REMOVE(struct flist_cache, l->caches, cache);
+
+            while (cache->n > 0) {
+                void *p = cache->items[--cache->n];
+
+                if (free_cb)
+                    free_cb(p);
+            }
+
+            pa_xfree(cache);
+        }
+
+        pa_mutex_free(l->mutex);
+    }
+
     if (free_cb) {
         pa_flist_elem *elem;
         while((elem = stack_pop(l, &l->stored)))
@@ -145,13 +275,13 @@ void pa_flist_free(pa_flist *l, pa_free_cb_t free_cb) {
     pa_xfree(l);
 }
 
-int pa_flist_push(pa_flist *l, void *p) {
+static int shared_push(pa_flist *l, void *p) {
     pa_flist_elem *elem;
-    pa_assert(l);
-    pa_assert(p);
+    int n, max;
 
     elem = stack_pop(l, &l->empty);
     if (elem == NULL) {
+        pa_atomic_inc(&l->n_push_failed);
         if (pa_log_ratelimit(PA_LOG_DEBUG))
             pa_log_debug("%s flist is full (don't worry)", l->name);
         return -1;
@@ -159,21 +289,167 @@ int pa_flist_push(pa_flist *l, void *p) {
     pa_atomic_ptr_store(&elem->ptr, p);
     stack_push(l, &l->stored, elem);
 
+    /* High water mark, races only make it a bit inaccurate */
+    n = pa_atomic_inc(&l->n_stored) + 1;
+    if (n > (max = pa_atomic_load(&l->max_stored)))
+        pa_atomic_cmpxchg(&l->max_stored, max, n);
+
     return 0;
 }
 
-void* pa_flist_pop(pa_flist *l) {
+static void *shared_pop(pa_flist *l) {
     pa_flist_elem *elem;
     void *ptr;
-    pa_assert(l);
 
     elem = stack_pop(l, &l->stored);
-    if (elem == NULL)
+    if (elem == NULL) {
+        pa_atomic_inc(&l->n_pop_empty);
         return NULL;
+    }
 
     ptr = pa_atomic_ptr_load(&elem->ptr);
 
     stack_push(l, &l->empty, elem);
+    pa_atomic_dec(&l->n_stored);
 
     return ptr;
 }
+
+static void cache_miss(pa_flist *l, struct flist_cache *cache) {
+    pa_atomic_inc(&l->n_cache_misses);
+    pa_atomic_add(&l->n_cache_hits, (int) cache->n_hits_pending);
+    cache->n_hits_pending = 0;
+}
+
+int pa_flist_push(pa_flist *l, void *p) {
+    struct flist_cache *cache;
+    pa_assert(l);
+    pa_assert(p);
+
+    if (!l->caches_tls)
+        return shared_push(l, p);
+
+    cache = get_cache(l);
+
+    if (cache->n < FLIST_CACHE_SIZE) {
+        cache->items[cache->n++] = p;
+        cache->n_hits_pending++;
+        return 0;
+    }
+
+    cache_miss(l, cache);
+
+    /* Make room by handing a batch to the shared list */
+    while (cache->n > FLIST_CACHE_SIZE - FLIST_CACHE_BATCH) {
+        if (shared_push(l, cache->items[cache->n - 1]) < 0)
+            break;
+
+        cache->n--;
+    }
+
+    if (cache->n >= FLIST_CACHE_SIZE)
+        return -1;
+
+    cache->items[cache->n++] = p;
+    return 0;
+}
+
+void* pa_flist_pop(pa_flist *l) {
+    struct flist_cache *cache;
+    void *p;
+    pa_assert(l);
+
+    if (!l->caches_tls)
+        return shared_pop(l);
+
+    cache = get_cache(l);
+
+    if (cache->n > 0) {
+        cache->n_hits_pending++;
+        return cache->items[--cache->n];
+    }
+
+    cache_miss(l, cache);
+
+    /* Refill in one go, keeping one entry for the caller */
+    if (!(p = shared_pop(l)))
+        return NULL;
+
+    while (cache->n < FLIST_CACHE_BATCH - 1 && (cache->items[cache->n] = shared_pop(l)))
+        cache->n++;
+
+    return p;
+}
+
+void pa_flist_get_stat(pa_flist *l, pa_flist_stat *stat) {
+    struct flist_cache *cache;
+
+    pa_assert(l);
+    pa_assert(stat);
+
+    stat->name = l->name;
+    stat->size = l->size;
+    stat->n_cache_hits = (unsigned) pa_atomic_load(&l->n_cache_hits);
+    stat->n_cache_misses = (unsigned) pa_atomic_load(&l->n_cache_misses);
+    stat->n_push_failed = (unsigned) pa_atomic_load(&l->n_push_failed);
+    stat->n_pop_empty = (unsigned) pa_atomic_load(&l->n_pop_empty);
+    stat->n_stored = (unsigned) PA_MAX(pa_atomic_load(&l->n_stored), 0);
+    stat->max_stored = (unsigned) pa_atomic_load(&l->max_stored);
+    stat->n_cached = 0;
+
+    if (!l->caches_tls)
+        return;
+
+    /* The counters of the caches are only approximations here, they
+     * belong to other threads */
+    pa_mutex_lock(l->mutex);
+    PA_LLIST_FOREACH(cache, l->caches) {
+        stat->n_cache_hits += cache->n_hits_pending;
+        stat->n_cached += cache->n;
+    }
+    pa_mutex_unlock(l->mutex);
+}
+
+void pa_flist_dump_stats(pa_strbuf *buf) {
+    pa_flist *l;
+
+    pa_assert(buf);
+
+    pa_mutex_lock(pa_static_mutex_get(&registry_mutex, FALSE, TRUE));
+
+    PA_LLIST_FOREACH(l, registry) {
+        pa_flist_stat stat;
+
+        pa_flist_get_stat(l, &stat);
+        pa_strbuf_printf(buf, "Free list %s: size %u, stored %u (max %u), cached %u, cache hits %u, misses %u, full %u, empty %u.\n",
+                         stat.name, stat.size, stat.n_stored, stat.max_stored, stat.n_cached,
+                         stat.n_cache_hits, stat.n_cache_misses, stat.n_push_failed, stat.n_pop_empty);
+    }
+
+    pa_mutex_unlock(pa_static_mutex_get(&registry_mutex, FALSE, TRUE));
+}
+
+unsigned pa_flist_trim_all(void) {
+    pa_flist *l;
+    unsigned n = 0;
+
+    pa_mutex_lock(pa_static_mutex_get(&registry_mutex, FALSE, TRUE));
+
+    PA_LLIST_FOREACH(l, registry) {
+        void *p;
+
+        if (!l->free_cb)
+            continue;
+
+        /* Popping is safe against concurrent users, what we get is ours.
+         * The count keeps the pops of empty lists out of the statistics. */
+        while (pa_atomic_load(&l->n_stored) > 0 && (p = shared_pop(l))) {
+            l->free_cb(p);
+            n++;
+        }
+    }
+
+    pa_mutex_unlock(pa_static_mutex_get(&registry_mutex, FALSE, TRUE));
+
+    return n;
+}
@@ -27,6 +27,7 @@
 
 #include <pulsecore/once.h>
 #include <pulsecore/core-util.h>
+#include <pulsecore/strbuf.h>
 
 /* A multiple-reader multipler-write lock-free free list implementation */
 
@@ -36,12 +37,37 @@ pa_flist * pa_flist_new(unsigned size);
 /* Name string is copied and added to flist structure. The original is
  * responsibility of the caller. The name is only used for debug printing. */
 pa_flist * pa_flist_new_with_name(unsigned size, const char *name);
+/* Like pa_flist_new_with_name(), but every thread keeps a few entries
+ * for itself and only touches the shared list once per batch. free_cb is
+ * used for the entries of an exiting thread that do not fit into the
+ * shared list anymore. */
+pa_flist * pa_flist_new_cached(unsigned size, const char *name, pa_free_cb_t free_cb);
 void pa_flist_free(pa_flist *l, pa_free_cb_t free_cb);
 
 /* Please note that this routine might fail! */
 int pa_flist_push(pa_flist*l, void *p);
 void* pa_flist_pop(pa_flist*l);
 
+typedef struct pa_flist_stat {
+    const char *name;
+    unsigned size;
+    unsigned n_stored, max_stored;
+    unsigned n_cached;
+    unsigned n_cache_hits, n_cache_misses;
+    unsigned n_push_failed, n_pop_empty;
+} pa_flist_stat;
+
+/* The name is only valid as long as the list is */
+void pa_flist_get_stat(pa_flist *l, pa_flist_stat *stat);
+
+/* Print the statistics of all free lists, to help choosing their sizes */
+void pa_flist_dump_stats(pa_strbuf *buf);
+
+/* Free the entries stored in the shared part of all lists that have a
+ * free callback. The per-thread caches are left alone, they belong to
+ * their threads. Returns the number of entries freed. */
+unsigned pa_flist_trim_all(void);
+
 /* Please note that the destructor stuff is not really necessary, we do
  * this just to make valgrind output more useful. */
 
@@ -52,7 +78,7 @@ void* pa_flist_pop(pa_flist*l);
     } name##_flist = { NULL, PA_ONCE_INIT };                            \
     static void name##_flist_init(void) {                               \
         name##_flist.flist =                                            \
-            pa_flist_new_with_name(size, __FILE__ ": " #name);          \
+            pa_flist_new_cached(size, __FILE__ ": " #name, (free_cb));  \
     }                                                                   \
     static inline pa_flist* name##_flist_get(void) {                    \
         pa_run_once(&name##_flist.once, name##_flist_init);             \
@@ -0,0 +1,555 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core-util.h>
+#include <pulsecore/macro.h>
+
+#include "format-match.h"
+
+/* Only plain ints of up to this many digits are parsed here, so that
+ * we never disagree with the JSON parser about overflows */
+#define MAX_INT_DIGITS 9
+
+/* The rates that have a bit in the rate bitset */
+static const int rates[] = {
+    8000, 11025, 16000, 22050, 32000, 44100, 48000,
+    64000, 88200, 96000, 128000, 176400, 192000, 384000
+};
+
+enum key_kind {
+    KEY_OTHER,
+    KEY_RATE,
+    KEY_CHANNELS
+};
+
+enum prop_type {
+    PROP_INT,
+    PROP_STRING,
+    PROP_ARRAY,
+    PROP_RANGE
+};
+
+/* A JSON int or string */
+struct value {
+    pa_bool_t is_int;
+    int i;
+    char *s;
+};
+
+struct prop {
+    const char *key;
+    enum key_kind kind;
+    enum prop_type type;
+
+    /* PROP_INT and PROP_STRING */
+    struct value value;
+
+    /* PROP_ARRAY. If all values are ints that have a bit, the bitset is
+     * used instead of the values. */
+    struct value *values;
+    unsigned n_values;
+    pa_bool_t use_mask;
+    uint32_t mask;
+
+    /* PROP_RANGE */
+    int min, max;
+};
+
+struct pa_format_match {
+    pa_format_info *format;
+    pa_encoding_t encoding;
+
+    /* Some value could not be parsed here, so we leave the matching to
+     * pa_format_info_is_compatible() */
+    pa_bool_t fallback;
+
+    struct prop *props;
+    unsigned n_props;
+};
+
+struct pa_format_match_set {
+    pa_idxset *formats;
+    pa_format_match **matches;
+    unsigned n_matches;
+};
+
+static int value_bit(enum key_kind kind, int v) {
+    unsigned i;
+
+    switch (kind) {
+        case KEY_CHANNELS:
+            return v >= 1 && v <= (int) PA_CHANNELS_MAX ? v - 1 : -1;
+
+        case KEY_RATE:
+            for (i = 0; i < PA_ELEMENTSOF(rates); i++)
+                if (rates[i] == v)
+                    return (int) i;
+
+            return -1;
+
+        default:
+            return -1;
+    }
+}
+
+static const char* skip_space(const char *p) {
+    while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')
+        p++;
+
+    return p;
+}
+
+static int parse_int(const char **p, int *ret) {
+    const char *q = *p;
+    pa_bool_t negative = FALSE;
+    unsigned n = 0;
+    int v = 0;
+
+    if (*q == '-') {
+        negative = TRUE;
+        q++;
+    }
+
+    /* No leading zeros */
+    if (*q == '0' && q[1] >= '0' && q[1] <= '9')
+        return -1;
+
+    for (; *q >= '0' && *q <= '9'; q++) {
+        if (++n > MAX_INT_DIGITS)
+            return -1;
+
+        v = v * 10 + (*q - '0');
+    }
+
+    if (n == 0)
+        return -1;
+
+    *ret = negative ? -v : v;
+    *p = q;
+
+    return 0;
+}
+
+/* Only strings without escapes, anything else is left to the JSON
+ * parser */
+static int parse_string(const char **p, char **ret) {
+    const char *q = *p, *e;
+
+    if (*q != '"')
+        return -1;
+
+    q++;
+
+    for (e = q; *e != '"'; e++)
+        if (*e == 0 || *e == '\\' || (unsigned char) *e < 0x20)
+            return -1;
+
+    if (ret)
+        *ret = pa_xstrndup(q, (size_t) (e - q));
+
+    *p = e + 1;
+
+    return 0;
+}
+
+static int parse_value(const char **p, struct value *v) {
+    v->s = NULL;
+
+    if (**p == '"') {
+        v->is_int = FALSE;
+        return parse_string(p, &v->s);
+    }
+
+    v->is_int = TRUE;
+    return parse_int(p, &v->i);
+}
+
+static int parse_array(const char **p, struct prop *prop) {
+    const char *q = skip_space(*p + 1);
+    unsigned n_allocated = 0;
+
+    prop->values = NULL;
+    prop->n_values = 0;
+
+    if (*q != ']') {
+        for (;;) {
+            if (prop->n_values >= n_allocated) {
+                n_allocated = PA_MAX(n_allocated * 2, 8U);
+                prop->values = pa_xrenew(struct value, prop->values, n_allocated);
+            }
+
+            if (parse_value(&q, &prop->values[prop->n_values]) < 0)
+                return -1;
+
+            prop->n_values++;
+            q = skip_space(q);
+
+            if (*q == ']')
+                break;
+
+            if (*q != ',')
+                return -1;
+
+            q = skip_space(q + 1);
+        }
+    }
+
+    *p = q + 1;
+
+    return 0;
+}
+
+/* { "min": x, "max": y } in either order and nothing else */
+static int parse_range(const char **p, struct prop *prop) {
+    const char *q = skip_space(*p + 1);
+    pa_bool_t have_min = FALSE, have_max = FALSE;
+    unsigned i;
+
+    for (i = 0; i < 2; i++) {
+        pa_bool_t is_min;
+        char *k;
+        int v;
+
+        if (parse_string(&q, &k) < 0)
+            return -1;
+
+        is_min = pa_streq(k, "min");
+
+        if ((!is_min && !pa_streq(k, "max")) || (is_min ? have_min : have_max)) {
+            pa_xfree(k);
+            return -1;
+        }
+
+        pa_xfree(k);
+
+        q = skip_space(q);
+        if (*q != ':')
+            return -1;
+
+        q = skip_space(q + 1);
+        if (parse_int(&q, &v) < 0)
+            return -1;
+
+        if (is_min) {
+            prop->min = v;
+            have_min = TRUE;
+        } else {
+            prop->max = v;
+            have_max = TRUE;
+        }
+
+        q = skip_space(q);
+        if (*q != (i == 0 ? ',' : '}'))
+            return -1;
+
+        q = skip_space(q + 1);
+    }
+
+    *p = q;
+
+    return 0;
+}
+
+static void prop_done(struct prop *prop) {
+    unsigned i;
+
+    pa_xfree(prop->value.s);
+
+    for (i = 0; i < prop->n_values; i++)
+        pa_xfree(prop->values[i].s);
+
+    pa_xfree(prop->values);
+}
+
+static int prop_parse(struct prop *prop, const char *key, const char *str) {
+    const char *p;
+    int r;
+
+    memset(prop, 0, sizeof(*prop));
+    prop->key = key;
+
+    if (pa_streq(key, PA_PROP_FORMAT_RATE))
+        prop->kind = KEY_RATE;
+    else if (pa_streq(key, PA_PROP_FORMAT_CHANNELS))
+        prop->kind = KEY_CHANNELS;
+    else
+        prop->kind = KEY_OTHER;
+
+    if (!str)
+        return -1;
+
+    p = skip_space(str);
+
+    if (*p == '[') {
+        prop->type = PROP_ARRAY;
+        r = parse_array(&p, prop);
+    } else if (*p == '{') {
+        prop->type = PROP_RANGE;
+        r = parse_range(&p, prop);
+    } else {
+        r = parse_value(&p, &prop->value);
+        prop->type = prop->value.is_int ? PROP_INT : PROP_STRING;
+    }
+
+    if (r < 0 || *skip_space(p) != 0)
+        return -1;
+
+    if (prop->type == PROP_ARRAY) {
+        unsigned i;
+
+        prop->use_mask = TRUE;
+
+        for (i = 0; i < prop->n_values; i++) {
+            int bit;
+
+            if (!prop->values[i].is_int || (bit = value_bit(prop->kind, prop->values[i].i)) < 0) {
+                prop->use_mask = FALSE;
+                break;
+            }
+
+            prop->mask |= 1U << bit;
+        }
+    }
+
+    return 0;
+}
+
+static int prop_compare(const void *a, const void *b) {
+    return strcmp(((const struct prop*) a)->key, ((const struct prop*) b)->key);
+}
+
+pa_format_match* pa_format_match_new(pa_format_info *f) {
+    pa_format_match *m;
+    const char *key;
+    void *state = NULL;
+    unsigned n_allocated = 0;
+
+    pa_assert(f);
+
+    m = pa_xnew0(pa_format_match, 1);
+    m->format = f;
+    m->encoding = f->encoding;
+
+    while ((key = pa_proplist_iterate(f->plist, &state))) {
+        if (m->n_props >= n_allocated) {
+            n_allocated = PA_MAX(n_allocated * 2, 4U);
+            m->props = pa_xrenew(struct prop, m->props, n_allocated);
+        }
+
+        if (prop_parse(&m->props[m->n_props], key, pa_proplist_gets(f->plist, key)) < 0) {
+            prop_done(&m->props[m->n_props]);
+            m->fallback = TRUE;
+            break;
+        }
+
+        m->n_props++;
+    }
+
+    /* Sorted by key, so that two formats can be matched in one go */
+    if (!m->fallback && m->n_props > 1)
+        qsort(m->props, m->n_props, sizeof(struct prop), prop_compare);
+
+    return m;
+}
+
+void pa_format_match_free(pa_format_match *m) {
+    unsigned i;
+
+    pa_assert(m);
+
+    for (i = 0; i < m->n_props; i++)
+        prop_done(&m->props[i]);
+
+    pa_xfree(m->props);
+    pa_xfree(m);
+}
+
+static pa_bool_t value_equal(const struct value *a, const struct value *b) {
+    if (a->is_int != b->is_int)
+        return FALSE;
+
+    return a->is_int ? a->i == b->i : pa_streq(a->s, b->s);
+}
+
+static pa_bool_t array_contains(const struct prop *array, const struct value *v) {
+    unsigned i;
+
+    if (array->use_mask) {
+        int bit;
+
+        /* All values are ints with a bit, so anything else is not in
+         * there */
+        if (!v->is_int || (bit = value_bit(array->kind, v->i)) < 0)
+            return FALSE;
+
+        return !!(array->mask & (1U << bit));
+    }
+
+    for (i = 0; i < array->n_values; i++)
+        if (value_equal(&array->values[i], v))
+            return TRUE;
+
+    return FALSE;
+}
+
+/* The same rules as pa_format_info_prop_compatible(): one side needs to
+ * be a single value, which is then looked up in the other side */
+static pa_bool_t prop_compatible(const struct prop *a, const struct prop *b) {
+    pa_bool_t a_fixed, b_fixed;
+
+    a_fixed = a->type == PROP_INT || a->type == PROP_STRING;
+    b_fixed = b->type == PROP_INT || b->type == PROP_STRING;
+
+    if (!a_fixed && !b_fixed)
+        return FALSE;
+
+    if (a_fixed && b_fixed)
+        return value_equal(&a->value, &b->value);
+
+    if (a_fixed) {
+        const struct prop *t = a;
+        a = b;
+        b = t;
+    }
+
+    if (a->type == PROP_ARRAY)
+        return array_contains(a, &b->value);
+
+    return b->value.is_int && b->value.i >= a->min && b->value.i <= a->max;
+}
+
+pa_bool_t pa_format_match_is_compatible(const pa_format_match *first, const pa_format_match *second) {
+    unsigned i, j = 0;
+
+    pa_assert(first);
+    pa_assert(second);
+
+    if (first->encoding != second->encoding)
+        return FALSE;
+
+    if (first->fallback || second->fallback)
+        return pa_format_info_is_compatible(first->format, second->format);
+
+    /* Every property of first needs to be there in second */
+    for (i = 0; i < first->n_props; i++) {
+        int c = 1;
+
+        while (j < second->n_props && (c = strcmp(second->props[j].key, first->props[i].key)) < 0)
+            j++;
+
+        if (c != 0 || !prop_compatible(&first->props[i], &second->props[j]))
+            return FALSE;
+
+        j++;
+    }
+
+    return TRUE;
+}
+
+pa_format_match_set* pa_format_match_set_new(pa_idxset *formats) {
+    pa_format_match_set *s;
+    pa_format_info *f;
+    uint32_t idx;
+
+    pa_assert(formats);
+
+    s = pa_xnew0(pa_format_match_set, 1);
+    s->formats = formats;
+    s->matches = pa_xnew(pa_format_match*, PA_MAX(pa_idxset_size(formats), 1U));
+
+    PA_IDXSET_FOREACH(f, formats, idx)
+        s->matches[s->n_matches++] = pa_format_match_new(f);
+
+    return s;
+}
+
+void pa_format_match_set_free(pa_format_match_set *s) {
+    unsigned i;
+
+    pa_assert(s);
+
+    for (i = 0; i < s->n_matches; i++)
+        pa_format_match_free(s->matches[i]);
+
+    pa_xfree(s->matches);
+    pa_idxset_free(s->formats, (pa_free_cb_t) pa_format_info_free);
+    pa_xfree(s);
+}
+
+pa_bool_t pa_format_match_set_check(pa_format_match_set *s, pa_format_info *f) {
+    pa_format_match *m;
+    pa_bool_t ret = FALSE;
+    unsigned i;
+
+    pa_assert(s);
+    pa_assert(f);
+
+    m = pa_format_match_new(f);
+
+    for (i = 0; i < s->n_matches; i++)
+        if (pa_format_match_is_compatible(s->matches[i], m)) {
+            ret = TRUE;
+            break;
+        }
+
+    pa_format_match_free(m);
+
+    return ret;
+}
+
+pa_idxset* pa_format_match_set_intersect(pa_format_match_set *s, pa_idxset *in_formats) {
+    pa_idxset *out_formats;
+    pa_format_match **in_matches;
+    pa_format_info *f;
+    unsigned i, j, n = 0;
+    uint32_t idx;
+
+    pa_assert(s);
+    pa_assert(in_formats);
+
+    out_formats = pa_idxset_new(NULL, NULL);
+
+    /* Every input format is parsed only once, not once per format of
+     * the set */
+    in_matches = pa_xnew(pa_format_match*, PA_MAX(pa_idxset_size(in_formats), 1U));
+
+    PA_IDXSET_FOREACH(f, in_formats, idx)
+        in_matches[n++] = pa_format_match_new(f);
+
+    for (i = 0; i < s->n_matches; i++)
+        for (j = 0; j < n; j++)
+            if (pa_format_match_is_compatible(s->matches[i], in_matches[j]))
+                pa_idxset_put(out_formats, pa_format_info_copy(in_matches[j]->format), NULL);
+
+    for (j = 0; j < n; j++)
+        pa_format_match_free(in_matches[j]);
+
+    pa_xfree(in_matches);
+
+    return out_formats;
+}
@@ -0,0 +1,58 @@
+#ifndef foopulsecoreformatmatchhfoo
+#define foopulsecoreformatmatchhfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <pulse/format.h>
+
+#include <pulsecore/idxset.h>
+#include <pulsecore/macro.h>
+
+/* A pa_format_info with its properties parsed once, so that it can be
+ * matched against others without going through the JSON strings every
+ * time. Supported rates and channel counts are kept as bitsets. The
+ * result is always the same as with pa_format_info_is_compatible(),
+ * which is used for the values that cannot be parsed here. */
+
+typedef struct pa_format_match pa_format_match;
+
+/* f is not copied and needs to stay around for as long as the match
+ * does */
+pa_format_match* pa_format_match_new(pa_format_info *f);
+void pa_format_match_free(pa_format_match *m);
+
+pa_bool_t pa_format_match_is_compatible(const pa_format_match *first, const pa_format_match *second);
+
+/* The formats of a device, parsed once and kept until the device
+ * formats change */
+typedef struct pa_format_match_set pa_format_match_set;
+
+/* Takes ownership of formats, an idxset of pa_format_info */
+pa_format_match_set* pa_format_match_set_new(pa_idxset *formats);
+void pa_format_match_set_free(pa_format_match_set *s);
+
+/* Whether any format of the set is compatible with f */
+pa_bool_t pa_format_match_set_check(pa_format_match_set *s, pa_format_info *f);
+
+/* Copies of the formats of in_formats that are compatible with the set,
+ * in the order of the formats in the set */
+pa_idxset* pa_format_match_set_intersect(pa_format_match_set *s, pa_idxset *in_formats);
+
+#endif
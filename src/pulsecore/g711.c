@@ -262,7 +262,7 @@ int16_t st_ulaw2linear16(
 
 #ifdef FAST_ALAW_CONVERSION
 
-int16_t _st_alaw2linear16[256] = {
+const int16_t _st_alaw2linear16[256] = {
      -5504,   -5248,   -6016,   -5760,   -4480,   -4224,   -4992,
      -4736,   -7552,   -7296,   -8064,   -7808,   -6528,   -6272,
      -7040,   -6784,   -2752,   -2624,   -3008,   -2880,   -2240,
@@ -302,7 +302,7 @@ int16_t _st_alaw2linear16[256] = {
        816,     784,     880,     848
 };
 
-uint8_t _st_13linear2alaw[0x2000] = {
+const uint8_t _st_13linear2alaw[0x2000] = {
    0x2a, 0x2a, 0x2a, 0x2a, 0x2a, 0x2a, 0x2a, 0x2a, 0x2a, 0x2a, 0x2a, 0x2a,
    0x2a, 0x2a, 0x2a, 0x2a, 0x2a, 0x2a, 0x2a, 0x2a, 0x2a, 0x2a, 0x2a, 0x2a,
    0x2a, 0x2a, 0x2a, 0x2a, 0x2a, 0x2a, 0x2a, 0x2a, 0x2a, 0x2a, 0x2a, 0x2a,
@@ -992,7 +992,7 @@ uint8_t _st_13linear2alaw[0x2000] = {
 
 #ifdef FAST_ULAW_CONVERSION
 
-int16_t _st_ulaw2linear16[256] = {
+const int16_t _st_ulaw2linear16[256] = {
     -32124,  -31100,  -30076,  -29052,  -28028,  -27004,  -25980,
     -24956,  -23932,  -22908,  -21884,  -20860,  -19836,  -18812,
     -17788,  -16764,  -15996,  -15484,  -14972,  -14460,  -13948,
@@ -1032,7 +1032,7 @@ int16_t _st_ulaw2linear16[256] = {
         24,      16,       8,       0
 };
 
-uint8_t _st_14linear2ulaw[0x4000] = {
+const uint8_t _st_14linear2ulaw[0x4000] = {
    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
@@ -17,21 +17,26 @@
 
 #include <inttypes.h>
 
+/* Decode through 256 entry tables and encode through 13 and 14 bit
+ * tables instead of searching for the segment of every sample */
+#define FAST_ALAW_CONVERSION
+#define FAST_ULAW_CONVERSION
+
 #ifdef FAST_ALAW_CONVERSION
-extern uint8_t _st_13linear2alaw[0x2000];
-extern int16_t _st_alaw2linear16[256];
-#define st_13linear2alaw(sw) (_st_13linear2alaw[(sw + 0x1000)])
-#define st_alaw2linear16(uc) (_st_alaw2linear16[uc])
+extern const uint8_t _st_13linear2alaw[0x2000];
+extern const int16_t _st_alaw2linear16[256];
+#define st_13linear2alaw(sw) (_st_13linear2alaw[(sw) + 0x1000])
+#define st_alaw2linear16(uc) (_st_alaw2linear16[(uint8_t) (uc)])
 #else
 unsigned char st_13linear2alaw(int16_t pcm_val);
 int16_t st_alaw2linear16(unsigned char);
 #endif
 
 #ifdef FAST_ULAW_CONVERSION
-extern uint8_t _st_14linear2ulaw[0x4000];
-extern int16_t _st_ulaw2linear16[256];
-#define st_14linear2ulaw(sw) (_st_14linear2ulaw[(sw + 0x2000)])
-#define st_ulaw2linear16(uc) (_st_ulaw2linear16[uc])
+extern const uint8_t _st_14linear2ulaw[0x4000];
+extern const int16_t _st_ulaw2linear16[256];
+#define st_14linear2ulaw(sw) (_st_14linear2ulaw[(sw) + 0x2000])
+#define st_ulaw2linear16(uc) (_st_ulaw2linear16[(uint8_t) (uc)])
 #else
 unsigned char st_14linear2ulaw(int16_t pcm_val);
 int16_t st_ulaw2linear16(unsigned char);
@@ -32,11 +32,15 @@
 
 #include "hashmap.h"
 
-#define NBUCKETS 127
+/* The number of buckets is a power of two and doubled whenever there
+ * are more entries than buckets. The first buckets are stored inline,
+ * most hashmaps never grow beyond that. */
+#define NBUCKETS_MIN 16
 
 struct hashmap_entry {
     const void *key;
     void *value;
+    unsigned hash;
 
     struct hashmap_entry *bucket_next, *bucket_previous;
     struct hashmap_entry *iterate_next, *iterate_previous;
@@ -46,28 +50,61 @@ struct pa_hashmap {
     pa_hash_func_t hash_func;
     pa_compare_func_t compare_func;
 
+    struct hashmap_entry **buckets;
+    unsigned n_buckets;
+
     struct hashmap_entry *iterate_list_head, *iterate_list_tail;
     unsigned n_entries;
-};
 
-#define BY_HASH(h) ((struct hashmap_entry**) ((uint8_t*) (h) + PA_ALIGN(sizeof(pa_hashmap))))
+    struct hashmap_entry *initial_buckets[NBUCKETS_MIN];
+};
 
 PA_STATIC_FLIST_DECLARE(entries, 0, pa_xfree);
 
 pa_hashmap *pa_hashmap_new(pa_hash_func_t hash_func, pa_compare_func_t compare_func) {
     pa_hashmap *h;
 
-    h = pa_xmalloc0(PA_ALIGN(sizeof(pa_hashmap)) + NBUCKETS*sizeof(struct hashmap_entry*));
+    h = pa_xnew0(pa_hashmap, 1);
 
     h->hash_func = hash_func ? hash_func : pa_idxset_trivial_hash_func;
     h->compare_func = compare_func ? compare_func : pa_idxset_trivial_compare_func;
 
+    h->buckets = h->initial_buckets;
+    h->n_buckets = NBUCKETS_MIN;
+
     h->n_entries = 0;
     h->iterate_list_head = h->iterate_list_tail = NULL;
 
     return h;
 }
 
+static unsigned bucket_of(pa_hashmap *h, unsigned hash) {
+    return pa_idxset_hash_mix(hash) & (h->n_buckets - 1);
+}
+
+static void bucket_insert(pa_hashmap *h, struct hashmap_entry *e) {
+    struct hashmap_entry **b = h->buckets + bucket_of(h, e->hash);
+
+    e->bucket_next = *b;
+    e->bucket_previous = NULL;
+    if (*b)
+        (*b)->bucket_previous = e;
+    *b = e;
+}
+
+static void grow(pa_hashmap *h) {
+    struct hashmap_entry *e;
+
+    if (h->buckets != h->initial_buckets)
+        pa_xfree(h->buckets);
+
+    h->n_buckets *= 2;
+    h->buckets = pa_xnew0(struct hashmap_entry*, h->n_buckets);
+
+    for (e = h->iterate_list_head; e; e = e->iterate_next)
+        bucket_insert(h, e);
+}
+
 static void remove_entry(pa_hashmap *h, struct hashmap_entry *e) {
     pa_assert(h);
     pa_assert(e);
@@ -89,10 +126,8 @@ static void remove_entry(pa_hashmap *h, struct hashmap_entry *e) {
 
     if (e->bucket_previous)
         e->bucket_previous->bucket_next = e->bucket_next;
-    else {
-        unsigned hash = h->hash_func(e->key) % NBUCKETS;
-        BY_HASH(h)[hash] = e->bucket_next;
-    }
+    else
+        h->buckets[bucket_of(h, e->hash)] = e->bucket_next;
 
     if (pa_flist_push(PA_STATIC_FLIST_GET(entries), e) < 0)
         pa_xfree(e);
@@ -105,16 +140,19 @@ void pa_hashmap_free(pa_hashmap *h, pa_free_cb_t free_cb) {
     pa_assert(h);
 
     pa_hashmap_remove_all(h, free_cb);
+
+    if (h->buckets != h->initial_buckets)
+        pa_xfree(h->buckets);
+
     pa_xfree(h);
 }
 
 static struct hashmap_entry *hash_scan(pa_hashmap *h, unsigned hash, const void *key) {
     struct hashmap_entry *e;
     pa_assert(h);
-    pa_assert(hash < NBUCKETS);
 
-    for (e = BY_HASH(h)[hash]; e; e = e->bucket_next)
-        if (h->compare_func(e->key, key) == 0)
+    for (e = h->buckets[bucket_of(h, hash)]; e; e = e->bucket_next)
+        if (e->hash == hash && h->compare_func(e->key, key) == 0)
             return e;
 
     return NULL;
@@ -126,7 +164,7 @@ int pa_hashmap_put(pa_hashmap *h, const void *key, void *value) {
 
     pa_assert(h);
 
-    hash = h->hash_func(key) % NBUCKETS;
+    hash = h->hash_func(key);
 
     if (hash_scan(h, hash, key))
         return -1;
@@ -136,13 +174,10 @@ int pa_hashmap_put(pa_hashmap *h, const void *key, void *value) {
 
     e->key = key;
     e->value = value;
+    e->hash = hash;
 
     /* Insert into hash table */
-    e->bucket_next = BY_HASH(h)[hash];
-    e->bucket_previous = NULL;
-    if (BY_HASH(h)[hash])
-        BY_HASH(h)[hash]->bucket_previous = e;
-    BY_HASH(h)[hash] = e;
+    bucket_insert(h, e);
 
     /* Insert into iteration list */
     e->iterate_previous = h->iterate_list_tail;
@@ -159,6 +194,9 @@ int pa_hashmap_put(pa_hashmap *h, const void *key, void *value) {
     h->n_entries++;
     pa_assert(h->n_entries >= 1);
 
+    if (h->n_entries > h->n_buckets)
+        grow(h);
+
     return 0;
 }
 
@@ -168,7 +206,7 @@ void* pa_hashmap_get(pa_hashmap *h, const void *key) {
 
     pa_assert(h);
 
-    hash = h->hash_func(key) % NBUCKETS;
+    hash = h->hash_func(key);
 
     if (!(e = hash_scan(h, hash, key)))
         return NULL;
@@ -183,7 +221,7 @@ void* pa_hashmap_remove(pa_hashmap *h, const void *key) {
 
     pa_assert(h);
 
-    hash = h->hash_func(key) % NBUCKETS;
+    hash = h->hash_func(key);
 
     if (!(e = hash_scan(h, hash, key)))
         return NULL;
@@ -29,11 +29,72 @@
 
 #include "hook-list.h"
 
+/* An immutable copy of the slot list. Firings keep a reference, so
+ * that slots may be connected and freed again from within callbacks. */
+struct pa_hook_snapshot {
+    unsigned ref;
+    unsigned n;
+    struct {
+        pa_hook_slot *slot;
+        pa_hook_cb_t callback;
+        void *data;
+    } entries[];
+};
+
+static void snapshot_unref(pa_hook_snapshot *s) {
+    pa_assert(s);
+    pa_assert(s->ref >= 1);
+
+    if (--s->ref <= 0)
+        pa_xfree(s);
+}
+
+static void invalidate_snapshot(pa_hook *hook) {
+    pa_assert(hook);
+
+    if (hook->snapshot) {
+        snapshot_unref(hook->snapshot);
+        hook->snapshot = NULL;
+    }
+}
+
+static pa_hook_snapshot* get_snapshot(pa_hook *hook) {
+    pa_hook_snapshot *s;
+    pa_hook_slot *slot;
+    unsigned n = 0;
+
+    pa_assert(hook);
+
+    if (hook->snapshot)
+        return hook->snapshot;
+
+    PA_LLIST_FOREACH(slot, hook->slots)
+        if (!slot->dead)
+            n++;
+
+    s = pa_xmalloc(sizeof(pa_hook_snapshot) + n * sizeof(s->entries[0]));
+    s->ref = 1;
+    s->n = 0;
+
+    PA_LLIST_FOREACH(slot, hook->slots) {
+        if (slot->dead)
+            continue;
+
+        s->entries[s->n].slot = slot;
+        s->entries[s->n].callback = slot->callback;
+        s->entries[s->n].data = slot->data;
+        s->n++;
+    }
+
+    return hook->snapshot = s;
+}
+
 void pa_hook_init(pa_hook *hook, void *data) {
     pa_assert(hook);
 
     PA_LLIST_HEAD_INIT(pa_hook_slot, hook->slots);
     hook->n_dead = hook->n_firing = 0;
+    hook->snapshot = NULL;
     hook->data = data;
 }
 
@@ -50,6 +111,8 @@ void pa_hook_done(pa_hook *hook) {
     pa_assert(hook);
     pa_assert(hook->n_firing == 0);
 
+    invalidate_snapshot(hook);
+
     while (hook->slots)
         slot_free(hook, hook->slots);
 
@@ -76,6 +139,7 @@ pa_hook_slot* pa_hook_connect(pa_hook *hook, pa_hook_priority_t prio, pa_hook_cb
     }
 
     PA_LLIST_INSERT_AFTER(pa_hook_slot, hook->slots, prev, slot);
+    invalidate_snapshot(hook);
 
     return slot;
 }
@@ -84,6 +148,8 @@ void pa_hook_slot_free(pa_hook_slot *slot) {
     pa_assert(slot);
     pa_assert(!slot->dead);
 
+    invalidate_snapshot(slot->hook);
+
     if (slot->hook->n_firing > 0) {
         slot->dead = TRUE;
         slot->hook->n_dead++;
@@ -93,23 +159,39 @@ void pa_hook_slot_free(pa_hook_slot *slot) {
 
 pa_hook_result_t pa_hook_fire(pa_hook *hook, void *data) {
     pa_hook_slot *slot, *next;
+    pa_hook_snapshot *s;
     pa_hook_result_t result = PA_HOOK_OK;
+    unsigned i;
 
     pa_assert(hook);
 
+    if (!hook->slots)
+        return PA_HOOK_OK;
+
+    s = get_snapshot(hook);
+    s->ref++;
+
     hook->n_firing ++;
 
-    PA_LLIST_FOREACH(slot, hook->slots) {
-        if (slot->dead)
+    /* Slots connected by a callback are called from the next firing on,
+     * slots freed by one are not called anymore. */
+    for (i = 0; i < s->n; i++) {
+        if (PA_UNLIKELY(hook->n_dead > 0) && s->entries[i].slot->dead)
             continue;
 
-        if ((result = slot->callback(hook->data, data, slot->data)) != PA_HOOK_OK)
+        if ((result = s->entries[i].callback(hook->data, data, s->entries[i].data)) != PA_HOOK_OK)
             break;
     }
 
     hook->n_firing --;
     pa_assert(hook->n_firing >= 0);
 
+    snapshot_unref(s);
+
+    /* Outer firings might still look at dead slots */
+    if (hook->n_firing > 0)
+        return result;
+
     for (slot = hook->slots; hook->n_dead > 0 && slot; slot = next) {
         next = slot->next;
 
@@ -26,6 +26,7 @@
 
 typedef struct pa_hook_slot pa_hook_slot;
 typedef struct pa_hook pa_hook;
+typedef struct pa_hook_snapshot pa_hook_snapshot;
 
 typedef enum pa_hook_result {
     PA_HOOK_OK = 0,
@@ -57,6 +58,10 @@ struct pa_hook {
     PA_LLIST_HEAD(pa_hook_slot, slots);
     int n_firing, n_dead;
 
+    /* The live slots in the order they are called, built on the first
+     * pa_hook_fire() after a slot was connected or freed */
+    pa_hook_snapshot *snapshot;
+
     void *data;
 };
 
@@ -34,11 +34,21 @@
 
 #include "idxset.h"
 
-#define NBUCKETS 127
+/* The number of buckets is a power of two and doubled whenever there
+ * are more entries than buckets. The first buckets are stored inline,
+ * most idxsets never grow beyond that. */
+#define NBUCKETS_MIN 16
+
+/* The most recently handed out indexes, [slots_base, current_index), are
+ * kept in a ring of slots, so that resolving them is a plain array
+ * access. Only entries that fall out of that window, i.e. long lived
+ * ones, are put into the index hash table. */
+#define NSLOTS_MIN 16
 
 struct idxset_entry {
     uint32_t idx;
     void *data;
+    unsigned hash;
 
     struct idxset_entry *data_next, *data_previous;
     struct idxset_entry *index_next, *index_previous;
@@ -51,12 +61,23 @@ struct pa_idxset {
 
     uint32_t current_index;
 
+    /* n_buckets by data, followed by n_buckets by index */
+    struct idxset_entry **buckets;
+    unsigned n_buckets;
+
+    struct idxset_entry **slots;
+    unsigned n_slots, n_slots_used;
+    uint32_t slots_base;
+
     struct idxset_entry *iterate_list_head, *iterate_list_tail;
     unsigned n_entries;
+
+    struct idxset_entry *initial_buckets[NBUCKETS_MIN*2];
+    struct idxset_entry *initial_slots[NSLOTS_MIN];
 };
 
-#define BY_DATA(i) ((struct idxset_entry**) ((uint8_t*) (i) + PA_ALIGN(sizeof(pa_idxset))))
-#define BY_INDEX(i) (BY_DATA(i) + NBUCKETS)
+#define BY_DATA(i) ((i)->buckets)
+#define BY_INDEX(i) ((i)->buckets + (i)->n_buckets)
 
 PA_STATIC_FLIST_DECLARE(entries, 0, pa_xfree);
 
@@ -85,11 +106,17 @@ int pa_idxset_trivial_compare_func(const void *a, const void *b) {
 pa_idxset* pa_idxset_new(pa_hash_func_t hash_func, pa_compare_func_t compare_func) {
     pa_idxset *s;
 
-    s = pa_xmalloc0(PA_ALIGN(sizeof(pa_idxset)) + NBUCKETS*2*sizeof(struct idxset_entry*));
+    s = pa_xnew0(pa_idxset, 1);
 
     s->hash_func = hash_func ? hash_func : pa_idxset_trivial_hash_func;
     s->compare_func = compare_func ? compare_func : pa_idxset_trivial_compare_func;
 
+    s->buckets = s->initial_buckets;
+    s->n_buckets = NBUCKETS_MIN;
+
+    s->slots = s->initial_slots;
+    s->n_slots = NSLOTS_MIN;
+
     s->current_index = 0;
     s->n_entries = 0;
     s->iterate_list_head = s->iterate_list_tail = NULL;
@@ -97,6 +124,102 @@ pa_idxset* pa_idxset_new(pa_hash_func_t hash_func, pa_compare_func_t compare_fun
     return s;
 }
 
+static unsigned data_bucket(pa_idxset *s, unsigned hash) {
+    return pa_idxset_hash_mix(hash) & (s->n_buckets - 1);
+}
+
+static unsigned index_bucket(pa_idxset *s, uint32_t idx) {
+    /* Indexes are handed out sequentially, no need to mix them */
+    return idx & (s->n_buckets - 1);
+}
+
+static pa_bool_t in_slots(pa_idxset *s, uint32_t idx) {
+    /* Unsigned arithmetic, so this is slots_base <= idx < current_index */
+    return idx - s->slots_base < s->current_index - s->slots_base;
+}
+
+static struct idxset_entry **slot(pa_idxset *s, uint32_t idx) {
+    return s->slots + (idx & (s->n_slots - 1));
+}
+
+static void data_link(pa_idxset *s, struct idxset_entry *e) {
+    struct idxset_entry **b = BY_DATA(s) + data_bucket(s, e->hash);
+
+    e->data_next = *b;
+    e->data_previous = NULL;
+    if (*b)
+        (*b)->data_previous = e;
+    *b = e;
+}
+
+static void index_link(pa_idxset *s, struct idxset_entry *e) {
+    struct idxset_entry **b = BY_INDEX(s) + index_bucket(s, e->idx);
+
+    e->index_next = *b;
+    e->index_previous = NULL;
+    if (*b)
+        (*b)->index_previous = e;
+    *b = e;
+}
+
+static void grow(pa_idxset *s) {
+    struct idxset_entry *e;
+
+    if (s->buckets != s->initial_buckets)
+        pa_xfree(s->buckets);
+
+    s->n_buckets *= 2;
+    s->buckets = pa_xnew0(struct idxset_entry*, s->n_buckets * 2);
+
+    for (e = s->iterate_list_head; e; e = e->iterate_next) {
+        data_link(s, e);
+
+        if (!in_slots(s, e->idx))
+            index_link(s, e);
+    }
+}
+
+/* Moves all entries below the new base from the slots to the index hash
+ * table */
+static void slots_advance(pa_idxset *s, uint32_t base) {
+    for (; s->slots_base != base; s->slots_base++) {
+        struct idxset_entry **e = slot(s, s->slots_base);
+
+        if (!*e)
+            continue;
+
+        index_link(s, *e);
+        *e = NULL;
+        s->n_slots_used--;
+    }
+}
+
+/* Called before handing out a new index if the window is full */
+static void slots_make_room(pa_idxset *s) {
+    struct idxset_entry **old;
+    unsigned n_old;
+    uint32_t i;
+
+    if (s->n_slots_used <= s->n_slots / 2) {
+        /* Mostly empty, so rather drop the older half of the window than
+         * letting a few long lived entries keep it growing */
+        slots_advance(s, s->current_index - s->n_slots / 2);
+        return;
+    }
+
+    old = s->slots;
+    n_old = s->n_slots;
+
+    s->n_slots *= 2;
+    s->slots = pa_xnew0(struct idxset_entry*, s->n_slots);
+
+    for (i = s->slots_base; i != s->current_index; i++)
+        *slot(s, i) = old[i & (n_old - 1)];
+
+    if (old != s->initial_slots)
+        pa_xfree(old);
+}
+
 static void remove_entry(pa_idxset *s, struct idxset_entry *e) {
     pa_assert(s);
     pa_assert(e);
@@ -118,19 +241,28 @@ static void remove_entry(pa_idxset *s, struct idxset_entry *e) {
 
     if (e->data_previous)
         e->data_previous->data_next = e->data_next;
-    else {
-        unsigned hash = s->hash_func(e->data) % NBUCKETS;
-        BY_DATA(s)[hash] = e->data_next;
-    }
+    else
+        BY_DATA(s)[data_bucket(s, e->hash)] = e->data_next;
 
-    /* Remove from index hash table */
-    if (e->index_next)
-        e->index_next->index_previous = e->index_previous;
+    if (in_slots(s, e->idx)) {
+        *slot(s, e->idx) = NULL;
+        s->n_slots_used--;
 
-    if (e->index_previous)
-        e->index_previous->index_next = e->index_next;
-    else
-        BY_INDEX(s)[e->idx % NBUCKETS] = e->index_next;
+        /* Skip leading empty slots, so that the window only covers what
+         * is still in use */
+        while (s->slots_base != s->current_index && !*slot(s, s->slots_base))
+            s->slots_base++;
+
+    } else {
+        /* Remove from index hash table */
+        if (e->index_next)
+            e->index_next->index_previous = e->index_previous;
+
+        if (e->index_previous)
+            e->index_previous->index_next = e->index_next;
+        else
+            BY_INDEX(s)[index_bucket(s, e->idx)] = e->index_next;
+    }
 
     if (pa_flist_push(PA_STATIC_FLIST_GET(entries), e) < 0)
         pa_xfree(e);
@@ -143,28 +275,36 @@ void pa_idxset_free(pa_idxset *s, pa_free_cb_t free_cb) {
     pa_assert(s);
 
     pa_idxset_remove_all(s, free_cb);
+
+    if (s->buckets != s->initial_buckets)
+        pa_xfree(s->buckets);
+
+    if (s->slots != s->initial_slots)
+        pa_xfree(s->slots);
+
     pa_xfree(s);
 }
 
 static struct idxset_entry* data_scan(pa_idxset *s, unsigned hash, const void *p) {
     struct idxset_entry *e;
     pa_assert(s);
-    pa_assert(hash < NBUCKETS);
     pa_assert(p);
 
-    for (e = BY_DATA(s)[hash]; e; e = e->data_next)
-        if (s->compare_func(e->data, p) == 0)
+    for (e = BY_DATA(s)[data_bucket(s, hash)]; e; e = e->data_next)
+        if (e->hash == hash && s->compare_func(e->data, p) == 0)
             return e;
 
     return NULL;
 }
 
-static struct idxset_entry* index_scan(pa_idxset *s, unsigned hash, uint32_t idx) {
+static struct idxset_entry* index_scan(pa_idxset *s, uint32_t idx) {
     struct idxset_entry *e;
     pa_assert(s);
-    pa_assert(hash < NBUCKETS);
 
-    for (e = BY_INDEX(s)[hash]; e; e = e->index_next)
+    if (in_slots(s, idx))
+        return *slot(s, idx);
+
+    for (e = BY_INDEX(s)[index_bucket(s, idx)]; e; e = e->index_next)
         if (e->idx == idx)
             return e;
 
@@ -177,7 +317,7 @@ int pa_idxset_put(pa_idxset*s, void *p, uint32_t *idx) {
 
     pa_assert(s);
 
-    hash = s->hash_func(p) % NBUCKETS;
+    hash = s->hash_func(p);
 
     if ((e = data_scan(s, hash, p))) {
         if (idx)
@@ -189,24 +329,18 @@ int pa_idxset_put(pa_idxset*s, void *p, uint32_t *idx) {
     if (!(e = pa_flist_pop(PA_STATIC_FLIST_GET(entries))))
         e = pa_xnew(struct idxset_entry, 1);
 
+    if (s->current_index - s->slots_base >= s->n_slots)
+        slots_make_room(s);
+
     e->data = p;
+    e->hash = hash;
     e->idx = s->current_index++;
 
-    /* Insert into data hash table */
-    e->data_next = BY_DATA(s)[hash];
-    e->data_previous = NULL;
-    if (BY_DATA(s)[hash])
-        BY_DATA(s)[hash]->data_previous = e;
-    BY_DATA(s)[hash] = e;
-
-    hash = e->idx % NBUCKETS;
+    /* Insert into data hash table and index slots */
+    data_link(s, e);
 
-    /* Insert into index hash table */
-    e->index_next = BY_INDEX(s)[hash];
-    e->index_previous = NULL;
-    if (BY_INDEX(s)[hash])
-        BY_INDEX(s)[hash]->index_previous = e;
-    BY_INDEX(s)[hash] = e;
+    *slot(s, e->idx) = e;
+    s->n_slots_used++;
 
     /* Insert into iteration list */
     e->iterate_previous = s->iterate_list_tail;
@@ -223,6 +357,9 @@ int pa_idxset_put(pa_idxset*s, void *p, uint32_t *idx) {
     s->n_entries++;
     pa_assert(s->n_entries >= 1);
 
+    if (s->n_entries > s->n_buckets)
+        grow(s);
+
     if (idx)
         *idx = e->idx;
 
@@ -230,14 +367,11 @@ int pa_idxset_put(pa_idxset*s, void *p, uint32_t *idx) {
 }
 
 void* pa_idxset_get_by_index(pa_idxset*s, uint32_t idx) {
-    unsigned hash;
     struct idxset_entry *e;
 
     pa_assert(s);
 
-    hash = idx % NBUCKETS;
-
-    if (!(e = index_scan(s, hash, idx)))
+    if (!(e = index_scan(s, idx)))
         return NULL;
 
     return e->data;
@@ -249,7 +383,7 @@ void* pa_idxset_get_by_data(pa_idxset*s, const void *p, uint32_t *idx) {
 
     pa_assert(s);
 
-    hash = s->hash_func(p) % NBUCKETS;
+    hash = s->hash_func(p);
 
     if (!(e = data_scan(s, hash, p)))
         return NULL;
@@ -262,14 +396,11 @@ void* pa_idxset_get_by_data(pa_idxset*s, const void *p, uint32_t *idx) {
 
 void* pa_idxset_remove_by_index(pa_idxset*s, uint32_t idx) {
     struct idxset_entry *e;
-    unsigned hash;
     void *data;
 
     pa_assert(s);
 
-    hash = idx % NBUCKETS;
-
-    if (!(e = index_scan(s, hash, idx)))
+    if (!(e = index_scan(s, idx)))
         return NULL;
 
     data = e->data;
@@ -285,7 +416,7 @@ void* pa_idxset_remove_by_data(pa_idxset*s, const void *data, uint32_t *idx) {
 
     pa_assert(s);
 
-    hash = s->hash_func(data) % NBUCKETS;
+    hash = s->hash_func(data);
 
     if (!(e = data_scan(s, hash, data)))
         return NULL;
@@ -314,15 +445,12 @@ void pa_idxset_remove_all(pa_idxset *s, pa_free_cb_t free_cb) {
 }
 
 void* pa_idxset_rrobin(pa_idxset *s, uint32_t *idx) {
-    unsigned hash;
     struct idxset_entry *e;
 
     pa_assert(s);
     pa_assert(idx);
 
-    hash = *idx % NBUCKETS;
-
-    e = index_scan(s, hash, *idx);
+    e = index_scan(s, *idx);
 
     if (e && e->iterate_next)
         e = e->iterate_next;
@@ -404,7 +532,6 @@ void* pa_idxset_first(pa_idxset *s, uint32_t *idx) {
 
 void *pa_idxset_next(pa_idxset *s, uint32_t *idx) {
     struct idxset_entry *e;
-    unsigned hash;
 
     pa_assert(s);
     pa_assert(idx);
@@ -412,9 +539,7 @@ void *pa_idxset_next(pa_idxset *s, uint32_t *idx) {
     if (*idx == PA_IDXSET_INVALID)
         return NULL;
 
-    hash = *idx % NBUCKETS;
-
-    if ((e = index_scan(s, hash, *idx))) {
+    if ((e = index_scan(s, *idx))) {
 
         e = e->iterate_next;
 
@@ -433,9 +558,7 @@ void *pa_idxset_next(pa_idxset *s, uint32_t *idx) {
 
         for ((*idx)++; *idx < s->current_index; (*idx)++) {
 
-            hash = *idx % NBUCKETS;
-
-            if ((e = index_scan(s, hash, *idx))) {
+            if ((e = index_scan(s, *idx))) {
                 *idx = e->idx;
                 return e->data;
             }
@@ -47,6 +47,16 @@ int pa_idxset_trivial_compare_func(const void *a, const void *b);
 unsigned pa_idxset_string_hash_func(const void *p);
 int pa_idxset_string_compare_func(const void *a, const void *b);
 
+/* Spreads the bits of a hash value, so that its low bits are good for
+ * picking a bucket. Pointers tend to be aligned, for example. */
+static inline unsigned pa_idxset_hash_mix(unsigned hash) {
+    hash ^= hash >> 16;
+    hash *= 0x45d9f3bU;
+    hash ^= hash >> 16;
+
+    return hash;
+}
+
 typedef unsigned (*pa_hash_func_t)(const void *p);
 typedef int (*pa_compare_func_t)(const void *a, const void *b);
 
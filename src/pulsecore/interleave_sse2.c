@@ -0,0 +1,436 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pulsecore/macro.h>
+#include <pulsecore/log.h>
+
+#include "cpu-x86.h"
+#include "sample-util.h"
+#include "simd-x86.h"
+
+/* Interleaving is a transpose of a channels x n matrix, which we do in
+ * blocks of 4 (32 bit samples) or 8 (16 bit samples) frames with the
+ * unpack instructions. The samples are only moved around, so the same
+ * kernels serve floats and integers alike. Frames that don't fill a
+ * block are left to the tail loops. */
+
+#define INTERLEAVE_TAIL(type, channels)                                 \
+    do {                                                                \
+        unsigned c;                                                     \
+                                                                        \
+        for (; j < n; j++)                                              \
+            for (c = 0; c < (channels); c++)                            \
+                ((type*) dst)[j * (channels) + c] = ((const type*) src[c])[j]; \
+    } while (0)
+
+#define DEINTERLEAVE_TAIL(type, channels)                               \
+    do {                                                                \
+        unsigned c;                                                     \
+                                                                        \
+        for (; j < n; j++)                                              \
+            for (c = 0; c < (channels); c++)                            \
+                ((type*) dst[c])[j] = ((const type*) src)[j * (channels) + c]; \
+    } while (0)
+
+#define LOAD(p) _mm_loadu_si128((const __m128i*) (p))
+#define STORE(p, v) _mm_storeu_si128((__m128i*) (p), (v))
+
+/* Transposes the 4x4 matrix of 32 bit samples in r0..r3 */
+static inline void transpose_4x4_32(__m128i *r0, __m128i *r1, __m128i *r2, __m128i *r3) {
+    __m128i t0 = _mm_unpacklo_epi32(*r0, *r1);
+    __m128i t1 = _mm_unpacklo_epi32(*r2, *r3);
+    __m128i t2 = _mm_unpackhi_epi32(*r0, *r1);
+    __m128i t3 = _mm_unpackhi_epi32(*r2, *r3);
+
+    *r0 = _mm_unpacklo_epi64(t0, t1);
+    *r1 = _mm_unpackhi_epi64(t0, t1);
+    *r2 = _mm_unpacklo_epi64(t2, t3);
+    *r3 = _mm_unpackhi_epi64(t2, t3);
+}
+
+static void interleave_32_ch2_sse2(const void *src[], void *dst, unsigned n) {
+    const uint32_t *s0 = src[0], *s1 = src[1];
+    uint32_t *d = dst;
+    unsigned j;
+
+    for (j = 0; j + 4 <= n; j += 4, d += 8) {
+        __m128i a = LOAD(s0 + j), b = LOAD(s1 + j);
+
+        STORE(d, _mm_unpacklo_epi32(a, b));
+        STORE(d + 4, _mm_unpackhi_epi32(a, b));
+    }
+
+    INTERLEAVE_TAIL(uint32_t, 2);
+}
+
+static void interleave_32_ch4_sse2(const void *src[], void *dst, unsigned n) {
+    const uint32_t *s0 = src[0], *s1 = src[1], *s2 = src[2], *s3 = src[3];
+    uint32_t *d = dst;
+    unsigned j;
+
+    for (j = 0; j + 4 <= n; j += 4, d += 16) {
+        __m128i r0 = LOAD(s0 + j), r1 = LOAD(s1 + j), r2 = LOAD(s2 + j), r3 = LOAD(s3 + j);
+
+        transpose_4x4_32(&r0, &r1, &r2, &r3);
+
+        STORE(d, r0);
+        STORE(d + 4, r1);
+        STORE(d + 8, r2);
+        STORE(d + 12, r3);
+    }
+
+    INTERLEAVE_TAIL(uint32_t, 4);
+}
+
+static void interleave_32_ch6_sse2(const void *src[], void *dst, unsigned n) {
+    const uint32_t *s0 = src[0], *s1 = src[1], *s2 = src[2], *s3 = src[3], *s4 = src[4], *s5 = src[5];
+    uint32_t *d = dst;
+    unsigned j;
+
+    for (j = 0; j + 4 <= n; j += 4, d += 24) {
+        __m128i r0 = LOAD(s0 + j), r1 = LOAD(s1 + j), r2 = LOAD(s2 + j), r3 = LOAD(s3 + j);
+        __m128i a = LOAD(s4 + j), b = LOAD(s5 + j);
+        __m128i p0, p1;
+
+        transpose_4x4_32(&r0, &r1, &r2, &r3);
+
+        /* Channels 4 and 5 of frames 0 and 1, and of frames 2 and 3 */
+        p0 = _mm_unpacklo_epi32(a, b);
+        p1 = _mm_unpackhi_epi32(a, b);
+
+        STORE(d, r0);
+        STORE(d + 4, _mm_unpacklo_epi64(p0, r1));
+        STORE(d + 8, _mm_unpackhi_epi64(r1, p0));
+        STORE(d + 12, r2);
+        STORE(d + 16, _mm_unpacklo_epi64(p1, r3));
+        STORE(d + 20, _mm_unpackhi_epi64(r3, p1));
+    }
+
+    INTERLEAVE_TAIL(uint32_t, 6);
+}
+
+static void interleave_32_ch8_sse2(const void *src[], void *dst, unsigned n) {
+    uint32_t *d = dst;
+    unsigned j;
+
+    for (j = 0; j + 4 <= n; j += 4, d += 32) {
+        __m128i r0 = LOAD((const uint32_t*) src[0] + j), r1 = LOAD((const uint32_t*) src[1] + j);
+        __m128i r2 = LOAD((const uint32_t*) src[2] + j), r3 = LOAD((const uint32_t*) src[3] + j);
+        __m128i r4 = LOAD((const uint32_t*) src[4] + j), r5 = LOAD((const uint32_t*) src[5] + j);
+        __m128i r6 = LOAD((const uint32_t*) src[6] + j), r7 = LOAD((const uint32_t*) src[7] + j);
+
+        transpose_4x4_32(&r0, &r1, &r2, &r3);
+        transpose_4x4_32(&r4, &r5, &r6, &r7);
+
+        STORE(d, r0);
+        STORE(d + 4, r4);
+        STORE(d + 8, r1);
+        STORE(d + 12, r5);
+        STORE(d + 16, r2);
+        STORE(d + 20, r6);
+        STORE(d + 24, r3);
+        STORE(d + 28, r7);
+    }
+
+    INTERLEAVE_TAIL(uint32_t, 8);
+}
+
+static void deinterleave_32_ch2_sse2(const void *src, void *dst[], unsigned n) {
+    const uint32_t *s = src;
+    uint32_t *d0 = dst[0], *d1 = dst[1];
+    unsigned j;
+
+    for (j = 0; j + 4 <= n; j += 4, s += 8) {
+        __m128 v0 = _mm_castsi128_ps(LOAD(s)), v1 = _mm_castsi128_ps(LOAD(s + 4));
+
+        STORE(d0 + j, _mm_castps_si128(_mm_shuffle_ps(v0, v1, _MM_SHUFFLE(2, 0, 2, 0))));
+        STORE(d1 + j, _mm_castps_si128(_mm_shuffle_ps(v0, v1, _MM_SHUFFLE(3, 1, 3, 1))));
+    }
+
+    DEINTERLEAVE_TAIL(uint32_t, 2);
+}
+
+static void deinterleave_32_ch4_sse2(const void *src, void *dst[], unsigned n) {
+    const uint32_t *s = src;
+    uint32_t *d0 = dst[0], *d1 = dst[1], *d2 = dst[2], *d3 = dst[3];
+    unsigned j;
+
+    for (j = 0; j + 4 <= n; j += 4, s += 16) {
+        __m128i r0 = LOAD(s), r1 = LOAD(s + 4), r2 = LOAD(s + 8), r3 = LOAD(s + 12);
+
+        transpose_4x4_32(&r0, &r1, &r2, &r3);
+
+        STORE(d0 + j, r0);
+        STORE(d1 + j, r1);
+        STORE(d2 + j, r2);
+        STORE(d3 + j, r3);
+    }
+
+    DEINTERLEAVE_TAIL(uint32_t, 4);
+}
+
+static void deinterleave_32_ch6_sse2(const void *src, void *dst[], unsigned n) {
+    const uint32_t *s = src;
+    uint32_t *d0 = dst[0], *d1 = dst[1], *d2 = dst[2], *d3 = dst[3], *d4 = dst[4], *d5 = dst[5];
+    unsigned j;
+
+    for (j = 0; j + 4 <= n; j += 4, s += 24) {
+        __m128i v1 = LOAD(s + 4), v2 = LOAD(s + 8), v4 = LOAD(s + 16), v5 = LOAD(s + 20);
+        __m128i r0, r1, r2, r3;
+        __m128 p0, p1;
+
+        /* The inverse of what interleave_32_ch6_sse2() does */
+        r0 = LOAD(s);
+        r1 = _mm_castpd_si128(_mm_shuffle_pd(_mm_castsi128_pd(v1), _mm_castsi128_pd(v2), 1));
+        r2 = LOAD(s + 12);
+        r3 = _mm_castpd_si128(_mm_shuffle_pd(_mm_castsi128_pd(v4), _mm_castsi128_pd(v5), 1));
+        p0 = _mm_castpd_ps(_mm_shuffle_pd(_mm_castsi128_pd(v1), _mm_castsi128_pd(v2), 2));
+        p1 = _mm_castpd_ps(_mm_shuffle_pd(_mm_castsi128_pd(v4), _mm_castsi128_pd(v5), 2));
+
+        transpose_4x4_32(&r0, &r1, &r2, &r3);
+
+        STORE(d0 + j, r0);
+        STORE(d1 + j, r1);
+        STORE(d2 + j, r2);
+        STORE(d3 + j, r3);
+        STORE(d4 + j, _mm_castps_si128(_mm_shuffle_ps(p0, p1, _MM_SHUFFLE(2, 0, 2, 0))));
+        STORE(d5 + j, _mm_castps_si128(_mm_shuffle_ps(p0, p1, _MM_SHUFFLE(3, 1, 3, 1))));
+    }
+
+    DEINTERLEAVE_TAIL(uint32_t, 6);
+}
+
+static void deinterleave_32_ch8_sse2(const void *src, void *dst[], unsigned n) {
+    const uint32_t *s = src;
+    unsigned j;
+
+    for (j = 0; j + 4 <= n; j += 4, s += 32) {
+        __m128i r0 = LOAD(s), r4 = LOAD(s + 4), r1 = LOAD(s + 8), r5 = LOAD(s + 12);
+        __m128i r2 = LOAD(s + 16), r6 = LOAD(s + 20), r3 = LOAD(s + 24), r7 = LOAD(s + 28);
+
+        transpose_4x4_32(&r0, &r1, &r2, &r3);
+        transpose_4x4_32(&r4, &r5, &r6, &r7);
+
+        STORE((uint32_t*) dst[0] + j, r0);
+        STORE((uint32_t*) dst[1] + j, r1);
+        STORE((uint32_t*) dst[2] + j, r2);
+        STORE((uint32_t*) dst[3] + j, r3);
+        STORE((uint32_t*) dst[4] + j, r4);
+        STORE((uint32_t*) dst[5] + j, r5);
+        STORE((uint32_t*) dst[6] + j, r6);
+        STORE((uint32_t*) dst[7] + j, r7);
+    }
+
+    DEINTERLEAVE_TAIL(uint32_t, 8);
+}
+
+static void interleave_16_ch2_sse2(const void *src[], void *dst, unsigned n) {
+    const uint16_t *s0 = src[0], *s1 = src[1];
+    uint16_t *d = dst;
+    unsigned j;
+
+    for (j = 0; j + 8 <= n; j += 8, d += 16) {
+        __m128i a = LOAD(s0 + j), b = LOAD(s1 + j);
+
+        STORE(d, _mm_unpacklo_epi16(a, b));
+        STORE(d + 8, _mm_unpackhi_epi16(a, b));
+    }
+
+    INTERLEAVE_TAIL(uint16_t, 2);
+}
+
+static void interleave_16_ch4_sse2(const void *src[], void *dst, unsigned n) {
+    const uint16_t *s0 = src[0], *s1 = src[1], *s2 = src[2], *s3 = src[3];
+    uint16_t *d = dst;
+    unsigned j;
+
+    for (j = 0; j + 8 <= n; j += 8, d += 32) {
+        __m128i a = LOAD(s0 + j), b = LOAD(s1 + j), c = LOAD(s2 + j), e = LOAD(s3 + j);
+        __m128i ab0 = _mm_unpacklo_epi16(a, b), ab1 = _mm_unpackhi_epi16(a, b);
+        __m128i ce0 = _mm_unpacklo_epi16(c, e), ce1 = _mm_unpackhi_epi16(c, e);
+
+        STORE(d, _mm_unpacklo_epi32(ab0, ce0));
+        STORE(d + 8, _mm_unpackhi_epi32(ab0, ce0));
+        STORE(d + 16, _mm_unpacklo_epi32(ab1, ce1));
+        STORE(d + 24, _mm_unpackhi_epi32(ab1, ce1));
+    }
+
+    INTERLEAVE_TAIL(uint16_t, 4);
+}
+
+/* Transposes the 8x8 matrix of 16 bit samples in r[] */
+static inline void transpose_8x8_16(__m128i r[8]) {
+    __m128i a0, a1, a2, a3, a4, a5, a6, a7;
+    __m128i b0, b1, b2, b3, b4, b5, b6, b7;
+
+    a0 = _mm_unpacklo_epi16(r[0], r[1]);
+    a1 = _mm_unpackhi_epi16(r[0], r[1]);
+    a2 = _mm_unpacklo_epi16(r[2], r[3]);
+    a3 = _mm_unpackhi_epi16(r[2], r[3]);
+    a4 = _mm_unpacklo_epi16(r[4], r[5]);
+    a5 = _mm_unpackhi_epi16(r[4], r[5]);
+    a6 = _mm_unpacklo_epi16(r[6], r[7]);
+    a7 = _mm_unpackhi_epi16(r[6], r[7]);
+
+    b0 = _mm_unpacklo_epi32(a0, a2);
+    b1 = _mm_unpackhi_epi32(a0, a2);
+    b2 = _mm_unpacklo_epi32(a1, a3);
+    b3 = _mm_unpackhi_epi32(a1, a3);
+    b4 = _mm_unpacklo_epi32(a4, a6);
+    b5 = _mm_unpackhi_epi32(a4, a6);
+    b6 = _mm_unpacklo_epi32(a5, a7);
+    b7 = _mm_unpackhi_epi32(a5, a7);
+
+    r[0] = _mm_unpacklo_epi64(b0, b4);
+    r[1] = _mm_unpackhi_epi64(b0, b4);
+    r[2] = _mm_unpacklo_epi64(b1, b5);
+    r[3] = _mm_unpackhi_epi64(b1, b5);
+    r[4] = _mm_unpacklo_epi64(b2, b6);
+    r[5] = _mm_unpackhi_epi64(b2, b6);
+    r[6] = _mm_unpacklo_epi64(b3, b7);
+    r[7] = _mm_unpackhi_epi64(b3, b7);
+}
+
+static void interleave_16_ch8_sse2(const void *src[], void *dst, unsigned n) {
+    uint16_t *d = dst;
+    unsigned j, c;
+
+    for (j = 0; j + 8 <= n; j += 8, d += 64) {
+        __m128i r[8];
+
+        for (c = 0; c < 8; c++)
+            r[c] = LOAD((const uint16_t*) src[c] + j);
+
+        transpose_8x8_16(r);
+
+        for (c = 0; c < 8; c++)
+            STORE(d + c * 8, r[c]);
+    }
+
+    INTERLEAVE_TAIL(uint16_t, 8);
+}
+
+static void deinterleave_16_ch2_sse2(const void *src, void *dst[], unsigned n) {
+    const uint16_t *s = src;
+    uint16_t *d0 = dst[0], *d1 = dst[1];
+    unsigned j;
+
+    for (j = 0; j + 8 <= n; j += 8, s += 16) {
+        __m128i v0 = LOAD(s), v1 = LOAD(s + 8);
+        __m128i a0, a1, b0, b1;
+
+        /* Every round of unpacking halves the distance between the
+         * samples of a channel */
+        a0 = _mm_unpacklo_epi16(v0, v1);
+        a1 = _mm_unpackhi_epi16(v0, v1);
+
+        b0 = _mm_unpacklo_epi16(a0, a1);
+        b1 = _mm_unpackhi_epi16(a0, a1);
+
+        STORE(d0 + j, _mm_unpacklo_epi16(b0, b1));
+        STORE(d1 + j, _mm_unpackhi_epi16(b0, b1));
+    }
+
+    DEINTERLEAVE_TAIL(uint16_t, 2);
+}
+
+static void deinterleave_16_ch4_sse2(const void *src, void *dst[], unsigned n) {
+    const uint16_t *s = src;
+    uint16_t *d0 = dst[0], *d1 = dst[1], *d2 = dst[2], *d3 = dst[3];
+    unsigned j;
+
+    for (j = 0; j + 8 <= n; j += 8, s += 32) {
+        __m128i v0 = LOAD(s), v1 = LOAD(s + 8), v2 = LOAD(s + 16), v3 = LOAD(s + 24);
+        __m128i a0, a1, a2, a3, b0, b1, b2, b3;
+
+        /* Two rounds of unpacking gather four samples of each channel */
+        a0 = _mm_unpacklo_epi16(v0, v1);
+        a1 = _mm_unpackhi_epi16(v0, v1);
+        a2 = _mm_unpacklo_epi16(v2, v3);
+        a3 = _mm_unpackhi_epi16(v2, v3);
+
+        b0 = _mm_unpacklo_epi16(a0, a1);
+        b1 = _mm_unpackhi_epi16(a0, a1);
+        b2 = _mm_unpacklo_epi16(a2, a3);
+        b3 = _mm_unpackhi_epi16(a2, a3);
+
+        STORE(d0 + j, _mm_unpacklo_epi64(b0, b2));
+        STORE(d1 + j, _mm_unpackhi_epi64(b0, b2));
+        STORE(d2 + j, _mm_unpacklo_epi64(b1, b3));
+        STORE(d3 + j, _mm_unpackhi_epi64(b1, b3));
+    }
+
+    DEINTERLEAVE_TAIL(uint16_t, 4);
+}
+
+static void deinterleave_16_ch8_sse2(const void *src, void *dst[], unsigned n) {
+    const uint16_t *s = src;
+    unsigned j, c;
+
+    for (j = 0; j + 8 <= n; j += 8, s += 64) {
+        __m128i r[8];
+
+        for (c = 0; c < 8; c++)
+            r[c] = LOAD(s + c * 8);
+
+        transpose_8x8_16(r);
+
+        for (c = 0; c < 8; c++)
+            STORE((uint16_t*) dst[c] + j, r[c]);
+    }
+
+    DEINTERLEAVE_TAIL(uint16_t, 8);
+}
+
+static void clamp_float32ne_sse2(float *dst, const float *src, unsigned n) {
+    const __m128 lo = _mm_set1_ps(-1.0f), hi = _mm_set1_ps(1.0f);
+    unsigned j;
+
+    for (j = 0; j + 4 <= n; j += 4)
+        _mm_storeu_ps(dst + j, _mm_max_ps(_mm_min_ps(_mm_loadu_ps(src + j), hi), lo));
+
+    for (; j < n; j++)
+        dst[j] = PA_CLAMP_UNLIKELY(src[j], -1.0f, 1.0f);
+}
+
+void pa_interleave_func_init_sse2(pa_cpu_x86_flag_t flags) {
+    pa_log_info("Initialising SSE2 optimized interleaving functions.");
+
+    pa_set_interleave_func(4, 2, interleave_32_ch2_sse2);
+    pa_set_interleave_func(4, 4, interleave_32_ch4_sse2);
+    pa_set_interleave_func(4, 6, interleave_32_ch6_sse2);
+    pa_set_interleave_func(4, 8, interleave_32_ch8_sse2);
+    pa_set_interleave_func(2, 2, interleave_16_ch2_sse2);
+    pa_set_interleave_func(2, 4, interleave_16_ch4_sse2);
+    pa_set_interleave_func(2, 8, interleave_16_ch8_sse2);
+
+    pa_set_deinterleave_func(4, 2, deinterleave_32_ch2_sse2);
+    pa_set_deinterleave_func(4, 4, deinterleave_32_ch4_sse2);
+    pa_set_deinterleave_func(4, 6, deinterleave_32_ch6_sse2);
+    pa_set_deinterleave_func(4, 8, deinterleave_32_ch8_sse2);
+    pa_set_deinterleave_func(2, 2, deinterleave_16_ch2_sse2);
+    pa_set_deinterleave_func(2, 4, deinterleave_16_ch4_sse2);
+    pa_set_deinterleave_func(2, 8, deinterleave_16_ch8_sse2);
+
+    pa_set_clamp_func(clamp_float32ne_sse2);
+}
@@ -0,0 +1,91 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core-util.h>
+#include <pulsecore/macro.h>
+
+#include "io-counters.h"
+
+static const char * const counter_names[PA_IO_COUNTERS_MAX] = {
+    "xruns",
+    "underruns",
+    "overflows",
+    "rewinds",
+    "rewind-bytes",
+    "max-render-usec"
+};
+
+void pa_io_counters_reset(pa_io_counters *c) {
+    pa_assert(c);
+
+    memset(c, 0, sizeof(*c));
+}
+
+const char *pa_io_counter_to_string(unsigned k) {
+    pa_assert(k < PA_IO_COUNTERS_MAX);
+
+    return counter_names[k];
+}
+
+void pa_io_counters_get_all(const pa_io_counters *c, uint64_t values[PA_IO_COUNTERS_MAX]) {
+    pa_assert(c);
+    pa_assert(values);
+
+    values[0] = c->xruns;
+    values[1] = c->underruns;
+    values[2] = c->overflows;
+    values[3] = c->rewinds;
+    values[4] = c->rewind_bytes;
+    values[5] = c->max_render_usec;
+}
+
+char *pa_io_counters_to_string(const pa_io_counters *c) {
+    pa_assert(c);
+
+    return pa_sprintf_malloc("xruns=%u underruns=%u overflows=%u rewinds=%u rewind-bytes=%llu max-render=%lluus",
+                             c->xruns, c->underruns, c->overflows, c->rewinds,
+                             (unsigned long long) c->rewind_bytes,
+                             (unsigned long long) c->max_render_usec);
+}
+
+void pa_io_counters_to_proplist(const pa_io_counters *c, pa_proplist *p) {
+    uint64_t values[PA_IO_COUNTERS_MAX];
+    unsigned k;
+
+    pa_assert(c);
+    pa_assert(p);
+
+    pa_io_counters_get_all(c, values);
+
+    for (k = 0; k < PA_IO_COUNTERS_MAX; k++) {
+        char key[32];
+
+        pa_snprintf(key, sizeof(key), "io.%s", counter_names[k]);
+        pa_proplist_setf(p, key, "%llu", (unsigned long long) values[k]);
+    }
+}
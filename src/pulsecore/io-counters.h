@@ -0,0 +1,69 @@
+#ifndef foopulsecoreiocountershfoo
+#define foopulsecoreiocountershfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <inttypes.h>
+
+#include <pulse/proplist.h>
+#include <pulse/sample.h>
+
+#include <pulsecore/macro.h>
+
+/* Error counters of a sink, source or stream. They are always kept,
+ * written by the IO thread only and read by the main thread without
+ * any locking. Resetting is done from the IO thread too, see
+ * pa_sink_reset_counters() and pa_source_reset_counters().
+ *
+ * xruns: the device lost its timing, e.g. an ALSA xrun or a failed
+ * write to a bluetooth socket. Devices only.
+ * underruns: a stream had no data when the sink wanted some. Counts
+ * the times it started to underrun, not the renders it was silent for.
+ * overflows: data of a stream was dropped because its queue was full.
+ * rewinds and rewind_bytes: rewinds that actually rewrote something.
+ * max_render_usec: the longest render (sinks) or post (sources). For
+ * playback streams only the peeks are timed, and only with
+ * enable-render-stats set. */
+
+typedef struct pa_io_counters {
+    unsigned xruns;
+    unsigned underruns;
+    unsigned overflows;
+    unsigned rewinds;
+    uint64_t rewind_bytes;
+    pa_usec_t max_render_usec;
+} pa_io_counters;
+
+#define PA_IO_COUNTERS_MAX 6
+
+void pa_io_counters_reset(pa_io_counters *c);
+
+/* The name of counter k, matching the order of the fields */
+const char *pa_io_counter_to_string(unsigned k);
+
+void pa_io_counters_get_all(const pa_io_counters *c, uint64_t values[PA_IO_COUNTERS_MAX]);
+
+/* E.g. "xruns=0 underruns=2 overflows=0 rewinds=14 rewind-bytes=35280 max-render=412us" */
+char *pa_io_counters_to_string(const pa_io_counters *c);
+
+/* Sets io.<counter> in p for every counter */
+void pa_io_counters_to_proplist(const pa_io_counters *c, pa_proplist *p);
+
+#endif
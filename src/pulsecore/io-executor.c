@@ -0,0 +1,346 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/atomic.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/llist.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/memarena.h>
+#include <pulsecore/msgobject.h>
+#include <pulsecore/refcnt.h>
+#include <pulsecore/shared.h>
+#include <pulsecore/thread.h>
+
+#include "io-executor.h"
+
+/* Deadlines this close to the current time are served right away */
+#define BATCH_USEC (2*PA_USEC_PER_MSEC)
+
+typedef struct executor_thread {
+    pa_msgobject parent;
+
+    pa_io_executor *executor;
+
+    pa_thread *thread;
+    pa_thread_mq thread_mq;
+    pa_rtpoll *rtpoll;
+    pa_memarena *arena;
+
+    /* Main context only */
+    unsigned n_items;
+
+    /* Set by the thread if it can't go on */
+    pa_atomic_t failed;
+
+    /* Thread context only */
+    PA_LLIST_HEAD(pa_io_executor_item, items);
+} executor_thread;
+
+PA_DEFINE_PRIVATE_CLASS(executor_thread, pa_msgobject);
+#define EXECUTOR_THREAD(o) (executor_thread_cast(o))
+
+enum {
+    EXECUTOR_THREAD_MESSAGE_ADD,
+    EXECUTOR_THREAD_MESSAGE_REMOVE
+};
+
+struct pa_io_executor_item {
+    executor_thread *thread;
+    pa_module *module;
+
+    pa_io_executor_cb_t cb;
+    void *userdata;
+
+    PA_LLIST_FIELDS(pa_io_executor_item);
+};
+
+struct pa_io_executor {
+    PA_REFCNT_DECLARE;
+
+    pa_core *core;
+
+    unsigned n_threads, max_threads;
+    executor_thread **threads;
+};
+
+/* Called from IO context */
+static int executor_thread_process_msg(pa_msgobject *o, int code, void *data, int64_t offset, pa_memchunk *chunk) {
+    executor_thread *t = EXECUTOR_THREAD(o);
+    pa_io_executor_item *i = data;
+
+    pa_assert(t);
+    pa_assert(i);
+
+    switch (code) {
+
+        case EXECUTOR_THREAD_MESSAGE_ADD:
+            PA_LLIST_PREPEND(pa_io_executor_item, t->items, i);
+            return 0;
+
+        case EXECUTOR_THREAD_MESSAGE_REMOVE:
+            PA_LLIST_REMOVE(pa_io_executor_item, t->items, i);
+            return 0;
+    }
+
+    return -1;
+}
+
+static void executor_thread_free(pa_object *o) {
+    executor_thread *t = EXECUTOR_THREAD(o);
+
+    pa_assert(t);
+    pa_assert(!t->items);
+
+    pa_thread_mq_done(&t->thread_mq);
+
+    if (t->arena)
+        pa_memarena_free(t->arena);
+
+    pa_rtpoll_free(t->rtpoll);
+    pa_xfree(t);
+}
+
+static void thread_func(void *userdata) {
+    executor_thread *t = userdata;
+    pa_io_executor_item *i;
+
+    pa_assert(t);
+
+    pa_log_debug("Thread starting up");
+
+    pa_thread_mq_install(&t->thread_mq);
+
+    if (t->executor->core->default_cpu_affinity)
+        pa_set_cpu_affinity(t->executor->core->default_cpu_affinity);
+
+    pa_memarena_set_thread(t->arena);
+
+    for (;;) {
+        pa_usec_t now, next = (pa_usec_t) -1;
+        int ret;
+
+        now = pa_rtclock_now() + BATCH_USEC;
+
+        PA_LLIST_FOREACH(i, t->items) {
+            pa_usec_t when = i->cb(i, now, i->userdata);
+
+            next = PA_MIN(next, when);
+        }
+
+        if (next != (pa_usec_t) -1)
+            pa_rtpoll_set_timer_absolute(t->rtpoll, next);
+        else
+            pa_rtpoll_set_timer_disabled(t->rtpoll);
+
+        /* Whatever was rendered in this iteration is gone by now */
+        pa_memarena_reset(t->arena);
+
+        if ((ret = pa_rtpoll_run(t->rtpoll, TRUE)) < 0)
+            goto fail;
+
+        if (ret == 0)
+            goto finish;
+    }
+
+fail:
+    /* Every module on this thread has to go. We still have to process
+     * messages until we received PA_MESSAGE_SHUTDOWN. */
+    pa_atomic_store(&t->failed, 1);
+
+    PA_LLIST_FOREACH(i, t->items)
+        pa_asyncmsgq_post(t->thread_mq.outq, PA_MSGOBJECT(t->executor->core), PA_CORE_MESSAGE_UNLOAD_MODULE, i->module, 0, NULL, NULL);
+
+    pa_asyncmsgq_wait_for(t->thread_mq.inq, PA_MESSAGE_SHUTDOWN);
+
+finish:
+    pa_memarena_set_thread(NULL);
+    pa_log_debug("Thread shutting down");
+}
+
+/* Called from main context */
+static executor_thread* executor_thread_new(pa_io_executor *e) {
+    executor_thread *t;
+
+    pa_assert(e);
+
+    t = pa_msgobject_new(executor_thread);
+    t->parent.parent.free = executor_thread_free;
+    t->parent.process_msg = executor_thread_process_msg;
+    t->executor = e;
+    t->n_items = 0;
+    pa_atomic_store(&t->failed, 0);
+    PA_LLIST_HEAD_INIT(pa_io_executor_item, t->items);
+
+    t->rtpoll = pa_rtpoll_new();
+    pa_thread_mq_init(&t->thread_mq, e->core->mainloop, t->rtpoll);
+    t->arena = pa_memarena_new(e->core->mempool, 8 * pa_mempool_block_size_max(e->core->mempool));
+
+    if (!(t->thread = pa_thread_new("io-executor", thread_func, t))) {
+        pa_log("Failed to create IO executor thread.");
+        executor_thread_unref(t);
+        return NULL;
+    }
+
+    return t;
+}
+
+/* Called from main context */
+static executor_thread* pick_thread(pa_io_executor *e) {
+    executor_thread *best = NULL;
+    unsigned j;
+
+    pa_assert(e);
+
+    for (j = 0; j < e->n_threads; j++) {
+        executor_thread *t = e->threads[j];
+
+        if (pa_atomic_load(&t->failed))
+            continue;
+
+        if (!best || t->n_items < best->n_items)
+            best = t;
+    }
+
+    /* Spread the devices over the CPUs first, then batch them */
+    if ((!best || best->n_items > 0) && e->n_threads < e->max_threads) {
+        executor_thread *t;
+
+        if ((t = executor_thread_new(e))) {
+            e->threads[e->n_threads++] = t;
+            best = t;
+        }
+    }
+
+    return best;
+}
+
+static pa_io_executor* io_executor_new(pa_core *c) {
+    pa_io_executor *e;
+
+    pa_assert(c);
+
+    e = pa_xnew0(pa_io_executor, 1);
+    PA_REFCNT_INIT(e);
+    e->core = c;
+    e->max_threads = PA_MAX(pa_ncpus(), 1U);
+    e->threads = pa_xnew0(executor_thread*, e->max_threads);
+
+    pa_assert_se(pa_shared_set(c, "io-executor", e) >= 0);
+
+    return e;
+}
+
+pa_io_executor* pa_io_executor_get(pa_core *c) {
+    pa_io_executor *e;
+
+    if ((e = pa_shared_get(c, "io-executor")))
+        return pa_io_executor_ref(e);
+
+    return io_executor_new(c);
+}
+
+pa_io_executor* pa_io_executor_ref(pa_io_executor *e) {
+    pa_assert(e);
+    pa_assert(PA_REFCNT_VALUE(e) >= 1);
+
+    PA_REFCNT_INC(e);
+
+    return e;
+}
+
+void pa_io_executor_unref(pa_io_executor *e) {
+    unsigned j;
+
+    pa_assert(e);
+    pa_assert(PA_REFCNT_VALUE(e) >= 1);
+
+    if (PA_REFCNT_DEC(e) > 0)
+        return;
+
+    for (j = 0; j < e->n_threads; j++) {
+        executor_thread *t = e->threads[j];
+
+        /* Every item has been freed by now */
+        pa_assert(t->n_items == 0);
+
+        pa_asyncmsgq_send(t->thread_mq.inq, NULL, PA_MESSAGE_SHUTDOWN, NULL, 0, NULL);
+        pa_thread_free(t->thread);
+
+        executor_thread_unref(t);
+    }
+
+    pa_assert_se(pa_shared_remove(e->core, "io-executor") >= 0);
+
+    pa_xfree(e->threads);
+    pa_xfree(e);
+}
+
+pa_io_executor_item* pa_io_executor_item_new(pa_io_executor *e, pa_module *m, pa_io_executor_cb_t cb, void *userdata) {
+    pa_io_executor_item *i;
+    executor_thread *t;
+
+    pa_assert(e);
+    pa_assert(PA_REFCNT_VALUE(e) >= 1);
+    pa_assert(m);
+    pa_assert(cb);
+
+    if (!(t = pick_thread(e)))
+        return NULL;
+
+    i = pa_xnew0(pa_io_executor_item, 1);
+    i->thread = t;
+    i->module = m;
+    i->cb = cb;
+    i->userdata = userdata;
+
+    t->n_items++;
+    pa_assert_se(pa_asyncmsgq_send(t->thread_mq.inq, PA_MSGOBJECT(t), EXECUTOR_THREAD_MESSAGE_ADD, i, 0, NULL) == 0);
+
+    return i;
+}
+
+void pa_io_executor_item_free(pa_io_executor_item *i) {
+    pa_assert(i);
+
+    pa_assert_se(pa_asyncmsgq_send(i->thread->thread_mq.inq, PA_MSGOBJECT(i->thread), EXECUTOR_THREAD_MESSAGE_REMOVE, i, 0, NULL) == 0);
+    i->thread->n_items--;
+
+    pa_xfree(i);
+}
+
+pa_thread_mq* pa_io_executor_item_get_thread_mq(pa_io_executor_item *i) {
+    pa_assert(i);
+
+    return &i->thread->thread_mq;
+}
+
+pa_rtpoll* pa_io_executor_item_get_rtpoll(pa_io_executor_item *i) {
+    pa_assert(i);
+
+    return i->thread->rtpoll;
+}
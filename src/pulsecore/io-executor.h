@@ -0,0 +1,62 @@
+#ifndef fooioexecutorhfoo
+#define fooioexecutorhfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <pulsecore/core.h>
+#include <pulsecore/module.h>
+#include <pulsecore/rtpoll.h>
+#include <pulsecore/thread-mq.h>
+
+/* Shared IO threads for timer driven devices that don't need a thread
+ * of their own, like the null sink. There is at most one thread per
+ * CPU, and every device is assigned to one of them when it is added.
+ * A device sets its asyncmsgq and rtpoll to the ones of its thread.
+ * On every wakeup of the thread the callbacks of all devices on it are
+ * called in turn, and each returns when it wants to be called next.
+ * The thread sleeps until the earliest of these. Each callback is
+ * passed the current time plus a short batching window, so that the
+ * devices whose deadlines are close together are all served on one
+ * wakeup rather than on one wakeup each. */
+
+typedef struct pa_io_executor pa_io_executor;
+typedef struct pa_io_executor_item pa_io_executor_item;
+
+/* Called from the IO thread. Returns the time to be called again at, or
+ * (pa_usec_t) -1 to be called only when the thread wakes up for other
+ * reasons, like a message. */
+typedef pa_usec_t (*pa_io_executor_cb_t)(pa_io_executor_item *i, pa_usec_t now, void *userdata);
+
+pa_io_executor* pa_io_executor_get(pa_core *c);
+pa_io_executor* pa_io_executor_ref(pa_io_executor *e);
+void pa_io_executor_unref(pa_io_executor *e);
+
+/* The callback might be called right away. If the thread fails, m is
+ * unloaded. Returns NULL if no thread could be created. */
+pa_io_executor_item* pa_io_executor_item_new(pa_io_executor *e, pa_module *m, pa_io_executor_cb_t cb, void *userdata);
+
+/* Returns after the callback has been called for the last time. The
+ * device must have been unlinked before. */
+void pa_io_executor_item_free(pa_io_executor_item *i);
+
+pa_thread_mq* pa_io_executor_item_get_thread_mq(pa_io_executor_item *i);
+pa_rtpoll* pa_io_executor_item_get_rtpoll(pa_io_executor_item *i);
+
+#endif
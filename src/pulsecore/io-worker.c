@@ -0,0 +1,292 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core-error.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/flist.h>
+#include <pulsecore/llist.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/mutex.h>
+#include <pulsecore/semaphore.h>
+
+#include "io-worker.h"
+
+struct job {
+    pa_io_worker_cb_t cb;
+    void *object;
+    void *userdata;
+    pa_free_cb_t free_cb;
+    pa_bool_t sync;
+
+    PA_LLIST_FIELDS(struct job);
+};
+
+/* Jobs for one side. The pipe stays readable for as long as there are
+ * jobs in the queue. */
+struct queue {
+    pa_io_worker *worker;
+
+    pa_mutex *mutex;
+    PA_LLIST_HEAD(struct job, jobs);
+    struct job *last;
+    unsigned n_jobs;
+    pa_bool_t signalled;
+
+    int fds[2];
+    int write_type;
+
+    pa_mainloop_api *mainloop;
+    pa_io_event *io_event;
+};
+
+struct pa_io_worker {
+    struct queue to_main, to_worker;
+    pa_semaphore *semaphore;
+};
+
+PA_STATIC_FLIST_DECLARE(jobs, 0, pa_xfree);
+
+static void job_free(struct job *j) {
+    if (pa_flist_push(PA_STATIC_FLIST_GET(jobs), j) < 0)
+        pa_xfree(j);
+}
+
+static struct job* queue_pop(struct queue *q) {
+    struct job *j;
+
+    pa_mutex_lock(q->mutex);
+
+    if ((j = q->jobs)) {
+        if (q->last == j)
+            q->last = NULL;
+
+        PA_LLIST_REMOVE(struct job, q->jobs, j);
+        q->n_jobs--;
+    }
+
+    pa_mutex_unlock(q->mutex);
+
+    return j;
+}
+
+static void io_callback(pa_mainloop_api *m, pa_io_event *e, int fd, pa_io_event_flags_t events, void *userdata) {
+    struct queue *q = userdata;
+    struct job *j;
+    unsigned n;
+
+    pa_assert(q);
+    pa_assert(q->io_event == e);
+    pa_assert(q->fds[0] == fd);
+
+    /* Only run what is there already, so that a busy sender does not
+     * starve the other events of this loop */
+    pa_mutex_lock(q->mutex);
+    n = q->n_jobs;
+    pa_mutex_unlock(q->mutex);
+
+    while (n-- > 0 && (j = queue_pop(q))) {
+        pa_bool_t sync = j->sync;
+
+        j->cb(j->object, j->userdata);
+        job_free(j);
+
+        if (sync)
+            pa_semaphore_post(q->worker->semaphore);
+    }
+
+    pa_mutex_lock(q->mutex);
+
+    if (!q->jobs) {
+        char x[64];
+
+        /* Anything posted from now on needs another wakeup */
+        if (pa_read(fd, x, sizeof(x), NULL) < 0 && errno != EAGAIN)
+            pa_log_error("Failed to read from worker pipe: %s", pa_cstrerror(errno));
+
+        q->signalled = FALSE;
+    }
+
+    pa_mutex_unlock(q->mutex);
+}
+
+static void queue_init(struct queue *q, pa_io_worker *w, pa_mainloop_api *m) {
+    q->worker = w;
+    q->mutex = pa_mutex_new(FALSE, TRUE);
+    PA_LLIST_HEAD_INIT(struct job, q->jobs);
+    q->last = NULL;
+    q->n_jobs = 0;
+    q->signalled = FALSE;
+    q->write_type = 0;
+
+    pa_assert_se(pa_pipe_cloexec(q->fds) >= 0);
+    pa_make_fd_nonblock(q->fds[0]);
+    pa_make_fd_nonblock(q->fds[1]);
+
+    q->mainloop = m;
+    q->io_event = m->io_new(m, q->fds[0], PA_IO_EVENT_INPUT, io_callback, q);
+}
+
+static void queue_done(struct queue *q) {
+    struct job *j;
+
+    q->mainloop->io_free(q->io_event);
+
+    while ((j = queue_pop(q))) {
+        if (j->free_cb)
+            j->free_cb(j->userdata);
+
+        job_free(j);
+    }
+
+    pa_close_pipe(q->fds);
+    pa_mutex_free(q->mutex);
+}
+
+static void queue_push(struct queue *q, pa_io_worker_cb_t cb, void *object, void *userdata, pa_free_cb_t free_cb, pa_bool_t sync) {
+    struct job *j;
+    pa_bool_t wakeup;
+
+    if (!(j = pa_flist_pop(PA_STATIC_FLIST_GET(jobs))))
+        j = pa_xnew(struct job, 1);
+
+    j->cb = cb;
+    j->object = object;
+    j->userdata = userdata;
+    j->free_cb = free_cb;
+    j->sync = sync;
+
+    pa_mutex_lock(q->mutex);
+
+    PA_LLIST_INSERT_AFTER(struct job, q->jobs, q->last, j);
+    q->last = j;
+    q->n_jobs++;
+
+    wakeup = !q->signalled;
+    q->signalled = TRUE;
+
+    pa_mutex_unlock(q->mutex);
+
+    if (wakeup) {
+        const char x = 'x';
+
+        /* A full pipe keeps the other side awake just as well */
+        if (pa_write(q->fds[1], &x, 1, &q->write_type) < 0 && errno != EAGAIN)
+            pa_log_error("Failed to write to worker pipe: %s", pa_cstrerror(errno));
+    }
+}
+
+pa_io_worker* pa_io_worker_new(pa_mainloop_api *m, pa_mainloop_api *worker_mainloop) {
+    pa_io_worker *w;
+
+    pa_assert(m);
+    pa_assert(worker_mainloop);
+
+    w = pa_xnew(pa_io_worker, 1);
+    queue_init(&w->to_main, w, m);
+    queue_init(&w->to_worker, w, worker_mainloop);
+    w->semaphore = pa_semaphore_new(0);
+
+    return w;
+}
+
+void pa_io_worker_free(pa_io_worker *w) {
+    pa_assert(w);
+
+    queue_done(&w->to_worker);
+    queue_done(&w->to_main);
+    pa_semaphore_free(w->semaphore);
+
+    pa_xfree(w);
+}
+
+pa_mainloop_api* pa_io_worker_get_mainloop_api(pa_io_worker *w) {
+    pa_assert(w);
+
+    return w->to_worker.mainloop;
+}
+
+void pa_io_worker_run(pa_io_worker *w, pa_io_worker_cb_t cb, void *object, void *userdata) {
+    pa_assert(w);
+    pa_assert(cb);
+
+    queue_push(&w->to_worker, cb, object, userdata, NULL, FALSE);
+}
+
+void pa_io_worker_run_sync(pa_io_worker *w, pa_io_worker_cb_t cb, void *object, void *userdata) {
+    pa_assert(w);
+    pa_assert(cb);
+
+    /* The worker never waits for us, so this cannot dead lock */
+    queue_push(&w->to_worker, cb, object, userdata, NULL, TRUE);
+    pa_semaphore_wait(w->semaphore);
+}
+
+void pa_io_worker_post(pa_io_worker *w, pa_io_worker_cb_t cb, void *object, void *userdata, pa_free_cb_t free_cb) {
+    pa_assert(w);
+    pa_assert(cb);
+
+    queue_push(&w->to_main, cb, object, userdata, free_cb, FALSE);
+}
+
+void pa_io_worker_cancel(pa_io_worker *w, void *object) {
+    struct queue *q;
+    struct job *j, *n;
+    PA_LLIST_HEAD(struct job, cancelled);
+
+    pa_assert(w);
+
+    q = &w->to_main;
+    PA_LLIST_HEAD_INIT(struct job, cancelled);
+
+    pa_mutex_lock(q->mutex);
+
+    PA_LLIST_FOREACH_SAFE(j, n, q->jobs) {
+        if (j->object != object)
+            continue;
+
+        if (q->last == j)
+            q->last = j->prev;
+
+        PA_LLIST_REMOVE(struct job, q->jobs, j);
+        q->n_jobs--;
+
+        PA_LLIST_PREPEND(struct job, cancelled, j);
+    }
+
+    pa_mutex_unlock(q->mutex);
+
+    /* Outside of the lock, freeing might drop further references */
+    while ((j = cancelled)) {
+        PA_LLIST_REMOVE(struct job, cancelled, j);
+
+        if (j->free_cb)
+            j->free_cb(j->userdata);
+
+        job_free(j);
+    }
+}
@@ -0,0 +1,55 @@
+#ifndef fooioworkerhfoo
+#define fooioworkerhfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <pulse/def.h>
+#include <pulse/mainloop-api.h>
+
+/* Passes jobs between the main loop and a second loop that is run in a
+ * worker thread by the owner. Both queues are unbounded and never block
+ * the sender, so the worker can always go on while the main loop is
+ * busy. The worker must be created before its loop is started and freed
+ * after it has stopped. */
+
+typedef struct pa_io_worker pa_io_worker;
+
+typedef void (*pa_io_worker_cb_t)(void *object, void *userdata);
+
+pa_io_worker* pa_io_worker_new(pa_mainloop_api *m, pa_mainloop_api *worker_mainloop);
+void pa_io_worker_free(pa_io_worker *w);
+
+/* The loop of the worker thread. Only to be used from within it. */
+pa_mainloop_api* pa_io_worker_get_mainloop_api(pa_io_worker *w);
+
+/* Called from main context. Queue a job for the worker thread, or queue
+ * it and wait until it has been run. */
+void pa_io_worker_run(pa_io_worker *w, pa_io_worker_cb_t cb, void *object, void *userdata);
+void pa_io_worker_run_sync(pa_io_worker *w, pa_io_worker_cb_t cb, void *object, void *userdata);
+
+/* Called from the worker thread. Queue a job for the main loop. If the
+ * job is cancelled instead of run, free_cb is called on userdata. */
+void pa_io_worker_post(pa_io_worker *w, pa_io_worker_cb_t cb, void *object, void *userdata, pa_free_cb_t free_cb);
+
+/* Called from main context. Drop the jobs for object that were posted to
+ * the main loop and not run yet. */
+void pa_io_worker_cancel(pa_io_worker *w, void *object);
+
+#endif
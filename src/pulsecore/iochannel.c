@@ -119,7 +119,7 @@ static void enable_events(pa_iochannel *io) {
                     io->mainloop->io_enable(io->output_event, PA_IO_EVENT_OUTPUT);
                 else
                     io->output_event = io->mainloop->io_new(io->mainloop, io->ofd, PA_IO_EVENT_OUTPUT, callback, io);
-            } else if (io->input_event) {
+            } else if (io->output_event) {
                 io->mainloop->io_free(io->output_event);
                 io->output_event = NULL;
             }
@@ -215,15 +215,9 @@ pa_bool_t pa_iochannel_is_hungup(pa_iochannel*io) {
     return io->hungup;
 }
 
-ssize_t pa_iochannel_write(pa_iochannel*io, const void*data, size_t l) {
-    ssize_t r;
-
-    pa_assert(io);
-    pa_assert(data);
-    pa_assert(l);
-    pa_assert(io->ofd >= 0);
-
-    r = pa_write(io->ofd, data, l, &io->ofd_type);
+/* Returns what the write functions return for the result r of writing
+ * l bytes */
+static ssize_t write_done(pa_iochannel *io, ssize_t r, size_t l) {
 
     if ((size_t) r == l)
         return r; /* Fast path - we almost always successfully write everything */
@@ -242,6 +236,93 @@ ssize_t pa_iochannel_write(pa_iochannel*io, const void*data, size_t l) {
     return r;
 }
 
+static size_t iov_length(const struct iovec *iov, unsigned n_iov) {
+    size_t l = 0;
+    unsigned i;
+
+    for (i = 0; i < n_iov; i++)
+        l += iov[i].iov_len;
+
+    return l;
+}
+
+ssize_t pa_iochannel_write(pa_iochannel*io, const void*data, size_t l) {
+    ssize_t r;
+
+    pa_assert(io);
+    pa_assert(data);
+    pa_assert(l);
+    pa_assert(io->ofd >= 0);
+
+    r = pa_write(io->ofd, data, l, &io->ofd_type);
+
+    return write_done(io, r, l);
+}
+
+ssize_t pa_iochannel_writev(pa_iochannel*io, const struct iovec *iov, unsigned n_iov) {
+    ssize_t r;
+    size_t l;
+
+    pa_assert(io);
+    pa_assert(iov);
+    pa_assert(n_iov > 0 && n_iov <= PA_IOCHANNEL_IOV_MAX);
+    pa_assert(io->ofd >= 0);
+
+    l = iov_length(iov, n_iov);
+    pa_assert(l);
+
+#ifdef OS_IS_WIN32
+    {
+        unsigned i;
+
+        /* No gather writes here, hand the buffers over one by one */
+        for (i = 0, r = 0; i < n_iov; i++) {
+            ssize_t k;
+
+            if (iov[i].iov_len <= 0)
+                continue;
+
+            if ((k = pa_write(io->ofd, iov[i].iov_base, iov[i].iov_len, &io->ofd_type)) < 0) {
+                if (r == 0)
+                    r = k;
+                break;
+            }
+
+            r += k;
+
+            if ((size_t) k < iov[i].iov_len)
+                break;
+        }
+    }
+#else
+    for (;;) {
+
+        /* Like pa_write() we try sendmsg() first to avoid SIGPIPE and
+         * fall back to writev() for anything that is not a socket */
+        if (io->ofd_type == 0) {
+            struct msghdr mh;
+
+            pa_zero(mh);
+            mh.msg_iov = (struct iovec*) iov;
+            mh.msg_iovlen = n_iov;
+
+            if ((r = sendmsg(io->ofd, &mh, MSG_NOSIGNAL)) < 0 && errno == ENOTSOCK) {
+                io->ofd_type = 1;
+                continue;
+            }
+        } else
+            r = writev(io->ofd, iov, (int) n_iov);
+
+        if (r < 0 && errno == EINTR)
+            continue;
+
+        break;
+    }
+#endif
+
+    return write_done(io, r, l);
+}
+
 ssize_t pa_iochannel_read(pa_iochannel*io, void*data, size_t l) {
     ssize_t r;
 
@@ -299,10 +380,9 @@ int pa_iochannel_creds_enable(pa_iochannel *io) {
     return 0;
 }
 
-ssize_t pa_iochannel_write_with_creds(pa_iochannel*io, const void*data, size_t l, const pa_creds *ucred) {
+ssize_t pa_iochannel_writev_with_creds(pa_iochannel*io, const struct iovec *iov, unsigned n_iov, const pa_creds *ucred) {
     ssize_t r;
     struct msghdr mh;
-    struct iovec iov;
     union {
         struct cmsghdr hdr;
         uint8_t data[CMSG_SPACE(sizeof(struct ucred))];
@@ -310,14 +390,10 @@ ssize_t pa_iochannel_write_with_creds(pa_iochannel*io, const void*data, size_t l
     struct ucred *u;
 
     pa_assert(io);
-    pa_assert(data);
-    pa_assert(l);
+    pa_assert(iov);
+    pa_assert(n_iov > 0 && n_iov <= PA_IOCHANNEL_IOV_MAX);
     pa_assert(io->ofd >= 0);
 
-    pa_zero(iov);
-    iov.iov_base = (void*) data;
-    iov.iov_len = l;
-
     pa_zero(cmsg);
     cmsg.hdr.cmsg_len = CMSG_LEN(sizeof(struct ucred));
     cmsg.hdr.cmsg_level = SOL_SOCKET;
@@ -335,27 +411,96 @@ ssize_t pa_iochannel_write_with_creds(pa_iochannel*io, const void*data, size_t l
     }
 
     pa_zero(mh);
-    mh.msg_iov = &iov;
-    mh.msg_iovlen = 1;
+    mh.msg_iov = (struct iovec*) iov;
+    mh.msg_iovlen = n_iov;
     mh.msg_control = &cmsg;
     mh.msg_controllen = sizeof(cmsg);
 
-    if ((r = sendmsg(io->ofd, &mh, MSG_NOSIGNAL)) >= 0) {
+    if ((r = sendmsg(io->ofd, &mh, MSG_NOSIGNAL)) >= 0 || errno == EAGAIN || errno == EWOULDBLOCK) {
         io->writable = io->hungup = FALSE;
         enable_events(io);
+        r = PA_MAX(r, 0);
     }
 
     return r;
 }
 
+ssize_t pa_iochannel_write_with_creds(pa_iochannel*io, const void*data, size_t l, const pa_creds *ucred) {
+    struct iovec iov;
+
+    pa_assert(data);
+    pa_assert(l);
+
+    iov.iov_base = (void*) data;
+    iov.iov_len = l;
+
+    return pa_iochannel_writev_with_creds(io, &iov, 1, ucred);
+}
+
 ssize_t pa_iochannel_read_with_creds(pa_iochannel*io, void*data, size_t l, pa_creds *creds, pa_bool_t *creds_valid) {
+    unsigned n_fds = 0;
+
+    return pa_iochannel_read_with_ancil(io, data, l, creds, creds_valid, NULL, &n_fds);
+}
+
+ssize_t pa_iochannel_writev_with_fds(pa_iochannel*io, const struct iovec *iov, unsigned n_iov, const int *fds, unsigned n_fds) {
+    ssize_t r;
+    struct msghdr mh;
+    union {
+        struct cmsghdr hdr;
+        uint8_t data[CMSG_SPACE(sizeof(int) * PA_IOCHANNEL_FDS_MAX)];
+    } cmsg;
+
+    pa_assert(io);
+    pa_assert(iov);
+    pa_assert(n_iov > 0 && n_iov <= PA_IOCHANNEL_IOV_MAX);
+    pa_assert(io->ofd >= 0);
+    pa_assert(fds);
+    pa_assert(n_fds > 0 && n_fds <= PA_IOCHANNEL_FDS_MAX);
+
+    pa_zero(cmsg);
+    cmsg.hdr.cmsg_len = CMSG_LEN(sizeof(int) * n_fds);
+    cmsg.hdr.cmsg_level = SOL_SOCKET;
+    cmsg.hdr.cmsg_type = SCM_RIGHTS;
+
+    memcpy(CMSG_DATA(&cmsg.hdr), fds, sizeof(int) * n_fds);
+
+    pa_zero(mh);
+    mh.msg_iov = (struct iovec*) iov;
+    mh.msg_iovlen = n_iov;
+    mh.msg_control = &cmsg;
+    mh.msg_controllen = CMSG_SPACE(sizeof(int) * n_fds);
+
+    if ((r = sendmsg(io->ofd, &mh, MSG_NOSIGNAL)) >= 0 || errno == EAGAIN || errno == EWOULDBLOCK) {
+        io->writable = io->hungup = FALSE;
+        enable_events(io);
+        r = PA_MAX(r, 0);
+    }
+
+    return r;
+}
+
+ssize_t pa_iochannel_write_with_fds(pa_iochannel*io, const void*data, size_t l, const int *fds, unsigned n_fds) {
+    struct iovec iov;
+
+    pa_assert(data);
+    pa_assert(l);
+
+    iov.iov_base = (void*) data;
+    iov.iov_len = l;
+
+    return pa_iochannel_writev_with_fds(io, &iov, 1, fds, n_fds);
+}
+
+ssize_t pa_iochannel_read_with_ancil(pa_iochannel*io, void*data, size_t l, pa_creds *creds, pa_bool_t *creds_valid, int *fds, unsigned *n_fds) {
     ssize_t r;
     struct msghdr mh;
     struct iovec iov;
     union {
         struct cmsghdr hdr;
-        uint8_t data[CMSG_SPACE(sizeof(struct ucred))];
+        uint8_t data[CMSG_SPACE(sizeof(struct ucred)) + CMSG_SPACE(sizeof(int) * PA_IOCHANNEL_FDS_MAX)];
     } cmsg;
+    unsigned max_fds;
 
     pa_assert(io);
     pa_assert(data);
@@ -363,6 +508,11 @@ ssize_t pa_iochannel_read_with_creds(pa_iochannel*io, void*data, size_t l, pa_cr
     pa_assert(io->ifd >= 0);
     pa_assert(creds);
     pa_assert(creds_valid);
+    pa_assert(n_fds);
+    pa_assert(fds || *n_fds == 0);
+
+    max_fds = *n_fds;
+    *n_fds = 0;
 
     pa_zero(iov);
     iov.iov_base = data;
@@ -375,14 +525,21 @@ ssize_t pa_iochannel_read_with_creds(pa_iochannel*io, void*data, size_t l, pa_cr
     mh.msg_control = &cmsg;
     mh.msg_controllen = sizeof(cmsg);
 
-    if ((r = recvmsg(io->ifd, &mh, 0)) >= 0) {
+#ifndef MSG_CMSG_CLOEXEC
+#define MSG_CMSG_CLOEXEC 0
+#endif
+
+    if ((r = recvmsg(io->ifd, &mh, MSG_CMSG_CLOEXEC)) >= 0) {
         struct cmsghdr *cmh;
 
         *creds_valid = FALSE;
 
         for (cmh = CMSG_FIRSTHDR(&mh); cmh; cmh = CMSG_NXTHDR(&mh, cmh)) {
 
-            if (cmh->cmsg_level == SOL_SOCKET && cmh->cmsg_type == SCM_CREDENTIALS) {
+            if (cmh->cmsg_level != SOL_SOCKET)
+                continue;
+
+            if (cmh->cmsg_type == SCM_CREDENTIALS) {
                 struct ucred u;
                 pa_assert(cmh->cmsg_len == CMSG_LEN(sizeof(struct ucred)));
                 memcpy(&u, CMSG_DATA(cmh), sizeof(struct ucred));
@@ -390,7 +547,23 @@ ssize_t pa_iochannel_read_with_creds(pa_iochannel*io, void*data, size_t l, pa_cr
                 creds->gid = u.gid;
                 creds->uid = u.uid;
                 *creds_valid = TRUE;
-                break;
+
+            } else if (cmh->cmsg_type == SCM_RIGHTS) {
+                unsigned i, n;
+
+                n = (unsigned) ((cmh->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+
+                /* Descriptors we did not ask for must not leak */
+                for (i = 0; i < n; i++) {
+                    int fd;
+
+                    memcpy(&fd, CMSG_DATA(cmh) + i * sizeof(int), sizeof(int));
+
+                    if (*n_fds < max_fds)
+                        fds[(*n_fds)++] = fd;
+                    else
+                        pa_close(fd);
+                }
             }
         }
 
@@ -29,6 +29,15 @@
 
 #include <sys/types.h>
 
+#ifdef HAVE_SYS_UIO_H
+#include <sys/uio.h>
+#else
+struct iovec {
+    void *iov_base;
+    size_t iov_len;
+};
+#endif
+
 #include <pulse/mainloop-api.h>
 #include <pulsecore/creds.h>
 #include <pulsecore/macro.h>
@@ -53,12 +62,26 @@ void pa_iochannel_free(pa_iochannel*io);
 ssize_t pa_iochannel_write(pa_iochannel*io, const void*data, size_t l);
 ssize_t pa_iochannel_read(pa_iochannel*io, void*data, size_t l);
 
+/* Gather write of up to PA_IOCHANNEL_IOV_MAX buffers in one system
+ * call. Same return values as pa_iochannel_write(). */
+#define PA_IOCHANNEL_IOV_MAX 32
+ssize_t pa_iochannel_writev(pa_iochannel*io, const struct iovec *iov, unsigned n_iov);
+
 #ifdef HAVE_CREDS
 pa_bool_t pa_iochannel_creds_supported(pa_iochannel *io);
 int pa_iochannel_creds_enable(pa_iochannel *io);
 
 ssize_t pa_iochannel_write_with_creds(pa_iochannel*io, const void*data, size_t l, const pa_creds *ucred);
+ssize_t pa_iochannel_writev_with_creds(pa_iochannel*io, const struct iovec *iov, unsigned n_iov, const pa_creds *ucred);
 ssize_t pa_iochannel_read_with_creds(pa_iochannel*io, void*data, size_t l, pa_creds *ucred, pa_bool_t *creds_valid);
+
+#define PA_IOCHANNEL_FDS_MAX 2
+
+/* Pass file descriptors along with the data. The receiver gets ownership
+ * of up to *n_fds descriptors, the rest is closed. */
+ssize_t pa_iochannel_write_with_fds(pa_iochannel*io, const void*data, size_t l, const int *fds, unsigned n_fds);
+ssize_t pa_iochannel_writev_with_fds(pa_iochannel*io, const struct iovec *iov, unsigned n_iov, const int *fds, unsigned n_fds);
+ssize_t pa_iochannel_read_with_ancil(pa_iochannel*io, void*data, size_t l, pa_creds *ucred, pa_bool_t *creds_valid, int *fds, unsigned *n_fds);
 #endif
 
 pa_bool_t pa_iochannel_is_readable(pa_iochannel*io);
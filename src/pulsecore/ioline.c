@@ -63,6 +63,7 @@ struct pa_ioline {
 
     pa_bool_t dead:1;
     pa_bool_t defer_close:1;
+    pa_bool_t corked:1;
 };
 
 static void io_callback(pa_iochannel*io, void *userdata);
@@ -95,6 +96,7 @@ pa_ioline* pa_ioline_new(pa_iochannel *io) {
 
     l->dead = FALSE;
     l->defer_close = FALSE;
+    l->corked = FALSE;
 
     pa_iochannel_set_callback(io, io_callback, l);
 
@@ -248,7 +250,7 @@ static void scan_for_lines(pa_ioline *l, size_t skip) {
     pa_assert(PA_REFCNT_VALUE(l) >= 1);
     pa_assert(skip < l->rbuf_valid_length);
 
-    while (!l->dead && l->rbuf_valid_length > skip) {
+    while (!l->dead && !l->corked && l->rbuf_valid_length > skip) {
         char *e, *p;
         size_t m;
 
@@ -274,7 +276,7 @@ static void scan_for_lines(pa_ioline *l, size_t skip) {
     }
 
     /* If the buffer became too large and still no newline was found, drop it. */
-    if (l->rbuf_valid_length >= BUFFER_LIMIT)
+    if (!l->corked && l->rbuf_valid_length >= BUFFER_LIMIT)
         l->rbuf_index = l->rbuf_valid_length = 0;
 }
 
@@ -284,7 +286,7 @@ static int do_read(pa_ioline *l) {
     pa_assert(l);
     pa_assert(PA_REFCNT_VALUE(l) >= 1);
 
-    while (l->io && !l->dead && pa_iochannel_is_readable(l->io)) {
+    while (l->io && !l->dead && !l->corked && pa_iochannel_is_readable(l->io)) {
         ssize_t r;
         size_t len;
 
@@ -384,6 +386,10 @@ static void do_work(pa_ioline *l) {
 
     l->mainloop->defer_enable(l->defer_event, 0);
 
+    /* Lines that arrived while we were corked */
+    if (!l->dead && !l->corked && l->rbuf_valid_length > 0)
+        scan_for_lines(l, 0);
+
     if (!l->dead)
         do_read(l);
 
@@ -442,6 +448,22 @@ void pa_ioline_printf(pa_ioline *l, const char *format, ...) {
     pa_xfree(t);
 }
 
+void pa_ioline_cork(pa_ioline *l, pa_bool_t b) {
+    pa_assert(l);
+    pa_assert(PA_REFCNT_VALUE(l) >= 1);
+
+    if (l->dead || l->corked == !!b)
+        return;
+
+    l->corked = !!b;
+
+    /* While corked the iochannel keeps its readable flag and doesn't
+     * wake us up for more input, so kick off the lines and the data
+     * that piled up in the meantime ourselves */
+    if (!l->corked)
+        l->mainloop->defer_enable(l->defer_event, 1);
+}
+
 pa_iochannel* pa_ioline_detach_iochannel(pa_ioline *l) {
     pa_iochannel *r;
 
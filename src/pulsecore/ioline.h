@@ -55,6 +55,12 @@ void pa_ioline_set_drain_callback(pa_ioline*io, pa_ioline_drain_cb_t callback, v
 /* Make sure to close the ioline object as soon as the send buffer is emptied */
 void pa_ioline_defer_close(pa_ioline *io);
 
+/* Stop or resume passing received lines to the callback. While
+ * corked nothing more is read from the iochannel either, so a client
+ * that sends commands faster than the replies can be written out is
+ * throttled. */
+void pa_ioline_cork(pa_ioline *io, pa_bool_t b);
+
 /* Returns TRUE when everything was written */
 pa_bool_t pa_ioline_is_drained(pa_ioline *io);
 
@@ -51,7 +51,11 @@
 #include <pulsecore/core-error.h>
 #include <pulsecore/once.h>
 #include <pulsecore/ratelimit.h>
+#include <pulsecore/rtcheck.h>
 #include <pulsecore/thread.h>
+#include <pulsecore/mutex.h>
+#include <pulsecore/semaphore.h>
+#include <pulsecore/atomic.h>
 #include <pulsecore/i18n.h>
 
 #include "log.h"
@@ -68,6 +72,11 @@
 #define ENV_LOG_NO_RATELIMIT "PULSE_LOG_NO_RATE_LIMIT"
 #define LOG_MAX_SUFFIX_NUMBER 99
 
+/* Per thread ring buffer size for asynchronous logging, and how much of
+ * a message fits into one entry */
+#define ASYNC_RING_SIZE 64
+#define ASYNC_TEXT_MAX 512
+
 static char *ident = NULL; /* in local charset format */
 static pa_log_target target = { PA_LOG_STDERR, NULL };
 static pa_log_target_type_t target_override;
@@ -78,6 +87,40 @@ static pa_log_flags_t flags = 0, flags_override = 0;
 static pa_bool_t no_rate_limit = FALSE;
 static int log_fd = -1;
 
+/* A message waiting in a ring buffer for the logger thread. file and
+ * func point to string literals, so they may be used later on. */
+struct async_message {
+    pa_log_level_t level;
+    const char *file;
+    int line;
+    const char *func;
+    pa_usec_t time;
+    char text[ASYNC_TEXT_MAX];
+};
+
+/* Each logging thread writes into its own ring, and the logger thread
+ * is the only reader. Hence all we need are two indexes. */
+struct async_ring {
+    pa_atomic_t read_idx, write_idx;
+    pa_atomic_t dropped;
+    pa_atomic_t dead;
+    unsigned dropped_reported;
+    char thread_name[32];
+    struct async_ring *next;
+    struct async_message messages[ASYNC_RING_SIZE];
+};
+
+static pa_atomic_t async_enabled = PA_ATOMIC_INIT(0);
+static pa_atomic_t async_quit = PA_ATOMIC_INIT(0);
+static pa_atomic_t async_dropped = PA_ATOMIC_INIT(0);
+static pa_static_mutex async_mutex = PA_STATIC_MUTEX_INIT;
+static struct async_ring *async_rings = NULL;
+static pa_thread *async_thread = NULL;
+static pa_semaphore *async_semaphore = NULL;
+
+static void async_ring_release(void *p);
+PA_STATIC_TLS_DECLARE(async_ring, async_ring_release);
+
 #ifdef HAVE_SYSLOG_H
 static const int level_to_syslog[] = {
     [PA_LOG_ERROR] = LOG_ERR,
@@ -325,47 +368,28 @@ static void init_defaults(void) {
     } PA_ONCE_END;
 }
 
-void pa_log_levelv_meta(
+/* Formats and writes out a message that has already passed the level
+ * check. text is modified in place. */
+static void write_message(
         pa_log_level_t level,
-        const char*file,
+        const char *file,
         int line,
         const char *func,
-        const char *format,
-        va_list ap) {
+        const char *thread_name,
+        pa_usec_t now,
+        char *text,
+        pa_log_target_type_t _target,
+        unsigned _show_backtrace,
+        pa_log_flags_t _flags) {
 
     char *t, *n;
-    int saved_errno = errno;
     char *bt = NULL;
-    pa_log_target_type_t _target;
-    pa_log_level_t _maximum_level;
-    unsigned _show_backtrace;
-    pa_log_flags_t _flags;
-
-    /* We don't use dynamic memory allocation here to minimize the hit
-     * in RT threads */
-    char text[16*1024], location[128], timestamp[32];
-
-    pa_assert(level < PA_LOG_LEVEL_MAX);
-    pa_assert(format);
-
-    init_defaults();
-
-    _target = target_override_set ? target_override : target.type;
-    _maximum_level = PA_MAX(maximum_level, maximum_level_override);
-    _show_backtrace = PA_MAX(show_backtrace, show_backtrace_override);
-    _flags = flags | flags_override;
-
-    if (PA_LIKELY(level > _maximum_level)) {
-        errno = saved_errno;
-        return;
-    }
-
-    pa_vsnprintf(text, sizeof(text), format, ap);
+    char location[128], timestamp[32];
 
     if ((_flags & PA_LOG_PRINT_META) && file && line > 0 && func)
-        pa_snprintf(location, sizeof(location), "[%s][%s:%i %s()] ", pa_thread_get_name(pa_thread_self()), file, line, func);
+        pa_snprintf(location, sizeof(location), "[%s][%s:%i %s()] ", thread_name, file, line, func);
     else if ((_flags & (PA_LOG_PRINT_META|PA_LOG_PRINT_FILE)) && file)
-        pa_snprintf(location, sizeof(location), "[%s] %s: ", pa_thread_get_name(pa_thread_self()), pa_path_get_filename(file));
+        pa_snprintf(location, sizeof(location), "[%s] %s: ", thread_name, pa_path_get_filename(file));
     else
         location[0] = 0;
 
@@ -373,15 +397,15 @@ void pa_log_levelv_meta(
         static pa_usec_t start, last;
         pa_usec_t u, a, r;
 
-        u = pa_rtclock_now();
+        u = now;
 
         PA_ONCE_BEGIN {
             start = u;
             last = u;
         } PA_ONCE_END;
 
-        r = u - last;
-        a = u - start;
+        r = u > last ? u - last : 0;
+        a = u > start ? u - start : 0;
 
         /* This is not thread safe, but this is a debugging tool only
          * anyway. */
@@ -415,7 +439,6 @@ void pa_log_levelv_meta(
             continue;
 
         switch (_target) {
-
             case PA_LOG_STDERR: {
                 const char *prefix = "", *suffix = "", *grey = "";
                 char *local_t;
@@ -479,7 +502,6 @@ void pa_log_levelv_meta(
 
                     if ((write(log_fd, metadata, strlen(metadata)) < 0) || (write(log_fd, t, strlen(t)) < 0)) {
                         pa_log_target new_target = { .type = PA_LOG_STDERR, .file = NULL };
-                        saved_errno = errno;
                         pa_log_set_fd(-1);
                         fprintf(stderr, "%s\n", "Error writing logs to a file descriptor. Redirect log messages to console.");
                         fprintf(stderr, "%s %s\n", metadata, t);
@@ -496,6 +518,226 @@ void pa_log_levelv_meta(
     }
 
     pa_xfree(bt);
+}
+
+/* Called from the thread that logs */
+static struct async_ring *get_async_ring(void) {
+    struct async_ring *r;
+    pa_mutex *m;
+
+    if ((r = PA_STATIC_TLS_GET(async_ring)))
+        return r;
+
+    /* This is the only time a thread allocates memory or takes a lock
+     * for asynchronous logging */
+    r = pa_xnew0(struct async_ring, 1);
+    pa_strlcpy(r->thread_name, pa_strnull(pa_thread_get_name(pa_thread_self())), sizeof(r->thread_name));
+
+    m = pa_static_mutex_get(&async_mutex, FALSE, FALSE);
+    pa_mutex_lock(m);
+    r->next = async_rings;
+    async_rings = r;
+    pa_mutex_unlock(m);
+
+    PA_STATIC_TLS_SET(async_ring, r);
+    return r;
+}
+
+/* Called when a thread that logged asynchronously exits. The ring is
+ * freed by the logger thread once it has been drained. */
+static void async_ring_release(void *p) {
+    struct async_ring *r = p;
+
+    pa_atomic_store(&r->dead, 1);
+}
+
+/* Called from the thread that logs. Never blocks, if the ring is full the
+ * message is dropped and counted. */
+static void push_async(
+        pa_log_level_t level,
+        const char *file,
+        int line,
+        const char *func,
+        const char *format,
+        va_list ap) {
+
+    struct async_ring *r;
+    struct async_message *m;
+    int w;
+
+    r = get_async_ring();
+    w = pa_atomic_load(&r->write_idx);
+
+    if ((unsigned) w - (unsigned) pa_atomic_load(&r->read_idx) >= ASYNC_RING_SIZE) {
+        pa_atomic_inc(&r->dropped);
+        pa_atomic_inc(&async_dropped);
+        return;
+    }
+
+    m = &r->messages[(unsigned) w % ASYNC_RING_SIZE];
+    m->level = level;
+    m->file = file;
+    m->line = line;
+    m->func = func;
+    m->time = pa_rtclock_now();
+    pa_vsnprintf(m->text, sizeof(m->text), format, ap);
+
+    pa_atomic_inc(&r->write_idx);
+
+    /* Wake up the logger only if it might have found the ring empty.
+     * Either it sees our new write index, or we see that it has caught
+     * up with us. */
+    if (pa_atomic_load(&r->read_idx) == w)
+        pa_semaphore_post(async_semaphore);
+}
+
+/* Drains all rings, frees those of threads that exited. Called with
+ * async_mutex held. */
+static void drain_async(void) {
+    struct async_ring *r, **p;
+    pa_log_target_type_t _target = target_override_set ? target_override : target.type;
+    unsigned _show_backtrace = PA_MAX(show_backtrace, show_backtrace_override);
+    pa_log_flags_t _flags = flags | flags_override;
+
+    for (p = &async_rings; (r = *p); ) {
+        pa_bool_t dead = !!pa_atomic_load(&r->dead);
+        unsigned dropped;
+        int ri;
+
+        /* If the thread has exited, everything it wrote is visible by
+         * now, hence checking before draining is enough */
+        while ((ri = pa_atomic_load(&r->read_idx)) != pa_atomic_load(&r->write_idx)) {
+            struct async_message *m = &r->messages[(unsigned) ri % ASYNC_RING_SIZE];
+
+            write_message(m->level, m->file, m->line, m->func, r->thread_name, m->time, m->text, _target, _show_backtrace, _flags);
+            pa_atomic_inc(&r->read_idx);
+        }
+
+        if ((dropped = (unsigned) pa_atomic_load(&r->dropped)) != r->dropped_reported) {
+            char text[128];
+
+            pa_snprintf(text, sizeof(text), "Dropped %u log messages of thread %s, total %u.",
+                        dropped - r->dropped_reported, r->thread_name, dropped);
+            write_message(PA_LOG_WARN, NULL, 0, NULL, r->thread_name, pa_rtclock_now(), text, _target, _show_backtrace, _flags);
+            r->dropped_reported = dropped;
+        }
+
+        if (dead) {
+            *p = r->next;
+            pa_xfree(r);
+        } else
+            p = &r->next;
+    }
+}
+
+static void async_thread_func(void *userdata) {
+    pa_mutex *m = pa_static_mutex_get(&async_mutex, FALSE, FALSE);
+
+    while (!pa_atomic_load(&async_quit)) {
+        pa_semaphore_wait(async_semaphore);
+
+        pa_mutex_lock(m);
+        drain_async();
+        pa_mutex_unlock(m);
+    }
+}
+
+void pa_log_set_async(pa_bool_t b) {
+    pa_mutex *m;
+
+    init_defaults();
+
+    m = pa_static_mutex_get(&async_mutex, FALSE, FALSE);
+
+    if (b) {
+        if (async_thread)
+            return;
+
+        /* Never freed, since threads that are just logging might still
+         * post it after we disabled asynchronous logging again */
+        if (!async_semaphore)
+            async_semaphore = pa_semaphore_new(0);
+
+        pa_atomic_store(&async_quit, 0);
+
+        if (!(async_thread = pa_thread_new("logger", async_thread_func, NULL)))
+            return;
+
+        pa_atomic_store(&async_enabled, 1);
+
+    } else {
+        if (!async_thread)
+            return;
+
+        pa_atomic_store(&async_enabled, 0);
+        pa_atomic_store(&async_quit, 1);
+        pa_semaphore_post(async_semaphore);
+
+        pa_thread_free(async_thread);
+        async_thread = NULL;
+
+        /* Write out what the logger thread didn't get to anymore */
+        pa_mutex_lock(m);
+        drain_async();
+        pa_mutex_unlock(m);
+    }
+}
+
+unsigned pa_log_get_dropped(void) {
+    return (unsigned) pa_atomic_load(&async_dropped);
+}
+
+void pa_log_levelv_meta(
+        pa_log_level_t level,
+        const char*file,
+        int line,
+        const char *func,
+        const char *format,
+        va_list ap) {
+
+    int saved_errno = errno;
+    pa_log_target_type_t _target;
+    pa_log_level_t _maximum_level;
+    unsigned _show_backtrace;
+    pa_log_flags_t _flags;
+
+    /* We don't use dynamic memory allocation here to minimize the hit
+     * in RT threads */
+    char text[16*1024];
+
+    pa_assert(level < PA_LOG_LEVEL_MAX);
+    pa_assert(format);
+
+    init_defaults();
+
+    _target = target_override_set ? target_override : target.type;
+    _maximum_level = PA_MAX(maximum_level, maximum_level_override);
+    _show_backtrace = PA_MAX(show_backtrace, show_backtrace_override);
+    _flags = flags | flags_override;
+
+    if (PA_LIKELY(level > _maximum_level)) {
+        errno = saved_errno;
+        return;
+    }
+
+    pa_rtcheck(PA_RTCHECK_LOG);
+
+    /* Errors are written out right away, since they are rare and might
+     * be followed by an abort(). Backtraces have to be taken now, too. */
+    if (pa_atomic_load(&async_enabled) &&
+        level > PA_LOG_ERROR &&
+        _show_backtrace <= 0 &&
+        pa_thread_self() != async_thread) {
+
+        push_async(level, file, line, func, format, ap);
+        errno = saved_errno;
+        return;
+    }
+
+    pa_vsnprintf(text, sizeof(text), format, ap);
+
+    write_message(level, file, line, func, pa_thread_get_name(pa_thread_self()), pa_rtclock_now(), text, _target, _show_backtrace, _flags);
+
     errno = saved_errno;
 }
 
@@ -90,6 +90,15 @@ void pa_log_set_show_backtrace(unsigned nlevels);
 /* Skip the first backtrace frames */
 void pa_log_set_skip_backtrace(unsigned nlevels);
 
+/* Enable asynchronous logging: messages are copied into a ring buffer
+ * of the calling thread and written out by a separate logger
+ * thread. Errors and messages that need a backtrace are still written
+ * synchronously. If a ring is full, messages are dropped. */
+void pa_log_set_async(pa_bool_t b);
+
+/* Number of messages dropped because a ring buffer was full */
+unsigned pa_log_get_dropped(void);
+
 void pa_log_level_meta(
         pa_log_level_t level,
         const char*file,
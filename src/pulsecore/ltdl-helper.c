@@ -26,6 +26,7 @@
 
 #include <stdlib.h>
 #include <ctype.h>
+#include <string.h>
 
 #include <pulse/xmalloc.h>
 
@@ -63,3 +64,26 @@ pa_void_func_t pa_load_sym(lt_dlhandle handle, const char *module, const char *s
 
     return f;
 }
+
+lt_dlhandle pa_dlopenext_in_path(const char *name, const char *path) {
+    const char *state = NULL;
+    char *dir;
+    lt_dlhandle handle;
+
+    pa_assert(name);
+
+    if (path && !strchr(name, '/'))
+        while ((dir = pa_split(path, ":", &state))) {
+            char *fn;
+
+            fn = pa_sprintf_malloc("%s" PA_PATH_SEP "%s", dir, name);
+            handle = lt_dlopenext(fn);
+            pa_xfree(fn);
+            pa_xfree(dir);
+
+            if (handle)
+                return handle;
+        }
+
+    return lt_dlopenext(name);
+}
@@ -28,4 +28,9 @@ typedef void (*pa_void_func_t)(void);
 
 pa_void_func_t pa_load_sym(lt_dlhandle handle, const char*module, const char *symbol);
 
+/* Like lt_dlopenext(), but looks into the directories of the
+ * colon-separated path first. The global search path of ltdl is left
+ * alone. */
+lt_dlhandle pa_dlopenext_in_path(const char *name, const char *path);
+
 #endif
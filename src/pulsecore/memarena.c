@@ -0,0 +1,196 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/refcnt.h>
+#include <pulsecore/thread.h>
+
+#include "memarena.h"
+
+/* Every block is preceded by a header pointing back to the arena, so
+ * that the free callback can find it. The header is padded so that
+ * the data stays aligned for SIMD code. */
+#define ARENA_ALIGN 32
+
+struct header {
+    pa_memarena *arena;
+};
+
+#define HEADER_SIZE PA_ROUND_UP(sizeof(struct header), ARENA_ALIGN)
+
+struct pa_memarena {
+    /* One reference is held by the owner, one by every block in use */
+    PA_REFCNT_DECLARE;
+
+    pa_mempool *pool;
+    uint8_t *buffer;
+    size_t size, offset;
+    pa_bool_t touched;
+};
+
+PA_STATIC_TLS_DECLARE_NO_FREE(current_arena);
+
+pa_memarena *pa_memarena_new(pa_mempool *p, size_t size) {
+    pa_memarena *a;
+
+    pa_assert(p);
+    pa_assert(size > 0);
+
+    a = pa_xnew(pa_memarena, 1);
+    PA_REFCNT_INIT(a);
+    a->pool = pa_mempool_ref(p);
+    a->size = PA_ROUND_UP(size, ARENA_ALIGN);
+    a->offset = 0;
+    a->touched = FALSE;
+
+    /* Over-allocate so that we can align the start ourselves */
+    a->buffer = pa_xmalloc(a->size + ARENA_ALIGN);
+
+    return a;
+}
+
+static void arena_unref(pa_memarena *a) {
+    pa_assert(a);
+    pa_assert(PA_REFCNT_VALUE(a) >= 1);
+
+    if (PA_REFCNT_DEC(a) > 0)
+        return;
+
+    pa_mempool_unref(a->pool);
+    pa_xfree(a->buffer);
+    pa_xfree(a);
+}
+
+void pa_memarena_free(pa_memarena *a) {
+    pa_assert(a);
+
+    if (PA_STATIC_TLS_GET(current_arena) == a)
+        PA_STATIC_TLS_SET(current_arena, NULL);
+
+    /* Blocks still in use keep the memory around */
+    arena_unref(a);
+}
+
+/* Called from whatever thread releases the last reference of a block */
+static void block_free_cb(void *d) {
+    struct header *h = (struct header*) ((uint8_t*) d - HEADER_SIZE);
+
+    arena_unref(h->arena);
+}
+
+pa_memblock *pa_memarena_alloc(pa_memarena *a, size_t length) {
+    uint8_t *start;
+    struct header *h;
+    size_t l;
+
+    pa_assert(a);
+    pa_assert(PA_REFCNT_VALUE(a) >= 1);
+
+    if (length == (size_t) -1)
+        length = pa_mempool_block_size_max(a->pool);
+
+    pa_assert(length > 0);
+
+    l = HEADER_SIZE + PA_ROUND_UP(length, ARENA_ALIGN);
+
+    if (l > a->size - a->offset)
+        return pa_memblock_new(a->pool, length);
+
+    start = (uint8_t*) PA_ROUND_UP((uintptr_t) a->buffer, ARENA_ALIGN) + a->offset;
+    a->offset += l;
+
+    h = (struct header*) start;
+    h->arena = a;
+    PA_REFCNT_INC(a);
+
+    return pa_memblock_new_user(a->pool, start + HEADER_SIZE, length, block_free_cb, FALSE);
+}
+
+void pa_memarena_reset(pa_memarena *a) {
+    pa_assert(a);
+
+    if (PA_REFCNT_VALUE(a) == 1)
+        a->offset = 0;
+}
+
+void pa_memarena_set_thread(pa_memarena *a) {
+
+    /* Nothing has written to the buffer yet, so its pages get placed
+     * on the NUMA node of the thread that touches them first. Make
+     * sure that is the thread using the arena. */
+    if (a && !a->touched) {
+        memset(a->buffer, 0, a->size + ARENA_ALIGN);
+        a->touched = TRUE;
+    }
+
+    PA_STATIC_TLS_SET(current_arena, a);
+}
+
+pa_memblock *pa_memblock_new_scratch(pa_mempool *p, size_t length) {
+    pa_memarena *a;
+
+    pa_assert(p);
+
+    if ((a = PA_STATIC_TLS_GET(current_arena)) && a->pool == p)
+        return pa_memarena_alloc(a, length);
+
+    return pa_memblock_new(p, length);
+}
+
+pa_memchunk *pa_memchunk_make_writable_scratch(pa_memchunk *c, size_t min) {
+    pa_memblock *n;
+    size_t l;
+    void *tdata, *sdata;
+
+    pa_assert(c);
+    pa_assert(c->memblock);
+
+    if (pa_memblock_ref_is_one(c->memblock) &&
+        !pa_memblock_is_read_only(c->memblock) &&
+        pa_memblock_get_length(c->memblock) >= c->index+min)
+        return c;
+
+    l = PA_MAX(c->length, min);
+
+    n = pa_memblock_new_scratch(pa_memblock_get_pool(c->memblock), l);
+
+    sdata = pa_memblock_acquire(c->memblock);
+    tdata = pa_memblock_acquire(n);
+
+    memcpy(tdata, (uint8_t*) sdata + c->index, c->length);
+
+    pa_memblock_release(c->memblock);
+    pa_memblock_release(n);
+
+    pa_memblock_unref(c->memblock);
+
+    c->memblock = n;
+    c->index = 0;
+
+    return c;
+}
@@ -0,0 +1,60 @@
+#ifndef foopulsememarenahfoo
+#define foopulsememarenahfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <pulsecore/macro.h>
+#include <pulsecore/memblock.h>
+#include <pulsecore/memchunk.h>
+
+/* A bump allocator for memory blocks that are only needed for a very
+ * short time, typically the temporary buffers of one render cycle of
+ * an IO thread. Blocks are handed out in order from one big buffer;
+ * the arena starts over from the beginning on pa_memarena_reset(),
+ * but only once every block handed out before has been released
+ * again. Blocks that happen to live longer are hence perfectly safe,
+ * they just keep the arena from being reused for a while. When the
+ * arena is full allocation falls back to the memory pool. */
+
+typedef struct pa_memarena pa_memarena;
+
+pa_memarena *pa_memarena_new(pa_mempool *p, size_t size);
+void pa_memarena_free(pa_memarena *a);
+
+/* Allocate a block from the arena, or from the pool if it is full */
+pa_memblock *pa_memarena_alloc(pa_memarena *a, size_t length);
+
+/* Start over at the beginning, if no block is in use anymore */
+void pa_memarena_reset(pa_memarena *a);
+
+/* Make a the arena that pa_memblock_new_scratch() uses in the calling
+ * thread. Pass NULL to unset. The first call faults in the arena's
+ * memory, hence do it after binding the thread to its CPUs. */
+void pa_memarena_set_thread(pa_memarena *a);
+
+/* Like pa_memblock_new(), but uses the arena of the calling thread if
+ * there is one for this pool. Only for blocks that are released again
+ * before the thread's arena is reset. */
+pa_memblock *pa_memblock_new_scratch(pa_mempool *p, size_t length);
+
+/* Like pa_memchunk_make_writable(), but copies into a scratch block */
+pa_memchunk *pa_memchunk_make_writable_scratch(pa_memchunk *c, size_t min);
+
+#endif
@@ -49,6 +49,8 @@
 #include <pulsecore/flist.h>
 #include <pulsecore/core-util.h>
 #include <pulsecore/memtrap.h>
+#include <pulsecore/memowner.h>
+#include <pulsecore/thread.h>
 
 #include "memblock.h"
 
@@ -59,6 +61,31 @@
 #define PA_MEMPOOL_SLOTS_MAX 1024
 #define PA_MEMPOOL_SLOT_SIZE (64*1024)
 
+/* The pool is split into classes of equally sized slots which all live in
+ * the same SHM segment. Each class gets the given share (in 16ths) of the
+ * pool size. A block is placed in the smallest class it fits in and moves
+ * on to the next larger class if that one is full. The PA_MEMPOOL_SLOT_SIZE
+ * class defines pa_mempool_block_size_max(). */
+#define PA_MEMPOOL_CLASSES_MAX 4
+#define PA_MEMPOOL_CLASS_DEFAULT 2
+
+/* Every thread keeps a few free slots of each class for itself, so that
+ * the global free lists are only touched once per half a cache. Slots
+ * don't move between the caches, hence a thread may only keep a small
+ * share of a class, and none of classes with too few slots to share. */
+#define PA_MEMPOOL_CACHE_SLOTS 16
+#define PA_MEMPOOL_CACHE_SHARE 8
+
+static const struct {
+    size_t size;
+    unsigned share;
+} mempool_class_table[PA_MEMPOOL_CLASSES_MAX] = {
+    { 1024, 1 },
+    { 8*1024, 2 },
+    { PA_MEMPOOL_SLOT_SIZE, 10 },
+    { 256*1024, 3 }
+};
+
 #define PA_MEMEXPORT_SLOTS_MAX 128
 
 #define PA_MEMIMPORT_SLOTS_MAX 160
@@ -67,6 +94,7 @@
 struct pa_memblock {
     PA_REFCNT_DECLARE; /* the reference counter */
     pa_mempool *pool;
+    pa_memowner *owner;
 
     pa_memblock_type_t type;
 
@@ -95,8 +123,16 @@ struct pa_memblock {
 struct pa_memimport_segment {
     pa_memimport *import;
     pa_shm memory;
+
+    /* Only for POSIX SHM segments, NULL for sealed memfds */
     pa_memtrap *trap;
     unsigned n_blocks;
+
+    /* memfd segments are only passed to us once, so they stay attached
+     * until the import goes away. POSIX SHM segments stay mapped while
+     * idle too, but are checked before they are used again and may be
+     * evicted to make room for new ones. */
+    pa_bool_t permanent;
 };
 
 /* A collection of multiple segments */
@@ -124,6 +160,9 @@ struct pa_memexport {
     pa_mutex *mutex;
     pa_mempool *pool;
 
+    /* The owner of the pool when the export was created, or NULL */
+    pa_memowner *owner;
+
     struct memexport_slot slots[PA_MEMEXPORT_SLOTS_MAX];
 
     PA_LLIST_HEAD(struct memexport_slot, free_slots);
@@ -139,23 +178,65 @@ struct pa_memexport {
     PA_LLIST_FIELDS(pa_memexport);
 };
 
+struct mempool_class {
+    size_t block_size;
+    unsigned n_blocks;
+
+    /* Where the slots of this class start in the SHM segment */
+    size_t offset;
+
+    pa_atomic_t n_init;
+
+    /* How many free slots a thread may keep in its cache */
+    unsigned cache_slots;
+
+    /* A list of free slots that may be reused */
+    pa_flist *free_slots;
+};
+
+struct mempool_cache {
+    pa_mempool *pool;
+    char *thread_name;
+
+    struct {
+        unsigned n;
+        struct mempool_slot *slots[PA_MEMPOOL_CACHE_SLOTS];
+    } classes[PA_MEMPOOL_CLASSES_MAX];
+
+    /* Totals for this thread, and what has not been added to the pool
+     * statistics yet */
+    unsigned n_hits, n_misses;
+    unsigned n_hits_pending;
+
+    PA_LLIST_FIELDS(struct mempool_cache);
+};
+
 struct pa_mempool {
+    /* Every memblock holds a reference to its pool, so that pools
+     * outlive their owner as long as blocks are still in flight */
+    PA_REFCNT_DECLARE;
+
     pa_semaphore *semaphore;
     pa_mutex *mutex;
 
     pa_shm memory;
-    size_t block_size;
-    unsigned n_blocks;
+    pa_shm_huge_pages_t huge_pages;
 
-    pa_atomic_t n_init;
+    /* Ordered by block size, classes without slots have n_blocks == 0 */
+    struct mempool_class classes[PA_MEMPOOL_CLASSES_MAX];
 
     PA_LLIST_HEAD(pa_memimport, imports);
     PA_LLIST_HEAD(pa_memexport, exports);
 
-    /* A list of free slots that may be reused */
-    pa_flist *free_slots;
+    /* The slot caches of all threads that used this pool, protected by
+     * the mutex. NULL if we ran out of TLS keys. */
+    pa_tls *caches_tls;
+    PA_LLIST_HEAD(struct mempool_cache, caches);
 
     pa_mempool_stat stat;
+
+    /* Who blocks are charged to if their thread has no owner, or NULL */
+    pa_memowner *owner;
 };
 
 static void segment_detach(pa_memimport_segment *seg);
@@ -180,6 +261,24 @@ static void stat_add(pa_memblock*b) {
 
     pa_atomic_inc(&b->pool->stat.n_allocated_by_type[b->type]);
     pa_atomic_inc(&b->pool->stat.n_accumulated_by_type[b->type]);
+
+    /* Imports always belong to whoever the pool is for */
+    if (b->type == PA_MEMBLOCK_IMPORTED && b->pool->owner)
+        b->owner = b->pool->owner;
+    else if (!(b->owner = pa_memowner_get_current()))
+        b->owner = b->pool->owner;
+
+    if (b->owner) {
+        pa_memowner_stat *ostat = pa_memowner_get_stat(pa_memowner_ref(b->owner));
+
+        pa_atomic_inc(&ostat->n_allocated);
+        pa_atomic_add(&ostat->allocated_size, (int) b->length);
+
+        if (b->type == PA_MEMBLOCK_IMPORTED) {
+            pa_atomic_inc(&ostat->n_imported);
+            pa_atomic_add(&ostat->imported_size, (int) b->length);
+        }
+    }
 }
 
 /* No lock necessary */
@@ -202,6 +301,21 @@ static void stat_remove(pa_memblock *b) {
     }
 
     pa_atomic_dec(&b->pool->stat.n_allocated_by_type[b->type]);
+
+    if (b->owner) {
+        pa_memowner_stat *ostat = pa_memowner_get_stat(b->owner);
+
+        pa_atomic_dec(&ostat->n_allocated);
+        pa_atomic_sub(&ostat->allocated_size, (int) b->length);
+
+        if (b->type == PA_MEMBLOCK_IMPORTED) {
+            pa_atomic_dec(&ostat->n_imported);
+            pa_atomic_sub(&ostat->imported_size, (int) b->length);
+        }
+
+        pa_memowner_unref(b->owner);
+        b->owner = NULL;
+    }
 }
 
 static pa_memblock *memblock_new_appended(pa_mempool *p, size_t length);
@@ -233,7 +347,7 @@ static pa_memblock *memblock_new_appended(pa_mempool *p, size_t length) {
 
     b = pa_xmalloc(PA_ALIGN(sizeof(pa_memblock)) + length);
     PA_REFCNT_INIT(b);
-    b->pool = p;
+    b->pool = pa_mempool_ref(p);
     b->type = PA_MEMBLOCK_APPENDED;
     b->read_only = b->is_silence = FALSE;
     pa_atomic_ptr_store(&b->data, (uint8_t*) b + PA_ALIGN(sizeof(pa_memblock)));
@@ -245,67 +359,237 @@ static pa_memblock *memblock_new_appended(pa_mempool *p, size_t length) {
     return b;
 }
 
+/* Hand all slots of a cache back to the global free lists */
+static void mempool_cache_drain(struct mempool_cache *cache) {
+    unsigned i;
+
+    pa_assert(cache);
+
+    for (i = 0; i < PA_MEMPOOL_CLASSES_MAX; i++)
+        while (cache->classes[i].n > 0)
+            while (pa_flist_push(cache->pool->classes[i].free_slots, cache->classes[i].slots[--cache->classes[i].n]) < 0)
+                ;
+
+    pa_atomic_add(&cache->pool->stat.n_slot_cache_hits, (int) cache->n_hits_pending);
+    cache->n_hits_pending = 0;
+}
+
+static void mempool_cache_free(struct mempool_cache *cache) {
+    pa_assert(cache);
+
+    mempool_cache_drain(cache);
+
+    pa_log_debug("Memory pool slot cache of thread %s: %u hits, %u misses",
+                 pa_strnull(cache->thread_name), cache->n_hits, cache->n_misses);
+
+    pa_xfree(cache->thread_name);
+    pa_xfree(cache);
+}
+
+/* Called when a thread that used the pool exits */
+static void mempool_cache_free_cb(void *userdata) {
+    struct mempool_cache *cache = userdata;
+    pa_mempool *p;
+
+    pa_assert(cache);
+
+    p = cache->pool;
+
+    pa_mutex_lock(p->mutex);
+    PA_LLIST_REMOVE(struct mempool_cache, p->caches, cache);
+    pa_mutex_unlock(p->mutex);
+
+    mempool_cache_free(cache);
+}
+
 /* No lock necessary */
-static struct mempool_slot* mempool_allocate_slot(pa_mempool *p) {
+static struct mempool_cache* mempool_get_cache(pa_mempool *p) {
+    struct mempool_cache *cache;
+    pa_thread *t;
+
+    pa_assert(p);
+
+    if (!p->caches_tls)
+        return NULL;
+
+    if ((cache = pa_tls_get(p->caches_tls)))
+        return cache;
+
+    cache = pa_xnew0(struct mempool_cache, 1);
+    cache->pool = p;
+
+    if ((t = pa_thread_self()))
+        cache->thread_name = pa_xstrdup(pa_thread_get_name(t));
+
+    pa_mutex_lock(p->mutex);
+    PA_LLIST_PREPEND(struct mempool_cache, p->caches, cache);
+    pa_mutex_unlock(p->mutex);
+
+    pa_tls_set(p->caches_tls, cache);
+
+    return cache;
+}
+
+/* No lock necessary */
+static struct mempool_slot* mempool_allocate_slot(pa_mempool *p, struct mempool_class *c) {
+    struct mempool_cache *cache;
     struct mempool_slot *slot;
     pa_assert(p);
+    pa_assert(c);
+
+    if (c->n_blocks <= 0)
+        return NULL;
+
+    if (c->cache_slots > 0 && (cache = mempool_get_cache(p))) {
+        unsigned i = (unsigned) (c - p->classes);
+
+        if (cache->classes[i].n > 0) {
+            cache->n_hits++;
+            cache->n_hits_pending++;
+            return cache->classes[i].slots[--cache->classes[i].n];
+        }
 
-    if (!(slot = pa_flist_pop(p->free_slots))) {
+        cache->n_misses++;
+        pa_atomic_inc(&p->stat.n_slot_cache_misses);
+        pa_atomic_add(&p->stat.n_slot_cache_hits, (int) cache->n_hits_pending);
+        cache->n_hits_pending = 0;
+
+        /* Refill the cache in one go, keeping one slot for the caller */
+        while (cache->classes[i].n < c->cache_slots / 2 - 1 && (slot = pa_flist_pop(c->free_slots)))
+            cache->classes[i].slots[cache->classes[i].n++] = slot;
+    }
+
+    if (!(slot = pa_flist_pop(c->free_slots))) {
         int idx;
 
         /* The free list was empty, we have to allocate a new entry */
 
-        if ((unsigned) (idx = pa_atomic_inc(&p->n_init)) >= p->n_blocks)
-            pa_atomic_dec(&p->n_init);
+        if ((unsigned) (idx = pa_atomic_inc(&c->n_init)) >= c->n_blocks)
+            pa_atomic_dec(&c->n_init);
         else
-            slot = (struct mempool_slot*) ((uint8_t*) p->memory.ptr + (p->block_size * (size_t) idx));
-
-        if (!slot) {
-            if (pa_log_ratelimit(PA_LOG_DEBUG))
-                pa_log_debug("Pool full");
-            pa_atomic_inc(&p->stat.n_pool_full);
-            return NULL;
-        }
+            slot = (struct mempool_slot*) ((uint8_t*) p->memory.ptr + c->offset + (c->block_size * (size_t) idx));
     }
 
 /* #ifdef HAVE_VALGRIND_MEMCHECK_H */
 /*     if (PA_UNLIKELY(pa_in_valgrind())) { */
-/*         VALGRIND_MALLOCLIKE_BLOCK(slot, p->block_size, 0, 0); */
+/*         VALGRIND_MALLOCLIKE_BLOCK(slot, c->block_size, 0, 0); */
 /*     } */
 /* #endif */
 
     return slot;
 }
 
+/* No lock necessary */
+static size_t mempool_slot_size_max(pa_mempool *p) {
+    unsigned i;
+
+    pa_assert(p);
+
+    for (i = PA_MEMPOOL_CLASSES_MAX; i > 0; i--)
+        if (p->classes[i-1].n_blocks > 0)
+            return p->classes[i-1].block_size;
+
+    pa_assert_not_reached();
+}
+
+/* No lock necessary */
+static struct mempool_slot* mempool_allocate_slot_for(pa_mempool *p, size_t length, struct mempool_class **class) {
+    struct mempool_class *c;
+    struct mempool_slot *slot;
+
+    pa_assert(p);
+    pa_assert(class);
+
+    for (c = p->classes; c < p->classes + PA_MEMPOOL_CLASSES_MAX; c++) {
+        if (c->block_size < length)
+            continue;
+
+        if ((slot = mempool_allocate_slot(p, c))) {
+            *class = c;
+            return slot;
+        }
+    }
+
+    if (pa_log_ratelimit(PA_LOG_DEBUG))
+        pa_log_debug("Pool full");
+    pa_atomic_inc(&p->stat.n_pool_full);
+
+    return NULL;
+}
+
 /* No lock necessary, totally redundant anyway */
 static inline void* mempool_slot_data(struct mempool_slot *slot) {
     return slot;
 }
 
 /* No lock necessary */
-static unsigned mempool_slot_idx(pa_mempool *p, void *ptr) {
+static struct mempool_class* mempool_class_by_ptr(pa_mempool *p, void *ptr) {
+    size_t offset;
+    unsigned i;
+
     pa_assert(p);
 
     pa_assert((uint8_t*) ptr >= (uint8_t*) p->memory.ptr);
     pa_assert((uint8_t*) ptr < (uint8_t*) p->memory.ptr + p->memory.size);
 
-    return (unsigned) ((size_t) ((uint8_t*) ptr - (uint8_t*) p->memory.ptr) / p->block_size);
+    offset = (size_t) ((uint8_t*) ptr - (uint8_t*) p->memory.ptr);
+
+    for (i = PA_MEMPOOL_CLASSES_MAX; i > 0; i--)
+        if (p->classes[i-1].n_blocks > 0 && offset >= p->classes[i-1].offset)
+            return p->classes + i - 1;
+
+    pa_assert_not_reached();
 }
 
 /* No lock necessary */
-static struct mempool_slot* mempool_slot_by_ptr(pa_mempool *p, void *ptr) {
-    unsigned idx;
+static struct mempool_slot* mempool_slot_by_ptr(pa_mempool *p, void *ptr, struct mempool_class **class) {
+    struct mempool_class *c;
+    size_t idx;
 
-    if ((idx = mempool_slot_idx(p, ptr)) == (unsigned) -1)
-        return NULL;
+    c = mempool_class_by_ptr(p, ptr);
+    idx = ((size_t) ((uint8_t*) ptr - (uint8_t*) p->memory.ptr) - c->offset) / c->block_size;
+
+    pa_assert(idx < c->n_blocks);
+
+    if (class)
+        *class = c;
+
+    return (struct mempool_slot*) ((uint8_t*) p->memory.ptr + c->offset + (idx * c->block_size));
+}
+
+/* No lock necessary */
+static void mempool_free_slot(pa_mempool *p, struct mempool_class *c, struct mempool_slot *slot) {
+    struct mempool_cache *cache;
+
+    pa_assert(p);
+    pa_assert(c);
+    pa_assert(slot);
+
+    if (c->cache_slots > 0 && (cache = mempool_get_cache(p))) {
+        unsigned i = (unsigned) (c - p->classes);
+
+        /* Make room by returning half of the cached slots */
+        if (cache->classes[i].n >= c->cache_slots)
+            while (cache->classes[i].n > c->cache_slots / 2)
+                while (pa_flist_push(c->free_slots, cache->classes[i].slots[--cache->classes[i].n]) < 0)
+                    ;
 
-    return (struct mempool_slot*) ((uint8_t*) p->memory.ptr + (idx * p->block_size));
+        cache->classes[i].slots[cache->classes[i].n++] = slot;
+        return;
+    }
+
+    /* The free list dimensions should easily allow all slots
+     * to fit in, hence try harder if pushing this slot into
+     * the free list fails */
+    while (pa_flist_push(c->free_slots, slot) < 0)
+        ;
 }
 
 /* No lock necessary */
 pa_memblock *pa_memblock_new_pool(pa_mempool *p, size_t length) {
     pa_memblock *b = NULL;
     struct mempool_slot *slot;
+    struct mempool_class *c;
     static int mempool_disable = 0;
 
     pa_assert(p);
@@ -323,34 +607,32 @@ pa_memblock *pa_memblock_new_pool(pa_mempool *p, size_t length) {
     if (length == (size_t) -1)
         length = pa_mempool_block_size_max(p);
 
-    if (p->block_size >= PA_ALIGN(sizeof(pa_memblock)) + length) {
+    if (length > mempool_slot_size_max(p)) {
+        pa_log_debug("Memory block too large for pool: %lu > %lu", (unsigned long) length, (unsigned long) mempool_slot_size_max(p));
+        pa_atomic_inc(&p->stat.n_too_large_for_pool);
+        return NULL;
+    }
+
+    if (!(slot = mempool_allocate_slot_for(p, length, &c)))
+        return NULL;
 
-        if (!(slot = mempool_allocate_slot(p)))
-            return NULL;
+    if (c->block_size >= PA_ALIGN(sizeof(pa_memblock)) + length) {
 
         b = mempool_slot_data(slot);
         b->type = PA_MEMBLOCK_POOL;
         pa_atomic_ptr_store(&b->data, (uint8_t*) b + PA_ALIGN(sizeof(pa_memblock)));
 
-    } else if (p->block_size >= length) {
-
-        if (!(slot = mempool_allocate_slot(p)))
-            return NULL;
+    } else {
 
         if (!(b = pa_flist_pop(PA_STATIC_FLIST_GET(unused_memblocks))))
             b = pa_xnew(pa_memblock, 1);
 
         b->type = PA_MEMBLOCK_POOL_EXTERNAL;
         pa_atomic_ptr_store(&b->data, mempool_slot_data(slot));
-
-    } else {
-        pa_log_debug("Memory block too large for pool: %lu > %lu", (unsigned long) length, (unsigned long) p->block_size);
-        pa_atomic_inc(&p->stat.n_too_large_for_pool);
-        return NULL;
     }
 
     PA_REFCNT_INIT(b);
-    b->pool = p;
+    b->pool = pa_mempool_ref(p);
     b->read_only = b->is_silence = FALSE;
     b->length = length;
     pa_atomic_store(&b->n_acquired, 0);
@@ -373,7 +655,7 @@ pa_memblock *pa_memblock_new_fixed(pa_mempool *p, void *d, size_t length, pa_boo
         b = pa_xnew(pa_memblock, 1);
 
     PA_REFCNT_INIT(b);
-    b->pool = p;
+    b->pool = pa_mempool_ref(p);
     b->type = PA_MEMBLOCK_FIXED;
     b->read_only = read_only;
     b->is_silence = FALSE;
@@ -400,7 +682,7 @@ pa_memblock *pa_memblock_new_user(pa_mempool *p, void *d, size_t length, pa_free
         b = pa_xnew(pa_memblock, 1);
 
     PA_REFCNT_INIT(b);
-    b->pool = p;
+    b->pool = pa_mempool_ref(p);
     b->type = PA_MEMBLOCK_USER;
     b->read_only = read_only;
     b->is_silence = FALSE;
@@ -494,6 +776,19 @@ pa_mempool* pa_memblock_get_pool(pa_memblock *b) {
     return b->pool;
 }
 
+/* No lock necessary */
+int pa_memblock_get_memfd(pa_memblock *b) {
+    pa_assert(b);
+    pa_assert(PA_REFCNT_VALUE(b) > 0);
+
+    /* Everything but imported blocks is exported from the pool, if
+     * necessary as a copy */
+    if (b->type == PA_MEMBLOCK_IMPORTED)
+        return b->per_type.imported.segment->memory.fd;
+
+    return pa_mempool_is_memfd_backed(b->pool) ? b->pool->memory.fd : -1;
+}
+
 /* No lock necessary */
 pa_memblock* pa_memblock_ref(pa_memblock*b) {
     pa_assert(b);
@@ -504,7 +799,10 @@ pa_memblock* pa_memblock_ref(pa_memblock*b) {
 }
 
 static void memblock_free(pa_memblock *b) {
+    pa_mempool *pool;
+
     pa_assert(b);
+    pa_assert_se(pool = b->pool);
 
     pa_assert(pa_atomic_load(&b->n_acquired) == 0);
 
@@ -544,8 +842,7 @@ static void memblock_free(pa_memblock *b) {
             pa_assert_se(pa_hashmap_remove(import->blocks, PA_UINT32_TO_PTR(b->per_type.imported.id)));
 
             pa_assert(segment->n_blocks >= 1);
-            if (-- segment->n_blocks <= 0)
-                segment_detach(segment);
+            segment->n_blocks--;
 
             pa_mutex_unlock(import->mutex);
 
@@ -560,23 +857,20 @@ static void memblock_free(pa_memblock *b) {
         case PA_MEMBLOCK_POOL_EXTERNAL:
         case PA_MEMBLOCK_POOL: {
             struct mempool_slot *slot;
+            struct mempool_class *c;
             pa_bool_t call_free;
 
-            pa_assert_se(slot = mempool_slot_by_ptr(b->pool, pa_atomic_ptr_load(&b->data)));
+            pa_assert_se(slot = mempool_slot_by_ptr(b->pool, pa_atomic_ptr_load(&b->data), &c));
 
             call_free = b->type == PA_MEMBLOCK_POOL_EXTERNAL;
 
 /* #ifdef HAVE_VALGRIND_MEMCHECK_H */
 /*             if (PA_UNLIKELY(pa_in_valgrind())) { */
-/*                 VALGRIND_FREELIKE_BLOCK(slot, b->pool->block_size); */
+/*                 VALGRIND_FREELIKE_BLOCK(slot, c->block_size); */
 /*             } */
 /* #endif */
 
-            /* The free list dimensions should easily allow all slots
-             * to fit in, hence try harder if pushing this slot into
-             * the free list fails */
-            while (pa_flist_push(b->pool->free_slots, slot) < 0)
-                ;
+            mempool_free_slot(b->pool, c, slot);
 
             if (call_free)
                 if (pa_flist_push(PA_STATIC_FLIST_GET(unused_memblocks), b) < 0)
@@ -589,6 +883,10 @@ static void memblock_free(pa_memblock *b) {
         default:
             pa_assert_not_reached();
     }
+
+    /* Pool blocks may have been the memblock itself, hence we use our
+     * own copy of the pointer */
+    pa_mempool_unref(pool);
 }
 
 /* No lock necessary */
@@ -626,10 +924,11 @@ static void memblock_make_local(pa_memblock *b) {
 
     pa_atomic_dec(&b->pool->stat.n_allocated_by_type[b->type]);
 
-    if (b->length <= b->pool->block_size) {
+    if (b->length <= mempool_slot_size_max(b->pool)) {
         struct mempool_slot *slot;
+        struct mempool_class *c;
 
-        if ((slot = mempool_allocate_slot(b->pool))) {
+        if ((slot = mempool_allocate_slot_for(b->pool, b->length, &c))) {
             void *new_data;
             /* We can move it into a local pool, perfect! */
 
@@ -696,6 +995,13 @@ static void memblock_replace_import(pa_memblock *b) {
     pa_atomic_dec(&b->pool->stat.n_imported);
     pa_atomic_sub(&b->pool->stat.imported_size, (int) b->length);
 
+    if (b->owner) {
+        pa_memowner_stat *ostat = pa_memowner_get_stat(b->owner);
+
+        pa_atomic_dec(&ostat->n_imported);
+        pa_atomic_sub(&ostat->imported_size, (int) b->length);
+    }
+
     pa_assert_se(segment = b->per_type.imported.segment);
     pa_assert_se(import = segment->import);
 
@@ -706,122 +1012,195 @@ static void memblock_replace_import(pa_memblock *b) {
     memblock_make_local(b);
 
     pa_assert(segment->n_blocks >= 1);
-    if (-- segment->n_blocks <= 0)
-        segment_detach(segment);
+    segment->n_blocks--;
 
     pa_mutex_unlock(import->mutex);
 }
 
 pa_mempool* pa_mempool_new(pa_bool_t shared, size_t size) {
+    return pa_mempool_new_extended(shared, size, PA_SHM_HUGE_PAGES_NO, FALSE);
+}
+
+pa_mempool* pa_mempool_new_extended(pa_bool_t shared, size_t size, pa_shm_huge_pages_t huge_pages, pa_bool_t lock) {
     pa_mempool *p;
     char t1[PA_BYTES_SNPRINT_MAX], t2[PA_BYTES_SNPRINT_MAX];
+    size_t total, offset = 0;
+    unsigned i;
 
     p = pa_xnew(pa_mempool, 1);
-
-    p->block_size = PA_PAGE_ALIGN(PA_MEMPOOL_SLOT_SIZE);
-    if (p->block_size < PA_PAGE_SIZE)
-        p->block_size = PA_PAGE_SIZE;
+    PA_REFCNT_INIT(p);
 
     if (size <= 0)
-        p->n_blocks = PA_MEMPOOL_SLOTS_MAX;
-    else {
-        p->n_blocks = (unsigned) (size / p->block_size);
+        total = PA_MEMPOOL_SLOTS_MAX * PA_PAGE_ALIGN(PA_MEMPOOL_SLOT_SIZE);
+    else
+        total = size;
 
-        if (p->n_blocks < 2)
-            p->n_blocks = 2;
+    for (i = 0; i < PA_MEMPOOL_CLASSES_MAX; i++) {
+        struct mempool_class *c = p->classes + i;
+
+        c->block_size = mempool_class_table[i].size;
+
+        /* Slots of a page or more can be punched out of the segment on
+         * vacuum, so keep them page aligned */
+        if (c->block_size >= PA_MEMPOOL_SLOT_SIZE) {
+            c->block_size = PA_PAGE_ALIGN(c->block_size);
+            if (c->block_size < PA_PAGE_SIZE)
+                c->block_size = PA_PAGE_SIZE;
+        }
+
+        c->n_blocks = (unsigned) (total / 16 * mempool_class_table[i].share / c->block_size);
+
+        if (i == PA_MEMPOOL_CLASS_DEFAULT && c->n_blocks < 2)
+            c->n_blocks = 2;
+
+        if ((c->cache_slots = PA_MIN(PA_MEMPOOL_CACHE_SLOTS, c->n_blocks / PA_MEMPOOL_CACHE_SHARE)) < 2)
+            c->cache_slots = 0;
+
+        c->offset = offset;
+        offset = PA_PAGE_ALIGN(offset + c->n_blocks * c->block_size);
     }
 
-    if (pa_shm_create_rw(&p->memory, p->n_blocks * p->block_size, shared, 0700) < 0) {
+    if (pa_shm_create_rw(&p->memory, offset, shared, huge_pages, 0700) < 0) {
         pa_xfree(p);
         return NULL;
     }
 
-    pa_log_debug("Using %s memory pool with %u slots of size %s each, total size is %s, maximum usable slot size is %lu",
+    p->huge_pages = huge_pages;
+
+    pa_log_debug("Using %s memory pool, total size is %s, maximum usable slot size is %lu, page size is %s",
                  p->memory.shared ? "shared" : "private",
-                 p->n_blocks,
-                 pa_bytes_snprint(t1, sizeof(t1), (unsigned) p->block_size),
-                 pa_bytes_snprint(t2, sizeof(t2), (unsigned) (p->n_blocks * p->block_size)),
-                 (unsigned long) pa_mempool_block_size_max(p));
+                 pa_bytes_snprint(t1, sizeof(t1), (unsigned) p->memory.size),
+                 (unsigned long) pa_mempool_block_size_max(p),
+                 pa_bytes_snprint(t2, sizeof(t2), (unsigned) p->memory.page_size));
+
+    if (lock) {
+        if (pa_shm_lock(&p->memory) >= 0)
+            pa_log_info("Locked memory pool into memory.");
+        else
+            pa_log_warn("Failed to lock memory pool into memory, only faulted it in.");
+    }
+
+    for (i = 0; i < PA_MEMPOOL_CLASSES_MAX; i++) {
+        struct mempool_class *c = p->classes + i;
+
+        pa_atomic_store(&c->n_init, 0);
+        c->free_slots = c->n_blocks > 0 ? pa_flist_new(c->n_blocks) : NULL;
+
+        if (c->n_blocks > 0)
+            pa_log_debug("Memory pool class with %u slots of size %s each",
+                         c->n_blocks,
+                         pa_bytes_snprint(t2, sizeof(t2), (unsigned) c->block_size));
+    }
 
     memset(&p->stat, 0, sizeof(p->stat));
-    pa_atomic_store(&p->n_init, 0);
+    p->owner = NULL;
 
     PA_LLIST_HEAD_INIT(pa_memimport, p->imports);
     PA_LLIST_HEAD_INIT(pa_memexport, p->exports);
+    PA_LLIST_HEAD_INIT(struct mempool_cache, p->caches);
 
     p->mutex = pa_mutex_new(TRUE, TRUE);
     p->semaphore = pa_semaphore_new(0);
 
-    p->free_slots = pa_flist_new(p->n_blocks);
+    if (!(p->caches_tls = pa_tls_new(mempool_cache_free_cb)))
+        pa_log_debug("Failed to allocate TLS key, not using per-thread slot caches.");
 
     return p;
 }
 
-void pa_mempool_free(pa_mempool *p) {
+static void mempool_free(pa_mempool *p) {
+    struct mempool_class *c;
+
     pa_assert(p);
+    pa_assert(!p->imports);
+    pa_assert(!p->exports);
 
     pa_mutex_lock(p->mutex);
 
-    while (p->imports)
-        pa_memimport_free(p->imports);
+    /* Once the key is gone no thread exit will touch the caches anymore */
+    if (p->caches_tls)
+        pa_tls_free(p->caches_tls);
 
-    while (p->exports)
-        pa_memexport_free(p->exports);
+    while (p->caches) {
+        struct mempool_cache *cache = p->caches;
+
+        PA_LLIST_REMOVE(struct mempool_cache, p->caches, cache);
+        mempool_cache_free(cache);
+    }
 
     pa_mutex_unlock(p->mutex);
 
-    pa_flist_free(p->free_slots, NULL);
+    pa_assert(pa_atomic_load(&p->stat.n_allocated) == 0);
 
-    if (pa_atomic_load(&p->stat.n_allocated) > 0) {
+    for (c = p->classes; c < p->classes + PA_MEMPOOL_CLASSES_MAX; c++)
+        if (c->free_slots)
+            pa_flist_free(c->free_slots, NULL);
 
-        /* Ouch, somebody is retaining a memory block reference! */
+    pa_shm_free(&p->memory);
 
-#ifdef DEBUG_REF
-        unsigned i;
-        pa_flist *list;
+    pa_mutex_free(p->mutex);
+    pa_semaphore_free(p->semaphore);
 
-        /* Let's try to find at least one of those leaked memory blocks */
+    if (p->owner)
+        pa_memowner_unref(p->owner);
 
-        list = pa_flist_new(p->n_blocks);
+    pa_xfree(p);
+}
 
-        for (i = 0; i < (unsigned) pa_atomic_load(&p->n_init); i++) {
-            struct mempool_slot *slot;
-            pa_memblock *b, *k;
+/* No lock necessary */
+pa_mempool* pa_mempool_ref(pa_mempool *p) {
+    pa_assert(p);
+    pa_assert(PA_REFCNT_VALUE(p) > 0);
 
-            slot = (struct mempool_slot*) ((uint8_t*) p->memory.ptr + (p->block_size * (size_t) i));
-            b = mempool_slot_data(slot);
+    PA_REFCNT_INC(p);
+    return p;
+}
 
-            while ((k = pa_flist_pop(p->free_slots))) {
-                while (pa_flist_push(list, k) < 0)
-                    ;
+/* No lock necessary */
+void pa_mempool_unref(pa_mempool *p) {
+    pa_assert(p);
+    pa_assert(PA_REFCNT_VALUE(p) > 0);
 
-                if (b == k)
-                    break;
-            }
+    if (PA_REFCNT_DEC(p) > 0)
+        return;
 
-            if (!k)
-                pa_log("REF: Leaked memory block %p", b);
+    mempool_free(p);
+}
 
-            while ((k = pa_flist_pop(list)))
-                while (pa_flist_push(p->free_slots, k) < 0)
-                    ;
-        }
+void pa_mempool_free(pa_mempool *p) {
+    pa_assert(p);
+    pa_assert(PA_REFCNT_VALUE(p) > 0);
 
-        pa_flist_free(list, NULL);
+    /* Imports and exports belong to the owner. Dropping them here also
+     * releases the references exports hold on blocks of this pool. */
+    pa_mutex_lock(p->mutex);
 
-#endif
+    while (p->imports)
+        pa_memimport_free(p->imports);
 
-        pa_log_error("Memory pool destroyed but not all memory blocks freed! %u remain.", pa_atomic_load(&p->stat.n_allocated));
+    while (p->exports)
+        pa_memexport_free(p->exports);
 
-/*         PA_DEBUG_TRAP; */
-    }
+    pa_mutex_unlock(p->mutex);
 
-    pa_shm_free(&p->memory);
+    if (PA_REFCNT_VALUE(p) > 1)
+        pa_log_debug("Memory pool released by its owner, %u blocks still in use.", pa_atomic_load(&p->stat.n_allocated));
 
-    pa_mutex_free(p->mutex);
-    pa_semaphore_free(p->semaphore);
+    pa_mempool_unref(p);
+}
 
-    pa_xfree(p);
+/* Should be called right after creating the pool, before it is used
+ * from other threads */
+void pa_mempool_set_owner(pa_mempool *p, pa_memowner *o) {
+    pa_assert(p);
+
+    if (o)
+        pa_memowner_ref(o);
+
+    if (p->owner)
+        pa_memowner_unref(p->owner);
+
+    p->owner = o;
 }
 
 /* No lock necessary */
@@ -835,30 +1214,44 @@ const pa_mempool_stat* pa_mempool_get_stat(pa_mempool *p) {
 size_t pa_mempool_block_size_max(pa_mempool *p) {
     pa_assert(p);
 
-    return p->block_size - PA_ALIGN(sizeof(pa_memblock));
+    return p->classes[PA_MEMPOOL_CLASS_DEFAULT].block_size - PA_ALIGN(sizeof(pa_memblock));
 }
 
 /* No lock necessary */
 void pa_mempool_vacuum(pa_mempool *p) {
+    struct mempool_class *c;
     struct mempool_slot *slot;
     pa_flist *list;
 
     pa_assert(p);
 
-    list = pa_flist_new(p->n_blocks);
+    /* Punching holes would undo the locking, or split the huge pages */
+    if (p->memory.locked ||
+        p->memory.page_size > PA_PAGE_SIZE ||
+        p->huge_pages == PA_SHM_HUGE_PAGES_TRANSPARENT)
+        return;
 
-    while ((slot = pa_flist_pop(p->free_slots)))
-        while (pa_flist_push(list, slot) < 0)
-            ;
+    for (c = p->classes; c < p->classes + PA_MEMPOOL_CLASSES_MAX; c++) {
 
-    while ((slot = pa_flist_pop(list))) {
-        pa_shm_punch(&p->memory, (size_t) ((uint8_t*) slot - (uint8_t*) p->memory.ptr), p->block_size);
+        /* Slots smaller than a page cannot be given back to the kernel */
+        if (c->n_blocks <= 0 || c->block_size < PA_PAGE_SIZE)
+            continue;
 
-        while (pa_flist_push(p->free_slots, slot))
-            ;
-    }
+        list = pa_flist_new(c->n_blocks);
 
-    pa_flist_free(list, NULL);
+        while ((slot = pa_flist_pop(c->free_slots)))
+            while (pa_flist_push(list, slot) < 0)
+                ;
+
+        while ((slot = pa_flist_pop(list))) {
+            pa_shm_punch(&p->memory, (size_t) ((uint8_t*) slot - (uint8_t*) p->memory.ptr), c->block_size);
+
+            while (pa_flist_push(c->free_slots, slot))
+                ;
+        }
+
+        pa_flist_free(list, NULL);
+    }
 }
 
 /* No lock necessary */
@@ -880,6 +1273,25 @@ pa_bool_t pa_mempool_is_shared(pa_mempool *p) {
     return !!p->memory.shared;
 }
 
+/* No lock necessary */
+pa_bool_t pa_mempool_is_memfd_backed(pa_mempool *p) {
+    pa_assert(p);
+
+    return p->memory.shared && p->memory.fd >= 0;
+}
+
+size_t pa_mempool_get_page_size(pa_mempool *p) {
+    pa_assert(p);
+
+    return p->memory.page_size;
+}
+
+pa_bool_t pa_mempool_is_locked(pa_mempool *p) {
+    pa_assert(p);
+
+    return p->memory.locked;
+}
+
 /* For receiving blocks from other nodes */
 pa_memimport* pa_memimport_new(pa_mempool *p, pa_memimport_release_cb_t cb, void *userdata) {
     pa_memimport *i;
@@ -889,7 +1301,7 @@ pa_memimport* pa_memimport_new(pa_mempool *p, pa_memimport_release_cb_t cb, void
 
     i = pa_xnew(pa_memimport, 1);
     i->mutex = pa_mutex_new(TRUE, TRUE);
-    i->pool = p;
+    i->pool = pa_mempool_ref(p);
     i->segments = pa_hashmap_new(NULL, NULL);
     i->blocks = pa_hashmap_new(NULL, NULL);
     i->release_cb = cb;
@@ -904,11 +1316,29 @@ pa_memimport* pa_memimport_new(pa_mempool *p, pa_memimport_release_cb_t cb, void
 
 static void memexport_revoke_blocks(pa_memexport *e, pa_memimport *i);
 
+/* Should be called locked. Unmaps an idle POSIX SHM segment if there
+ * is no room for another one. */
+static pa_bool_t segment_make_room(pa_memimport *i) {
+    pa_memimport_segment *seg;
+    void *state;
+
+    if (pa_hashmap_size(i->segments) < PA_MEMIMPORT_SEGMENTS_MAX)
+        return TRUE;
+
+    PA_HASHMAP_FOREACH(seg, i->segments, state)
+        if (seg->n_blocks <= 0 && !seg->permanent) {
+            segment_detach(seg);
+            return TRUE;
+        }
+
+    return FALSE;
+}
+
 /* Should be called locked */
 static pa_memimport_segment* segment_attach(pa_memimport *i, uint32_t shm_id) {
     pa_memimport_segment* seg;
 
-    if (pa_hashmap_size(i->segments) >= PA_MEMIMPORT_SEGMENTS_MAX)
+    if (!segment_make_room(i))
         return NULL;
 
     seg = pa_xnew0(pa_memimport_segment, 1);
@@ -925,6 +1355,49 @@ static pa_memimport_segment* segment_attach(pa_memimport *i, uint32_t shm_id) {
     return seg;
 }
 
+/* Self-locked */
+int pa_memimport_attach_memfd(pa_memimport *i, uint32_t shm_id, int memfd) {
+    pa_memimport_segment *seg;
+    int ret = -1;
+
+    pa_assert(i);
+    pa_assert(memfd >= 0);
+
+    pa_mutex_lock(i->mutex);
+
+    if (pa_hashmap_get(i->segments, PA_UINT32_TO_PTR(shm_id))) {
+        pa_log_debug("Segment %u already attached.", shm_id);
+        pa_close(memfd);
+        goto finish;
+    }
+
+    if (!segment_make_room(i)) {
+        pa_close(memfd);
+        goto finish;
+    }
+
+    seg = pa_xnew0(pa_memimport_segment, 1);
+
+    if (pa_shm_attach_fd(&seg->memory, shm_id, memfd) < 0) {
+        pa_xfree(seg);
+        goto finish;
+    }
+
+    /* pa_shm_attach_fd() only maps memfds that are sealed against
+     * shrinking, so the sender can't truncate them beneath us and we
+     * don't need a memtrap for them */
+    seg->import = i;
+    seg->permanent = TRUE;
+
+    pa_hashmap_put(i->segments, PA_UINT32_TO_PTR(seg->memory.id), seg);
+    ret = 0;
+
+finish:
+    pa_mutex_unlock(i->mutex);
+
+    return ret;
+}
+
 /* Should be called locked */
 static void segment_detach(pa_memimport_segment *seg) {
     pa_assert(seg);
@@ -942,6 +1415,7 @@ static void segment_detach(pa_memimport_segment *seg) {
 void pa_memimport_free(pa_memimport *i) {
     pa_memexport *e;
     pa_memblock *b;
+    pa_memimport_segment *seg;
 
     pa_assert(i);
 
@@ -950,7 +1424,10 @@ void pa_memimport_free(pa_memimport *i) {
     while ((b = pa_hashmap_first(i->blocks)))
         memblock_replace_import(b);
 
-    pa_assert(pa_hashmap_size(i->segments) == 0);
+    while ((seg = pa_hashmap_first(i->segments))) {
+        pa_assert(seg->n_blocks == 0);
+        segment_detach(seg);
+    }
 
     pa_mutex_unlock(i->mutex);
 
@@ -969,6 +1446,7 @@ void pa_memimport_free(pa_memimport *i) {
 
     pa_mutex_free(i->mutex);
 
+    pa_mempool_unref(i->pool);
     pa_xfree(i);
 }
 
@@ -989,7 +1467,16 @@ pa_memblock* pa_memimport_get(pa_memimport *i, uint32_t block_id, uint32_t shm_i
     if (pa_hashmap_size(i->blocks) >= PA_MEMIMPORT_SLOTS_MAX)
         goto finish;
 
-    if (!(seg = pa_hashmap_get(i->segments, PA_UINT32_TO_PTR(shm_id))))
+    /* An idle segment might have been replaced by the peer in the
+     * meantime, in which case we map the new one */
+    if ((seg = pa_hashmap_get(i->segments, PA_UINT32_TO_PTR(shm_id))) &&
+        seg->n_blocks <= 0 && !seg->permanent &&
+        !pa_shm_is_current(&seg->memory)) {
+        segment_detach(seg);
+        seg = NULL;
+    }
+
+    if (!seg)
         if (!(seg = segment_attach(i, shm_id)))
             goto finish;
 
@@ -1000,7 +1487,7 @@ pa_memblock* pa_memimport_get(pa_memimport *i, uint32_t block_id, uint32_t shm_i
         b = pa_xnew(pa_memblock, 1);
 
     PA_REFCNT_INIT(b);
-    b->pool = i->pool;
+    b->pool = pa_mempool_ref(i->pool);
     b->type = PA_MEMBLOCK_IMPORTED;
     b->read_only = TRUE;
     b->is_silence = FALSE;
@@ -1055,7 +1542,8 @@ pa_memexport* pa_memexport_new(pa_mempool *p, pa_memexport_revoke_cb_t cb, void
 
     e = pa_xnew(pa_memexport, 1);
     e->mutex = pa_mutex_new(TRUE, TRUE);
-    e->pool = p;
+    e->pool = pa_mempool_ref(p);
+    e->owner = p->owner ? pa_memowner_ref(p->owner) : NULL;
     PA_LLIST_HEAD_INIT(struct memexport_slot, e->free_slots);
     PA_LLIST_HEAD_INIT(struct memexport_slot, e->used_slots);
     e->n_init = 0;
@@ -1081,6 +1569,11 @@ void pa_memexport_free(pa_memexport *e) {
     pa_mutex_unlock(e->pool->mutex);
 
     pa_mutex_free(e->mutex);
+
+    if (e->owner)
+        pa_memowner_unref(e->owner);
+
+    pa_mempool_unref(e->pool);
     pa_xfree(e);
 }
 
@@ -1114,6 +1607,13 @@ int pa_memexport_process_release(pa_memexport *e, uint32_t id) {
     pa_atomic_dec(&e->pool->stat.n_exported);
     pa_atomic_sub(&e->pool->stat.exported_size, (int) b->length);
 
+    if (e->owner) {
+        pa_memowner_stat *ostat = pa_memowner_get_stat(e->owner);
+
+        pa_atomic_dec(&ostat->n_exported);
+        pa_atomic_sub(&ostat->exported_size, (int) b->length);
+    }
+
     pa_memblock_unref(b);
 
     return 0;
@@ -1155,12 +1655,17 @@ static pa_memblock *memblock_shared_copy(pa_mempool *p, pa_memblock *b) {
     pa_assert(p);
     pa_assert(b);
 
-    if (b->type == PA_MEMBLOCK_IMPORTED ||
-        b->type == PA_MEMBLOCK_POOL ||
-        b->type == PA_MEMBLOCK_POOL_EXTERNAL) {
-        pa_assert(b->pool == p);
+    /* Blocks of other shared pools can be passed on as they are, the
+     * peer simply attaches to that pool's segment. Imported blocks of
+     * other pools are copied however, since they might be revoked
+     * without us being notified. */
+    if (b->type == PA_MEMBLOCK_IMPORTED && b->pool == p)
+        return pa_memblock_ref(b);
+
+    if ((b->type == PA_MEMBLOCK_POOL ||
+         b->type == PA_MEMBLOCK_POOL_EXTERNAL) &&
+        (b->pool == p || b->pool->memory.shared))
         return pa_memblock_ref(b);
-    }
 
     if (!(n = pa_memblock_new_pool(p, b->length)))
         return NULL;
@@ -1181,7 +1686,6 @@ int pa_memexport_put(pa_memexport *e, pa_memblock *b, uint32_t *block_id, uint32
     pa_assert(shm_id);
     pa_assert(offset);
     pa_assert(size);
-    pa_assert(b->pool == e->pool);
 
     if (!(b = memblock_shared_copy(e->pool, b)))
         return -1;
@@ -1229,5 +1733,12 @@ int pa_memexport_put(pa_memexport *e, pa_memblock *b, uint32_t *block_id, uint32
     pa_atomic_inc(&e->pool->stat.n_exported);
     pa_atomic_add(&e->pool->stat.exported_size, (int) b->length);
 
+    if (e->owner) {
+        pa_memowner_stat *ostat = pa_memowner_get_stat(e->owner);
+
+        pa_atomic_inc(&ostat->n_exported);
+        pa_atomic_add(&ostat->exported_size, (int) b->length);
+    }
+
     return 0;
 }
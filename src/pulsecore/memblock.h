@@ -31,6 +31,8 @@ typedef struct pa_memblock pa_memblock;
 #include <pulse/def.h>
 #include <pulsecore/atomic.h>
 #include <pulsecore/memchunk.h>
+#include <pulsecore/memowner.h>
+#include <pulsecore/shm.h>
 
 /* A pa_memblock is a reference counted memory block. PulseAudio
  * passes references to pa_memblocks around instead of copying
@@ -74,6 +76,11 @@ struct pa_mempool_stat {
     pa_atomic_t n_too_large_for_pool;
     pa_atomic_t n_pool_full;
 
+    /* Slot allocations served from (or missing) the per-thread caches,
+     * the hits of a thread are added in batches */
+    pa_atomic_t n_slot_cache_hits;
+    pa_atomic_t n_slot_cache_misses;
+
     pa_atomic_t n_allocated_by_type[PA_MEMBLOCK_TYPE_MAX];
     pa_atomic_t n_accumulated_by_type[PA_MEMBLOCK_TYPE_MAX];
 };
@@ -116,15 +123,37 @@ void pa_memblock_release(pa_memblock *b);
 size_t pa_memblock_get_length(pa_memblock *b);
 pa_mempool * pa_memblock_get_pool(pa_memblock *b);
 
+/* The memfd of the segment pa_memexport_put() shares the block from, or
+ * -1 if there is none */
+int pa_memblock_get_memfd(pa_memblock *b);
+
 pa_memblock *pa_memblock_will_need(pa_memblock *b);
 
 /* The memory block manager */
 pa_mempool* pa_mempool_new(pa_bool_t shared, size_t size);
+
+/* Optionally backs the pool with huge pages, and faults in and locks
+ * all of it right away, so that the IO threads never take a page fault
+ * on it */
+pa_mempool* pa_mempool_new_extended(pa_bool_t shared, size_t size, pa_shm_huge_pages_t huge_pages, pa_bool_t lock);
+pa_mempool* pa_mempool_ref(pa_mempool *p);
+void pa_mempool_unref(pa_mempool *p);
+
+/* Drops the owner's reference and its imports and exports. The pool
+ * itself goes away when the last of its memory blocks is freed. */
 void pa_mempool_free(pa_mempool *p);
+
+/* Blocks allocated from threads without a current owner, imported
+ * blocks and exports are charged to o, see pa_memowner */
+void pa_mempool_set_owner(pa_mempool *p, pa_memowner *o);
+
 const pa_mempool_stat* pa_mempool_get_stat(pa_mempool *p);
 void pa_mempool_vacuum(pa_mempool *p);
 int pa_mempool_get_shm_id(pa_mempool *p, uint32_t *id);
 pa_bool_t pa_mempool_is_shared(pa_mempool *p);
+pa_bool_t pa_mempool_is_memfd_backed(pa_mempool *p);
+size_t pa_mempool_get_page_size(pa_mempool *p);
+pa_bool_t pa_mempool_is_locked(pa_mempool *p);
 size_t pa_mempool_block_size_max(pa_mempool *p);
 
 /* For receiving blocks from other nodes */
@@ -133,6 +162,9 @@ void pa_memimport_free(pa_memimport *i);
 pa_memblock* pa_memimport_get(pa_memimport *i, uint32_t block_id, uint32_t shm_id, size_t offset, size_t size);
 int pa_memimport_process_revoke(pa_memimport *i, uint32_t block_id);
 
+/* Attach a memfd segment received from the peer, takes ownership of the fd */
+int pa_memimport_attach_memfd(pa_memimport *i, uint32_t shm_id, int memfd);
+
 /* For sending blocks to other nodes */
 pa_memexport* pa_memexport_new(pa_mempool *p, pa_memexport_revoke_cb_t cb, void *userdata);
 void pa_memexport_free(pa_memexport *e);
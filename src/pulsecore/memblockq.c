@@ -33,6 +33,7 @@
 #include <pulsecore/mcalign.h>
 #include <pulsecore/macro.h>
 #include <pulsecore/flist.h>
+#include <pulsecore/trace.h>
 
 #include "memblockq.h"
 
@@ -58,6 +59,15 @@ struct pa_memblockq {
     int64_t missing, requested;
     char *name;
     pa_sample_spec sample_spec;
+    size_t coalesce;
+
+    /* Ring buffer mode, only used while the list above is empty. The
+     * data between ring_start and ring_end is stored in ring at the
+     * index modulo ring_size. */
+    pa_bool_t ring_enabled;
+    pa_memblock *ring;
+    size_t ring_size;
+    int64_t ring_start, ring_end;
 };
 
 pa_memblockq* pa_memblockq_new(
@@ -112,6 +122,9 @@ void pa_memblockq_free(pa_memblockq* bq) {
 
     pa_memblockq_silence(bq);
 
+    if (bq->ring)
+        pa_memblock_unref(bq->ring);
+
     if (bq->silence.memblock)
         pa_memblock_unref(bq->silence.memblock);
 
@@ -122,6 +135,232 @@ void pa_memblockq_free(pa_memblockq* bq) {
     pa_xfree(bq);
 }
 
+static pa_bool_t ring_active(pa_memblockq *bq) {
+    return bq->ring_enabled && !bq->blocks;
+}
+
+static pa_bool_t ring_is_empty(pa_memblockq *bq) {
+    return bq->ring_start >= bq->ring_end;
+}
+
+static size_t ring_offset(size_t size, int64_t idx) {
+    int64_t o = idx % (int64_t) size;
+
+    return (size_t) (o < 0 ? o + (int64_t) size : o);
+}
+
+/* Copy length bytes into the ring at idx, wrapping around at the end */
+static void ring_write(uint8_t *ring, size_t size, int64_t idx, const uint8_t *src, size_t length) {
+    size_t o, l;
+
+    pa_assert(length <= size);
+
+    o = ring_offset(size, idx);
+    l = PA_MIN(length, size - o);
+
+    memcpy(ring + o, src, l);
+    memcpy(ring, src + l, length - l);
+}
+
+/* The size a new ring starts with, and the least it is shrunk to */
+static size_t ring_size_min(pa_memblockq *bq, pa_mempool *pool) {
+    size_t size;
+
+    if ((size = pa_mempool_block_size_max(pool) / bq->base * bq->base) <= 0)
+        size = bq->base;
+
+    return size;
+}
+
+/* Replace the ring by a new block of the given size, keeping its contents */
+static void ring_resize(pa_memblockq *bq, pa_mempool *pool, size_t size) {
+    pa_memblock *n;
+    uint8_t *dst;
+
+    pa_assert(!bq->ring || (size_t) (bq->ring_end - bq->ring_start) <= size);
+
+    n = pa_memblock_new(pool, size);
+
+    if (bq->ring) {
+        const uint8_t *src;
+        int64_t idx;
+
+        dst = pa_memblock_acquire(n);
+        src = pa_memblock_acquire(bq->ring);
+
+        for (idx = bq->ring_start; idx < bq->ring_end;) {
+            size_t o = ring_offset(bq->ring_size, idx);
+            size_t l = PA_MIN((size_t) (bq->ring_end - idx), bq->ring_size - o);
+
+            ring_write(dst, size, idx, src + o, l);
+            idx += (int64_t) l;
+        }
+
+        pa_memblock_release(bq->ring);
+        pa_memblock_release(n);
+        pa_memblock_unref(bq->ring);
+    }
+
+    bq->ring = n;
+    bq->ring_size = size;
+}
+
+/* Make sure the ring is ours alone and can hold everything up to end */
+static void ring_prepare(pa_memblockq *bq, pa_mempool *pool, int64_t end) {
+    size_t needed, size;
+
+    pa_assert(end >= bq->ring_start);
+    needed = (size_t) (end - bq->ring_start);
+
+    if (bq->ring && needed <= bq->ring_size && pa_memblock_ref_is_one(bq->ring))
+        return;
+
+    size = bq->ring ? bq->ring_size : ring_size_min(bq, pool);
+
+    /* Doubling keeps the size a multiple of the frame size, hence
+     * chunks never wrap in the middle of a frame */
+    while (size < needed)
+        size *= 2;
+
+    ring_resize(bq, pool, size);
+}
+
+/* Give back memory the ring doesn't need anymore, e.g. after the history
+ * was cut down. Halving undoes the doubling of ring_prepare(), and the
+ * ring is left at least twice as large as its contents so that it isn't
+ * grown again right away. */
+static void ring_shrink(pa_memblockq *bq) {
+    pa_mempool *pool;
+    size_t needed, size, min;
+
+    if (!bq->ring || !ring_active(bq) || !pa_memblock_ref_is_one(bq->ring))
+        return;
+
+    pool = pa_memblock_get_pool(bq->ring);
+    needed = (size_t) (bq->ring_end - bq->ring_start);
+    min = ring_size_min(bq, pool);
+
+    for (size = bq->ring_size; size / 2 >= min && size / 4 >= needed; size /= 2)
+        ;
+
+    if (size < bq->ring_size)
+        ring_resize(bq, pool, size);
+}
+
+/* Returns the piece of the ring starting at idx that is contiguous in
+ * memory, without taking a reference */
+static void ring_chunk(pa_memblockq *bq, int64_t idx, pa_memchunk *chunk) {
+    size_t o;
+
+    pa_assert(idx >= bq->ring_start && idx < bq->ring_end);
+
+    o = ring_offset(bq->ring_size, idx);
+
+    chunk->memblock = bq->ring;
+    chunk->index = o;
+    chunk->length = PA_MIN((size_t) (bq->ring_end - idx), bq->ring_size - o);
+}
+
+/* Copy the chunk into the ring at the write index. Returns -1 if the
+ * ring cannot store it, in which case nothing is changed. */
+static int ring_push(pa_memblockq *bq, const pa_memchunk *chunk) {
+    int64_t end;
+    uint8_t *dst;
+    const uint8_t *src;
+
+    if (bq->write_index % (int64_t) bq->base != 0)
+        return -1;
+
+    /* Silence blocks are shared, referencing them is cheaper than copying
+     * and keeps them recognizable further down */
+    if (pa_memblock_is_silence(chunk->memblock))
+        return -1;
+
+    if (ring_is_empty(bq))
+        bq->ring_start = bq->ring_end = bq->write_index;
+
+    /* Data in front of what is stored would have to be kept apart */
+    if (bq->write_index < bq->ring_start)
+        return -1;
+
+    /* A hole needs to be filled with silence */
+    if (bq->write_index > bq->ring_end && !bq->silence.memblock)
+        return -1;
+
+    end = PA_MAX(bq->ring_end, bq->write_index + (int64_t) chunk->length);
+    ring_prepare(bq, pa_memblock_get_pool(chunk->memblock), end);
+
+    dst = pa_memblock_acquire(bq->ring);
+
+    if (bq->write_index > bq->ring_end) {
+        const uint8_t *s;
+        int64_t idx;
+
+        /* That's what pa_memblockq_peek() would have returned for the
+         * hole anyway */
+        s = (const uint8_t*) pa_memblock_acquire(bq->silence.memblock) + bq->silence.index;
+
+        for (idx = bq->ring_end; idx < bq->write_index;) {
+            size_t l = PA_MIN(bq->silence.length, (size_t) (bq->write_index - idx));
+
+            ring_write(dst, bq->ring_size, idx, s, l);
+            idx += (int64_t) l;
+        }
+
+        pa_memblock_release(bq->silence.memblock);
+    }
+
+    src = pa_memblock_acquire(chunk->memblock);
+    ring_write(dst, bq->ring_size, bq->write_index, src + chunk->index, chunk->length);
+    pa_memblock_release(chunk->memblock);
+
+    pa_memblock_release(bq->ring);
+
+    bq->ring_end = end;
+    bq->write_index += (int64_t) chunk->length;
+
+    return 0;
+}
+
+/* Move the contents of the ring into list items, which reference the
+ * ring block from now on. A new ring is allocated once the list runs
+ * empty again. */
+static void ring_to_list(pa_memblockq *bq) {
+    int64_t idx;
+
+    pa_assert(ring_active(bq));
+
+    for (idx = bq->ring_start; idx < bq->ring_end;) {
+        struct list_item *n;
+
+        if (!(n = pa_flist_pop(PA_STATIC_FLIST_GET(list_items))))
+            n = pa_xnew(struct list_item, 1);
+
+        ring_chunk(bq, idx, &n->chunk);
+        pa_memblock_ref(n->chunk.memblock);
+        n->index = idx;
+
+        n->next = NULL;
+        if ((n->prev = bq->blocks_tail))
+            bq->blocks_tail->next = n;
+        else
+            bq->blocks = n;
+        bq->blocks_tail = n;
+
+        bq->n_blocks++;
+        idx += (int64_t) n->chunk.length;
+    }
+
+    /* If nothing was stored we may keep the block */
+    if (bq->blocks) {
+        pa_memblock_unref(bq->ring);
+        bq->ring = NULL;
+        bq->ring_size = 0;
+    }
+
+    bq->ring_start = bq->ring_end;
+}
+
 static void fix_current_read(pa_memblockq *bq) {
     pa_assert(bq);
 
@@ -218,10 +457,29 @@ static void drop_backlog(pa_memblockq *bq) {
 
     boundary = bq->read_index - (int64_t) bq->maxrewind;
 
+    if (ring_active(bq)) {
+        /* Only drop whole frames, so that the start stays aligned */
+        if (boundary > bq->ring_start)
+            bq->ring_start = PA_MIN(bq->ring_start + (boundary - bq->ring_start) / (int64_t) bq->base * (int64_t) bq->base, bq->ring_end);
+
+        return;
+    }
+
     while (bq->blocks && (bq->blocks->index + (int64_t) bq->blocks->chunk.length <= boundary))
         drop_block(bq, bq->blocks);
 }
 
+/* Returns the index right after the last byte stored, or def if the queue is empty */
+static int64_t queue_end(pa_memblockq *bq, int64_t def) {
+    if (bq->blocks_tail)
+        return bq->blocks_tail->index + (int64_t) bq->blocks_tail->chunk.length;
+
+    if (ring_active(bq) && !ring_is_empty(bq))
+        return bq->ring_end;
+
+    return def;
+}
+
 static pa_bool_t can_push(pa_memblockq *bq, size_t l) {
     int64_t end;
 
@@ -236,7 +494,7 @@ static pa_bool_t can_push(pa_memblockq *bq, size_t l) {
             return TRUE;
     }
 
-    end = bq->blocks_tail ? bq->blocks_tail->index + (int64_t) bq->blocks_tail->chunk.length : bq->write_index;
+    end = queue_end(bq, bq->write_index);
 
     /* Make sure that the list doesn't get too long */
     if (bq->write_index + (int64_t) l > end)
@@ -276,6 +534,26 @@ static void read_index_changed(pa_memblockq *bq, int64_t old_read_index) {
 #endif
 }
 
+/* Copy the chunk to the end of the block of q, if nobody else uses
+ * the block and it has enough room left */
+static pa_bool_t coalesce_chunk(struct list_item *q, pa_memchunk *chunk) {
+    pa_memchunk t;
+
+    if (!pa_memblock_ref_is_one(q->chunk.memblock) ||
+        pa_memblock_is_read_only(q->chunk.memblock) ||
+        pa_memblock_is_silence(q->chunk.memblock) ||
+        q->chunk.index + q->chunk.length + chunk->length > pa_memblock_get_length(q->chunk.memblock))
+        return FALSE;
+
+    t.memblock = q->chunk.memblock;
+    t.index = q->chunk.index + q->chunk.length;
+    t.length = chunk->length;
+    pa_memchunk_memcpy(&t, chunk);
+
+    q->chunk.length += chunk->length;
+    return TRUE;
+}
+
 int pa_memblockq_push(pa_memblockq* bq, const pa_memchunk *uchunk) {
     struct list_item *q, *n;
     pa_memchunk chunk;
@@ -289,12 +567,21 @@ int pa_memblockq_push(pa_memblockq* bq, const pa_memchunk *uchunk) {
 
     pa_assert_se(uchunk->length % bq->base == 0);
 
+    PA_TRACE2(memblockq_push, bq, uchunk->length);
+
     if (!can_push(bq, uchunk->length))
         return -1;
 
     old = bq->write_index;
     chunk = *uchunk;
 
+    if (ring_active(bq)) {
+        if (ring_push(bq, &chunk) >= 0)
+            goto finish;
+
+        ring_to_list(bq);
+    }
+
     fix_current_write(bq);
     q = bq->current_write;
 
@@ -410,14 +697,33 @@ int pa_memblockq_push(pa_memblockq* bq, const pa_memchunk *uchunk) {
             bq->write_index += (int64_t) chunk.length;
             goto finish;
         }
+
+        /* Append small chunks to the data right before them */
+        if (chunk.length < bq->coalesce &&
+            bq->write_index == q->index + (int64_t) q->chunk.length &&
+            coalesce_chunk(q, &chunk)) {
+
+            bq->write_index += (int64_t) chunk.length;
+            goto finish;
+        }
     } else
         pa_assert(!bq->blocks || (bq->write_index + (int64_t)chunk.length <= bq->blocks->index));
 
     if (!(n = pa_flist_pop(PA_STATIC_FLIST_GET(list_items))))
         n = pa_xnew(struct list_item, 1);
 
-    n->chunk = chunk;
-    pa_memblock_ref(n->chunk.memblock);
+    if (chunk.length < bq->coalesce) {
+        /* Copy small chunks into a full sized block of our own, so
+         * that the following ones can be appended to it */
+        n->chunk.memblock = pa_memblock_new(pa_memblock_get_pool(chunk.memblock), PA_MAX(pa_mempool_block_size_max(pa_memblock_get_pool(chunk.memblock)), chunk.length));
+        n->chunk.index = 0;
+        n->chunk.length = chunk.length;
+        pa_memchunk_memcpy(&n->chunk, &chunk);
+    } else {
+        n->chunk = chunk;
+        pa_memblock_ref(n->chunk.memblock);
+    }
+
     n->index = bq->write_index;
     bq->write_index += (int64_t) n->chunk.length;
 
@@ -483,6 +789,12 @@ int pa_memblockq_peek(pa_memblockq* bq, pa_memchunk *chunk) {
 
     fix_current_read(bq);
 
+    if (ring_active(bq) && bq->read_index >= bq->ring_start && bq->read_index < bq->ring_end) {
+        ring_chunk(bq, bq->read_index, chunk);
+        pa_memblock_ref(chunk->memblock);
+        return 0;
+    }
+
     /* Do we need to spit out silence? */
     if (!bq->current_read || bq->current_read->index > bq->read_index) {
         size_t length;
@@ -490,6 +802,8 @@ int pa_memblockq_peek(pa_memblockq* bq, pa_memchunk *chunk) {
         /* How much silence shall we return? */
         if (bq->current_read)
             length = (size_t) (bq->current_read->index - bq->read_index);
+        else if (ring_active(bq) && bq->read_index < bq->ring_start && !ring_is_empty(bq))
+            length = (size_t) (bq->ring_start - bq->read_index);
         else if (bq->write_index > bq->read_index)
             length = (size_t) (bq->write_index - bq->read_index);
         else
@@ -565,7 +879,18 @@ int pa_memblockq_peek_fixed_size(pa_memblockq *bq, size_t block_size, pa_memchun
 
     while (rchunk.index < block_size) {
 
-        if (!item || item->index > ri) {
+        if (ring_active(bq)) {
+
+            if (ri >= bq->ring_start && ri < bq->ring_end)
+                ring_chunk(bq, ri, &tchunk);
+            else {
+                tchunk = bq->silence;
+
+                if (ri < bq->ring_start && !ring_is_empty(bq))
+                    tchunk.length = PA_MIN(tchunk.length, (size_t) (bq->ring_start - ri));
+            }
+
+        } else if (!item || item->index > ri) {
             /* Do we need to append silence? */
             tchunk = bq->silence;
 
@@ -605,6 +930,8 @@ void pa_memblockq_drop(pa_memblockq *bq, size_t length) {
     pa_assert(bq);
     pa_assert(length % bq->base == 0);
 
+    PA_TRACE2(memblockq_drop, bq, length);
+
     old = bq->read_index;
 
     while (length > 0) {
@@ -615,13 +942,13 @@ void pa_memblockq_drop(pa_memblockq *bq, size_t length) {
 
         fix_current_read(bq);
 
-        if (bq->current_read) {
+        if (bq->current_read || (ring_active(bq) && !ring_is_empty(bq) && bq->read_index < bq->ring_end)) {
             int64_t p, d;
 
             /* We go through this piece by piece to make sure we don't
              * drop more than allowed by prebuf */
 
-            p = bq->current_read->index + (int64_t) bq->current_read->chunk.length;
+            p = bq->current_read ? bq->current_read->index + (int64_t) bq->current_read->chunk.length : bq->ring_end;
             pa_assert(p >= bq->read_index);
             d = p - bq->read_index;
 
@@ -643,6 +970,18 @@ void pa_memblockq_drop(pa_memblockq *bq, size_t length) {
     read_index_changed(bq, old);
 }
 
+void pa_memblockq_skip(pa_memblockq *bq, size_t length) {
+    int64_t old;
+    pa_assert(bq);
+    pa_assert(length % bq->base == 0);
+
+    old = bq->read_index;
+    bq->read_index += (int64_t) length;
+
+    drop_backlog(bq);
+    read_index_changed(bq, old);
+}
+
 void pa_memblockq_rewind(pa_memblockq *bq, size_t length) {
     int64_t old;
     pa_assert(bq);
@@ -707,7 +1046,7 @@ void pa_memblockq_seek(pa_memblockq *bq, int64_t offset, pa_seek_mode_t seek, pa
             bq->write_index = bq->read_index + offset;
             break;
         case PA_SEEK_RELATIVE_END:
-            bq->write_index = (bq->blocks_tail ? bq->blocks_tail->index + (int64_t) bq->blocks_tail->chunk.length : bq->read_index) + offset;
+            bq->write_index = queue_end(bq, bq->read_index) + offset;
             break;
         default:
             pa_assert_not_reached();
@@ -761,6 +1100,19 @@ size_t pa_memblockq_get_maxrewind(pa_memblockq *bq) {
     return bq->maxrewind;
 }
 
+size_t pa_memblockq_get_history(pa_memblockq *bq) {
+    int64_t start;
+
+    pa_assert(bq);
+
+    if (ring_active(bq))
+        start = ring_is_empty(bq) ? bq->read_index : bq->ring_start;
+    else
+        start = bq->blocks ? bq->blocks->index : bq->read_index;
+
+    return start < bq->read_index ? (size_t) (bq->read_index - start) : 0;
+}
+
 int64_t pa_memblockq_get_read_index(pa_memblockq *bq) {
     pa_assert(bq);
 
@@ -921,6 +1273,11 @@ void pa_memblockq_set_maxrewind(pa_memblockq *bq, size_t maxrewind) {
     pa_assert(bq);
 
     bq->maxrewind = (maxrewind/bq->base)*bq->base;
+
+    /* Release what is beyond the new limit right away instead of on the
+     * next drop */
+    drop_backlog(bq);
+    ring_shrink(bq);
 }
 
 void pa_memblockq_apply_attr(pa_memblockq *bq, const pa_buffer_attr *a) {
@@ -980,6 +1337,20 @@ void pa_memblockq_willneed(pa_memblockq *bq) {
 
     fix_current_read(bq);
 
+    if (ring_active(bq)) {
+        int64_t idx;
+
+        for (idx = PA_MAX(bq->read_index, bq->ring_start); idx < bq->ring_end;) {
+            pa_memchunk chunk;
+
+            ring_chunk(bq, idx, &chunk);
+            pa_memchunk_will_need(&chunk);
+            idx += (int64_t) chunk.length;
+        }
+
+        return;
+    }
+
     for (q = bq->current_read; q; q = q->next)
         pa_memchunk_will_need(&q->chunk);
 }
@@ -1000,7 +1371,7 @@ void pa_memblockq_set_silence(pa_memblockq *bq, pa_memchunk *silence) {
 pa_bool_t pa_memblockq_is_empty(pa_memblockq *bq) {
     pa_assert(bq);
 
-    return !bq->blocks;
+    return !bq->blocks && (!ring_active(bq) || ring_is_empty(bq));
 }
 
 void pa_memblockq_silence(pa_memblockq *bq) {
@@ -1010,11 +1381,17 @@ void pa_memblockq_silence(pa_memblockq *bq) {
         drop_block(bq, bq->blocks);
 
     pa_assert(bq->n_blocks == 0);
+
+    /* Keep the ring block around for reuse */
+    bq->ring_start = bq->ring_end;
 }
 
 unsigned pa_memblockq_get_nblocks(pa_memblockq *bq) {
     pa_assert(bq);
 
+    if (ring_active(bq) && !ring_is_empty(bq))
+        return 1;
+
     return bq->n_blocks;
 }
 
@@ -1023,3 +1400,24 @@ size_t pa_memblockq_get_base(pa_memblockq *bq) {
 
     return bq->base;
 }
+
+void pa_memblockq_set_ring(pa_memblockq *bq, pa_bool_t enabled) {
+    pa_assert(bq);
+
+    if (!enabled && ring_active(bq))
+        ring_to_list(bq);
+
+    if (!enabled && bq->ring) {
+        pa_memblock_unref(bq->ring);
+        bq->ring = NULL;
+        bq->ring_size = 0;
+    }
+
+    bq->ring_enabled = enabled;
+}
+
+void pa_memblockq_set_coalesce(pa_memblockq *bq, size_t length) {
+    pa_assert(bq);
+
+    bq->coalesce = length;
+}
@@ -33,7 +33,11 @@
  * perfect). It is similar to the ring buffers used by most other
  * audio software. In contrast to a ring buffer this memblockq data
  * type doesn't need to copy any data around, it just maintains
- * references to reference counted memory blocks. */
+ * references to reference counted memory blocks.
+ *
+ * Queues that are read and written mostly contiguously may instead be
+ * switched into ring buffer mode with pa_memblockq_set_ring(), which
+ * copies the data into a single memory block. */
 
 typedef struct pa_memblockq pa_memblockq;
 
@@ -105,6 +109,10 @@ int pa_memblockq_peek_fixed_size(pa_memblockq *bq, size_t block_size, pa_memchun
 /* Drop the specified bytes from the queue. */
 void pa_memblockq_drop(pa_memblockq *bq, size_t length);
 
+/* Advance the read index as if the specified bytes had been played,
+ * even past the write index and while prebuffering. */
+void pa_memblockq_skip(pa_memblockq *bq, size_t length);
+
 /* Rewind the read index. If the history is shorter than the specified length we'll point to silence afterwards. */
 void pa_memblockq_rewind(pa_memblockq *bq, size_t length);
 
@@ -151,6 +159,9 @@ size_t pa_memblockq_get_minreq(pa_memblockq *bq);
 /* Returns the maximal rewind value */
 size_t pa_memblockq_get_maxrewind(pa_memblockq *bq);
 
+/* Returns how much history before the read index is actually stored */
+size_t pa_memblockq_get_history(pa_memblockq *bq);
+
 /* Return the base unit in bytes */
 size_t pa_memblockq_get_base(pa_memblockq *bq);
 
@@ -189,4 +200,17 @@ pa_bool_t pa_memblockq_prebuf_active(pa_memblockq *bq);
 /* Return how many items are currently stored in the queue */
 unsigned pa_memblockq_get_nblocks(pa_memblockq *bq);
 
+/* Enable or disable ring buffer mode. In this mode contiguous data is
+ * copied into one memory block that is reused for the lifetime of the
+ * queue, instead of keeping one list item per pushed chunk. Pushes to
+ * a position the ring cannot represent (i.e. before the oldest data
+ * stored) transparently fall back to the list until the queue runs
+ * empty again. The API behaves the same in both modes. */
+void pa_memblockq_set_ring(pa_memblockq *bq, pa_bool_t enabled);
+
+/* Copy pushed chunks shorter than length into larger blocks owned by
+ * the queue and append to them as long as possible, so that small
+ * fragments don't end up as one item each. Pass 0 to disable. */
+void pa_memblockq_set_coalesce(pa_memblockq *bq, size_t length);
+
 #endif
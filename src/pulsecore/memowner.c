@@ -0,0 +1,140 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pulse/sample.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core-util.h>
+#include <pulsecore/refcnt.h>
+#include <pulsecore/thread.h>
+
+#include "memowner.h"
+
+struct pa_memowner {
+    PA_REFCNT_DECLARE;
+    pa_memowner_stat stat;
+};
+
+static const char * const stat_names[PA_MEMOWNER_STAT_MAX] = {
+    "allocated",
+    "allocated-bytes",
+    "imported",
+    "imported-bytes",
+    "exported",
+    "exported-bytes"
+};
+
+PA_STATIC_TLS_DECLARE_NO_FREE(current_memowner);
+
+pa_memowner* pa_memowner_new(void) {
+    pa_memowner *o;
+
+    o = pa_xnew0(pa_memowner, 1);
+    PA_REFCNT_INIT(o);
+
+    return o;
+}
+
+pa_memowner* pa_memowner_ref(pa_memowner *o) {
+    pa_assert(o);
+    pa_assert(PA_REFCNT_VALUE(o) > 0);
+
+    PA_REFCNT_INC(o);
+    return o;
+}
+
+void pa_memowner_unref(pa_memowner *o) {
+    pa_assert(o);
+    pa_assert(PA_REFCNT_VALUE(o) > 0);
+
+    if (PA_REFCNT_DEC(o) > 0)
+        return;
+
+    pa_assert(pa_atomic_load(&o->stat.n_allocated) == 0);
+    pa_assert(pa_atomic_load(&o->stat.n_exported) == 0);
+
+    pa_xfree(o);
+}
+
+pa_memowner_stat* pa_memowner_get_stat(pa_memowner *o) {
+    pa_assert(o);
+
+    return &o->stat;
+}
+
+const char *pa_memowner_stat_to_string(unsigned k) {
+    pa_assert(k < PA_MEMOWNER_STAT_MAX);
+
+    return stat_names[k];
+}
+
+void pa_memowner_get_all(pa_memowner *o, uint64_t values[PA_MEMOWNER_STAT_MAX]) {
+    pa_assert(o);
+    pa_assert(values);
+
+    values[0] = (unsigned) pa_atomic_load(&o->stat.n_allocated);
+    values[1] = (unsigned) pa_atomic_load(&o->stat.allocated_size);
+    values[2] = (unsigned) pa_atomic_load(&o->stat.n_imported);
+    values[3] = (unsigned) pa_atomic_load(&o->stat.imported_size);
+    values[4] = (unsigned) pa_atomic_load(&o->stat.n_exported);
+    values[5] = (unsigned) pa_atomic_load(&o->stat.exported_size);
+}
+
+char *pa_memowner_to_string(pa_memowner *o) {
+    uint64_t values[PA_MEMOWNER_STAT_MAX];
+    char allocated[PA_BYTES_SNPRINT_MAX], imported[PA_BYTES_SNPRINT_MAX], exported[PA_BYTES_SNPRINT_MAX];
+
+    pa_assert(o);
+
+    pa_memowner_get_all(o, values);
+
+    return pa_sprintf_malloc("allocated=%llu blocks (%s) imported=%llu blocks (%s) exported=%llu blocks (%s)",
+                             (unsigned long long) values[0], pa_bytes_snprint(allocated, sizeof(allocated), (unsigned) values[1]),
+                             (unsigned long long) values[2], pa_bytes_snprint(imported, sizeof(imported), (unsigned) values[3]),
+                             (unsigned long long) values[4], pa_bytes_snprint(exported, sizeof(exported), (unsigned) values[5]));
+}
+
+void pa_memowner_to_proplist(pa_memowner *o, pa_proplist *p) {
+    uint64_t values[PA_MEMOWNER_STAT_MAX];
+    unsigned k;
+
+    pa_assert(o);
+    pa_assert(p);
+
+    pa_memowner_get_all(o, values);
+
+    for (k = 0; k < PA_MEMOWNER_STAT_MAX; k++) {
+        char key[32];
+
+        pa_snprintf(key, sizeof(key), "memory.%s", stat_names[k]);
+        pa_proplist_setf(p, key, "%llu", (unsigned long long) values[k]);
+    }
+}
+
+pa_memowner* pa_memowner_get_current(void) {
+    return PA_STATIC_TLS_GET(current_memowner);
+}
+
+pa_memowner* pa_memowner_set_current(pa_memowner *o) {
+    return PA_STATIC_TLS_SET(current_memowner, o);
+}
@@ -0,0 +1,79 @@
+#ifndef foopulsememownerhfoo
+#define foopulsememownerhfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <inttypes.h>
+
+#include <pulse/proplist.h>
+
+#include <pulsecore/atomic.h>
+#include <pulsecore/macro.h>
+
+/* Who memory blocks are charged to. A block is charged to the owner
+ * that is current in the thread allocating it, or else to the owner of
+ * its pool, and keeps a reference to it until it is freed. Imported
+ * blocks and exports are always charged to the owner of the pool they
+ * go through. In the daemon the core, every module and every client
+ * have an owner.
+ *
+ * Like pa_mempool_stat the counters are updated without locking, so
+ * take them with a grain of salt. */
+
+typedef struct pa_memowner pa_memowner;
+
+typedef struct pa_memowner_stat {
+    pa_atomic_t n_allocated;
+    pa_atomic_t allocated_size;
+    pa_atomic_t n_imported;
+    pa_atomic_t imported_size;
+    pa_atomic_t n_exported;
+    pa_atomic_t exported_size;
+} pa_memowner_stat;
+
+#define PA_MEMOWNER_STAT_MAX 6
+
+pa_memowner* pa_memowner_new(void);
+pa_memowner* pa_memowner_ref(pa_memowner *o);
+void pa_memowner_unref(pa_memowner *o);
+
+pa_memowner_stat* pa_memowner_get_stat(pa_memowner *o);
+
+/* The name of value k, matching the order of the fields */
+const char *pa_memowner_stat_to_string(unsigned k);
+
+void pa_memowner_get_all(pa_memowner *o, uint64_t values[PA_MEMOWNER_STAT_MAX]);
+
+/* E.g. "allocated=12 blocks (1.1 MiB) imported=0 blocks (0 B) exported=4 blocks (256.0 KiB)" */
+char *pa_memowner_to_string(pa_memowner *o);
+
+/* Sets memory.<value> in p for every value */
+void pa_memowner_to_proplist(pa_memowner *o, pa_proplist *p);
+
+/* The owner of the calling thread, or NULL. Threads created with
+ * pa_thread_new() start out with the owner of the thread that created
+ * them. */
+pa_memowner* pa_memowner_get_current(void);
+
+/* No reference is taken, o needs to stay around for as long as it is
+ * current. Returns the previous owner, for restoring it. */
+pa_memowner* pa_memowner_set_current(pa_memowner *o);
+
+#endif
@@ -27,9 +27,11 @@
 
 #include <math.h>
 
+#include <pulse/xmalloc.h>
+
 #include <pulsecore/sample-util.h>
 #include <pulsecore/macro.h>
-#include <pulsecore/g711.h>
+#include <pulsecore/sconv.h>
 #include <pulsecore/endianmacros.h>
 
 #include "mix.h"
@@ -485,56 +487,61 @@ static void pa_mix_u8_c(pa_mix_info streams[], unsigned nstreams, unsigned chann
     }
 }
 
-static void pa_mix_ulaw_c(pa_mix_info streams[], unsigned nstreams, unsigned channels, uint8_t *data, unsigned length) {
-    unsigned channel = 0;
+/* The 8 bit formats are decoded to s16 once per stream, mixed by the s16
+ * mixer, which may well be a vectorized one, and encoded again. The same
+ * volume is applied and the sum is clamped the same, hence the result is
+ * what mixing sample by sample in the original format gives. This is
+ * done in passes that each use a part of the buffer for every stream and
+ * one for the result. With too many streams for that the passes go frame
+ * by frame, through the scratch frame of every pa_mix_info. */
+#define MIX_S16_SAMPLES 16384
 
-    length /= sizeof(uint8_t);
+static void mix_via_s16(pa_sample_format_t format, pa_mix_info streams[], unsigned nstreams, unsigned channels, uint8_t *data, unsigned length) {
+    int16_t scratch[MIX_S16_SAMPLES];
+    pa_convert_func_t decode, encode;
+    pa_do_mix_func_t mix;
+    unsigned n, k;
+    pa_bool_t per_frame;
 
-    for (; length > 0; length--, data++) {
-        int32_t sum = 0;
-        unsigned i;
-
-        for (i = 0; i < nstreams; i++) {
-            pa_mix_info *m = streams + i;
-            int32_t cv = m->linear[channel].i;
+    pa_assert_se(decode = pa_get_convert_to_s16ne_function(format));
+    pa_assert_se(encode = pa_get_convert_from_s16ne_function(format));
+    mix = pa_get_mix_func(PA_SAMPLE_S16NE);
 
-            if (PA_LIKELY(cv > 0))
-                sum += pa_mult_s16_volume(st_ulaw2linear16(*((uint8_t*) m->ptr)), cv);
-            m->ptr = (uint8_t*) m->ptr + 1;
-        }
+    n = MIX_S16_SAMPLES / (nstreams + 1) / channels * channels;
 
-        sum = PA_CLAMP_UNLIKELY(sum, -0x8000, 0x7FFF);
-        *data = (uint8_t) st_14linear2ulaw((int16_t) sum >> 2);
+    if ((per_frame = PA_UNLIKELY(n <= 0)))
+        n = channels;
 
-        if (PA_UNLIKELY(++channel >= channels))
-            channel = 0;
-    }
-}
+    for (k = 0; k < nstreams; k++)
+        streams[k].src = streams[k].ptr;
 
-static void pa_mix_alaw_c(pa_mix_info streams[], unsigned nstreams, unsigned channels, uint8_t *data, unsigned length) {
-    unsigned channel = 0;
+    while (length > 0) {
+        unsigned l = PA_MIN(length, n);
+        int16_t *result = per_frame ? scratch : scratch + nstreams * n;
 
-    length /= sizeof(uint8_t);
+        for (k = 0; k < nstreams; k++) {
+            streams[k].ptr = per_frame ? streams[k].frame : scratch + k * n;
+            decode(l, streams[k].src, streams[k].ptr);
+            streams[k].src = (const uint8_t*) streams[k].src + l;
+        }
 
-    for (; length > 0; length--, data++) {
-        int32_t sum = 0;
-        unsigned i;
+        mix(streams, nstreams, channels, result, l * sizeof(int16_t));
+        encode(l, result, data);
 
-        for (i = 0; i < nstreams; i++) {
-            pa_mix_info *m = streams + i;
-            int32_t cv = m->linear[channel].i;
+        data += l;
+        length -= l;
+    }
 
-            if (PA_LIKELY(cv > 0))
-                sum += pa_mult_s16_volume(st_alaw2linear16(*((uint8_t*) m->ptr)), cv);
-            m->ptr = (uint8_t*) m->ptr + 1;
-        }
+    for (k = 0; k < nstreams; k++)
+        streams[k].ptr = (void*) streams[k].src;
+}
 
-        sum = PA_CLAMP_UNLIKELY(sum, -0x8000, 0x7FFF);
-        *data = (uint8_t) st_13linear2alaw((int16_t) sum >> 3);
+static void pa_mix_ulaw_c(pa_mix_info streams[], unsigned nstreams, unsigned channels, uint8_t *data, unsigned length) {
+    mix_via_s16(PA_SAMPLE_ULAW, streams, nstreams, channels, data, length);
+}
 
-        if (PA_UNLIKELY(++channel >= channels))
-            channel = 0;
-    }
+static void pa_mix_alaw_c(pa_mix_info streams[], unsigned nstreams, unsigned channels, uint8_t *data, unsigned length) {
+    mix_via_s16(PA_SAMPLE_ALAW, streams, nstreams, channels, data, length);
 }
 
 static void pa_mix_float32ne_c(pa_mix_info streams[], unsigned nstreams, unsigned channels, float *data, unsigned length) {
@@ -723,3 +730,53 @@ void pa_volume_memchunk(
 
     pa_memblock_release(c->memblock);
 }
+
+/* Formats without a ramp function get a constant volume for every
+ * this many frames instead */
+#define RAMP_STEP_FRAMES 32
+
+void pa_volume_ramp_memchunk(
+        pa_memchunk *c,
+        const pa_sample_spec *spec,
+        float gain,
+        float step) {
+
+    pa_do_volume_ramp_func_t do_volume_ramp;
+    size_t fs, frames, k;
+    void *ptr;
+
+    pa_assert(c);
+    pa_assert(spec);
+    pa_assert(pa_sample_spec_valid(spec));
+    pa_assert(pa_frame_aligned(c->length, spec));
+
+    if (pa_memblock_is_silence(c->memblock))
+        return;
+
+    fs = pa_frame_size(spec);
+    frames = c->length / fs;
+
+    if (!(do_volume_ramp = pa_get_volume_ramp_func(spec->format))) {
+
+        for (k = 0; k < frames; k += RAMP_STEP_FRAMES) {
+            size_t n = PA_MIN(frames - k, (size_t) RAMP_STEP_FRAMES);
+            pa_memchunk part;
+            pa_cvolume v;
+
+            part.memblock = c->memblock;
+            part.index = c->index + k * fs;
+            part.length = n * fs;
+
+            pa_cvolume_set(&v, spec->channels, pa_sw_volume_from_linear(gain + step * ((float) k + (float) n / 2.0f)));
+            pa_volume_memchunk(&part, spec, &v);
+        }
+
+        return;
+    }
+
+    ptr = pa_memblock_acquire_chunk(c);
+
+    do_volume_ramp(ptr, gain, step, spec->channels, c->length);
+
+    pa_memblock_release(c->memblock);
+}
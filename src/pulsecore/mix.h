@@ -40,6 +40,11 @@ typedef struct pa_mix_info {
         int32_t i;
         float f;
     } linear[PA_CHANNELS_MAX];
+
+    /* Scratch space of the formats that are mixed as s16, so that
+     * mixing doesn't need to allocate however many streams there are */
+    const void *src;
+    int16_t frame[PA_CHANNELS_MAX];
 } pa_mix_info;
 
 size_t pa_mix(
@@ -61,4 +66,11 @@ void pa_volume_memchunk(
     const pa_sample_spec *spec,
     const pa_cvolume *volume);
 
+/* Multiplies frame k of the chunk with the linear gain + k * step */
+void pa_volume_ramp_memchunk(
+    pa_memchunk *c,
+    const pa_sample_spec *spec,
+    float gain,
+    float step);
+
 #endif
@@ -0,0 +1,272 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pulsecore/macro.h>
+#include <pulsecore/log.h>
+
+#include "cpu-x86.h"
+#include "mix.h"
+#include "simd-x86.h"
+
+/* Same scheme as the SSE2 mixers in mix_sse.c, with twice the lanes. */
+
+#define TILE_SAMPLES 1024
+#define PATTERN_MAX (PA_CHANNELS_MAX * 16)
+
+static pa_do_mix_func_t fallback_s16ne, fallback_s32ne, fallback_float32ne;
+
+static unsigned gcd(unsigned a, unsigned b) {
+    while (b) {
+        unsigned t = a % b;
+        a = b;
+        b = t;
+    }
+
+    return a;
+}
+
+static unsigned pattern_length(unsigned channels, unsigned lanes) {
+    return channels / gcd(channels, lanes) * lanes;
+}
+
+static pa_bool_t fill_pattern_i(const pa_mix_info *m, unsigned channels, unsigned period, int32_t *pattern) {
+    unsigned i, channel = 0;
+    pa_bool_t audible = FALSE;
+
+    for (i = 0; i < period; i++) {
+        int32_t cv = m->linear[channel].i;
+
+        pattern[i] = cv > 0 ? cv : 0;
+        audible = audible || cv > 0;
+
+        if (++channel >= channels)
+            channel = 0;
+    }
+
+    return audible;
+}
+
+static pa_bool_t fill_pattern_f(const pa_mix_info *m, unsigned channels, unsigned period, float *pattern) {
+    unsigned i, channel = 0;
+    pa_bool_t audible = FALSE;
+
+    for (i = 0; i < period; i++) {
+        float cv = m->linear[channel].f;
+
+        pattern[i] = cv > 0 ? cv : 0;
+        audible = audible || cv > 0;
+
+        if (++channel >= channels)
+            channel = 0;
+    }
+
+    return audible;
+}
+
+static void advance_streams(pa_mix_info streams[], unsigned nstreams, size_t bytes) {
+    unsigned i;
+
+    for (i = 0; i < nstreams; i++)
+        streams[i].ptr = (uint8_t*) streams[i].ptr + bytes;
+}
+
+static void pa_mix_s16ne_avx2(pa_mix_info streams[], unsigned nstreams, unsigned channels, int16_t *data, unsigned length) {
+    /* Unpacking works within 128 bit halves, so the first accumulator of
+     * each group of 16 samples holds samples 0-3 and 8-11. The final
+     * _mm256_packs_epi32() undoes that. */
+    PA_DECLARE_ALIGNED(32, int32_t, acc[TILE_SAMPLES]);
+    PA_DECLARE_ALIGNED(32, int16_t, vh[PATTERN_MAX]);
+    PA_DECLARE_ALIGNED(32, int16_t, vl[PATTERN_MAX]);
+    int32_t pattern[PATTERN_MAX];
+    const __m256i one = _mm256_set1_epi16(1);
+    unsigned period, tile, n, done;
+
+    period = pattern_length(channels, 16);
+    tile = TILE_SAMPLES / period * period;
+    n = length / sizeof(int16_t) / period * period;
+
+    for (done = 0; done < n; done += tile) {
+        unsigned len = PA_MIN(tile, n - done);
+        unsigned i, j, k;
+
+        for (j = 0; j < len; j += 8)
+            _mm256_store_si256((__m256i*) (acc + j), _mm256_setzero_si256());
+
+        for (i = 0; i < nstreams; i++) {
+            const int16_t *src = (const int16_t*) streams[i].ptr + done;
+
+            if (!fill_pattern_i(streams + i, channels, period, pattern))
+                continue;
+
+            for (k = 0; k < period; k++) {
+                vh[k] = (int16_t) (pattern[k] >> 16);
+                vl[k] = (int16_t) (pattern[k] & 0xFFFF);
+            }
+
+            for (j = 0, k = 0; j < len; j += 16) {
+                __m256i v = _mm256_loadu_si256((const __m256i*) (src + j));
+                __m256i h = _mm256_load_si256((const __m256i*) (vh + k));
+                __m256i l = _mm256_load_si256((const __m256i*) (vl + k));
+                __m256i lp, a0, a1;
+
+                lp = _mm256_sub_epi16(_mm256_mulhi_epu16(v, l), _mm256_and_si256(_mm256_srai_epi16(v, 15), l));
+
+                a0 = _mm256_madd_epi16(_mm256_unpacklo_epi16(v, lp), _mm256_unpacklo_epi16(h, one));
+                a1 = _mm256_madd_epi16(_mm256_unpackhi_epi16(v, lp), _mm256_unpackhi_epi16(h, one));
+
+                _mm256_store_si256((__m256i*) (acc + j), _mm256_add_epi32(_mm256_load_si256((__m256i*) (acc + j)), a0));
+                _mm256_store_si256((__m256i*) (acc + j + 8), _mm256_add_epi32(_mm256_load_si256((__m256i*) (acc + j + 8)), a1));
+
+                if ((k += 16) >= period)
+                    k = 0;
+            }
+        }
+
+        for (j = 0; j < len; j += 16) {
+            __m256i a0 = _mm256_load_si256((__m256i*) (acc + j));
+            __m256i a1 = _mm256_load_si256((__m256i*) (acc + j + 8));
+
+            _mm256_storeu_si256((__m256i*) (data + done + j), _mm256_packs_epi32(a0, a1));
+        }
+    }
+
+    advance_streams(streams, nstreams, n * sizeof(int16_t));
+    length -= n * sizeof(int16_t);
+
+    if (length > 0)
+        fallback_s16ne(streams, nstreams, channels, data + n, length);
+}
+
+static void pa_mix_s32ne_avx2(pa_mix_info streams[], unsigned nstreams, unsigned channels, int32_t *data, unsigned length) {
+    /* Every group of eight samples is kept as two vectors, the first one
+     * holding the sums of the even samples, the second of the odd ones */
+    PA_DECLARE_ALIGNED(32, int64_t, acc[TILE_SAMPLES]);
+    PA_DECLARE_ALIGNED(32, int32_t, pattern[PATTERN_MAX]);
+    unsigned period, tile, n, done;
+
+    period = pattern_length(channels, 8);
+    tile = TILE_SAMPLES / period * period;
+    n = length / sizeof(int32_t) / period * period;
+
+    for (done = 0; done < n; done += tile) {
+        unsigned len = PA_MIN(tile, n - done);
+        unsigned i, j, k;
+
+        for (j = 0; j < len; j += 4)
+            _mm256_store_si256((__m256i*) (acc + j), _mm256_setzero_si256());
+
+        for (i = 0; i < nstreams; i++) {
+            const int32_t *src = (const int32_t*) streams[i].ptr + done;
+
+            if (!fill_pattern_i(streams + i, channels, period, pattern))
+                continue;
+
+            for (j = 0, k = 0; j < len; j += 8) {
+                __m256i v = _mm256_loadu_si256((const __m256i*) (src + j));
+                __m256i c = _mm256_load_si256((const __m256i*) (pattern + k));
+                __m256i e, o;
+
+                e = sra16_s64_avx2(_mm256_mul_epi32(v, c));
+                o = sra16_s64_avx2(_mm256_mul_epi32(_mm256_srli_epi64(v, 32), _mm256_srli_epi64(c, 32)));
+
+                _mm256_store_si256((__m256i*) (acc + j), _mm256_add_epi64(_mm256_load_si256((__m256i*) (acc + j)), e));
+                _mm256_store_si256((__m256i*) (acc + j + 4), _mm256_add_epi64(_mm256_load_si256((__m256i*) (acc + j + 4)), o));
+
+                if ((k += 8) >= period)
+                    k = 0;
+            }
+        }
+
+        for (j = 0; j < len; j += 8) {
+            __m256i e = sat_s64_avx2(_mm256_load_si256((__m256i*) (acc + j)));
+            __m256i o = sat_s64_avx2(_mm256_load_si256((__m256i*) (acc + j + 4)));
+
+            _mm256_storeu_si256((__m256i*) (data + done + j), _mm256_blend_epi32(e, _mm256_slli_epi64(o, 32), 0xAA));
+        }
+    }
+
+    advance_streams(streams, nstreams, n * sizeof(int32_t));
+    length -= n * sizeof(int32_t);
+
+    if (length > 0)
+        fallback_s32ne(streams, nstreams, channels, data + n, length);
+}
+
+static void pa_mix_float32ne_avx2(pa_mix_info streams[], unsigned nstreams, unsigned channels, float *data, unsigned length) {
+    PA_DECLARE_ALIGNED(32, float, pattern[PATTERN_MAX]);
+    const __m256 zero = _mm256_setzero_ps();
+    unsigned period, tile, n, done;
+
+    period = pattern_length(channels, 8);
+    tile = TILE_SAMPLES / period * period;
+    n = length / sizeof(float) / period * period;
+
+    for (done = 0; done < n; done += tile) {
+        unsigned len = PA_MIN(tile, n - done);
+        float *d = data + done;
+        unsigned i, j, k;
+
+        for (j = 0; j < len; j += 8)
+            _mm256_storeu_ps(d + j, zero);
+
+        for (i = 0; i < nstreams; i++) {
+            const float *src = (const float*) streams[i].ptr + done;
+
+            if (!fill_pattern_f(streams + i, channels, period, pattern))
+                continue;
+
+            for (j = 0, k = 0; j < len; j += 8) {
+                __m256 c = _mm256_load_ps(pattern + k);
+                __m256 v = _mm256_mul_ps(_mm256_loadu_ps(src + j), c);
+
+                v = _mm256_and_ps(v, _mm256_cmp_ps(c, zero, _CMP_GT_OQ));
+                _mm256_storeu_ps(d + j, _mm256_add_ps(_mm256_loadu_ps(d + j), v));
+
+                if ((k += 8) >= period)
+                    k = 0;
+            }
+        }
+    }
+
+    advance_streams(streams, nstreams, n * sizeof(float));
+    length -= n * sizeof(float);
+
+    if (length > 0)
+        fallback_float32ne(streams, nstreams, channels, data + n, length);
+}
+
+void pa_mix_func_init_avx2(pa_cpu_x86_flag_t flags) {
+    if (flags & PA_CPU_X86_AVX2) {
+        pa_log_info("Initialising AVX2 optimized mixing functions.");
+
+        if (!fallback_s16ne) {
+            fallback_s16ne = pa_get_mix_func(PA_SAMPLE_S16NE);
+            fallback_s32ne = pa_get_mix_func(PA_SAMPLE_S32NE);
+            fallback_float32ne = pa_get_mix_func(PA_SAMPLE_FLOAT32NE);
+        }
+
+        pa_set_mix_func(PA_SAMPLE_S16NE, (pa_do_mix_func_t) pa_mix_s16ne_avx2);
+        pa_set_mix_func(PA_SAMPLE_S32NE, (pa_do_mix_func_t) pa_mix_s32ne_avx2);
+        pa_set_mix_func(PA_SAMPLE_FLOAT32NE, (pa_do_mix_func_t) pa_mix_float32ne_avx2);
+    }
+}
@@ -0,0 +1,199 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include <pulsecore/macro.h>
+#include <pulsecore/log.h>
+#include <pulsecore/mix.h>
+#include <pulsecore/mix-orc-gen.h>
+
+#include "cpu-orc.h"
+
+/* The Orc kernels apply one volume to all samples of a stream, or two to
+ * the samples of a stereo stream. Streams whose volumes differ between
+ * more channels than that are left to the C mixers. The integer mixers
+ * accumulate a tile of output samples at a time, so that the accumulator
+ * stays in the cache. */
+
+#define TILE_SAMPLES 1024
+
+static pa_do_mix_func_t fallback_s16ne, fallback_s32ne, fallback_float32ne;
+
+static pa_bool_t volume_is_flat_i(const pa_mix_info *m, unsigned channels) {
+    unsigned c;
+
+    for (c = 1; c < channels; c++)
+        if (m->linear[c].i != m->linear[0].i)
+            return FALSE;
+
+    return TRUE;
+}
+
+static pa_bool_t volume_is_flat_f(const pa_mix_info *m, unsigned channels) {
+    unsigned c;
+
+    for (c = 1; c < channels; c++)
+        if (m->linear[c].f != m->linear[0].f)
+            return FALSE;
+
+    return TRUE;
+}
+
+static pa_bool_t streams_are_flat_i(pa_mix_info streams[], unsigned nstreams, unsigned channels) {
+    unsigned i;
+
+    for (i = 0; i < nstreams; i++)
+        if (!volume_is_flat_i(streams + i, channels))
+            return FALSE;
+
+    return TRUE;
+}
+
+static pa_bool_t streams_are_flat_f(pa_mix_info streams[], unsigned nstreams, unsigned channels) {
+    unsigned i;
+
+    for (i = 0; i < nstreams; i++)
+        if (!volume_is_flat_f(streams + i, channels))
+            return FALSE;
+
+    return TRUE;
+}
+
+/* The C mixers skip non-positive volumes, which is the same as scaling
+ * with 0 */
+static uint32_t positive_i(int32_t cv) {
+    return cv > 0 ? (uint32_t) cv : 0;
+}
+
+static uint32_t positive_f(float cv) {
+    union { float f; uint32_t u; } v;
+
+    v.f = cv > 0 ? cv : 0.0f;
+    return v.u;
+}
+
+static void pa_mix_s16ne_orc(pa_mix_info streams[], unsigned nstreams, unsigned channels, int16_t *data, unsigned length) {
+    int32_t acc[TILE_SAMPLES];
+    unsigned n, i;
+
+    if (channels != 2 && !streams_are_flat_i(streams, nstreams, channels)) {
+        fallback_s16ne(streams, nstreams, channels, data, length);
+        return;
+    }
+
+    length /= sizeof(int16_t);
+
+    /* TILE_SAMPLES is even, so the tiles of stereo streams always start
+     * with the left channel */
+    for (; length > 0; length -= n, data += n) {
+        n = PA_MIN(length, TILE_SAMPLES);
+        memset(acc, 0, n * sizeof(int32_t));
+
+        for (i = 0; i < nstreams; i++) {
+            pa_mix_info *m = streams + i;
+
+            if (volume_is_flat_i(m, channels)) {
+                if (PA_LIKELY(m->linear[0].i > 0))
+                    pa_mix_s16ne_orc_add_1ch(acc, m->ptr, m->linear[0].i, n);
+            } else {
+                int64_t v = (int64_t) positive_i(m->linear[1].i) << 32 | positive_i(m->linear[0].i);
+                pa_mix_s16ne_orc_add_2ch(acc, m->ptr, v, n / 2);
+            }
+
+            m->ptr = (uint8_t*) m->ptr + n * sizeof(int16_t);
+        }
+
+        pa_mix_s16ne_orc_store(data, acc, n);
+    }
+}
+
+static void pa_mix_s32ne_orc(pa_mix_info streams[], unsigned nstreams, unsigned channels, int32_t *data, unsigned length) {
+    int64_t acc[TILE_SAMPLES];
+    unsigned n, i;
+
+    /* Two 64 bit lanes don't fit into an Orc variable, so there is no
+     * stereo kernel */
+    if (!streams_are_flat_i(streams, nstreams, channels)) {
+        fallback_s32ne(streams, nstreams, channels, data, length);
+        return;
+    }
+
+    length /= sizeof(int32_t);
+
+    for (; length > 0; length -= n, data += n) {
+        n = PA_MIN(length, TILE_SAMPLES);
+        memset(acc, 0, n * sizeof(int64_t));
+
+        for (i = 0; i < nstreams; i++) {
+            pa_mix_info *m = streams + i;
+
+            if (PA_LIKELY(m->linear[0].i > 0))
+                pa_mix_s32ne_orc_add_1ch(acc, m->ptr, m->linear[0].i, n);
+
+            m->ptr = (uint8_t*) m->ptr + n * sizeof(int32_t);
+        }
+
+        pa_mix_s32ne_orc_store(data, acc, n);
+    }
+}
+
+static void pa_mix_float32ne_orc(pa_mix_info streams[], unsigned nstreams, unsigned channels, float *data, unsigned length) {
+    unsigned i;
+
+    if (channels != 2 && !streams_are_flat_f(streams, nstreams, channels)) {
+        fallback_float32ne(streams, nstreams, channels, data, length);
+        return;
+    }
+
+    length /= sizeof(float);
+    memset(data, 0, length * sizeof(float));
+
+    for (i = 0; i < nstreams; i++) {
+        pa_mix_info *m = streams + i;
+
+        if (volume_is_flat_f(m, channels)) {
+            if (PA_LIKELY(m->linear[0].f > 0))
+                pa_mix_float32ne_orc_add_1ch(data, m->ptr, m->linear[0].f, length);
+        } else {
+            int64_t v = (int64_t) positive_f(m->linear[1].f) << 32 | positive_f(m->linear[0].f);
+            pa_mix_float32ne_orc_add_2ch(data, m->ptr, v, length / 2);
+        }
+
+        m->ptr = (uint8_t*) m->ptr + length * sizeof(float);
+    }
+}
+
+void pa_mix_func_init_orc(void) {
+    pa_log_info("Initialising ORC optimized mixing functions.");
+
+    if (!fallback_s16ne) {
+        fallback_s16ne = pa_get_mix_func(PA_SAMPLE_S16NE);
+        fallback_s32ne = pa_get_mix_func(PA_SAMPLE_S32NE);
+        fallback_float32ne = pa_get_mix_func(PA_SAMPLE_FLOAT32NE);
+    }
+
+    pa_set_mix_func(PA_SAMPLE_S16NE, (pa_do_mix_func_t) pa_mix_s16ne_orc);
+    pa_set_mix_func(PA_SAMPLE_S32NE, (pa_do_mix_func_t) pa_mix_s32ne_orc);
+    pa_set_mix_func(PA_SAMPLE_FLOAT32NE, (pa_do_mix_func_t) pa_mix_float32ne_orc);
+}
@@ -0,0 +1,287 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pulsecore/macro.h>
+#include <pulsecore/log.h>
+
+#include "cpu-x86.h"
+#include "mix.h"
+#include "simd-x86.h"
+
+/* The kernels below loop over the streams for every tile of output
+ * samples and keep the running sums in a small accumulator on the stack,
+ * so that each input is read exactly once and the accumulator stays in L1.
+ * The results are bit-identical to the generic C mixers in mix.c. */
+
+#define TILE_SAMPLES 1024
+#define PATTERN_MAX (PA_CHANNELS_MAX * 8)
+
+static pa_do_mix_func_t fallback_s16ne, fallback_s32ne, fallback_float32ne;
+
+static unsigned gcd(unsigned a, unsigned b) {
+    while (b) {
+        unsigned t = a % b;
+        a = b;
+        b = t;
+    }
+
+    return a;
+}
+
+/* Number of samples after which both the channel layout and the SIMD lanes
+ * line up again, i.e. lcm(channels, lanes) */
+static unsigned pattern_length(unsigned channels, unsigned lanes) {
+    return channels / gcd(channels, lanes) * lanes;
+}
+
+/* Expand the per-channel volumes of a stream to one value per sample of a
+ * pattern period. Returns FALSE if the stream does not contribute at all. */
+static pa_bool_t fill_pattern_i(const pa_mix_info *m, unsigned channels, unsigned period, int32_t *pattern) {
+    unsigned i, channel = 0;
+    pa_bool_t audible = FALSE;
+
+    for (i = 0; i < period; i++) {
+        int32_t cv = m->linear[channel].i;
+
+        /* Match the C mixers which skip non-positive volumes */
+        pattern[i] = cv > 0 ? cv : 0;
+        audible = audible || cv > 0;
+
+        if (++channel >= channels)
+            channel = 0;
+    }
+
+    return audible;
+}
+
+static pa_bool_t fill_pattern_f(const pa_mix_info *m, unsigned channels, unsigned period, float *pattern) {
+    unsigned i, channel = 0;
+    pa_bool_t audible = FALSE;
+
+    for (i = 0; i < period; i++) {
+        float cv = m->linear[channel].f;
+
+        pattern[i] = cv > 0 ? cv : 0;
+        audible = audible || cv > 0;
+
+        if (++channel >= channels)
+            channel = 0;
+    }
+
+    return audible;
+}
+
+static void advance_streams(pa_mix_info streams[], unsigned nstreams, size_t bytes) {
+    unsigned i;
+
+    for (i = 0; i < nstreams; i++)
+        streams[i].ptr = (uint8_t*) streams[i].ptr + bytes;
+}
+
+static void pa_mix_s16ne_sse2(pa_mix_info streams[], unsigned nstreams, unsigned channels, int16_t *data, unsigned length) {
+    PA_DECLARE_ALIGNED(16, int32_t, acc[TILE_SAMPLES]);
+    PA_DECLARE_ALIGNED(16, int16_t, vh[PATTERN_MAX]);
+    PA_DECLARE_ALIGNED(16, int16_t, vl[PATTERN_MAX]);
+    int32_t pattern[PATTERN_MAX];
+    const __m128i one = _mm_set1_epi16(1);
+    unsigned period, tile, n, done;
+
+    period = pattern_length(channels, 8);
+    tile = TILE_SAMPLES / period * period;
+    n = length / sizeof(int16_t) / period * period;
+
+    for (done = 0; done < n; done += tile) {
+        unsigned len = PA_MIN(tile, n - done);
+        unsigned i, j, k;
+
+        for (j = 0; j < len; j += 4)
+            _mm_store_si128((__m128i*) (acc + j), _mm_setzero_si128());
+
+        for (i = 0; i < nstreams; i++) {
+            const int16_t *src = (const int16_t*) streams[i].ptr + done;
+
+            if (!fill_pattern_i(streams + i, channels, period, pattern))
+                continue;
+
+            /* Split cv into hi * 0x10000 + lo, then (v * cv) >> 16 is
+             * exactly v * hi + ((v * lo) >> 16) */
+            for (k = 0; k < period; k++) {
+                vh[k] = (int16_t) (pattern[k] >> 16);
+                vl[k] = (int16_t) (pattern[k] & 0xFFFF);
+            }
+
+            for (j = 0, k = 0; j < len; j += 8) {
+                __m128i v = _mm_loadu_si128((const __m128i*) (src + j));
+                __m128i h = _mm_load_si128((const __m128i*) (vh + k));
+                __m128i l = _mm_load_si128((const __m128i*) (vl + k));
+                __m128i lp, a0, a1;
+
+                /* unsigned high product, corrected for negative samples */
+                lp = _mm_sub_epi16(_mm_mulhi_epu16(v, l), _mm_and_si128(_mm_srai_epi16(v, 15), l));
+
+                /* v * hi + lp * 1, widened to 32 bit */
+                a0 = _mm_madd_epi16(_mm_unpacklo_epi16(v, lp), _mm_unpacklo_epi16(h, one));
+                a1 = _mm_madd_epi16(_mm_unpackhi_epi16(v, lp), _mm_unpackhi_epi16(h, one));
+
+                _mm_store_si128((__m128i*) (acc + j), _mm_add_epi32(_mm_load_si128((__m128i*) (acc + j)), a0));
+                _mm_store_si128((__m128i*) (acc + j + 4), _mm_add_epi32(_mm_load_si128((__m128i*) (acc + j + 4)), a1));
+
+                if ((k += 8) >= period)
+                    k = 0;
+            }
+        }
+
+        for (j = 0; j < len; j += 8) {
+            __m128i a0 = _mm_load_si128((__m128i*) (acc + j));
+            __m128i a1 = _mm_load_si128((__m128i*) (acc + j + 4));
+
+            _mm_storeu_si128((__m128i*) (data + done + j), _mm_packs_epi32(a0, a1));
+        }
+    }
+
+    advance_streams(streams, nstreams, n * sizeof(int16_t));
+    length -= n * sizeof(int16_t);
+
+    if (length > 0)
+        fallback_s16ne(streams, nstreams, channels, data + n, length);
+}
+
+static void pa_mix_s32ne_sse2(pa_mix_info streams[], unsigned nstreams, unsigned channels, int32_t *data, unsigned length) {
+    /* Every group of four samples is kept as two vectors, the first one
+     * holding the sums of samples 0 and 2, the second of samples 1 and 3 */
+    PA_DECLARE_ALIGNED(16, int64_t, acc[TILE_SAMPLES]);
+    PA_DECLARE_ALIGNED(16, int32_t, pattern[PATTERN_MAX]);
+    const __m128i low = _mm_set_epi32(0, -1, 0, -1);
+    unsigned period, tile, n, done;
+
+    period = pattern_length(channels, 4);
+    tile = TILE_SAMPLES / period * period;
+    n = length / sizeof(int32_t) / period * period;
+
+    for (done = 0; done < n; done += tile) {
+        unsigned len = PA_MIN(tile, n - done);
+        unsigned i, j, k;
+
+        for (j = 0; j < len; j += 2)
+            _mm_store_si128((__m128i*) (acc + j), _mm_setzero_si128());
+
+        for (i = 0; i < nstreams; i++) {
+            const int32_t *src = (const int32_t*) streams[i].ptr + done;
+
+            if (!fill_pattern_i(streams + i, channels, period, pattern))
+                continue;
+
+            for (j = 0, k = 0; j < len; j += 4) {
+                __m128i v = _mm_loadu_si128((const __m128i*) (src + j));
+                __m128i c = _mm_load_si128((const __m128i*) (pattern + k));
+                __m128i e, o;
+
+                e = sra16_s64_sse2(mul_s32_sse2(v, c));
+                o = sra16_s64_sse2(mul_s32_sse2(_mm_srli_epi64(v, 32), _mm_srli_epi64(c, 32)));
+
+                _mm_store_si128((__m128i*) (acc + j), _mm_add_epi64(_mm_load_si128((__m128i*) (acc + j)), e));
+                _mm_store_si128((__m128i*) (acc + j + 2), _mm_add_epi64(_mm_load_si128((__m128i*) (acc + j + 2)), o));
+
+                if ((k += 4) >= period)
+                    k = 0;
+            }
+        }
+
+        for (j = 0; j < len; j += 4) {
+            __m128i e = sat_s64_sse2(_mm_load_si128((__m128i*) (acc + j)));
+            __m128i o = sat_s64_sse2(_mm_load_si128((__m128i*) (acc + j + 2)));
+
+            _mm_storeu_si128((__m128i*) (data + done + j), _mm_or_si128(_mm_and_si128(e, low), _mm_slli_epi64(o, 32)));
+        }
+    }
+
+    advance_streams(streams, nstreams, n * sizeof(int32_t));
+    length -= n * sizeof(int32_t);
+
+    if (length > 0)
+        fallback_s32ne(streams, nstreams, channels, data + n, length);
+}
+
+static void pa_mix_float32ne_sse2(pa_mix_info streams[], unsigned nstreams, unsigned channels, float *data, unsigned length) {
+    PA_DECLARE_ALIGNED(16, float, pattern[PATTERN_MAX]);
+    const __m128 zero = _mm_setzero_ps();
+    unsigned period, tile, n, done;
+
+    period = pattern_length(channels, 4);
+    tile = TILE_SAMPLES / period * period;
+    n = length / sizeof(float) / period * period;
+
+    /* Float sums need no saturation, so the output doubles as the
+     * accumulator. The streams are added in the same order as in the C
+     * version, which keeps the rounding identical. */
+    for (done = 0; done < n; done += tile) {
+        unsigned len = PA_MIN(tile, n - done);
+        float *d = data + done;
+        unsigned i, j, k;
+
+        for (j = 0; j < len; j += 4)
+            _mm_storeu_ps(d + j, zero);
+
+        for (i = 0; i < nstreams; i++) {
+            const float *src = (const float*) streams[i].ptr + done;
+
+            if (!fill_pattern_f(streams + i, channels, period, pattern))
+                continue;
+
+            for (j = 0, k = 0; j < len; j += 4) {
+                __m128 c = _mm_load_ps(pattern + k);
+                __m128 v = _mm_mul_ps(_mm_loadu_ps(src + j), c);
+
+                /* Lanes with zero volume are skipped rather than multiplied,
+                 * just like in the C version */
+                v = _mm_and_ps(v, _mm_cmpgt_ps(c, zero));
+                _mm_storeu_ps(d + j, _mm_add_ps(_mm_loadu_ps(d + j), v));
+
+                if ((k += 4) >= period)
+                    k = 0;
+            }
+        }
+    }
+
+    advance_streams(streams, nstreams, n * sizeof(float));
+    length -= n * sizeof(float);
+
+    if (length > 0)
+        fallback_float32ne(streams, nstreams, channels, data + n, length);
+}
+
+void pa_mix_func_init_sse(pa_cpu_x86_flag_t flags) {
+    if (flags & PA_CPU_X86_SSE2) {
+        pa_log_info("Initialising SSE2 optimized mixing functions.");
+
+        if (!fallback_s16ne) {
+            fallback_s16ne = pa_get_mix_func(PA_SAMPLE_S16NE);
+            fallback_s32ne = pa_get_mix_func(PA_SAMPLE_S32NE);
+            fallback_float32ne = pa_get_mix_func(PA_SAMPLE_FLOAT32NE);
+        }
+
+        pa_set_mix_func(PA_SAMPLE_S16NE, (pa_do_mix_func_t) pa_mix_s16ne_sse2);
+        pa_set_mix_func(PA_SAMPLE_S32NE, (pa_do_mix_func_t) pa_mix_s32ne_sse2);
+        pa_set_mix_func(PA_SAMPLE_FLOAT32NE, (pa_do_mix_func_t) pa_mix_float32ne_sse2);
+    }
+}
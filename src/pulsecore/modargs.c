@@ -409,6 +409,37 @@ int pa_modargs_get_alternate_sample_rate(pa_modargs *ma, uint32_t *alternate_rat
     return 0;
 }
 
+int pa_modargs_get_cpu_affinity(pa_modargs *ma, const char *def, char **cpus) {
+    const char *v;
+    int32_t node;
+
+    pa_assert(ma);
+    pa_assert(cpus);
+
+    *cpus = NULL;
+
+    if ((v = pa_modargs_get_value(ma, "cpu_affinity", NULL))) {
+        if (modargs_get_value_raw(ma, "numa_node", NULL) || !pa_cpu_list_valid(v))
+            return -1;
+
+        *cpus = pa_xstrdup(v);
+        return 0;
+    }
+
+    if (modargs_get_value_raw(ma, "numa_node", NULL)) {
+        if (pa_modargs_get_value_s32(ma, "numa_node", &node) < 0 || node < 0)
+            return -1;
+
+        if (!(*cpus = pa_numa_node_cpus(node)))
+            return -1;
+
+        return 0;
+    }
+
+    *cpus = pa_xstrdup(def);
+    return 0;
+}
+
 int pa_modargs_get_channel_map(pa_modargs *ma, const char *name, pa_channel_map *rmap) {
     pa_channel_map map;
     const char *cm;
@@ -68,6 +68,12 @@ int pa_modargs_get_sample_spec_and_channel_map(pa_modargs *ma, pa_sample_spec *s
 /* Return alternate sample rate from "alternate_sample_rate" parameter */
 int pa_modargs_get_alternate_sample_rate(pa_modargs *ma, uint32_t *alternate_rate);
 
+/* Return the CPUs an IO thread shall run on as newly allocated list in
+ * *cpus, either from the "cpu_affinity" argument or as all CPUs of the
+ * node in "numa_node". If neither is specified a copy of def, which
+ * may be NULL, is returned. */
+int pa_modargs_get_cpu_affinity(pa_modargs *ma, const char *def, char **cpus);
+
 int pa_modargs_get_proplist(pa_modargs *ma, const char *name, pa_proplist *p, pa_update_mode_t m);
 
 /* Iterate through the module argument list. The user should allocate a
@@ -30,6 +30,7 @@
 #include <errno.h>
 
 #include <pulse/xmalloc.h>
+#include <pulse/rtclock.h>
 #include <pulse/proplist.h>
 
 #include <pulsecore/core-subscribe.h>
@@ -52,6 +53,10 @@ pa_module* pa_module_load(pa_core *c, const char *name, const char *argument) {
     pa_bool_t (*load_once)(void);
     const char* (*get_deprecated)(void);
     pa_modinfo *mi;
+    pa_memowner *previous_owner;
+    pa_cpu_account *previous_account;
+    pa_usec_t t;
+    int r;
 
     pa_assert(c);
     pa_assert(name);
@@ -65,6 +70,10 @@ pa_module* pa_module_load(pa_core *c, const char *name, const char *argument) {
     m->load_once = FALSE;
     m->proplist = pa_proplist_new();
     m->index = PA_IDXSET_INVALID;
+    m->load_started = pa_rtclock_now();
+    m->open_time = m->init_time = 0;
+    m->memowner = pa_memowner_new();
+    m->cpu_account = pa_cpu_account_new();
 
     if (!(m->dl = lt_dlopenext(name))) {
         /* We used to print the error that is returned by lt_dlerror(), but
@@ -116,11 +125,25 @@ pa_module* pa_module_load(pa_core *c, const char *name, const char *argument) {
     pa_assert_se(pa_idxset_put(c->modules, m, &m->index) >= 0);
     pa_assert(m->index != PA_IDXSET_INVALID);
 
-    if (m->init(m) < 0) {
+    t = pa_rtclock_now();
+    m->open_time = t - m->load_started;
+
+    /* Whatever the module allocates during initialization, including
+     * in the threads it starts, is charged to it. So are the main
+     * loop events it creates, and those created from their callbacks */
+    previous_owner = pa_memowner_set_current(m->memowner);
+    previous_account = pa_cpu_accounting_set_current(c->cpu_accounting, m->cpu_account);
+    r = m->init(m);
+    pa_cpu_accounting_set_current(c->cpu_accounting, previous_account);
+    pa_memowner_set_current(previous_owner);
+
+    if (r < 0) {
         pa_log_error("Failed to load module \"%s\" (argument: \"%s\"): initialization failed.", name, argument ? argument : "");
         goto fail;
     }
 
+    m->init_time = pa_rtclock_now() - t;
+
     pa_log_info("Loaded \"%s\" (index: #%u; argument: \"%s\").", m->name, m->index, m->argument ? m->argument : "");
 
     pa_subscription_post(c, PA_SUBSCRIPTION_EVENT_MODULE|PA_SUBSCRIPTION_EVENT_NEW, m->index);
@@ -156,6 +179,8 @@ fail:
         if (m->dl)
             lt_dlclose(m->dl);
 
+        pa_memowner_unref(m->memowner);
+        pa_cpu_account_unref(m->cpu_account);
         pa_xfree(m);
     }
 
@@ -168,8 +193,13 @@ static void pa_module_free(pa_module *m) {
 
     pa_log_info("Unloading \"%s\" (index: #%u).", m->name, m->index);
 
-    if (m->done)
+    if (m->done) {
+        pa_memowner *previous_owner;
+
+        previous_owner = pa_memowner_set_current(m->memowner);
         m->done(m);
+        pa_memowner_set_current(previous_owner);
+    }
 
     if (m->proplist)
         pa_proplist_free(m->proplist);
@@ -180,6 +210,9 @@ static void pa_module_free(pa_module *m) {
 
     pa_subscription_post(m->core, PA_SUBSCRIPTION_EVENT_MODULE|PA_SUBSCRIPTION_EVENT_REMOVE, m->index);
 
+    pa_memowner_unref(m->memowner);
+    pa_cpu_account_unref(m->cpu_account);
+
     pa_xfree(m->name);
     pa_xfree(m->argument);
     pa_xfree(m);
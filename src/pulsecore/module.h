@@ -47,6 +47,16 @@ struct pa_module {
     pa_bool_t load_once:1;
     pa_bool_t unload_requested:1;
 
+    /* When loading started, how long opening the module and resolving
+     * its symbols took and how long pa__init() ran */
+    pa_usec_t load_started, open_time, init_time;
+
+    /* What the module and its threads allocate is charged to this */
+    pa_memowner *memowner;
+
+    /* The main thread time spent in its mainloop callbacks */
+    pa_cpu_account *cpu_account;
+
     pa_proplist *proplist;
 };
 
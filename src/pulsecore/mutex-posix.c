@@ -28,6 +28,7 @@
 
 #include <pulse/xmalloc.h>
 #include <pulsecore/macro.h>
+#include <pulsecore/rtcheck.h>
 
 #include "mutex.h"
 
@@ -87,6 +88,14 @@ void pa_mutex_free(pa_mutex *m) {
 void pa_mutex_lock(pa_mutex *m) {
     pa_assert(m);
 
+    if (PA_UNLIKELY(pa_rtcheck_enabled) && pa_rtcheck_active()) {
+        /* Only complain if we'd actually have to wait */
+        if (pthread_mutex_trylock(&m->mutex) == 0)
+            return;
+
+        pa_rtcheck_report(PA_RTCHECK_MUTEX);
+    }
+
     pa_assert_se(pthread_mutex_lock(&m->mutex) == 0);
 }
 
@@ -136,6 +145,8 @@ int pa_cond_wait(pa_cond *c, pa_mutex *m) {
     pa_assert(c);
     pa_assert(m);
 
+    pa_rtcheck(PA_RTCHECK_WAIT);
+
     return pthread_cond_wait(&c->cond, &m->mutex);
 }
 
@@ -176,6 +176,32 @@ enum {
     /* Supported since protocol v27 (3.0) */
     PA_COMMAND_SET_PORT_LATENCY_OFFSET,
 
+    /* Supported since protocol v30 (5.0) */
+    PA_COMMAND_GET_PLAYBACK_LATENCY_BATCH,
+
+    /* SERVER->CLIENT */
+    PA_COMMAND_REQUEST_BATCH,
+
+    /* CLIENT->SERVER */
+    PA_COMMAND_GET_SERVER_SNAPSHOT,
+    PA_COMMAND_SUBSCRIBE_FILTER,
+    PA_COMMAND_SET_PLAYBACK_STREAM_CODEC,
+    PA_COMMAND_SET_PLAYBACK_STREAM_SHM_RING,
+    PA_COMMAND_SET_PLAYBACK_STREAM_TIMING_PUSH,
+
+    /* SERVER->CLIENT */
+    PA_COMMAND_PLAYBACK_STREAM_TIMING,
+
+    /* CLIENT->SERVER */
+    PA_COMMAND_GET_SINK_LEVELS,
+    PA_COMMAND_SET_SINK_LEVELS_PUSH,
+
+    /* SERVER->CLIENT */
+    PA_COMMAND_SINK_LEVELS,
+
+    /* CLIENT->SERVER */
+    PA_COMMAND_SET_PLAYBACK_STREAM_ADAPTIVE_LATENCY,
+
     PA_COMMAND_MAX
 };
 
@@ -190,6 +216,10 @@ enum {
 
 #define PA_NATIVE_DEFAULT_UNIX_SOCKET "native"
 
+/* In the runtime directory, where clients remember the server they
+ * found last and its protocol version */
+#define PA_NATIVE_CLIENT_CACHE_FILE "client-cache"
+
 PA_C_DECL_END
 
 #endif
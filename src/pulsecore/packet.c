@@ -27,38 +27,97 @@
 
 #include <pulse/xmalloc.h>
 #include <pulsecore/macro.h>
+#include <pulsecore/flist.h>
 
 #include "packet.h"
 
+/* Room for data in the pooled packets. Most control packets fit. */
+#define POOL_DATA_SIZE 1024
+
+/* Headers of packets that do not have their data appended */
+PA_STATIC_FLIST_DECLARE(packets, 0, pa_xfree);
+
+/* Appended packets of POOL_DATA_SIZE */
+PA_STATIC_FLIST_DECLARE(pooled_packets, 0, pa_xfree);
+
 pa_packet* pa_packet_new(size_t length) {
     pa_packet *p;
+    size_t allocated;
 
     pa_assert(length > 0);
 
-    p = pa_xmalloc(PA_ALIGN(sizeof(pa_packet)) + length);
+    if (length <= POOL_DATA_SIZE) {
+        allocated = POOL_DATA_SIZE;
+
+        if (!(p = pa_flist_pop(PA_STATIC_FLIST_GET(pooled_packets))))
+            p = pa_xmalloc(PA_ALIGN(sizeof(pa_packet)) + allocated);
+    } else {
+        allocated = length;
+        p = pa_xmalloc(PA_ALIGN(sizeof(pa_packet)) + allocated);
+    }
+
     PA_REFCNT_INIT(p);
     p->length = length;
     p->data = (uint8_t*) p + PA_ALIGN(sizeof(pa_packet));
+    p->allocated = allocated;
     p->type = PA_PACKET_APPENDED;
 
     return p;
 }
 
+pa_packet* pa_packet_resize(pa_packet *p, size_t length) {
+    pa_assert(p);
+    pa_assert(PA_REFCNT_VALUE(p) == 1);
+    pa_assert(p->type == PA_PACKET_APPENDED);
+    pa_assert(length > 0);
+
+    if (length > p->allocated) {
+        p = pa_xrealloc(p, PA_ALIGN(sizeof(pa_packet)) + length);
+        p->data = (uint8_t*) p + PA_ALIGN(sizeof(pa_packet));
+        p->allocated = length;
+    }
+
+    p->length = length;
+
+    return p;
+}
+
 pa_packet* pa_packet_new_dynamic(void* data, size_t length) {
     pa_packet *p;
 
     pa_assert(data);
     pa_assert(length > 0);
 
-    p = pa_xnew(pa_packet, 1);
+    if (!(p = pa_flist_pop(PA_STATIC_FLIST_GET(packets))))
+        p = pa_xnew(pa_packet, 1);
+
     PA_REFCNT_INIT(p);
     p->length = length;
     p->data = data;
+    p->allocated = 0;
     p->type = PA_PACKET_DYNAMIC;
 
     return p;
 }
 
+pa_packet* pa_packet_new_fixed(void* data, size_t length) {
+    pa_packet *p;
+
+    pa_assert(data);
+    pa_assert(length > 0);
+
+    if (!(p = pa_flist_pop(PA_STATIC_FLIST_GET(packets))))
+        p = pa_xnew(pa_packet, 1);
+
+    PA_REFCNT_INIT(p);
+    p->length = length;
+    p->data = data;
+    p->allocated = 0;
+    p->type = PA_PACKET_FIXED;
+
+    return p;
+}
+
 pa_packet* pa_packet_ref(pa_packet *p) {
     pa_assert(p);
     pa_assert(PA_REFCNT_VALUE(p) >= 1);
@@ -72,8 +131,30 @@ void pa_packet_unref(pa_packet *p) {
     pa_assert(PA_REFCNT_VALUE(p) >= 1);
 
     if (PA_REFCNT_DEC(p) <= 0) {
+        if (p->type == PA_PACKET_APPENDED) {
+            if (p->allocated != POOL_DATA_SIZE ||
+                pa_flist_push(PA_STATIC_FLIST_GET(pooled_packets), p) < 0)
+                pa_xfree(p);
+            return;
+        }
+
         if (p->type == PA_PACKET_DYNAMIC)
             pa_xfree(p->data);
-        pa_xfree(p);
+
+        if (pa_flist_push(PA_STATIC_FLIST_GET(packets), p) < 0)
+            pa_xfree(p);
     }
 }
+
+void pa_packet_unref_fixed(pa_packet *p) {
+    pa_assert(p);
+    pa_assert(PA_REFCNT_VALUE(p) >= 1);
+    pa_assert(p->type == PA_PACKET_FIXED);
+
+    if (PA_REFCNT_VALUE(p) > 1) {
+        p->data = pa_xmemdup(p->data, p->length);
+        p->type = PA_PACKET_DYNAMIC;
+    }
+
+    pa_packet_unref(p);
+}
@@ -29,14 +29,27 @@
 
 typedef struct pa_packet {
     PA_REFCNT_DECLARE;
-    enum { PA_PACKET_APPENDED, PA_PACKET_DYNAMIC } type;
+    enum { PA_PACKET_APPENDED, PA_PACKET_DYNAMIC, PA_PACKET_FIXED } type;
     size_t length;
     uint8_t *data;
+    size_t allocated; /* Room for data, only for appended packets */
 } pa_packet;
 
+/* Small appended packets are taken from a pool and returned there once
+ * they are unreferenced */
 pa_packet* pa_packet_new(size_t length);
+
+/* Change the length of an appended packet that nobody else references,
+ * reallocating it if it does not fit. Returns the new packet pointer. */
+pa_packet* pa_packet_resize(pa_packet *p, size_t length);
 pa_packet* pa_packet_new_dynamic(void* data, size_t length);
 
+/* Wrap memory owned by the caller. pa_packet_unref_fixed() drops the
+ * caller's reference and gives anyone still holding one a private copy
+ * of the data, so that the memory may be reused afterwards. */
+pa_packet* pa_packet_new_fixed(void* data, size_t length);
+void pa_packet_unref_fixed(pa_packet *p);
+
 pa_packet* pa_packet_ref(pa_packet *p);
 void pa_packet_unref(pa_packet *p);
 
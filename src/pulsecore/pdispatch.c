@@ -190,6 +190,31 @@ static const char *command_names[PA_COMMAND_MAX] = {
     [PA_COMMAND_SET_SOURCE_OUTPUT_VOLUME] = "SET_SOURCE_OUTPUT_VOLUME",
     [PA_COMMAND_SET_SOURCE_OUTPUT_MUTE] = "SET_SOURCE_OUTPUT_MUTE",
 
+    /* Supported since protocol v30 (5.0) */
+    [PA_COMMAND_GET_PLAYBACK_LATENCY_BATCH] = "GET_PLAYBACK_LATENCY_BATCH",
+
+    /* SERVER->CLIENT */
+    [PA_COMMAND_REQUEST_BATCH] = "REQUEST_BATCH",
+
+    /* CLIENT->SERVER */
+    [PA_COMMAND_GET_SERVER_SNAPSHOT] = "GET_SERVER_SNAPSHOT",
+    [PA_COMMAND_SUBSCRIBE_FILTER] = "SUBSCRIBE_FILTER",
+    [PA_COMMAND_SET_PLAYBACK_STREAM_CODEC] = "SET_PLAYBACK_STREAM_CODEC",
+    [PA_COMMAND_SET_PLAYBACK_STREAM_SHM_RING] = "SET_PLAYBACK_STREAM_SHM_RING",
+    [PA_COMMAND_SET_PLAYBACK_STREAM_TIMING_PUSH] = "SET_PLAYBACK_STREAM_TIMING_PUSH",
+
+    /* SERVER->CLIENT */
+    [PA_COMMAND_PLAYBACK_STREAM_TIMING] = "PLAYBACK_STREAM_TIMING",
+
+    /* CLIENT->SERVER */
+    [PA_COMMAND_GET_SINK_LEVELS] = "GET_SINK_LEVELS",
+    [PA_COMMAND_SET_SINK_LEVELS_PUSH] = "SET_SINK_LEVELS_PUSH",
+
+    /* SERVER->CLIENT */
+    [PA_COMMAND_SINK_LEVELS] = "SINK_LEVELS",
+
+    /* CLIENT->SERVER */
+    [PA_COMMAND_SET_PLAYBACK_STREAM_ADAPTIVE_LATENCY] = "SET_PLAYBACK_STREAM_ADAPTIVE_LATENCY",
 };
 
 #endif
@@ -27,6 +27,9 @@
 
 #include <pulse/xmalloc.h>
 
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
+
 #include <pulsecore/core-util.h>
 #include <pulsecore/dbus-util.h>
 #include <pulsecore/hashmap.h>
@@ -44,9 +47,24 @@ struct pa_dbus_protocol {
     pa_hashmap *connections; /* DBusConnection -> struct connection_entry */
     pa_idxset *extensions; /* Strings */
 
+    /* Signals from pa_dbus_protocol_send_signal_batched() that haven't
+     * been sent yet, in the order they were first queued */
+    pa_hashmap *batched_signals; /* "path interface.member" -> struct batched_signal */
+    pa_time_event *batch_event;
+
     pa_hook hooks[PA_DBUS_PROTOCOL_HOOK_MAX];
 };
 
+/* How long batched signals wait for newer values */
+#define SIGNAL_BATCH_USEC (20 * PA_USEC_PER_MSEC)
+
+struct batched_signal {
+    char *key;
+    DBusMessage *message;
+};
+
+static void flush_batched_signals(pa_dbus_protocol *p);
+
 struct object_entry {
     char *path;
     pa_hashmap *interfaces; /* Interface name -> struct interface_entry */
@@ -81,6 +99,8 @@ struct interface_entry {
     pa_hashmap *method_signatures; /* Derived from method_handlers. Contains only "in" arguments. */
     pa_hashmap *property_handlers;
     pa_dbus_receive_cb_t get_all_properties_cb;
+    pa_dbus_append_properties_cb_t append_all_properties_cb;
+    DBusMessage *get_all_reply; /* Cached, only with append_all_properties_cb */
     pa_dbus_signal_info *signals;
     unsigned n_signals;
     void *userdata;
@@ -129,6 +149,8 @@ static pa_dbus_protocol *dbus_protocol_new(pa_core *c) {
     p->objects = pa_hashmap_new(pa_idxset_string_hash_func, pa_idxset_string_compare_func);
     p->connections = pa_hashmap_new(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func);
     p->extensions = pa_idxset_new(pa_idxset_string_hash_func, pa_idxset_string_compare_func);
+    p->batched_signals = pa_hashmap_new(pa_idxset_string_hash_func, pa_idxset_string_compare_func);
+    p->batch_event = NULL;
 
     for (i = 0; i < PA_DBUS_PROTOCOL_HOOK_MAX; ++i)
         pa_hook_init(&p->hooks[i], p);
@@ -173,6 +195,13 @@ void pa_dbus_protocol_unref(pa_dbus_protocol *p) {
     pa_hashmap_free(p->connections, NULL);
     pa_idxset_free(p->extensions, NULL);
 
+    /* All objects are gone, so this has been flushed already */
+    pa_assert(pa_hashmap_isempty(p->batched_signals));
+    pa_hashmap_free(p->batched_signals, NULL);
+
+    if (p->batch_event)
+        p->core->mainloop->time_free(p->batch_event);
+
     for (i = 0; i < PA_DBUS_PROTOCOL_HOOK_MAX; ++i)
         pa_hook_done(&p->hooks[i]);
 
@@ -493,6 +522,34 @@ static enum find_result_t find_handler(struct call_info *call_info) {
     }
 }
 
+/* The reply is marshalled once and then only copied, with its header
+ * fixed up for the call it answers. */
+static void send_cached_get_all_reply(DBusConnection *conn, DBusMessage *msg, struct interface_entry *iface_entry) {
+    DBusMessage *reply;
+
+    pa_assert(conn);
+    pa_assert(msg);
+    pa_assert(iface_entry);
+
+    if (!iface_entry->get_all_reply) {
+        DBusMessageIter msg_iter;
+        DBusMessageIter dict_iter;
+
+        pa_assert_se(iface_entry->get_all_reply = dbus_message_new_method_return(msg));
+        dbus_message_iter_init_append(iface_entry->get_all_reply, &msg_iter);
+        pa_assert_se(dbus_message_iter_open_container(&msg_iter, DBUS_TYPE_ARRAY, "{sv}", &dict_iter));
+        iface_entry->append_all_properties_cb(&dict_iter, iface_entry->userdata);
+        pa_assert_se(dbus_message_iter_close_container(&msg_iter, &dict_iter));
+    }
+
+    pa_assert_se(reply = dbus_message_copy(iface_entry->get_all_reply));
+    pa_assert_se(dbus_message_set_reply_serial(reply, dbus_message_get_serial(msg)));
+    pa_assert_se(dbus_message_set_destination(reply, dbus_message_get_sender(msg)));
+
+    pa_assert_se(dbus_connection_send(conn, reply, NULL));
+    dbus_message_unref(reply);
+}
+
 static DBusHandlerResult handle_message_cb(DBusConnection *connection, DBusMessage *message, void *user_data) {
     pa_dbus_protocol *p = user_data;
     struct call_info call_info;
@@ -536,7 +593,9 @@ static DBusHandlerResult handle_message_cb(DBusConnection *connection, DBusMessa
             break;
 
         case FOUND_GET_ALL:
-            if (call_info.iface_entry->get_all_properties_cb)
+            if (call_info.iface_entry->append_all_properties_cb)
+                send_cached_get_all_reply(connection, message, call_info.iface_entry);
+            else if (call_info.iface_entry->get_all_properties_cb)
                 call_info.iface_entry->get_all_properties_cb(connection, message, call_info.iface_entry->userdata);
             else {
                 DBusMessage *dummy_reply = NULL;
@@ -738,7 +797,7 @@ int pa_dbus_protocol_add_interface(pa_dbus_protocol *p,
     pa_assert(info->name);
     pa_assert(info->method_handlers || info->n_method_handlers == 0);
     pa_assert(info->property_handlers || info->n_property_handlers == 0);
-    pa_assert(info->get_all_properties_cb || info->n_property_handlers == 0);
+    pa_assert(info->get_all_properties_cb || info->append_all_properties_cb || info->n_property_handlers == 0);
     pa_assert(info->signals || info->n_signals == 0);
 
     if (!(obj_entry = pa_hashmap_get(p->objects, path))) {
@@ -760,6 +819,8 @@ int pa_dbus_protocol_add_interface(pa_dbus_protocol *p,
     iface_entry->method_signatures = extract_method_signatures(iface_entry->method_handlers);
     iface_entry->property_handlers = create_property_handlers(info);
     iface_entry->get_all_properties_cb = info->get_all_properties_cb;
+    iface_entry->append_all_properties_cb = info->append_all_properties_cb;
+    iface_entry->get_all_reply = NULL;
     iface_entry->signals = copy_signals(info);
     iface_entry->n_signals = info->n_signals;
     iface_entry->userdata = userdata;
@@ -830,6 +891,9 @@ int pa_dbus_protocol_remove_interface(pa_dbus_protocol *p, const char* path, con
     if (!(iface_entry = pa_hashmap_remove(obj_entry->interfaces, interface)))
         return -1;
 
+    /* Nothing may be sent on behalf of the object once it is gone */
+    flush_batched_signals(p);
+
     update_introspection(obj_entry);
 
     pa_log_debug("Interface %s removed from object %s", iface_entry->name, obj_entry->path);
@@ -854,6 +918,10 @@ int pa_dbus_protocol_remove_interface(pa_dbus_protocol *p, const char* path, con
     }
 
     pa_xfree(iface_entry->signals);
+
+    if (iface_entry->get_all_reply)
+        dbus_message_unref(iface_entry->get_all_reply);
+
     pa_xfree(iface_entry);
 
     if (pa_hashmap_isempty(obj_entry->interfaces)) {
@@ -1033,7 +1101,27 @@ void pa_dbus_protocol_remove_signal_listener(pa_dbus_protocol *p, DBusConnection
     }
 }
 
-void pa_dbus_protocol_send_signal(pa_dbus_protocol *p, DBusMessage *signal_msg) {
+void pa_dbus_protocol_invalidate_properties(pa_dbus_protocol *p, const char *path, const char *interface) {
+    struct object_entry *obj_entry;
+    struct interface_entry *iface_entry;
+
+    pa_assert(p);
+    pa_assert(path);
+    pa_assert(interface);
+
+    if (!(obj_entry = pa_hashmap_get(p->objects, path)))
+        return;
+
+    if (!(iface_entry = pa_hashmap_get(obj_entry->interfaces, interface)))
+        return;
+
+    if (iface_entry->get_all_reply) {
+        dbus_message_unref(iface_entry->get_all_reply);
+        iface_entry->get_all_reply = NULL;
+    }
+}
+
+static void send_signal(pa_dbus_protocol *p, DBusMessage *signal_msg) {
     struct connection_entry *conn_entry;
     struct signal_paths_entry *signal_paths_entry;
     void *state = NULL;
@@ -1068,6 +1156,74 @@ void pa_dbus_protocol_send_signal(pa_dbus_protocol *p, DBusMessage *signal_msg)
     pa_xfree(signal_string);
 }
 
+static void flush_batched_signals(pa_dbus_protocol *p) {
+    struct batched_signal *b;
+
+    pa_assert(p);
+
+    while ((b = pa_hashmap_steal_first(p->batched_signals))) {
+        send_signal(p, b->message);
+
+        dbus_message_unref(b->message);
+        pa_xfree(b->key);
+        pa_xfree(b);
+    }
+
+    if (p->batch_event)
+        p->core->mainloop->time_restart(p->batch_event, NULL);
+}
+
+static void batch_cb(pa_mainloop_api *m, pa_time_event *e, const struct timeval *t, void *userdata) {
+    pa_dbus_protocol *p = userdata;
+
+    pa_assert(p);
+
+    flush_batched_signals(p);
+}
+
+void pa_dbus_protocol_send_signal(pa_dbus_protocol *p, DBusMessage *signal_msg) {
+    pa_assert(p);
+    pa_assert(signal_msg);
+
+    flush_batched_signals(p);
+    send_signal(p, signal_msg);
+}
+
+void pa_dbus_protocol_send_signal_batched(pa_dbus_protocol *p, DBusMessage *signal_msg) {
+    struct batched_signal *b;
+    char *key;
+
+    pa_assert(p);
+    pa_assert(signal_msg);
+    pa_assert(dbus_message_get_type(signal_msg) == DBUS_MESSAGE_TYPE_SIGNAL);
+    pa_assert(dbus_message_get_path(signal_msg));
+    pa_assert(dbus_message_get_interface(signal_msg));
+    pa_assert(dbus_message_get_member(signal_msg));
+
+    key = pa_sprintf_malloc("%s %s.%s", dbus_message_get_path(signal_msg), dbus_message_get_interface(signal_msg), dbus_message_get_member(signal_msg));
+
+    /* A newer value replaces the pending one, but keeps its place */
+    if ((b = pa_hashmap_get(p->batched_signals, key))) {
+        dbus_message_unref(b->message);
+        b->message = dbus_message_ref(signal_msg);
+        pa_xfree(key);
+        return;
+    }
+
+    b = pa_xnew(struct batched_signal, 1);
+    b->key = key;
+    b->message = dbus_message_ref(signal_msg);
+    pa_assert_se(pa_hashmap_put(p->batched_signals, b->key, b) >= 0);
+
+    if (pa_hashmap_size(p->batched_signals) > 1)
+        return;
+
+    if (!p->batch_event)
+        p->batch_event = pa_core_rttime_new(p->core, pa_rtclock_now() + SIGNAL_BATCH_USEC, batch_cb, p);
+    else
+        pa_core_rttime_restart(p->core, p->batch_event, pa_rtclock_now() + SIGNAL_BATCH_USEC);
+}
+
 const char **pa_dbus_protocol_get_extensions(pa_dbus_protocol *p, unsigned *n) {
     const char **extensions;
     const char *ext_name;
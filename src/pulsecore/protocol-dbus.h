@@ -70,6 +70,10 @@ typedef void (*pa_dbus_receive_cb_t)(DBusConnection *conn, DBusMessage *msg, voi
  * don't have to do that yourself. */
 typedef void (*pa_dbus_set_property_cb_t)(DBusConnection *conn, DBusMessage *msg, DBusMessageIter *iter, void *userdata);
 
+/* Appends all properties of an object as entries of the given a{sv}
+ * dictionary, as returned by GetAll. */
+typedef void (*pa_dbus_append_properties_cb_t)(DBusMessageIter *dict_iter, void *userdata);
+
 typedef struct pa_dbus_arg_info {
     const char *name;
     const char *type;
@@ -106,6 +110,14 @@ typedef struct pa_dbus_interface_info {
     const pa_dbus_property_handler *property_handlers; /* NULL, if the interface has no properties. */
     unsigned n_property_handlers;
     const pa_dbus_receive_cb_t get_all_properties_cb; /* May be NULL, in which case GetAll returns an error. */
+
+    /* May be NULL. If set, it is used for GetAll instead of
+     * get_all_properties_cb, and the reply is cached until
+     * pa_dbus_protocol_invalidate_properties() is called for the object.
+     * So only use this if every change of the properties is followed by
+     * that call. */
+    const pa_dbus_append_properties_cb_t append_all_properties_cb;
+
     const pa_dbus_signal_info *signals; /* NULL, if the interface has no signals. */
     unsigned n_signals;
 } pa_dbus_interface_info;
@@ -171,6 +183,20 @@ void pa_dbus_protocol_remove_signal_listener(pa_dbus_protocol *p, DBusConnection
  * pa_dbus_protocol_add_signal_listener(). */
 void pa_dbus_protocol_send_signal(pa_dbus_protocol *p, DBusMessage *signal);
 
+/* Like pa_dbus_protocol_send_signal(), for signals that may be sent at a high
+ * rate and only carry the current state of something, like VolumeUpdated.
+ * The signal is sent after a short delay, and if another signal with the same
+ * object path, interface and member is sent in the meantime, it replaces the
+ * pending one. Any pending signals are sent before the next signal that goes
+ * through pa_dbus_protocol_send_signal(), so distinct signals aren't
+ * reordered. */
+void pa_dbus_protocol_send_signal_batched(pa_dbus_protocol *p, DBusMessage *signal);
+
+/* Drops the cached GetAll reply of the given interface of the object, see
+ * append_all_properties_cb in pa_dbus_interface_info. Doesn't do anything if
+ * there is no such object or interface. */
+void pa_dbus_protocol_invalidate_properties(pa_dbus_protocol *p, const char *path, const char *interface);
+
 /* Returns an array of extension identifier strings. The strings pointers point
  * to the internal copies, so don't free the strings. The caller must free the
  * array, however. Also, do not save the returned pointer or any of the string
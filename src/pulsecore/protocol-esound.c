@@ -53,6 +53,7 @@
 #include <pulsecore/macro.h>
 #include <pulsecore/thread-mq.h>
 #include <pulsecore/shared.h>
+#include <pulsecore/sound-file.h>
 #include <pulsecore/endianmacros.h>
 
 #include "protocol-esound.h"
@@ -71,6 +72,9 @@
 
 #define MAX_CACHE_SAMPLE_SIZE (2048000)
 
+/* How often we read from a connection before going back to the main loop */
+#define MAX_READS_PER_WAKEUP (32)
+
 #define DEFAULT_SINK_LATENCY (150*PA_USEC_PER_MSEC)
 #define DEFAULT_SOURCE_LATENCY (150*PA_USEC_PER_MSEC)
 
@@ -1112,6 +1116,11 @@ static int do_read(connection *c) {
             uint32_t idx;
 
             c->scache.memchunk.index = 0;
+
+            /* Swaps the upload for a mapping that is shared with the
+             * identical uploads of every other client start */
+            pa_sound_file_cache_upload(c->protocol->core->mempool, &c->scache.sample_spec, NULL, &c->scache.memchunk);
+
             pa_scache_add_item(c->protocol->core, c->scache.name, &c->scache.sample_spec, NULL, &c->scache.memchunk, c->client->proplist, &idx);
 
             pa_memblock_unref(c->scache.memchunk.memblock);
@@ -1181,9 +1190,10 @@ static int do_read(connection *c) {
 
         pa_atomic_sub(&c->playback.missing, (int) r);
         pa_asyncmsgq_post(c->sink_input->sink->asyncmsgq, PA_MSGOBJECT(c->sink_input), SINK_INPUT_MESSAGE_POST_DATA, NULL, 0, &chunk, NULL);
-    }
+    } else
+        return 0;
 
-    return 0;
+    return 1;
 }
 
 static int do_write(connection *c) {
@@ -1243,9 +1253,24 @@ static void do_work(connection *c) {
     if (c->dead)
         return;
 
-    if (pa_iochannel_is_readable(c->io))
-        if (do_read(c) < 0)
-            goto fail;
+    if (pa_iochannel_is_readable(c->io)) {
+        unsigned n;
+
+        /* Clients like to send a lot of small requests back to back,
+         * sample plays for example, so keep on reading as long as there
+         * is something, instead of going through the main loop for each
+         * request header and its data. The limit keeps a busy client
+         * from starving everybody else. */
+        for (n = 0; n < MAX_READS_PER_WAKEUP; n++) {
+            int r;
+
+            if ((r = do_read(c)) < 0)
+                goto fail;
+
+            if (r == 0 || !c->io)
+                break;
+        }
+    }
 
     if (c->state == ESD_STREAMING_DATA && !c->sink_input && pa_iochannel_is_hungup(c->io))
         /* In case we are in capture mode we will never call read()
@@ -1261,6 +1286,10 @@ static void do_work(connection *c) {
             break;
     }
 
+    /* What the requests above queued is written now, or the channel
+     * tells us when it can take more, so no need for another round */
+    c->protocol->core->mainloop->defer_enable(c->defer_event, 0);
+
     return;
 
 fail:
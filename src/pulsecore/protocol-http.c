@@ -31,6 +31,7 @@
 #include <pulse/util.h>
 #include <pulse/xmalloc.h>
 #include <pulse/timeval.h>
+#include <pulse/rtclock.h>
 
 #include <pulsecore/core-util.h>
 #include <pulsecore/ioline.h>
@@ -42,21 +43,34 @@
 #include <pulsecore/shared.h>
 #include <pulsecore/core-error.h>
 #include <pulsecore/mime-type.h>
+#include <pulsecore/random.h>
+#include <pulsecore/llist.h>
+
+#ifdef HAVE_OPUS
+#include <opus_multistream.h>
+#endif
 
 #include "protocol-http.h"
 
 /* Don't allow more than this many concurrent connections */
 #define MAX_CONNECTIONS 10
 
+/* Listeners of a broadcast are cheap and counted on their own */
+#define MAX_LISTENERS 256
+
 #define URL_ROOT "/"
 #define URL_CSS "/style"
 #define URL_STATUS "/status"
 #define URL_LISTEN "/listen"
 #define URL_LISTEN_SOURCE "/listen/source/"
+#define URL_BROADCAST_WAV "/broadcast/wav/"
+#define URL_BROADCAST_OPUS "/broadcast/opus/"
 
 #define MIME_HTML "text/html; charset=utf-8"
 #define MIME_TEXT "text/plain; charset=utf-8"
 #define MIME_CSS "text/css"
+#define MIME_WAV "audio/wav"
+#define MIME_OGG "audio/ogg"
 
 #define HTML_HEADER(t)                                                  \
     "<?xml version=\"1.0\"?>\n"                                         \
@@ -75,6 +89,22 @@
 #define RECORD_BUFFER_SECONDS (5)
 #define DEFAULT_SOURCE_LATENCY (300*PA_USEC_PER_MSEC)
 
+/* A listener that could not take any data for this long is dropped */
+#define LISTENER_STALL_USEC (30*PA_USEC_PER_SEC)
+
+#define OPUS_RATE 48000
+#define OPUS_BITRATE 128000
+#define OPUS_FRAME_SAMPLES 960
+#define OPUS_MAX_PACKET 1275
+#define OPUS_PACKETS_PER_PAGE 5
+
+/* Listener queues carry encoded data, not samples */
+static const pa_sample_spec byte_spec = {
+    .format = PA_SAMPLE_U8,
+    .rate = 8000,
+    .channels = 1
+};
+
 enum state {
     STATE_REQUEST_LINE,
     STATE_MIME_HEADER,
@@ -86,6 +116,13 @@ enum method {
     METHOD_HEAD
 };
 
+enum broadcast_format {
+    BROADCAST_WAV,
+    BROADCAST_OPUS
+};
+
+struct broadcast;
+
 struct connection {
     pa_http_protocol *protocol;
     pa_iochannel *io;
@@ -97,6 +134,48 @@ struct connection {
     char *url;
     enum method method;
     pa_module *module;
+
+    /* Set if this connection listens to a shared broadcast instead of
+     * having its own source output */
+    struct broadcast *broadcast;
+    pa_usec_t stalled_since;
+    PA_LLIST_FIELDS(struct connection);
+};
+
+/* One source output per source and format, encoded once. Every listener
+ * queues references to the same memblocks. */
+struct broadcast {
+    pa_http_protocol *protocol;
+    pa_source_output *source_output;
+    enum broadcast_format format;
+
+    /* What a listener gets before joining in */
+    pa_memchunk header;
+    size_t max_queue;
+
+    /* Keeps the broadcast around while its listeners are walked */
+    pa_bool_t busy;
+
+    PA_LLIST_HEAD(struct connection, listeners);
+    PA_LLIST_FIELDS(struct broadcast);
+
+#ifdef HAVE_OPUS
+    /* Only touched from IO thread context once the output is put */
+    OpusMSEncoder *encoder;
+    unsigned channels;
+    float *pcm;
+    unsigned n_pcm;
+
+    uint8_t *packets;
+    size_t packets_length;
+    unsigned n_packets;
+    uint8_t segments[255];
+    unsigned n_segments;
+
+    uint32_t serial;
+    uint32_t sequence;
+    uint64_t granule;
+#endif
 };
 
 struct pa_http_protocol {
@@ -105,6 +184,9 @@ struct pa_http_protocol {
     pa_core *core;
     pa_idxset *connections;
 
+    PA_LLIST_HEAD(struct broadcast, broadcasts);
+    unsigned n_listeners;
+
     pa_strlist *servers;
 };
 
@@ -112,10 +194,15 @@ enum {
     SOURCE_OUTPUT_MESSAGE_POST_DATA = PA_SOURCE_OUTPUT_MESSAGE_MAX
 };
 
+static void broadcast_remove_listener(struct broadcast *b, struct connection *c);
+
 /* Called from main context */
 static void connection_unlink(struct connection *c) {
     pa_assert(c);
 
+    if (c->broadcast)
+        broadcast_remove_listener(c->broadcast, c);
+
     if (c->source_output) {
         pa_source_output_unlink(c->source_output);
         c->source_output->userdata = NULL;
@@ -249,6 +336,476 @@ static pa_usec_t source_output_get_latency_cb(pa_source_output *o) {
     return pa_bytes_to_usec(pa_memblockq_get_length(c->output_memblockq), &c->source_output->sample_spec);
 }
 
+static void put_le16(uint8_t *d, uint16_t v) {
+    d[0] = (uint8_t) v;
+    d[1] = (uint8_t) (v >> 8);
+}
+
+static void put_le32(uint8_t *d, uint32_t v) {
+    put_le16(d, (uint16_t) v);
+    put_le16(d + 2, (uint16_t) (v >> 16));
+}
+
+static void broadcast_wav_header(struct broadcast *b, const pa_sample_spec *ss) {
+    uint8_t *d;
+
+    b->header.memblock = pa_memblock_new(b->protocol->core->mempool, 44);
+    b->header.index = 0;
+    b->header.length = 44;
+
+    d = pa_memblock_acquire(b->header.memblock);
+
+    /* The stream has no end, so claim the largest sizes possible */
+    memcpy(d, "RIFF", 4);
+    put_le32(d + 4, 0xFFFFFFFFU);
+    memcpy(d + 8, "WAVEfmt ", 8);
+    put_le32(d + 16, 16);
+    put_le16(d + 20, 1);
+    put_le16(d + 22, ss->channels);
+    put_le32(d + 24, ss->rate);
+    put_le32(d + 28, (uint32_t) pa_bytes_per_second(ss));
+    put_le16(d + 32, (uint16_t) pa_frame_size(ss));
+    put_le16(d + 34, (uint16_t) (pa_sample_size(ss) * 8));
+    memcpy(d + 36, "data", 4);
+    put_le32(d + 40, 0xFFFFFFFFU);
+
+    pa_memblock_release(b->header.memblock);
+}
+
+#ifdef HAVE_OPUS
+
+static uint32_t ogg_crc_table[256];
+static pa_bool_t ogg_crc_table_ready = FALSE;
+
+/* Called from main context */
+static void ogg_crc_init(void) {
+    unsigned i, j;
+
+    if (ogg_crc_table_ready)
+        return;
+
+    for (i = 0; i < 256; i++) {
+        uint32_t r = i << 24;
+
+        for (j = 0; j < 8; j++)
+            r = (r & 0x80000000U) ? (r << 1) ^ 0x04C11DB7U : r << 1;
+
+        ogg_crc_table[i] = r;
+    }
+
+    ogg_crc_table_ready = TRUE;
+}
+
+static uint32_t ogg_crc(const uint8_t *d, size_t length) {
+    uint32_t crc = 0;
+
+    while (length-- > 0)
+        crc = (crc << 8) ^ ogg_crc_table[((crc >> 24) ^ *(d++)) & 0xFF];
+
+    return crc;
+}
+
+static size_t ogg_page_size(unsigned n_segments, size_t length) {
+    return 27 + n_segments + length;
+}
+
+/* Append the lacing values of a packet, returns how many there are */
+static unsigned ogg_lace(uint8_t *segments, size_t length) {
+    unsigned n = 0;
+
+    while (length >= 255) {
+        segments[n++] = 255;
+        length -= 255;
+    }
+
+    segments[n++] = (uint8_t) length;
+
+    return n;
+}
+
+static size_t ogg_write_page(
+        uint8_t *d,
+        uint8_t flags,
+        uint64_t granule,
+        uint32_t serial,
+        uint32_t sequence,
+        const uint8_t *segments,
+        unsigned n_segments,
+        const uint8_t *data,
+        size_t length) {
+
+    size_t size;
+
+    pa_assert(n_segments <= 255);
+
+    memcpy(d, "OggS", 4);
+    d[4] = 0;
+    d[5] = flags;
+    put_le32(d + 6, (uint32_t) granule);
+    put_le32(d + 10, (uint32_t) (granule >> 32));
+    put_le32(d + 14, serial);
+    put_le32(d + 18, sequence);
+    put_le32(d + 22, 0);
+    d[26] = (uint8_t) n_segments;
+    memcpy(d + 27, segments, n_segments);
+    memcpy(d + 27 + n_segments, data, length);
+
+    size = ogg_page_size(n_segments, length);
+    put_le32(d + 22, ogg_crc(d, size));
+
+    return size;
+}
+
+/* Called from main context */
+static void broadcast_opus_header(struct broadcast *b, unsigned pre_skip) {
+    static const char vendor[] = PACKAGE_NAME " " PACKAGE_VERSION;
+    uint8_t head[19], tags[8 + 4 + sizeof(vendor) - 1 + 4];
+    uint8_t segments[2][255];
+    unsigned n_head, n_tags;
+    uint8_t *d;
+
+    memcpy(head, "OpusHead", 8);
+    head[8] = 1;
+    head[9] = (uint8_t) b->channels;
+    put_le16(head + 10, (uint16_t) pre_skip);
+    put_le32(head + 12, OPUS_RATE);
+    put_le16(head + 16, 0);
+    head[18] = 0;
+
+    memcpy(tags, "OpusTags", 8);
+    put_le32(tags + 8, sizeof(vendor) - 1);
+    memcpy(tags + 12, vendor, sizeof(vendor) - 1);
+    put_le32(tags + 12 + sizeof(vendor) - 1, 0);
+
+    n_head = ogg_lace(segments[0], sizeof(head));
+    n_tags = ogg_lace(segments[1], sizeof(tags));
+
+    b->header.length = ogg_page_size(n_head, sizeof(head)) + ogg_page_size(n_tags, sizeof(tags));
+    b->header.memblock = pa_memblock_new(b->protocol->core->mempool, b->header.length);
+    b->header.index = 0;
+
+    d = pa_memblock_acquire(b->header.memblock);
+    d += ogg_write_page(d, 0x02, 0, b->serial, 0, segments[0], n_head, head, sizeof(head));
+    ogg_write_page(d, 0, 0, b->serial, 1, segments[1], n_tags, tags, sizeof(tags));
+    pa_memblock_release(b->header.memblock);
+
+    b->sequence = 2;
+}
+
+/* Called from thread context */
+static void broadcast_flush_page(struct broadcast *b) {
+    pa_memchunk page;
+    uint8_t *d;
+
+    if (b->n_packets <= 0)
+        return;
+
+    page.length = ogg_page_size(b->n_segments, b->packets_length);
+    page.memblock = pa_memblock_new(b->protocol->core->mempool, page.length);
+    page.index = 0;
+
+    d = pa_memblock_acquire(page.memblock);
+    ogg_write_page(d, 0, b->granule, b->serial, b->sequence++, b->segments, b->n_segments, b->packets, b->packets_length);
+    pa_memblock_release(page.memblock);
+
+    pa_asyncmsgq_post(pa_thread_mq_get()->outq, PA_MSGOBJECT(b->source_output), SOURCE_OUTPUT_MESSAGE_POST_DATA, NULL, 0, &page, NULL);
+    pa_memblock_unref(page.memblock);
+
+    b->packets_length = 0;
+    b->n_packets = 0;
+    b->n_segments = 0;
+}
+
+/* Called from thread context */
+static void broadcast_encode(struct broadcast *b, const pa_memchunk *chunk) {
+    const float *p;
+    size_t n;
+
+    p = (const float*) ((uint8_t*) pa_memblock_acquire(chunk->memblock) + chunk->index);
+    n = chunk->length / (sizeof(float) * b->channels);
+
+    while (n > 0) {
+        size_t l;
+        int r;
+
+        l = PA_MIN(n, (size_t) (OPUS_FRAME_SAMPLES - b->n_pcm));
+        memcpy(b->pcm + b->n_pcm * b->channels, p, l * b->channels * sizeof(float));
+        b->n_pcm += (unsigned) l;
+        p += l * b->channels;
+        n -= l;
+
+        if (b->n_pcm < OPUS_FRAME_SAMPLES)
+            break;
+
+        b->n_pcm = 0;
+
+        if ((r = opus_multistream_encode_float(b->encoder, b->pcm, OPUS_FRAME_SAMPLES, b->packets + b->packets_length, OPUS_MAX_PACKET)) < 0) {
+            pa_log_error("Failed to encode Opus packet: %s", opus_strerror(r));
+            continue;
+        }
+
+        b->n_segments += ogg_lace(b->segments + b->n_segments, (size_t) r);
+        b->packets_length += (size_t) r;
+        b->granule += OPUS_FRAME_SAMPLES;
+
+        if (++b->n_packets >= OPUS_PACKETS_PER_PAGE)
+            broadcast_flush_page(b);
+    }
+
+    pa_memblock_release(chunk->memblock);
+}
+
+#endif
+
+/* Called from main context */
+static void broadcast_free(struct broadcast *b) {
+    pa_assert(b);
+    pa_assert(!b->listeners);
+
+    PA_LLIST_REMOVE(struct broadcast, b->protocol->broadcasts, b);
+
+    if (b->source_output) {
+        pa_source_output_unlink(b->source_output);
+        b->source_output->userdata = NULL;
+        pa_source_output_unref(b->source_output);
+    }
+
+    if (b->header.memblock)
+        pa_memblock_unref(b->header.memblock);
+
+#ifdef HAVE_OPUS
+    if (b->encoder)
+        opus_multistream_encoder_destroy(b->encoder);
+
+    pa_xfree(b->pcm);
+    pa_xfree(b->packets);
+#endif
+
+    pa_xfree(b);
+}
+
+/* Called from main context */
+static void broadcast_remove_listener(struct broadcast *b, struct connection *c) {
+    pa_assert(b);
+    pa_assert(c);
+    pa_assert(c->broadcast == b);
+
+    PA_LLIST_REMOVE(struct connection, b->listeners, c);
+    c->broadcast = NULL;
+
+    pa_assert(b->protocol->n_listeners > 0);
+    b->protocol->n_listeners--;
+
+    if (!b->listeners && !b->busy)
+        broadcast_free(b);
+}
+
+/* Called from main context */
+static void listener_push(struct connection *c, const pa_memchunk *chunk) {
+    pa_assert(c);
+    pa_assert(chunk);
+
+    if (pa_memblockq_push(c->output_memblockq, chunk) >= 0)
+        c->stalled_since = 0;
+    else {
+        pa_usec_t now = pa_rtclock_now();
+
+        /* The queue only ever holds whole chunks, so skipping one for a
+         * slow listener leaves its stream decodable */
+        if (c->stalled_since <= 0)
+            c->stalled_since = now;
+        else if (now - c->stalled_since > LISTENER_STALL_USEC) {
+            pa_log_info("Listener stopped taking data, dropping it.");
+            connection_unlink(c);
+            return;
+        }
+    }
+
+    /* Still waiting for the response to be written */
+    if (!c->io)
+        return;
+
+    do_work(c);
+}
+
+/* Called from main context */
+static void broadcast_send(struct broadcast *b, const pa_memchunk *chunk) {
+    struct connection *c, *n;
+
+    pa_assert(b);
+    pa_assert(chunk);
+
+    b->busy = TRUE;
+
+    PA_LLIST_FOREACH_SAFE(c, n, b->listeners)
+        listener_push(c, chunk);
+
+    b->busy = FALSE;
+
+    if (!b->listeners)
+        broadcast_free(b);
+}
+
+/* Called from thread context, except when it is not */
+static int broadcast_source_output_process_msg(pa_msgobject *m, int code, void *userdata, int64_t offset, pa_memchunk *chunk) {
+    pa_source_output *o = PA_SOURCE_OUTPUT(m);
+    struct broadcast *b;
+
+    pa_source_output_assert_ref(o);
+
+    if (!(b = o->userdata))
+        return -1;
+
+    switch (code) {
+
+        case SOURCE_OUTPUT_MESSAGE_POST_DATA:
+            /* Like above, this one comes in from main context */
+            broadcast_send(b, chunk);
+            break;
+
+        default:
+            return pa_source_output_process_msg(m, code, userdata, offset, chunk);
+    }
+
+    return 0;
+}
+
+/* Called from thread context */
+static void broadcast_source_output_push_cb(pa_source_output *o, const pa_memchunk *chunk) {
+    struct broadcast *b;
+
+    pa_source_output_assert_ref(o);
+    pa_assert_se(b = o->userdata);
+    pa_assert(chunk);
+
+#ifdef HAVE_OPUS
+    if (b->format == BROADCAST_OPUS) {
+        broadcast_encode(b, chunk);
+        return;
+    }
+#endif
+
+    pa_asyncmsgq_post(pa_thread_mq_get()->outq, PA_MSGOBJECT(o), SOURCE_OUTPUT_MESSAGE_POST_DATA, NULL, 0, chunk, NULL);
+}
+
+/* Called from main context */
+static void broadcast_source_output_kill_cb(pa_source_output *o) {
+    struct broadcast *b;
+    struct connection *c;
+
+    pa_source_output_assert_ref(o);
+    pa_assert_se(b = o->userdata);
+
+    b->busy = TRUE;
+
+    while ((c = b->listeners))
+        connection_unlink(c);
+
+    broadcast_free(b);
+}
+
+/* Called from main context */
+static struct broadcast* broadcast_new(pa_http_protocol *p, pa_source *source, enum broadcast_format format) {
+    struct broadcast *b;
+    pa_source_output_new_data data;
+    pa_sample_spec ss;
+    pa_channel_map cm;
+
+    ss = source->sample_spec;
+    cm = source->channel_map;
+
+    if (format == BROADCAST_WAV)
+        ss.format = PA_SAMPLE_S16LE;
+    else {
+        /* Family 0 only knows mono and stereo */
+        ss.format = PA_SAMPLE_FLOAT32NE;
+        ss.rate = OPUS_RATE;
+        ss.channels = PA_MIN(ss.channels, 2);
+        pa_channel_map_init_auto(&cm, ss.channels, PA_CHANNEL_MAP_DEFAULT);
+    }
+
+    b = pa_xnew0(struct broadcast, 1);
+    b->protocol = p;
+    b->format = format;
+    PA_LLIST_HEAD_INIT(struct connection, b->listeners);
+    PA_LLIST_PREPEND(struct broadcast, p->broadcasts, b);
+
+    pa_source_output_new_data_init(&data);
+    data.driver = __FILE__;
+    pa_source_output_new_data_set_source(&data, source, FALSE);
+    pa_proplist_setf(data.proplist, PA_PROP_MEDIA_NAME, "HTTP broadcast (%s)", format == BROADCAST_WAV ? "WAV" : "Opus");
+    pa_source_output_new_data_set_sample_spec(&data, &ss);
+    pa_source_output_new_data_set_channel_map(&data, &cm);
+
+    pa_source_output_new(&b->source_output, p->core, &data);
+    pa_source_output_new_data_done(&data);
+
+    if (!b->source_output)
+        goto fail;
+
+    if (format == BROADCAST_WAV) {
+        broadcast_wav_header(b, &ss);
+        b->max_queue = pa_bytes_per_second(&ss) * RECORD_BUFFER_SECONDS;
+    } else {
+#ifdef HAVE_OPUS
+        int streams, coupled_streams, r;
+        unsigned char mapping[2];
+        opus_int32 lookahead = 0;
+
+        b->channels = ss.channels;
+
+        if (!(b->encoder = opus_multistream_surround_encoder_create(OPUS_RATE, b->channels, 0, &streams, &coupled_streams, mapping, OPUS_APPLICATION_AUDIO, &r))) {
+            pa_log_error("Failed to create Opus encoder: %s", opus_strerror(r));
+            goto fail;
+        }
+
+        opus_multistream_encoder_ctl(b->encoder, OPUS_SET_BITRATE(OPUS_BITRATE));
+        opus_multistream_encoder_ctl(b->encoder, OPUS_GET_LOOKAHEAD(&lookahead));
+
+        b->pcm = pa_xnew(float, OPUS_FRAME_SAMPLES * b->channels);
+        b->packets = pa_xmalloc(OPUS_PACKETS_PER_PAGE * OPUS_MAX_PACKET);
+        pa_random(&b->serial, sizeof(b->serial));
+
+        ogg_crc_init();
+        broadcast_opus_header(b, (unsigned) lookahead);
+
+        /* Leave room for bursts, the bit rate is variable */
+        b->max_queue = OPUS_BITRATE / 8 * RECORD_BUFFER_SECONDS * 2;
+#else
+        pa_assert_not_reached();
+#endif
+    }
+
+    b->max_queue += b->header.length;
+
+    b->source_output->parent.process_msg = broadcast_source_output_process_msg;
+    b->source_output->push = broadcast_source_output_push_cb;
+    b->source_output->kill = broadcast_source_output_kill_cb;
+    b->source_output->userdata = b;
+
+    pa_source_output_set_requested_latency(b->source_output, DEFAULT_SOURCE_LATENCY);
+    pa_source_output_put(b->source_output);
+
+    pa_log_info("Started %s broadcast of source %s.", format == BROADCAST_WAV ? "WAV" : "Opus", source->name);
+
+    return b;
+
+fail:
+    broadcast_free(b);
+    return NULL;
+}
+
+/* Called from main context */
+static struct broadcast* broadcast_get(pa_http_protocol *p, pa_source *source, enum broadcast_format format) {
+    struct broadcast *b;
+
+    PA_LLIST_FOREACH(b, p->broadcasts)
+        if (b->format == format && b->source_output->source == source)
+            return b;
+
+    return broadcast_new(p, source, format);
+}
+
 /*** client callbacks ***/
 static void client_kill_cb(pa_client *client) {
     struct connection*c;
@@ -368,6 +925,14 @@ static void html_print_field(pa_ioline *line, const char *left, const char *righ
     pa_xfree(eright);
 }
 
+static void html_print_broadcast_links(pa_ioline *line, pa_source *source) {
+    pa_ioline_printf(line, " (<a href=\"" URL_BROADCAST_WAV "%s\" title=\"" MIME_WAV "\">WAV</a>", source->name);
+#ifdef HAVE_OPUS
+    pa_ioline_printf(line, ", <a href=\"" URL_BROADCAST_OPUS "%s\" title=\"" MIME_OGG "\">Opus</a>", source->name);
+#endif
+    pa_ioline_puts(line, ")<br/>\n");
+}
+
 static void handle_root(struct connection *c) {
     char *t;
 
@@ -479,8 +1044,9 @@ static void handle_listen(struct connection *c) {
         m = pa_sample_spec_to_mime_type_mimefy(&sink->sample_spec, &sink->channel_map);
 
         pa_ioline_printf(c->line,
-                         "<a href=\"" URL_LISTEN_SOURCE "%s\" title=\"%s\">%s</a><br/>\n",
+                         "<a href=\"" URL_LISTEN_SOURCE "%s\" title=\"%s\">%s</a>",
                          sink->monitor_source->name, m, t);
+        html_print_broadcast_links(c->line, sink->monitor_source);
 
         pa_xfree(t);
         pa_xfree(m);
@@ -501,8 +1067,9 @@ static void handle_listen(struct connection *c) {
         m = pa_sample_spec_to_mime_type_mimefy(&source->sample_spec, &source->channel_map);
 
         pa_ioline_printf(c->line,
-                         "<a href=\"" URL_LISTEN_SOURCE "%s\" title=\"%s\">%s</a><br/>\n",
+                         "<a href=\"" URL_LISTEN_SOURCE "%s\" title=\"%s\">%s</a>",
                          source->name, m, t);
+        html_print_broadcast_links(c->line, source);
 
         pa_xfree(m);
         pa_xfree(t);
@@ -612,6 +1179,67 @@ static void handle_listen_prefix(struct connection *c, const char *source_name)
         pa_ioline_set_drain_callback(c->line, line_drain_callback, c);
 }
 
+static void handle_broadcast_prefix(struct connection *c, const char *source_name, enum broadcast_format format) {
+    pa_http_protocol *p;
+    pa_source *source;
+    struct broadcast *b;
+
+    pa_assert(c);
+    pa_assert(source_name);
+
+    pa_assert(c->line);
+    pa_assert(!c->io);
+
+    p = c->protocol;
+
+    if (!(source = pa_namereg_get(p->core, source_name, PA_NAMEREG_SOURCE))) {
+        html_response(c, 404, "Source not found", NULL);
+        return;
+    }
+
+    if (c->method == METHOD_HEAD) {
+        http_response(c, 200, "OK", format == BROADCAST_WAV ? MIME_WAV : MIME_OGG);
+        pa_ioline_defer_close(c->line);
+        return;
+    }
+
+    if (p->n_listeners >= MAX_LISTENERS) {
+        html_response(c, 503, "Too many listeners", NULL);
+        return;
+    }
+
+    if (!(b = broadcast_get(p, source, format))) {
+        html_response(c, 403, "Cannot create source output", NULL);
+        return;
+    }
+
+    c->output_memblockq = pa_memblockq_new(
+            "http protocol listener output_memblockq",
+            0,
+            b->max_queue,
+            0,
+            &byte_spec,
+            1,
+            0,
+            0,
+            NULL);
+
+    pa_assert_se(pa_memblockq_push(c->output_memblockq, &b->header) >= 0);
+
+    c->broadcast = b;
+    PA_LLIST_PREPEND(struct connection, b->listeners, c);
+    p->n_listeners++;
+
+    http_response(c, 200, "OK", format == BROADCAST_WAV ? MIME_WAV : MIME_OGG);
+
+    pa_ioline_set_callback(c->line, NULL, NULL);
+
+    if (pa_ioline_is_drained(c->line))
+        line_drain_callback(c->line, c);
+    else
+        pa_ioline_set_drain_callback(c->line, line_drain_callback, c);
+}
+
 static void handle_url(struct connection *c) {
     pa_assert(c);
 
@@ -627,6 +1255,12 @@ static void handle_url(struct connection *c) {
         handle_listen(c);
     else if (pa_startswith(c->url, URL_LISTEN_SOURCE))
         handle_listen_prefix(c, c->url + sizeof(URL_LISTEN_SOURCE)-1);
+    else if (pa_startswith(c->url, URL_BROADCAST_WAV))
+        handle_broadcast_prefix(c, c->url + sizeof(URL_BROADCAST_WAV)-1, BROADCAST_WAV);
+#ifdef HAVE_OPUS
+    else if (pa_startswith(c->url, URL_BROADCAST_OPUS))
+        handle_broadcast_prefix(c, c->url + sizeof(URL_BROADCAST_OPUS)-1, BROADCAST_OPUS);
+#endif
     else
         html_response(c, 404, "Not Found", NULL);
 }
@@ -691,7 +1325,7 @@ void pa_http_protocol_connect(pa_http_protocol *p, pa_iochannel *io, pa_module *
     pa_assert(io);
     pa_assert(m);
 
-    if (pa_idxset_size(p->connections)+1 > MAX_CONNECTIONS) {
+    if (pa_idxset_size(p->connections) - p->n_listeners + 1 > MAX_CONNECTIONS) {
         pa_log("Warning! Too many connections (%u), dropping incoming connection.", MAX_CONNECTIONS);
         pa_iochannel_free(io);
         return;
@@ -750,6 +1384,7 @@ static pa_http_protocol* http_protocol_new(pa_core *c) {
     PA_REFCNT_INIT(p);
     p->core = c;
     p->connections = pa_idxset_new(NULL, NULL);
+    PA_LLIST_HEAD_INIT(struct broadcast, p->broadcasts);
 
     pa_assert_se(pa_shared_set(c, "http-protocol", p) >= 0);
 
@@ -786,6 +1421,7 @@ void pa_http_protocol_unref(pa_http_protocol *p) {
     while ((c = pa_idxset_first(p->connections, NULL)))
         connection_unlink(c);
 
+    pa_assert(!p->broadcasts);
     pa_idxset_free(p->connections, NULL);
 
     pa_strlist_free(p->servers);
@@ -29,6 +29,10 @@
 #include <stdlib.h>
 #include <unistd.h>
 
+#ifdef HAVE_OPUS
+#include <opus_multistream.h>
+#endif
+
 #include <pulse/rtclock.h>
 #include <pulse/timeval.h>
 #include <pulse/version.h>
@@ -36,6 +40,7 @@
 #include <pulse/util.h>
 #include <pulse/xmalloc.h>
 #include <pulse/internal.h>
+#include <pulse/mainloop.h>
 
 #include <pulsecore/native-common.h>
 #include <pulsecore/packet.h>
@@ -57,6 +62,9 @@
 #include <pulsecore/core-util.h>
 #include <pulsecore/ipacl.h>
 #include <pulsecore/thread-mq.h>
+#include <pulsecore/thread.h>
+#include <pulsecore/io-worker.h>
+#include <pulsecore/shmring.h>
 
 #include "protocol-native.h"
 
@@ -68,11 +76,35 @@
 /* Don't accept more connection than this */
 #define MAX_CONNECTIONS 64
 
+/* Don't start more threads than this for reading from the connections */
+#define IO_THREADS_MAX 32
+
+/* Sinks keep measuring levels for a connection this long after it last
+ * asked for them */
+#define LEVELS_POLL_TIMEOUT (2 * PA_USEC_PER_SEC)
+
+/* The range of intervals for pushing sink levels */
+#define LEVELS_PUSH_INTERVAL_MIN PA_SINK_LEVELS_WINDOW_USEC
+#define LEVELS_PUSH_INTERVAL_MAX (PA_SINK_LEVELS_HISTORY * PA_SINK_LEVELS_WINDOW_USEC)
+
 #define MAX_MEMBLOCKQ_LENGTH (4*1024*1024) /* 4MB */
 #define DEFAULT_TLENGTH_MSEC 2000 /* 2s */
 #define DEFAULT_PROCESS_MSEC 20   /* 20ms */
 #define DEFAULT_FRAGSIZE_MSEC DEFAULT_TLENGTH_MSEC
 
+/* Largest compressed packet a length prefix can describe */
+#define CODEC_PACKET_MAX 0xFFFF
+
+/* Playback data written in smaller pieces than this is copied together */
+#define COALESCE_MSEC 10 /* 10ms */
+
+/* With adaptive latency, tlength grows by half on each underrun and
+ * shrinks by an eighth after this much playback during which the queue
+ * never ran below half of it. Without a maxlength from the client it
+ * grows up to ADAPT_MAX_FACTOR times what the client asked for. */
+#define ADAPT_SHRINK_USEC (10*PA_USEC_PER_SEC)
+#define ADAPT_MAX_FACTOR 4
+
 struct pa_native_protocol;
 
 typedef struct record_stream {
@@ -127,6 +159,12 @@ typedef struct playback_stream {
     pa_bool_t is_underrun:1;
     pa_bool_t drain_request:1;
     uint32_t drain_tag;
+
+    /* Set while the reply to PA_COMMAND_CREATE_PLAYBACK_STREAM waits
+     * for the IO thread to take the sink input over */
+    pa_bool_t create_pending:1;
+    uint32_t create_tag;
+    uint32_t create_missing;
     uint32_t syncid;
 
     /* Optimization to avoid too many rewinds with a lot of small blocks */
@@ -145,6 +183,42 @@ typedef struct playback_stream {
     size_t render_memblockq_length;
     pa_usec_t current_sink_latency;
     uint64_t playing_for, underrun_for;
+
+    /* Only updated from the IO thread, to track fragmentation */
+    unsigned max_nblocks;
+
+    /* Only used from the IO thread. With a threshold set, this is what
+     * the client extrapolates from the timing info it got last. Once
+     * the real read index is off by more than that, the client gets
+     * PA_COMMAND_PLAYBACK_STREAM_TIMING. */
+    size_t timing_push_threshold;
+    pa_usec_t timing_push_time;
+    int64_t timing_push_read_index;
+    pa_bool_t timing_push_playing:1;
+    pa_bool_t timing_push_pending:1;
+
+    /* Only used from the IO thread. Set by
+     * PA_COMMAND_SET_PLAYBACK_STREAM_ADAPTIVE_LATENCY, tlength and
+     * minreq then move between the base the client asked for and
+     * adapt_max_tlength, see playback_stream_adapt(). */
+    size_t adapt_max_tlength;
+    size_t adapt_base_tlength, adapt_base_minreq;
+    size_t adapt_low_water, adapt_played;
+
+#ifdef HAVE_OPUS
+    /* Set by PA_COMMAND_SET_PLAYBACK_STREAM_CODEC, the client then sends
+     * length prefixed packets which are reassembled and decoded here */
+    OpusMSDecoder *opus_decoder;
+    uint8_t *codec_buffer;
+    size_t codec_buffer_length;
+#endif
+
+    /* Set by PA_COMMAND_SET_PLAYBACK_STREAM_SHM_RING, the client then
+     * writes into the ring instead of sending memblocks. Read from the IO
+     * thread, which also tracks how much it freed since waking up the
+     * client the last time. */
+    pa_shmring *shm_ring;
+    size_t shm_ring_freed;
 } playback_stream;
 
 #define PLAYBACK_STREAM(o) (playback_stream_cast(o))
@@ -175,17 +249,40 @@ struct pa_native_connection {
     pa_bool_t is_local:1;
     uint32_t version;
     pa_client *client;
+    pa_mempool *mempool;
     pa_pstream *pstream;
     pa_pdispatch *pdispatch;
     pa_idxset *record_streams, *output_streams;
     uint32_t rrobin_index;
     pa_subscription *subscription;
     pa_time_event *auth_timeout_event;
+    pa_defer_event *request_event;
+    pa_hashmap *levels_watches;
 };
 
+/* The levels of a sink a connection polls or has pushed. Each of the
+ * two keeps the sink measuring while its time event exists. */
+typedef struct levels_watch {
+    pa_native_connection *connection;
+    pa_sink *sink;
+
+    uint32_t poll_seq;
+    pa_time_event *poll_event;
+
+    uint32_t push_seq;
+    pa_usec_t push_interval;
+    pa_time_event *push_event;
+} levels_watch;
+
 #define PA_NATIVE_CONNECTION(o) (pa_native_connection_cast(o))
 PA_DEFINE_PRIVATE_CLASS(pa_native_connection, pa_msgobject);
 
+struct pa_native_io_thread {
+    pa_mainloop *mainloop;
+    pa_io_worker *worker;
+    pa_thread *thread;
+};
+
 struct pa_native_protocol {
     PA_REFCNT_DECLARE;
 
@@ -210,7 +307,10 @@ enum {
     SINK_INPUT_MESSAGE_SEEK,
     SINK_INPUT_MESSAGE_PREBUF_FORCE,
     SINK_INPUT_MESSAGE_UPDATE_LATENCY,
-    SINK_INPUT_MESSAGE_UPDATE_BUFFER_ATTR
+    SINK_INPUT_MESSAGE_UPDATE_BUFFER_ATTR,
+    SINK_INPUT_MESSAGE_SET_SHM_RING,
+    SINK_INPUT_MESSAGE_SET_TIMING_PUSH,
+    SINK_INPUT_MESSAGE_SET_ADAPTIVE_LATENCY
 };
 
 enum {
@@ -219,7 +319,9 @@ enum {
     PLAYBACK_STREAM_MESSAGE_OVERFLOW,
     PLAYBACK_STREAM_MESSAGE_DRAIN_ACK,
     PLAYBACK_STREAM_MESSAGE_STARTED,
-    PLAYBACK_STREAM_MESSAGE_UPDATE_TLENGTH
+    PLAYBACK_STREAM_MESSAGE_UPDATE_TLENGTH,
+    PLAYBACK_STREAM_MESSAGE_TIMING_DRIFT,
+    PLAYBACK_STREAM_MESSAGE_UPDATE_BUFFER_ATTR
 };
 
 enum {
@@ -233,6 +335,7 @@ enum {
 
 static bool sink_input_process_underrun_cb(pa_sink_input *i);
 static int sink_input_pop_cb(pa_sink_input *i, size_t length, pa_memchunk *chunk);
+static int sink_input_pop_into_cb(pa_sink_input *i, pa_memchunk *target);
 static void sink_input_kill_cb(pa_sink_input *i);
 static void sink_input_suspend_cb(pa_sink_input *i, pa_bool_t suspend);
 static void sink_input_moving_cb(pa_sink_input *i, pa_sink *dest);
@@ -240,9 +343,12 @@ static void sink_input_process_rewind_cb(pa_sink_input *i, size_t nbytes);
 static void sink_input_update_max_rewind_cb(pa_sink_input *i, size_t nbytes);
 static void sink_input_update_max_request_cb(pa_sink_input *i, size_t nbytes);
 static void sink_input_send_event_cb(pa_sink_input *i, const char *event, pa_proplist *pl);
+static void sink_input_put_cb(pa_sink_input *i, void *userdata);
 
 static void native_connection_send_memblock(pa_native_connection *c);
 static void playback_stream_request_bytes(struct playback_stream*s);
+static void playback_stream_put_latency(playback_stream *s, pa_tagstruct *reply, const struct timeval *tv);
+static void playback_stream_send_buffer_attr(playback_stream *s);
 
 static void source_output_kill_cb(pa_source_output *o);
 static void source_output_push_cb(pa_source_output *o, const pa_memchunk *chunk);
@@ -273,6 +379,7 @@ static void command_get_info(pa_pdispatch *pd, uint32_t command, uint32_t tag, p
 static void command_get_info_list(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
 static void command_get_server_info(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
 static void command_subscribe(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
+static void command_subscribe_filter(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
 static void command_set_volume(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
 static void command_set_mute(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
 static void command_cork_playback_stream(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
@@ -294,6 +401,14 @@ static void command_extension(pa_pdispatch *pd, uint32_t command, uint32_t tag,
 static void command_set_card_profile(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
 static void command_set_sink_or_source_port(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
 static void command_set_port_latency_offset(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
+static void command_get_playback_latency_batch(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
+static void command_get_server_snapshot(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
+static void command_set_playback_stream_codec(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
+static void command_set_playback_stream_shm_ring(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
+static void command_set_playback_stream_timing_push(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
+static void command_set_playback_stream_adaptive_latency(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
+static void command_get_sink_levels(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
+static void command_set_sink_levels_push(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
 
 static const pa_pdispatch_cb_t command_table[PA_COMMAND_MAX] = {
     [PA_COMMAND_ERROR] = NULL,
@@ -397,6 +512,18 @@ static const pa_pdispatch_cb_t command_table[PA_COMMAND_MAX] = {
 
     [PA_COMMAND_SET_PORT_LATENCY_OFFSET] = command_set_port_latency_offset,
 
+    [PA_COMMAND_GET_PLAYBACK_LATENCY_BATCH] = command_get_playback_latency_batch,
+    [PA_COMMAND_REQUEST_BATCH] = NULL,
+    [PA_COMMAND_GET_SERVER_SNAPSHOT] = command_get_server_snapshot,
+    [PA_COMMAND_SUBSCRIBE_FILTER] = command_subscribe_filter,
+    [PA_COMMAND_SET_PLAYBACK_STREAM_CODEC] = command_set_playback_stream_codec,
+    [PA_COMMAND_SET_PLAYBACK_STREAM_SHM_RING] = command_set_playback_stream_shm_ring,
+    [PA_COMMAND_SET_PLAYBACK_STREAM_TIMING_PUSH] = command_set_playback_stream_timing_push,
+    [PA_COMMAND_GET_SINK_LEVELS] = command_get_sink_levels,
+    [PA_COMMAND_SET_SINK_LEVELS_PUSH] = command_set_sink_levels_push,
+    [PA_COMMAND_SINK_LEVELS] = NULL,
+    [PA_COMMAND_SET_PLAYBACK_STREAM_ADAPTIVE_LATENCY] = command_set_playback_stream_adaptive_latency,
+
     [PA_COMMAND_EXTENSION] = command_extension
 };
 
@@ -773,6 +900,9 @@ static void playback_stream_unlink(playback_stream *s) {
     if (s->drain_request)
         pa_pstream_send_error(s->connection->pstream, s->drain_tag, PA_ERR_NOENTITY);
 
+    if (s->create_pending)
+        pa_pstream_send_error(s->connection->pstream, s->create_tag, PA_ERR_NOENTITY);
+
     pa_assert_se(pa_idxset_remove_by_data(s->connection->output_streams, s, NULL) == s);
     s->connection = NULL;
     playback_stream_unref(s);
@@ -785,10 +915,80 @@ static void playback_stream_free(pa_object* o) {
 
     playback_stream_unlink(s);
 
+    pa_log_debug("Playback stream memblockq held at most %u blocks.", s->max_nblocks);
+
     pa_memblockq_free(s->memblockq);
+
+#ifdef HAVE_OPUS
+    if (s->opus_decoder)
+        opus_multistream_decoder_destroy(s->opus_decoder);
+    pa_xfree(s->codec_buffer);
+#endif
+
+    if (s->shm_ring)
+        pa_shmring_free(s->shm_ring);
+
     pa_xfree(s);
 }
 
+/* Called from main context. Returns how many bytes to request from the
+ * client now. */
+static int playback_stream_take_missing(playback_stream *s) {
+    int l;
+
+    for (;;) {
+        if ((l = pa_atomic_load(&s->missing)) <= 0)
+            return 0;
+
+        if (pa_atomic_cmpxchg(&s->missing, l, 0))
+            return l;
+    }
+}
+
+/* Called from main context */
+static void request_batch_cb(pa_mainloop_api *m, pa_defer_event *e, void *userdata) {
+    pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
+    pa_tagstruct *t = NULL;
+    output_stream *o;
+    uint32_t idx;
+
+    pa_native_connection_assert_ref(c);
+    pa_assert(c->request_event == e);
+
+    m->defer_enable(e, 0);
+
+    /* Everything the streams of this connection asked for since the last
+     * main loop iteration goes out in a single packet */
+    PA_IDXSET_FOREACH(o, c->output_streams, idx) {
+        playback_stream *s;
+        int l;
+
+        if (!playback_stream_isinstance(o))
+            continue;
+
+        s = PLAYBACK_STREAM(o);
+
+        if ((l = playback_stream_take_missing(s)) <= 0)
+            continue;
+
+        if (!t) {
+            t = pa_tagstruct_new(NULL, 0);
+            pa_tagstruct_putu32(t, PA_COMMAND_REQUEST_BATCH);
+            pa_tagstruct_putu32(t, (uint32_t) -1); /* tag */
+        }
+
+        pa_tagstruct_putu32(t, s->index);
+        pa_tagstruct_putu32(t, (uint32_t) l);
+
+#ifdef PROTOCOL_NATIVE_DEBUG
+        pa_log("Requesting %lu bytes for stream %u", (unsigned long) l, s->index);
+#endif
+    }
+
+    if (t)
+        pa_pstream_send_tagstruct(c->pstream, t);
+}
+
 /* Called from main context */
 static int playback_stream_process_msg(pa_msgobject *o, int code, void*userdata, int64_t offset, pa_memchunk *chunk) {
     playback_stream *s = PLAYBACK_STREAM(o);
@@ -803,14 +1003,14 @@ static int playback_stream_process_msg(pa_msgobject *o, int code, void*userdata,
             pa_tagstruct *t;
             int l = 0;
 
-            for (;;) {
-                if ((l = pa_atomic_load(&s->missing)) <= 0)
-                    return 0;
-
-                if (pa_atomic_cmpxchg(&s->missing, l, 0))
-                    break;
+            if (s->connection->version >= 30) {
+                s->connection->protocol->core->mainloop->defer_enable(s->connection->request_event, 1);
+                return 0;
             }
 
+            if ((l = playback_stream_take_missing(s)) <= 0)
+                return 0;
+
             t = pa_tagstruct_new(NULL, 0);
             pa_tagstruct_putu32(t, PA_COMMAND_REQUEST);
             pa_tagstruct_putu32(t, (uint32_t) -1); /* tag */
@@ -873,31 +1073,66 @@ static int playback_stream_process_msg(pa_msgobject *o, int code, void*userdata,
             pa_pstream_send_simple_ack(s->connection->pstream, PA_PTR_TO_UINT(userdata));
             break;
 
+        case PLAYBACK_STREAM_MESSAGE_TIMING_DRIFT: {
+            pa_tagstruct *t;
+            struct timeval now;
+
+            /* Sent unasked, both timestamps are ours */
+            t = pa_tagstruct_new(NULL, 0);
+            pa_tagstruct_putu32(t, PA_COMMAND_PLAYBACK_STREAM_TIMING);
+            pa_tagstruct_putu32(t, (uint32_t) -1); /* tag */
+            pa_tagstruct_putu32(t, s->index);
+            playback_stream_put_latency(s, t, pa_gettimeofday(&now));
+            pa_pstream_send_tagstruct(s->connection->pstream, t);
+            break;
+        }
+
         case PLAYBACK_STREAM_MESSAGE_UPDATE_TLENGTH:
 
             s->buffer_attr.tlength = (uint32_t) offset;
+            playback_stream_send_buffer_attr(s);
+            break;
 
-            if (s->connection->version >= 15) {
-                pa_tagstruct *t;
+        case PLAYBACK_STREAM_MESSAGE_UPDATE_BUFFER_ATTR: {
+            uint32_t max_prebuf;
 
-                t = pa_tagstruct_new(NULL, 0);
-                pa_tagstruct_putu32(t, PA_COMMAND_PLAYBACK_BUFFER_ATTR_CHANGED);
-                pa_tagstruct_putu32(t, (uint32_t) -1); /* tag */
-                pa_tagstruct_putu32(t, s->index);
-                pa_tagstruct_putu32(t, s->buffer_attr.maxlength);
-                pa_tagstruct_putu32(t, s->buffer_attr.tlength);
-                pa_tagstruct_putu32(t, s->buffer_attr.prebuf);
-                pa_tagstruct_putu32(t, s->buffer_attr.minreq);
-                pa_tagstruct_put_usec(t, s->configured_sink_latency);
-                pa_pstream_send_tagstruct(s->connection->pstream, t);
-            }
+            /* Mirrors what the memblockq did to prebuf */
+            s->buffer_attr.tlength = (uint32_t) offset;
+            s->buffer_attr.minreq = PA_PTR_TO_UINT(userdata);
+
+            max_prebuf = s->buffer_attr.tlength + (uint32_t) pa_frame_size(&s->sink_input->sample_spec) - s->buffer_attr.minreq;
+            if (s->buffer_attr.prebuf > max_prebuf)
+                s->buffer_attr.prebuf = max_prebuf;
 
+            playback_stream_send_buffer_attr(s);
             break;
+        }
     }
 
     return 0;
 }
 
+/* Called from main context */
+static void playback_stream_send_buffer_attr(playback_stream *s) {
+    pa_tagstruct *t;
+
+    playback_stream_assert_ref(s);
+
+    if (s->connection->version < 15)
+        return;
+
+    t = pa_tagstruct_new(NULL, 0);
+    pa_tagstruct_putu32(t, PA_COMMAND_PLAYBACK_BUFFER_ATTR_CHANGED);
+    pa_tagstruct_putu32(t, (uint32_t) -1); /* tag */
+    pa_tagstruct_putu32(t, s->index);
+    pa_tagstruct_putu32(t, s->buffer_attr.maxlength);
+    pa_tagstruct_putu32(t, s->buffer_attr.tlength);
+    pa_tagstruct_putu32(t, s->buffer_attr.prebuf);
+    pa_tagstruct_putu32(t, s->buffer_attr.minreq);
+    pa_tagstruct_put_usec(t, s->configured_sink_latency);
+    pa_pstream_send_tagstruct(s->connection->pstream, t);
+}
+
 /* Called from main context */
 static void fix_playback_buffer_attr(playback_stream *s) {
     size_t frame_size, max_prebuf;
@@ -1085,7 +1320,7 @@ static playback_stream* playback_stream_new(
         pa_bool_t early_requests,
         pa_bool_t relative_volume,
         uint32_t syncid,
-        uint32_t *missing,
+        uint32_t tag,
         int *ret) {
 
     /* Note: This function takes ownership of the 'formats' param, so we need
@@ -1094,6 +1329,7 @@ static playback_stream* playback_stream_new(
     playback_stream *ssync;
     playback_stream *s = NULL;
     pa_sink_input *sink_input = NULL;
+    pa_sink_input_sync_group *group = NULL;
     pa_memchunk silence;
     uint32_t idx;
     int64_t start_index;
@@ -1102,7 +1338,6 @@ static playback_stream* playback_stream_new(
 
     pa_assert(c);
     pa_assert(ss);
-    pa_assert(missing);
     pa_assert(p);
     pa_assert(ret);
 
@@ -1153,13 +1388,21 @@ static playback_stream* playback_stream_new(
         pa_sink_input_new_data_set_muted(&data, muted);
         data.save_muted = FALSE;
     }
-    data.sync_base = ssync ? ssync->sink_input : NULL;
-    data.flags = flags;
+    /* Every stream gets a group, so that others can join it later */
+    if (ssync)
+        data.sync_group = ssync->sink_input->sync_group;
+    else
+        data.sync_group = group = pa_sink_input_sync_group_new();
+    /* pop() only touches the stream itself and posts to the outq */
+    data.flags = flags | PA_SINK_INPUT_PARALLEL_PEEK;
 
     *ret = -pa_sink_input_new(&sink_input, c->protocol->core, &data);
 
     pa_sink_input_new_data_done(&data);
 
+    if (group)
+        pa_sink_input_sync_group_unref(group);
+
     if (!sink_input)
         goto out;
 
@@ -1180,6 +1423,7 @@ static playback_stream* playback_stream_new(
 
     s->sink_input->parent.process_msg = sink_input_process_msg;
     s->sink_input->pop = sink_input_pop_cb;
+    s->sink_input->pop_into = sink_input_pop_into_cb;
     s->sink_input->process_underrun = sink_input_process_underrun_cb;
     s->sink_input->process_rewind = sink_input_process_rewind_cb;
     s->sink_input->update_max_rewind = sink_input_update_max_rewind_cb;
@@ -1206,15 +1450,16 @@ static playback_stream* playback_stream_new(
             s->buffer_attr.minreq,
             0,
             &silence);
+    pa_memblockq_set_coalesce(s->memblockq, pa_usec_to_bytes(COALESCE_MSEC * PA_USEC_PER_MSEC, &sink_input->sample_spec));
     pa_xfree(memblockq_name);
     pa_memblock_unref(silence.memblock);
 
     pa_memblockq_get_attr(s->memblockq, &s->buffer_attr);
 
-    *missing = (uint32_t) pa_memblockq_pop_missing(s->memblockq);
+    s->create_missing = (uint32_t) pa_memblockq_pop_missing(s->memblockq);
 
 #ifdef PROTOCOL_NATIVE_DEBUG
-    pa_log("missing original: %li", (long int) *missing);
+    pa_log("missing original: %li", (long int) s->create_missing);
 #endif
 
     *ss = s->sink_input->sample_spec;
@@ -1228,7 +1473,11 @@ static playback_stream* playback_stream_new(
                 (double) pa_bytes_to_usec(s->buffer_attr.minreq, &sink_input->sample_spec) / PA_USEC_PER_MSEC,
                 (double) s->configured_sink_latency / PA_USEC_PER_MSEC);
 
-    pa_sink_input_put(s->sink_input);
+    /* The reply is sent once the IO thread has the sink input, so
+     * that many streams created in a row don't each wait for it */
+    s->create_tag = tag;
+    s->create_pending = TRUE;
+    pa_sink_input_put_async(s->sink_input, sink_input_put_cb, NULL);
 
 out:
     if (formats)
@@ -1246,6 +1495,10 @@ static void playback_stream_request_bytes(playback_stream *s) {
 
     m = pa_memblockq_pop_missing(s->memblockq);
 
+    /* Clients with a SHM ring are woken up through its fdsem instead */
+    if (s->shm_ring)
+        return;
+
     /* pa_log("request_bytes(%lu) (tlength=%lu minreq=%lu length=%lu really missing=%lli)", */
     /*        (unsigned long) m, */
     /*        pa_memblockq_get_tlength(s->memblockq), */
@@ -1303,6 +1556,124 @@ static int native_connection_process_msg(pa_msgobject *o, int code, void*userdat
 }
 
 /* Called from main context */
+/* Called from main context */
+static void levels_watch_free(levels_watch *w) {
+    pa_mainloop_api *m;
+
+    pa_assert(w);
+
+    m = w->connection->protocol->core->mainloop;
+
+    if (w->poll_event) {
+        m->time_free(w->poll_event);
+        pa_sink_levels_stop(w->sink);
+    }
+
+    if (w->push_event) {
+        m->time_free(w->push_event);
+        pa_sink_levels_stop(w->sink);
+    }
+
+    pa_sink_unref(w->sink);
+    pa_xfree(w);
+}
+
+/* Called from main context */
+static levels_watch* levels_watch_get(pa_native_connection *c, pa_sink *s) {
+    levels_watch *w;
+
+    if ((w = pa_hashmap_get(c->levels_watches, PA_UINT32_TO_PTR(s->index))))
+        return w;
+
+    w = pa_xnew0(levels_watch, 1);
+    w->connection = c;
+    w->sink = pa_sink_ref(s);
+    pa_assert_se(pa_hashmap_put(c->levels_watches, PA_UINT32_TO_PTR(s->index), w) == 0);
+
+    return w;
+}
+
+/* Called from main context */
+static void levels_watch_release(levels_watch *w) {
+    pa_assert(w);
+
+    if (w->poll_event || w->push_event)
+        return;
+
+    pa_assert_se(pa_hashmap_remove(w->connection->levels_watches, PA_UINT32_TO_PTR(w->sink->index)) == w);
+    levels_watch_free(w);
+}
+
+/* Called from main context. Falls back to the last window if none was
+ * completed since, and to silence if there is nothing to go by. */
+static void levels_get(pa_sink *s, uint32_t *seq, pa_bool_t fresh, pa_sink_levels *l) {
+    uint32_t last;
+
+    if (pa_sink_get_levels(s, seq, l))
+        return;
+
+    last = *seq - 1;
+    if (fresh || s->state == PA_SINK_SUSPENDED || !pa_sink_get_levels(s, &last, l))
+        memset(l, 0, sizeof(*l));
+}
+
+static void levels_put(pa_tagstruct *t, pa_sink *s, const pa_sink_levels *l) {
+    pa_cvolume peak, rms;
+    unsigned c;
+
+    peak.channels = rms.channels = s->sample_spec.channels;
+    for (c = 0; c < s->sample_spec.channels; c++) {
+        peak.values[c] = pa_sw_volume_from_linear(l->peak[c]);
+        rms.values[c] = pa_sw_volume_from_linear(l->rms[c]);
+    }
+
+    pa_tagstruct_putu32(t, s->index);
+    pa_tagstruct_put_cvolume(t, &peak);
+    pa_tagstruct_put_cvolume(t, &rms);
+}
+
+static void levels_poll_timeout_cb(pa_mainloop_api *m, pa_time_event *e, const struct timeval *tv, void *userdata) {
+    levels_watch *w = userdata;
+
+    pa_assert(w);
+    pa_assert(w->poll_event == e);
+
+    m->time_free(w->poll_event);
+    w->poll_event = NULL;
+    pa_sink_levels_stop(w->sink);
+
+    levels_watch_release(w);
+}
+
+static void levels_push_cb(pa_mainloop_api *m, pa_time_event *e, const struct timeval *tv, void *userdata) {
+    levels_watch *w = userdata;
+    pa_sink_levels l;
+    pa_tagstruct *t;
+
+    pa_assert(w);
+    pa_assert(w->push_event == e);
+
+    /* The client learns about removed sinks from the subscription */
+    if (!PA_SINK_IS_LINKED(w->sink->state)) {
+        m->time_free(w->push_event);
+        w->push_event = NULL;
+        pa_sink_levels_stop(w->sink);
+
+        levels_watch_release(w);
+        return;
+    }
+
+    levels_get(w->sink, &w->push_seq, FALSE, &l);
+
+    t = pa_tagstruct_new(NULL, 0);
+    pa_tagstruct_putu32(t, PA_COMMAND_SINK_LEVELS);
+    pa_tagstruct_putu32(t, (uint32_t) -1); /* tag */
+    levels_put(t, w->sink, &l);
+    pa_pstream_send_tagstruct(w->connection->pstream, t);
+
+    pa_core_rttime_restart(w->connection->protocol->core, e, pa_rtclock_now() + w->push_interval);
+}
+
 static void native_connection_unlink(pa_native_connection *c) {
     record_stream *r;
     output_stream *o;
@@ -1314,9 +1685,6 @@ static void native_connection_unlink(pa_native_connection *c) {
 
     pa_hook_fire(&c->protocol->hooks[PA_NATIVE_HOOK_CONNECTION_UNLINK], c);
 
-    if (c->options)
-        pa_native_options_unref(c->options);
-
     while ((r = pa_idxset_first(c->record_streams, NULL)))
         record_stream_unlink(r);
 
@@ -1329,14 +1697,25 @@ static void native_connection_unlink(pa_native_connection *c) {
     if (c->subscription)
         pa_subscription_free(c->subscription);
 
+    pa_hashmap_remove_all(c->levels_watches, (pa_free_cb_t) levels_watch_free);
+
     if (c->pstream)
         pa_pstream_unlink(c->pstream);
 
+    /* Only now, the options might own the I/O thread of the pstream */
+    if (c->options)
+        pa_native_options_unref(c->options);
+
     if (c->auth_timeout_event) {
         c->protocol->core->mainloop->time_free(c->auth_timeout_event);
         c->auth_timeout_event = NULL;
     }
 
+    if (c->request_event) {
+        c->protocol->core->mainloop->defer_free(c->request_event);
+        c->request_event = NULL;
+    }
+
     pa_assert_se(pa_idxset_remove_by_data(c->protocol->connections, c, NULL) == c);
     c->protocol = NULL;
     pa_native_connection_unref(c);
@@ -1352,11 +1731,16 @@ static void native_connection_free(pa_object *o) {
 
     pa_idxset_free(c->record_streams, NULL);
     pa_idxset_free(c->output_streams, NULL);
+    pa_hashmap_free(c->levels_watches, NULL);
 
     pa_pdispatch_unref(c->pdispatch);
     pa_pstream_unref(c->pstream);
     pa_client_free(c->client);
 
+    /* The pstream took its imports and exports along, blocks still in
+     * flight keep the pool around */
+    pa_mempool_unref(c->mempool);
+
     pa_xfree(c);
 }
 
@@ -1395,6 +1779,91 @@ static void native_connection_send_memblock(pa_native_connection *c) {
 
 /*** sink input callbacks ***/
 
+/* Called from thread context. Moves what the client wrote into the SHM
+ * ring over to the memblockq, until that holds nbytes or at least as
+ * much as needed to get past prebuffering. The rest stays in the ring
+ * where the client accounts for it. */
+static void playback_stream_fetch_ring(playback_stream *s, size_t nbytes) {
+    size_t length, want, minreq;
+
+    playback_stream_assert_ref(s);
+
+    if (!s->shm_ring)
+        return;
+
+    want = PA_MAX(nbytes, pa_memblockq_get_prebuf(s->memblockq));
+
+    while ((length = pa_memblockq_get_length(s->memblockq)) < want) {
+        pa_memchunk chunk;
+        const void *d;
+        void *p;
+        size_t l;
+        int r;
+
+        if (!(d = pa_shmring_peek(s->shm_ring, &l)))
+            break;
+
+        l = PA_MIN(l, want - length);
+        l = PA_MIN(l, pa_mempool_block_size_max(s->sink_input->core->mempool));
+
+        chunk.memblock = pa_memblock_new(s->sink_input->core->mempool, l);
+        chunk.index = 0;
+        chunk.length = l;
+
+        p = pa_memblock_acquire(chunk.memblock);
+        memcpy(p, d, l);
+        pa_memblock_release(chunk.memblock);
+
+        pa_shmring_drop(s->shm_ring, l);
+        s->shm_ring_freed += l;
+
+        r = pa_memblockq_push_align(s->memblockq, &chunk);
+        pa_memblock_unref(chunk.memblock);
+
+        if (r < 0) {
+            if (pa_log_ratelimit(PA_LOG_WARN))
+                pa_log_warn("Failed to push data into queue");
+            s->sink_input->thread_info.counters.overflows++;
+            pa_asyncmsgq_post(pa_thread_mq_get()->outq, PA_MSGOBJECT(s), PLAYBACK_STREAM_MESSAGE_OVERFLOW, NULL, 0, NULL, NULL);
+            break;
+        }
+    }
+
+    s->max_nblocks = PA_MAX(s->max_nblocks, pa_memblockq_get_nblocks(s->memblockq));
+
+    /* Like with requests, wake the client up once there is room for at
+     * least minreq bytes, or when we are about to run dry */
+    minreq = pa_memblockq_get_minreq(s->memblockq);
+
+    if (s->shm_ring_freed > 0 &&
+        (s->shm_ring_freed >= minreq || pa_shmring_get_length(s->shm_ring) <= 0)) {
+        pa_fdsem_post(pa_shmring_get_fdsem(s->shm_ring));
+        s->shm_ring_freed = 0;
+    }
+}
+
+/* Called from thread context */
+static void playback_stream_flush_ring(playback_stream *s) {
+    const void *d;
+    size_t l;
+
+    playback_stream_assert_ref(s);
+
+    if (!s->shm_ring)
+        return;
+
+    while ((d = pa_shmring_peek(s->shm_ring, &l)))
+        pa_shmring_drop(s->shm_ring, l);
+
+    pa_fdsem_post(pa_shmring_get_fdsem(s->shm_ring));
+    s->shm_ring_freed = 0;
+}
+
+/* Called from thread context */
+static size_t playback_stream_get_length(playback_stream *s) {
+    return pa_memblockq_get_length(s->memblockq) + (s->shm_ring ? pa_shmring_get_length(s->shm_ring) : 0);
+}
+
 /* Called from thread context */
 static void handle_seek(playback_stream *s, int64_t indexw) {
     playback_stream_assert_ref(s);
@@ -1438,6 +1907,76 @@ static void flush_write_no_account(pa_memblockq *q) {
     pa_memblockq_flush_write(q, FALSE);
 }
 
+/* Called from thread context */
+static void playback_stream_rebase_adapt(playback_stream *s, size_t max_tlength) {
+    s->adapt_max_tlength = max_tlength;
+    s->adapt_base_tlength = pa_memblockq_get_tlength(s->memblockq);
+    s->adapt_base_minreq = pa_memblockq_get_minreq(s->memblockq);
+    s->adapt_low_water = (size_t) -1;
+    s->adapt_played = 0;
+}
+
+/* Called from thread context. minreq keeps its share of tlength, so
+ * that the client is woken up accordingly less often. */
+static void playback_stream_set_tlength(playback_stream *s, size_t tlength) {
+    size_t old_tlength, minreq;
+
+    old_tlength = pa_memblockq_get_tlength(s->memblockq);
+    tlength = PA_CLAMP(tlength, s->adapt_base_tlength, PA_MAX(s->adapt_max_tlength, s->adapt_base_tlength));
+    minreq = (size_t) ((uint64_t) s->adapt_base_minreq * tlength / s->adapt_base_tlength);
+
+    /* minreq may never exceed tlength on the way */
+    if (tlength > old_tlength) {
+        pa_memblockq_set_tlength(s->memblockq, tlength);
+        pa_memblockq_set_minreq(s->memblockq, minreq);
+    } else {
+        pa_memblockq_set_minreq(s->memblockq, minreq);
+        pa_memblockq_set_tlength(s->memblockq, tlength);
+    }
+
+    if (pa_memblockq_get_tlength(s->memblockq) == old_tlength)
+        return;
+
+    pa_log_debug("Adapted tlength of '%s' from %zu to %zu bytes.",
+                 pa_strnull(pa_proplist_gets(s->sink_input->proplist, PA_PROP_MEDIA_NAME)),
+                 old_tlength, pa_memblockq_get_tlength(s->memblockq));
+
+    pa_asyncmsgq_post(pa_thread_mq_get()->outq, PA_MSGOBJECT(s), PLAYBACK_STREAM_MESSAGE_UPDATE_BUFFER_ATTR,
+                      PA_UINT_TO_PTR(pa_memblockq_get_minreq(s->memblockq)), (int64_t) pa_memblockq_get_tlength(s->memblockq), NULL, NULL);
+}
+
+/* Called from thread context, after nbytes were played. Grows tlength
+ * right away if the client let the stream underrun, and shrinks it
+ * slowly while the client always refills well in time. */
+static void playback_stream_adapt(playback_stream *s, size_t nbytes, pa_bool_t underrun) {
+    size_t tlength;
+
+    if (s->adapt_max_tlength <= 0)
+        return;
+
+    tlength = pa_memblockq_get_tlength(s->memblockq);
+
+    if (underrun) {
+        s->adapt_low_water = (size_t) -1;
+        s->adapt_played = 0;
+
+        playback_stream_set_tlength(s, tlength + tlength / 2);
+        return;
+    }
+
+    s->adapt_low_water = PA_MIN(s->adapt_low_water, pa_memblockq_get_length(s->memblockq));
+    s->adapt_played += nbytes;
+
+    if (s->adapt_played < pa_usec_to_bytes(ADAPT_SHRINK_USEC, &s->sink_input->sample_spec))
+        return;
+
+    if (s->adapt_low_water > tlength / 2)
+        playback_stream_set_tlength(s, tlength - tlength / 8);
+
+    s->adapt_low_water = (size_t) -1;
+    s->adapt_played = 0;
+}
+
 /* Called from thread context */
 static int sink_input_process_msg(pa_msgobject *o, int code, void *userdata, int64_t offset, pa_memchunk *chunk) {
     pa_sink_input *i = PA_SINK_INPUT(o);
@@ -1465,10 +2004,13 @@ static int sink_input_process_msg(pa_msgobject *o, int code, void *userdata, int
             if (chunk && pa_memblockq_push_align(s->memblockq, chunk) < 0) {
                 if (pa_log_ratelimit(PA_LOG_WARN))
                     pa_log_warn("Failed to push data into queue");
+                s->sink_input->thread_info.counters.overflows++;
                 pa_asyncmsgq_post(pa_thread_mq_get()->outq, PA_MSGOBJECT(s), PLAYBACK_STREAM_MESSAGE_OVERFLOW, NULL, 0, NULL, NULL);
                 pa_memblockq_seek(s->memblockq, (int64_t) chunk->length, PA_SEEK_RELATIVE, TRUE);
             }
 
+            s->max_nblocks = PA_MAX(s->max_nblocks, pa_memblockq_get_nblocks(s->memblockq));
+
             /* If more data is in queue, we rewind later instead. */
             if (s->seek_windex != -1)
                 windex = PA_MIN(windex, s->seek_windex);
@@ -1508,26 +2050,20 @@ static int sink_input_process_msg(pa_msgobject *o, int code, void *userdata, int
                     pa_assert_not_reached();
             }
 
-            windex = pa_memblockq_get_write_index(s->memblockq);
-            func(s->memblockq);
-            handle_seek(s, windex);
-
-            /* Do the same for all other members in the sync group */
-            for (isync = i->sync_prev; isync; isync = isync->sync_prev) {
-                playback_stream *ssync = PLAYBACK_STREAM(isync->userdata);
-                windex = pa_memblockq_get_write_index(ssync->memblockq);
-                func(ssync->memblockq);
-                handle_seek(ssync, windex);
-            }
-
-            for (isync = i->sync_next; isync; isync = isync->sync_next) {
+            /* Do the same for all members of the sync group, s is one
+             * of them */
+            for (isync = i->sync_group->thread_info.inputs; isync; isync = isync->thread_info.sync_next) {
                 playback_stream *ssync = PLAYBACK_STREAM(isync->userdata);
                 windex = pa_memblockq_get_write_index(ssync->memblockq);
+                if (code == SINK_INPUT_MESSAGE_FLUSH)
+                    playback_stream_flush_ring(ssync);
                 func(ssync->memblockq);
                 handle_seek(ssync, windex);
             }
 
             if (code == SINK_INPUT_MESSAGE_DRAIN) {
+                playback_stream_fetch_ring(s, pa_memblockq_get_minreq(s->memblockq));
+
                 if (!pa_memblockq_is_readable(s->memblockq))
                     pa_asyncmsgq_post(pa_thread_mq_get()->outq, PA_MSGOBJECT(s), PLAYBACK_STREAM_MESSAGE_DRAIN_ACK, userdata, 0, NULL, NULL);
                 else {
@@ -1543,11 +2079,20 @@ static int sink_input_process_msg(pa_msgobject *o, int code, void *userdata, int
             /* Atomically get a snapshot of all timing parameters... */
             s->read_index = pa_memblockq_get_read_index(s->memblockq);
             s->write_index = pa_memblockq_get_write_index(s->memblockq);
+            if (s->shm_ring)
+                s->write_index += (int64_t) pa_shmring_get_length(s->shm_ring);
             s->render_memblockq_length = pa_memblockq_get_length(s->sink_input->thread_info.render_memblockq);
             s->current_sink_latency = pa_sink_get_latency_within_thread(s->sink_input->sink);
             s->underrun_for = s->sink_input->thread_info.underrun_for;
             s->playing_for = s->sink_input->thread_info.playing_for;
 
+            /* Whatever asked for this passes it on to the client, which
+             * extrapolates from there */
+            s->timing_push_time = pa_rtclock_now();
+            s->timing_push_read_index = s->read_index;
+            s->timing_push_playing = s->playing_for > 0;
+            s->timing_push_pending = FALSE;
+
             return 0;
 
         case PA_SINK_INPUT_MESSAGE_SET_STATE: {
@@ -1572,7 +2117,7 @@ static int sink_input_process_msg(pa_msgobject *o, int code, void *userdata, int
         case PA_SINK_INPUT_MESSAGE_GET_LATENCY: {
             pa_usec_t *r = userdata;
 
-            *r = pa_bytes_to_usec(pa_memblockq_get_length(s->memblockq), &i->sample_spec);
+            *r = pa_bytes_to_usec(playback_stream_get_length(s), &i->sample_spec);
 
             /* Fall through, the default handler will add in the extra
              * latency added by the resampler */
@@ -1582,8 +2127,31 @@ static int sink_input_process_msg(pa_msgobject *o, int code, void *userdata, int
         case SINK_INPUT_MESSAGE_UPDATE_BUFFER_ATTR: {
             pa_memblockq_apply_attr(s->memblockq, &s->buffer_attr);
             pa_memblockq_get_attr(s->memblockq, &s->buffer_attr);
+
+            /* Adapting starts over from what the client asked for now */
+            if (s->adapt_max_tlength > 0)
+                playback_stream_rebase_adapt(s, PA_MAX(s->adapt_max_tlength, (size_t) s->buffer_attr.tlength));
+
             return 0;
         }
+
+        case SINK_INPUT_MESSAGE_SET_SHM_RING:
+            s->shm_ring = userdata;
+            s->shm_ring_freed = 0;
+            return 0;
+
+        case SINK_INPUT_MESSAGE_SET_TIMING_PUSH:
+            s->timing_push_threshold = (size_t) offset;
+            s->timing_push_pending = TRUE;
+            return 0;
+
+        case SINK_INPUT_MESSAGE_SET_ADAPTIVE_LATENCY:
+            /* Switching it off goes back to what the client asked for */
+            if (offset <= 0 && s->adapt_max_tlength > 0)
+                playback_stream_set_tlength(s, s->adapt_base_tlength);
+
+            playback_stream_rebase_adapt(s, (size_t) offset);
+            return 0;
     }
 
     return pa_sink_input_process_msg(o, code, userdata, offset, chunk);
@@ -1607,12 +2175,38 @@ static bool handle_input_underrun(playback_stream *s, bool force) {
          pa_log_debug("Drain acknowledged of '%s'", pa_strnull(pa_proplist_gets(s->sink_input->proplist, PA_PROP_MEDIA_NAME)));
     } else if (!s->is_underrun) {
          pa_asyncmsgq_post(pa_thread_mq_get()->outq, PA_MSGOBJECT(s), PLAYBACK_STREAM_MESSAGE_UNDERFLOW, NULL, pa_memblockq_get_read_index(s->memblockq), NULL, NULL);
+
+         /* Only if it ran dry while playing, before that the client
+          * didn't even have a chance */
+         if (s->sink_input->thread_info.playing_for > 0)
+             playback_stream_adapt(s, 0, TRUE);
     }
     s->is_underrun = true;
     playback_stream_request_bytes(s);
     return true;
 }
 
+/* Called from thread context. Whether another stream of the sync group
+ * of s has something to play. */
+static bool sync_group_is_playing(playback_stream *s) {
+    pa_sink_input *isync;
+
+    for (isync = s->sink_input->sync_group->thread_info.inputs; isync; isync = isync->thread_info.sync_next)
+        if (isync != s->sink_input && pa_memblockq_is_readable(PLAYBACK_STREAM(isync->userdata)->memblockq))
+            return true;
+
+    return false;
+}
+
+/* Called from thread context, when nothing could be peeked. While the
+ * rest of the group plays on, keep the read index in step with theirs.
+ * Whatever comes in late is skipped then, instead of playing shifted
+ * against the other streams. */
+static void sync_group_skip(playback_stream *s, size_t nbytes) {
+    if (sync_group_is_playing(s))
+        pa_memblockq_skip(s->memblockq, nbytes);
+}
+
 /* Called from thread context */
 static bool sink_input_process_underrun_cb(pa_sink_input *i) {
     playback_stream *s;
@@ -1621,9 +2215,36 @@ static bool sink_input_process_underrun_cb(pa_sink_input *i) {
     s = PLAYBACK_STREAM(i->userdata);
     playback_stream_assert_ref(s);
 
+    playback_stream_fetch_ring(s, pa_memblockq_get_minreq(s->memblockq));
+
     return handle_input_underrun(s, true);
 }
 
+/* Called from thread context. Tell the main loop when the read index
+ * of the stream left the linear model of the client. */
+static void playback_stream_check_timing(playback_stream *s) {
+    int64_t predicted, d;
+    pa_bool_t playing;
+
+    if (s->timing_push_threshold <= 0 || s->timing_push_pending)
+        return;
+
+    playing = s->sink_input->thread_info.playing_for > 0;
+
+    predicted = s->timing_push_read_index;
+    if (s->timing_push_playing)
+        predicted += (int64_t) pa_usec_to_bytes(pa_rtclock_now() - s->timing_push_time, &s->sink_input->sample_spec);
+
+    if ((d = pa_memblockq_get_read_index(s->memblockq) - predicted) < 0)
+        d = -d;
+
+    if (playing == s->timing_push_playing && (uint64_t) d <= s->timing_push_threshold)
+        return;
+
+    s->timing_push_pending = TRUE;
+    pa_asyncmsgq_post(pa_thread_mq_get()->outq, PA_MSGOBJECT(s), PLAYBACK_STREAM_MESSAGE_TIMING_DRIFT, NULL, 0, NULL, NULL);
+}
+
 /* Called from thread context */
 static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk) {
     playback_stream *s;
@@ -1637,13 +2258,17 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk
     pa_log("%s, pop(): %lu", pa_proplist_gets(i->proplist, PA_PROP_MEDIA_NAME), (unsigned long) pa_memblockq_get_length(s->memblockq));
 #endif
 
+    playback_stream_fetch_ring(s, nbytes);
+
     if (!handle_input_underrun(s, false))
         s->is_underrun = false;
 
     /* This call will not fail with prebuf=0, hence we check for
        underrun explicitly in handle_input_underrun */
-    if (pa_memblockq_peek(s->memblockq, chunk) < 0)
+    if (pa_memblockq_peek(s->memblockq, chunk) < 0) {
+        sync_group_skip(s, nbytes);
         return -1;
+    }
 
     chunk->length = PA_MIN(nbytes, chunk->length);
 
@@ -1651,7 +2276,62 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk
         pa_asyncmsgq_post(pa_thread_mq_get()->outq, PA_MSGOBJECT(s), PLAYBACK_STREAM_MESSAGE_STARTED, NULL, 0, NULL, NULL);
 
     pa_memblockq_drop(s->memblockq, chunk->length);
+    playback_stream_adapt(s, chunk->length, FALSE);
     playback_stream_request_bytes(s);
+    playback_stream_check_timing(s);
+
+    return 0;
+}
+
+/* Called from thread context. Used instead of pop() while we are the
+ * only stream of the sink and neither need resampling nor volume, as
+ * with passthrough or bit-perfect playback. The client's blocks are
+ * copied straight into the target, which usually is the hardware
+ * buffer, past the render queue and the mixer. */
+static int sink_input_pop_into_cb(pa_sink_input *i, pa_memchunk *target) {
+    playback_stream *s;
+    size_t length = 0;
+
+    pa_sink_input_assert_ref(i);
+    s = PLAYBACK_STREAM(i->userdata);
+    playback_stream_assert_ref(s);
+    pa_assert(target);
+
+    playback_stream_fetch_ring(s, target->length);
+
+    if (!handle_input_underrun(s, false))
+        s->is_underrun = false;
+
+    while (length < target->length) {
+        pa_memchunk chunk, t;
+
+        if (pa_memblockq_peek(s->memblockq, &chunk) < 0)
+            break;
+
+        t = *target;
+        t.index += length;
+        t.length = chunk.length = PA_MIN(chunk.length, target->length - length);
+
+        pa_memchunk_memcpy(&t, &chunk);
+        pa_memblock_unref(chunk.memblock);
+
+        pa_memblockq_drop(s->memblockq, t.length);
+        length += t.length;
+    }
+
+    if (length == 0) {
+        sync_group_skip(s, target->length);
+        return -1;
+    }
+
+    target->length = length;
+
+    if (i->thread_info.underrun_for > 0)
+        pa_asyncmsgq_post(pa_thread_mq_get()->outq, PA_MSGOBJECT(s), PLAYBACK_STREAM_MESSAGE_STARTED, NULL, 0, NULL, NULL);
+
+    playback_stream_adapt(s, length, FALSE);
+    playback_stream_request_bytes(s);
+    playback_stream_check_timing(s);
 
     return 0;
 }
@@ -1943,38 +2623,125 @@ static void protocol_error(pa_native_connection *c) {
     native_connection_unlink(c);
 }
 
-#define CHECK_VALIDITY(pstream, expression, tag, error) do { \
-if (!(expression)) { \
-    pa_pstream_send_error((pstream), (tag), (error)); \
-    return; \
-} \
-} while(0);
+#define CHECK_VALIDITY(pstream, expression, tag, error) do { \
+if (!(expression)) { \
+    pa_pstream_send_error((pstream), (tag), (error)); \
+    return; \
+} \
+} while(0);
+
+#define CHECK_VALIDITY_GOTO(pstream, expression, tag, error, label) do { \
+if (!(expression)) { \
+    pa_pstream_send_error((pstream), (tag), (error)); \
+    goto label; \
+} \
+} while(0);
+
+static pa_tagstruct *reply_new(uint32_t tag) {
+    pa_tagstruct *reply;
+
+    reply = pa_tagstruct_new(NULL, 0);
+    pa_tagstruct_putu32(reply, PA_COMMAND_REPLY);
+    pa_tagstruct_putu32(reply, tag);
+    return reply;
+}
+
+/* Rough size of an introspection entry including its property list, used
+ * to size list replies up front */
+#define INFO_SIZE_HINT 1024
+
+static pa_tagstruct *reply_new_sized(uint32_t tag, size_t size) {
+    pa_tagstruct *reply;
+
+    reply = pa_tagstruct_new_sized(PA_MAX(size, (size_t) 10));
+    pa_tagstruct_putu32(reply, PA_COMMAND_REPLY);
+    pa_tagstruct_putu32(reply, tag);
+    return reply;
+}
+
+/* Called from main context */
+static void playback_stream_send_create_reply(playback_stream *s) {
+    pa_tagstruct *reply;
+
+    playback_stream_assert_ref(s);
+    pa_assert(s->connection);
+
+    reply = reply_new(s->create_tag);
+    pa_tagstruct_putu32(reply, s->index);
+    pa_assert(s->sink_input);
+    pa_tagstruct_putu32(reply, s->sink_input->index);
+    pa_tagstruct_putu32(reply, s->create_missing);
+
+#ifdef PROTOCOL_NATIVE_DEBUG
+    pa_log("initial request is %u", s->create_missing);
+#endif
+
+    if (s->connection->version >= 9) {
+        /* Since 0.9.0 we support sending the buffer metrics back to the client */
+
+        pa_tagstruct_putu32(reply, (uint32_t) s->buffer_attr.maxlength);
+        pa_tagstruct_putu32(reply, (uint32_t) s->buffer_attr.tlength);
+        pa_tagstruct_putu32(reply, (uint32_t) s->buffer_attr.prebuf);
+        pa_tagstruct_putu32(reply, (uint32_t) s->buffer_attr.minreq);
+    }
+
+    if (s->connection->version >= 12) {
+        /* Since 0.9.8 we support sending the chosen sample
+         * spec/channel map/device/suspend status back to the
+         * client */
+
+        pa_tagstruct_put_sample_spec(reply, &s->sink_input->sample_spec);
+        pa_tagstruct_put_channel_map(reply, &s->sink_input->channel_map);
+
+        pa_tagstruct_putu32(reply, s->sink_input->sink->index);
+        pa_tagstruct_puts(reply, s->sink_input->sink->name);
+
+        pa_tagstruct_put_boolean(reply, pa_sink_get_state(s->sink_input->sink) == PA_SINK_SUSPENDED);
+    }
+
+    if (s->connection->version >= 13)
+        pa_tagstruct_put_usec(reply, s->configured_sink_latency);
+
+    if (s->connection->version >= 21) {
+        /* Send back the format we negotiated */
+        if (s->sink_input->format)
+            pa_tagstruct_put_format_info(reply, s->sink_input->format);
+        else {
+            pa_format_info *f = pa_format_info_new();
+            pa_tagstruct_put_format_info(reply, f);
+            pa_format_info_free(f);
+        }
+    }
+
+    pa_pstream_send_tagstruct(s->connection->pstream, reply);
+}
+
+/* Called from main context */
+static void sink_input_put_cb(pa_sink_input *i, void *userdata) {
+    playback_stream *s;
+
+    pa_sink_input_assert_ref(i);
 
-#define CHECK_VALIDITY_GOTO(pstream, expression, tag, error, label) do { \
-if (!(expression)) { \
-    pa_pstream_send_error((pstream), (tag), (error)); \
-    goto label; \
-} \
-} while(0);
+    /* If the stream is gone already the client got an error for it */
+    if (!PA_SINK_INPUT_IS_LINKED(i->state))
+        return;
 
-static pa_tagstruct *reply_new(uint32_t tag) {
-    pa_tagstruct *reply;
+    s = PLAYBACK_STREAM(i->userdata);
+    playback_stream_assert_ref(s);
+    pa_assert(s->create_pending);
 
-    reply = pa_tagstruct_new(NULL, 0);
-    pa_tagstruct_putu32(reply, PA_COMMAND_REPLY);
-    pa_tagstruct_putu32(reply, tag);
-    return reply;
+    s->create_pending = FALSE;
+    playback_stream_send_create_reply(s);
 }
 
 static void command_create_playback_stream(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
     pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
     playback_stream *s;
-    uint32_t sink_index, syncid, missing = 0;
+    uint32_t sink_index, syncid;
     pa_buffer_attr attr;
     const char *name = NULL, *sink_name;
     pa_sample_spec ss;
     pa_channel_map map;
-    pa_tagstruct *reply;
     pa_sink *sink = NULL;
     pa_cvolume volume;
     pa_bool_t
@@ -2171,61 +2938,12 @@ static void command_create_playback_stream(pa_pdispatch *pd, uint32_t command, u
      * flag. For older versions we synthesize it here */
     muted_set = muted_set || muted;
 
-    s = playback_stream_new(c, sink, &ss, &map, formats, &attr, volume_set ? &volume : NULL, muted, muted_set, flags, p, adjust_latency, early_requests, relative_volume, syncid, &missing, &ret);
+    s = playback_stream_new(c, sink, &ss, &map, formats, &attr, volume_set ? &volume : NULL, muted, muted_set, flags, p, adjust_latency, early_requests, relative_volume, syncid, tag, &ret);
     /* We no longer own the formats idxset */
     formats = NULL;
 
     CHECK_VALIDITY_GOTO(c->pstream, s, tag, ret, finish);
 
-    reply = reply_new(tag);
-    pa_tagstruct_putu32(reply, s->index);
-    pa_assert(s->sink_input);
-    pa_tagstruct_putu32(reply, s->sink_input->index);
-    pa_tagstruct_putu32(reply, missing);
-
-#ifdef PROTOCOL_NATIVE_DEBUG
-    pa_log("initial request is %u", missing);
-#endif
-
-    if (c->version >= 9) {
-        /* Since 0.9.0 we support sending the buffer metrics back to the client */
-
-        pa_tagstruct_putu32(reply, (uint32_t) s->buffer_attr.maxlength);
-        pa_tagstruct_putu32(reply, (uint32_t) s->buffer_attr.tlength);
-        pa_tagstruct_putu32(reply, (uint32_t) s->buffer_attr.prebuf);
-        pa_tagstruct_putu32(reply, (uint32_t) s->buffer_attr.minreq);
-    }
-
-    if (c->version >= 12) {
-        /* Since 0.9.8 we support sending the chosen sample
-         * spec/channel map/device/suspend status back to the
-         * client */
-
-        pa_tagstruct_put_sample_spec(reply, &ss);
-        pa_tagstruct_put_channel_map(reply, &map);
-
-        pa_tagstruct_putu32(reply, s->sink_input->sink->index);
-        pa_tagstruct_puts(reply, s->sink_input->sink->name);
-
-        pa_tagstruct_put_boolean(reply, pa_sink_get_state(s->sink_input->sink) == PA_SINK_SUSPENDED);
-    }
-
-    if (c->version >= 13)
-        pa_tagstruct_put_usec(reply, s->configured_sink_latency);
-
-    if (c->version >= 21) {
-        /* Send back the format we negotiated */
-        if (s->sink_input->format)
-            pa_tagstruct_put_format_info(reply, s->sink_input->format);
-        else {
-            pa_format_info *f = pa_format_info_new();
-            pa_tagstruct_put_format_info(reply, f);
-            pa_format_info_free(f);
-        }
-    }
-
-    pa_pstream_send_tagstruct(c->pstream, reply);
-
 finish:
     if (p)
         pa_proplist_free(p);
@@ -2658,7 +3376,7 @@ static void command_auth(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_ta
 
     /* Enable shared memory support if possible */
     do_shm =
-        pa_mempool_is_shared(c->protocol->core->mempool) &&
+        pa_mempool_is_shared(c->mempool) &&
         c->is_local;
 
     pa_log_debug("SHM possible: %s", pa_yes_no(do_shm));
@@ -2682,6 +3400,11 @@ static void command_auth(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_ta
     pa_log_debug("Negotiated SHM: %s", pa_yes_no(do_shm));
     pa_pstream_enable_shm(c->pstream, do_shm);
 
+    /* Starting with protocol version 29 memfd segments are passed
+     * along with the SHM frames */
+    if (do_shm && c->version >= 29)
+        pa_pstream_enable_memfd(c->pstream);
+
     reply = reply_new(tag);
     pa_tagstruct_putu32(reply, PA_PROTOCOL_VERSION | (do_shm ? 0x80000000 : 0));
 
@@ -2822,14 +3545,51 @@ static void command_stat(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_ta
     pa_tagstruct_putu32(reply, (uint32_t) pa_atomic_load(&stat->n_accumulated));
     pa_tagstruct_putu32(reply, (uint32_t) pa_atomic_load(&stat->accumulated_size));
     pa_tagstruct_putu32(reply, (uint32_t) pa_scache_total_size(c->protocol->core));
+
+    if (c->version >= 29) {
+        pa_tagstruct_putu32(reply, (uint32_t) pa_mempool_get_page_size(c->protocol->core->mempool));
+        pa_tagstruct_put_boolean(reply, pa_mempool_is_locked(c->protocol->core->mempool));
+    }
+
+    if (c->version >= 30) {
+        pa_tagstruct_putu64(reply, c->protocol->core->memory_trimmed);
+        pa_tagstruct_putu32(reply, c->protocol->core->n_memory_trims);
+    }
+
     pa_pstream_send_tagstruct(c->pstream, reply);
 }
 
+/* Called from main context */
+static void playback_stream_put_latency(playback_stream *s, pa_tagstruct *reply, const struct timeval *tv) {
+    struct timeval now;
+
+    /* Get an atomic snapshot of all timing parameters */
+    pa_assert_se(pa_asyncmsgq_send(s->sink_input->sink->asyncmsgq, PA_MSGOBJECT(s->sink_input), SINK_INPUT_MESSAGE_UPDATE_LATENCY, s, 0, NULL) == 0);
+
+    pa_tagstruct_put_usec(reply,
+                          s->current_sink_latency +
+                          pa_bytes_to_usec(s->render_memblockq_length, &s->sink_input->sink->sample_spec));
+    pa_tagstruct_put_usec(reply, 0);
+    pa_tagstruct_put_boolean(reply,
+                             s->playing_for > 0 &&
+                             pa_sink_get_state(s->sink_input->sink) == PA_SINK_RUNNING &&
+                             pa_sink_input_get_state(s->sink_input) == PA_SINK_INPUT_RUNNING);
+    pa_tagstruct_put_timeval(reply, tv);
+    pa_tagstruct_put_timeval(reply, pa_gettimeofday(&now));
+    pa_tagstruct_puts64(reply, s->write_index);
+    pa_tagstruct_puts64(reply, s->read_index);
+
+    if (s->connection->version >= 13) {
+        pa_tagstruct_putu64(reply, s->underrun_for);
+        pa_tagstruct_putu64(reply, s->playing_for);
+    }
+}
+
 static void command_get_playback_latency(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
     pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
     pa_tagstruct *reply;
     playback_stream *s;
-    struct timeval tv, now;
+    struct timeval tv;
     uint32_t idx;
 
     pa_native_connection_assert_ref(c);
@@ -2847,26 +3607,58 @@ static void command_get_playback_latency(pa_pdispatch *pd, uint32_t command, uin
     CHECK_VALIDITY(c->pstream, s, tag, PA_ERR_NOENTITY);
     CHECK_VALIDITY(c->pstream, playback_stream_isinstance(s), tag, PA_ERR_NOENTITY);
 
-    /* Get an atomic snapshot of all timing parameters */
-    pa_assert_se(pa_asyncmsgq_send(s->sink_input->sink->asyncmsgq, PA_MSGOBJECT(s->sink_input), SINK_INPUT_MESSAGE_UPDATE_LATENCY, s, 0, NULL) == 0);
+    reply = reply_new(tag);
+    playback_stream_put_latency(s, reply, &tv);
+    pa_pstream_send_tagstruct(c->pstream, reply);
+}
+
+/* Like command_get_playback_latency(), for a whole list of streams. Streams
+ * that are gone are marked as such in the reply. */
+static void command_get_playback_latency_batch(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
+    pa_tagstruct *reply;
+    struct timeval tv;
+    uint32_t n, i;
+
+    pa_native_connection_assert_ref(c);
+    pa_assert(t);
+
+    if (pa_tagstruct_get_timeval(t, &tv) < 0 ||
+        pa_tagstruct_getu32(t, &n) < 0) {
+        protocol_error(c);
+        return;
+    }
+
+    CHECK_VALIDITY(c->pstream, c->authorized, tag, PA_ERR_ACCESS);
 
     reply = reply_new(tag);
-    pa_tagstruct_put_usec(reply,
-                          s->current_sink_latency +
-                          pa_bytes_to_usec(s->render_memblockq_length, &s->sink_input->sink->sample_spec));
-    pa_tagstruct_put_usec(reply, 0);
-    pa_tagstruct_put_boolean(reply,
-                             s->playing_for > 0 &&
-                             pa_sink_get_state(s->sink_input->sink) == PA_SINK_RUNNING &&
-                             pa_sink_input_get_state(s->sink_input) == PA_SINK_INPUT_RUNNING);
-    pa_tagstruct_put_timeval(reply, &tv);
-    pa_tagstruct_put_timeval(reply, pa_gettimeofday(&now));
-    pa_tagstruct_puts64(reply, s->write_index);
-    pa_tagstruct_puts64(reply, s->read_index);
+    pa_tagstruct_putu32(reply, n);
 
-    if (c->version >= 13) {
-        pa_tagstruct_putu64(reply, s->underrun_for);
-        pa_tagstruct_putu64(reply, s->playing_for);
+    for (i = 0; i < n; i++) {
+        playback_stream *s;
+        uint32_t idx;
+
+        if (pa_tagstruct_getu32(t, &idx) < 0) {
+            pa_tagstruct_free(reply);
+            protocol_error(c);
+            return;
+        }
+
+        pa_tagstruct_putu32(reply, idx);
+
+        if (!(s = pa_idxset_get_by_index(c->output_streams, idx)) || !playback_stream_isinstance(s)) {
+            pa_tagstruct_put_boolean(reply, FALSE);
+            continue;
+        }
+
+        pa_tagstruct_put_boolean(reply, TRUE);
+        playback_stream_put_latency(s, reply, &tv);
+    }
+
+    if (!pa_tagstruct_eof(t)) {
+        pa_tagstruct_free(reply);
+        protocol_error(c);
+        return;
     }
 
     pa_pstream_send_tagstruct(c->pstream, reply);
@@ -3139,7 +3931,17 @@ static void sink_fill_tagstruct(pa_native_connection *c, pa_tagstruct *t, pa_sin
         PA_TAG_INVALID);
 
     if (c->version >= 13) {
-        pa_tagstruct_put_proplist(t, sink->proplist);
+        /* The statistics change all the time, so they are only added
+         * to what is sent instead of being kept in the proplist */
+        pa_proplist *p = pa_proplist_copy(sink->proplist);
+
+        pa_io_counters_to_proplist(&sink->thread_info.counters, p);
+
+        if (sink->render_stats)
+            pa_render_stats_to_proplist(sink->render_stats, p);
+
+        pa_tagstruct_put_proplist(t, p);
+        pa_proplist_free(p);
         pa_tagstruct_put_usec(t, pa_sink_get_requested_latency(sink));
     }
 
@@ -3209,7 +4011,17 @@ static void source_fill_tagstruct(pa_native_connection *c, pa_tagstruct *t, pa_s
         PA_TAG_INVALID);
 
     if (c->version >= 13) {
-        pa_tagstruct_put_proplist(t, source->proplist);
+        /* The statistics change all the time, so they are only added
+         * to what is sent instead of being kept in the proplist */
+        pa_proplist *p = pa_proplist_copy(source->proplist);
+
+        pa_io_counters_to_proplist(&source->thread_info.counters, p);
+
+        if (source->render_stats)
+            pa_render_stats_to_proplist(source->render_stats, p);
+
+        pa_tagstruct_put_proplist(t, p);
+        pa_proplist_free(p);
         pa_tagstruct_put_usec(t, pa_source_get_requested_latency(source));
     }
 
@@ -3253,6 +4065,15 @@ static void source_fill_tagstruct(pa_native_connection *c, pa_tagstruct *t, pa_s
     }
 }
 
+/* The memory.* values of the owner are only added to what is sent */
+static void put_proplist_with_memory(pa_tagstruct *t, pa_proplist *proplist, pa_memowner *owner) {
+    pa_proplist *p = pa_proplist_copy(proplist);
+
+    pa_memowner_to_proplist(owner, p);
+    pa_tagstruct_put_proplist(t, p);
+    pa_proplist_free(p);
+}
+
 static void client_fill_tagstruct(pa_native_connection *c, pa_tagstruct *t, pa_client *client) {
     pa_assert(t);
     pa_assert(client);
@@ -3263,7 +4084,7 @@ static void client_fill_tagstruct(pa_native_connection *c, pa_tagstruct *t, pa_c
     pa_tagstruct_puts(t, client->driver);
 
     if (c->version >= 13)
-        pa_tagstruct_put_proplist(t, client->proplist);
+        put_proplist_with_memory(t, client->proplist, client->memowner);
 }
 
 static void card_fill_tagstruct(pa_native_connection *c, pa_tagstruct *t, pa_card *card) {
@@ -3330,7 +4151,17 @@ static void module_fill_tagstruct(pa_native_connection *c, pa_tagstruct *t, pa_m
         pa_tagstruct_put_boolean(t, FALSE); /* autoload is obsolete */
 
     if (c->version >= 15)
-        pa_tagstruct_put_proplist(t, module->proplist);
+        put_proplist_with_memory(t, module->proplist, module->memowner);
+}
+
+/* Like for sinks and sources, the counters are only added to what is
+ * sent */
+static void put_proplist_with_counters(pa_tagstruct *t, pa_proplist *proplist, const pa_io_counters *counters) {
+    pa_proplist *p = pa_proplist_copy(proplist);
+
+    pa_io_counters_to_proplist(counters, p);
+    pa_tagstruct_put_proplist(t, p);
+    pa_proplist_free(p);
 }
 
 static void sink_input_fill_tagstruct(pa_native_connection *c, pa_tagstruct *t, pa_sink_input *s) {
@@ -3365,7 +4196,7 @@ static void sink_input_fill_tagstruct(pa_native_connection *c, pa_tagstruct *t,
     if (c->version >= 11)
         pa_tagstruct_put_boolean(t, pa_sink_input_get_mute(s));
     if (c->version >= 13)
-        pa_tagstruct_put_proplist(t, s->proplist);
+        put_proplist_with_counters(t, s->proplist, &s->thread_info.counters);
     if (c->version >= 19)
         pa_tagstruct_put_boolean(t, (pa_sink_input_get_state(s) == PA_SINK_INPUT_CORKED));
     if (c->version >= 20) {
@@ -3405,7 +4236,7 @@ static void source_output_fill_tagstruct(pa_native_connection *c, pa_tagstruct *
     pa_tagstruct_puts(t, pa_resample_method_to_string(pa_source_output_get_resample_method(s)));
     pa_tagstruct_puts(t, s->driver);
     if (c->version >= 13)
-        pa_tagstruct_put_proplist(t, s->proplist);
+        put_proplist_with_counters(t, s->proplist, &s->thread_info.counters);
     if (c->version >= 19)
         pa_tagstruct_put_boolean(t, (pa_source_output_get_state(s) == PA_SOURCE_OUTPUT_CORKED));
     if (c->version >= 22) {
@@ -3563,8 +4394,6 @@ static void command_get_info_list(pa_pdispatch *pd, uint32_t command, uint32_t t
 
     CHECK_VALIDITY(c->pstream, c->authorized, tag, PA_ERR_ACCESS);
 
-    reply = reply_new(tag);
-
     if (command == PA_COMMAND_GET_SINK_INFO_LIST)
         i = c->protocol->core->sinks;
     else if (command == PA_COMMAND_GET_SOURCE_INFO_LIST)
@@ -3584,6 +4413,8 @@ static void command_get_info_list(pa_pdispatch *pd, uint32_t command, uint32_t t
         i = c->protocol->core->scache;
     }
 
+    reply = reply_new_sized(tag, i ? pa_idxset_size(i) * INFO_SIZE_HINT : 0);
+
     if (i) {
         PA_IDXSET_FOREACH(p, i, idx) {
             if (command == PA_COMMAND_GET_SINK_INFO_LIST)
@@ -3610,25 +4441,12 @@ static void command_get_info_list(pa_pdispatch *pd, uint32_t command, uint32_t t
     pa_pstream_send_tagstruct(c->pstream, reply);
 }
 
-static void command_get_server_info(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
-    pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
-    pa_tagstruct *reply;
+static void server_info_fill_tagstruct(pa_native_connection *c, pa_tagstruct *reply) {
     pa_sink *def_sink;
     pa_source *def_source;
     pa_sample_spec fixed_ss;
     char *h, *u;
 
-    pa_native_connection_assert_ref(c);
-    pa_assert(t);
-
-    if (!pa_tagstruct_eof(t)) {
-        protocol_error(c);
-        return;
-    }
-
-    CHECK_VALIDITY(c->pstream, c->authorized, tag, PA_ERR_ACCESS);
-
-    reply = reply_new(tag);
     pa_tagstruct_puts(reply, PACKAGE_NAME);
     pa_tagstruct_puts(reply, PACKAGE_VERSION);
 
@@ -3652,6 +4470,91 @@ static void command_get_server_info(pa_pdispatch *pd, uint32_t command, uint32_t
 
     if (c->version >= 15)
         pa_tagstruct_put_channel_map(reply, &c->protocol->core->default_channel_map);
+}
+
+static void command_get_server_info(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
+    pa_tagstruct *reply;
+
+    pa_native_connection_assert_ref(c);
+    pa_assert(t);
+
+    if (!pa_tagstruct_eof(t)) {
+        protocol_error(c);
+        return;
+    }
+
+    CHECK_VALIDITY(c->pstream, c->authorized, tag, PA_ERR_ACCESS);
+
+    reply = reply_new(tag);
+    server_info_fill_tagstruct(c, reply);
+    pa_pstream_send_tagstruct(c->pstream, reply);
+}
+
+/* The server info followed by every object class, each as the number of
+ * entries and the entries themselves. Everything is serialized in one go
+ * from the main thread, hence the client gets a consistent view. */
+static void command_get_server_snapshot(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
+    pa_core *core;
+    pa_tagstruct *reply;
+    uint32_t idx;
+    void *p;
+
+    pa_native_connection_assert_ref(c);
+    pa_assert(t);
+
+    if (!pa_tagstruct_eof(t)) {
+        protocol_error(c);
+        return;
+    }
+
+    CHECK_VALIDITY(c->pstream, c->authorized, tag, PA_ERR_ACCESS);
+
+    core = c->protocol->core;
+
+    reply = reply_new_sized(tag, INFO_SIZE_HINT * (1 +
+                                                   pa_idxset_size(core->sinks) +
+                                                   pa_idxset_size(core->sources) +
+                                                   pa_idxset_size(core->sink_inputs) +
+                                                   pa_idxset_size(core->source_outputs) +
+                                                   pa_idxset_size(core->clients) +
+                                                   pa_idxset_size(core->modules) +
+                                                   pa_idxset_size(core->cards) +
+                                                   pa_idxset_size(core->scache)));
+    server_info_fill_tagstruct(c, reply);
+
+    pa_tagstruct_putu32(reply, pa_idxset_size(core->sinks));
+    PA_IDXSET_FOREACH(p, core->sinks, idx)
+        sink_fill_tagstruct(c, reply, p);
+
+    pa_tagstruct_putu32(reply, pa_idxset_size(core->sources));
+    PA_IDXSET_FOREACH(p, core->sources, idx)
+        source_fill_tagstruct(c, reply, p);
+
+    pa_tagstruct_putu32(reply, pa_idxset_size(core->sink_inputs));
+    PA_IDXSET_FOREACH(p, core->sink_inputs, idx)
+        sink_input_fill_tagstruct(c, reply, p);
+
+    pa_tagstruct_putu32(reply, pa_idxset_size(core->source_outputs));
+    PA_IDXSET_FOREACH(p, core->source_outputs, idx)
+        source_output_fill_tagstruct(c, reply, p);
+
+    pa_tagstruct_putu32(reply, pa_idxset_size(core->clients));
+    PA_IDXSET_FOREACH(p, core->clients, idx)
+        client_fill_tagstruct(c, reply, p);
+
+    pa_tagstruct_putu32(reply, pa_idxset_size(core->modules));
+    PA_IDXSET_FOREACH(p, core->modules, idx)
+        module_fill_tagstruct(c, reply, p);
+
+    pa_tagstruct_putu32(reply, pa_idxset_size(core->cards));
+    PA_IDXSET_FOREACH(p, core->cards, idx)
+        card_fill_tagstruct(c, reply, p);
+
+    pa_tagstruct_putu32(reply, pa_idxset_size(core->scache));
+    PA_IDXSET_FOREACH(p, core->scache, idx)
+        scache_fill_tagstruct(c, reply, p);
 
     pa_pstream_send_tagstruct(c->pstream, reply);
 }
@@ -3686,16 +4589,70 @@ static void command_subscribe(pa_pdispatch *pd, uint32_t command, uint32_t tag,
     CHECK_VALIDITY(c->pstream, c->authorized, tag, PA_ERR_ACCESS);
     CHECK_VALIDITY(c->pstream, (m & ~PA_SUBSCRIPTION_MASK_ALL) == 0, tag, PA_ERR_INVALID);
 
-    if (c->subscription)
-        pa_subscription_free(c->subscription);
+    /* Changing the mask keeps the filters of an existing subscription */
+    if (c->subscription && m != 0)
+        pa_subscription_set_mask(c->subscription, m);
+    else {
+        if (c->subscription)
+            pa_subscription_free(c->subscription);
+
+        if (m != 0) {
+            c->subscription = pa_subscription_new(c->protocol->core, m, subscription_cb, c);
+            pa_assert(c->subscription);
+        } else
+            c->subscription = NULL;
+    }
+
+    pa_pstream_send_simple_ack(c->pstream, tag);
+}
+
+static void command_subscribe_filter(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
+    uint32_t facility, n, i, allocated = 0;
+    uint32_t *idx = NULL;
+
+    pa_native_connection_assert_ref(c);
+    pa_assert(t);
+
+    if (pa_tagstruct_getu32(t, &facility) < 0 ||
+        pa_tagstruct_getu32(t, &n) < 0) {
+        protocol_error(c);
+        return;
+    }
+
+    /* Don't trust n for allocating, grow as we go */
+    for (i = 0; i < n; i++) {
+        uint32_t j;
+
+        if (pa_tagstruct_getu32(t, &j) < 0) {
+            pa_xfree(idx);
+            protocol_error(c);
+            return;
+        }
+
+        if (i >= allocated) {
+            allocated = PA_MAX(16U, allocated * 2);
+            idx = pa_xrenew(uint32_t, idx, allocated);
+        }
+
+        idx[i] = j;
+    }
 
-    if (m != 0) {
-        c->subscription = pa_subscription_new(c->protocol->core, m, subscription_cb, c);
-        pa_assert(c->subscription);
-    } else
-        c->subscription = NULL;
+    if (!pa_tagstruct_eof(t)) {
+        pa_xfree(idx);
+        protocol_error(c);
+        return;
+    }
+
+    CHECK_VALIDITY_GOTO(c->pstream, c->authorized, tag, PA_ERR_ACCESS, finish);
+    CHECK_VALIDITY_GOTO(c->pstream, (facility & ~PA_SUBSCRIPTION_EVENT_FACILITY_MASK) == 0, tag, PA_ERR_INVALID, finish);
+    CHECK_VALIDITY_GOTO(c->pstream, c->subscription, tag, PA_ERR_BADSTATE, finish);
 
+    pa_subscription_set_filter(c->subscription, facility, idx, n);
     pa_pstream_send_simple_ack(c->pstream, tag);
+
+finish:
+    pa_xfree(idx);
 }
 
 static void command_set_volume(
@@ -4807,20 +5764,364 @@ static void command_set_port_latency_offset(pa_pdispatch *pd, uint32_t command,
     pa_pstream_send_simple_ack(c->pstream, tag);
 }
 
+static void command_set_playback_stream_codec(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
+    uint32_t idx;
+    const char *codec;
+    playback_stream *s;
+
+    pa_native_connection_assert_ref(c);
+    pa_assert(t);
+
+    if (pa_tagstruct_getu32(t, &idx) < 0 ||
+        pa_tagstruct_gets(t, &codec) < 0) {
+        protocol_error(c);
+        return;
+    }
+
+    CHECK_VALIDITY(c->pstream, c->authorized, tag, PA_ERR_ACCESS);
+    CHECK_VALIDITY(c->pstream, codec, tag, PA_ERR_INVALID);
+
+    s = pa_idxset_get_by_index(c->output_streams, idx);
+    CHECK_VALIDITY(c->pstream, s, tag, PA_ERR_NOENTITY);
+    CHECK_VALIDITY(c->pstream, playback_stream_isinstance(s), tag, PA_ERR_NOENTITY);
+
+#ifdef HAVE_OPUS
+    if (pa_streq(codec, "opus")) {
+        const pa_sample_spec *ss = &s->sink_input->sample_spec;
+        uint8_t streams, coupled_streams;
+        const void *mapping;
+        int err;
+
+        if (pa_tagstruct_getu8(t, &streams) < 0 ||
+            pa_tagstruct_getu8(t, &coupled_streams) < 0 ||
+            pa_tagstruct_get_arbitrary(t, &mapping, ss->channels) < 0 ||
+            !pa_tagstruct_eof(t)) {
+            protocol_error(c);
+            return;
+        }
+
+        CHECK_VALIDITY(c->pstream, !s->opus_decoder && !s->shm_ring, tag, PA_ERR_BADSTATE);
+        CHECK_VALIDITY(c->pstream, ss->format == PA_SAMPLE_FLOAT32NE || ss->format == PA_SAMPLE_S16NE, tag, PA_ERR_NOTSUPPORTED);
+        CHECK_VALIDITY(c->pstream,
+                       ss->rate == 8000 || ss->rate == 12000 || ss->rate == 16000 || ss->rate == 24000 || ss->rate == 48000,
+                       tag, PA_ERR_NOTSUPPORTED);
+
+        s->opus_decoder = opus_multistream_decoder_create((opus_int32) ss->rate, ss->channels, streams, coupled_streams, mapping, &err);
+        CHECK_VALIDITY(c->pstream, s->opus_decoder, tag, PA_ERR_INVALID);
+
+        s->codec_buffer = pa_xmalloc(2 + CODEC_PACKET_MAX);
+        s->codec_buffer_length = 0;
+
+        pa_log_debug("Playback stream %u now sends Opus packets (%u streams, %u coupled).", s->index, streams, coupled_streams);
+
+        pa_pstream_send_simple_ack(c->pstream, tag);
+        return;
+    }
+#endif
+
+    pa_pstream_send_error(c->pstream, tag, PA_ERR_NOTSUPPORTED);
+}
+
+static void command_set_playback_stream_shm_ring(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
+    uint32_t idx;
+    playback_stream *s;
+    pa_shmring *ring;
+    int fds[2];
+    unsigned n_fds;
+
+    pa_native_connection_assert_ref(c);
+    pa_assert(t);
+
+    if (pa_tagstruct_getu32(t, &idx) < 0 ||
+        !pa_tagstruct_eof(t)) {
+        protocol_error(c);
+        return;
+    }
+
+    CHECK_VALIDITY(c->pstream, c->authorized, tag, PA_ERR_ACCESS);
+
+    s = pa_idxset_get_by_index(c->output_streams, idx);
+    CHECK_VALIDITY(c->pstream, s, tag, PA_ERR_NOENTITY);
+    CHECK_VALIDITY(c->pstream, playback_stream_isinstance(s), tag, PA_ERR_NOENTITY);
+    CHECK_VALIDITY(c->pstream, !s->shm_ring, tag, PA_ERR_BADSTATE);
+#ifdef HAVE_OPUS
+    CHECK_VALIDITY(c->pstream, !s->opus_decoder, tag, PA_ERR_BADSTATE);
+#endif
+
+    /* The memfd of the ring and the eventfd of its fdsem come with the
+     * packet, anything we don't take is closed after this call */
+    if ((n_fds = pa_pstream_take_packet_fds(c->pstream, fds, 2)) < 2) {
+        while (n_fds > 0)
+            pa_close(fds[--n_fds]);
+
+        pa_pstream_send_error(c->pstream, tag, PA_ERR_INVALID);
+        return;
+    }
+
+    ring = pa_shmring_open(fds[0], fds[1]);
+    CHECK_VALIDITY(c->pstream, ring, tag, PA_ERR_INVALID);
+
+    pa_assert_se(pa_asyncmsgq_send(s->sink_input->sink->asyncmsgq, PA_MSGOBJECT(s->sink_input), SINK_INPUT_MESSAGE_SET_SHM_RING, ring, 0, NULL) == 0);
+
+    pa_log_debug("Playback stream %u now writes into a SHM ring of %lu bytes.", s->index, (unsigned long) pa_shmring_get_size(ring));
+
+    pa_pstream_send_simple_ack(c->pstream, tag);
+}
+
+static void command_set_playback_stream_timing_push(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
+    uint32_t idx;
+    pa_usec_t threshold;
+    playback_stream *s;
+
+    pa_native_connection_assert_ref(c);
+    pa_assert(t);
+
+    if (pa_tagstruct_getu32(t, &idx) < 0 ||
+        pa_tagstruct_get_usec(t, &threshold) < 0 ||
+        !pa_tagstruct_eof(t)) {
+        protocol_error(c);
+        return;
+    }
+
+    CHECK_VALIDITY(c->pstream, c->authorized, tag, PA_ERR_ACCESS);
+
+    s = pa_idxset_get_by_index(c->output_streams, idx);
+    CHECK_VALIDITY(c->pstream, s, tag, PA_ERR_NOENTITY);
+    CHECK_VALIDITY(c->pstream, playback_stream_isinstance(s), tag, PA_ERR_NOENTITY);
+
+    /* Nothing is pushed before the client asked for timing info once */
+    pa_assert_se(pa_asyncmsgq_send(s->sink_input->sink->asyncmsgq, PA_MSGOBJECT(s->sink_input), SINK_INPUT_MESSAGE_SET_TIMING_PUSH, NULL,
+                                   (int64_t) pa_usec_to_bytes(threshold, &s->sink_input->sample_spec), NULL) == 0);
+
+    pa_pstream_send_simple_ack(c->pstream, tag);
+}
+
+static void command_set_playback_stream_adaptive_latency(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
+    uint32_t idx, max_tlength;
+    playback_stream *s;
+
+    pa_native_connection_assert_ref(c);
+    pa_assert(t);
+
+    if (pa_tagstruct_getu32(t, &idx) < 0 ||
+        pa_tagstruct_getu32(t, &max_tlength) < 0 ||
+        !pa_tagstruct_eof(t)) {
+        protocol_error(c);
+        return;
+    }
+
+    CHECK_VALIDITY(c->pstream, c->authorized, tag, PA_ERR_ACCESS);
+
+    s = pa_idxset_get_by_index(c->output_streams, idx);
+    CHECK_VALIDITY(c->pstream, s, tag, PA_ERR_NOENTITY);
+    CHECK_VALIDITY(c->pstream, playback_stream_isinstance(s), tag, PA_ERR_NOENTITY);
+
+    if (max_tlength == (uint32_t) -1) {
+        if (s->buffer_attr_req.maxlength != (uint32_t) -1)
+            max_tlength = s->buffer_attr.maxlength;
+        else
+            max_tlength = s->buffer_attr.tlength * ADAPT_MAX_FACTOR;
+    }
+
+    if (max_tlength > 0)
+        max_tlength = PA_CLAMP(max_tlength, s->buffer_attr.tlength, s->buffer_attr.maxlength);
+
+    pa_assert_se(pa_asyncmsgq_send(s->sink_input->sink->asyncmsgq, PA_MSGOBJECT(s->sink_input), SINK_INPUT_MESSAGE_SET_ADAPTIVE_LATENCY, NULL,
+                                   (int64_t) max_tlength, NULL) == 0);
+
+    pa_pstream_send_simple_ack(c->pstream, tag);
+}
+
+static void command_get_sink_levels(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
+    uint32_t idx;
+    pa_sink *s;
+    levels_watch *w;
+    pa_sink_levels l;
+    pa_tagstruct *reply;
+    pa_bool_t fresh = FALSE;
+
+    pa_native_connection_assert_ref(c);
+    pa_assert(t);
+
+    if (pa_tagstruct_getu32(t, &idx) < 0 ||
+        !pa_tagstruct_eof(t)) {
+        protocol_error(c);
+        return;
+    }
+
+    CHECK_VALIDITY(c->pstream, c->authorized, tag, PA_ERR_ACCESS);
+
+    s = pa_idxset_get_by_index(c->protocol->core->sinks, idx);
+    CHECK_VALIDITY(c->pstream, s, tag, PA_ERR_NOENTITY);
+
+    w = levels_watch_get(c, s);
+
+    if (!w->poll_event) {
+        w->poll_seq = pa_sink_levels_start(s);
+        w->poll_event = pa_core_rttime_new(c->protocol->core, pa_rtclock_now() + LEVELS_POLL_TIMEOUT, levels_poll_timeout_cb, w);
+        fresh = TRUE;
+    } else
+        pa_core_rttime_restart(c->protocol->core, w->poll_event, pa_rtclock_now() + LEVELS_POLL_TIMEOUT);
+
+    levels_get(s, &w->poll_seq, fresh, &l);
+
+    reply = reply_new(tag);
+    levels_put(reply, s, &l);
+    pa_pstream_send_tagstruct(c->pstream, reply);
+}
+
+static void command_set_sink_levels_push(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
+    uint32_t idx;
+    pa_usec_t interval;
+    pa_sink *s;
+    levels_watch *w;
+
+    pa_native_connection_assert_ref(c);
+    pa_assert(t);
+
+    if (pa_tagstruct_getu32(t, &idx) < 0 ||
+        pa_tagstruct_get_usec(t, &interval) < 0 ||
+        !pa_tagstruct_eof(t)) {
+        protocol_error(c);
+        return;
+    }
+
+    CHECK_VALIDITY(c->pstream, c->authorized, tag, PA_ERR_ACCESS);
+
+    s = pa_idxset_get_by_index(c->protocol->core->sinks, idx);
+    CHECK_VALIDITY(c->pstream, s, tag, PA_ERR_NOENTITY);
+
+    if (interval > 0) {
+        w = levels_watch_get(c, s);
+        w->push_interval = PA_CLAMP(interval, LEVELS_PUSH_INTERVAL_MIN, LEVELS_PUSH_INTERVAL_MAX);
+
+        if (!w->push_event) {
+            w->push_seq = pa_sink_levels_start(s);
+            w->push_event = pa_core_rttime_new(c->protocol->core, pa_rtclock_now() + w->push_interval, levels_push_cb, w);
+        } else
+            pa_core_rttime_restart(c->protocol->core, w->push_event, pa_rtclock_now() + w->push_interval);
+
+    } else if ((w = pa_hashmap_get(c->levels_watches, PA_UINT32_TO_PTR(s->index))) && w->push_event) {
+        c->protocol->core->mainloop->time_free(w->push_event);
+        w->push_event = NULL;
+        pa_sink_levels_stop(s);
+
+        levels_watch_release(w);
+    }
+
+    pa_pstream_send_simple_ack(c->pstream, tag);
+}
+
 /*** pstream callbacks ***/
 
 static void pstream_packet_callback(pa_pstream *p, pa_packet *packet, const pa_creds *creds, void *userdata) {
     pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
+    pa_cpu_accounting *accounting;
+    pa_cpu_account *account, *previous;
 
     pa_assert(p);
     pa_assert(packet);
     pa_native_connection_assert_ref(c);
 
+    /* The io event we are called from belongs to the module that
+     * accepted the connection, but the commands are the client's. The
+     * client might go away while we run them, hence the ref. */
+    accounting = c->protocol->core->cpu_accounting;
+    account = pa_cpu_account_ref(c->client->cpu_account);
+    previous = pa_cpu_accounting_set_current(accounting, account);
+
     if (pa_pdispatch_run(c->pdispatch, packet, creds, c) < 0) {
         pa_log("invalid packet.");
         native_connection_unlink(c);
     }
+
+    pa_cpu_accounting_set_current(accounting, previous);
+    pa_cpu_account_unref(account);
+}
+
+#ifdef HAVE_OPUS
+/* Called from main context */
+static void playback_stream_decode_packet(playback_stream *s, const uint8_t *p, size_t length) {
+    const pa_sample_spec *ss = &s->sink_input->sample_spec;
+    size_t fs = pa_frame_size(ss);
+    pa_memchunk chunk;
+    void *d;
+    int frames;
+
+    if ((frames = opus_packet_get_nb_samples(p, (opus_int32) length, (opus_int32) ss->rate)) <= 0) {
+        pa_log_debug("Client sent an invalid Opus packet.");
+        return;
+    }
+
+    chunk.memblock = pa_memblock_new(s->connection->protocol->core->mempool, (size_t) frames * fs);
+    chunk.index = 0;
+
+    d = pa_memblock_acquire(chunk.memblock);
+
+    if (ss->format == PA_SAMPLE_FLOAT32NE)
+        frames = opus_multistream_decode_float(s->opus_decoder, p, (opus_int32) length, d, frames, 0);
+    else
+        frames = opus_multistream_decode(s->opus_decoder, p, (opus_int32) length, d, frames, 0);
+
+    pa_memblock_release(chunk.memblock);
+
+    if (frames > 0) {
+        chunk.length = (size_t) frames * fs;
+
+        pa_atomic_inc(&s->seek_or_post_in_queue);
+        pa_asyncmsgq_post(s->sink_input->sink->asyncmsgq, PA_MSGOBJECT(s->sink_input), SINK_INPUT_MESSAGE_POST_DATA, NULL, 0, &chunk, NULL);
+    } else
+        pa_log_debug("Failed to decode Opus packet: %s", opus_strerror(frames));
+
+    pa_memblock_unref(chunk.memblock);
+}
+
+/* Called from main context. Packets are prefixed with their length as
+ * 16 bit big endian and may be split up arbitrarily by the pstream. */
+static void playback_stream_decode(playback_stream *s, const pa_memchunk *chunk) {
+    const uint8_t *d;
+    size_t n;
+
+    d = (const uint8_t*) pa_memblock_acquire(chunk->memblock) + chunk->index;
+    n = chunk->length;
+
+    while (n > 0) {
+        size_t want, l, packet_length;
+
+        if (s->codec_buffer_length < 2)
+            want = 2;
+        else
+            want = 2 + ((size_t) s->codec_buffer[0] << 8 | s->codec_buffer[1]);
+
+        l = PA_MIN(n, want - s->codec_buffer_length);
+        memcpy(s->codec_buffer + s->codec_buffer_length, d, l);
+        s->codec_buffer_length += l;
+        d += l;
+        n -= l;
+
+        if (s->codec_buffer_length < 2)
+            continue;
+
+        packet_length = (size_t) s->codec_buffer[0] << 8 | s->codec_buffer[1];
+
+        if (s->codec_buffer_length < 2 + packet_length)
+            continue;
+
+        if (packet_length > 0)
+            playback_stream_decode_packet(s, s->codec_buffer + 2, packet_length);
+
+        s->codec_buffer_length = 0;
+    }
+
+    pa_memblock_release(chunk->memblock);
 }
+#endif
 
 static void pstream_memblock_callback(pa_pstream *p, uint32_t channel, int64_t offset, pa_seek_mode_t seek, const pa_memchunk *chunk, void *userdata) {
     pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
@@ -4843,6 +6144,17 @@ static void pstream_memblock_callback(pa_pstream *p, uint32_t channel, int64_t o
     if (playback_stream_isinstance(stream)) {
         playback_stream *ps = PLAYBACK_STREAM(stream);
 
+#ifdef HAVE_OPUS
+        if (ps->opus_decoder) {
+            if (chunk->memblock && seek == PA_SEEK_RELATIVE && offset == 0)
+                playback_stream_decode(ps, chunk);
+            else
+                pa_log_debug("Ignoring seek on a compressed stream.");
+
+            return;
+        }
+#endif
+
         pa_atomic_inc(&ps->seek_or_post_in_queue);
         if (chunk->memblock) {
             if (seek != PA_SEEK_RELATIVE || offset != 0)
@@ -4981,6 +6293,7 @@ void pa_native_protocol_connect(pa_native_protocol *p, pa_iochannel *io, pa_nati
     char pname[128];
     pa_client *client;
     pa_client_new_data data;
+    pa_cpu_account *previous_account;
 
     pa_assert(p);
     pa_assert(io);
@@ -5004,6 +6317,9 @@ void pa_native_protocol_connect(pa_native_protocol *p, pa_iochannel *io, pa_nati
     if (!client)
         return;
 
+    /* The events created for the connection are the client's */
+    previous_account = pa_cpu_accounting_set_current(p->core->cpu_accounting, client->cpu_account);
+
     c = pa_msgobject_new(pa_native_connection);
     c->parent.parent.free = native_connection_free;
     c->parent.process_msg = native_connection_process_msg;
@@ -5037,7 +6353,22 @@ void pa_native_protocol_connect(pa_native_protocol *p, pa_iochannel *io, pa_nati
     c->client->send_event = client_send_event_cb;
     c->client->userdata = c;
 
-    c->pstream = pa_pstream_new(p->core->mainloop, io, p->core->mempool);
+    /* Local clients get a shared pool of their own, so that the
+     * blocks exported to them, and their revocation when they go
+     * away, are accounted separately from everybody else's. */
+    c->mempool = NULL;
+    if (c->is_local && pa_mempool_is_shared(p->core->mempool)) {
+        if (!(c->mempool = pa_mempool_new_extended(TRUE, p->core->shm_size, p->core->shm_huge_pages, FALSE)))
+            pa_log_warn("Failed to allocate connection memory pool, using the global one.");
+        else
+            pa_mempool_set_owner(c->mempool, client->memowner);
+    }
+
+    if (!c->mempool)
+        c->mempool = pa_mempool_ref(p->core->mempool);
+
+    c->pstream = pa_pstream_new(p->core->mainloop, io, c->mempool);
+    pa_pstream_set_memowner(c->pstream, client->memowner);
     pa_pstream_set_receive_packet_callback(c->pstream, pstream_packet_callback, c);
     pa_pstream_set_receive_memblock_callback(c->pstream, pstream_memblock_callback, c);
     pa_pstream_set_die_callback(c->pstream, pstream_die_callback, c);
@@ -5049,10 +6380,14 @@ void pa_native_protocol_connect(pa_native_protocol *p, pa_iochannel *io, pa_nati
 
     c->record_streams = pa_idxset_new(NULL, NULL);
     c->output_streams = pa_idxset_new(NULL, NULL);
+    c->levels_watches = pa_hashmap_new(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func);
 
     c->rrobin_index = PA_IDXSET_INVALID;
     c->subscription = NULL;
 
+    c->request_event = p->core->mainloop->defer_new(p->core->mainloop, request_batch_cb, c);
+    p->core->mainloop->defer_enable(c->request_event, 0);
+
     pa_idxset_put(p->connections, c, NULL);
 
 #ifdef HAVE_CREDS
@@ -5060,6 +6395,13 @@ void pa_native_protocol_connect(pa_native_protocol *p, pa_iochannel *io, pa_nati
         pa_iochannel_creds_enable(io);
 #endif
 
+    if (o->n_io_threads > 0) {
+        pa_pstream_set_io_worker(c->pstream, o->io_threads[o->next_io_thread].worker);
+        o->next_io_thread = (o->next_io_thread + 1) % o->n_io_threads;
+    }
+
+    pa_cpu_accounting_set_current(p->core->cpu_accounting, previous_account);
+
     pa_hook_fire(&p->hooks[PA_NATIVE_HOOK_CONNECTION_PUT], c);
 }
 
@@ -5196,6 +6538,69 @@ void pa_native_protocol_remove_ext(pa_native_protocol *p, pa_module *m) {
     pa_assert_se(pa_hashmap_remove(p->extensions, m));
 }
 
+static void io_thread_func(void *userdata) {
+    struct pa_native_io_thread *t = userdata;
+
+    pa_assert(t);
+
+    pa_log_debug("I/O thread starting up");
+
+    if (pa_mainloop_run(t->mainloop, NULL) < 0)
+        pa_log_error("I/O thread main loop failed.");
+
+    pa_log_debug("I/O thread shutting down");
+}
+
+/* Called from I/O thread context */
+static void io_thread_quit_cb(void *object, void *userdata) {
+    pa_mainloop_quit(object, 0);
+}
+
+static void io_threads_free(pa_native_options *o) {
+    unsigned i;
+
+    for (i = 0; i < o->n_io_threads; i++) {
+        struct pa_native_io_thread *t = &o->io_threads[i];
+
+        if (t->thread) {
+            pa_io_worker_run(t->worker, io_thread_quit_cb, t->mainloop, NULL);
+            pa_thread_free(t->thread);
+        }
+
+        pa_io_worker_free(t->worker);
+        pa_mainloop_free(t->mainloop);
+    }
+
+    pa_xfree(o->io_threads);
+    o->io_threads = NULL;
+    o->n_io_threads = o->next_io_thread = 0;
+}
+
+/* The connections only ever read from their sockets in these threads. The
+ * commands are still dispatched from the main loop. */
+static int io_threads_new(pa_native_options *o, pa_core *c, unsigned n) {
+    unsigned i;
+
+    pa_assert(!o->io_threads);
+
+    o->io_threads = pa_xnew0(struct pa_native_io_thread, n);
+
+    for (i = 0; i < n; i++) {
+        struct pa_native_io_thread *t = &o->io_threads[i];
+
+        t->mainloop = pa_mainloop_new();
+        t->worker = pa_io_worker_new(c->mainloop, pa_mainloop_get_api(t->mainloop));
+        o->n_io_threads++;
+
+        if (!(t->thread = pa_thread_new("native-io", io_thread_func, t))) {
+            pa_log("Failed to create I/O thread.");
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
 pa_native_options* pa_native_options_new(void) {
     pa_native_options *o;
 
@@ -5229,12 +6634,16 @@ void pa_native_options_unref(pa_native_options *o) {
     if (o->auth_cookie)
         pa_auth_cookie_unref(o->auth_cookie);
 
+    if (o->io_threads)
+        io_threads_free(o);
+
     pa_xfree(o);
 }
 
 int pa_native_options_parse(pa_native_options *o, pa_core *c, pa_modargs *ma) {
     pa_bool_t enabled;
     const char *acl;
+    uint32_t n_io_threads;
 
     pa_assert(o);
     pa_assert(PA_REFCNT_VALUE(o) >= 1);
@@ -5309,6 +6718,16 @@ int pa_native_options_parse(pa_native_options *o, pa_core *c, pa_modargs *ma) {
     } else
           o->auth_cookie = NULL;
 
+    n_io_threads = o->n_io_threads;
+    if (pa_modargs_get_value_u32(ma, "io-threads", &n_io_threads) < 0 || n_io_threads > IO_THREADS_MAX) {
+        pa_log("io-threads= expects a number between 0 and %u.", IO_THREADS_MAX);
+        return -1;
+    }
+
+    /* Connections might be using the threads we have already */
+    if (n_io_threads > 0 && !o->io_threads && io_threads_new(o, c, n_io_threads) < 0)
+        return -1;
+
     return 0;
 }
 
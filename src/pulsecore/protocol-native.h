@@ -47,6 +47,10 @@ typedef struct pa_native_options {
     char *auth_group;
     pa_ip_acl *auth_ip_acl;
     pa_auth_cookie *auth_cookie;
+
+    /* Threads that read from the connections, assigned round robin */
+    struct pa_native_io_thread *io_threads;
+    unsigned n_io_threads, next_io_thread;
 } pa_native_options;
 
 typedef enum pa_native_hook {
@@ -27,6 +27,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <errno.h>
 
 #ifdef HAVE_NETINET_IN_H
 #include <netinet/in.h>
@@ -35,12 +36,17 @@
 #include <pulse/xmalloc.h>
 
 #include <pulsecore/socket.h>
+#include <pulsecore/atomic.h>
 #include <pulsecore/queue.h>
 #include <pulsecore/log.h>
 #include <pulsecore/creds.h>
 #include <pulsecore/refcnt.h>
 #include <pulsecore/flist.h>
+#include <pulsecore/idxset.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/core-error.h>
 #include <pulsecore/macro.h>
+#include <pulsecore/trace.h>
 
 #include "pstream.h"
 
@@ -49,8 +55,15 @@
 #define PA_FLAG_SHMRELEASE 0x40000000LU
 #define PA_FLAG_SHMREVOKE  0xC0000000LU
 #define PA_FLAG_SHMMASK    0xFF000000LU
+
+/* Set on the first SHM memblock frame that refers to a memfd segment, the
+ * memfd is passed along with the frame */
+#define PA_FLAG_SHMDATA_MEMFD_BLOCK 0x20000000LU
 #define PA_FLAG_SEEKMASK   0x000000FFLU
 
+/* Set on packet frames that have file descriptors passed along with them */
+#define PA_FLAG_PACKET_FDS 0x00010000LU
+
 /* The sequence descriptor header consists of 5 32bit integers: */
 enum {
     PA_PSTREAM_DESCRIPTOR_LENGTH,
@@ -74,7 +87,18 @@ typedef uint32_t pa_pstream_descriptor[PA_PSTREAM_DESCRIPTOR_MAX];
 
 #define PA_PSTREAM_DESCRIPTOR_SIZE (PA_PSTREAM_DESCRIPTOR_MAX*sizeof(uint32_t))
 
-#define MINIBUF_SIZE (256)
+/* How many queued items do_write() sends with one writev() call, and how
+ * much payload it gathers at most before it stops adding items */
+#define WRITE_ITEMS_MAX (PA_IOCHANNEL_IOV_MAX/2)
+#define WRITE_BATCH_BYTES (64*1024)
+
+/* do_read() reads into a buffer of this size and parses as many frames
+ * from it as it holds. Only payloads that do not fit are read in place. */
+#define READ_BUFFER_SIZE (16*1024)
+
+/* With an I/O worker, reading stops while this many bytes of received data
+ * wait for the main loop */
+#define WORKER_PENDING_MAX (256*1024)
 
 /* To allow uploading a single sample in one frame, this value should be the
  * same size (16 MB) as PA_SCACHE_ENTRY_SIZE_MAX from pulsecore/core-scache.h.
@@ -106,6 +130,18 @@ struct item_info {
 
     /* release/revoke info */
     uint32_t block_id;
+
+    /* The frame header as it goes over the wire, filled in by
+     * prepare_write_item(). For SHM blocks the SHM info follows the
+     * descriptor directly. */
+    uint32_t header[PA_PSTREAM_DESCRIPTOR_MAX + PA_PSTREAM_SHM_MAX];
+    size_t header_size;
+    int memfd;
+
+    /* Descriptors owned by a packet item, to be sent or received along
+     * with it */
+    int fds[PA_IOCHANNEL_FDS_MAX];
+    unsigned n_fds;
 };
 
 struct pa_pstream {
@@ -119,18 +155,16 @@ struct pa_pstream {
 
     pa_bool_t dead;
 
+    /* Items taken from the send queue whose headers are prepared. The
+     * first one has been written up to index. */
     struct {
-        union {
-            uint8_t minibuf[MINIBUF_SIZE];
-            pa_pstream_descriptor descriptor;
-        };
-        struct item_info* current;
-        void *data;
+        struct item_info *items[WRITE_ITEMS_MAX];
+        unsigned n_items;
         size_t index;
-        int minibuf_validsize;
-        pa_memchunk memchunk;
     } write;
 
+    /* While index is non-zero the payload of the current frame is read
+     * directly into packet or memblock */
     struct {
         pa_pstream_descriptor descriptor;
         pa_memblock *memblock;
@@ -138,15 +172,32 @@ struct pa_pstream {
         uint32_t shm_info[PA_PSTREAM_SHM_MAX];
         void *data;
         size_t index;
+
+        /* Descriptors received along with data not parsed yet */
+        int fds[PA_IOCHANNEL_FDS_MAX];
+        unsigned n_fds;
+
+        /* Received data that has not been parsed into frames yet */
+        uint8_t buffer[READ_BUFFER_SIZE];
+        size_t buffer_index, buffer_length;
     } read;
 
     pa_bool_t use_shm;
+    pa_bool_t use_memfd;
+
+    /* The memfd segments we already passed to the peer */
+    pa_idxset *memfd_ids;
+
     pa_memimport *import;
     pa_memexport *export;
 
     pa_pstream_packet_cb_t receive_packet_callback;
     void *receive_packet_callback_userdata;
 
+    /* The descriptors of the packet that is being dispatched */
+    int *packet_fds;
+    unsigned *n_packet_fds;
+
     pa_pstream_memblock_cb_t receive_memblock_callback;
     void *receive_memblock_callback_userdata;
 
@@ -164,21 +215,39 @@ struct pa_pstream {
 
     pa_mempool *mempool;
 
+    /* Current while reading and dispatching, or NULL */
+    pa_memowner *memowner;
+
 #ifdef HAVE_CREDS
-    pa_creds read_creds, write_creds;
-    pa_bool_t read_creds_valid, send_creds_now;
+    pa_creds read_creds;
+    pa_bool_t read_creds_valid;
 #endif
+
+    /* If set, reading happens on read_io in the worker thread and the
+     * frames are passed on to the main loop */
+    pa_io_worker *worker;
+    pa_iochannel *read_io;
+    int read_fd;
+    pa_bool_t read_fd_owned;
+    pa_atomic_t pending;
+    pa_atomic_t paused;
 };
 
 static int do_write(pa_pstream *p);
 static int do_read(pa_pstream *p);
+static void reader_stop_cb(void *object, void *userdata);
 
 static void do_pstream_read_write(pa_pstream *p) {
+    pa_memowner *previous_owner = NULL;
+
     pa_assert(p);
     pa_assert(PA_REFCNT_VALUE(p) > 0);
 
     pa_pstream_ref(p);
 
+    if (p->memowner)
+        previous_owner = pa_memowner_set_current(p->memowner);
+
     p->mainloop->defer_enable(p->defer_event, 0);
 
     if (!p->dead && pa_iochannel_is_readable(p->io)) {
@@ -195,6 +264,9 @@ static void do_pstream_read_write(pa_pstream *p) {
             break;
     }
 
+    if (p->memowner)
+        pa_memowner_set_current(previous_owner);
+
     pa_pstream_unref(p);
     return;
 
@@ -203,6 +275,9 @@ fail:
     if (p->die_callback)
         p->die_callback(p, p->die_callback_userdata);
 
+    if (p->memowner)
+        pa_memowner_set_current(previous_owner);
+
     pa_pstream_unlink(p);
     pa_pstream_unref(p);
 }
@@ -249,15 +324,18 @@ pa_pstream *pa_pstream_new(pa_mainloop_api *m, pa_iochannel *io, pa_mempool *poo
 
     p->send_queue = pa_queue_new();
 
-    p->write.current = NULL;
+    p->write.n_items = 0;
     p->write.index = 0;
-    pa_memchunk_reset(&p->write.memchunk);
     p->read.memblock = NULL;
     p->read.packet = NULL;
     p->read.index = 0;
+    p->read.n_fds = 0;
+    p->read.buffer_index = p->read.buffer_length = 0;
 
     p->receive_packet_callback = NULL;
     p->receive_packet_callback_userdata = NULL;
+    p->packet_fds = NULL;
+    p->n_packet_fds = NULL;
     p->receive_memblock_callback = NULL;
     p->receive_memblock_callback_userdata = NULL;
     p->drain_callback = NULL;
@@ -270,8 +348,11 @@ pa_pstream *pa_pstream_new(pa_mainloop_api *m, pa_iochannel *io, pa_mempool *poo
     p->release_callback_userdata = NULL;
 
     p->mempool = pool;
+    p->memowner = NULL;
 
     p->use_shm = FALSE;
+    p->use_memfd = FALSE;
+    p->memfd_ids = NULL;
     p->export = NULL;
 
     /* We do importing unconditionally */
@@ -281,16 +362,34 @@ pa_pstream *pa_pstream_new(pa_mainloop_api *m, pa_iochannel *io, pa_mempool *poo
     pa_iochannel_socket_set_sndbuf(io, pa_mempool_block_size_max(p->mempool));
 
 #ifdef HAVE_CREDS
-    p->send_creds_now = FALSE;
     p->read_creds_valid = FALSE;
 #endif
+
+    p->worker = NULL;
+    p->read_io = NULL;
+    p->read_fd = -1;
+    p->read_fd_owned = FALSE;
+    pa_atomic_store(&p->pending, 0);
+    pa_atomic_store(&p->paused, 0);
+
     return p;
 }
 
+static void close_fds(int *fds, unsigned *n_fds) {
+    unsigned k;
+
+    for (k = 0; k < *n_fds; k++)
+        pa_close(fds[k]);
+
+    *n_fds = 0;
+}
+
 static void item_free(void *item) {
     struct item_info *i = item;
     pa_assert(i);
 
+    close_fds(i->fds, &i->n_fds);
+
     if (i->type == PA_PSTREAM_ITEM_MEMBLOCK) {
         pa_assert(i->chunk.memblock);
         pa_memblock_unref(i->chunk.memblock);
@@ -304,17 +403,16 @@ static void item_free(void *item) {
 }
 
 static void pstream_free(pa_pstream *p) {
+    unsigned i;
+
     pa_assert(p);
 
     pa_pstream_unlink(p);
 
     pa_queue_free(p->send_queue, item_free);
 
-    if (p->write.current)
-        item_free(p->write.current);
-
-    if (p->write.memchunk.memblock)
-        pa_memblock_unref(p->write.memchunk.memblock);
+    for (i = 0; i < p->write.n_items; i++)
+        item_free(p->write.items[i]);
 
     if (p->read.memblock)
         pa_memblock_unref(p->read.memblock);
@@ -322,15 +420,30 @@ static void pstream_free(pa_pstream *p) {
     if (p->read.packet)
         pa_packet_unref(p->read.packet);
 
+    close_fds(p->read.fds, &p->read.n_fds);
+
+    if (p->memfd_ids)
+        pa_idxset_free(p->memfd_ids, NULL);
+
+    if (p->memowner)
+        pa_memowner_unref(p->memowner);
+
     pa_xfree(p);
 }
 
 void pa_pstream_send_packet(pa_pstream*p, pa_packet *packet, const pa_creds *creds) {
+    pa_pstream_send_packet_with_fds(p, packet, creds, NULL, 0);
+}
+
+void pa_pstream_send_packet_with_fds(pa_pstream*p, pa_packet *packet, const pa_creds *creds, const int *fds, unsigned n_fds) {
     struct item_info *i;
+    unsigned k;
 
     pa_assert(p);
     pa_assert(PA_REFCNT_VALUE(p) > 0);
     pa_assert(packet);
+    pa_assert(n_fds <= PA_IOCHANNEL_FDS_MAX);
+    pa_assert(n_fds == 0 || (p->use_memfd && !creds));
 
     if (p->dead)
         return;
@@ -340,6 +453,20 @@ void pa_pstream_send_packet(pa_pstream*p, pa_packet *packet, const pa_creds *cre
 
     i->type = PA_PSTREAM_ITEM_PACKET;
     i->packet = pa_packet_ref(packet);
+    i->n_fds = 0;
+
+    /* The caller may close its descriptors before the packet went out */
+    for (k = 0; k < n_fds; k++) {
+        int fd;
+
+        if ((fd = dup(fds[k])) < 0) {
+            pa_log_error("dup() failed: %s", pa_cstrerror(errno));
+            break;
+        }
+
+        pa_make_fd_cloexec(fd);
+        i->fds[i->n_fds++] = fd;
+    }
 
 #ifdef HAVE_CREDS
     if ((i->with_creds = !!creds))
@@ -384,6 +511,7 @@ void pa_pstream_send_memblock(pa_pstream*p, uint32_t channel, int64_t offset, pa
         i->channel = channel;
         i->offset = offset;
         i->seek_mode = seek_mode;
+        i->n_fds = 0;
 #ifdef HAVE_CREDS
         i->with_creds = FALSE;
 #endif
@@ -411,6 +539,7 @@ void pa_pstream_send_release(pa_pstream *p, uint32_t block_id) {
         item = pa_xnew(struct item_info, 1);
     item->type = PA_PSTREAM_ITEM_SHMRELEASE;
     item->block_id = block_id;
+    item->n_fds = 0;
 #ifdef HAVE_CREDS
     item->with_creds = FALSE;
 #endif
@@ -448,6 +577,7 @@ void pa_pstream_send_revoke(pa_pstream *p, uint32_t block_id) {
         item = pa_xnew(struct item_info, 1);
     item->type = PA_PSTREAM_ITEM_SHMREVOKE;
     item->block_id = block_id;
+    item->n_fds = 0;
 #ifdef HAVE_CREDS
     item->with_creds = FALSE;
 #endif
@@ -469,69 +599,66 @@ static void memexport_revoke_cb(pa_memexport *e, uint32_t block_id, void *userda
         pa_pstream_send_revoke(p, block_id);
 }
 
-static void prepare_next_write_item(pa_pstream *p) {
+static void prepare_write_item(pa_pstream *p, struct item_info *i) {
     pa_assert(p);
     pa_assert(PA_REFCNT_VALUE(p) > 0);
+    pa_assert(i);
 
-    p->write.current = pa_queue_pop(p->send_queue);
-
-    if (!p->write.current)
-        return;
-    p->write.index = 0;
-    p->write.data = NULL;
-    p->write.minibuf_validsize = 0;
-    pa_memchunk_reset(&p->write.memchunk);
+    i->header_size = PA_PSTREAM_DESCRIPTOR_SIZE;
+    i->memfd = -1;
 
-    p->write.descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH] = 0;
-    p->write.descriptor[PA_PSTREAM_DESCRIPTOR_CHANNEL] = htonl((uint32_t) -1);
-    p->write.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI] = 0;
-    p->write.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_LO] = 0;
-    p->write.descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS] = 0;
+    i->header[PA_PSTREAM_DESCRIPTOR_LENGTH] = 0;
+    i->header[PA_PSTREAM_DESCRIPTOR_CHANNEL] = htonl((uint32_t) -1);
+    i->header[PA_PSTREAM_DESCRIPTOR_OFFSET_HI] = 0;
+    i->header[PA_PSTREAM_DESCRIPTOR_OFFSET_LO] = 0;
+    i->header[PA_PSTREAM_DESCRIPTOR_FLAGS] = 0;
 
-    if (p->write.current->type == PA_PSTREAM_ITEM_PACKET) {
+    if (i->type == PA_PSTREAM_ITEM_PACKET) {
 
-        pa_assert(p->write.current->packet);
-        p->write.data = p->write.current->packet->data;
-        p->write.descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH] = htonl((uint32_t) p->write.current->packet->length);
+        pa_assert(i->packet);
+        i->header[PA_PSTREAM_DESCRIPTOR_LENGTH] = htonl((uint32_t) i->packet->length);
 
-        if (p->write.current->packet->length <= MINIBUF_SIZE - PA_PSTREAM_DESCRIPTOR_SIZE) {
-            memcpy(&p->write.minibuf[PA_PSTREAM_DESCRIPTOR_SIZE], p->write.data, p->write.current->packet->length);
-            p->write.minibuf_validsize = PA_PSTREAM_DESCRIPTOR_SIZE + p->write.current->packet->length;
-        }
+        if (i->n_fds > 0)
+            i->header[PA_PSTREAM_DESCRIPTOR_FLAGS] = htonl(PA_FLAG_PACKET_FDS);
 
-    } else if (p->write.current->type == PA_PSTREAM_ITEM_SHMRELEASE) {
+    } else if (i->type == PA_PSTREAM_ITEM_SHMRELEASE) {
 
-        p->write.descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS] = htonl(PA_FLAG_SHMRELEASE);
-        p->write.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI] = htonl(p->write.current->block_id);
+        i->header[PA_PSTREAM_DESCRIPTOR_FLAGS] = htonl(PA_FLAG_SHMRELEASE);
+        i->header[PA_PSTREAM_DESCRIPTOR_OFFSET_HI] = htonl(i->block_id);
 
-    } else if (p->write.current->type == PA_PSTREAM_ITEM_SHMREVOKE) {
+    } else if (i->type == PA_PSTREAM_ITEM_SHMREVOKE) {
 
-        p->write.descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS] = htonl(PA_FLAG_SHMREVOKE);
-        p->write.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI] = htonl(p->write.current->block_id);
+        i->header[PA_PSTREAM_DESCRIPTOR_FLAGS] = htonl(PA_FLAG_SHMREVOKE);
+        i->header[PA_PSTREAM_DESCRIPTOR_OFFSET_HI] = htonl(i->block_id);
 
     } else {
         uint32_t flags;
         pa_bool_t send_payload = TRUE;
 
-        pa_assert(p->write.current->type == PA_PSTREAM_ITEM_MEMBLOCK);
-        pa_assert(p->write.current->chunk.memblock);
+        pa_assert(i->type == PA_PSTREAM_ITEM_MEMBLOCK);
+        pa_assert(i->chunk.memblock);
 
-        p->write.descriptor[PA_PSTREAM_DESCRIPTOR_CHANNEL] = htonl(p->write.current->channel);
-        p->write.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI] = htonl((uint32_t) (((uint64_t) p->write.current->offset) >> 32));
-        p->write.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_LO] = htonl((uint32_t) ((uint64_t) p->write.current->offset));
+        i->header[PA_PSTREAM_DESCRIPTOR_CHANNEL] = htonl(i->channel);
+        i->header[PA_PSTREAM_DESCRIPTOR_OFFSET_HI] = htonl((uint32_t) (((uint64_t) i->offset) >> 32));
+        i->header[PA_PSTREAM_DESCRIPTOR_OFFSET_LO] = htonl((uint32_t) ((uint64_t) i->offset));
 
-        flags = (uint32_t) (p->write.current->seek_mode & PA_FLAG_SEEKMASK);
+        flags = (uint32_t) (i->seek_mode & PA_FLAG_SEEKMASK);
 
         if (p->use_shm) {
             uint32_t block_id, shm_id;
             size_t offset, length;
-            uint32_t *shm_info = (uint32_t *) &p->write.minibuf[PA_PSTREAM_DESCRIPTOR_SIZE];
+            uint32_t *shm_info = i->header + PA_PSTREAM_DESCRIPTOR_MAX;
             size_t shm_size = sizeof(uint32_t) * PA_PSTREAM_SHM_MAX;
+            int memfd;
 
             pa_assert(p->export);
 
+            /* Peers that cannot receive the memfd get a copy */
+            if ((memfd = pa_memblock_get_memfd(i->chunk.memblock)) >= 0 && !p->use_memfd)
+                goto no_shm;
+
             if (pa_memexport_put(p->export,
-                                 p->write.current->chunk.memblock,
+                                 i->chunk.memblock,
                                  &block_id,
                                  &shm_id,
                                  &offset,
@@ -540,364 +667,761 @@ static void prepare_next_write_item(pa_pstream *p) {
                 flags |= PA_FLAG_SHMDATA;
                 send_payload = FALSE;
 
+                if (memfd >= 0 && pa_idxset_put(p->memfd_ids, PA_UINT32_TO_PTR(shm_id), NULL) >= 0) {
+                    flags |= PA_FLAG_SHMDATA_MEMFD_BLOCK;
+                    i->memfd = memfd;
+                }
+
                 shm_info[PA_PSTREAM_SHM_BLOCKID] = htonl(block_id);
                 shm_info[PA_PSTREAM_SHM_SHMID] = htonl(shm_id);
-                shm_info[PA_PSTREAM_SHM_INDEX] = htonl((uint32_t) (offset + p->write.current->chunk.index));
-                shm_info[PA_PSTREAM_SHM_LENGTH] = htonl((uint32_t) p->write.current->chunk.length);
+                shm_info[PA_PSTREAM_SHM_INDEX] = htonl((uint32_t) (offset + i->chunk.index));
+                shm_info[PA_PSTREAM_SHM_LENGTH] = htonl((uint32_t) i->chunk.length);
 
-                p->write.descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH] = htonl(shm_size);
-                p->write.minibuf_validsize = PA_PSTREAM_DESCRIPTOR_SIZE + shm_size;
+                i->header[PA_PSTREAM_DESCRIPTOR_LENGTH] = htonl(shm_size);
+                i->header_size = PA_PSTREAM_DESCRIPTOR_SIZE + shm_size;
             }
 /*             else */
 /*                 pa_log_warn("Failed to export memory block."); */
         }
 
-        if (send_payload) {
-            p->write.descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH] = htonl((uint32_t) p->write.current->chunk.length);
-            p->write.memchunk = p->write.current->chunk;
-            pa_memblock_ref(p->write.memchunk.memblock);
-            p->write.data = NULL;
-        }
+    no_shm:
+        if (send_payload)
+            i->header[PA_PSTREAM_DESCRIPTOR_LENGTH] = htonl((uint32_t) i->chunk.length);
 
-        p->write.descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS] = htonl(flags);
+        i->header[PA_PSTREAM_DESCRIPTOR_FLAGS] = htonl(flags);
     }
+}
+
+static size_t item_frame_size(struct item_info *i) {
+    return PA_PSTREAM_DESCRIPTOR_SIZE + ntohl(i->header[PA_PSTREAM_DESCRIPTOR_LENGTH]);
+}
 
+/* Credentials and file descriptors are attached to the first byte that a
+ * sendmsg() call transfers, hence such an item always starts a batch. */
+static pa_bool_t item_has_ancil(struct item_info *i) {
 #ifdef HAVE_CREDS
-    if ((p->send_creds_now = p->write.current->with_creds))
-        p->write_creds = p->write.current->creds;
+    return i->memfd >= 0 || i->n_fds > 0 || (i->type == PA_PSTREAM_ITEM_PACKET && i->with_creds);
+#else
+    return FALSE;
 #endif
 }
 
+static void prepare_next_write_items(pa_pstream *p) {
+    struct item_info *i;
+
+    pa_assert(p);
+    pa_assert(PA_REFCNT_VALUE(p) > 0);
+
+    while (p->write.n_items < WRITE_ITEMS_MAX && (i = pa_queue_pop(p->send_queue))) {
+        prepare_write_item(p, i);
+        p->write.items[p->write.n_items++] = i;
+    }
+}
+
 static int do_write(pa_pstream *p) {
-    void *d;
-    size_t l;
+    struct iovec iov[PA_IOCHANNEL_IOV_MAX];
+    pa_memblock *acquired[WRITE_ITEMS_MAX];
+    unsigned n_iov = 0, n_acquired = 0, n, k;
+    size_t l = 0, skip;
     ssize_t r;
-    pa_memblock *release_memblock = NULL;
 
     pa_assert(p);
     pa_assert(PA_REFCNT_VALUE(p) > 0);
 
-    if (!p->write.current)
-        prepare_next_write_item(p);
+    prepare_next_write_items(p);
 
-    if (!p->write.current)
+    if (p->write.n_items <= 0)
         return 0;
 
-    if (p->write.minibuf_validsize > 0) {
-        d = p->write.minibuf + p->write.index;
-        l = p->write.minibuf_validsize - p->write.index;
-    } else if (p->write.index < PA_PSTREAM_DESCRIPTOR_SIZE) {
-        d = (uint8_t*) p->write.descriptor + p->write.index;
-        l = PA_PSTREAM_DESCRIPTOR_SIZE - p->write.index;
-    } else {
-        pa_assert(p->write.data || p->write.memchunk.memblock);
+    /* Gather as many of the prepared frames as we may send in one go. Only
+     * the first one can be partially written already. */
+    skip = p->write.index;
 
-        if (p->write.data)
-            d = p->write.data;
-        else {
-            d = pa_memblock_acquire_chunk(&p->write.memchunk);
-            release_memblock = p->write.memchunk.memblock;
-        }
+    for (n = 0; n < p->write.n_items; n++) {
+        struct item_info *i = p->write.items[n];
+        size_t payload = item_frame_size(i) - i->header_size;
+
+        if (n > 0 && (item_has_ancil(i) || l >= WRITE_BATCH_BYTES))
+            break;
 
-        d = (uint8_t*) d + p->write.index - PA_PSTREAM_DESCRIPTOR_SIZE;
-        l = ntohl(p->write.descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH]) - (p->write.index - PA_PSTREAM_DESCRIPTOR_SIZE);
+        if (skip < i->header_size) {
+            iov[n_iov].iov_base = (uint8_t*) i->header + skip;
+            iov[n_iov].iov_len = i->header_size - skip;
+            l += iov[n_iov++].iov_len;
+            skip = 0;
+        } else
+            skip -= i->header_size;
+
+        if (payload > 0) {
+            void *d;
+
+            pa_assert(skip < payload);
+
+            if (i->type == PA_PSTREAM_ITEM_PACKET)
+                d = i->packet->data;
+            else {
+                pa_assert(i->type == PA_PSTREAM_ITEM_MEMBLOCK);
+
+                d = pa_memblock_acquire_chunk(&i->chunk);
+                acquired[n_acquired++] = i->chunk.memblock;
+            }
+
+            iov[n_iov].iov_base = (uint8_t*) d + skip;
+            iov[n_iov].iov_len = payload - skip;
+            l += iov[n_iov++].iov_len;
+            skip = 0;
+        }
     }
 
     pa_assert(l > 0);
 
 #ifdef HAVE_CREDS
-    if (p->send_creds_now) {
-
-        if ((r = pa_iochannel_write_with_creds(p->io, d, l, &p->write_creds)) < 0)
-            goto fail;
-
-        p->send_creds_now = FALSE;
+    if (p->write.index == 0 && item_has_ancil(p->write.items[0])) {
+        struct item_info *i = p->write.items[0];
+
+        if (i->memfd >= 0)
+            /* The fd stays owned by the segment, the kernel gives the peer
+             * its own copy */
+            r = pa_iochannel_writev_with_fds(p->io, iov, n_iov, &i->memfd, 1);
+        else if (i->n_fds > 0)
+            r = pa_iochannel_writev_with_fds(p->io, iov, n_iov, i->fds, i->n_fds);
+        else
+            r = pa_iochannel_writev_with_creds(p->io, iov, n_iov, &i->creds);
     } else
 #endif
+        r = pa_iochannel_writev(p->io, iov, n_iov);
 
-    if ((r = pa_iochannel_write(p->io, d, l)) < 0)
-        goto fail;
+    for (k = 0; k < n_acquired; k++)
+        pa_memblock_release(acquired[k]);
 
-    if (release_memblock)
-        pa_memblock_release(release_memblock);
+    if (r < 0)
+        return -1;
 
+    /* Retire everything that went out completely */
     p->write.index += (size_t) r;
+    n = 0;
 
-    if (p->write.index >= PA_PSTREAM_DESCRIPTOR_SIZE + ntohl(p->write.descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH])) {
-        pa_assert(p->write.current);
-        item_free(p->write.current);
-        p->write.current = NULL;
-
-        if (p->write.memchunk.memblock)
-            pa_memblock_unref(p->write.memchunk.memblock);
+    while (n < p->write.n_items && p->write.index >= item_frame_size(p->write.items[n])) {
+        p->write.index -= item_frame_size(p->write.items[n]);
+        PA_TRACE2(pstream_frame_sent, p, item_frame_size(p->write.items[n]));
+        item_free(p->write.items[n]);
+        n++;
+    }
 
-        pa_memchunk_reset(&p->write.memchunk);
+    if (n > 0) {
+        p->write.n_items -= n;
+        memmove(p->write.items, p->write.items + n, p->write.n_items * sizeof(struct item_info*));
 
         if (p->drain_callback && !pa_pstream_is_pending(p))
             p->drain_callback(p, p->drain_callback_userdata);
     }
 
     return (size_t) r == l ? 1 : 0;
+}
 
-fail:
+/* Read whatever is available into d, along with the credentials and
+ * file descriptors that might come with it */
+static ssize_t read_data(pa_pstream *p, void *d, size_t l) {
+    pa_iochannel *io = p->worker ? p->read_io : p->io;
+    ssize_t r;
 
-    if (release_memblock)
-        pa_memblock_release(release_memblock);
+#ifdef HAVE_CREDS
+    pa_bool_t b = 0;
+    int fds[PA_IOCHANNEL_FDS_MAX];
+    unsigned i, n_fds = p->use_memfd ? PA_IOCHANNEL_FDS_MAX : 0;
 
-    return -1;
+    if ((r = pa_iochannel_read_with_ancil(io, d, l, &p->read_creds, &b, fds, &n_fds)) <= 0)
+        return r;
+
+    p->read_creds_valid = p->read_creds_valid || b;
+
+    for (i = 0; i < n_fds; i++) {
+        if (p->read.n_fds < PA_IOCHANNEL_FDS_MAX)
+            p->read.fds[p->read.n_fds++] = fds[i];
+        else
+            pa_close(fds[i]);
+    }
+#else
+    r = pa_iochannel_read(io, d, l);
+#endif
+
+    return r;
 }
 
-static int do_read(pa_pstream *p) {
-    void *d;
-    size_t l;
-    ssize_t r;
-    pa_memblock *release_memblock = NULL;
-    pa_assert(p);
-    pa_assert(PA_REFCNT_VALUE(p) > 0);
+/* Validate a frame descriptor. Returns the payload length of packet and
+ * memblock frames, 0 for frames without payload or -1 on error. */
+static int64_t frame_check(pa_pstream *p) {
+    uint32_t flags, length, channel;
+
+    flags = ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS]);
+
+    if (!p->use_shm && (flags & PA_FLAG_SHMMASK) != 0) {
+        pa_log_warn("Received SHM frame on a socket where SHM is disabled.");
+        return -1;
+    }
+
+    if (flags == PA_FLAG_SHMRELEASE || flags == PA_FLAG_SHMREVOKE)
+        return 0;
+
+    length = ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH]);
+
+    if (length > FRAME_SIZE_MAX_ALLOW || length <= 0) {
+        pa_log_warn("Received invalid frame size: %lu", (unsigned long) length);
+        return -1;
+    }
+
+    channel = ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_CHANNEL]);
+
+    if (channel == (uint32_t) -1) {
+
+        if (flags == PA_FLAG_PACKET_FDS && !p->use_memfd) {
+            pa_log_warn("Received packet frame with file descriptors on a socket where memfd is disabled.");
+            return -1;
+        }
+
+        if (flags != 0 && flags != PA_FLAG_PACKET_FDS) {
+            pa_log_warn("Received packet frame with invalid flags value.");
+            return -1;
+        }
 
-    if (p->read.index < PA_PSTREAM_DESCRIPTOR_SIZE) {
-        d = (uint8_t*) p->read.descriptor + p->read.index;
-        l = PA_PSTREAM_DESCRIPTOR_SIZE - p->read.index;
     } else {
-        pa_assert(p->read.data || p->read.memblock);
 
-        if (p->read.data)
-            d = p->read.data;
-        else {
-            d = pa_memblock_acquire(p->read.memblock);
-            release_memblock = p->read.memblock;
+        if ((flags & PA_FLAG_SEEKMASK) > PA_SEEK_RELATIVE_END) {
+            pa_log_warn("Received memblock frame with invalid seek mode.");
+            return -1;
         }
 
-        d = (uint8_t*) d + p->read.index - PA_PSTREAM_DESCRIPTOR_SIZE;
-        l = ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH]) - (p->read.index - PA_PSTREAM_DESCRIPTOR_SIZE);
+        if ((flags & PA_FLAG_SHMMASK & ~PA_FLAG_SHMDATA_MEMFD_BLOCK) == PA_FLAG_SHMDATA) {
+
+            if ((flags & PA_FLAG_SHMDATA_MEMFD_BLOCK) && !p->use_memfd) {
+                pa_log_warn("Received memfd memblock frame on a socket where memfd is disabled.");
+                return -1;
+            }
+
+            if (length != sizeof(p->read.shm_info)) {
+                pa_log_warn("Received SHM memblock frame with invalid frame length.");
+                return -1;
+            }
+
+        } else if ((flags & PA_FLAG_SHMMASK) != 0) {
+            pa_log_warn("Received memblock frame with invalid flags value.");
+            return -1;
+        }
     }
 
+    return (int64_t) length;
+}
+
+static pa_bool_t frame_is_shm(pa_pstream *p) {
+    return (ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS]) & PA_FLAG_SHMMASK) != 0;
+}
+
+static pa_bool_t frame_is_packet(pa_pstream *p) {
+    return ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_CHANNEL]) == (uint32_t) -1;
+}
+
+/* The descriptors received so far belong to the current frame */
+static void take_read_fds(pa_pstream *p, int *fds, unsigned *n_fds) {
+    memcpy(fds, p->read.fds, p->read.n_fds * sizeof(int));
+    *n_fds = p->read.n_fds;
+    p->read.n_fds = 0;
+}
+
+static pa_bool_t packet_has_fds(pa_pstream *p) {
+    return ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS]) == PA_FLAG_PACKET_FDS;
+}
+
+static struct item_info* received_item_new(int type) {
+    struct item_info *i;
+
+    if (!(i = pa_flist_pop(PA_STATIC_FLIST_GET(items))))
+        i = pa_xnew(struct item_info, 1);
+
+    i->type = type;
+    i->packet = NULL;
+    i->chunk.memblock = NULL;
+    i->n_fds = 0;
 #ifdef HAVE_CREDS
-    {
-        pa_bool_t b = 0;
+    i->with_creds = FALSE;
+#endif
 
-        if ((r = pa_iochannel_read_with_creds(p->io, d, l, &p->read_creds, &b)) <= 0)
-            goto fail;
+    return i;
+}
 
-        p->read_creds_valid = p->read_creds_valid || b;
-    }
+/* Unlike item_free() this takes memblock items for SHM blocks that could
+ * not be imported */
+static void received_item_free(void *item) {
+    struct item_info *i = item;
+    pa_assert(i);
+
+    if (i->chunk.memblock)
+        pa_memblock_unref(i->chunk.memblock);
+
+    if (i->packet)
+        pa_packet_unref(i->packet);
+
+    close_fds(i->fds, &i->n_fds);
+
+    if (pa_flist_push(PA_STATIC_FLIST_GET(items), i) < 0)
+        pa_xfree(i);
+}
+
+static void reader_resume_cb(void *object, void *userdata);
+
+/* Called from main context, with an item the worker received */
+static void worker_item_cb(void *object, void *userdata) {
+    pa_pstream *p = object;
+    struct item_info *i = userdata;
+    pa_memowner *previous_owner = NULL;
+    int length = 0;
+
+    pa_assert(p);
+    pa_assert(PA_REFCNT_VALUE(p) > 0);
+    pa_assert(i);
+
+    pa_pstream_ref(p);
+
+    if (p->memowner)
+        previous_owner = pa_memowner_set_current(p->memowner);
+
+    switch (i->type) {
+
+        case PA_PSTREAM_ITEM_PACKET:
+            length = (int) i->packet->length;
+
+            p->packet_fds = i->fds;
+            p->n_packet_fds = &i->n_fds;
+
+            if (p->receive_packet_callback)
+#ifdef HAVE_CREDS
+                p->receive_packet_callback(p, i->packet, i->with_creds ? &i->creds : NULL, p->receive_packet_callback_userdata);
 #else
-    if ((r = pa_iochannel_read(p->io, d, l)) <= 0)
-        goto fail;
+                p->receive_packet_callback(p, i->packet, NULL, p->receive_packet_callback_userdata);
 #endif
 
-    if (release_memblock)
-        pa_memblock_release(release_memblock);
+            p->packet_fds = NULL;
+            p->n_packet_fds = NULL;
+            break;
 
-    p->read.index += (size_t) r;
+        case PA_PSTREAM_ITEM_MEMBLOCK:
+            length = (int) i->chunk.length;
 
-    if (p->read.index == PA_PSTREAM_DESCRIPTOR_SIZE) {
-        uint32_t flags, length, channel;
-        /* Reading of frame descriptor complete */
+            if (p->receive_memblock_callback)
+                p->receive_memblock_callback(p, i->channel, i->offset, i->seek_mode, &i->chunk, p->receive_memblock_callback_userdata);
+            break;
 
-        flags = ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS]);
+        case PA_PSTREAM_ITEM_SHMRELEASE:
+            if (p->export)
+                pa_memexport_process_release(p->export, i->block_id);
+            break;
 
-        if (!p->use_shm && (flags & PA_FLAG_SHMMASK) != 0) {
-            pa_log_warn("Received SHM frame on a socket where SHM is disabled.");
-            return -1;
-        }
+        case PA_PSTREAM_ITEM_SHMREVOKE:
+            if (p->import)
+                pa_memimport_process_revoke(p->import, i->block_id);
+            break;
+    }
 
-        if (flags == PA_FLAG_SHMRELEASE) {
+    received_item_free(i);
 
-            /* This is a SHM memblock release frame with no payload */
+    if (p->memowner)
+        pa_memowner_set_current(previous_owner);
 
-/*             pa_log("Got release frame for %u", ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI])); */
+    /* Let the worker read on once we caught up */
+    if (length > 0 &&
+        pa_atomic_sub(&p->pending, length) - length < WORKER_PENDING_MAX &&
+        !p->dead &&
+        pa_atomic_cmpxchg(&p->paused, 1, 0))
+        pa_io_worker_run(p->worker, reader_resume_cb, p, NULL);
 
-            pa_assert(p->export);
-            pa_memexport_process_release(p->export, ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI]));
+    pa_pstream_unref(p);
+}
 
-            goto frame_done;
+/* Called from worker context. The item and its references are passed on
+ * to the main loop. */
+static void worker_post_item(pa_pstream *p, struct item_info *i, size_t length) {
+    pa_atomic_add(&p->pending, (int) length);
+    pa_io_worker_post(p->worker, worker_item_cb, p, i, received_item_free);
+}
 
-        } else if (flags == PA_FLAG_SHMREVOKE) {
+/* Called from worker context */
+static void worker_post_packet(pa_pstream *p) {
+    struct item_info *i;
+    pa_packet *packet = p->read.packet;
 
-            /* This is a SHM memblock revoke frame with no payload */
+    i = received_item_new(PA_PSTREAM_ITEM_PACKET);
 
-/*             pa_log("Got revoke frame for %u", ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI])); */
+    /* Small packets point into the receive buffer, which is reused */
+    if (packet->type == PA_PACKET_FIXED) {
+        i->packet = pa_packet_new(packet->length);
+        memcpy(i->packet->data, packet->data, packet->length);
+    } else
+        i->packet = pa_packet_ref(packet);
 
-            pa_assert(p->import);
-            pa_memimport_process_revoke(p->import, ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI]));
+#ifdef HAVE_CREDS
+    if ((i->with_creds = p->read_creds_valid))
+        i->creds = p->read_creds;
+#endif
 
-            goto frame_done;
-        }
+    if (packet_has_fds(p))
+        take_read_fds(p, i->fds, &i->n_fds);
 
-        length = ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH]);
+    worker_post_item(p, i, packet->length);
+}
 
-        if (length > FRAME_SIZE_MAX_ALLOW || length <= 0) {
-            pa_log_warn("Received invalid frame size: %lu", (unsigned long) length);
-            return -1;
-        }
+/* Pass a chunk of the current memblock frame on to the user. With a worker
+ * the reference to chunk->memblock is taken over. */
+static void memblock_frame_deliver(pa_pstream *p, const pa_memchunk *chunk) {
+    uint32_t channel;
+    int64_t offset;
+    pa_seek_mode_t seek;
 
-        pa_assert(!p->read.packet && !p->read.memblock);
+    channel = ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_CHANNEL]);
+    seek = ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS]) & PA_FLAG_SEEKMASK;
+    offset = (int64_t) (
+            (((uint64_t) ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI])) << 32) |
+            (((uint64_t) ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_LO]))));
 
-        channel = ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_CHANNEL]);
+    if (p->worker) {
+        struct item_info *i;
 
-        if (channel == (uint32_t) -1) {
+        i = received_item_new(PA_PSTREAM_ITEM_MEMBLOCK);
+        i->chunk = *chunk;
+        i->channel = channel;
+        i->offset = offset;
+        i->seek_mode = seek;
 
-            if (flags != 0) {
-                pa_log_warn("Received packet frame with invalid flags value.");
-                return -1;
-            }
+        worker_post_item(p, i, chunk->length);
 
-            /* Frame is a packet frame */
-            p->read.packet = pa_packet_new(length);
-            p->read.data = p->read.packet->data;
+    } else if (p->receive_memblock_callback)
+        p->receive_memblock_callback(p, channel, offset, seek, chunk, p->receive_memblock_callback_userdata);
+}
 
-        } else {
+/* Pass the payload bytes [index - l, index) of a memblock frame on to the
+ * user */
+static void memblock_frame_data(pa_pstream *p, size_t l) {
+    pa_memchunk chunk;
 
-            if ((flags & PA_FLAG_SEEKMASK) > PA_SEEK_RELATIVE_END) {
-                pa_log_warn("Received memblock frame with invalid seek mode.");
-                return -1;
-            }
+    pa_assert(p->read.memblock);
 
-            if ((flags & PA_FLAG_SHMMASK) == PA_FLAG_SHMDATA) {
+    if (l <= 0)
+        return;
 
-                if (length != sizeof(p->read.shm_info)) {
-                    pa_log_warn("Received SHM memblock frame with invalid frame length.");
-                    return -1;
-                }
+    chunk.memblock = p->worker ? pa_memblock_ref(p->read.memblock) : p->read.memblock;
+    chunk.index = p->read.index - PA_PSTREAM_DESCRIPTOR_SIZE - l;
+    chunk.length = l;
 
-                /* Frame is a memblock frame referencing an SHM memblock */
-                p->read.data = p->read.shm_info;
+    memblock_frame_deliver(p, &chunk);
 
-            } else if ((flags & PA_FLAG_SHMMASK) == 0) {
+    /* Drop seek info for following callbacks */
+    p->read.descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS] =
+        p->read.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI] =
+        p->read.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_LO] = 0;
+}
 
-                /* Frame is a memblock frame */
+static void frame_done(pa_pstream *p) {
+    PA_TRACE2(pstream_frame_received, p, ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH]));
 
-                p->read.memblock = pa_memblock_new(p->mempool, length);
-                p->read.data = NULL;
-            } else {
+    p->read.memblock = NULL;
+    p->read.packet = NULL;
+    p->read.index = 0;
+    p->read.data = NULL;
+
+    /* Ancillary data stays around until everything that was read along
+     * with it has been parsed */
+    if (p->read.buffer_length > 0)
+        return;
+
+    /* Descriptors that came with a frame which did not need them */
+    close_fds(p->read.fds, &p->read.n_fds);
+
+#ifdef HAVE_CREDS
+    p->read_creds_valid = FALSE;
+#endif
+}
+
+/* Called when the whole payload of the current frame is available */
+static int frame_complete(pa_pstream *p) {
+
+    if (p->read.memblock) {
+
+        /* This was a memblock frame. We can unref the memblock now */
+        pa_memblock_unref(p->read.memblock);
+
+    } else if (p->read.packet) {
+
+        if (p->worker)
+            worker_post_packet(p);
+        else {
+            int fds[PA_IOCHANNEL_FDS_MAX];
+            unsigned n_fds = 0;
+
+            if (packet_has_fds(p))
+                take_read_fds(p, fds, &n_fds);
+
+            p->packet_fds = fds;
+            p->n_packet_fds = &n_fds;
+
+            if (p->receive_packet_callback)
+#ifdef HAVE_CREDS
+                p->receive_packet_callback(p, p->read.packet, p->read_creds_valid ? &p->read_creds : NULL, p->receive_packet_callback_userdata);
+#else
+                p->receive_packet_callback(p, p->read.packet, NULL, p->receive_packet_callback_userdata);
+#endif
+
+            p->packet_fds = NULL;
+            p->n_packet_fds = NULL;
+            close_fds(fds, &n_fds);
+        }
 
-                pa_log_warn("Received memblock frame with invalid flags value.");
+        if (p->read.packet->type == PA_PACKET_FIXED)
+            pa_packet_unref_fixed(p->read.packet);
+        else
+            pa_packet_unref(p->read.packet);
+
+    } else {
+        pa_memblock *b;
+        pa_memchunk chunk;
+        uint32_t flags = ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS]);
+
+        pa_assert((flags & PA_FLAG_SHMMASK & ~PA_FLAG_SHMDATA_MEMFD_BLOCK) == PA_FLAG_SHMDATA);
+
+        pa_assert(p->import);
+
+        if (flags & PA_FLAG_SHMDATA_MEMFD_BLOCK) {
+
+            if (p->read.n_fds <= 0) {
+                pa_log_warn("Received memfd memblock frame without a memfd.");
                 return -1;
             }
+
+            if (pa_memimport_attach_memfd(p->import, ntohl(p->read.shm_info[PA_PSTREAM_SHM_SHMID]), p->read.fds[0]) < 0)
+                pa_log_warn("Failed to attach memfd segment.");
+
+            p->read.n_fds--;
+            memmove(p->read.fds, p->read.fds + 1, p->read.n_fds * sizeof(int));
         }
 
-    } else if (p->read.index > PA_PSTREAM_DESCRIPTOR_SIZE) {
-        /* Frame payload available */
+        if (!(b = pa_memimport_get(p->import,
+                                  ntohl(p->read.shm_info[PA_PSTREAM_SHM_BLOCKID]),
+                                  ntohl(p->read.shm_info[PA_PSTREAM_SHM_SHMID]),
+                                  ntohl(p->read.shm_info[PA_PSTREAM_SHM_INDEX]),
+                                  ntohl(p->read.shm_info[PA_PSTREAM_SHM_LENGTH])))) {
 
-        if (p->read.memblock && p->receive_memblock_callback) {
+            if (pa_log_ratelimit(PA_LOG_DEBUG))
+                pa_log_debug("Failed to import memory block.");
+        }
 
-            /* Is this memblock data? Than pass it to the user */
-            l = (p->read.index - (size_t) r) < PA_PSTREAM_DESCRIPTOR_SIZE ? (size_t) (p->read.index - PA_PSTREAM_DESCRIPTOR_SIZE) : (size_t) r;
+        chunk.memblock = b;
+        chunk.index = 0;
+        chunk.length = b ? pa_memblock_get_length(b) : ntohl(p->read.shm_info[PA_PSTREAM_SHM_LENGTH]);
 
-            if (l > 0) {
-                pa_memchunk chunk;
+        /* The worker must not drop the last reference to an imported
+         * block, the release would be sent from its thread */
+        memblock_frame_deliver(p, &chunk);
 
-                chunk.memblock = p->read.memblock;
-                chunk.index = p->read.index - PA_PSTREAM_DESCRIPTOR_SIZE - l;
-                chunk.length = l;
+        if (b && !p->worker)
+            pa_memblock_unref(b);
+    }
 
-                if (p->receive_memblock_callback) {
-                    int64_t offset;
+    frame_done(p);
+    return 0;
+}
 
-                    offset = (int64_t) (
-                            (((uint64_t) ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI])) << 32) |
-                            (((uint64_t) ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_LO]))));
+static void buffer_consume(pa_pstream *p, size_t l) {
+    pa_assert(l <= p->read.buffer_length);
 
-                    p->receive_memblock_callback(
-                        p,
-                        ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_CHANNEL]),
-                        offset,
-                        ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS]) & PA_FLAG_SEEKMASK,
-                        &chunk,
-                        p->receive_memblock_callback_userdata);
-                }
+    p->read.buffer_index += l;
+    p->read.buffer_length -= l;
+}
 
-                /* Drop seek info for following callbacks */
-                p->read.descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS] =
-                    p->read.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI] =
-                    p->read.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_LO] = 0;
-            }
-        }
+/* Parse all complete frames in the receive buffer. The payload of a frame
+ * that is too large for the buffer is taken over by a packet or memblock
+ * of its own and read in place from then on. */
+static int parse_buffer(pa_pstream *p) {
 
-        /* Frame complete */
-        if (p->read.index >= ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH]) + PA_PSTREAM_DESCRIPTOR_SIZE) {
+    while (!p->dead && p->read.buffer_length >= PA_PSTREAM_DESCRIPTOR_SIZE) {
+        const uint8_t *d = p->read.buffer + p->read.buffer_index;
+        uint32_t flags;
+        int64_t length;
+        size_t l;
 
-            if (p->read.memblock) {
+        pa_assert(p->read.index == 0);
 
-                /* This was a memblock frame. We can unref the memblock now */
-                pa_memblock_unref(p->read.memblock);
+        memcpy(p->read.descriptor, d, PA_PSTREAM_DESCRIPTOR_SIZE);
 
-            } else if (p->read.packet) {
+        if ((length = frame_check(p)) < 0)
+            return -1;
 
-                if (p->receive_packet_callback)
-#ifdef HAVE_CREDS
-                    p->receive_packet_callback(p, p->read.packet, p->read_creds_valid ? &p->read_creds : NULL, p->receive_packet_callback_userdata);
-#else
-                    p->receive_packet_callback(p, p->read.packet, NULL, p->receive_packet_callback_userdata);
-#endif
+        flags = ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS]);
 
-                pa_packet_unref(p->read.packet);
-            } else {
-                pa_memblock *b;
+        if (length == 0) {
+
+            buffer_consume(p, PA_PSTREAM_DESCRIPTOR_SIZE);
+
+            if (p->worker) {
+                struct item_info *i;
+
+                /* Releases and revocations are processed in the main
+                 * loop, which owns the export */
+                i = received_item_new(flags == PA_FLAG_SHMRELEASE ? PA_PSTREAM_ITEM_SHMRELEASE : PA_PSTREAM_ITEM_SHMREVOKE);
+                i->block_id = ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI]);
 
-                pa_assert((ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS]) & PA_FLAG_SHMMASK) == PA_FLAG_SHMDATA);
+                worker_post_item(p, i, 0);
 
+            } else if (flags == PA_FLAG_SHMRELEASE) {
+
+                /* This is a SHM memblock release frame with no payload */
+                pa_assert(p->export);
+                pa_memexport_process_release(p->export, ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI]));
+
+            } else {
+
+                /* This is a SHM memblock revoke frame with no payload */
+                pa_assert(flags == PA_FLAG_SHMREVOKE);
                 pa_assert(p->import);
+                pa_memimport_process_revoke(p->import, ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI]));
+            }
 
-                if (!(b = pa_memimport_get(p->import,
-                                          ntohl(p->read.shm_info[PA_PSTREAM_SHM_BLOCKID]),
-                                          ntohl(p->read.shm_info[PA_PSTREAM_SHM_SHMID]),
-                                          ntohl(p->read.shm_info[PA_PSTREAM_SHM_INDEX]),
-                                          ntohl(p->read.shm_info[PA_PSTREAM_SHM_LENGTH])))) {
+            frame_done(p);
+            continue;
+        }
 
-                    if (pa_log_ratelimit(PA_LOG_DEBUG))
-                        pa_log_debug("Failed to import memory block.");
-                }
+        d += PA_PSTREAM_DESCRIPTOR_SIZE;
+        l = PA_MIN((size_t) length, p->read.buffer_length - PA_PSTREAM_DESCRIPTOR_SIZE);
 
-                if (p->receive_memblock_callback) {
-                    int64_t offset;
-                    pa_memchunk chunk;
-
-                    chunk.memblock = b;
-                    chunk.index = 0;
-                    chunk.length = b ? pa_memblock_get_length(b) : ntohl(p->read.shm_info[PA_PSTREAM_SHM_LENGTH]);
-
-                    offset = (int64_t) (
-                            (((uint64_t) ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI])) << 32) |
-                            (((uint64_t) ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_LO]))));
-
-                    p->receive_memblock_callback(
-                            p,
-                            ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_CHANNEL]),
-                            offset,
-                            ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS]) & PA_FLAG_SEEKMASK,
-                            &chunk,
-                            p->receive_memblock_callback_userdata);
-                }
+        if (frame_is_shm(p) || (frame_is_packet(p) && PA_PSTREAM_DESCRIPTOR_SIZE + (size_t) length <= READ_BUFFER_SIZE)) {
+
+            /* Wait until the whole frame is in the buffer */
+            if (l < (size_t) length)
+                break;
 
-                if (b)
-                    pa_memblock_unref(b);
+            if (frame_is_shm(p)) {
+                memcpy(p->read.shm_info, d, sizeof(p->read.shm_info));
+                buffer_consume(p, PA_PSTREAM_DESCRIPTOR_SIZE + l);
+            } else {
+                /* Small packets are passed on straight from the buffer.
+                 * The frame is consumed first so that frame_done() sees
+                 * whether anything else came with this read. */
+                p->read.packet = pa_packet_new_fixed((void*) d, l);
+                buffer_consume(p, PA_PSTREAM_DESCRIPTOR_SIZE + l);
             }
 
-            goto frame_done;
+            p->read.index = PA_PSTREAM_DESCRIPTOR_SIZE + l;
+
+            if (frame_complete(p) < 0)
+                return -1;
+
+            continue;
         }
+
+        /* Memblock frames and large packets get their own storage */
+        if (frame_is_packet(p)) {
+            p->read.packet = pa_packet_new((size_t) length);
+            p->read.data = p->read.packet->data;
+
+            memcpy(p->read.data, d, l);
+        } else {
+            void *m;
+
+            p->read.memblock = pa_memblock_new(p->mempool, (size_t) length);
+
+            m = pa_memblock_acquire(p->read.memblock);
+            memcpy(m, d, l);
+            pa_memblock_release(p->read.memblock);
+        }
+
+        buffer_consume(p, PA_PSTREAM_DESCRIPTOR_SIZE + l);
+        p->read.index = PA_PSTREAM_DESCRIPTOR_SIZE + l;
+
+        if (p->read.memblock)
+            memblock_frame_data(p, l);
+
+        if (l < (size_t) length) {
+            /* Read the rest in place */
+            pa_assert(p->read.buffer_length == 0);
+            break;
+        }
+
+        if (frame_complete(p) < 0)
+            return -1;
     }
 
     return 0;
+}
 
-frame_done:
-    p->read.memblock = NULL;
-    p->read.packet = NULL;
-    p->read.index = 0;
-    p->read.data = NULL;
+static int do_read(pa_pstream *p) {
+    void *d;
+    size_t l;
+    ssize_t r;
 
-#ifdef HAVE_CREDS
-    p->read_creds_valid = FALSE;
-#endif
+    pa_assert(p);
+    pa_assert(PA_REFCNT_VALUE(p) > 0);
 
-    return 0;
+    if (p->read.index > 0) {
+        pa_memblock *release_memblock = NULL;
 
-fail:
-    if (release_memblock)
-        pa_memblock_release(release_memblock);
+        /* The payload of the current frame goes directly to its final
+         * place */
+        pa_assert(p->read.index > PA_PSTREAM_DESCRIPTOR_SIZE);
+        pa_assert(p->read.data || p->read.memblock);
+        pa_assert(p->read.buffer_length == 0);
 
-    return -1;
+        if (p->read.data)
+            d = p->read.data;
+        else {
+            d = pa_memblock_acquire(p->read.memblock);
+            release_memblock = p->read.memblock;
+        }
+
+        d = (uint8_t*) d + p->read.index - PA_PSTREAM_DESCRIPTOR_SIZE;
+        l = ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH]) - (p->read.index - PA_PSTREAM_DESCRIPTOR_SIZE);
+
+        r = read_data(p, d, l);
+
+        if (release_memblock)
+            pa_memblock_release(release_memblock);
+
+        if (r <= 0)
+            return -1;
+
+        p->read.index += (size_t) r;
+
+        if (p->read.memblock)
+            memblock_frame_data(p, (size_t) r);
+
+        if (p->read.index >= ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH]) + PA_PSTREAM_DESCRIPTOR_SIZE)
+            return frame_complete(p);
+
+        return 0;
+    }
+
+    /* Move the remains of an incomplete frame to the front */
+    if (p->read.buffer_index > 0) {
+        memmove(p->read.buffer, p->read.buffer + p->read.buffer_index, p->read.buffer_length);
+        p->read.buffer_index = 0;
+    }
+
+    pa_assert(p->read.buffer_length < READ_BUFFER_SIZE);
+
+    if ((r = read_data(p, p->read.buffer + p->read.buffer_length, READ_BUFFER_SIZE - p->read.buffer_length)) <= 0)
+        return -1;
+
+    p->read.buffer_length += (size_t) r;
+
+    return parse_buffer(p);
+}
+
+void pa_pstream_set_memowner(pa_pstream *p, pa_memowner *o) {
+    pa_assert(p);
+    pa_assert(PA_REFCNT_VALUE(p) > 0);
+
+    if (o)
+        pa_memowner_ref(o);
+
+    if (p->memowner)
+        pa_memowner_unref(p->memowner);
+
+    p->memowner = o;
 }
 
 void pa_pstream_set_die_callback(pa_pstream *p, pa_pstream_notify_cb_t cb, void *userdata) {
@@ -957,7 +1481,7 @@ pa_bool_t pa_pstream_is_pending(pa_pstream *p) {
     if (p->dead)
         b = FALSE;
     else
-        b = p->write.current || !pa_queue_isempty(p->send_queue);
+        b = p->write.n_items > 0 || !pa_queue_isempty(p->send_queue);
 
     return b;
 }
@@ -986,6 +1510,14 @@ void pa_pstream_unlink(pa_pstream *p) {
 
     p->dead = TRUE;
 
+    if (p->worker) {
+        /* Once the worker let go of us, drop what it passed on and the
+         * main loop did not get to yet */
+        pa_io_worker_run_sync(p->worker, reader_stop_cb, p, NULL);
+        pa_io_worker_cancel(p->worker, p);
+        p->worker = NULL;
+    }
+
     if (p->import) {
         pa_memimport_free(p->import);
         p->import = NULL;
@@ -1038,3 +1570,169 @@ pa_bool_t pa_pstream_get_shm(pa_pstream *p) {
 
     return p->use_shm;
 }
+
+unsigned pa_pstream_take_packet_fds(pa_pstream *p, int *fds, unsigned n) {
+    unsigned k;
+
+    pa_assert(p);
+    pa_assert(PA_REFCNT_VALUE(p) > 0);
+    pa_assert(fds);
+
+    if (!p->n_packet_fds)
+        return 0;
+
+    k = PA_MIN(n, *p->n_packet_fds);
+    memcpy(fds, p->packet_fds, k * sizeof(int));
+
+    *p->n_packet_fds -= k;
+    memmove(p->packet_fds, p->packet_fds + k, *p->n_packet_fds * sizeof(int));
+
+    return k;
+}
+
+void pa_pstream_enable_memfd(pa_pstream *p) {
+    pa_assert(p);
+    pa_assert(PA_REFCNT_VALUE(p) > 0);
+
+    /* Descriptors are passed the same way as the credentials */
+#ifdef HAVE_CREDS
+    p->use_memfd = TRUE;
+
+    if (!p->memfd_ids)
+        p->memfd_ids = pa_idxset_new(NULL, NULL);
+#endif
+}
+
+/* Called from main context */
+static void worker_die_cb(void *object, void *userdata) {
+    pa_pstream *p = object;
+
+    pa_assert(p);
+    pa_assert(PA_REFCNT_VALUE(p) > 0);
+
+    pa_pstream_ref(p);
+
+    if (p->die_callback)
+        p->die_callback(p, p->die_callback_userdata);
+
+    pa_pstream_unlink(p);
+    pa_pstream_unref(p);
+}
+
+/* Called from worker context. Returns TRUE if the main loop is too far
+ * behind, reader_resume_cb() is run once it caught up. */
+static pa_bool_t reader_throttled(pa_pstream *p) {
+
+    if (pa_atomic_load(&p->pending) < WORKER_PENDING_MAX)
+        return FALSE;
+
+    pa_atomic_store(&p->paused, 1);
+
+    /* The main loop might have caught up in the meantime */
+    if (pa_atomic_load(&p->pending) < WORKER_PENDING_MAX && pa_atomic_cmpxchg(&p->paused, 1, 0))
+        return FALSE;
+
+    return TRUE;
+}
+
+/* Called from worker context */
+static void reader_read(pa_pstream *p) {
+
+    if (!p->read_io)
+        return;
+
+    if (pa_iochannel_is_readable(p->read_io)) {
+        pa_memowner *previous_owner = NULL;
+        int r;
+
+        /* While we do not read the iochannel does not poll either */
+        if (reader_throttled(p))
+            return;
+
+        if (p->memowner)
+            previous_owner = pa_memowner_set_current(p->memowner);
+
+        r = do_read(p);
+
+        if (p->memowner)
+            pa_memowner_set_current(previous_owner);
+
+        if (r >= 0)
+            return;
+
+    } else if (!pa_iochannel_is_hungup(p->read_io))
+        return;
+
+    pa_iochannel_free(p->read_io);
+    p->read_io = NULL;
+
+    pa_io_worker_post(p->worker, worker_die_cb, p, NULL, NULL);
+}
+
+/* Called from worker context */
+static void reader_io_callback(pa_iochannel *io, void *userdata) {
+    pa_pstream *p = userdata;
+
+    pa_assert(p);
+    pa_assert(p->read_io == io);
+
+    reader_read(p);
+}
+
+/* Called from worker context */
+static void reader_resume_cb(void *object, void *userdata) {
+    reader_read(object);
+}
+
+/* Called from worker context */
+static void reader_start_cb(void *object, void *userdata) {
+    pa_pstream *p = object;
+
+    pa_assert(p);
+    pa_assert(!p->read_io);
+
+    p->read_io = pa_iochannel_new(pa_io_worker_get_mainloop_api(p->worker), p->read_fd, -1);
+    pa_iochannel_set_noclose(p->read_io, !p->read_fd_owned);
+    pa_iochannel_set_callback(p->read_io, reader_io_callback, p);
+}
+
+/* Called from worker context */
+static void reader_stop_cb(void *object, void *userdata) {
+    pa_pstream *p = object;
+
+    pa_assert(p);
+
+    if (p->read_io) {
+        pa_iochannel_free(p->read_io);
+        p->read_io = NULL;
+    }
+}
+
+void pa_pstream_set_io_worker(pa_pstream *p, pa_io_worker *w) {
+    int ifd, ofd;
+
+    pa_assert(p);
+    pa_assert(PA_REFCNT_VALUE(p) > 0);
+    pa_assert(w);
+    pa_assert(!p->worker);
+    pa_assert(!p->dead);
+    pa_assert(p->read.index == 0 && p->read.buffer_length == 0);
+
+    ifd = pa_iochannel_get_recv_fd(p->io);
+    ofd = pa_iochannel_get_send_fd(p->io);
+    pa_assert(ifd >= 0 && ofd >= 0);
+
+    /* Only the sending side stays in the main loop. The socket is closed
+     * with it, after the worker has stopped using it. */
+    pa_iochannel_set_noclose(p->io, TRUE);
+    pa_iochannel_free(p->io);
+
+    p->io = pa_iochannel_new(p->mainloop, -1, ofd);
+    pa_iochannel_set_callback(p->io, io_callback, p);
+
+    p->worker = w;
+    p->read_fd = ifd;
+    p->read_fd_owned = ifd != ofd;
+
+    pa_io_worker_run(w, reader_start_cb, p, NULL);
+}
@@ -33,6 +33,7 @@
 #include <pulsecore/iochannel.h>
 #include <pulsecore/memchunk.h>
 #include <pulsecore/creds.h>
+#include <pulsecore/io-worker.h>
 #include <pulsecore/macro.h>
 
 typedef struct pa_pstream pa_pstream;
@@ -50,6 +51,9 @@ void pa_pstream_unref(pa_pstream*p);
 void pa_pstream_unlink(pa_pstream *p);
 
 void pa_pstream_send_packet(pa_pstream*p, pa_packet *packet, const pa_creds *creds);
+/* Pass up to PA_IOCHANNEL_FDS_MAX file descriptors along with the packet,
+ * they are duplicated. Requires memfd to be enabled. */
+void pa_pstream_send_packet_with_fds(pa_pstream*p, pa_packet *packet, const pa_creds *creds, const int *fds, unsigned n_fds);
 void pa_pstream_send_memblock(pa_pstream*p, uint32_t channel, int64_t offset, pa_seek_mode_t seek, const pa_memchunk *chunk);
 void pa_pstream_send_release(pa_pstream *p, uint32_t block_id);
 void pa_pstream_send_revoke(pa_pstream *p, uint32_t block_id);
@@ -58,12 +62,30 @@ void pa_pstream_set_receive_packet_callback(pa_pstream *p, pa_pstream_packet_cb_
 void pa_pstream_set_receive_memblock_callback(pa_pstream *p, pa_pstream_memblock_cb_t cb, void *userdata);
 void pa_pstream_set_drain_callback(pa_pstream *p, pa_pstream_notify_cb_t cb, void *userdata);
 void pa_pstream_set_die_callback(pa_pstream *p, pa_pstream_notify_cb_t cb, void *userdata);
+
+/* Makes o the current memory owner while the stream reads and
+ * dispatches what it received */
+void pa_pstream_set_memowner(pa_pstream *p, pa_memowner *o);
 void pa_pstream_set_release_callback(pa_pstream *p, pa_pstream_block_id_cb_t cb, void *userdata);
 void pa_pstream_set_revoke_callback(pa_pstream *p, pa_pstream_block_id_cb_t cb, void *userdata);
 
 pa_bool_t pa_pstream_is_pending(pa_pstream *p);
 
+/* Only to be called from within the packet callback. Takes over up to n
+ * of the file descriptors that came with the packet, returns how many
+ * were stored in fds. The rest are closed after the callback. */
+unsigned pa_pstream_take_packet_fds(pa_pstream *p, int *fds, unsigned n);
+
 void pa_pstream_enable_shm(pa_pstream *p, pa_bool_t enable);
 pa_bool_t pa_pstream_get_shm(pa_pstream *p);
 
+/* Allow passing memfd segments to the peer. Without this blocks from
+ * memfd backed pools are sent as a copy. */
+void pa_pstream_enable_memfd(pa_pstream *p);
+
+/* Read and parse the incoming frames in the thread of the worker. All
+ * callbacks are still called from the main loop, in order. Must be set
+ * before the main loop dispatches any event for the pstream. */
+void pa_pstream_set_io_worker(pa_pstream *p, pa_io_worker *w);
+
 #endif
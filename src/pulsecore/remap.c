@@ -86,71 +86,151 @@ static void remap_mono_to_stereo_c(pa_remap_t *m, void *dst, const void *src, un
     }
 }
 
-static void remap_channels_matrix_c(pa_remap_t *m, void *dst, const void *src, unsigned n) {
-    unsigned oc, ic, i;
-    unsigned n_ic, n_oc;
+void pa_remap_calc_coefs(pa_remap_t *m) {
+    unsigned oc, ic, n_oc, n_ic;
+
+    pa_assert(m);
+
+    n_oc = m->o_ss->channels;
+    n_ic = m->i_ss->channels;
+
+    for (oc = 0; oc < n_oc; oc++) {
+        unsigned k = 0;
+
+        for (ic = 0; ic < n_ic; ic++) {
+            float f = m->map_table_f[oc][ic];
+            int32_t i = m->map_table_i[oc][ic];
+
+            /* Non-positive volumes are skipped */
+            if (*m->format == PA_SAMPLE_FLOAT32NE ? f <= 0.0f : i <= 0)
+                continue;
+
+            m->coefs[oc][k].ic = ic;
+            m->coefs[oc][k].f = PA_MIN(f, 1.0f);
+            m->coefs[oc][k].i = PA_MIN(i, (int32_t) PA_VOLUME_NORM);
+            k++;
+        }
+
+        m->n_coefs[oc] = k;
+    }
+}
+
+static pa_bool_t coef_is_unity(pa_remap_t *m, const pa_remap_coef_t *c) {
+    return *m->format == PA_SAMPLE_FLOAT32NE ? c->f >= 1.0f : c->i >= (int32_t) PA_VOLUME_NORM;
+}
+
+/* Every output channel is a copy of at most one input channel */
+static pa_bool_t remap_is_permutation(pa_remap_t *m) {
+    unsigned oc;
+
+    for (oc = 0; oc < m->o_ss->channels; oc++) {
+        if (m->n_coefs[oc] > 1)
+            return FALSE;
+
+        if (m->n_coefs[oc] == 1 && !coef_is_unity(m, &m->coefs[oc][0]))
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+static pa_bool_t remap_is_identity(pa_remap_t *m) {
+    unsigned oc;
+
+    if (m->i_ss->channels != m->o_ss->channels || !remap_is_permutation(m))
+        return FALSE;
+
+    for (oc = 0; oc < m->o_ss->channels; oc++)
+        if (m->n_coefs[oc] != 1 || m->coefs[oc][0].ic != oc)
+            return FALSE;
+
+    return TRUE;
+}
+
+static void remap_copy_c(pa_remap_t *m, void *dst, const void *src, unsigned n) {
+    memcpy(dst, src, n * m->o_ss->channels * pa_sample_size_of_format(*m->format));
+}
+
+static void remap_permute_c(pa_remap_t *m, void *dst, const void *src, unsigned n) {
+    unsigned oc, n_ic, n_oc;
+    int map[PA_CHANNELS_MAX];
 
     n_ic = m->i_ss->channels;
     n_oc = m->o_ss->channels;
 
+    for (oc = 0; oc < n_oc; oc++)
+        map[oc] = m->n_coefs[oc] ? (int) m->coefs[oc][0].ic : -1;
+
     switch (*m->format) {
         case PA_SAMPLE_FLOAT32NE:
         {
-            float *d, *s;
+            float *d = (float *) dst;
+            const float *s = (const float *) src;
 
-            memset(dst, 0, n * sizeof(float) * n_oc);
+            for (; n > 0; n--, s += n_ic, d += n_oc)
+                for (oc = 0; oc < n_oc; oc++)
+                    d[oc] = map[oc] >= 0 ? s[map[oc]] : 0.0f;
+            break;
+        }
+        case PA_SAMPLE_S16NE:
+        {
+            int16_t *d = (int16_t *) dst;
+            const int16_t *s = (const int16_t *) src;
+
+            for (; n > 0; n--, s += n_ic, d += n_oc)
+                for (oc = 0; oc < n_oc; oc++)
+                    d[oc] = map[oc] >= 0 ? s[map[oc]] : 0;
+            break;
+        }
+        default:
+            pa_assert_not_reached();
+    }
+}
 
-            for (oc = 0; oc < n_oc; oc++) {
+/* Walks the coefficient lists frame by frame. Every output sample is the
+ * sum of its inputs in increasing order of input channels, just like in a
+ * full matrix multiplication, so zero entries cost nothing. */
+static void remap_channels_sparse_c(pa_remap_t *m, void *dst, const void *src, unsigned n) {
+    unsigned oc, k, n_ic, n_oc;
 
-                for (ic = 0; ic < n_ic; ic++) {
-                    float vol;
+    n_ic = m->i_ss->channels;
+    n_oc = m->o_ss->channels;
 
-                    vol = m->map_table_f[oc][ic];
+    switch (*m->format) {
+        case PA_SAMPLE_FLOAT32NE:
+        {
+            float *d = (float *) dst;
+            const float *s = (const float *) src;
 
-                    if (vol <= 0.0)
-                        continue;
+            for (; n > 0; n--, s += n_ic, d += n_oc) {
+                for (oc = 0; oc < n_oc; oc++) {
+                    const pa_remap_coef_t *c = m->coefs[oc];
+                    float sum = 0.0f;
 
-                    d = (float *)dst + oc;
-                    s = (float *)src + ic;
+                    for (k = 0; k < m->n_coefs[oc]; k++)
+                        sum += s[c[k].ic] * c[k].f;
 
-                    if (vol >= 1.0) {
-                        for (i = n; i > 0; i--, s += n_ic, d += n_oc)
-                            *d += *s;
-                    } else {
-                        for (i = n; i > 0; i--, s += n_ic, d += n_oc)
-                            *d += *s * vol;
-                    }
+                    d[oc] = sum;
                 }
             }
-
             break;
         }
         case PA_SAMPLE_S16NE:
         {
-            int16_t *d, *s;
-
-            memset(dst, 0, n * sizeof(int16_t) * n_oc);
-
-            for (oc = 0; oc < n_oc; oc++) {
+            int16_t *d = (int16_t *) dst;
+            const int16_t *s = (const int16_t *) src;
 
-                for (ic = 0; ic < n_ic; ic++) {
-                    int32_t vol;
+            for (; n > 0; n--, s += n_ic, d += n_oc) {
+                for (oc = 0; oc < n_oc; oc++) {
+                    const pa_remap_coef_t *c = m->coefs[oc];
+                    int32_t sum = 0;
 
-                    vol = m->map_table_i[oc][ic];
+                    /* The sum wraps around like the 16 bit accumulation of
+                     * a matrix multiplication would */
+                    for (k = 0; k < m->n_coefs[oc]; k++)
+                        sum += (int16_t) (((int32_t) s[c[k].ic] * c[k].i) >> 16);
 
-                    if (vol <= 0)
-                        continue;
-
-                    d = (int16_t *)dst + oc;
-                    s = (int16_t *)src + ic;
-
-                    if (vol >= 0x10000) {
-                        for (i = n; i > 0; i--, s += n_ic, d += n_oc)
-                            *d += *s;
-                    } else {
-                        for (i = n; i > 0; i--, s += n_ic, d += n_oc)
-                            *d += (int16_t) (((int32_t)*s * vol) >> 16);
-                    }
+                    d[oc] = (int16_t) sum;
                 }
             }
             break;
@@ -167,14 +247,23 @@ static void init_remap_c(pa_remap_t *m) {
     n_oc = m->o_ss->channels;
     n_ic = m->i_ss->channels;
 
-    /* find some common channel remappings, fall back to full matrix operation. */
+    pa_remap_calc_coefs(m);
+
+    /* find some common channel remappings, fall back to walking the
+     * non-zero matrix entries. */
     if (n_ic == 1 && n_oc == 2 &&
             m->map_table_i[0][0] == PA_VOLUME_NORM && m->map_table_i[1][0] == PA_VOLUME_NORM) {
         m->do_remap = (pa_do_remap_func_t) remap_mono_to_stereo_c;
         pa_log_info("Using mono to stereo remapping");
+    } else if (remap_is_identity(m)) {
+        m->do_remap = (pa_do_remap_func_t) remap_copy_c;
+        pa_log_info("Using identity remapping");
+    } else if (remap_is_permutation(m)) {
+        m->do_remap = (pa_do_remap_func_t) remap_permute_c;
+        pa_log_info("Using channel permutation remapping");
     } else {
-        m->do_remap = (pa_do_remap_func_t) remap_channels_matrix_c;
-        pa_log_info("Using generic matrix remapping");
+        m->do_remap = (pa_do_remap_func_t) remap_channels_sparse_c;
+        pa_log_info("Using sparse matrix remapping");
     }
 }
 
@@ -29,16 +29,33 @@ typedef struct pa_remap pa_remap_t;
 
 typedef void (*pa_do_remap_func_t) (pa_remap_t *m, void *d, const void *s, unsigned n);
 
+/* One input channel that contributes to an output channel. The volumes
+ * are clamped to PA_VOLUME_NORM, which is what the remappers apply. */
+typedef struct pa_remap_coef {
+    unsigned ic;
+    float f;
+    int32_t i;
+} pa_remap_coef_t;
+
 struct pa_remap {
     pa_sample_format_t *format;
     pa_sample_spec *i_ss, *o_ss;
     float map_table_f[PA_CHANNELS_MAX][PA_CHANNELS_MAX];
     int32_t map_table_i[PA_CHANNELS_MAX][PA_CHANNELS_MAX];
     pa_do_remap_func_t do_remap;
+
+    /* Filled in by pa_remap_calc_coefs() */
+    pa_remap_coef_t coefs[PA_CHANNELS_MAX][PA_CHANNELS_MAX];
+    unsigned n_coefs[PA_CHANNELS_MAX];
 };
 
 void pa_init_remap (pa_remap_t *m);
 
+/* Collect the non-zero entries of the map table that matches *m->format,
+ * for every output channel in increasing order of input channels. Init
+ * functions call this before they look at the coefficients. */
+void pa_remap_calc_coefs(pa_remap_t *m);
+
 /* custom installation of init functions */
 typedef void (*pa_init_remap_func_t) (pa_remap_t *m);
 
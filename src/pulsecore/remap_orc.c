@@ -0,0 +1,67 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pulse/volume.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/log.h>
+#include <pulsecore/remap.h>
+#include <pulsecore/remap-orc-gen.h>
+
+#include "cpu-orc.h"
+
+static pa_init_remap_func_t init_remap_fallback;
+
+static void remap_mono_to_stereo_orc(pa_remap_t *m, void *dst, const void *src, unsigned n) {
+    switch (*m->format) {
+        case PA_SAMPLE_FLOAT32NE:
+            pa_remap_mono_to_stereo_float32ne_orc(dst, src, n);
+            break;
+        case PA_SAMPLE_S16NE:
+            pa_remap_mono_to_stereo_s16ne_orc(dst, src, n);
+            break;
+        default:
+            pa_assert_not_reached();
+    }
+}
+
+static void init_remap_orc(pa_remap_t *m) {
+    unsigned n_oc, n_ic;
+
+    n_oc = m->o_ss->channels;
+    n_ic = m->i_ss->channels;
+
+    if (n_ic == 1 && n_oc == 2 &&
+            m->map_table_i[0][0] == PA_VOLUME_NORM && m->map_table_i[1][0] == PA_VOLUME_NORM) {
+        m->do_remap = (pa_do_remap_func_t) remap_mono_to_stereo_orc;
+        pa_log_info("Using ORC mono to stereo remapping");
+    } else
+        init_remap_fallback(m);
+}
+
+void pa_remap_func_init_orc(void) {
+    pa_log_info("Initialising ORC optimized remappers.");
+
+    if (!init_remap_fallback)
+        init_remap_fallback = pa_get_init_remap_func();
+    pa_set_init_remap_func((pa_init_remap_func_t) init_remap_orc);
+}
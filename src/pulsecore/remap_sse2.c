@@ -0,0 +1,293 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include <pulse/sample.h>
+#include <pulse/volume.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#include "cpu-x86.h"
+#include "remap.h"
+#include "simd-x86.h"
+
+/* Full matrix multiplication for matrices that have too many non-zero
+ * entries for the sparse C remapper. The vector lanes hold consecutive
+ * output samples: when the number of output channels divides the number
+ * of lanes, several frames share one vector, otherwise every frame is
+ * split into blocks of lanes. Zero entries are multiplied rather than
+ * skipped, which leaves the sums unchanged, so the results are identical
+ * to the C remappers. */
+
+#define FLOAT_LANES 4
+#define S16_LANES 8
+
+static pa_init_remap_func_t init_remap_fallback;
+
+/* Number of output samples a frame occupies in the vectors */
+static unsigned lanes_per_frame(unsigned n_oc, unsigned lanes) {
+    if (lanes % n_oc == 0)
+        return n_oc;
+
+    return (n_oc + lanes - 1) / lanes * lanes;
+}
+
+/* Lay out the clamped map table so that coefficient vector (b, ic) holds
+ * the volumes of input channel ic for the lanes of block b */
+static void fill_coefs_f(pa_remap_t *m, unsigned lanes, float *c) {
+    unsigned n_ic = m->i_ss->channels, n_oc = m->o_ss->channels;
+    unsigned per_frame = lanes_per_frame(n_oc, lanes);
+    unsigned b, ic, l;
+
+    for (b = 0; b < (per_frame + lanes - 1) / lanes; b++)
+        for (ic = 0; ic < n_ic; ic++)
+            for (l = 0; l < lanes; l++) {
+                unsigned oc = lanes % n_oc == 0 ? l % n_oc : b * lanes + l;
+                float f = oc < n_oc ? m->map_table_f[oc][ic] : 0.0f;
+
+                c[(b * n_ic + ic) * lanes + l] = f > 0.0f ? PA_MIN(f, 1.0f) : 0.0f;
+            }
+}
+
+static void fill_coefs_i(pa_remap_t *m, unsigned lanes, int32_t *c) {
+    unsigned n_ic = m->i_ss->channels, n_oc = m->o_ss->channels;
+    unsigned per_frame = lanes_per_frame(n_oc, lanes);
+    unsigned b, ic, l;
+
+    for (b = 0; b < (per_frame + lanes - 1) / lanes; b++)
+        for (ic = 0; ic < n_ic; ic++)
+            for (l = 0; l < lanes; l++) {
+                unsigned oc = lanes % n_oc == 0 ? l % n_oc : b * lanes + l;
+                int32_t i = oc < n_oc ? m->map_table_i[oc][ic] : 0;
+
+                c[(b * n_ic + ic) * lanes + l] = i > 0 ? PA_MIN(i, (int32_t) PA_VOLUME_NORM) : 0;
+            }
+}
+
+/* The frames left over by the packed kernels */
+static void remap_frames_float(pa_remap_t *m, float *d, const float *s, unsigned n) {
+    unsigned n_ic = m->i_ss->channels, n_oc = m->o_ss->channels;
+    unsigned oc, k;
+
+    for (; n > 0; n--, s += n_ic, d += n_oc)
+        for (oc = 0; oc < n_oc; oc++) {
+            float sum = 0.0f;
+
+            for (k = 0; k < m->n_coefs[oc]; k++)
+                sum += s[m->coefs[oc][k].ic] * m->coefs[oc][k].f;
+
+            d[oc] = sum;
+        }
+}
+
+static void remap_frames_s16(pa_remap_t *m, int16_t *d, const int16_t *s, unsigned n) {
+    unsigned n_ic = m->i_ss->channels, n_oc = m->o_ss->channels;
+    unsigned oc, k;
+
+    for (; n > 0; n--, s += n_ic, d += n_oc)
+        for (oc = 0; oc < n_oc; oc++) {
+            int32_t sum = 0;
+
+            for (k = 0; k < m->n_coefs[oc]; k++)
+                sum += (int16_t) (((int32_t) s[m->coefs[oc][k].ic] * m->coefs[oc][k].i) >> 16);
+
+            d[oc] = (int16_t) sum;
+        }
+}
+
+#define DENSE_FLOAT_PACKED(frames, load)                                        \
+    for (; n >= frames; n -= frames, s += frames * n_ic, d += FLOAT_LANES) {    \
+        __m128 acc = _mm_setzero_ps();                                          \
+                                                                                \
+        for (ic = 0; ic < n_ic; ic++)                                           \
+            acc = _mm_add_ps(acc, _mm_mul_ps(load, _mm_load_ps(c + ic * FLOAT_LANES))); \
+                                                                                \
+        _mm_storeu_ps(d, acc);                                                  \
+    }
+
+static void remap_channels_matrix_float_sse2(pa_remap_t *m, void *dst, const void *src, unsigned n) {
+    PA_DECLARE_ALIGNED(16, float, c[PA_CHANNELS_MAX * PA_CHANNELS_MAX]);
+    unsigned n_ic = m->i_ss->channels, n_oc = m->o_ss->channels;
+    const float *s = (const float *) src;
+    float *d = (float *) dst;
+    unsigned ic, b;
+
+    fill_coefs_f(m, FLOAT_LANES, c);
+
+    switch (FLOAT_LANES % n_oc ? 0 : FLOAT_LANES / n_oc) {
+        case 4:
+            DENSE_FLOAT_PACKED(4, _mm_setr_ps(s[ic], s[n_ic + ic], s[2 * n_ic + ic], s[3 * n_ic + ic]));
+            break;
+        case 2:
+            DENSE_FLOAT_PACKED(2, _mm_setr_ps(s[ic], s[ic], s[n_ic + ic], s[n_ic + ic]));
+            break;
+        case 1:
+            DENSE_FLOAT_PACKED(1, _mm_set1_ps(s[ic]));
+            break;
+        default:
+            for (; n > 0; n--, s += n_ic, d += n_oc) {
+                for (b = 0; b * FLOAT_LANES < n_oc; b++) {
+                    const float *cb = c + b * n_ic * FLOAT_LANES;
+                    __m128 acc = _mm_setzero_ps();
+
+                    for (ic = 0; ic < n_ic; ic++)
+                        acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(s[ic]), _mm_load_ps(cb + ic * FLOAT_LANES)));
+
+                    if ((b + 1) * FLOAT_LANES <= n_oc)
+                        _mm_storeu_ps(d + b * FLOAT_LANES, acc);
+                    else {
+                        PA_DECLARE_ALIGNED(16, float, t[FLOAT_LANES]);
+
+                        _mm_store_ps(t, acc);
+                        memcpy(d + b * FLOAT_LANES, t, (n_oc - b * FLOAT_LANES) * sizeof(float));
+                    }
+                }
+            }
+            break;
+    }
+
+    if (n > 0)
+        remap_frames_float(m, d, s, n);
+}
+
+/* (s * vol) >> 16 with vol split into hi * 0x10000 + lo is s * hi plus the
+ * signed high half of s * lo, as in the SSE2 mixer. The results wrap
+ * around in the 16 bit lanes just like the C sums do. */
+static inline __m128i mul_vol_s16(__m128i v, __m128i h, __m128i l) {
+    __m128i lp = _mm_sub_epi16(_mm_mulhi_epu16(v, l), _mm_and_si128(_mm_srai_epi16(v, 15), l));
+
+    return _mm_add_epi16(_mm_and_si128(v, h), lp);
+}
+
+#define DENSE_S16_PACKED(frames, load)                                          \
+    for (; n >= frames; n -= frames, s += frames * n_ic, d += S16_LANES) {      \
+        __m128i acc = _mm_setzero_si128();                                      \
+                                                                                \
+        for (ic = 0; ic < n_ic; ic++)                                           \
+            acc = _mm_add_epi16(acc, mul_vol_s16(load,                          \
+                                                 _mm_load_si128((const __m128i *) (vh + ic * S16_LANES)), \
+                                                 _mm_load_si128((const __m128i *) (vl + ic * S16_LANES)))); \
+                                                                                \
+        _mm_storeu_si128((__m128i *) d, acc);                                   \
+    }
+
+static void remap_channels_matrix_s16_sse2(pa_remap_t *m, void *dst, const void *src, unsigned n) {
+    PA_DECLARE_ALIGNED(16, int16_t, vh[PA_CHANNELS_MAX * PA_CHANNELS_MAX]);
+    PA_DECLARE_ALIGNED(16, int16_t, vl[PA_CHANNELS_MAX * PA_CHANNELS_MAX]);
+    int32_t c[PA_CHANNELS_MAX * PA_CHANNELS_MAX];
+    unsigned n_ic = m->i_ss->channels, n_oc = m->o_ss->channels;
+    const int16_t *s = (const int16_t *) src;
+    int16_t *d = (int16_t *) dst;
+    unsigned ic, b, k;
+
+    fill_coefs_i(m, S16_LANES, c);
+
+    /* hi is 0 or 1 and used as a mask */
+    for (k = 0; k < (lanes_per_frame(n_oc, S16_LANES) + S16_LANES - 1) / S16_LANES * n_ic * S16_LANES; k++) {
+        vh[k] = (int16_t) -(c[k] >> 16);
+        vl[k] = (int16_t) (c[k] & 0xFFFF);
+    }
+
+    switch (S16_LANES % n_oc ? 0 : S16_LANES / n_oc) {
+        case 8:
+            DENSE_S16_PACKED(8, _mm_setr_epi16(s[ic], s[n_ic + ic], s[2 * n_ic + ic], s[3 * n_ic + ic],
+                                               s[4 * n_ic + ic], s[5 * n_ic + ic], s[6 * n_ic + ic], s[7 * n_ic + ic]));
+            break;
+        case 4:
+            DENSE_S16_PACKED(4, _mm_setr_epi16(s[ic], s[ic], s[n_ic + ic], s[n_ic + ic],
+                                               s[2 * n_ic + ic], s[2 * n_ic + ic], s[3 * n_ic + ic], s[3 * n_ic + ic]));
+            break;
+        case 2:
+            DENSE_S16_PACKED(2, _mm_setr_epi16(s[ic], s[ic], s[ic], s[ic],
+                                               s[n_ic + ic], s[n_ic + ic], s[n_ic + ic], s[n_ic + ic]));
+            break;
+        case 1:
+            DENSE_S16_PACKED(1, _mm_set1_epi16(s[ic]));
+            break;
+        default:
+            for (; n > 0; n--, s += n_ic, d += n_oc) {
+                for (b = 0; b * S16_LANES < n_oc; b++) {
+                    const int16_t *hb = vh + b * n_ic * S16_LANES, *lb = vl + b * n_ic * S16_LANES;
+                    __m128i acc = _mm_setzero_si128();
+
+                    for (ic = 0; ic < n_ic; ic++)
+                        acc = _mm_add_epi16(acc, mul_vol_s16(_mm_set1_epi16(s[ic]),
+                                                             _mm_load_si128((const __m128i *) (hb + ic * S16_LANES)),
+                                                             _mm_load_si128((const __m128i *) (lb + ic * S16_LANES))));
+
+                    if ((b + 1) * S16_LANES <= n_oc)
+                        _mm_storeu_si128((__m128i *) (d + b * S16_LANES), acc);
+                    else {
+                        PA_DECLARE_ALIGNED(16, int16_t, t[S16_LANES]);
+
+                        _mm_store_si128((__m128i *) t, acc);
+                        memcpy(d + b * S16_LANES, t, (n_oc - b * S16_LANES) * sizeof(int16_t));
+                    }
+                }
+            }
+            break;
+    }
+
+    if (n > 0)
+        remap_frames_s16(m, d, s, n);
+}
+
+/* The dense kernels do one vector operation per input channel and block of
+ * lanes, the sparse C remapper one scalar operation per non-zero entry.
+ * Pick the dense kernels only when they need fewer operations, and never
+ * for plain copies of channels, which the other remappers handle better. */
+static pa_bool_t prefer_dense(pa_remap_t *m, unsigned lanes) {
+    unsigned oc, entries = 0;
+
+    for (oc = 0; oc < m->o_ss->channels; oc++)
+        entries += m->n_coefs[oc];
+
+    if (entries <= m->o_ss->channels)
+        return FALSE;
+
+    return m->i_ss->channels * lanes_per_frame(m->o_ss->channels, lanes) < entries * lanes;
+}
+
+static void init_remap_sse2_matrix(pa_remap_t *m) {
+    pa_remap_calc_coefs(m);
+
+    if (*m->format == PA_SAMPLE_FLOAT32NE && prefer_dense(m, FLOAT_LANES)) {
+        m->do_remap = (pa_do_remap_func_t) remap_channels_matrix_float_sse2;
+        pa_log_info("Using SSE2 dense matrix remapping");
+    } else if (*m->format == PA_SAMPLE_S16NE && prefer_dense(m, S16_LANES)) {
+        m->do_remap = (pa_do_remap_func_t) remap_channels_matrix_s16_sse2;
+        pa_log_info("Using SSE2 dense matrix remapping");
+    } else
+        init_remap_fallback(m);
+}
+
+void pa_remap_func_init_sse2(pa_cpu_x86_flag_t flags) {
+    if (flags & PA_CPU_X86_SSE2) {
+        pa_log_info("Initialising SSE2 optimized matrix remappers.");
+
+        if (!init_remap_fallback)
+            init_remap_fallback = pa_get_init_remap_func();
+        pa_set_init_remap_func((pa_init_remap_func_t) init_remap_sse2_matrix);
+    }
+}
@@ -0,0 +1,173 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/atomic.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/semaphore.h>
+#include <pulsecore/thread.h>
+
+#include "render-pool.h"
+
+PA_STATIC_TLS_DECLARE_NO_FREE(render_pool);
+
+struct pa_render_pool {
+    unsigned n_threads;
+    pa_thread **threads;
+
+    pa_thread_mq *thread_mq;
+    pa_bool_t realtime;
+    int rtprio;
+
+    pa_semaphore *start, *done;
+    pa_atomic_t quit;
+
+    /* Only valid while pa_render_pool_run() is active. The semaphores
+     * order the accesses, hence these need no locking. */
+    pa_render_pool_job_cb_t cb;
+    void *userdata;
+    unsigned n_jobs;
+    pa_atomic_t next_job;
+};
+
+static void run_jobs(pa_render_pool *p) {
+    int j;
+
+    while ((j = pa_atomic_inc(&p->next_job)) < (int) p->n_jobs)
+        p->cb((unsigned) j, p->userdata);
+}
+
+static void thread_func(void *userdata) {
+    pa_render_pool *p = userdata;
+
+    pa_assert(p);
+
+    if (p->realtime)
+        pa_make_realtime(p->rtprio);
+
+    pa_thread_mq_install(p->thread_mq);
+    PA_STATIC_TLS_SET(render_pool, p);
+
+    for (;;) {
+        pa_semaphore_wait(p->start);
+
+        if (pa_atomic_load(&p->quit))
+            break;
+
+        run_jobs(p);
+        pa_semaphore_post(p->done);
+    }
+}
+
+pa_render_pool *pa_render_pool_new(const char *name, unsigned n_threads, pa_thread_mq *thread_mq, pa_bool_t realtime, int rtprio) {
+    pa_render_pool *p;
+    unsigned i;
+
+    pa_assert(name);
+    pa_assert(n_threads > 0);
+    pa_assert(thread_mq);
+
+    p = pa_xnew0(pa_render_pool, 1);
+    p->thread_mq = thread_mq;
+    p->realtime = realtime;
+    p->rtprio = rtprio;
+    p->start = pa_semaphore_new(0);
+    p->done = pa_semaphore_new(0);
+    pa_atomic_store(&p->quit, 0);
+    p->threads = pa_xnew0(pa_thread*, n_threads);
+
+    for (i = 0; i < n_threads; i++) {
+        if (!(p->threads[i] = pa_thread_new(name, thread_func, p))) {
+            pa_log("Failed to create render thread.");
+            pa_render_pool_free(p);
+            return NULL;
+        }
+
+        p->n_threads++;
+    }
+
+    return p;
+}
+
+void pa_render_pool_free(pa_render_pool *p) {
+    unsigned i;
+
+    pa_assert(p);
+    pa_assert(!pa_render_pool_in_helper(p));
+
+    pa_atomic_store(&p->quit, 1);
+
+    for (i = 0; i < p->n_threads; i++)
+        pa_semaphore_post(p->start);
+
+    for (i = 0; i < p->n_threads; i++)
+        pa_thread_free(p->threads[i]);
+
+    pa_xfree(p->threads);
+    pa_semaphore_free(p->start);
+    pa_semaphore_free(p->done);
+    pa_xfree(p);
+}
+
+unsigned pa_render_pool_get_n_threads(pa_render_pool *p) {
+    pa_assert(p);
+
+    return p->n_threads;
+}
+
+void pa_render_pool_run(pa_render_pool *p, unsigned n_jobs, pa_render_pool_job_cb_t cb, void *userdata) {
+    unsigned i, n_wake;
+
+    pa_assert(p);
+    pa_assert(cb);
+    pa_assert(!pa_render_pool_in_helper(p));
+
+    p->cb = cb;
+    p->userdata = userdata;
+    p->n_jobs = n_jobs;
+    pa_atomic_store(&p->next_job, 0);
+
+    /* We do one share of the work ourselves, so there is no point in
+     * waking up more helpers than there are remaining jobs */
+    n_wake = n_jobs > 1 ? PA_MIN(p->n_threads, n_jobs - 1) : 0;
+
+    for (i = 0; i < n_wake; i++)
+        pa_semaphore_post(p->start);
+
+    run_jobs(p);
+
+    for (i = 0; i < n_wake; i++)
+        pa_semaphore_wait(p->done);
+
+    p->cb = NULL;
+    p->userdata = NULL;
+}
+
+pa_bool_t pa_render_pool_in_helper(pa_render_pool *p) {
+    pa_assert(p);
+
+    return PA_STATIC_TLS_GET(render_pool) == p;
+}
@@ -0,0 +1,49 @@
+#ifndef foopulsecorerenderpoolhfoo
+#define foopulsecorerenderpoolhfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <pulsecore/macro.h>
+#include <pulsecore/thread-mq.h>
+
+/* A small set of helper threads an IO thread can hand independent jobs
+ * to. All threads are created up front, pa_render_pool_run() does not
+ * allocate and the calling thread works on the jobs itself, too. The
+ * helpers install the thread_mq of the IO thread they work for, so
+ * that code run as a job sees the same IO context. */
+
+typedef struct pa_render_pool pa_render_pool;
+
+typedef void (*pa_render_pool_job_cb_t)(unsigned job, void *userdata);
+
+pa_render_pool *pa_render_pool_new(const char *name, unsigned n_threads, pa_thread_mq *thread_mq, pa_bool_t realtime, int rtprio);
+void pa_render_pool_free(pa_render_pool *p);
+
+unsigned pa_render_pool_get_n_threads(pa_render_pool *p);
+
+/* Call cb for every job in 0..n_jobs-1 and return after all of them
+ * are done. The order and the thread each job is run in is
+ * undefined. Must not be called from one of the helper threads. */
+void pa_render_pool_run(pa_render_pool *p, unsigned n_jobs, pa_render_pool_job_cb_t cb, void *userdata);
+
+/* Returns TRUE if called from one of the helper threads of p */
+pa_bool_t pa_render_pool_in_helper(pa_render_pool *p);
+
+#endif
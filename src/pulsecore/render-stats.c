@@ -0,0 +1,172 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core-util.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/strbuf.h>
+
+#include "render-stats.h"
+
+static const char * const stat_names[PA_RENDER_STAT_MAX] = {
+    [PA_RENDER_STAT_CYCLE] = "cycle",
+    [PA_RENDER_STAT_PEEK] = "peek",
+    [PA_RENDER_STAT_RESAMPLE] = "resample",
+    [PA_RENDER_STAT_LATENESS] = "wakeup-lateness"
+};
+
+pa_render_stats *pa_render_stats_new(void) {
+    return pa_xnew0(pa_render_stats, 1);
+}
+
+void pa_render_stats_free(pa_render_stats *s) {
+    pa_assert(s);
+
+    pa_xfree(s);
+}
+
+static unsigned bucket_of(pa_usec_t usec) {
+    unsigned e = 0;
+    unsigned b;
+
+    if (usec < PA_RENDER_HISTOGRAM_SUB_BUCKETS)
+        return (unsigned) usec;
+
+    /* The position of the highest bit, at least 2 here */
+    while ((usec >> e) >= PA_RENDER_HISTOGRAM_SUB_BUCKETS * 2)
+        e++;
+
+    b = PA_RENDER_HISTOGRAM_SUB_BUCKETS * (e + 1) + (unsigned) ((usec >> e) - PA_RENDER_HISTOGRAM_SUB_BUCKETS);
+
+    return PA_MIN(b, PA_RENDER_HISTOGRAM_BUCKETS - 1U);
+}
+
+pa_usec_t pa_render_histogram_bucket_limit(unsigned bucket) {
+    unsigned e, sub;
+
+    pa_assert(bucket < PA_RENDER_HISTOGRAM_BUCKETS);
+
+    if (bucket >= PA_RENDER_HISTOGRAM_BUCKETS - 1)
+        return (pa_usec_t) -1;
+
+    if (bucket < PA_RENDER_HISTOGRAM_SUB_BUCKETS)
+        return bucket + 1;
+
+    e = bucket / PA_RENDER_HISTOGRAM_SUB_BUCKETS - 1;
+    sub = bucket % PA_RENDER_HISTOGRAM_SUB_BUCKETS;
+
+    return (pa_usec_t) (PA_RENDER_HISTOGRAM_SUB_BUCKETS + sub + 1) << e;
+}
+
+void pa_render_histogram_add(pa_render_histogram *h, pa_usec_t usec) {
+    pa_assert(h);
+
+    h->buckets[bucket_of(usec)]++;
+    h->n++;
+    h->sum += usec;
+
+    if (usec > h->max)
+        h->max = usec;
+}
+
+pa_usec_t pa_render_histogram_percentile(const pa_render_histogram *h, unsigned permille) {
+    uint64_t limit, seen = 0;
+    unsigned k;
+
+    pa_assert(h);
+    pa_assert(permille <= 1000);
+
+    if (h->n <= 0)
+        return 0;
+
+    limit = ((uint64_t) h->n * permille + 999) / 1000;
+
+    for (k = 0; k < PA_RENDER_HISTOGRAM_BUCKETS - 1; k++) {
+        seen += h->buckets[k];
+
+        if (seen >= limit && seen > 0)
+            return PA_MIN(pa_render_histogram_bucket_limit(k), h->max);
+    }
+
+    return h->max;
+}
+
+const char *pa_render_stat_to_string(pa_render_stat_t stat) {
+    pa_assert(stat < PA_RENDER_STAT_MAX);
+
+    return stat_names[stat];
+}
+
+char *pa_render_histogram_to_string(const pa_render_histogram *h) {
+    pa_assert(h);
+
+    return pa_sprintf_malloc("n=%u avg=%lluus p50=%lluus p99=%lluus max=%lluus",
+                             h->n,
+                             (unsigned long long) (h->n > 0 ? h->sum / h->n : 0),
+                             (unsigned long long) pa_render_histogram_percentile(h, 500),
+                             (unsigned long long) pa_render_histogram_percentile(h, 990),
+                             (unsigned long long) h->max);
+}
+
+char *pa_render_stats_to_string(const pa_render_stats *s, const char *prefix) {
+    pa_strbuf *buf;
+    unsigned k;
+
+    pa_assert(s);
+
+    buf = pa_strbuf_new();
+
+    for (k = 0; k < PA_RENDER_STAT_MAX; k++) {
+        char *t;
+
+        if (s->histograms[k].n <= 0)
+            continue;
+
+        t = pa_render_histogram_to_string(&s->histograms[k]);
+        pa_strbuf_printf(buf, "%s%s: %s\n", pa_strempty(prefix), stat_names[k], t);
+        pa_xfree(t);
+    }
+
+    return pa_strbuf_tostring_free(buf);
+}
+
+void pa_render_stats_to_proplist(const pa_render_stats *s, pa_proplist *p) {
+    unsigned k;
+
+    pa_assert(s);
+    pa_assert(p);
+
+    for (k = 0; k < PA_RENDER_STAT_MAX; k++) {
+        char *key, *t;
+
+        if (s->histograms[k].n <= 0)
+            continue;
+
+        key = pa_sprintf_malloc("render.%s", stat_names[k]);
+        t = pa_render_histogram_to_string(&s->histograms[k]);
+        pa_proplist_sets(p, key, t);
+        pa_xfree(t);
+        pa_xfree(key);
+    }
+}
@@ -0,0 +1,83 @@
+#ifndef foopulsecorerenderstatshfoo
+#define foopulsecorerenderstatshfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <inttypes.h>
+
+#include <pulse/proplist.h>
+#include <pulse/sample.h>
+
+#include <pulsecore/macro.h>
+
+/* Timing histograms of the IO thread of a sink or source, only kept
+ * when enable-render-stats is set. They are written by the IO thread
+ * and read by the main thread without any locking, so a reader may
+ * see a sample counted in one field and not yet in another. */
+
+/* Values below 4us get a bucket each. Above that every power of two
+ * is split into four buckets, so the error stays below 25% up to about
+ * 4s. Everything beyond goes into the last bucket. */
+#define PA_RENDER_HISTOGRAM_SUB_BUCKETS 4
+#define PA_RENDER_HISTOGRAM_BUCKETS (PA_RENDER_HISTOGRAM_SUB_BUCKETS * 21)
+
+typedef struct pa_render_histogram {
+    unsigned buckets[PA_RENDER_HISTOGRAM_BUCKETS];
+    unsigned n;
+    uint64_t sum;
+    pa_usec_t max;
+} pa_render_histogram;
+
+typedef enum pa_render_stat {
+    PA_RENDER_STAT_CYCLE,     /* a whole render (sink) or post (source) */
+    PA_RENDER_STAT_PEEK,      /* peeking a single input, sinks only */
+    PA_RENDER_STAT_RESAMPLE,  /* the resampler of a single stream */
+    PA_RENDER_STAT_LATENESS,  /* wakeup after the rtpoll timer */
+    PA_RENDER_STAT_MAX
+} pa_render_stat_t;
+
+typedef struct pa_render_stats {
+    pa_render_histogram histograms[PA_RENDER_STAT_MAX];
+} pa_render_stats;
+
+pa_render_stats *pa_render_stats_new(void);
+void pa_render_stats_free(pa_render_stats *s);
+
+void pa_render_histogram_add(pa_render_histogram *h, pa_usec_t usec);
+
+/* The upper limit of a bucket, (pa_usec_t) -1 for the last one */
+pa_usec_t pa_render_histogram_bucket_limit(unsigned bucket);
+
+/* The value below which permille of the samples are, 0 if there are
+ * none */
+pa_usec_t pa_render_histogram_percentile(const pa_render_histogram *h, unsigned permille);
+
+const char *pa_render_stat_to_string(pa_render_stat_t stat);
+
+/* E.g. "n=1234 avg=52us p50=48us p99=190us max=801us" */
+char *pa_render_histogram_to_string(const pa_render_histogram *h);
+
+/* One line per histogram that has samples, each starting with prefix */
+char *pa_render_stats_to_string(const pa_render_stats *s, const char *prefix);
+
+/* Sets render.<stat> in p for every histogram that has samples */
+void pa_render_stats_to_proplist(const pa_render_stats *s, pa_proplist *p);
+
+#endif
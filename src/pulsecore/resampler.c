@@ -40,6 +40,9 @@
 #include <pulsecore/strbuf.h>
 #include <pulsecore/remap.h>
 #include <pulsecore/core-util.h>
+#include <pulsecore/llist.h>
+#include <pulsecore/mutex.h>
+#include <pulsecore/sample-util.h>
 #include "ffmpeg/avcodec.h"
 
 #include "resampler.h"
@@ -47,6 +50,31 @@
 /* Number of samples of extra space we allow the resamplers to return */
 #define EXTRA_FRAMES 128
 
+/* Size of the scratch tiles that carry a block of frames from one stage of
+ * the conversion pipeline to the next */
+#define TILE_BYTES 8192
+
+/* The adaptive speex method moves between these quality settings. It steps
+ * down as soon as the render load reaches ADAPTIVE_LOAD_HIGH percent, but
+ * at most once every ADAPTIVE_SETTLE_CHUNKS chunks so that the effect of
+ * the previous step shows up in the load first. It steps up again after
+ * ADAPTIVE_RAISE_CHUNKS chunks in a row below ADAPTIVE_LOAD_LOW percent. */
+#define ADAPTIVE_QUALITY_MIN 0
+#define ADAPTIVE_QUALITY_MAX 5
+#define ADAPTIVE_LOAD_HIGH 75
+#define ADAPTIVE_LOAD_LOW 40
+#define ADAPTIVE_SETTLE_CHUNKS 8
+#define ADAPTIVE_RAISE_CHUNKS 200
+
+/* Number of output frames the linear resampler hands to its
+ * interpolation function at once */
+#define LINEAR_BLOCK 64
+
+/* Stages of the pipeline that convert_remap() may run in one pass */
+#define STAGE_TO_WORK 0x1U
+#define STAGE_REMAP 0x2U
+#define STAGE_FROM_WORK 0x4U
+
 struct pa_resampler {
     pa_resample_method_t method;
     pa_resample_flags_t flags;
@@ -60,12 +88,14 @@ struct pa_resampler {
     pa_memchunk remap_buf;
     pa_memchunk resample_buf;
     pa_memchunk from_work_format_buf;
-    unsigned to_work_format_buf_samples;
+    size_t to_work_format_buf_size;
     size_t remap_buf_size;
-    unsigned resample_buf_samples;
-    unsigned from_work_format_buf_samples;
+    size_t resample_buf_size;
+    size_t from_work_format_buf_size;
     bool remap_buf_contains_leftover_data;
 
+    float tile_buf[2][TILE_BYTES / sizeof(float)];
+
     pa_sample_format_t work_format;
     uint8_t work_channels;
 
@@ -75,10 +105,19 @@ struct pa_resampler {
     pa_remap_t remap;
     bool map_required;
 
+    /* Once more than silence_tail bytes of silence were passed in, the
+     * output is known to be silent as well and we skip the processing.
+     * silence_frac keeps the output length exact across such chunks. */
+    size_t silence_tail, silence_bytes;
+    uint64_t silence_frac;
+    bool silence_skipping;
+    pa_silence_cache silence_cache;
+
     void (*impl_free)(pa_resampler *r);
     void (*impl_update_rates)(pa_resampler *r);
     void (*impl_resample)(pa_resampler *r, const pa_memchunk *in, unsigned in_samples, pa_memchunk *out, unsigned *out_samples);
     void (*impl_reset)(pa_resampler *r);
+    void (*impl_update_load)(pa_resampler *r, unsigned load);
 
     struct { /* data specific to the trivial resampler */
         unsigned o_counter;
@@ -94,6 +133,20 @@ struct pa_resampler {
 
     } peaks;
 
+    struct { /* data specific to the linear resampler */
+        /* The next output frame lies frac/rate of the way from input
+         * frame index - 1 to index, counting from the start of the next
+         * chunk */
+        unsigned index;
+        unsigned frac;
+        uint32_t rate;
+
+        /* The last frame of the previous chunk, followed by the first
+         * frame of the current one */
+        float edge[2 * PA_CHANNELS_MAX];
+        bool have_edge;
+    } linear;
+
 #ifdef HAVE_LIBSAMPLERATE
     struct { /* data specific to libsamplerate */
         SRC_STATE *state;
@@ -103,12 +156,16 @@ struct pa_resampler {
 #ifdef HAVE_SPEEX
     struct { /* data specific to speex */
         SpeexResamplerState* state;
+
+        /* only used by the adaptive method */
+        int quality;
+        unsigned settle_chunks;
+        unsigned low_chunks;
     } speex;
 #endif
 
     struct { /* data specific to ffmpeg */
         struct AVResampleContext *state;
-        pa_memchunk buf[PA_CHANNELS_MAX];
     } ffmpeg;
 };
 
@@ -119,11 +176,12 @@ static int speex_init(pa_resampler*r);
 #endif
 static int ffmpeg_init(pa_resampler*r);
 static int peaks_init(pa_resampler*r);
+static int linear_init(pa_resampler*r);
 #ifdef HAVE_LIBSAMPLERATE
 static int libsamplerate_init(pa_resampler*r);
 #endif
 
-static void calc_map_table(pa_resampler *r);
+static void init_remap(pa_resampler *r);
 
 static int (* const init_table[])(pa_resampler*r) = {
 #ifdef HAVE_LIBSAMPLERATE
@@ -163,6 +221,7 @@ static int (* const init_table[])(pa_resampler*r) = {
     [PA_RESAMPLER_SPEEX_FIXED_BASE+8]      = speex_init,
     [PA_RESAMPLER_SPEEX_FIXED_BASE+9]      = speex_init,
     [PA_RESAMPLER_SPEEX_FIXED_BASE+10]     = speex_init,
+    [PA_RESAMPLER_SPEEX_FLOAT_ADAPTIVE]    = speex_init,
 #else
     [PA_RESAMPLER_SPEEX_FLOAT_BASE+0]      = NULL,
     [PA_RESAMPLER_SPEEX_FLOAT_BASE+1]      = NULL,
@@ -186,11 +245,13 @@ static int (* const init_table[])(pa_resampler*r) = {
     [PA_RESAMPLER_SPEEX_FIXED_BASE+8]      = NULL,
     [PA_RESAMPLER_SPEEX_FIXED_BASE+9]      = NULL,
     [PA_RESAMPLER_SPEEX_FIXED_BASE+10]     = NULL,
+    [PA_RESAMPLER_SPEEX_FLOAT_ADAPTIVE]    = NULL,
 #endif
     [PA_RESAMPLER_FFMPEG]                  = ffmpeg_init,
     [PA_RESAMPLER_AUTO]                    = NULL,
     [PA_RESAMPLER_COPY]                    = copy_init,
     [PA_RESAMPLER_PEAKS]                   = peaks_init,
+    [PA_RESAMPLER_LINEAR]                  = linear_init,
 };
 
 pa_resampler* pa_resampler_new(
@@ -239,7 +300,7 @@ pa_resampler* pa_resampler_new(
         method = PA_RESAMPLER_SPEEX_FLOAT_BASE + 1;
 #else
         if (flags & PA_RESAMPLER_VARIABLE_RATE)
-            method = PA_RESAMPLER_TRIVIAL;
+            method = PA_RESAMPLER_LINEAR;
         else
             method = PA_RESAMPLER_FFMPEG;
 #endif
@@ -272,16 +333,18 @@ pa_resampler* pa_resampler_new(
     r->i_fz = pa_frame_size(a);
     r->o_fz = pa_frame_size(b);
 
-    calc_map_table(r);
+    r->map_required = r->i_ss.channels != r->o_ss.channels || (!(r->flags & PA_RESAMPLER_NO_REMAP) && !pa_channel_map_equal(&r->i_cm, &r->o_cm));
 
     pa_log_info("Using resampler '%s'", pa_resample_method_to_string(method));
 
     if ((method >= PA_RESAMPLER_SPEEX_FIXED_BASE && method <= PA_RESAMPLER_SPEEX_FIXED_MAX) ||
         (method == PA_RESAMPLER_FFMPEG))
         r->work_format = PA_SAMPLE_S16NE;
-    else if (method == PA_RESAMPLER_TRIVIAL || method == PA_RESAMPLER_COPY || method == PA_RESAMPLER_PEAKS) {
+    else if (method == PA_RESAMPLER_TRIVIAL || method == PA_RESAMPLER_COPY || method == PA_RESAMPLER_PEAKS ||
+             method == PA_RESAMPLER_LINEAR) {
 
-        if (r->map_required || a->format != b->format || method == PA_RESAMPLER_PEAKS) {
+        /* Peaks and linear need to do math on the samples */
+        if (r->map_required || a->format != b->format || method == PA_RESAMPLER_PEAKS || method == PA_RESAMPLER_LINEAR) {
 
             if (a->format == PA_SAMPLE_S16NE || b->format == PA_SAMPLE_S16NE)
                 r->work_format = PA_SAMPLE_S16NE;
@@ -307,6 +370,9 @@ pa_resampler* pa_resampler_new(
 
     r->w_sz = pa_sample_size_of_format(r->work_format);
 
+    /* The remapping function depends on the working format */
+    init_remap(r);
+
     if (r->i_ss.format != r->work_format) {
         if (r->work_format == PA_SAMPLE_FLOAT32NE) {
             if (!(r->to_work_format_func = pa_get_convert_to_float32ne_function(r->i_ss.format)))
@@ -343,6 +409,13 @@ pa_resampler* pa_resampler_new(
     if (init_table[method](r) < 0)
         goto fail;
 
+    /* The real resamplers look at some history. A tenth of a second is
+     * more than any filter we use, the others have no state at all. */
+    if (r->impl_resample && r->method != PA_RESAMPLER_TRIVIAL && r->method != PA_RESAMPLER_PEAKS)
+        r->silence_tail = (r->i_ss.rate / 10) * r->i_fz;
+
+    pa_silence_cache_init(&r->silence_cache);
+
     return r;
 
 fail:
@@ -366,6 +439,8 @@ void pa_resampler_free(pa_resampler *r) {
     if (r->from_work_format_buf.memblock)
         pa_memblock_unref(r->from_work_format_buf.memblock);
 
+    pa_silence_cache_done(&r->silence_cache);
+
     pa_xfree(r);
 }
 
@@ -460,6 +535,15 @@ void pa_resampler_reset(pa_resampler *r) {
         r->impl_reset(r);
 
     r->remap_buf_contains_leftover_data = false;
+    r->silence_bytes = 0;
+    r->silence_skipping = false;
+}
+
+void pa_resampler_set_load(pa_resampler *r, unsigned load) {
+    pa_assert(r);
+
+    if (r->impl_update_load)
+        r->impl_update_load(r, load);
 }
 
 pa_resample_method_t pa_resampler_get_method(pa_resampler *r) {
@@ -524,7 +608,9 @@ static const char * const resample_methods[] = {
     "ffmpeg",
     "auto",
     "copy",
-    "peaks"
+    "peaks",
+    "speex-float-adaptive",
+    "linear"
 };
 
 const char *pa_resample_method_to_string(pa_resample_method_t m) {
@@ -550,6 +636,8 @@ int pa_resample_method_supported(pa_resample_method_t m) {
         return 0;
     if (m >= PA_RESAMPLER_SPEEX_FIXED_BASE && m <= PA_RESAMPLER_SPEEX_FIXED_MAX)
         return 0;
+    if (m == PA_RESAMPLER_SPEEX_FLOAT_ADAPTIVE)
+        return 0;
 #endif
 
     return 1;
@@ -666,9 +754,7 @@ static void calc_map_table(pa_resampler *r) {
     pa_remap_t *m;
 
     pa_assert(r);
-
-    if (!(r->map_required = (r->i_ss.channels != r->o_ss.channels || (!(r->flags & PA_RESAMPLER_NO_REMAP) && !pa_channel_map_equal(&r->i_cm, &r->o_cm)))))
-        return;
+    pa_assert(r->map_required);
 
     m = &r->remap;
 
@@ -1019,47 +1105,228 @@ static void calc_map_table(pa_resampler *r) {
 
     pa_log_debug("Channel matrix:\n%s", t = pa_strbuf_tostring_free(s));
     pa_xfree(t);
+}
+
+/* The channel matrix and the remapping function only depend on the
+ * channel maps, the remix flags and the working format, and the same
+ * few combinations (stereo to 5.1 and the like) come up for almost every
+ * stream. Hence we keep the most recently used ones process-wide, just
+ * like the ffmpeg filter banks. */
+#define REMAP_CACHE_MAX 16
+
+typedef struct remap_cache_entry {
+    pa_channel_map i_cm, o_cm;
+    pa_resample_flags_t flags;
+    pa_sample_format_t format;
+    pa_init_remap_func_t init_func;
+
+    pa_remap_t remap;
+
+    PA_LLIST_FIELDS(struct remap_cache_entry);
+} remap_cache_entry;
+
+static PA_LLIST_HEAD(remap_cache_entry, remap_cache) = NULL;
+static unsigned n_remap_cache = 0;
+static pa_static_mutex remap_cache_mutex = PA_STATIC_MUTEX_INIT;
 
-    /* initialize the remapping function */
-    pa_init_remap(m);
+/* Copies what calc_map_table() and pa_init_remap() filled in, but not the
+ * pointers to the sample specs of the owner */
+static void copy_remap(pa_remap_t *dst, const pa_remap_t *src, unsigned n_ic, unsigned n_oc) {
+    unsigned oc;
+
+    for (oc = 0; oc < n_oc; oc++) {
+        memcpy(dst->map_table_f[oc], src->map_table_f[oc], n_ic * sizeof(float));
+        memcpy(dst->map_table_i[oc], src->map_table_i[oc], n_ic * sizeof(int32_t));
+        memcpy(dst->coefs[oc], src->coefs[oc], src->n_coefs[oc] * sizeof(pa_remap_coef_t));
+        dst->n_coefs[oc] = src->n_coefs[oc];
+    }
+
+    dst->do_remap = src->do_remap;
 }
 
-static pa_memchunk* convert_to_work_format(pa_resampler *r, pa_memchunk *input) {
-    unsigned n_samples;
-    void *src, *dst;
+static void init_remap(pa_resampler *r) {
+    pa_resample_flags_t flags;
+    pa_init_remap_func_t init_func;
+    remap_cache_entry *e;
+    pa_mutex *mutex;
+
+    pa_assert(r);
+
+    if (!r->map_required)
+        return;
+
+    flags = r->flags & (PA_RESAMPLER_NO_REMAP | PA_RESAMPLER_NO_REMIX);
+    init_func = pa_get_init_remap_func();
+
+    mutex = pa_static_mutex_get(&remap_cache_mutex, FALSE, FALSE);
+    pa_mutex_lock(mutex);
+
+    PA_LLIST_FOREACH(e, remap_cache)
+        if (e->flags == flags &&
+            e->format == r->work_format &&
+            e->init_func == init_func &&
+            e->i_cm.channels == r->i_ss.channels &&
+            e->o_cm.channels == r->o_ss.channels &&
+            pa_channel_map_equal(&e->i_cm, &r->i_cm) &&
+            pa_channel_map_equal(&e->o_cm, &r->o_cm))
+            break;
+
+    if (e) {
+        copy_remap(&r->remap, &e->remap, r->i_ss.channels, r->o_ss.channels);
+
+        /* Most recently used first */
+        PA_LLIST_REMOVE(remap_cache_entry, remap_cache, e);
+        PA_LLIST_PREPEND(remap_cache_entry, remap_cache, e);
+
+        pa_mutex_unlock(mutex);
+
+        pa_log_debug("Using cached channel matrix.");
+        return;
+    }
+
+    pa_mutex_unlock(mutex);
+
+    /* Not under the lock, this logs and might take a while */
+    calc_map_table(r);
+    pa_init_remap(&r->remap);
+
+    /* The channel maps of the resampler might not match its channel
+     * counts, these are not worth caching */
+    if (r->i_cm.channels != r->i_ss.channels || r->o_cm.channels != r->o_ss.channels)
+        return;
+
+    e = pa_xnew0(remap_cache_entry, 1);
+    e->i_cm = r->i_cm;
+    e->o_cm = r->o_cm;
+    e->flags = flags;
+    e->format = r->work_format;
+    e->init_func = init_func;
+    copy_remap(&e->remap, &r->remap, r->i_ss.channels, r->o_ss.channels);
+
+    pa_mutex_lock(mutex);
+
+    PA_LLIST_PREPEND(remap_cache_entry, remap_cache, e);
+
+    if (++n_remap_cache > REMAP_CACHE_MAX) {
+        remap_cache_entry *last;
+
+        for (last = remap_cache; last->next; last = last->next)
+            ;
+
+        PA_LLIST_REMOVE(remap_cache_entry, remap_cache, last);
+        n_remap_cache--;
+        pa_xfree(last);
+    }
+
+    pa_mutex_unlock(mutex);
+}
+
+/* Make sure b has room for length bytes. The block is kept across calls and
+ * only replaced when it is too small, or when the previous one was handed
+ * out by pa_resampler_run(). */
+static void alloc_buf(pa_resampler *r, pa_memchunk *b, size_t *size, size_t length) {
+    pa_assert(r);
+    pa_assert(b);
+    pa_assert(size);
+
+    b->index = 0;
+    b->length = length;
+
+    if (!b->memblock || *size < length) {
+        if (b->memblock)
+            pa_memblock_unref(b->memblock);
+
+        *size = length;
+        b->memblock = pa_memblock_new(r->mempool, length);
+    }
+}
+
+static pa_memchunk *convert_remap(pa_resampler *r, pa_memchunk *input, unsigned stages) {
+    pa_convert_func_t to_work = NULL, from_work = NULL;
+    pa_remap_t *remap = NULL;
+    pa_memchunk *output;
+    size_t *output_size;
+    size_t in_fz, out_fz;
+    unsigned i_ch, o_ch, n_frames, tile_frames, done, n;
+    const uint8_t *src;
+    uint8_t *dst;
 
     pa_assert(r);
     pa_assert(input);
     pa_assert(input->memblock);
 
-    /* Convert the incoming sample into the work sample format and place them
-     * in to_work_format_buf. */
+    /* Run the conversion to the work format, the channel remapping and the
+     * conversion from the work format, as far as they are selected in
+     * stages, in a single pass. The data is processed in tiles, so the
+     * intermediate results live in tile_buf and stay in the cache, and
+     * only the final result is written to a memblock. */
 
-    if (!r->to_work_format_func || !input->length)
-        return input;
+    if (stages & STAGE_TO_WORK)
+        to_work = r->to_work_format_func;
+    if ((stages & STAGE_REMAP) && r->map_required)
+        remap = &r->remap;
+    if (stages & STAGE_FROM_WORK)
+        from_work = r->from_work_format_func;
 
-    n_samples = (unsigned) ((input->length / r->i_fz) * r->i_ss.channels);
+    if ((!to_work && !remap && !from_work) || !input->length)
+        return input;
 
-    r->to_work_format_buf.index = 0;
-    r->to_work_format_buf.length = r->w_sz * n_samples;
+    i_ch = r->i_ss.channels;
+    o_ch = r->o_ss.channels;
 
-    if (!r->to_work_format_buf.memblock || r->to_work_format_buf_samples < n_samples) {
-        if (r->to_work_format_buf.memblock)
-            pa_memblock_unref(r->to_work_format_buf.memblock);
+    /* Data before the remapping stage has i_ch channels, after it o_ch */
+    in_fz = (stages & STAGE_TO_WORK) ? r->i_fz : r->w_sz * ((stages & STAGE_REMAP) ? i_ch : o_ch);
+    out_fz = (stages & STAGE_FROM_WORK) ? r->o_fz : r->w_sz * ((stages & STAGE_REMAP) ? o_ch : i_ch);
 
-        r->to_work_format_buf_samples = n_samples;
-        r->to_work_format_buf.memblock = pa_memblock_new(r->mempool, r->to_work_format_buf.length);
+    /* Keep the results in the same buffers as the separate stages used */
+    if (from_work) {
+        output = &r->from_work_format_buf;
+        output_size = &r->from_work_format_buf_size;
+    } else if (remap) {
+        output = &r->remap_buf;
+        output_size = &r->remap_buf_size;
+    } else {
+        output = &r->to_work_format_buf;
+        output_size = &r->to_work_format_buf_size;
     }
 
+    n_frames = (unsigned) (input->length / in_fz);
+    alloc_buf(r, output, output_size, n_frames * out_fz);
+
+    tile_frames = TILE_BYTES / (unsigned) (r->w_sz * PA_MAX(i_ch, o_ch));
+
     src = pa_memblock_acquire_chunk(input);
-    dst = pa_memblock_acquire(r->to_work_format_buf.memblock);
+    dst = pa_memblock_acquire(output->memblock);
+
+    for (done = 0; done < n_frames; done += n) {
+        const void *s = src + done * in_fz;
+        void *d = dst + done * out_fz;
+
+        n = PA_MIN(tile_frames, n_frames - done);
+
+        if (to_work) {
+            void *t = (remap || from_work) ? r->tile_buf[0] : d;
+
+            to_work(n * i_ch, s, t);
+            s = t;
+        }
+
+        if (remap) {
+            void *t = from_work ? r->tile_buf[1] : d;
 
-    r->to_work_format_func(n_samples, src, dst);
+            pa_assert(remap->do_remap);
+            remap->do_remap(remap, t, s, n);
+            s = t;
+        }
+
+        if (from_work)
+            from_work(n * o_ch, s, d);
+    }
 
     pa_memblock_release(input->memblock);
-    pa_memblock_release(r->to_work_format_buf.memblock);
+    pa_memblock_release(output->memblock);
 
-    return &r->to_work_format_buf;
+    return output;
 }
 
 static pa_memchunk *remap_channels(pa_resampler *r, pa_memchunk *input) {
@@ -1110,15 +1377,8 @@ static pa_memchunk *remap_channels(pa_resampler *r, pa_memchunk *input) {
             r->remap_buf_size = r->remap_buf.length;
         }
 
-    } else {
-        if (!r->remap_buf.memblock || r->remap_buf_size < r->remap_buf.length) {
-            if (r->remap_buf.memblock)
-                pa_memblock_unref(r->remap_buf.memblock);
-
-            r->remap_buf_size = r->remap_buf.length;
-            r->remap_buf.memblock = pa_memblock_new(r->mempool, r->remap_buf.length);
-        }
-    }
+    } else
+        alloc_buf(r, &r->remap_buf, &r->remap_buf_size, r->remap_buf.length);
 
     src = pa_memblock_acquire_chunk(input);
     dst = (uint8_t *) pa_memblock_acquire(r->remap_buf.memblock) + leftover_length;
@@ -1156,16 +1416,7 @@ static pa_memchunk *resample(pa_resampler *r, pa_memchunk *input) {
     out_n_frames = ((in_n_frames*r->o_ss.rate)/r->i_ss.rate)+EXTRA_FRAMES;
     out_n_samples = out_n_frames * r->work_channels;
 
-    r->resample_buf.index = 0;
-    r->resample_buf.length = r->w_sz * out_n_samples;
-
-    if (!r->resample_buf.memblock || r->resample_buf_samples < out_n_samples) {
-        if (r->resample_buf.memblock)
-            pa_memblock_unref(r->resample_buf.memblock);
-
-        r->resample_buf_samples = out_n_samples;
-        r->resample_buf.memblock = pa_memblock_new(r->mempool, r->resample_buf.length);
-    }
+    alloc_buf(r, &r->resample_buf, &r->resample_buf_size, r->w_sz * out_n_samples);
 
     r->impl_resample(r, input, in_n_frames, &r->resample_buf, &out_n_frames);
     r->resample_buf.length = out_n_frames * r->w_sz * r->work_channels;
@@ -1173,40 +1424,48 @@ static pa_memchunk *resample(pa_resampler *r, pa_memchunk *input) {
     return &r->resample_buf;
 }
 
-static pa_memchunk *convert_from_work_format(pa_resampler *r, pa_memchunk *input) {
-    unsigned n_samples, n_frames;
-    void *src, *dst;
+/* Produce as much silence as running the input through the resampler
+ * would have */
+static void resample_silence(pa_resampler *r, const pa_memchunk *in, pa_memchunk *out) {
+    uint64_t frames;
+    size_t length;
+
+    frames = in->length / r->i_fz;
+
+    /* Whatever the resampler still holds is silence by now, too. From
+     * here on the output is computed from the input length alone, so
+     * the implementation starts from scratch once real data arrives. */
+    if (!r->silence_skipping) {
+        if (r->remap_buf_contains_leftover_data) {
+            frames += r->remap_buf.length / (r->w_sz * r->work_channels);
+            r->remap_buf_contains_leftover_data = false;
+        }
 
-    pa_assert(r);
-    pa_assert(input);
+        if (r->impl_reset)
+            r->impl_reset(r);
 
-    /* Convert the data into the correct sample type and place the result in
-     * from_work_format_buf. */
+        r->silence_frac = 0;
+        r->silence_skipping = true;
+    }
 
-    if (!r->from_work_format_func || !input->length)
-        return input;
+    frames = frames * r->o_ss.rate + r->silence_frac;
+    r->silence_frac = frames % r->i_ss.rate;
+    length = (size_t) (frames / r->i_ss.rate) * r->o_fz;
 
-    n_samples = (unsigned) (input->length / r->w_sz);
-    n_frames = n_samples / r->o_ss.channels;
+    if (length <= 0) {
+        pa_memchunk_reset(out);
+        return;
+    }
 
-    r->from_work_format_buf.index = 0;
-    r->from_work_format_buf.length = r->o_fz * n_frames;
+    pa_silence_memchunk_get(&r->silence_cache, r->mempool, out, &r->o_ss, length);
 
-    if (!r->from_work_format_buf.memblock || r->from_work_format_buf_samples < n_samples) {
-        if (r->from_work_format_buf.memblock)
-            pa_memblock_unref(r->from_work_format_buf.memblock);
+    if (out->length < length) {
+        pa_memblock_unref(out->memblock);
 
-        r->from_work_format_buf_samples = n_samples;
-        r->from_work_format_buf.memblock = pa_memblock_new(r->mempool, r->from_work_format_buf.length);
+        out->memblock = pa_silence_memblock(pa_memblock_new(r->mempool, length), &r->o_ss);
+        out->index = 0;
+        out->length = length;
     }
-
-    src = pa_memblock_acquire_chunk(input);
-    dst = pa_memblock_acquire(r->from_work_format_buf.memblock);
-    r->from_work_format_func(n_samples, src, dst);
-    pa_memblock_release(input->memblock);
-    pa_memblock_release(r->from_work_format_buf.memblock);
-
-    return &r->from_work_format_buf;
 }
 
 void pa_resampler_run(pa_resampler *r, const pa_memchunk *in, pa_memchunk *out) {
@@ -1219,20 +1478,54 @@ void pa_resampler_run(pa_resampler *r, const pa_memchunk *in, pa_memchunk *out)
     pa_assert(in->memblock);
     pa_assert(in->length % r->i_fz == 0);
 
+    if (!pa_memblock_is_silence(in->memblock)) {
+        r->silence_bytes = 0;
+        r->silence_skipping = false;
+    } else if (r->silence_bytes >= r->silence_tail) {
+        resample_silence(r, in, out);
+        return;
+    } else
+        r->silence_bytes += in->length;
+
     buf = (pa_memchunk*) in;
-    buf = convert_to_work_format(r, buf);
+
+    if (r->remap_buf_contains_leftover_data) {
+        /* The leftover in remap_buf is prepended by remap_channels(), so
+         * the stages around it have to run one after the other */
+        buf = convert_remap(r, buf, STAGE_TO_WORK);
+
+        if (r->o_ss.channels <= r->i_ss.channels) {
+            buf = remap_channels(r, buf);
+            buf = resample(r, buf);
+        } else {
+            buf = resample(r, buf);
+            buf = remap_channels(r, buf);
+        }
+
+        buf = convert_remap(r, buf, STAGE_FROM_WORK);
+
+    } else if (!r->impl_resample)
+        buf = convert_remap(r, buf, STAGE_TO_WORK | STAGE_REMAP | STAGE_FROM_WORK);
+
     /* Try to save resampling effort: if we have more output channels than
      * input channels, do resampling first, then remapping. */
-    if (r->o_ss.channels <= r->i_ss.channels) {
-        buf = remap_channels(r, buf);
+    else if (r->o_ss.channels <= r->i_ss.channels) {
+        buf = convert_remap(r, buf, STAGE_TO_WORK | STAGE_REMAP);
         buf = resample(r, buf);
+        buf = convert_remap(r, buf, STAGE_FROM_WORK);
+
     } else {
+        buf = convert_remap(r, buf, STAGE_TO_WORK);
         buf = resample(r, buf);
-        buf = remap_channels(r, buf);
+
+        if (r->remap_buf_contains_leftover_data) {
+            buf = remap_channels(r, buf);
+            buf = convert_remap(r, buf, STAGE_FROM_WORK);
+        } else
+            buf = convert_remap(r, buf, STAGE_REMAP | STAGE_FROM_WORK);
     }
 
     if (buf->length) {
-        buf = convert_from_work_format(r, buf);
         *out = *buf;
 
         if (buf == in)
@@ -1399,6 +1692,39 @@ static void speex_reset(pa_resampler *r) {
     pa_assert_se(speex_resampler_reset_mem(r->speex.state) == 0);
 }
 
+static void speex_update_load(pa_resampler *r, unsigned load) {
+    int q;
+
+    pa_assert(r);
+
+    q = r->speex.quality;
+
+    if (r->speex.settle_chunks > 0)
+        r->speex.settle_chunks--;
+
+    if (load < ADAPTIVE_LOAD_LOW)
+        r->speex.low_chunks++;
+    else
+        r->speex.low_chunks = 0;
+
+    if (load >= ADAPTIVE_LOAD_HIGH && r->speex.settle_chunks <= 0 && q > ADAPTIVE_QUALITY_MIN)
+        q--;
+    else if (r->speex.low_chunks >= ADAPTIVE_RAISE_CHUNKS && q < ADAPTIVE_QUALITY_MAX)
+        q++;
+    else
+        return;
+
+    pa_log_debug("Render load at %u%%, switching to speex quality setting %i.", load, q);
+
+    /* speex carries the filter history over to the new filter, so this
+     * does not interrupt the signal */
+    pa_assert_se(speex_resampler_set_quality(r->speex.state, q) == 0);
+
+    r->speex.quality = q;
+    r->speex.settle_chunks = ADAPTIVE_SETTLE_CHUNKS;
+    r->speex.low_chunks = 0;
+}
+
 static void speex_free(pa_resampler *r) {
     pa_assert(r);
 
@@ -1422,6 +1748,14 @@ static int speex_init(pa_resampler *r) {
         q = r->method - PA_RESAMPLER_SPEEX_FIXED_BASE;
         r->impl_resample = speex_resample_int;
 
+    } else if (r->method == PA_RESAMPLER_SPEEX_FLOAT_ADAPTIVE) {
+
+        /* Start out at the best quality and leave it only under load */
+        q = r->speex.quality = ADAPTIVE_QUALITY_MAX;
+        r->speex.settle_chunks = r->speex.low_chunks = 0;
+        r->impl_resample = speex_resample_float;
+        r->impl_update_load = speex_update_load;
+
     } else {
         pa_assert(r->method >= PA_RESAMPLER_SPEEX_FLOAT_BASE && r->method <= PA_RESAMPLER_SPEEX_FLOAT_MAX);
 
@@ -1504,16 +1838,84 @@ static int trivial_init(pa_resampler*r) {
 
 /* Peak finder implementation */
 
+static void peaks_s16ne_c(unsigned channels, const void *src, unsigned n, void *max) {
+    const int16_t *s = src;
+    int16_t *m = max;
+    unsigned i, c;
+
+    for (i = 0; i < n; i++)
+        for (c = 0; c < channels; c++) {
+            int16_t v = abs(*s++);
+
+            if (v > m[c])
+                m[c] = v;
+        }
+}
+
+static void peaks_float32ne_c(unsigned channels, const void *src, unsigned n, void *max) {
+    const float *s = src;
+    float *m = max;
+    unsigned i, c;
+
+    /* 1ch float is treated separately, because that is the common case */
+    if (channels == 1) {
+        for (i = 0; i < n; i++) {
+            float v = fabsf(*s++);
+
+            if (v > m[0])
+                m[0] = v;
+        }
+
+        return;
+    }
+
+    for (i = 0; i < n; i++)
+        for (c = 0; c < channels; c++) {
+            float v = fabsf(*s++);
+
+            if (v > m[c])
+                m[c] = v;
+        }
+}
+
+static pa_resampler_peaks_func_t peaks_table[] = {
+    [PA_SAMPLE_S16NE]     = peaks_s16ne_c,
+    [PA_SAMPLE_FLOAT32NE] = peaks_float32ne_c,
+};
+
+pa_resampler_peaks_func_t pa_get_resampler_peaks_func(pa_sample_format_t f) {
+    pa_assert(f == PA_SAMPLE_S16NE || f == PA_SAMPLE_FLOAT32NE);
+
+    return peaks_table[f];
+}
+
+void pa_set_resampler_peaks_func(pa_sample_format_t f, pa_resampler_peaks_func_t func) {
+    pa_assert(f == PA_SAMPLE_S16NE || f == PA_SAMPLE_FLOAT32NE);
+
+    peaks_table[f] = func;
+}
+
 static void peaks_resample(pa_resampler *r, const pa_memchunk *input, unsigned in_n_frames, pa_memchunk *output, unsigned *out_n_frames) {
+    pa_resampler_peaks_func_t func;
     unsigned c, o_index = 0;
     unsigned i, i_end = 0;
-    void *src, *dst;
+    size_t fz;
+    uint8_t *src, *dst;
+    void *max;
 
     pa_assert(r);
     pa_assert(input);
     pa_assert(output);
     pa_assert(out_n_frames);
 
+    func = peaks_table[r->work_format];
+    fz = r->w_sz * r->work_channels;
+
+    if (r->work_format == PA_SAMPLE_S16NE)
+        max = r->peaks.max_i;
+    else
+        max = r->peaks.max_f;
+
     src = pa_memblock_acquire_chunk(input);
     dst = pa_memblock_acquire_chunk(output);
 
@@ -1521,66 +1923,37 @@ static void peaks_resample(pa_resampler *r, const pa_memchunk *input, unsigned i
     i = i > r->peaks.i_counter ? i - r->peaks.i_counter : 0;
 
     while (i_end < in_n_frames) {
+        unsigned n;
+
         i_end = ((uint64_t) (r->peaks.o_counter + 1) * r->i_ss.rate) / r->o_ss.rate;
         i_end = i_end > r->peaks.i_counter ? i_end - r->peaks.i_counter : 0;
 
-        pa_assert_fp(o_index * r->w_sz * r->o_ss.channels < pa_memblock_get_length(output->memblock));
-
-        /* 1ch float is treated separately, because that is the common case */
-        if (r->o_ss.channels == 1 && r->work_format == PA_SAMPLE_FLOAT32NE) {
-            float *s = (float*) src + i;
-            float *d = (float*) dst + o_index;
-
-            for (; i < i_end && i < in_n_frames; i++) {
-                float n = fabsf(*s++);
-
-                if (n > r->peaks.max_f[0])
-                    r->peaks.max_f[0] = n;
-            }
+        pa_assert_fp(o_index * fz < pa_memblock_get_length(output->memblock));
 
-            if (i == i_end) {
-                *d = r->peaks.max_f[0];
-                r->peaks.max_f[0] = 0;
-                o_index++, r->peaks.o_counter++;
-            }
-        } else if (r->work_format == PA_SAMPLE_S16NE) {
-            int16_t *s = (int16_t*) src + r->i_ss.channels * i;
-            int16_t *d = (int16_t*) dst + r->o_ss.channels * o_index;
+        n = PA_MIN(i_end, in_n_frames);
+        if (n > i) {
+            func(r->work_channels, src + i * fz, n - i, max);
+            i = n;
+        }
 
-            for (; i < i_end && i < in_n_frames; i++)
-                for (c = 0; c < r->o_ss.channels; c++) {
-                    int16_t n = abs(*s++);
+        if (i == i_end) {
+            if (r->work_format == PA_SAMPLE_S16NE) {
+                int16_t *d = (int16_t*) (dst + o_index * fz);
 
-                    if (n > r->peaks.max_i[c])
-                        r->peaks.max_i[c] = n;
-                }
-
-            if (i == i_end) {
-                for (c = 0; c < r->o_ss.channels; c++, d++) {
-                    *d = r->peaks.max_i[c];
+                for (c = 0; c < r->work_channels; c++) {
+                    d[c] = r->peaks.max_i[c];
                     r->peaks.max_i[c] = 0;
                 }
-                o_index++, r->peaks.o_counter++;
-            }
-        } else {
-            float *s = (float*) src + r->i_ss.channels * i;
-            float *d = (float*) dst + r->o_ss.channels * o_index;
-
-            for (; i < i_end && i < in_n_frames; i++)
-                for (c = 0; c < r->o_ss.channels; c++) {
-                    float n = fabsf(*s++);
-
-                    if (n > r->peaks.max_f[c])
-                        r->peaks.max_f[c] = n;
-                }
+            } else {
+                float *d = (float*) (dst + o_index * fz);
 
-            if (i == i_end) {
-                for (c = 0; c < r->o_ss.channels; c++, d++) {
-                    *d = r->peaks.max_f[c];
+                for (c = 0; c < r->work_channels; c++) {
+                    d[c] = r->peaks.max_f[c];
                     r->peaks.max_f[c] = 0;
                 }
-                o_index++, r->peaks.o_counter++;
             }
+
+            o_index++, r->peaks.o_counter++;
         }
     }
 
@@ -1623,94 +1996,269 @@ static int peaks_init(pa_resampler*r) {
     return 0;
 }
 
-/*** ffmpeg based implementation ***/
+/* Linear interpolation implementation */
 
-static void ffmpeg_resample(pa_resampler *r, const pa_memchunk *input, unsigned in_n_frames, pa_memchunk *output, unsigned *out_n_frames) {
-    unsigned used_frames = 0, c;
-    int previous_consumed_frames = -1;
+static void linear_s16ne_c(unsigned channels, const void *src, const unsigned *index, const float *weight, unsigned n, void *dst) {
+    const int16_t *s = src;
+    int16_t *d = dst;
+    unsigned i, c;
+
+    for (i = 0; i < n; i++) {
+        const int16_t *a = s + (index[i] - 1) * channels, *b = a + channels;
+
+        for (c = 0; c < channels; c++)
+            *(d++) = (int16_t) (a[c] + lrintf(weight[i] * (float) (b[c] - a[c])));
+    }
+}
+
+static void linear_float32ne_c(unsigned channels, const void *src, const unsigned *index, const float *weight, unsigned n, void *dst) {
+    const float *s = src;
+    float *d = dst;
+    unsigned i, c;
+
+    for (i = 0; i < n; i++) {
+        const float *a = s + (index[i] - 1) * channels, *b = a + channels;
+
+        for (c = 0; c < channels; c++)
+            *(d++) = a[c] + weight[i] * (b[c] - a[c]);
+    }
+}
+
+static pa_resampler_linear_func_t linear_table[] = {
+    [PA_SAMPLE_S16NE]     = linear_s16ne_c,
+    [PA_SAMPLE_FLOAT32NE] = linear_float32ne_c,
+};
+
+pa_resampler_linear_func_t pa_get_resampler_linear_func(pa_sample_format_t f) {
+    pa_assert(f == PA_SAMPLE_S16NE || f == PA_SAMPLE_FLOAT32NE);
+
+    return linear_table[f];
+}
+
+void pa_set_resampler_linear_func(pa_sample_format_t f, pa_resampler_linear_func_t func) {
+    pa_assert(f == PA_SAMPLE_S16NE || f == PA_SAMPLE_FLOAT32NE);
+
+    linear_table[f] = func;
+}
+
+static void linear_resample(pa_resampler *r, const pa_memchunk *input, unsigned in_n_frames, pa_memchunk *output, unsigned *out_n_frames) {
+    pa_resampler_linear_func_t func;
+    unsigned index[LINEAR_BLOCK];
+    float weight[LINEAR_BLOCK];
+    unsigned i, n, o_index = 0;
+    unsigned frac, i_rate, o_rate;
+    size_t fz;
+    uint8_t *src, *dst;
+    float scale;
 
     pa_assert(r);
     pa_assert(input);
     pa_assert(output);
     pa_assert(out_n_frames);
+    pa_assert(in_n_frames > 0);
 
-    for (c = 0; c < r->work_channels; c++) {
-        unsigned u;
-        pa_memblock *b, *w;
-        int16_t *p, *t, *k, *q, *s;
-        int consumed_frames;
-
-        /* Allocate a new block */
-        b = pa_memblock_new(r->mempool, r->ffmpeg.buf[c].length + in_n_frames * sizeof(int16_t));
-        p = pa_memblock_acquire(b);
-
-        /* Now copy the input data, splitting up channels */
-        t = (int16_t*) pa_memblock_acquire_chunk(input) + c;
-        k = p;
-        for (u = 0; u < in_n_frames; u++) {
-            *k = *t;
-            t += r->work_channels;
-            k ++;
-        }
-        pa_memblock_release(input->memblock);
-
-        /* Allocate buffer for the result */
-        w = pa_memblock_new(r->mempool, *out_n_frames * sizeof(int16_t));
-        q = pa_memblock_acquire(w);
-
-        /* Now, resample */
-        used_frames = (unsigned) av_resample(r->ffmpeg.state,
-                                             q, p,
-                                             &consumed_frames,
-                                             (int) in_n_frames, (int) *out_n_frames,
-                                             c >= (unsigned) (r->work_channels-1));
-
-        pa_memblock_release(b);
-        pa_memblock_unref(b);
-
-        pa_assert(consumed_frames <= (int) in_n_frames);
-        pa_assert(previous_consumed_frames == -1 || consumed_frames == previous_consumed_frames);
-        previous_consumed_frames = consumed_frames;
-
-        /* And place the results in the output buffer */
-        s = (int16_t *) pa_memblock_acquire_chunk(output) + c;
-        for (u = 0; u < used_frames; u++) {
-            *s = *q;
-            q++;
-            s += r->work_channels;
+    func = linear_table[r->work_format];
+    fz = r->w_sz * r->work_channels;
+
+    src = pa_memblock_acquire_chunk(input);
+    dst = pa_memblock_acquire_chunk(output);
+
+    /* Without a previous chunk the stream starts with its first frame */
+    if (!r->linear.have_edge) {
+        memcpy(r->linear.edge, src, fz);
+        r->linear.have_edge = true;
+    }
+
+    memcpy((uint8_t*) r->linear.edge + fz, src, fz);
+
+    i = r->linear.index;
+    frac = r->linear.frac;
+    i_rate = r->i_ss.rate;
+    o_rate = r->o_ss.rate;
+    scale = 1.0f / (float) o_rate;
+
+    while (i < in_n_frames) {
+
+        /* Frames between the two chunks are taken from the edge buffer,
+         * where the first frame of this chunk has index 1 */
+        bool edge = i == 0;
+
+        for (n = 0; n < LINEAR_BLOCK && i < in_n_frames && (i == 0) == edge; n++) {
+            index[n] = edge ? 1 : i;
+            weight[n] = (float) frac * scale;
+
+            frac += i_rate;
+            i += frac / o_rate;
+            frac %= o_rate;
         }
-        pa_memblock_release(output->memblock);
-        pa_memblock_release(w);
-        pa_memblock_unref(w);
+
+        pa_assert_fp(o_index + n <= *out_n_frames);
+
+        func(r->work_channels, edge ? (const void*) r->linear.edge : src, index, weight, n, dst + o_index * fz);
+        o_index += n;
+    }
+
+    memcpy(r->linear.edge, src + (in_n_frames - 1) * fz, fz);
+
+    pa_memblock_release(input->memblock);
+    pa_memblock_release(output->memblock);
+
+    *out_n_frames = o_index;
+
+    r->linear.index = i - in_n_frames;
+    r->linear.frac = frac;
+}
+
+static void linear_update_rates(pa_resampler *r) {
+    pa_assert(r);
+
+    /* Keep the phase, so that rate adjustments don't skip or repeat
+     * frames */
+    r->linear.frac = (unsigned) (((uint64_t) r->linear.frac * r->o_ss.rate) / r->linear.rate);
+    r->linear.rate = r->o_ss.rate;
+}
+
+static void linear_reset(pa_resampler *r) {
+    pa_assert(r);
+
+    r->linear.index = 0;
+    r->linear.frac = 0;
+    r->linear.have_edge = false;
+}
+
+static int linear_init(pa_resampler*r) {
+    pa_assert(r);
+    pa_assert(r->work_format == PA_SAMPLE_S16NE || r->work_format == PA_SAMPLE_FLOAT32NE);
+
+    r->linear.rate = r->o_ss.rate;
+    linear_reset(r);
+
+    r->impl_resample = linear_resample;
+    r->impl_update_rates = linear_update_rates;
+    r->impl_reset = linear_reset;
+
+    return 0;
+}
+
+/*** ffmpeg based implementation ***/
+
+/* The polyphase filter bank only depends on the resampling factor and the
+ * filter parameters, and av_resample() never writes to it. Hence all
+ * resamplers in the process share one refcounted bank per parameter set,
+ * which makes creating a stream with a common rate pair cheap. */
+typedef struct ffmpeg_filter_bank {
+    double factor;
+    int filter_length;
+    int phase_count;
+    unsigned ref;
+    int16_t *filter;
+
+    PA_LLIST_FIELDS(struct ffmpeg_filter_bank);
+} ffmpeg_filter_bank;
+
+static PA_LLIST_HEAD(ffmpeg_filter_bank, ffmpeg_filter_banks) = NULL;
+static pa_static_mutex ffmpeg_filter_banks_mutex = PA_STATIC_MUTEX_INIT;
+
+int16_t *av_filter_bank_ref(double factor, int filter_length, int phase_count) {
+    ffmpeg_filter_bank *b;
+    pa_mutex *m;
+
+    m = pa_static_mutex_get(&ffmpeg_filter_banks_mutex, FALSE, FALSE);
+    pa_mutex_lock(m);
+
+    PA_LLIST_FOREACH(b, ffmpeg_filter_banks)
+        if (b->factor == factor && b->filter_length == filter_length && b->phase_count == phase_count)
+            break;
+
+    if (b)
+        b->ref++;
+    else {
+        b = pa_xnew(ffmpeg_filter_bank, 1);
+        b->factor = factor;
+        b->filter_length = filter_length;
+        b->phase_count = phase_count;
+        b->ref = 1;
+        b->filter = av_build_filter_bank(factor, filter_length, phase_count);
+
+        PA_LLIST_PREPEND(ffmpeg_filter_bank, ffmpeg_filter_banks, b);
+    }
+
+    pa_mutex_unlock(m);
+
+    return b->filter;
+}
+
+void av_filter_bank_unref(int16_t *filter) {
+    ffmpeg_filter_bank *b;
+    pa_mutex *m;
+
+    pa_assert(filter);
+
+    m = pa_static_mutex_get(&ffmpeg_filter_banks_mutex, FALSE, FALSE);
+    pa_mutex_lock(m);
+
+    PA_LLIST_FOREACH(b, ffmpeg_filter_banks)
+        if (b->filter == filter)
+            break;
+
+    pa_assert(b);
+    pa_assert(b->ref > 0);
+
+    if (--b->ref <= 0) {
+        PA_LLIST_REMOVE(ffmpeg_filter_bank, ffmpeg_filter_banks, b);
+        av_free(b->filter);
+        pa_xfree(b);
     }
 
-    if (previous_consumed_frames < (int) in_n_frames) {
-        void *leftover_data = (int16_t *) pa_memblock_acquire_chunk(input) + previous_consumed_frames * r->o_ss.channels;
-        size_t leftover_length = (in_n_frames - previous_consumed_frames) * r->o_ss.channels * sizeof(int16_t);
+    pa_mutex_unlock(m);
+}
+
+static void ffmpeg_resample(pa_resampler *r, const pa_memchunk *input, unsigned in_n_frames, pa_memchunk *output, unsigned *out_n_frames) {
+    int16_t *src, *dst;
+    int consumed_frames;
+    unsigned used_frames;
+
+    pa_assert(r);
+    pa_assert(input);
+    pa_assert(output);
+    pa_assert(out_n_frames);
+
+    /* All channels are filtered together, straight from the
+     * interleaved input into the interleaved output */
+    src = pa_memblock_acquire_chunk(input);
+    dst = pa_memblock_acquire_chunk(output);
+
+    used_frames = (unsigned) av_resample(r->ffmpeg.state,
+                                         dst, src,
+                                         (int) r->work_channels,
+                                         &consumed_frames,
+                                         (int) in_n_frames, (int) *out_n_frames,
+                                         1);
+
+    pa_memblock_release(output->memblock);
+
+    pa_assert(consumed_frames <= (int) in_n_frames);
+
+    if (consumed_frames < (int) in_n_frames) {
+        void *leftover_data = src + consumed_frames * r->work_channels;
+        size_t leftover_length = (in_n_frames - consumed_frames) * r->work_channels * sizeof(int16_t);
 
         save_leftover(r, leftover_data, leftover_length);
-        pa_memblock_release(input->memblock);
     }
 
+    pa_memblock_release(input->memblock);
+
     *out_n_frames = used_frames;
 }
 
 static void ffmpeg_free(pa_resampler *r) {
-    unsigned c;
-
     pa_assert(r);
 
     if (r->ffmpeg.state)
         av_resample_close(r->ffmpeg.state);
-
-    for (c = 0; c < PA_ELEMENTSOF(r->ffmpeg.buf); c++)
-        if (r->ffmpeg.buf[c].memblock)
-            pa_memblock_unref(r->ffmpeg.buf[c].memblock);
 }
 
 static int ffmpeg_init(pa_resampler *r) {
-    unsigned c;
-
     pa_assert(r);
 
     /* We could probably implement different quality levels by
@@ -1724,9 +2272,6 @@ static int ffmpeg_init(pa_resampler *r) {
     r->impl_free = ffmpeg_free;
     r->impl_resample = ffmpeg_resample;
 
-    for (c = 0; c < PA_ELEMENTSOF(r->ffmpeg.buf); c++)
-        pa_memchunk_reset(&r->ffmpeg.buf[c]);
-
     return 0;
 }
 
@@ -45,6 +45,8 @@ typedef enum pa_resample_method {
     PA_RESAMPLER_AUTO, /* automatic select based on sample format */
     PA_RESAMPLER_COPY,
     PA_RESAMPLER_PEAKS,
+    PA_RESAMPLER_SPEEX_FLOAT_ADAPTIVE, /* speex-float, quality following the render load */
+    PA_RESAMPLER_LINEAR,
     PA_RESAMPLER_MAX
 } pa_resample_method_t;
 
@@ -87,6 +89,11 @@ void pa_resampler_set_output_rate(pa_resampler *r, uint32_t rate);
 /* Reinitialize state of the resampler, possibly due to seeking or other discontinuities */
 void pa_resampler_reset(pa_resampler *r);
 
+/* Tell the resampler how long the last renders took, in percent of the
+ * duration of the audio produced. Only the adaptive method acts on it,
+ * by changing its quality at the next chunk. */
+void pa_resampler_set_load(pa_resampler *r, unsigned load);
+
 /* Return the resampling method of the resampler object */
 pa_resample_method_t pa_resampler_get_method(pa_resampler *r);
 
@@ -99,6 +106,22 @@ const char *pa_resample_method_to_string(pa_resample_method_t m);
 /* Return 1 when the specified resampling method is supported */
 int pa_resample_method_supported(pa_resample_method_t m);
 
+/* Linear interpolation of n frames for the linear resampler. Frame i of
+ * dst lies weight[i] of the way from frame index[i] - 1 to frame
+ * index[i] of src. The index is never 0. */
+typedef void (*pa_resampler_linear_func_t)(unsigned channels, const void *src, const unsigned *index, const float *weight, unsigned n, void *dst);
+
+pa_resampler_linear_func_t pa_get_resampler_linear_func(pa_sample_format_t f);
+void pa_set_resampler_linear_func(pa_sample_format_t f, pa_resampler_linear_func_t func);
+
+/* Raises max[c] to the largest absolute value of channel c in n frames
+ * of src, for the peaks resampler. max is of the same type as the
+ * samples. */
+typedef void (*pa_resampler_peaks_func_t)(unsigned channels, const void *src, unsigned n, void *max);
+
+pa_resampler_peaks_func_t pa_get_resampler_peaks_func(pa_sample_format_t f);
+void pa_set_resampler_peaks_func(pa_sample_format_t f, pa_resampler_peaks_func_t func);
+
 const pa_channel_map* pa_resampler_input_channel_map(pa_resampler *r);
 const pa_sample_spec* pa_resampler_input_sample_spec(pa_resampler *r);
 const pa_channel_map* pa_resampler_output_channel_map(pa_resampler *r);
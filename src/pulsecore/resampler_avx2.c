@@ -0,0 +1,131 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <math.h>
+#include <stdlib.h>
+
+#include <pulsecore/macro.h>
+#include <pulsecore/log.h>
+#include <pulsecore/resampler.h>
+
+#include "cpu-x86.h"
+#include "simd-x86.h"
+
+/* The peak finder of resampler_sse2.c, twice as wide. This also covers
+ * eight float channels. */
+
+static void peaks_s16ne_avx2(unsigned channels, const void *src, unsigned n, void *max) {
+    const int16_t *s = src;
+    int16_t *m = max;
+    unsigned i = 0, c;
+
+    if (channels == 1 || channels == 2 || channels == 4 || channels == 8) {
+        PA_DECLARE_ALIGNED(32, int16_t, lanes[16]);
+        __m256i acc, zero = _mm256_setzero_si256();
+        __m128i r;
+
+        for (c = 0; c < 16; c++)
+            lanes[c] = m[c % channels];
+        acc = _mm256_load_si256((const __m256i*) lanes);
+
+        for (; i + 16 <= n * channels; i += 16, s += 16) {
+            __m256i v = _mm256_loadu_si256((const __m256i*) s);
+
+            acc = _mm256_max_epi16(acc, _mm256_max_epi16(v, _mm256_sub_epi16(zero, v)));
+        }
+
+        r = _mm_max_epi16(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+        if (channels < 8)
+            r = _mm_max_epi16(r, _mm_srli_si128(r, 8));
+        if (channels < 4)
+            r = _mm_max_epi16(r, _mm_srli_si128(r, 4));
+        if (channels < 2)
+            r = _mm_max_epi16(r, _mm_srli_si128(r, 2));
+
+        _mm_store_si128((__m128i*) lanes, r);
+        for (c = 0; c < channels; c++)
+            m[c] = lanes[c];
+
+        i /= channels;
+    }
+
+    for (; i < n; i++)
+        for (c = 0; c < channels; c++) {
+            int16_t v = abs(*s++);
+
+            if (v > m[c])
+                m[c] = v;
+        }
+}
+
+static void peaks_float32ne_avx2(unsigned channels, const void *src, unsigned n, void *max) {
+    const float *s = src;
+    float *m = max;
+    unsigned i = 0, c;
+
+    if (channels == 1 || channels == 2 || channels == 4 || channels == 8) {
+        PA_DECLARE_ALIGNED(32, float, lanes[8]);
+        __m256 acc, mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+        __m128 r;
+
+        for (c = 0; c < 8; c++)
+            lanes[c] = m[c % channels];
+        acc = _mm256_load_ps(lanes);
+
+        /* vmaxps returns its second operand if either one is a NaN */
+        for (; i + 8 <= n * channels; i += 8, s += 8)
+            acc = _mm256_max_ps(_mm256_and_ps(_mm256_loadu_ps(s), mask), acc);
+
+        if (channels == 8) {
+            _mm256_store_ps(lanes, acc);
+        } else {
+            r = _mm_max_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+            if (channels < 4)
+                r = _mm_max_ps(r, _mm_movehl_ps(r, r));
+            if (channels < 2)
+                r = _mm_max_ps(r, _mm_shuffle_ps(r, r, _MM_SHUFFLE(1, 1, 1, 1)));
+
+            _mm_store_ps(lanes, r);
+        }
+
+        for (c = 0; c < channels; c++)
+            m[c] = lanes[c];
+
+        i /= channels;
+    }
+
+    for (; i < n; i++)
+        for (c = 0; c < channels; c++) {
+            float v = fabsf(*s++);
+
+            if (v > m[c])
+                m[c] = v;
+        }
+}
+
+void pa_resampler_func_init_avx2(pa_cpu_x86_flag_t flags) {
+    pa_log_info("Initialising AVX2 optimized resampler functions.");
+
+    pa_set_resampler_peaks_func(PA_SAMPLE_S16NE, peaks_s16ne_avx2);
+    pa_set_resampler_peaks_func(PA_SAMPLE_FLOAT32NE, peaks_float32ne_avx2);
+}
@@ -0,0 +1,235 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <math.h>
+#include <stdlib.h>
+
+#include <pulsecore/macro.h>
+#include <pulsecore/log.h>
+#include <pulsecore/resampler.h>
+
+#include "cpu-x86.h"
+#include "simd-x86.h"
+
+/* The interpolation of the linear resampler. The two frames an output
+ * frame lies between are adjacent in memory, so for one and two channels
+ * several output frames are gathered into one vector. The operations are
+ * those of the C version in the same order, with the same rounding, so
+ * the results are identical. */
+
+static void linear_s16ne_sse2(unsigned channels, const void *src, const unsigned *index, const float *weight, unsigned n, void *dst) {
+    const int16_t *s = src;
+    int16_t *d = dst;
+    unsigned i = 0, c;
+
+    if (channels == 1) {
+        for (; i + 4 <= n; i += 4, d += 4) {
+            const int16_t *a0 = s + index[i] - 1, *a1 = s + index[i + 1] - 1;
+            const int16_t *a2 = s + index[i + 2] - 1, *a3 = s + index[i + 3] - 1;
+            __m128i a = _mm_set_epi32(a3[0], a2[0], a1[0], a0[0]);
+            __m128i b = _mm_set_epi32(a3[1], a2[1], a1[1], a0[1]);
+            __m128 w = _mm_loadu_ps(weight + i);
+
+            b = _mm_cvtps_epi32(_mm_mul_ps(w, _mm_cvtepi32_ps(_mm_sub_epi32(b, a))));
+            _mm_storel_epi64((__m128i*) d, _mm_packs_epi32(_mm_add_epi32(a, b), b));
+        }
+
+    } else if (channels == 2) {
+        for (; i + 2 <= n; i += 2, d += 4) {
+            /* The 16 bit lanes of t are a of both frames, then b of both */
+            __m128i t = _mm_unpacklo_epi32(_mm_loadl_epi64((const __m128i*) (s + (index[i] - 1) * 2)),
+                                           _mm_loadl_epi64((const __m128i*) (s + (index[i + 1] - 1) * 2)));
+            __m128i a = _mm_srai_epi32(_mm_unpacklo_epi16(t, t), 16);
+            __m128i b = _mm_srai_epi32(_mm_unpackhi_epi16(t, t), 16);
+            __m128 w = _mm_set_ps(weight[i + 1], weight[i + 1], weight[i], weight[i]);
+
+            b = _mm_cvtps_epi32(_mm_mul_ps(w, _mm_cvtepi32_ps(_mm_sub_epi32(b, a))));
+            _mm_storel_epi64((__m128i*) d, _mm_packs_epi32(_mm_add_epi32(a, b), b));
+        }
+
+    } else if (channels % 4 == 0) {
+        for (; i < n; i++) {
+            const int16_t *a = s + (index[i] - 1) * channels, *b = a + channels;
+            __m128 w = _mm_set1_ps(weight[i]);
+
+            for (c = 0; c < channels; c += 4, d += 4) {
+                __m128i va = _mm_loadl_epi64((const __m128i*) (a + c));
+                __m128i vb = _mm_loadl_epi64((const __m128i*) (b + c));
+
+                va = _mm_srai_epi32(_mm_unpacklo_epi16(va, va), 16);
+                vb = _mm_srai_epi32(_mm_unpacklo_epi16(vb, vb), 16);
+
+                vb = _mm_cvtps_epi32(_mm_mul_ps(w, _mm_cvtepi32_ps(_mm_sub_epi32(vb, va))));
+                _mm_storel_epi64((__m128i*) d, _mm_packs_epi32(_mm_add_epi32(va, vb), vb));
+            }
+        }
+    }
+
+    for (; i < n; i++) {
+        const int16_t *a = s + (index[i] - 1) * channels, *b = a + channels;
+
+        for (c = 0; c < channels; c++)
+            *(d++) = (int16_t) (a[c] + lrintf(weight[i] * (float) (b[c] - a[c])));
+    }
+}
+
+static void linear_float32ne_sse2(unsigned channels, const void *src, const unsigned *index, const float *weight, unsigned n, void *dst) {
+    const float *s = src;
+    float *d = dst;
+    unsigned i = 0, c;
+
+    if (channels == 1) {
+        for (; i + 4 <= n; i += 4, d += 4) {
+            const float *a0 = s + index[i] - 1, *a1 = s + index[i + 1] - 1;
+            const float *a2 = s + index[i + 2] - 1, *a3 = s + index[i + 3] - 1;
+            __m128 a = _mm_set_ps(a3[0], a2[0], a1[0], a0[0]);
+            __m128 b = _mm_set_ps(a3[1], a2[1], a1[1], a0[1]);
+
+            _mm_storeu_ps(d, _mm_add_ps(a, _mm_mul_ps(_mm_loadu_ps(weight + i), _mm_sub_ps(b, a))));
+        }
+
+    } else if (channels == 2) {
+        for (; i + 2 <= n; i += 2, d += 4) {
+            /* Both frames to interpolate between in one load */
+            __m128 v0 = _mm_loadu_ps(s + (index[i] - 1) * 2);
+            __m128 v1 = _mm_loadu_ps(s + (index[i + 1] - 1) * 2);
+            __m128 a = _mm_movelh_ps(v0, v1), b = _mm_movehl_ps(v1, v0);
+            __m128 w = _mm_set_ps(weight[i + 1], weight[i + 1], weight[i], weight[i]);
+
+            _mm_storeu_ps(d, _mm_add_ps(a, _mm_mul_ps(w, _mm_sub_ps(b, a))));
+        }
+
+    } else if (channels % 4 == 0) {
+        for (; i < n; i++) {
+            const float *a = s + (index[i] - 1) * channels, *b = a + channels;
+            __m128 w = _mm_set1_ps(weight[i]);
+
+            for (c = 0; c < channels; c += 4, d += 4) {
+                __m128 va = _mm_loadu_ps(a + c), vb = _mm_loadu_ps(b + c);
+
+                _mm_storeu_ps(d, _mm_add_ps(va, _mm_mul_ps(w, _mm_sub_ps(vb, va))));
+            }
+        }
+    }
+
+    for (; i < n; i++) {
+        const float *a = s + (index[i] - 1) * channels, *b = a + channels;
+
+        for (c = 0; c < channels; c++)
+            *(d++) = a[c] + weight[i] * (b[c] - a[c]);
+    }
+}
+
+/* The peak finder. With a channel count that divides the vector width
+ * every lane always sees the same channel, so the maxima are collected
+ * per lane and then folded down to one per channel. Like in the C
+ * version -32768 stays negative and NaNs are ignored. */
+
+static void peaks_s16ne_sse2(unsigned channels, const void *src, unsigned n, void *max) {
+    const int16_t *s = src;
+    int16_t *m = max;
+    unsigned i = 0, c;
+
+    if (channels == 1 || channels == 2 || channels == 4 || channels == 8) {
+        PA_DECLARE_ALIGNED(16, int16_t, lanes[8]);
+        __m128i acc, zero = _mm_setzero_si128();
+
+        for (c = 0; c < 8; c++)
+            lanes[c] = m[c % channels];
+        acc = _mm_load_si128((const __m128i*) lanes);
+
+        for (; i + 8 <= n * channels; i += 8, s += 8) {
+            __m128i v = _mm_loadu_si128((const __m128i*) s);
+
+            acc = _mm_max_epi16(acc, _mm_max_epi16(v, _mm_sub_epi16(zero, v)));
+        }
+
+        if (channels < 8)
+            acc = _mm_max_epi16(acc, _mm_srli_si128(acc, 8));
+        if (channels < 4)
+            acc = _mm_max_epi16(acc, _mm_srli_si128(acc, 4));
+        if (channels < 2)
+            acc = _mm_max_epi16(acc, _mm_srli_si128(acc, 2));
+
+        _mm_store_si128((__m128i*) lanes, acc);
+        for (c = 0; c < channels; c++)
+            m[c] = lanes[c];
+
+        i /= channels;
+    }
+
+    for (; i < n; i++)
+        for (c = 0; c < channels; c++) {
+            int16_t v = abs(*s++);
+
+            if (v > m[c])
+                m[c] = v;
+        }
+}
+
+static void peaks_float32ne_sse2(unsigned channels, const void *src, unsigned n, void *max) {
+    const float *s = src;
+    float *m = max;
+    unsigned i = 0, c;
+
+    if (channels == 1 || channels == 2 || channels == 4) {
+        PA_DECLARE_ALIGNED(16, float, lanes[4]);
+        __m128 acc, mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+
+        for (c = 0; c < 4; c++)
+            lanes[c] = m[c % channels];
+        acc = _mm_load_ps(lanes);
+
+        /* maxps returns its second operand if either one is a NaN */
+        for (; i + 4 <= n * channels; i += 4, s += 4)
+            acc = _mm_max_ps(_mm_and_ps(_mm_loadu_ps(s), mask), acc);
+
+        if (channels < 4)
+            acc = _mm_max_ps(acc, _mm_movehl_ps(acc, acc));
+        if (channels < 2)
+            acc = _mm_max_ps(acc, _mm_shuffle_ps(acc, acc, _MM_SHUFFLE(1, 1, 1, 1)));
+
+        _mm_store_ps(lanes, acc);
+        for (c = 0; c < channels; c++)
+            m[c] = lanes[c];
+
+        i /= channels;
+    }
+
+    for (; i < n; i++)
+        for (c = 0; c < channels; c++) {
+            float v = fabsf(*s++);
+
+            if (v > m[c])
+                m[c] = v;
+        }
+}
+
+void pa_resampler_func_init_sse2(pa_cpu_x86_flag_t flags) {
+    pa_log_info("Initialising SSE2 optimized resampler functions.");
+
+    pa_set_resampler_linear_func(PA_SAMPLE_S16NE, linear_s16ne_sse2);
+    pa_set_resampler_linear_func(PA_SAMPLE_FLOAT32NE, linear_float32ne_sse2);
+    pa_set_resampler_peaks_func(PA_SAMPLE_S16NE, peaks_s16ne_sse2);
+    pa_set_resampler_peaks_func(PA_SAMPLE_FLOAT32NE, peaks_float32ne_sse2);
+}
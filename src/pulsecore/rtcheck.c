@@ -0,0 +1,254 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#ifdef HAVE_EXECINFO_H
+#include <execinfo.h>
+#endif
+
+#ifdef HAVE_SYS_RESOURCE_H
+#include <sys/resource.h>
+#endif
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/atomic.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+#include <pulsecore/thread.h>
+
+#include "rtcheck.h"
+
+#if defined(HAVE_SYS_RESOURCE_H) && defined(RUSAGE_THREAD)
+#define USE_RUSAGE
+#endif
+
+#define BACKTRACE_MAX 32
+#define SEEN_MAX 1024
+
+struct rtcheck_thread {
+    pa_bool_t active:1;
+    pa_bool_t reporting:1;
+#ifdef USE_RUSAGE
+    struct rusage rusage;
+#endif
+};
+
+pa_bool_t pa_rtcheck_enabled = FALSE;
+
+static pa_atomic_t counts[PA_RTCHECK_MAX];
+
+/* Hashes of the backtraces reported so far, an open addressing hash
+ * table that is only ever added to */
+static pa_atomic_ptr_t seen[SEEN_MAX];
+
+static const char * const violation_names[PA_RTCHECK_MAX] = {
+    "memory allocation",
+    "contended mutex",
+    "blocking wait",
+    "log message",
+    "page fault",
+    "block IO",
+    "context switch"
+};
+
+PA_STATIC_TLS_DECLARE(rtcheck_thread, pa_xfree);
+
+void pa_rtcheck_enable(void) {
+#ifdef HAVE_EXECINFO_H
+    void *trace[1];
+
+    /* The first call might load libgcc, let's get that over with */
+    backtrace(trace, 1);
+#endif
+
+    /* Setting up the TLS allocates memory and takes a mutex itself */
+    PA_STATIC_TLS_GET(rtcheck_thread);
+
+    pa_rtcheck_enabled = TRUE;
+
+    pa_log_info("Checking the IO threads for realtime violations.");
+}
+
+static void take_rusage(struct rtcheck_thread *t) {
+#ifdef USE_RUSAGE
+    if (getrusage(RUSAGE_THREAD, &t->rusage) < 0)
+        pa_zero(t->rusage);
+#endif
+}
+
+/* Returns TRUE if the hash wasn't seen before */
+static pa_bool_t first_seen(unsigned hash) {
+    void *h = PA_UINT_TO_PTR(hash | 1U);
+    unsigned j;
+
+    for (j = 0; j < SEEN_MAX; j++) {
+        pa_atomic_ptr_t *slot = &seen[(hash + j) % SEEN_MAX];
+        void *p;
+
+        if (!(p = pa_atomic_ptr_load(slot))) {
+            if (pa_atomic_ptr_cmpxchg(slot, NULL, h))
+                return TRUE;
+
+            p = pa_atomic_ptr_load(slot);
+        }
+
+        if (p == h)
+            return FALSE;
+    }
+
+    /* The table is full, we said enough */
+    return FALSE;
+}
+
+static void report_violation(struct rtcheck_thread *t, pa_rtcheck_violation_t v) {
+    unsigned hash = 2166136261U ^ (unsigned) v;
+    const char *name;
+#ifdef HAVE_EXECINFO_H
+    void *trace[BACKTRACE_MAX];
+    char **symbols;
+    int i, n;
+#endif
+
+    pa_atomic_inc(&counts[v]);
+
+    /* Whatever we do from here on is not reported itself */
+    t->reporting = TRUE;
+
+    name = pa_strnull(pa_thread_get_name(pa_thread_self()));
+
+#ifdef HAVE_EXECINFO_H
+    n = backtrace(trace, BACKTRACE_MAX);
+
+    for (i = 0; i < n; i++)
+        hash = (hash ^ (unsigned) (uintptr_t) trace[i]) * 16777619U;
+
+    if (first_seen(hash)) {
+        pa_log_warn("Realtime violation in thread %s: %s", name, violation_names[v]);
+
+        if ((symbols = backtrace_symbols(trace, n))) {
+            for (i = 0; i < n; i++)
+                pa_log_warn("    #%i %s", i, symbols[i]);
+
+            free(symbols);
+        }
+
+        pa_log_warn("Further violations of this kind from here are not reported.");
+    }
+#else
+    if (first_seen(hash))
+        pa_log_warn("Realtime violation in thread %s: %s (no backtrace available)", name, violation_names[v]);
+#endif
+
+    /* Don't blame the next check for the time we spent logging */
+    take_rusage(t);
+
+    t->reporting = FALSE;
+}
+
+void pa_rtcheck_begin(void) {
+    struct rtcheck_thread *t;
+
+    if (PA_LIKELY(!pa_rtcheck_enabled))
+        return;
+
+    if (!(t = PA_STATIC_TLS_GET(rtcheck_thread))) {
+        t = pa_xnew0(struct rtcheck_thread, 1);
+        PA_STATIC_TLS_SET(rtcheck_thread, t);
+    }
+
+    if (t->active)
+        return;
+
+    take_rusage(t);
+    t->active = TRUE;
+}
+
+void pa_rtcheck_end(void) {
+    struct rtcheck_thread *t;
+#ifdef USE_RUSAGE
+    struct rusage ru;
+#endif
+
+    if (PA_LIKELY(!pa_rtcheck_enabled))
+        return;
+
+    if (!(t = PA_STATIC_TLS_GET(rtcheck_thread)) || !t->active)
+        return;
+
+#ifdef USE_RUSAGE
+    if (getrusage(RUSAGE_THREAD, &ru) >= 0) {
+        pa_bool_t faulted, did_io, switched;
+
+        /* Decide on all of them first, reporting resets the baseline */
+        faulted = ru.ru_majflt + ru.ru_minflt > t->rusage.ru_majflt + t->rusage.ru_minflt;
+        did_io = ru.ru_inblock + ru.ru_oublock > t->rusage.ru_inblock + t->rusage.ru_oublock;
+        switched = ru.ru_nvcsw > t->rusage.ru_nvcsw;
+
+        if (faulted)
+            report_violation(t, PA_RTCHECK_PAGE_FAULT);
+        if (did_io)
+            report_violation(t, PA_RTCHECK_BLOCK_IO);
+        if (switched)
+            report_violation(t, PA_RTCHECK_CONTEXT_SWITCH);
+    }
+#endif
+
+    t->active = FALSE;
+}
+
+pa_bool_t pa_rtcheck_active(void) {
+    struct rtcheck_thread *t;
+
+    if (!pa_rtcheck_enabled)
+        return FALSE;
+
+    t = PA_STATIC_TLS_GET(rtcheck_thread);
+
+    return t && t->active && !t->reporting;
+}
+
+void pa_rtcheck_report(pa_rtcheck_violation_t v) {
+    struct rtcheck_thread *t;
+
+    pa_assert(v < PA_RTCHECK_MAX);
+
+    if (!(t = PA_STATIC_TLS_GET(rtcheck_thread)) || !t->active || t->reporting)
+        return;
+
+    report_violation(t, v);
+}
+
+unsigned pa_rtcheck_get_count(pa_rtcheck_violation_t v) {
+    pa_assert(v < PA_RTCHECK_MAX);
+
+    return (unsigned) pa_atomic_load(&counts[v]);
+}
+
+const char *pa_rtcheck_violation_to_string(pa_rtcheck_violation_t v) {
+    pa_assert(v < PA_RTCHECK_MAX);
+
+    return violation_names[v];
+}
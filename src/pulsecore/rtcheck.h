@@ -0,0 +1,79 @@
+#ifndef foopulsertcheckhfoo
+#define foopulsertcheckhfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <pulsecore/macro.h>
+
+/* A debugging aid that finds code which may block in the IO
+ * threads. Every thread that runs a pa_rtpoll is considered realtime,
+ * except while it sleeps in the poll itself and after the rtpoll was
+ * told to quit. Memory allocations, contended mutexes, waits on
+ * semaphores and fdsems and log messages in a realtime thread are
+ * reported with a backtrace, once per call site. Page faults, block IO
+ * and voluntary context switches are caught from getrusage() deltas
+ * of the thread between two sleeps, where available.
+ *
+ * This is off by default and costs a single branch in the checked
+ * functions then. */
+
+typedef enum pa_rtcheck_violation {
+    PA_RTCHECK_ALLOC,
+    PA_RTCHECK_MUTEX,
+    PA_RTCHECK_WAIT,
+    PA_RTCHECK_LOG,
+    PA_RTCHECK_PAGE_FAULT,
+    PA_RTCHECK_BLOCK_IO,
+    PA_RTCHECK_CONTEXT_SWITCH,
+    PA_RTCHECK_MAX
+} pa_rtcheck_violation_t;
+
+/* Don't touch this directly, use pa_rtcheck() */
+extern pa_bool_t pa_rtcheck_enabled;
+
+/* Turn the checks on. Needs to be called before any of the threads
+ * to check are started. */
+void pa_rtcheck_enable(void);
+
+/* Called by the rtpoll when the current thread wakes up, and when it
+ * goes back to sleep. */
+void pa_rtcheck_begin(void);
+void pa_rtcheck_end(void);
+
+/* TRUE if the current thread is in a realtime section right now. */
+pa_bool_t pa_rtcheck_active(void);
+
+/* Report that the current thread does something it shouldn't, if it
+ * is realtime. */
+void pa_rtcheck_report(pa_rtcheck_violation_t v);
+
+/* How often a violation was seen, including the ones not reported
+ * because their call site was reported before. */
+unsigned pa_rtcheck_get_count(pa_rtcheck_violation_t v);
+
+const char *pa_rtcheck_violation_to_string(pa_rtcheck_violation_t v);
+
+#define pa_rtcheck(v)                                                   \
+    do {                                                                \
+        if (PA_UNLIKELY(pa_rtcheck_enabled))                            \
+            pa_rtcheck_report(v);                                       \
+    } while (FALSE)
+
+#endif
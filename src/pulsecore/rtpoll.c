@@ -29,6 +29,11 @@
 #include <string.h>
 #include <errno.h>
 
+#ifdef HAVE_EPOLL
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#endif
+
 #include <pulse/xmalloc.h>
 #include <pulse/timeval.h>
 
@@ -40,16 +45,58 @@
 #include <pulsecore/flist.h>
 #include <pulsecore/core-util.h>
 #include <pulsecore/ratelimit.h>
+#include <pulsecore/rtcheck.h>
+#include <pulsecore/trace.h>
 #include <pulse/rtclock.h>
 
+#ifdef HAVE_EPOLL
+#include <pulsecore/hashmap.h>
+#include <pulsecore/idxset.h>
+#endif
+
 #include "rtpoll.h"
 
+/* Maximum number of messages asyncmsgq items handle per iteration */
+#define ASYNCMSGQ_WORK_MAX 32
+
 /* #define DEBUG_TIMING */
 
+#ifdef HAVE_EPOLL
+/* One fd as registered with epoll. Several pollfd entries may refer to
+ * the same fd, their events are merged. */
+struct epoll_fd {
+    int fd;
+    uint32_t registered;
+    uint32_t wanted;
+    uint32_t revents;
+    pa_bool_t added:1;
+    pa_bool_t seen:1;
+
+    PA_LLIST_FIELDS(struct epoll_fd);
+};
+#endif
+
 struct pa_rtpoll {
     struct pollfd *pollfd, *pollfd2;
     unsigned n_pollfd_alloc, n_pollfd_used;
 
+#ifdef HAVE_EPOLL
+    int epoll_fd, timer_fd;
+    pa_hashmap *epoll_fds;
+    PA_LLIST_HEAD(struct epoll_fd, epoll_fd_list);
+    unsigned n_epoll_fds;
+
+    struct epoll_event *epoll_events;
+    unsigned n_epoll_events_alloc;
+
+    /* The epoll_fd of each entry in pollfd */
+    struct epoll_fd **epoll_slots;
+    unsigned n_epoll_slots_alloc;
+
+    struct timeval timer_armed;
+    pa_bool_t epoll_resync:1;
+#endif
+
     struct timeval next_elapse;
     pa_bool_t timer_enabled:1;
 
@@ -58,6 +105,15 @@ struct pa_rtpoll {
     pa_bool_t rebuild_needed:1;
     pa_bool_t quit:1;
     pa_bool_t timer_elapsed:1;
+    pa_bool_t track_lateness:1;
+    pa_bool_t lateness_valid:1;
+    pa_bool_t now_valid:1;
+
+    /* How late we woke up after the timer elapsed the last time */
+    pa_usec_t lateness;
+
+    /* The time of the current iteration, see pa_rtpoll_now() */
+    pa_usec_t now;
 
 #ifdef DEBUG_TIMING
     pa_usec_t timestamp;
@@ -86,6 +142,293 @@ struct pa_rtpoll_item {
 
 PA_STATIC_FLIST_DECLARE(items, 0, pa_xfree);
 
+#ifdef HAVE_EPOLL
+
+static void epoll_done(pa_rtpoll *p) {
+    struct epoll_fd *e;
+
+    pa_assert(p);
+
+    if (p->epoll_fds) {
+        pa_hashmap_free(p->epoll_fds, NULL);
+        p->epoll_fds = NULL;
+    }
+
+    while ((e = p->epoll_fd_list)) {
+        PA_LLIST_REMOVE(struct epoll_fd, p->epoll_fd_list, e);
+        pa_xfree(e);
+    }
+
+    p->n_epoll_fds = 0;
+
+    pa_xfree(p->epoll_events);
+    p->epoll_events = NULL;
+    p->n_epoll_events_alloc = 0;
+
+    pa_xfree(p->epoll_slots);
+    p->epoll_slots = NULL;
+    p->n_epoll_slots_alloc = 0;
+
+    if (p->timer_fd >= 0) {
+        pa_close(p->timer_fd);
+        p->timer_fd = -1;
+    }
+
+    if (p->epoll_fd >= 0) {
+        pa_close(p->epoll_fd);
+        p->epoll_fd = -1;
+    }
+}
+
+static void epoll_init(pa_rtpoll *p) {
+    struct epoll_event ev;
+
+    pa_assert(p);
+
+    p->epoll_fd = p->timer_fd = -1;
+    PA_LLIST_HEAD_INIT(struct epoll_fd, p->epoll_fd_list);
+
+    if ((p->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        pa_log_debug("epoll_create1() failed, using poll(): %s", pa_cstrerror(errno));
+        return;
+    }
+
+    if ((p->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC)) < 0) {
+        pa_log_debug("timerfd_create() failed, using poll(): %s", pa_cstrerror(errno));
+        epoll_done(p);
+        return;
+    }
+
+    /* The timer is the only registration without an epoll_fd */
+    pa_zero(ev);
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+
+    if (epoll_ctl(p->epoll_fd, EPOLL_CTL_ADD, p->timer_fd, &ev) < 0) {
+        pa_log_debug("epoll_ctl() failed, using poll(): %s", pa_cstrerror(errno));
+        epoll_done(p);
+        return;
+    }
+
+    p->epoll_fds = pa_hashmap_new(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func);
+
+    p->n_epoll_events_alloc = 32;
+    p->epoll_events = pa_xnew(struct epoll_event, p->n_epoll_events_alloc);
+}
+
+static uint32_t poll_to_epoll(short events) {
+    uint32_t r = 0;
+
+    if (events & POLLIN)
+        r |= EPOLLIN;
+    if (events & POLLPRI)
+        r |= EPOLLPRI;
+    if (events & POLLOUT)
+        r |= EPOLLOUT;
+
+    return r;
+}
+
+static short epoll_to_poll(uint32_t events) {
+    short r = 0;
+
+    if (events & EPOLLIN)
+        r |= POLLIN;
+    if (events & EPOLLPRI)
+        r |= POLLPRI;
+    if (events & EPOLLOUT)
+        r |= POLLOUT;
+    if (events & EPOLLERR)
+        r |= POLLERR;
+    if (events & EPOLLHUP)
+        r |= POLLHUP;
+
+    return r;
+}
+
+static int epoll_register(pa_rtpoll *p, struct epoll_fd *e) {
+    struct epoll_event ev;
+
+    pa_zero(ev);
+    ev.events = e->wanted;
+    ev.data.ptr = e;
+
+    if (epoll_ctl(p->epoll_fd, e->added ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, e->fd, &ev) < 0) {
+
+        /* The fd was closed and the kernel dropped it, or it is
+         * registered already because it was reused */
+        if (errno == ENOENT && e->added) {
+            if (epoll_ctl(p->epoll_fd, EPOLL_CTL_ADD, e->fd, &ev) < 0)
+                return -1;
+        } else if (errno == EEXIST && !e->added) {
+            if (epoll_ctl(p->epoll_fd, EPOLL_CTL_MOD, e->fd, &ev) < 0)
+                return -1;
+        } else
+            return -1;
+    }
+
+    e->added = TRUE;
+    e->registered = e->wanted;
+
+    return 0;
+}
+
+/* Pass all changes of the pollfd array on to the kernel. Only fds
+ * whose events changed cause a syscall. */
+static int epoll_sync(pa_rtpoll *p) {
+    struct epoll_fd *e, *n;
+    struct pollfd *f;
+    unsigned k;
+
+    pa_assert(p);
+
+    if (p->n_pollfd_used > p->n_epoll_slots_alloc) {
+        p->n_epoll_slots_alloc = p->n_pollfd_used * 2;
+        p->epoll_slots = pa_xrenew(struct epoll_fd*, p->epoll_slots, p->n_epoll_slots_alloc);
+    }
+
+    for (e = p->epoll_fd_list; e; e = e->next) {
+        e->wanted = 0;
+        e->seen = FALSE;
+    }
+
+    for (k = 0, f = p->pollfd; k < p->n_pollfd_used; k++, f++) {
+
+        if (f->fd < 0) {
+            p->epoll_slots[k] = NULL;
+            continue;
+        }
+
+        if (!(e = pa_hashmap_get(p->epoll_fds, PA_INT_TO_PTR(f->fd)))) {
+            e = pa_xnew0(struct epoll_fd, 1);
+            e->fd = f->fd;
+
+            pa_assert_se(pa_hashmap_put(p->epoll_fds, PA_INT_TO_PTR(e->fd), e) == 0);
+            PA_LLIST_PREPEND(struct epoll_fd, p->epoll_fd_list, e);
+            p->n_epoll_fds++;
+        }
+
+        e->seen = TRUE;
+        e->wanted |= poll_to_epoll(f->events);
+        p->epoll_slots[k] = e;
+    }
+
+    for (e = p->epoll_fd_list; e; e = n) {
+        n = e->next;
+
+        if (!e->seen) {
+            /* Fails if the fd has been closed already, which is fine */
+            if (e->added)
+                epoll_ctl(p->epoll_fd, EPOLL_CTL_DEL, e->fd, NULL);
+
+            pa_hashmap_remove(p->epoll_fds, PA_INT_TO_PTR(e->fd));
+            PA_LLIST_REMOVE(struct epoll_fd, p->epoll_fd_list, e);
+            p->n_epoll_fds--;
+            pa_xfree(e);
+            continue;
+        }
+
+        /* When items were added or removed the fds might have been
+         * reused, hence refresh everything in that case */
+        if (e->added && e->registered == e->wanted && !p->epoll_resync)
+            continue;
+
+        if (epoll_register(p, e) < 0) {
+            pa_log_info("Failed to add fd %i to epoll, falling back to poll(): %s", e->fd, pa_cstrerror(errno));
+            return -1;
+        }
+    }
+
+    p->epoll_resync = FALSE;
+
+    if (p->n_epoll_fds + 1 > p->n_epoll_events_alloc) {
+        p->n_epoll_events_alloc = (p->n_epoll_fds + 1) * 2;
+        p->epoll_events = pa_xrenew(struct epoll_event, p->epoll_events, p->n_epoll_events_alloc);
+    }
+
+    return 0;
+}
+
+static int epoll_set_timer(pa_rtpoll *p, const struct timeval *tv) {
+    struct itimerspec its;
+
+    pa_assert(p);
+
+    if (tv) {
+        if (pa_timeval_cmp(&p->timer_armed, tv) == 0)
+            return 0;
+    } else if (p->timer_armed.tv_sec == 0 && p->timer_armed.tv_usec == 0)
+        return 0;
+
+    pa_zero(its);
+
+    if (tv) {
+        its.it_value.tv_sec = tv->tv_sec;
+        its.it_value.tv_nsec = tv->tv_usec * 1000;
+    }
+
+    if (timerfd_settime(p->timer_fd, TFD_TIMER_ABSTIME, &its, NULL) < 0)
+        return -1;
+
+    if (tv)
+        p->timer_armed = *tv;
+    else
+        pa_zero(p->timer_armed);
+
+    return 0;
+}
+
+/* Like poll(): returns the number of ready pollfd entries, 0 on
+ * timeout, or -1 with errno set */
+static int epoll_poll(pa_rtpoll *p, pa_bool_t wait_op) {
+    int timeout = wait_op ? -1 : 0, n, k, r = 0;
+    struct pollfd *f;
+    unsigned j;
+
+    pa_assert(p);
+
+    if (epoll_set_timer(p, p->timer_enabled && timeout != 0 ? &p->next_elapse : NULL) < 0)
+        return -1;
+
+    if ((n = epoll_wait(p->epoll_fd, p->epoll_events, (int) p->n_epoll_events_alloc, timeout)) < 0)
+        return -1;
+
+    for (k = 0; k < n; k++) {
+        struct epoll_fd *e = p->epoll_events[k].data.ptr;
+
+        if (!e) {
+            uint64_t expirations;
+
+            /* The timer is a one-shot, it is disarmed now */
+            (void) pa_read(p->timer_fd, &expirations, sizeof(expirations), NULL);
+            pa_zero(p->timer_armed);
+            continue;
+        }
+
+        e->revents = p->epoll_events[k].events;
+    }
+
+    for (j = 0, f = p->pollfd; j < p->n_pollfd_used; j++, f++) {
+        struct epoll_fd *e = p->epoll_slots[j];
+
+        f->revents = e ? epoll_to_poll(e->revents) & (f->events | POLLERR | POLLHUP) : 0;
+
+        if (f->revents)
+            r++;
+    }
+
+    for (k = 0; k < n; k++) {
+        struct epoll_fd *e = p->epoll_events[k].data.ptr;
+
+        if (e)
+            e->revents = 0;
+    }
+
+    return r;
+}
+
+#endif
+
 pa_rtpoll *pa_rtpoll_new(void) {
     pa_rtpoll *p;
 
@@ -95,6 +438,10 @@ pa_rtpoll *pa_rtpoll_new(void) {
     p->pollfd = pa_xnew(struct pollfd, p->n_pollfd_alloc);
     p->pollfd2 = pa_xnew(struct pollfd, p->n_pollfd_alloc);
 
+#ifdef HAVE_EPOLL
+    epoll_init(p);
+#endif
+
 #ifdef DEBUG_TIMING
     p->timestamp = pa_rtclock_now();
 #endif
@@ -112,6 +459,10 @@ static void rtpoll_rebuild(pa_rtpoll *p) {
 
     p->rebuild_needed = FALSE;
 
+#ifdef HAVE_EPOLL
+    p->epoll_resync = TRUE;
+#endif
+
     if (p->n_pollfd_used > p->n_pollfd_alloc) {
         /* Hmm, we have to allocate some more space */
         p->n_pollfd_alloc = p->n_pollfd_used * 2;
@@ -170,6 +521,10 @@ void pa_rtpoll_free(pa_rtpoll *p) {
     while (p->items)
         rtpoll_item_destroy(p->items);
 
+#ifdef HAVE_EPOLL
+    epoll_done(p);
+#endif
+
     pa_xfree(p->pollfd);
     pa_xfree(p->pollfd2);
 
@@ -215,8 +570,14 @@ int pa_rtpoll_run(pa_rtpoll *p, pa_bool_t wait_op) {
     pa_log("rtpoll_run");
 #endif
 
+    PA_TRACE2(rtpoll_run_enter, p, wait_op);
+
     p->running = TRUE;
     p->timer_elapsed = FALSE;
+    p->now_valid = FALSE;
+
+    /* A thread running an rtpoll is a realtime thread from now on */
+    pa_rtcheck_begin();
 
     /* First, let's do some work */
     for (i = p->items; i && i->priority < PA_RTPOLL_NEVER; i = i->next) {
@@ -305,7 +666,19 @@ int pa_rtpoll_run(pa_rtpoll *p, pa_bool_t wait_op) {
     }
 #endif
 
-    /* OK, now let's sleep */
+    /* OK, now let's sleep, which is the one thing we may block in */
+    pa_rtcheck_end();
+
+#ifdef HAVE_EPOLL
+    if (p->epoll_fd >= 0 && epoll_sync(p) < 0)
+        epoll_done(p);
+
+    /* The timeout was calculated above already, don't ask the clock
+     * again whether the timer is due */
+    if (p->epoll_fd >= 0)
+        r = epoll_poll(p, wait_op && !p->quit && (!p->timer_enabled || timeout.tv_sec > 0 || timeout.tv_usec > 0));
+    else
+#endif
 #ifdef HAVE_PPOLL
     {
         struct timespec ts;
@@ -319,9 +692,24 @@ int pa_rtpoll_run(pa_rtpoll *p, pa_bool_t wait_op) {
 
     p->timer_elapsed = r == 0;
 
+    /* The one clock read of the iteration */
+    p->now = pa_rtclock_now();
+    p->now_valid = TRUE;
+
+    pa_rtcheck_begin();
+
+    PA_TRACE2(rtpoll_wakeup, p, r);
+
+    if (p->track_lateness && p->timer_elapsed && wait_op && p->timer_enabled) {
+        pa_usec_t elapse = pa_timeval_load(&p->next_elapse);
+
+        p->lateness = p->now > elapse ? p->now - elapse : 0;
+        p->lateness_valid = TRUE;
+    }
+
 #ifdef DEBUG_TIMING
     {
-        pa_usec_t now = pa_rtclock_now();
+        pa_usec_t now = p->now;
         p->slept = now - p->timestamp;
         p->timestamp = now;
 
@@ -356,6 +744,10 @@ finish:
 
     p->running = FALSE;
 
+    /* Tearing down after being told to quit is not realtime anymore */
+    if (r < 0 || p->quit)
+        pa_rtcheck_end();
+
     if (p->scan_for_dead) {
         pa_rtpoll_item *n;
 
@@ -369,6 +761,8 @@ finish:
         }
     }
 
+    PA_TRACE2(rtpoll_run_exit, p, r);
+
     return r < 0 ? r : !p->quit;
 }
 
@@ -397,6 +791,39 @@ void pa_rtpoll_set_timer_disabled(pa_rtpoll *p) {
     p->timer_enabled = FALSE;
 }
 
+void pa_rtpoll_set_track_lateness(pa_rtpoll *p, pa_bool_t b) {
+    pa_assert(p);
+
+    p->track_lateness = b;
+    p->lateness_valid = FALSE;
+}
+
+pa_bool_t pa_rtpoll_take_lateness(pa_rtpoll *p, pa_usec_t *lateness) {
+    pa_assert(p);
+    pa_assert(lateness);
+
+    if (!p->lateness_valid)
+        return FALSE;
+
+    *lateness = p->lateness;
+    p->lateness_valid = FALSE;
+
+    return TRUE;
+}
+
+pa_usec_t pa_rtpoll_now(pa_rtpoll *p) {
+    pa_assert(p);
+
+    /* We didn't sleep, so this is the first time the clock is asked
+     * for in this iteration */
+    if (!p->now_valid) {
+        p->now = pa_rtclock_now();
+        p->now_valid = TRUE;
+    }
+
+    return p->now;
+}
+
 pa_rtpoll_item *pa_rtpoll_item_new(pa_rtpoll *p, pa_rtpoll_priority_t prio, unsigned n_fds) {
     pa_rtpoll_item *i, *j, *l = NULL;
 
@@ -544,29 +971,46 @@ static void asyncmsgq_read_after(pa_rtpoll_item *i) {
 }
 
 static int asyncmsgq_read_work(pa_rtpoll_item *i) {
-    pa_msgobject *object;
-    int code;
-    void *data;
-    pa_memchunk chunk;
-    int64_t offset;
+    pa_asyncmsgq *q;
+    unsigned n;
+    int r = 0;
 
     pa_assert(i);
 
-    if (pa_asyncmsgq_get(i->userdata, &object, &code, &data, &offset, &chunk, 0) == 0) {
+    q = pa_asyncmsgq_ref(i->userdata);
+
+    /* Handle a batch of messages per iteration instead of a single one,
+     * but not too many so that the other items don't starve */
+    for (n = 0; n < ASYNCMSGQ_WORK_MAX; n++) {
+        pa_msgobject *object;
+        int code;
+        void *data;
+        pa_memchunk chunk;
+        int64_t offset;
         int ret;
 
+        if (pa_asyncmsgq_get(q, &object, &code, &data, &offset, &chunk, 0) < 0)
+            break;
+
+        r = 1;
+
         if (!object && code == PA_MESSAGE_SHUTDOWN) {
-            pa_asyncmsgq_done(i->userdata, 0);
+            pa_asyncmsgq_done(q, 0);
             pa_rtpoll_quit(i->rtpoll);
-            return 1;
+            break;
         }
 
         ret = pa_asyncmsgq_dispatch(object, code, data, offset, &chunk);
-        pa_asyncmsgq_done(i->userdata, ret);
-        return 1;
+        pa_asyncmsgq_done(q, ret);
+
+        /* The handler might have removed us or asked the loop to quit */
+        if (i->dead || i->rtpoll->quit)
+            break;
     }
 
-    return 0;
+    pa_asyncmsgq_unref(q);
+
+    return r;
 }
 
 pa_rtpoll_item *pa_rtpoll_item_new_asyncmsgq_read(pa_rtpoll *p, pa_rtpoll_priority_t prio, pa_asyncmsgq *q) {
@@ -41,7 +41,14 @@
  * 3) It allows arbitrary functions to be run before entering the
  * actual poll() and after it.
  *
- * Only a single interval timer is supported..*/
+ * Only a single interval timer is supported..
+ *
+ * Where available the loop is driven by epoll and a timerfd instead
+ * of ppoll(). The fds in the pollfd arrays are then registered with
+ * the kernel persistently and only changes are passed on. Users may
+ * still change events and fds of their pollfd entries at any time,
+ * but an fd must not be closed and replaced by a new one with the
+ * same number without also modifying or recreating the item. */
 
 typedef struct pa_rtpoll pa_rtpoll;
 typedef struct pa_rtpoll_item pa_rtpoll_item;
@@ -71,6 +78,22 @@ void pa_rtpoll_set_timer_disabled(pa_rtpoll *p);
  * the last pa_rtpoll_run() invocation to finish */
 pa_bool_t pa_rtpoll_timer_elapsed(pa_rtpoll *p);
 
+/* When enabled, every wakeup by the timer measures how long after the
+ * programmed time it happened. pa_rtpoll_take_lateness() returns that
+ * once per wakeup, and FALSE if there was no such wakeup since it was
+ * called last. */
+void pa_rtpoll_set_track_lateness(pa_rtpoll *p, pa_bool_t b);
+pa_bool_t pa_rtpoll_take_lateness(pa_rtpoll *p, pa_usec_t *lateness);
+
+/* The time of the current loop iteration: when the last
+ * pa_rtpoll_run() woke up from poll(), or if it returned without
+ * sleeping, when this was first called after that. This saves the
+ * many clock reads of code that runs right after waking up and
+ * doesn't care about the time spent since. Use pa_rtclock_now() where
+ * the exact time matters, e.g. for timing information read from the
+ * hardware. Call this from the thread running the loop only. */
+pa_usec_t pa_rtpoll_now(pa_rtpoll *p);
+
 /* A new fd wakeup item for pa_rtpoll */
 pa_rtpoll_item *pa_rtpoll_item_new(pa_rtpoll *p, pa_rtpoll_priority_t prio, unsigned n_fds);
 void pa_rtpoll_item_free(pa_rtpoll_item *i);
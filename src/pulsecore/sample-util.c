@@ -123,7 +123,89 @@ pa_bool_t pa_frame_aligned(size_t l, const pa_sample_spec *ss) {
     return l % fs == 0;
 }
 
+/* Indexed by sample size (2 or 4 bytes) and channels */
+static pa_interleave_func_t interleave_table[2][PA_INTERLEAVE_CHANNELS_MAX + 1];
+static pa_deinterleave_func_t deinterleave_table[2][PA_INTERLEAVE_CHANNELS_MAX + 1];
+
+static int interleave_size_index(size_t ss) {
+    switch (ss) {
+        case 2:
+            return 0;
+        case 4:
+            return 1;
+        default:
+            return -1;
+    }
+}
+
+pa_interleave_func_t pa_get_interleave_func(size_t ss, unsigned channels) {
+    int i = interleave_size_index(ss);
+
+    pa_assert(channels > 0);
+
+    if (i < 0 || channels > PA_INTERLEAVE_CHANNELS_MAX)
+        return NULL;
+
+    return interleave_table[i][channels];
+}
+
+void pa_set_interleave_func(size_t ss, unsigned channels, pa_interleave_func_t func) {
+    int i = interleave_size_index(ss);
+
+    pa_assert(i >= 0);
+    pa_assert(channels > 0 && channels <= PA_INTERLEAVE_CHANNELS_MAX);
+
+    interleave_table[i][channels] = func;
+}
+
+pa_deinterleave_func_t pa_get_deinterleave_func(size_t ss, unsigned channels) {
+    int i = interleave_size_index(ss);
+
+    pa_assert(channels > 0);
+
+    if (i < 0 || channels > PA_INTERLEAVE_CHANNELS_MAX)
+        return NULL;
+
+    return deinterleave_table[i][channels];
+}
+
+void pa_set_deinterleave_func(size_t ss, unsigned channels, pa_deinterleave_func_t func) {
+    int i = interleave_size_index(ss);
+
+    pa_assert(i >= 0);
+    pa_assert(channels > 0 && channels <= PA_INTERLEAVE_CHANNELS_MAX);
+
+    deinterleave_table[i][channels] = func;
+}
+
+/* The generic versions copy whole samples of the common sizes instead
+ * of calling memcpy() for each of them */
+#define INTERLEAVE_LOOP(type)                                           \
+    do {                                                                \
+        for (c = 0; c < channels; c++) {                                \
+            const type *s = src[c];                                     \
+            type *d = (type*) dst + c;                                  \
+            unsigned j;                                                 \
+                                                                        \
+            for (j = 0; j < n; j++, d += channels)                      \
+                *d = s[j];                                              \
+        }                                                               \
+    } while (0)
+
+#define DEINTERLEAVE_LOOP(type)                                         \
+    do {                                                                \
+        for (c = 0; c < channels; c++) {                                \
+            const type *s = (const type*) src + c;                      \
+            type *d = dst[c];                                           \
+            unsigned j;                                                 \
+                                                                        \
+            for (j = 0; j < n; j++, s += channels)                      \
+                d[j] = *s;                                              \
+        }                                                               \
+    } while (0)
+
 void pa_interleave(const void *src[], unsigned channels, void *dst, size_t ss, unsigned n) {
+    pa_interleave_func_t func;
     unsigned c;
     size_t fs;
 
@@ -133,6 +215,20 @@ void pa_interleave(const void *src[], unsigned channels, void *dst, size_t ss, u
     pa_assert(ss > 0);
     pa_assert(n > 0);
 
+    if ((func = pa_get_interleave_func(ss, channels))) {
+        func(src, dst, n);
+        return;
+    }
+
+    switch (ss) {
+        case 2:
+            INTERLEAVE_LOOP(uint16_t);
+            return;
+        case 4:
+            INTERLEAVE_LOOP(uint32_t);
+            return;
+    }
+
     fs = ss * channels;
 
     for (c = 0; c < channels; c++) {
@@ -152,6 +248,7 @@ void pa_interleave(const void *src[], unsigned channels, void *dst, size_t ss, u
 }
 
 void pa_deinterleave(const void *src, void *dst[], unsigned channels, size_t ss, unsigned n) {
+    pa_deinterleave_func_t func;
     size_t fs;
     unsigned c;
 
@@ -161,6 +258,20 @@ void pa_deinterleave(const void *src, void *dst[], unsigned channels, size_t ss,
     pa_assert(ss > 0);
     pa_assert(n > 0);
 
+    if ((func = pa_get_deinterleave_func(ss, channels))) {
+        func(src, dst, n);
+        return;
+    }
+
+    switch (ss) {
+        case 2:
+            DEINTERLEAVE_LOOP(uint16_t);
+            return;
+        case 4:
+            DEINTERLEAVE_LOOP(uint32_t);
+            return;
+    }
+
     fs = ss * channels;
 
     for (c = 0; c < channels; c++) {
@@ -207,27 +318,48 @@ void pa_silence_cache_init(pa_silence_cache *cache) {
 
 void pa_silence_cache_done(pa_silence_cache *cache) {
     pa_sample_format_t f;
+    pa_memblock *b;
     pa_assert(cache);
 
     for (f = 0; f < PA_SAMPLE_MAX; f++)
-        if (cache->blocks[f])
-            pa_memblock_unref(cache->blocks[f]);
+        if ((b = pa_atomic_ptr_load(&cache->blocks[f])))
+            pa_memblock_unref(b);
 
     memset(cache, 0, sizeof(pa_silence_cache));
 }
 
+/* Takes over the reference to b. If another thread was quicker b is
+ * dropped again and the block that thread stored is returned. */
+static pa_memblock *silence_cache_store(pa_silence_cache *cache, pa_sample_format_t f, pa_memblock *b) {
+    if (pa_atomic_ptr_cmpxchg(&cache->blocks[f], NULL, b))
+        return b;
+
+    pa_memblock_unref(b);
+    pa_assert_se(b = pa_atomic_ptr_load(&cache->blocks[f]));
+
+    return b;
+}
+
 pa_memchunk* pa_silence_memchunk_get(pa_silence_cache *cache, pa_mempool *pool, pa_memchunk* ret, const pa_sample_spec *spec, size_t length) {
+    static const pa_sample_format_t zero_formats[] = {
+        PA_SAMPLE_S16LE, PA_SAMPLE_S16BE,
+        PA_SAMPLE_S32LE, PA_SAMPLE_S32BE,
+        PA_SAMPLE_S24LE, PA_SAMPLE_S24BE,
+        PA_SAMPLE_S24_32LE, PA_SAMPLE_S24_32BE,
+        PA_SAMPLE_FLOAT32LE, PA_SAMPLE_FLOAT32BE
+    };
     pa_memblock *b;
     size_t l;
+    unsigned k;
 
     pa_assert(cache);
     pa_assert(pa_sample_spec_valid(spec));
 
-    if (!(b = cache->blocks[spec->format]))
+    if (!(b = pa_atomic_ptr_load(&cache->blocks[spec->format])))
 
         switch (spec->format) {
             case PA_SAMPLE_U8:
-                cache->blocks[PA_SAMPLE_U8] = b = silence_memblock_new(pool, 0x80);
+                b = silence_cache_store(cache, PA_SAMPLE_U8, silence_memblock_new(pool, 0x80));
                 break;
             case PA_SAMPLE_S16LE:
             case PA_SAMPLE_S16BE:
@@ -239,22 +371,20 @@ pa_memchunk* pa_silence_memchunk_get(pa_silence_cache *cache, pa_mempool *pool,
             case PA_SAMPLE_S24_32BE:
             case PA_SAMPLE_FLOAT32LE:
             case PA_SAMPLE_FLOAT32BE:
-                cache->blocks[PA_SAMPLE_S16LE] = b = silence_memblock_new(pool, 0);
-                cache->blocks[PA_SAMPLE_S16BE] = pa_memblock_ref(b);
-                cache->blocks[PA_SAMPLE_S32LE] = pa_memblock_ref(b);
-                cache->blocks[PA_SAMPLE_S32BE] = pa_memblock_ref(b);
-                cache->blocks[PA_SAMPLE_S24LE] = pa_memblock_ref(b);
-                cache->blocks[PA_SAMPLE_S24BE] = pa_memblock_ref(b);
-                cache->blocks[PA_SAMPLE_S24_32LE] = pa_memblock_ref(b);
-                cache->blocks[PA_SAMPLE_S24_32BE] = pa_memblock_ref(b);
-                cache->blocks[PA_SAMPLE_FLOAT32LE] = pa_memblock_ref(b);
-                cache->blocks[PA_SAMPLE_FLOAT32BE] = pa_memblock_ref(b);
+                /* All these formats share one block of zeros */
+                b = silence_memblock_new(pool, 0);
+
+                for (k = 0; k < PA_ELEMENTSOF(zero_formats); k++)
+                    if (zero_formats[k] != spec->format && !pa_atomic_ptr_load(&cache->blocks[zero_formats[k]]))
+                        silence_cache_store(cache, zero_formats[k], pa_memblock_ref(b));
+
+                b = silence_cache_store(cache, spec->format, b);
                 break;
             case PA_SAMPLE_ALAW:
-                cache->blocks[PA_SAMPLE_ALAW] = b = silence_memblock_new(pool, 0xd5);
+                b = silence_cache_store(cache, PA_SAMPLE_ALAW, silence_memblock_new(pool, 0xd5));
                 break;
             case PA_SAMPLE_ULAW:
-                cache->blocks[PA_SAMPLE_ULAW] = b = silence_memblock_new(pool, 0xff);
+                b = silence_cache_store(cache, PA_SAMPLE_ULAW, silence_memblock_new(pool, 0xff));
                 break;
             default:
                 pa_assert_not_reached();
@@ -274,12 +404,27 @@ pa_memchunk* pa_silence_memchunk_get(pa_silence_cache *cache, pa_mempool *pool,
     return ret;
 }
 
+static pa_clamp_func_t clamp_func;
+
+pa_clamp_func_t pa_get_clamp_func(void) {
+    return clamp_func;
+}
+
+void pa_set_clamp_func(pa_clamp_func_t func) {
+    clamp_func = func;
+}
+
 void pa_sample_clamp(pa_sample_format_t format, void *dst, size_t dstr, const void *src, size_t sstr, unsigned n) {
     const float *s;
     float *d;
 
     s = src; d = dst;
 
+    if (format == PA_SAMPLE_FLOAT32NE && clamp_func && dstr == sizeof(float) && sstr == sizeof(float)) {
+        clamp_func(d, s, n);
+        return;
+    }
+
     if (format == PA_SAMPLE_FLOAT32NE) {
         for (; n > 0; n--) {
             float f;
@@ -31,11 +31,14 @@
 #include <pulse/volume.h>
 #include <pulse/channelmap.h>
 
+#include <pulsecore/atomic.h>
 #include <pulsecore/memblock.h>
 #include <pulsecore/memchunk.h>
 
+/* The blocks are created on first use and may be looked up from
+ * several threads at once */
 typedef struct pa_silence_cache {
-    pa_memblock* blocks[PA_SAMPLE_MAX];
+    pa_atomic_ptr_t blocks[PA_SAMPLE_MAX];
 } pa_silence_cache;
 
 void pa_silence_cache_init(pa_silence_cache *cache);
@@ -56,6 +59,24 @@ void pa_deinterleave(const void *src, void *dst[], unsigned channels, size_t ss,
 
 void pa_sample_clamp(pa_sample_format_t format, void *dst, size_t dstr, const void *src, size_t sstr, unsigned n);
 
+/* Optimized versions of the above may be installed for samples of 2 and
+ * 4 bytes and up to PA_INTERLEAVE_CHANNELS_MAX channels, and for
+ * clamping contiguous native endian floats */
+#define PA_INTERLEAVE_CHANNELS_MAX 8
+
+typedef void (*pa_interleave_func_t)(const void *src[], void *dst, unsigned n);
+typedef void (*pa_deinterleave_func_t)(const void *src, void *dst[], unsigned n);
+typedef void (*pa_clamp_func_t)(float *dst, const float *src, unsigned n);
+
+pa_interleave_func_t pa_get_interleave_func(size_t ss, unsigned channels);
+void pa_set_interleave_func(size_t ss, unsigned channels, pa_interleave_func_t func);
+
+pa_deinterleave_func_t pa_get_deinterleave_func(size_t ss, unsigned channels);
+void pa_set_deinterleave_func(size_t ss, unsigned channels, pa_deinterleave_func_t func);
+
+pa_clamp_func_t pa_get_clamp_func(void);
+void pa_set_clamp_func(pa_clamp_func_t func);
+
 static inline int32_t pa_mult_s16_volume(int16_t v, int32_t cv) {
 #if __WORDSIZE == 64 || ((ULONG_MAX) > (UINT_MAX))
     /* Multiply with 64 bit integers on 64 bit platforms */
@@ -85,6 +106,13 @@ typedef void (*pa_do_volume_func_t) (void *samples, const void *volumes, unsigne
 pa_do_volume_func_t pa_get_volume_func(pa_sample_format_t f);
 void pa_set_volume_func(pa_sample_format_t f, pa_do_volume_func_t func);
 
+/* Multiplies frame k with the linear gain + k * step. Only some formats
+ * have one of these, see pa_volume_ramp_memchunk() */
+typedef void (*pa_do_volume_ramp_func_t) (void *samples, float gain, float step, unsigned channels, unsigned length);
+
+pa_do_volume_ramp_func_t pa_get_volume_ramp_func(pa_sample_format_t f);
+void pa_set_volume_ramp_func(pa_sample_format_t f, pa_do_volume_ramp_func_t func);
+
 size_t pa_convert_size(size_t size, const pa_sample_spec *from, const pa_sample_spec *to);
 
 #define PA_CHANNEL_POSITION_MASK_LEFT                                   \
@@ -0,0 +1,212 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <immintrin.h>
+
+#include <pulsecore/macro.h>
+#include <pulsecore/log.h>
+
+#include "cpu-x86.h"
+#include "sconv.h"
+
+/* Same scheme as the SSE4.1 conversions in sconv_sse4.c, with twice the
+ * lanes. Packed 24 bit samples are shuffled within each 128 bit half, so
+ * every half is loaded and stored on its own. */
+
+static pa_convert_func_t fallback_to_float32ne[PA_SAMPLE_MAX];
+static pa_convert_func_t fallback_from_float32ne[PA_SAMPLE_MAX];
+static pa_convert_func_t fallback_to_s16ne[PA_SAMPLE_MAX];
+static pa_convert_func_t fallback_from_s16ne[PA_SAMPLE_MAX];
+
+static inline __m256i load_s32le(const uint8_t *a) {
+    return _mm256_loadu_si256((const __m256i*) a);
+}
+
+static inline __m256i load_s32be(const uint8_t *a) {
+    const __m256i swap = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+                                          3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+
+    return _mm256_shuffle_epi8(load_s32le(a), swap);
+}
+
+static inline __m256i load_s24_32le(const uint8_t *a) {
+    return _mm256_slli_epi32(load_s32le(a), 8);
+}
+
+static inline __m256i load_s24_32be(const uint8_t *a) {
+    return _mm256_slli_epi32(load_s32be(a), 8);
+}
+
+/* Reads 28 bytes for 24 bytes of samples, callers leave two samples of
+ * slack at the end */
+static inline __m256i load_s24(const uint8_t *a, __m256i unpack) {
+    __m256i v = _mm256_castsi128_si256(_mm_loadu_si128((const __m128i*) a));
+
+    v = _mm256_inserti128_si256(v, _mm_loadu_si128((const __m128i*) (a + 12)), 1);
+    return _mm256_shuffle_epi8(v, unpack);
+}
+
+static inline __m256i load_s24le(const uint8_t *a) {
+    const __m256i unpack = _mm256_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11,
+                                            -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+
+    return load_s24(a, unpack);
+}
+
+static inline __m256i load_s24be(const uint8_t *a) {
+    const __m256i unpack = _mm256_setr_epi8(-1, 2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9,
+                                            -1, 2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9);
+
+    return load_s24(a, unpack);
+}
+
+static inline void store_s32le(uint8_t *b, __m256i s) {
+    _mm256_storeu_si256((__m256i*) b, s);
+}
+
+static inline void store_s32be(uint8_t *b, __m256i s) {
+    const __m256i swap = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+                                          3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+
+    store_s32le(b, _mm256_shuffle_epi8(s, swap));
+}
+
+static inline void store_s24_32le(uint8_t *b, __m256i s) {
+    store_s32le(b, _mm256_srli_epi32(s, 8));
+}
+
+static inline void store_s24_32be(uint8_t *b, __m256i s) {
+    store_s32be(b, _mm256_srli_epi32(s, 8));
+}
+
+/* Writes 28 bytes for 24 bytes of samples, the extra bytes are
+ * overwritten by the next store */
+static inline void store_s24(uint8_t *b, __m256i s, __m256i pack) {
+    s = _mm256_shuffle_epi8(s, pack);
+
+    _mm_storeu_si128((__m128i*) b, _mm256_castsi256_si128(s));
+    _mm_storeu_si128((__m128i*) (b + 12), _mm256_extracti128_si256(s, 1));
+}
+
+static inline void store_s24le(uint8_t *b, __m256i s) {
+    const __m256i pack = _mm256_setr_epi8(1, 2, 3, 5, 6, 7, 9, 10, 11, 13, 14, 15, -1, -1, -1, -1,
+                                          1, 2, 3, 5, 6, 7, 9, 10, 11, 13, 14, 15, -1, -1, -1, -1);
+
+    store_s24(b, s, pack);
+}
+
+static inline void store_s24be(uint8_t *b, __m256i s) {
+    const __m256i pack = _mm256_setr_epi8(3, 2, 1, 7, 6, 5, 11, 10, 9, 15, 14, 13, -1, -1, -1, -1,
+                                          3, 2, 1, 7, 6, 5, 11, 10, 9, 15, 14, 13, -1, -1, -1, -1);
+
+    store_s24(b, s, pack);
+}
+
+static inline __m256i float_to_s32(__m256 v) {
+    const __m256 limit = _mm256_set1_ps((float) (1U << 31));
+
+    v = _mm256_mul_ps(v, limit);
+    return _mm256_xor_si256(_mm256_cvtps_epi32(v), _mm256_castps_si256(_mm256_cmp_ps(v, limit, _CMP_GE_OQ)));
+}
+
+/* packs and unpack work on each 128 bit half, which is fixed up with a
+ * 64 bit permutation */
+#define DEFINE_CONVERSIONS(name, format, width, slack)                                          \
+static void pa_sconv_##name##_to_float32ne_avx2(unsigned n, const uint8_t *a, float *b) {      \
+    const __m256 scale = _mm256_set1_ps(1.0f / (1U << 31));                                     \
+                                                                                                \
+    for (; n >= 8 + slack; n -= 8, a += 8 * width, b += 8)                                      \
+        _mm256_storeu_ps(b, _mm256_mul_ps(_mm256_cvtepi32_ps(load_##name(a)), scale));          \
+                                                                                                \
+    if (n > 0)                                                                                  \
+        fallback_to_float32ne[format](n, a, b);                                                 \
+}                                                                                               \
+                                                                                                \
+static void pa_sconv_##name##_from_float32ne_avx2(unsigned n, const float *a, uint8_t *b) {    \
+    for (; n >= 8 + slack; n -= 8, a += 8, b += 8 * width)                                      \
+        store_##name(b, float_to_s32(_mm256_loadu_ps(a)));                                      \
+                                                                                                \
+    if (n > 0)                                                                                  \
+        fallback_from_float32ne[format](n, a, b);                                               \
+}                                                                                               \
+                                                                                                \
+static void pa_sconv_##name##_to_s16ne_avx2(unsigned n, const uint8_t *a, int16_t *b) {        \
+    for (; n >= 16 + slack; n -= 16, a += 16 * width, b += 16) {                                \
+        __m256i s0 = _mm256_srai_epi32(load_##name(a), 16);                                     \
+        __m256i s1 = _mm256_srai_epi32(load_##name(a + 8 * width), 16);                         \
+                                                                                                \
+        _mm256_storeu_si256((__m256i*) b, _mm256_permute4x64_epi64(_mm256_packs_epi32(s0, s1), 0xD8)); \
+    }                                                                                           \
+                                                                                                \
+    if (n > 0)                                                                                  \
+        fallback_to_s16ne[format](n, a, b);                                                     \
+}                                                                                               \
+                                                                                                \
+static void pa_sconv_##name##_from_s16ne_avx2(unsigned n, const int16_t *a, uint8_t *b) {      \
+    const __m256i zero = _mm256_setzero_si256();                                                \
+                                                                                                \
+    for (; n >= 16 + slack; n -= 16, a += 16, b += 16 * width) {                                \
+        __m256i v = _mm256_permute4x64_epi64(_mm256_loadu_si256((const __m256i*) a), 0xD8);     \
+                                                                                                \
+        store_##name(b, _mm256_unpacklo_epi16(zero, v));                                        \
+        store_##name(b + 8 * width, _mm256_unpackhi_epi16(zero, v));                            \
+    }                                                                                           \
+                                                                                                \
+    if (n > 0)                                                                                  \
+        fallback_from_s16ne[format](n, a, b);                                                   \
+}
+
+DEFINE_CONVERSIONS(s32le, PA_SAMPLE_S32LE, 4, 0)
+DEFINE_CONVERSIONS(s32be, PA_SAMPLE_S32BE, 4, 0)
+DEFINE_CONVERSIONS(s24_32le, PA_SAMPLE_S24_32LE, 4, 0)
+DEFINE_CONVERSIONS(s24_32be, PA_SAMPLE_S24_32BE, 4, 0)
+DEFINE_CONVERSIONS(s24le, PA_SAMPLE_S24LE, 3, 2)
+DEFINE_CONVERSIONS(s24be, PA_SAMPLE_S24BE, 3, 2)
+
+#define INSTALL_CONVERSIONS(name, format)                                                                       \
+    do {                                                                                                        \
+        if (!fallback_to_float32ne[format]) {                                                                   \
+            fallback_to_float32ne[format] = pa_get_convert_to_float32ne_function(format);                       \
+            fallback_from_float32ne[format] = pa_get_convert_from_float32ne_function(format);                   \
+            fallback_to_s16ne[format] = pa_get_convert_to_s16ne_function(format);                               \
+            fallback_from_s16ne[format] = pa_get_convert_from_s16ne_function(format);                           \
+        }                                                                                                       \
+                                                                                                                \
+        pa_set_convert_to_float32ne_function(format, (pa_convert_func_t) pa_sconv_##name##_to_float32ne_avx2);   \
+        pa_set_convert_from_float32ne_function(format, (pa_convert_func_t) pa_sconv_##name##_from_float32ne_avx2); \
+        pa_set_convert_to_s16ne_function(format, (pa_convert_func_t) pa_sconv_##name##_to_s16ne_avx2);           \
+        pa_set_convert_from_s16ne_function(format, (pa_convert_func_t) pa_sconv_##name##_from_s16ne_avx2);       \
+    } while (0)
+
+void pa_convert_func_init_avx2(pa_cpu_x86_flag_t flags) {
+    if (flags & PA_CPU_X86_AVX2) {
+        pa_log_info("Initialising AVX2 optimized 24 and 32 bit conversions.");
+
+        INSTALL_CONVERSIONS(s32le, PA_SAMPLE_S32LE);
+        INSTALL_CONVERSIONS(s32be, PA_SAMPLE_S32BE);
+        INSTALL_CONVERSIONS(s24_32le, PA_SAMPLE_S24_32LE);
+        INSTALL_CONVERSIONS(s24_32be, PA_SAMPLE_S24_32BE);
+        INSTALL_CONVERSIONS(s24le, PA_SAMPLE_S24LE);
+        INSTALL_CONVERSIONS(s24be, PA_SAMPLE_S24BE);
+    }
+}
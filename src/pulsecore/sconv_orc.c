@@ -0,0 +1,47 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pulsecore/macro.h>
+#include <pulsecore/log.h>
+#include <pulsecore/sconv.h>
+#include <pulsecore/sconv-orc-gen.h>
+
+#include "cpu-orc.h"
+
+/* Only the conversions to float are done with Orc. The ones from float
+ * round with lrintf(), which Orc has no equivalent for. */
+
+static void pa_sconv_s16ne_to_float32ne_orc_wrap(unsigned n, const int16_t *a, float *b) {
+    pa_sconv_s16ne_to_float32ne_orc(b, a, 1.0f / (1 << 15), n);
+}
+
+static void pa_sconv_s32ne_to_float32ne_orc_wrap(unsigned n, const int32_t *a, float *b) {
+    pa_sconv_s32ne_to_float32ne_orc(b, a, 1.0f / (1U << 31), n);
+}
+
+void pa_convert_func_init_orc(void) {
+    pa_log_info("Initialising ORC optimized conversions.");
+
+    pa_set_convert_to_float32ne_function(PA_SAMPLE_S16NE, (pa_convert_func_t) pa_sconv_s16ne_to_float32ne_orc_wrap);
+    pa_set_convert_to_float32ne_function(PA_SAMPLE_S32NE, (pa_convert_func_t) pa_sconv_s32ne_to_float32ne_orc_wrap);
+}
@@ -0,0 +1,197 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <smmintrin.h>
+
+#include <pulsecore/macro.h>
+#include <pulsecore/log.h>
+
+#include "cpu-x86.h"
+#include "sconv.h"
+
+/* Conversions between the 24 and 32 bit integer formats and the float32ne
+ * and s16ne work formats. Every format is loaded into (or stored from)
+ * left aligned 32 bit integers, so that all of them share the same
+ * arithmetic. The results are bit-identical to the generic C versions in
+ * sconv-s16le.c; whatever does not fill a whole vector is passed on to the
+ * function that was registered before. */
+
+static pa_convert_func_t fallback_to_float32ne[PA_SAMPLE_MAX];
+static pa_convert_func_t fallback_from_float32ne[PA_SAMPLE_MAX];
+static pa_convert_func_t fallback_to_s16ne[PA_SAMPLE_MAX];
+static pa_convert_func_t fallback_from_s16ne[PA_SAMPLE_MAX];
+
+static inline __m128i load_s32le(const uint8_t *a) {
+    return _mm_loadu_si128((const __m128i*) a);
+}
+
+static inline __m128i load_s32be(const uint8_t *a) {
+    const __m128i swap = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+
+    return _mm_shuffle_epi8(load_s32le(a), swap);
+}
+
+static inline __m128i load_s24_32le(const uint8_t *a) {
+    return _mm_slli_epi32(load_s32le(a), 8);
+}
+
+static inline __m128i load_s24_32be(const uint8_t *a) {
+    return _mm_slli_epi32(load_s32be(a), 8);
+}
+
+/* The packed 24 bit loads read 16 bytes for 12 bytes of samples, hence
+ * callers must leave two samples of slack at the end */
+static inline __m128i load_s24le(const uint8_t *a) {
+    const __m128i unpack = _mm_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+
+    return _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) a), unpack);
+}
+
+static inline __m128i load_s24be(const uint8_t *a) {
+    const __m128i unpack = _mm_setr_epi8(-1, 2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9);
+
+    return _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) a), unpack);
+}
+
+static inline void store_s32le(uint8_t *b, __m128i s) {
+    _mm_storeu_si128((__m128i*) b, s);
+}
+
+static inline void store_s32be(uint8_t *b, __m128i s) {
+    const __m128i swap = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+
+    store_s32le(b, _mm_shuffle_epi8(s, swap));
+}
+
+static inline void store_s24_32le(uint8_t *b, __m128i s) {
+    store_s32le(b, _mm_srli_epi32(s, 8));
+}
+
+static inline void store_s24_32be(uint8_t *b, __m128i s) {
+    store_s32be(b, _mm_srli_epi32(s, 8));
+}
+
+/* Writes 16 bytes for 12 bytes of samples. The four extra bytes are
+ * overwritten by the next store, again callers leave two samples of
+ * slack. */
+static inline void store_s24le(uint8_t *b, __m128i s) {
+    const __m128i pack = _mm_setr_epi8(1, 2, 3, 5, 6, 7, 9, 10, 11, 13, 14, 15, -1, -1, -1, -1);
+
+    _mm_storeu_si128((__m128i*) b, _mm_shuffle_epi8(s, pack));
+}
+
+static inline void store_s24be(uint8_t *b, __m128i s) {
+    const __m128i pack = _mm_setr_epi8(3, 2, 1, 7, 6, 5, 11, 10, 9, 15, 14, 13, -1, -1, -1, -1);
+
+    _mm_storeu_si128((__m128i*) b, _mm_shuffle_epi8(s, pack));
+}
+
+/* cvtps gives 0x80000000 for anything at or above 2^31, which we turn
+ * into 0x7FFFFFFF to match the clamping of the C version. Rounding is
+ * done in the current rounding mode, just like llrint(). */
+static inline __m128i float_to_s32(__m128 v) {
+    const __m128 limit = _mm_set1_ps((float) (1U << 31));
+
+    v = _mm_mul_ps(v, limit);
+    return _mm_xor_si128(_mm_cvtps_epi32(v), _mm_castps_si128(_mm_cmpge_ps(v, limit)));
+}
+
+#define DEFINE_CONVERSIONS(name, format, width, slack)                                          \
+static void pa_sconv_##name##_to_float32ne_sse4(unsigned n, const uint8_t *a, float *b) {      \
+    const __m128 scale = _mm_set1_ps(1.0f / (1U << 31));                                        \
+                                                                                                \
+    for (; n >= 4 + slack; n -= 4, a += 4 * width, b += 4)                                      \
+        _mm_storeu_ps(b, _mm_mul_ps(_mm_cvtepi32_ps(load_##name(a)), scale));                   \
+                                                                                                \
+    if (n > 0)                                                                                  \
+        fallback_to_float32ne[format](n, a, b);                                                 \
+}                                                                                               \
+                                                                                                \
+static void pa_sconv_##name##_from_float32ne_sse4(unsigned n, const float *a, uint8_t *b) {    \
+    for (; n >= 4 + slack; n -= 4, a += 4, b += 4 * width)                                      \
+        store_##name(b, float_to_s32(_mm_loadu_ps(a)));                                         \
+                                                                                                \
+    if (n > 0)                                                                                  \
+        fallback_from_float32ne[format](n, a, b);                                               \
+}                                                                                               \
+                                                                                                \
+static void pa_sconv_##name##_to_s16ne_sse4(unsigned n, const uint8_t *a, int16_t *b) {        \
+    for (; n >= 8 + slack; n -= 8, a += 8 * width, b += 8) {                                    \
+        __m128i s0 = _mm_srai_epi32(load_##name(a), 16);                                        \
+        __m128i s1 = _mm_srai_epi32(load_##name(a + 4 * width), 16);                            \
+                                                                                                \
+        _mm_storeu_si128((__m128i*) b, _mm_packs_epi32(s0, s1));                                \
+    }                                                                                           \
+                                                                                                \
+    if (n > 0)                                                                                  \
+        fallback_to_s16ne[format](n, a, b);                                                     \
+}                                                                                               \
+                                                                                                \
+static void pa_sconv_##name##_from_s16ne_sse4(unsigned n, const int16_t *a, uint8_t *b) {      \
+    const __m128i zero = _mm_setzero_si128();                                                   \
+                                                                                                \
+    for (; n >= 8 + slack; n -= 8, a += 8, b += 8 * width) {                                    \
+        __m128i v = _mm_loadu_si128((const __m128i*) a);                                        \
+                                                                                                \
+        store_##name(b, _mm_unpacklo_epi16(zero, v));                                           \
+        store_##name(b + 4 * width, _mm_unpackhi_epi16(zero, v));                               \
+    }                                                                                           \
+                                                                                                \
+    if (n > 0)                                                                                  \
+        fallback_from_s16ne[format](n, a, b);                                                   \
+}
+
+DEFINE_CONVERSIONS(s32le, PA_SAMPLE_S32LE, 4, 0)
+DEFINE_CONVERSIONS(s32be, PA_SAMPLE_S32BE, 4, 0)
+DEFINE_CONVERSIONS(s24_32le, PA_SAMPLE_S24_32LE, 4, 0)
+DEFINE_CONVERSIONS(s24_32be, PA_SAMPLE_S24_32BE, 4, 0)
+DEFINE_CONVERSIONS(s24le, PA_SAMPLE_S24LE, 3, 2)
+DEFINE_CONVERSIONS(s24be, PA_SAMPLE_S24BE, 3, 2)
+
+#define INSTALL_CONVERSIONS(name, format)                                                                       \
+    do {                                                                                                        \
+        if (!fallback_to_float32ne[format]) {                                                                   \
+            fallback_to_float32ne[format] = pa_get_convert_to_float32ne_function(format);                       \
+            fallback_from_float32ne[format] = pa_get_convert_from_float32ne_function(format);                   \
+            fallback_to_s16ne[format] = pa_get_convert_to_s16ne_function(format);                               \
+            fallback_from_s16ne[format] = pa_get_convert_from_s16ne_function(format);                           \
+        }                                                                                                       \
+                                                                                                                \
+        pa_set_convert_to_float32ne_function(format, (pa_convert_func_t) pa_sconv_##name##_to_float32ne_sse4);   \
+        pa_set_convert_from_float32ne_function(format, (pa_convert_func_t) pa_sconv_##name##_from_float32ne_sse4); \
+        pa_set_convert_to_s16ne_function(format, (pa_convert_func_t) pa_sconv_##name##_to_s16ne_sse4);           \
+        pa_set_convert_from_s16ne_function(format, (pa_convert_func_t) pa_sconv_##name##_from_s16ne_sse4);       \
+    } while (0)
+
+void pa_convert_func_init_sse4(pa_cpu_x86_flag_t flags) {
+    if (flags & PA_CPU_X86_SSE4_1) {
+        pa_log_info("Initialising SSE4.1 optimized 24 and 32 bit conversions.");
+
+        INSTALL_CONVERSIONS(s32le, PA_SAMPLE_S32LE);
+        INSTALL_CONVERSIONS(s32be, PA_SAMPLE_S32BE);
+        INSTALL_CONVERSIONS(s24_32le, PA_SAMPLE_S24_32LE);
+        INSTALL_CONVERSIONS(s24_32be, PA_SAMPLE_S24_32BE);
+        INSTALL_CONVERSIONS(s24le, PA_SAMPLE_S24LE);
+        INSTALL_CONVERSIONS(s24be, PA_SAMPLE_S24BE);
+    }
+}
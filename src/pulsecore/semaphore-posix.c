@@ -29,6 +29,7 @@
 
 #include <pulse/xmalloc.h>
 #include <pulsecore/macro.h>
+#include <pulsecore/rtcheck.h>
 
 #include "semaphore.h"
 
@@ -59,6 +60,13 @@ void pa_semaphore_wait(pa_semaphore *s) {
     int ret;
     pa_assert(s);
 
+    if (PA_UNLIKELY(pa_rtcheck_enabled) && pa_rtcheck_active()) {
+        if (sem_trywait(&s->sem) == 0)
+            return;
+
+        pa_rtcheck_report(PA_RTCHECK_WAIT);
+    }
+
     do {
         ret = sem_wait(&s->sem);
     } while (ret < 0 && errno == EINTR);
@@ -0,0 +1,77 @@
+#ifndef foopulsecoreseqlockhfoo
+#define foopulsecoreseqlockhfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <pulsecore/atomic.h>
+#include <pulsecore/macro.h>
+
+/*
+ * A sequence lock for small structures that one thread updates and
+ * others read. Unlike pa_aupdate the writer never waits for the
+ * readers, which makes it suitable for publishing data from IO
+ * threads. Readers instead retry if they raced with the writer:
+ *
+ * writer() {
+ *     pa_seqlock_write_begin(&l);
+ *     ... update the data ...
+ *     pa_seqlock_write_end(&l);
+ * }
+ *
+ * reader() {
+ *     int seq;
+ *
+ *     do {
+ *         seq = pa_seqlock_read_begin(&l);
+ *         ... copy the data ...
+ *     } while (pa_seqlock_read_retry(&l, seq));
+ * }
+ *
+ * There may only be one writer at a time. All atomic operations imply
+ * full memory barriers, so no further barriers are needed.
+ */
+
+typedef struct pa_seqlock {
+    pa_atomic_t sequence;
+} pa_seqlock;
+
+static inline void pa_seqlock_init(pa_seqlock *l) {
+    pa_atomic_store(&l->sequence, 0);
+}
+
+static inline void pa_seqlock_write_begin(pa_seqlock *l) {
+    pa_atomic_inc(&l->sequence);
+}
+
+static inline void pa_seqlock_write_end(pa_seqlock *l) {
+    pa_atomic_inc(&l->sequence);
+}
+
+static inline int pa_seqlock_read_begin(pa_seqlock *l) {
+    return pa_atomic_load(&l->sequence);
+}
+
+/* Returns TRUE if what was read since pa_seqlock_read_begin() might be
+ * inconsistent and needs to be read again */
+static inline pa_bool_t pa_seqlock_read_retry(pa_seqlock *l, int seq) {
+    return (seq & 1) || pa_atomic_load(&l->sequence) != seq;
+}
+
+#endif
@@ -39,11 +39,19 @@
 #include <sys/mman.h>
 #endif
 
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
 /* This is deprecated on glibc but is still used by FreeBSD */
 #if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
 # define MAP_ANONYMOUS MAP_ANON
 #endif
 
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+
 #include <pulse/xmalloc.h>
 #include <pulse/gccmacro.h>
 
@@ -95,6 +103,124 @@ struct shm_marker {
 
 #define SHM_MARKER_SIZE PA_ALIGN(sizeof(struct shm_marker))
 
+#ifdef __linux__
+/* The default hugetlb page size, 0 if the kernel has none */
+static size_t huge_page_size(void) {
+    FILE *f;
+    char ln[128];
+    unsigned long kb = 0;
+
+    if (!(f = pa_fopen_cloexec("/proc/meminfo", "r")))
+        return 0;
+
+    while (fgets(ln, sizeof(ln), f))
+        if (sscanf(ln, "Hugepagesize: %lu kB", &kb) == 1)
+            break;
+
+    fclose(f);
+
+    return (size_t) kb * 1024;
+}
+#else
+static size_t huge_page_size(void) {
+    return 0;
+}
+#endif
+
+#if defined(__linux__) && (defined(HAVE_MEMFD_CREATE) || defined(__NR_memfd_create))
+/* memfd segments have no name, hence nothing to clean up in /dev/shm,
+ * and are handed to the peers as file descriptors. Older C libraries
+ * lack the definitions even if the kernel has them. */
+#define HAVE_MEMFD 1
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+
+#ifndef MFD_ALLOW_SEALING
+#define MFD_ALLOW_SEALING 0x0002U
+#endif
+
+#ifndef MFD_HUGETLB
+#define MFD_HUGETLB 0x0004U
+#endif
+
+#ifndef F_ADD_SEALS
+#define F_ADD_SEALS (1024 + 9)
+#define F_GET_SEALS (1024 + 10)
+#define F_SEAL_SEAL 0x0001
+#define F_SEAL_SHRINK 0x0002
+#define F_SEAL_GROW 0x0004
+#endif
+
+static int memfd_open(const char *name, unsigned flags) {
+#ifdef HAVE_MEMFD_CREATE
+    return memfd_create(name, flags);
+#else
+    return (int) syscall(__NR_memfd_create, name, flags);
+#endif
+}
+
+static int memfd_create_rw(pa_shm *m, size_t size, pa_bool_t hugetlb) {
+    unsigned flags = MFD_CLOEXEC|MFD_ALLOW_SEALING;
+    size_t page_size = PA_PAGE_SIZE;
+    int fd;
+
+    if (hugetlb) {
+        if ((page_size = huge_page_size()) <= 0)
+            return -1;
+
+        flags |= MFD_HUGETLB;
+    }
+
+    if ((fd = memfd_open("pulseaudio", flags)) < 0) {
+        if (errno != ENOSYS)
+            pa_log_debug("memfd_create() failed: %s", pa_cstrerror(errno));
+        return -1;
+    }
+
+    m->size = PA_ROUND_UP(size, page_size);
+
+    if (ftruncate(fd, (off_t) m->size) < 0) {
+        pa_log("ftruncate() failed: %s", pa_cstrerror(errno));
+        goto fail;
+    }
+
+    /* The peers map the segment as long as they like, so make sure it
+     * can never shrink under them */
+    if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK|F_SEAL_GROW|F_SEAL_SEAL) < 0) {
+        pa_log_debug("Failed to seal memfd: %s", pa_cstrerror(errno));
+        goto fail;
+    }
+
+    /* hugetlb pages are reserved at mmap() time, hence this fails
+     * right away rather than on first access if the system has not
+     * got enough of them */
+    if ((m->ptr = mmap(NULL, m->size, PROT_READ|PROT_WRITE, MAP_SHARED|(hugetlb ? 0 : MAP_NORESERVE), fd, (off_t) 0)) == MAP_FAILED) {
+        if (hugetlb)
+            pa_log_debug("Failed to map hugetlb pages: %s", pa_cstrerror(errno));
+        else
+            pa_log("mmap() failed: %s", pa_cstrerror(errno));
+        goto fail;
+    }
+
+    /* There is no name to derive the id from, it only has to tell our
+     * segments apart on the peer's side */
+    pa_random(&m->id, sizeof(m->id));
+
+    m->fd = fd;
+    m->page_size = page_size;
+    m->do_unlink = FALSE;
+    m->shared = TRUE;
+
+    return 0;
+
+fail:
+    pa_close(fd);
+    return -1;
+}
+#endif
+
 #ifdef HAVE_SHM_OPEN
 static char *segment_name(char *fn, size_t l, unsigned id) {
     pa_snprintf(fn, l, "/pulse-shm-%u", id);
@@ -102,7 +228,7 @@ static char *segment_name(char *fn, size_t l, unsigned id) {
 }
 #endif
 
-int pa_shm_create_rw(pa_shm *m, size_t size, pa_bool_t shared, mode_t mode) {
+int pa_shm_create_rw(pa_shm *m, size_t size, pa_bool_t shared, pa_shm_huge_pages_t huge_pages, mode_t mode) {
 #ifdef HAVE_SHM_OPEN
     char fn[32];
     int fd = -1;
@@ -114,10 +240,22 @@ int pa_shm_create_rw(pa_shm *m, size_t size, pa_bool_t shared, mode_t mode) {
     pa_assert(!(mode & ~0777));
     pa_assert(mode >= 0600);
 
+    m->page_size = PA_PAGE_SIZE;
+    m->locked = FALSE;
+
+#ifdef HAVE_MEMFD
+    if (shared &&
+        ((huge_pages == PA_SHM_HUGE_PAGES_YES && memfd_create_rw(m, size, TRUE) >= 0) ||
+         memfd_create_rw(m, size, FALSE) >= 0))
+        goto finish;
+#endif
+
     /* Each time we create a new SHM area, let's first drop all stale
      * ones */
     pa_shm_cleanup();
 
+    m->fd = -1;
+
     /* Round up to make it page aligned */
     size = PA_PAGE_ALIGN(size);
 
@@ -126,9 +264,25 @@ int pa_shm_create_rw(pa_shm *m, size_t size, pa_bool_t shared, mode_t mode) {
         m->size = size;
 
 #ifdef MAP_ANONYMOUS
-        if ((m->ptr = mmap(NULL, m->size, PROT_READ|PROT_WRITE, MAP_ANONYMOUS|MAP_PRIVATE, -1, (off_t) 0)) == MAP_FAILED) {
-            pa_log("mmap() failed: %s", pa_cstrerror(errno));
-            goto fail;
+        m->ptr = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+        if (huge_pages == PA_SHM_HUGE_PAGES_YES && (m->page_size = huge_page_size()) > 0) {
+            m->size = PA_ROUND_UP(size, m->page_size);
+
+            if ((m->ptr = mmap(NULL, m->size, PROT_READ|PROT_WRITE, MAP_ANONYMOUS|MAP_PRIVATE|MAP_HUGETLB, -1, (off_t) 0)) == MAP_FAILED)
+                pa_log_debug("Failed to map hugetlb pages: %s", pa_cstrerror(errno));
+        }
+#endif
+
+        if (m->ptr == MAP_FAILED) {
+            m->size = size;
+            m->page_size = PA_PAGE_SIZE;
+
+            if ((m->ptr = mmap(NULL, m->size, PROT_READ|PROT_WRITE, MAP_ANONYMOUS|MAP_PRIVATE, -1, (off_t) 0)) == MAP_FAILED) {
+                pa_log("mmap() failed: %s", pa_cstrerror(errno));
+                goto fail;
+            }
         }
 #elif defined(HAVE_POSIX_MEMALIGN)
         {
@@ -164,10 +318,6 @@ int pa_shm_create_rw(pa_shm *m, size_t size, pa_bool_t shared, mode_t mode) {
             goto fail;
         }
 
-#ifndef MAP_NORESERVE
-#define MAP_NORESERVE 0
-#endif
-
         if ((m->ptr = mmap(NULL, PA_PAGE_ALIGN(m->size), PROT_READ|PROT_WRITE, MAP_SHARED|MAP_NORESERVE, fd, (off_t) 0)) == MAP_FAILED) {
             pa_log("mmap() failed: %s", pa_cstrerror(errno));
             goto fail;
@@ -188,6 +338,18 @@ int pa_shm_create_rw(pa_shm *m, size_t size, pa_bool_t shared, mode_t mode) {
 
     m->shared = shared;
 
+#ifdef HAVE_MEMFD
+finish:
+#endif
+    if (huge_pages == PA_SHM_HUGE_PAGES_YES && m->page_size <= PA_PAGE_SIZE)
+        pa_log_info("No hugetlb pages available, using normal pages.");
+
+#ifdef MADV_HUGEPAGE
+    if (huge_pages == PA_SHM_HUGE_PAGES_TRANSPARENT &&
+        madvise(m->ptr, PA_PAGE_ALIGN(m->size), MADV_HUGEPAGE) < 0)
+        pa_log_debug("madvise(MADV_HUGEPAGE) failed: %s", pa_cstrerror(errno));
+#endif
+
     return 0;
 
 fail:
@@ -220,6 +382,11 @@ void pa_shm_free(pa_shm *m) {
 #else
         pa_xfree(m->ptr);
 #endif
+    } else if (m->fd >= 0) {
+        if (munmap(m->ptr, PA_PAGE_ALIGN(m->size)) < 0)
+            pa_log("munmap() failed: %s", pa_cstrerror(errno));
+
+        pa_assert_se(pa_close(m->fd) == 0);
     } else {
 #ifdef HAVE_SHM_OPEN
         if (munmap(m->ptr, PA_PAGE_ALIGN(m->size)) < 0)
@@ -288,6 +455,34 @@ void pa_shm_punch(pa_shm *m, size_t offset, size_t size) {
 #endif
 }
 
+int pa_shm_lock(pa_shm *m) {
+    volatile uint8_t *p;
+    size_t i;
+
+    pa_assert(m);
+    pa_assert(m->ptr);
+    pa_assert(m->size > 0);
+
+#ifdef HAVE_MLOCK
+    /* mlock() faults everything in as well */
+    if (mlock(m->ptr, m->size) >= 0) {
+        m->locked = TRUE;
+        return 0;
+    }
+
+    pa_log_warn("mlock() failed: %s", pa_cstrerror(errno));
+#endif
+
+    /* Touch every page, so that at least nobody takes a fault on first
+     * use. The segment may already contain data, hence we write back
+     * what is there. */
+    p = m->ptr;
+    for (i = 0; i < m->size; i += m->page_size)
+        p[i] = p[i];
+
+    return -1;
+}
+
 #ifdef HAVE_SHM_OPEN
 
 int pa_shm_attach_ro(pa_shm *m, unsigned id) {
@@ -318,12 +513,15 @@ int pa_shm_attach_ro(pa_shm *m, unsigned id) {
     }
 
     m->size = (size_t) st.st_size;
+    m->dev = st.st_dev;
+    m->ino = st.st_ino;
 
     if ((m->ptr = mmap(NULL, PA_PAGE_ALIGN(m->size), PROT_READ, MAP_SHARED, fd, (off_t) 0)) == MAP_FAILED) {
         pa_log("mmap() failed: %s", pa_cstrerror(errno));
         goto fail;
     }
 
+    m->fd = -1;
     m->do_unlink = FALSE;
     m->shared = TRUE;
 
@@ -338,14 +536,103 @@ fail:
     return -1;
 }
 
+pa_bool_t pa_shm_is_current(pa_shm *m) {
+    char fn[32];
+    int fd;
+    struct stat st;
+    pa_bool_t b;
+
+    pa_assert(m);
+    pa_assert(m->ptr);
+
+    /* memfds carry their identity with them, and our own segments
+     * don't go away under us */
+    if (m->fd >= 0 || m->do_unlink || !m->shared)
+        return TRUE;
+
+    segment_name(fn, sizeof(fn), m->id);
+
+    if ((fd = shm_open(fn, O_RDONLY, 0)) < 0)
+        return FALSE;
+
+    b = fstat(fd, &st) >= 0 &&
+        st.st_dev == m->dev &&
+        st.st_ino == m->ino &&
+        (size_t) st.st_size == m->size;
+
+    pa_assert_se(pa_close(fd) == 0);
+
+    return b;
+}
+
 #else /* HAVE_SHM_OPEN */
 
 int pa_shm_attach_ro(pa_shm *m, unsigned id) {
     return -1;
 }
 
+pa_bool_t pa_shm_is_current(pa_shm *m) {
+    return TRUE;
+}
+
 #endif /* HAVE_SHM_OPEN */
 
+static int attach_fd(pa_shm *m, unsigned id, int fd, pa_bool_t writable) {
+#ifdef HAVE_MEMFD
+    struct stat st;
+    int seals;
+
+    pa_assert(m);
+    pa_assert(fd >= 0);
+
+    /* Without the seal the sender could truncate the segment and make
+     * us fault when touching it */
+    if ((seals = fcntl(fd, F_GET_SEALS)) < 0 || !(seals & F_SEAL_SHRINK)) {
+        pa_log("Refusing to map memfd without shrink seal.");
+        goto fail;
+    }
+
+    if (fstat(fd, &st) < 0) {
+        pa_log("fstat() failed: %s", pa_cstrerror(errno));
+        goto fail;
+    }
+
+    if (st.st_size <= 0 ||
+        st.st_size > (off_t) MAX_SHM_SIZE ||
+        PA_ALIGN((size_t) st.st_size) != (size_t) st.st_size) {
+        pa_log("Invalid shared memory segment size");
+        goto fail;
+    }
+
+    m->size = (size_t) st.st_size;
+
+    if ((m->ptr = mmap(NULL, PA_PAGE_ALIGN(m->size), writable ? PROT_READ|PROT_WRITE : PROT_READ, MAP_SHARED, fd, (off_t) 0)) == MAP_FAILED) {
+        pa_log("mmap() failed: %s", pa_cstrerror(errno));
+        goto fail;
+    }
+
+    m->id = id;
+    m->fd = fd;
+    m->do_unlink = FALSE;
+    m->shared = TRUE;
+
+    return 0;
+
+fail:
+#endif
+
+    pa_close(fd);
+    return -1;
+}
+
+int pa_shm_attach_fd(pa_shm *m, unsigned id, int fd) {
+    return attach_fd(m, id, fd, FALSE);
+}
+
+int pa_shm_attach_fd_rw(pa_shm *m, unsigned id, int fd) {
+    return attach_fd(m, id, fd, TRUE);
+}
+
 int pa_shm_cleanup(void) {
 
 #ifdef HAVE_SHM_OPEN
@@ -26,19 +26,54 @@
 
 #include <pulsecore/macro.h>
 
+typedef enum pa_shm_huge_pages {
+    PA_SHM_HUGE_PAGES_NO,
+    PA_SHM_HUGE_PAGES_TRANSPARENT, /* madvise() the segment for THP */
+    PA_SHM_HUGE_PAGES_YES          /* hugetlb pages, if there are any available */
+} pa_shm_huge_pages_t;
+
 typedef struct pa_shm {
     unsigned id;
     void *ptr;
     size_t size;
+
+    /* For segments backed by a sealed memfd, to be passed to the
+     * peers. -1 for POSIX SHM and private memory. */
+    int fd;
+
+    /* The size of the pages backing segments we created */
+    size_t page_size;
+
+    /* Identity of a POSIX SHM segment we attached to */
+    dev_t dev;
+    ino_t ino;
+
     pa_bool_t do_unlink:1;
     pa_bool_t shared:1;
+    pa_bool_t locked:1;
 } pa_shm;
 
-int pa_shm_create_rw(pa_shm *m, size_t size, pa_bool_t shared, mode_t mode);
+int pa_shm_create_rw(pa_shm *m, size_t size, pa_bool_t shared, pa_shm_huge_pages_t huge_pages, mode_t mode);
 int pa_shm_attach_ro(pa_shm *m, unsigned id);
 
+/* Takes ownership of the fd, also on failure */
+int pa_shm_attach_fd(pa_shm *m, unsigned id, int fd);
+
+/* Like pa_shm_attach_fd(), but maps the segment writable. For segments
+ * both sides update, such as the SHM ring of a stream. */
+int pa_shm_attach_fd_rw(pa_shm *m, unsigned id, int fd);
+
+/* Checks whether an attached POSIX SHM segment is still the one
+ * published under its id, i.e. it has neither been unlinked nor
+ * replaced since. Always true for memfd segments. */
+pa_bool_t pa_shm_is_current(pa_shm *m);
+
 void pa_shm_punch(pa_shm *m, size_t offset, size_t size);
 
+/* Faults in and locks the whole segment. Returns -1 if it could only
+ * be faulted in. */
+int pa_shm_lock(pa_shm *m);
+
 void pa_shm_free(pa_shm *m);
 
 int pa_shm_cleanup(void);
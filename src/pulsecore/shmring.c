@@ -0,0 +1,286 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/atomic.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/shm.h>
+
+#include "shmring.h"
+
+/* The header takes the first page, the data starts page aligned after
+ * it */
+#define HEADER_SIZE PA_PAGE_SIZE
+
+struct header {
+    pa_atomic_t write_index;
+    pa_atomic_t read_index;
+    pa_fdsem_data fdsem_data;
+};
+
+struct pa_shmring {
+    pa_shm shm;
+    struct header *header;
+    uint8_t *data;
+    size_t size;
+
+    pa_fdsem *fdsem;
+    pa_bool_t consumer;
+    pa_bool_t private;
+
+    /* Our own indexes. The ones in the header are only written, so that
+     * the peer cannot make us step outside of the ring. */
+    unsigned read_index, write_index;
+};
+
+static void setup(pa_shmring *r) {
+    r->header = r->shm.ptr;
+    r->data = (uint8_t*) r->shm.ptr + HEADER_SIZE;
+    r->size = r->shm.size - HEADER_SIZE;
+}
+
+pa_shmring* pa_shmring_new(size_t size) {
+    pa_shmring *r;
+    int efd;
+
+    pa_assert(size > 0);
+
+    r = pa_xnew0(pa_shmring, 1);
+
+    size = pa_make_power_of_two((unsigned) PA_MAX(size, (size_t) PA_PAGE_SIZE));
+
+    if (pa_shm_create_rw(&r->shm, HEADER_SIZE + size, TRUE, PA_SHM_HUGE_PAGES_NO, 0700) < 0) {
+        pa_xfree(r);
+        return NULL;
+    }
+
+    /* Only a memfd can be handed over to the peer */
+    if (r->shm.fd < 0 || r->shm.size != HEADER_SIZE + size) {
+        pa_shm_free(&r->shm);
+        pa_xfree(r);
+        return NULL;
+    }
+
+    setup(r);
+
+    pa_atomic_store(&r->header->write_index, 0);
+    pa_atomic_store(&r->header->read_index, 0);
+
+    if (!(r->fdsem = pa_fdsem_new_shm(&r->header->fdsem_data, &efd))) {
+        pa_shm_free(&r->shm);
+        pa_xfree(r);
+        return NULL;
+    }
+
+    return r;
+}
+
+pa_shmring* pa_shmring_new_private(size_t size) {
+    pa_shmring *r;
+
+    pa_assert(size > 0);
+
+    r = pa_xnew0(pa_shmring, 1);
+    r->private = TRUE;
+
+    size = pa_make_power_of_two((unsigned) PA_MAX(size, (size_t) PA_PAGE_SIZE));
+
+    if (pa_shm_create_rw(&r->shm, HEADER_SIZE + size, FALSE, PA_SHM_HUGE_PAGES_NO, 0700) < 0) {
+        pa_xfree(r);
+        return NULL;
+    }
+
+    setup(r);
+
+    pa_atomic_store(&r->header->write_index, 0);
+    pa_atomic_store(&r->header->read_index, 0);
+
+    return r;
+}
+
+pa_shmring* pa_shmring_open(int memfd, int event_fd) {
+    pa_shmring *r;
+
+    pa_assert(memfd >= 0);
+    pa_assert(event_fd >= 0);
+
+    r = pa_xnew0(pa_shmring, 1);
+    r->consumer = TRUE;
+
+    if (pa_shm_attach_fd_rw(&r->shm, 0, memfd) < 0)
+        goto fail;
+
+    if (r->shm.size <= HEADER_SIZE || !pa_is_power_of_two((unsigned) (r->shm.size - HEADER_SIZE))) {
+        pa_log("Invalid SHM ring size.");
+        pa_shm_free(&r->shm);
+        goto fail;
+    }
+
+    setup(r);
+
+    if (!(r->fdsem = pa_fdsem_open_shm(&r->header->fdsem_data, event_fd))) {
+        pa_shm_free(&r->shm);
+        goto fail;
+    }
+
+    /* There might be data already */
+    r->read_index = (unsigned) pa_atomic_load(&r->header->read_index);
+
+    return r;
+
+fail:
+    pa_close(event_fd);
+    pa_xfree(r);
+    return NULL;
+}
+
+void pa_shmring_free(pa_shmring *r) {
+    pa_assert(r);
+
+    if (r->fdsem)
+        pa_fdsem_free(r->fdsem);
+
+    pa_shm_free(&r->shm);
+    pa_xfree(r);
+}
+
+void pa_shmring_get_fds(pa_shmring *r, int fds[2]) {
+    pa_assert(r);
+    pa_assert(!r->private);
+    pa_assert(fds);
+
+    fds[0] = r->shm.fd;
+    fds[1] = pa_fdsem_get(r->fdsem);
+}
+
+size_t pa_shmring_get_size(pa_shmring *r) {
+    pa_assert(r);
+
+    return r->size;
+}
+
+size_t pa_shmring_get_length(pa_shmring *r) {
+    unsigned l;
+
+    pa_assert(r);
+
+    /* Both sides may ask for a private ring, the header is trusted
+     * then */
+    if (r->private)
+        l = (unsigned) pa_atomic_load(&r->header->write_index) - (unsigned) pa_atomic_load(&r->header->read_index);
+    else if (r->consumer)
+        l = (unsigned) pa_atomic_load(&r->header->write_index) - r->read_index;
+    else
+        l = r->write_index - (unsigned) pa_atomic_load(&r->header->read_index);
+
+    return PA_MIN((size_t) l, r->size);
+}
+
+void* pa_shmring_begin_write(pa_shmring *r, size_t *l) {
+    size_t idx, n;
+
+    pa_assert(r);
+    pa_assert(!r->consumer);
+    pa_assert(l);
+
+    n = r->write_index - (unsigned) pa_atomic_load(&r->header->read_index);
+    if ((n = r->size - PA_MIN(n, r->size)) <= 0)
+        return NULL;
+
+    idx = r->write_index & (r->size - 1);
+    *l = PA_MIN(n, r->size - idx);
+
+    return r->data + idx;
+}
+
+void pa_shmring_end_write(pa_shmring *r, size_t l) {
+    pa_assert(r);
+    pa_assert(!r->consumer);
+
+    r->write_index += (unsigned) l;
+
+    /* Also a barrier, the data is visible before the index */
+    pa_atomic_add(&r->header->write_index, (int) l);
+}
+
+size_t pa_shmring_write(pa_shmring *r, const void *data, size_t l) {
+    size_t written = 0;
+
+    pa_assert(r);
+    pa_assert(data);
+
+    while (written < l) {
+        void *d;
+        size_t n;
+
+        if (!(d = pa_shmring_begin_write(r, &n)))
+            break;
+
+        n = PA_MIN(n, l - written);
+        memcpy(d, (const uint8_t*) data + written, n);
+        pa_shmring_end_write(r, n);
+
+        written += n;
+    }
+
+    return written;
+}
+
+const void* pa_shmring_peek(pa_shmring *r, size_t *l) {
+    size_t idx, n;
+
+    pa_assert(r);
+    pa_assert(r->consumer || r->private);
+    pa_assert(l);
+
+    n = (unsigned) pa_atomic_load(&r->header->write_index) - r->read_index;
+    if ((n = PA_MIN(n, r->size)) <= 0)
+        return NULL;
+
+    idx = r->read_index & (r->size - 1);
+    *l = PA_MIN(n, r->size - idx);
+
+    return r->data + idx;
+}
+
+void pa_shmring_drop(pa_shmring *r, size_t l) {
+    pa_assert(r);
+    pa_assert(r->consumer || r->private);
+
+    r->read_index += (unsigned) l;
+
+    /* Also a barrier, we are done with the data before the producer
+     * sees the space */
+    pa_atomic_add(&r->header->read_index, (int) l);
+}
+
+pa_fdsem* pa_shmring_get_fdsem(pa_shmring *r) {
+    pa_assert(r);
+
+    return r->fdsem;
+}
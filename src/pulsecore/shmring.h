@@ -0,0 +1,82 @@
+#ifndef foopulseshmringhfoo
+#define foopulseshmringhfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <sys/types.h>
+
+#include <pulsecore/fdsem.h>
+#include <pulsecore/macro.h>
+
+/* A single producer, single consumer byte ring in a memfd segment that
+ * is mapped by two processes. The read and write indexes live in the
+ * segment and only ever grow. The consumer posts the fdsem whenever it
+ * has freed some space, the producer may sleep on it.
+ *
+ * The producer creates the ring and passes the memfd and the eventfd
+ * of the fdsem on to the consumer. The consumer does not trust the
+ * producer: it only relies on the size of the segment it mapped and
+ * never reads more than that from the indexes. */
+
+typedef struct pa_shmring pa_shmring;
+
+/* Producer side. The size is rounded up to a power of two. Returns NULL
+ * if memfd or eventfd are not available. */
+pa_shmring* pa_shmring_new(size_t size);
+
+/* Both sides in one process, e.g. two threads. The memory is not
+ * shared and there is no fdsem, it is up to the caller to wake up the
+ * other side. */
+pa_shmring* pa_shmring_new_private(size_t size);
+
+/* Consumer side. Takes ownership of the fds, also on failure. */
+pa_shmring* pa_shmring_open(int memfd, int event_fd);
+
+void pa_shmring_free(pa_shmring *r);
+
+/* The memfd and the eventfd, to be passed to the consumer. They stay
+ * owned by the ring. */
+void pa_shmring_get_fds(pa_shmring *r, int fds[2]);
+
+size_t pa_shmring_get_size(pa_shmring *r);
+
+/* The number of bytes written and not consumed yet */
+size_t pa_shmring_get_length(pa_shmring *r);
+
+/* Producer side. Returns the free space up to the end of the ring, to
+ * be filled in place and committed with pa_shmring_end_write(). NULL if
+ * the ring is full. */
+void* pa_shmring_begin_write(pa_shmring *r, size_t *l);
+void pa_shmring_end_write(pa_shmring *r, size_t l);
+
+/* Producer side. Copies as much of data as fits, returns how much that
+ * was. */
+size_t pa_shmring_write(pa_shmring *r, const void *data, size_t l);
+
+/* Consumer side. Returns the readable bytes up to the end of the ring,
+ * NULL if the ring is empty. */
+const void* pa_shmring_peek(pa_shmring *r, size_t *l);
+void pa_shmring_drop(pa_shmring *r, size_t l);
+
+/* Posted by the consumer, waited on by the producer. NULL for a
+ * private ring. */
+pa_fdsem* pa_shmring_get_fdsem(pa_shmring *r);
+
+#endif
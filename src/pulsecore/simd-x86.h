@@ -0,0 +1,90 @@
+#ifndef foosimdx86hfoo
+#define foosimdx86hfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+/* Helpers for the SSE2 and AVX2 intrinsics code. Only include this
+ * from files that are built with SSE2_CFLAGS or AVX2_CFLAGS. */
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+
+/* Signed 32x32->64 bit multiply of the even lanes, c must be non-negative */
+static inline __m128i mul_s32_sse2(__m128i v, __m128i c) {
+    __m128i corr = _mm_slli_epi64(_mm_and_si128(_mm_srai_epi32(v, 31), c), 32);
+
+    return _mm_sub_epi64(_mm_mul_epu32(v, c), corr);
+}
+
+/* Arithmetic shift right by 16 of 64 bit lanes */
+static inline __m128i sra16_s64_sse2(__m128i p) {
+    const __m128i fill = _mm_set_epi32(0xFFFF0000, 0, 0xFFFF0000, 0);
+
+    return _mm_or_si128(_mm_srli_epi64(p, 16), _mm_and_si128(_mm_srai_epi32(p, 31), fill));
+}
+
+/* Saturate 64 bit lanes to 32 bit, the result is in the low half of
+ * each lane */
+static inline __m128i sat_s64_sse2(__m128i x) {
+    __m128i hi = _mm_srli_epi64(x, 32);
+    __m128i fits = _mm_cmpeq_epi32(hi, _mm_srai_epi32(x, 31));
+    __m128i sat = _mm_xor_si128(_mm_srai_epi32(hi, 31), _mm_set1_epi32(0x7FFFFFFF));
+
+    return _mm_or_si128(_mm_and_si128(fits, x), _mm_andnot_si128(fits, sat));
+}
+
+/* Byte swap 32 bit lanes */
+static inline __m128i bswap32_sse2(__m128i x) {
+    x = _mm_shufflehi_epi16(_mm_shufflelo_epi16(x, 0xB1), 0xB1);
+
+    return _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8));
+}
+#endif /* __SSE2__ */
+
+#ifdef __AVX2__
+#include <immintrin.h>
+
+/* Arithmetic shift right by 16 of 64 bit lanes */
+static inline __m256i sra16_s64_avx2(__m256i p) {
+    const __m256i fill = _mm256_set_epi32(0xFFFF0000, 0, 0xFFFF0000, 0, 0xFFFF0000, 0, 0xFFFF0000, 0);
+
+    return _mm256_or_si256(_mm256_srli_epi64(p, 16), _mm256_and_si256(_mm256_srai_epi32(p, 31), fill));
+}
+
+/* Saturate 64 bit lanes to 32 bit, the result is in the low half of
+ * each lane */
+static inline __m256i sat_s64_avx2(__m256i x) {
+    const __m256i max = _mm256_set1_epi64x(0x7FFFFFFFLL);
+    const __m256i min = _mm256_set1_epi64x(-0x80000000LL);
+
+    x = _mm256_blendv_epi8(x, max, _mm256_cmpgt_epi64(x, max));
+    return _mm256_blendv_epi8(x, min, _mm256_cmpgt_epi64(min, x));
+}
+
+/* Byte swap 32 bit lanes */
+static inline __m256i bswap32_avx2(__m256i x) {
+    const __m256i mask = _mm256_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3,
+                                         12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+
+    return _mm256_shuffle_epi8(x, mask);
+}
+#endif /* __AVX2__ */
+
+#endif
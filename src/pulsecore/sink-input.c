@@ -26,18 +26,23 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <pulse/utf8.h>
 #include <pulse/xmalloc.h>
 #include <pulse/util.h>
 #include <pulse/internal.h>
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
 
 #include <pulsecore/mix.h>
 #include <pulsecore/core-subscribe.h>
 #include <pulsecore/log.h>
+#include <pulsecore/memarena.h>
 #include <pulsecore/play-memblockq.h>
 #include <pulsecore/namereg.h>
 #include <pulsecore/core-util.h>
+#include <pulsecore/thread-mq.h>
 
 #include "sink-input.h"
 
@@ -46,6 +51,12 @@
 #define MEMBLOCKQ_MAXLENGTH (32*1024*1024)
 #define CONVERT_BUFFER_LENGTH (PA_PAGE_SIZE)
 
+/* The history of render_memblockq is bounded by the deepest rewind seen
+ * over the last one or two windows of this length, but never below the
+ * minimum */
+#define RENDER_HISTORY_WINDOW_USEC (10*PA_USEC_PER_SEC)
+#define RENDER_HISTORY_MIN_USEC (20*PA_USEC_PER_MSEC)
+
 PA_DEFINE_PUBLIC_CLASS(pa_sink_input, pa_msgobject);
 
 struct volume_factor_entry {
@@ -53,6 +64,11 @@ struct volume_factor_entry {
     pa_cvolume volume;
 };
 
+struct volume_ramp {
+    float target;
+    pa_usec_t usec;
+};
+
 static struct volume_factor_entry *volume_factor_entry_new(const char *key, const pa_cvolume *volume) {
     struct volume_factor_entry *entry;
 
@@ -249,11 +265,44 @@ void pa_sink_input_new_data_done(pa_sink_input_new_data *data) {
     pa_proplist_free(data->proplist);
 }
 
+pa_sink_input_sync_group *pa_sink_input_sync_group_new(void) {
+    pa_sink_input_sync_group *g;
+
+    g = pa_xnew0(pa_sink_input_sync_group, 1);
+    PA_REFCNT_INIT(g);
+
+    return g;
+}
+
+pa_sink_input_sync_group *pa_sink_input_sync_group_ref(pa_sink_input_sync_group *g) {
+    pa_assert(g);
+    pa_assert(PA_REFCNT_VALUE(g) >= 1);
+
+    PA_REFCNT_INC(g);
+    return g;
+}
+
+/* May be called from the IO thread, when it drops the last reference to
+ * a member */
+void pa_sink_input_sync_group_unref(pa_sink_input_sync_group *g) {
+    pa_assert(g);
+    pa_assert(PA_REFCNT_VALUE(g) >= 1);
+
+    if (PA_REFCNT_DEC(g) > 0)
+        return;
+
+    pa_assert(!g->inputs);
+    pa_assert(!g->thread_info.inputs);
+
+    pa_xfree(g);
+}
+
 /* Called from main context */
 static void reset_callbacks(pa_sink_input *i) {
     pa_assert(i);
 
     i->pop = NULL;
+    i->pop_into = NULL;
     i->process_underrun = NULL;
     i->process_rewind = NULL;
     i->update_max_rewind = NULL;
@@ -352,7 +401,8 @@ int pa_sink_input_new(
         pa_sink_input_new_data_set_channel_map(data, &map);
 
     pa_return_val_if_fail(PA_SINK_IS_LINKED(pa_sink_get_state(data->sink)), -PA_ERR_BADSTATE);
-    pa_return_val_if_fail(!data->sync_base || (data->sync_base->sink == data->sink && pa_sink_input_get_state(data->sync_base) == PA_SINK_INPUT_CORKED), -PA_ERR_INVALID);
+    pa_return_val_if_fail(!data->sync_group || !data->sync_group->inputs ||
+                          (data->sync_group->inputs->sink == data->sink && pa_sink_input_get_state(data->sync_group->inputs) == PA_SINK_INPUT_CORKED), -PA_ERR_INVALID);
 
     r = check_passthrough_connection(pa_sink_input_new_data_is_passthrough(data), data->sink);
     if (r != PA_OK)
@@ -529,15 +579,19 @@ int pa_sink_input_new(
 
     i->muted = data->muted;
 
-    if (data->sync_base) {
-        i->sync_next = data->sync_base->sync_next;
-        i->sync_prev = data->sync_base;
+    i->sync_prev = NULL;
 
-        if (data->sync_base->sync_next)
-            data->sync_base->sync_next->sync_prev = i;
-        data->sync_base->sync_next = i;
-    } else
-        i->sync_next = i->sync_prev = NULL;
+    if (data->sync_group) {
+        i->sync_group = pa_sink_input_sync_group_ref(data->sync_group);
+
+        if ((i->sync_next = i->sync_group->inputs))
+            i->sync_next->sync_prev = i;
+        i->sync_group->inputs = i;
+        i->sync_group->n_inputs++;
+    } else {
+        i->sync_group = NULL;
+        i->sync_next = NULL;
+    }
 
     i->direct_outputs = pa_idxset_new(NULL, NULL);
 
@@ -551,10 +605,20 @@ int pa_sink_input_new(
     i->thread_info.resampler = resampler;
     i->thread_info.soft_volume = i->soft_volume;
     i->thread_info.muted = i->muted;
+    i->thread_info.ramp_start = i->thread_info.ramp_target = 1.0f;
+    i->thread_info.ramp_pos = i->thread_info.ramp_length = 0;
+    i->thread_info.ramp_restart = FALSE;
     i->thread_info.requested_sink_latency = (pa_usec_t) -1;
+    pa_seqlock_init(&i->latency_snapshot.lock);
+    i->latency_snapshot.queued = 0;
+    i->latency_snapshot.requested_latency = (pa_usec_t) -1;
     i->thread_info.rewrite_nbytes = 0;
     i->thread_info.rewrite_flush = FALSE;
     i->thread_info.dont_rewind_render = FALSE;
+    i->thread_info.render_history_missing = FALSE;
+    i->thread_info.rewind_depth = i->thread_info.rewind_depth_prev = 0;
+    i->thread_info.rewind_window = 0;
+    i->thread_info.render_history = i->thread_info.render_history_max = 0;
     i->thread_info.underrun_for = (uint64_t) -1;
     i->thread_info.underrun_for_sink = 0;
     i->thread_info.playing_for = 0;
@@ -577,6 +641,7 @@ int pa_sink_input_new(
             1,
             0,
             &i->sink->silence);
+    pa_memblockq_set_ring(i->thread_info.render_memblockq, TRUE);
     pa_xfree(memblockq_name);
 
     pt = pa_proplist_to_string_sep(i->proplist, "\n    ");
@@ -633,23 +698,20 @@ static void sink_input_set_state(pa_sink_input *i, pa_sink_input_state_t state)
     update_n_corked(i, state);
     i->state = state;
 
-    for (ssync = i->sync_prev; ssync; ssync = ssync->sync_prev) {
-        update_n_corked(ssync, state);
-        ssync->state = state;
-    }
-    for (ssync = i->sync_next; ssync; ssync = ssync->sync_next) {
-        update_n_corked(ssync, state);
-        ssync->state = state;
-    }
+    /* The IO thread changed the state of the whole group with the one
+     * message above */
+    for (ssync = i->sync_group ? i->sync_group->inputs : NULL; ssync; ssync = ssync->sync_next)
+        if (ssync != i) {
+            update_n_corked(ssync, state);
+            ssync->state = state;
+        }
 
     if (state != PA_SINK_INPUT_UNLINKED) {
         pa_hook_fire(&i->core->hooks[PA_CORE_HOOK_SINK_INPUT_STATE_CHANGED], i);
 
-        for (ssync = i->sync_prev; ssync; ssync = ssync->sync_prev)
-            pa_hook_fire(&i->core->hooks[PA_CORE_HOOK_SINK_INPUT_STATE_CHANGED], ssync);
-
-        for (ssync = i->sync_next; ssync; ssync = ssync->sync_next)
-            pa_hook_fire(&i->core->hooks[PA_CORE_HOOK_SINK_INPUT_STATE_CHANGED], ssync);
+        for (ssync = i->sync_group ? i->sync_group->inputs : NULL; ssync; ssync = ssync->sync_next)
+            if (ssync != i)
+                pa_hook_fire(&i->core->hooks[PA_CORE_HOOK_SINK_INPUT_STATE_CHANGED], ssync);
 
         if (PA_SINK_INPUT_IS_LINKED(state))
             pa_subscription_post(i->core, PA_SUBSCRIPTION_EVENT_SINK_INPUT|PA_SUBSCRIPTION_EVENT_CHANGE, i->index);
@@ -676,10 +738,17 @@ void pa_sink_input_unlink(pa_sink_input *i) {
     if (linked)
         pa_hook_fire(&i->core->hooks[PA_CORE_HOOK_SINK_INPUT_UNLINK], i);
 
-    if (i->sync_prev)
-        i->sync_prev->sync_next = i->sync_next;
-    if (i->sync_next)
-        i->sync_next->sync_prev = i->sync_prev;
+    if (i->sync_group && (i->sync_prev || i->sync_group->inputs == i)) {
+        if (i->sync_prev)
+            i->sync_prev->sync_next = i->sync_next;
+        else
+            i->sync_group->inputs = i->sync_next;
+
+        if (i->sync_next)
+            i->sync_next->sync_prev = i->sync_prev;
+
+        i->sync_group->n_inputs--;
+    }
 
     i->sync_prev = i->sync_next = NULL;
 
@@ -774,12 +843,159 @@ static void sink_input_free(pa_object *o) {
     if (i->volume_factor_sink_items)
         pa_hashmap_free(i->volume_factor_sink_items, (pa_free_cb_t) volume_factor_entry_free);
 
+    if (i->sync_group)
+        pa_sink_input_sync_group_unref(i->sync_group);
+
     pa_xfree(i->driver);
     pa_xfree(i);
 }
 
+/* Inputs put with pa_sink_input_put_async() are handed to the IO
+ * thread in batches. The main thread keeps appending to the batch it
+ * posted last until the IO thread picks it up and closes it by
+ * setting n_inputs to -1. Only the main thread appends, so a failing
+ * cmpxchg always means that the batch has been closed. */
+#define ATTACH_BATCH_MAX 64
+
+struct attach_slot {
+    pa_sink_input *input;
+    pa_sink_input_put_cb_t cb;
+    void *userdata;
+};
+
+typedef struct attach_batch {
+    pa_msgobject parent;
+
+    pa_sink *sink;
+
+    pa_atomic_t n_inputs;
+    unsigned n_closed;  /* Written by the IO thread when closing */
+    struct attach_slot slots[ATTACH_BATCH_MAX];
+} attach_batch;
+
+PA_DEFINE_PRIVATE_CLASS(attach_batch, pa_msgobject);
+#define ATTACH_BATCH(o) (attach_batch_cast(o))
+
+enum {
+    ATTACH_BATCH_MESSAGE_ATTACH,   /* IO thread */
+    ATTACH_BATCH_MESSAGE_DONE      /* main thread */
+};
+
 /* Called from main context */
-void pa_sink_input_put(pa_sink_input *i) {
+static void attach_batch_free(pa_object *o) {
+    attach_batch *b = ATTACH_BATCH(o);
+    unsigned n, k;
+
+    pa_assert(b);
+
+    if (b->sink->attach_batch == PA_MSGOBJECT(b))
+        b->sink->attach_batch = NULL;
+
+    /* If the batch never made it to the IO thread n_inputs is still
+     * the number of inputs in it */
+    n = pa_atomic_load(&b->n_inputs) >= 0 ? (unsigned) pa_atomic_load(&b->n_inputs) : b->n_closed;
+
+    for (k = 0; k < n; k++)
+        pa_sink_input_unref(b->slots[k].input);
+
+    pa_sink_unref(b->sink);
+    pa_xfree(b);
+}
+
+/* Called from IO context */
+static void attach_batch_close(attach_batch *b) {
+    int n;
+
+    do {
+        n = pa_atomic_load(&b->n_inputs);
+        pa_assert(n >= 0);
+    } while (!pa_atomic_cmpxchg(&b->n_inputs, n, -1));
+
+    b->n_closed = (unsigned) n;
+}
+
+/* Called from IO context, or from main context for DONE */
+static int attach_batch_process_msg(pa_msgobject *o, int code, void *data, int64_t offset, pa_memchunk *chunk) {
+    attach_batch *b = ATTACH_BATCH(o);
+    unsigned k;
+
+    pa_assert(b);
+
+    switch (code) {
+
+        case ATTACH_BATCH_MESSAGE_ATTACH:
+            attach_batch_close(b);
+
+            /* The completion goes out before anything the inputs may
+             * post themselves once attached, so the main thread can
+             * rely on seeing it first. */
+            pa_asyncmsgq_post(pa_thread_mq_get()->outq, PA_MSGOBJECT(b), ATTACH_BATCH_MESSAGE_DONE, NULL, 0, NULL, NULL);
+
+            /* Dispatched through the sink's own handler, so that
+             * implementations overriding ADD_INPUT see every input */
+            for (k = 0; k < b->n_closed; k++)
+                pa_assert_se(PA_MSGOBJECT(b->sink)->process_msg(PA_MSGOBJECT(b->sink), PA_SINK_MESSAGE_ADD_INPUT, b->slots[k].input, 0, NULL) == 0);
+
+            return 0;
+
+        case ATTACH_BATCH_MESSAGE_DONE:
+            if (b->sink->attach_batch == PA_MSGOBJECT(b))
+                b->sink->attach_batch = NULL;
+
+            for (k = 0; k < b->n_closed; k++)
+                if (b->slots[k].cb)
+                    b->slots[k].cb(b->slots[k].input, b->slots[k].userdata);
+
+            return 0;
+    }
+
+    return -1;
+}
+
+/* Called from main context */
+static pa_bool_t attach_batch_append(attach_batch *b, pa_sink_input *i, pa_sink_input_put_cb_t cb, void *userdata) {
+    int n;
+
+    n = pa_atomic_load(&b->n_inputs);
+    if (n < 0 || n >= ATTACH_BATCH_MAX)
+        return FALSE;
+
+    b->slots[n].input = pa_sink_input_ref(i);
+    b->slots[n].cb = cb;
+    b->slots[n].userdata = userdata;
+
+    if (!pa_atomic_cmpxchg(&b->n_inputs, n, n + 1)) {
+        pa_sink_input_unref(b->slots[n].input);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/* Called from main context */
+static void attach_async(pa_sink_input *i, pa_sink_input_put_cb_t cb, void *userdata) {
+    attach_batch *b;
+
+    if (i->sink->attach_batch && attach_batch_append(ATTACH_BATCH(i->sink->attach_batch), i, cb, userdata))
+        return;
+
+    b = pa_msgobject_new(attach_batch);
+    b->parent.parent.free = attach_batch_free;
+    b->parent.process_msg = attach_batch_process_msg;
+    b->sink = pa_sink_ref(i->sink);
+    pa_atomic_store(&b->n_inputs, 0);
+
+    pa_assert_se(attach_batch_append(b, i, cb, userdata));
+
+    i->sink->attach_batch = PA_MSGOBJECT(b);
+    pa_asyncmsgq_post(i->sink->asyncmsgq, PA_MSGOBJECT(b), ATTACH_BATCH_MESSAGE_ATTACH, NULL, 0, NULL, NULL);
+
+    /* The queue holds on to the batch now */
+    attach_batch_unref(b);
+}
+
+/* Called from main context */
+static void put_prepare(pa_sink_input *i) {
     pa_sink_input_state_t state;
 
     pa_sink_input_assert_ref(i);
@@ -814,15 +1030,33 @@ void pa_sink_input_put(pa_sink_input *i) {
 
     i->thread_info.soft_volume = i->soft_volume;
     i->thread_info.muted = i->muted;
+}
 
-    pa_assert_se(pa_asyncmsgq_send(i->sink->asyncmsgq, PA_MSGOBJECT(i->sink), PA_SINK_MESSAGE_ADD_INPUT, i, 0, NULL) == 0);
-
+/* Called from main context */
+static void put_finish(pa_sink_input *i) {
     pa_subscription_post(i->core, PA_SUBSCRIPTION_EVENT_SINK_INPUT|PA_SUBSCRIPTION_EVENT_NEW, i->index);
     pa_hook_fire(&i->core->hooks[PA_CORE_HOOK_SINK_INPUT_PUT], i);
 
     pa_sink_update_status(i->sink);
 }
 
+/* Called from main context */
+void pa_sink_input_put(pa_sink_input *i) {
+    put_prepare(i);
+
+    pa_assert_se(pa_asyncmsgq_send(i->sink->asyncmsgq, PA_MSGOBJECT(i->sink), PA_SINK_MESSAGE_ADD_INPUT, i, 0, NULL) == 0);
+
+    put_finish(i);
+}
+
+/* Called from main context */
+void pa_sink_input_put_async(pa_sink_input *i, pa_sink_input_put_cb_t cb, void *userdata) {
+    put_prepare(i);
+
+    attach_async(i, cb, userdata);
+    put_finish(i);
+}
+
 /* Called from main context */
 void pa_sink_input_kill(pa_sink_input*i) {
     pa_sink_input_assert_ref(i);
@@ -852,10 +1086,93 @@ pa_usec_t pa_sink_input_get_latency(pa_sink_input *i, pa_usec_t *sink_latency) {
 }
 
 /* Called from thread context */
-void pa_sink_input_peek(pa_sink_input *i, size_t slength /* in sink bytes */, pa_memchunk *chunk, pa_cvolume *volume) {
+static void publish_latency(pa_sink_input *i) {
+    pa_seqlock_write_begin(&i->latency_snapshot.lock);
+    i->latency_snapshot.queued = pa_bytes_to_usec(pa_memblockq_get_length(i->thread_info.render_memblockq), &i->sink->sample_spec);
+    i->latency_snapshot.requested_latency = i->thread_info.requested_sink_latency;
+    pa_seqlock_write_end(&i->latency_snapshot.lock);
+}
+
+/* Called from main context */
+pa_usec_t pa_sink_input_get_latency_nowait(pa_sink_input *i, pa_usec_t *requested_latency) {
+    pa_usec_t queued, requested;
+
+    pa_sink_input_assert_ref(i);
+    pa_assert_ctl_context();
+    pa_assert(PA_SINK_INPUT_IS_LINKED(i->state));
+
+    if (i->sink) {
+        int seq;
+
+        do {
+            seq = pa_seqlock_read_begin(&i->latency_snapshot.lock);
+            queued = i->latency_snapshot.queued;
+            requested = i->latency_snapshot.requested_latency;
+        } while (pa_seqlock_read_retry(&i->latency_snapshot.lock, seq));
+    } else {
+        /* Being moved, see pa_sink_input_get_requested_latency() */
+        queued = 0;
+        requested = i->thread_info.requested_sink_latency;
+    }
+
+    if (i->get_latency)
+        queued += i->get_latency(i);
+
+    if (requested_latency)
+        *requested_latency = requested;
+
+    return queued;
+}
+
+/* Called from thread context */
+static float ramp_gain(pa_sink_input *i, int64_t pos) {
+
+    if (pos < 0)
+        return i->thread_info.ramp_start;
+
+    if (pos >= i->thread_info.ramp_length)
+        return i->thread_info.ramp_target;
+
+    return i->thread_info.ramp_start +
+        (i->thread_info.ramp_target - i->thread_info.ramp_start) * (float) pos / (float) i->thread_info.ramp_length;
+}
+
+/* Applies the part of the volume ramp that falls into the chunk, which
+ * is shortened to the ramp or the flat part before or after it. Returns
+ * the gain that is left for the flat parts.
+ *
+ * Called from thread context */
+static float apply_ramp(pa_sink_input *i, pa_memchunk *chunk) {
+    size_t fs = pa_frame_size(&i->sink->sample_spec);
+    int64_t pos = i->thread_info.ramp_pos, frames = (int64_t) (chunk->length / fs);
+    float step;
+
+    if (pos < 0) {
+        chunk->length = (size_t) PA_MIN(frames, -pos) * fs;
+        return i->thread_info.ramp_start;
+    }
+
+    if (pos >= i->thread_info.ramp_length)
+        return i->thread_info.ramp_target;
+
+    chunk->length = (size_t) PA_MIN(frames, i->thread_info.ramp_length - pos) * fs;
+
+    if (!i->thread_info.muted && !pa_memblock_is_silence(chunk->memblock)) {
+        step = (i->thread_info.ramp_target - i->thread_info.ramp_start) / (float) i->thread_info.ramp_length;
+
+        pa_memchunk_make_writable_scratch(chunk, 0);
+        pa_volume_ramp_memchunk(chunk, &i->sink->sample_spec, ramp_gain(i, pos), step);
+    }
+
+    return 1.0f;
+}
+
+/* Called from thread context */
+static pa_bool_t peek(pa_sink_input *i, size_t slength /* in sink bytes */, pa_memchunk *chunk, pa_cvolume *volume, pa_bool_t ready_only) {
     pa_bool_t do_volume_adj_here, need_volume_factor_sink;
-    pa_bool_t volume_is_norm;
+    pa_bool_t volume_is_norm, ready = TRUE;
     size_t block_size_max_sink, block_size_max_sink_input;
+    float gain;
     size_t ilength;
     size_t ilength_full;
 
@@ -884,6 +1201,7 @@ void pa_sink_input_peek(pa_sink_input *i, size_t slength /* in sink bytes */, pa
         slength = block_size_max_sink;
 
     if (i->thread_info.resampler) {
+        pa_resampler_set_load(i->thread_info.resampler, i->sink->thread_info.render_load);
         ilength = pa_resampler_request(i->thread_info.resampler, slength);
 
         if (ilength <= 0)
@@ -920,11 +1238,17 @@ void pa_sink_input_peek(pa_sink_input *i, size_t slength /* in sink bytes */, pa
             pa_atomic_store(&i->thread_info.drained, 1);
 
             pa_memblockq_seek(i->thread_info.render_memblockq, (int64_t) slength, PA_SEEK_RELATIVE, TRUE);
+
+            if (i->thread_info.underrun_for == 0 && i->thread_info.playing_for > 0)
+                i->thread_info.counters.underruns++;
+
             i->thread_info.playing_for = 0;
             if (i->thread_info.underrun_for != (uint64_t) -1) {
                 i->thread_info.underrun_for += ilength_full;
                 i->thread_info.underrun_for_sink += slength;
             }
+
+            ready = FALSE;
             break;
         }
 
@@ -947,12 +1271,19 @@ void pa_sink_input_peek(pa_sink_input *i, size_t slength /* in sink bytes */, pa
             if (wchunk.length > block_size_max_sink_input)
                 wchunk.length = block_size_max_sink_input;
 
-            /* It might be necessary to adjust the volume here */
-            if (do_volume_adj_here && !volume_is_norm) {
-                pa_memchunk_make_writable(&wchunk, 0);
+            /* It might be necessary to adjust the volume here. Silence
+             * stays silence whatever the volume, so the shared block is
+             * passed on instead of being copied. */
+            if (pa_memblock_is_silence(wchunk.memblock))
+                nvfs = FALSE;
+
+            else if (do_volume_adj_here && !volume_is_norm) {
 
                 if (i->thread_info.muted) {
-                    pa_silence_memchunk(&wchunk, &i->thread_info.sample_spec);
+                    size_t length = wchunk.length;
+
+                    pa_memblock_unref(wchunk.memblock);
+                    pa_silence_memchunk_get(&i->core->silence_cache, i->core->mempool, &wchunk, &i->thread_info.sample_spec, length);
                     nvfs = FALSE;
 
                 } else if (!i->thread_info.resampler && nvfs) {
@@ -961,25 +1292,35 @@ void pa_sink_input_peek(pa_sink_input *i, size_t slength /* in sink bytes */, pa
                     /* If we don't need a resampler we can merge the
                      * post and the pre volume adjustment into one */
 
+                    pa_memchunk_make_writable_scratch(&wchunk, 0);
                     pa_sw_cvolume_multiply(&v, &i->thread_info.soft_volume, &i->volume_factor_sink);
                     pa_volume_memchunk(&wchunk, &i->thread_info.sample_spec, &v);
                     nvfs = FALSE;
 
-                } else
+                } else {
+                    pa_memchunk_make_writable_scratch(&wchunk, 0);
                     pa_volume_memchunk(&wchunk, &i->thread_info.sample_spec, &i->thread_info.soft_volume);
+                }
             }
 
             if (!i->thread_info.resampler) {
 
                 if (nvfs) {
-                    pa_memchunk_make_writable(&wchunk, 0);
+                    pa_memchunk_make_writable_scratch(&wchunk, 0);
                     pa_volume_memchunk(&wchunk, &i->sink->sample_spec, &i->volume_factor_sink);
                 }
 
                 pa_memblockq_push_align(i->thread_info.render_memblockq, &wchunk);
             } else {
                 pa_memchunk rchunk;
-                pa_resampler_run(i->thread_info.resampler, &wchunk, &rchunk);
+
+                if (PA_UNLIKELY(i->sink->render_stats)) {
+                    pa_usec_t start = pa_rtclock_now();
+
+                    pa_resampler_run(i->thread_info.resampler, &wchunk, &rchunk);
+                    i->thread_info.resample_usec += pa_rtclock_now() - start;
+                } else
+                    pa_resampler_run(i->thread_info.resampler, &wchunk, &rchunk);
 
 #ifdef SINK_INPUT_DEBUG
                 pa_log_debug("pushing %lu", (unsigned long) rchunk.length);
@@ -987,8 +1328,8 @@ void pa_sink_input_peek(pa_sink_input *i, size_t slength /* in sink bytes */, pa
 
                 if (rchunk.memblock) {
 
-                    if (nvfs) {
-                        pa_memchunk_make_writable(&rchunk, 0);
+                    if (nvfs && !pa_memblock_is_silence(rchunk.memblock)) {
+                        pa_memchunk_make_writable_scratch(&rchunk, 0);
                         pa_volume_memchunk(&rchunk, &i->sink->sample_spec, &i->volume_factor_sink);
                     }
 
@@ -1006,6 +1347,13 @@ void pa_sink_input_peek(pa_sink_input *i, size_t slength /* in sink bytes */, pa
         pa_memblock_unref(tchunk.memblock);
     }
 
+    /* All there is to read is the silence we just seeked over */
+    if (!ready && ready_only) {
+        pa_memchunk_reset(chunk);
+        chunk->length = slength;
+        return FALSE;
+    }
+
     pa_assert_se(pa_memblockq_peek(i->thread_info.render_memblockq, chunk) >= 0);
 
     pa_assert(chunk->length > 0);
@@ -1018,6 +1366,8 @@ void pa_sink_input_peek(pa_sink_input *i, size_t slength /* in sink bytes */, pa
     if (chunk->length > block_size_max_sink)
         chunk->length = block_size_max_sink;
 
+    gain = apply_ramp(i, chunk);
+
     /* Let's see if we had to apply the volume adjustment ourselves,
      * or if this can be done by the sink for us */
 
@@ -1029,6 +1379,52 @@ void pa_sink_input_peek(pa_sink_input *i, size_t slength /* in sink bytes */, pa
         pa_cvolume_mute(volume, i->sink->sample_spec.channels);
     else
         *volume = i->thread_info.soft_volume;
+
+    /* Outside of the ramp its gain is left to the sink too */
+    if (gain != 1.0f && !i->thread_info.muted)
+        pa_sw_cvolume_multiply_scalar(volume, volume, pa_sw_volume_from_linear(gain));
+
+    return TRUE;
+}
+
+/* Called from thread context */
+void pa_sink_input_peek(pa_sink_input *i, size_t slength /* in sink bytes */, pa_memchunk *chunk, pa_cvolume *volume) {
+    peek(i, slength, chunk, volume, FALSE);
+}
+
+/* Called from thread context */
+pa_bool_t pa_sink_input_peek_ready(pa_sink_input *i, size_t slength /* in sink bytes */, pa_memchunk *chunk, pa_cvolume *volume) {
+    return peek(i, slength, chunk, volume, TRUE);
+}
+
+/* Called from thread context */
+static pa_bool_t render_history_bounded(pa_sink_input *i) {
+
+    /* Only implementors that keep a history of their own for
+     * update_max_rewind() can render again what we don't keep */
+    return i->update_max_rewind && i->process_rewind;
+}
+
+/* Called from thread context */
+static void update_render_history(pa_sink_input *i) {
+    size_t nbytes = i->sink->thread_info.max_rewind;
+
+    if (render_history_bounded(i)) {
+        size_t depth = PA_MAX(i->thread_info.rewind_depth, i->thread_info.rewind_depth_prev);
+
+        depth = PA_MAX(depth, pa_usec_to_bytes(RENDER_HISTORY_MIN_USEC, &i->sink->sample_spec));
+        nbytes = PA_MIN(nbytes, depth);
+    }
+
+    if (nbytes == pa_memblockq_get_maxrewind(i->thread_info.render_memblockq))
+        return;
+
+#ifdef SINK_INPUT_DEBUG
+    pa_log_debug("Keeping %lu bytes of render history.", (unsigned long) nbytes);
+#endif
+
+    pa_memblockq_set_maxrewind(i->thread_info.render_memblockq, nbytes);
+    i->thread_info.render_history_max = pa_memblockq_get_maxrewind(i->thread_info.render_memblockq);
 }
 
 /* Called from thread context */
@@ -1045,6 +1441,82 @@ void pa_sink_input_drop(pa_sink_input *i, size_t nbytes /* in sink sample spec *
 #endif
 
     pa_memblockq_drop(i->thread_info.render_memblockq, nbytes);
+
+    i->thread_info.ramp_pos += (int64_t) (nbytes / pa_frame_size(&i->sink->sample_spec));
+    i->thread_info.ramp_restart = FALSE;
+
+    publish_latency(i);
+
+    i->thread_info.render_history = pa_memblockq_get_history(i->thread_info.render_memblockq);
+    i->thread_info.rewind_window += nbytes;
+
+    if (i->thread_info.rewind_window >= pa_usec_to_bytes(RENDER_HISTORY_WINDOW_USEC, &i->sink->sample_spec)) {
+        i->thread_info.rewind_depth_prev = i->thread_info.rewind_depth;
+        i->thread_info.rewind_depth = 0;
+        i->thread_info.rewind_window = 0;
+
+        update_render_history(i);
+    }
+}
+
+/* Called from thread context */
+pa_bool_t pa_sink_input_render_into(pa_sink_input *i, pa_memchunk *target /* in sink sample spec */) {
+    size_t length;
+
+    pa_sink_input_assert_ref(i);
+    pa_sink_input_assert_io_context(i);
+    pa_assert(PA_SINK_INPUT_IS_LINKED(i->thread_info.state));
+    pa_assert(target);
+    pa_assert(target->memblock);
+    pa_assert(target->length > 0);
+    pa_assert(pa_frame_aligned(target->length, &i->sink->sample_spec));
+
+    /* This only works if the data of the implementor would have ended
+     * up in the sink unmodified anyway, and if nothing from an earlier
+     * peek() is still waiting to be played */
+    if (!i->pop_into ||
+        i->thread_info.state != PA_SINK_INPUT_RUNNING ||
+        i->thread_info.resampler ||
+        i->thread_info.muted ||
+        !pa_cvolume_is_norm(&i->thread_info.soft_volume) ||
+        !pa_cvolume_is_norm(&i->volume_factor_sink) ||
+        i->thread_info.ramp_pos < i->thread_info.ramp_length ||
+        i->thread_info.ramp_target != 1.0f ||
+        pa_memblockq_is_readable(i->thread_info.render_memblockq))
+        return FALSE;
+
+    length = target->length;
+
+    if (i->pop_into(i, target) < 0)
+        return FALSE;
+
+    pa_assert(target->length > 0);
+    pa_assert(target->length <= length);
+    pa_assert(pa_frame_aligned(target->length, &i->sink->sample_spec));
+
+#ifdef SINK_INPUT_DEBUG
+    pa_log_debug("rendered %lu into target", (unsigned long) target->length);
+#endif
+
+    pa_atomic_store(&i->thread_info.drained, 0);
+
+    i->thread_info.underrun_for = 0;
+    i->thread_info.underrun_for_sink = 0;
+    i->thread_info.playing_for += target->length;
+
+    /* Keep the read and write indexes in sync with what peek() would
+     * have done. The data itself never passed through the queue, so
+     * all the queue remembers is a hole. */
+    pa_memblockq_seek(i->thread_info.render_memblockq, (int64_t) target->length, PA_SEEK_RELATIVE, TRUE);
+    pa_memblockq_drop(i->thread_info.render_memblockq, target->length);
+    i->thread_info.render_history_missing = TRUE;
+
+    i->thread_info.ramp_pos += (int64_t) (target->length / pa_frame_size(&i->sink->sample_spec));
+    i->thread_info.ramp_restart = FALSE;
+
+    publish_latency(i);
+
+    return TRUE;
 }
 
 /* Called from thread context */
@@ -1080,8 +1552,41 @@ void pa_sink_input_process_rewind(pa_sink_input *i, size_t nbytes /* in sink sam
     lbq = pa_memblockq_get_length(i->thread_info.render_memblockq);
 
     if (nbytes > 0 && !i->thread_info.dont_rewind_render) {
+        pa_bool_t history_short;
+
         pa_log_debug("Have to rewind %lu bytes on render memblockq.", (unsigned long) nbytes);
+
+        /* A rewind deeper than the history we keep is served by the
+         * implementor, and from now on that much is kept */
+        history_short = nbytes > pa_memblockq_get_maxrewind(i->thread_info.render_memblockq);
+
         pa_memblockq_rewind(i->thread_info.render_memblockq, nbytes);
+
+        /* A new ramp starts with what is played again */
+        if (i->thread_info.ramp_restart)
+            i->thread_info.ramp_pos = 0;
+        else
+            i->thread_info.ramp_pos -= (int64_t) (nbytes / pa_frame_size(&i->sink->sample_spec));
+
+        i->thread_info.counters.rewinds++;
+        i->thread_info.counters.rewind_bytes += nbytes;
+
+        if (nbytes > i->thread_info.rewind_depth) {
+            i->thread_info.rewind_depth = nbytes;
+            update_render_history(i);
+        }
+
+        /* What pop_into() rendered can't be replayed from the queue, so
+         * the implementor has to render all of it again */
+        if ((i->thread_info.render_history_missing || (history_short && render_history_bounded(i))) &&
+            i->thread_info.rewrite_nbytes != (size_t) -1) {
+            size_t missing = nbytes + lbq;
+
+            if (i->thread_info.resampler)
+                missing = pa_resampler_request(i->thread_info.resampler, missing);
+
+            i->thread_info.rewrite_nbytes = PA_MAX(i->thread_info.rewrite_nbytes, missing);
+        }
     }
 
     if (i->thread_info.rewrite_nbytes == (size_t) -1) {
@@ -1136,6 +1641,9 @@ void pa_sink_input_process_rewind(pa_sink_input *i, size_t nbytes /* in sink sam
     i->thread_info.rewrite_nbytes = 0;
     i->thread_info.rewrite_flush = FALSE;
     i->thread_info.dont_rewind_render = FALSE;
+    i->thread_info.ramp_restart = FALSE;
+
+    publish_latency(i);
 }
 
 /* Called from thread context */
@@ -1164,7 +1672,7 @@ void pa_sink_input_update_max_rewind(pa_sink_input *i, size_t nbytes  /* in the
     pa_assert(PA_SINK_INPUT_IS_LINKED(i->thread_info.state));
     pa_assert(pa_frame_aligned(nbytes, &i->sink->sample_spec));
 
-    pa_memblockq_set_maxrewind(i->thread_info.render_memblockq, nbytes);
+    update_render_history(i);
 
     if (i->update_max_rewind)
         i->update_max_rewind(i, i->thread_info.resampler ? pa_resampler_request(i->thread_info.resampler, nbytes) : nbytes);
@@ -1195,6 +1703,8 @@ pa_usec_t pa_sink_input_set_requested_latency_within_thread(pa_sink_input *i, pa
     i->thread_info.requested_sink_latency = usec;
     pa_sink_invalidate_requested_latency(i->sink, TRUE);
 
+    publish_latency(i);
+
     return usec;
 }
 
@@ -1246,7 +1756,7 @@ pa_usec_t pa_sink_input_get_requested_latency(pa_sink_input *i) {
 
 /* Called from main context */
 void pa_sink_input_set_volume(pa_sink_input *i, const pa_cvolume *volume, pa_bool_t save, pa_bool_t absolute) {
-    pa_cvolume v;
+    pa_cvolume v, old_volume;
 
     pa_sink_input_assert_ref(i);
     pa_assert_ctl_context();
@@ -1276,14 +1786,17 @@ void pa_sink_input_set_volume(pa_sink_input *i, const pa_cvolume *volume, pa_boo
         return;
     }
 
+    old_volume = i->volume;
     i->volume = *volume;
     i->save_volume = save;
 
     if (pa_sink_flat_volume_enabled(i->sink)) {
         /* We are in flat volume mode, so let's update all sink input
-         * volumes and update the flat volume of the sink */
+         * volumes and update the flat volume of the sink, unless this
+         * input does not affect the sink volume in the first place */
 
-        pa_sink_set_volume(i->sink, NULL, TRUE, save);
+        if (!pa_sink_update_flat_volume_for_input(i, &old_volume, save))
+            pa_sink_set_volume(i->sink, NULL, TRUE, save);
 
     } else {
         /* OK, we are in normal volume mode. The volume only affects
@@ -1358,6 +1871,21 @@ void pa_sink_input_remove_volume_factor(pa_sink_input *i, const char *key) {
     pa_assert_se(pa_asyncmsgq_send(i->sink->asyncmsgq, PA_MSGOBJECT(i), PA_SINK_INPUT_MESSAGE_SET_SOFT_VOLUME, NULL, 0, NULL) == 0);
 }
 
+/* Called from main context */
+void pa_sink_input_set_volume_ramp(pa_sink_input *i, pa_volume_t volume, pa_usec_t usec) {
+    struct volume_ramp r;
+
+    pa_sink_input_assert_ref(i);
+    pa_assert_ctl_context();
+    pa_assert(PA_SINK_INPUT_IS_LINKED(i->state));
+    pa_assert(PA_VOLUME_IS_VALID(volume));
+
+    r.target = (float) pa_sw_volume_to_linear(volume);
+    r.usec = usec;
+
+    pa_assert_se(pa_asyncmsgq_send(i->sink->asyncmsgq, PA_MSGOBJECT(i), PA_SINK_INPUT_MESSAGE_SET_VOLUME_RAMP, &r, 0, NULL) == 0);
+}
+
 /* Called from main context */
 static void set_real_ratio(pa_sink_input *i, const pa_cvolume *v) {
     pa_sink_input_assert_ref(i);
@@ -1530,7 +2058,7 @@ pa_bool_t pa_sink_input_may_move(pa_sink_input *i) {
     if (i->flags & PA_SINK_INPUT_DONT_MOVE)
         return FALSE;
 
-    if (i->sync_next || i->sync_prev) {
+    if (i->sync_group && i->sync_group->n_inputs > 1) {
         pa_log_warn("Moving synchronized streams not supported.");
         return FALSE;
     }
@@ -1584,17 +2112,39 @@ pa_bool_t pa_sink_input_may_move_to(pa_sink_input *i, pa_sink *dest) {
 }
 
 /* Called from main context */
-int pa_sink_input_start_move(pa_sink_input *i) {
+/* Whether the audio that was rendered for the old sink can be played to
+ * dest as it is. That needs the same sample spec and channel map on both
+ * sinks, and the volume must not have been applied in the render queue
+ * already. Also the rate of dest must not be changed for us. */
+static pa_bool_t move_keeps_render(pa_sink_input *i, pa_sink *dest) {
+    pa_assert(i);
+    pa_assert(i->sink);
+
+    if (!dest || pa_sink_input_is_passthrough(i))
+        return FALSE;
+
+    if (!pa_sample_spec_equal(&i->sink->sample_spec, &dest->sample_spec) ||
+        !pa_channel_map_equal(&i->sink->channel_map, &dest->channel_map))
+        return FALSE;
+
+    if (!pa_channel_map_equal(&i->channel_map, &i->sink->channel_map))
+        return FALSE;
+
+    if (!(i->flags & PA_SINK_INPUT_VARIABLE_RATE) &&
+        !pa_sample_spec_equal(&i->sample_spec, &dest->sample_spec) &&
+        dest->update_rate)
+        return FALSE;
+
+    return TRUE;
+}
+
+/* Called from main context */
+/* Everything of a move start that comes before the IO thread of the old
+ * sink lets go of the stream */
+static int start_move_prepare(pa_sink_input *i) {
     pa_source_output *o, *p = NULL;
-    struct volume_factor_entry *v;
-    void *state = NULL;
     int r;
 
-    pa_sink_input_assert_ref(i);
-    pa_assert_ctl_context();
-    pa_assert(PA_SINK_INPUT_IS_LINKED(i->state));
-    pa_assert(i->sink);
-
     if (!pa_sink_input_may_move(i))
         return -PA_ERR_NOTSUPPORTED;
 
@@ -1617,14 +2167,14 @@ int pa_sink_input_start_move(pa_sink_input *i) {
     if (pa_sink_input_is_passthrough(i))
         pa_sink_leave_passthrough(i->sink);
 
-    if (pa_sink_flat_volume_enabled(i->sink))
-        /* We might need to update the sink's volume if we are in flat
-         * volume mode. */
-        pa_sink_set_volume(i->sink, NULL, FALSE, FALSE);
-
-    pa_assert_se(pa_asyncmsgq_send(i->sink->asyncmsgq, PA_MSGOBJECT(i->sink), PA_SINK_MESSAGE_START_MOVE, i, 0, NULL) == 0);
+    return 0;
+}
 
-    pa_sink_update_status(i->sink);
+/* Called from main context */
+/* And everything after that */
+static void start_move_done(pa_sink_input *i) {
+    struct volume_factor_entry *v;
+    void *state = NULL;
 
     PA_HASHMAP_FOREACH(v, i->volume_factor_sink_items, state)
         pa_cvolume_remap(&v->volume, &i->sink->channel_map, &i->channel_map);
@@ -1634,10 +2184,45 @@ int pa_sink_input_start_move(pa_sink_input *i) {
     i->sink = NULL;
 
     pa_sink_input_unref(i);
+}
+
+/* Called from main context */
+static int start_move(pa_sink_input *i, pa_sink *dest) {
+    pa_sink *sink;
+    pa_bool_t keep_render;
+    int r;
+
+    if ((r = start_move_prepare(i)) < 0)
+        return r;
+
+    sink = i->sink;
+    keep_render = move_keeps_render(i, dest);
+
+    if (pa_sink_flat_volume_enabled(sink))
+        /* We might need to update the sink's volume if we are in flat
+         * volume mode. */
+        pa_sink_set_volume(sink, NULL, FALSE, FALSE);
+
+    pa_assert_se(pa_asyncmsgq_send(sink->asyncmsgq, PA_MSGOBJECT(sink), PA_SINK_MESSAGE_START_MOVE, i, keep_render, NULL) == 0);
+
+    pa_sink_update_status(sink);
+
+    start_move_done(i);
 
     return 0;
 }
 
+/* Called from main context */
+int pa_sink_input_start_move(pa_sink_input *i) {
+    pa_sink_input_assert_ref(i);
+    pa_assert_ctl_context();
+    pa_assert(PA_SINK_INPUT_IS_LINKED(i->state));
+    pa_assert(i->sink);
+
+    /* We don't know where the stream goes, so it is rendered anew */
+    return start_move(i, NULL);
+}
+
 /* Called from main context. If i has an origin sink that uses volume sharing,
  * then also the origin sink and all streams connected to it need to update
  * their volume - this function does all that by using recursion. */
@@ -1789,16 +2374,12 @@ static void update_volume_due_to_moving(pa_sink_input *i, pa_sink *dest) {
 }
 
 /* Called from main context */
-int pa_sink_input_finish_move(pa_sink_input *i, pa_sink *dest, pa_bool_t save) {
+/* Everything of a move finish that comes before the IO thread of the new
+ * sink takes the stream */
+static int finish_move_prepare(pa_sink_input *i, pa_sink *dest, pa_bool_t save) {
     struct volume_factor_entry *v;
     void *state = NULL;
 
-    pa_sink_input_assert_ref(i);
-    pa_assert_ctl_context();
-    pa_assert(PA_SINK_INPUT_IS_LINKED(i->state));
-    pa_assert(!i->sink);
-    pa_sink_assert_ref(dest);
-
     if (!pa_sink_input_may_move_to(i, dest))
         return -PA_ERR_NOTSUPPORTED;
 
@@ -1839,6 +2420,10 @@ int pa_sink_input_finish_move(pa_sink_input *i, pa_sink *dest, pa_bool_t save) {
     if (pa_sink_input_get_state(i) == PA_SINK_INPUT_CORKED)
         i->sink->n_corked++;
 
+    /* The ramp counts frames of the old sink, so just finish it */
+    i->thread_info.ramp_start = i->thread_info.ramp_target;
+    i->thread_info.ramp_pos = i->thread_info.ramp_length = 0;
+
     pa_sink_input_update_rate(i);
 
     pa_sink_update_status(dest);
@@ -1848,13 +2433,34 @@ int pa_sink_input_finish_move(pa_sink_input *i, pa_sink *dest, pa_bool_t save) {
     if (pa_sink_input_is_passthrough(i))
         pa_sink_enter_passthrough(i->sink);
 
-    pa_assert_se(pa_asyncmsgq_send(i->sink->asyncmsgq, PA_MSGOBJECT(i->sink), PA_SINK_MESSAGE_FINISH_MOVE, i, 0, NULL) == 0);
+    return 0;
+}
 
-    pa_log_debug("Successfully moved sink input %i to %s.", i->index, dest->name);
+/* Called from main context */
+static void finish_move_done(pa_sink_input *i) {
+    pa_log_debug("Successfully moved sink input %i to %s.", i->index, i->sink->name);
 
     /* Notify everyone */
     pa_hook_fire(&i->core->hooks[PA_CORE_HOOK_SINK_INPUT_MOVE_FINISH], i);
     pa_subscription_post(i->core, PA_SUBSCRIPTION_EVENT_SINK_INPUT|PA_SUBSCRIPTION_EVENT_CHANGE, i->index);
+}
+
+/* Called from main context */
+int pa_sink_input_finish_move(pa_sink_input *i, pa_sink *dest, pa_bool_t save) {
+    int r;
+
+    pa_sink_input_assert_ref(i);
+    pa_assert_ctl_context();
+    pa_assert(PA_SINK_INPUT_IS_LINKED(i->state));
+    pa_assert(!i->sink);
+    pa_sink_assert_ref(dest);
+
+    if ((r = finish_move_prepare(i, dest, save)) < 0)
+        return r;
+
+    pa_assert_se(pa_asyncmsgq_send(i->sink->asyncmsgq, PA_MSGOBJECT(i->sink), PA_SINK_MESSAGE_FINISH_MOVE, i, 0, NULL) == 0);
+
+    finish_move_done(i);
 
     return 0;
 }
@@ -1895,7 +2501,7 @@ int pa_sink_input_move_to(pa_sink_input *i, pa_sink *dest, pa_bool_t save) {
 
     pa_sink_input_ref(i);
 
-    if ((r = pa_sink_input_start_move(i)) < 0) {
+    if ((r = start_move(i, dest)) < 0) {
         pa_sink_input_unref(i);
         return r;
     }
@@ -1911,6 +2517,203 @@ int pa_sink_input_move_to(pa_sink_input *i, pa_sink *dest, pa_bool_t save) {
     return 0;
 }
 
+/* Called from main context */
+/* Detaches all of inputs, which are on the same sink, with one message to
+ * that sink. The inputs that could be detached are moved to the front
+ * of the array, their number is returned. */
+static unsigned start_move_batch(pa_sink_input **inputs, unsigned n, pa_sink *dest) {
+    pa_sink_input_move *moves;
+    pa_sink *sink;
+    unsigned k, m = 0;
+
+    if (n == 0)
+        return 0;
+
+    sink = inputs[0]->sink;
+    moves = pa_xnew(pa_sink_input_move, n);
+
+    for (k = 0; k < n; k++) {
+        pa_sink_input *i = inputs[k];
+
+        /* The hooks of an earlier one might have killed it */
+        if (!PA_SINK_INPUT_IS_LINKED(i->state) || i->sink != sink)
+            continue;
+
+        if (start_move_prepare(i) < 0)
+            continue;
+
+        moves[m].input = i;
+        moves[m].keep_render = move_keeps_render(i, dest);
+        inputs[m++] = i;
+    }
+
+    if (m > 0) {
+        if (pa_sink_flat_volume_enabled(sink))
+            /* We might need to update the sink's volume if we are in flat
+             * volume mode. */
+            pa_sink_set_volume(sink, NULL, FALSE, FALSE);
+
+        pa_assert_se(pa_asyncmsgq_send(sink->asyncmsgq, PA_MSGOBJECT(sink), PA_SINK_MESSAGE_START_MOVE_BATCH, moves, (int64_t) m, NULL) == 0);
+
+        pa_sink_update_status(sink);
+
+        for (k = 0; k < m; k++)
+            start_move_done(inputs[k]);
+    }
+
+    pa_xfree(moves);
+
+    return m;
+}
+
+/* Called from main context */
+/* Attaches all of inputs to dest with one message, the ones that fail
+ * are passed to pa_sink_input_fail_move(). Returns how many were
+ * attached. */
+static unsigned finish_move_batch(pa_sink_input **inputs, unsigned n, pa_sink *dest, pa_bool_t save) {
+    pa_sink_input_move *moves;
+    unsigned k, m = 0;
+
+    if (n == 0)
+        return 0;
+
+    moves = pa_xnew(pa_sink_input_move, n);
+
+    for (k = 0; k < n; k++) {
+        if (!PA_SINK_INPUT_IS_LINKED(inputs[k]->state))
+            continue;
+
+        if (finish_move_prepare(inputs[k], dest, save) < 0) {
+            pa_sink_input_fail_move(inputs[k]);
+            continue;
+        }
+
+        moves[m].input = inputs[k];
+        moves[m].keep_render = FALSE;
+        m++;
+    }
+
+    if (m > 0) {
+        pa_assert_se(pa_asyncmsgq_send(dest->asyncmsgq, PA_MSGOBJECT(dest), PA_SINK_MESSAGE_FINISH_MOVE_BATCH, moves, (int64_t) m, NULL) == 0);
+
+        for (k = 0; k < m; k++)
+            finish_move_done(moves[k].input);
+    }
+
+    pa_xfree(moves);
+
+    return m;
+}
+
+/* Called from main context */
+unsigned pa_sink_input_start_move_many(pa_sink_input **inputs, unsigned n) {
+    unsigned k;
+
+    pa_assert(inputs || n == 0);
+    pa_assert_ctl_context();
+
+    for (k = 0; k < n; k++) {
+        pa_sink_input_assert_ref(inputs[k]);
+        pa_assert(PA_SINK_INPUT_IS_LINKED(inputs[k]->state));
+        pa_assert(inputs[k]->sink == inputs[0]->sink);
+    }
+
+    return start_move_batch(inputs, n, NULL);
+}
+
+/* Called from main context */
+unsigned pa_sink_input_finish_move_many(pa_sink_input **inputs, unsigned n, pa_sink *dest, pa_bool_t save) {
+    unsigned k;
+
+    pa_assert(inputs || n == 0);
+    pa_assert_ctl_context();
+    pa_sink_assert_ref(dest);
+
+    for (k = 0; k < n; k++) {
+        pa_sink_input_assert_ref(inputs[k]);
+        pa_assert(PA_SINK_INPUT_IS_LINKED(inputs[k]->state));
+        pa_assert(!inputs[k]->sink);
+    }
+
+    return finish_move_batch(inputs, n, dest, save);
+}
+
+/* Called from main context */
+unsigned pa_sink_input_move_many_to(pa_sink_input **inputs, unsigned n, pa_sink *dest, pa_bool_t save) {
+    pa_sink_input **started, **group;
+    pa_bool_t *handled;
+    unsigned k, j, n_started = 0, n_moved = 0;
+
+    pa_assert(inputs || n == 0);
+    pa_assert_ctl_context();
+    pa_sink_assert_ref(dest);
+
+    if (n == 0)
+        return 0;
+
+    started = pa_xnew(pa_sink_input*, n);
+    group = pa_xnew(pa_sink_input*, n);
+    handled = pa_xnew0(pa_bool_t, n);
+
+    for (k = 0; k < n; k++)
+        pa_sink_input_ref(inputs[k]);
+
+    /* First take the streams off their sinks, with one message to each
+     * of the old sinks */
+    for (k = 0; k < n; k++) {
+        pa_sink_input *i = inputs[k];
+        unsigned m = 0;
+
+        if (handled[k])
+            continue;
+
+        handled[k] = TRUE;
+
+        if (!PA_SINK_INPUT_IS_LINKED(i->state) || !i->sink || i->sink == dest || !pa_sink_input_may_move_to(i, dest))
+            continue;
+
+        /* The format of passthrough streams might not be supported by
+         * dest, which is handled on the slow path */
+        if (pa_sink_input_is_passthrough(i)) {
+            if (pa_sink_input_move_to(i, dest, save) >= 0)
+                n_moved++;
+
+            continue;
+        }
+
+        group[m++] = i;
+
+        for (j = k + 1; j < n; j++) {
+            pa_sink_input *t = inputs[j];
+
+            if (handled[j] || !PA_SINK_INPUT_IS_LINKED(t->state) || t->sink != i->sink)
+                continue;
+
+            if (!pa_sink_input_may_move_to(t, dest) || pa_sink_input_is_passthrough(t))
+                continue;
+
+            handled[j] = TRUE;
+            group[m++] = t;
+        }
+
+        m = start_move_batch(group, m, dest);
+        memcpy(started + n_started, group, m * sizeof(pa_sink_input*));
+        n_started += m;
+    }
+
+    /* Then attach them all to dest in one go */
+    n_moved += finish_move_batch(started, n_started, dest, save);
+
+    for (k = 0; k < n; k++)
+        pa_sink_input_unref(inputs[k]);
+
+    pa_xfree(handled);
+    pa_xfree(group);
+    pa_xfree(started);
+
+    return n_moved;
+}
+
 /* Called from IO thread context */
 void pa_sink_input_set_state_within_thread(pa_sink_input *i, pa_sink_input_state_t state) {
     pa_bool_t corking, uncorking;
@@ -1961,6 +2764,24 @@ void pa_sink_input_set_state_within_thread(pa_sink_input *i, pa_sink_input_state
         i->thread_info.state = state;
 }
 
+/* Called from thread context. Unless the channel maps differ the soft
+ * volume is applied by the sink while mixing, hence what is queued in
+ * the render memblockq stays valid and replaying it with the new volume
+ * is all that is needed. The implementor only has to render everything
+ * again if the volume was applied before queueing. (If pop_into() left
+ * holes in the queue, pa_sink_input_process_rewind() takes care of
+ * those.) */
+static void request_volume_rewind(pa_sink_input *i) {
+
+    if (i->thread_info.state == PA_SINK_INPUT_CORKED)
+        return;
+
+    if (pa_channel_map_equal(&i->channel_map, &i->sink->channel_map))
+        pa_sink_request_rewind(i->sink, (size_t) -1);
+    else
+        pa_sink_input_request_rewind(i, 0, TRUE, FALSE, FALSE);
+}
+
 /* Called from thread context, except when it is not. */
 int pa_sink_input_process_msg(pa_msgobject *o, int code, void *userdata, int64_t offset, pa_memchunk *chunk) {
     pa_sink_input *i = PA_SINK_INPUT(o);
@@ -1971,14 +2792,14 @@ int pa_sink_input_process_msg(pa_msgobject *o, int code, void *userdata, int64_t
         case PA_SINK_INPUT_MESSAGE_SET_SOFT_VOLUME:
             if (!pa_cvolume_equal(&i->thread_info.soft_volume, &i->soft_volume)) {
                 i->thread_info.soft_volume = i->soft_volume;
-                pa_sink_input_request_rewind(i, 0, TRUE, FALSE, FALSE);
+                request_volume_rewind(i);
             }
             return 0;
 
         case PA_SINK_INPUT_MESSAGE_SET_SOFT_MUTE:
             if (i->thread_info.muted != i->muted) {
                 i->thread_info.muted = i->muted;
-                pa_sink_input_request_rewind(i, 0, TRUE, FALSE, FALSE);
+                request_volume_rewind(i);
             }
             return 0;
 
@@ -2003,11 +2824,9 @@ int pa_sink_input_process_msg(pa_msgobject *o, int code, void *userdata, int64_t
 
             pa_sink_input_set_state_within_thread(i, PA_PTR_TO_UINT(userdata));
 
-            for (ssync = i->thread_info.sync_prev; ssync; ssync = ssync->thread_info.sync_prev)
-                pa_sink_input_set_state_within_thread(ssync, PA_PTR_TO_UINT(userdata));
-
-            for (ssync = i->thread_info.sync_next; ssync; ssync = ssync->thread_info.sync_next)
-                pa_sink_input_set_state_within_thread(ssync, PA_PTR_TO_UINT(userdata));
+            for (ssync = i->sync_group ? i->sync_group->thread_info.inputs : NULL; ssync; ssync = ssync->thread_info.sync_next)
+                if (ssync != i)
+                    pa_sink_input_set_state_within_thread(ssync, PA_PTR_TO_UINT(userdata));
 
             return 0;
         }
@@ -2025,6 +2844,19 @@ int pa_sink_input_process_msg(pa_msgobject *o, int code, void *userdata, int64_t
             *r = i->thread_info.requested_sink_latency;
             return 0;
         }
+
+        case PA_SINK_INPUT_MESSAGE_SET_VOLUME_RAMP: {
+            struct volume_ramp *r = userdata;
+
+            i->thread_info.ramp_start = ramp_gain(i, i->thread_info.ramp_pos);
+            i->thread_info.ramp_target = r->target;
+            i->thread_info.ramp_length = (int64_t) (pa_usec_to_bytes(r->usec, &i->sink->sample_spec) / pa_frame_size(&i->sink->sample_spec));
+            i->thread_info.ramp_pos = 0;
+            i->thread_info.ramp_restart = TRUE;
+
+            request_volume_rewind(i);
+            return 0;
+        }
     }
 
     return -PA_ERR_NOTIMPLEMENTED;
@@ -2235,6 +3067,7 @@ int pa_sink_input_update_rate(pa_sink_input *i) {
     i->thread_info.resampler = new_resampler;
 
     pa_memblockq_free(i->thread_info.render_memblockq);
+    i->thread_info.render_history_missing = FALSE;
 
     memblockq_name = pa_sprintf_malloc("sink input render_memblockq [%u]", i->index);
     i->thread_info.render_memblockq = pa_memblockq_new(
@@ -2247,6 +3080,7 @@ int pa_sink_input_update_rate(pa_sink_input *i) {
             1,
             0,
             &i->sink->silence);
+    pa_memblockq_set_ring(i->thread_info.render_memblockq, TRUE);
     pa_xfree(memblockq_name);
 
     i->actual_resample_method = new_resampler ? pa_resampler_get_method(new_resampler) : PA_RESAMPLER_INVALID;
@@ -26,6 +26,7 @@
 #include <inttypes.h>
 
 typedef struct pa_sink_input pa_sink_input;
+typedef struct pa_sink_input_sync_group pa_sink_input_sync_group;
 
 #include <pulse/sample.h>
 #include <pulse/format.h>
@@ -35,6 +36,7 @@ typedef struct pa_sink_input pa_sink_input;
 #include <pulsecore/client.h>
 #include <pulsecore/sink.h>
 #include <pulsecore/core.h>
+#include <pulsecore/refcnt.h>
 
 typedef enum pa_sink_input_state {
     PA_SINK_INPUT_INIT,         /*< The stream is not active yet, because pa_sink_input_put() has not been called yet */
@@ -61,7 +63,12 @@ typedef enum pa_sink_input_flags {
     PA_SINK_INPUT_DONT_INHIBIT_AUTO_SUSPEND = 256,
     PA_SINK_INPUT_NO_CREATE_ON_SUSPEND = 512,
     PA_SINK_INPUT_KILL_ON_SUSPEND = 1024,
-    PA_SINK_INPUT_PASSTHROUGH = 2048
+    PA_SINK_INPUT_PASSTHROUGH = 2048,
+    /* pop() may be called from a render pool thread of the sink,
+     * concurrently with pop() of other inputs. It may only touch the
+     * input's own state then and post messages to the outq of
+     * pa_thread_mq_get(). */
+    PA_SINK_INPUT_PARALLEL_PEEK = 4096
 } pa_sink_input_flags_t;
 
 struct pa_sink_input {
@@ -94,6 +101,9 @@ struct pa_sink_input {
     pa_channel_map channel_map;
     pa_format_info *format;
 
+    /* The inputs that play in lock step with this one, if any. The
+     * members are linked through sync_prev/sync_next. */
+    pa_sink_input_sync_group *sync_group;
     pa_sink_input *sync_prev, *sync_next;
 
     /* Also see http://pulseaudio.org/wiki/InternalVolumes */
@@ -135,6 +145,15 @@ struct pa_sink_input {
      * the full block. */
     int (*pop) (pa_sink_input *i, size_t request_nbytes, pa_memchunk *chunk); /* may NOT be NULL */
 
+    /* Like pop(), but renders the data straight into the memory
+     * described by target, which usually belongs to the sink
+     * itself. The implementor may shorten target->length if less data
+     * is available. Returns -1 on failure, in which case target must
+     * be left untouched. Only used if the stream needs neither
+     * resampling nor any volume adjustment. Called from IO thread
+     * context. */
+    int (*pop_into) (pa_sink_input *i, pa_memchunk *target); /* may be NULL */
+
     /* This is called when the playback buffer has actually played back
        all available data. Return true unless there is more data to play back.
        Called from IO context. */
@@ -224,6 +243,15 @@ struct pa_sink_input {
      * mute status changes. Called from main context */
     void (*mute_changed)(pa_sink_input *i); /* may be NULL */
 
+    /* The length of render_memblockq and the requested latency as
+     * last published by the IO thread, for
+     * pa_sink_input_get_latency_nowait() */
+    struct {
+        pa_seqlock lock;
+        pa_usec_t queued;
+        pa_usec_t requested_latency;
+    } latency_snapshot;
+
     struct {
         pa_sink_input_state_t state;
         pa_atomic_t drained;
@@ -231,12 +259,42 @@ struct pa_sink_input {
         pa_cvolume soft_volume;
         pa_bool_t muted:1;
 
+        /* A linear gain ramp on top of soft_volume, from ramp_start to
+         * ramp_target over ramp_length sink frames. ramp_pos is the
+         * frame at the read index of render_memblockq, rewinds may take
+         * it below 0. If ramp_restart is set the ramp begins wherever the
+         * next rewind ends. */
+        float ramp_start, ramp_target;
+        int64_t ramp_pos, ramp_length;
+        pa_bool_t ramp_restart:1;
+
         pa_bool_t attached:1; /* True only between ->attach() and ->detach() calls */
 
         /* rewrite_nbytes: 0: rewrite nothing, (size_t) -1: rewrite everything, otherwise how many bytes to rewrite */
         pa_bool_t rewrite_flush:1, dont_rewind_render:1;
         size_t rewrite_nbytes;
+
+        /* Set once pop_into() was used, which leaves holes in the
+         * history of render_memblockq */
+        pa_bool_t render_history_missing:1;
         uint64_t underrun_for, playing_for;
+
+        /* The deepest rewind in the current and the previous window,
+         * and how much was played in the current one. They bound the
+         * history of render_memblockq. */
+        size_t rewind_depth, rewind_depth_prev;
+        size_t rewind_window;
+
+        /* How much history render_memblockq held after the last drop,
+         * and at most. For reporting only. */
+        size_t render_history, render_history_max;
+
+        /* Only kept when the sink has render_stats, collected by the
+         * sink after each peek */
+        pa_usec_t peek_usec, resample_usec;
+
+        pa_io_counters counters;
+
         uint64_t underrun_for_sink; /* Like underrun_for, but in sink sample spec */
 
         pa_sample_spec sample_spec;
@@ -268,6 +326,7 @@ enum {
     PA_SINK_INPUT_MESSAGE_SET_STATE,
     PA_SINK_INPUT_MESSAGE_SET_REQUESTED_LATENCY,
     PA_SINK_INPUT_MESSAGE_GET_REQUESTED_LATENCY,
+    PA_SINK_INPUT_MESSAGE_SET_VOLUME_RAMP,
     PA_SINK_INPUT_MESSAGE_MAX
 };
 
@@ -291,7 +350,9 @@ typedef struct pa_sink_input_new_data {
 
     pa_resample_method_t resample_method;
 
-    pa_sink_input *sync_base;
+    /* Not referenced, the caller keeps it alive until
+     * pa_sink_input_new() returns */
+    pa_sink_input_sync_group *sync_group;
 
     pa_sample_spec sample_spec;
     pa_channel_map channel_map;
@@ -328,6 +389,25 @@ pa_bool_t pa_sink_input_new_data_set_sink(pa_sink_input_new_data *data, pa_sink
 pa_bool_t pa_sink_input_new_data_set_formats(pa_sink_input_new_data *data, pa_idxset *formats);
 void pa_sink_input_new_data_done(pa_sink_input_new_data *data);
 
+/* Inputs of one sync group are on the same sink, and are corked,
+ * started and flushed together, each with a single message to the IO
+ * thread. Inputs may only join a group while it is corked. */
+struct pa_sink_input_sync_group {
+    PA_REFCNT_DECLARE;
+
+    pa_sink_input *inputs;
+    unsigned n_inputs;
+
+    struct {
+        /* Linked through thread_info.sync_prev/sync_next */
+        pa_sink_input *inputs;
+    } thread_info;
+};
+
+pa_sink_input_sync_group *pa_sink_input_sync_group_new(void);
+pa_sink_input_sync_group *pa_sink_input_sync_group_ref(pa_sink_input_sync_group *g);
+void pa_sink_input_sync_group_unref(pa_sink_input_sync_group *g);
+
 /* To be called by the implementing module only */
 
 int pa_sink_input_new(
@@ -336,6 +416,18 @@ int pa_sink_input_new(
         pa_sink_input_new_data *data);
 
 void pa_sink_input_put(pa_sink_input *i);
+
+typedef void (*pa_sink_input_put_cb_t)(pa_sink_input *i, void *userdata);
+
+/* Like pa_sink_input_put(), but doesn't wait for the IO thread to
+ * attach the input. Consecutive calls for the same sink are handed
+ * over in one message. cb is called from the main loop once the IO
+ * thread has taken the input over, and before any message the IO
+ * thread posts on behalf of it. Inputs that are synchronized with
+ * others are attached right away and cb is called before this
+ * returns. cb is called even if the input has been unlinked in the
+ * meantime, so check its state there. */
+void pa_sink_input_put_async(pa_sink_input *i, pa_sink_input_put_cb_t cb, void *userdata);
 void pa_sink_input_unlink(pa_sink_input* i);
 
 void pa_sink_input_set_name(pa_sink_input *i, const char *name);
@@ -366,12 +458,23 @@ size_t pa_sink_input_get_max_request(pa_sink_input *i);
 void pa_sink_input_kill(pa_sink_input*i);
 
 pa_usec_t pa_sink_input_get_latency(pa_sink_input *i, pa_usec_t *sink_latency);
+/* Like pa_sink_input_get_latency(), but doesn't wait for the IO
+ * thread. The render queue is taken as it was after the last render or
+ * rewind. If requested_latency is not NULL it is set to what
+ * pa_sink_input_get_requested_latency() would return. */
+pa_usec_t pa_sink_input_get_latency_nowait(pa_sink_input *i, pa_usec_t *requested_latency);
 
 pa_bool_t pa_sink_input_is_passthrough(pa_sink_input *i);
 pa_bool_t pa_sink_input_is_volume_readable(pa_sink_input *i);
 void pa_sink_input_set_volume(pa_sink_input *i, const pa_cvolume *volume, pa_bool_t save, pa_bool_t absolute);
 void pa_sink_input_add_volume_factor(pa_sink_input *i, const char *key, const pa_cvolume *volume_factor);
 void pa_sink_input_remove_volume_factor(pa_sink_input *i, const char *key);
+
+/* Changes the gain of the stream linearly to volume within usec, on top
+ * of all its other volumes. The ramp runs in the IO thread and starts
+ * with what is played next, so fades and ducking take one call. The
+ * gain stays at volume until the next ramp. */
+void pa_sink_input_set_volume_ramp(pa_sink_input *i, pa_volume_t volume, pa_usec_t usec);
 pa_cvolume *pa_sink_input_get_volume(pa_sink_input *i, pa_cvolume *volume, pa_bool_t absolute);
 
 void pa_sink_input_set_mute(pa_sink_input *i, pa_bool_t mute, pa_bool_t save);
@@ -394,6 +497,29 @@ int pa_sink_input_start_move(pa_sink_input *i);
 int pa_sink_input_finish_move(pa_sink_input *i, pa_sink *dest, pa_bool_t save);
 void pa_sink_input_fail_move(pa_sink_input *i);
 
+/* One stream of a batch move, passed to the IO threads with
+ * PA_SINK_MESSAGE_START_MOVE_BATCH and PA_SINK_MESSAGE_FINISH_MOVE_BATCH */
+typedef struct pa_sink_input_move {
+    pa_sink_input *input;
+    pa_bool_t keep_render; /* the audio rendered for the old sink stays valid */
+} pa_sink_input_move;
+
+/* Like pa_sink_input_start_move() and pa_sink_input_finish_move(), but
+ * for a whole group with a single message to the sink. All inputs have
+ * to be on the same sink for pa_sink_input_start_move_many(). It moves
+ * the inputs that could be started to the front of the array and
+ * returns their number. pa_sink_input_finish_move_many() passes the
+ * ones that cannot be attached to pa_sink_input_fail_move() and returns
+ * how many were attached. */
+unsigned pa_sink_input_start_move_many(pa_sink_input **inputs, unsigned n);
+unsigned pa_sink_input_finish_move_many(pa_sink_input **inputs, unsigned n, pa_sink *dest, pa_bool_t save);
+
+/* Moves all of inputs to dest like pa_sink_input_move_to() does, but
+ * with only one message and rewind for each of the sinks involved.
+ * Streams that cannot be moved to dest stay where they are, streams that
+ * fail to attach to dest are killed. Returns how many were moved. */
+unsigned pa_sink_input_move_many_to(pa_sink_input **inputs, unsigned n, pa_sink *dest, pa_bool_t save);
+
 pa_sink_input_state_t pa_sink_input_get_state(pa_sink_input *i);
 
 pa_usec_t pa_sink_input_get_requested_latency(pa_sink_input *i);
@@ -401,7 +527,14 @@ pa_usec_t pa_sink_input_get_requested_latency(pa_sink_input *i);
 /* To be used exclusively by the sink driver IO thread */
 
 void pa_sink_input_peek(pa_sink_input *i, size_t length, pa_memchunk *chunk, pa_cvolume *volume);
+
+/* Like pa_sink_input_peek(), but returns FALSE instead of handing out
+ * silence if the input has nothing to play because it is corked, or its
+ * implementor is prebuffering or ran dry. chunk->memblock is NULL then,
+ * and chunk->length is how much silence the input will play. */
+pa_bool_t pa_sink_input_peek_ready(pa_sink_input *i, size_t length, pa_memchunk *chunk, pa_cvolume *volume);
 void pa_sink_input_drop(pa_sink_input *i, size_t length);
+pa_bool_t pa_sink_input_render_into(pa_sink_input *i, pa_memchunk *target);
 void pa_sink_input_process_rewind(pa_sink_input *i, size_t nbytes /* in the sink's sample spec */);
 void pa_sink_input_update_max_rewind(pa_sink_input *i, size_t nbytes  /* in the sink's sample spec */);
 void pa_sink_input_update_max_request(pa_sink_input *i, size_t nbytes  /* in the sink's sample spec */);
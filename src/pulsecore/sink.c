@@ -27,6 +27,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 
 #include <pulse/introspect.h>
 #include <pulse/format.h>
@@ -43,20 +44,33 @@
 #include <pulsecore/core-util.h>
 #include <pulsecore/sample-util.h>
 #include <pulsecore/mix.h>
+#include <pulsecore/sconv.h>
 #include <pulsecore/core-subscribe.h>
 #include <pulsecore/log.h>
 #include <pulsecore/macro.h>
+#include <pulsecore/memarena.h>
 #include <pulsecore/play-memblockq.h>
 #include <pulsecore/flist.h>
+#include <pulsecore/trace.h>
 
 #include "sink.h"
 
-#define MAX_MIX_CHANNELS 32
+#define MIX_INFO_MIN 32
 #define MIX_BUFFER_LENGTH (PA_PAGE_SIZE)
 #define ABSOLUTE_MIN_LATENCY (500)
 #define ABSOLUTE_MAX_LATENCY (10*PA_USEC_PER_SEC)
 #define DEFAULT_FIXED_LATENCY (250*PA_USEC_PER_MSEC)
 
+/* How often pa_sink_get_latency_nowait() tries again if it raced with the
+ * IO thread, and how old a latency snapshot may get before we rather ask
+ * the IO thread */
+#define LATENCY_SNAPSHOT_RETRIES 8
+#define LATENCY_SNAPSHOT_MAX_AGE (500*PA_USEC_PER_MSEC)
+
+/* How many samples are converted to float at once for measuring
+ * levels */
+#define LEVELS_CONVERT_SAMPLES 256
+
 PA_DEFINE_PUBLIC_CLASS(pa_sink, pa_msgobject);
 
 struct pa_sink_volume_change {
@@ -76,6 +90,7 @@ static void sink_free(pa_object *s);
 static void pa_sink_volume_change_push(pa_sink *s);
 static void pa_sink_volume_change_flush(pa_sink *s);
 static void pa_sink_volume_change_rewind(pa_sink *s, size_t nbytes);
+static void update_deadline(pa_sink *s);
 
 pa_sink_new_data* pa_sink_new_data_init(pa_sink_new_data *data) {
     pa_assert(data);
@@ -136,6 +151,27 @@ void pa_sink_new_data_set_port(pa_sink_new_data *data, const char *port) {
     data->active_port = pa_xstrdup(port);
 }
 
+void pa_sink_new_data_set_cpu_affinity(pa_sink_new_data *data, const char *cpus) {
+    int node;
+
+    pa_assert(data);
+
+    if (!cpus)
+        return;
+
+    pa_proplist_sets(data->proplist, PA_PROP_DEVICE_CPU_AFFINITY, cpus);
+
+    if ((node = pa_cpu_list_numa_node(cpus)) >= 0)
+        pa_proplist_setf(data->proplist, PA_PROP_DEVICE_NUMA_NODE, "%i", node);
+}
+
+void pa_sink_new_data_set_clock_domain(pa_sink_new_data *data, const char *name) {
+    pa_assert(data);
+
+    if (name)
+        pa_proplist_sets(data->proplist, PA_PROP_DEVICE_CLOCK_DOMAIN, name);
+}
+
 void pa_sink_new_data_done(pa_sink_new_data *data) {
     pa_assert(data);
 
@@ -176,7 +212,7 @@ pa_sink* pa_sink_new(
     const char *name;
     char st[PA_SAMPLE_SPEC_SNPRINT_MAX], cm[PA_CHANNEL_MAP_SNPRINT_MAX];
     pa_source_new_data source_data;
-    const char *dn;
+    const char *dn, *clock_domain;
     char *pt;
 
     pa_assert(core);
@@ -256,6 +292,9 @@ pa_sink* pa_sink_new(
     s->module = data->module;
     s->card = data->card;
 
+    if ((clock_domain = pa_proplist_gets(s->proplist, PA_PROP_DEVICE_CLOCK_DOMAIN)))
+        s->clock_domain = pa_clock_domain_get(core, clock_domain);
+
     s->priority = pa_device_init_priority(s->proplist);
 
     s->sample_spec = data->sample_spec;
@@ -314,6 +353,13 @@ pa_sink* pa_sink_new(
     else
         s->latency_offset = 0;
 
+    pa_seqlock_init(&s->latency_snapshot.lock);
+    s->latency_snapshot.valid = FALSE;
+
+    pa_atomic_store(&s->levels_users, 0);
+    pa_seqlock_init(&s->levels_snapshot.lock);
+    s->levels_snapshot.seq = 0;
+
     s->save_volume = data->save_volume;
     s->save_muted = data->save_muted;
 
@@ -324,8 +370,15 @@ pa_sink* pa_sink_new(
             &s->sample_spec,
             0);
 
+    s->render_stats = core->render_stats ? pa_render_stats_new() : NULL;
+
     s->thread_info.rtpoll = NULL;
+    s->thread_info.render_pool = NULL;
+    pa_atomic_store(&s->thread_info.deferred_rewind, 0);
+    s->thread_info.render_load = 0;
     s->thread_info.inputs = pa_hashmap_new(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func);
+    s->thread_info.n_mix_info = MIX_INFO_MIN;
+    s->thread_info.mix_info = pa_xnew(pa_mix_info, s->thread_info.n_mix_info);
     s->thread_info.soft_volume =  s->soft_volume;
     s->thread_info.soft_muted = s->muted;
     s->thread_info.state = s->state;
@@ -702,6 +755,11 @@ void pa_sink_unlink(pa_sink* s) {
 
     reset_callbacks(s);
 
+    if (s->sync_volumes_event) {
+        s->core->mainloop->defer_free(s->sync_volumes_event);
+        s->sync_volumes_event = NULL;
+    }
+
     if (s->monitor_source)
         pa_source_unlink(s->monitor_source);
 
@@ -724,6 +782,12 @@ static void sink_free(pa_object *o) {
 
     pa_log_info("Freeing sink %u \"%s\"", s->index, s->name);
 
+    if (s->format_matches)
+        pa_format_match_set_free(s->format_matches);
+
+    if (s->render_stats)
+        pa_render_stats_free(s->render_stats);
+
     if (s->monitor_source) {
         pa_source_unref(s->monitor_source);
         s->monitor_source = NULL;
@@ -731,6 +795,7 @@ static void sink_free(pa_object *o) {
 
     pa_idxset_free(s->inputs, NULL);
     pa_hashmap_free(s->thread_info.inputs, (pa_free_cb_t) pa_sink_input_unref);
+    pa_xfree(s->thread_info.mix_info);
 
     if (s->silence.memblock)
         pa_memblock_unref(s->silence.memblock);
@@ -741,6 +806,9 @@ static void sink_free(pa_object *o) {
     if (s->proplist)
         pa_proplist_free(s->proplist);
 
+    if (s->clock_domain)
+        pa_clock_domain_unref(s->clock_domain);
+
     if (s->ports)
         pa_hashmap_free(s->ports, (pa_free_cb_t) pa_device_port_unref);
 
@@ -806,10 +874,21 @@ void pa_sink_set_rtpoll(pa_sink *s, pa_rtpoll *p) {
 
     s->thread_info.rtpoll = p;
 
+    if (p && s->render_stats)
+        pa_rtpoll_set_track_lateness(p, TRUE);
+
     if (s->monitor_source)
         pa_source_set_rtpoll(s->monitor_source, p);
 }
 
+/* Called from IO context, or before _put() from main context */
+void pa_sink_set_render_pool(pa_sink *s, pa_render_pool *p) {
+    pa_sink_assert_ref(s);
+    pa_sink_assert_io_context(s);
+
+    s->thread_info.render_pool = p;
+}
+
 /* Called from main context */
 int pa_sink_update_status(pa_sink*s) {
     pa_sink_assert_ref(s);
@@ -876,8 +955,9 @@ int pa_sink_suspend(pa_sink *s, pa_bool_t suspend, pa_suspend_cause_t cause) {
 
 /* Called from main context */
 pa_queue *pa_sink_move_all_start(pa_sink *s, pa_queue *q) {
-    pa_sink_input *i, *n;
+    pa_sink_input *i, **inputs;
     uint32_t idx;
+    unsigned n = 0, k;
 
     pa_sink_assert_ref(s);
     pa_assert_ctl_context();
@@ -886,34 +966,60 @@ pa_queue *pa_sink_move_all_start(pa_sink *s, pa_queue *q) {
     if (!q)
         q = pa_queue_new();
 
-    for (i = PA_SINK_INPUT(pa_idxset_first(s->inputs, &idx)); i; i = n) {
-        n = PA_SINK_INPUT(pa_idxset_next(s->inputs, &idx));
+    if (pa_idxset_isempty(s->inputs))
+        return q;
 
-        pa_sink_input_ref(i);
+    /* All inputs are detached with a single message to the IO thread */
+    inputs = pa_xnew(pa_sink_input*, pa_idxset_size(s->inputs));
 
-        if (pa_sink_input_start_move(i) >= 0)
-            pa_queue_push(q, i);
-        else
-            pa_sink_input_unref(i);
-    }
+    PA_IDXSET_FOREACH(i, s->inputs, idx)
+        inputs[n++] = pa_sink_input_ref(i);
+
+    k = pa_sink_input_start_move_many(inputs, n);
+
+    for (idx = 0; idx < k; idx++)
+        pa_queue_push(q, inputs[idx]);
+
+    for (; idx < n; idx++)
+        pa_sink_input_unref(inputs[idx]);
+
+    pa_xfree(inputs);
 
     return q;
 }
 
 /* Called from main context */
 void pa_sink_move_all_finish(pa_sink *s, pa_queue *q, pa_bool_t save) {
-    pa_sink_input *i;
+    pa_sink_input *i, **inputs;
+    unsigned n = 0, k;
 
     pa_sink_assert_ref(s);
     pa_assert_ctl_context();
     pa_assert(PA_SINK_IS_LINKED(s->state));
     pa_assert(q);
 
-    while ((i = PA_SINK_INPUT(pa_queue_pop(q)))) {
-        if (pa_sink_input_finish_move(i, s, save) < 0)
-            pa_sink_input_fail_move(i);
+    if (!pa_queue_isempty(q)) {
+        /* The queue does not know its length */
+        unsigned size = 16;
 
-        pa_sink_input_unref(i);
+        inputs = pa_xnew(pa_sink_input*, size);
+
+        while ((i = PA_SINK_INPUT(pa_queue_pop(q)))) {
+            if (n >= size) {
+                size *= 2;
+                inputs = pa_xrenew(pa_sink_input*, inputs, size);
+            }
+
+            inputs[n++] = i;
+        }
+
+        /* And all are attached with a single message as well */
+        pa_sink_input_finish_move_many(inputs, n, s, save);
+
+        for (k = 0; k < n; k++)
+            pa_sink_input_unref(inputs[k]);
+
+        pa_xfree(inputs);
     }
 
     pa_queue_free(q, NULL);
@@ -976,11 +1082,16 @@ void pa_sink_process_rewind(pa_sink *s, size_t nbytes) {
     if (!s->thread_info.rewind_requested && nbytes <= 0)
         return;
 
+    PA_TRACE2(sink_process_rewind, s->index, nbytes);
+
     s->thread_info.rewind_nbytes = 0;
     s->thread_info.rewind_requested = FALSE;
 
     if (nbytes > 0) {
         pa_log_debug("Processing rewind...");
+        s->thread_info.counters.rewinds++;
+        s->thread_info.counters.rewind_bytes += nbytes;
+        pa_sink_invalidate_latency(s);
         if (s->flags & PA_SINK_DEFERRED_VOLUME)
             pa_sink_volume_change_rewind(s, nbytes);
     }
@@ -996,8 +1107,102 @@ void pa_sink_process_rewind(pa_sink *s, size_t nbytes) {
     }
 }
 
+/* Called from IO thread context, whenever an input is attached. Growing
+ * here (rarely, and geometrically) keeps allocations out of the render
+ * path. */
+static void ensure_mix_info(pa_sink *s) {
+    unsigned n;
+
+    pa_sink_assert_ref(s);
+    pa_sink_assert_io_context(s);
+
+    if ((n = pa_hashmap_size(s->thread_info.inputs)) <= s->thread_info.n_mix_info)
+        return;
+
+    while (s->thread_info.n_mix_info < n)
+        s->thread_info.n_mix_info *= 2;
+
+    s->thread_info.mix_info = pa_xrenew(pa_mix_info, s->thread_info.mix_info, s->thread_info.n_mix_info);
+}
+
+/* Called from IO thread context. Accounts for a freshly peeked
+ * chunk, returns FALSE if the input wasn't ready or gave silence, which
+ * has been dropped then. */
+static pa_bool_t collect_mix_info(pa_mix_info *info, size_t *mixlength) {
+
+    if (*mixlength == 0 || info->chunk.length < *mixlength)
+        *mixlength = info->chunk.length;
+
+    if (!info->chunk.memblock)
+        return FALSE;
+
+    if (pa_memblock_is_silence(info->chunk.memblock)) {
+        pa_memblock_unref(info->chunk.memblock);
+        return FALSE;
+    }
+
+    pa_assert(info->chunk.memblock);
+    pa_assert(info->chunk.length > 0);
+
+    return TRUE;
+}
+
+struct peek_data {
+    pa_mix_info *info;
+    size_t length;
+};
+
+/* Called from IO thread context or one of the render pool threads.
+ * Inputs that aren't ready leave chunk->memblock NULL, so that they are
+ * neither mixed nor take a slot in the mix info. */
+static void peek_input(pa_sink_input *i, size_t length, pa_memchunk *chunk, pa_cvolume *volume) {
+    pa_usec_t start;
+
+    if (PA_LIKELY(!i->sink->render_stats)) {
+        pa_sink_input_peek_ready(i, length, chunk, volume);
+        return;
+    }
+
+    start = pa_rtclock_now();
+    pa_sink_input_peek_ready(i, length, chunk, volume);
+    i->thread_info.peek_usec = pa_rtclock_now() - start;
+}
+
+/* Called from IO thread context. Members of a sync group may look at
+ * each other's state in pop(), so they stay in the IO thread even if
+ * they are flagged. */
+static pa_bool_t peek_in_parallel(pa_sink_input *i) {
+    return (i->flags & PA_SINK_INPUT_PARALLEL_PEEK) && !i->thread_info.sync_prev && !i->thread_info.sync_next;
+}
+
+/* Called from IO thread context or one of the render pool threads */
+static void peek_job_cb(unsigned job, void *userdata) {
+    struct peek_data *d = userdata;
+    pa_mix_info *info = d->info + job;
+
+    peek_input(info->userdata, d->length, &info->chunk, &info->volume);
+}
+
 /* Called from IO thread context */
-static unsigned fill_mix_info(pa_sink *s, size_t *length, pa_mix_info *info, unsigned maxinfo) {
+static void collect_peek_stats(pa_sink *s) {
+    pa_sink_input *i;
+    void *state = NULL;
+
+    PA_HASHMAP_FOREACH(i, s->thread_info.inputs, state) {
+        pa_render_histogram_add(&s->render_stats->histograms[PA_RENDER_STAT_PEEK], i->thread_info.peek_usec);
+
+        if (i->thread_info.peek_usec > i->thread_info.counters.max_render_usec)
+            i->thread_info.counters.max_render_usec = i->thread_info.peek_usec;
+
+        if (i->thread_info.resample_usec > 0)
+            pa_render_histogram_add(&s->render_stats->histograms[PA_RENDER_STAT_RESAMPLE], i->thread_info.resample_usec);
+
+        i->thread_info.peek_usec = i->thread_info.resample_usec = 0;
+    }
+}
+
+/* Called from IO thread context */
+static unsigned fill_mix_info(pa_sink *s, size_t *length, pa_mix_info *info) {
     pa_sink_input *i;
     unsigned n = 0;
     void *state = NULL;
@@ -1006,30 +1211,77 @@ static unsigned fill_mix_info(pa_sink *s, size_t *length, pa_mix_info *info, uns
     pa_sink_assert_ref(s);
     pa_sink_assert_io_context(s);
     pa_assert(info);
+    pa_assert(pa_hashmap_size(s->thread_info.inputs) <= s->thread_info.n_mix_info);
 
-    while ((i = pa_hashmap_iterate(s->thread_info.inputs, &state, NULL)) && maxinfo > 0) {
-        pa_sink_input_assert_ref(i);
+    if (s->thread_info.render_pool && pa_hashmap_size(s->thread_info.inputs) > 1) {
+        struct peek_data d;
+        unsigned k, n_serial = 0, n_peeked;
+        int deferred;
 
-        pa_sink_input_peek(i, *length, &info->chunk, &info->volume);
+        /* Inputs that don't declare pop() safe for the render pool are
+         * peeked here, before the pool starts, so that they never run
+         * concurrently with anything. They take the first slots, the
+         * others follow. */
+        while ((i = pa_hashmap_iterate(s->thread_info.inputs, &state, NULL))) {
+            pa_sink_input_assert_ref(i);
 
-        if (mixlength == 0 || info->chunk.length < mixlength)
-            mixlength = info->chunk.length;
+            if (peek_in_parallel(i))
+                continue;
 
-        if (pa_memblock_is_silence(info->chunk.memblock)) {
-            pa_memblock_unref(info->chunk.memblock);
-            continue;
+            peek_input(i, *length, &info[n_serial].chunk, &info[n_serial].volume);
+            info[n_serial++].userdata = i;
+        }
+
+        /* Each job peeks into its own slot, the borrowed input
+         * pointer is replaced by a real reference below */
+        n_peeked = n_serial;
+        state = NULL;
+        while ((i = pa_hashmap_iterate(s->thread_info.inputs, &state, NULL)))
+            if (peek_in_parallel(i))
+                info[n_peeked++].userdata = i;
+
+        d.info = info + n_serial;
+        d.length = *length;
+        pa_render_pool_run(s->thread_info.render_pool, n_peeked - n_serial, peek_job_cb, &d);
+
+        if ((deferred = pa_atomic_load(&s->thread_info.deferred_rewind)) > 0) {
+            pa_atomic_store(&s->thread_info.deferred_rewind, 0);
+            pa_sink_request_rewind(s, (size_t) deferred - 1);
+        }
+
+        for (k = 0; k < n_peeked; k++) {
+            i = info[k].userdata;
+
+            if (!collect_mix_info(info + k, &mixlength))
+                continue;
+
+            if (n != k)
+                info[n] = info[k];
+
+            info[n].userdata = pa_sink_input_ref(i);
+            n++;
         }
 
-        info->userdata = pa_sink_input_ref(i);
+    } else {
+
+        while ((i = pa_hashmap_iterate(s->thread_info.inputs, &state, NULL))) {
+            pa_sink_input_assert_ref(i);
 
-        pa_assert(info->chunk.memblock);
-        pa_assert(info->chunk.length > 0);
+            peek_input(i, *length, &info->chunk, &info->volume);
+
+            if (!collect_mix_info(info, &mixlength))
+                continue;
 
-        info++;
-        n++;
-        maxinfo--;
+            info->userdata = pa_sink_input_ref(i);
+
+            info++;
+            n++;
+        }
     }
 
+    if (PA_UNLIKELY(s->render_stats))
+        collect_peek_stats(s);
+
     if (mixlength > 0)
         *length = mixlength;
 
@@ -1086,7 +1338,7 @@ static void inputs_drop(pa_sink *s, pa_mix_info *info, unsigned n, pa_memchunk *
                     pa_assert(result->length <= c.length);
                     c.length = result->length;
 
-                    pa_memchunk_make_writable(&c, 0);
+                    pa_memchunk_make_writable_scratch(&c, 0);
                     pa_volume_memchunk(&c, &s->sample_spec, &m->volume);
                 } else {
                     c = s->silence;
@@ -1133,11 +1385,167 @@ static void inputs_drop(pa_sink *s, pa_mix_info *info, unsigned n, pa_memchunk *
         pa_source_post(s->monitor_source, result);
 }
 
+/* Called from IO thread context */
+static pa_bool_t render_into_direct(pa_sink *s, pa_memchunk *target) {
+    pa_sink_input *i;
+
+    /* A single stream that needs no volume adjustment may render
+     * straight into the target, which spares us a copy if the target
+     * is the hardware buffer */
+    if (pa_hashmap_size(s->thread_info.inputs) != 1 ||
+        s->thread_info.soft_muted ||
+        !pa_cvolume_is_norm(&s->thread_info.soft_volume))
+        return FALSE;
+
+    pa_assert_se(i = pa_hashmap_first(s->thread_info.inputs));
+
+    if (!pa_sink_input_render_into(i, target))
+        return FALSE;
+
+    if (s->monitor_source && PA_SOURCE_IS_LINKED(s->monitor_source->thread_info.state)) {
+        void *ostate = NULL;
+        pa_source_output *o;
+
+        while ((o = pa_hashmap_iterate(i->thread_info.direct_outputs, &ostate, NULL))) {
+            pa_source_output_assert_ref(o);
+            pa_assert(o->direct_on_input == i);
+            pa_source_post_direct(s->monitor_source, o, target);
+        }
+
+        pa_source_post(s->monitor_source, target);
+    }
+
+    return TRUE;
+}
+
+/* Called from IO thread context */
+static void update_render_load(pa_sink *s, pa_usec_t start, size_t length) {
+    pa_usec_t duration, spent;
+    unsigned load;
+
+    if ((duration = pa_bytes_to_usec(length, &s->sample_spec)) <= 0)
+        return;
+
+    spent = pa_rtclock_now() - start;
+    load = (unsigned) PA_MIN(spent * 100 / duration, 1000);
+
+    if (spent > s->thread_info.counters.max_render_usec) {
+        s->thread_info.counters.max_render_usec = spent;
+
+        if (PA_UNLIKELY(s->thread_info.deadline_period > 0) && spent * 4 > s->thread_info.deadline_runtime)
+            update_deadline(s);
+    }
+
+    if (PA_UNLIKELY(s->render_stats)) {
+        pa_usec_t lateness;
+
+        pa_render_histogram_add(&s->render_stats->histograms[PA_RENDER_STAT_CYCLE], spent);
+
+        if (s->thread_info.rtpoll && pa_rtpoll_take_lateness(s->thread_info.rtpoll, &lateness))
+            pa_render_histogram_add(&s->render_stats->histograms[PA_RENDER_STAT_LATENESS], lateness);
+    }
+
+    /* Smooth it a little, so that a single slow render doesn't make any
+     * resampler switch */
+    s->thread_info.render_load = (s->thread_info.render_load * 7 + load) / 8;
+}
+
+/* Called from IO thread context */
+static void levels_publish(pa_sink *s) {
+    pa_sink_levels_window *w;
+    unsigned c;
+
+    pa_seqlock_write_begin(&s->levels_snapshot.lock);
+
+    w = &s->levels_snapshot.windows[s->levels_snapshot.seq % PA_SINK_LEVELS_HISTORY];
+    for (c = 0; c < s->sample_spec.channels; c++) {
+        w->peak[c] = s->thread_info.levels.peak[c];
+        w->mean_square[c] = s->thread_info.levels.mean_square[c] / (float) s->thread_info.levels_frames;
+    }
+    s->levels_snapshot.seq++;
+
+    pa_seqlock_write_end(&s->levels_snapshot.lock);
+
+    memset(&s->thread_info.levels, 0, sizeof(s->thread_info.levels));
+    s->thread_info.levels_frames = 0;
+}
+
+/* Called from IO thread context */
+static void levels_add(pa_sink *s, const float *p, size_t n_frames) {
+    float *peak = s->thread_info.levels.peak;
+    float *sum = s->thread_info.levels.mean_square;
+    unsigned channels = s->sample_spec.channels;
+    size_t i;
+    unsigned c;
+
+    /* Kept simple enough for the compiler to vectorize */
+    for (i = 0; i < n_frames; i++)
+        for (c = 0; c < channels; c++, p++) {
+            float v = fabsf(*p);
+
+            peak[c] = v > peak[c] ? v : peak[c];
+            sum[c] += v * v;
+        }
+}
+
+/* Called from IO thread context */
+static void levels_measure(pa_sink *s, const pa_memchunk *chunk) {
+    pa_convert_func_t convert = NULL;
+    float buf[LEVELS_CONVERT_SAMPLES];
+    const uint8_t *p = NULL;
+    size_t fs, window, n;
+    pa_bool_t silence;
+
+    if (PA_LIKELY(pa_atomic_load(&s->levels_users) <= 0))
+        return;
+
+    fs = pa_frame_size(&s->sample_spec);
+    window = PA_MAX(1U, (size_t) (s->sample_spec.rate * PA_SINK_LEVELS_WINDOW_USEC / PA_USEC_PER_SEC));
+    n = chunk->length / fs;
+
+    /* Silence only needs counting */
+    if (!(silence = pa_memblock_is_silence(chunk->memblock))) {
+        p = pa_memblock_acquire_chunk(chunk);
+
+        if (s->sample_spec.format != PA_SAMPLE_FLOAT32NE)
+            pa_assert_se(convert = pa_get_convert_to_float32ne_function(s->sample_spec.format));
+    }
+
+    while (n > 0) {
+        size_t k;
+
+        if (s->thread_info.levels_frames >= window)
+            levels_publish(s);
+
+        k = PA_MIN(n, window - s->thread_info.levels_frames);
+
+        if (convert) {
+            k = PA_MIN(k, LEVELS_CONVERT_SAMPLES / s->sample_spec.channels);
+            convert((unsigned) (k * s->sample_spec.channels), p, buf);
+            levels_add(s, buf, k);
+        } else if (!silence)
+            levels_add(s, (const float*) p, k);
+
+        if (p)
+            p += k * fs;
+
+        s->thread_info.levels_frames += k;
+        n -= k;
+    }
+
+    if (s->thread_info.levels_frames >= window)
+        levels_publish(s);
+
+    if (!silence)
+        pa_memblock_release(chunk->memblock);
+}
+
 /* Called from IO thread context */
 void pa_sink_render(pa_sink*s, size_t length, pa_memchunk *result) {
-    pa_mix_info info[MAX_MIX_CHANNELS];
+    pa_mix_info *info;
     unsigned n;
     size_t block_size_max;
+    pa_usec_t start;
 
     pa_sink_assert_ref(s);
     pa_sink_assert_io_context(s);
@@ -1156,6 +1564,8 @@ void pa_sink_render(pa_sink*s, size_t length, pa_memchunk *result) {
     }
 
     pa_sink_ref(s);
+    start = pa_rtclock_now();
+    PA_TRACE2(sink_render_begin, s->index, length);
 
     if (length <= 0)
         length = pa_frame_align(MIX_BUFFER_LENGTH, &s->sample_spec);
@@ -1166,7 +1576,8 @@ void pa_sink_render(pa_sink*s, size_t length, pa_memchunk *result) {
 
     pa_assert(length > 0);
 
-    n = fill_mix_info(s, &length, info, MAX_MIX_CHANNELS);
+    info = s->thread_info.mix_info;
+    n = fill_mix_info(s, &length, info);
 
     if (n == 0) {
 
@@ -1179,28 +1590,42 @@ void pa_sink_render(pa_sink*s, size_t length, pa_memchunk *result) {
     } else if (n == 1) {
         pa_cvolume volume;
 
-        *result = info[0].chunk;
-        pa_memblock_ref(result->memblock);
-
-        if (result->length > length)
-            result->length = length;
+        if (length > info[0].chunk.length)
+            length = info[0].chunk.length;
 
         pa_sw_cvolume_multiply(&volume, &s->thread_info.soft_volume, &info[0].volume);
 
         if (s->thread_info.soft_muted || pa_cvolume_is_muted(&volume)) {
-            pa_memblock_unref(result->memblock);
             pa_silence_memchunk_get(&s->core->silence_cache,
                                     s->core->mempool,
                                     result,
                                     &s->sample_spec,
-                                    result->length);
-        } else if (!pa_cvolume_is_norm(&volume)) {
-            pa_memchunk_make_writable(result, 0);
-            pa_volume_memchunk(result, &s->sample_spec, &volume);
+                                    length);
+        } else if (pa_cvolume_is_norm(&volume)) {
+            *result = info[0].chunk;
+            pa_memblock_ref(result->memblock);
+            result->length = length;
+        } else {
+            void *ptr;
+
+            /* Scale while copying into a fresh block instead of making
+             * the input writable (which usually means a copy) and then
+             * scaling it in place in a second pass */
+            result->memblock = pa_memblock_new_scratch(s->core->mempool, length);
+
+            ptr = pa_memblock_acquire(result->memblock);
+            result->length = pa_mix(info, 1,
+                                    ptr, length,
+                                    &s->sample_spec,
+                                    &s->thread_info.soft_volume,
+                                    FALSE);
+            pa_memblock_release(result->memblock);
+
+            result->index = 0;
         }
     } else {
         void *ptr;
-        result->memblock = pa_memblock_new(s->core->mempool, length);
+        result->memblock = pa_memblock_new_scratch(s->core->mempool, length);
 
         ptr = pa_memblock_acquire(result->memblock);
         result->length = pa_mix(info, n,
@@ -1214,15 +1639,19 @@ void pa_sink_render(pa_sink*s, size_t length, pa_memchunk *result) {
     }
 
     inputs_drop(s, info, n, result);
+    levels_measure(s, result);
+    update_render_load(s, start, result->length);
+    PA_TRACE2(sink_render_end, s->index, result->length);
 
     pa_sink_unref(s);
 }
 
 /* Called from IO thread context */
 void pa_sink_render_into(pa_sink*s, pa_memchunk *target) {
-    pa_mix_info info[MAX_MIX_CHANNELS];
+    pa_mix_info *info;
     unsigned n;
     size_t length, block_size_max;
+    pa_usec_t start;
 
     pa_sink_assert_ref(s);
     pa_sink_assert_io_context(s);
@@ -1241,6 +1670,8 @@ void pa_sink_render_into(pa_sink*s, pa_memchunk *target) {
     }
 
     pa_sink_ref(s);
+    start = pa_rtclock_now();
+    PA_TRACE2(sink_render_begin, s->index, target->length);
 
     length = target->length;
     block_size_max = pa_mempool_block_size_max(s->core->mempool);
@@ -1249,7 +1680,19 @@ void pa_sink_render_into(pa_sink*s, pa_memchunk *target) {
 
     pa_assert(length > 0);
 
-    n = fill_mix_info(s, &length, info, MAX_MIX_CHANNELS);
+    if (target->length > length)
+        target->length = length;
+
+    if (render_into_direct(s, target)) {
+        levels_measure(s, target);
+        update_render_load(s, start, target->length);
+        PA_TRACE2(sink_render_end, s->index, target->length);
+        pa_sink_unref(s);
+        return;
+    }
+
+    info = s->thread_info.mix_info;
+    n = fill_mix_info(s, &length, info);
 
     if (n == 0) {
         if (target->length > length)
@@ -1266,22 +1709,28 @@ void pa_sink_render_into(pa_sink*s, pa_memchunk *target) {
 
         if (s->thread_info.soft_muted || pa_cvolume_is_muted(&volume))
             pa_silence_memchunk(target, &s->sample_spec);
-        else {
+        else if (pa_cvolume_is_norm(&volume)) {
             pa_memchunk vchunk;
 
             vchunk = info[0].chunk;
-            pa_memblock_ref(vchunk.memblock);
 
             if (vchunk.length > length)
                 vchunk.length = length;
 
-            if (!pa_cvolume_is_norm(&volume)) {
-                pa_memchunk_make_writable(&vchunk, 0);
-                pa_volume_memchunk(&vchunk, &s->sample_spec, &volume);
-            }
-
             pa_memchunk_memcpy(target, &vchunk);
-            pa_memblock_unref(vchunk.memblock);
+        } else {
+            void *ptr;
+
+            /* Scale straight into the target, in a single pass */
+            ptr = pa_memblock_acquire(target->memblock);
+
+            target->length = pa_mix(info, 1,
+                                    (uint8_t*) ptr + target->index, length,
+                                    &s->sample_spec,
+                                    &s->thread_info.soft_volume,
+                                    FALSE);
+
+            pa_memblock_release(target->memblock);
         }
 
     } else {
@@ -1299,6 +1748,9 @@ void pa_sink_render_into(pa_sink*s, pa_memchunk *target) {
     }
 
     inputs_drop(s, info, n, target);
+    levels_measure(s, target);
+    update_render_load(s, start, target->length);
+    PA_TRACE2(sink_render_end, s->index, target->length);
 
     pa_sink_unref(s);
 }
@@ -1460,6 +1912,134 @@ pa_bool_t pa_sink_update_rate(pa_sink *s, uint32_t rate, pa_bool_t passthrough)
     return ret ;
 }
 
+/* Called from main thread */
+static pa_usec_t add_latency_offset(pa_usec_t usec, int64_t offset) {
+
+    /* usec is unsigned, so check that the offset can be added to usec without
+     * underflowing. */
+    if (-offset <= (int64_t) usec)
+        return usec + offset;
+
+    return 0;
+}
+
+/* Called from main thread */
+pa_bool_t pa_sink_get_latency_nowait(pa_sink *s, pa_usec_t *usec) {
+    pa_bool_t valid = FALSE;
+    pa_usec_t latency = 0, timestamp = 0, now, age;
+    unsigned n;
+
+    pa_sink_assert_ref(s);
+    pa_assert_ctl_context();
+    pa_assert(PA_SINK_IS_LINKED(s->state));
+    pa_assert(usec);
+
+    if (s->state == PA_SINK_SUSPENDED || !(s->flags & PA_SINK_LATENCY)) {
+        *usec = 0;
+        return TRUE;
+    }
+
+    for (n = 0; n < LATENCY_SNAPSHOT_RETRIES; n++) {
+        int seq;
+
+        seq = pa_seqlock_read_begin(&s->latency_snapshot.lock);
+        valid = s->latency_snapshot.valid;
+        latency = s->latency_snapshot.latency;
+        timestamp = s->latency_snapshot.timestamp;
+
+        if (!pa_seqlock_read_retry(&s->latency_snapshot.lock, seq))
+            break;
+    }
+
+    if (n >= LATENCY_SNAPSHOT_RETRIES || !valid)
+        return FALSE;
+
+    now = pa_rtclock_now();
+    age = now > timestamp ? now - timestamp : 0;
+
+    if (age > LATENCY_SNAPSHOT_MAX_AGE)
+        return FALSE;
+
+    /* The snapshot was taken at the time of the last write, since then
+     * the device has played back what elapsed in the meantime */
+    if (age > latency)
+        return FALSE;
+
+    latency -= age;
+
+    *usec = add_latency_offset(latency, s->latency_offset);
+    return TRUE;
+}
+
+/* Called from main thread */
+uint32_t pa_sink_levels_start(pa_sink *s) {
+    uint32_t seq;
+    int lock_seq;
+
+    pa_sink_assert_ref(s);
+    pa_assert_ctl_context();
+
+    pa_atomic_inc(&s->levels_users);
+
+    do {
+        lock_seq = pa_seqlock_read_begin(&s->levels_snapshot.lock);
+        seq = s->levels_snapshot.seq;
+    } while (pa_seqlock_read_retry(&s->levels_snapshot.lock, lock_seq));
+
+    return seq;
+}
+
+/* Called from main thread */
+void pa_sink_levels_stop(pa_sink *s) {
+    pa_sink_assert_ref(s);
+    pa_assert_ctl_context();
+
+    pa_assert_se(pa_atomic_dec(&s->levels_users) >= 1);
+}
+
+/* Called from main thread */
+pa_bool_t pa_sink_get_levels(pa_sink *s, uint32_t *seq, pa_sink_levels *l) {
+    uint32_t now = 0, k, n = 0;
+    unsigned c, retries;
+
+    pa_sink_assert_ref(s);
+    pa_assert_ctl_context();
+    pa_assert(seq);
+    pa_assert(l);
+
+    for (retries = 0; retries < LATENCY_SNAPSHOT_RETRIES; retries++) {
+        int lock_seq;
+
+        lock_seq = pa_seqlock_read_begin(&s->levels_snapshot.lock);
+
+        now = s->levels_snapshot.seq;
+        n = PA_MIN(now - *seq, (uint32_t) PA_SINK_LEVELS_HISTORY);
+
+        memset(l, 0, sizeof(*l));
+
+        for (k = now - n; k != now; k++) {
+            const pa_sink_levels_window *w = &s->levels_snapshot.windows[k % PA_SINK_LEVELS_HISTORY];
+
+            for (c = 0; c < s->sample_spec.channels; c++) {
+                l->peak[c] = PA_MAX(l->peak[c], w->peak[c]);
+                l->rms[c] += w->mean_square[c];
+            }
+        }
+
+        if (!pa_seqlock_read_retry(&s->levels_snapshot.lock, lock_seq))
+            break;
+    }
+
+    if (retries >= LATENCY_SNAPSHOT_RETRIES || n == 0)
+        return FALSE;
+
+    for (c = 0; c < s->sample_spec.channels; c++)
+        l->rms[c] = sqrtf(l->rms[c] / (float) n);
+
+    *seq = now;
+    return TRUE;
+}
+
 /* Called from main thread */
 pa_usec_t pa_sink_get_latency(pa_sink *s) {
     pa_usec_t usec = 0;
@@ -1470,22 +2050,12 @@ pa_usec_t pa_sink_get_latency(pa_sink *s) {
 
     /* The returned value is supposed to be in the time domain of the sound card! */
 
-    if (s->state == PA_SINK_SUSPENDED)
-        return 0;
-
-    if (!(s->flags & PA_SINK_LATENCY))
-        return 0;
+    if (pa_sink_get_latency_nowait(s, &usec))
+        return usec;
 
     pa_assert_se(pa_asyncmsgq_send(s->asyncmsgq, PA_MSGOBJECT(s), PA_SINK_MESSAGE_GET_LATENCY, &usec, 0, NULL) == 0);
 
-    /* usec is unsigned, so check that the offset can be added to usec without
-     * underflowing. */
-    if (-s->latency_offset <= (int64_t) usec)
-        usec += s->latency_offset;
-    else
-        usec = 0;
-
-    return usec;
+    return add_latency_offset(usec, s->latency_offset);
 }
 
 /* Called from IO thread */
@@ -1507,19 +2077,47 @@ pa_usec_t pa_sink_get_latency_within_thread(pa_sink *s) {
 
     o = PA_MSGOBJECT(s);
 
-    /* FIXME: We probably should make this a proper vtable callback instead of going through process_msg() */
+    /* FIXME: We probably should make this a proper vtable callback instead of going through process_msg() */
+
+    if (o->process_msg(o, PA_SINK_MESSAGE_GET_LATENCY, &usec, 0, NULL) < 0)
+        return -1;
+
+    /* usec is unsigned, so check that the offset can be added to usec without
+     * underflowing. */
+    if (-s->thread_info.latency_offset <= (int64_t) usec)
+        usec += s->thread_info.latency_offset;
+    else
+        usec = 0;
+
+    return usec;
+}
+
+/* Called from IO thread */
+void pa_sink_publish_latency(pa_sink *s, pa_usec_t usec) {
+    pa_usec_t now;
+
+    pa_sink_assert_ref(s);
+    pa_sink_assert_io_context(s);
+
+    now = pa_rtclock_now();
+
+    pa_seqlock_write_begin(&s->latency_snapshot.lock);
+    s->latency_snapshot.valid = TRUE;
+    s->latency_snapshot.latency = usec;
+    s->latency_snapshot.timestamp = now;
+    pa_seqlock_write_end(&s->latency_snapshot.lock);
+}
 
-    if (o->process_msg(o, PA_SINK_MESSAGE_GET_LATENCY, &usec, 0, NULL) < 0)
-        return -1;
+/* Called from IO thread */
+void pa_sink_invalidate_latency(pa_sink *s) {
+    pa_sink_assert_ref(s);
 
-    /* usec is unsigned, so check that the offset can be added to usec without
-     * underflowing. */
-    if (-s->thread_info.latency_offset <= (int64_t) usec)
-        usec += s->thread_info.latency_offset;
-    else
-        usec = 0;
+    if (!s->latency_snapshot.valid)
+        return;
 
-    return usec;
+    pa_seqlock_write_begin(&s->latency_snapshot.lock);
+    s->latency_snapshot.valid = FALSE;
+    pa_seqlock_write_end(&s->latency_snapshot.lock);
 }
 
 /* Called from the main thread (and also from the IO thread while the main
@@ -1662,6 +2260,52 @@ static void compute_reference_ratios(pa_sink *s) {
     }
 }
 
+/* Called from main context. */
+static void compute_real_ratio(pa_sink_input *i) {
+    unsigned c;
+    pa_cvolume remapped;
+
+    pa_assert(i);
+
+    /*
+     * This basically calculates:
+     *
+     * i->real_ratio := i->volume / i->sink->real_volume
+     * i->soft_volume := i->real_ratio * i->volume_factor
+     */
+
+    remapped = i->sink->real_volume;
+    pa_cvolume_remap(&remapped, &i->sink->channel_map, &i->channel_map);
+
+    i->real_ratio.channels = i->sample_spec.channels;
+    i->soft_volume.channels = i->sample_spec.channels;
+
+    for (c = 0; c < i->sample_spec.channels; c++) {
+
+        if (remapped.values[c] <= PA_VOLUME_MUTED) {
+            /* We leave i->real_ratio untouched */
+            i->soft_volume.values[c] = PA_VOLUME_MUTED;
+            continue;
+        }
+
+        /* Don't lose accuracy unless necessary */
+        if (pa_sw_volume_multiply(
+                    i->real_ratio.values[c],
+                    remapped.values[c]) != i->volume.values[c])
+
+            i->real_ratio.values[c] = pa_sw_volume_divide(
+                    i->volume.values[c],
+                    remapped.values[c]);
+
+        i->soft_volume.values[c] = pa_sw_volume_multiply(
+                i->real_ratio.values[c],
+                i->volume_factor.values[c]);
+    }
+
+    /* We don't copy the soft_volume to the thread_info data
+     * here. That must be done by the caller */
+}
+
 /* Called from main context. Only called for the root sink in volume sharing
  * cases, except for internal recursive calls. */
 static void compute_real_ratios(pa_sink *s) {
@@ -1674,8 +2318,6 @@ static void compute_real_ratios(pa_sink *s) {
     pa_assert(pa_sink_flat_volume_enabled(s));
 
     PA_IDXSET_FOREACH(i, s->inputs, idx) {
-        unsigned c;
-        pa_cvolume remapped;
 
         if (i->origin_sink && (i->origin_sink->flags & PA_SINK_SHARE_VOLUME_WITH_MASTER)) {
             /* The origin sink uses volume sharing, so this input's real ratio
@@ -1689,43 +2331,7 @@ static void compute_real_ratios(pa_sink *s) {
             continue;
         }
 
-        /*
-         * This basically calculates:
-         *
-         * i->real_ratio := i->volume / s->real_volume
-         * i->soft_volume := i->real_ratio * i->volume_factor
-         */
-
-        remapped = s->real_volume;
-        pa_cvolume_remap(&remapped, &s->channel_map, &i->channel_map);
-
-        i->real_ratio.channels = i->sample_spec.channels;
-        i->soft_volume.channels = i->sample_spec.channels;
-
-        for (c = 0; c < i->sample_spec.channels; c++) {
-
-            if (remapped.values[c] <= PA_VOLUME_MUTED) {
-                /* We leave i->real_ratio untouched */
-                i->soft_volume.values[c] = PA_VOLUME_MUTED;
-                continue;
-            }
-
-            /* Don't lose accuracy unless necessary */
-            if (pa_sw_volume_multiply(
-                        i->real_ratio.values[c],
-                        remapped.values[c]) != i->volume.values[c])
-
-                i->real_ratio.values[c] = pa_sw_volume_divide(
-                        i->volume.values[c],
-                        remapped.values[c]);
-
-            i->soft_volume.values[c] = pa_sw_volume_multiply(
-                    i->real_ratio.values[c],
-                    i->volume_factor.values[c]);
-        }
-
-        /* We don't copy the soft_volume to the thread_info data
-         * here. That must be done by the caller */
+        compute_real_ratio(i);
     }
 }
 
@@ -2073,6 +2679,69 @@ void pa_sink_set_volume(
         pa_assert_se(pa_asyncmsgq_send(root_sink->asyncmsgq, PA_MSGOBJECT(root_sink), PA_SINK_MESSAGE_SET_SHARED_VOLUME, NULL, 0, NULL) == 0);
 }
 
+/* Called from main context */
+static void sync_volumes_cb(pa_mainloop_api *m, pa_defer_event *e, void *userdata) {
+    pa_sink *s = userdata;
+
+    pa_sink_assert_ref(s);
+
+    m->defer_enable(e, 0);
+
+    if (PA_SINK_IS_LINKED(s->state))
+        pa_assert_se(pa_asyncmsgq_send(s->asyncmsgq, PA_MSGOBJECT(s), PA_SINK_MESSAGE_SYNC_VOLUMES, NULL, 0, NULL) == 0);
+}
+
+/* Called from main context */
+pa_bool_t pa_sink_update_flat_volume_for_input(pa_sink_input *i, const pa_cvolume *old_volume, pa_bool_t save) {
+    pa_sink *s;
+    pa_cvolume t;
+    unsigned c;
+
+    pa_sink_input_assert_ref(i);
+    pa_assert_ctl_context();
+    pa_assert(old_volume);
+
+    s = i->sink;
+
+    pa_sink_assert_ref(s);
+    pa_assert(PA_SINK_IS_LINKED(s->state));
+    pa_assert(pa_sink_flat_volume_enabled(s));
+
+    /* Filter sinks, volume sharing and remapping between different
+     * channel maps all need the full treatment */
+    if ((s->flags & PA_SINK_SHARE_VOLUME_WITH_MASTER) ||
+        (i->origin_sink && (i->origin_sink->flags & PA_SINK_SHARE_VOLUME_WITH_MASTER)) ||
+        pa_sink_is_passthrough(s) ||
+        !pa_channel_map_equal(&i->channel_map, &s->channel_map))
+        return FALSE;
+
+    /* The real volume stays the same if this input neither was nor now
+     * is what determines it. The reference volume then stays, too. */
+    for (c = 0; c < s->real_volume.channels; c++)
+        if (old_volume->values[c] >= s->real_volume.values[c] ||
+            i->volume.values[c] > s->real_volume.values[c])
+            return FALSE;
+
+    pa_cvolume_merge(&t, &s->reference_volume, &s->real_volume);
+    if (!pa_cvolume_equal(&t, &s->reference_volume))
+        return FALSE;
+
+    s->save_volume = s->save_volume || save;
+
+    /* Hence only this input's ratios change */
+    compute_reference_ratio(i);
+    compute_real_ratio(i);
+
+    /* All the soft volumes changed in this main loop iteration are
+     * passed on with a single message */
+    if (!s->sync_volumes_event)
+        s->sync_volumes_event = s->core->mainloop->defer_new(s->core->mainloop, sync_volumes_cb, s);
+
+    s->core->mainloop->defer_enable(s->sync_volumes_event, 1);
+
+    return TRUE;
+}
+
 /* Called from the io thread if sync volume is used, otherwise from the main thread.
  * Only to be called by sink implementor */
 void pa_sink_set_soft_volume(pa_sink *s, const pa_cvolume *volume) {
@@ -2439,6 +3108,161 @@ static void set_shared_volume_within_thread(pa_sink *s) {
     }
 }
 
+/* Called from IO thread */
+/* Takes the audio of i back from s and detaches it. If keep_render is
+ * true the rendered audio is valid for the sink i goes to as well. */
+static void start_move_within_thread(pa_sink *s, pa_sink_input *i, pa_bool_t keep_render) {
+    /* We don't support moving synchronized streams. */
+    pa_assert(!i->sync_prev);
+    pa_assert(!i->sync_next);
+    pa_assert(!i->thread_info.sync_next);
+    pa_assert(!i->thread_info.sync_prev);
+
+    if (i->thread_info.state != PA_SINK_INPUT_CORKED) {
+        pa_usec_t usec = 0;
+        size_t sink_nbytes, total_nbytes;
+
+        /* The old sink probably has some audio from this
+         * stream in its buffer. We want to "take it back" as
+         * much as possible and play it to the new sink. We
+         * don't know at this point how much the old sink can
+         * rewind. We have to pick something, and that
+         * something is the full latency of the old sink here.
+         * So we rewind the stream buffer by the sink latency
+         * amount, which may be more than what we should
+         * rewind. This can result in a chunk of audio being
+         * played both to the old sink and the new sink.
+         *
+         * FIXME: Fix this code so that we don't have to make
+         * guesses about how much the sink will actually be
+         * able to rewind. If someone comes up with a solution
+         * for this, something to note is that the part of the
+         * latency that the old sink couldn't rewind should
+         * ideally be compensated after the stream has moved
+         * to the new sink by adding silence. The new sink
+         * most likely can't start playing the moved stream
+         * immediately, and that gap should be removed from
+         * the "compensation silence" (at least at the time of
+         * writing this, the move finish code will actually
+         * already take care of dropping the new sink's
+         * unrewindable latency, so taking into account the
+         * unrewindable latency of the old sink is the only
+         * problem).
+         *
+         * The render_memblockq contents are discarded,
+         * because when the sink changes, the format of the
+         * audio stored in the render_memblockq may change
+         * too, making the stored audio invalid. FIXME:
+         * However, the read and write indices are moved back
+         * the same amount, so if they are not the same now,
+         * they won't be the same after the rewind either. If
+         * the write index of the render_memblockq is ahead of
+         * the read index, then the render_memblockq will feed
+         * the new sink some silence first, which it shouldn't
+         * do. The write index should be flushed to be the
+         * same as the read index. */
+
+        /* Get the latency of the sink */
+        usec = pa_sink_get_latency_within_thread(s);
+        sink_nbytes = pa_usec_to_bytes(usec, &s->sample_spec);
+
+        /* If the new sink takes the same format, the render_memblockq
+         * contents stay valid. If they also cover all that the old
+         * sink has queued, we just take that back from the queue and
+         * neither the implementor nor the resampler need to be
+         * bothered. */
+        if (keep_render &&
+            !i->thread_info.render_history_missing &&
+            !i->thread_info.dont_rewind_render &&
+            sink_nbytes <= pa_memblockq_get_maxrewind(i->thread_info.render_memblockq)) {
+
+            if (sink_nbytes > 0)
+                pa_sink_input_process_rewind(i, sink_nbytes);
+        } else if ((total_nbytes = sink_nbytes + pa_memblockq_get_length(i->thread_info.render_memblockq)) > 0) {
+            i->thread_info.rewrite_nbytes = i->thread_info.resampler ? pa_resampler_request(i->thread_info.resampler, total_nbytes) : total_nbytes;
+            i->thread_info.rewrite_flush = TRUE;
+            pa_sink_input_process_rewind(i, sink_nbytes);
+        }
+    }
+
+    if (i->detach)
+        i->detach(i);
+
+    pa_assert(i->thread_info.attached);
+    i->thread_info.attached = FALSE;
+
+    /* Let's remove the sink input ...*/
+    if (pa_hashmap_remove(s->thread_info.inputs, PA_UINT32_TO_PTR(i->index)))
+        pa_sink_input_unref(i);
+}
+
+/* Called from IO thread */
+/* Attaches i to s and returns how much s should rewind for it */
+static size_t finish_move_within_thread(pa_sink *s, pa_sink_input *i) {
+    size_t nbytes = 0;
+
+    /* We don't support moving synchronized streams. */
+    pa_assert(!i->sync_prev);
+    pa_assert(!i->sync_next);
+    pa_assert(!i->thread_info.sync_next);
+    pa_assert(!i->thread_info.sync_prev);
+
+    pa_hashmap_put(s->thread_info.inputs, PA_UINT32_TO_PTR(i->index), pa_sink_input_ref(i));
+    ensure_mix_info(s);
+
+    pa_assert(!i->thread_info.attached);
+    i->thread_info.attached = TRUE;
+
+    if (i->attach)
+        i->attach(i);
+
+    if (i->thread_info.state != PA_SINK_INPUT_CORKED) {
+        pa_usec_t usec = 0;
+
+        /* In the ideal case the new sink would start playing
+         * the stream immediately. That requires the sink to
+         * be able to rewind all of its latency, which usually
+         * isn't possible, so there will probably be some gap
+         * before the moved stream becomes audible. We then
+         * have two possibilities: 1) start playing the stream
+         * from where it is now, or 2) drop the unrewindable
+         * latency of the sink from the stream. With option 1
+         * we won't lose any audio but the stream will have a
+         * pause. With option 2 we may lose some audio but the
+         * stream time will be somewhat in sync with the wall
+         * clock. Lennart seems to have chosen option 2 (one
+         * of the reasons might have been that option 1 is
+         * actually much harder to implement), so we drop the
+         * latency of the new sink from the moved stream and
+         * hope that the sink will undo most of that in the
+         * rewind. */
+
+        /* Get the latency of the sink */
+        usec = pa_sink_get_latency_within_thread(s);
+        nbytes = pa_usec_to_bytes(usec, &s->sample_spec);
+
+        if (nbytes > 0)
+            pa_sink_input_drop(i, nbytes);
+    }
+
+    return nbytes;
+}
+
+/* Called from IO thread */
+/* What is left to do for i once s has been asked to rewind */
+static void finish_move_update_within_thread(pa_sink *s, pa_sink_input *i) {
+    /* Updating the requested sink latency has to be done
+     * after the sink rewind request, not before, because
+     * otherwise the sink may limit the rewind amount
+     * needlessly. */
+
+    if (i->thread_info.requested_sink_latency != (pa_usec_t) -1)
+        pa_sink_input_set_requested_latency_within_thread(i, i->thread_info.requested_sink_latency);
+
+    pa_sink_input_update_max_rewind(i, s->thread_info.max_rewind);
+    pa_sink_input_update_max_request(i, s->thread_info.max_request);
+}
+
 /* Called from IO thread, except when it is not */
 int pa_sink_process_msg(pa_msgobject *o, int code, void *userdata, int64_t offset, pa_memchunk *chunk) {
     pa_sink *s = PA_SINK(o);
@@ -2454,21 +3278,22 @@ int pa_sink_process_msg(pa_msgobject *o, int code, void *userdata, int64_t offse
              * PA_SINK_MESSAGE_FINISH_MOVE, too. */
 
             pa_hashmap_put(s->thread_info.inputs, PA_UINT32_TO_PTR(i->index), pa_sink_input_ref(i));
+            ensure_mix_info(s);
 
-            /* Since the caller sleeps in pa_sink_input_put(), we can
-             * safely access data outside of thread_info even though
-             * it is mutable */
+            /* The order of the group members doesn't matter, so only
+             * the IO thread's own list of the group is touched here.
+             * That way pa_sink_input_put_async() needn't wait for
+             * synced inputs either. */
 
-            if ((i->thread_info.sync_prev = i->sync_prev)) {
-                pa_assert(i->sink == i->thread_info.sync_prev->sink);
-                pa_assert(i->sync_prev->sync_next == i);
-                i->thread_info.sync_prev->thread_info.sync_next = i;
-            }
+            i->thread_info.sync_prev = i->thread_info.sync_next = NULL;
 
-            if ((i->thread_info.sync_next = i->sync_next)) {
-                pa_assert(i->sink == i->thread_info.sync_next->sink);
-                pa_assert(i->sync_next->sync_prev == i);
-                i->thread_info.sync_next->thread_info.sync_prev = i;
+            if (i->sync_group) {
+                if ((i->thread_info.sync_next = i->sync_group->thread_info.inputs)) {
+                    pa_assert(i->sink == i->thread_info.sync_next->sink);
+                    i->thread_info.sync_next->thread_info.sync_prev = i;
+                }
+
+                i->sync_group->thread_info.inputs = i;
             }
 
             pa_assert(!i->thread_info.attached);
@@ -2525,21 +3350,16 @@ int pa_sink_process_msg(pa_msgobject *o, int code, void *userdata, int64_t offse
             pa_assert(i->thread_info.attached);
             i->thread_info.attached = FALSE;
 
-            /* Since the caller sleeps in pa_sink_input_unlink(),
-             * we can safely access data outside of thread_info even
-             * though it is mutable */
+            if (i->sync_group) {
+                if (i->thread_info.sync_prev)
+                    i->thread_info.sync_prev->thread_info.sync_next = i->thread_info.sync_next;
+                else if (i->sync_group->thread_info.inputs == i)
+                    i->sync_group->thread_info.inputs = i->thread_info.sync_next;
 
-            pa_assert(!i->sync_prev);
-            pa_assert(!i->sync_next);
-
-            if (i->thread_info.sync_prev) {
-                i->thread_info.sync_prev->thread_info.sync_next = i->thread_info.sync_prev->sync_next;
-                i->thread_info.sync_prev = NULL;
-            }
+                if (i->thread_info.sync_next)
+                    i->thread_info.sync_next->thread_info.sync_prev = i->thread_info.sync_prev;
 
-            if (i->thread_info.sync_next) {
-                i->thread_info.sync_next->thread_info.sync_prev = i->thread_info.sync_next->sync_prev;
-                i->thread_info.sync_next = NULL;
+                i->thread_info.sync_prev = i->thread_info.sync_next = NULL;
             }
 
             if (pa_hashmap_remove(s->thread_info.inputs, PA_UINT32_TO_PTR(i->index)))
@@ -2553,151 +3373,73 @@ int pa_sink_process_msg(pa_msgobject *o, int code, void *userdata, int64_t offse
             return o->process_msg(o, PA_SINK_MESSAGE_SET_SHARED_VOLUME, NULL, 0, NULL);
         }
 
-        case PA_SINK_MESSAGE_START_MOVE: {
-            pa_sink_input *i = PA_SINK_INPUT(userdata);
+        case PA_SINK_MESSAGE_START_MOVE:
 
-            /* We don't support moving synchronized streams. */
-            pa_assert(!i->sync_prev);
-            pa_assert(!i->sync_next);
-            pa_assert(!i->thread_info.sync_next);
-            pa_assert(!i->thread_info.sync_prev);
+            start_move_within_thread(s, PA_SINK_INPUT(userdata), (pa_bool_t) offset);
 
-            if (i->thread_info.state != PA_SINK_INPUT_CORKED) {
-                pa_usec_t usec = 0;
-                size_t sink_nbytes, total_nbytes;
-
-                /* The old sink probably has some audio from this
-                 * stream in its buffer. We want to "take it back" as
-                 * much as possible and play it to the new sink. We
-                 * don't know at this point how much the old sink can
-                 * rewind. We have to pick something, and that
-                 * something is the full latency of the old sink here.
-                 * So we rewind the stream buffer by the sink latency
-                 * amount, which may be more than what we should
-                 * rewind. This can result in a chunk of audio being
-                 * played both to the old sink and the new sink.
-                 *
-                 * FIXME: Fix this code so that we don't have to make
-                 * guesses about how much the sink will actually be
-                 * able to rewind. If someone comes up with a solution
-                 * for this, something to note is that the part of the
-                 * latency that the old sink couldn't rewind should
-                 * ideally be compensated after the stream has moved
-                 * to the new sink by adding silence. The new sink
-                 * most likely can't start playing the moved stream
-                 * immediately, and that gap should be removed from
-                 * the "compensation silence" (at least at the time of
-                 * writing this, the move finish code will actually
-                 * already take care of dropping the new sink's
-                 * unrewindable latency, so taking into account the
-                 * unrewindable latency of the old sink is the only
-                 * problem).
-                 *
-                 * The render_memblockq contents are discarded,
-                 * because when the sink changes, the format of the
-                 * audio stored in the render_memblockq may change
-                 * too, making the stored audio invalid. FIXME:
-                 * However, the read and write indices are moved back
-                 * the same amount, so if they are not the same now,
-                 * they won't be the same after the rewind either. If
-                 * the write index of the render_memblockq is ahead of
-                 * the read index, then the render_memblockq will feed
-                 * the new sink some silence first, which it shouldn't
-                 * do. The write index should be flushed to be the
-                 * same as the read index. */
-
-                /* Get the latency of the sink */
-                usec = pa_sink_get_latency_within_thread(s);
-                sink_nbytes = pa_usec_to_bytes(usec, &s->sample_spec);
-                total_nbytes = sink_nbytes + pa_memblockq_get_length(i->thread_info.render_memblockq);
-
-                if (total_nbytes > 0) {
-                    i->thread_info.rewrite_nbytes = i->thread_info.resampler ? pa_resampler_request(i->thread_info.resampler, total_nbytes) : total_nbytes;
-                    i->thread_info.rewrite_flush = TRUE;
-                    pa_sink_input_process_rewind(i, sink_nbytes);
-                }
-            }
+            pa_sink_invalidate_requested_latency(s, TRUE);
 
-            if (i->detach)
-                i->detach(i);
+            pa_log_debug("Requesting rewind due to started move");
+            pa_sink_request_rewind(s, (size_t) -1);
 
-            pa_assert(i->thread_info.attached);
-            i->thread_info.attached = FALSE;
+            /* In flat volume mode we need to update the volume as
+             * well */
+            return o->process_msg(o, PA_SINK_MESSAGE_SET_SHARED_VOLUME, NULL, 0, NULL);
 
-            /* Let's remove the sink input ...*/
-            if (pa_hashmap_remove(s->thread_info.inputs, PA_UINT32_TO_PTR(i->index)))
-                pa_sink_input_unref(i);
+        case PA_SINK_MESSAGE_START_MOVE_BATCH: {
+            pa_sink_input_move *moves = userdata;
+            int64_t k;
+
+            for (k = 0; k < offset; k++)
+                start_move_within_thread(s, moves[k].input, moves[k].keep_render);
 
             pa_sink_invalidate_requested_latency(s, TRUE);
 
-            pa_log_debug("Requesting rewind due to started move");
+            pa_log_debug("Requesting rewind due to %lli started moves", (long long) offset);
             pa_sink_request_rewind(s, (size_t) -1);
 
-            /* In flat volume mode we need to update the volume as
-             * well */
             return o->process_msg(o, PA_SINK_MESSAGE_SET_SHARED_VOLUME, NULL, 0, NULL);
         }
 
         case PA_SINK_MESSAGE_FINISH_MOVE: {
             pa_sink_input *i = PA_SINK_INPUT(userdata);
 
-            /* We don't support moving synchronized streams. */
-            pa_assert(!i->sync_prev);
-            pa_assert(!i->sync_next);
-            pa_assert(!i->thread_info.sync_next);
-            pa_assert(!i->thread_info.sync_prev);
-
-            pa_hashmap_put(s->thread_info.inputs, PA_UINT32_TO_PTR(i->index), pa_sink_input_ref(i));
-
-            pa_assert(!i->thread_info.attached);
-            i->thread_info.attached = TRUE;
-
-            if (i->attach)
-                i->attach(i);
+            size_t nbytes = finish_move_within_thread(s, i);
 
             if (i->thread_info.state != PA_SINK_INPUT_CORKED) {
-                pa_usec_t usec = 0;
-                size_t nbytes;
-
-                /* In the ideal case the new sink would start playing
-                 * the stream immediately. That requires the sink to
-                 * be able to rewind all of its latency, which usually
-                 * isn't possible, so there will probably be some gap
-                 * before the moved stream becomes audible. We then
-                 * have two possibilities: 1) start playing the stream
-                 * from where it is now, or 2) drop the unrewindable
-                 * latency of the sink from the stream. With option 1
-                 * we won't lose any audio but the stream will have a
-                 * pause. With option 2 we may lose some audio but the
-                 * stream time will be somewhat in sync with the wall
-                 * clock. Lennart seems to have chosen option 2 (one
-                 * of the reasons might have been that option 1 is
-                 * actually much harder to implement), so we drop the
-                 * latency of the new sink from the moved stream and
-                 * hope that the sink will undo most of that in the
-                 * rewind. */
-
-                /* Get the latency of the sink */
-                usec = pa_sink_get_latency_within_thread(s);
-                nbytes = pa_usec_to_bytes(usec, &s->sample_spec);
-
-                if (nbytes > 0)
-                    pa_sink_input_drop(i, nbytes);
-
                 pa_log_debug("Requesting rewind due to finished move");
                 pa_sink_request_rewind(s, nbytes);
             }
 
-            /* Updating the requested sink latency has to be done
-             * after the sink rewind request, not before, because
-             * otherwise the sink may limit the rewind amount
-             * needlessly. */
+            finish_move_update_within_thread(s, i);
 
-            if (i->thread_info.requested_sink_latency != (pa_usec_t) -1)
-                pa_sink_input_set_requested_latency_within_thread(i, i->thread_info.requested_sink_latency);
+            return o->process_msg(o, PA_SINK_MESSAGE_SET_SHARED_VOLUME, NULL, 0, NULL);
+        }
 
-            pa_sink_input_update_max_rewind(i, s->thread_info.max_rewind);
-            pa_sink_input_update_max_request(i, s->thread_info.max_request);
+        case PA_SINK_MESSAGE_FINISH_MOVE_BATCH: {
+            pa_sink_input_move *moves = userdata;
+            pa_bool_t rewind = FALSE;
+            size_t nbytes = 0;
+            int64_t k;
+
+            /* All streams are attached before the sink rewinds, and all
+             * of them rewind together */
+            for (k = 0; k < offset; k++) {
+                size_t n = finish_move_within_thread(s, moves[k].input);
+
+                if (moves[k].input->thread_info.state != PA_SINK_INPUT_CORKED) {
+                    nbytes = PA_MAX(nbytes, n);
+                    rewind = TRUE;
+                }
+            }
+
+            if (rewind) {
+                pa_log_debug("Requesting rewind due to %lli finished moves", (long long) offset);
+                pa_sink_request_rewind(s, nbytes);
+            }
+
+            for (k = 0; k < offset; k++)
+                finish_move_update_within_thread(s, moves[k].input);
 
             return o->process_msg(o, PA_SINK_MESSAGE_SET_SHARED_VOLUME, NULL, 0, NULL);
         }
@@ -2773,6 +3515,8 @@ int pa_sink_process_msg(pa_msgobject *o, int code, void *userdata, int64_t offse
                 (s->thread_info.state == PA_SINK_SUSPENDED && PA_SINK_IS_OPENED(PA_PTR_TO_UINT(userdata))) ||
                 (PA_SINK_IS_OPENED(s->thread_info.state) && PA_PTR_TO_UINT(userdata) == PA_SINK_SUSPENDED);
 
+            pa_sink_invalidate_latency(s);
+
             s->thread_info.state = PA_PTR_TO_UINT(userdata);
 
             if (s->thread_info.state == PA_SINK_SUSPENDED) {
@@ -2890,6 +3634,18 @@ int pa_sink_process_msg(pa_msgobject *o, int code, void *userdata, int64_t offse
             s->thread_info.latency_offset = offset;
             return 0;
 
+        case PA_SINK_MESSAGE_RESET_COUNTERS: {
+            pa_sink_input *i;
+            void *state = NULL;
+
+            pa_io_counters_reset(&s->thread_info.counters);
+
+            PA_HASHMAP_FOREACH(i, s->thread_info.inputs, state)
+                pa_io_counters_reset(&i->thread_info.counters);
+
+            return 0;
+        }
+
         case PA_SINK_MESSAGE_GET_LATENCY:
         case PA_SINK_MESSAGE_MAX:
             ;
@@ -2981,6 +3737,20 @@ void pa_sink_request_rewind(pa_sink*s, size_t nbytes) {
 
     nbytes = PA_MIN(nbytes, s->thread_info.max_rewind);
 
+    PA_TRACE2(sink_request_rewind, s->index, nbytes);
+
+    /* A render pool thread must not touch our state, remember the
+     * largest request instead, fill_mix_info() applies it */
+    if (s->thread_info.render_pool && pa_render_pool_in_helper(s->thread_info.render_pool)) {
+        int v;
+
+        do {
+            v = pa_atomic_load(&s->thread_info.deferred_rewind);
+        } while (v <= (int) nbytes && !pa_atomic_cmpxchg(&s->thread_info.deferred_rewind, v, (int) nbytes + 1));
+
+        return;
+    }
+
     if (s->thread_info.rewind_requested &&
         nbytes <= s->thread_info.rewind_nbytes)
         return;
@@ -3132,6 +3902,9 @@ void pa_sink_invalidate_requested_latency(pa_sink *s, pa_bool_t dynamic) {
             if (i->update_sink_requested_latency)
                 i->update_sink_requested_latency(i);
     }
+
+    if (s->thread_info.deadline_period > 0)
+        update_deadline(s);
 }
 
 /* Called from main thread */
@@ -3303,6 +4076,67 @@ void pa_sink_set_fixed_latency_within_thread(pa_sink *s, pa_usec_t latency) {
     pa_source_set_fixed_latency_within_thread(s->monitor_source, latency);
 }
 
+/* Called from IO thread context */
+static void get_deadline(pa_sink *s, pa_usec_t *runtime, pa_usec_t *period) {
+    pa_usec_t latency;
+
+    if ((latency = pa_sink_get_requested_latency_within_thread(s)) == (pa_usec_t) -1)
+        latency = s->thread_info.max_latency;
+
+    pa_deadline_from_latency(latency, s->thread_info.counters.max_render_usec, runtime, period);
+}
+
+/* Called from IO thread context */
+static void update_deadline(pa_sink *s) {
+    pa_usec_t runtime, period;
+
+    get_deadline(s, &runtime, &period);
+
+    /* Small changes aren't worth a syscall */
+    if (period == s->thread_info.deadline_period &&
+        runtime * 4 >= s->thread_info.deadline_runtime * 3 &&
+        runtime * 4 <= s->thread_info.deadline_runtime * 5)
+        return;
+
+    /* Remembered even if it fails, so that it isn't retried on every
+     * render. The previous reservation stays in place then. */
+    s->thread_info.deadline_runtime = runtime;
+    s->thread_info.deadline_period = period;
+
+    pa_make_deadline(runtime, period);
+}
+
+/* Called from IO thread context */
+void pa_sink_make_realtime_within_thread(pa_sink *s, int rtprio) {
+    pa_usec_t runtime, period;
+
+    pa_sink_assert_ref(s);
+    pa_sink_assert_io_context(s);
+
+    if (s->core->realtime_deadline) {
+        get_deadline(s, &runtime, &period);
+
+        if (pa_make_deadline(runtime, period) >= 0) {
+            s->thread_info.deadline_runtime = runtime;
+            s->thread_info.deadline_period = period;
+            return;
+        }
+    }
+
+    pa_make_realtime(rtprio);
+}
+
+/* Called from IO thread */
+pa_usec_t pa_sink_align_wakeup_within_thread(pa_sink *s, pa_usec_t deadline, pa_usec_t slack) {
+    pa_sink_assert_ref(s);
+    pa_sink_assert_io_context(s);
+
+    if (!s->clock_domain)
+        return deadline;
+
+    return pa_clock_domain_align(s->clock_domain, deadline, slack);
+}
+
 /* Called from main context */
 void pa_sink_set_latency_offset(pa_sink *s, int64_t offset) {
     pa_sink_assert_ref(s);
@@ -3315,6 +4149,25 @@ void pa_sink_set_latency_offset(pa_sink *s, int64_t offset) {
         s->thread_info.latency_offset = offset;
 }
 
+/* Called from main context */
+void pa_sink_reset_counters(pa_sink *s) {
+    pa_sink_input *i;
+    uint32_t idx;
+
+    pa_assert_ctl_context();
+    pa_sink_assert_ref(s);
+
+    if (PA_SINK_IS_LINKED(s->state)) {
+        pa_assert_se(pa_asyncmsgq_send(s->asyncmsgq, PA_MSGOBJECT(s), PA_SINK_MESSAGE_RESET_COUNTERS, NULL, 0, NULL) == 0);
+        return;
+    }
+
+    pa_io_counters_reset(&s->thread_info.counters);
+
+    PA_IDXSET_FOREACH(i, s->inputs, idx)
+        pa_io_counters_reset(&i->thread_info.counters);
+}
+
 /* Called from main context */
 size_t pa_sink_get_max_rewind(pa_sink *s) {
     size_t r;
@@ -3656,6 +4509,19 @@ static void pa_sink_volume_change_flush(pa_sink *s) {
     }
 }
 
+static pa_bool_t volume_not_above(const pa_cvolume *a, const pa_cvolume *b) {
+    unsigned c;
+
+    if (a->channels != b->channels)
+        return FALSE;
+
+    for (c = 0; c < a->channels; c++)
+        if (a->values[c] > b->values[c])
+            return FALSE;
+
+    return TRUE;
+}
+
 /* Called from the IO thread. */
 pa_bool_t pa_sink_volume_change_apply(pa_sink *s, pa_usec_t *usec_to_next) {
     pa_usec_t now;
@@ -3673,11 +4539,22 @@ pa_bool_t pa_sink_volume_change_apply(pa_sink *s, pa_usec_t *usec_to_next) {
 
     now = pa_rtclock_now();
 
-    while (s->thread_info.volume_changes && now >= s->thread_info.volume_changes->at) {
+    while (s->thread_info.volume_changes) {
         pa_sink_volume_change *c = s->thread_info.volume_changes;
+
+        /* Once we write anyway, changes that follow within the safety
+         * margin and only lower the volume further are merged into the
+         * same write. Decreases are scheduled early anyway, and this
+         * saves a mixer write and a wakeup. */
+        if (now < c->at &&
+            (!ret ||
+             c->at - now > s->thread_info.volume_change_safety_margin ||
+             !volume_not_above(&c->hw_volume, &s->thread_info.current_hw_volume)))
+            break;
+
         PA_LLIST_REMOVE(pa_sink_volume_change, s->thread_info.volume_changes, c);
-        pa_log_debug("Volume change to %d at %llu was written %llu usec late",
-                     pa_cvolume_avg(&c->hw_volume), (long long unsigned) c->at, (long long unsigned) (now - c->at));
+        pa_log_debug("Volume change to %d at %llu was written %lld usec late",
+                     pa_cvolume_avg(&c->hw_volume), (long long unsigned) c->at, (long long) now - (long long) c->at);
         ret = TRUE;
         s->thread_info.current_hw_volume = c->hw_volume;
         pa_sink_volume_change_free(c);
@@ -3757,67 +4634,49 @@ pa_bool_t pa_sink_set_formats(pa_sink *s, pa_idxset *formats) {
     pa_assert(s);
     pa_assert(formats);
 
-    if (s->set_formats)
+    if (s->set_formats) {
         /* Sink supports setting formats -- let's give it a shot */
-        return s->set_formats(s, formats);
-    else
+        if (!s->set_formats(s, formats))
+            return FALSE;
+
+        if (s->format_matches) {
+            pa_format_match_set_free(s->format_matches);
+            s->format_matches = NULL;
+        }
+
+        return TRUE;
+    } else
         /* Sink doesn't support setting this -- bail out */
         return FALSE;
 }
 
 /* Called from the main thread */
-/* Checks if the sink can accept this format */
-pa_bool_t pa_sink_check_format(pa_sink *s, pa_format_info *f) {
-    pa_idxset *formats = NULL;
-    pa_bool_t ret = FALSE;
-
+static pa_format_match_set* get_format_matches(pa_sink *s) {
     pa_assert(s);
-    pa_assert(f);
 
-    formats = pa_sink_get_formats(s);
+    if (!s->format_matches)
+        s->format_matches = pa_format_match_set_new(pa_sink_get_formats(s));
 
-    if (formats) {
-        pa_format_info *finfo_device;
-        uint32_t i;
-
-        PA_IDXSET_FOREACH(finfo_device, formats, i) {
-            if (pa_format_info_is_compatible(finfo_device, f)) {
-                ret = TRUE;
-                break;
-            }
-        }
+    return s->format_matches;
+}
 
-        pa_idxset_free(formats, (pa_free_cb_t) pa_format_info_free);
-    }
+/* Called from the main thread */
+/* Checks if the sink can accept this format */
+pa_bool_t pa_sink_check_format(pa_sink *s, pa_format_info *f) {
+    pa_assert(s);
+    pa_assert(f);
 
-    return ret;
+    return pa_format_match_set_check(get_format_matches(s), f);
 }
 
 /* Called from the main thread */
 /* Calculates the intersection between formats supported by the sink and
  * in_formats, and returns these, in the order of the sink's formats. */
 pa_idxset* pa_sink_check_formats(pa_sink *s, pa_idxset *in_formats) {
-    pa_idxset *out_formats = pa_idxset_new(NULL, NULL), *sink_formats = NULL;
-    pa_format_info *f_sink, *f_in;
-    uint32_t i, j;
-
     pa_assert(s);
 
     if (!in_formats || pa_idxset_isempty(in_formats))
-        goto done;
-
-    sink_formats = pa_sink_get_formats(s);
-
-    PA_IDXSET_FOREACH(f_sink, sink_formats, i) {
-        PA_IDXSET_FOREACH(f_in, in_formats, j) {
-            if (pa_format_info_is_compatible(f_sink, f_in))
-                pa_idxset_put(out_formats, pa_format_info_copy(f_in), NULL);
-        }
-    }
-
-done:
-    if (sink_formats)
-        pa_idxset_free(sink_formats, (pa_free_cb_t) pa_format_info_free);
+        return pa_idxset_new(NULL, NULL);
 
-    return out_formats;
+    return pa_format_match_set_intersect(get_format_matches(s), in_formats);
 }
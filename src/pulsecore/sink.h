@@ -37,19 +37,31 @@ typedef struct pa_sink_volume_change pa_sink_volume_change;
 #include <pulsecore/core.h>
 #include <pulsecore/idxset.h>
 #include <pulsecore/memchunk.h>
+#include <pulsecore/mix.h>
 #include <pulsecore/source.h>
 #include <pulsecore/module.h>
 #include <pulsecore/asyncmsgq.h>
 #include <pulsecore/msgobject.h>
 #include <pulsecore/rtpoll.h>
+#include <pulsecore/render-pool.h>
 #include <pulsecore/device-port.h>
+#include <pulsecore/format-match.h>
+#include <pulsecore/io-counters.h>
+#include <pulsecore/render-stats.h>
 #include <pulsecore/card.h>
+#include <pulsecore/clock-domain.h>
 #include <pulsecore/queue.h>
 #include <pulsecore/thread-mq.h>
+#include <pulsecore/seqlock.h>
 #include <pulsecore/sink-input.h>
 
 #define PA_MAX_INPUTS_PER_SINK 32
 
+/* The levels of what a sink renders are measured in windows of this
+ * length, and this many of the last windows are kept */
+#define PA_SINK_LEVELS_WINDOW_USEC (10*PA_USEC_PER_MSEC)
+#define PA_SINK_LEVELS_HISTORY 32
+
 /* Returns true if sink is linked: registered and accessible from client side. */
 static inline pa_bool_t PA_SINK_IS_LINKED(pa_sink_state_t x) {
     return x == PA_SINK_RUNNING || x == PA_SINK_IDLE || x == PA_SINK_SUSPENDED;
@@ -58,6 +70,17 @@ static inline pa_bool_t PA_SINK_IS_LINKED(pa_sink_state_t x) {
 /* A generic definition for void callback functions */
 typedef void(*pa_sink_cb_t)(pa_sink *s);
 
+/* Per channel levels, linear, so that 1.0 is full scale */
+typedef struct pa_sink_levels {
+    float peak[PA_CHANNELS_MAX];
+    float rms[PA_CHANNELS_MAX];
+} pa_sink_levels;
+
+typedef struct pa_sink_levels_window {
+    float peak[PA_CHANNELS_MAX];
+    float mean_square[PA_CHANNELS_MAX];
+} pa_sink_levels_window;
+
 struct pa_sink {
     pa_msgobject parent;
 
@@ -74,6 +97,7 @@ struct pa_sink {
 
     pa_module *module;                      /* may be NULL */
     pa_card *card;                          /* may be NULL */
+    pa_clock_domain *clock_domain;          /* may be NULL */
 
     pa_sample_spec sample_spec;
     pa_channel_map channel_map;
@@ -105,6 +129,22 @@ struct pa_sink {
     pa_cvolume saved_volume;
     pa_bool_t saved_save_volume:1;
 
+    /* Soft volumes of inputs have changed and are to be passed on to the
+     * IO thread in one go */
+    pa_defer_event *sync_volumes_event;
+
+    /* The batch pa_sink_input_put_async() appends new inputs to as long
+     * as the IO thread hasn't picked it up, may be NULL */
+    pa_msgobject *attach_batch;
+
+    /* The formats from get_formats(), parsed for matching. Dropped when
+     * the formats are changed with pa_sink_set_formats(). */
+    pa_format_match_set *format_matches;
+
+    /* Timing histograms of the IO thread, NULL unless the core has
+     * render_stats set. Only written from the IO thread. */
+    pa_render_stats *render_stats;
+
     pa_asyncmsgq *asyncmsgq;
 
     pa_memchunk silence;
@@ -116,6 +156,26 @@ struct pa_sink {
     /* The latency offset is inherited from the currently active port */
     int64_t latency_offset;
 
+    /* The latency as last published by the IO thread with
+     * pa_sink_publish_latency(), for the main thread to read without a
+     * round trip through the asyncmsgq */
+    struct {
+        pa_seqlock lock;
+        pa_bool_t valid;
+        pa_usec_t latency;
+        pa_usec_t timestamp;
+    } latency_snapshot;
+
+    /* The levels of what was rendered, measured by the IO thread
+     * while anybody asked for them with pa_sink_levels_start(). seq
+     * counts the windows completed so far. */
+    pa_atomic_t levels_users;
+    struct {
+        pa_seqlock lock;
+        uint32_t seq;
+        pa_sink_levels_window windows[PA_SINK_LEVELS_HISTORY];
+    } levels_snapshot;
+
     unsigned priority;
 
     /* Called when the main loop requests a state change. Called from
@@ -219,7 +279,8 @@ struct pa_sink {
     int (*set_port)(pa_sink *s, pa_device_port *port); /* may be NULL */
 
     /* Called to get the list of formats supported by the sink, sorted
-     * in descending order of preference. */
+     * in descending order of preference. The result is cached for
+     * matching until pa_sink_set_formats() is called. */
     pa_idxset* (*get_formats)(pa_sink *s); /* may be NULL */
 
     /* Called to set the list of formats supported by the sink. Can be
@@ -238,8 +299,36 @@ struct pa_sink {
         pa_sink_state_t state;
         pa_hashmap *inputs;
 
+        /* Scratch space for pa_sink_render(), always large enough for
+         * all entries of the inputs hashmap */
+        pa_mix_info *mix_info;
+        unsigned n_mix_info;
+
         pa_rtpoll *rtpoll;
 
+        /* If set, the inputs are peeked in parallel on these
+         * threads. Rewind requests issued from them are collected in
+         * deferred_rewind and applied once all peeks are done. */
+        pa_render_pool *render_pool;
+        pa_atomic_t deferred_rewind;
+
+        /* Smoothed time spent in pa_sink_render() and
+         * pa_sink_render_into(), in percent of the duration of the
+         * rendered audio. Adaptive resamplers follow it. */
+        unsigned render_load;
+
+        /* The levels window being measured, mean_square still holds
+         * the plain sum of squares here */
+        pa_sink_levels_window levels;
+        size_t levels_frames;
+
+        pa_io_counters counters;
+
+        /* The SCHED_DEADLINE reservation last asked for, 0 unless the
+         * IO thread was made realtime with it */
+        pa_usec_t deadline_runtime;
+        pa_usec_t deadline_period;
+
         pa_cvolume soft_volume;
         pa_bool_t soft_muted:1;
 
@@ -311,6 +400,8 @@ typedef enum pa_sink_message {
     PA_SINK_MESSAGE_SET_STATE,
     PA_SINK_MESSAGE_START_MOVE,
     PA_SINK_MESSAGE_FINISH_MOVE,
+    PA_SINK_MESSAGE_START_MOVE_BATCH,
+    PA_SINK_MESSAGE_FINISH_MOVE_BATCH,
     PA_SINK_MESSAGE_ATTACH,
     PA_SINK_MESSAGE_DETACH,
     PA_SINK_MESSAGE_SET_LATENCY_RANGE,
@@ -324,6 +415,7 @@ typedef enum pa_sink_message {
     PA_SINK_MESSAGE_SET_PORT,
     PA_SINK_MESSAGE_UPDATE_VOLUME_AND_MUTE,
     PA_SINK_MESSAGE_SET_LATENCY_OFFSET,
+    PA_SINK_MESSAGE_RESET_COUNTERS,
     PA_SINK_MESSAGE_MAX
 } pa_sink_message_t;
 
@@ -367,6 +459,10 @@ void pa_sink_new_data_set_alternate_sample_rate(pa_sink_new_data *data, const ui
 void pa_sink_new_data_set_volume(pa_sink_new_data *data, const pa_cvolume *volume);
 void pa_sink_new_data_set_muted(pa_sink_new_data *data, pa_bool_t mute);
 void pa_sink_new_data_set_port(pa_sink_new_data *data, const char *port);
+/* Records where the IO thread runs, see pa_modargs_get_cpu_affinity() */
+void pa_sink_new_data_set_cpu_affinity(pa_sink_new_data *data, const char *cpus);
+/* Puts the sink into the clock domain of that name, see clock-domain.h */
+void pa_sink_new_data_set_clock_domain(pa_sink_new_data *data, const char *name);
 void pa_sink_new_data_done(pa_sink_new_data *data);
 
 /*** To be called exclusively by the sink driver, from main context */
@@ -389,6 +485,7 @@ void pa_sink_unlink(pa_sink* s);
 void pa_sink_set_description(pa_sink *s, const char *description);
 void pa_sink_set_asyncmsgq(pa_sink *s, pa_asyncmsgq *q);
 void pa_sink_set_rtpoll(pa_sink *s, pa_rtpoll *p);
+void pa_sink_set_render_pool(pa_sink *s, pa_render_pool *p);
 
 void pa_sink_set_max_rewind(pa_sink *s, size_t max_rewind);
 void pa_sink_set_max_request(pa_sink *s, size_t max_request);
@@ -414,12 +511,28 @@ unsigned pa_device_init_priority(pa_proplist *p);
 pa_bool_t pa_sink_update_rate(pa_sink *s, uint32_t rate, pa_bool_t passthrough);
 void pa_sink_set_latency_offset(pa_sink *s, int64_t offset);
 
+/* Resets the counters of the sink and of all its inputs */
+void pa_sink_reset_counters(pa_sink *s);
+
 /* The returned value is supposed to be in the time domain of the sound card! */
 pa_usec_t pa_sink_get_latency(pa_sink *s);
+/* Like pa_sink_get_latency(), but only consults the snapshot published
+ * by the IO thread. Returns FALSE if there is none. */
+pa_bool_t pa_sink_get_latency_nowait(pa_sink *s, pa_usec_t *usec);
 pa_usec_t pa_sink_get_requested_latency(pa_sink *s);
 void pa_sink_get_latency_range(pa_sink *s, pa_usec_t *min_latency, pa_usec_t *max_latency);
 pa_usec_t pa_sink_get_fixed_latency(pa_sink *s);
 
+/* Measuring levels costs the IO thread a little, so it is only done
+ * while it was started more often than stopped. pa_sink_levels_start()
+ * returns the sequence number to pass to pa_sink_get_levels() first,
+ * which combines the windows completed since into l and advances *seq.
+ * Only the last PA_SINK_LEVELS_HISTORY windows are looked at. Returns
+ * FALSE if no window was completed since. */
+uint32_t pa_sink_levels_start(pa_sink *s);
+void pa_sink_levels_stop(pa_sink *s);
+pa_bool_t pa_sink_get_levels(pa_sink *s, uint32_t *seq, pa_sink_levels *l);
+
 size_t pa_sink_get_max_rewind(pa_sink *s);
 size_t pa_sink_get_max_request(pa_sink *s);
 
@@ -441,6 +554,11 @@ void pa_sink_enter_passthrough(pa_sink *s);
 void pa_sink_leave_passthrough(pa_sink *s);
 
 void pa_sink_set_volume(pa_sink *sink, const pa_cvolume *volume, pa_bool_t sendmsg, pa_bool_t save);
+/* The volume of i changed from old_volume, which did not have any effect
+ * on the other inputs. Does what pa_sink_set_volume(i->sink, NULL, TRUE,
+ * save) would, unless that would change the sink's volume. Returns FALSE
+ * then, and pa_sink_set_volume() needs to be called. */
+pa_bool_t pa_sink_update_flat_volume_for_input(pa_sink_input *i, const pa_cvolume *old_volume, pa_bool_t save);
 const pa_cvolume *pa_sink_get_volume(pa_sink *sink, pa_bool_t force_refresh);
 
 void pa_sink_set_mute(pa_sink *sink, pa_bool_t mute, pa_bool_t save);
@@ -488,6 +606,16 @@ void pa_sink_set_max_request_within_thread(pa_sink *s, size_t max_request);
 void pa_sink_set_latency_range_within_thread(pa_sink *s, pa_usec_t min_latency, pa_usec_t max_latency);
 void pa_sink_set_fixed_latency_within_thread(pa_sink *s, pa_usec_t latency);
 
+/* Returns the time to wake up at for something that is due at
+ * deadline, aligned to the other wakeups of the clock domain. At most
+ * slack early, and deadline itself if the sink has no domain. */
+pa_usec_t pa_sink_align_wakeup_within_thread(pa_sink *s, pa_usec_t deadline, pa_usec_t slack);
+
+/* Makes the IO thread realtime, see pa_make_realtime(). With
+ * realtime-deadline set it asks for SCHED_DEADLINE first, and keeps
+ * the reservation in line with the latency and the render cost. */
+void pa_sink_make_realtime_within_thread(pa_sink *s, int rtprio);
+
 void pa_sink_update_volume_and_mute(pa_sink *s);
 
 pa_bool_t pa_sink_volume_change_apply(pa_sink *s, pa_usec_t *usec_to_next);
@@ -502,6 +630,13 @@ void pa_sink_invalidate_requested_latency(pa_sink *s, pa_bool_t dynamic);
 
 pa_usec_t pa_sink_get_latency_within_thread(pa_sink *s);
 
+/* To be called by sink implementations that report their latency
+ * from the IO thread, e.g. after each write. The snapshot is used by
+ * pa_sink_get_latency() until it is invalidated again, which happens
+ * on state changes and rewinds. */
+void pa_sink_publish_latency(pa_sink *s, pa_usec_t usec);
+void pa_sink_invalidate_latency(pa_sink *s);
+
 /* Verify that we called in IO context (aka 'thread context), or that
  * the sink is not yet set up, i.e. the thread not set up yet. See
  * pa_assert_io_context() in thread-mq.h for more information. */
@@ -30,6 +30,7 @@
 #include <sys/types.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/stat.h>
 
 #ifdef HAVE_SYS_UN_H
@@ -67,6 +68,7 @@ int deny_severity = LOG_WARNING;
 #include <pulsecore/core-error.h>
 #include <pulsecore/refcnt.h>
 #include <pulsecore/arpa-inet.h>
+#include <pulsecore/strbuf.h>
 
 #include "socket-server.h"
 
@@ -89,6 +91,17 @@ struct pa_socket_server {
     } type;
 };
 
+/* The listening UNIX sockets that are carried over a daemon restart,
+ * only ever touched from the main thread */
+struct handoff_socket {
+    char *filename;
+    int fd;
+};
+
+static struct handoff_socket handoff[PA_SOCKET_SERVER_HANDOFF_MAX];
+static unsigned n_handoff = 0;
+static pa_bool_t handoff_keep = FALSE;
+
 static void callback(pa_mainloop_api *mainloop, pa_io_event *e, int fd, pa_io_event_flags_t f, void *userdata) {
     pa_socket_server *s = userdata;
     pa_iochannel *io;
@@ -221,12 +234,56 @@ fail:
     return NULL;
 }
 
+pa_socket_server* pa_socket_server_new_unix_handoff(pa_mainloop_api *m, const char *filename) {
+    struct sockaddr_un sa;
+    socklen_t sa_len = sizeof(sa);
+    pa_socket_server *s;
+    unsigned i;
+    int fd;
+
+    pa_assert(m);
+    pa_assert(filename);
+
+    for (i = 0; i < n_handoff; i++)
+        if (pa_streq(handoff[i].filename, filename))
+            break;
+
+    if (i >= n_handoff)
+        return NULL;
+
+    fd = handoff[i].fd;
+    pa_xfree(handoff[i].filename);
+    handoff[i] = handoff[--n_handoff];
+
+    /* Make sure this is still what the old daemon was listening on */
+    if (getsockname(fd, (struct sockaddr*) &sa, &sa_len) < 0 ||
+        sa.sun_family != AF_UNIX ||
+        strncmp(sa.sun_path, filename, sizeof(sa.sun_path)) != 0) {
+        pa_log_warn("Handed over socket for '%s' is not bound to it, ignoring.", filename);
+        pa_close(fd);
+        return NULL;
+    }
+
+    pa_assert_se(s = pa_socket_server_new(m, fd));
+
+    s->filename = pa_xstrdup(filename);
+    s->type = SOCKET_SERVER_UNIX;
+
+    pa_log_info("Continuing to listen on handed over socket '%s'.", filename);
+
+    return s;
+}
+
 #else /* HAVE_SYS_UN_H */
 
 pa_socket_server* pa_socket_server_new_unix(pa_mainloop_api *m, const char *filename) {
     return NULL;
 }
 
+pa_socket_server* pa_socket_server_new_unix_handoff(pa_mainloop_api *m, const char *filename) {
+    return NULL;
+}
+
 #endif /* HAVE_SYS_UN_H */
 
 pa_socket_server* pa_socket_server_new_ipv4(pa_mainloop_api *m, uint32_t address, uint16_t port, pa_bool_t fallback, const char *tcpwrap_service) {
@@ -423,12 +480,20 @@ pa_socket_server* pa_socket_server_new_ipv6_string(pa_mainloop_api *m, const cha
 static void socket_server_free(pa_socket_server*s) {
     pa_assert(s);
 
-    if (s->filename) {
-        unlink(s->filename);
-        pa_xfree(s->filename);
-    }
+    if (handoff_keep && s->type == SOCKET_SERVER_UNIX && n_handoff < PA_SOCKET_SERVER_HANDOFF_MAX) {
+        /* Keep the socket listening and its file in place, so that
+         * clients queue up until the next daemon accepts them */
+        handoff[n_handoff].filename = s->filename;
+        handoff[n_handoff].fd = s->fd;
+        n_handoff++;
+    } else {
+        if (s->filename) {
+            unlink(s->filename);
+            pa_xfree(s->filename);
+        }
 
-    pa_close(s->fd);
+        pa_close(s->fd);
+    }
 
     pa_xfree(s->tcpwrap_service);
 
@@ -554,3 +619,87 @@ char *pa_socket_server_get_address(pa_socket_server *s, char *c, size_t l) {
             return NULL;
     }
 }
+
+void pa_socket_server_handoff_begin(void) {
+    handoff_keep = TRUE;
+}
+
+char *pa_socket_server_handoff_export(void) {
+    pa_strbuf *buf;
+    unsigned i;
+
+    buf = pa_strbuf_new();
+
+    for (i = 0; i < n_handoff; i++) {
+        /* The sockets have to survive the exec() */
+        if (fcntl(handoff[i].fd, F_SETFD, 0) < 0) {
+            pa_log_warn("Failed to clear FD_CLOEXEC: %s", pa_cstrerror(errno));
+            continue;
+        }
+
+        pa_strbuf_printf(buf, "%i:%s\n", handoff[i].fd, handoff[i].filename);
+    }
+
+    /* From now on the sockets belong to whoever gets the string */
+    for (i = 0; i < n_handoff; i++)
+        pa_xfree(handoff[i].filename);
+
+    n_handoff = 0;
+    handoff_keep = FALSE;
+
+    return pa_strbuf_tostring_free(buf);
+}
+
+unsigned pa_socket_server_handoff_import(const char *str, int *fds, unsigned n_fds) {
+    const char *state = NULL;
+    char *line;
+    unsigned n = 0;
+
+    pa_assert(str);
+    pa_assert(fds || n_fds == 0);
+
+    while ((line = pa_split(str, "\n", &state))) {
+        char *colon;
+        int32_t fd;
+
+        if (n >= n_fds || n_handoff >= PA_SOCKET_SERVER_HANDOFF_MAX)
+            goto next;
+
+        if (!(colon = strchr(line, ':')) || !colon[1])
+            goto next;
+
+        *colon = 0;
+
+        if (pa_atoi(line, &fd) < 0 || fd <= 2)
+            goto next;
+
+        pa_make_fd_cloexec(fd);
+
+        handoff[n_handoff].filename = pa_xstrdup(colon + 1);
+        handoff[n_handoff].fd = fd;
+        n_handoff++;
+
+        fds[n++] = fd;
+
+    next:
+        pa_xfree(line);
+    }
+
+    return n;
+}
+
+void pa_socket_server_handoff_done(void) {
+    unsigned i;
+
+    /* Whatever the new configuration didn't pick up is closed for good */
+    for (i = 0; i < n_handoff; i++) {
+        pa_log_info("Socket '%s' was handed over but isn't used anymore, closing.", handoff[i].filename);
+
+        unlink(handoff[i].filename);
+        pa_close(handoff[i].fd);
+        pa_xfree(handoff[i].filename);
+    }
+
+    n_handoff = 0;
+    handoff_keep = FALSE;
+}
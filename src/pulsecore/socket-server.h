@@ -53,4 +53,31 @@ void pa_socket_server_set_callback(pa_socket_server*s, pa_socket_server_on_conne
 
 char *pa_socket_server_get_address(pa_socket_server *s, char *c, size_t l);
 
+/* Listening UNIX sockets can be carried over when the daemon executes
+ * a new instance of itself, so that clients connecting meanwhile are
+ * queued instead of refused and don't spawn a daemon of their own.
+ *
+ * In the old process, after pa_socket_server_handoff_begin() freed
+ * UNIX socket servers leave their socket open and its file in place.
+ * pa_socket_server_handoff_export() then prepares these for exec()
+ * and describes them in a string for the new process, which owns them
+ * from then on.
+ *
+ * The new process passes that string to
+ * pa_socket_server_handoff_import(), which returns the fds in fds[]
+ * so that they can be spared from closing. A module that sets up a
+ * socket server on one of the paths gets the inherited socket from
+ * pa_socket_server_new_unix_handoff(), which returns NULL for all
+ * others. pa_socket_server_handoff_done() closes what is left after
+ * startup. */
+
+#define PA_SOCKET_SERVER_HANDOFF_MAX 16
+
+void pa_socket_server_handoff_begin(void);
+char *pa_socket_server_handoff_export(void);
+
+unsigned pa_socket_server_handoff_import(const char *str, int *fds, unsigned n_fds);
+pa_socket_server* pa_socket_server_new_unix_handoff(pa_mainloop_api *m, const char *filename);
+void pa_socket_server_handoff_done(void);
+
 #endif
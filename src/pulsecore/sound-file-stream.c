@@ -25,6 +25,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
@@ -32,6 +33,7 @@
 #include <sndfile.h>
 
 #include <pulse/xmalloc.h>
+#include <pulse/timeval.h>
 #include <pulse/util.h>
 
 #include <pulsecore/core-error.h>
@@ -41,11 +43,19 @@
 #include <pulsecore/core-util.h>
 #include <pulsecore/mix.h>
 #include <pulsecore/sndfile-util.h>
+#include <pulsecore/atomic.h>
+#include <pulsecore/semaphore.h>
+#include <pulsecore/shmring.h>
+#include <pulsecore/thread.h>
 
 #include "sound-file-stream.h"
 
 #define MEMBLOCKQ_MAXLENGTH (16*1024*1024)
 
+/* How much the reader thread decodes ahead of the IO thread */
+#define RING_USEC (2*PA_USEC_PER_SEC)
+#define READ_USEC (100*PA_USEC_PER_MSEC)
+
 typedef struct file_stream {
     pa_msgobject parent;
     pa_core *core;
@@ -53,9 +63,21 @@ typedef struct file_stream {
 
     SNDFILE *sndfile;
     sf_count_t (*readf_function)(SNDFILE *sndfile, void *ptr, sf_count_t frames);
+    size_t frame_size;
+
+    /* The file is decoded by a reader thread into this ring, the IO
+     * thread only copies from it and never touches the disk. */
+    pa_thread *thread;
+    pa_shmring *ring;
+    pa_semaphore *semaphore;
+    size_t read_size;
+    pa_atomic_t reader_waiting;
+    pa_atomic_t eof;
+    pa_atomic_t quit;
 
     /* We need this memblockq here to easily fulfill rewind requests
-     * (even beyond the file start!) */
+     * (even beyond the file start!). It only holds what has been
+     * played and can still be rewound. */
     pa_memblockq *memblockq;
 } file_stream;
 
@@ -66,6 +88,82 @@ enum {
 PA_DEFINE_PRIVATE_CLASS(file_stream, pa_msgobject);
 #define FILE_STREAM(o) (file_stream_cast(o))
 
+/* Called from IO thread context */
+static void wakeup_reader(file_stream *u) {
+
+    /* Only post if the reader is about to sleep, otherwise it will see
+     * the space anyway */
+    if (pa_atomic_cmpxchg(&u->reader_waiting, 1, 0))
+        pa_semaphore_post(u->semaphore);
+}
+
+/* Called from reader thread context */
+static void wait_for_space(file_stream *u) {
+    pa_atomic_store(&u->reader_waiting, 1);
+
+    if (pa_shmring_get_length(u->ring) < pa_shmring_get_size(u->ring) || pa_atomic_load(&u->quit)) {
+
+        /* Someone might have posted in the meantime, that has to be
+         * consumed */
+        if (!pa_atomic_cmpxchg(&u->reader_waiting, 1, 0))
+            pa_semaphore_wait(u->semaphore);
+
+        return;
+    }
+
+    pa_semaphore_wait(u->semaphore);
+}
+
+/* Called from reader thread context */
+static void reader_thread_func(void *userdata) {
+    file_stream *u = userdata;
+    uint8_t *buf;
+
+    buf = pa_xmalloc(u->read_size);
+
+    while (!pa_atomic_load(&u->quit)) {
+        sf_count_t n;
+        size_t l, written = 0;
+
+        if (u->readf_function) {
+            n = u->readf_function(u->sndfile, buf, (sf_count_t) (u->read_size / u->frame_size));
+            l = n > 0 ? (size_t) n * u->frame_size : 0;
+        } else {
+            n = sf_read_raw(u->sndfile, buf, (sf_count_t) u->read_size);
+            l = n > 0 ? ((size_t) n / u->frame_size) * u->frame_size : 0;
+        }
+
+        if (l <= 0)
+            break;
+
+        while (written < l && !pa_atomic_load(&u->quit)) {
+            written += pa_shmring_write(u->ring, buf + written, l - written);
+
+            if (written < l)
+                wait_for_space(u);
+        }
+    }
+
+    pa_xfree(buf);
+
+    pa_atomic_store(&u->eof, 1);
+}
+
+/* Called from main context */
+static void stop_reader(file_stream *u) {
+    pa_assert(u);
+
+    if (!u->thread)
+        return;
+
+    pa_atomic_store(&u->quit, 1);
+    if (pa_atomic_cmpxchg(&u->reader_waiting, 1, 0))
+        pa_semaphore_post(u->semaphore);
+
+    pa_thread_free(u->thread);
+    u->thread = NULL;
+}
+
 /* Called from main context */
 static void file_stream_unlink(file_stream *u) {
     pa_assert(u);
@@ -86,9 +184,17 @@ static void file_stream_free(pa_object *o) {
     file_stream *u = FILE_STREAM(o);
     pa_assert(u);
 
+    stop_reader(u);
+
     if (u->memblockq)
         pa_memblockq_free(u->memblockq);
 
+    if (u->ring)
+        pa_shmring_free(u->ring);
+
+    if (u->semaphore)
+        pa_semaphore_free(u->semaphore);
+
     if (u->sndfile)
         sf_close(u->sndfile);
 
@@ -149,9 +255,9 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t length, pa_memchunk *chunk
 
     for (;;) {
         pa_memchunk tchunk;
-        size_t fs;
-        void *p;
-        sf_count_t n;
+        pa_bool_t eof;
+        size_t l;
+        uint8_t *p;
 
         if (pa_memblockq_peek(u->memblockq, chunk) >= 0) {
             chunk->length = PA_MIN(chunk->length, length);
@@ -159,33 +265,42 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t length, pa_memchunk *chunk
             return 0;
         }
 
-        if (!u->sndfile)
-            break;
+        /* Read the flag first, whatever was written before it is in the
+         * ring then */
+        eof = !!pa_atomic_load(&u->eof);
 
-        tchunk.memblock = pa_memblock_new(i->sink->core->mempool, length);
-        tchunk.index = 0;
+        l = PA_MIN(length, pa_shmring_get_length(u->ring));
+        l = (l / u->frame_size) * u->frame_size;
 
-        p = pa_memblock_acquire(tchunk.memblock);
+        if (l <= 0) {
+            if (eof)
+                break;
 
-        if (u->readf_function) {
-            fs = pa_frame_size(&i->sample_spec);
-            n = u->readf_function(u->sndfile, p, (sf_count_t) (length/fs));
-        } else {
-            fs = 1;
-            n = sf_read_raw(u->sndfile, p, (sf_count_t) length);
+            /* The reader fell behind, play silence for now */
+            return -1;
         }
 
-        pa_memblock_release(tchunk.memblock);
+        tchunk.memblock = pa_memblock_new(i->sink->core->mempool, l);
+        tchunk.index = 0;
+        tchunk.length = 0;
 
-        if (n <= 0) {
-            pa_memblock_unref(tchunk.memblock);
+        p = pa_memblock_acquire(tchunk.memblock);
 
-            sf_close(u->sndfile);
-            u->sndfile = NULL;
-            break;
+        while (tchunk.length < l) {
+            const void *d;
+            size_t n;
+
+            pa_assert_se(d = pa_shmring_peek(u->ring, &n));
+            n = PA_MIN(n, l - tchunk.length);
+
+            memcpy(p + tchunk.length, d, n);
+            pa_shmring_drop(u->ring, n);
+            tchunk.length += n;
         }
 
-        tchunk.length = (size_t) n * fs;
+        pa_memblock_release(tchunk.memblock);
+
+        wakeup_reader(u);
 
         pa_memblockq_push(u->memblockq, &tchunk);
         pa_memblock_unref(tchunk.memblock);
@@ -250,6 +365,12 @@ int pa_play_file(
     u->sink_input = NULL;
     u->sndfile = NULL;
     u->readf_function = NULL;
+    u->thread = NULL;
+    u->ring = NULL;
+    u->semaphore = NULL;
+    pa_atomic_store(&u->reader_waiting, 0);
+    pa_atomic_store(&u->eof, 0);
+    pa_atomic_store(&u->quit, 0);
     u->memblockq = NULL;
 
     if ((fd = pa_open_cloexec(fname, O_RDONLY, 0)) < 0) {
@@ -257,10 +378,7 @@ int pa_play_file(
         goto fail;
     }
 
-    /* FIXME: For now we just use posix_fadvise to avoid page faults
-     * when accessing the file data. Eventually we should move the
-     * file reader into the main event loop and pass the data over the
-     * asyncmsgq. */
+    /* The reader thread reads sequentially, let the kernel know */
 
 #ifdef HAVE_POSIX_FADVISE
     if (posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL) < 0) {
@@ -296,6 +414,15 @@ int pa_play_file(
     }
 
     u->readf_function = pa_sndfile_readf_function(&ss);
+    u->frame_size = pa_frame_size(&ss);
+    u->read_size = pa_usec_to_bytes(READ_USEC, &ss);
+
+    if (!(u->ring = pa_shmring_new_private(pa_usec_to_bytes(RING_USEC, &ss)))) {
+        pa_log("Failed to allocate read ahead ring.");
+        goto fail;
+    }
+
+    u->semaphore = pa_semaphore_new(0);
 
     pa_sink_input_new_data_init(&data);
     pa_sink_input_new_data_set_sink(&data, sink, FALSE);
@@ -307,6 +434,13 @@ int pa_play_file(
     pa_proplist_sets(data.proplist, PA_PROP_MEDIA_FILENAME, fname);
     pa_sndfile_init_proplist(u->sndfile, data.proplist);
 
+    /* From now on the file belongs to the reader thread */
+    if (!(u->thread = pa_thread_new("file-reader", reader_thread_func, u))) {
+        pa_log("Failed to create reader thread.");
+        pa_sink_input_new_data_done(&data);
+        goto fail;
+    }
+
     pa_sink_input_new(&u->sink_input, sink->core, &data);
     pa_sink_input_new_data_done(&data);
 
@@ -23,19 +23,29 @@
 #include <config.h>
 #endif
 
+#include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
 
 #include <sndfile.h>
 
 #include <pulse/sample.h>
+#include <pulse/xmalloc.h>
 #include <pulsecore/log.h>
 #include <pulsecore/macro.h>
 #include <pulsecore/core-error.h>
 #include <pulsecore/core-util.h>
 #include <pulsecore/core-scache.h>
+#include <pulsecore/idxset.h>
 #include <pulsecore/sndfile-util.h>
+#include <pulsecore/tagstruct.h>
 
 #include "sound-file.h"
 
@@ -163,3 +173,340 @@ int pa_sound_file_too_big_to_cache(const char *fname) {
 
     return 0;
 }
+
+#ifdef HAVE_SYS_MMAN_H
+
+#define CACHE_DIR "sample-cache"
+#define CACHE_MAGIC "PASMPL01"
+
+/* At the start of each cache file, followed by the path of the source
+ * file and the serialized proplist. The data starts at a page boundary,
+ * right before it the data offset is repeated, so that the mapping can
+ * be found from the data pointer alone. The layout is native, the
+ * directory is per machine. */
+struct cache_header {
+    char magic[8];
+    uint64_t data_offset;
+    uint64_t length;
+    int64_t mtime;
+    uint64_t size;
+    pa_sample_spec sample_spec;
+    pa_channel_map channel_map;
+    uint32_t path_length;
+    uint32_t proplist_length;
+};
+
+static char *cache_path(const char *fname) {
+    char *dir, *fn;
+
+    if (!(dir = pa_state_path(CACHE_DIR, TRUE)))
+        return NULL;
+
+    if (pa_make_secure_dir(dir, 0700U, (uid_t) -1, (gid_t) -1, FALSE) < 0) {
+        pa_log_debug("Failed to create %s: %s", dir, pa_cstrerror(errno));
+        pa_xfree(dir);
+        return NULL;
+    }
+
+    /* Collisions are caught by the path stored in the file */
+    fn = pa_sprintf_malloc("%s" PA_PATH_SEP "%08x", dir, pa_idxset_string_hash_func(fname));
+    pa_xfree(dir);
+
+    return fn;
+}
+
+static size_t cache_data_offset(size_t path_length, size_t proplist_length) {
+    return PA_PAGE_ALIGN(sizeof(struct cache_header) + path_length + proplist_length + sizeof(uint64_t));
+}
+
+static void cache_unmap(void *data) {
+    struct cache_header *h;
+    uint64_t offset;
+
+    memcpy(&offset, (uint8_t*) data - sizeof(offset), sizeof(offset));
+    h = (struct cache_header*) ((uint8_t*) data - offset);
+
+    pa_assert_se(munmap(h, (size_t) (h->data_offset + h->length)) == 0);
+}
+
+static int cache_map(
+        pa_mempool *pool,
+        const char *cfn,
+        const char *fname,
+        const struct stat *st,
+        pa_sample_spec *ss,
+        pa_channel_map *map,
+        pa_memchunk *chunk,
+        pa_proplist *p) {
+
+    struct stat cst;
+    struct cache_header *h = NULL;
+    size_t map_size = 0, l;
+    uint64_t offset;
+    int fd, ret = -1;
+
+    if ((fd = pa_open_cloexec(cfn, O_RDONLY, 0)) < 0)
+        return -1;
+
+    if (fstat(fd, &cst) < 0 || (size_t) cst.st_size < PA_PAGE_SIZE)
+        goto finish;
+
+    map_size = (size_t) cst.st_size;
+
+    if ((h = mmap(NULL, map_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        h = NULL;
+        goto finish;
+    }
+
+    l = strlen(fname);
+
+    if (memcmp(h->magic, CACHE_MAGIC, sizeof(h->magic)) != 0 ||
+        h->mtime != (int64_t) st->st_mtime ||
+        h->size != (uint64_t) st->st_size ||
+        h->path_length != l ||
+        h->proplist_length > map_size ||
+        h->data_offset != cache_data_offset(l, h->proplist_length) ||
+        h->data_offset + h->length != map_size ||
+        h->length <= 0 || h->length > PA_SCACHE_ENTRY_SIZE_MAX ||
+        !pa_sample_spec_valid(&h->sample_spec) ||
+        !pa_channel_map_valid(&h->channel_map) ||
+        memcmp((const uint8_t*) h + sizeof(struct cache_header), fname, l) != 0)
+        goto finish;
+
+    memcpy(&offset, (const uint8_t*) h + h->data_offset - sizeof(offset), sizeof(offset));
+    if (offset != h->data_offset)
+        goto finish;
+
+    if (p && h->proplist_length > 0) {
+        pa_tagstruct *t;
+
+        t = pa_tagstruct_new((const uint8_t*) h + sizeof(struct cache_header) + l, h->proplist_length);
+        if (pa_tagstruct_get_proplist(t, p) < 0) {
+            pa_tagstruct_free(t);
+            goto finish;
+        }
+        pa_tagstruct_free(t);
+    }
+
+    *ss = h->sample_spec;
+    if (map)
+        *map = h->channel_map;
+
+    /* Stays mapped for as long as the block is referenced */
+    chunk->memblock = pa_memblock_new_user(pool, (uint8_t*) h + h->data_offset, (size_t) h->length, cache_unmap, TRUE);
+    chunk->index = 0;
+    chunk->length = (size_t) h->length;
+
+    h = NULL;
+    ret = 0;
+
+finish:
+    if (h)
+        munmap(h, map_size);
+
+    pa_close(fd);
+
+    return ret;
+}
+
+static void cache_write(
+        const char *cfn,
+        const char *fname,
+        const struct stat *st,
+        const pa_sample_spec *ss,
+        const pa_channel_map *map,
+        const pa_memchunk *chunk,
+        pa_proplist *p) {
+
+    struct cache_header h;
+    pa_tagstruct *t = NULL;
+    const uint8_t *pl = NULL;
+    size_t pl_length = 0;
+    char *tmp;
+    FILE *f;
+    const void *d;
+    pa_bool_t ok;
+
+    if (p && !pa_proplist_isempty(p)) {
+        t = pa_tagstruct_new(NULL, 0);
+        pa_tagstruct_put_proplist(t, p);
+        pl = pa_tagstruct_data(t, &pl_length);
+    }
+
+    pa_zero(h);
+    memcpy(h.magic, CACHE_MAGIC, sizeof(h.magic));
+    h.path_length = (uint32_t) strlen(fname);
+    h.proplist_length = (uint32_t) pl_length;
+    h.data_offset = cache_data_offset(h.path_length, pl_length);
+    h.length = chunk->length;
+    h.mtime = (int64_t) st->st_mtime;
+    h.size = (uint64_t) st->st_size;
+    h.sample_spec = *ss;
+    if (map)
+        h.channel_map = *map;
+    else
+        pa_channel_map_init_extend(&h.channel_map, ss->channels, PA_CHANNEL_MAP_DEFAULT);
+
+    /* Another instance might be mapping the old one right now */
+    tmp = pa_sprintf_malloc("%s.tmp-%lu", cfn, (unsigned long) getpid());
+
+    if (!(f = pa_fopen_cloexec(tmp, "w"))) {
+        pa_xfree(tmp);
+        if (t)
+            pa_tagstruct_free(t);
+        return;
+    }
+
+    ok = fwrite(&h, sizeof(h), 1, f) == 1 &&
+        fwrite(fname, 1, h.path_length, f) == h.path_length &&
+        (!pl_length || fwrite(pl, 1, pl_length, f) == pl_length) &&
+        fseek(f, (long) (h.data_offset - sizeof(h.data_offset)), SEEK_SET) == 0 &&
+        fwrite(&h.data_offset, sizeof(h.data_offset), 1, f) == 1;
+
+    if (ok) {
+        d = pa_memblock_acquire(chunk->memblock);
+        ok = fwrite((const uint8_t*) d + chunk->index, 1, chunk->length, f) == chunk->length;
+        pa_memblock_release(chunk->memblock);
+    }
+
+    if (fclose(f) != 0)
+        ok = FALSE;
+
+    if (!ok || rename(tmp, cfn) < 0) {
+        pa_log_debug("Failed to write sample cache file %s: %s", cfn, pa_cstrerror(errno));
+        unlink(tmp);
+    }
+
+    pa_xfree(tmp);
+
+    if (t)
+        pa_tagstruct_free(t);
+}
+
+#endif
+
+int pa_sound_file_load_cached(
+        pa_mempool *pool,
+        const char *fname,
+        pa_sample_spec *ss,
+        pa_channel_map *map,
+        pa_memchunk *chunk,
+        pa_proplist *p) {
+
+#ifdef HAVE_SYS_MMAN_H
+    struct stat st;
+    char *cfn;
+    pa_memchunk mapped;
+    pa_proplist *tags;
+    int ret = -1;
+
+    pa_assert(fname);
+    pa_assert(ss);
+    pa_assert(chunk);
+
+    if (stat(fname, &st) < 0 || !(cfn = cache_path(fname)))
+        return pa_sound_file_load(pool, fname, ss, map, chunk, p);
+
+    /* Only what the file itself says goes into the cache */
+    tags = pa_proplist_new();
+
+    if (cache_map(pool, cfn, fname, &st, ss, map, chunk, tags) >= 0) {
+        pa_log_debug("Mapped decoded %s from the sample cache.", fname);
+        ret = 0;
+        goto finish;
+    }
+
+    if (pa_sound_file_load(pool, fname, ss, map, chunk, tags) < 0)
+        goto finish;
+
+    cache_write(cfn, fname, &st, ss, map, chunk, tags);
+
+    /* Swap the heap copy for the mapping right away */
+    pa_memchunk_reset(&mapped);
+    if (cache_map(pool, cfn, fname, &st, ss, map, &mapped, NULL) >= 0) {
+        pa_memblock_unref(chunk->memblock);
+        *chunk = mapped;
+    }
+
+    ret = 0;
+
+finish:
+    if (ret >= 0 && p)
+        pa_proplist_update(p, PA_UPDATE_REPLACE, tags);
+
+    pa_proplist_free(tags);
+    pa_xfree(cfn);
+
+    return ret;
+#else
+    return pa_sound_file_load(pool, fname, ss, map, chunk, p);
+#endif
+}
+
+void pa_sound_file_cache_upload(pa_mempool *pool, const pa_sample_spec *ss, const pa_channel_map *map, pa_memchunk *chunk) {
+#ifdef HAVE_SYS_MMAN_H
+    struct stat st;
+    char *key, *cfn;
+    const uint8_t *d, *e;
+    uint32_t hash = 2166136261U;
+    pa_sample_spec mss;
+    pa_memchunk mapped;
+    size_t i;
+    pa_bool_t same;
+
+    pa_assert(pool);
+    pa_assert(ss);
+    pa_assert(chunk);
+    pa_assert(chunk->memblock);
+
+    /* Not worth a file and at least two pages of mapping */
+    if (chunk->length < PA_PAGE_SIZE)
+        return;
+
+    /* FNV-1a over the data, there is no file name to go by */
+    d = (const uint8_t*) pa_memblock_acquire(chunk->memblock) + chunk->index;
+    for (i = 0; i < chunk->length; i++)
+        hash = (hash ^ d[i]) * 16777619U;
+    pa_memblock_release(chunk->memblock);
+
+    key = pa_sprintf_malloc("upload:%08x:%lu", hash, (unsigned long) chunk->length);
+
+    if (!(cfn = cache_path(key))) {
+        pa_xfree(key);
+        return;
+    }
+
+    /* Only the size is checked against this */
+    pa_zero(st);
+    st.st_size = (off_t) chunk->length;
+
+    pa_memchunk_reset(&mapped);
+    if (cache_map(pool, cfn, key, &st, &mss, NULL, &mapped, NULL) < 0) {
+        cache_write(cfn, key, &st, ss, map, chunk, NULL);
+
+        if (cache_map(pool, cfn, key, &st, &mss, NULL, &mapped, NULL) < 0)
+            goto finish;
+    }
+
+    /* The hash might collide */
+    d = (const uint8_t*) pa_memblock_acquire(chunk->memblock) + chunk->index;
+    e = pa_memblock_acquire(mapped.memblock);
+    same = pa_sample_spec_equal(&mss, ss) && mapped.length == chunk->length && memcmp(d, e, chunk->length) == 0;
+    pa_memblock_release(mapped.memblock);
+    pa_memblock_release(chunk->memblock);
+
+    if (!same) {
+        pa_memblock_unref(mapped.memblock);
+        goto finish;
+    }
+
+    pa_log_debug("Mapped uploaded sample from the sample cache.");
+
+    pa_memblock_unref(chunk->memblock);
+    *chunk = mapped;
+
+finish:
+    pa_xfree(cfn);
+    pa_xfree(key);
+#endif
+}
@@ -28,6 +28,17 @@
 
 int pa_sound_file_load(pa_mempool *pool, const char *fname, pa_sample_spec *ss, pa_channel_map *map, pa_memchunk *chunk, pa_proplist *p);
 
+/* Like pa_sound_file_load(), but keeps the decoded data in a file in
+ * the state directory and returns a read-only mapping of it, which is
+ * paged in as needed and reused as long as the file is unchanged. */
+int pa_sound_file_load_cached(pa_mempool *pool, const char *fname, pa_sample_spec *ss, pa_channel_map *map, pa_memchunk *chunk, pa_proplist *p);
+
+/* Swaps the data of a sample that doesn't come from a file, like an
+ * upload, for a mapping of a cache file keyed by its contents, so that
+ * identical uploads share their pages. Leaves the chunk alone if that
+ * fails. */
+void pa_sound_file_cache_upload(pa_mempool *pool, const pa_sample_spec *ss, const pa_channel_map *map, pa_memchunk *chunk);
+
 int pa_sound_file_too_big_to_cache(const char *fname);
 
 #endif
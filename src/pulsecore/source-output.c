@@ -31,6 +31,7 @@
 #include <pulse/xmalloc.h>
 #include <pulse/util.h>
 #include <pulse/internal.h>
+#include <pulse/rtclock.h>
 
 #include <pulsecore/mix.h>
 #include <pulsecore/core-subscribe.h>
@@ -463,11 +464,16 @@ int pa_source_output_new(
     o->thread_info.attached = FALSE;
     o->thread_info.sample_spec = o->sample_spec;
     o->thread_info.resampler = resampler;
+    o->thread_info.resampler_borrowed = FALSE;
     o->thread_info.soft_volume = o->soft_volume;
     o->thread_info.muted = o->muted;
     o->thread_info.requested_source_latency = (pa_usec_t) -1;
     o->thread_info.direct_on_input = o->direct_on_input;
 
+    pa_seqlock_init(&o->latency_snapshot.lock);
+    o->latency_snapshot.queued = 0;
+    o->latency_snapshot.requested_latency = (pa_usec_t) -1;
+
     o->thread_info.delay_memblockq = pa_memblockq_new(
             "source output delay_memblockq",
             0,
@@ -712,12 +718,128 @@ pa_usec_t pa_source_output_get_latency(pa_source_output *o, pa_usec_t *source_la
     return r[0];
 }
 
+/* Called from thread context */
+static void publish_latency(pa_source_output *o) {
+    size_t n;
+
+    n = pa_memblockq_get_length(o->thread_info.delay_memblockq);
+    if (pa_source_output_uses_source_delay(o))
+        n += pa_memblockq_get_length(o->source->thread_info.delay_memblockq);
+
+    pa_seqlock_write_begin(&o->latency_snapshot.lock);
+    o->latency_snapshot.queued = pa_bytes_to_usec(n, &o->source->sample_spec);
+    o->latency_snapshot.requested_latency = o->thread_info.requested_source_latency;
+    pa_seqlock_write_end(&o->latency_snapshot.lock);
+}
+
+/* Called from main context */
+pa_usec_t pa_source_output_get_latency_nowait(pa_source_output *o, pa_usec_t *requested_latency) {
+    pa_usec_t queued, requested;
+
+    pa_source_output_assert_ref(o);
+    pa_assert_ctl_context();
+    pa_assert(PA_SOURCE_OUTPUT_IS_LINKED(o->state));
+
+    if (o->source) {
+        int seq;
+
+        do {
+            seq = pa_seqlock_read_begin(&o->latency_snapshot.lock);
+            queued = o->latency_snapshot.queued;
+            requested = o->latency_snapshot.requested_latency;
+        } while (pa_seqlock_read_retry(&o->latency_snapshot.lock, seq));
+    } else {
+        /* Being moved, see pa_source_output_get_requested_latency() */
+        queued = 0;
+        requested = o->thread_info.requested_source_latency;
+    }
+
+    if (o->get_latency)
+        queued += o->get_latency(o);
+
+    if (requested_latency)
+        *requested_latency = requested;
+
+    return queued;
+}
+
+/* Called from thread context. Delivers data that went through a delay
+ * queue already, applying our volume and resampling it. */
+static void push_released(pa_source_output *o, pa_memchunk *qchunk) {
+    pa_bool_t nvfs;
+    size_t mbs;
+
+    nvfs = !pa_cvolume_is_norm(&o->volume_factor_source);
+
+    /* It might be necessary to adjust the volume here */
+    if (!pa_cvolume_is_norm(&o->thread_info.soft_volume) || o->thread_info.muted) {
+        pa_memchunk_make_writable(qchunk, 0);
+
+        if (o->thread_info.muted) {
+            pa_silence_memchunk(qchunk, &o->source->sample_spec);
+            nvfs = FALSE;
+
+        } else if (!o->thread_info.resampler && nvfs) {
+            pa_cvolume v;
+
+            /* If we don't need a resampler we can merge the
+             * post and the pre volume adjustment into one */
+
+            pa_sw_cvolume_multiply(&v, &o->thread_info.soft_volume, &o->volume_factor_source);
+            pa_volume_memchunk(qchunk, &o->source->sample_spec, &v);
+            nvfs = FALSE;
+
+        } else
+            pa_volume_memchunk(qchunk, &o->source->sample_spec, &o->thread_info.soft_volume);
+    }
+
+    if (!o->thread_info.resampler) {
+        if (nvfs) {
+            pa_memchunk_make_writable(qchunk, 0);
+            pa_volume_memchunk(qchunk, &o->thread_info.sample_spec, &o->volume_factor_source);
+        }
+
+        o->push(o, qchunk);
+        return;
+    }
+
+    mbs = pa_resampler_max_block_size(o->thread_info.resampler);
+
+    while (qchunk->length > 0) {
+        pa_memchunk tchunk = *qchunk, rchunk;
+
+        if (tchunk.length > mbs)
+            tchunk.length = mbs;
+
+        if (PA_UNLIKELY(o->source->render_stats)) {
+            pa_usec_t start = pa_rtclock_now();
+
+            pa_resampler_run(o->thread_info.resampler, &tchunk, &rchunk);
+            pa_render_histogram_add(&o->source->render_stats->histograms[PA_RENDER_STAT_RESAMPLE], pa_rtclock_now() - start);
+        } else
+            pa_resampler_run(o->thread_info.resampler, &tchunk, &rchunk);
+
+        if (rchunk.length > 0) {
+            if (nvfs) {
+                pa_memchunk_make_writable(&rchunk, 0);
+                pa_volume_memchunk(&rchunk, &o->thread_info.sample_spec, &o->volume_factor_source);
+            }
+
+            o->push(o, &rchunk);
+        }
+
+        if (rchunk.memblock)
+            pa_memblock_unref(rchunk.memblock);
+
+        qchunk->index += tchunk.length;
+        qchunk->length -= tchunk.length;
+    }
+}
+
 /* Called from thread context */
 void pa_source_output_push(pa_source_output *o, const pa_memchunk *chunk) {
-    pa_bool_t need_volume_factor_source;
-    pa_bool_t volume_is_norm;
     size_t length;
-    size_t limit, mbs = 0;
+    size_t limit;
 
     pa_source_output_assert_ref(o);
     pa_source_output_assert_io_context(o);
@@ -730,16 +852,21 @@ void pa_source_output_push(pa_source_output *o, const pa_memchunk *chunk) {
 
     pa_assert(o->thread_info.state == PA_SOURCE_OUTPUT_RUNNING);
 
+    /* Our resampler sat idle while we were fed by somebody else's,
+     * don't let it continue from the history it had back then */
+    if (o->thread_info.resampler_borrowed) {
+        pa_resampler_reset(o->thread_info.resampler);
+        o->thread_info.resampler_borrowed = FALSE;
+    }
+
     if (pa_memblockq_push(o->thread_info.delay_memblockq, chunk) < 0) {
         pa_log_debug("Delay queue overflow!");
+        o->thread_info.counters.overflows++;
         pa_memblockq_seek(o->thread_info.delay_memblockq, (int64_t) chunk->length, PA_SEEK_RELATIVE, TRUE);
     }
 
     limit = o->process_rewind ? 0 : o->source->thread_info.max_rewind;
 
-    volume_is_norm = pa_cvolume_is_norm(&o->thread_info.soft_volume) && !o->thread_info.muted;
-    need_volume_factor_source = !pa_cvolume_is_norm(&o->volume_factor_source);
-
     if (limit > 0 && o->source->monitor_of) {
         pa_usec_t latency;
         size_t n;
@@ -762,7 +889,7 @@ void pa_source_output_push(pa_source_output *o, const pa_memchunk *chunk) {
     /* Implement the delay queue */
     while ((length = pa_memblockq_get_length(o->thread_info.delay_memblockq)) > limit) {
         pa_memchunk qchunk;
-        pa_bool_t nvfs = need_volume_factor_source;
+        size_t l;
 
         length -= limit;
 
@@ -773,62 +900,118 @@ void pa_source_output_push(pa_source_output *o, const pa_memchunk *chunk) {
 
         pa_assert(qchunk.length > 0);
 
-        /* It might be necessary to adjust the volume here */
-        if (!volume_is_norm) {
-            pa_memchunk_make_writable(&qchunk, 0);
+        l = qchunk.length;
+        push_released(o, &qchunk);
 
-            if (o->thread_info.muted) {
-                pa_silence_memchunk(&qchunk, &o->source->sample_spec);
-                nvfs = FALSE;
+        pa_memblock_unref(qchunk.memblock);
+        pa_memblockq_drop(o->thread_info.delay_memblockq, l);
+    }
 
-            } else if (!o->thread_info.resampler && nvfs) {
-                pa_cvolume v;
+    publish_latency(o);
+}
 
-                /* If we don't need a resampler we can merge the
-                 * post and the pre volume adjustment into one */
+/* Called from thread context. Like pa_source_output_push(), for
+ * outputs for which pa_source_output_uses_source_delay() is TRUE. The
+ * source did the delaying already. */
+void pa_source_output_push_delayed(pa_source_output *o, const pa_memchunk *chunk) {
+    pa_memchunk qchunk;
 
-                pa_sw_cvolume_multiply(&v, &o->thread_info.soft_volume, &o->volume_factor_source);
-                pa_volume_memchunk(&qchunk, &o->source->sample_spec, &v);
-                nvfs = FALSE;
+    pa_source_output_assert_ref(o);
+    pa_source_output_assert_io_context(o);
+    pa_assert(PA_SOURCE_OUTPUT_IS_LINKED(o->thread_info.state));
+    pa_assert(chunk);
+    pa_assert(pa_frame_aligned(chunk->length, &o->source->sample_spec));
 
-            } else
-                pa_volume_memchunk(&qchunk, &o->source->sample_spec, &o->thread_info.soft_volume);
-        }
+    if (!o->push || o->thread_info.state == PA_SOURCE_OUTPUT_CORKED)
+        return;
 
-        if (!o->thread_info.resampler) {
-            if (nvfs) {
-                pa_memchunk_make_writable(&qchunk, 0);
-                pa_volume_memchunk(&qchunk, &o->thread_info.sample_spec, &o->volume_factor_source);
-            }
+    pa_assert(o->thread_info.state == PA_SOURCE_OUTPUT_RUNNING);
 
-            o->push(o, &qchunk);
-        } else {
-            pa_memchunk rchunk;
+    if (o->thread_info.resampler_borrowed) {
+        pa_resampler_reset(o->thread_info.resampler);
+        o->thread_info.resampler_borrowed = FALSE;
+    }
 
-            if (mbs == 0)
-                mbs = pa_resampler_max_block_size(o->thread_info.resampler);
+    /* Left over from a source where we had to delay on our own */
+    if (pa_memblockq_get_length(o->thread_info.delay_memblockq) > 0)
+        pa_memblockq_flush_read(o->thread_info.delay_memblockq);
 
-            if (qchunk.length > mbs)
-                qchunk.length = mbs;
+    qchunk = *chunk;
+    pa_memblock_ref(qchunk.memblock);
+    push_released(o, &qchunk);
+    pa_memblock_unref(qchunk.memblock);
 
-            pa_resampler_run(o->thread_info.resampler, &qchunk, &rchunk);
+    publish_latency(o);
+}
 
-            if (rchunk.length > 0) {
-                if (nvfs) {
-                    pa_memchunk_make_writable(&rchunk, 0);
-                    pa_volume_memchunk(&rchunk, &o->thread_info.sample_spec, &o->volume_factor_source);
-                }
+/* Called from thread context. Outputs on monitor sources that don't
+ * implement rewind() leave the delaying to the source, which then feeds
+ * all of them from one queue. */
+pa_bool_t pa_source_output_uses_source_delay(pa_source_output *o) {
+    pa_source_output_assert_ref(o);
 
-                o->push(o, &rchunk);
-            }
+    return
+        o->source->thread_info.delay_memblockq &&
+        !o->process_rewind &&
+        !o->thread_info.direct_on_input;
+}
 
-            if (rchunk.memblock)
-                pa_memblock_unref(rchunk.memblock);
-        }
+/* Called from thread context. Returns TRUE if o can be fed what the
+ * resampler of with produces instead of running its own, or, if with
+ * is NULL, whether o is a candidate for that at all. */
+pa_bool_t pa_source_output_can_share_resampler(pa_source_output *o, pa_source_output *with) {
+    pa_resampler *r, *w;
 
-        pa_memblock_unref(qchunk.memblock);
-        pa_memblockq_drop(o->thread_info.delay_memblockq, qchunk.length);
-    }
+    pa_source_output_assert_ref(o);
+    pa_source_output_assert_io_context(o);
+
+    if (!(r = o->thread_info.resampler) ||
+        !o->push ||
+        o->thread_info.state != PA_SOURCE_OUTPUT_RUNNING ||
+        o->thread_info.direct_on_input ||
+        (o->flags & PA_SOURCE_OUTPUT_VARIABLE_RATE))
+        return FALSE;
+
+    /* Volume adjustments would need a copy of our own */
+    if (o->thread_info.muted ||
+        !pa_cvolume_is_norm(&o->thread_info.soft_volume) ||
+        !pa_cvolume_is_norm(&o->volume_factor_source))
+        return FALSE;
+
+    /* Data that sits in the delay queue was not resampled yet. For
+     * outputs fed by the source's queue that is no concern, all of them
+     * get the same data out of it. */
+    if ((!o->process_rewind && o->source->thread_info.max_rewind > 0 && !pa_source_output_uses_source_delay(o)) ||
+        pa_memblockq_get_length(o->thread_info.delay_memblockq) > 0)
+        return FALSE;
+
+    if (!with)
+        return TRUE;
+
+    pa_assert_se(w = with->thread_info.resampler);
+
+    return
+        (o->flags & (PA_SOURCE_OUTPUT_NO_REMAP|PA_SOURCE_OUTPUT_NO_REMIX)) ==
+        (with->flags & (PA_SOURCE_OUTPUT_NO_REMAP|PA_SOURCE_OUTPUT_NO_REMIX)) &&
+        pa_resampler_get_method(r) == pa_resampler_get_method(w) &&
+        pa_sample_spec_equal(pa_resampler_input_sample_spec(r), pa_resampler_input_sample_spec(w)) &&
+        pa_channel_map_equal(pa_resampler_input_channel_map(r), pa_resampler_input_channel_map(w)) &&
+        pa_sample_spec_equal(pa_resampler_output_sample_spec(r), pa_resampler_output_sample_spec(w)) &&
+        pa_channel_map_equal(pa_resampler_output_channel_map(r), pa_resampler_output_channel_map(w));
+}
+
+/* Called from thread context. Like pa_source_output_push(), but for
+ * data that was already resampled on our behalf by an output for which
+ * pa_source_output_can_share_resampler() returned TRUE. */
+void pa_source_output_push_resampled(pa_source_output *o, const pa_memchunk *rchunk) {
+    pa_source_output_assert_ref(o);
+    pa_source_output_assert_io_context(o);
+    pa_assert(o->thread_info.state == PA_SOURCE_OUTPUT_RUNNING);
+    pa_assert(rchunk);
+    pa_assert(pa_frame_aligned(rchunk->length, &o->thread_info.sample_spec));
+
+    o->thread_info.resampler_borrowed = TRUE;
+    o->push(o, rchunk);
 }
 
 /* Called from thread context */
@@ -842,6 +1025,9 @@ void pa_source_output_process_rewind(pa_source_output *o, size_t nbytes /* in so
     if (nbytes <= 0)
         return;
 
+    o->thread_info.counters.rewinds++;
+    o->thread_info.counters.rewind_bytes += nbytes;
+
     if (o->process_rewind) {
         pa_assert(pa_memblockq_get_length(o->thread_info.delay_memblockq) == 0);
 
@@ -856,8 +1042,12 @@ void pa_source_output_process_rewind(pa_source_output *o, size_t nbytes /* in so
         if (o->thread_info.resampler)
             pa_resampler_reset(o->thread_info.resampler);
 
-    } else
+    } else if (!pa_source_output_uses_source_delay(o))
         pa_memblockq_rewind(o->thread_info.delay_memblockq, nbytes);
+
+    /* Otherwise the source rewound the queue we share already */
+
+    publish_latency(o);
 }
 
 /* Called from thread context */
@@ -893,6 +1083,8 @@ pa_usec_t pa_source_output_set_requested_latency_within_thread(pa_source_output
     o->thread_info.requested_source_latency = usec;
     pa_source_invalidate_requested_latency(o->source, TRUE);
 
+    publish_latency(o);
+
     return usec;
 }
 
@@ -1554,6 +1746,9 @@ int pa_source_output_process_msg(pa_msgobject *mo, int code, void *userdata, int
             pa_usec_t *r = userdata;
 
             r[0] += pa_bytes_to_usec(pa_memblockq_get_length(o->thread_info.delay_memblockq), &o->source->sample_spec);
+
+            if (pa_source_output_uses_source_delay(o))
+                r[0] += pa_bytes_to_usec(pa_memblockq_get_length(o->source->thread_info.delay_memblockq), &o->source->sample_spec);
             r[1] += pa_source_get_latency_within_thread(o->source);
 
             return 0;
@@ -1674,6 +1869,7 @@ int pa_source_output_update_rate(pa_source_output *o) {
         pa_resampler_free(o->thread_info.resampler);
 
     o->thread_info.resampler = new_resampler;
+    o->thread_info.resampler_borrowed = FALSE;
 
     pa_memblockq_free(o->thread_info.delay_memblockq);
 
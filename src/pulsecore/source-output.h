@@ -190,6 +190,15 @@ struct pa_source_output {
      * mute status changes. Called from main context */
     void (*mute_changed)(pa_source_output *o); /* may be NULL */
 
+    /* The length of the delay queue and the requested latency as last
+     * published by the IO thread, for
+     * pa_source_output_get_latency_nowait() */
+    struct {
+        pa_seqlock lock;
+        pa_usec_t queued;
+        pa_usec_t requested_latency;
+    } latency_snapshot;
+
     struct {
         pa_source_output_state_t state;
 
@@ -202,14 +211,21 @@ struct pa_source_output {
 
         pa_resampler* resampler;              /* may be NULL */
 
+        /* TRUE if we were fed data that another output's resampler
+         * produced, so that the state of our own one is stale */
+        pa_bool_t resampler_borrowed:1;
+
         /* We maintain a delay memblockq here for source outputs that
-         * don't implement rewind() */
+         * don't implement rewind(), unless the source does that for us,
+         * see pa_source_output_uses_source_delay() */
         pa_memblockq *delay_memblockq;
 
         /* The requested latency for the source */
         pa_usec_t requested_source_latency;
 
         pa_sink_input *direct_on_input;       /* may be NULL */
+
+        pa_io_counters counters;
     } thread_info;
 
     void *userdata;
@@ -311,6 +327,9 @@ size_t pa_source_output_get_max_rewind(pa_source_output *o);
 void pa_source_output_kill(pa_source_output*o);
 
 pa_usec_t pa_source_output_get_latency(pa_source_output *o, pa_usec_t *source_latency);
+/* Like pa_source_output_get_latency(), but doesn't wait for the IO
+ * thread, see pa_sink_input_get_latency_nowait() */
+pa_usec_t pa_source_output_get_latency_nowait(pa_source_output *o, pa_usec_t *requested_latency);
 
 pa_bool_t pa_source_output_is_volume_readable(pa_source_output *o);
 pa_bool_t pa_source_output_is_passthrough(pa_source_output *o);
@@ -344,6 +363,10 @@ pa_usec_t pa_source_output_get_requested_latency(pa_source_output *o);
 /* To be used exclusively by the source driver thread */
 
 void pa_source_output_push(pa_source_output *o, const pa_memchunk *chunk);
+void pa_source_output_push_delayed(pa_source_output *o, const pa_memchunk *chunk);
+pa_bool_t pa_source_output_uses_source_delay(pa_source_output *o);
+pa_bool_t pa_source_output_can_share_resampler(pa_source_output *o, pa_source_output *with);
+void pa_source_output_push_resampled(pa_source_output *o, const pa_memchunk *rchunk);
 void pa_source_output_process_rewind(pa_source_output *o, size_t nbytes);
 void pa_source_output_update_max_rewind(pa_source_output *o, size_t nbytes);
 
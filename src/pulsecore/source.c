@@ -42,12 +42,20 @@
 #include <pulsecore/log.h>
 #include <pulsecore/mix.h>
 #include <pulsecore/flist.h>
+#include <pulsecore/trace.h>
 
 #include "source.h"
 
 #define ABSOLUTE_MIN_LATENCY (500)
 #define ABSOLUTE_MAX_LATENCY (10*PA_USEC_PER_SEC)
 #define DEFAULT_FIXED_LATENCY (250*PA_USEC_PER_MSEC)
+#define MEMBLOCKQ_MAXLENGTH (32*1024*1024)
+
+/* How often pa_source_get_latency_nowait() tries again if it raced with the
+ * IO thread, and how old a latency snapshot may get before we rather ask
+ * the IO thread */
+#define LATENCY_SNAPSHOT_RETRIES 8
+#define LATENCY_SNAPSHOT_MAX_AGE (500*PA_USEC_PER_MSEC)
 
 PA_DEFINE_PUBLIC_CLASS(pa_source, pa_msgobject);
 
@@ -67,6 +75,7 @@ static void source_free(pa_object *o);
 
 static void pa_source_volume_change_push(pa_source *s);
 static void pa_source_volume_change_flush(pa_source *s);
+static void update_deadline(pa_source *s);
 
 pa_source_new_data* pa_source_new_data_init(pa_source_new_data *data) {
     pa_assert(data);
@@ -127,6 +136,27 @@ void pa_source_new_data_set_port(pa_source_new_data *data, const char *port) {
     data->active_port = pa_xstrdup(port);
 }
 
+void pa_source_new_data_set_cpu_affinity(pa_source_new_data *data, const char *cpus) {
+    int node;
+
+    pa_assert(data);
+
+    if (!cpus)
+        return;
+
+    pa_proplist_sets(data->proplist, PA_PROP_DEVICE_CPU_AFFINITY, cpus);
+
+    if ((node = pa_cpu_list_numa_node(cpus)) >= 0)
+        pa_proplist_setf(data->proplist, PA_PROP_DEVICE_NUMA_NODE, "%i", node);
+}
+
+void pa_source_new_data_set_clock_domain(pa_source_new_data *data, const char *name) {
+    pa_assert(data);
+
+    if (name)
+        pa_proplist_sets(data->proplist, PA_PROP_DEVICE_CLOCK_DOMAIN, name);
+}
+
 void pa_source_new_data_done(pa_source_new_data *data) {
     pa_assert(data);
 
@@ -162,7 +192,7 @@ pa_source* pa_source_new(
         pa_source_flags_t flags) {
 
     pa_source *s;
-    const char *name;
+    const char *name, *clock_domain;
     char st[PA_SAMPLE_SPEC_SNPRINT_MAX], cm[PA_CHANNEL_MAP_SNPRINT_MAX];
     char *pt;
 
@@ -243,6 +273,9 @@ pa_source* pa_source_new(
     s->module = data->module;
     s->card = data->card;
 
+    if ((clock_domain = pa_proplist_gets(s->proplist, PA_PROP_DEVICE_CLOCK_DOMAIN)))
+        s->clock_domain = pa_clock_domain_get(core, clock_domain);
+
     s->priority = pa_device_init_priority(s->proplist);
 
     s->sample_spec = data->sample_spec;
@@ -302,6 +335,9 @@ pa_source* pa_source_new(
     else
         s->latency_offset = 0;
 
+    pa_seqlock_init(&s->latency_snapshot.lock);
+    s->latency_snapshot.valid = FALSE;
+
     s->save_volume = data->save_volume;
     s->save_muted = data->save_muted;
 
@@ -312,12 +348,15 @@ pa_source* pa_source_new(
             &s->sample_spec,
             0);
 
+    s->render_stats = core->render_stats ? pa_render_stats_new() : NULL;
+
     s->thread_info.rtpoll = NULL;
     s->thread_info.outputs = pa_hashmap_new(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func);
     s->thread_info.soft_volume = s->soft_volume;
     s->thread_info.soft_muted = s->muted;
     s->thread_info.state = s->state;
     s->thread_info.max_rewind = 0;
+    s->thread_info.delay_memblockq = NULL;
     s->thread_info.requested_latency_valid = FALSE;
     s->thread_info.requested_latency = 0;
     s->thread_info.min_latency = ABSOLUTE_MIN_LATENCY;
@@ -536,6 +575,20 @@ void pa_source_put(pa_source *s) {
     pa_assert(s->asyncmsgq);
     pa_assert(s->thread_info.min_latency <= s->thread_info.max_latency);
 
+    /* Monitors are rewound with their sink, so their outputs need to hold
+     * data back until it can't change anymore */
+    if (s->monitor_of)
+        s->thread_info.delay_memblockq = pa_memblockq_new(
+                "source delay_memblockq",
+                0,
+                MEMBLOCKQ_MAXLENGTH,
+                0,
+                &s->sample_spec,
+                0,
+                1,
+                0,
+                &s->silence);
+
     /* Generally, flags should be initialized via pa_source_new(). As a
      * special exception we allow some volume related flags to be set
      * between _new() and _put() by the callback setter functions above.
@@ -659,9 +712,18 @@ static void source_free(pa_object *o) {
 
     pa_log_info("Freeing source %u \"%s\"", s->index, s->name);
 
+    if (s->format_matches)
+        pa_format_match_set_free(s->format_matches);
+
+    if (s->render_stats)
+        pa_render_stats_free(s->render_stats);
+
     pa_idxset_free(s->outputs, NULL);
     pa_hashmap_free(s->thread_info.outputs, (pa_free_cb_t) pa_source_output_unref);
 
+    if (s->thread_info.delay_memblockq)
+        pa_memblockq_free(s->thread_info.delay_memblockq);
+
     if (s->silence.memblock)
         pa_memblock_unref(s->silence.memblock);
 
@@ -671,6 +733,9 @@ static void source_free(pa_object *o) {
     if (s->proplist)
         pa_proplist_free(s->proplist);
 
+    if (s->clock_domain)
+        pa_clock_domain_unref(s->clock_domain);
+
     if (s->ports)
         pa_hashmap_free(s->ports, (pa_free_cb_t) pa_device_port_unref);
 
@@ -725,6 +790,9 @@ void pa_source_set_rtpoll(pa_source *s, pa_rtpoll *p) {
     pa_source_assert_io_context(s);
 
     s->thread_info.rtpoll = p;
+
+    if (p && s->render_stats)
+        pa_rtpoll_set_track_lateness(p, TRUE);
 }
 
 /* Called from main context */
@@ -882,10 +950,18 @@ void pa_source_process_rewind(pa_source *s, size_t nbytes) {
     if (nbytes <= 0)
         return;
 
+    PA_TRACE2(source_process_rewind, s->index, nbytes);
+
     if (s->thread_info.state == PA_SOURCE_SUSPENDED)
         return;
 
     pa_log_debug("Processing rewind...");
+    s->thread_info.counters.rewinds++;
+    s->thread_info.counters.rewind_bytes += nbytes;
+    pa_source_invalidate_latency(s);
+
+    if (s->thread_info.delay_memblockq)
+        pa_memblockq_rewind(s->thread_info.delay_memblockq, nbytes);
 
     PA_HASHMAP_FOREACH(o, s->thread_info.outputs, state) {
         pa_source_output_assert_ref(o);
@@ -893,11 +969,134 @@ void pa_source_process_rewind(pa_source *s, size_t nbytes) {
     }
 }
 
-/* Called from IO thread context */
-void pa_source_post(pa_source*s, const pa_memchunk *chunk) {
+/* Called from IO thread context. Resamples chunk once with the
+ * resampler of o and hands the result to o and to every output after it
+ * that could share it. delayed tells whether the chunk comes from the
+ * delay queue of the source, only the outputs fed from there may get
+ * it then. */
+static void push_shared(pa_source *s, pa_source_output *o, void *state, const pa_memchunk *chunk, pa_bool_t delayed) {
+    pa_resampler *r = o->thread_info.resampler;
+    pa_memchunk qchunk = *chunk;
+    size_t mbs;
+
+    if (o->thread_info.resampler_borrowed) {
+        pa_resampler_reset(r);
+        o->thread_info.resampler_borrowed = FALSE;
+    }
+
+    mbs = pa_resampler_max_block_size(r);
+
+    while (qchunk.length > 0) {
+        pa_memchunk tchunk = qchunk, rchunk;
+
+        if (tchunk.length > mbs)
+            tchunk.length = mbs;
+
+        pa_resampler_run(r, &tchunk, &rchunk);
+
+        if (rchunk.length > 0) {
+            pa_source_output *p;
+            void *pstate = state;
+
+            o->push(o, &rchunk);
+
+            while ((p = pa_hashmap_iterate(s->thread_info.outputs, &pstate, NULL)))
+                if (pa_source_output_uses_source_delay(p) == delayed &&
+                    pa_source_output_can_share_resampler(p, NULL) && pa_source_output_can_share_resampler(p, o))
+                    pa_source_output_push_resampled(p, &rchunk);
+        }
+
+        if (rchunk.memblock)
+            pa_memblock_unref(rchunk.memblock);
+
+        qchunk.index += tchunk.length;
+        qchunk.length -= tchunk.length;
+    }
+}
+
+/* Called from IO thread context. Hands chunk to the outputs that are
+ * fed from the delay queue of the source if delayed is TRUE, and to the
+ * others otherwise. */
+static void post_outputs(pa_source *s, const pa_memchunk *chunk, pa_bool_t delayed) {
     pa_source_output *o;
     void *state = NULL;
 
+    while ((o = pa_hashmap_iterate(s->thread_info.outputs, &state, NULL))) {
+        pa_source_output *p;
+        void *pstate = NULL;
+
+        pa_source_output_assert_ref(o);
+
+        if (o->thread_info.direct_on_input || pa_source_output_uses_source_delay(o) != delayed)
+            continue;
+
+        if (!pa_source_output_can_share_resampler(o, NULL)) {
+            if (delayed)
+                pa_source_output_push_delayed(o, chunk);
+            else
+                pa_source_output_push(o, chunk);
+            continue;
+        }
+
+        /* Many recorders on one source tend to ask for the same format,
+         * so let the first of them do the conversion for all */
+        while ((p = pa_hashmap_iterate(s->thread_info.outputs, &pstate, NULL)) != o)
+            if (pa_source_output_uses_source_delay(p) == delayed &&
+                pa_source_output_can_share_resampler(p, NULL) && pa_source_output_can_share_resampler(o, p))
+                break;
+
+        if (p == o)
+            push_shared(s, o, state, chunk, delayed);
+    }
+}
+
+/* Called from IO thread context. The monitor equivalent of the delay
+ * queue in pa_source_output_push(): whatever can't be rewound anymore
+ * leaves the queue once, as the very same blocks for all outputs that
+ * are fed from it. */
+static void post_delayed(pa_source *s, const pa_memchunk *chunk) {
+    pa_memblockq *q = s->thread_info.delay_memblockq;
+    size_t length, limit;
+
+    if (pa_memblockq_push(q, chunk) < 0) {
+        pa_log_debug("Delay queue overflow!");
+        pa_memblockq_seek(q, (int64_t) chunk->length, PA_SEEK_RELATIVE, TRUE);
+    }
+
+    limit = s->thread_info.max_rewind;
+
+    if (limit > 0) {
+        size_t n;
+
+        /* Only what the sink hasn't played yet might still change, see
+         * the FIXME in pa_source_output_push() */
+        n = pa_usec_to_bytes(pa_sink_get_latency_within_thread(s->monitor_of), &s->sample_spec);
+
+        if (n < limit)
+            limit = n;
+    }
+
+    while ((length = pa_memblockq_get_length(q)) > limit) {
+        pa_memchunk qchunk;
+
+        pa_assert_se(pa_memblockq_peek(q, &qchunk) >= 0);
+
+        if (qchunk.length > length - limit)
+            qchunk.length = length - limit;
+
+        pa_assert(qchunk.length > 0);
+
+        post_outputs(s, &qchunk, TRUE);
+
+        pa_memblock_unref(qchunk.memblock);
+        pa_memblockq_drop(q, qchunk.length);
+    }
+}
+
+/* Called from IO thread context */
+void pa_source_post(pa_source*s, const pa_memchunk *chunk) {
+    pa_usec_t start, spent;
+
     pa_source_assert_ref(s);
     pa_source_assert_io_context(s);
     pa_assert(PA_SOURCE_IS_LINKED(s->thread_info.state));
@@ -906,6 +1105,10 @@ void pa_source_post(pa_source*s, const pa_memchunk *chunk) {
     if (s->thread_info.state == PA_SOURCE_SUSPENDED)
         return;
 
+    start = pa_rtclock_now();
+
+    PA_TRACE2(source_post, s->index, chunk->length);
+
     if (s->thread_info.soft_muted || !pa_cvolume_is_norm(&s->thread_info.soft_volume)) {
         pa_memchunk vchunk = *chunk;
 
@@ -917,22 +1120,35 @@ void pa_source_post(pa_source*s, const pa_memchunk *chunk) {
         else
             pa_volume_memchunk(&vchunk, &s->sample_spec, &s->thread_info.soft_volume);
 
-        while ((o = pa_hashmap_iterate(s->thread_info.outputs, &state, NULL))) {
-            pa_source_output_assert_ref(o);
+        post_outputs(s, &vchunk, FALSE);
 
-            if (!o->thread_info.direct_on_input)
-                pa_source_output_push(o, &vchunk);
-        }
+        if (s->thread_info.delay_memblockq)
+            post_delayed(s, &vchunk);
 
         pa_memblock_unref(vchunk.memblock);
     } else {
+        post_outputs(s, chunk, FALSE);
 
-        while ((o = pa_hashmap_iterate(s->thread_info.outputs, &state, NULL))) {
-            pa_source_output_assert_ref(o);
+        if (s->thread_info.delay_memblockq)
+            post_delayed(s, chunk);
+    }
 
-            if (!o->thread_info.direct_on_input)
-                pa_source_output_push(o, chunk);
-        }
+    spent = pa_rtclock_now() - start;
+
+    if (spent > s->thread_info.counters.max_render_usec) {
+        s->thread_info.counters.max_render_usec = spent;
+
+        if (PA_UNLIKELY(s->thread_info.deadline_period > 0) && spent * 4 > s->thread_info.deadline_runtime)
+            update_deadline(s);
+    }
+
+    if (PA_UNLIKELY(s->render_stats)) {
+        pa_usec_t lateness;
+
+        pa_render_histogram_add(&s->render_stats->histograms[PA_RENDER_STAT_CYCLE], spent);
+
+        if (s->thread_info.rtpoll && pa_rtpoll_take_lateness(s->thread_info.rtpoll, &lateness))
+            pa_render_histogram_add(&s->render_stats->histograms[PA_RENDER_STAT_LATENESS], lateness);
     }
 }
 
@@ -1031,6 +1247,12 @@ pa_bool_t pa_source_update_rate(pa_source *s, uint32_t rate, pa_bool_t passthrou
                 if (o->state == PA_SOURCE_OUTPUT_CORKED)
                     pa_source_output_update_rate(o);
             }
+
+            /* Like the outputs' own queues, don't mix up data of both
+             * rates */
+            if (s->thread_info.delay_memblockq)
+                pa_memblockq_flush_read(s->thread_info.delay_memblockq);
+
             ret = TRUE;
         }
 
@@ -1040,30 +1262,78 @@ pa_bool_t pa_source_update_rate(pa_source *s, uint32_t rate, pa_bool_t passthrou
     return ret;
 }
 
+/* Called from main thread */
+static pa_usec_t add_latency_offset(pa_usec_t usec, int64_t offset) {
+
+    /* usec is unsigned, so check that the offset can be added to usec without
+     * underflowing. */
+    if (-offset <= (int64_t) usec)
+        return usec + offset;
+
+    return 0;
+}
+
+/* Called from main thread */
+pa_bool_t pa_source_get_latency_nowait(pa_source *s, pa_usec_t *usec) {
+    pa_bool_t valid = FALSE;
+    pa_usec_t latency = 0, timestamp = 0, now, age;
+    unsigned n;
+
+    pa_source_assert_ref(s);
+    pa_assert_ctl_context();
+    pa_assert(PA_SOURCE_IS_LINKED(s->state));
+    pa_assert(usec);
+
+    if (s->state == PA_SOURCE_SUSPENDED || !(s->flags & PA_SOURCE_LATENCY)) {
+        *usec = 0;
+        return TRUE;
+    }
+
+    for (n = 0; n < LATENCY_SNAPSHOT_RETRIES; n++) {
+        int seq;
+
+        seq = pa_seqlock_read_begin(&s->latency_snapshot.lock);
+        valid = s->latency_snapshot.valid;
+        latency = s->latency_snapshot.latency;
+        timestamp = s->latency_snapshot.timestamp;
+
+        if (!pa_seqlock_read_retry(&s->latency_snapshot.lock, seq))
+            break;
+    }
+
+    if (n >= LATENCY_SNAPSHOT_RETRIES || !valid)
+        return FALSE;
+
+    now = pa_rtclock_now();
+    age = now > timestamp ? now - timestamp : 0;
+
+    if (age > LATENCY_SNAPSHOT_MAX_AGE)
+        return FALSE;
+
+    /* The snapshot was taken at the time of the last read, since then
+     * the device has recorded what elapsed in the meantime */
+    latency += age;
+
+    *usec = add_latency_offset(latency, s->latency_offset);
+    return TRUE;
+}
+
 /* Called from main thread */
 pa_usec_t pa_source_get_latency(pa_source *s) {
-    pa_usec_t usec;
+    pa_usec_t usec = 0;
 
     pa_source_assert_ref(s);
     pa_assert_ctl_context();
     pa_assert(PA_SOURCE_IS_LINKED(s->state));
 
-    if (s->state == PA_SOURCE_SUSPENDED)
-        return 0;
+    /* The returned value is supposed to be in the time domain of the sound card! */
 
-    if (!(s->flags & PA_SOURCE_LATENCY))
-        return 0;
+    if (pa_source_get_latency_nowait(s, &usec))
+        return usec;
 
     pa_assert_se(pa_asyncmsgq_send(s->asyncmsgq, PA_MSGOBJECT(s), PA_SOURCE_MESSAGE_GET_LATENCY, &usec, 0, NULL) == 0);
 
-    /* usec is unsigned, so check that the offset can be added to usec without
-     * underflowing. */
-    if (-s->latency_offset <= (int64_t) usec)
-        usec += s->latency_offset;
-    else
-        usec = 0;
-
-    return usec;
+    return add_latency_offset(usec, s->latency_offset);
 }
 
 /* Called from IO thread */
@@ -1100,6 +1370,34 @@ pa_usec_t pa_source_get_latency_within_thread(pa_source *s) {
     return usec;
 }
 
+/* Called from IO thread */
+void pa_source_publish_latency(pa_source *s, pa_usec_t usec) {
+    pa_usec_t now;
+
+    pa_source_assert_ref(s);
+    pa_source_assert_io_context(s);
+
+    now = pa_rtclock_now();
+
+    pa_seqlock_write_begin(&s->latency_snapshot.lock);
+    s->latency_snapshot.valid = TRUE;
+    s->latency_snapshot.latency = usec;
+    s->latency_snapshot.timestamp = now;
+    pa_seqlock_write_end(&s->latency_snapshot.lock);
+}
+
+/* Called from IO thread */
+void pa_source_invalidate_latency(pa_source *s) {
+    pa_source_assert_ref(s);
+
+    if (!s->latency_snapshot.valid)
+        return;
+
+    pa_seqlock_write_begin(&s->latency_snapshot.lock);
+    s->latency_snapshot.valid = FALSE;
+    pa_seqlock_write_end(&s->latency_snapshot.lock);
+}
+
 /* Called from the main thread (and also from the IO thread while the main
  * thread is waiting).
  *
@@ -2106,6 +2404,8 @@ int pa_source_process_msg(pa_msgobject *object, int code, void *userdata, int64_
                 (s->thread_info.state == PA_SOURCE_SUSPENDED && PA_SOURCE_IS_OPENED(PA_PTR_TO_UINT(userdata))) ||
                 (PA_SOURCE_IS_OPENED(s->thread_info.state) && PA_PTR_TO_UINT(userdata) == PA_SOURCE_SUSPENDED);
 
+            pa_source_invalidate_latency(s);
+
             s->thread_info.state = PA_PTR_TO_UINT(userdata);
 
             if (suspend_change) {
@@ -2218,6 +2518,18 @@ int pa_source_process_msg(pa_msgobject *object, int code, void *userdata, int64_
             s->thread_info.latency_offset = offset;
             return 0;
 
+        case PA_SOURCE_MESSAGE_RESET_COUNTERS: {
+            pa_source_output *o;
+            void *state = NULL;
+
+            pa_io_counters_reset(&s->thread_info.counters);
+
+            PA_HASHMAP_FOREACH(o, s->thread_info.outputs, state)
+                pa_io_counters_reset(&o->thread_info.counters);
+
+            return 0;
+        }
+
         case PA_SOURCE_MESSAGE_MAX:
             ;
     }
@@ -2394,6 +2706,9 @@ void pa_source_invalidate_requested_latency(pa_source *s, pa_bool_t dynamic) {
                 o->update_source_requested_latency(o);
     }
 
+    if (s->thread_info.deadline_period > 0)
+        update_deadline(s);
+
     if (s->monitor_of)
         pa_sink_invalidate_requested_latency(s->monitor_of, dynamic);
 }
@@ -2559,6 +2874,67 @@ void pa_source_set_fixed_latency_within_thread(pa_source *s, pa_usec_t latency)
     pa_source_invalidate_requested_latency(s, FALSE);
 }
 
+/* Called from IO thread context */
+static void get_deadline(pa_source *s, pa_usec_t *runtime, pa_usec_t *period) {
+    pa_usec_t latency;
+
+    if ((latency = pa_source_get_requested_latency_within_thread(s)) == (pa_usec_t) -1)
+        latency = s->thread_info.max_latency;
+
+    pa_deadline_from_latency(latency, s->thread_info.counters.max_render_usec, runtime, period);
+}
+
+/* Called from IO thread context */
+static void update_deadline(pa_source *s) {
+    pa_usec_t runtime, period;
+
+    get_deadline(s, &runtime, &period);
+
+    /* Small changes aren't worth a syscall */
+    if (period == s->thread_info.deadline_period &&
+        runtime * 4 >= s->thread_info.deadline_runtime * 3 &&
+        runtime * 4 <= s->thread_info.deadline_runtime * 5)
+        return;
+
+    /* Remembered even if it fails, so that it isn't retried on every
+     * render. The previous reservation stays in place then. */
+    s->thread_info.deadline_runtime = runtime;
+    s->thread_info.deadline_period = period;
+
+    pa_make_deadline(runtime, period);
+}
+
+/* Called from IO thread context */
+void pa_source_make_realtime_within_thread(pa_source *s, int rtprio) {
+    pa_usec_t runtime, period;
+
+    pa_source_assert_ref(s);
+    pa_source_assert_io_context(s);
+
+    if (s->core->realtime_deadline) {
+        get_deadline(s, &runtime, &period);
+
+        if (pa_make_deadline(runtime, period) >= 0) {
+            s->thread_info.deadline_runtime = runtime;
+            s->thread_info.deadline_period = period;
+            return;
+        }
+    }
+
+    pa_make_realtime(rtprio);
+}
+
+/* Called from IO thread */
+pa_usec_t pa_source_align_wakeup_within_thread(pa_source *s, pa_usec_t deadline, pa_usec_t slack) {
+    pa_source_assert_ref(s);
+    pa_source_assert_io_context(s);
+
+    if (!s->clock_domain)
+        return deadline;
+
+    return pa_clock_domain_align(s->clock_domain, deadline, slack);
+}
+
 /* Called from main thread */
 void pa_source_set_latency_offset(pa_source *s, int64_t offset) {
     pa_source_assert_ref(s);
@@ -2571,6 +2947,25 @@ void pa_source_set_latency_offset(pa_source *s, int64_t offset) {
         s->thread_info.latency_offset = offset;
 }
 
+/* Called from main context */
+void pa_source_reset_counters(pa_source *s) {
+    pa_source_output *o;
+    uint32_t idx;
+
+    pa_assert_ctl_context();
+    pa_source_assert_ref(s);
+
+    if (PA_SOURCE_IS_LINKED(s->state)) {
+        pa_assert_se(pa_asyncmsgq_send(s->asyncmsgq, PA_MSGOBJECT(s), PA_SOURCE_MESSAGE_RESET_COUNTERS, NULL, 0, NULL) == 0);
+        return;
+    }
+
+    pa_io_counters_reset(&s->thread_info.counters);
+
+    PA_IDXSET_FOREACH(o, s->outputs, idx)
+        pa_io_counters_reset(&o->thread_info.counters);
+}
+
 /* Called from main thread */
 size_t pa_source_get_max_rewind(pa_source *s) {
     size_t r;
@@ -2735,6 +3130,19 @@ static void pa_source_volume_change_flush(pa_source *s) {
     }
 }
 
+static pa_bool_t volume_not_above(const pa_cvolume *a, const pa_cvolume *b) {
+    unsigned c;
+
+    if (a->channels != b->channels)
+        return FALSE;
+
+    for (c = 0; c < a->channels; c++)
+        if (a->values[c] > b->values[c])
+            return FALSE;
+
+    return TRUE;
+}
+
 /* Called from the IO thread. */
 pa_bool_t pa_source_volume_change_apply(pa_source *s, pa_usec_t *usec_to_next) {
     pa_usec_t now;
@@ -2752,11 +3160,22 @@ pa_bool_t pa_source_volume_change_apply(pa_source *s, pa_usec_t *usec_to_next) {
 
     now = pa_rtclock_now();
 
-    while (s->thread_info.volume_changes && now >= s->thread_info.volume_changes->at) {
+    while (s->thread_info.volume_changes) {
         pa_source_volume_change *c = s->thread_info.volume_changes;
+
+        /* Once we write anyway, changes that follow within the safety
+         * margin and only lower the volume further are merged into the
+         * same write. Decreases are scheduled early anyway, and this
+         * saves a mixer write and a wakeup. */
+        if (now < c->at &&
+            (!ret ||
+             c->at - now > s->thread_info.volume_change_safety_margin ||
+             !volume_not_above(&c->hw_volume, &s->thread_info.current_hw_volume)))
+            break;
+
         PA_LLIST_REMOVE(pa_source_volume_change, s->thread_info.volume_changes, c);
-        pa_log_debug("Volume change to %d at %llu was written %llu usec late",
-                     pa_cvolume_avg(&c->hw_volume), (long long unsigned) c->at, (long long unsigned) (now - c->at));
+        pa_log_debug("Volume change to %d at %llu was written %lld usec late",
+                     pa_cvolume_avg(&c->hw_volume), (long long unsigned) c->at, (long long) now - (long long) c->at);
         ret = TRUE;
         s->thread_info.current_hw_volume = c->hw_volume;
         pa_source_volume_change_free(c);
@@ -2803,58 +3222,33 @@ pa_idxset* pa_source_get_formats(pa_source *s) {
 }
 
 /* Called from the main thread */
-/* Checks if the source can accept this format */
-pa_bool_t pa_source_check_format(pa_source *s, pa_format_info *f) {
-    pa_idxset *formats = NULL;
-    pa_bool_t ret = FALSE;
-
+static pa_format_match_set* get_format_matches(pa_source *s) {
     pa_assert(s);
-    pa_assert(f);
-
-    formats = pa_source_get_formats(s);
 
-    if (formats) {
-        pa_format_info *finfo_device;
-        uint32_t i;
+    /* The formats of a source never change */
+    if (!s->format_matches)
+        s->format_matches = pa_format_match_set_new(pa_source_get_formats(s));
 
-        PA_IDXSET_FOREACH(finfo_device, formats, i) {
-            if (pa_format_info_is_compatible(finfo_device, f)) {
-                ret = TRUE;
-                break;
-            }
-        }
+    return s->format_matches;
+}
 
-        pa_idxset_free(formats, (pa_free_cb_t) pa_format_info_free);
-    }
+/* Called from the main thread */
+/* Checks if the source can accept this format */
+pa_bool_t pa_source_check_format(pa_source *s, pa_format_info *f) {
+    pa_assert(s);
+    pa_assert(f);
 
-    return ret;
+    return pa_format_match_set_check(get_format_matches(s), f);
 }
 
 /* Called from the main thread */
 /* Calculates the intersection between formats supported by the source and
  * in_formats, and returns these, in the order of the source's formats. */
 pa_idxset* pa_source_check_formats(pa_source *s, pa_idxset *in_formats) {
-    pa_idxset *out_formats = pa_idxset_new(NULL, NULL), *source_formats = NULL;
-    pa_format_info *f_source, *f_in;
-    uint32_t i, j;
-
     pa_assert(s);
 
     if (!in_formats || pa_idxset_isempty(in_formats))
-        goto done;
-
-    source_formats = pa_source_get_formats(s);
-
-    PA_IDXSET_FOREACH(f_source, source_formats, i) {
-        PA_IDXSET_FOREACH(f_in, in_formats, j) {
-            if (pa_format_info_is_compatible(f_source, f_in))
-                pa_idxset_put(out_formats, pa_format_info_copy(f_in), NULL);
-        }
-    }
-
-done:
-    if (source_formats)
-        pa_idxset_free(source_formats, (pa_free_cb_t) pa_format_info_free);
+        return pa_idxset_new(NULL, NULL);
 
-    return out_formats;
+    return pa_format_match_set_intersect(get_format_matches(s), in_formats);
 }
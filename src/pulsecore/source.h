@@ -43,9 +43,14 @@ typedef struct pa_source_volume_change pa_source_volume_change;
 #include <pulsecore/msgobject.h>
 #include <pulsecore/rtpoll.h>
 #include <pulsecore/card.h>
+#include <pulsecore/clock-domain.h>
 #include <pulsecore/device-port.h>
+#include <pulsecore/format-match.h>
+#include <pulsecore/io-counters.h>
+#include <pulsecore/render-stats.h>
 #include <pulsecore/queue.h>
 #include <pulsecore/thread-mq.h>
+#include <pulsecore/seqlock.h>
 #include <pulsecore/source-output.h>
 
 #define PA_MAX_OUTPUTS_PER_SOURCE 32
@@ -74,6 +79,7 @@ struct pa_source {
 
     pa_module *module;                        /* may be NULL */
     pa_card *card;                            /* may be NULL */
+    pa_clock_domain *clock_domain;            /* may be NULL */
 
     pa_sample_spec sample_spec;
     pa_channel_map channel_map;
@@ -105,6 +111,13 @@ struct pa_source {
     pa_cvolume saved_volume;
     pa_bool_t saved_save_volume:1;
 
+    /* The formats from get_formats(), parsed for matching */
+    pa_format_match_set *format_matches;
+
+    /* Timing histograms of the IO thread, NULL unless the core has
+     * render_stats set. Only written from the IO thread. */
+    pa_render_stats *render_stats;
+
     pa_asyncmsgq *asyncmsgq;
 
     pa_memchunk silence;
@@ -116,6 +129,16 @@ struct pa_source {
     /* The latency offset is inherited from the currently active port */
     int64_t latency_offset;
 
+    /* The latency as last published by the IO thread with
+     * pa_source_publish_latency(), for the main thread to read without a
+     * round trip through the asyncmsgq */
+    struct {
+        pa_seqlock lock;
+        pa_bool_t valid;
+        pa_usec_t latency;
+        pa_usec_t timestamp;
+    } latency_snapshot;
+
     unsigned priority;
 
     /* Called when the main loop requests a state change. Called from
@@ -207,6 +230,11 @@ struct pa_source {
          * max. (Only used on monitor sources) */
         size_t max_rewind;
 
+        /* Monitor sources only: one delay queue for all outputs that
+         * don't implement rewind(), so that they all get the same
+         * blocks, see pa_source_output_uses_source_delay() */
+        pa_memblockq *delay_memblockq;
+
         pa_usec_t min_latency; /* we won't go below this latency */
         pa_usec_t max_latency; /* An upper limit for the latencies */
 
@@ -229,6 +257,13 @@ struct pa_source {
         uint32_t volume_change_safety_margin;
         /* Usec delay added to all volume change events, may be negative. */
         int32_t volume_change_extra_delay;
+
+        pa_io_counters counters;
+
+        /* The SCHED_DEADLINE reservation last asked for, 0 unless the
+         * IO thread was made realtime with it */
+        pa_usec_t deadline_runtime;
+        pa_usec_t deadline_period;
     } thread_info;
 
     void *userdata;
@@ -261,6 +296,7 @@ typedef enum pa_source_message {
     PA_SOURCE_MESSAGE_SET_PORT,
     PA_SOURCE_MESSAGE_UPDATE_VOLUME_AND_MUTE,
     PA_SOURCE_MESSAGE_SET_LATENCY_OFFSET,
+    PA_SOURCE_MESSAGE_RESET_COUNTERS,
     PA_SOURCE_MESSAGE_MAX
 } pa_source_message_t;
 
@@ -304,6 +340,10 @@ void pa_source_new_data_set_alternate_sample_rate(pa_source_new_data *data, cons
 void pa_source_new_data_set_volume(pa_source_new_data *data, const pa_cvolume *volume);
 void pa_source_new_data_set_muted(pa_source_new_data *data, pa_bool_t mute);
 void pa_source_new_data_set_port(pa_source_new_data *data, const char *port);
+/* Records where the IO thread runs, see pa_modargs_get_cpu_affinity() */
+void pa_source_new_data_set_cpu_affinity(pa_source_new_data *data, const char *cpus);
+/* Puts the source into the clock domain of that name, see clock-domain.h */
+void pa_source_new_data_set_clock_domain(pa_source_new_data *data, const char *name);
 void pa_source_new_data_done(pa_source_new_data *data);
 
 /*** To be called exclusively by the source driver, from main context */
@@ -346,8 +386,14 @@ void pa_source_update_flags(pa_source *s, pa_source_flags_t mask, pa_source_flag
 
 void pa_source_set_latency_offset(pa_source *s, int64_t offset);
 
+/* Resets the counters of the source and of all its outputs */
+void pa_source_reset_counters(pa_source *s);
+
 /* The returned value is supposed to be in the time domain of the sound card! */
 pa_usec_t pa_source_get_latency(pa_source *s);
+/* Like pa_source_get_latency(), but only consults the snapshot published
+ * by the IO thread. Returns FALSE if there is none. */
+pa_bool_t pa_source_get_latency_nowait(pa_source *s, pa_usec_t *usec);
 pa_usec_t pa_source_get_requested_latency(pa_source *s);
 void pa_source_get_latency_range(pa_source *s, pa_usec_t *min_latency, pa_usec_t *max_latency);
 pa_usec_t pa_source_get_fixed_latency(pa_source *s);
@@ -416,6 +462,16 @@ void pa_source_set_max_rewind_within_thread(pa_source *s, size_t max_rewind);
 void pa_source_set_latency_range_within_thread(pa_source *s, pa_usec_t min_latency, pa_usec_t max_latency);
 void pa_source_set_fixed_latency_within_thread(pa_source *s, pa_usec_t latency);
 
+/* Returns the time to wake up at for something that is due at
+ * deadline, aligned to the other wakeups of the clock domain. At most
+ * slack early, and deadline itself if the source has no domain. */
+pa_usec_t pa_source_align_wakeup_within_thread(pa_source *s, pa_usec_t deadline, pa_usec_t slack);
+
+/* Makes the IO thread realtime, see pa_make_realtime(). With
+ * realtime-deadline set it asks for SCHED_DEADLINE first, and keeps
+ * the reservation in line with the latency and the render cost. */
+void pa_source_make_realtime_within_thread(pa_source *s, int rtprio);
+
 void pa_source_update_volume_and_mute(pa_source *s);
 
 pa_bool_t pa_source_volume_change_apply(pa_source *s, pa_usec_t *usec_to_next);
@@ -425,6 +481,13 @@ pa_bool_t pa_source_volume_change_apply(pa_source *s, pa_usec_t *usec_to_next);
 void pa_source_invalidate_requested_latency(pa_source *s, pa_bool_t dynamic);
 pa_usec_t pa_source_get_latency_within_thread(pa_source *s);
 
+/* To be called by source implementations that report their latency
+ * from the IO thread, e.g. after each write. The snapshot is used by
+ * pa_source_get_latency() until it is invalidated again, which happens
+ * on state changes and rewinds. */
+void pa_source_publish_latency(pa_source *s, pa_usec_t usec);
+void pa_source_invalidate_latency(pa_source *s);
+
 #define pa_source_assert_io_context(s) \
     pa_assert(pa_thread_mq_get() || !PA_SOURCE_IS_LINKED((s)->state))
 
@@ -0,0 +1,173 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pulsecore/macro.h>
+#include <pulsecore/log.h>
+
+#include "cpu-x86.h"
+#include "sample-util.h"
+#include "simd-x86.h"
+
+/* Same scheme as the SSE2 functions in svolume_sse2.c, with eight
+ * samples at a time. */
+
+#define LANES 8
+
+static pa_do_volume_func_t fallback_float32ne, fallback_float32re;
+static pa_do_volume_func_t fallback_s32ne, fallback_s32re;
+static pa_do_volume_func_t fallback_s24_32ne, fallback_s24_32re;
+
+static unsigned wrap_channels(unsigned channels) {
+    return (LANES + channels - 1) / channels * channels;
+}
+
+/* (s * c) >> 16 with saturation, just like the C version */
+static inline __m256i volume_s32_avx2(__m256i s, __m256i c) {
+    __m256i e, o;
+
+    e = sat_s64_avx2(sra16_s64_avx2(_mm256_mul_epi32(s, c)));
+    o = sat_s64_avx2(sra16_s64_avx2(_mm256_mul_epi32(_mm256_srli_epi64(s, 32), _mm256_srli_epi64(c, 32))));
+
+    return _mm256_blend_epi32(e, _mm256_slli_epi64(o, 32), 0xAA);
+}
+
+static void pa_volume_float32ne_avx2(float *samples, const float *volumes, unsigned channels, unsigned length) {
+    unsigned n, channel = 0, wrap = wrap_channels(channels);
+
+    for (n = length / sizeof(float) / LANES; n > 0; n--, samples += LANES) {
+        _mm256_storeu_ps(samples, _mm256_mul_ps(_mm256_loadu_ps(samples), _mm256_loadu_ps(volumes + channel)));
+
+        if ((channel += LANES) >= wrap)
+            channel -= wrap;
+    }
+
+    if ((length %= sizeof(float) * LANES) > 0)
+        fallback_float32ne(samples, volumes + channel, channels, length);
+}
+
+static void pa_volume_float32re_avx2(float *samples, const float *volumes, unsigned channels, unsigned length) {
+    unsigned n, channel = 0, wrap = wrap_channels(channels);
+
+    for (n = length / sizeof(float) / LANES; n > 0; n--, samples += LANES) {
+        __m256 s = _mm256_castsi256_ps(bswap32_avx2(_mm256_loadu_si256((__m256i*) samples)));
+
+        s = _mm256_mul_ps(s, _mm256_loadu_ps(volumes + channel));
+        _mm256_storeu_si256((__m256i*) samples, bswap32_avx2(_mm256_castps_si256(s)));
+
+        if ((channel += LANES) >= wrap)
+            channel -= wrap;
+    }
+
+    if ((length %= sizeof(float) * LANES) > 0)
+        fallback_float32re(samples, volumes + channel, channels, length);
+}
+
+static void pa_volume_s32ne_avx2(int32_t *samples, const int32_t *volumes, unsigned channels, unsigned length) {
+    unsigned n, channel = 0, wrap = wrap_channels(channels);
+
+    for (n = length / sizeof(int32_t) / LANES; n > 0; n--, samples += LANES) {
+        __m256i s = _mm256_loadu_si256((__m256i*) samples);
+
+        s = volume_s32_avx2(s, _mm256_loadu_si256((const __m256i*) (volumes + channel)));
+        _mm256_storeu_si256((__m256i*) samples, s);
+
+        if ((channel += LANES) >= wrap)
+            channel -= wrap;
+    }
+
+    if ((length %= sizeof(int32_t) * LANES) > 0)
+        fallback_s32ne(samples, volumes + channel, channels, length);
+}
+
+static void pa_volume_s32re_avx2(int32_t *samples, const int32_t *volumes, unsigned channels, unsigned length) {
+    unsigned n, channel = 0, wrap = wrap_channels(channels);
+
+    for (n = length / sizeof(int32_t) / LANES; n > 0; n--, samples += LANES) {
+        __m256i s = bswap32_avx2(_mm256_loadu_si256((__m256i*) samples));
+
+        s = volume_s32_avx2(s, _mm256_loadu_si256((const __m256i*) (volumes + channel)));
+        _mm256_storeu_si256((__m256i*) samples, bswap32_avx2(s));
+
+        if ((channel += LANES) >= wrap)
+            channel -= wrap;
+    }
+
+    if ((length %= sizeof(int32_t) * LANES) > 0)
+        fallback_s32re(samples, volumes + channel, channels, length);
+}
+
+static void pa_volume_s24_32ne_avx2(uint32_t *samples, const int32_t *volumes, unsigned channels, unsigned length) {
+    unsigned n, channel = 0, wrap = wrap_channels(channels);
+
+    for (n = length / sizeof(uint32_t) / LANES; n > 0; n--, samples += LANES) {
+        __m256i s = _mm256_slli_epi32(_mm256_loadu_si256((__m256i*) samples), 8);
+
+        s = volume_s32_avx2(s, _mm256_loadu_si256((const __m256i*) (volumes + channel)));
+        _mm256_storeu_si256((__m256i*) samples, _mm256_srli_epi32(s, 8));
+
+        if ((channel += LANES) >= wrap)
+            channel -= wrap;
+    }
+
+    if ((length %= sizeof(uint32_t) * LANES) > 0)
+        fallback_s24_32ne(samples, volumes + channel, channels, length);
+}
+
+static void pa_volume_s24_32re_avx2(uint32_t *samples, const int32_t *volumes, unsigned channels, unsigned length) {
+    unsigned n, channel = 0, wrap = wrap_channels(channels);
+
+    for (n = length / sizeof(uint32_t) / LANES; n > 0; n--, samples += LANES) {
+        __m256i s = _mm256_slli_epi32(bswap32_avx2(_mm256_loadu_si256((__m256i*) samples)), 8);
+
+        s = volume_s32_avx2(s, _mm256_loadu_si256((const __m256i*) (volumes + channel)));
+        _mm256_storeu_si256((__m256i*) samples, bswap32_avx2(_mm256_srli_epi32(s, 8)));
+
+        if ((channel += LANES) >= wrap)
+            channel -= wrap;
+    }
+
+    if ((length %= sizeof(uint32_t) * LANES) > 0)
+        fallback_s24_32re(samples, volumes + channel, channels, length);
+}
+
+void pa_volume_func_init_avx2(pa_cpu_x86_flag_t flags) {
+    if (flags & PA_CPU_X86_AVX2) {
+        pa_log_info("Initialising AVX2 optimized 32 bit volume functions.");
+
+        if (!fallback_float32ne) {
+            fallback_float32ne = pa_get_volume_func(PA_SAMPLE_FLOAT32NE);
+            fallback_float32re = pa_get_volume_func(PA_SAMPLE_FLOAT32RE);
+            fallback_s32ne = pa_get_volume_func(PA_SAMPLE_S32NE);
+            fallback_s32re = pa_get_volume_func(PA_SAMPLE_S32RE);
+            fallback_s24_32ne = pa_get_volume_func(PA_SAMPLE_S24_32NE);
+            fallback_s24_32re = pa_get_volume_func(PA_SAMPLE_S24_32RE);
+        }
+
+        pa_set_volume_func(PA_SAMPLE_FLOAT32NE, (pa_do_volume_func_t) pa_volume_float32ne_avx2);
+        pa_set_volume_func(PA_SAMPLE_FLOAT32RE, (pa_do_volume_func_t) pa_volume_float32re_avx2);
+        pa_set_volume_func(PA_SAMPLE_S32NE, (pa_do_volume_func_t) pa_volume_s32ne_avx2);
+        pa_set_volume_func(PA_SAMPLE_S32RE, (pa_do_volume_func_t) pa_volume_s32re_avx2);
+        pa_set_volume_func(PA_SAMPLE_S24_32NE, (pa_do_volume_func_t) pa_volume_s24_32ne_avx2);
+        pa_set_volume_func(PA_SAMPLE_S24_32RE, (pa_do_volume_func_t) pa_volume_s24_32re_avx2);
+    }
+}
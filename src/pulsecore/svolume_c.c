@@ -24,6 +24,8 @@
 #include <config.h>
 #endif
 
+#include <math.h>
+
 #include <pulsecore/macro.h>
 #include <pulsecore/g711.h>
 #include <pulsecore/endianmacros.h>
@@ -273,3 +275,55 @@ void pa_set_volume_func(pa_sample_format_t f, pa_do_volume_func_t func) {
 
     do_volume_table[f] = func;
 }
+
+/* The gain is computed for every frame rather than accumulated, so the
+ * vectorized versions can give exactly the same results */
+
+static void pa_volume_ramp_s16ne_c(int16_t *samples, float gain, float step, unsigned channels, unsigned length) {
+    unsigned frame, channel;
+
+    length /= sizeof(int16_t) * channels;
+
+    for (frame = 0; frame < length; frame++) {
+        float g = gain + step * (float) frame;
+
+        for (channel = 0; channel < channels; channel++) {
+            float t = (float) *samples * g;
+
+            t = PA_CLAMP_UNLIKELY(t, -32768.0f, 32767.0f);
+            *samples++ = (int16_t) lrintf(t);
+        }
+    }
+}
+
+static void pa_volume_ramp_float32ne_c(float *samples, float gain, float step, unsigned channels, unsigned length) {
+    unsigned frame, channel;
+
+    length /= sizeof(float) * channels;
+
+    for (frame = 0; frame < length; frame++) {
+        float g = gain + step * (float) frame;
+
+        for (channel = 0; channel < channels; channel++, samples++)
+            *samples = *samples * g;
+    }
+}
+
+static pa_do_volume_ramp_func_t do_volume_ramp_table[PA_SAMPLE_MAX] = {
+    [PA_SAMPLE_S16NE]     = (pa_do_volume_ramp_func_t) pa_volume_ramp_s16ne_c,
+    [PA_SAMPLE_FLOAT32NE] = (pa_do_volume_ramp_func_t) pa_volume_ramp_float32ne_c
+};
+
+pa_do_volume_ramp_func_t pa_get_volume_ramp_func(pa_sample_format_t f) {
+    pa_assert(f >= 0);
+    pa_assert(f < PA_SAMPLE_MAX);
+
+    return do_volume_ramp_table[f];
+}
+
+void pa_set_volume_ramp_func(pa_sample_format_t f, pa_do_volume_ramp_func_t func) {
+    pa_assert(f >= 0);
+    pa_assert(f < PA_SAMPLE_MAX);
+
+    do_volume_ramp_table[f] = func;
+}
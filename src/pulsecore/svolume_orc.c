@@ -32,6 +32,7 @@
 #include <pulsecore/svolume-orc-gen.h>
 
 pa_do_volume_func_t fallback;
+static pa_do_volume_func_t fallback_float;
 
 static void
 pa_volume_s16ne_orc(int16_t *samples, const int32_t *volumes, unsigned channels, unsigned length) {
@@ -44,9 +45,46 @@ pa_volume_s16ne_orc(int16_t *samples, const int32_t *volumes, unsigned channels,
         fallback(samples, volumes, channels, length);
 }
 
+/* Whether all channels have the same volume, so that the channel layout
+ * doesn't matter */
+static pa_bool_t volumes_are_flat(const float *volumes, unsigned channels) {
+    unsigned c;
+
+    for (c = 1; c < channels; c++)
+        if (volumes[c] != volumes[0])
+            return FALSE;
+
+    return TRUE;
+}
+
+static void
+pa_volume_float32ne_orc(float *samples, const float *volumes, unsigned channels, unsigned length) {
+    if (volumes_are_flat(volumes, channels))
+        pa_volume_float32ne_orc_1ch (samples, volumes[0], length / (sizeof(float)));
+    else if (channels == 2) {
+        union { float f; uint32_t u; } l, r;
+        int64_t v;
+
+        l.f = volumes[0];
+        r.f = volumes[1];
+        v = (int64_t)r.u << 32 | l.u;
+        pa_volume_float32ne_orc_2ch (samples, v, ((length / (sizeof(float))) / 2));
+    } else
+        fallback_float(samples, volumes, channels, length);
+}
+
 void pa_volume_func_init_orc(void) {
     pa_log_info("Initialising ORC optimized volume functions.");
 
-    fallback = pa_get_volume_func(PA_SAMPLE_S16NE);
+    if (!fallback)
+        fallback = pa_get_volume_func(PA_SAMPLE_S16NE);
     pa_set_volume_func(PA_SAMPLE_S16NE, (pa_do_volume_func_t) pa_volume_s16ne_orc);
 }
+
+void pa_volume_float32_func_init_orc(void) {
+    pa_log_info("Initialising ORC optimized float volume functions.");
+
+    if (!fallback_float)
+        fallback_float = pa_get_volume_func(PA_SAMPLE_FLOAT32NE);
+    pa_set_volume_func(PA_SAMPLE_FLOAT32NE, (pa_do_volume_func_t) pa_volume_float32ne_orc);
+}
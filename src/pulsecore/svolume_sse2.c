@@ -0,0 +1,259 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <math.h>
+
+#include <pulsecore/macro.h>
+#include <pulsecore/log.h>
+
+#include "cpu-x86.h"
+#include "sample-util.h"
+#include "simd-x86.h"
+
+/* SSE2 intrinsics versions of the 32 bit volume functions. The s16
+ * ones are inline assembly in svolume_sse.c.
+ *
+ * The volume array repeats the channel volumes for some padding, so
+ * we can always load four consecutive volumes starting at the current
+ * channel, as long as we wrap around at a multiple of the channel
+ * count that is at least four. The leftover samples are handed to the
+ * previous implementation, with the volume array rotated to the
+ * current channel. */
+
+#define LANES 4
+
+static pa_do_volume_func_t fallback_float32ne, fallback_float32re;
+static pa_do_volume_func_t fallback_s32ne, fallback_s32re;
+static pa_do_volume_func_t fallback_s24_32ne, fallback_s24_32re;
+
+static unsigned wrap_channels(unsigned channels) {
+    return (LANES + channels - 1) / channels * channels;
+}
+
+/* (s * c) >> 16 with saturation, just like the C version */
+static inline __m128i volume_s32_sse2(__m128i s, __m128i c) {
+    const __m128i low = _mm_set_epi32(0, -1, 0, -1);
+    __m128i e, o;
+
+    e = sat_s64_sse2(sra16_s64_sse2(mul_s32_sse2(s, c)));
+    o = sat_s64_sse2(sra16_s64_sse2(mul_s32_sse2(_mm_srli_epi64(s, 32), _mm_srli_epi64(c, 32))));
+
+    return _mm_or_si128(_mm_and_si128(e, low), _mm_slli_epi64(o, 32));
+}
+
+static void pa_volume_float32ne_sse2(float *samples, const float *volumes, unsigned channels, unsigned length) {
+    unsigned n, channel = 0, wrap = wrap_channels(channels);
+
+    for (n = length / sizeof(float) / LANES; n > 0; n--, samples += LANES) {
+        _mm_storeu_ps(samples, _mm_mul_ps(_mm_loadu_ps(samples), _mm_loadu_ps(volumes + channel)));
+
+        if ((channel += LANES) >= wrap)
+            channel -= wrap;
+    }
+
+    if ((length %= sizeof(float) * LANES) > 0)
+        fallback_float32ne(samples, volumes + channel, channels, length);
+}
+
+static void pa_volume_float32re_sse2(float *samples, const float *volumes, unsigned channels, unsigned length) {
+    unsigned n, channel = 0, wrap = wrap_channels(channels);
+
+    for (n = length / sizeof(float) / LANES; n > 0; n--, samples += LANES) {
+        __m128 s = _mm_castsi128_ps(bswap32_sse2(_mm_loadu_si128((__m128i*) samples)));
+
+        s = _mm_mul_ps(s, _mm_loadu_ps(volumes + channel));
+        _mm_storeu_si128((__m128i*) samples, bswap32_sse2(_mm_castps_si128(s)));
+
+        if ((channel += LANES) >= wrap)
+            channel -= wrap;
+    }
+
+    if ((length %= sizeof(float) * LANES) > 0)
+        fallback_float32re(samples, volumes + channel, channels, length);
+}
+
+static void pa_volume_s32ne_sse2(int32_t *samples, const int32_t *volumes, unsigned channels, unsigned length) {
+    unsigned n, channel = 0, wrap = wrap_channels(channels);
+
+    for (n = length / sizeof(int32_t) / LANES; n > 0; n--, samples += LANES) {
+        __m128i s = _mm_loadu_si128((__m128i*) samples);
+
+        s = volume_s32_sse2(s, _mm_loadu_si128((const __m128i*) (volumes + channel)));
+        _mm_storeu_si128((__m128i*) samples, s);
+
+        if ((channel += LANES) >= wrap)
+            channel -= wrap;
+    }
+
+    if ((length %= sizeof(int32_t) * LANES) > 0)
+        fallback_s32ne(samples, volumes + channel, channels, length);
+}
+
+static void pa_volume_s32re_sse2(int32_t *samples, const int32_t *volumes, unsigned channels, unsigned length) {
+    unsigned n, channel = 0, wrap = wrap_channels(channels);
+
+    for (n = length / sizeof(int32_t) / LANES; n > 0; n--, samples += LANES) {
+        __m128i s = bswap32_sse2(_mm_loadu_si128((__m128i*) samples));
+
+        s = volume_s32_sse2(s, _mm_loadu_si128((const __m128i*) (volumes + channel)));
+        _mm_storeu_si128((__m128i*) samples, bswap32_sse2(s));
+
+        if ((channel += LANES) >= wrap)
+            channel -= wrap;
+    }
+
+    if ((length %= sizeof(int32_t) * LANES) > 0)
+        fallback_s32re(samples, volumes + channel, channels, length);
+}
+
+static void pa_volume_s24_32ne_sse2(uint32_t *samples, const int32_t *volumes, unsigned channels, unsigned length) {
+    unsigned n, channel = 0, wrap = wrap_channels(channels);
+
+    for (n = length / sizeof(uint32_t) / LANES; n > 0; n--, samples += LANES) {
+        __m128i s = _mm_slli_epi32(_mm_loadu_si128((__m128i*) samples), 8);
+
+        s = volume_s32_sse2(s, _mm_loadu_si128((const __m128i*) (volumes + channel)));
+        _mm_storeu_si128((__m128i*) samples, _mm_srli_epi32(s, 8));
+
+        if ((channel += LANES) >= wrap)
+            channel -= wrap;
+    }
+
+    if ((length %= sizeof(uint32_t) * LANES) > 0)
+        fallback_s24_32ne(samples, volumes + channel, channels, length);
+}
+
+static void pa_volume_s24_32re_sse2(uint32_t *samples, const int32_t *volumes, unsigned channels, unsigned length) {
+    unsigned n, channel = 0, wrap = wrap_channels(channels);
+
+    for (n = length / sizeof(uint32_t) / LANES; n > 0; n--, samples += LANES) {
+        __m128i s = _mm_slli_epi32(bswap32_sse2(_mm_loadu_si128((__m128i*) samples)), 8);
+
+        s = volume_s32_sse2(s, _mm_loadu_si128((const __m128i*) (volumes + channel)));
+        _mm_storeu_si128((__m128i*) samples, bswap32_sse2(_mm_srli_epi32(s, 8)));
+
+        if ((channel += LANES) >= wrap)
+            channel -= wrap;
+    }
+
+    if ((length %= sizeof(uint32_t) * LANES) > 0)
+        fallback_s24_32re(samples, volumes + channel, channels, length);
+}
+
+/* The gain ramps. Within a period of channels vectors the frame of
+ * every sample repeats, eight resp. four frames further on. The frames
+ * stay small integers, so the gains are exactly those of the C
+ * version, and so is the rounding. */
+
+static void ramp_frames(float *frame, unsigned channels, unsigned lanes) {
+    unsigned k;
+
+    for (k = 0; k < channels * lanes; k++)
+        frame[k] = (float) (k / channels);
+}
+
+static void pa_volume_ramp_s16ne_sse2(int16_t *samples, float gain, float step, unsigned channels, unsigned length) {
+    PA_DECLARE_ALIGNED(16, float, frame[PA_CHANNELS_MAX * 8]);
+    const __m128 lo = _mm_set1_ps(-32768.0f), hi = _mm_set1_ps(32767.0f);
+    const __m128 g = _mm_set1_ps(gain), st = _mm_set1_ps(step);
+    unsigned i, n, k = 0;
+    float base = 0.0f;
+
+    ramp_frames(frame, channels, 8);
+    n = length / sizeof(int16_t);
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        __m128 b = _mm_set1_ps(base);
+        __m128 g0 = _mm_add_ps(g, _mm_mul_ps(st, _mm_add_ps(b, _mm_load_ps(frame + k))));
+        __m128 g1 = _mm_add_ps(g, _mm_mul_ps(st, _mm_add_ps(b, _mm_load_ps(frame + k + 4))));
+        __m128i v = _mm_loadu_si128((__m128i*) (samples + i));
+        __m128 s0 = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16));
+        __m128 s1 = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16));
+
+        s0 = _mm_min_ps(_mm_max_ps(_mm_mul_ps(s0, g0), lo), hi);
+        s1 = _mm_min_ps(_mm_max_ps(_mm_mul_ps(s1, g1), lo), hi);
+        _mm_storeu_si128((__m128i*) (samples + i), _mm_packs_epi32(_mm_cvtps_epi32(s0), _mm_cvtps_epi32(s1)));
+
+        if ((k += 8) >= channels * 8) {
+            k = 0;
+            base += 8.0f;
+        }
+    }
+
+    for (; i < n; i++) {
+        float t = (float) samples[i] * (gain + step * (float) (i / channels));
+
+        t = PA_CLAMP_UNLIKELY(t, -32768.0f, 32767.0f);
+        samples[i] = (int16_t) lrintf(t);
+    }
+}
+
+static void pa_volume_ramp_float32ne_sse2(float *samples, float gain, float step, unsigned channels, unsigned length) {
+    PA_DECLARE_ALIGNED(16, float, frame[PA_CHANNELS_MAX * LANES]);
+    const __m128 g = _mm_set1_ps(gain), st = _mm_set1_ps(step);
+    unsigned i, n, k = 0;
+    float base = 0.0f;
+
+    ramp_frames(frame, channels, LANES);
+    n = length / sizeof(float);
+
+    for (i = 0; i + LANES <= n; i += LANES) {
+        __m128 gv = _mm_add_ps(g, _mm_mul_ps(st, _mm_add_ps(_mm_set1_ps(base), _mm_load_ps(frame + k))));
+
+        _mm_storeu_ps(samples + i, _mm_mul_ps(_mm_loadu_ps(samples + i), gv));
+
+        if ((k += LANES) >= channels * LANES) {
+            k = 0;
+            base += (float) LANES;
+        }
+    }
+
+    for (; i < n; i++)
+        samples[i] = samples[i] * (gain + step * (float) (i / channels));
+}
+
+void pa_volume_func_init_sse2(pa_cpu_x86_flag_t flags) {
+    if (flags & PA_CPU_X86_SSE2) {
+        pa_log_info("Initialising SSE2 optimized 32 bit volume and ramp functions.");
+
+        /* On a second init the current functions would be our own */
+        if (!fallback_float32ne) {
+            fallback_float32ne = pa_get_volume_func(PA_SAMPLE_FLOAT32NE);
+            fallback_float32re = pa_get_volume_func(PA_SAMPLE_FLOAT32RE);
+            fallback_s32ne = pa_get_volume_func(PA_SAMPLE_S32NE);
+            fallback_s32re = pa_get_volume_func(PA_SAMPLE_S32RE);
+            fallback_s24_32ne = pa_get_volume_func(PA_SAMPLE_S24_32NE);
+            fallback_s24_32re = pa_get_volume_func(PA_SAMPLE_S24_32RE);
+        }
+
+        pa_set_volume_func(PA_SAMPLE_FLOAT32NE, (pa_do_volume_func_t) pa_volume_float32ne_sse2);
+        pa_set_volume_func(PA_SAMPLE_FLOAT32RE, (pa_do_volume_func_t) pa_volume_float32re_sse2);
+        pa_set_volume_func(PA_SAMPLE_S32NE, (pa_do_volume_func_t) pa_volume_s32ne_sse2);
+        pa_set_volume_func(PA_SAMPLE_S32RE, (pa_do_volume_func_t) pa_volume_s32re_sse2);
+        pa_set_volume_func(PA_SAMPLE_S24_32NE, (pa_do_volume_func_t) pa_volume_s24_32ne_sse2);
+        pa_set_volume_func(PA_SAMPLE_S24_32RE, (pa_do_volume_func_t) pa_volume_s24_32re_sse2);
+
+        pa_set_volume_ramp_func(PA_SAMPLE_S16NE, (pa_do_volume_ramp_func_t) pa_volume_ramp_s16ne_sse2);
+        pa_set_volume_ramp_func(PA_SAMPLE_FLOAT32NE, (pa_do_volume_ramp_func_t) pa_volume_ramp_float32ne_sse2);
+    }
+}
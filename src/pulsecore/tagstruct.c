@@ -37,6 +37,7 @@
 
 #include <pulsecore/socket.h>
 #include <pulsecore/macro.h>
+#include <pulsecore/flist.h>
 
 #include "tagstruct.h"
 
@@ -47,52 +48,105 @@ struct pa_tagstruct {
     size_t length, allocated;
     size_t rindex;
 
+    /* Dynamic tagstructs are built right inside the packet that is sent
+     * later on */
     pa_bool_t dynamic;
+    pa_packet *packet;
 };
 
+PA_STATIC_FLIST_DECLARE(tagstructs, 0, pa_xfree);
+
+static pa_tagstruct *tagstruct_new(void) {
+    pa_tagstruct *t;
+
+    if (!(t = pa_flist_pop(PA_STATIC_FLIST_GET(tagstructs))))
+        t = pa_xnew(pa_tagstruct, 1);
+
+    t->data = NULL;
+    t->length = t->allocated = 0;
+    t->rindex = 0;
+    t->dynamic = FALSE;
+    t->packet = NULL;
+
+    return t;
+}
+
+static void tagstruct_free(pa_tagstruct *t) {
+    if (pa_flist_push(PA_STATIC_FLIST_GET(tagstructs), t) < 0)
+        pa_xfree(t);
+}
+
 pa_tagstruct *pa_tagstruct_new(const uint8_t* data, size_t length) {
     pa_tagstruct*t;
 
     pa_assert(!data || (data && length));
 
-    t = pa_xnew(pa_tagstruct, 1);
+    t = tagstruct_new();
     t->data = (uint8_t*) data;
     t->allocated = t->length = data ? length : 0;
-    t->rindex = 0;
     t->dynamic = !data;
 
     return t;
 }
 
+pa_tagstruct *pa_tagstruct_new_sized(size_t size) {
+    pa_tagstruct *t;
+
+    pa_assert(size > 0);
+
+    t = tagstruct_new();
+    t->dynamic = TRUE;
+    t->packet = pa_packet_new(size);
+    t->data = t->packet->data;
+    t->allocated = t->packet->allocated;
+
+    return t;
+}
+
 void pa_tagstruct_free(pa_tagstruct*t) {
     pa_assert(t);
 
-    if (t->dynamic)
-        pa_xfree(t->data);
-    pa_xfree(t);
+    if (t->packet)
+        pa_packet_unref(t->packet);
+    tagstruct_free(t);
 }
 
-uint8_t* pa_tagstruct_free_data(pa_tagstruct*t, size_t *l) {
-    uint8_t *p;
+pa_packet* pa_tagstruct_free_packet(pa_tagstruct*t) {
+    pa_packet *p;
 
     pa_assert(t);
     pa_assert(t->dynamic);
-    pa_assert(l);
+    pa_assert(t->packet);
+    pa_assert(t->length > 0);
 
-    p = t->data;
-    *l = t->length;
-    pa_xfree(t);
+    p = pa_packet_resize(t->packet, t->length);
+    tagstruct_free(t);
     return p;
 }
 
 static void extend(pa_tagstruct*t, size_t l) {
+    size_t n;
+
     pa_assert(t);
     pa_assert(t->dynamic);
 
     if (t->length+l <= t->allocated)
         return;
 
-    t->data = pa_xrealloc(t->data, t->allocated = t->length+l+100);
+    if (!t->packet) {
+        t->packet = pa_packet_new(l);
+        t->data = t->packet->data;
+        t->allocated = t->packet->allocated;
+        return;
+    }
+
+    /* Grow geometrically, large replies would otherwise be reallocated
+     * over and over again */
+    n = PA_MAX(t->length+l, t->allocated*2);
+
+    t->packet = pa_packet_resize(t->packet, n);
+    t->data = t->packet->data;
+    t->allocated = t->packet->allocated;
 }
 
 void pa_tagstruct_puts(pa_tagstruct*t, const char *s) {
@@ -429,6 +483,21 @@ const uint8_t* pa_tagstruct_data(pa_tagstruct*t, size_t *l) {
     return t->data;
 }
 
+size_t pa_tagstruct_get_read_index(pa_tagstruct *t) {
+    pa_assert(t);
+
+    return t->rindex;
+}
+
+const uint8_t* pa_tagstruct_get_read_data(pa_tagstruct *t, size_t start, size_t *l) {
+    pa_assert(t);
+    pa_assert(start <= t->rindex);
+    pa_assert(l);
+
+    *l = t->rindex - start;
+    return t->data + start;
+}
+
 int pa_tagstruct_get_boolean(pa_tagstruct*t, pa_bool_t *b) {
     pa_assert(t);
     pa_assert(b);
@@ -33,6 +33,7 @@
 #include <pulse/proplist.h>
 
 #include <pulsecore/macro.h>
+#include <pulsecore/packet.h>
 
 typedef struct pa_tagstruct pa_tagstruct;
 
@@ -63,12 +64,20 @@ enum {
 };
 
 pa_tagstruct *pa_tagstruct_new(const uint8_t* data, size_t length);
+/* Like pa_tagstruct_new(NULL, 0), with room for size bytes up front */
+pa_tagstruct *pa_tagstruct_new_sized(size_t size);
 void pa_tagstruct_free(pa_tagstruct*t);
-uint8_t* pa_tagstruct_free_data(pa_tagstruct*t, size_t *l);
+/* Frees the tagstruct and returns the packet it was written into */
+pa_packet* pa_tagstruct_free_packet(pa_tagstruct*t);
 
 int pa_tagstruct_eof(pa_tagstruct*t);
 const uint8_t* pa_tagstruct_data(pa_tagstruct*t, size_t *l);
 
+/* The position of the read pointer, and the data read since it was at
+ * start. For keeping a copy of one entry of a longer reply around. */
+size_t pa_tagstruct_get_read_index(pa_tagstruct *t);
+const uint8_t* pa_tagstruct_get_read_data(pa_tagstruct *t, size_t start, size_t *l);
+
 void pa_tagstruct_put(pa_tagstruct *t, ...);
 
 void pa_tagstruct_puts(pa_tagstruct*t, const char *s);
@@ -32,6 +32,8 @@
 
 #include "thread-mq.h"
 
+#define RESERVED_MESSAGES 32
+
 PA_STATIC_TLS_DECLARE_NO_FREE(thread_mq);
 
 static void asyncmsgq_read_cb(pa_mainloop_api*api, pa_io_event* e, int fd, pa_io_event_flags_t events, void *userdata) {
@@ -122,6 +124,11 @@ void pa_thread_mq_install(pa_thread_mq *q) {
 
     pa_assert(!(PA_STATIC_TLS_GET(thread_mq)));
     PA_STATIC_TLS_SET(thread_mq, q);
+
+    /* So that the thread can post its replies without allocating.
+     * Done from the thread itself, which also sets up its cache of
+     * message items before it goes realtime. */
+    pa_asyncmsgq_reserve(RESERVED_MESSAGES);
 }
 
 pa_thread_mq *pa_thread_mq_get(void) {
@@ -28,7 +28,14 @@
 
 /* Two way communication between a thread and a mainloop. Before the
  * thread is started a pa_thread_mq should be initialized and than
- * attached to the thread using pa_thread_mq_install(). */
+ * attached to the thread using pa_thread_mq_install().
+ *
+ * The thread's side never blocks: both queues are lock-free, the
+ * thread is woken up through an fdsem, and it answers a
+ * pa_asyncmsgq_send() by posting a semaphore. Message items for its
+ * replies are preallocated, so as long as the mainloop keeps up the
+ * thread doesn't allocate either. A main thread that is preempted
+ * while queueing a message therefore can't hold the thread up. */
 
 typedef struct pa_thread_mq {
     pa_mainloop_api *mainloop;
@@ -35,6 +35,7 @@
 #include <pulse/xmalloc.h>
 #include <pulsecore/atomic.h>
 #include <pulsecore/macro.h>
+#include <pulsecore/memowner.h>
 
 #include "thread.h"
 
@@ -45,6 +46,10 @@ struct pa_thread {
     pa_atomic_t running;
     pa_bool_t joined;
     char *name;
+
+    /* Inherited from the creating thread, only used until the thread
+     * has started */
+    pa_memowner *memowner;
 };
 
 struct pa_tls {
@@ -67,6 +72,7 @@ PA_STATIC_TLS_DECLARE(current_thread, thread_free_cb);
 
 static void* internal_thread_func(void *userdata) {
     pa_thread *t = userdata;
+    pa_memowner *memowner;
     pa_assert(t);
 
 #ifdef __linux__
@@ -79,10 +85,20 @@ static void* internal_thread_func(void *userdata) {
 
     PA_STATIC_TLS_SET(current_thread, t);
 
+    if ((memowner = t->memowner)) {
+        t->memowner = NULL;
+        pa_memowner_set_current(memowner);
+    }
+
     pa_atomic_inc(&t->running);
     t->thread_func(t->userdata);
     pa_atomic_sub(&t->running, 2);
 
+    if (memowner) {
+        pa_memowner_set_current(NULL);
+        pa_memowner_unref(memowner);
+    }
+
     return NULL;
 }
 
@@ -96,7 +112,12 @@ pa_thread* pa_thread_new(const char *name, pa_thread_func_t thread_func, void *u
     t->thread_func = thread_func;
     t->userdata = userdata;
 
+    if ((t->memowner = pa_memowner_get_current()))
+        pa_memowner_ref(t->memowner);
+
     if (pthread_create(&t->id, NULL, internal_thread_func, t) < 0) {
+        if (t->memowner)
+            pa_memowner_unref(t->memowner);
         pa_xfree(t);
         return NULL;
     }
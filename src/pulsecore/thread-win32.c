@@ -29,6 +29,7 @@
 
 #include <pulse/xmalloc.h>
 #include <pulsecore/once.h>
+#include <pulsecore/memowner.h>
 
 #include "thread.h"
 
@@ -36,6 +37,10 @@ struct pa_thread {
     HANDLE thread;
     pa_thread_func_t thread_func;
     void *userdata;
+
+    /* Inherited from the creating thread, only used until the thread
+     * has started */
+    pa_memowner *memowner;
 };
 
 struct pa_tls {
@@ -60,13 +65,24 @@ static void thread_tls_once_func(void) {
 
 static DWORD WINAPI internal_thread_func(LPVOID param) {
     pa_thread *t = param;
+    pa_memowner *memowner;
     assert(t);
 
     pa_run_once(&thread_tls_once, thread_tls_once_func);
     pa_tls_set(thread_tls, t);
 
+    if ((memowner = t->memowner)) {
+        t->memowner = NULL;
+        pa_memowner_set_current(memowner);
+    }
+
     t->thread_func(t->userdata);
 
+    if (memowner) {
+        pa_memowner_set_current(NULL);
+        pa_memowner_unref(memowner);
+    }
+
     return 0;
 }
 
@@ -80,9 +96,14 @@ pa_thread* pa_thread_new(const char *name, pa_thread_func_t thread_func, void *u
     t->thread_func = thread_func;
     t->userdata = userdata;
 
+    if ((t->memowner = pa_memowner_get_current()))
+        pa_memowner_ref(t->memowner);
+
     t->thread = CreateThread(NULL, 0, internal_thread_func, t, 0, &thread_id);
 
     if (!t->thread) {
+        if (t->memowner)
+            pa_memowner_unref(t->memowner);
         pa_xfree(t);
         return NULL;
     }
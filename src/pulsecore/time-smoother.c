@@ -30,6 +30,7 @@
 #include <pulse/xmalloc.h>
 
 #include <pulsecore/macro.h>
+#include <pulsecore/atomic.h>
 
 #include "time-smoother.h"
 
@@ -58,9 +59,9 @@
  * guaranteed to be monotonic.
  */
 
-struct pa_smoother {
-    pa_usec_t adjust_time, history_time;
-
+/* Everything needed to evaluate the estimation function. The writer
+ * publishes a copy of this to concurrent readers as a whole. */
+struct curve {
     pa_usec_t time_offset;
 
     pa_usec_t px, py;     /* Point p, where we want to reach stability */
@@ -68,6 +69,19 @@ struct pa_smoother {
 
     pa_usec_t ex, ey;     /* Point e, which we estimated before and need to smooth to */
     double de;            /* Gradient we estimated for point e */
+
+    /* Cached parameters for our interpolation polynomial y=ax^3+b^2+cx */
+    double a, b, c;
+    pa_bool_t abc_valid:1;
+
+    pa_bool_t paused:1;
+    pa_usec_t pause_time;
+};
+
+struct pa_smoother {
+    pa_usec_t adjust_time, history_time;
+
+    struct curve curve;
     pa_usec_t ry;         /* The original y value for ex */
 
                           /* History of last measurements */
@@ -77,17 +91,16 @@ struct pa_smoother {
     /* To even out for monotonicity */
     pa_usec_t last_y, last_x;
 
-    /* Cached parameters for our interpolation polynomial y=ax^3+b^2+cx */
-    double a, b, c;
-    pa_bool_t abc_valid:1;
-
     pa_bool_t monotonic:1;
-    pa_bool_t paused:1;
     pa_bool_t smoothing:1; /* If FALSE we skip the polynomial interpolation step */
 
-    pa_usec_t pause_time;
-
     unsigned min_history;
+
+    /* Two copies of the curve for pa_smoother_peek(). While one is
+     * being updated readers use the other one, the lowest bit of the
+     * sequence number tells which. */
+    pa_atomic_t sequence;
+    struct curve published[2];
 };
 
 pa_smoother* pa_smoother_new(
@@ -112,6 +125,7 @@ pa_smoother* pa_smoother_new(
     s->min_history = min_history;
     s->monotonic = monotonic;
     s->smoothing = smoothing;
+    pa_atomic_store(&s->sequence, 0);
 
     pa_smoother_reset(s, time_offset, paused);
 
@@ -243,23 +257,23 @@ static double avg_gradient(pa_smoother *s, pa_usec_t x) {
     return (s->monotonic && r < 0) ? 0 : r;
 }
 
-static void calc_abc(pa_smoother *s) {
+static void calc_abc(struct curve *c) {
     pa_usec_t ex, ey, px, py;
     int64_t kx, ky;
     double de, dp;
 
-    pa_assert(s);
+    pa_assert(c);
 
-    if (s->abc_valid)
+    if (c->abc_valid)
         return;
 
     /* We have two points: (ex|ey) and (px|py) with two gradients at
      * these points de and dp. We do a polynomial
      * interpolation of degree 3 with these 6 values */
 
-    ex = s->ex; ey = s->ey;
-    px = s->px; py = s->py;
-    de = s->de; dp = s->dp;
+    ex = c->ex; ey = c->ey;
+    px = c->px; py = c->py;
+    de = c->de; dp = c->dp;
 
     pa_assert(ex < px);
 
@@ -269,25 +283,25 @@ static void calc_abc(pa_smoother *s) {
     ky = (int64_t) py - (int64_t) ey;
 
     /* Calculate a, b, c for y=ax^3+bx^2+cx */
-    s->c = de;
-    s->b = (((double) (3*ky)/ (double) kx - dp - (double) (2*de))) / (double) kx;
-    s->a = (dp/(double) kx - 2*s->b - de/(double) kx) / (double) (3*kx);
+    c->c = de;
+    c->b = (((double) (3*ky)/ (double) kx - dp - (double) (2*de))) / (double) kx;
+    c->a = (dp/(double) kx - 2*c->b - de/(double) kx) / (double) (3*kx);
 
-    s->abc_valid = TRUE;
+    c->abc_valid = TRUE;
 }
 
-static void estimate(pa_smoother *s, pa_usec_t x, pa_usec_t *y, double *deriv) {
-    pa_assert(s);
+static void estimate(struct curve *c, pa_bool_t monotonic, pa_usec_t x, pa_usec_t *y, double *deriv) {
+    pa_assert(c);
     pa_assert(y);
 
-    if (x >= s->px) {
+    if (x >= c->px) {
         /* Linear interpolation right from px */
         int64_t t;
 
         /* The requested point is right of the point where we wanted
          * to be on track again, thus just linearly estimate */
 
-        t = (int64_t) s->py + (int64_t) llrint(s->dp * (double) (x - s->px));
+        t = (int64_t) c->py + (int64_t) llrint(c->dp * (double) (x - c->px));
 
         if (t < 0)
             t = 0;
@@ -295,13 +309,13 @@ static void estimate(pa_smoother *s, pa_usec_t x, pa_usec_t *y, double *deriv) {
         *y = (pa_usec_t) t;
 
         if (deriv)
-            *deriv = s->dp;
+            *deriv = c->dp;
 
-    } else if (x <= s->ex) {
+    } else if (x <= c->ex) {
         /* Linear interpolation left from ex */
         int64_t t;
 
-        t = (int64_t) s->ey - (int64_t) llrint(s->de * (double) (s->ex - x));
+        t = (int64_t) c->ey - (int64_t) llrint(c->de * (double) (c->ex - x));
 
         if (t < 0)
             t = 0;
@@ -309,7 +323,7 @@ static void estimate(pa_smoother *s, pa_usec_t x, pa_usec_t *y, double *deriv) {
         *y = (pa_usec_t) t;
 
         if (deriv)
-            *deriv = s->de;
+            *deriv = c->de;
 
     } else {
         /* Spline interpolation between ex and px */
@@ -318,32 +332,58 @@ static void estimate(pa_smoother *s, pa_usec_t x, pa_usec_t *y, double *deriv) {
         /* Ok, we're not yet on track, thus let's interpolate, and
          * make sure that the first derivative is smooth */
 
-        calc_abc(s);
+        calc_abc(c);
 
         /* Move to origin */
-        tx = (double) (x - s->ex);
+        tx = (double) (x - c->ex);
 
         /* Horner scheme */
-        ty = (tx * (s->c + tx * (s->b + tx * s->a)));
+        ty = (tx * (c->c + tx * (c->b + tx * c->a)));
 
         /* Move back from origin */
-        ty += (double) s->ey;
+        ty += (double) c->ey;
 
         *y = ty >= 0 ? (pa_usec_t) llrint(ty) : 0;
 
         /* Horner scheme */
         if (deriv)
-            *deriv = s->c + (tx * (s->b*2 + tx * s->a*3));
+            *deriv = c->c + (tx * (c->b*2 + tx * c->a*3));
     }
 
     /* Guarantee monotonicity */
-    if (s->monotonic) {
+    if (monotonic) {
 
         if (deriv && *deriv < 0)
             *deriv = 0;
     }
 }
 
+/* Translates the system time x into the time domain of the curve */
+static pa_usec_t local_x(const struct curve *c, pa_usec_t x) {
+
+    if (c->paused)
+        x = c->pause_time;
+
+    return PA_LIKELY(x >= c->time_offset) ? x - c->time_offset : 0;
+}
+
+/* Makes the current curve visible to pa_smoother_peek(). Readers use
+ * the second copy while the first one is written and vice versa, so
+ * they never wait for us and only have to retry if they were
+ * preempted for longer than one update. */
+static void publish(pa_smoother *s) {
+    pa_assert(s);
+
+    /* Readers should not have to do any of the expensive work */
+    if (s->curve.ex < s->curve.px)
+        calc_abc(&s->curve);
+
+    pa_atomic_inc(&s->sequence);
+    s->published[0] = s->curve;
+    pa_atomic_inc(&s->sequence);
+    s->published[1] = s->curve;
+}
+
 void pa_smoother_put(pa_smoother *s, pa_usec_t x, pa_usec_t y) {
     pa_usec_t ney;
     double nde;
@@ -351,19 +391,15 @@ void pa_smoother_put(pa_smoother *s, pa_usec_t x, pa_usec_t y) {
 
     pa_assert(s);
 
-    /* Fix up x value */
-    if (s->paused)
-        x = s->pause_time;
-
-    x = PA_LIKELY(x >= s->time_offset) ? x - s->time_offset : 0;
+    x = local_x(&s->curve, x);
 
-    is_new = x >= s->ex;
+    is_new = x >= s->curve.ex;
 
     if (is_new) {
         /* First, we calculate the position we'd estimate for x, so that
          * we can adjust our position smoothly from this one */
-        estimate(s, x, &ney, &nde);
-        s->ex = x; s->ey = ney; s->de = nde;
+        estimate(&s->curve, s->monotonic, x, &ney, &nde);
+        s->curve.ex = x; s->curve.ey = ney; s->curve.de = nde;
         s->ry = y;
     }
 
@@ -371,21 +407,23 @@ void pa_smoother_put(pa_smoother *s, pa_usec_t x, pa_usec_t y) {
     add_to_history(s, x, y);
 
     /* And determine the average gradient of the history */
-    s->dp = avg_gradient(s, x);
+    s->curve.dp = avg_gradient(s, x);
 
     /* And calculate when we want to be on track again */
     if (s->smoothing) {
-        s->px = s->ex + s->adjust_time;
-        s->py = s->ry + (pa_usec_t) llrint(s->dp * (double) s->adjust_time);
+        s->curve.px = s->curve.ex + s->adjust_time;
+        s->curve.py = s->ry + (pa_usec_t) llrint(s->curve.dp * (double) s->adjust_time);
     } else {
-        s->px = s->ex;
-        s->py = s->ry;
+        s->curve.px = s->curve.ex;
+        s->curve.py = s->ry;
     }
 
-    s->abc_valid = FALSE;
+    s->curve.abc_valid = FALSE;
+
+    publish(s);
 
 #ifdef DEBUG_DATA
-    pa_log_debug("%p, put(%llu | %llu) = %llu", s, (unsigned long long) (x + s->time_offset), (unsigned long long) x, (unsigned long long) y);
+    pa_log_debug("%p, put(%llu | %llu) = %llu", s, (unsigned long long) (x + s->curve.time_offset), (unsigned long long) x, (unsigned long long) y);
 #endif
 }
 
@@ -394,17 +432,13 @@ pa_usec_t pa_smoother_get(pa_smoother *s, pa_usec_t x) {
 
     pa_assert(s);
 
-    /* Fix up x value */
-    if (s->paused)
-        x = s->pause_time;
-
-    x = PA_LIKELY(x >= s->time_offset) ? x - s->time_offset : 0;
+    x = local_x(&s->curve, x);
 
     if (s->monotonic)
         if (x <= s->last_x)
             x = s->last_x;
 
-    estimate(s, x, &y, NULL);
+    estimate(&s->curve, s->monotonic, x, &y, NULL);
 
     if (s->monotonic) {
 
@@ -418,16 +452,35 @@ pa_usec_t pa_smoother_get(pa_smoother *s, pa_usec_t x) {
     }
 
 #ifdef DEBUG_DATA
-    pa_log_debug("%p, get(%llu | %llu) = %llu", s, (unsigned long long) (x + s->time_offset), (unsigned long long) x, (unsigned long long) y);
+    pa_log_debug("%p, get(%llu | %llu) = %llu", s, (unsigned long long) (x + s->curve.time_offset), (unsigned long long) x, (unsigned long long) y);
 #endif
 
     return y;
 }
 
+pa_usec_t pa_smoother_peek(pa_smoother *s, pa_usec_t x) {
+    struct curve c;
+    pa_usec_t y;
+    int seq;
+
+    pa_assert(s);
+
+    do {
+        seq = pa_atomic_load(&s->sequence);
+        c = s->published[seq & 1];
+    } while (pa_atomic_load(&s->sequence) != seq);
+
+    estimate(&c, s->monotonic, local_x(&c, x), &y, NULL);
+
+    return y;
+}
+
 void pa_smoother_set_time_offset(pa_smoother *s, pa_usec_t offset) {
     pa_assert(s);
 
-    s->time_offset = offset;
+    s->curve.time_offset = offset;
+
+    publish(s);
 
 #ifdef DEBUG_DATA
     pa_log_debug("offset(%llu)", (unsigned long long) offset);
@@ -437,42 +490,48 @@ void pa_smoother_set_time_offset(pa_smoother *s, pa_usec_t offset) {
 void pa_smoother_pause(pa_smoother *s, pa_usec_t x) {
     pa_assert(s);
 
-    if (s->paused)
+    if (s->curve.paused)
         return;
 
 #ifdef DEBUG_DATA
     pa_log_debug("pause(%llu)", (unsigned long long) x);
 #endif
 
-    s->paused = TRUE;
-    s->pause_time = x;
+    s->curve.paused = TRUE;
+    s->curve.pause_time = x;
+
+    publish(s);
 }
 
 void pa_smoother_resume(pa_smoother *s, pa_usec_t x, pa_bool_t fix_now) {
     pa_assert(s);
 
-    if (!s->paused)
+    if (!s->curve.paused)
         return;
 
-    if (x < s->pause_time)
-        x = s->pause_time;
+    if (x < s->curve.pause_time)
+        x = s->curve.pause_time;
 
 #ifdef DEBUG_DATA
     pa_log_debug("resume(%llu)", (unsigned long long) x);
 #endif
 
-    s->paused = FALSE;
-    s->time_offset += x - s->pause_time;
+    s->curve.paused = FALSE;
+    s->curve.time_offset += x - s->curve.pause_time;
 
     if (fix_now)
         pa_smoother_fix_now(s);
+    else
+        publish(s);
 }
 
 void pa_smoother_fix_now(pa_smoother *s) {
     pa_assert(s);
 
-    s->px = s->ex;
-    s->py = s->ry;
+    s->curve.px = s->curve.ex;
+    s->curve.py = s->ry;
+
+    publish(s);
 }
 
 pa_usec_t pa_smoother_translate(pa_smoother *s, pa_usec_t x, pa_usec_t y_delay) {
@@ -481,18 +540,14 @@ pa_usec_t pa_smoother_translate(pa_smoother *s, pa_usec_t x, pa_usec_t y_delay)
 
     pa_assert(s);
 
-    /* Fix up x value */
-    if (s->paused)
-        x = s->pause_time;
-
-    x = PA_LIKELY(x >= s->time_offset) ? x - s->time_offset : 0;
+    x = local_x(&s->curve, x);
 
-    estimate(s, x, &ney, &nde);
+    estimate(&s->curve, s->monotonic, x, &ney, &nde);
 
     /* Play safe and take the larger gradient, so that we wakeup
      * earlier when this is used for sleeping */
-    if (s->dp > nde)
-        nde = s->dp;
+    if (s->curve.dp > nde)
+        nde = s->curve.dp;
 
 #ifdef DEBUG_DATA
     pa_log_debug("translate(%llu) = %llu (%0.2f)", (unsigned long long) y_delay, (unsigned long long) ((double) y_delay / nde), nde);
@@ -504,21 +559,23 @@ pa_usec_t pa_smoother_translate(pa_smoother *s, pa_usec_t x, pa_usec_t y_delay)
 void pa_smoother_reset(pa_smoother *s, pa_usec_t time_offset, pa_bool_t paused) {
     pa_assert(s);
 
-    s->px = s->py = 0;
-    s->dp = 1;
+    s->curve.px = s->curve.py = 0;
+    s->curve.dp = 1;
 
-    s->ex = s->ey = s->ry = 0;
-    s->de = 1;
+    s->curve.ex = s->curve.ey = s->ry = 0;
+    s->curve.de = 1;
 
     s->history_idx = 0;
     s->n_history = 0;
 
     s->last_y = s->last_x = 0;
 
-    s->abc_valid = FALSE;
+    s->curve.abc_valid = FALSE;
+
+    s->curve.paused = paused;
+    s->curve.time_offset = s->curve.pause_time = time_offset;
 
-    s->paused = paused;
-    s->time_offset = s->pause_time = time_offset;
+    publish(s);
 
 #ifdef DEBUG_DATA
     pa_log_debug("reset()");
@@ -44,6 +44,13 @@ void pa_smoother_put(pa_smoother *s, pa_usec_t x, pa_usec_t y);
 /* Returns an interpolated value based on the dataset. x = local/system time, return value = remote time */
 pa_usec_t pa_smoother_get(pa_smoother *s, pa_usec_t x);
 
+/* Like pa_smoother_get(), but may be called from any thread, even
+ * while the owner of the smoother updates it. Takes a constant amount
+ * of time and never blocks. Unlike pa_smoother_get() the queries are
+ * not remembered, hence successive return values are not guaranteed to
+ * be monotonic. x = local/system time, return value = remote time */
+pa_usec_t pa_smoother_peek(pa_smoother *s, pa_usec_t x);
+
 /* Translates a time span from the remote time domain to the local one. x = local/system time when to estimate, y_delay = remote time span */
 pa_usec_t pa_smoother_translate(pa_smoother *s, pa_usec_t x, pa_usec_t y_delay);
 
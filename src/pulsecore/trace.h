@@ -0,0 +1,47 @@
+#ifndef foopulsecoretracehfoo
+#define foopulsecoretracehfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+/* Static tracepoints of the provider "pulseaudio" in the audio path.
+ * They are USDT probes, which perf, bpftrace, SystemTap and LTTng (via
+ * uprobes) can attach to. A probe that is not attached costs a single
+ * nop. Unless configured with --enable-tracing they are not compiled in
+ * at all, and their arguments are not evaluated. */
+
+#ifdef HAVE_TRACING
+
+#include <sys/sdt.h>
+
+#define PA_TRACE(name) DTRACE_PROBE(pulseaudio, name)
+#define PA_TRACE1(name, a) DTRACE_PROBE1(pulseaudio, name, a)
+#define PA_TRACE2(name, a, b) DTRACE_PROBE2(pulseaudio, name, a, b)
+#define PA_TRACE3(name, a, b, c) DTRACE_PROBE3(pulseaudio, name, a, b, c)
+
+#else
+
+#define PA_TRACE(name) do { } while (0)
+#define PA_TRACE1(name, a) do { } while (0)
+#define PA_TRACE2(name, a, b) do { } while (0)
+#define PA_TRACE3(name, a, b, c) do { } while (0)
+
+#endif
+
+#endif
@@ -0,0 +1,221 @@
+#!/bin/sh
+#
+# Starts a private pulseaudio daemon with null sinks, runs a number of
+# stream-bench clients against it and writes a report of the CPU time
+# and context switches of the daemon and of the glitches the clients
+# saw. Optionally rtstutter keeps the CPUs busy meanwhile.
+#
+# Like test-daemon.sh this is meant to be run from the src/ directory
+# of a build tree, with stream-bench and rtstutter built.
+#
+
+SCRIPTNAME="$0"
+
+CLIENTS=1
+STREAMS=1
+SINKS=1
+DURATION=10
+STUTTER=
+REPORT=bench-report.txt
+CLIENT_ARGS=
+
+usage()
+{
+    cat <<EOF
+$SCRIPTNAME [options] [-- stream-bench options]
+
+  -c CLIENTS     Number of clients (defaults to 1)
+  -s STREAMS     Streams per client (defaults to 1)
+  -k SINKS       Number of null sinks, the clients are spread over them (defaults to 1)
+  -t SECONDS     How long the clients run (defaults to 10)
+  -S LOW:HIGH    Run rtstutter with freezes of LOW to HIGH ms meanwhile
+  -o FILE        Where to write the report (defaults to bench-report.txt)
+
+Everything after -- is passed to stream-bench, e.g. --tlength=20 --minreq=5
+or --record. See stream-bench --help.
+EOF
+}
+
+die()
+{
+    echo $SCRIPTNAME: $* >&2
+    cleanup
+    exit 1
+}
+
+cleanup()
+{
+    if ! test -z "$STUTTER_PID" ; then
+        kill -TERM $STUTTER_PID 2>/dev/null
+    fi
+    if ! test -z "$DAEMON_PID" ; then
+        kill -TERM $DAEMON_PID 2>/dev/null
+        wait $DAEMON_PID 2>/dev/null
+    fi
+    if ! test -z "$TEMP_PULSE_DIR" ; then
+        rm -rf "$TEMP_PULSE_DIR"
+    fi
+}
+
+trap 'die "Received SIGINT"' INT
+
+while getopts "c:s:k:t:S:o:h" OPT ; do
+    case $OPT in
+        c) CLIENTS=$OPTARG ;;
+        s) STREAMS=$OPTARG ;;
+        k) SINKS=$OPTARG ;;
+        t) DURATION=$OPTARG ;;
+        S) STUTTER=$OPTARG ;;
+        o) REPORT=$OPTARG ;;
+        h) usage ; exit 0 ;;
+        *) usage ; exit 1 ;;
+    esac
+done
+shift `expr $OPTIND - 1`
+CLIENT_ARGS="$*"
+
+# utime + stime of all threads, in clock ticks
+daemon_ticks()
+{
+    awk '{ print $14 + $15 }' /proc/$DAEMON_PID/stat
+}
+
+# Voluntary plus involuntary context switches of all threads
+daemon_switches()
+{
+    cat /proc/$DAEMON_PID/task/*/status | awk '/ctxt_switches/ { n += $2 } END { print n }'
+}
+
+now_ms()
+{
+    echo $(( `date +%s%N` / 1000000 ))
+}
+
+TEMP_PULSE_DIR=`mktemp -d`
+export PULSE_RUNTIME_PATH=${TEMP_PULSE_DIR}
+export PULSE_STATE_PATH=${TEMP_PULSE_DIR}
+SERVER=unix:${TEMP_PULSE_DIR}/native
+
+pulseaudio -n \
+        --daemonize=no \
+        --exit-idle-time=-1 \
+        --log-target=file:${PWD}/bench-daemon.log \
+        --log-level=notice \
+        --load="module-native-protocol-unix" \
+        --dl-search-path="${PWD}/.libs/" \
+        > /dev/null 2>&1 &
+DAEMON_PID=$!
+
+# Wait for the daemon to come up
+i=0
+until pactl --server=$SERVER info > /dev/null 2>&1 ; do
+    i=`expr $i + 1`
+    test $i -gt 50 && die "The daemon didn't start, see bench-daemon.log"
+    sleep 0.2
+done
+
+i=0
+while test $i -lt $SINKS ; do
+    pactl --server=$SERVER load-module module-null-sink sink_name=bench$i > /dev/null || die "Failed to load a null sink"
+    i=`expr $i + 1`
+done
+
+if ! test -z "$STUTTER" ; then
+    rtstutter `echo $STUTTER | tr ':' ' '` > /dev/null 2>&1 &
+    STUTTER_PID=$!
+fi
+
+CLK_TCK=`getconf CLK_TCK`
+TICKS_START=`daemon_ticks`
+SWITCHES_START=`daemon_switches`
+TIME_START=`now_ms`
+
+CLIENT_OUT=`mktemp`
+i=0
+CLIENT_PIDS=
+while test $i -lt $CLIENTS ; do
+    DEVICE=bench`expr $i % $SINKS`
+    case " $CLIENT_ARGS " in
+        *" --record "*|*" -r "*) DEVICE=$DEVICE.monitor ;;
+    esac
+    stream-bench --server=$SERVER --device=$DEVICE --streams=$STREAMS --seconds=$DURATION $CLIENT_ARGS >> $CLIENT_OUT &
+    CLIENT_PIDS="$CLIENT_PIDS $!"
+    i=`expr $i + 1`
+done
+
+FAILED=0
+for PID in $CLIENT_PIDS ; do
+    wait $PID || FAILED=`expr $FAILED + 1`
+done
+
+TIME_END=`now_ms`
+TICKS_END=`daemon_ticks`
+SWITCHES_END=`daemon_switches`
+
+# The io.* counters of the sinks, see pa_io_counters
+DEVICE_COUNTERS=`pactl --server=$SERVER list sinks 2>/dev/null | grep -E '^[[:space:]]*(Name:|io\.)' | sed 's/^[[:space:]]*//'`
+
+cleanup
+DAEMON_PID=
+STUTTER_PID=
+TEMP_PULSE_DIR=
+
+TOTAL_STREAMS=`expr $CLIENTS \* $STREAMS`
+
+awk -v ticks=`expr $TICKS_END - $TICKS_START` \
+    -v clk_tck=$CLK_TCK \
+    -v switches=`expr $SWITCHES_END - $SWITCHES_START` \
+    -v ms=`expr $TIME_END - $TIME_START` \
+    -v clients=$CLIENTS -v streams=$STREAMS -v sinks=$SINKS \
+    -v total=$TOTAL_STREAMS -v failed=$FAILED \
+    -v stutter="$STUTTER" -v args="$CLIENT_ARGS" '
+    function field(line, name,    r) {
+        if (match(line, "\"" name "\": [0-9]+")) {
+            r = substr(line, RSTART, RLENGTH)
+            sub(/.*: /, "", r)
+            return r + 0
+        }
+        return 0
+    }
+    {
+        underflows += field($0, "underflows")
+        overflows += field($0, "overflows")
+        bytes += field($0, "bytes")
+        latency += field($0, "avg_latency_usec")
+        max = field($0, "max_latency_usec")
+        if (max > max_latency)
+            max_latency = max
+        n++
+    }
+    END {
+        cpu = ms > 0 ? ticks / clk_tck * 100000 / ms : 0
+        printf "# PulseAudio stream benchmark\n"
+        printf "clients: %d\n", clients
+        printf "streams_per_client: %d\n", streams
+        printf "sinks: %d\n", sinks
+        printf "client_args: %s\n", args
+        printf "stutter: %s\n", stutter == "" ? "none" : stutter
+        printf "duration_ms: %d\n", ms
+        printf "failed_clients: %d\n", failed
+        printf "daemon_cpu_percent: %.2f\n", cpu
+        printf "daemon_cpu_percent_per_stream: %.3f\n", total > 0 ? cpu / total : 0
+        printf "context_switches_per_sec: %.1f\n", ms > 0 ? switches * 1000 / ms : 0
+        printf "underflows: %d\n", underflows
+        printf "overflows: %d\n", overflows
+        printf "bytes: %.0f\n", bytes
+        printf "avg_latency_usec: %d\n", n > 0 ? latency / n : 0
+        printf "max_latency_usec: %d\n", max_latency
+    }' $CLIENT_OUT > $REPORT
+
+if ! test -z "$DEVICE_COUNTERS" ; then
+    echo "# sinks" >> $REPORT
+    echo "$DEVICE_COUNTERS" >> $REPORT
+fi
+
+echo "# clients" >> $REPORT
+cat $CLIENT_OUT >> $REPORT
+rm -f $CLIENT_OUT
+
+cat $REPORT
+
+test $FAILED -eq 0
@@ -0,0 +1,178 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include <check.h>
+
+#include <pulse/mainloop.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/cli.h>
+#include <pulsecore/client.h>
+#include <pulsecore/core.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/iochannel.h>
+#include <pulsecore/macro.h>
+
+/* Enough clients for the listing to be well beyond what the ioline
+ * would buffer at once */
+#define N_CLIENTS 1000
+
+static pa_bool_t got_eof;
+
+static void eof_cb(pa_cli *cli, void *userdata) {
+    got_eof = TRUE;
+    pa_cli_free(cli);
+}
+
+static unsigned count(const char *s, const char *needle) {
+    unsigned n = 0;
+
+    while ((s = strstr(s, needle))) {
+        n++;
+        s++;
+    }
+
+    return n;
+}
+
+START_TEST (cli_list_test) {
+    pa_mainloop *m;
+    pa_core *c;
+    pa_client *clients[N_CLIENTS];
+    pa_cli *cli;
+    int fds[2], sndbuf = 4096;
+    const char *commands = "list-clients\nlist-modules\n";
+    char *out, *p, header[64];
+    size_t length = 0, size = 4096;
+    pa_bool_t removed = FALSE;
+    unsigned i;
+
+    pa_assert_se(m = pa_mainloop_new());
+    pa_assert_se(c = pa_core_new(pa_mainloop_get_api(m), FALSE, 0, PA_SHM_HUGE_PAGES_NO, FALSE));
+
+    for (i = 0; i < N_CLIENTS; i++) {
+        pa_client_new_data data;
+
+        pa_client_new_data_init(&data);
+        data.driver = __FILE__;
+        pa_proplist_setf(data.proplist, PA_PROP_APPLICATION_NAME, "client %u with a reasonably long name to make the listing grow", i);
+        pa_assert_se(clients[i] = pa_client_new(c, &data));
+        pa_client_new_data_done(&data);
+    }
+
+    fail_unless(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    fail_unless(setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf)) == 0);
+    pa_make_fd_nonblock(fds[1]);
+
+    pa_assert_se(cli = pa_cli_new(c, pa_iochannel_new(c->mainloop, fds[0], fds[0]), NULL));
+    pa_cli_set_eof_callback(cli, eof_cb, NULL);
+
+    /* Both commands at once and then EOF, like pacmd does it. None of
+     * the output may get lost. */
+    fail_unless(write(fds[1], commands, strlen(commands)) == (ssize_t) strlen(commands));
+    fail_unless(shutdown(fds[1], SHUT_WR) == 0);
+
+    out = pa_xmalloc(size);
+
+    for (;;) {
+        ssize_t r;
+
+        fail_unless(pa_mainloop_iterate(m, FALSE, NULL) >= 0);
+
+        if (length + 1024 > size)
+            out = pa_xrealloc(out, size *= 2);
+
+        if ((r = read(fds[1], out + length, size - length - 1)) == 0)
+            break;
+
+        if (r < 0) {
+            fail_unless(errno == EAGAIN);
+            continue;
+        }
+
+        length += (size_t) r;
+
+        /* Removing a client the listing has not got to yet must
+         * neither confuse it nor make it start over */
+        if (!removed && length > 64*1024) {
+            pa_client_free(clients[N_CLIENTS-1]);
+            clients[N_CLIENTS-1] = NULL;
+            removed = TRUE;
+        }
+    }
+
+    out[length] = 0;
+
+    fail_unless(got_eof);
+    fail_unless(removed);
+
+    /* The header is written before the removal, and the CLI itself is a client too */
+    pa_snprintf(header, sizeof(header), "%u client(s) logged in.\n", N_CLIENTS + 1);
+    fail_unless(strstr(out, header) != NULL);
+
+    fail_unless((p = strstr(out, "0 module(s) loaded.\n")) != NULL);
+    fail_unless(count(out, "    index: ") == N_CLIENTS);
+    fail_unless(count(p, "    index: ") == 0);
+    fail_unless(strstr(out, "with a reasonably long name to make the listing grow") != NULL);
+    fail_unless(strstr(out, "client 998 with") != NULL);
+    fail_unless(strstr(out, "client 999 with") == NULL);
+
+    /* The second command is only taken once the first one is done */
+    fail_unless(count(out, ">>> ") - count(p, ">>> ") == 2);
+    fail_unless(strncmp(p - 4, ">>> ", 4) == 0);
+
+    pa_xfree(out);
+
+    for (i = 0; i < N_CLIENTS-1; i++)
+        pa_client_free(clients[i]);
+
+    pa_close(fds[1]);
+
+    pa_core_unref(c);
+    pa_mainloop_free(m);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    s = suite_create("CLI List");
+    tc = tcase_create("clilist");
+    tcase_add_test(tc, cli_list_test);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,105 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <check.h>
+
+#include <pulse/mainloop.h>
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
+
+#include <pulsecore/clock-domain.h>
+#include <pulsecore/core.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/macro.h>
+
+#define MSEC PA_USEC_PER_MSEC
+
+START_TEST (clock_domain_test) {
+    pa_mainloop *m;
+    pa_core *c;
+    pa_clock_domain *a, *b, *other;
+    pa_usec_t now;
+
+    pa_assert_se(m = pa_mainloop_new());
+    pa_assert_se(c = pa_core_new(pa_mainloop_get_api(m), FALSE, 0, PA_SHM_HUGE_PAGES_NO, FALSE));
+
+    a = pa_clock_domain_get(c, "card");
+    b = pa_clock_domain_get(c, "card");
+    other = pa_clock_domain_get(c, "other");
+    fail_unless(a == b);
+    fail_unless(a != other);
+    fail_unless(pa_streq(pa_clock_domain_get_name(other), "other"));
+
+    now = pa_rtclock_now();
+
+    /* Nobody else wakes up yet */
+    fail_unless(pa_clock_domain_align(a, now + 100 * MSEC, 20 * MSEC) == now + 100 * MSEC);
+
+    /* Shortly after the first one, so it joins that */
+    fail_unless(pa_clock_domain_align(b, now + 110 * MSEC, 20 * MSEC) == now + 100 * MSEC);
+
+    /* Too late to join */
+    fail_unless(pa_clock_domain_align(b, now + 130 * MSEC, 20 * MSEC) == now + 130 * MSEC);
+
+    /* Another domain does not care */
+    fail_unless(pa_clock_domain_align(other, now + 110 * MSEC, 20 * MSEC) == now + 110 * MSEC);
+
+    /* Earlier ones are never delayed, but become the one to join */
+    fail_unless(pa_clock_domain_align(b, now + 90 * MSEC, 20 * MSEC) == now + 90 * MSEC);
+    fail_unless(pa_clock_domain_align(a, now + 100 * MSEC, 20 * MSEC) == now + 90 * MSEC);
+
+    /* Nor are the ones that are due already */
+    fail_unless(pa_clock_domain_align(a, now, 20 * MSEC) == now);
+
+    pa_clock_domain_unref(a);
+    pa_clock_domain_unref(b);
+    pa_clock_domain_unref(other);
+
+    /* Gone with the last reference */
+    a = pa_clock_domain_get(c, "card");
+    fail_unless(pa_clock_domain_align(a, now + 100 * MSEC, 20 * MSEC) == now + 100 * MSEC);
+    pa_clock_domain_unref(a);
+
+    pa_core_unref(c);
+    pa_mainloop_free(m);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    s = suite_create("Clock Domain");
+    tc = tcase_create("clockdomain");
+    tcase_add_test(tc, clock_domain_test);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,153 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <check.h>
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/macro.h>
+#include <pulsecore/conf-parser.h>
+#include <pulsecore/core-util.h>
+
+struct values {
+    int a;
+    char *path;
+    pa_bool_t flag;
+};
+
+static void write_file(const char *fn, const char *text) {
+    FILE *f;
+
+    pa_assert_se(f = fopen(fn, "w"));
+    pa_assert_se(fputs(text, f) >= 0);
+    pa_assert_se(fclose(f) == 0);
+}
+
+static int parse(const char *fn, struct values *v, pa_proplist *p) {
+    pa_config_item items[] = {
+        { "a",    pa_config_parse_int,    NULL, "General" },
+        { "path", pa_config_parse_string, NULL, "General" },
+        { "flag", pa_config_parse_bool,   NULL, NULL },
+        { NULL, NULL, NULL, NULL }
+    };
+
+    items[0].data = &v->a;
+    items[1].data = &v->path;
+    items[2].data = &v->flag;
+
+    return pa_config_parse(fn, NULL, items, p, NULL);
+}
+
+START_TEST (conf_parser_test) {
+    char dir[] = "/tmp/conf-parser-test-XXXXXX";
+    char *fn, *inc;
+    struct values v;
+    pa_proplist *p;
+    int i;
+
+    pa_assert_se(mkdtemp(dir));
+    fn = pa_sprintf_malloc("%s/test.conf", dir);
+    inc = pa_sprintf_malloc("%s/included.conf", dir);
+
+    write_file(inc, "flag = yes\n");
+    write_file(fn,
+               "# A comment\n"
+               "[General]\n"
+               "a = 42 ; another one\n"
+               "path =  /some/where  \n"
+               ".include included.conf\n"
+               "[Properties]\n"
+               "device.description = Test\n");
+
+    /* The second time the lines come from the cache */
+    for (i = 0; i < 2; i++) {
+        pa_zero(v);
+        p = pa_proplist_new();
+
+        fail_unless(parse(fn, &v, p) == 0);
+        fail_unless(v.a == 42);
+        fail_unless(pa_streq(v.path, "/some/where"));
+        fail_unless(v.flag);
+        fail_unless(pa_streq(pa_proplist_gets(p, "device.description"), "Test"));
+
+        pa_xfree(v.path);
+        pa_proplist_free(p);
+    }
+
+    /* Changes are picked up, in included files as well */
+    write_file(inc, "flag = no\n");
+    write_file(fn, "[General]\na = 4711\n.include included.conf\n");
+
+    pa_zero(v);
+    v.flag = TRUE;
+    fail_unless(parse(fn, &v, NULL) == 0);
+    fail_unless(v.a == 4711);
+    fail_unless(!v.path);
+    fail_unless(!v.flag);
+
+    /* Errors are reported on every parse, not just the first one */
+    write_file(fn, "[General]\na = 1\nb = 2\n");
+
+    for (i = 0; i < 2; i++) {
+        pa_zero(v);
+        fail_unless(parse(fn, &v, NULL) < 0);
+        fail_unless(v.a == 1);
+    }
+
+    write_file(fn, "[Properties]\nx = y\n");
+    fail_unless(parse(fn, &v, NULL) < 0);
+
+    /* Missing files are fine */
+    fail_unless(unlink(fn) == 0);
+    fail_unless(parse(fn, &v, NULL) == 0);
+
+    fail_unless(unlink(inc) == 0);
+    fail_unless(rmdir(dir) == 0);
+
+    pa_xfree(fn);
+    pa_xfree(inc);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    s = suite_create("Config Parser");
+    tc = tcase_create("conf-parser");
+    tcase_add_test(tc, conf_parser_test);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
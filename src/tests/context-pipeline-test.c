@@ -0,0 +1,296 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <check.h>
+
+#include <pulse/context.h>
+#include <pulse/mainloop.h>
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core-rtclock.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/memblock.h>
+#include <pulsecore/native-common.h>
+#include <pulsecore/pdispatch.h>
+#include <pulsecore/pstream.h>
+#include <pulsecore/pstream-util.h>
+#include <pulsecore/socket-server.h>
+#include <pulsecore/tagstruct.h>
+
+/* A fake server that speaks protocol version 12, which wants the client
+ * name as a plain string, while the client cache claims a newer one */
+#define SERVER_VERSION 12
+#define CACHED_VERSION PA_PROTOCOL_VERSION
+
+struct server {
+    pa_mainloop_api *api;
+    pa_mempool *mempool;
+    unsigned n_connections;
+    unsigned n_pipelined;
+    unsigned n_named;
+    struct connection *connection;
+};
+
+struct connection {
+    struct server *server;
+    pa_pstream *pstream;
+    pa_pdispatch *pdispatch;
+};
+
+static void connection_free(struct connection *c) {
+    pa_pdispatch_unref(c->pdispatch);
+    pa_pstream_unlink(c->pstream);
+    pa_pstream_unref(c->pstream);
+    pa_xfree(c);
+}
+
+static void reply(struct connection *c, uint32_t tag, pa_bool_t with_version) {
+    pa_tagstruct *reply;
+
+    reply = pa_tagstruct_new(NULL, 0);
+    pa_tagstruct_putu32(reply, PA_COMMAND_REPLY);
+    pa_tagstruct_putu32(reply, tag);
+
+    if (with_version)
+        pa_tagstruct_putu32(reply, SERVER_VERSION);
+
+    pa_pstream_send_tagstruct(c->pstream, reply);
+}
+
+static void command_auth(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    reply(userdata, tag, TRUE);
+}
+
+static void command_set_client_name(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    struct connection *c = userdata;
+    const char *name;
+
+    /* A proplist, pipelined in the format of the cached version. A
+     * version 12 server would fail the connection, the client should
+     * have given up on it already. */
+    if (pa_tagstruct_gets(t, &name) < 0 || !name || !pa_tagstruct_eof(t)) {
+        c->server->n_pipelined++;
+        return;
+    }
+
+    c->server->n_named++;
+    reply(c, tag, FALSE);
+}
+
+static const pa_pdispatch_cb_t command_table[PA_COMMAND_MAX] = {
+    [PA_COMMAND_AUTH] = command_auth,
+    [PA_COMMAND_SET_CLIENT_NAME] = command_set_client_name
+};
+
+static void packet_cb(pa_pstream *p, pa_packet *packet, const pa_creds *creds, void *userdata) {
+    struct connection *c = userdata;
+
+    fail_unless(pa_pdispatch_run(c->pdispatch, packet, creds, c) >= 0);
+}
+
+static void die_cb(pa_pstream *p, void *userdata) {
+    struct connection *c = userdata;
+
+    if (c->server->connection == c)
+        c->server->connection = NULL;
+
+    connection_free(c);
+}
+
+static void on_connection(pa_socket_server *s, pa_iochannel *io, void *userdata) {
+    struct server *server = userdata;
+    struct connection *c;
+
+    server->n_connections++;
+
+    c = pa_xnew0(struct connection, 1);
+    c->server = server;
+    c->pstream = pa_pstream_new(server->api, io, server->mempool);
+    c->pdispatch = pa_pdispatch_new(server->api, TRUE, command_table, PA_COMMAND_MAX);
+
+    pa_pstream_set_receive_packet_callback(c->pstream, packet_cb, c);
+    pa_pstream_set_die_callback(c->pstream, die_cb, c);
+
+    server->connection = c;
+}
+
+static void context_state_cb(pa_context *c, void *userdata) {
+    pa_mainloop_api *api = userdata;
+
+    switch (pa_context_get_state(c)) {
+        case PA_CONTEXT_READY:
+            api->quit(api, 0);
+            break;
+
+        case PA_CONTEXT_FAILED:
+            api->quit(api, 1);
+            break;
+
+        default:
+            break;
+    }
+}
+
+static void timeout_cb(pa_mainloop_api *api, pa_time_event *e, const struct timeval *tv, void *userdata) {
+    api->quit(api, 2);
+}
+
+static char *read_cache(const char *dir) {
+    char *fn, line[1024];
+    FILE *f;
+
+    fn = pa_sprintf_malloc("%s" PA_PATH_SEP PA_NATIVE_CLIENT_CACHE_FILE, dir);
+    f = fopen(fn, "r");
+    pa_xfree(fn);
+
+    if (!f)
+        return NULL;
+
+    if (!fgets(line, sizeof(line), f))
+        line[0] = 0;
+
+    fclose(f);
+
+    line[strcspn(line, "\r\n")] = 0;
+    return pa_xstrdup(line);
+}
+
+static void write_file(const char *dir, const char *name, const char *contents) {
+    char *fn;
+    FILE *f;
+
+    fn = pa_sprintf_malloc("%s" PA_PATH_SEP "%s", dir, name);
+    fail_unless((f = fopen(fn, "w")) != NULL);
+    fputs(contents, f);
+    fail_unless(fclose(f) == 0);
+    pa_xfree(fn);
+}
+
+START_TEST (version_change_test) {
+    char dir[] = "/tmp/context-pipeline-test-XXXXXX";
+    char *sock, *conf, *cache, *expected;
+    struct server server;
+    pa_socket_server *s;
+    pa_mainloop *m;
+    pa_context *c;
+    pa_time_event *timeout;
+    struct timeval tv;
+    int ret = -1;
+
+    fail_unless(mkdtemp(dir) != NULL);
+
+    /* Keep the client away from the user's setup */
+    conf = pa_sprintf_malloc("%s" PA_PATH_SEP "client.conf", dir);
+    write_file(dir, "client.conf", "");
+    setenv("PULSE_CLIENTCONFIG", conf, 1);
+    setenv("PULSE_RUNTIME_PATH", dir, 1);
+    unsetenv("PULSE_SERVER");
+    unsetenv("DISPLAY");
+
+    /* The per-user socket is the first server tried, and the cache
+     * says it speaks our version */
+    sock = pa_sprintf_malloc("%s" PA_PATH_SEP PA_NATIVE_DEFAULT_UNIX_SOCKET, dir);
+    cache = pa_sprintf_malloc("%u %s\n", CACHED_VERSION, sock);
+    write_file(dir, PA_NATIVE_CLIENT_CACHE_FILE, cache);
+    pa_xfree(cache);
+
+    fail_unless((m = pa_mainloop_new()) != NULL);
+
+    pa_zero(server);
+    server.api = pa_mainloop_get_api(m);
+    fail_unless((server.mempool = pa_mempool_new(FALSE, 0)) != NULL);
+
+    fail_unless((s = pa_socket_server_new_unix(server.api, sock)) != NULL);
+    pa_socket_server_set_callback(s, on_connection, &server);
+
+    fail_unless((c = pa_context_new(server.api, "context-pipeline-test")) != NULL);
+    pa_context_set_state_callback(c, context_state_cb, server.api);
+    fail_unless(pa_context_connect(c, NULL, PA_CONTEXT_NOAUTOSPAWN, NULL) >= 0);
+
+    timeout = server.api->time_new(server.api, pa_timeval_rtstore(&tv, pa_rtclock_now() + 5 * PA_USEC_PER_SEC, TRUE), timeout_cb, NULL);
+    fail_unless(pa_mainloop_run(m, &ret) >= 0);
+
+    /* The name was pipelined to the first connection, which was dropped
+     * for a second one that waited for the version */
+    fail_unless(ret == 0);
+    fail_unless(server.n_connections == 2);
+    fail_unless(server.n_pipelined == 1);
+    fail_unless(server.n_named == 1);
+
+    /* The next client learns the real version */
+    expected = pa_sprintf_malloc("%u %s", SERVER_VERSION, sock);
+    cache = read_cache(dir);
+    fail_unless(cache && pa_streq(cache, expected));
+    pa_xfree(cache);
+    pa_xfree(expected);
+
+    server.api->time_free(timeout);
+    pa_context_disconnect(c);
+    pa_context_unref(c);
+
+    if (server.connection)
+        connection_free(server.connection);
+
+    pa_socket_server_unref(s);
+    pa_mainloop_free(m);
+    pa_mempool_free(server.mempool);
+
+    unlink(sock);
+    pa_xfree(sock);
+    unlink(conf);
+    pa_xfree(conf);
+
+    cache = pa_sprintf_malloc("%s" PA_PATH_SEP PA_NATIVE_CLIENT_CACHE_FILE, dir);
+    unlink(cache);
+    pa_xfree(cache);
+
+    rmdir(dir);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    s = suite_create("Context Pipeline");
+    tc = tcase_create("contextpipeline");
+    tcase_add_test(tc, version_change_test);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
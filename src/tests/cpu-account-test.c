@@ -0,0 +1,135 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <check.h>
+
+#include <pulse/mainloop.h>
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
+
+#include <pulsecore/cpu-account.h>
+#include <pulsecore/macro.h>
+
+static pa_cpu_accounting *accounting;
+static pa_cpu_account *core_account, *module_account, *client_account;
+static pa_defer_event *child;
+static unsigned destroyed;
+
+/* Keeps the CPU busy for a while */
+static void spin(pa_usec_t usec) {
+    pa_usec_t until = pa_rtclock_now() + usec;
+
+    while (pa_rtclock_now() < until)
+        ;
+}
+
+static void child_cb(pa_mainloop_api *a, pa_defer_event *e, void *userdata) {
+    a->defer_enable(e, 0);
+    spin(2 * PA_USEC_PER_MSEC);
+}
+
+static void module_cb(pa_mainloop_api *a, pa_defer_event *e, void *userdata) {
+    pa_cpu_account *previous;
+
+    a->defer_enable(e, 0);
+
+    /* Created from a callback, so it belongs to the module as well */
+    child = a->defer_new(a, child_cb, NULL);
+
+    /* Handling something for a client */
+    previous = pa_cpu_accounting_set_current(accounting, client_account);
+    spin(5 * PA_USEC_PER_MSEC);
+    pa_cpu_accounting_set_current(accounting, previous);
+}
+
+static void destroy_cb(pa_mainloop_api *a, pa_defer_event *e, void *userdata) {
+    destroyed++;
+}
+
+START_TEST (cpu_account_test) {
+    pa_mainloop *m;
+    pa_mainloop_api *api;
+    pa_defer_event *e;
+    pa_cpu_account *previous;
+
+    pa_assert_se(m = pa_mainloop_new());
+
+    core_account = pa_cpu_account_new();
+    module_account = pa_cpu_account_new();
+    client_account = pa_cpu_account_new();
+
+    accounting = pa_cpu_accounting_new(pa_mainloop_get_api(m), core_account);
+    api = pa_cpu_accounting_get_api(accounting);
+
+    previous = pa_cpu_accounting_set_current(accounting, module_account);
+    fail_unless(previous == core_account);
+    e = api->defer_new(api, module_cb, NULL);
+    api->defer_set_destroy(e, destroy_cb);
+    pa_cpu_accounting_set_current(accounting, previous);
+
+    fail_unless(pa_mainloop_iterate(m, 0, NULL) >= 0);
+
+    fail_unless(pa_cpu_account_get_dispatched(module_account) == 1);
+    fail_unless(pa_cpu_account_get_dispatched(client_account) == 0);
+    fail_unless(pa_cpu_account_get_usec(client_account) >= 4 * PA_USEC_PER_MSEC);
+    fail_unless(pa_cpu_account_get_usec(module_account) < pa_cpu_account_get_usec(client_account));
+    fail_unless(child != NULL);
+
+    fail_unless(pa_mainloop_iterate(m, 0, NULL) >= 0);
+
+    fail_unless(pa_cpu_account_get_dispatched(module_account) == 2);
+    fail_unless(pa_cpu_account_get_usec(module_account) >= PA_USEC_PER_MSEC);
+    fail_unless(pa_cpu_account_get_dispatched(core_account) == 0);
+
+    /* The wrapper has to survive until the mainloop destroys the events */
+    api->defer_free(e);
+    api->defer_free(child);
+    pa_cpu_accounting_free(accounting);
+
+    pa_mainloop_free(m);
+    fail_unless(destroyed == 1);
+
+    pa_cpu_account_unref(core_account);
+    pa_cpu_account_unref(module_account);
+    pa_cpu_account_unref(client_account);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    s = suite_create("CPU Account");
+    tc = tcase_create("cpuaccount");
+    tcase_add_test(tc, cpu_account_test);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
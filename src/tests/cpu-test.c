@@ -26,6 +26,7 @@
 #include <math.h>
 
 #include <pulse/rtclock.h>
+#include <pulse/xmalloc.h>
 #include <pulsecore/cpu-x86.h>
 #include <pulsecore/cpu-orc.h>
 #include <pulsecore/random.h>
@@ -35,6 +36,8 @@
 #include <pulsecore/remap.h>
 #include <pulsecore/sample-util.h>
 #include <pulsecore/mix.h>
+#include <pulsecore/resampler.h>
+#include <pulsecore/ffmpeg/avcodec.h>
 
 #define PA_CPU_TEST_RUN_START(l, t1, t2)                        \
 {                                                               \
@@ -250,6 +253,300 @@ START_TEST (svolume_orc_test) {
 }
 END_TEST
 
+/* Same as run_volume_test(), for the formats with 32 bit samples */
+static void run_volume_test_32(
+        pa_do_volume_func_t func,
+        pa_do_volume_func_t orig_func,
+        pa_sample_format_t format,
+        int align,
+        int channels,
+        pa_bool_t correct,
+        pa_bool_t perf) {
+
+    PA_DECLARE_ALIGNED(8, uint32_t, s[SAMPLES]) = { 0 };
+    PA_DECLARE_ALIGNED(8, uint32_t, s_ref[SAMPLES]) = { 0 };
+    PA_DECLARE_ALIGNED(8, uint32_t, s_orig[SAMPLES]) = { 0 };
+    int32_t ivolumes[channels + PADDING];
+    float fvolumes[channels + PADDING];
+    void *volumes;
+    uint32_t *samples, *samples_ref, *samples_orig;
+    int i, padding, nsamples, size;
+
+    /* Force sample alignment as requested */
+    samples = s + (8 - align);
+    samples_ref = s_ref + (8 - align);
+    samples_orig = s_orig + (8 - align);
+    nsamples = SAMPLES - (8 - align);
+    if (nsamples % channels)
+        nsamples -= nsamples % channels;
+    size = nsamples * sizeof(uint32_t);
+
+    if (format == PA_SAMPLE_FLOAT32NE || format == PA_SAMPLE_FLOAT32RE) {
+        for (i = 0; i < nsamples; i++) {
+            float f = 2.0f * rand() / RAND_MAX - 1.0f;
+
+            memcpy(samples + i, &f, sizeof(f));
+            if (format == PA_SAMPLE_FLOAT32RE)
+                samples[i] = PA_UINT32_SWAP(samples[i]);
+        }
+    } else
+        pa_random(samples, size);
+
+    memcpy(samples_ref, samples, size);
+    memcpy(samples_orig, samples, size);
+
+    for (i = 0; i < channels; i++) {
+        ivolumes[i] = PA_CLAMP_VOLUME((pa_volume_t)(rand() >> 15));
+        fvolumes[i] = (float) ivolumes[i] / 0x10000;
+    }
+    for (padding = 0; padding < PADDING; padding++, i++) {
+        ivolumes[i] = ivolumes[padding];
+        fvolumes[i] = fvolumes[padding];
+    }
+
+    if (format == PA_SAMPLE_FLOAT32NE || format == PA_SAMPLE_FLOAT32RE)
+        volumes = fvolumes;
+    else
+        volumes = ivolumes;
+
+    if (correct) {
+        orig_func(samples_ref, volumes, channels, size);
+        func(samples, volumes, channels, size);
+
+        for (i = 0; i < nsamples; i++) {
+            if (samples[i] != samples_ref[i]) {
+                pa_log_debug("Correctness test failed: format=%s, align=%d, channels=%d",
+                        pa_sample_format_to_string(format), align, channels);
+                pa_log_debug("%d: %08x != %08x (%08x * %08x)\n", i, samples[i], samples_ref[i],
+                        samples_orig[i], ivolumes[i % channels]);
+                fail();
+            }
+        }
+    }
+
+    if (perf) {
+        pa_log_debug("Testing svolume %s %dch performance with %d sample alignment",
+                pa_sample_format_to_string(format), channels, align);
+
+        PA_CPU_TEST_RUN_START("func", TIMES, TIMES2) {
+            memcpy(samples, samples_orig, size);
+            func(samples, volumes, channels, size);
+        } PA_CPU_TEST_RUN_STOP
+
+        PA_CPU_TEST_RUN_START("orig", TIMES, TIMES2) {
+            memcpy(samples_ref, samples_orig, size);
+            orig_func(samples_ref, volumes, channels, size);
+        } PA_CPU_TEST_RUN_STOP
+
+        fail_unless(memcmp(samples_ref, samples, size) == 0);
+    }
+}
+
+static const pa_sample_format_t volume_formats_32[] = {
+    PA_SAMPLE_FLOAT32NE, PA_SAMPLE_FLOAT32RE,
+    PA_SAMPLE_S32NE, PA_SAMPLE_S32RE,
+    PA_SAMPLE_S24_32NE, PA_SAMPLE_S24_32RE
+};
+
+static void volume_test_32(pa_do_volume_func_t orig_funcs[], pa_do_volume_func_t funcs[]) {
+    unsigned f;
+    int i, j;
+
+    for (f = 0; f < PA_ELEMENTSOF(volume_formats_32); f++) {
+        pa_log_debug("Checking %s svolume", pa_sample_format_to_string(volume_formats_32[f]));
+
+        for (i = 1; i <= 8; i++) {
+            for (j = 0; j < 7; j++)
+                run_volume_test_32(funcs[f], orig_funcs[f], volume_formats_32[f], j, i, TRUE, FALSE);
+        }
+        run_volume_test_32(funcs[f], orig_funcs[f], volume_formats_32[f], 7, 1, TRUE, TRUE);
+        run_volume_test_32(funcs[f], orig_funcs[f], volume_formats_32[f], 7, 2, TRUE, TRUE);
+        run_volume_test_32(funcs[f], orig_funcs[f], volume_formats_32[f], 7, 6, TRUE, TRUE);
+    }
+}
+
+static void get_volume_funcs_32(pa_do_volume_func_t funcs[]) {
+    unsigned f;
+
+    for (f = 0; f < PA_ELEMENTSOF(volume_formats_32); f++)
+        funcs[f] = pa_get_volume_func(volume_formats_32[f]);
+}
+
+#if defined (__i386__) || defined (__amd64__)
+#ifdef HAVE_SSE2
+START_TEST (svolume_sse2_32_test) {
+    pa_do_volume_func_t orig_funcs[PA_ELEMENTSOF(volume_formats_32)], sse2_funcs[PA_ELEMENTSOF(volume_formats_32)];
+    pa_cpu_x86_flag_t flags = 0;
+
+    pa_cpu_get_x86_flags(&flags);
+
+    if (!(flags & PA_CPU_X86_SSE2)) {
+        pa_log_info("SSE2 not supported. Skipping");
+        return;
+    }
+
+    get_volume_funcs_32(orig_funcs);
+    pa_volume_func_init_sse2(flags);
+    /* Initialising twice must leave the fallbacks alone */
+    pa_volume_func_init_sse2(flags);
+    get_volume_funcs_32(sse2_funcs);
+
+    pa_log_debug("Checking SSE2 32 bit svolume");
+    volume_test_32(orig_funcs, sse2_funcs);
+}
+END_TEST
+#endif /* HAVE_SSE2 */
+
+#ifdef HAVE_AVX2
+START_TEST (svolume_avx2_32_test) {
+    pa_do_volume_func_t orig_funcs[PA_ELEMENTSOF(volume_formats_32)], avx2_funcs[PA_ELEMENTSOF(volume_formats_32)];
+    pa_cpu_x86_flag_t flags = 0;
+
+    pa_cpu_get_x86_flags(&flags);
+
+    if (!(flags & PA_CPU_X86_AVX2)) {
+        pa_log_info("AVX2 not supported. Skipping");
+        return;
+    }
+
+    get_volume_funcs_32(orig_funcs);
+    pa_volume_func_init_avx2(flags);
+    /* Initialising twice must leave the fallbacks alone */
+    pa_volume_func_init_avx2(flags);
+    get_volume_funcs_32(avx2_funcs);
+
+    pa_log_debug("Checking AVX2 32 bit svolume");
+    volume_test_32(orig_funcs, avx2_funcs);
+}
+END_TEST
+#endif /* HAVE_AVX2 */
+#endif /* defined (__i386__) || defined (__amd64__) */
+
+#ifdef HAVE_ORC
+START_TEST (svolume_orc_32_test) {
+    pa_do_volume_func_t orig_funcs[PA_ELEMENTSOF(volume_formats_32)], orc_funcs[PA_ELEMENTSOF(volume_formats_32)];
+
+    get_volume_funcs_32(orig_funcs);
+    pa_volume_float32_func_init_orc();
+    /* The Orc inits may run more than once, too */
+    pa_volume_float32_func_init_orc();
+    get_volume_funcs_32(orc_funcs);
+
+    pa_log_debug("Checking Orc 32 bit svolume");
+    volume_test_32(orig_funcs, orc_funcs);
+}
+END_TEST
+#endif /* HAVE_ORC */
+
+static void run_volume_ramp_test(pa_do_volume_ramp_func_t func, pa_do_volume_ramp_func_t orig_func, pa_sample_format_t sf,
+        unsigned align, unsigned channels, pa_bool_t correct, pa_bool_t perf) {
+    size_t ss = pa_sample_size_of_format(sf);
+    unsigned samples = SAMPLES - align;
+    unsigned frames = samples / channels;
+    void *samples_ref, *samples_orig, *samples_new;
+    float gain, step;
+    unsigned i;
+
+    samples_ref = pa_xmalloc(SAMPLES * ss);
+    samples_orig = pa_xmalloc(SAMPLES * ss);
+    samples_new = pa_xmalloc(SAMPLES * ss);
+
+    pa_random(samples_ref, SAMPLES * ss);
+
+    if (sf == PA_SAMPLE_FLOAT32NE)
+        for (i = 0; i < SAMPLES; i++)
+            ((float*) samples_ref)[i] = 2.0f * ((float) rand() / (float) RAND_MAX) - 1.0f;
+
+    /* Down from 1.5 to 0.1, so both the clipping and the small gains
+     * are covered */
+    gain = 1.5f;
+    step = (0.1f - gain) / (float) frames;
+
+    memcpy(samples_orig, samples_ref, SAMPLES * ss);
+    memcpy(samples_new, samples_ref, SAMPLES * ss);
+
+    if (correct) {
+        orig_func((uint8_t*) samples_orig + align * ss, gain, step, channels, frames * channels * ss);
+        func((uint8_t*) samples_new + align * ss, gain, step, channels, frames * channels * ss);
+
+        for (i = 0; i < SAMPLES; i++) {
+            pa_bool_t ok;
+
+            if (sf == PA_SAMPLE_FLOAT32NE)
+                ok = ((float*) samples_new)[i] == ((float*) samples_orig)[i];
+            else
+                ok = ((int16_t*) samples_new)[i] == ((int16_t*) samples_orig)[i];
+
+            if (!ok) {
+                pa_log_debug("Correctness test failed: format=%s, align=%u, channels=%u, sample %u differs",
+                             pa_sample_format_to_string(sf), align, channels, i);
+                fail();
+            }
+        }
+    }
+
+    if (perf) {
+        pa_log_debug("Testing %u-channel %s volume ramp performance with %u sample alignment",
+                     channels, pa_sample_format_to_string(sf), align);
+
+        PA_CPU_TEST_RUN_START("func", TIMES, TIMES2) {
+            memcpy(samples_new, samples_ref, SAMPLES * ss);
+            func((uint8_t*) samples_new + align * ss, gain, step, channels, frames * channels * ss);
+        } PA_CPU_TEST_RUN_STOP
+
+        PA_CPU_TEST_RUN_START("orig", TIMES, TIMES2) {
+            memcpy(samples_orig, samples_ref, SAMPLES * ss);
+            orig_func((uint8_t*) samples_orig + align * ss, gain, step, channels, frames * channels * ss);
+        } PA_CPU_TEST_RUN_STOP
+    }
+
+    pa_xfree(samples_ref);
+    pa_xfree(samples_orig);
+    pa_xfree(samples_new);
+}
+
+static void volume_ramp_test(pa_do_volume_ramp_func_t orig_funcs[2], pa_do_volume_ramp_func_t funcs[2]) {
+    static const pa_sample_format_t formats[] = { PA_SAMPLE_S16NE, PA_SAMPLE_FLOAT32NE };
+    unsigned f;
+    unsigned i, j;
+
+    for (f = 0; f < PA_ELEMENTSOF(formats); f++) {
+        pa_log_debug("Checking %s volume ramp", pa_sample_format_to_string(formats[f]));
+
+        for (i = 1; i <= 8; i++)
+            for (j = 0; j < 7; j++)
+                run_volume_ramp_test(funcs[f], orig_funcs[f], formats[f], j, i, TRUE, FALSE);
+
+        run_volume_ramp_test(funcs[f], orig_funcs[f], formats[f], 7, 2, FALSE, TRUE);
+    }
+}
+
+#if defined (__i386__) || defined (__amd64__)
+#ifdef HAVE_SSE2
+START_TEST (svolume_ramp_sse2_test) {
+    pa_do_volume_ramp_func_t orig_funcs[2], sse2_funcs[2];
+    pa_cpu_x86_flag_t flags = 0;
+
+    pa_cpu_get_x86_flags(&flags);
+
+    if (!(flags & PA_CPU_X86_SSE2)) {
+        pa_log_info("SSE2 not supported. Skipping");
+        return;
+    }
+
+    orig_funcs[0] = pa_get_volume_ramp_func(PA_SAMPLE_S16NE);
+    orig_funcs[1] = pa_get_volume_ramp_func(PA_SAMPLE_FLOAT32NE);
+    pa_volume_func_init_sse2(flags);
+    sse2_funcs[0] = pa_get_volume_ramp_func(PA_SAMPLE_S16NE);
+    sse2_funcs[1] = pa_get_volume_ramp_func(PA_SAMPLE_FLOAT32NE);
+
+    pa_log_debug("Checking SSE2 volume ramp");
+    volume_ramp_test(orig_funcs, sse2_funcs);
+}
+END_TEST
+#endif /* HAVE_SSE2 */
+#endif /* defined (__i386__) || defined (__amd64__) */
+
 #undef SAMPLES
 #undef TIMES
 #undef TIMES2
@@ -311,9 +608,8 @@ static void run_conv_test_float_to_s16(
     }
 }
 
-/* This test is currently only run under NEON */
-#if defined (__arm__) && defined (__linux__)
-#ifdef HAVE_NEON
+/* This test is currently only run under NEON and Orc */
+#if (defined (__arm__) && defined (__linux__) && defined (HAVE_NEON)) || defined (HAVE_ORC)
 static void run_conv_test_s16_to_float(
         pa_convert_func_t func,
         pa_convert_func_t orig_func,
@@ -361,8 +657,7 @@ static void run_conv_test_s16_to_float(
         } PA_CPU_TEST_RUN_STOP
     }
 }
-#endif /* HAVE_NEON */
-#endif /* defined (__arm__) && defined (__linux__) */
+#endif
 
 #if defined (__i386__) || defined (__amd64__)
 START_TEST (sconv_sse2_test) {
@@ -464,6 +759,200 @@ END_TEST
 #endif /* HAVE_NEON */
 #endif /* defined (__arm__) && defined (__linux__) */
 
+/* The 24 and 32 bit conversions need to be bit-exact, in every direction */
+static const pa_sample_format_t conv_formats_24_32[] = {
+    PA_SAMPLE_S32LE, PA_SAMPLE_S32BE,
+    PA_SAMPLE_S24_32LE, PA_SAMPLE_S24_32BE,
+    PA_SAMPLE_S24LE, PA_SAMPLE_S24BE
+};
+
+enum {
+    CONV_TO_FLOAT32NE,
+    CONV_FROM_FLOAT32NE,
+    CONV_TO_S16NE,
+    CONV_FROM_S16NE,
+    CONV_DIRECTIONS
+};
+
+static const char *conv_direction_names[CONV_DIRECTIONS] = {
+    "-> float", "float ->", "-> s16", "s16 ->"
+};
+
+static void run_conv_test_24_32(
+        pa_convert_func_t func,
+        pa_convert_func_t orig_func,
+        pa_sample_format_t format,
+        int direction,
+        int align,
+        pa_bool_t correct,
+        pa_bool_t perf) {
+
+    PA_DECLARE_ALIGNED(8, uint8_t, in[SAMPLES * 4]);
+    PA_DECLARE_ALIGNED(8, uint8_t, out[SAMPLES * 4]) = { 0 };
+    PA_DECLARE_ALIGNED(8, uint8_t, out_ref[SAMPLES * 4]) = { 0 };
+    size_t in_size, out_size, fs = pa_sample_size_of_format(format);
+    uint8_t *input, *output, *output_ref;
+    int i, nsamples;
+
+    switch (direction) {
+        case CONV_TO_FLOAT32NE: in_size = fs; out_size = sizeof(float); break;
+        case CONV_FROM_FLOAT32NE: in_size = sizeof(float); out_size = fs; break;
+        case CONV_TO_S16NE: in_size = fs; out_size = sizeof(int16_t); break;
+        default: in_size = sizeof(int16_t); out_size = fs; break;
+    }
+
+    /* Force sample alignment as requested */
+    input = in + (8 - align) * in_size;
+    output = out + (8 - align) * out_size;
+    output_ref = out_ref + (8 - align) * out_size;
+    nsamples = SAMPLES - (8 - align);
+
+    if (direction == CONV_FROM_FLOAT32NE) {
+        float *floats = (float *) input;
+
+        for (i = 0; i < nsamples; i++)
+            floats[i] = 2.1f * (rand()/(float) RAND_MAX - 0.5f);
+
+        /* Make sure clipping and rounding of exact halves is covered */
+        floats[0] = 1.0f;
+        floats[1] = -1.0f;
+        floats[2] = 2.0f;
+        floats[3] = -2.0f;
+        floats[4] = 2.5f / (1U << 31);
+        floats[5] = -3.5f / (1U << 31);
+    } else
+        pa_random(input, nsamples * in_size);
+
+    if (correct) {
+        orig_func(nsamples, input, output_ref);
+        func(nsamples, input, output);
+
+        for (i = 0; i < nsamples; i++) {
+            if (memcmp(output + i * out_size, output_ref + i * out_size, out_size)) {
+                pa_log_debug("Correctness test failed: format=%s (%s), align=%d",
+                        pa_sample_format_to_string(format), conv_direction_names[direction], align);
+                pa_log_debug("%d: sample differs", i);
+                fail();
+                break;
+            }
+        }
+    }
+
+    if (perf) {
+        pa_log_debug("Testing sconv %s (%s) performance with %d sample alignment",
+                pa_sample_format_to_string(format), conv_direction_names[direction], align);
+
+        PA_CPU_TEST_RUN_START("func", TIMES, TIMES2) {
+            func(nsamples, input, output);
+        } PA_CPU_TEST_RUN_STOP
+
+        PA_CPU_TEST_RUN_START("orig", TIMES, TIMES2) {
+            orig_func(nsamples, input, output_ref);
+        } PA_CPU_TEST_RUN_STOP
+    }
+}
+
+static void get_conv_funcs_24_32(pa_convert_func_t funcs[][CONV_DIRECTIONS]) {
+    unsigned f;
+
+    for (f = 0; f < PA_ELEMENTSOF(conv_formats_24_32); f++) {
+        funcs[f][CONV_TO_FLOAT32NE] = pa_get_convert_to_float32ne_function(conv_formats_24_32[f]);
+        funcs[f][CONV_FROM_FLOAT32NE] = pa_get_convert_from_float32ne_function(conv_formats_24_32[f]);
+        funcs[f][CONV_TO_S16NE] = pa_get_convert_to_s16ne_function(conv_formats_24_32[f]);
+        funcs[f][CONV_FROM_S16NE] = pa_get_convert_from_s16ne_function(conv_formats_24_32[f]);
+    }
+}
+
+static void conv_test_24_32(pa_convert_func_t orig_funcs[][CONV_DIRECTIONS], pa_convert_func_t funcs[][CONV_DIRECTIONS]) {
+    unsigned f;
+    int d, j;
+
+    for (f = 0; f < PA_ELEMENTSOF(conv_formats_24_32); f++) {
+        for (d = 0; d < CONV_DIRECTIONS; d++) {
+            for (j = 0; j < 7; j++)
+                run_conv_test_24_32(funcs[f][d], orig_funcs[f][d], conv_formats_24_32[f], d, j, TRUE, FALSE);
+            run_conv_test_24_32(funcs[f][d], orig_funcs[f][d], conv_formats_24_32[f], d, 7, TRUE, TRUE);
+        }
+    }
+}
+
+#if defined (__i386__) || defined (__amd64__)
+#ifdef HAVE_SSE4_1
+START_TEST (sconv_sse4_24_32_test) {
+    pa_convert_func_t orig_funcs[PA_ELEMENTSOF(conv_formats_24_32)][CONV_DIRECTIONS];
+    pa_convert_func_t sse4_funcs[PA_ELEMENTSOF(conv_formats_24_32)][CONV_DIRECTIONS];
+    pa_cpu_x86_flag_t flags = 0;
+
+    pa_cpu_get_x86_flags(&flags);
+
+    if (!(flags & PA_CPU_X86_SSE4_1)) {
+        pa_log_info("SSE4.1 not supported. Skipping");
+        return;
+    }
+
+    get_conv_funcs_24_32(orig_funcs);
+    pa_convert_func_init_sse4(flags);
+    /* Initialising again must not change the fallbacks */
+    pa_convert_func_init_sse4(flags);
+    get_conv_funcs_24_32(sse4_funcs);
+
+    pa_log_debug("Checking SSE4.1 24 and 32 bit sconv");
+    conv_test_24_32(orig_funcs, sse4_funcs);
+}
+END_TEST
+#endif /* HAVE_SSE4_1 */
+
+#ifdef HAVE_AVX2
+START_TEST (sconv_avx2_24_32_test) {
+    pa_convert_func_t orig_funcs[PA_ELEMENTSOF(conv_formats_24_32)][CONV_DIRECTIONS];
+    pa_convert_func_t avx2_funcs[PA_ELEMENTSOF(conv_formats_24_32)][CONV_DIRECTIONS];
+    pa_cpu_x86_flag_t flags = 0;
+
+    pa_cpu_get_x86_flags(&flags);
+
+    if (!(flags & PA_CPU_X86_AVX2)) {
+        pa_log_info("AVX2 not supported. Skipping");
+        return;
+    }
+
+    get_conv_funcs_24_32(orig_funcs);
+    pa_convert_func_init_avx2(flags);
+    /* Initialising again must not change the fallbacks */
+    pa_convert_func_init_avx2(flags);
+    get_conv_funcs_24_32(avx2_funcs);
+
+    pa_log_debug("Checking AVX2 24 and 32 bit sconv");
+    conv_test_24_32(orig_funcs, avx2_funcs);
+}
+END_TEST
+#endif /* HAVE_AVX2 */
+#endif /* defined (__i386__) || defined (__amd64__) */
+
+#ifdef HAVE_ORC
+START_TEST (sconv_orc_test) {
+    pa_convert_func_t orig_funcs[PA_ELEMENTSOF(conv_formats_24_32)][CONV_DIRECTIONS];
+    pa_convert_func_t orc_funcs[PA_ELEMENTSOF(conv_formats_24_32)][CONV_DIRECTIONS];
+    pa_convert_func_t orig_func, orc_func;
+    int j;
+
+    orig_func = pa_get_convert_to_float32ne_function(PA_SAMPLE_S16NE);
+    get_conv_funcs_24_32(orig_funcs);
+    pa_convert_func_init_orc();
+    pa_convert_func_init_orc();
+    orc_func = pa_get_convert_to_float32ne_function(PA_SAMPLE_S16NE);
+    get_conv_funcs_24_32(orc_funcs);
+
+    pa_log_debug("Checking Orc sconv (s16 -> float)");
+    for (j = 0; j < 7; j++)
+        run_conv_test_s16_to_float(orc_func, orig_func, j, TRUE, FALSE);
+    run_conv_test_s16_to_float(orc_func, orig_func, 7, TRUE, TRUE);
+
+    pa_log_debug("Checking Orc 24 and 32 bit sconv");
+    conv_test_24_32(orig_funcs, orc_funcs);
+}
+END_TEST
+#endif /* HAVE_ORC */
+
 #undef SAMPLES
 #undef TIMES
 /* End conversion tests */
@@ -694,135 +1183,459 @@ START_TEST (remap_sse2_test) {
 END_TEST
 #endif /* defined (__i386__) || defined (__amd64__) */
 
-#undef SAMPLES
-#undef TIMES
-#undef TIMES2
-/* End remap tests */
+#ifdef HAVE_ORC
+START_TEST (remap_orc_test) {
+    pa_init_remap_func_t init_func, orig_init_func;
 
-/* Start mix tests */
+    pa_log_debug("Checking Orc remap (float, mono->stereo)");
+    orig_init_func = pa_get_init_remap_func();
+    pa_remap_func_init_orc();
+    pa_remap_func_init_orc();
+    init_func = pa_get_init_remap_func();
+    remap_test_mono_stereo_float(init_func, orig_init_func);
 
-/* Only ARM NEON has mix tests, so disable the related functions for other
- * architectures for now to avoid compiler warnings about unused functions. */
-#if defined (__arm__) && defined (__linux__)
-#ifdef HAVE_NEON
+    pa_log_debug("Checking Orc remap (s16, mono->stereo)");
+    remap_test_mono_stereo_s16(init_func, orig_init_func);
+}
+END_TEST
+#endif /* HAVE_ORC */
+
+/* Straight matrix multiplication, used as the reference for the
+ * other remappers */
+static void remap_matrix_ref(pa_remap_t *m, void *dst, const void *src, unsigned n) {
+    unsigned oc, ic, i, n_ic = m->i_ss->channels, n_oc = m->o_ss->channels;
+
+    if (*m->format == PA_SAMPLE_FLOAT32NE) {
+        float *d = dst;
+        const float *s = src;
+
+        memset(dst, 0, n * sizeof(float) * n_oc);
+
+        for (i = 0; i < n; i++)
+            for (oc = 0; oc < n_oc; oc++)
+                for (ic = 0; ic < n_ic; ic++) {
+                    float vol = m->map_table_f[oc][ic];
+
+                    if (vol > 0.0f)
+                        d[i * n_oc + oc] += vol >= 1.0f ? s[i * n_ic + ic] : s[i * n_ic + ic] * vol;
+                }
+    } else {
+        int16_t *d = dst;
+        const int16_t *s = src;
+
+        memset(dst, 0, n * sizeof(int16_t) * n_oc);
+
+        for (i = 0; i < n; i++)
+            for (oc = 0; oc < n_oc; oc++)
+                for (ic = 0; ic < n_ic; ic++) {
+                    int32_t vol = m->map_table_i[oc][ic];
+
+                    if (vol >= 0x10000)
+                        d[i * n_oc + oc] += s[i * n_ic + ic];
+                    else if (vol > 0)
+                        d[i * n_oc + oc] += (int16_t) (((int32_t) s[i * n_ic + ic] * vol) >> 16);
+                }
+    }
+}
 
-#define SAMPLES 1028
-#define TIMES 1000
-#define TIMES2 100
+#define MATRIX_CHANNELS 8
 
-static void acquire_mix_streams(pa_mix_info streams[], unsigned nstreams) {
-    unsigned i;
+static void run_remap_test_matrix(
+        pa_remap_t *remap,
+        pa_do_remap_func_t func,
+        int align,
+        pa_bool_t correct,
+        pa_bool_t perf) {
 
-    for (i = 0; i < nstreams; i++)
-        streams[i].ptr = pa_memblock_acquire_chunk(&streams[i].chunk);
-}
+    PA_DECLARE_ALIGNED(8, float, in[SAMPLES * MATRIX_CHANNELS]);
+    PA_DECLARE_ALIGNED(8, float, out[SAMPLES * MATRIX_CHANNELS]) = { 0 };
+    PA_DECLARE_ALIGNED(8, float, out_ref[SAMPLES * MATRIX_CHANNELS]) = { 0 };
+    unsigned n_ic = remap->i_ss->channels, n_oc = remap->o_ss->channels;
+    size_t fs = pa_sample_size_of_format(*remap->format);
+    uint8_t *input, *output, *output_ref;
+    int i, nframes;
 
-static void release_mix_streams(pa_mix_info streams[], unsigned nstreams) {
-    unsigned i;
+    /* Force sample alignment as requested */
+    input = (uint8_t *) in + (8 - align) * fs;
+    output = (uint8_t *) out + (8 - align) * fs;
+    output_ref = (uint8_t *) out_ref + (8 - align) * fs;
+    nframes = SAMPLES - 8;
 
-    for (i = 0; i < nstreams; i++)
-        pa_memblock_release(streams[i].chunk.memblock);
-}
+    if (*remap->format == PA_SAMPLE_FLOAT32NE) {
+        for (i = 0; i < (int) (nframes * n_ic); i++)
+            ((float *) input)[i] = 2.1f * (rand()/(float) RAND_MAX - 0.5f);
+    } else
+        pa_random(input, nframes * n_ic * fs);
 
-static void run_mix_test(
+    if (correct) {
+        remap_matrix_ref(remap, output_ref, input, nframes);
+        func(remap, output, input, nframes);
+
+        for (i = 0; i < (int) (nframes * n_oc); i++) {
+            pa_bool_t equal;
+
+            if (*remap->format == PA_SAMPLE_FLOAT32NE)
+                equal = fabsf(((float *) output)[i] - ((float *) output_ref)[i]) <= 0.0001;
+            else
+                equal = ((int16_t *) output)[i] == ((int16_t *) output_ref)[i];
+
+            if (!equal) {
+                pa_log_debug("Correctness test failed: format=%s, align=%d, %u->%u channels",
+                        pa_sample_format_to_string(*remap->format), align, n_ic, n_oc);
+                pa_log_debug("%d: sample differs", i);
+                fail();
+                break;
+            }
+        }
+    }
+
+    if (perf) {
+        pa_log_debug("Testing %s %u->%u remap performance with %d sample alignment",
+                pa_sample_format_to_string(*remap->format), n_ic, n_oc, align);
+
+        PA_CPU_TEST_RUN_START("func", TIMES, TIMES2) {
+            func(remap, output, input, nframes);
+        } PA_CPU_TEST_RUN_STOP
+
+        PA_CPU_TEST_RUN_START("ref", TIMES, TIMES2) {
+            remap_matrix_ref(remap, output_ref, input, nframes);
+        } PA_CPU_TEST_RUN_STOP
+    }
+}
+
+/* Matrices of different shapes: the 5.1 up- and downmixes, a channel swap,
+ * an identity and a few dense ones with volumes above PA_VOLUME_NORM */
+static const struct {
+    unsigned n_ic, n_oc;
+    float table[MATRIX_CHANNELS][MATRIX_CHANNELS];
+} remap_matrices[] = {
+    { 2, 6, { { 1, 0 }, { 0, 1 }, { .5f, .5f }, { .375f, .375f }, { 1, 0 }, { 0, 1 } } },
+    { 6, 2, { { .46f, 0, .19f, .17f, .18f, 0 }, { 0, .46f, .19f, .17f, 0, .18f } } },
+    { 2, 2, { { 0, 1 }, { 1, 0 } } },
+    { 6, 6, { { 1 }, { 0, 1 }, { 0, 0, 1 }, { 0, 0, 0, 1 }, { 0, 0, 0, 0, 1 }, { 0, 0, 0, 0, 0, 1 } } },
+    { 3, 1, { { .3f, .6f, 1.2f } } },
+    { 4, 3, { { .1f, .9f, .3f, .2f }, { 1.1f, .4f, .5f, .6f }, { .7f, .8f, .25f, .05f } } },
+    { 4, 4, { { .1f, .9f, .3f, .2f }, { 1.1f, .4f, .5f, .6f }, { .7f, .8f, .25f, .05f }, { .5f, .5f, .5f, .5f } } },
+    { 8, 5, { { .1f, .2f, .3f, .4f, .5f, .6f, .7f, .8f }, { .8f, .7f, .6f, .5f, .4f, .3f, .2f, .1f },
+              { .5f, .5f, .5f, .5f, .5f, .5f, .5f, .5f }, { 1, .2f, 1, .2f, 1, .2f, 1, .2f },
+              { .9f, 0, .9f, 0, .9f, 0, .9f, 0 } } },
+};
+
+static void remap_test_matrix(pa_init_remap_func_t init_func, pa_sample_format_t sf) {
+    pa_sample_spec iss, oss;
+    pa_remap_t remap;
+    unsigned t, oc, ic;
+
+    for (t = 0; t < PA_ELEMENTSOF(remap_matrices); t++) {
+        iss.format = oss.format = sf;
+        iss.channels = remap_matrices[t].n_ic;
+        oss.channels = remap_matrices[t].n_oc;
+        remap.format = &sf;
+        remap.i_ss = &iss;
+        remap.o_ss = &oss;
+
+        for (oc = 0; oc < oss.channels; oc++)
+            for (ic = 0; ic < iss.channels; ic++) {
+                remap.map_table_f[oc][ic] = remap_matrices[t].table[oc][ic];
+                remap.map_table_i[oc][ic] = (int32_t) (remap_matrices[t].table[oc][ic] * 0x10000);
+            }
+
+        remap.do_remap = NULL;
+        init_func(&remap);
+        fail_unless(remap.do_remap != NULL);
+
+        run_remap_test_matrix(&remap, remap.do_remap, 0, TRUE, FALSE);
+        run_remap_test_matrix(&remap, remap.do_remap, 1, TRUE, FALSE);
+        run_remap_test_matrix(&remap, remap.do_remap, 2, TRUE, FALSE);
+        /* Only time the 5.1 up- and downmixes */
+        run_remap_test_matrix(&remap, remap.do_remap, 3, TRUE, t < 2);
+    }
+}
+
+/* Leaves the choice to the C remappers */
+static void init_remap_none(pa_remap_t *m) {
+}
+
+START_TEST (remap_matrix_test) {
+    pa_init_remap_func_t orig_init_func;
+
+    orig_init_func = pa_get_init_remap_func();
+    pa_set_init_remap_func(init_remap_none);
+
+    pa_log_debug("Checking C matrix remap (float)");
+    remap_test_matrix(pa_init_remap, PA_SAMPLE_FLOAT32NE);
+    pa_log_debug("Checking C matrix remap (s16)");
+    remap_test_matrix(pa_init_remap, PA_SAMPLE_S16NE);
+
+    pa_set_init_remap_func(orig_init_func);
+}
+END_TEST
+
+#if defined (__i386__) || defined (__amd64__)
+#ifdef HAVE_SSE2
+START_TEST (remap_sse2_matrix_test) {
+    pa_cpu_x86_flag_t flags = 0;
+    pa_init_remap_func_t orig_init_func;
+
+    pa_cpu_get_x86_flags(&flags);
+    if (!(flags & PA_CPU_X86_SSE2)) {
+        pa_log_info("SSE2 not supported. Skipping");
+        return;
+    }
+
+    orig_init_func = pa_get_init_remap_func();
+    pa_remap_func_init_sse2(flags);
+    /* A second init keeps the generic remappers as fallback */
+    pa_remap_func_init_sse2(flags);
+
+    pa_log_debug("Checking SSE2 matrix remap (float)");
+    remap_test_matrix(pa_init_remap, PA_SAMPLE_FLOAT32NE);
+    pa_log_debug("Checking SSE2 matrix remap (s16)");
+    remap_test_matrix(pa_init_remap, PA_SAMPLE_S16NE);
+
+    pa_set_init_remap_func(orig_init_func);
+}
+END_TEST
+#endif /* HAVE_SSE2 */
+#endif /* defined (__i386__) || defined (__amd64__) */
+
+#undef SAMPLES
+#undef TIMES
+#undef TIMES2
+/* End remap tests */
+
+/* Start mix tests */
+
+#define SAMPLES 1028
+#define TIMES 1000
+#define TIMES2 100
+#define MIX_STREAMS_MAX 8
+
+static void acquire_mix_streams(pa_mix_info streams[], unsigned nstreams) {
+    unsigned i;
+
+    for (i = 0; i < nstreams; i++)
+        streams[i].ptr = pa_memblock_acquire_chunk(&streams[i].chunk);
+}
+
+static void release_mix_streams(pa_mix_info streams[], unsigned nstreams) {
+    unsigned i;
+
+    for (i = 0; i < nstreams; i++)
+        pa_memblock_release(streams[i].chunk.memblock);
+}
+
+static void run_mix_test(
         pa_do_mix_func_t func,
         pa_do_mix_func_t orig_func,
+        pa_sample_format_t format,
         int align,
         int channels,
+        int nstreams,
         pa_bool_t correct,
         pa_bool_t perf) {
 
-    PA_DECLARE_ALIGNED(8, int16_t, in0[SAMPLES * 4]) = { 0 };
-    PA_DECLARE_ALIGNED(8, int16_t, in1[SAMPLES * 4]) = { 0 };
-    PA_DECLARE_ALIGNED(8, int16_t, out[SAMPLES * 4]) = { 0 };
-    PA_DECLARE_ALIGNED(8, int16_t, out_ref[SAMPLES * 4]) = { 0 };
-    int16_t *samples0, *samples1;
-    int16_t *samples, *samples_ref;
+    pa_sample_spec ss;
+    size_t ssize;
+    uint8_t *in[MIX_STREAMS_MAX];
+    uint8_t *out, *out_ref;
+    void *samples, *samples_ref;
     int nsamples;
     pa_mempool *pool;
-    pa_memchunk c0, c1;
-    pa_mix_info m[2];
-    int i;
+    pa_mix_info m[MIX_STREAMS_MAX];
+    int i, j;
+
+    pa_assert(format == PA_SAMPLE_S16NE || format == PA_SAMPLE_S32NE || format == PA_SAMPLE_FLOAT32NE);
+    pa_assert(nstreams <= MIX_STREAMS_MAX);
 
-    pa_assert(channels == 1 || channels == 2 || channels == 4);
+    ss.format = format;
+    ss.channels = channels;
+    ss.rate = 44100;
+    ssize = pa_sample_size(&ss);
 
     /* Force sample alignment as requested */
-    samples0 = in0 + (8 - align);
-    samples1 = in1 + (8 - align);
-    samples = out + (8 - align);
-    samples_ref = out_ref + (8 - align);
     nsamples = channels * (SAMPLES - (8 - align));
 
     fail_unless((pool = pa_mempool_new(FALSE, 0)) != NULL, NULL);
 
-    pa_random(samples0, nsamples * sizeof(int16_t));
-    c0.memblock = pa_memblock_new_fixed(pool, samples0, nsamples * sizeof(int16_t), FALSE);
-    c0.length = pa_memblock_get_length(c0.memblock);
-    c0.index = 0;
+    out = pa_xmalloc0((nsamples + 8) * ssize);
+    out_ref = pa_xmalloc0((nsamples + 8) * ssize);
+    samples = out + (8 - align) * ssize;
+    samples_ref = out_ref + (8 - align) * ssize;
 
-    pa_random(samples1, nsamples * sizeof(int16_t));
-    c1.memblock = pa_memblock_new_fixed(pool, samples1, nsamples * sizeof(int16_t), FALSE);
-    c1.length = pa_memblock_get_length(c1.memblock);
-    c1.index = 0;
+    for (i = 0; i < nstreams; i++) {
+        void *d;
 
-    m[0].chunk = c0;
-    m[0].volume.channels = channels;
-    for (i = 0; i < channels; i++) {
-        m[0].volume.values[i] = PA_VOLUME_NORM;
-        m[0].linear[i].i = 0x5555;
-    }
+        in[i] = pa_xmalloc0((nsamples + 8) * ssize);
+        d = in[i] + (8 - align) * ssize;
 
-    m[1].chunk = c1;
-    m[1].volume.channels = channels;
-    for (i = 0; i < channels; i++) {
-        m[1].volume.values[i] = PA_VOLUME_NORM;
-        m[1].linear[i].i = 0x6789;
+        if (format == PA_SAMPLE_FLOAT32NE) {
+            float *f = d;
+
+            for (j = 0; j < nsamples; j++)
+                f[j] = 2.1f * (rand()/(float) RAND_MAX - 0.5f);
+        } else
+            pa_random(d, nsamples * ssize);
+
+        m[i].chunk.memblock = pa_memblock_new_fixed(pool, d, nsamples * ssize, FALSE);
+        m[i].chunk.length = pa_memblock_get_length(m[i].chunk.memblock);
+        m[i].chunk.index = 0;
+        m[i].volume.channels = channels;
+
+        for (j = 0; j < channels; j++) {
+            m[i].volume.values[j] = PA_VOLUME_NORM;
+
+            /* Mix in some muted and amplified channels */
+            if (format == PA_SAMPLE_FLOAT32NE)
+                m[i].linear[j].f = (i + j) % 5 == 4 ? 0.0f : 1.5f * (rand() / (float) RAND_MAX);
+            else
+                m[i].linear[j].i = (i + j) % 5 == 4 ? 0 : rand() % 0x18000;
+        }
     }
 
     if (correct) {
-        acquire_mix_streams(m, 2);
-        orig_func(m, 2, channels, samples_ref, nsamples * sizeof(int16_t));
-        release_mix_streams(m, 2);
+        acquire_mix_streams(m, nstreams);
+        orig_func(m, nstreams, channels, samples_ref, nsamples * ssize);
+        release_mix_streams(m, nstreams);
 
-        acquire_mix_streams(m, 2);
-        func(m, 2, channels, samples, nsamples * sizeof(int16_t));
-        release_mix_streams(m, 2);
+        acquire_mix_streams(m, nstreams);
+        func(m, nstreams, channels, samples, nsamples * ssize);
+        release_mix_streams(m, nstreams);
 
         for (i = 0; i < nsamples; i++) {
-            if (samples[i] != samples_ref[i]) {
-                pa_log_debug("Correctness test failed: align=%d, channels=%d", align, channels);
-                pa_log_debug("%d: %hd != %04hd (%hd + %hd)\n",
-                    i,
-                    samples[i], samples_ref[i],
-                    samples0[i], samples1[i]);
+            pa_bool_t equal;
+
+            switch (format) {
+                case PA_SAMPLE_S16NE:
+                    equal = ((int16_t*) samples)[i] == ((int16_t*) samples_ref)[i];
+                    break;
+                case PA_SAMPLE_S32NE:
+                    equal = ((int32_t*) samples)[i] == ((int32_t*) samples_ref)[i];
+                    break;
+                default:
+#if defined (__i386__)
+                    /* The C version may keep the sums in extended precision
+                     * x87 registers */
+                    equal = fabsf(((float*) samples)[i] - ((float*) samples_ref)[i]) <= 0.00001;
+#else
+                    equal = memcmp((float*) samples + i, (float*) samples_ref + i, sizeof(float)) == 0;
+#endif
+                    break;
+            }
+
+            if (!equal) {
+                pa_log_debug("Correctness test failed: format=%s, align=%d, channels=%d, streams=%d",
+                    pa_sample_format_to_string(format), align, channels, nstreams);
+                pa_log_debug("%d: sample differs", i);
                 fail();
             }
         }
     }
 
     if (perf) {
-        pa_log_debug("Testing %d-channel mixing performance with %d sample alignment", channels, align);
+        pa_log_debug("Testing %d-channel %d-stream %s mixing performance with %d sample alignment",
+            channels, nstreams, pa_sample_format_to_string(format), align);
 
         PA_CPU_TEST_RUN_START("func", TIMES, TIMES2) {
-            acquire_mix_streams(m, 2);
-            func(m, 2, channels, samples, nsamples * sizeof(int16_t));
-            release_mix_streams(m, 2);
+            acquire_mix_streams(m, nstreams);
+            func(m, nstreams, channels, samples, nsamples * ssize);
+            release_mix_streams(m, nstreams);
         } PA_CPU_TEST_RUN_STOP
 
         PA_CPU_TEST_RUN_START("orig", TIMES, TIMES2) {
-            acquire_mix_streams(m, 2);
-            orig_func(m, 2, channels, samples_ref, nsamples * sizeof(int16_t));
-            release_mix_streams(m, 2);
+            acquire_mix_streams(m, nstreams);
+            orig_func(m, nstreams, channels, samples_ref, nsamples * ssize);
+            release_mix_streams(m, nstreams);
         } PA_CPU_TEST_RUN_STOP
     }
 
-    pa_memblock_unref(c0.memblock);
-    pa_memblock_unref(c1.memblock);
+    for (i = 0; i < nstreams; i++) {
+        pa_memblock_unref(m[i].chunk.memblock);
+        pa_xfree(in[i]);
+    }
+
+    pa_xfree(out);
+    pa_xfree(out_ref);
 
     pa_mempool_free(pool);
 }
-#endif /* HAVE_NEON */
-#endif /* defined (__arm__) && defined (__linux__) */
+
+#if defined (__i386__) || defined (__amd64__) || defined (HAVE_ORC)
+static void mix_test(pa_do_mix_func_t orig_funcs[], pa_do_mix_func_t funcs[]) {
+    static const pa_sample_format_t formats[] = { PA_SAMPLE_S16NE, PA_SAMPLE_S32NE, PA_SAMPLE_FLOAT32NE };
+    static const int channels[] = { 1, 2, 3, 6, 8 };
+    unsigned f, c, j;
+
+    for (f = 0; f < PA_ELEMENTSOF(formats); f++) {
+        pa_log_debug("Checking %s mix", pa_sample_format_to_string(formats[f]));
+
+        for (c = 0; c < PA_ELEMENTSOF(channels); c++)
+            for (j = 0; j < 8; j++)
+                run_mix_test(funcs[f], orig_funcs[f], formats[f], j, channels[c], 1 + (j + c) % MIX_STREAMS_MAX, TRUE, FALSE);
+
+        run_mix_test(funcs[f], orig_funcs[f], formats[f], 7, 2, 2, TRUE, TRUE);
+        run_mix_test(funcs[f], orig_funcs[f], formats[f], 7, 2, MIX_STREAMS_MAX, TRUE, TRUE);
+    }
+}
+#endif
+
+#if defined (__i386__) || defined (__amd64__)
+#ifdef HAVE_SSE2
+START_TEST (mix_sse2_test) {
+    pa_do_mix_func_t orig_funcs[3], sse2_funcs[3];
+    pa_cpu_x86_flag_t flags = 0;
+
+    pa_cpu_get_x86_flags(&flags);
+
+    if (!(flags & PA_CPU_X86_SSE2)) {
+        pa_log_info("SSE2 not supported. Skipping");
+        return;
+    }
+
+    orig_funcs[0] = pa_get_mix_func(PA_SAMPLE_S16NE);
+    orig_funcs[1] = pa_get_mix_func(PA_SAMPLE_S32NE);
+    orig_funcs[2] = pa_get_mix_func(PA_SAMPLE_FLOAT32NE);
+    pa_mix_func_init_sse(flags);
+    /* Again, the fallbacks must still be the old functions then */
+    pa_mix_func_init_sse(flags);
+    sse2_funcs[0] = pa_get_mix_func(PA_SAMPLE_S16NE);
+    sse2_funcs[1] = pa_get_mix_func(PA_SAMPLE_S32NE);
+    sse2_funcs[2] = pa_get_mix_func(PA_SAMPLE_FLOAT32NE);
+
+    pa_log_debug("Checking SSE2 mix");
+    mix_test(orig_funcs, sse2_funcs);
+}
+END_TEST
+#endif /* HAVE_SSE2 */
+
+#ifdef HAVE_AVX2
+START_TEST (mix_avx2_test) {
+    pa_do_mix_func_t orig_funcs[3], avx2_funcs[3];
+    pa_cpu_x86_flag_t flags = 0;
+
+    pa_cpu_get_x86_flags(&flags);
+
+    if (!(flags & PA_CPU_X86_AVX2)) {
+        pa_log_info("AVX2 not supported. Skipping");
+        return;
+    }
+
+    orig_funcs[0] = pa_get_mix_func(PA_SAMPLE_S16NE);
+    orig_funcs[1] = pa_get_mix_func(PA_SAMPLE_S32NE);
+    orig_funcs[2] = pa_get_mix_func(PA_SAMPLE_FLOAT32NE);
+    pa_mix_func_init_avx2(flags);
+    /* Again, the fallbacks must still be the old functions then */
+    pa_mix_func_init_avx2(flags);
+    avx2_funcs[0] = pa_get_mix_func(PA_SAMPLE_S16NE);
+    avx2_funcs[1] = pa_get_mix_func(PA_SAMPLE_S32NE);
+    avx2_funcs[2] = pa_get_mix_func(PA_SAMPLE_FLOAT32NE);
+
+    pa_log_debug("Checking AVX2 mix");
+    mix_test(orig_funcs, avx2_funcs);
+}
+END_TEST
+#endif /* HAVE_AVX2 */
+#endif /* defined (__i386__) || defined (__amd64__) */
 
 #if defined (__arm__) && defined (__linux__)
 #ifdef HAVE_NEON
@@ -842,13 +1655,536 @@ START_TEST (mix_neon_test) {
     neon_func = pa_get_mix_func(PA_SAMPLE_S16NE);
 
     pa_log_debug("Checking NEON mix");
-    run_mix_test(neon_func, orig_func, 7, 2, TRUE, TRUE);
+    run_mix_test(neon_func, orig_func, PA_SAMPLE_S16NE, 7, 2, 2, TRUE, TRUE);
 }
 END_TEST
 #endif /* HAVE_NEON */
 #endif /* defined (__arm__) && defined (__linux__) */
+
+#ifdef HAVE_ORC
+START_TEST (mix_orc_test) {
+    pa_do_mix_func_t orig_funcs[3], orc_funcs[3];
+
+    orig_funcs[0] = pa_get_mix_func(PA_SAMPLE_S16NE);
+    orig_funcs[1] = pa_get_mix_func(PA_SAMPLE_S32NE);
+    orig_funcs[2] = pa_get_mix_func(PA_SAMPLE_FLOAT32NE);
+    pa_mix_func_init_orc();
+    pa_mix_func_init_orc();
+    orc_funcs[0] = pa_get_mix_func(PA_SAMPLE_S16NE);
+    orc_funcs[1] = pa_get_mix_func(PA_SAMPLE_S32NE);
+    orc_funcs[2] = pa_get_mix_func(PA_SAMPLE_FLOAT32NE);
+
+    pa_log_debug("Checking Orc mix");
+    mix_test(orig_funcs, orc_funcs);
+}
+END_TEST
+#endif /* HAVE_ORC */
+
+#undef SAMPLES
+#undef TIMES
+#undef TIMES2
 /* End mix tests */
 
+/* Start interleave tests */
+#define FRAMES 1021
+#define TIMES 1000
+#define TIMES2 100
+
+static void run_interleave_test(size_t ss, unsigned channels, pa_bool_t correct, pa_bool_t perf) {
+    pa_interleave_func_t ifunc;
+    pa_deinterleave_func_t dfunc;
+    uint8_t *planes[PA_INTERLEAVE_CHANNELS_MAX], *planes_ref[PA_INTERLEAVE_CHANNELS_MAX];
+    uint8_t *interleaved, *interleaved_ref;
+    unsigned c;
+
+    ifunc = pa_get_interleave_func(ss, channels);
+    dfunc = pa_get_deinterleave_func(ss, channels);
+
+    if (!ifunc || !dfunc)
+        return;
+
+    interleaved = pa_xmalloc(FRAMES * channels * ss);
+    interleaved_ref = pa_xmalloc(FRAMES * channels * ss);
+
+    for (c = 0; c < channels; c++) {
+        planes[c] = pa_xmalloc(FRAMES * ss);
+        planes_ref[c] = pa_xmalloc(FRAMES * ss);
+        pa_random(planes[c], FRAMES * ss);
+    }
+
+    if (correct) {
+        /* With no function installed the generic version is used */
+        pa_set_interleave_func(ss, channels, NULL);
+        pa_interleave((const void**) planes, channels, interleaved_ref, ss, FRAMES);
+        pa_set_interleave_func(ss, channels, ifunc);
+
+        pa_interleave((const void**) planes, channels, interleaved, ss, FRAMES);
+        fail_unless(memcmp(interleaved, interleaved_ref, FRAMES * channels * ss) == 0);
+
+        /* Different block offsets within the frames */
+        pa_interleave((const void**) planes, channels, interleaved, ss, FRAMES - 3);
+        fail_unless(memcmp(interleaved, interleaved_ref, (FRAMES - 3) * channels * ss) == 0);
+
+        pa_set_deinterleave_func(ss, channels, NULL);
+        pa_deinterleave(interleaved_ref, (void**) planes_ref, channels, ss, FRAMES);
+        pa_set_deinterleave_func(ss, channels, dfunc);
+
+        for (c = 0; c < channels; c++)
+            fail_unless(memcmp(planes_ref[c], planes[c], FRAMES * ss) == 0);
+
+        pa_deinterleave(interleaved, (void**) planes_ref, channels, ss, FRAMES);
+
+        for (c = 0; c < channels; c++)
+            if (memcmp(planes_ref[c], planes[c], FRAMES * ss) != 0) {
+                pa_log_debug("Correctness test failed: size=%u, channels=%u, channel %u differs",
+                             (unsigned) ss, channels, c);
+                fail();
+            }
+    }
+
+    if (perf) {
+        pa_log_debug("Testing %u-channel %u-byte interleaving performance", channels, (unsigned) ss);
+
+        PA_CPU_TEST_RUN_START("func", TIMES, TIMES2) {
+            pa_interleave((const void**) planes, channels, interleaved, ss, FRAMES);
+        } PA_CPU_TEST_RUN_STOP
+
+        pa_set_interleave_func(ss, channels, NULL);
+        PA_CPU_TEST_RUN_START("orig", TIMES, TIMES2) {
+            pa_interleave((const void**) planes, channels, interleaved_ref, ss, FRAMES);
+        } PA_CPU_TEST_RUN_STOP
+        pa_set_interleave_func(ss, channels, ifunc);
+    }
+
+    for (c = 0; c < channels; c++) {
+        pa_xfree(planes[c]);
+        pa_xfree(planes_ref[c]);
+    }
+
+    pa_xfree(interleaved);
+    pa_xfree(interleaved_ref);
+}
+
+static void run_clamp_test(void) {
+    float *in, *out, *out_ref;
+    pa_clamp_func_t func;
+    unsigned i;
+
+    func = pa_get_clamp_func();
+    fail_unless(func != NULL);
+
+    in = pa_xnew(float, FRAMES);
+    out = pa_xnew(float, FRAMES);
+    out_ref = pa_xnew(float, FRAMES);
+
+    for (i = 0; i < FRAMES; i++)
+        in[i] = 4.0f * ((float) rand() / (float) RAND_MAX) - 2.0f;
+
+    pa_set_clamp_func(NULL);
+    pa_sample_clamp(PA_SAMPLE_FLOAT32NE, out_ref, sizeof(float), in, sizeof(float), FRAMES);
+    pa_set_clamp_func(func);
+    pa_sample_clamp(PA_SAMPLE_FLOAT32NE, out, sizeof(float), in, sizeof(float), FRAMES);
+
+    fail_unless(memcmp(out, out_ref, FRAMES * sizeof(float)) == 0);
+
+    pa_xfree(in);
+    pa_xfree(out);
+    pa_xfree(out_ref);
+}
+
+static void interleave_test(void) {
+    static const unsigned channels[] = { 2, 4, 6, 8 };
+    unsigned c;
+
+    for (c = 0; c < PA_ELEMENTSOF(channels); c++) {
+        run_interleave_test(2, channels[c], TRUE, FALSE);
+        run_interleave_test(4, channels[c], TRUE, FALSE);
+    }
+
+    run_interleave_test(4, 2, FALSE, TRUE);
+    run_interleave_test(4, 6, FALSE, TRUE);
+
+    run_clamp_test();
+}
+
+#if defined (__i386__) || defined (__amd64__)
+#ifdef HAVE_SSE2
+START_TEST (interleave_sse2_test) {
+    pa_cpu_x86_flag_t flags = 0;
+
+    pa_cpu_get_x86_flags(&flags);
+
+    if (!(flags & PA_CPU_X86_SSE2)) {
+        pa_log_info("SSE2 not supported. Skipping");
+        return;
+    }
+
+    pa_interleave_func_init_sse2(flags);
+
+    pa_log_debug("Checking SSE2 interleave");
+    interleave_test();
+}
+END_TEST
+#endif /* HAVE_SSE2 */
+#endif /* defined (__i386__) || defined (__amd64__) */
+
+#undef FRAMES
+#undef TIMES
+#undef TIMES2
+/* End interleave tests */
+
+/* Start ffmpeg resampler tests */
+#define FRAMES 1021
+#define TIMES 100
+#define TIMES2 10
+
+static int run_ffmpeg_resample(struct AVResampleContext *c, int channels, int16_t *dst, const int16_t *src) {
+    int consumed;
+
+    /* Not updating the context keeps repeated runs identical */
+    return av_resample(c, dst, (int16_t*) src, channels, &consumed, FRAMES, FRAMES * 2, 0);
+}
+
+static void run_ffmpeg_test(int out_rate, int in_rate, int channels, pa_bool_t correct, pa_bool_t perf) {
+    av_resample_filter_func_t func;
+    struct AVResampleContext *c;
+    int16_t *src, *dst, *dst_ref;
+    int i, n, n_ref;
+
+    func = av_resample_get_filter_func(channels);
+    fail_unless(func != NULL);
+
+    pa_assert_se(c = av_resample_init(out_rate, in_rate, 16, 10, 0, 0.8));
+
+    src = pa_xnew(int16_t, FRAMES * channels);
+    dst = pa_xnew0(int16_t, FRAMES * 2 * channels);
+    dst_ref = pa_xnew0(int16_t, FRAMES * 2 * channels);
+
+    for (i = 0; i < FRAMES * channels; i++)
+        src[i] = (int16_t) (rand() - RAND_MAX / 2);
+
+    if (correct) {
+        /* With no function installed the generic version is used */
+        av_resample_set_filter_func(channels, NULL);
+        n_ref = run_ffmpeg_resample(c, channels, dst_ref, src);
+        av_resample_set_filter_func(channels, func);
+
+        n = run_ffmpeg_resample(c, channels, dst, src);
+
+        fail_unless(n == n_ref);
+        if (memcmp(dst, dst_ref, n * channels * sizeof(int16_t)) != 0) {
+            pa_log_debug("Correctness test failed: %d -> %d, channels=%d", in_rate, out_rate, channels);
+            fail();
+        }
+    }
+
+    if (perf) {
+        pa_log_debug("Testing %d-channel ffmpeg resampler performance, %d -> %d", channels, in_rate, out_rate);
+
+        PA_CPU_TEST_RUN_START("func", TIMES, TIMES2) {
+            run_ffmpeg_resample(c, channels, dst, src);
+        } PA_CPU_TEST_RUN_STOP
+
+        av_resample_set_filter_func(channels, NULL);
+        PA_CPU_TEST_RUN_START("orig", TIMES, TIMES2) {
+            run_ffmpeg_resample(c, channels, dst_ref, src);
+        } PA_CPU_TEST_RUN_STOP
+        av_resample_set_filter_func(channels, func);
+    }
+
+    av_resample_close(c);
+
+    pa_xfree(src);
+    pa_xfree(dst);
+    pa_xfree(dst_ref);
+}
+
+static void ffmpeg_test(void) {
+    static const int channels[] = { 1, 2, 4, 8 };
+    unsigned c;
+
+    /* Downsampling stretches the filter to taps that aren't a multiple of
+     * the vector width */
+    for (c = 0; c < PA_ELEMENTSOF(channels); c++) {
+        run_ffmpeg_test(44100, 48000, channels[c], TRUE, FALSE);
+        run_ffmpeg_test(48000, 44100, channels[c], TRUE, FALSE);
+    }
+
+    run_ffmpeg_test(44100, 48000, 2, FALSE, TRUE);
+}
+
+#if defined (__i386__) || defined (__amd64__)
+#ifdef HAVE_SSE2
+START_TEST (ffmpeg_sse2_test) {
+    pa_cpu_x86_flag_t flags = 0;
+
+    pa_cpu_get_x86_flags(&flags);
+
+    if (!(flags & PA_CPU_X86_SSE2)) {
+        pa_log_info("SSE2 not supported. Skipping");
+        return;
+    }
+
+    pa_ffmpeg_func_init_sse2(flags);
+
+    pa_log_debug("Checking SSE2 ffmpeg resampler");
+    ffmpeg_test();
+}
+END_TEST
+#endif /* HAVE_SSE2 */
+#endif /* defined (__i386__) || defined (__amd64__) */
+
+#undef FRAMES
+#undef TIMES
+#undef TIMES2
+/* End ffmpeg resampler tests */
+
+/* Start linear resampler tests */
+#define FRAMES 1021
+#define TIMES 1000
+#define TIMES2 100
+
+static void run_resampler_linear_test(pa_sample_format_t f, unsigned channels,
+        pa_resampler_linear_func_t func, pa_resampler_linear_func_t orig_func, pa_bool_t correct, pa_bool_t perf) {
+    size_t ss = pa_sample_size_of_format(f);
+    unsigned index[FRAMES];
+    float weight[FRAMES];
+    void *src, *dst, *dst_ref;
+    unsigned i, n = 0;
+
+    src = pa_xmalloc(FRAMES * channels * ss);
+    dst = pa_xmalloc0(FRAMES * channels * ss);
+    dst_ref = pa_xmalloc0(FRAMES * channels * ss);
+
+    pa_random(src, FRAMES * channels * ss);
+
+    if (f == PA_SAMPLE_FLOAT32NE)
+        for (i = 0; i < FRAMES * channels; i++)
+            ((float*) src)[i] = 2.0f * ((float) rand() / (float) RAND_MAX) - 1.0f;
+
+    /* Up to three output frames for each input frame, like upsampling,
+     * and skipping some input frames, like downsampling */
+    for (i = 1; i < FRAMES && n < FRAMES; i += rand() % 3) {
+        index[n] = i;
+        weight[n++] = (float) rand() / ((float) RAND_MAX + 1.0f);
+    }
+
+    if (correct) {
+        orig_func(channels, src, index, weight, n, dst_ref);
+        func(channels, src, index, weight, n, dst);
+
+        for (i = 0; i < n * channels; i++) {
+            pa_bool_t ok;
+
+            if (f == PA_SAMPLE_FLOAT32NE)
+                ok = fabsf(((float*) dst)[i] - ((float*) dst_ref)[i]) <= 1e-6f;
+            else
+                ok = abs(((int16_t*) dst)[i] - ((int16_t*) dst_ref)[i]) <= 1;
+
+            if (!ok) {
+                pa_log_debug("Correctness test failed: format=%s, channels=%u, sample %u differs",
+                             pa_sample_format_to_string(f), channels, i);
+                fail();
+            }
+        }
+    }
+
+    if (perf) {
+        pa_log_debug("Testing %u-channel %s linear resampler performance", channels, pa_sample_format_to_string(f));
+
+        PA_CPU_TEST_RUN_START("func", TIMES, TIMES2) {
+            func(channels, src, index, weight, n, dst);
+        } PA_CPU_TEST_RUN_STOP
+
+        PA_CPU_TEST_RUN_START("orig", TIMES, TIMES2) {
+            orig_func(channels, src, index, weight, n, dst_ref);
+        } PA_CPU_TEST_RUN_STOP
+    }
+
+    pa_xfree(src);
+    pa_xfree(dst);
+    pa_xfree(dst_ref);
+}
+
+static void resampler_linear_test(pa_resampler_linear_func_t orig_funcs[2], pa_resampler_linear_func_t funcs[2]) {
+    static const pa_sample_format_t formats[] = { PA_SAMPLE_S16NE, PA_SAMPLE_FLOAT32NE };
+    static const unsigned channels[] = { 1, 2, 3, 4, 6, 8 };
+    unsigned f, c;
+
+    for (f = 0; f < PA_ELEMENTSOF(formats); f++) {
+        for (c = 0; c < PA_ELEMENTSOF(channels); c++)
+            run_resampler_linear_test(formats[f], channels[c], funcs[f], orig_funcs[f], TRUE, FALSE);
+
+        run_resampler_linear_test(formats[f], 2, funcs[f], orig_funcs[f], FALSE, TRUE);
+    }
+}
+
+#if defined (__i386__) || defined (__amd64__)
+#ifdef HAVE_SSE2
+START_TEST (resampler_linear_sse2_test) {
+    pa_resampler_linear_func_t orig_funcs[2], sse2_funcs[2];
+    pa_cpu_x86_flag_t flags = 0;
+
+    pa_cpu_get_x86_flags(&flags);
+
+    if (!(flags & PA_CPU_X86_SSE2)) {
+        pa_log_info("SSE2 not supported. Skipping");
+        return;
+    }
+
+    orig_funcs[0] = pa_get_resampler_linear_func(PA_SAMPLE_S16NE);
+    orig_funcs[1] = pa_get_resampler_linear_func(PA_SAMPLE_FLOAT32NE);
+    pa_resampler_func_init_sse2(flags);
+    sse2_funcs[0] = pa_get_resampler_linear_func(PA_SAMPLE_S16NE);
+    sse2_funcs[1] = pa_get_resampler_linear_func(PA_SAMPLE_FLOAT32NE);
+
+    pa_log_debug("Checking SSE2 linear resampler");
+    resampler_linear_test(orig_funcs, sse2_funcs);
+}
+END_TEST
+#endif /* HAVE_SSE2 */
+#endif /* defined (__i386__) || defined (__amd64__) */
+
+#undef FRAMES
+#undef TIMES
+#undef TIMES2
+/* End linear resampler tests */
+
+/* Start peaks resampler tests */
+#define FRAMES 1021
+#define TIMES 1000
+#define TIMES2 100
+
+static void run_resampler_peaks_test(pa_sample_format_t f, unsigned channels,
+        pa_resampler_peaks_func_t func, pa_resampler_peaks_func_t orig_func, pa_bool_t correct, pa_bool_t perf) {
+    size_t ss = pa_sample_size_of_format(f);
+    float max_f[PA_CHANNELS_MAX], max_f_ref[PA_CHANNELS_MAX];
+    int16_t max_i[PA_CHANNELS_MAX], max_i_ref[PA_CHANNELS_MAX];
+    void *max, *max_ref;
+    void *src;
+    unsigned i, n;
+
+    src = pa_xmalloc(FRAMES * channels * ss);
+    pa_random(src, FRAMES * channels * ss);
+
+    if (f == PA_SAMPLE_FLOAT32NE) {
+        for (i = 0; i < FRAMES * channels; i++)
+            ((float*) src)[i] = 2.0f * ((float) rand() / (float) RAND_MAX) - 1.0f;
+
+        /* NaNs never count as a peak */
+        ((float*) src)[FRAMES / 2] = NAN;
+        max = max_f;
+        max_ref = max_f_ref;
+    } else {
+        /* Neither does -32768, which abs() can't represent */
+        for (i = 0; i < FRAMES * channels; i += 7)
+            ((int16_t*) src)[i] = INT16_MIN;
+        max = max_i;
+        max_ref = max_i_ref;
+    }
+
+    if (correct) {
+        /* Odd frame counts exercise the tails */
+        for (n = FRAMES - 4; n <= FRAMES; n++) {
+            memset(max_f, 0, sizeof(max_f));
+            memset(max_f_ref, 0, sizeof(max_f_ref));
+            memset(max_i, 0, sizeof(max_i));
+            memset(max_i_ref, 0, sizeof(max_i_ref));
+
+            orig_func(channels, src, n, max_ref);
+            func(channels, src, n, max);
+
+            if (memcmp(max, max_ref, channels * ss) != 0) {
+                pa_log_debug("Correctness test failed: format=%s, channels=%u, frames=%u",
+                             pa_sample_format_to_string(f), channels, n);
+                fail();
+            }
+        }
+    }
+
+    if (perf) {
+        pa_log_debug("Testing %u-channel %s peaks resampler performance", channels, pa_sample_format_to_string(f));
+
+        PA_CPU_TEST_RUN_START("func", TIMES, TIMES2) {
+            func(channels, src, FRAMES, max);
+        } PA_CPU_TEST_RUN_STOP
+
+        PA_CPU_TEST_RUN_START("orig", TIMES, TIMES2) {
+            orig_func(channels, src, FRAMES, max_ref);
+        } PA_CPU_TEST_RUN_STOP
+    }
+
+    pa_xfree(src);
+}
+
+static void resampler_peaks_test(pa_resampler_peaks_func_t orig_funcs[2], pa_resampler_peaks_func_t funcs[2]) {
+    static const pa_sample_format_t formats[] = { PA_SAMPLE_S16NE, PA_SAMPLE_FLOAT32NE };
+    unsigned f, c;
+
+    for (f = 0; f < PA_ELEMENTSOF(formats); f++) {
+        for (c = 1; c <= 8; c++)
+            run_resampler_peaks_test(formats[f], c, funcs[f], orig_funcs[f], TRUE, FALSE);
+
+        run_resampler_peaks_test(formats[f], 1, funcs[f], orig_funcs[f], FALSE, TRUE);
+        run_resampler_peaks_test(formats[f], 2, funcs[f], orig_funcs[f], FALSE, TRUE);
+    }
+}
+
+#if defined (__i386__) || defined (__amd64__)
+#ifdef HAVE_SSE2
+START_TEST (resampler_peaks_sse2_test) {
+    pa_resampler_peaks_func_t orig_funcs[2], sse2_funcs[2];
+    pa_cpu_x86_flag_t flags = 0;
+
+    pa_cpu_get_x86_flags(&flags);
+
+    if (!(flags & PA_CPU_X86_SSE2)) {
+        pa_log_info("SSE2 not supported. Skipping");
+        return;
+    }
+
+    orig_funcs[0] = pa_get_resampler_peaks_func(PA_SAMPLE_S16NE);
+    orig_funcs[1] = pa_get_resampler_peaks_func(PA_SAMPLE_FLOAT32NE);
+    pa_resampler_func_init_sse2(flags);
+    sse2_funcs[0] = pa_get_resampler_peaks_func(PA_SAMPLE_S16NE);
+    sse2_funcs[1] = pa_get_resampler_peaks_func(PA_SAMPLE_FLOAT32NE);
+
+    pa_log_debug("Checking SSE2 peaks resampler");
+    resampler_peaks_test(orig_funcs, sse2_funcs);
+}
+END_TEST
+#endif /* HAVE_SSE2 */
+
+#ifdef HAVE_AVX2
+START_TEST (resampler_peaks_avx2_test) {
+    pa_resampler_peaks_func_t orig_funcs[2], avx2_funcs[2];
+    pa_cpu_x86_flag_t flags = 0;
+
+    pa_cpu_get_x86_flags(&flags);
+
+    if (!(flags & PA_CPU_X86_AVX2)) {
+        pa_log_info("AVX2 not supported. Skipping");
+        return;
+    }
+
+    orig_funcs[0] = pa_get_resampler_peaks_func(PA_SAMPLE_S16NE);
+    orig_funcs[1] = pa_get_resampler_peaks_func(PA_SAMPLE_FLOAT32NE);
+    pa_resampler_func_init_avx2(flags);
+    avx2_funcs[0] = pa_get_resampler_peaks_func(PA_SAMPLE_S16NE);
+    avx2_funcs[1] = pa_get_resampler_peaks_func(PA_SAMPLE_FLOAT32NE);
+
+    pa_log_debug("Checking AVX2 peaks resampler");
+    resampler_peaks_test(orig_funcs, avx2_funcs);
+}
+END_TEST
+#endif /* HAVE_AVX2 */
+#endif /* defined (__i386__) || defined (__amd64__) */
+
+#undef FRAMES
+#undef TIMES
+#undef TIMES2
+/* End peaks resampler tests */
+
 int main(int argc, char *argv[]) {
     int failed = 0;
     Suite *s;
@@ -870,6 +2206,18 @@ int main(int argc, char *argv[]) {
     tcase_add_test(tc, svolume_arm_test);
 #endif
     tcase_add_test(tc, svolume_orc_test);
+#ifdef HAVE_ORC
+    tcase_add_test(tc, svolume_orc_32_test);
+#endif
+#if defined (__i386__) || defined (__amd64__)
+#ifdef HAVE_SSE2
+    tcase_add_test(tc, svolume_sse2_32_test);
+    tcase_add_test(tc, svolume_ramp_sse2_test);
+#endif
+#ifdef HAVE_AVX2
+    tcase_add_test(tc, svolume_avx2_32_test);
+#endif
+#endif
     tcase_set_timeout(tc, 120);
     suite_add_tcase(s, tc);
 
@@ -878,29 +2226,90 @@ int main(int argc, char *argv[]) {
 #if defined (__i386__) || defined (__amd64__)
     tcase_add_test(tc, sconv_sse2_test);
     tcase_add_test(tc, sconv_sse_test);
+#ifdef HAVE_SSE4_1
+    tcase_add_test(tc, sconv_sse4_24_32_test);
+#endif
+#ifdef HAVE_AVX2
+    tcase_add_test(tc, sconv_avx2_24_32_test);
+#endif
 #endif
 #if defined (__arm__) && defined (__linux__)
 #if HAVE_NEON
     tcase_add_test(tc, sconv_neon_test);
 #endif
+#endif
+#ifdef HAVE_ORC
+    tcase_add_test(tc, sconv_orc_test);
 #endif
     tcase_set_timeout(tc, 120);
     suite_add_tcase(s, tc);
 
     /* Remap tests */
     tc = tcase_create("remap");
+    tcase_add_test(tc, remap_matrix_test);
 #if defined (__i386__) || defined (__amd64__)
     tcase_add_test(tc, remap_mmx_test);
     tcase_add_test(tc, remap_sse2_test);
+#ifdef HAVE_SSE2
+    tcase_add_test(tc, remap_sse2_matrix_test);
+#endif
+#endif
+#ifdef HAVE_ORC
+    tcase_add_test(tc, remap_orc_test);
 #endif
     tcase_set_timeout(tc, 120);
     suite_add_tcase(s, tc);
     /* Mix tests */
     tc = tcase_create("mix");
+#if defined (__i386__) || defined (__amd64__)
+#ifdef HAVE_SSE2
+    tcase_add_test(tc, mix_sse2_test);
+#endif
+#ifdef HAVE_AVX2
+    tcase_add_test(tc, mix_avx2_test);
+#endif
+#endif
 #if defined (__arm__) && defined (__linux__)
 #if HAVE_NEON
     tcase_add_test(tc, mix_neon_test);
 #endif
+#endif
+#ifdef HAVE_ORC
+    tcase_add_test(tc, mix_orc_test);
+#endif
+    tcase_set_timeout(tc, 120);
+    suite_add_tcase(s, tc);
+
+    /* Interleave tests */
+    tc = tcase_create("interleave");
+#if defined (__i386__) || defined (__amd64__)
+#ifdef HAVE_SSE2
+    tcase_add_test(tc, interleave_sse2_test);
+#endif
+#endif
+    tcase_set_timeout(tc, 120);
+    suite_add_tcase(s, tc);
+
+    /* ffmpeg resampler tests */
+    tc = tcase_create("ffmpeg");
+#if defined (__i386__) || defined (__amd64__)
+#ifdef HAVE_SSE2
+    tcase_add_test(tc, ffmpeg_sse2_test);
+#endif
+#endif
+    tcase_set_timeout(tc, 120);
+    suite_add_tcase(s, tc);
+
+    /* Linear and peaks resampler tests */
+    tc = tcase_create("resampler");
+#if defined (__i386__) || defined (__amd64__)
+#ifdef HAVE_SSE2
+    tcase_add_test(tc, resampler_linear_sse2_test);
+    tcase_add_test(tc, resampler_peaks_sse2_test);
+#endif
+#ifdef HAVE_AVX2
+    tcase_add_test(tc, resampler_peaks_avx2_test);
+#endif
 #endif
     tcase_set_timeout(tc, 120);
     suite_add_tcase(s, tc);
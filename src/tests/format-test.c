@@ -27,6 +27,7 @@
 
 #include <pulsecore/macro.h>
 #include <pulsecore/core-util.h>
+#include <pulsecore/format-match.h>
 #include <pulse/format.h>
 #include <pulse/xmalloc.h>
 
@@ -151,6 +152,67 @@ START_TEST (format_test) {
 }
 END_TEST
 
+/* The parsed formats need to give the same results as the JSON ones */
+START_TEST (match_test) {
+    pa_format_info *f[16];
+    pa_format_match *m[16];
+    int rates[] = { 32000, 44100, 48000 }, odd_rates[] = { 44100, 44101 }, channels[] = { 2, 6, 8 };
+    const char *strings[] = { "thing1", "thing2" };
+    unsigned i, j, n = 0;
+
+    INIT(f[n]); f[n]->encoding = PA_ENCODING_AC3_IEC61937; n++;
+    INIT(f[n]); f[n]->encoding = PA_ENCODING_PCM; n++;
+
+    for (i = 0; i < 2; i++) {
+        INIT(f[n]); f[n]->encoding = PA_ENCODING_AC3_IEC61937;
+        pa_format_info_set_rate(f[n], i ? 44100 : 96000); n++;
+    }
+
+    INIT(f[n]); f[n]->encoding = PA_ENCODING_AC3_IEC61937;
+    pa_format_info_set_prop_int_array(f[n], PA_PROP_FORMAT_RATE, rates, PA_ELEMENTSOF(rates)); n++;
+
+    INIT(f[n]); f[n]->encoding = PA_ENCODING_AC3_IEC61937;
+    pa_format_info_set_prop_int_array(f[n], PA_PROP_FORMAT_RATE, odd_rates, PA_ELEMENTSOF(odd_rates)); n++;
+
+    INIT(f[n]); f[n]->encoding = PA_ENCODING_AC3_IEC61937;
+    pa_format_info_set_prop_int_range(f[n], PA_PROP_FORMAT_RATE, 8000, 48000); n++;
+
+    INIT(f[n]); f[n]->encoding = PA_ENCODING_AC3_IEC61937;
+    pa_format_info_set_rate(f[n], 44101);
+    pa_format_info_set_channels(f[n], 6); n++;
+
+    INIT(f[n]); f[n]->encoding = PA_ENCODING_AC3_IEC61937;
+    pa_format_info_set_prop_int_array(f[n], PA_PROP_FORMAT_CHANNELS, channels, PA_ELEMENTSOF(channels));
+    pa_format_info_set_prop_int_range(f[n], PA_PROP_FORMAT_RATE, 32000, 48000); n++;
+
+    INIT(f[n]); f[n]->encoding = PA_ENCODING_AC3_IEC61937;
+    pa_format_info_set_prop_string_array(f[n], "format.test_string", strings, PA_ELEMENTSOF(strings)); n++;
+
+    INIT(f[n]); f[n]->encoding = PA_ENCODING_AC3_IEC61937;
+    pa_format_info_set_prop_string(f[n], "format.test_string", "thing2"); n++;
+
+    INIT(f[n]); f[n]->encoding = PA_ENCODING_AC3_IEC61937;
+    pa_format_info_set_prop_string(f[n], "format.test_string", "44100");
+    pa_format_info_set_rate(f[n], 44100); n++;
+
+    /* Not parsed, left to pa_format_info_is_compatible() */
+    INIT(f[n]); f[n]->encoding = PA_ENCODING_AC3_IEC61937;
+    pa_proplist_sets(f[n]->plist, PA_PROP_FORMAT_RATE, "44100.0"); n++;
+
+    for (i = 0; i < n; i++)
+        m[i] = pa_format_match_new(f[i]);
+
+    for (i = 0; i < n; i++)
+        for (j = 0; j < n; j++)
+            fail_unless(!pa_format_match_is_compatible(m[i], m[j]) == !pa_format_info_is_compatible(f[i], f[j]));
+
+    for (i = 0; i < n; i++) {
+        pa_format_match_free(m[i]);
+        DEINIT(f[i]);
+    }
+}
+END_TEST
+
 int main(int argc, char *argv[]) {
     int failed = 0;
     Suite *s;
@@ -160,6 +222,7 @@ int main(int argc, char *argv[]) {
     s = suite_create("Format");
     tc = tcase_create("format");
     tcase_add_test(tc, format_test);
+    tcase_add_test(tc, match_test);
     suite_add_tcase(s, tc);
 
     sr = srunner_create(s);
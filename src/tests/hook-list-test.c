@@ -41,6 +41,63 @@ START_TEST (hooklist_test) {
 }
 END_TEST
 
+static pa_hook_slot *victim, *added;
+static unsigned calls;
+
+static pa_hook_result_t count_cb(pa_hook *hook, void *call_data, void *slot_data) {
+    calls++;
+    return PA_HOOK_OK;
+}
+
+/* Frees another slot, connects a new one and fires the hook again */
+static pa_hook_result_t modify_cb(pa_hook *hook, void *call_data, void *slot_data) {
+    calls++;
+
+    if (victim) {
+        pa_hook_slot_free(victim);
+        victim = NULL;
+    }
+
+    if (!added) {
+        added = pa_hook_connect(hook, PA_HOOK_LATE, (pa_hook_cb_t) count_cb, NULL);
+        pa_hook_fire(hook, NULL);
+    }
+
+    return PA_HOOK_OK;
+}
+
+START_TEST (hooklist_modify_test) {
+    pa_hook hook;
+
+    pa_hook_init(&hook, &hook);
+
+    /* Empty hooks do nothing */
+    fail_unless(pa_hook_fire(&hook, NULL) == PA_HOOK_OK);
+
+    pa_hook_connect(&hook, PA_HOOK_EARLY, (pa_hook_cb_t) modify_cb, NULL);
+    victim = pa_hook_connect(&hook, PA_HOOK_NORMAL, (pa_hook_cb_t) count_cb, NULL);
+
+    /* The outer firing calls modify_cb only, since victim is freed
+     * and added was connected while firing. The nested one calls
+     * modify_cb and added. */
+    calls = 0;
+    pa_hook_fire(&hook, NULL);
+    fail_unless(calls == 3);
+
+    calls = 0;
+    pa_hook_fire(&hook, NULL);
+    fail_unless(calls == 2);
+
+    pa_hook_slot_free(added);
+
+    calls = 0;
+    pa_hook_fire(&hook, NULL);
+    fail_unless(calls == 1);
+
+    pa_hook_done(&hook);
+}
+END_TEST
+
 int main(int argc, char *argv[]) {
     int failed = 0;
     Suite *s;
@@ -50,6 +107,7 @@ int main(int argc, char *argv[]) {
     s = suite_create("Hook List");
     tc = tcase_create("hooklist");
     tcase_add_test(tc, hooklist_test);
+    tcase_add_test(tc, hooklist_modify_test);
     suite_add_tcase(s, tc);
 
     sr = srunner_create(s);
@@ -0,0 +1,144 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <check.h>
+
+#include <pulse/mainloop.h>
+#include <pulse/timeval.h>
+
+#include <pulsecore/atomic.h>
+#include <pulsecore/core.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/io-executor.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/thread.h>
+
+#define INTERVAL_USEC (5*PA_USEC_PER_MSEC)
+
+struct item_data {
+    pa_atomic_t calls;
+    pa_atomic_ptr_t thread;
+    pa_atomic_ptr_t mq;
+};
+
+static pa_usec_t item_cb(pa_io_executor_item *i, pa_usec_t now, void *userdata) {
+    struct item_data *d = userdata;
+
+    pa_atomic_inc(&d->calls);
+    pa_atomic_ptr_store(&d->thread, pa_thread_self());
+    pa_atomic_ptr_store(&d->mq, pa_thread_mq_get());
+
+    return now + INTERVAL_USEC;
+}
+
+START_TEST (io_executor_test) {
+    pa_mainloop *m;
+    pa_core *c;
+    pa_io_executor *e;
+    pa_io_executor_item **items;
+    struct item_data *data;
+    pa_module module;
+    unsigned n, j;
+    int calls;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    pa_assert_se(m = pa_mainloop_new());
+    pa_assert_se(c = pa_core_new(pa_mainloop_get_api(m), FALSE, 0, PA_SHM_HUGE_PAGES_NO, FALSE));
+
+    e = pa_io_executor_get(c);
+    fail_unless(pa_io_executor_get(c) == e);
+    pa_io_executor_unref(e);
+
+    /* One more than there are threads, so that two have to share */
+    n = pa_ncpus() + 1;
+    items = pa_xnew0(pa_io_executor_item*, n);
+    data = pa_xnew0(struct item_data, n);
+    pa_zero(module);
+
+    for (j = 0; j < n; j++) {
+        fail_unless((items[j] = pa_io_executor_item_new(e, &module, item_cb, &data[j])) != NULL);
+        fail_unless(pa_io_executor_item_get_rtpoll(items[j]) != NULL);
+    }
+
+    /* The first ones are spread over their own threads */
+    fail_unless(pa_io_executor_item_get_thread_mq(items[0]) != pa_io_executor_item_get_thread_mq(items[n - 1]) || n == 2);
+
+    usleep(100000);
+
+    for (j = 0; j < n; j++) {
+        /* Every item is called on every wakeup of its thread */
+        fail_unless(pa_atomic_load(&data[j].calls) >= 5);
+        fail_unless(pa_atomic_ptr_load(&data[j].mq) == pa_io_executor_item_get_thread_mq(items[j]));
+    }
+
+    /* The last one shares a thread with one of the others */
+    for (j = 0; j < n - 1; j++)
+        if (pa_io_executor_item_get_thread_mq(items[j]) == pa_io_executor_item_get_thread_mq(items[n - 1]))
+            break;
+
+    fail_unless(j < n - 1);
+    fail_unless(pa_atomic_ptr_load(&data[j].thread) == pa_atomic_ptr_load(&data[n - 1].thread));
+
+    /* Nothing is called after it is freed */
+    pa_io_executor_item_free(items[0]);
+    calls = pa_atomic_load(&data[0].calls);
+    usleep(50000);
+    fail_unless(pa_atomic_load(&data[0].calls) == calls);
+
+    for (j = 1; j < n; j++)
+        pa_io_executor_item_free(items[j]);
+
+    pa_io_executor_unref(e);
+
+    pa_core_unref(c);
+    pa_mainloop_free(m);
+
+    pa_xfree(items);
+    pa_xfree(data);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    s = suite_create("IO Executor");
+    tc = tcase_create("ioexecutor");
+    tcase_add_test(tc, io_executor_test);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,134 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+
+#include <check.h>
+
+#include <pulsecore/memarena.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+/* Blocks handed out by the arena vs. taken from the pool */
+static int n_arena(pa_mempool *p) {
+    return pa_atomic_load(&pa_mempool_get_stat(p)->n_allocated_by_type[PA_MEMBLOCK_USER]);
+}
+
+static int n_pool(pa_mempool *p) {
+    return pa_atomic_load(&pa_mempool_get_stat(p)->n_allocated) - n_arena(p);
+}
+
+START_TEST (memarena_test) {
+    pa_mempool *pool;
+    pa_memarena *a;
+    pa_memblock *b[4], *held;
+    pa_memchunk c;
+    void *first;
+    unsigned i;
+
+    pool = pa_mempool_new(FALSE, 0);
+    fail_unless(pool != NULL);
+
+    a = pa_memarena_new(pool, 4096);
+
+    /* Not installed yet, hence taken from the pool */
+    b[0] = pa_memblock_new_scratch(pool, 1000);
+    fail_unless(n_pool(pool) == 1);
+    pa_memblock_unref(b[0]);
+
+    pa_memarena_set_thread(a);
+
+    for (i = 0; i < 4; i++) {
+        b[i] = pa_memblock_new_scratch(pool, 1000);
+        fail_unless(((uintptr_t) pa_memblock_acquire(b[i]) & 31) == 0);
+        pa_memblock_release(b[i]);
+    }
+
+    /* The arena is full by now */
+    fail_unless(n_arena(pool) == 3);
+    fail_unless(n_pool(pool) == 1);
+
+    first = pa_memblock_acquire(b[0]);
+    pa_memblock_release(b[0]);
+
+    /* Nothing may be reused while a block is still around */
+    held = b[1];
+    pa_memblock_unref(b[0]);
+    pa_memblock_unref(b[2]);
+    pa_memblock_unref(b[3]);
+    pa_memarena_reset(a);
+
+    b[0] = pa_memblock_new_scratch(pool, 1000);
+    fail_unless(n_pool(pool) == 1);
+    pa_memblock_unref(b[0]);
+
+    pa_memblock_unref(held);
+    pa_memarena_reset(a);
+
+    b[0] = pa_memblock_new_scratch(pool, 1000);
+    fail_unless(pa_memblock_acquire(b[0]) == first);
+    pa_memblock_release(b[0]);
+
+    /* Blocks referenced by the arena only are written to in place */
+    c.memblock = b[0];
+    c.index = 0;
+    c.length = 1000;
+    pa_memchunk_make_writable_scratch(&c, 0);
+    fail_unless(c.memblock == b[0]);
+
+    /* Others are copied into the arena */
+    pa_memblock_ref(c.memblock);
+    pa_memchunk_make_writable_scratch(&c, 0);
+    fail_unless(c.memblock != b[0]);
+    fail_unless(n_arena(pool) == 2);
+    pa_memblock_unref(c.memblock);
+
+    /* Blocks may outlive the arena */
+    pa_memarena_free(a);
+    pa_memblock_unref(b[0]);
+
+    pa_mempool_free(pool);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    s = suite_create("Memory Arena");
+    tc = tcase_create("memarena");
+    tcase_add_test(tc, memarena_test);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -30,6 +30,7 @@
 
 #include <pulsecore/log.h>
 #include <pulsecore/memblock.h>
+#include <pulsecore/thread.h>
 #include <pulsecore/macro.h>
 
 static void release_cb(pa_memimport *i, uint32_t block_id, void *userdata) {
@@ -40,6 +41,15 @@ static void revoke_cb(pa_memexport *e, uint32_t block_id, void *userdata) {
     pa_log("%s: Exported block %u is revoked.", (char*) userdata, block_id);
 }
 
+/* memfd segments cannot be looked up by their id, hand them over like
+ * the pstream does */
+static void attach_memfd(pa_memimport *i, pa_memblock *b, uint32_t shm_id) {
+    int fd;
+
+    if ((fd = pa_memblock_get_memfd(b)) >= 0)
+        fail_unless(pa_memimport_attach_memfd(i, shm_id, dup(fd)) >= 0);
+}
+
 static void print_stats(pa_mempool *p, const char *text) {
     const pa_mempool_stat*s = pa_mempool_get_stat(p);
 
@@ -54,6 +64,8 @@ static void print_stats(pa_mempool *p, const char *text) {
                  "\texported_size = %u\n"
                  "\tn_too_large_for_pool = %u\n"
                  "\tn_pool_full = %u\n"
+                 "\tn_slot_cache_hits = %u\n"
+                 "\tn_slot_cache_misses = %u\n"
                  "}",
            text,
            (unsigned) pa_atomic_load(&s->n_allocated),
@@ -65,7 +77,9 @@ static void print_stats(pa_mempool *p, const char *text) {
            (unsigned) pa_atomic_load(&s->imported_size),
            (unsigned) pa_atomic_load(&s->exported_size),
            (unsigned) pa_atomic_load(&s->n_too_large_for_pool),
-           (unsigned) pa_atomic_load(&s->n_pool_full));
+           (unsigned) pa_atomic_load(&s->n_pool_full),
+           (unsigned) pa_atomic_load(&s->n_slot_cache_hits),
+           (unsigned) pa_atomic_load(&s->n_slot_cache_misses));
 }
 
 START_TEST (memblock_test) {
@@ -130,15 +144,18 @@ START_TEST (memblock_test) {
 
         pa_log("A: Memory block exported as %u", id);
 
+        attach_memfd(import_b, mb_a, shm_id);
         mb_b = pa_memimport_get(import_b, id, shm_id, offset, size);
         fail_unless(mb_b != NULL);
         r = pa_memexport_put(export_b, mb_b, &id, &shm_id, &offset, &size);
         fail_unless(r >= 0);
         fail_unless(shm_id == id_a || shm_id == id_b);
-        pa_memblock_unref(mb_b);
 
         pa_log("B: Memory block exported as %u", id);
 
+        attach_memfd(import_c, mb_b, shm_id);
+        pa_memblock_unref(mb_b);
+
         mb_c = pa_memimport_get(import_c, id, shm_id, offset, size);
         fail_unless(mb_c != NULL);
         x = pa_memblock_acquire(mb_c);
@@ -177,6 +194,275 @@ START_TEST (memblock_test) {
 }
 END_TEST
 
+START_TEST (memblock_class_test) {
+    pa_mempool *pool;
+    const pa_mempool_stat *stat;
+    pa_memblock *small, *medium, *large, *huge;
+    int misses;
+
+    pool = pa_mempool_new(FALSE, 0);
+    fail_unless(pool != NULL);
+
+    stat = pa_mempool_get_stat(pool);
+
+    /* Small and default sized blocks carry their header in the slot, a block
+     * larger than the default slot size goes to the largest class */
+    small = pa_memblock_new_pool(pool, 64);
+    medium = pa_memblock_new_pool(pool, (size_t) -1);
+    large = pa_memblock_new_pool(pool, 200*1024);
+    huge = pa_memblock_new_pool(pool, 1024*1024);
+
+    fail_unless(small != NULL);
+    fail_unless(medium != NULL);
+    fail_unless(large != NULL);
+    fail_unless(huge == NULL);
+
+    fail_unless(pa_memblock_get_length(medium) == pa_mempool_block_size_max(pool));
+    fail_unless(pa_atomic_load(&stat->n_allocated_by_type[PA_MEMBLOCK_POOL]) == 3);
+    fail_unless(pa_atomic_load(&stat->n_too_large_for_pool) == 1);
+
+    pa_memblock_unref(small);
+    pa_memblock_unref(medium);
+    pa_memblock_unref(large);
+
+    /* A freed slot is kept in the cache of this thread and reused */
+    misses = pa_atomic_load(&stat->n_slot_cache_misses);
+    small = pa_memblock_new_pool(pool, 64);
+    fail_unless(small != NULL);
+    fail_unless(pa_atomic_load(&stat->n_slot_cache_misses) == misses);
+    pa_memblock_unref(small);
+
+    pa_mempool_vacuum(pool);
+
+    fail_unless(pa_atomic_load(&stat->n_allocated) == 0);
+
+    pa_mempool_free(pool);
+}
+END_TEST
+
+START_TEST (memblock_pool_lifetime_test) {
+    pa_mempool *pool_a, *pool_b;
+    pa_memexport *export;
+    pa_memblock *b;
+    uint32_t id, shm_id, shm_id_a;
+    size_t offset, size;
+
+    pool_a = pa_mempool_new(TRUE, 0);
+    fail_unless(pool_a != NULL);
+    pool_b = pa_mempool_new(TRUE, 0);
+    fail_unless(pool_b != NULL);
+
+    export = pa_memexport_new(pool_b, revoke_cb, (void*) "B");
+    fail_unless(export != NULL);
+
+    /* A block of another shared pool is exported from its own segment */
+    b = pa_memblock_new_pool(pool_a, 100);
+    fail_unless(b != NULL);
+    fail_unless(pa_memexport_put(export, b, &id, &shm_id, &offset, &size) >= 0);
+    fail_unless(pa_mempool_get_shm_id(pool_a, &shm_id_a) >= 0);
+    fail_unless(shm_id == shm_id_a);
+    fail_unless(pa_memexport_process_release(export, id) >= 0);
+
+    /* The block keeps its pool alive after the owner let go */
+    pa_mempool_free(pool_a);
+    memset(pa_memblock_acquire(b), 0x42, 100);
+    pa_memblock_release(b);
+    pa_memblock_unref(b);
+
+    pa_memexport_free(export);
+    pa_mempool_free(pool_b);
+}
+END_TEST
+
+START_TEST (memblock_import_reuse_test) {
+    pa_mempool *pool_a, *pool_b;
+    pa_memexport *export;
+    pa_memimport *import;
+    pa_memblock *a, *b;
+    uint32_t id, shm_id;
+    size_t offset, size;
+    unsigned k;
+
+    pool_a = pa_mempool_new(TRUE, 0);
+    fail_unless(pool_a != NULL);
+    pool_b = pa_mempool_new(TRUE, 0);
+    fail_unless(pool_b != NULL);
+
+    export = pa_memexport_new(pool_a, revoke_cb, (void*) "A");
+    fail_unless(export != NULL);
+    import = pa_memimport_new(pool_b, release_cb, (void*) "B");
+    fail_unless(import != NULL);
+
+    /* The segment stays mapped while no block refers to it, and new
+     * blocks from it still show what the exporter wrote */
+    for (k = 0; k < 4; k++) {
+        a = pa_memblock_new(pool_a, 100);
+        memset(pa_memblock_acquire(a), 'a' + k, 100);
+        pa_memblock_release(a);
+
+        fail_unless(pa_memexport_put(export, a, &id, &shm_id, &offset, &size) >= 0);
+        if (k == 0)
+            attach_memfd(import, a, shm_id);
+
+        b = pa_memimport_get(import, id, shm_id, offset, size);
+        fail_unless(b != NULL);
+        fail_unless(((char*) pa_memblock_acquire(b))[99] == 'a' + (char) k);
+        pa_memblock_release(b);
+        pa_memblock_unref(b);
+
+        fail_unless(pa_memexport_process_release(export, id) >= 0);
+        pa_memblock_unref(a);
+    }
+
+    pa_memimport_free(import);
+    pa_memexport_free(export);
+    pa_mempool_free(pool_b);
+    pa_mempool_free(pool_a);
+}
+END_TEST
+
+static void *owner_thread_func_result;
+
+static void owner_thread_func(void *userdata) {
+    pa_mempool *pool = userdata;
+
+    /* Started while the owner was current, so it is ours too */
+    owner_thread_func_result = pa_memblock_new_pool(pool, 100);
+}
+
+START_TEST (memblock_owner_test) {
+    pa_mempool *pool;
+    pa_memowner *pool_owner, *owner, *previous;
+    pa_memexport *export;
+    pa_memblock *a, *b, *c;
+    pa_thread *thread;
+    uint32_t id, shm_id;
+    size_t offset, size;
+
+    pool = pa_mempool_new(TRUE, 0);
+    fail_unless(pool != NULL);
+
+    pool_owner = pa_memowner_new();
+    owner = pa_memowner_new();
+    pa_mempool_set_owner(pool, pool_owner);
+
+    /* Without a current owner blocks are charged to the pool's */
+    a = pa_memblock_new(pool, 100);
+    fail_unless(pa_atomic_load(&pa_memowner_get_stat(pool_owner)->n_allocated) == 1);
+    fail_unless(pa_atomic_load(&pa_memowner_get_stat(pool_owner)->allocated_size) == 100);
+
+    previous = pa_memowner_set_current(owner);
+    fail_unless(previous == NULL);
+
+    b = pa_memblock_new(pool, 200);
+    thread = pa_thread_new("owner", owner_thread_func, pool);
+    fail_unless(thread != NULL);
+    pa_thread_free(thread);
+    c = owner_thread_func_result;
+    fail_unless(c != NULL);
+
+    fail_unless(pa_memowner_set_current(previous) == owner);
+
+    fail_unless(pa_atomic_load(&pa_memowner_get_stat(owner)->n_allocated) == 2);
+    fail_unless(pa_atomic_load(&pa_memowner_get_stat(owner)->allocated_size) == 300);
+    fail_unless(pa_atomic_load(&pa_memowner_get_stat(pool_owner)->n_allocated) == 1);
+
+    /* Exports are charged to the pool's owner */
+    export = pa_memexport_new(pool, revoke_cb, (void*) "A");
+    fail_unless(export != NULL);
+    fail_unless(pa_memexport_put(export, b, &id, &shm_id, &offset, &size) >= 0);
+    fail_unless(pa_atomic_load(&pa_memowner_get_stat(pool_owner)->n_exported) == 1);
+    fail_unless(pa_atomic_load(&pa_memowner_get_stat(pool_owner)->exported_size) == 200);
+    fail_unless(pa_memexport_process_release(export, id) >= 0);
+    fail_unless(pa_atomic_load(&pa_memowner_get_stat(pool_owner)->n_exported) == 0);
+    pa_memexport_free(export);
+
+    pa_memblock_unref(a);
+    pa_memblock_unref(b);
+    pa_memblock_unref(c);
+
+    fail_unless(pa_atomic_load(&pa_memowner_get_stat(owner)->n_allocated) == 0);
+    fail_unless(pa_atomic_load(&pa_memowner_get_stat(owner)->allocated_size) == 0);
+    fail_unless(pa_atomic_load(&pa_memowner_get_stat(pool_owner)->n_allocated) == 0);
+
+    pa_memowner_unref(owner);
+    pa_memowner_unref(pool_owner);
+    pa_mempool_free(pool);
+}
+END_TEST
+
+/* More 256K slots than any thread may keep for itself */
+#define CACHE_TEST_BLOCKS 64
+
+struct cache_test_data {
+    pa_mempool *pool;
+    unsigned n;
+};
+
+static void cache_thread_func(void *userdata) {
+    struct cache_test_data *d = userdata;
+    pa_memblock *blocks[CACHE_TEST_BLOCKS];
+    unsigned i;
+
+    while (d->n < CACHE_TEST_BLOCKS && (blocks[d->n] = pa_memblock_new_pool(d->pool, 200*1024)))
+        d->n++;
+
+    for (i = 0; i < d->n; i++)
+        pa_memblock_unref(blocks[i]);
+}
+
+START_TEST (memblock_cache_share_test) {
+    struct cache_test_data d;
+    pa_memblock *blocks[CACHE_TEST_BLOCKS];
+    pa_thread *thread;
+    unsigned n = 0, i;
+
+    /* The largest class gets about 48 slots in the default pool */
+    d.pool = pa_mempool_new(FALSE, 0);
+    fail_unless(d.pool != NULL);
+
+    while (n < CACHE_TEST_BLOCKS && (blocks[n] = pa_memblock_new_pool(d.pool, 200*1024)))
+        n++;
+
+    fail_unless(n > 0 && n < CACHE_TEST_BLOCKS);
+
+    for (i = 0; i < n; i++)
+        pa_memblock_unref(blocks[i]);
+
+    /* The slots this thread kept are lost to the other one, but only a
+     * small share of them */
+    d.n = 0;
+    thread = pa_thread_new("cache", cache_thread_func, &d);
+    fail_unless(thread != NULL);
+    pa_thread_free(thread);
+
+    fail_unless(d.n >= n - n / 8);
+
+    /* A small pool has no slots to spare for the caches */
+    pa_mempool_free(d.pool);
+    d.pool = pa_mempool_new(FALSE, 16*256*1024);
+    fail_unless(d.pool != NULL);
+
+    n = 0;
+    while (n < CACHE_TEST_BLOCKS && (blocks[n] = pa_memblock_new_pool(d.pool, 200*1024)))
+        n++;
+
+    fail_unless(n > 0 && n < CACHE_TEST_BLOCKS);
+
+    for (i = 0; i < n; i++)
+        pa_memblock_unref(blocks[i]);
+
+    d.n = 0;
+    thread = pa_thread_new("cache", cache_thread_func, &d);
+    fail_unless(thread != NULL);
+    pa_thread_free(thread);
+
+    fail_unless(d.n == n);
+
+    pa_mempool_free(d.pool);
+}
+END_TEST
+
 int main(int argc, char *argv[]) {
     int failed = 0;
     Suite *s;
@@ -189,6 +475,11 @@ int main(int argc, char *argv[]) {
     s = suite_create("Memblock");
     tc = tcase_create("memblock");
     tcase_add_test(tc, memblock_test);
+    tcase_add_test(tc, memblock_class_test);
+    tcase_add_test(tc, memblock_pool_lifetime_test);
+    tcase_add_test(tc, memblock_import_reuse_test);
+    tcase_add_test(tc, memblock_owner_test);
+    tcase_add_test(tc, memblock_cache_share_test);
     suite_add_tcase(s, tc);
 
     sr = srunner_create(s);
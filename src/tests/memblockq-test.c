@@ -95,7 +95,7 @@ static void dump(pa_memblockq *bq, int n) {
     fprintf(stderr, "<\n");
 }
 
-START_TEST (memblockq_test) {
+static void run_test(pa_bool_t ring) {
     int ret;
 
     pa_mempool *p;
@@ -121,6 +121,8 @@ START_TEST (memblockq_test) {
     bq = pa_memblockq_new("test memblockq", 0, 200, 10, &ss, 4, 4, 40, &silence);
     fail_unless(bq != NULL);
 
+    pa_memblockq_set_ring(bq, ring);
+
     chunk1.memblock = pa_memblock_new_fixed(p, (char*) "11", 2, 1);
     fail_unless(chunk1.memblock != NULL);
 
@@ -212,6 +214,265 @@ START_TEST (memblockq_test) {
 
     pa_mempool_free(p);
 }
+
+START_TEST (memblockq_test) {
+    run_test(FALSE);
+}
+END_TEST
+
+/* The same pushes and seeks yield the same data in ring buffer mode */
+START_TEST (memblockq_ring_test) {
+    run_test(TRUE);
+}
+END_TEST
+
+/* Stream a counting pattern through a ring mode queue, long enough for
+ * the ring to wrap around a couple of times */
+START_TEST (memblockq_ring_wrap_test) {
+    pa_mempool *p;
+    pa_memblockq *bq;
+    pa_memchunk chunk, silence;
+    pa_sample_spec ss = {
+        .format = PA_SAMPLE_S16LE,
+        .rate = 48000,
+        .channels = 1
+    };
+    size_t total = 4 * 1024 * 1024, pushed = 0, read = 0;
+    uint8_t *d;
+    unsigned i;
+
+    p = pa_mempool_new(FALSE, 0);
+
+    silence.memblock = pa_memblock_new_fixed(p, (char*) "__", 2, 1);
+    silence.index = 0;
+    silence.length = 2;
+
+    bq = pa_memblockq_new("test memblockq", 0, 64 * 1024, 0, &ss, 0, 2, 1000, &silence);
+    fail_unless(bq != NULL);
+
+    pa_memblockq_set_ring(bq, TRUE);
+
+    chunk.memblock = pa_memblock_new(p, 3000);
+    chunk.index = 0;
+    chunk.length = 3000;
+
+    while (read < total) {
+        pa_memchunk out;
+        size_t l;
+
+        /* Keep a few chunks in the queue */
+        while (pa_memblockq_get_length(bq) < 10000) {
+            d = pa_memblock_acquire(chunk.memblock);
+            for (i = 0; i < chunk.length; i++)
+                d[i] = (uint8_t) (pushed + i);
+            pa_memblock_release(chunk.memblock);
+
+            fail_unless(pa_memblockq_push(bq, &chunk) == 0);
+            pushed += chunk.length;
+        }
+
+        fail_unless(pa_memblockq_get_nblocks(bq) == 1);
+        fail_unless(pa_memblockq_peek(bq, &out) == 0);
+        fail_unless(out.memblock != silence.memblock);
+
+        l = PA_MIN(out.length, 2222U);
+
+        d = pa_memblock_acquire(out.memblock);
+        for (i = 0; i < l; i++)
+            fail_unless(d[out.index + i] == (uint8_t) (read + i));
+        pa_memblock_release(out.memblock);
+        pa_memblock_unref(out.memblock);
+
+        pa_memblockq_drop(bq, l);
+        read += l;
+
+        /* Go back and forth within the history */
+        if (read % 7 == 0) {
+            pa_memblockq_rewind(bq, 1000);
+            fail_unless(pa_memblockq_peek(bq, &out) == 0);
+            fail_unless(*((uint8_t*) pa_memblock_acquire(out.memblock) + out.index) == (uint8_t) (read - 1000));
+            pa_memblock_release(out.memblock);
+            pa_memblock_unref(out.memblock);
+            pa_memblockq_drop(bq, 1000);
+        }
+    }
+
+    /* Data in front of the stored history forces the list */
+    pa_memblockq_seek(bq, -2000, PA_SEEK_RELATIVE_ON_READ, TRUE);
+    fail_unless(pa_memblockq_push(bq, &chunk) == 0);
+    fail_unless(pa_memblockq_get_nblocks(bq) > 1);
+
+    pa_memblockq_free(bq);
+    pa_memblock_unref(chunk.memblock);
+    pa_memblock_unref(silence.memblock);
+
+    pa_mempool_free(p);
+}
+END_TEST
+
+/* Lowering maxrewind gives back the history, and the ring memory, right
+ * away */
+START_TEST (memblockq_maxrewind_test) {
+    pa_mempool *p;
+    pa_memblockq *bq;
+    pa_memchunk chunk, out;
+    pa_sample_spec ss = {
+        .format = PA_SAMPLE_S16LE,
+        .rate = 48000,
+        .channels = 1
+    };
+    size_t total = 1024 * 1024, pushed = 0, read;
+    int allocated;
+    uint8_t *d;
+    unsigned i;
+
+    p = pa_mempool_new(FALSE, 0);
+
+    bq = pa_memblockq_new("test memblockq", 0, 4 * 1024 * 1024, 0, &ss, 0, 2, total, NULL);
+    fail_unless(bq != NULL);
+
+    pa_memblockq_set_ring(bq, TRUE);
+
+    chunk.memblock = pa_memblock_new(p, 4000);
+    chunk.index = 0;
+    chunk.length = 4000;
+
+    while (pushed < total) {
+        d = pa_memblock_acquire(chunk.memblock);
+        for (i = 0; i < chunk.length; i++)
+            d[i] = (uint8_t) (pushed + i);
+        pa_memblock_release(chunk.memblock);
+
+        fail_unless(pa_memblockq_push(bq, &chunk) == 0);
+        pa_memblockq_drop(bq, chunk.length);
+        pushed += chunk.length;
+    }
+
+    fail_unless(pa_memblockq_get_nblocks(bq) == 1);
+    fail_unless(pa_memblockq_get_history(bq) == total);
+
+    allocated = pa_atomic_load(&pa_mempool_get_stat(p)->allocated_size);
+    fail_unless(allocated >= (int) total);
+
+    pa_memblockq_set_maxrewind(bq, 6000);
+    fail_unless(pa_memblockq_get_history(bq) == 6000);
+    fail_unless(pa_atomic_load(&pa_mempool_get_stat(p)->allocated_size) < allocated / 4);
+
+    /* What is left can still be rewound to */
+    pa_memblockq_rewind(bq, 6000);
+
+    for (read = pushed - 6000; read < pushed; read += out.length) {
+        fail_unless(pa_memblockq_peek(bq, &out) == 0);
+        fail_unless(out.length <= pushed - read);
+
+        d = pa_memblock_acquire(out.memblock);
+        for (i = 0; i < out.length; i++)
+            fail_unless(d[out.index + i] == (uint8_t) (read + i));
+        pa_memblock_release(out.memblock);
+        pa_memblock_unref(out.memblock);
+
+        pa_memblockq_drop(bq, out.length);
+    }
+
+    pa_memblockq_free(bq);
+    pa_memblock_unref(chunk.memblock);
+
+    pa_mempool_free(p);
+}
+END_TEST
+
+/* Small chunks end up in one block, unless that block is still being read */
+START_TEST (memblockq_coalesce_test) {
+    pa_mempool *p;
+    pa_memblockq *bq;
+    pa_memchunk chunk, out;
+    pa_sample_spec ss = {
+        .format = PA_SAMPLE_S16LE,
+        .rate = 48000,
+        .channels = 1
+    };
+    unsigned i;
+
+    p = pa_mempool_new(FALSE, 0);
+
+    bq = pa_memblockq_new("test memblockq", 0, 200, 0, &ss, 0, 2, 0, NULL);
+    fail_unless(bq != NULL);
+
+    pa_memblockq_set_coalesce(bq, 8);
+
+    chunk.memblock = pa_memblock_new_fixed(p, (char*) "1234", 4, 1);
+    chunk.index = 0;
+    chunk.length = 4;
+
+    for (i = 0; i < 10; i++)
+        fail_unless(pa_memblockq_push(bq, &chunk) == 0);
+
+    fail_unless(pa_memblockq_get_nblocks(bq) == 1);
+    fail_unless(pa_memblockq_get_length(bq) == 40);
+
+    fail_unless(pa_memblockq_peek(bq, &out) == 0);
+    fail_unless(out.length == 40);
+    fail_unless(memcmp((uint8_t*) pa_memblock_acquire(out.memblock) + out.index + 36, "1234", 4) == 0);
+    pa_memblock_release(out.memblock);
+
+    /* The reader still holds a reference, so we may not touch the block */
+    fail_unless(pa_memblockq_push(bq, &chunk) == 0);
+    fail_unless(pa_memblockq_get_nblocks(bq) == 2);
+    pa_memblock_unref(out.memblock);
+
+    /* Larger chunks are queued as they are */
+    pa_memblockq_set_coalesce(bq, 4);
+    fail_unless(pa_memblockq_push(bq, &chunk) == 0);
+    fail_unless(pa_memblockq_get_nblocks(bq) == 3);
+
+    pa_memblockq_free(bq);
+    pa_memblock_unref(chunk.memblock);
+
+    pa_mempool_free(p);
+}
+END_TEST
+
+/* Skipping moves past data that hasn't arrived yet, which is then
+ * dropped when it comes in */
+START_TEST (memblockq_skip_test) {
+    pa_mempool *p;
+    pa_memblockq *bq;
+    pa_memchunk chunk, out;
+    pa_sample_spec ss = {
+        .format = PA_SAMPLE_S16LE,
+        .rate = 48000,
+        .channels = 1
+    };
+
+    p = pa_mempool_new(FALSE, 0);
+
+    bq = pa_memblockq_new("test memblockq", 0, 200, 0, &ss, 4, 2, 0, NULL);
+    fail_unless(bq != NULL);
+
+    /* Prebuffering doesn't stop it */
+    fail_unless(pa_memblockq_peek(bq, &out) < 0);
+    pa_memblockq_skip(bq, 4);
+    fail_unless(pa_memblockq_get_read_index(bq) == 4);
+    fail_unless(pa_memblockq_get_length(bq) == 0);
+
+    chunk.memblock = pa_memblock_new_fixed(p, (char*) "12345678", 8, 1);
+    chunk.index = 0;
+    chunk.length = 8;
+
+    fail_unless(pa_memblockq_push(bq, &chunk) == 0);
+    fail_unless(pa_memblockq_get_length(bq) == 4);
+
+    fail_unless(pa_memblockq_peek(bq, &out) == 0);
+    fail_unless(out.length == 4);
+    fail_unless(memcmp((uint8_t*) pa_memblock_acquire(out.memblock) + out.index, "5678", 4) == 0);
+    pa_memblock_release(out.memblock);
+    pa_memblock_unref(out.memblock);
+
+    pa_memblockq_free(bq);
+    pa_memblock_unref(chunk.memblock);
+
+    pa_mempool_free(p);
+}
 END_TEST
 
 int main(int argc, char *argv[]) {
@@ -223,6 +484,11 @@ int main(int argc, char *argv[]) {
     s = suite_create("Memblock Queue");
     tc = tcase_create("memblockq");
     tcase_add_test(tc, memblockq_test);
+    tcase_add_test(tc, memblockq_ring_test);
+    tcase_add_test(tc, memblockq_ring_wrap_test);
+    tcase_add_test(tc, memblockq_maxrewind_test);
+    tcase_add_test(tc, memblockq_coalesce_test);
+    tcase_add_test(tc, memblockq_skip_test);
     suite_add_tcase(s, tc);
 
     sr = srunner_create(s);
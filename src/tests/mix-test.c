@@ -22,12 +22,14 @@
 #endif
 
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
 
 #include <check.h>
 
 #include <pulse/sample.h>
 #include <pulse/volume.h>
+#include <pulse/xmalloc.h>
 
 #include <pulsecore/macro.h>
 #include <pulsecore/endianmacros.h>
@@ -465,6 +467,51 @@ START_TEST (mix_test) {
 }
 END_TEST
 
+/* So many streams that the 8 bit formats are mixed frame by frame */
+#define MANY_STREAMS 600
+
+START_TEST (mix_many_test) {
+    pa_mempool *pool;
+    pa_sample_spec a;
+    pa_mix_info *m;
+    pa_memchunk c;
+    uint8_t *data, few[320], many[320];
+    unsigned k;
+
+    fail_unless((pool = pa_mempool_new(FALSE, 0)) != NULL, NULL);
+
+    a.format = PA_SAMPLE_ULAW;
+    a.channels = 32;
+    a.rate = 44100;
+
+    c.memblock = pa_memblock_new(pool, sizeof(few));
+    c.length = sizeof(few);
+    c.index = 0;
+
+    data = pa_memblock_acquire(c.memblock);
+    for (k = 0; k < c.length; k++)
+        data[k] = (uint8_t) (k * 37);
+    pa_memblock_release(c.memblock);
+
+    /* Only the first two streams are audible, so the result must be the
+     * same as when mixing just those */
+    m = pa_xnew0(pa_mix_info, MANY_STREAMS);
+    for (k = 0; k < MANY_STREAMS; k++) {
+        m[k].chunk = c;
+        pa_cvolume_set(&m[k].volume, a.channels, k < 2 ? PA_VOLUME_NORM : PA_VOLUME_MUTED);
+    }
+
+    pa_mix(m, 2, few, sizeof(few), &a, NULL, FALSE);
+    pa_mix(m, MANY_STREAMS, many, sizeof(many), &a, NULL, FALSE);
+
+    fail_unless(memcmp(few, many, sizeof(few)) == 0);
+
+    pa_xfree(m);
+    pa_memblock_unref(c.memblock);
+    pa_mempool_free(pool);
+}
+END_TEST
+
 int main(int argc, char *argv[]) {
     int failed = 0;
     Suite *s;
@@ -474,6 +521,7 @@ int main(int argc, char *argv[]) {
     s = suite_create("Mix");
     tc = tcase_create("mix");
     tcase_add_test(tc, mix_test);
+    tcase_add_test(tc, mix_many_test);
     suite_add_tcase(s, tc);
 
     sr = srunner_create(s);
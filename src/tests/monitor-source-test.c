@@ -0,0 +1,252 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+
+#include <check.h>
+
+#include <pulse/mainloop.h>
+#include <pulse/timeval.h>
+
+#include <pulsecore/core.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/rtpoll.h>
+#include <pulsecore/sink.h>
+#include <pulsecore/source.h>
+#include <pulsecore/source-output.h>
+#include <pulsecore/thread.h>
+#include <pulsecore/thread-mq.h>
+
+/* The first three are recorders that leave rewinds to the monitor, all
+ * at the same rate, the last one handles rewinds itself */
+#define N_OUTPUTS 4
+#define N_DELAYED 3
+
+#define SINK_LATENCY (10*PA_USEC_PER_MSEC)
+#define MAX_REWIND (100*PA_USEC_PER_MSEC)
+#define POST_USEC (20*PA_USEC_PER_MSEC)
+
+/* The resampler may round to either side */
+#define CLOSE_TO(a, b, d) ((a) + (d) >= (b) && (a) <= (b) + (d))
+
+enum {
+    TEST_SINK_MESSAGE_POST = PA_SINK_MESSAGE_MAX
+};
+
+static pa_thread_mq thread_mq;
+static pa_rtpoll *rtpoll;
+static pa_sample_spec ss;
+
+static pa_source_output *outputs[N_OUTPUTS];
+
+/* IO thread */
+static size_t received[N_OUTPUTS];
+static pa_memblock *last_block[N_OUTPUTS];
+static pa_bool_t shared = TRUE;
+
+/* Called from IO context */
+static int sink_process_msg(pa_msgobject *o, int code, void *data, int64_t offset, pa_memchunk *chunk) {
+    pa_sink *s = PA_SINK(o);
+
+    switch (code) {
+
+        case PA_SINK_MESSAGE_GET_LATENCY:
+            *((pa_usec_t*) data) = SINK_LATENCY;
+            return 0;
+
+        case TEST_SINK_MESSAGE_POST: {
+            pa_memchunk c;
+            unsigned k;
+
+            pa_source_set_max_rewind_within_thread(s->monitor_source, pa_usec_to_bytes(MAX_REWIND, &ss));
+
+            c.index = 0;
+            c.length = pa_usec_to_bytes(POST_USEC, &ss);
+            c.memblock = pa_memblock_new(s->core->mempool, c.length);
+            pa_silence_memchunk(&c, &ss);
+
+            for (k = 0; k < N_OUTPUTS; k++)
+                last_block[k] = NULL;
+
+            pa_source_post(s->monitor_source, &c);
+            pa_memblock_unref(c.memblock);
+
+            /* Everybody who was fed from the monitor's queue got the
+             * blocks the first of them resampled */
+            for (k = 1; k < N_DELAYED; k++)
+                if (last_block[k] != last_block[0])
+                    shared = FALSE;
+
+            return 0;
+        }
+    }
+
+    return pa_sink_process_msg(o, code, data, offset, chunk);
+}
+
+static void thread_func(void *userdata) {
+    pa_thread_mq_install(&thread_mq);
+
+    while (pa_rtpoll_run(rtpoll, TRUE) > 0)
+        ;
+}
+
+static void source_output_push_cb(pa_source_output *o, const pa_memchunk *chunk) {
+    unsigned k = PA_PTR_TO_UINT(o->userdata);
+
+    received[k] += chunk->length;
+    last_block[k] = chunk->memblock;
+}
+
+static void source_output_process_rewind_cb(pa_source_output *o, size_t nbytes) {
+}
+
+static void source_output_kill_cb(pa_source_output *o) {
+    pa_source_output_unlink(o);
+}
+
+START_TEST (monitor_source_test) {
+    pa_mainloop *m;
+    pa_core *c;
+    pa_sink_new_data data;
+    pa_sink *s;
+    pa_thread *thread;
+    pa_sample_spec output_ss;
+    size_t delayed_bytes;
+    unsigned k;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    pa_assert_se(m = pa_mainloop_new());
+    pa_assert_se(c = pa_core_new(pa_mainloop_get_api(m), FALSE, 0, PA_SHM_HUGE_PAGES_NO, FALSE));
+
+    rtpoll = pa_rtpoll_new();
+    pa_thread_mq_init(&thread_mq, c->mainloop, rtpoll);
+
+    ss.format = PA_SAMPLE_S16LE;
+    ss.rate = 44100;
+    ss.channels = 2;
+
+    pa_sink_new_data_init(&data);
+    data.driver = __FILE__;
+    pa_sink_new_data_set_name(&data, "test-sink");
+    pa_sink_new_data_set_sample_spec(&data, &ss);
+    pa_assert_se(s = pa_sink_new(c, &data, PA_SINK_LATENCY));
+    pa_sink_new_data_done(&data);
+
+    s->parent.process_msg = sink_process_msg;
+    pa_sink_set_asyncmsgq(s, thread_mq.inq);
+    pa_sink_set_rtpoll(s, rtpoll);
+
+    pa_assert_se(thread = pa_thread_new("test-sink", thread_func, NULL));
+    pa_sink_put(s);
+
+    fail_unless(s->monitor_source->thread_info.delay_memblockq != NULL);
+
+    output_ss = ss;
+    output_ss.rate = 22050;
+
+    for (k = 0; k < N_OUTPUTS; k++) {
+        pa_source_output_new_data output_data;
+
+        pa_source_output_new_data_init(&output_data);
+        output_data.driver = __FILE__;
+        output_data.resample_method = PA_RESAMPLER_TRIVIAL;
+        pa_source_output_new_data_set_source(&output_data, s->monitor_source, FALSE);
+        pa_source_output_new_data_set_sample_spec(&output_data, k < N_DELAYED ? &output_ss : &ss);
+        fail_unless(pa_source_output_new(&outputs[k], c, &output_data) == 0);
+        pa_source_output_new_data_done(&output_data);
+
+        outputs[k]->push = source_output_push_cb;
+        if (k >= N_DELAYED)
+            outputs[k]->process_rewind = source_output_process_rewind_cb;
+        outputs[k]->kill = source_output_kill_cb;
+        outputs[k]->userdata = PA_UINT_TO_PTR(k);
+
+        pa_source_output_put(outputs[k]);
+
+        fail_unless(pa_source_output_uses_source_delay(outputs[k]) == (k < N_DELAYED));
+    }
+
+    pa_asyncmsgq_send(thread_mq.inq, PA_MSGOBJECT(s), TEST_SINK_MESSAGE_POST, NULL, 0, NULL);
+
+    /* The sink may still change what it hasn't played yet, so only that
+     * much is held back, and only from those that can't rewind */
+    fail_unless(received[N_DELAYED] == pa_usec_to_bytes(POST_USEC, &ss));
+    delayed_bytes = pa_usec_to_bytes(POST_USEC - SINK_LATENCY, &output_ss);
+    for (k = 0; k < N_DELAYED; k++)
+        fail_unless(received[k] == received[0]);
+    fail_unless(CLOSE_TO(received[0], delayed_bytes, pa_frame_size(&output_ss)));
+
+    pa_asyncmsgq_send(thread_mq.inq, PA_MSGOBJECT(s), TEST_SINK_MESSAGE_POST, NULL, 0, NULL);
+
+    fail_unless(received[N_DELAYED] == 2 * pa_usec_to_bytes(POST_USEC, &ss));
+    delayed_bytes = pa_usec_to_bytes(2 * POST_USEC - SINK_LATENCY, &output_ss);
+    for (k = 0; k < N_DELAYED; k++)
+        fail_unless(received[k] == received[0]);
+    fail_unless(CLOSE_TO(received[0], delayed_bytes, pa_frame_size(&output_ss)));
+
+    fail_unless(shared);
+
+    /* What the monitor holds back counts for the recorders' latency */
+    fail_unless(pa_source_output_get_latency(outputs[0], NULL) >= SINK_LATENCY);
+
+    for (k = 0; k < N_OUTPUTS; k++) {
+        pa_source_output_unlink(outputs[k]);
+        pa_source_output_unref(outputs[k]);
+    }
+
+    pa_sink_unlink(s);
+
+    pa_asyncmsgq_send(thread_mq.inq, NULL, PA_MESSAGE_SHUTDOWN, NULL, 0, NULL);
+    pa_thread_free(thread);
+    pa_thread_mq_done(&thread_mq);
+
+    pa_sink_unref(s);
+    pa_rtpoll_free(rtpoll);
+
+    pa_core_unref(c);
+    pa_mainloop_free(m);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    s = suite_create("Monitor Source");
+    tc = tcase_create("monitorsource");
+    tcase_add_test(tc, monitor_source_test);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
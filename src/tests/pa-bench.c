@@ -0,0 +1,608 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+/* Microbenchmarks of the DSP kernels: pa_mix(), pa_volume_memchunk(),
+ * the sample format conversions, the channel remappers and every
+ * resample method, swept over formats, channel counts and block sizes.
+ * The results go to stdout as JSON, one object per case, so that runs
+ * on different machines or revisions can be compared by a script.
+ *
+ * The optimized implementations are enabled like in the daemon, so
+ * PULSE_NO_SIMD=1 measures the generic C versions. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#include <pulse/rtclock.h>
+#include <pulse/sample.h>
+#include <pulse/volume.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/cpu.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/cpu-orc.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/memblock.h>
+#include <pulsecore/mix.h>
+#include <pulsecore/remap.h>
+#include <pulsecore/resampler.h>
+#include <pulsecore/sconv.h>
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#define HAVE_CYCLE_COUNTER 1
+#endif
+
+/* Each round runs for at least this long, the fastest one counts */
+#define ROUND_USEC 2000
+#define ROUNDS 5
+
+#define MAX_STREAMS 4
+
+static const unsigned channel_counts[] = { 1, 2, 6, 8 };
+static const unsigned block_frames[] = { 64, 256, 1024, 4096 };
+static const unsigned quick_block_frames[] = { 1024 };
+
+static const unsigned *frames_list = block_frames;
+static unsigned n_frames_list = PA_ELEMENTSOF(block_frames);
+static const char *kernel_filter = NULL;
+static pa_bool_t first_result = TRUE;
+
+static pa_mempool *pool;
+
+static uint64_t read_cycles(void) {
+#ifdef HAVE_CYCLE_COUNTER
+    uint32_t lo, hi;
+
+    __asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((uint64_t) hi << 32) | lo;
+#else
+    return 0;
+#endif
+}
+
+typedef void (*bench_func_t)(void *userdata);
+
+/* Runs f until a round takes ROUND_USEC, then takes the fastest of
+ * ROUNDS rounds of that many calls. Returns the time and cycles of a
+ * single call. */
+static void measure(bench_func_t f, void *userdata, double *usec, double *cycles) {
+    unsigned n = 1, k, i;
+    pa_usec_t start, best_usec = (pa_usec_t) -1;
+    uint64_t c, best_cycles = (uint64_t) -1;
+
+    /* Warm up the caches and find out how many calls make a round */
+    for (;;) {
+        start = pa_rtclock_now();
+
+        for (i = 0; i < n; i++)
+            f(userdata);
+
+        if (pa_rtclock_now() - start >= ROUND_USEC)
+            break;
+
+        n *= 2;
+    }
+
+    for (k = 0; k < ROUNDS; k++) {
+        pa_usec_t t;
+
+        start = pa_rtclock_now();
+        c = read_cycles();
+
+        for (i = 0; i < n; i++)
+            f(userdata);
+
+        c = read_cycles() - c;
+        t = pa_rtclock_now() - start;
+
+        best_usec = PA_MIN(best_usec, t);
+        best_cycles = PA_MIN(best_cycles, c);
+    }
+
+    *usec = (double) best_usec / n;
+    *cycles = (double) best_cycles / n;
+}
+
+static pa_bool_t kernel_enabled(const char *kernel) {
+    return !kernel_filter || pa_streq(kernel, kernel_filter);
+}
+
+/* The samples processed per call are used for cycles/sample, the
+ * frames for ns/frame */
+static void print_result(const char *kernel, const char *variant, pa_sample_format_t format,
+                         unsigned in_channels, unsigned out_channels, unsigned frames,
+                         double usec, double cycles, unsigned samples) {
+
+    printf("%s\n    {\"kernel\": \"%s\", \"variant\": \"%s\", \"format\": \"%s\", "
+           "\"in_channels\": %u, \"out_channels\": %u, \"frames\": %u, "
+           "\"ns_per_frame\": %.3f, ",
+           first_result ? "" : ",",
+           kernel, variant ? variant : "", pa_sample_format_to_string(format),
+           in_channels, out_channels, frames,
+           usec * 1000.0 / frames);
+
+#ifdef HAVE_CYCLE_COUNTER
+    printf("\"cycles_per_sample\": %.3f}", cycles / samples);
+#else
+    printf("\"cycles_per_sample\": null}");
+#endif
+
+    fflush(stdout);
+    first_result = FALSE;
+}
+
+/* Random audio in format f, converted from floats so that every format
+ * gets sane values */
+static pa_memblock *random_block(pa_sample_format_t f, unsigned samples) {
+    pa_memblock *b;
+    float *t;
+    unsigned i;
+
+    t = pa_xnew(float, samples);
+    for (i = 0; i < samples; i++)
+        t[i] = (float) (rand() % 20001 - 10000) / 10000.0f * 0.8f;
+
+    b = pa_memblock_new(pool, samples * pa_sample_size_of_format(f));
+    pa_get_convert_from_float32ne_function(f)(samples, t, pa_memblock_acquire(b));
+    pa_memblock_release(b);
+
+    pa_xfree(t);
+    return b;
+}
+
+static void set_volume(pa_cvolume *v, unsigned channels, double base) {
+    unsigned c;
+
+    v->channels = (uint8_t) channels;
+    for (c = 0; c < channels; c++)
+        v->values[c] = pa_sw_volume_from_linear(base - 0.05 * c);
+}
+
+/* pa_mix() */
+
+struct mix_data {
+    pa_mix_info streams[MAX_STREAMS];
+    unsigned n_streams;
+    void *out;
+    size_t length;
+    pa_sample_spec ss;
+    pa_cvolume volume;
+};
+
+static void mix_run(void *userdata) {
+    struct mix_data *d = userdata;
+
+    pa_mix(d->streams, d->n_streams, d->out, d->length, &d->ss, &d->volume, FALSE);
+}
+
+static void bench_mix(void) {
+    pa_sample_format_t f;
+    unsigned c, k, n_streams, s;
+
+    if (!kernel_enabled("mix"))
+        return;
+
+    for (f = 0; f < PA_SAMPLE_MAX; f++)
+        for (c = 0; c < PA_ELEMENTSOF(channel_counts); c++)
+            for (k = 0; k < n_frames_list; k++)
+                for (n_streams = 2; n_streams <= MAX_STREAMS; n_streams *= 2) {
+                    struct mix_data d;
+                    unsigned samples = frames_list[k] * channel_counts[c];
+                    double usec, cycles;
+                    char variant[32];
+
+                    d.ss.format = f;
+                    d.ss.channels = (uint8_t) channel_counts[c];
+                    d.ss.rate = 48000;
+                    d.n_streams = n_streams;
+                    d.length = samples * pa_sample_size_of_format(f);
+                    d.out = pa_xmalloc(d.length);
+                    pa_cvolume_reset(&d.volume, d.ss.channels);
+
+                    for (s = 0; s < n_streams; s++) {
+                        d.streams[s].chunk.memblock = random_block(f, samples);
+                        d.streams[s].chunk.index = 0;
+                        d.streams[s].chunk.length = d.length;
+                        set_volume(&d.streams[s].volume, d.ss.channels, 0.9 - 0.1 * s);
+                    }
+
+                    measure(mix_run, &d, &usec, &cycles);
+
+                    pa_snprintf(variant, sizeof(variant), "%u-streams", n_streams);
+                    print_result("mix", variant, f, d.ss.channels, d.ss.channels, frames_list[k], usec, cycles, samples * n_streams);
+
+                    for (s = 0; s < n_streams; s++)
+                        pa_memblock_unref(d.streams[s].chunk.memblock);
+                    pa_xfree(d.out);
+                }
+}
+
+/* pa_volume_memchunk() */
+
+struct volume_data {
+    pa_memchunk chunk;
+    pa_sample_spec ss;
+    pa_cvolume down, up;
+};
+
+/* Scaling down and back up again keeps the samples from decaying into
+ * silence or denormals over the many runs */
+static void volume_run(void *userdata) {
+    struct volume_data *d = userdata;
+
+    pa_volume_memchunk(&d->chunk, &d->ss, &d->down);
+    pa_volume_memchunk(&d->chunk, &d->ss, &d->up);
+}
+
+static void bench_volume(void) {
+    pa_sample_format_t f;
+    unsigned c, k, i;
+
+    if (!kernel_enabled("volume"))
+        return;
+
+    for (f = 0; f < PA_SAMPLE_MAX; f++)
+        for (c = 0; c < PA_ELEMENTSOF(channel_counts); c++)
+            for (k = 0; k < n_frames_list; k++) {
+                struct volume_data d;
+                unsigned samples = frames_list[k] * channel_counts[c];
+                double usec, cycles;
+
+                d.ss.format = f;
+                d.ss.channels = (uint8_t) channel_counts[c];
+                d.ss.rate = 48000;
+
+                d.chunk.memblock = random_block(f, samples);
+                d.chunk.index = 0;
+                d.chunk.length = samples * pa_sample_size_of_format(f);
+
+                d.down.channels = d.up.channels = d.ss.channels;
+                for (i = 0; i < d.ss.channels; i++) {
+                    d.down.values[i] = pa_sw_volume_from_linear(0.5);
+                    d.up.values[i] = pa_sw_volume_from_linear(2.0);
+                }
+
+                measure(volume_run, &d, &usec, &cycles);
+
+                /* Two calls per run */
+                print_result("volume", NULL, f, d.ss.channels, d.ss.channels, frames_list[k], usec / 2, cycles / 2, samples);
+
+                pa_memblock_unref(d.chunk.memblock);
+            }
+}
+
+/* sconv */
+
+struct convert_data {
+    pa_convert_func_t func;
+    unsigned samples;
+    void *in, *out;
+};
+
+static void convert_run(void *userdata) {
+    struct convert_data *d = userdata;
+
+    d->func(d->samples, d->in, d->out);
+}
+
+static void bench_convert_one(const char *variant, pa_convert_func_t func, pa_sample_format_t f,
+                              pa_sample_format_t in_format, size_t out_size) {
+    unsigned c, k;
+
+    for (c = 0; c < PA_ELEMENTSOF(channel_counts); c++)
+        for (k = 0; k < n_frames_list; k++) {
+            struct convert_data d;
+            pa_memblock *b;
+            double usec, cycles;
+
+            d.func = func;
+            d.samples = frames_list[k] * channel_counts[c];
+
+            b = random_block(in_format, d.samples);
+            d.in = pa_memblock_acquire(b);
+            d.out = pa_xmalloc(d.samples * out_size);
+
+            measure(convert_run, &d, &usec, &cycles);
+            print_result("sconv", variant, f, channel_counts[c], channel_counts[c], frames_list[k], usec, cycles, d.samples);
+
+            pa_memblock_release(b);
+            pa_memblock_unref(b);
+            pa_xfree(d.out);
+        }
+}
+
+static void bench_sconv(void) {
+    pa_sample_format_t f;
+
+    if (!kernel_enabled("sconv"))
+        return;
+
+    for (f = 0; f < PA_SAMPLE_MAX; f++) {
+        size_t fs = pa_sample_size_of_format(f);
+        pa_convert_func_t func;
+
+        if (f != PA_SAMPLE_FLOAT32NE) {
+            if ((func = pa_get_convert_to_float32ne_function(f)))
+                bench_convert_one("to-float32ne", func, f, f, sizeof(float));
+            if ((func = pa_get_convert_from_float32ne_function(f)))
+                bench_convert_one("from-float32ne", func, f, PA_SAMPLE_FLOAT32NE, fs);
+        }
+
+        if (f != PA_SAMPLE_S16NE) {
+            if ((func = pa_get_convert_to_s16ne_function(f)))
+                bench_convert_one("to-s16ne", func, f, f, sizeof(int16_t));
+            if ((func = pa_get_convert_from_s16ne_function(f)))
+                bench_convert_one("from-s16ne", func, f, PA_SAMPLE_S16NE, fs);
+        }
+    }
+}
+
+/* pa_remap_t */
+
+struct remap_data {
+    pa_remap_t remap;
+    pa_sample_format_t format;
+    pa_sample_spec i_ss, o_ss;
+    unsigned frames;
+    void *in, *out;
+};
+
+static void remap_run(void *userdata) {
+    struct remap_data *d = userdata;
+
+    d->remap.do_remap(&d->remap, d->out, d->in, d->frames);
+}
+
+static const struct {
+    const char *name;
+    unsigned in_channels, out_channels;
+    pa_bool_t swap;
+} remappings[] = {
+    { "mono-to-stereo", 1, 2, FALSE },
+    { "stereo-to-mono", 2, 1, FALSE },
+    { "stereo-swap", 2, 2, TRUE },
+    { "stereo-to-5.1", 2, 6, FALSE },
+    { "5.1-to-stereo", 6, 2, FALSE },
+    { "7.1-to-stereo", 8, 2, FALSE },
+};
+
+/* Every output channel gets the input channel of the same position
+ * modulo the input channels, and when there are more inputs than
+ * outputs, the extra ones are mixed in evenly */
+static void init_map_table(pa_remap_t *m, unsigned n_ic, unsigned n_oc, pa_bool_t swap) {
+    unsigned oc, ic;
+
+    memset(m->map_table_f, 0, sizeof(m->map_table_f));
+    memset(m->map_table_i, 0, sizeof(m->map_table_i));
+
+    for (oc = 0; oc < n_oc; oc++)
+        for (ic = 0; ic < n_ic; ic++) {
+            float f = 0.0f;
+
+            if (swap)
+                f = (ic == n_ic - 1 - oc) ? 1.0f : 0.0f;
+            else if (n_ic <= n_oc)
+                f = (ic == oc % n_ic) ? 1.0f : 0.0f;
+            else if (ic % n_oc == oc)
+                f = (float) n_oc / (float) n_ic;
+
+            m->map_table_f[oc][ic] = f;
+            m->map_table_i[oc][ic] = (int32_t) (f * 0x10000);
+        }
+}
+
+static void bench_remap(void) {
+    static const pa_sample_format_t formats[] = { PA_SAMPLE_S16NE, PA_SAMPLE_FLOAT32NE };
+    unsigned f, r, k;
+
+    if (!kernel_enabled("remap"))
+        return;
+
+    for (f = 0; f < PA_ELEMENTSOF(formats); f++)
+        for (r = 0; r < PA_ELEMENTSOF(remappings); r++)
+            for (k = 0; k < n_frames_list; k++) {
+                struct remap_data d;
+                pa_memblock *b;
+                double usec, cycles;
+
+                d.format = formats[f];
+                d.i_ss.format = d.o_ss.format = d.format;
+                d.i_ss.rate = d.o_ss.rate = 48000;
+                d.i_ss.channels = (uint8_t) remappings[r].in_channels;
+                d.o_ss.channels = (uint8_t) remappings[r].out_channels;
+                d.frames = frames_list[k];
+
+                d.remap.format = &d.format;
+                d.remap.i_ss = &d.i_ss;
+                d.remap.o_ss = &d.o_ss;
+                init_map_table(&d.remap, d.i_ss.channels, d.o_ss.channels, remappings[r].swap);
+                pa_init_remap(&d.remap);
+
+                b = random_block(d.format, d.frames * d.i_ss.channels);
+                d.in = pa_memblock_acquire(b);
+                d.out = pa_xmalloc(d.frames * pa_frame_size(&d.o_ss));
+
+                measure(remap_run, &d, &usec, &cycles);
+                print_result("remap", remappings[r].name, d.format, d.i_ss.channels, d.o_ss.channels,
+                             d.frames, usec, cycles, d.frames * d.o_ss.channels);
+
+                pa_memblock_release(b);
+                pa_memblock_unref(b);
+                pa_xfree(d.out);
+            }
+}
+
+/* pa_resampler */
+
+struct resample_data {
+    pa_resampler *resampler;
+    pa_memchunk in;
+};
+
+static void resample_run(void *userdata) {
+    struct resample_data *d = userdata;
+    pa_memchunk out;
+
+    pa_resampler_run(d->resampler, &d->in, &out);
+
+    if (out.memblock)
+        pa_memblock_unref(out.memblock);
+}
+
+static void bench_resampler(void) {
+    static const pa_sample_format_t formats[] = { PA_SAMPLE_S16NE, PA_SAMPLE_FLOAT32NE };
+    static const unsigned resample_channels[] = { 1, 2 };
+    pa_resample_method_t m;
+    unsigned f, c, k;
+
+    if (!kernel_enabled("resample"))
+        return;
+
+    for (m = 0; m < PA_RESAMPLER_MAX; m++) {
+        if (m == PA_RESAMPLER_AUTO || !pa_resample_method_supported(m))
+            continue;
+
+        for (f = 0; f < PA_ELEMENTSOF(formats); f++)
+            for (c = 0; c < PA_ELEMENTSOF(resample_channels); c++)
+                for (k = 0; k < n_frames_list; k++) {
+                    struct resample_data d;
+                    pa_sample_spec a, b;
+                    pa_channel_map map;
+                    double usec, cycles;
+
+                    a.format = b.format = formats[f];
+                    a.channels = b.channels = (uint8_t) resample_channels[c];
+
+                    /* Copying needs equal rates, peaks only goes down */
+                    if (m == PA_RESAMPLER_COPY)
+                        a.rate = b.rate = 48000;
+                    else if (m == PA_RESAMPLER_PEAKS) {
+                        a.rate = 48000;
+                        b.rate = 44100;
+                    } else {
+                        a.rate = 44100;
+                        b.rate = 48000;
+                    }
+
+                    pa_channel_map_init_auto(&map, a.channels, PA_CHANNEL_MAP_DEFAULT);
+
+                    if (!(d.resampler = pa_resampler_new(pool, &a, &map, &b, &map, m, 0)))
+                        continue;
+
+                    d.in.memblock = random_block(a.format, frames_list[k] * a.channels);
+                    d.in.index = 0;
+                    d.in.length = frames_list[k] * pa_frame_size(&a);
+
+                    measure(resample_run, &d, &usec, &cycles);
+                    print_result("resample", pa_resample_method_to_string(m), a.format, a.channels, b.channels,
+                                 frames_list[k], usec, cycles, frames_list[k] * a.channels);
+
+                    pa_memblock_unref(d.in.memblock);
+                    pa_resampler_free(d.resampler);
+                }
+    }
+}
+
+static void help(const char *argv0) {
+    printf("%s [options]\n\n"
+           "-h, --help                            Show this help\n"
+           "-q, --quick                           Only use blocks of 1024 frames\n"
+           "-k, --kernel=KERNEL                   Only run one of mix, volume, sconv, remap, resample\n"
+           "\n"
+           "Set PULSE_NO_SIMD=1 to measure the generic implementations.\n",
+           argv0);
+}
+
+int main(int argc, char *argv[]) {
+    pa_cpu_info cpu_info;
+    int c;
+
+    static const struct option long_options[] = {
+        {"help",   0, NULL, 'h'},
+        {"quick",  0, NULL, 'q'},
+        {"kernel", 1, NULL, 'k'},
+        {NULL,     0, NULL, 0}
+    };
+
+    while ((c = getopt_long(argc, argv, "hqk:", long_options, NULL)) != -1) {
+        switch (c) {
+            case 'h':
+                help(argv[0]);
+                return 0;
+
+            case 'q':
+                frames_list = quick_block_frames;
+                n_frames_list = PA_ELEMENTSOF(quick_block_frames);
+                break;
+
+            case 'k':
+                kernel_filter = optarg;
+                break;
+
+            default:
+                return 1;
+        }
+    }
+
+    /* The init functions log which implementation they picked */
+    pa_log_set_level(PA_LOG_WARN);
+
+    cpu_info.cpu_type = PA_CPU_UNDEFINED;
+    if (!getenv("PULSE_NO_SIMD")) {
+        if (pa_cpu_init_x86(&cpu_info.flags.x86))
+            cpu_info.cpu_type = PA_CPU_X86;
+        if (pa_cpu_init_arm(&cpu_info.flags.arm))
+            cpu_info.cpu_type = PA_CPU_ARM;
+        pa_cpu_init_orc(cpu_info);
+    }
+
+    pa_assert_se(pool = pa_mempool_new(FALSE, 0));
+
+    srand(0);
+
+    printf("{\n  \"cpu\": \"%s\",\n  \"cpu_flags\": %u,\n  \"cycle_counter\": %s,\n  \"results\": [",
+           cpu_info.cpu_type == PA_CPU_X86 ? "x86" : cpu_info.cpu_type == PA_CPU_ARM ? "arm" : "generic",
+           cpu_info.cpu_type == PA_CPU_X86 ? (unsigned) cpu_info.flags.x86 :
+           cpu_info.cpu_type == PA_CPU_ARM ? (unsigned) cpu_info.flags.arm : 0,
+#ifdef HAVE_CYCLE_COUNTER
+           "\"tsc\""
+#else
+           "null"
+#endif
+           );
+
+    bench_mix();
+    bench_volume();
+    bench_sconv();
+    bench_remap();
+    bench_resampler();
+
+    printf("\n  ]\n}\n");
+
+    pa_mempool_free(pool);
+
+    return 0;
+}
@@ -0,0 +1,173 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <check.h>
+
+#include <pulsecore/atomic.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/memblock.h>
+#include <pulsecore/render-pool.h>
+#include <pulsecore/sample-util.h>
+#include <pulsecore/thread-mq.h>
+
+#define N_THREADS 3
+#define N_JOBS_MAX 20
+#define N_RUNS 2000
+
+/* The helpers only install the thread_mq, they never use it */
+static pa_thread_mq mq;
+
+static void install_mq(void) {
+    if (!pa_thread_mq_get())
+        pa_thread_mq_install(&mq);
+}
+
+struct run_data {
+    pa_render_pool *pool;
+    pa_thread_mq *mq;
+    pa_atomic_t count[N_JOBS_MAX];
+    pa_atomic_t in_helper;
+};
+
+static void job_cb(unsigned job, void *userdata) {
+    struct run_data *d = userdata;
+
+    fail_unless(job < N_JOBS_MAX);
+    fail_unless(pa_thread_mq_get() == d->mq);
+
+    if (pa_render_pool_in_helper(d->pool))
+        pa_atomic_inc(&d->in_helper);
+
+    pa_atomic_inc(&d->count[job]);
+}
+
+START_TEST (render_pool_test) {
+    struct run_data d;
+    unsigned run, j;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    install_mq();
+
+    memset(&d, 0, sizeof(d));
+    d.mq = &mq;
+    d.pool = pa_render_pool_new("render-test", N_THREADS, &mq, FALSE, 0);
+    fail_unless(d.pool != NULL);
+    fail_unless(pa_render_pool_get_n_threads(d.pool) == N_THREADS);
+    fail_unless(!pa_render_pool_in_helper(d.pool));
+
+    for (run = 0; run < N_RUNS; run++)
+        pa_render_pool_run(d.pool, run % (N_JOBS_MAX + 1), job_cb, &d);
+
+    for (j = 0; j < N_JOBS_MAX; j++) {
+        unsigned expected = 0;
+
+        for (run = 0; run < N_RUNS; run++)
+            if (j < run % (N_JOBS_MAX + 1))
+                expected++;
+
+        fail_unless(pa_atomic_load(&d.count[j]) == (int) expected);
+    }
+
+    pa_log_debug("%i of the jobs were run on helper threads", pa_atomic_load(&d.in_helper));
+
+    pa_render_pool_free(d.pool);
+}
+END_TEST
+
+struct silence_data {
+    pa_mempool *pool;
+    pa_silence_cache cache;
+    pa_memchunk chunks[N_JOBS_MAX];
+};
+
+static void silence_job_cb(unsigned job, void *userdata) {
+    struct silence_data *d = userdata;
+    pa_sample_spec ss;
+
+    ss.format = (pa_sample_format_t) (job % PA_SAMPLE_MAX);
+    ss.rate = 44100;
+    ss.channels = 1;
+
+    pa_silence_memchunk_get(&d->cache, d->pool, &d->chunks[job], &ss, 0);
+}
+
+/* Jobs filling the silence cache at the same time must end up with the
+ * same blocks, and the blocks of the threads that lost must not leak */
+START_TEST (silence_cache_test) {
+    pa_render_pool *pool;
+    struct silence_data d;
+    unsigned run, j;
+
+    install_mq();
+
+    pool = pa_render_pool_new("silence-test", N_THREADS, &mq, FALSE, 0);
+    fail_unless(pool != NULL);
+
+    d.pool = pa_mempool_new(FALSE, 0);
+    fail_unless(d.pool != NULL);
+
+    for (run = 0; run < N_RUNS / 10; run++) {
+        pa_silence_cache_init(&d.cache);
+        pa_render_pool_run(pool, N_JOBS_MAX, silence_job_cb, &d);
+
+        for (j = 0; j < N_JOBS_MAX; j++) {
+            fail_unless(d.chunks[j].memblock == pa_atomic_ptr_load(&d.cache.blocks[j % PA_SAMPLE_MAX]));
+            pa_memblock_unref(d.chunks[j].memblock);
+        }
+
+        fail_unless(pa_atomic_ptr_load(&d.cache.blocks[PA_SAMPLE_S16LE]) == pa_atomic_ptr_load(&d.cache.blocks[PA_SAMPLE_FLOAT32BE]));
+
+        pa_silence_cache_done(&d.cache);
+        fail_unless(pa_atomic_load(&pa_mempool_get_stat(d.pool)->n_allocated) == 0);
+    }
+
+    pa_mempool_free(d.pool);
+    pa_render_pool_free(pool);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    s = suite_create("Render Pool");
+    tc = tcase_create("renderpool");
+    tcase_add_test(tc, render_pool_test);
+    tcase_add_test(tc, silence_cache_test);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
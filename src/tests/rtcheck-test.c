@@ -0,0 +1,132 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <unistd.h>
+
+#include <check.h>
+
+#include <pulse/xmalloc.h>
+#include <pulsecore/thread.h>
+#include <pulsecore/mutex.h>
+#include <pulsecore/rtpoll.h>
+#include <pulsecore/rtcheck.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+static pa_mutex *mutex = NULL;
+
+static void thread_func(void *data) {
+    pa_rtpoll *rtpoll;
+    unsigned allocs, mutexes;
+
+    /* Not realtime yet */
+    pa_xfree(pa_xmalloc(16));
+    fail_unless(pa_rtcheck_get_count(PA_RTCHECK_ALLOC) == 0);
+
+    pa_rtcheck_begin();
+    fail_unless(pa_rtcheck_active());
+
+    /* The main thread holds the mutex for a while */
+    pa_mutex_lock(mutex);
+    pa_mutex_unlock(mutex);
+    mutexes = pa_rtcheck_get_count(PA_RTCHECK_MUTEX);
+    fail_unless(mutexes == 1);
+
+    /* Nobody holds it now */
+    pa_mutex_lock(mutex);
+    pa_mutex_unlock(mutex);
+    fail_unless(pa_rtcheck_get_count(PA_RTCHECK_MUTEX) == mutexes);
+
+    pa_xfree(pa_xmalloc(16));
+    allocs = pa_rtcheck_get_count(PA_RTCHECK_ALLOC);
+    fail_unless(allocs == 2);
+
+    pa_rtcheck_end();
+    fail_unless(!pa_rtcheck_active());
+
+    pa_xfree(pa_xmalloc(16));
+    fail_unless(pa_rtcheck_get_count(PA_RTCHECK_ALLOC) == allocs);
+
+    /* Running an rtpoll makes a thread realtime, quitting it ends that */
+    rtpoll = pa_rtpoll_new();
+    pa_rtpoll_set_timer_relative(rtpoll, 1000);
+    fail_unless(pa_rtpoll_run(rtpoll, TRUE) > 0);
+    fail_unless(pa_rtcheck_active());
+
+    pa_xfree(pa_xmalloc(16));
+    fail_unless(pa_rtcheck_get_count(PA_RTCHECK_ALLOC) == allocs + 2);
+
+    pa_rtpoll_quit(rtpoll);
+    fail_unless(pa_rtpoll_run(rtpoll, TRUE) == 0);
+    fail_unless(!pa_rtcheck_active());
+
+    pa_rtpoll_free(rtpoll);
+    fail_unless(pa_rtcheck_get_count(PA_RTCHECK_ALLOC) == allocs + 2);
+}
+
+START_TEST (rtcheck_test) {
+    pa_thread *t;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    mutex = pa_mutex_new(FALSE, FALSE);
+
+    pa_rtcheck_enable();
+
+    pa_mutex_lock(mutex);
+
+    t = pa_thread_new("rtcheck-test", thread_func, NULL);
+    fail_unless(t != NULL);
+
+    usleep(100000);
+    pa_mutex_unlock(mutex);
+
+    pa_thread_free(t);
+
+    /* The main thread never ran an rtpoll */
+    fail_unless(!pa_rtcheck_active());
+    fail_unless(pa_rtcheck_get_count(PA_RTCHECK_ALLOC) == 4);
+
+    pa_mutex_free(mutex);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    s = suite_create("Realtime Check");
+    tc = tcase_create("rtcheck");
+    tcase_add_test(tc, rtcheck_test);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
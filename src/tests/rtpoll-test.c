@@ -24,6 +24,9 @@
 #include <check.h>
 #include <signal.h>
 
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
+
 #include <pulsecore/poll.h>
 #include <pulsecore/log.h>
 #include <pulsecore/rtpoll.h>
@@ -84,6 +87,46 @@ START_TEST (rtpoll_test) {
 }
 END_TEST
 
+static int busy_worker(pa_rtpoll_item *w) {
+    return 1;
+}
+
+START_TEST (rtpoll_now_test) {
+    pa_rtpoll *p;
+    pa_rtpoll_item *w;
+    pa_usec_t start, now;
+
+    p = pa_rtpoll_new();
+
+    /* A wakeup by the timer is stamped once, after the sleep */
+    start = pa_rtclock_now();
+    pa_rtpoll_set_timer_relative(p, 20 * PA_USEC_PER_MSEC);
+    fail_unless(pa_rtpoll_run(p, TRUE) == 1);
+    fail_unless(pa_rtpoll_timer_elapsed(p));
+
+    now = pa_rtpoll_now(p);
+    fail_unless(now >= start + 20 * PA_USEC_PER_MSEC);
+    fail_unless(now <= pa_rtclock_now());
+    fail_unless(pa_rtpoll_now(p) == now);
+
+    /* Without sleeping the time is read when it is first asked for */
+    w = pa_rtpoll_item_new(p, PA_RTPOLL_NORMAL, 0);
+    pa_rtpoll_item_set_work_callback(w, busy_worker);
+
+    pa_rtpoll_set_timer_disabled(p);
+    fail_unless(pa_rtpoll_run(p, TRUE) == 1);
+    fail_unless(!pa_rtpoll_timer_elapsed(p));
+
+    start = pa_rtclock_now();
+    now = pa_rtpoll_now(p);
+    fail_unless(now >= start);
+    fail_unless(pa_rtpoll_now(p) == now);
+
+    pa_rtpoll_item_free(w);
+    pa_rtpoll_free(p);
+}
+END_TEST
+
 int main(int argc, char *argv[]) {
     int failed = 0;
     Suite *s;
@@ -93,6 +136,7 @@ int main(int argc, char *argv[]) {
     s = suite_create("RT Poll");
     tc = tcase_create("rtpoll");
     tcase_add_test(tc, rtpoll_test);
+    tcase_add_test(tc, rtpoll_now_test);
     /* the default timeout is too small,
      * set it to a reasonable large one.
      */
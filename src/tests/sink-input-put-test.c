@@ -0,0 +1,241 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+
+#include <check.h>
+
+#include <pulse/mainloop.h>
+
+#include <pulsecore/core.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/rtpoll.h>
+#include <pulsecore/semaphore.h>
+#include <pulsecore/sink.h>
+#include <pulsecore/sink-input.h>
+#include <pulsecore/thread.h>
+#include <pulsecore/thread-mq.h>
+
+#define N_INPUTS PA_MAX_INPUTS_PER_SINK
+
+enum {
+    TEST_SINK_MESSAGE_STALL = PA_SINK_MESSAGE_MAX,
+    TEST_SINK_MESSAGE_SYNC,
+    TEST_SINK_MESSAGE_RENDER
+};
+
+static pa_thread_mq thread_mq;
+static pa_rtpoll *rtpoll;
+static pa_semaphore *stall;
+
+static unsigned added;            /* IO thread */
+static pa_sink_input *previous;   /* IO thread */
+static pa_bool_t in_order = TRUE; /* IO thread */
+
+static unsigned popped;            /* IO thread */
+static pa_bool_t rendered_silence; /* IO thread */
+
+static pa_sink_input *inputs[N_INPUTS];
+static unsigned completed;
+
+/* Called from IO context */
+static int sink_process_msg(pa_msgobject *o, int code, void *data, int64_t offset, pa_memchunk *chunk) {
+
+    switch (code) {
+
+        case TEST_SINK_MESSAGE_STALL:
+            pa_semaphore_wait(stall);
+            return 0;
+
+        case TEST_SINK_MESSAGE_SYNC:
+            return 0;
+
+        case TEST_SINK_MESSAGE_RENDER: {
+            pa_sink *s = PA_SINK(o);
+            pa_memchunk result;
+
+            pa_sink_render(s, 4096, &result);
+            rendered_silence = pa_memblock_is_silence(result.memblock);
+            pa_memblock_unref(result.memblock);
+            return 0;
+        }
+
+        case PA_SINK_MESSAGE_ADD_INPUT:
+            /* Inputs show up in the order they were put */
+            if (previous && PA_SINK_INPUT(data)->index != previous->index + 1)
+                in_order = FALSE;
+            previous = PA_SINK_INPUT(data);
+            added++;
+            break;
+    }
+
+    return pa_sink_process_msg(o, code, data, offset, chunk);
+}
+
+static void thread_func(void *userdata) {
+    pa_thread_mq_install(&thread_mq);
+
+    while (pa_rtpoll_run(rtpoll, TRUE) > 0)
+        ;
+}
+
+static int sink_input_pop_cb(pa_sink_input *i, size_t length, pa_memchunk *chunk) {
+    popped++;
+    return -1;
+}
+
+static void sink_input_process_rewind_cb(pa_sink_input *i, size_t nbytes) {
+}
+
+static void sink_input_kill_cb(pa_sink_input *i) {
+    pa_sink_input_unlink(i);
+}
+
+static void put_cb(pa_sink_input *i, void *userdata) {
+    unsigned k = PA_PTR_TO_UINT(userdata);
+
+    fail_unless(inputs[k] == i);
+    fail_unless(completed == k);
+    completed++;
+}
+
+START_TEST (sink_input_put_test) {
+    pa_mainloop *m;
+    pa_core *c;
+    pa_sink_new_data data;
+    pa_sink *s;
+    pa_thread *thread;
+    pa_sample_spec ss;
+    unsigned k;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    pa_assert_se(m = pa_mainloop_new());
+    pa_assert_se(c = pa_core_new(pa_mainloop_get_api(m), FALSE, 0, PA_SHM_HUGE_PAGES_NO, FALSE));
+
+    rtpoll = pa_rtpoll_new();
+    pa_thread_mq_init(&thread_mq, c->mainloop, rtpoll);
+    stall = pa_semaphore_new(0);
+
+    ss.format = PA_SAMPLE_S16LE;
+    ss.rate = 44100;
+    ss.channels = 2;
+
+    pa_sink_new_data_init(&data);
+    data.driver = __FILE__;
+    pa_sink_new_data_set_name(&data, "test-sink");
+    pa_sink_new_data_set_sample_spec(&data, &ss);
+    pa_assert_se(s = pa_sink_new(c, &data, 0));
+    pa_sink_new_data_done(&data);
+
+    s->parent.process_msg = sink_process_msg;
+    pa_sink_set_asyncmsgq(s, thread_mq.inq);
+    pa_sink_set_rtpoll(s, rtpoll);
+
+    pa_assert_se(thread = pa_thread_new("test-sink", thread_func, NULL));
+    pa_sink_put(s);
+
+    /* Keep the IO thread busy while the inputs come in. Had any of
+     * them to wait for it, this would never return. */
+    pa_asyncmsgq_post(thread_mq.inq, PA_MSGOBJECT(s), TEST_SINK_MESSAGE_STALL, NULL, 0, NULL, NULL);
+
+    for (k = 0; k < N_INPUTS; k++) {
+        pa_sink_input_new_data input_data;
+
+        pa_sink_input_new_data_init(&input_data);
+        input_data.driver = __FILE__;
+        pa_sink_input_new_data_set_sink(&input_data, s, FALSE);
+        pa_sink_input_new_data_set_sample_spec(&input_data, &ss);
+        input_data.flags = PA_SINK_INPUT_START_CORKED;
+        fail_unless(pa_sink_input_new(&inputs[k], c, &input_data) == 0);
+        pa_sink_input_new_data_done(&input_data);
+
+        inputs[k]->pop = sink_input_pop_cb;
+        inputs[k]->process_rewind = sink_input_process_rewind_cb;
+        inputs[k]->kill = sink_input_kill_cb;
+
+        pa_sink_input_put_async(inputs[k], put_cb, PA_UINT_TO_PTR(k));
+        fail_unless(PA_SINK_INPUT_IS_LINKED(inputs[k]->state));
+    }
+
+    fail_unless(completed == 0);
+    fail_unless(pa_idxset_size(s->inputs) == N_INPUTS);
+
+    pa_semaphore_post(stall);
+
+    while (completed < N_INPUTS)
+        fail_unless(pa_mainloop_iterate(m, TRUE, NULL) >= 0);
+
+    /* A synchronous message is only answered once all batches are
+     * through */
+    pa_asyncmsgq_send(thread_mq.inq, PA_MSGOBJECT(s), TEST_SINK_MESSAGE_SYNC, NULL, 0, NULL);
+    fail_unless(added == N_INPUTS);
+    fail_unless(in_order);
+    fail_unless(pa_hashmap_size(s->thread_info.inputs) == N_INPUTS);
+    fail_unless(s->attach_batch == NULL);
+
+    /* Corked inputs aren't asked for data and leave nothing to mix */
+    pa_asyncmsgq_send(thread_mq.inq, PA_MSGOBJECT(s), TEST_SINK_MESSAGE_RENDER, NULL, 0, NULL);
+    fail_unless(popped == 0);
+    fail_unless(rendered_silence);
+
+    for (k = 0; k < N_INPUTS; k++) {
+        pa_sink_input_unlink(inputs[k]);
+        pa_sink_input_unref(inputs[k]);
+    }
+
+    pa_sink_unlink(s);
+
+    pa_asyncmsgq_send(thread_mq.inq, NULL, PA_MESSAGE_SHUTDOWN, NULL, 0, NULL);
+    pa_thread_free(thread);
+    pa_thread_mq_done(&thread_mq);
+
+    pa_sink_unref(s);
+    pa_rtpoll_free(rtpoll);
+    pa_semaphore_free(stall);
+
+    pa_core_unref(c);
+    pa_mainloop_free(m);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    s = suite_create("Sink Input Put");
+    tc = tcase_create("sinkinputput");
+    tcase_add_test(tc, sink_input_put_test);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
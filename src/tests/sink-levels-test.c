@@ -0,0 +1,218 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <math.h>
+#include <stdlib.h>
+
+#include <check.h>
+
+#include <pulse/mainloop.h>
+#include <pulse/timeval.h>
+
+#include <pulsecore/core.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/rtpoll.h>
+#include <pulsecore/sink.h>
+#include <pulsecore/sink-input.h>
+#include <pulsecore/thread.h>
+#include <pulsecore/thread-mq.h>
+
+/* Two and a half windows */
+#define RENDER_USEC (25*PA_USEC_PER_MSEC)
+
+/* A square wave at half scale on the left, a quarter on the right */
+#define LEFT 16384
+#define RIGHT 8192
+
+enum {
+    TEST_SINK_MESSAGE_RENDER = PA_SINK_MESSAGE_MAX
+};
+
+static pa_thread_mq thread_mq;
+static pa_rtpoll *rtpoll;
+static pa_sample_spec ss;
+
+/* Called from IO context */
+static int sink_process_msg(pa_msgobject *o, int code, void *data, int64_t offset, pa_memchunk *chunk) {
+    pa_sink *s = PA_SINK(o);
+
+    switch (code) {
+
+        case TEST_SINK_MESSAGE_RENDER: {
+            pa_memchunk c;
+
+            pa_sink_render_full(s, pa_usec_to_bytes(RENDER_USEC, &ss), &c);
+            pa_memblock_unref(c.memblock);
+
+            return 0;
+        }
+    }
+
+    return pa_sink_process_msg(o, code, data, offset, chunk);
+}
+
+static void thread_func(void *userdata) {
+    pa_thread_mq_install(&thread_mq);
+
+    while (pa_rtpoll_run(rtpoll, TRUE) > 0)
+        ;
+}
+
+static int sink_input_pop_cb(pa_sink_input *i, size_t length, pa_memchunk *chunk) {
+    int16_t *p;
+    size_t n, k;
+
+    chunk->index = 0;
+    chunk->length = length;
+    chunk->memblock = pa_memblock_new(i->sink->core->mempool, length);
+
+    p = pa_memblock_acquire(chunk->memblock);
+    n = length / pa_frame_size(&ss);
+    for (k = 0; k < n; k++) {
+        *(p++) = k & 1 ? -LEFT : LEFT;
+        *(p++) = k & 1 ? -RIGHT : RIGHT;
+    }
+    pa_memblock_release(chunk->memblock);
+
+    return 0;
+}
+
+static void sink_input_process_rewind_cb(pa_sink_input *i, size_t nbytes) {
+}
+
+static void sink_input_kill_cb(pa_sink_input *i) {
+    pa_sink_input_unlink(i);
+}
+
+START_TEST (sink_levels_test) {
+    pa_mainloop *m;
+    pa_core *c;
+    pa_sink_new_data data;
+    pa_sink_input_new_data input_data;
+    pa_sink *s;
+    pa_sink_input *i;
+    pa_thread *thread;
+    pa_sink_levels l;
+    uint32_t seq;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    pa_assert_se(m = pa_mainloop_new());
+    pa_assert_se(c = pa_core_new(pa_mainloop_get_api(m), FALSE, 0, PA_SHM_HUGE_PAGES_NO, FALSE));
+
+    rtpoll = pa_rtpoll_new();
+    pa_thread_mq_init(&thread_mq, c->mainloop, rtpoll);
+
+    ss.format = PA_SAMPLE_S16NE;
+    ss.rate = 48000;
+    ss.channels = 2;
+
+    pa_sink_new_data_init(&data);
+    data.driver = __FILE__;
+    pa_sink_new_data_set_name(&data, "test-sink");
+    pa_sink_new_data_set_sample_spec(&data, &ss);
+    pa_assert_se(s = pa_sink_new(c, &data, 0));
+    pa_sink_new_data_done(&data);
+
+    s->parent.process_msg = sink_process_msg;
+    pa_sink_set_asyncmsgq(s, thread_mq.inq);
+    pa_sink_set_rtpoll(s, rtpoll);
+
+    pa_assert_se(thread = pa_thread_new("test-sink", thread_func, NULL));
+    pa_sink_put(s);
+
+    pa_sink_input_new_data_init(&input_data);
+    input_data.driver = __FILE__;
+    pa_sink_input_new_data_set_sink(&input_data, s, FALSE);
+    pa_sink_input_new_data_set_sample_spec(&input_data, &ss);
+    fail_unless(pa_sink_input_new(&i, c, &input_data) == 0);
+    pa_sink_input_new_data_done(&input_data);
+
+    i->pop = sink_input_pop_cb;
+    i->process_rewind = sink_input_process_rewind_cb;
+    i->kill = sink_input_kill_cb;
+
+    pa_sink_input_put(i);
+
+    /* Nobody asked, so nothing is measured */
+    pa_asyncmsgq_send(thread_mq.inq, PA_MSGOBJECT(s), TEST_SINK_MESSAGE_RENDER, NULL, 0, NULL);
+    seq = 0;
+    fail_unless(!pa_sink_get_levels(s, &seq, &l));
+
+    seq = pa_sink_levels_start(s);
+    pa_asyncmsgq_send(thread_mq.inq, PA_MSGOBJECT(s), TEST_SINK_MESSAGE_RENDER, NULL, 0, NULL);
+
+    fail_unless(pa_sink_get_levels(s, &seq, &l));
+    fail_unless(seq == 2);
+    fail_unless(l.peak[0] == 0.5f);
+    fail_unless(l.peak[1] == 0.25f);
+    fail_unless(fabsf(l.rms[0] - 0.5f) < 0.001f);
+    fail_unless(fabsf(l.rms[1] - 0.25f) < 0.001f);
+
+    /* The half window left over is only reported once it is complete */
+    fail_unless(!pa_sink_get_levels(s, &seq, &l));
+    pa_asyncmsgq_send(thread_mq.inq, PA_MSGOBJECT(s), TEST_SINK_MESSAGE_RENDER, NULL, 0, NULL);
+    fail_unless(pa_sink_get_levels(s, &seq, &l));
+    fail_unless(seq == 5);
+
+    pa_sink_levels_stop(s);
+    pa_asyncmsgq_send(thread_mq.inq, PA_MSGOBJECT(s), TEST_SINK_MESSAGE_RENDER, NULL, 0, NULL);
+    fail_unless(!pa_sink_get_levels(s, &seq, &l));
+
+    pa_sink_input_unlink(i);
+    pa_sink_input_unref(i);
+
+    pa_sink_unlink(s);
+
+    pa_asyncmsgq_send(thread_mq.inq, NULL, PA_MESSAGE_SHUTDOWN, NULL, 0, NULL);
+    pa_thread_free(thread);
+    pa_thread_mq_done(&thread_mq);
+
+    pa_sink_unref(s);
+    pa_rtpoll_free(rtpoll);
+
+    pa_core_unref(c);
+    pa_mainloop_free(m);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    s = suite_create("Sink Levels");
+    tc = tcase_create("sinklevels");
+    tcase_add_test(tc, sink_levels_test);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
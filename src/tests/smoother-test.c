@@ -27,9 +27,12 @@
 #include <check.h>
 
 #include <pulse/timeval.h>
+#include <pulse/rtclock.h>
 
 #include <pulsecore/log.h>
 #include <pulsecore/time-smoother.h>
+#include <pulsecore/thread.h>
+#include <pulsecore/atomic.h>
 
 START_TEST (smoother_test) {
     pa_usec_t x;
@@ -86,6 +89,75 @@ START_TEST (smoother_test) {
 }
 END_TEST
 
+#define QUERIES 1000000
+
+static pa_atomic_t stop_reader = PA_ATOMIC_INIT(0);
+
+static void reader(void *userdata) {
+    pa_smoother *s = userdata;
+    pa_usec_t start, x, sink = 0;
+    unsigned n = 0;
+
+    start = pa_rtclock_now();
+
+    while (!pa_atomic_load(&stop_reader)) {
+        x = pa_rtclock_now() - start;
+        sink += pa_smoother_peek(s, x);
+        n++;
+    }
+
+    pa_log_debug("Concurrent reader did %u queries (%llu).", n, (unsigned long long) sink);
+}
+
+START_TEST (smoother_peek_test) {
+    pa_smoother *s;
+    pa_thread *t;
+    pa_usec_t x, start, stop, sink = 0;
+    unsigned u;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    /* Not monotonic, so that pa_smoother_get() doesn't remember anything
+     * and both functions have to return the same values */
+    s = pa_smoother_new(700*PA_USEC_PER_MSEC, 2000*PA_USEC_PER_MSEC, FALSE, TRUE, 6, 0, FALSE);
+
+    for (u = 0; u < 20; u++)
+        pa_smoother_put(s, u * 100 * PA_USEC_PER_MSEC, u * 101 * PA_USEC_PER_MSEC);
+
+    for (x = 0; x < PA_USEC_PER_SEC * 4; x += PA_USEC_PER_MSEC)
+        fail_unless(pa_smoother_get(s, x) == pa_smoother_peek(s, x));
+
+    start = pa_rtclock_now();
+    for (u = 0; u < QUERIES; u++)
+        sink += pa_smoother_get(s, u * PA_USEC_PER_MSEC / 1000);
+    stop = pa_rtclock_now();
+    pa_log_debug("pa_smoother_get(): %0.1f ns per query.", (double) (stop - start) * 1000 / QUERIES);
+
+    start = pa_rtclock_now();
+    for (u = 0; u < QUERIES; u++)
+        sink += pa_smoother_peek(s, u * PA_USEC_PER_MSEC / 1000);
+    stop = pa_rtclock_now();
+    pa_log_debug("pa_smoother_peek(): %0.1f ns per query.", (double) (stop - start) * 1000 / QUERIES);
+
+    /* Keep updating while another thread reads */
+    t = pa_thread_new("reader", reader, s);
+
+    start = pa_rtclock_now();
+    for (u = 20; u < 20 + QUERIES / 10; u++)
+        pa_smoother_put(s, u * 100 * PA_USEC_PER_MSEC, u * 101 * PA_USEC_PER_MSEC);
+    stop = pa_rtclock_now();
+    pa_log_debug("pa_smoother_put() with concurrent reader: %0.1f ns per update.", (double) (stop - start) * 1000 / (QUERIES / 10));
+
+    pa_atomic_store(&stop_reader, 1);
+    pa_thread_free(t);
+
+    pa_log_debug("(%llu)", (unsigned long long) sink);
+
+    pa_smoother_free(s);
+}
+END_TEST
+
 int main(int argc, char *argv[]) {
     int failed = 0;
     Suite *s;
@@ -95,6 +167,7 @@ int main(int argc, char *argv[]) {
     s = suite_create("Smoother");
     tc = tcase_create("smoother");
     tcase_add_test(tc, smoother_test);
+    tcase_add_test(tc, smoother_peek_test);
     suite_add_tcase(s, tc);
 
     sr = srunner_create(s);
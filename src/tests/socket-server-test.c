@@ -0,0 +1,178 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <check.h>
+
+#include <pulse/mainloop.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/socket.h>
+#include <pulsecore/socket-server.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/macro.h>
+
+static unsigned n_connections;
+
+static void on_connection(pa_socket_server *s, pa_iochannel *io, void *userdata) {
+    n_connections++;
+    pa_iochannel_free(io);
+}
+
+static int connect_to(const char *fn) {
+    struct sockaddr_un sa;
+    int fd;
+
+    fail_unless((fd = pa_socket_cloexec(PF_UNIX, SOCK_STREAM, 0)) >= 0);
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sun_family = AF_UNIX;
+    pa_strlcpy(sa.sun_path, fn, sizeof(sa.sun_path));
+
+    fail_unless(connect(fd, (struct sockaddr*) &sa, sizeof(sa)) >= 0);
+
+    return fd;
+}
+
+START_TEST (handoff_test) {
+    pa_mainloop *m;
+    pa_socket_server *s;
+    char dir[] = "/tmp/socket-server-test-XXXXXX", *fn, *str;
+    int fds[PA_SOCKET_SERVER_HANDOFF_MAX], client, other;
+    struct stat st;
+
+    fail_unless(mkdtemp(dir) != NULL);
+    fn = pa_sprintf_malloc("%s/native", dir);
+
+    m = pa_mainloop_new();
+
+    fail_unless((s = pa_socket_server_new_unix(pa_mainloop_get_api(m), fn)) != NULL);
+
+    /* The old instance goes away with a client still waiting */
+    pa_socket_server_handoff_begin();
+    client = connect_to(fn);
+    pa_socket_server_unref(s);
+
+    fail_unless(stat(fn, &st) == 0);
+
+    fail_unless((str = pa_socket_server_handoff_export()) != NULL);
+    fail_unless(strstr(str, fn) != NULL);
+
+    /* Nothing else is kept open anymore after the export */
+    fail_unless((s = pa_socket_server_new_unix(pa_mainloop_get_api(m), "/tmp/socket-server-test-unused")) != NULL);
+    pa_socket_server_unref(s);
+
+    /* The new instance takes over the socket along with the client */
+    fail_unless(pa_socket_server_handoff_import(str, fds, PA_ELEMENTSOF(fds)) == 1);
+    pa_xfree(str);
+
+    fail_unless(pa_socket_server_new_unix_handoff(pa_mainloop_get_api(m), "/tmp/socket-server-test-unused") == NULL);
+    fail_unless((s = pa_socket_server_new_unix_handoff(pa_mainloop_get_api(m), fn)) != NULL);
+    fail_unless(pa_socket_server_new_unix_handoff(pa_mainloop_get_api(m), fn) == NULL);
+    pa_socket_server_handoff_done();
+
+    pa_socket_server_set_callback(s, on_connection, NULL);
+
+    n_connections = 0;
+    while (n_connections < 1)
+        fail_unless(pa_mainloop_iterate(m, TRUE, NULL) >= 0);
+
+    other = connect_to(fn);
+    while (n_connections < 2)
+        fail_unless(pa_mainloop_iterate(m, TRUE, NULL) >= 0);
+
+    pa_close(client);
+    pa_close(other);
+
+    /* Once it is let go of for good, the socket goes away */
+    pa_socket_server_unref(s);
+    fail_unless(stat(fn, &st) < 0 && errno == ENOENT);
+
+    pa_mainloop_free(m);
+
+    rmdir(dir);
+    pa_xfree(fn);
+}
+END_TEST
+
+START_TEST (handoff_unused_test) {
+    pa_mainloop *m;
+    pa_socket_server *s;
+    char dir[] = "/tmp/socket-server-test-XXXXXX", *fn, *str;
+    int fds[PA_SOCKET_SERVER_HANDOFF_MAX];
+    struct stat st;
+
+    fail_unless(mkdtemp(dir) != NULL);
+    fn = pa_sprintf_malloc("%s/native", dir);
+
+    m = pa_mainloop_new();
+
+    fail_unless((s = pa_socket_server_new_unix(pa_mainloop_get_api(m), fn)) != NULL);
+    pa_socket_server_handoff_begin();
+    pa_socket_server_unref(s);
+    str = pa_socket_server_handoff_export();
+
+    /* Garbage is skipped */
+    fail_unless(pa_socket_server_handoff_import("x:/foo\n1:/bar\n7:\nnonsense\n", fds, PA_ELEMENTSOF(fds)) == 0);
+
+    /* A socket the new configuration doesn't use is closed and removed */
+    fail_unless(pa_socket_server_handoff_import(str, fds, PA_ELEMENTSOF(fds)) == 1);
+    pa_xfree(str);
+
+    fail_unless(stat(fn, &st) == 0);
+    pa_socket_server_handoff_done();
+    fail_unless(stat(fn, &st) < 0 && errno == ENOENT);
+
+    pa_mainloop_free(m);
+
+    rmdir(dir);
+    pa_xfree(fn);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    s = suite_create("Socket server");
+    tc = tcase_create("socket-server");
+    tcase_add_test(tc, handoff_test);
+    tcase_add_test(tc, handoff_unused_test);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
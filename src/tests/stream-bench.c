@@ -0,0 +1,417 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+/* One client of the bench-daemon.sh harness: opens a number of
+ * playback (or record) streams with the given buffer attributes, keeps
+ * them running for a while and prints a single JSON line with the
+ * glitches and latencies it saw. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#include <pulse/pulseaudio.h>
+
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/sample-util.h>
+
+#define MAX_STREAMS 256
+
+/* How often the latency of the streams is sampled */
+#define SAMPLE_USEC (100 * PA_USEC_PER_MSEC)
+
+struct stream_info {
+    pa_stream *stream;
+    pa_bool_t ready;
+    unsigned underflows, overflows;
+    uint64_t bytes;
+};
+
+static pa_mainloop_api *mainloop_api = NULL;
+static pa_context *context = NULL;
+static struct stream_info streams[MAX_STREAMS];
+
+static const char *sink_name = NULL;
+static unsigned n_streams = 1;
+static unsigned seconds = 10;
+static pa_bool_t record = FALSE;
+static pa_sample_spec sample_spec = { PA_SAMPLE_S16LE, 48000, 2 };
+static pa_buffer_attr buffer_attr = {
+    (uint32_t) -1, (uint32_t) -1, (uint32_t) -1, (uint32_t) -1, (uint32_t) -1
+};
+static pa_stream_flags_t stream_flags = PA_STREAM_INTERPOLATE_TIMING | PA_STREAM_AUTO_TIMING_UPDATE | PA_STREAM_ADJUST_LATENCY;
+
+static void *silence = NULL;
+static size_t silence_length = 0;
+
+static unsigned n_ready = 0;
+static pa_bool_t failed = FALSE;
+static pa_usec_t start_time = 0;
+
+static uint64_t latency_sum = 0;
+static unsigned latency_n = 0;
+static pa_usec_t latency_max = 0;
+
+static void quit(int ret) {
+    failed = failed || ret != 0;
+    mainloop_api->quit(mainloop_api, ret);
+}
+
+static void underflow_cb(pa_stream *s, void *userdata) {
+    struct stream_info *i = userdata;
+
+    i->underflows++;
+}
+
+static void overflow_cb(pa_stream *s, void *userdata) {
+    struct stream_info *i = userdata;
+
+    i->overflows++;
+}
+
+static void write_cb(pa_stream *s, size_t nbytes, void *userdata) {
+    struct stream_info *i = userdata;
+
+    while (nbytes > 0) {
+        size_t l = PA_MIN(nbytes, silence_length);
+
+        if (pa_stream_write(s, silence, l, NULL, 0, PA_SEEK_RELATIVE) < 0) {
+            pa_log("pa_stream_write() failed: %s", pa_strerror(pa_context_errno(context)));
+            quit(1);
+            return;
+        }
+
+        i->bytes += l;
+        nbytes -= l;
+    }
+}
+
+static void read_cb(pa_stream *s, size_t nbytes, void *userdata) {
+    struct stream_info *i = userdata;
+    const void *data;
+
+    while (pa_stream_readable_size(s) > 0) {
+        if (pa_stream_peek(s, &data, &nbytes) < 0) {
+            pa_log("pa_stream_peek() failed: %s", pa_strerror(pa_context_errno(context)));
+            quit(1);
+            return;
+        }
+
+        if (nbytes <= 0)
+            break;
+
+        i->bytes += nbytes;
+        pa_stream_drop(s);
+    }
+}
+
+static void sample_cb(pa_mainloop_api *a, pa_time_event *e, const struct timeval *tv, void *userdata) {
+    unsigned k;
+
+    if (pa_rtclock_now() - start_time >= seconds * PA_USEC_PER_SEC) {
+        quit(0);
+        return;
+    }
+
+    for (k = 0; k < n_streams; k++) {
+        pa_usec_t l;
+        int negative = 0;
+
+        if (!streams[k].ready)
+            continue;
+
+        if (pa_stream_get_latency(streams[k].stream, &l, &negative) < 0 || negative)
+            continue;
+
+        latency_sum += l;
+        latency_n++;
+        latency_max = PA_MAX(latency_max, l);
+    }
+
+    pa_context_rttime_restart(context, e, pa_rtclock_now() + SAMPLE_USEC);
+}
+
+static void stream_state_cb(pa_stream *s, void *userdata) {
+    struct stream_info *i = userdata;
+
+    switch (pa_stream_get_state(s)) {
+        case PA_STREAM_READY:
+            i->ready = TRUE;
+
+            /* Start measuring once all streams are running */
+            if (++n_ready == n_streams) {
+                start_time = pa_rtclock_now();
+                pa_context_rttime_new(context, start_time + SAMPLE_USEC, sample_cb, NULL);
+            }
+            break;
+
+        case PA_STREAM_FAILED:
+            pa_log("Stream failed: %s", pa_strerror(pa_context_errno(context)));
+            quit(1);
+            break;
+
+        default:
+            break;
+    }
+}
+
+static void context_state_cb(pa_context *c, void *userdata) {
+    unsigned k;
+
+    switch (pa_context_get_state(c)) {
+        case PA_CONTEXT_READY:
+            for (k = 0; k < n_streams; k++) {
+                char name[32];
+                int r;
+
+                pa_snprintf(name, sizeof(name), "bench %u", k);
+                pa_assert_se(streams[k].stream = pa_stream_new(c, name, &sample_spec, NULL));
+
+                pa_stream_set_state_callback(streams[k].stream, stream_state_cb, &streams[k]);
+                pa_stream_set_underflow_callback(streams[k].stream, underflow_cb, &streams[k]);
+                pa_stream_set_overflow_callback(streams[k].stream, overflow_cb, &streams[k]);
+
+                if (record) {
+                    pa_stream_set_read_callback(streams[k].stream, read_cb, &streams[k]);
+                    r = pa_stream_connect_record(streams[k].stream, sink_name, &buffer_attr, stream_flags);
+                } else {
+                    pa_stream_set_write_callback(streams[k].stream, write_cb, &streams[k]);
+                    r = pa_stream_connect_playback(streams[k].stream, sink_name, &buffer_attr, stream_flags, NULL, NULL);
+                }
+
+                if (r < 0) {
+                    pa_log("Failed to connect stream: %s", pa_strerror(pa_context_errno(c)));
+                    quit(1);
+                    return;
+                }
+            }
+            break;
+
+        case PA_CONTEXT_FAILED:
+            pa_log("Connection failed: %s", pa_strerror(pa_context_errno(c)));
+            quit(1);
+            break;
+
+        default:
+            break;
+    }
+}
+
+static uint32_t msec_to_bytes(const char *s) {
+    uint32_t msec;
+
+    if (pa_atou(s, &msec) < 0) {
+        pa_log("Invalid time: %s", s);
+        exit(1);
+    }
+
+    return (uint32_t) pa_usec_to_bytes(msec * PA_USEC_PER_MSEC, &sample_spec);
+}
+
+static void help(const char *argv0) {
+    printf("%s [options]\n\n"
+           "-h, --help                            Show this help\n"
+           "-s, --server=SERVER                   The server to connect to\n"
+           "-d, --device=DEVICE                   The sink (or source with --record) to connect to\n"
+           "-n, --streams=N                       Number of streams (defaults to 1)\n"
+           "-t, --seconds=SECONDS                 How long to run after all streams are ready (defaults to 10)\n"
+           "-r, --record                          Create record streams instead of playback streams\n"
+           "      --rate=RATE                     Sample rate (defaults to 48000)\n"
+           "      --channels=CHANNELS             Number of channels (defaults to 2)\n"
+           "      --tlength=MSEC                  Target length of the buffer\n"
+           "      --minreq=MSEC                   Minimum request\n"
+           "      --prebuf=MSEC                   Prebuffering\n"
+           "      --maxlength=MSEC                Maximum length of the buffer\n"
+           "      --fragsize=MSEC                 Fragment size (record streams)\n"
+           "      --no-adjust-latency             Don't ask the server to adjust the latency\n"
+           "\n"
+           "Buffer attributes are applied in the order given, after the sample spec.\n",
+           argv0);
+}
+
+enum {
+    ARG_RATE = 256,
+    ARG_CHANNELS,
+    ARG_TLENGTH,
+    ARG_MINREQ,
+    ARG_PREBUF,
+    ARG_MAXLENGTH,
+    ARG_FRAGSIZE,
+    ARG_NO_ADJUST_LATENCY
+};
+
+int main(int argc, char *argv[]) {
+    pa_mainloop *m;
+    const char *server = NULL;
+    uint64_t bytes = 0;
+    unsigned underflows = 0, overflows = 0, k;
+    int ret = 1, c;
+    uint32_t u;
+
+    static const struct option long_options[] = {
+        {"help",              0, NULL, 'h'},
+        {"server",            1, NULL, 's'},
+        {"device",            1, NULL, 'd'},
+        {"streams",           1, NULL, 'n'},
+        {"seconds",           1, NULL, 't'},
+        {"record",            0, NULL, 'r'},
+        {"rate",              1, NULL, ARG_RATE},
+        {"channels",          1, NULL, ARG_CHANNELS},
+        {"tlength",           1, NULL, ARG_TLENGTH},
+        {"minreq",            1, NULL, ARG_MINREQ},
+        {"prebuf",            1, NULL, ARG_PREBUF},
+        {"maxlength",         1, NULL, ARG_MAXLENGTH},
+        {"fragsize",          1, NULL, ARG_FRAGSIZE},
+        {"no-adjust-latency", 0, NULL, ARG_NO_ADJUST_LATENCY},
+        {NULL,                0, NULL, 0}
+    };
+
+    pa_log_set_level(PA_LOG_WARN);
+
+    while ((c = getopt_long(argc, argv, "hs:d:n:t:r", long_options, NULL)) != -1) {
+        switch (c) {
+            case 'h':
+                help(argv[0]);
+                return 0;
+
+            case 's':
+                server = optarg;
+                break;
+
+            case 'd':
+                sink_name = optarg;
+                break;
+
+            case 'n':
+                if (pa_atou(optarg, &n_streams) < 0 || n_streams <= 0 || n_streams > MAX_STREAMS) {
+                    pa_log("Invalid number of streams: %s", optarg);
+                    return 1;
+                }
+                break;
+
+            case 't':
+                if (pa_atou(optarg, &seconds) < 0 || seconds <= 0) {
+                    pa_log("Invalid duration: %s", optarg);
+                    return 1;
+                }
+                break;
+
+            case 'r':
+                record = TRUE;
+                break;
+
+            case ARG_RATE:
+                if (pa_atou(optarg, &u) < 0 || u <= 0 || u > PA_RATE_MAX) {
+                    pa_log("Invalid rate: %s", optarg);
+                    return 1;
+                }
+                sample_spec.rate = u;
+                break;
+
+            case ARG_CHANNELS:
+                if (pa_atou(optarg, &u) < 0 || u <= 0 || u > PA_CHANNELS_MAX) {
+                    pa_log("Invalid number of channels: %s", optarg);
+                    return 1;
+                }
+                sample_spec.channels = (uint8_t) u;
+                break;
+
+            case ARG_TLENGTH:
+                buffer_attr.tlength = msec_to_bytes(optarg);
+                break;
+
+            case ARG_MINREQ:
+                buffer_attr.minreq = msec_to_bytes(optarg);
+                break;
+
+            case ARG_PREBUF:
+                buffer_attr.prebuf = msec_to_bytes(optarg);
+                break;
+
+            case ARG_MAXLENGTH:
+                buffer_attr.maxlength = msec_to_bytes(optarg);
+                break;
+
+            case ARG_FRAGSIZE:
+                buffer_attr.fragsize = msec_to_bytes(optarg);
+                break;
+
+            case ARG_NO_ADJUST_LATENCY:
+                stream_flags &= ~PA_STREAM_ADJUST_LATENCY;
+                break;
+
+            default:
+                return 1;
+        }
+    }
+
+    silence_length = pa_usec_to_bytes(100 * PA_USEC_PER_MSEC, &sample_spec);
+    silence = pa_xmalloc(silence_length);
+    pa_silence_memory(silence, silence_length, &sample_spec);
+
+    pa_assert_se(m = pa_mainloop_new());
+    mainloop_api = pa_mainloop_get_api(m);
+
+    pa_assert_se(context = pa_context_new(mainloop_api, "stream-bench"));
+    pa_context_set_state_callback(context, context_state_cb, NULL);
+
+    if (pa_context_connect(context, server, PA_CONTEXT_NOAUTOSPAWN, NULL) < 0) {
+        pa_log("pa_context_connect() failed: %s", pa_strerror(pa_context_errno(context)));
+        goto quit;
+    }
+
+    if (pa_mainloop_run(m, NULL) < 0 || failed)
+        goto quit;
+
+    for (k = 0; k < n_streams; k++) {
+        underflows += streams[k].underflows;
+        overflows += streams[k].overflows;
+        bytes += streams[k].bytes;
+    }
+
+    printf("{\"streams\": %u, \"record\": %s, \"seconds\": %u, \"underflows\": %u, \"overflows\": %u, "
+           "\"bytes\": %llu, \"avg_latency_usec\": %llu, \"max_latency_usec\": %llu}\n",
+           n_streams, record ? "true" : "false", seconds, underflows, overflows,
+           (unsigned long long) bytes,
+           (unsigned long long) (latency_n > 0 ? latency_sum / latency_n : 0),
+           (unsigned long long) latency_max);
+
+    ret = 0;
+
+quit:
+    for (k = 0; k < n_streams; k++)
+        if (streams[k].stream) {
+            pa_stream_disconnect(streams[k].stream);
+            pa_stream_unref(streams[k].stream);
+        }
+
+    pa_context_disconnect(context);
+    pa_context_unref(context);
+    pa_mainloop_free(m);
+    pa_xfree(silence);
+
+    return ret;
+}
@@ -0,0 +1,238 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <check.h>
+
+#include <pulse/mainloop.h>
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
+#include <pulse/util.h>
+
+#include <pulsecore/atomic.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/msgobject.h>
+#include <pulsecore/rtcheck.h>
+#include <pulsecore/rtpoll.h>
+#include <pulsecore/thread.h>
+#include <pulsecore/thread-mq.h>
+
+/* The IO thread answers pings from the main thread and from a few
+ * stutter threads, which like rtstutter keep freezing for random
+ * times, also in the middle of queueing a message. None of that may
+ * make the IO thread block or allocate. */
+
+#define RUN_USEC (500 * PA_USEC_PER_MSEC)
+#define MAX_OUTSTANDING 64
+
+enum {
+    ECHO_MESSAGE_PING,
+    ECHO_MESSAGE_PONG,
+    ECHO_MESSAGE_SYNC
+};
+
+typedef struct echo {
+    pa_msgobject parent;
+} echo;
+
+PA_DEFINE_PRIVATE_CLASS(echo, pa_msgobject);
+
+static pa_thread_mq thread_mq;
+static pa_rtpoll *rtpoll;
+static echo *io_object, *main_object;
+
+static pa_atomic_t pings, outstanding, stop;
+static int pongs;
+
+static int io_process_msg(pa_msgobject *o, int code, void *data, int64_t offset, pa_memchunk *chunk) {
+    switch (code) {
+        case ECHO_MESSAGE_PING:
+            pa_asyncmsgq_post(thread_mq.outq, PA_MSGOBJECT(main_object), ECHO_MESSAGE_PONG, NULL, 0, NULL, NULL);
+            return 0;
+
+        case ECHO_MESSAGE_SYNC:
+            return 0;
+    }
+
+    return -1;
+}
+
+static int main_process_msg(pa_msgobject *o, int code, void *data, int64_t offset, pa_memchunk *chunk) {
+    pa_assert(code == ECHO_MESSAGE_PONG);
+
+    pongs++;
+    pa_atomic_dec(&outstanding);
+
+    return 0;
+}
+
+static void ping(void) {
+    pa_atomic_inc(&pings);
+    pa_atomic_inc(&outstanding);
+    pa_asyncmsgq_post(thread_mq.inq, PA_MSGOBJECT(io_object), ECHO_MESSAGE_PING, NULL, 0, NULL, NULL);
+}
+
+static void spin(pa_usec_t usec) {
+    pa_usec_t until = pa_rtclock_now() + usec;
+
+    while (pa_rtclock_now() < until)
+        ;
+}
+
+static void stutter_thread(void *userdata) {
+    unsigned seed = PA_PTR_TO_UINT(userdata);
+
+    while (!pa_atomic_load(&stop)) {
+        spin((pa_usec_t) (rand_r(&seed) % (2 * PA_USEC_PER_MSEC)));
+
+        if (pa_atomic_load(&outstanding) < MAX_OUTSTANDING)
+            ping();
+
+        pa_msleep(1);
+    }
+}
+
+static void io_thread(void *userdata) {
+    int r;
+
+    pa_thread_mq_install(&thread_mq);
+
+    /* Only works with the privileges for it, the checks are the same
+     * either way */
+    pa_make_realtime(5);
+
+    do {
+        pa_rtpoll_set_timer_relative(rtpoll, PA_USEC_PER_MSEC);
+        pa_assert_se((r = pa_rtpoll_run(rtpoll, TRUE)) >= 0);
+    } while (r > 0);
+}
+
+static echo *echo_new(int (*process_msg)(pa_msgobject *o, int code, void *data, int64_t offset, pa_memchunk *chunk)) {
+    echo *e;
+
+    e = pa_msgobject_new(echo);
+    e->parent.process_msg = process_msg;
+
+    return e;
+}
+
+START_TEST (thread_mq_test) {
+    pa_mainloop *m;
+    pa_thread *io, **stutter;
+    pa_usec_t until;
+    unsigned n, j;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    pa_rtcheck_enable();
+
+    pa_assert_se(m = pa_mainloop_new());
+    rtpoll = pa_rtpoll_new();
+    pa_thread_mq_init(&thread_mq, pa_mainloop_get_api(m), rtpoll);
+
+    io_object = echo_new(io_process_msg);
+    main_object = echo_new(main_process_msg);
+
+    fail_unless((io = pa_thread_new("thread-mq-io", io_thread, NULL)) != NULL);
+
+    n = pa_ncpus();
+    stutter = pa_xnew(pa_thread*, n);
+
+    for (j = 0; j < n; j++)
+        fail_unless((stutter[j] = pa_thread_new("thread-mq-stutter", stutter_thread, PA_UINT_TO_PTR(j + 1))) != NULL);
+
+    until = pa_rtclock_now() + RUN_USEC;
+
+    for (j = 0; pa_rtclock_now() < until; j++) {
+
+        if (pa_atomic_load(&outstanding) < MAX_OUTSTANDING)
+            ping();
+
+        /* Now and then wait for the IO thread, too */
+        if (j % 16 == 0)
+            fail_unless(pa_asyncmsgq_send(thread_mq.inq, PA_MSGOBJECT(io_object), ECHO_MESSAGE_SYNC, NULL, 0, NULL) == 0);
+
+        pa_mainloop_iterate(m, 0, NULL);
+        pa_msleep(1);
+    }
+
+    pa_atomic_store(&stop, 1);
+
+    for (j = 0; j < n; j++)
+        pa_thread_free(stutter[j]);
+
+    pa_xfree(stutter);
+
+    /* Every ping has been answered before the sync returns, the pongs
+     * only need to be read */
+    fail_unless(pa_asyncmsgq_send(thread_mq.inq, PA_MSGOBJECT(io_object), ECHO_MESSAGE_SYNC, NULL, 0, NULL) == 0);
+
+    until = pa_rtclock_now() + PA_USEC_PER_SEC;
+
+    while (pongs < pa_atomic_load(&pings) && pa_rtclock_now() < until)
+        pa_mainloop_iterate(m, 0, NULL);
+
+    pa_log_debug("%i pings answered", pongs);
+    fail_unless(pongs == pa_atomic_load(&pings));
+
+    pa_asyncmsgq_send(thread_mq.inq, NULL, PA_MESSAGE_SHUTDOWN, NULL, 0, NULL);
+    pa_thread_free(io);
+
+    fail_unless(pa_rtcheck_get_count(PA_RTCHECK_MUTEX) == 0);
+    fail_unless(pa_rtcheck_get_count(PA_RTCHECK_WAIT) == 0);
+    fail_unless(pa_rtcheck_get_count(PA_RTCHECK_ALLOC) == 0);
+    fail_unless(pa_rtcheck_get_count(PA_RTCHECK_CONTEXT_SWITCH) == 0);
+
+    pa_thread_mq_done(&thread_mq);
+    pa_rtpoll_free(rtpoll);
+
+    pa_msgobject_unref(PA_MSGOBJECT(io_object));
+    pa_msgobject_unref(PA_MSGOBJECT(main_object));
+
+    pa_mainloop_free(m);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    s = suite_create("Thread MQ");
+    tc = tcase_create("threadmq");
+    tcase_add_test(tc, thread_mq_test);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
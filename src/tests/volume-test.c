@@ -22,10 +22,12 @@
 #endif
 
 #include <stdio.h>
+#include <limits.h>
 #include <math.h>
 
 #include <check.h>
 
+#include <pulse/rtclock.h>
 #include <pulse/volume.h>
 
 #include <pulsecore/log.h>
@@ -134,6 +136,111 @@ START_TEST (volume_test) {
 }
 END_TEST
 
+#define PA_CPU_TEST_RUN_START(l, t1, t2)                        \
+{                                                               \
+    int _j, _k;                                                 \
+    int _times = (t1), _times2 = (t2);                          \
+    pa_usec_t _start, _stop;                                    \
+    pa_usec_t _min = INT_MAX, _max = 0;                         \
+    double _s1 = 0, _s2 = 0;                                    \
+    const char *_label = (l);                                   \
+                                                                \
+    for (_k = 0; _k < _times2; _k++) {                          \
+        _start = pa_rtclock_now();                              \
+        for (_j = 0; _j < _times; _j++)
+
+#define PA_CPU_TEST_RUN_STOP                                    \
+        _stop = pa_rtclock_now();                               \
+                                                                \
+        if (_min > (_stop - _start)) _min = _stop - _start;     \
+        if (_max < (_stop - _start)) _max = _stop - _start;     \
+        _s1 += _stop - _start;                                  \
+        _s2 += (_stop - _start) * (_stop - _start);             \
+    }                                                           \
+    pa_log_debug("%s: %llu usec (avg: %g, min = %llu, max = %llu, stddev = %g).", _label, \
+            (long long unsigned int)_s1,                        \
+            ((double)_s1 / _times2),                            \
+            (long long unsigned int)_min,                       \
+            (long long unsigned int)_max,                       \
+            sqrt(_times2 * _s2 - _s1 * _s1) / _times2);         \
+}
+
+#define TIMES 100
+#define TIMES2 100
+#define N_STREAMS 100
+
+/* What pa_sw_volume_from_dB() and pa_sw_volume_to_dB() used to do */
+static pa_volume_t ref_volume_from_dB(double dB) {
+    if (isinf(dB) < 0 || dB <= PA_DECIBEL_MININFTY)
+        return PA_VOLUME_MUTED;
+
+    return pa_sw_volume_from_linear(pow(10.0, dB / 20.0));
+}
+
+static double ref_volume_to_dB(pa_volume_t v) {
+    if (v <= PA_VOLUME_MUTED)
+        return PA_DECIBEL_MININFTY;
+
+    return 20.0 * log10(pa_sw_volume_to_linear(v));
+}
+
+START_TEST (volume_benchmark) {
+    pa_volume_t v;
+    pa_cvolume streams[N_STREAMS], sink, ratio;
+    unsigned i;
+    double dB;
+    pa_volume_t sum1 = 0, sum2 = 0;
+    double dsum1 = 0, dsum2 = 0;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    for (v = PA_VOLUME_MUTED; v <= PA_VOLUME_NORM*2; v++) {
+        fail_unless(pa_sw_volume_from_dB(pa_sw_volume_to_dB(v)) == v);
+        fail_unless(v == PA_VOLUME_MUTED || fabs(pa_sw_volume_to_dB(v) - ref_volume_to_dB(v)) < 1e-9);
+    }
+
+    for (dB = -120.0; dB < 20.0; dB += 0.0137)
+        fail_unless(pa_sw_volume_from_dB(dB) == ref_volume_from_dB(dB));
+
+    PA_CPU_TEST_RUN_START("from_dB (pow + cbrt)", TIMES, TIMES2) {
+        for (v = 0; v < 1000; v++)
+            sum1 += ref_volume_from_dB(-(double) v / 10.0);
+    } PA_CPU_TEST_RUN_STOP
+
+    PA_CPU_TEST_RUN_START("from_dB", TIMES, TIMES2) {
+        for (v = 0; v < 1000; v++)
+            sum2 += pa_sw_volume_from_dB(-(double) v / 10.0);
+    } PA_CPU_TEST_RUN_STOP
+
+    PA_CPU_TEST_RUN_START("to_dB (cube + log10)", TIMES, TIMES2) {
+        for (v = 1; v <= 1000; v++)
+            dsum1 += ref_volume_to_dB(v * 64);
+    } PA_CPU_TEST_RUN_STOP
+
+    PA_CPU_TEST_RUN_START("to_dB", TIMES, TIMES2) {
+        for (v = 1; v <= 1000; v++)
+            dsum2 += pa_sw_volume_to_dB(v * 64);
+    } PA_CPU_TEST_RUN_STOP
+
+    fail_unless(sum1 == sum2);
+    fail_unless(fabs(dsum1 - dsum2) < 1e-3);
+
+    /* A flat volume recompute: the ratio of every stream against the
+     * sink, which is pure integer math */
+    pa_cvolume_set(&sink, 8, PA_VOLUME_NORM / 2);
+    for (i = 0; i < N_STREAMS; i++)
+        pa_cvolume_set(&streams[i], 8, (pa_volume_t) (PA_VOLUME_NORM / (i + 1)));
+
+    PA_CPU_TEST_RUN_START("flat volume ratios", TIMES, TIMES2) {
+        for (i = 0; i < N_STREAMS; i++) {
+            pa_sw_cvolume_divide(&ratio, &streams[i], &sink);
+            pa_sw_cvolume_multiply(&ratio, &ratio, &sink);
+        }
+    } PA_CPU_TEST_RUN_STOP
+}
+END_TEST
+
 int main(int argc, char *argv[]) {
     int failed = 0;
     Suite *s;
@@ -143,6 +250,7 @@ int main(int argc, char *argv[]) {
     s = suite_create("Volume");
     tc = tcase_create("volume");
     tcase_add_test(tc, volume_test);
+    tcase_add_test(tc, volume_benchmark);
     tcase_set_timeout(tc, 120);
     suite_add_tcase(s, tc);
 
@@ -34,6 +34,7 @@
 #include <getopt.h>
 #include <fcntl.h>
 #include <locale.h>
+#include <sys/stat.h>
 
 #include <sndfile.h>
 
@@ -60,6 +61,14 @@ static pa_mainloop_api *mainloop_api = NULL;
 static void *buffer = NULL;
 static size_t buffer_length = 0, buffer_index = 0;
 
+/* When recording the buffer is kept around between writes, this is
+ * how much of it is allocated */
+static size_t buffer_size = 0;
+
+/* Read and write the file in blocks of at least this size */
+static size_t file_buffer = 0;
+static pa_bool_t output_is_regular_file = FALSE;
+
 static void *silence_buffer = NULL;
 static size_t silence_buffer_length = 0;
 
@@ -97,6 +106,9 @@ static int file_format = -1;
 
 static uint32_t cork_requests = 0;
 
+static pa_bool_t stats = FALSE;
+static uint64_t stats_bytes = 0, stats_callbacks = 0, stats_file_io = 0, stats_wakeups = 0;
+
 /* A shortcut for terminating the application */
 static void quit(int ret) {
     pa_assert(mainloop_api);
@@ -170,6 +182,7 @@ static void do_stream_write(size_t length) {
         return;
     }
 
+    stats_bytes += l;
     buffer_length -= l;
     buffer_index += l;
 
@@ -185,6 +198,8 @@ static void stream_write_callback(pa_stream *s, size_t length, void *userdata) {
     pa_assert(s);
     pa_assert(length > 0);
 
+    stats_callbacks++;
+
     if (raw) {
         pa_assert(!sndfile);
 
@@ -220,9 +235,12 @@ static void stream_write_callback(pa_stream *s, size_t length, void *userdata) {
             } else
                 bytes = sf_read_raw(sndfile, data, (sf_count_t) data_length);
 
-            if (bytes > 0)
+            stats_file_io++;
+
+            if (bytes > 0) {
                 pa_stream_write(s, data, (size_t) bytes, NULL, 0, PA_SEEK_RELATIVE);
-            else
+                stats_bytes += (uint64_t) bytes;
+            } else
                 pa_stream_cancel_write(s);
 
             /* EOF? */
@@ -240,18 +258,82 @@ static void stream_write_callback(pa_stream *s, size_t length, void *userdata) {
     }
 }
 
+/* Append recorded data to the buffer, silence if data is NULL */
+static void buffer_append(const void *data, size_t length) {
+
+    if (buffer_index + buffer_length + length > buffer_size) {
+
+        /* Move what is left to the front before making the buffer any larger */
+        if (buffer_index > 0 && buffer_length > 0)
+            memmove(buffer, (uint8_t*) buffer + buffer_index, buffer_length);
+        buffer_index = 0;
+
+        if (buffer_length + length > buffer_size) {
+            buffer_size = PA_MAX(buffer_length + length, PA_MAX(buffer_size * 2, file_buffer));
+            buffer = pa_xrealloc(buffer, buffer_size);
+        }
+    }
+
+    if (data)
+        memcpy((uint8_t*) buffer + buffer_index + buffer_length, data, length);
+    else
+        pa_silence_memory((uint8_t*) buffer + buffer_index + buffer_length, length, &sample_spec);
+
+    buffer_length += length;
+}
+
+/* Recorded data has been written to the file */
+static void buffer_written(void) {
+
+#ifdef HAVE_POSIX_FADVISE
+    /* Nobody is going to read a long recording back right away, so don't
+     * let it push everything else out of the page cache. This only drops
+     * what has already been written back. */
+    if (output_is_regular_file && file_buffer > 0)
+        posix_fadvise(STDOUT_FILENO, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+}
+
+static pa_bool_t sndfile_write(const void *data, size_t length) {
+    sf_count_t bytes;
+
+    if (writef_function) {
+        size_t k = pa_frame_size(&sample_spec);
+
+        if ((bytes = writef_function(sndfile, data, (sf_count_t) (length/k))) > 0)
+            bytes *= (sf_count_t) k;
+
+    } else
+        bytes = sf_write_raw(sndfile, data, (sf_count_t) length);
+
+    stats_file_io++;
+
+    return bytes >= (sf_count_t) length;
+}
+
+static void sndfile_write_buffer(void) {
+
+    if (!buffer_length)
+        return;
+
+    if (!sndfile_write((uint8_t*) buffer + buffer_index, buffer_length))
+        quit(1);
+
+    buffer_index = buffer_length = 0;
+    buffer_written();
+}
+
 /* This is called whenever new data may is available */
 static void stream_read_callback(pa_stream *s, size_t length, void *userdata) {
 
     pa_assert(s);
     pa_assert(length > 0);
 
+    stats_callbacks++;
+
     if (raw) {
         pa_assert(!sndfile);
 
-        if (stdio_event)
-            mainloop_api->io_enable(stdio_event, PA_IO_EVENT_OUTPUT);
-
         while (pa_stream_readable_size(s) > 0) {
             const void *data;
 
@@ -266,23 +348,22 @@ static void stream_read_callback(pa_stream *s, size_t length, void *userdata) {
             /* If there is a hole in the stream, we generate silence, except
              * if it's a passthrough stream in which case we skip the hole. */
             if (data || !(flags & PA_STREAM_PASSTHROUGH)) {
-                buffer = pa_xrealloc(buffer, buffer_length + length);
-                if (data)
-                    memcpy((uint8_t *) buffer + buffer_length, data, length);
-                else
-                    pa_silence_memory((uint8_t *) buffer + buffer_length, length, &sample_spec);
-
-                buffer_length += length;
+                buffer_append(data, length);
+                stats_bytes += length;
             }
 
             pa_stream_drop(s);
         }
 
+        /* With a file buffer wait until it is full, that way the file
+         * is written in large blocks and we wake up less often */
+        if (stdio_event && buffer_length > 0 && buffer_length >= file_buffer)
+            mainloop_api->io_enable(stdio_event, PA_IO_EVENT_OUTPUT);
+
     } else {
         pa_assert(sndfile);
 
         while (pa_stream_readable_size(s) > 0) {
-            sf_count_t bytes;
             const void *data;
 
             if (pa_stream_peek(s, &data, &length) < 0) {
@@ -298,26 +379,28 @@ static void stream_read_callback(pa_stream *s, size_t length, void *userdata) {
                 continue;
             }
 
+            stats_bytes += length;
+
+            if (file_buffer > 0) {
+                buffer_append(data, length);
+                pa_stream_drop(s);
+                continue;
+            }
+
             if (!data && length > silence_buffer_length) {
                 silence_buffer = pa_xrealloc(silence_buffer, length);
                 pa_silence_memory((uint8_t *) silence_buffer + silence_buffer_length, length - silence_buffer_length, &sample_spec);
                 silence_buffer_length = length;
             }
 
-            if (writef_function) {
-                size_t k = pa_frame_size(&sample_spec);
-
-                if ((bytes = writef_function(sndfile, data ? data : silence_buffer, (sf_count_t) (length/k))) > 0)
-                    bytes *= (sf_count_t) k;
-
-            } else
-                bytes = sf_write_raw(sndfile, data ? data : silence_buffer, (sf_count_t) length);
-
-            if (bytes < (sf_count_t) length)
+            if (!sndfile_write(data ? data : silence_buffer, length))
                 quit(1);
 
             pa_stream_drop(s);
         }
+
+        if (buffer_length >= file_buffer)
+            sndfile_write_buffer();
     }
 }
 
@@ -551,8 +634,15 @@ static void stdin_callback(pa_mainloop_api*a, pa_io_event *e, int fd, pa_io_even
     if (!stream || pa_stream_get_state(stream) != PA_STREAM_READY || !(l = w = pa_stream_writable_size(stream)))
         l = 4096;
 
+    /* Whatever doesn't fit into the stream right away is written from
+     * stream_write_callback() later on */
+    if (l < file_buffer)
+        l = file_buffer;
+
     buffer = pa_xmalloc(l);
 
+    stats_file_io++;
+
     if ((r = pa_read(fd, buffer, l, userdata)) <= 0) {
         if (r == 0) {
             if (verbose)
@@ -585,12 +675,12 @@ static void stdout_callback(pa_mainloop_api*a, pa_io_event *e, int fd, pa_io_eve
     pa_assert(e);
     pa_assert(stdio_event == e);
 
-    if (!buffer) {
+    if (!buffer_length) {
         mainloop_api->io_enable(stdio_event, PA_IO_EVENT_NULL);
         return;
     }
 
-    pa_assert(buffer_length);
+    stats_file_io++;
 
     if ((r = pa_write(fd, (uint8_t*) buffer+buffer_index, buffer_length, userdata)) <= 0) {
         pa_log(_("write() failed: %s"), strerror(errno));
@@ -604,10 +694,12 @@ static void stdout_callback(pa_mainloop_api*a, pa_io_event *e, int fd, pa_io_eve
     buffer_length -= (uint32_t) r;
     buffer_index += (uint32_t) r;
 
+    /* Keep the buffer for the next time, and don't wake up again
+     * before there is something new to write */
     if (!buffer_length) {
-        pa_xfree(buffer);
-        buffer = NULL;
-        buffer_length = buffer_index = 0;
+        buffer_index = 0;
+        mainloop_api->io_enable(stdio_event, PA_IO_EVENT_NULL);
+        buffer_written();
     }
 }
 
@@ -698,7 +790,9 @@ static void help(const char *argv0) {
              "      --raw                             Record/play raw PCM data.\n"
              "      --passthrough                     passthrough data \n"
              "      --file-format[=FFORMAT]           Record/play formatted PCM data.\n"
-             "      --list-file-formats               List available file formats.\n")
+             "      --list-file-formats               List available file formats.\n"
+             "      --file-buffer=BYTES               Read or write the file in blocks of at least this size.\n"
+             "      --stats                           Show the throughput and the number of wakeups on exit.\n")
            , argv0);
 }
 
@@ -723,12 +817,15 @@ enum {
     ARG_FILE_FORMAT,
     ARG_LIST_FILE_FORMATS,
     ARG_LATENCY_MSEC,
-    ARG_PROCESS_TIME_MSEC
+    ARG_PROCESS_TIME_MSEC,
+    ARG_FILE_BUFFER,
+    ARG_STATS
 };
 
 int main(int argc, char *argv[]) {
     pa_mainloop* m = NULL;
-    int ret = 1, c;
+    int ret = 1, c, r;
+    pa_usec_t start = 0;
     char *bn, *server = NULL;
     pa_time_event *time_event = NULL;
     const char *filename = NULL;
@@ -764,6 +861,8 @@ int main(int argc, char *argv[]) {
         {"list-file-formats", 0, NULL, ARG_LIST_FILE_FORMATS},
         {"latency-msec", 1, NULL, ARG_LATENCY_MSEC},
         {"process-time-msec", 1, NULL, ARG_PROCESS_TIME_MSEC},
+        {"file-buffer",  1, NULL, ARG_FILE_BUFFER},
+        {"stats",        0, NULL, ARG_STATS},
         {NULL,           0, NULL, 0}
     };
 
@@ -939,6 +1038,17 @@ int main(int argc, char *argv[]) {
                 }
                 break;
 
+            case ARG_FILE_BUFFER:
+                if (((file_buffer = (size_t) atoi(optarg))) <= 0) {
+                    pa_log(_("Invalid file buffer size '%s'"), optarg);
+                    goto quit;
+                }
+                break;
+
+            case ARG_STATS:
+                stats = TRUE;
+                break;
+
             case ARG_PROPERTY: {
                 char *t;
 
@@ -1010,6 +1120,12 @@ int main(int argc, char *argv[]) {
         goto quit;
     }
 
+    if (mode == RECORD) {
+        struct stat st;
+
+        output_is_regular_file = fstat(STDOUT_FILENO, &st) == 0 && S_ISREG(st.st_mode);
+    }
+
     if (!raw) {
         SF_INFO sfi;
         pa_zero(sfi);
@@ -1179,12 +1295,39 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    /* Run the main loop */
-    if (pa_mainloop_run(m, &ret) < 0) {
+    start = pa_rtclock_now();
+
+    /* Run the main loop. This is pa_mainloop_run(), but counting the
+     * iterations for --stats */
+    while ((r = pa_mainloop_iterate(m, 1, &ret)) >= 0)
+        stats_wakeups++;
+
+    if (r != -2) {
         pa_log(_("pa_mainloop_run() failed."));
         goto quit;
     }
 
+    /* Write out what is still waiting in the file buffer */
+    if (mode == RECORD && buffer_length > 0 && (sndfile || stdio_event)) {
+        if (sndfile)
+            sndfile_write_buffer();
+        else if (pa_loop_write(STDOUT_FILENO, (uint8_t*) buffer + buffer_index, buffer_length, NULL) < 0)
+            pa_log(_("write() failed: %s"), strerror(errno));
+        else
+            stats_file_io++;
+    }
+
+    if (stats) {
+        double t = (double) (pa_rtclock_now() - start) / PA_USEC_PER_SEC;
+
+        pa_log(_("%llu bytes in %0.1f s (%0.1f KiB/s), %llu main loop wakeups, %llu stream callbacks, %llu file reads or writes."),
+               (unsigned long long) stats_bytes, t,
+               t > 0 ? (double) stats_bytes / 1024 / t : 0.0,
+               (unsigned long long) stats_wakeups,
+               (unsigned long long) stats_callbacks,
+               (unsigned long long) stats_file_io);
+    }
+
 quit:
     if (stream)
         pa_stream_unref(stream);
@@ -41,6 +41,7 @@
 
 #include <pulsecore/i18n.h>
 #include <pulsecore/macro.h>
+#include <pulsecore/core-error.h>
 #include <pulsecore/core-util.h>
 #include <pulsecore/log.h>
 #include <pulsecore/sndfile-util.h>
@@ -96,6 +97,18 @@ static size_t sample_length = 0;
 static int actions = 1;
 
 static pa_bool_t nl = FALSE;
+static pa_bool_t verbose = FALSE;
+
+/* --batch: the commands are read from batch_file and sent over one
+ * connection. batch_line is the line of the command that is being
+ * issued, 0 if not batching. */
+static pa_bool_t batch = FALSE;
+static FILE *batch_file = NULL;
+static unsigned batch_line = 0;
+static char **batch_argv = NULL;
+static int batch_argc = 0;
+static pa_bool_t batch_waiting = FALSE;
+static pa_bool_t batch_failed = FALSE;
 
 static enum {
     NONE,
@@ -148,18 +161,50 @@ static void drain(void) {
         pa_operation_unref(o);
 }
 
+static void run_batch(pa_context *c);
+static int parse_command(int argc, char *argv[]);
+
 static void complete_action(void) {
     pa_assert(actions > 0);
 
     if (!(--actions))
         drain();
+    else if (batch_waiting && actions == 1) {
+        /* Only the batch itself is left, go on with the next command */
+        batch_waiting = FALSE;
+        run_batch(context);
+    }
+}
+
+/* In batch mode every command that changes something reports one
+ * status line, tagged with its line number */
+static void batch_status(void *userdata, const char *error) {
+    pa_assert(batch);
+
+    if (error) {
+        printf("%u: Failure: %s\n", PA_PTR_TO_UINT(userdata), error);
+        batch_failed = TRUE;
+    } else
+        printf("%u: OK\n", PA_PTR_TO_UINT(userdata));
+}
+
+/* A query failed. That ends the whole run, except when batching where
+ * only the command it belongs to fails. */
+static void query_failed(pa_context *c, void *userdata) {
+    if (!batch) {
+        quit(1);
+        return;
+    }
+
+    batch_status(userdata, pa_strerror(pa_context_errno(c)));
+    complete_action();
 }
 
 static void stat_callback(pa_context *c, const pa_stat_info *i, void *userdata) {
     char s[PA_BYTES_SNPRINT_MAX];
     if (!i) {
         pa_log(_("Failed to get statistics: %s"), pa_strerror(pa_context_errno(c)));
-        quit(1);
+        query_failed(c, userdata);
         return;
     }
 
@@ -172,15 +217,84 @@ static void stat_callback(pa_context *c, const pa_stat_info *i, void *userdata)
     pa_bytes_snprint(s, sizeof(s), i->scache_size);
     printf(_("Sample cache size: %s\n"), s);
 
+    if (i->mempool_page_size > 0) {
+        pa_bytes_snprint(s, sizeof(s), i->mempool_page_size);
+        printf(_("Memory pool page size: %s, locked: %s\n"), s, pa_yes_no(i->mempool_locked));
+    }
+
+    if (i->memory_trims > 0) {
+        pa_bytes_snprint(s, sizeof(s), (unsigned) i->memory_trimmed);
+        printf(_("Memory given back by idle trimming: %s in %u runs\n"), s, i->memory_trims);
+    }
+
     complete_action();
 }
 
-static void get_server_info_callback(pa_context *c, const pa_server_info *i, void *useerdata) {
+/* Prints the memory.* properties the server adds for modules and clients */
+static void print_memory(const char *what, uint32_t idx, const char *name, pa_proplist *p) {
+    const char *v;
+    uint32_t n_allocated = 0, allocated = 0, imported = 0, exported = 0;
+    char a[PA_BYTES_SNPRINT_MAX], i[PA_BYTES_SNPRINT_MAX], e[PA_BYTES_SNPRINT_MAX];
+
+    if (!(v = pa_proplist_gets(p, "memory.allocated")) || pa_atou(v, &n_allocated) < 0)
+        return;
+
+    if ((v = pa_proplist_gets(p, "memory.allocated-bytes")))
+        pa_atou(v, &allocated);
+    if ((v = pa_proplist_gets(p, "memory.imported-bytes")))
+        pa_atou(v, &imported);
+    if ((v = pa_proplist_gets(p, "memory.exported-bytes")))
+        pa_atou(v, &exported);
+
+    printf(_("%s #%u (%s): %u blocks, %s allocated, %s imported, %s exported\n"),
+           what, idx, pa_strnull(name), n_allocated,
+           pa_bytes_snprint(a, sizeof(a), allocated),
+           pa_bytes_snprint(i, sizeof(i), imported),
+           pa_bytes_snprint(e, sizeof(e), exported));
+}
+
+static void stat_module_callback(pa_context *c, const pa_module_info *i, int is_last, void *userdata) {
+
+    if (is_last < 0) {
+        pa_log(_("Failed to get module information: %s"), pa_strerror(pa_context_errno(c)));
+        query_failed(c, userdata);
+        return;
+    }
+
+    if (is_last) {
+        complete_action();
+        return;
+    }
+
+    pa_assert(i);
+
+    print_memory(_("Module"), i->index, i->name, i->proplist);
+}
+
+static void stat_client_callback(pa_context *c, const pa_client_info *i, int is_last, void *userdata) {
+
+    if (is_last < 0) {
+        pa_log(_("Failed to get client information: %s"), pa_strerror(pa_context_errno(c)));
+        query_failed(c, userdata);
+        return;
+    }
+
+    if (is_last) {
+        complete_action();
+        return;
+    }
+
+    pa_assert(i);
+
+    print_memory(_("Client"), i->index, i->name, i->proplist);
+}
+
+static void get_server_info_callback(pa_context *c, const pa_server_info *i, void *userdata) {
     char ss[PA_SAMPLE_SPEC_SNPRINT_MAX], cm[PA_CHANNEL_MAP_SNPRINT_MAX];
 
     if (!i) {
         pa_log(_("Failed to get server information: %s"), pa_strerror(pa_context_errno(c)));
-        quit(1);
+        query_failed(c, userdata);
         return;
     }
 
@@ -252,7 +366,7 @@ static void get_sink_info_callback(pa_context *c, const pa_sink_info *i, int is_
 
     if (is_last < 0) {
         pa_log(_("Failed to get sink information: %s"), pa_strerror(pa_context_errno(c)));
-        quit(1);
+        query_failed(c, userdata);
         return;
     }
 
@@ -365,7 +479,7 @@ static void get_source_info_callback(pa_context *c, const pa_source_info *i, int
 
     if (is_last < 0) {
         pa_log(_("Failed to get source information: %s"), pa_strerror(pa_context_errno(c)));
-        quit(1);
+        query_failed(c, userdata);
         return;
     }
 
@@ -462,7 +576,7 @@ static void get_module_info_callback(pa_context *c, const pa_module_info *i, int
 
     if (is_last < 0) {
         pa_log(_("Failed to get module information: %s"), pa_strerror(pa_context_errno(c)));
-        quit(1);
+        query_failed(c, userdata);
         return;
     }
 
@@ -504,7 +618,7 @@ static void get_client_info_callback(pa_context *c, const pa_client_info *i, int
 
     if (is_last < 0) {
         pa_log(_("Failed to get client information: %s"), pa_strerror(pa_context_errno(c)));
-        quit(1);
+        query_failed(c, userdata);
         return;
     }
 
@@ -628,7 +742,7 @@ static void get_sink_input_info_callback(pa_context *c, const pa_sink_input_info
 
     if (is_last < 0) {
         pa_log(_("Failed to get sink input information: %s"), pa_strerror(pa_context_errno(c)));
-        quit(1);
+        query_failed(c, userdata);
         return;
     }
 
@@ -700,7 +814,7 @@ static void get_source_output_info_callback(pa_context *c, const pa_source_outpu
 
     if (is_last < 0) {
         pa_log(_("Failed to get source output information: %s"), pa_strerror(pa_context_errno(c)));
-        quit(1);
+        query_failed(c, userdata);
         return;
     }
 
@@ -772,7 +886,7 @@ static void get_sample_info_callback(pa_context *c, const pa_sample_info *i, int
 
     if (is_last < 0) {
         pa_log(_("Failed to get sample information: %s"), pa_strerror(pa_context_errno(c)));
-        quit(1);
+        query_failed(c, userdata);
         return;
     }
 
@@ -827,7 +941,10 @@ static void get_sample_info_callback(pa_context *c, const pa_sample_info *i, int
 }
 
 static void simple_callback(pa_context *c, int success, void *userdata) {
-    if (!success) {
+
+    if (batch)
+        batch_status(userdata, success ? NULL : pa_strerror(pa_context_errno(c)));
+    else if (!success) {
         pa_log(_("Failure: %s"), pa_strerror(pa_context_errno(c)));
         quit(1);
         return;
@@ -837,13 +954,19 @@ static void simple_callback(pa_context *c, int success, void *userdata) {
 }
 
 static void index_callback(pa_context *c, uint32_t idx, void *userdata) {
-    if (idx == PA_INVALID_INDEX) {
+
+    if (batch) {
+        if (idx == PA_INVALID_INDEX)
+            batch_status(userdata, pa_strerror(pa_context_errno(c)));
+        else
+            printf("%u: OK %u\n", PA_PTR_TO_UINT(userdata), idx);
+
+    } else if (idx == PA_INVALID_INDEX) {
         pa_log(_("Failure: %s"), pa_strerror(pa_context_errno(c)));
         quit(1);
         return;
-    }
-
-    printf("%u\n", idx);
+    } else
+        printf("%u\n", idx);
 
     complete_action();
 }
@@ -868,13 +991,17 @@ static void unload_module_by_name_callback(pa_context *c, const pa_module_info *
 
     if (is_last < 0) {
         pa_log(_("Failed to get module information: %s"), pa_strerror(pa_context_errno(c)));
-        quit(1);
+        query_failed(c, userdata);
         return;
     }
 
     if (is_last) {
-        if (unloaded == FALSE)
+        if (unloaded == FALSE) {
             pa_log(_("Failed to unload module: Module %s not loaded"), module_name);
+            if (batch)
+                batch_status(userdata, pa_strerror(PA_ERR_NOENTITY));
+        }
+        unloaded = FALSE;
         complete_action();
         return;
     }
@@ -884,7 +1011,7 @@ static void unload_module_by_name_callback(pa_context *c, const pa_module_info *
     if (pa_streq(module_name, i->name)) {
         unloaded = TRUE;
         actions++;
-        pa_operation_unref(pa_context_unload_module(c, i->index, simple_callback, NULL));
+        pa_operation_unref(pa_context_unload_module(c, i->index, simple_callback, userdata));
     }
 }
 
@@ -893,7 +1020,7 @@ static void get_sink_volume_callback(pa_context *c, const pa_sink_info *i, int i
 
     if (is_last < 0) {
         pa_log(_("Failed to get sink information: %s"), pa_strerror(pa_context_errno(c)));
-        quit(1);
+        query_failed(c, userdata);
         return;
     }
 
@@ -904,7 +1031,7 @@ static void get_sink_volume_callback(pa_context *c, const pa_sink_info *i, int i
 
     cv = i->volume;
     volume_relative_adjust(&cv);
-    pa_operation_unref(pa_context_set_sink_volume_by_name(c, sink_name, &cv, simple_callback, NULL));
+    pa_operation_unref(pa_context_set_sink_volume_by_name(c, sink_name, &cv, simple_callback, userdata));
 }
 
 static void get_source_volume_callback(pa_context *c, const pa_source_info *i, int is_last, void *userdata) {
@@ -912,7 +1039,7 @@ static void get_source_volume_callback(pa_context *c, const pa_source_info *i, i
 
     if (is_last < 0) {
         pa_log(_("Failed to get source information: %s"), pa_strerror(pa_context_errno(c)));
-        quit(1);
+        query_failed(c, userdata);
         return;
     }
 
@@ -923,7 +1050,7 @@ static void get_source_volume_callback(pa_context *c, const pa_source_info *i, i
 
     cv = i->volume;
     volume_relative_adjust(&cv);
-    pa_operation_unref(pa_context_set_source_volume_by_name(c, source_name, &cv, simple_callback, NULL));
+    pa_operation_unref(pa_context_set_source_volume_by_name(c, source_name, &cv, simple_callback, userdata));
 }
 
 static void get_sink_input_volume_callback(pa_context *c, const pa_sink_input_info *i, int is_last, void *userdata) {
@@ -931,7 +1058,7 @@ static void get_sink_input_volume_callback(pa_context *c, const pa_sink_input_in
 
     if (is_last < 0) {
         pa_log(_("Failed to get sink input information: %s"), pa_strerror(pa_context_errno(c)));
-        quit(1);
+        query_failed(c, userdata);
         return;
     }
 
@@ -942,7 +1069,7 @@ static void get_sink_input_volume_callback(pa_context *c, const pa_sink_input_in
 
     cv = i->volume;
     volume_relative_adjust(&cv);
-    pa_operation_unref(pa_context_set_sink_input_volume(c, sink_input_idx, &cv, simple_callback, NULL));
+    pa_operation_unref(pa_context_set_sink_input_volume(c, sink_input_idx, &cv, simple_callback, userdata));
 }
 
 static void get_source_output_volume_callback(pa_context *c, const pa_source_output_info *o, int is_last, void *userdata) {
@@ -950,7 +1077,7 @@ static void get_source_output_volume_callback(pa_context *c, const pa_source_out
 
     if (is_last < 0) {
         pa_log(_("Failed to get source output information: %s"), pa_strerror(pa_context_errno(c)));
-        quit(1);
+        query_failed(c, userdata);
         return;
     }
 
@@ -961,13 +1088,13 @@ static void get_source_output_volume_callback(pa_context *c, const pa_source_out
 
     cv = o->volume;
     volume_relative_adjust(&cv);
-    pa_operation_unref(pa_context_set_source_output_volume(c, source_output_idx, &cv, simple_callback, NULL));
+    pa_operation_unref(pa_context_set_source_output_volume(c, source_output_idx, &cv, simple_callback, userdata));
 }
 
 static void sink_toggle_mute_callback(pa_context *c, const pa_sink_info *i, int is_last, void *userdata) {
     if (is_last < 0) {
         pa_log(_("Failed to get sink information: %s"), pa_strerror(pa_context_errno(c)));
-        quit(1);
+        query_failed(c, userdata);
         return;
     }
 
@@ -976,13 +1103,13 @@ static void sink_toggle_mute_callback(pa_context *c, const pa_sink_info *i, int
 
     pa_assert(i);
 
-    pa_operation_unref(pa_context_set_sink_mute_by_name(c, i->name, !i->mute, simple_callback, NULL));
+    pa_operation_unref(pa_context_set_sink_mute_by_name(c, i->name, !i->mute, simple_callback, userdata));
 }
 
 static void source_toggle_mute_callback(pa_context *c, const pa_source_info *o, int is_last, void *userdata) {
     if (is_last < 0) {
         pa_log(_("Failed to get source information: %s"), pa_strerror(pa_context_errno(c)));
-        quit(1);
+        query_failed(c, userdata);
         return;
     }
 
@@ -991,13 +1118,13 @@ static void source_toggle_mute_callback(pa_context *c, const pa_source_info *o,
 
     pa_assert(o);
 
-    pa_operation_unref(pa_context_set_source_mute_by_name(c, o->name, !o->mute, simple_callback, NULL));
+    pa_operation_unref(pa_context_set_source_mute_by_name(c, o->name, !o->mute, simple_callback, userdata));
 }
 
 static void sink_input_toggle_mute_callback(pa_context *c, const pa_sink_input_info *i, int is_last, void *userdata) {
     if (is_last < 0) {
         pa_log(_("Failed to get sink input information: %s"), pa_strerror(pa_context_errno(c)));
-        quit(1);
+        query_failed(c, userdata);
         return;
     }
 
@@ -1006,13 +1133,13 @@ static void sink_input_toggle_mute_callback(pa_context *c, const pa_sink_input_i
 
     pa_assert(i);
 
-    pa_operation_unref(pa_context_set_sink_input_mute(c, i->index, !i->mute, simple_callback, NULL));
+    pa_operation_unref(pa_context_set_sink_input_mute(c, i->index, !i->mute, simple_callback, userdata));
 }
 
 static void source_output_toggle_mute_callback(pa_context *c, const pa_source_output_info *o, int is_last, void *userdata) {
     if (is_last < 0) {
         pa_log(_("Failed to get source output information: %s"), pa_strerror(pa_context_errno(c)));
-        quit(1);
+        query_failed(c, userdata);
         return;
     }
 
@@ -1021,7 +1148,7 @@ static void source_output_toggle_mute_callback(pa_context *c, const pa_source_ou
 
     pa_assert(o);
 
-    pa_operation_unref(pa_context_set_source_output_mute(c, o->index, !o->mute, simple_callback, NULL));
+    pa_operation_unref(pa_context_set_source_output_mute(c, o->index, !o->mute, simple_callback, userdata));
 }
 
 /* PA_MAX_FORMATS is defined in internal.h so we just define a sane value here */
@@ -1045,7 +1172,7 @@ static void set_sink_formats(pa_context *c, uint32_t sink, const char *str) {
         pa_xfree(format);
     }
 
-    pa_operation_unref(pa_ext_device_restore_save_formats(c, PA_DEVICE_TYPE_SINK, sink, i, f_arr, simple_callback, NULL));
+    pa_operation_unref(pa_ext_device_restore_save_formats(c, PA_DEVICE_TYPE_SINK, sink, i, f_arr, simple_callback, PA_UINT_TO_PTR(batch_line)));
 
 done:
     if (format)
@@ -1071,7 +1198,7 @@ static void stream_state_callback(pa_stream *s, void *userdata) {
             break;
 
         case PA_STREAM_TERMINATED:
-            drain();
+            complete_action();
             break;
 
         case PA_STREAM_FAILED:
@@ -1170,6 +1297,384 @@ static void context_subscribe_callback(pa_context *c, pa_subscription_event_type
     fflush(stdout);
 }
 
+/* Send the requests for the command that has been parsed last */
+static void run_action(pa_context *c) {
+
+    switch (action) {
+        case STAT:
+            pa_operation_unref(pa_context_stat(c, stat_callback, PA_UINT_TO_PTR(batch_line)));
+            if (verbose) {
+                pa_operation_unref(pa_context_get_module_info_list(c, stat_module_callback, PA_UINT_TO_PTR(batch_line)));
+                pa_operation_unref(pa_context_get_client_info_list(c, stat_client_callback, PA_UINT_TO_PTR(batch_line)));
+                actions += 2;
+            }
+            if (short_list_format)
+                break;
+            actions++;
+
+        case INFO:
+            pa_operation_unref(pa_context_get_server_info(c, get_server_info_callback, PA_UINT_TO_PTR(batch_line)));
+            break;
+
+        case PLAY_SAMPLE:
+            pa_operation_unref(pa_context_play_sample(c, sample_name, sink_name, PA_VOLUME_NORM, simple_callback, PA_UINT_TO_PTR(batch_line)));
+            break;
+
+        case REMOVE_SAMPLE:
+            pa_operation_unref(pa_context_remove_sample(c, sample_name, simple_callback, PA_UINT_TO_PTR(batch_line)));
+            break;
+
+        case UPLOAD_SAMPLE:
+            sample_stream = pa_stream_new(c, sample_name, &sample_spec, NULL);
+            pa_assert(sample_stream);
+
+            pa_stream_set_state_callback(sample_stream, stream_state_callback, NULL);
+            pa_stream_set_write_callback(sample_stream, stream_write_callback, NULL);
+            pa_stream_connect_upload(sample_stream, sample_length);
+            break;
+
+        case EXIT:
+            pa_operation_unref(pa_context_exit_daemon(c, simple_callback, PA_UINT_TO_PTR(batch_line)));
+            break;
+
+        case LIST:
+            if (list_type) {
+                if (pa_streq(list_type, "modules"))
+                    pa_operation_unref(pa_context_get_module_info_list(c, get_module_info_callback, PA_UINT_TO_PTR(batch_line)));
+                else if (pa_streq(list_type, "sinks"))
+                    pa_operation_unref(pa_context_get_sink_info_list(c, get_sink_info_callback, PA_UINT_TO_PTR(batch_line)));
+                else if (pa_streq(list_type, "sources"))
+                    pa_operation_unref(pa_context_get_source_info_list(c, get_source_info_callback, PA_UINT_TO_PTR(batch_line)));
+                else if (pa_streq(list_type, "sink-inputs"))
+                    pa_operation_unref(pa_context_get_sink_input_info_list(c, get_sink_input_info_callback, PA_UINT_TO_PTR(batch_line)));
+                else if (pa_streq(list_type, "source-outputs"))
+                    pa_operation_unref(pa_context_get_source_output_info_list(c, get_source_output_info_callback, PA_UINT_TO_PTR(batch_line)));
+                else if (pa_streq(list_type, "clients"))
+                    pa_operation_unref(pa_context_get_client_info_list(c, get_client_info_callback, PA_UINT_TO_PTR(batch_line)));
+                else if (pa_streq(list_type, "samples"))
+                    pa_operation_unref(pa_context_get_sample_info_list(c, get_sample_info_callback, PA_UINT_TO_PTR(batch_line)));
+                else if (pa_streq(list_type, "cards"))
+                    pa_operation_unref(pa_context_get_card_info_list(c, get_card_info_callback, PA_UINT_TO_PTR(batch_line)));
+                else
+                    pa_assert_not_reached();
+            } else {
+                actions += 7;
+                pa_operation_unref(pa_context_get_module_info_list(c, get_module_info_callback, PA_UINT_TO_PTR(batch_line)));
+                pa_operation_unref(pa_context_get_sink_info_list(c, get_sink_info_callback, PA_UINT_TO_PTR(batch_line)));
+                pa_operation_unref(pa_context_get_source_info_list(c, get_source_info_callback, PA_UINT_TO_PTR(batch_line)));
+                pa_operation_unref(pa_context_get_sink_input_info_list(c, get_sink_input_info_callback, PA_UINT_TO_PTR(batch_line)));
+                pa_operation_unref(pa_context_get_source_output_info_list(c, get_source_output_info_callback, PA_UINT_TO_PTR(batch_line)));
+                pa_operation_unref(pa_context_get_client_info_list(c, get_client_info_callback, PA_UINT_TO_PTR(batch_line)));
+                pa_operation_unref(pa_context_get_sample_info_list(c, get_sample_info_callback, PA_UINT_TO_PTR(batch_line)));
+                pa_operation_unref(pa_context_get_card_info_list(c, get_card_info_callback, PA_UINT_TO_PTR(batch_line)));
+            }
+            break;
+
+        case MOVE_SINK_INPUT:
+            pa_operation_unref(pa_context_move_sink_input_by_name(c, sink_input_idx, sink_name, simple_callback, PA_UINT_TO_PTR(batch_line)));
+            break;
+
+        case MOVE_SOURCE_OUTPUT:
+            pa_operation_unref(pa_context_move_source_output_by_name(c, source_output_idx, source_name, simple_callback, PA_UINT_TO_PTR(batch_line)));
+            break;
+
+        case LOAD_MODULE:
+            pa_operation_unref(pa_context_load_module(c, module_name, module_args, index_callback, PA_UINT_TO_PTR(batch_line)));
+            break;
+
+        case UNLOAD_MODULE:
+            if (module_name)
+                pa_operation_unref(pa_context_get_module_info_list(c, unload_module_by_name_callback, PA_UINT_TO_PTR(batch_line)));
+            else
+                pa_operation_unref(pa_context_unload_module(c, module_index, simple_callback, PA_UINT_TO_PTR(batch_line)));
+            break;
+
+        case SUSPEND_SINK:
+            if (sink_name)
+                pa_operation_unref(pa_context_suspend_sink_by_name(c, sink_name, suspend, simple_callback, PA_UINT_TO_PTR(batch_line)));
+            else
+                pa_operation_unref(pa_context_suspend_sink_by_index(c, PA_INVALID_INDEX, suspend, simple_callback, PA_UINT_TO_PTR(batch_line)));
+            break;
+
+        case SUSPEND_SOURCE:
+            if (source_name)
+                pa_operation_unref(pa_context_suspend_source_by_name(c, source_name, suspend, simple_callback, PA_UINT_TO_PTR(batch_line)));
+            else
+                pa_operation_unref(pa_context_suspend_source_by_index(c, PA_INVALID_INDEX, suspend, simple_callback, PA_UINT_TO_PTR(batch_line)));
+            break;
+
+        case SET_CARD_PROFILE:
+            pa_operation_unref(pa_context_set_card_profile_by_name(c, card_name, profile_name, simple_callback, PA_UINT_TO_PTR(batch_line)));
+            break;
+
+        case SET_SINK_PORT:
+            pa_operation_unref(pa_context_set_sink_port_by_name(c, sink_name, port_name, simple_callback, PA_UINT_TO_PTR(batch_line)));
+            break;
+
+        case SET_DEFAULT_SINK:
+            pa_operation_unref(pa_context_set_default_sink(c, sink_name, simple_callback, PA_UINT_TO_PTR(batch_line)));
+            break;
+
+        case SET_SOURCE_PORT:
+            pa_operation_unref(pa_context_set_source_port_by_name(c, source_name, port_name, simple_callback, PA_UINT_TO_PTR(batch_line)));
+            break;
+
+        case SET_DEFAULT_SOURCE:
+            pa_operation_unref(pa_context_set_default_source(c, source_name, simple_callback, PA_UINT_TO_PTR(batch_line)));
+            break;
+
+        case SET_SINK_MUTE:
+            if (mute == TOGGLE_MUTE)
+                pa_operation_unref(pa_context_get_sink_info_by_name(c, sink_name, sink_toggle_mute_callback, PA_UINT_TO_PTR(batch_line)));
+            else
+                pa_operation_unref(pa_context_set_sink_mute_by_name(c, sink_name, mute, simple_callback, PA_UINT_TO_PTR(batch_line)));
+            break;
+
+        case SET_SOURCE_MUTE:
+            if (mute == TOGGLE_MUTE)
+                pa_operation_unref(pa_context_get_source_info_by_name(c, source_name, source_toggle_mute_callback, PA_UINT_TO_PTR(batch_line)));
+            else
+                pa_operation_unref(pa_context_set_source_mute_by_name(c, source_name, mute, simple_callback, PA_UINT_TO_PTR(batch_line)));
+            break;
+
+        case SET_SINK_INPUT_MUTE:
+            if (mute == TOGGLE_MUTE)
+                pa_operation_unref(pa_context_get_sink_input_info(c, sink_input_idx, sink_input_toggle_mute_callback, PA_UINT_TO_PTR(batch_line)));
+            else
+                pa_operation_unref(pa_context_set_sink_input_mute(c, sink_input_idx, mute, simple_callback, PA_UINT_TO_PTR(batch_line)));
+            break;
+
+        case SET_SOURCE_OUTPUT_MUTE:
+            if (mute == TOGGLE_MUTE)
+                pa_operation_unref(pa_context_get_source_output_info(c, source_output_idx, source_output_toggle_mute_callback, PA_UINT_TO_PTR(batch_line)));
+            else
+                pa_operation_unref(pa_context_set_source_output_mute(c, source_output_idx, mute, simple_callback, PA_UINT_TO_PTR(batch_line)));
+            break;
+
+        case SET_SINK_VOLUME:
+            if ((volume_flags & VOL_RELATIVE) == VOL_RELATIVE) {
+                pa_operation_unref(pa_context_get_sink_info_by_name(c, sink_name, get_sink_volume_callback, PA_UINT_TO_PTR(batch_line)));
+            } else {
+                pa_cvolume v;
+                pa_cvolume_set(&v, 1, volume);
+                pa_operation_unref(pa_context_set_sink_volume_by_name(c, sink_name, &v, simple_callback, PA_UINT_TO_PTR(batch_line)));
+            }
+            break;
+
+        case SET_SOURCE_VOLUME:
+            if ((volume_flags & VOL_RELATIVE) == VOL_RELATIVE) {
+                pa_operation_unref(pa_context_get_source_info_by_name(c, source_name, get_source_volume_callback, PA_UINT_TO_PTR(batch_line)));
+            } else {
+                pa_cvolume v;
+                pa_cvolume_set(&v, 1, volume);
+                pa_operation_unref(pa_context_set_source_volume_by_name(c, source_name, &v, simple_callback, PA_UINT_TO_PTR(batch_line)));
+            }
+            break;
+
+        case SET_SINK_INPUT_VOLUME:
+            if ((volume_flags & VOL_RELATIVE) == VOL_RELATIVE) {
+                pa_operation_unref(pa_context_get_sink_input_info(c, sink_input_idx, get_sink_input_volume_callback, PA_UINT_TO_PTR(batch_line)));
+            } else {
+                pa_cvolume v;
+                pa_cvolume_set(&v, 1, volume);
+                pa_operation_unref(pa_context_set_sink_input_volume(c, sink_input_idx, &v, simple_callback, PA_UINT_TO_PTR(batch_line)));
+            }
+            break;
+
+        case SET_SOURCE_OUTPUT_VOLUME:
+            if ((volume_flags & VOL_RELATIVE) == VOL_RELATIVE) {
+                pa_operation_unref(pa_context_get_source_output_info(c, source_output_idx, get_source_output_volume_callback, PA_UINT_TO_PTR(batch_line)));
+            } else {
+                pa_cvolume v;
+                pa_cvolume_set(&v, 1, volume);
+                pa_operation_unref(pa_context_set_source_output_volume(c, source_output_idx, &v, simple_callback, PA_UINT_TO_PTR(batch_line)));
+            }
+            break;
+
+        case SET_SINK_FORMATS:
+            set_sink_formats(c, sink_idx, formats);
+            break;
+
+        case SET_PORT_LATENCY_OFFSET:
+            pa_operation_unref(pa_context_set_port_latency_offset(c, card_name, port_name, latency_offset, simple_callback, PA_UINT_TO_PTR(batch_line)));
+            break;
+
+        case SUBSCRIBE:
+            pa_context_set_subscribe_callback(c, context_subscribe_callback, NULL);
+
+            pa_operation_unref(pa_context_subscribe(
+                                      c,
+                                      PA_SUBSCRIPTION_MASK_SINK|
+                                      PA_SUBSCRIPTION_MASK_SOURCE|
+                                      PA_SUBSCRIPTION_MASK_SINK_INPUT|
+                                      PA_SUBSCRIPTION_MASK_SOURCE_OUTPUT|
+                                      PA_SUBSCRIPTION_MASK_MODULE|
+                                      PA_SUBSCRIPTION_MASK_CLIENT|
+                                      PA_SUBSCRIPTION_MASK_SAMPLE_CACHE|
+                                      PA_SUBSCRIPTION_MASK_SERVER|
+                                      PA_SUBSCRIPTION_MASK_CARD,
+                                      NULL,
+                                      NULL));
+            break;
+
+        default:
+            pa_assert_not_reached();
+    }
+}
+
+/* Whether the callbacks of the command need the parsed arguments, or
+ * print something, in which case the next command of a batch is only
+ * parsed after it has completed. The others are sent right away, in
+ * the order of the batch; the server answers them in the same order. */
+static pa_bool_t action_needs_reply(void) {
+
+    switch (action) {
+        case SET_SINK_VOLUME:
+        case SET_SOURCE_VOLUME:
+        case SET_SINK_INPUT_VOLUME:
+        case SET_SOURCE_OUTPUT_VOLUME:
+            return (volume_flags & VOL_RELATIVE) == VOL_RELATIVE;
+
+        case SET_SINK_MUTE:
+        case SET_SOURCE_MUTE:
+        case SET_SINK_INPUT_MUTE:
+        case SET_SOURCE_OUTPUT_MUTE:
+            return mute == TOGGLE_MUTE;
+
+        case UNLOAD_MODULE:
+            return !!module_name;
+
+        case STAT:
+        case INFO:
+        case LIST:
+        case UPLOAD_SAMPLE:
+        case EXIT:
+        case SUBSCRIBE:
+            return TRUE;
+
+        default:
+            return FALSE;
+    }
+}
+
+/* Forget the arguments of the previous command */
+static void reset_command(void) {
+
+    if (sample_stream) {
+        pa_stream_unref(sample_stream);
+        sample_stream = NULL;
+    }
+
+    if (sndfile) {
+        sf_close(sndfile);
+        sndfile = NULL;
+    }
+
+    pa_xfree(list_type);
+    pa_xfree(sample_name);
+    pa_xfree(sink_name);
+    pa_xfree(source_name);
+    pa_xfree(module_args);
+    pa_xfree(card_name);
+    pa_xfree(profile_name);
+    pa_xfree(port_name);
+    pa_xfree(formats);
+    list_type = sample_name = sink_name = source_name = module_name = module_args = NULL;
+    card_name = profile_name = port_name = formats = NULL;
+
+    sink_input_idx = source_output_idx = sink_idx = PA_INVALID_INDEX;
+    short_list_format = FALSE;
+    mute = INVALID_MUTE;
+    action = NONE;
+
+    pa_xstrfreev(batch_argv);
+    batch_argv = NULL;
+    batch_argc = 0;
+}
+
+/* Split a line of the batch file into words. The arguments of
+ * load-module are passed on as they are, since they may contain
+ * quoted spaces. */
+static void split_batch_line(char *line) {
+    const char *state = NULL;
+    char *w;
+    int size = 8;
+
+    batch_argv = pa_xnew(char*, size);
+
+    while ((w = pa_split_spaces(line, &state))) {
+        batch_argv[batch_argc++] = w;
+
+        if (batch_argc == 2 && pa_streq(batch_argv[0], "load-module")) {
+            state += strspn(state, " \t");
+
+            if (*state)
+                batch_argv[batch_argc++] = pa_xstrdup(state);
+            break;
+        }
+
+        if (batch_argc + 1 >= size)
+            batch_argv = pa_xrenew(char*, batch_argv, size *= 2);
+    }
+
+    batch_argv[batch_argc] = NULL;
+}
+
+static void run_batch(pa_context *c) {
+    static int error = 0;
+    char line[2048];
+
+    if (error) {
+        batch_status(PA_UINT_TO_PTR(batch_line), pa_strerror(error));
+        error = 0;
+    }
+
+    while (!batch_waiting && fgets(line, sizeof(line), batch_file)) {
+        char *l;
+
+        batch_line++;
+        reset_command();
+
+        l = pa_strip(line);
+
+        if (!*l || *l == '#')
+            continue;
+
+        split_batch_line(l);
+
+        if (pa_streq(batch_argv[0], "subscribe") || pa_streq(batch_argv[0], "help")) {
+            pa_log(_("%s is not supported in batch mode."), batch_argv[0]);
+            error = PA_ERR_NOTSUPPORTED;
+        } else if (parse_command(batch_argc, batch_argv) < 0)
+            error = PA_ERR_INVALID;
+
+        if (error) {
+            /* Keep the status lines in order: if earlier commands are
+             * still waiting for their replies report this one after them */
+            if (actions > 1) {
+                batch_waiting = TRUE;
+                break;
+            }
+
+            batch_status(PA_UINT_TO_PTR(batch_line), pa_strerror(error));
+            error = 0;
+            continue;
+        }
+
+        actions++;
+        run_action(c);
+
+        if (action_needs_reply())
+            batch_waiting = TRUE;
+    }
+
+    if (batch_waiting)
+        return;
+
+    /* That's all, drop the action that the batch itself was counted as */
+    complete_action();
+}
+
 static void context_state_callback(pa_context *c, void *userdata) {
     pa_assert(c);
     switch (pa_context_get_state(c)) {
@@ -1179,221 +1684,10 @@ static void context_state_callback(pa_context *c, void *userdata) {
             break;
 
         case PA_CONTEXT_READY:
-            switch (action) {
-                case STAT:
-                    pa_operation_unref(pa_context_stat(c, stat_callback, NULL));
-                    if (short_list_format)
-                        break;
-                    actions++;
-
-                case INFO:
-                    pa_operation_unref(pa_context_get_server_info(c, get_server_info_callback, NULL));
-                    break;
-
-                case PLAY_SAMPLE:
-                    pa_operation_unref(pa_context_play_sample(c, sample_name, sink_name, PA_VOLUME_NORM, simple_callback, NULL));
-                    break;
-
-                case REMOVE_SAMPLE:
-                    pa_operation_unref(pa_context_remove_sample(c, sample_name, simple_callback, NULL));
-                    break;
-
-                case UPLOAD_SAMPLE:
-                    sample_stream = pa_stream_new(c, sample_name, &sample_spec, NULL);
-                    pa_assert(sample_stream);
-
-                    pa_stream_set_state_callback(sample_stream, stream_state_callback, NULL);
-                    pa_stream_set_write_callback(sample_stream, stream_write_callback, NULL);
-                    pa_stream_connect_upload(sample_stream, sample_length);
-                    break;
-
-                case EXIT:
-                    pa_operation_unref(pa_context_exit_daemon(c, simple_callback, NULL));
-                    break;
-
-                case LIST:
-                    if (list_type) {
-                        if (pa_streq(list_type, "modules"))
-                            pa_operation_unref(pa_context_get_module_info_list(c, get_module_info_callback, NULL));
-                        else if (pa_streq(list_type, "sinks"))
-                            pa_operation_unref(pa_context_get_sink_info_list(c, get_sink_info_callback, NULL));
-                        else if (pa_streq(list_type, "sources"))
-                            pa_operation_unref(pa_context_get_source_info_list(c, get_source_info_callback, NULL));
-                        else if (pa_streq(list_type, "sink-inputs"))
-                            pa_operation_unref(pa_context_get_sink_input_info_list(c, get_sink_input_info_callback, NULL));
-                        else if (pa_streq(list_type, "source-outputs"))
-                            pa_operation_unref(pa_context_get_source_output_info_list(c, get_source_output_info_callback, NULL));
-                        else if (pa_streq(list_type, "clients"))
-                            pa_operation_unref(pa_context_get_client_info_list(c, get_client_info_callback, NULL));
-                        else if (pa_streq(list_type, "samples"))
-                            pa_operation_unref(pa_context_get_sample_info_list(c, get_sample_info_callback, NULL));
-                        else if (pa_streq(list_type, "cards"))
-                            pa_operation_unref(pa_context_get_card_info_list(c, get_card_info_callback, NULL));
-                        else
-                            pa_assert_not_reached();
-                    } else {
-                        actions = 8;
-                        pa_operation_unref(pa_context_get_module_info_list(c, get_module_info_callback, NULL));
-                        pa_operation_unref(pa_context_get_sink_info_list(c, get_sink_info_callback, NULL));
-                        pa_operation_unref(pa_context_get_source_info_list(c, get_source_info_callback, NULL));
-                        pa_operation_unref(pa_context_get_sink_input_info_list(c, get_sink_input_info_callback, NULL));
-                        pa_operation_unref(pa_context_get_source_output_info_list(c, get_source_output_info_callback, NULL));
-                        pa_operation_unref(pa_context_get_client_info_list(c, get_client_info_callback, NULL));
-                        pa_operation_unref(pa_context_get_sample_info_list(c, get_sample_info_callback, NULL));
-                        pa_operation_unref(pa_context_get_card_info_list(c, get_card_info_callback, NULL));
-                    }
-                    break;
-
-                case MOVE_SINK_INPUT:
-                    pa_operation_unref(pa_context_move_sink_input_by_name(c, sink_input_idx, sink_name, simple_callback, NULL));
-                    break;
-
-                case MOVE_SOURCE_OUTPUT:
-                    pa_operation_unref(pa_context_move_source_output_by_name(c, source_output_idx, source_name, simple_callback, NULL));
-                    break;
-
-                case LOAD_MODULE:
-                    pa_operation_unref(pa_context_load_module(c, module_name, module_args, index_callback, NULL));
-                    break;
-
-                case UNLOAD_MODULE:
-                    if (module_name)
-                        pa_operation_unref(pa_context_get_module_info_list(c, unload_module_by_name_callback, NULL));
-                    else
-                        pa_operation_unref(pa_context_unload_module(c, module_index, simple_callback, NULL));
-                    break;
-
-                case SUSPEND_SINK:
-                    if (sink_name)
-                        pa_operation_unref(pa_context_suspend_sink_by_name(c, sink_name, suspend, simple_callback, NULL));
-                    else
-                        pa_operation_unref(pa_context_suspend_sink_by_index(c, PA_INVALID_INDEX, suspend, simple_callback, NULL));
-                    break;
-
-                case SUSPEND_SOURCE:
-                    if (source_name)
-                        pa_operation_unref(pa_context_suspend_source_by_name(c, source_name, suspend, simple_callback, NULL));
-                    else
-                        pa_operation_unref(pa_context_suspend_source_by_index(c, PA_INVALID_INDEX, suspend, simple_callback, NULL));
-                    break;
-
-                case SET_CARD_PROFILE:
-                    pa_operation_unref(pa_context_set_card_profile_by_name(c, card_name, profile_name, simple_callback, NULL));
-                    break;
-
-                case SET_SINK_PORT:
-                    pa_operation_unref(pa_context_set_sink_port_by_name(c, sink_name, port_name, simple_callback, NULL));
-                    break;
-
-                case SET_DEFAULT_SINK:
-                    pa_operation_unref(pa_context_set_default_sink(c, sink_name, simple_callback, NULL));
-                    break;
-
-                case SET_SOURCE_PORT:
-                    pa_operation_unref(pa_context_set_source_port_by_name(c, source_name, port_name, simple_callback, NULL));
-                    break;
-
-                case SET_DEFAULT_SOURCE:
-                    pa_operation_unref(pa_context_set_default_source(c, source_name, simple_callback, NULL));
-                    break;
-
-                case SET_SINK_MUTE:
-                    if (mute == TOGGLE_MUTE)
-                        pa_operation_unref(pa_context_get_sink_info_by_name(c, sink_name, sink_toggle_mute_callback, NULL));
-                    else
-                        pa_operation_unref(pa_context_set_sink_mute_by_name(c, sink_name, mute, simple_callback, NULL));
-                    break;
-
-                case SET_SOURCE_MUTE:
-                    if (mute == TOGGLE_MUTE)
-                        pa_operation_unref(pa_context_get_source_info_by_name(c, source_name, source_toggle_mute_callback, NULL));
-                    else
-                        pa_operation_unref(pa_context_set_source_mute_by_name(c, source_name, mute, simple_callback, NULL));
-                    break;
-
-                case SET_SINK_INPUT_MUTE:
-                    if (mute == TOGGLE_MUTE)
-                        pa_operation_unref(pa_context_get_sink_input_info(c, sink_input_idx, sink_input_toggle_mute_callback, NULL));
-                    else
-                        pa_operation_unref(pa_context_set_sink_input_mute(c, sink_input_idx, mute, simple_callback, NULL));
-                    break;
-
-                case SET_SOURCE_OUTPUT_MUTE:
-                    if (mute == TOGGLE_MUTE)
-                        pa_operation_unref(pa_context_get_source_output_info(c, source_output_idx, source_output_toggle_mute_callback, NULL));
-                    else
-                        pa_operation_unref(pa_context_set_source_output_mute(c, source_output_idx, mute, simple_callback, NULL));
-                    break;
-
-                case SET_SINK_VOLUME:
-                    if ((volume_flags & VOL_RELATIVE) == VOL_RELATIVE) {
-                        pa_operation_unref(pa_context_get_sink_info_by_name(c, sink_name, get_sink_volume_callback, NULL));
-                    } else {
-                        pa_cvolume v;
-                        pa_cvolume_set(&v, 1, volume);
-                        pa_operation_unref(pa_context_set_sink_volume_by_name(c, sink_name, &v, simple_callback, NULL));
-                    }
-                    break;
-
-                case SET_SOURCE_VOLUME:
-                    if ((volume_flags & VOL_RELATIVE) == VOL_RELATIVE) {
-                        pa_operation_unref(pa_context_get_source_info_by_name(c, source_name, get_source_volume_callback, NULL));
-                    } else {
-                        pa_cvolume v;
-                        pa_cvolume_set(&v, 1, volume);
-                        pa_operation_unref(pa_context_set_source_volume_by_name(c, source_name, &v, simple_callback, NULL));
-                    }
-                    break;
-
-                case SET_SINK_INPUT_VOLUME:
-                    if ((volume_flags & VOL_RELATIVE) == VOL_RELATIVE) {
-                        pa_operation_unref(pa_context_get_sink_input_info(c, sink_input_idx, get_sink_input_volume_callback, NULL));
-                    } else {
-                        pa_cvolume v;
-                        pa_cvolume_set(&v, 1, volume);
-                        pa_operation_unref(pa_context_set_sink_input_volume(c, sink_input_idx, &v, simple_callback, NULL));
-                    }
-                    break;
-
-                case SET_SOURCE_OUTPUT_VOLUME:
-                    if ((volume_flags & VOL_RELATIVE) == VOL_RELATIVE) {
-                        pa_operation_unref(pa_context_get_source_output_info(c, source_output_idx, get_source_output_volume_callback, NULL));
-                    } else {
-                        pa_cvolume v;
-                        pa_cvolume_set(&v, 1, volume);
-                        pa_operation_unref(pa_context_set_source_output_volume(c, source_output_idx, &v, simple_callback, NULL));
-                    }
-                    break;
-
-                case SET_SINK_FORMATS:
-                    set_sink_formats(c, sink_idx, formats);
-                    break;
-
-                case SET_PORT_LATENCY_OFFSET:
-                    pa_operation_unref(pa_context_set_port_latency_offset(c, card_name, port_name, latency_offset, simple_callback, NULL));
-                    break;
-
-                case SUBSCRIBE:
-                    pa_context_set_subscribe_callback(c, context_subscribe_callback, NULL);
-
-                    pa_operation_unref(pa_context_subscribe(
-                                              c,
-                                              PA_SUBSCRIPTION_MASK_SINK|
-                                              PA_SUBSCRIPTION_MASK_SOURCE|
-                                              PA_SUBSCRIPTION_MASK_SINK_INPUT|
-                                              PA_SUBSCRIPTION_MASK_SOURCE_OUTPUT|
-                                              PA_SUBSCRIPTION_MASK_MODULE|
-                                              PA_SUBSCRIPTION_MASK_CLIENT|
-                                              PA_SUBSCRIPTION_MASK_SAMPLE_CACHE|
-                                              PA_SUBSCRIPTION_MASK_SERVER|
-                                              PA_SUBSCRIPTION_MASK_CARD,
-                                              NULL,
-                                              NULL));
-                    break;
-
-                default:
-                    pa_assert_not_reached();
-            }
+            if (batch)
+                run_batch(c);
+            else
+                run_action(c);
             break;
 
         case PA_CONTEXT_TERMINATED:
@@ -1486,508 +1780,552 @@ static enum mute_flags parse_mute(const char *mute_text) {
     }
 }
 
-static void help(const char *argv0) {
+/* Parse one command and its arguments, argv[0] being the command */
+static int parse_command(int argc, char *argv[]) {
 
-    printf("%s %s %s\n",    argv0, _("[options]"), "stat [short]");
-    printf("%s %s %s\n",    argv0, _("[options]"), "info");
-    printf("%s %s %s %s\n", argv0, _("[options]"), "list [short]", _("[TYPE]"));
-    printf("%s %s %s\n",    argv0, _("[options]"), "exit");
-    printf("%s %s %s %s\n", argv0, _("[options]"), "upload-sample", _("FILENAME [NAME]"));
-    printf("%s %s %s %s\n", argv0, _("[options]"), "play-sample ", _("NAME [SINK]"));
-    printf("%s %s %s %s\n", argv0, _("[options]"), "remove-sample ", _("NAME"));
-    printf("%s %s %s %s\n", argv0, _("[options]"), "load-module ", _("NAME [ARGS ...]"));
-    printf("%s %s %s %s\n", argv0, _("[options]"), "unload-module ", _("NAME|#N"));
-    printf("%s %s %s %s\n", argv0, _("[options]"), "move-(sink-input|source-output)", _("#N SINK|SOURCE"));
-    printf("%s %s %s %s\n", argv0, _("[options]"), "suspend-(sink|source)", _("NAME|#N 1|0"));
-    printf("%s %s %s %s\n", argv0, _("[options]"), "set-card-profile ", _("CARD PROFILE"));
-    printf("%s %s %s %s\n", argv0, _("[options]"), "set-default-(sink|source)", _("NAME"));
-    printf("%s %s %s %s\n", argv0, _("[options]"), "set-(sink|source)-port", _("NAME|#N PORT"));
-    printf("%s %s %s %s\n", argv0, _("[options]"), "set-(sink|source)-volume", _("NAME|#N VOLUME"));
-    printf("%s %s %s %s\n", argv0, _("[options]"), "set-(sink-input|source-output)-volume", _("#N VOLUME"));
-    printf("%s %s %s %s\n", argv0, _("[options]"), "set-(sink|source)-mute", _("NAME|#N 1|0|toggle"));
-    printf("%s %s %s %s\n", argv0, _("[options]"), "set-(sink-input|source-output)-mute", _("#N 1|0|toggle"));
-    printf("%s %s %s %s\n", argv0, _("[options]"), "set-sink-formats", _("#N FORMATS"));
-    printf("%s %s %s %s\n", argv0, _("[options]"), "set-port-latency-offset", _("CARD-NAME|CARD-#N PORT OFFSET"));
-    printf("%s %s %s\n",    argv0, _("[options]"), "subscribe");
-    printf(_("\nThe special names @DEFAULT_SINK@, @DEFAULT_SOURCE@ and @DEFAULT_MONITOR@\n"
-             "can be used to specify the default sink, source and monitor.\n"));
+    if (pa_streq(argv[0], "stat")) {
+        action = STAT;
+        short_list_format = FALSE;
+        if (1 < argc && pa_streq(argv[1], "short"))
+            short_list_format = TRUE;
 
-    printf(_("\n"
-             "  -h, --help                            Show this help\n"
-             "      --version                         Show version\n\n"
-             "  -s, --server=SERVER                   The name of the server to connect to\n"
-             "  -n, --client-name=NAME                How to call this client on the server\n"));
-}
+    } else if (pa_streq(argv[0], "info"))
+        action = INFO;
 
-enum {
-    ARG_VERSION = 256
-};
+    else if (pa_streq(argv[0], "exit"))
+        action = EXIT;
 
-int main(int argc, char *argv[]) {
-    pa_mainloop *m = NULL;
-    int ret = 1, c;
-    char *server = NULL, *bn;
+    else if (pa_streq(argv[0], "list")) {
+        action = LIST;
 
-    static const struct option long_options[] = {
-        {"server",      1, NULL, 's'},
-        {"client-name", 1, NULL, 'n'},
-        {"version",     0, NULL, ARG_VERSION},
-        {"help",        0, NULL, 'h'},
-        {NULL,          0, NULL, 0}
-    };
+        for (int i = 1; i < argc; i++) {
+            if (pa_streq(argv[i], "modules") || pa_streq(argv[i], "clients") ||
+                pa_streq(argv[i], "sinks")   || pa_streq(argv[i], "sink-inputs") ||
+                pa_streq(argv[i], "sources") || pa_streq(argv[i], "source-outputs") ||
+                pa_streq(argv[i], "samples") || pa_streq(argv[i], "cards")) {
+                list_type = pa_xstrdup(argv[i]);
+            } else if (pa_streq(argv[i], "short")) {
+                short_list_format = TRUE;
+            } else {
+                pa_log(_("Specify nothing, or one of: %s"), "modules, sinks, sources, sink-inputs, source-outputs, clients, samples, cards");
+                return -1;
+            }
+        }
 
-    setlocale(LC_ALL, "");
-#ifdef ENABLE_NLS
-    bindtextdomain(GETTEXT_PACKAGE, PULSE_LOCALEDIR);
-#endif
+    } else if (pa_streq(argv[0], "upload-sample")) {
+        struct SF_INFO sfi;
+        action = UPLOAD_SAMPLE;
 
-    bn = pa_path_get_filename(argv[0]);
+        if (1 >= argc) {
+            pa_log(_("Please specify a sample file to load"));
+            return -1;
+        }
 
-    proplist = pa_proplist_new();
+        if (2 < argc)
+            sample_name = pa_xstrdup(argv[2]);
+        else {
+            char *f = pa_path_get_filename(argv[1]);
+            sample_name = pa_xstrndup(f, strcspn(f, "."));
+        }
 
-    while ((c = getopt_long(argc, argv, "s:n:h", long_options, NULL)) != -1) {
-        switch (c) {
-            case 'h' :
-                help(bn);
-                ret = 0;
-                goto quit;
+        pa_zero(sfi);
+        if (!(sndfile = sf_open(argv[1], SFM_READ, &sfi))) {
+            pa_log(_("Failed to open sound file."));
+            return -1;
+        }
 
-            case ARG_VERSION:
-                printf(_("pactl %s\n"
-                         "Compiled with libpulse %s\n"
-                         "Linked with libpulse %s\n"),
-                       PACKAGE_VERSION,
-                       pa_get_headers_version(),
-                       pa_get_library_version());
-                ret = 0;
-                goto quit;
+        if (pa_sndfile_read_sample_spec(sndfile, &sample_spec) < 0) {
+            pa_log(_("Failed to determine sample specification from file."));
+            return -1;
+        }
+        sample_spec.format = PA_SAMPLE_FLOAT32;
 
-            case 's':
-                pa_xfree(server);
-                server = pa_xstrdup(optarg);
-                break;
+        if (pa_sndfile_read_channel_map(sndfile, &channel_map) < 0) {
+            if (sample_spec.channels > 2)
+                pa_log(_("Warning: Failed to determine sample specification from file."));
+            pa_channel_map_init_extend(&channel_map, sample_spec.channels, PA_CHANNEL_MAP_DEFAULT);
+        }
 
-            case 'n': {
-                char *t;
+        pa_assert(pa_channel_map_compatible(&channel_map, &sample_spec));
+        sample_length = (size_t) sfi.frames*pa_frame_size(&sample_spec);
 
-                if (!(t = pa_locale_to_utf8(optarg)) ||
-                    pa_proplist_sets(proplist, PA_PROP_APPLICATION_NAME, t) < 0) {
+    } else if (pa_streq(argv[0], "play-sample")) {
+        action = PLAY_SAMPLE;
+        if (argc != 2 && argc != 3) {
+            pa_log(_("You have to specify a sample name to play"));
+            return -1;
+        }
 
-                    pa_log(_("Invalid client name '%s'"), t ? t : optarg);
-                    pa_xfree(t);
-                    goto quit;
-                }
+        sample_name = pa_xstrdup(argv[1]);
 
-                pa_xfree(t);
-                break;
-            }
+        if (2 < argc)
+            sink_name = pa_xstrdup(argv[2]);
 
-            default:
-                goto quit;
+    } else if (pa_streq(argv[0], "remove-sample")) {
+        action = REMOVE_SAMPLE;
+        if (argc != 2) {
+            pa_log(_("You have to specify a sample name to remove"));
+            return -1;
         }
-    }
 
-    if (optind < argc) {
-        if (pa_streq(argv[optind], "stat")) {
-            action = STAT;
-            short_list_format = FALSE;
-            if (optind+1 < argc && pa_streq(argv[optind+1], "short"))
-                short_list_format = TRUE;
+        sample_name = pa_xstrdup(argv[1]);
 
-        } else if (pa_streq(argv[optind], "info"))
-            action = INFO;
-
-        else if (pa_streq(argv[optind], "exit"))
-            action = EXIT;
-
-        else if (pa_streq(argv[optind], "list")) {
-            action = LIST;
-
-            for (int i = optind+1; i < argc; i++) {
-                if (pa_streq(argv[i], "modules") || pa_streq(argv[i], "clients") ||
-                    pa_streq(argv[i], "sinks")   || pa_streq(argv[i], "sink-inputs") ||
-                    pa_streq(argv[i], "sources") || pa_streq(argv[i], "source-outputs") ||
-                    pa_streq(argv[i], "samples") || pa_streq(argv[i], "cards")) {
-                    list_type = pa_xstrdup(argv[i]);
-                } else if (pa_streq(argv[i], "short")) {
-                    short_list_format = TRUE;
-                } else {
-                    pa_log(_("Specify nothing, or one of: %s"), "modules, sinks, sources, sink-inputs, source-outputs, clients, samples, cards");
-                    goto quit;
-                }
-            }
+    } else if (pa_streq(argv[0], "move-sink-input")) {
+        action = MOVE_SINK_INPUT;
+        if (argc != 3) {
+            pa_log(_("You have to specify a sink input index and a sink"));
+            return -1;
+        }
 
-        } else if (pa_streq(argv[optind], "upload-sample")) {
-            struct SF_INFO sfi;
-            action = UPLOAD_SAMPLE;
+        sink_input_idx = (uint32_t) atoi(argv[1]);
+        sink_name = pa_xstrdup(argv[2]);
 
-            if (optind+1 >= argc) {
-                pa_log(_("Please specify a sample file to load"));
-                goto quit;
-            }
+    } else if (pa_streq(argv[0], "move-source-output")) {
+        action = MOVE_SOURCE_OUTPUT;
+        if (argc != 3) {
+            pa_log(_("You have to specify a source output index and a source"));
+            return -1;
+        }
 
-            if (optind+2 < argc)
-                sample_name = pa_xstrdup(argv[optind+2]);
-            else {
-                char *f = pa_path_get_filename(argv[optind+1]);
-                sample_name = pa_xstrndup(f, strcspn(f, "."));
-            }
+        source_output_idx = (uint32_t) atoi(argv[1]);
+        source_name = pa_xstrdup(argv[2]);
 
-            pa_zero(sfi);
-            if (!(sndfile = sf_open(argv[optind+1], SFM_READ, &sfi))) {
-                pa_log(_("Failed to open sound file."));
-                goto quit;
-            }
+    } else if (pa_streq(argv[0], "load-module")) {
+        int i;
+        size_t n = 0;
+        char *p;
 
-            if (pa_sndfile_read_sample_spec(sndfile, &sample_spec) < 0) {
-                pa_log(_("Failed to determine sample specification from file."));
-                goto quit;
-            }
-            sample_spec.format = PA_SAMPLE_FLOAT32;
+        action = LOAD_MODULE;
 
-            if (pa_sndfile_read_channel_map(sndfile, &channel_map) < 0) {
-                if (sample_spec.channels > 2)
-                    pa_log(_("Warning: Failed to determine sample specification from file."));
-                pa_channel_map_init_extend(&channel_map, sample_spec.channels, PA_CHANNEL_MAP_DEFAULT);
-            }
+        if (argc <= 1) {
+            pa_log(_("You have to specify a module name and arguments."));
+            return -1;
+        }
 
-            pa_assert(pa_channel_map_compatible(&channel_map, &sample_spec));
-            sample_length = (size_t) sfi.frames*pa_frame_size(&sample_spec);
+        module_name = argv[1];
 
-        } else if (pa_streq(argv[optind], "play-sample")) {
-            action = PLAY_SAMPLE;
-            if (argc != optind+2 && argc != optind+3) {
-                pa_log(_("You have to specify a sample name to play"));
-                goto quit;
-            }
+        for (i = 2; i < argc; i++)
+            n += strlen(argv[i])+1;
 
-            sample_name = pa_xstrdup(argv[optind+1]);
+        if (n > 0) {
+            p = module_args = pa_xmalloc(n);
 
-            if (optind+2 < argc)
-                sink_name = pa_xstrdup(argv[optind+2]);
+            for (i = 2; i < argc; i++)
+                p += sprintf(p, "%s%s", p == module_args ? "" : " ", argv[i]);
+        }
 
-        } else if (pa_streq(argv[optind], "remove-sample")) {
-            action = REMOVE_SAMPLE;
-            if (argc != optind+2) {
-                pa_log(_("You have to specify a sample name to remove"));
-                goto quit;
-            }
+    } else if (pa_streq(argv[0], "unload-module")) {
+        action = UNLOAD_MODULE;
 
-            sample_name = pa_xstrdup(argv[optind+1]);
+        if (argc != 2) {
+            pa_log(_("You have to specify a module index or name"));
+            return -1;
+        }
 
-        } else if (pa_streq(argv[optind], "move-sink-input")) {
-            action = MOVE_SINK_INPUT;
-            if (argc != optind+3) {
-                pa_log(_("You have to specify a sink input index and a sink"));
-                goto quit;
-            }
+        if (pa_atou(argv[1], &module_index) < 0)
+            module_name = argv[1];
 
-            sink_input_idx = (uint32_t) atoi(argv[optind+1]);
-            sink_name = pa_xstrdup(argv[optind+2]);
+    } else if (pa_streq(argv[0], "suspend-sink")) {
+        int b;
 
-        } else if (pa_streq(argv[optind], "move-source-output")) {
-            action = MOVE_SOURCE_OUTPUT;
-            if (argc != optind+3) {
-                pa_log(_("You have to specify a source output index and a source"));
-                goto quit;
-            }
+        action = SUSPEND_SINK;
 
-            source_output_idx = (uint32_t) atoi(argv[optind+1]);
-            source_name = pa_xstrdup(argv[optind+2]);
+        if (argc > 3 || 1 >= argc) {
+            pa_log(_("You may not specify more than one sink. You have to specify a boolean value."));
+            return -1;
+        }
 
-        } else if (pa_streq(argv[optind], "load-module")) {
-            int i;
-            size_t n = 0;
-            char *p;
+        if ((b = pa_parse_boolean(argv[argc-1])) < 0) {
+            pa_log(_("Invalid suspend specification."));
+            return -1;
+        }
 
-            action = LOAD_MODULE;
+        suspend = !!b;
 
-            if (argc <= optind+1) {
-                pa_log(_("You have to specify a module name and arguments."));
-                goto quit;
-            }
+        if (argc > 2)
+            sink_name = pa_xstrdup(argv[1]);
 
-            module_name = argv[optind+1];
+    } else if (pa_streq(argv[0], "suspend-source")) {
+        int b;
 
-            for (i = optind+2; i < argc; i++)
-                n += strlen(argv[i])+1;
+        action = SUSPEND_SOURCE;
 
-            if (n > 0) {
-                p = module_args = pa_xmalloc(n);
+        if (argc > 3 || 1 >= argc) {
+            pa_log(_("You may not specify more than one source. You have to specify a boolean value."));
+            return -1;
+        }
 
-                for (i = optind+2; i < argc; i++)
-                    p += sprintf(p, "%s%s", p == module_args ? "" : " ", argv[i]);
-            }
+        if ((b = pa_parse_boolean(argv[argc-1])) < 0) {
+            pa_log(_("Invalid suspend specification."));
+            return -1;
+        }
 
-        } else if (pa_streq(argv[optind], "unload-module")) {
-            action = UNLOAD_MODULE;
+        suspend = !!b;
 
-            if (argc != optind+2) {
-                pa_log(_("You have to specify a module index or name"));
-                goto quit;
-            }
+        if (argc > 2)
+            source_name = pa_xstrdup(argv[1]);
+    } else if (pa_streq(argv[0], "set-card-profile")) {
+        action = SET_CARD_PROFILE;
 
-            if (pa_atou(argv[optind + 1], &module_index) < 0)
-                module_name = argv[optind + 1];
+        if (argc != 3) {
+            pa_log(_("You have to specify a card name/index and a profile name"));
+            return -1;
+        }
 
-        } else if (pa_streq(argv[optind], "suspend-sink")) {
-            int b;
+        card_name = pa_xstrdup(argv[1]);
+        profile_name = pa_xstrdup(argv[2]);
 
-            action = SUSPEND_SINK;
+    } else if (pa_streq(argv[0], "set-sink-port")) {
+        action = SET_SINK_PORT;
 
-            if (argc > optind+3 || optind+1 >= argc) {
-                pa_log(_("You may not specify more than one sink. You have to specify a boolean value."));
-                goto quit;
-            }
+        if (argc != 3) {
+            pa_log(_("You have to specify a sink name/index and a port name"));
+            return -1;
+        }
 
-            if ((b = pa_parse_boolean(argv[argc-1])) < 0) {
-                pa_log(_("Invalid suspend specification."));
-                goto quit;
-            }
+        sink_name = pa_xstrdup(argv[1]);
+        port_name = pa_xstrdup(argv[2]);
 
-            suspend = !!b;
+    } else if (pa_streq(argv[0], "set-default-sink")) {
+        action = SET_DEFAULT_SINK;
 
-            if (argc > optind+2)
-                sink_name = pa_xstrdup(argv[optind+1]);
+        if (argc != 2) {
+            pa_log(_("You have to specify a sink name"));
+            return -1;
+        }
 
-        } else if (pa_streq(argv[optind], "suspend-source")) {
-            int b;
+        sink_name = pa_xstrdup(argv[1]);
 
-            action = SUSPEND_SOURCE;
+    } else if (pa_streq(argv[0], "set-source-port")) {
+        action = SET_SOURCE_PORT;
 
-            if (argc > optind+3 || optind+1 >= argc) {
-                pa_log(_("You may not specify more than one source. You have to specify a boolean value."));
-                goto quit;
-            }
+        if (argc != 3) {
+            pa_log(_("You have to specify a source name/index and a port name"));
+            return -1;
+        }
 
-            if ((b = pa_parse_boolean(argv[argc-1])) < 0) {
-                pa_log(_("Invalid suspend specification."));
-                goto quit;
-            }
+        source_name = pa_xstrdup(argv[1]);
+        port_name = pa_xstrdup(argv[2]);
 
-            suspend = !!b;
+    } else if (pa_streq(argv[0], "set-default-source")) {
+        action = SET_DEFAULT_SOURCE;
 
-            if (argc > optind+2)
-                source_name = pa_xstrdup(argv[optind+1]);
-        } else if (pa_streq(argv[optind], "set-card-profile")) {
-            action = SET_CARD_PROFILE;
+        if (argc != 2) {
+            pa_log(_("You have to specify a source name"));
+            return -1;
+        }
 
-            if (argc != optind+3) {
-                pa_log(_("You have to specify a card name/index and a profile name"));
-                goto quit;
-            }
+        source_name = pa_xstrdup(argv[1]);
 
-            card_name = pa_xstrdup(argv[optind+1]);
-            profile_name = pa_xstrdup(argv[optind+2]);
+    } else if (pa_streq(argv[0], "set-sink-volume")) {
+        action = SET_SINK_VOLUME;
 
-        } else if (pa_streq(argv[optind], "set-sink-port")) {
-            action = SET_SINK_PORT;
+        if (argc != 3) {
+            pa_log(_("You have to specify a sink name/index and a volume"));
+            return -1;
+        }
 
-            if (argc != optind+3) {
-                pa_log(_("You have to specify a sink name/index and a port name"));
-                goto quit;
-            }
+        sink_name = pa_xstrdup(argv[1]);
 
-            sink_name = pa_xstrdup(argv[optind+1]);
-            port_name = pa_xstrdup(argv[optind+2]);
+        if (parse_volume(argv[2], &volume, &volume_flags) < 0)
+            return -1;
 
-        } else if (pa_streq(argv[optind], "set-default-sink")) {
-            action = SET_DEFAULT_SINK;
+    } else if (pa_streq(argv[0], "set-source-volume")) {
+        action = SET_SOURCE_VOLUME;
 
-            if (argc != optind+2) {
-                pa_log(_("You have to specify a sink name"));
-                goto quit;
-            }
+        if (argc != 3) {
+            pa_log(_("You have to specify a source name/index and a volume"));
+            return -1;
+        }
 
-            sink_name = pa_xstrdup(argv[optind+1]);
+        source_name = pa_xstrdup(argv[1]);
 
-        } else if (pa_streq(argv[optind], "set-source-port")) {
-            action = SET_SOURCE_PORT;
+        if (parse_volume(argv[2], &volume, &volume_flags) < 0)
+            return -1;
 
-            if (argc != optind+3) {
-                pa_log(_("You have to specify a source name/index and a port name"));
-                goto quit;
-            }
+    } else if (pa_streq(argv[0], "set-sink-input-volume")) {
+        action = SET_SINK_INPUT_VOLUME;
 
-            source_name = pa_xstrdup(argv[optind+1]);
-            port_name = pa_xstrdup(argv[optind+2]);
+        if (argc != 3) {
+            pa_log(_("You have to specify a sink input index and a volume"));
+            return -1;
+        }
 
-        } else if (pa_streq(argv[optind], "set-default-source")) {
-            action = SET_DEFAULT_SOURCE;
+        if (pa_atou(argv[1], &sink_input_idx) < 0) {
+            pa_log(_("Invalid sink input index"));
+            return -1;
+        }
 
-            if (argc != optind+2) {
-                pa_log(_("You have to specify a source name"));
-                goto quit;
-            }
+        if (parse_volume(argv[2], &volume, &volume_flags) < 0)
+            return -1;
 
-            source_name = pa_xstrdup(argv[optind+1]);
+    } else if (pa_streq(argv[0], "set-source-output-volume")) {
+        action = SET_SOURCE_OUTPUT_VOLUME;
 
-        } else if (pa_streq(argv[optind], "set-sink-volume")) {
-            action = SET_SINK_VOLUME;
+        if (argc != 3) {
+            pa_log(_("You have to specify a source output index and a volume"));
+            return -1;
+        }
 
-            if (argc != optind+3) {
-                pa_log(_("You have to specify a sink name/index and a volume"));
-                goto quit;
-            }
+        if (pa_atou(argv[1], &source_output_idx) < 0) {
+            pa_log(_("Invalid source output index"));
+            return -1;
+        }
 
-            sink_name = pa_xstrdup(argv[optind+1]);
+        if (parse_volume(argv[2], &volume, &volume_flags) < 0)
+            return -1;
 
-            if (parse_volume(argv[optind+2], &volume, &volume_flags) < 0)
-                goto quit;
+    } else if (pa_streq(argv[0], "set-sink-mute")) {
+        action = SET_SINK_MUTE;
 
-        } else if (pa_streq(argv[optind], "set-source-volume")) {
-            action = SET_SOURCE_VOLUME;
+        if (argc != 3) {
+            pa_log(_("You have to specify a sink name/index and a mute boolean"));
+            return -1;
+        }
 
-            if (argc != optind+3) {
-                pa_log(_("You have to specify a source name/index and a volume"));
-                goto quit;
-            }
+        if ((mute = parse_mute(argv[2])) == INVALID_MUTE) {
+            pa_log(_("Invalid mute specification"));
+            return -1;
+        }
 
-            source_name = pa_xstrdup(argv[optind+1]);
+        sink_name = pa_xstrdup(argv[1]);
 
-            if (parse_volume(argv[optind+2], &volume, &volume_flags) < 0)
-                goto quit;
+    } else if (pa_streq(argv[0], "set-source-mute")) {
+        action = SET_SOURCE_MUTE;
 
-        } else if (pa_streq(argv[optind], "set-sink-input-volume")) {
-            action = SET_SINK_INPUT_VOLUME;
+        if (argc != 3) {
+            pa_log(_("You have to specify a source name/index and a mute boolean"));
+            return -1;
+        }
 
-            if (argc != optind+3) {
-                pa_log(_("You have to specify a sink input index and a volume"));
-                goto quit;
-            }
+        if ((mute = parse_mute(argv[2])) == INVALID_MUTE) {
+            pa_log(_("Invalid mute specification"));
+            return -1;
+        }
 
-            if (pa_atou(argv[optind+1], &sink_input_idx) < 0) {
-                pa_log(_("Invalid sink input index"));
-                goto quit;
-            }
+        source_name = pa_xstrdup(argv[1]);
 
-            if (parse_volume(argv[optind+2], &volume, &volume_flags) < 0)
-                goto quit;
+    } else if (pa_streq(argv[0], "set-sink-input-mute")) {
+        action = SET_SINK_INPUT_MUTE;
 
-        } else if (pa_streq(argv[optind], "set-source-output-volume")) {
-            action = SET_SOURCE_OUTPUT_VOLUME;
+        if (argc != 3) {
+            pa_log(_("You have to specify a sink input index and a mute boolean"));
+            return -1;
+        }
 
-            if (argc != optind+3) {
-                pa_log(_("You have to specify a source output index and a volume"));
-                goto quit;
-            }
+        if (pa_atou(argv[1], &sink_input_idx) < 0) {
+            pa_log(_("Invalid sink input index specification"));
+            return -1;
+        }
 
-            if (pa_atou(argv[optind+1], &source_output_idx) < 0) {
-                pa_log(_("Invalid source output index"));
-                goto quit;
-            }
+        if ((mute = parse_mute(argv[2])) == INVALID_MUTE) {
+            pa_log(_("Invalid mute specification"));
+            return -1;
+        }
 
-            if (parse_volume(argv[optind+2], &volume, &volume_flags) < 0)
-                goto quit;
+    } else if (pa_streq(argv[0], "set-source-output-mute")) {
+        action = SET_SOURCE_OUTPUT_MUTE;
 
-        } else if (pa_streq(argv[optind], "set-sink-mute")) {
-            action = SET_SINK_MUTE;
+        if (argc != 3) {
+            pa_log(_("You have to specify a source output index and a mute boolean"));
+            return -1;
+        }
 
-            if (argc != optind+3) {
-                pa_log(_("You have to specify a sink name/index and a mute boolean"));
-                goto quit;
-            }
+        if (pa_atou(argv[1], &source_output_idx) < 0) {
+            pa_log(_("Invalid source output index specification"));
+            return -1;
+        }
 
-            if ((mute = parse_mute(argv[optind+2])) == INVALID_MUTE) {
-                pa_log(_("Invalid mute specification"));
-                goto quit;
-            }
+        if ((mute = parse_mute(argv[2])) == INVALID_MUTE) {
+            pa_log(_("Invalid mute specification"));
+            return -1;
+        }
 
-            sink_name = pa_xstrdup(argv[optind+1]);
+    } else if (pa_streq(argv[0], "subscribe"))
 
-        } else if (pa_streq(argv[optind], "set-source-mute")) {
-            action = SET_SOURCE_MUTE;
+        action = SUBSCRIBE;
 
-            if (argc != optind+3) {
-                pa_log(_("You have to specify a source name/index and a mute boolean"));
-                goto quit;
-            }
+    else if (pa_streq(argv[0], "set-sink-formats")) {
+        int32_t tmp;
 
-            if ((mute = parse_mute(argv[optind+2])) == INVALID_MUTE) {
-                pa_log(_("Invalid mute specification"));
-                goto quit;
-            }
+        if (argc != 3 || pa_atoi(argv[1], &tmp) < 0) {
+            pa_log(_("You have to specify a sink index and a semicolon-separated list of supported formats"));
+            return -1;
+        }
 
-            source_name = pa_xstrdup(argv[optind+1]);
+        sink_idx = tmp;
+        action = SET_SINK_FORMATS;
+        formats = pa_xstrdup(argv[2]);
 
-        } else if (pa_streq(argv[optind], "set-sink-input-mute")) {
-            action = SET_SINK_INPUT_MUTE;
+    } else if (pa_streq(argv[0], "set-port-latency-offset")) {
+        action = SET_PORT_LATENCY_OFFSET;
 
-            if (argc != optind+3) {
-                pa_log(_("You have to specify a sink input index and a mute boolean"));
-                goto quit;
-            }
+        if (argc != 4) {
+            pa_log(_("You have to specify a card name/index, a port name and a latency offset"));
+            return -1;
+        }
 
-            if (pa_atou(argv[optind+1], &sink_input_idx) < 0) {
-                pa_log(_("Invalid sink input index specification"));
-                goto quit;
-            }
+        card_name = pa_xstrdup(argv[1]);
+        port_name = pa_xstrdup(argv[2]);
+        if (pa_atoi(argv[3], &latency_offset) < 0) {
+            pa_log(_("Could not parse latency offset"));
+            return -1;
+        }
 
-            if ((mute = parse_mute(argv[optind+2])) == INVALID_MUTE) {
-                pa_log(_("Invalid mute specification"));
-                goto quit;
-            }
+    }
+
+    if (action == NONE) {
+        pa_log(_("No valid command specified."));
+        return -1;
+    }
 
-        } else if (pa_streq(argv[optind], "set-source-output-mute")) {
-            action = SET_SOURCE_OUTPUT_MUTE;
+    return 0;
+}
 
-            if (argc != optind+3) {
-                pa_log(_("You have to specify a source output index and a mute boolean"));
-                goto quit;
-            }
+static void help(const char *argv0) {
 
-            if (pa_atou(argv[optind+1], &source_output_idx) < 0) {
-                pa_log(_("Invalid source output index specification"));
+    printf("%s %s %s\n",    argv0, _("[options]"), "stat [short]");
+    printf("%s %s %s\n",    argv0, _("[options]"), "info");
+    printf("%s %s %s %s\n", argv0, _("[options]"), "list [short]", _("[TYPE]"));
+    printf("%s %s %s\n",    argv0, _("[options]"), "exit");
+    printf("%s %s %s %s\n", argv0, _("[options]"), "upload-sample", _("FILENAME [NAME]"));
+    printf("%s %s %s %s\n", argv0, _("[options]"), "play-sample ", _("NAME [SINK]"));
+    printf("%s %s %s %s\n", argv0, _("[options]"), "remove-sample ", _("NAME"));
+    printf("%s %s %s %s\n", argv0, _("[options]"), "load-module ", _("NAME [ARGS ...]"));
+    printf("%s %s %s %s\n", argv0, _("[options]"), "unload-module ", _("NAME|#N"));
+    printf("%s %s %s %s\n", argv0, _("[options]"), "move-(sink-input|source-output)", _("#N SINK|SOURCE"));
+    printf("%s %s %s %s\n", argv0, _("[options]"), "suspend-(sink|source)", _("NAME|#N 1|0"));
+    printf("%s %s %s %s\n", argv0, _("[options]"), "set-card-profile ", _("CARD PROFILE"));
+    printf("%s %s %s %s\n", argv0, _("[options]"), "set-default-(sink|source)", _("NAME"));
+    printf("%s %s %s %s\n", argv0, _("[options]"), "set-(sink|source)-port", _("NAME|#N PORT"));
+    printf("%s %s %s %s\n", argv0, _("[options]"), "set-(sink|source)-volume", _("NAME|#N VOLUME"));
+    printf("%s %s %s %s\n", argv0, _("[options]"), "set-(sink-input|source-output)-volume", _("#N VOLUME"));
+    printf("%s %s %s %s\n", argv0, _("[options]"), "set-(sink|source)-mute", _("NAME|#N 1|0|toggle"));
+    printf("%s %s %s %s\n", argv0, _("[options]"), "set-(sink-input|source-output)-mute", _("#N 1|0|toggle"));
+    printf("%s %s %s %s\n", argv0, _("[options]"), "set-sink-formats", _("#N FORMATS"));
+    printf("%s %s %s %s\n", argv0, _("[options]"), "set-port-latency-offset", _("CARD-NAME|CARD-#N PORT OFFSET"));
+    printf("%s %s %s\n",    argv0, _("[options]"), "subscribe");
+    printf("%s %s %s\n",    argv0, _("[options]"), _("--batch [FILE]"));
+    printf(_("\nThe special names @DEFAULT_SINK@, @DEFAULT_SOURCE@ and @DEFAULT_MONITOR@\n"
+             "can be used to specify the default sink, source and monitor.\n"));
+
+    printf(_("\n"
+             "  -h, --help                            Show this help\n"
+             "      --version                         Show version\n\n"
+             "  -s, --server=SERVER                   The name of the server to connect to\n"
+             "  -n, --client-name=NAME                How to call this client on the server\n"
+             "      --verbose                         With stat, also show the memory held\n"
+             "                                        by each module and client\n"
+             "      --batch                           Read commands from FILE or STDIN, one\n"
+             "                                        per line, and run them over a single\n"
+             "                                        connection\n"));
+}
+
+enum {
+    ARG_VERSION = 256,
+    ARG_VERBOSE,
+    ARG_BATCH
+};
+
+int main(int argc, char *argv[]) {
+    pa_mainloop *m = NULL;
+    int ret = 1, c;
+    char *server = NULL, *bn;
+
+    static const struct option long_options[] = {
+        {"server",      1, NULL, 's'},
+        {"client-name", 1, NULL, 'n'},
+        {"version",     0, NULL, ARG_VERSION},
+        {"verbose",     0, NULL, ARG_VERBOSE},
+        {"batch",       0, NULL, ARG_BATCH},
+        {"help",        0, NULL, 'h'},
+        {NULL,          0, NULL, 0}
+    };
+
+    setlocale(LC_ALL, "");
+#ifdef ENABLE_NLS
+    bindtextdomain(GETTEXT_PACKAGE, PULSE_LOCALEDIR);
+#endif
+
+    bn = pa_path_get_filename(argv[0]);
+
+    proplist = pa_proplist_new();
+
+    while ((c = getopt_long(argc, argv, "s:n:h", long_options, NULL)) != -1) {
+        switch (c) {
+            case 'h' :
+                help(bn);
+                ret = 0;
                 goto quit;
-            }
 
-            if ((mute = parse_mute(argv[optind+2])) == INVALID_MUTE) {
-                pa_log(_("Invalid mute specification"));
+            case ARG_VERSION:
+                printf(_("pactl %s\n"
+                         "Compiled with libpulse %s\n"
+                         "Linked with libpulse %s\n"),
+                       PACKAGE_VERSION,
+                       pa_get_headers_version(),
+                       pa_get_library_version());
+                ret = 0;
                 goto quit;
-            }
 
-        } else if (pa_streq(argv[optind], "subscribe"))
+            case ARG_VERBOSE:
+                verbose = TRUE;
+                break;
 
-            action = SUBSCRIBE;
+            case ARG_BATCH:
+                batch = TRUE;
+                break;
 
-        else if (pa_streq(argv[optind], "set-sink-formats")) {
-            int32_t tmp;
+            case 's':
+                pa_xfree(server);
+                server = pa_xstrdup(optarg);
+                break;
 
-            if (argc != optind+3 || pa_atoi(argv[optind+1], &tmp) < 0) {
-                pa_log(_("You have to specify a sink index and a semicolon-separated list of supported formats"));
-                goto quit;
-            }
+            case 'n': {
+                char *t;
 
-            sink_idx = tmp;
-            action = SET_SINK_FORMATS;
-            formats = pa_xstrdup(argv[optind+2]);
+                if (!(t = pa_locale_to_utf8(optarg)) ||
+                    pa_proplist_sets(proplist, PA_PROP_APPLICATION_NAME, t) < 0) {
 
-        } else if (pa_streq(argv[optind], "set-port-latency-offset")) {
-            action = SET_PORT_LATENCY_OFFSET;
+                    pa_log(_("Invalid client name '%s'"), t ? t : optarg);
+                    pa_xfree(t);
+                    goto quit;
+                }
 
-            if (argc != optind+4) {
-                pa_log(_("You have to specify a card name/index, a port name and a latency offset"));
-                goto quit;
+                pa_xfree(t);
+                break;
             }
 
-            card_name = pa_xstrdup(argv[optind+1]);
-            port_name = pa_xstrdup(argv[optind+2]);
-            if (pa_atoi(argv[optind + 3], &latency_offset) < 0) {
-                pa_log(_("Could not parse latency offset"));
+            default:
                 goto quit;
-            }
+        }
+    }
+
+    if (optind < argc && pa_streq(argv[optind], "help")) {
+        help(bn);
+        ret = 0;
+        goto quit;
+    }
 
-        } else if (pa_streq(argv[optind], "help")) {
-            help(bn);
-            ret = 0;
+    if (batch) {
+        if (optind+1 < argc) {
+            pa_log(_("Too many arguments."));
             goto quit;
         }
-    }
 
-    if (action == NONE) {
+        if (optind >= argc)
+            batch_file = stdin;
+        else if (!(batch_file = pa_fopen_cloexec(argv[optind], "r"))) {
+            pa_log(_("Failed to open %s: %s"), argv[optind], pa_cstrerror(errno));
+            goto quit;
+        }
+
+    } else if (optind >= argc) {
         pa_log(_("No valid command specified."));
         goto quit;
-    }
+
+    } else if (parse_command(argc - optind, argv + optind) < 0)
+        goto quit;
 
     if (!(m = pa_mainloop_new())) {
         pa_log(_("pa_mainloop_new() failed."));
@@ -2017,6 +2355,9 @@ int main(int argc, char *argv[]) {
         goto quit;
     }
 
+    if (batch_failed && ret == 0)
+        ret = 1;
+
 quit:
     if (sample_stream)
         pa_stream_unref(sample_stream);
@@ -2046,5 +2387,10 @@ quit:
     if (proplist)
         pa_proplist_free(proplist);
 
+    if (batch_file && batch_file != stdin)
+        fclose(batch_file);
+
+    pa_xstrfreev(batch_argv);
+
     return ret;
 }
@@ -34,6 +34,7 @@
 
 #include <sys/soundcard.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <pthread.h>
 #include <unistd.h>
 #include <sys/socket.h>
@@ -71,6 +72,16 @@ typedef enum {
 
 typedef struct fd_info fd_info;
 
+/* The buffer an application mmap()ed a stream into. The stream takes the
+ * data out of it (or puts it in) at offset, wrapping around at size. */
+typedef struct dsp_map {
+    void *buf;
+    size_t size;
+    size_t offset;
+    size_t bytes;
+    int blocks;
+} dsp_map;
+
 struct fd_info {
     pthread_mutex_t mutex;
     int ref;
@@ -93,9 +104,10 @@ struct fd_info {
     pa_io_event *io_event;
     pa_io_event_flags_t io_flags;
 
-    void *buf;
     size_t rec_offset;
 
+    dsp_map play_map, rec_map;
+
     int operation_success;
 
     pa_cvolume sink_volume, source_volume;
@@ -109,6 +121,7 @@ struct fd_info {
 
 static int dsp_drain(fd_info *i);
 static void fd_info_remove_from_list(fd_info *i);
+static void fd_info_shutdown(fd_info *i);
 
 static pthread_mutex_t fd_infos_mutex = PTHREAD_MUTEX_INITIALIZER;
 static pthread_mutex_t func_mutex = PTHREAD_MUTEX_INITIALIZER;
@@ -135,6 +148,11 @@ static int (*___xstat64)(int, const char *, struct stat64 *) = NULL;
 #endif
 static int (*_fclose)(FILE *f) = NULL;
 static int (*_access)(const char *, int) = NULL;
+static void* (*_mmap)(void *, size_t, int, int, int, off_t) = NULL;
+#ifdef HAVE_OPEN64
+static void* (*_mmap64)(void *, size_t, int, int, int, off64_t) = NULL;
+#endif
+static int (*_munmap)(void *, size_t) = NULL;
 
 /* dlsym() violates ISO C, so confide the breakage into this function to
  * avoid warnings. */
@@ -255,6 +273,30 @@ do { \
     pthread_mutex_unlock(&func_mutex); \
 } while(0)
 
+#define LOAD_MMAP_FUNC() \
+do { \
+    pthread_mutex_lock(&func_mutex); \
+    if (!_mmap) \
+        _mmap = (void* (*)(void *, size_t, int, int, int, off_t)) dlsym_fn(RTLD_NEXT, "mmap"); \
+    pthread_mutex_unlock(&func_mutex); \
+} while(0)
+
+#define LOAD_MMAP64_FUNC() \
+do { \
+    pthread_mutex_lock(&func_mutex); \
+    if (!_mmap64) \
+        _mmap64 = (void* (*)(void *, size_t, int, int, int, off64_t)) dlsym_fn(RTLD_NEXT, "mmap64"); \
+    pthread_mutex_unlock(&func_mutex); \
+} while(0)
+
+#define LOAD_MUNMAP_FUNC() \
+do { \
+    pthread_mutex_lock(&func_mutex); \
+    if (!_munmap) \
+        _munmap = (int (*)(void *, size_t)) dlsym_fn(RTLD_NEXT, "munmap"); \
+    pthread_mutex_unlock(&func_mutex); \
+} while(0)
+
 #define CONTEXT_CHECK_DEAD_GOTO(i, label) do { \
 if (!(i)->context || pa_context_get_state((i)->context) != PA_CONTEXT_READY) { \
     debug(DEBUG_LEVEL_NORMAL, __FILE__": Not connected: %s\n", (i)->context ? pa_strerror(pa_context_errno((i)->context)) : "NULL"); \
@@ -417,7 +459,8 @@ static void fd_info_free(fd_info *i) {
         _close(i->thread_fd);
     }
 
-    free(i->buf);
+    /* Like with a real device, mapped buffers stay valid until the
+     * application unmaps them */
 
     pthread_mutex_destroy(&i->mutex);
     free(i);
@@ -642,8 +685,9 @@ static fd_info* fd_info_new(fd_info_type_t type, int *_errno) {
     i->io_flags = 0;
     pthread_mutex_init(&i->mutex, NULL);
     i->ref = 1;
-    i->buf = NULL;
     i->rec_offset = 0;
+    memset(&i->play_map, 0, sizeof(i->play_map));
+    memset(&i->rec_map, 0, sizeof(i->rec_map));
     i->unusable = 0;
     pa_cvolume_reset(&i->sink_volume, 2);
     pa_cvolume_reset(&i->source_volume, 2);
@@ -787,10 +831,114 @@ static void fix_metrics(fd_info *i) {
     debug(DEBUG_LEVEL_NORMAL, __FILE__": fixated metrics to %i fragments, %li bytes each.\n", i->n_fragments, (long)i->fragment_size);
 }
 
+static void dsp_map_advance(fd_info *i, dsp_map *m, size_t l) {
+    m->blocks += (int) ((m->bytes + l) / i->fragment_size - m->bytes / i->fragment_size);
+    m->bytes += l;
+    m->offset = (m->offset + l) % m->size;
+}
+
+/* Feed the playback stream from the mapped buffer, as much as it asks
+ * for. Nothing is taken while output is not triggered. */
+static int dsp_map_write(fd_info *i) {
+    dsp_map *m = &i->play_map;
+    size_t n;
+
+    if (!m->buf || i->play_precork || !i->play_stream || pa_stream_get_state(i->play_stream) != PA_STREAM_READY)
+        return 0;
+
+    if ((n = pa_stream_writable_size(i->play_stream)) == (size_t) -1) {
+        debug(DEBUG_LEVEL_NORMAL, __FILE__": pa_stream_writable_size(): %s\n", pa_strerror(pa_context_errno(i->context)));
+        return -1;
+    }
+
+    while (n >= i->fragment_size) {
+        void *data;
+        size_t l = i->fragment_size, k;
+
+        if (pa_stream_begin_write(i->play_stream, &data, &l) < 0) {
+            debug(DEBUG_LEVEL_NORMAL, __FILE__": pa_stream_begin_write(): %s\n", pa_strerror(pa_context_errno(i->context)));
+            return -1;
+        }
+
+        k = PA_MIN(l, m->size - m->offset);
+        memcpy(data, (uint8_t*) m->buf + m->offset, k);
+        memcpy((uint8_t*) data + k, m->buf, l - k);
+
+        if (pa_stream_write(i->play_stream, data, l, NULL, 0LL, PA_SEEK_RELATIVE) < 0) {
+            debug(DEBUG_LEVEL_NORMAL, __FILE__": pa_stream_write(): %s\n", pa_strerror(pa_context_errno(i->context)));
+            return -1;
+        }
+
+        dsp_map_advance(i, m, l);
+        n -= l;
+    }
+
+    return 0;
+}
+
+/* Put everything recorded so far into the mapped buffer */
+static int dsp_map_read(fd_info *i) {
+    dsp_map *m = &i->rec_map;
+
+    if (!m->buf || !i->rec_stream || pa_stream_get_state(i->rec_stream) != PA_STREAM_READY)
+        return 0;
+
+    for (;;) {
+        const void *data;
+        size_t len;
+
+        if (pa_stream_peek(i->rec_stream, &data, &len) < 0) {
+            debug(DEBUG_LEVEL_NORMAL, __FILE__": pa_stream_peek(): %s\n", pa_strerror(pa_context_errno(i->context)));
+            return -1;
+        }
+
+        if (len <= 0)
+            break;
+
+        /* Holes are skipped, like for the socket */
+        if (data) {
+            const uint8_t *d = (const uint8_t*) data + i->rec_offset;
+            size_t l = len - i->rec_offset;
+
+            while (l > 0) {
+                size_t k = PA_MIN(l, m->size - m->offset);
+
+                memcpy((uint8_t*) m->buf + m->offset, d, k);
+                dsp_map_advance(i, m, k);
+
+                d += k;
+                l -= k;
+            }
+        }
+
+        if (pa_stream_drop(i->rec_stream) < 0) {
+            debug(DEBUG_LEVEL_NORMAL, __FILE__": pa_stream_drop(): %s\n", pa_strerror(pa_context_errno(i->context)));
+            return -1;
+        }
+
+        i->rec_offset = 0;
+    }
+
+    return 0;
+}
+
 static void stream_request_cb(pa_stream *s, size_t length, void *userdata) {
     fd_info *i = userdata;
     assert(s);
 
+    /* Mapped streams don't go through the socket at all */
+    if (s == i->play_stream && i->play_map.buf) {
+        if (dsp_map_write(i) < 0)
+            fd_info_shutdown(i);
+        return;
+    }
+
+    if (s == i->rec_stream && i->rec_map.buf) {
+        if (dsp_map_read(i) < 0)
+            fd_info_shutdown(i);
+        return;
+    }
+
     if (i->io_event) {
         pa_mainloop_api *api;
         size_t n;
@@ -857,7 +1005,11 @@ static int fd_info_copy_data(fd_info *i, int force) {
     if (!i->play_stream && !i->rec_stream)
         return -1;
 
-    if ((i->play_stream) && (pa_stream_get_state(i->play_stream) == PA_STREAM_READY)) {
+    /* Whatever the application writes to or reads from the socket of a
+     * mapped stream is not looked at */
+    if (i->play_map.buf)
+        i->io_flags &= ~PA_IO_EVENT_INPUT;
+    else if ((i->play_stream) && (pa_stream_get_state(i->play_stream) == PA_STREAM_READY)) {
         n = pa_stream_writable_size(i->play_stream);
 
         if (n == (size_t)-1) {
@@ -867,31 +1019,34 @@ static int fd_info_copy_data(fd_info *i, int force) {
         }
 
         while (n >= i->fragment_size || force) {
+            void *data;
+            size_t l = i->fragment_size;
             ssize_t r;
 
-            if (!i->buf) {
-                if (!(i->buf = malloc(i->fragment_size))) {
-                    debug(DEBUG_LEVEL_NORMAL, __FILE__": malloc() failed.\n");
-                    return -1;
-                }
+            /* Read right into the memory of the stream, so that the data
+             * isn't copied once more on its way to the server */
+            if (pa_stream_begin_write(i->play_stream, &data, &l) < 0) {
+                debug(DEBUG_LEVEL_NORMAL, __FILE__": pa_stream_begin_write(): %s\n", pa_strerror(pa_context_errno(i->context)));
+                return -1;
             }
 
-            if ((r = read(i->thread_fd, i->buf, i->fragment_size)) <= 0) {
+            if ((r = read(i->thread_fd, data, l)) <= 0) {
+                int e = errno;
 
-                if (errno == EAGAIN)
+                pa_stream_cancel_write(i->play_stream);
+
+                if (e == EAGAIN)
                     break;
 
-                debug(DEBUG_LEVEL_NORMAL, __FILE__": read(): %s\n", r == 0 ? "EOF" : strerror(errno));
+                debug(DEBUG_LEVEL_NORMAL, __FILE__": read(): %s\n", r == 0 ? "EOF" : strerror(e));
                 return -1;
             }
 
-            if (pa_stream_write(i->play_stream, i->buf, (size_t) r, free, 0LL, PA_SEEK_RELATIVE) < 0) {
+            if (pa_stream_write(i->play_stream, data, (size_t) r, NULL, 0LL, PA_SEEK_RELATIVE) < 0) {
                 debug(DEBUG_LEVEL_NORMAL, __FILE__": pa_stream_write(): %s\n", pa_strerror(pa_context_errno(i->context)));
                 return -1;
             }
 
-            i->buf = NULL;
-
             assert(n >= (size_t) r);
             n -= (size_t) r;
         }
@@ -902,7 +1057,9 @@ static int fd_info_copy_data(fd_info *i, int force) {
             i->io_flags &= ~PA_IO_EVENT_INPUT;
     }
 
-    if ((i->rec_stream) && (pa_stream_get_state(i->rec_stream) == PA_STREAM_READY)) {
+    if (i->rec_map.buf)
+        i->io_flags &= ~PA_IO_EVENT_OUTPUT;
+    else if ((i->rec_stream) && (pa_stream_get_state(i->rec_stream) == PA_STREAM_READY)) {
         n = pa_stream_readable_size(i->rec_stream);
 
         if (n == (size_t)-1) {
@@ -992,6 +1149,7 @@ static void stream_state_cb(pa_stream *s, void * userdata) {
 
         case PA_STREAM_READY:
             debug(DEBUG_LEVEL_NORMAL, __FILE__": stream established.\n");
+            pa_threaded_mainloop_signal(i->mainloop, 0);
             break;
 
         case PA_STREAM_FAILED:
@@ -1009,6 +1167,7 @@ static void stream_state_cb(pa_stream *s, void * userdata) {
                 i->rec_stream = NULL;
             }
             fd_info_shutdown(i);
+            pa_threaded_mainloop_signal(i->mainloop, 0);
             break;
 
         case PA_STREAM_TERMINATED:
@@ -1039,6 +1198,11 @@ static int create_playback_stream(fd_info *i) {
     attr.maxlength = (uint32_t) (i->fragment_size * (i->n_fragments+1));
     attr.tlength = (uint32_t) (i->fragment_size * i->n_fragments);
     attr.prebuf = (uint32_t) i->fragment_size;
+
+    /* The application writes into a mapped buffer just ahead of where we
+     * read, so don't read further ahead than necessary */
+    if (i->play_map.buf)
+        attr.tlength = (uint32_t) (i->fragment_size * 2);
     attr.minreq = (uint32_t) i->fragment_size;
 
     flags = PA_STREAM_INTERPOLATE_TIMING|PA_STREAM_AUTO_TIMING_UPDATE|PA_STREAM_EARLY_REQUESTS;
@@ -1962,6 +2126,109 @@ fail:
     return r;
 }
 
+/* Make sure the stream behind a mapped buffer exists and is ready */
+static int dsp_map_stream(fd_info *i, int play) {
+    pa_stream **s = play ? &i->play_stream : &i->rec_stream;
+
+    if (!*s && (play ? create_playback_stream(i) : create_record_stream(i)) < 0)
+        return -1;
+
+    while (*s && pa_stream_get_state(*s) == PA_STREAM_CREATING)
+        pa_threaded_mainloop_wait(i->mainloop);
+
+    return *s && pa_stream_get_state(*s) == PA_STREAM_READY ? 0 : -1;
+}
+
+static int silence_byte(pa_sample_format_t format) {
+    switch (format) {
+        case PA_SAMPLE_U8:
+            return 0x80;
+        case PA_SAMPLE_ALAW:
+            return 0xd5;
+        case PA_SAMPLE_ULAW:
+            return 0xff;
+        default:
+            return 0;
+    }
+}
+
+/* Instead of the DMA buffer of a sound card the application gets
+ * anonymous shared memory, which the stream callbacks copy from or to
+ * directly. A writable mapping is the output buffer, a read-only one the
+ * input buffer, as with OSS. */
+static void *dsp_mmap(fd_info *i, void *start, size_t length, int prot, int flags, int *_errno) {
+    dsp_map *m;
+    void *buf = MAP_FAILED;
+    int play = !!(prot & PROT_WRITE);
+
+    debug(DEBUG_LEVEL_NORMAL, __FILE__": mmap() of %lu bytes for %s\n", (unsigned long) length, play ? "playback" : "recording");
+
+    if (i->thread_fd == -1) {
+        *_errno = EIO;
+        return MAP_FAILED;
+    }
+
+    pa_threaded_mainloop_lock(i->mainloop);
+
+    fix_metrics(i);
+    m = play ? &i->play_map : &i->rec_map;
+
+    if (m->buf) {
+        *_errno = EBUSY;
+        goto fail;
+    }
+
+    if (length < i->fragment_size) {
+        *_errno = EINVAL;
+        goto fail;
+    }
+
+    LOAD_MMAP_FUNC();
+    if ((buf = _mmap(start, length, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS|(flags & MAP_FIXED), -1, 0)) == MAP_FAILED) {
+        *_errno = errno;
+        goto fail;
+    }
+
+    if (play)
+        memset(buf, silence_byte(i->sample_spec.format), length);
+
+    m->buf = buf;
+    m->size = length;
+    m->offset = m->bytes = 0;
+    m->blocks = 0;
+
+    if (dsp_map_stream(i, play) < 0 || dsp_map_write(i) < 0 || dsp_map_read(i) < 0) {
+        memset(m, 0, sizeof(*m));
+        LOAD_MUNMAP_FUNC();
+        _munmap(buf, length);
+        buf = MAP_FAILED;
+        *_errno = EIO;
+        goto fail;
+    }
+
+    pa_threaded_mainloop_unlock(i->mainloop);
+
+    return buf;
+
+fail:
+    pa_threaded_mainloop_unlock(i->mainloop);
+
+    debug(DEBUG_LEVEL_NORMAL, __FILE__": mmap() failed: %s\n", strerror(*_errno));
+
+    return MAP_FAILED;
+}
+
+static void dsp_munmap(fd_info *i, void *start) {
+    pa_threaded_mainloop_lock(i->mainloop);
+
+    if (i->play_map.buf == start)
+        memset(&i->play_map, 0, sizeof(i->play_map));
+    if (i->rec_map.buf == start)
+        memset(&i->rec_map, 0, sizeof(i->rec_map));
+
+    pa_threaded_mainloop_unlock(i->mainloop);
+}
+
 static int dsp_ioctl(fd_info *i, unsigned long request, void*argp, int *_errno) {
     int ret = -1;
 
@@ -2091,7 +2358,7 @@ static int dsp_ioctl(fd_info *i, unsigned long request, void*argp, int *_errno)
         case SNDCTL_DSP_GETCAPS:
             debug(DEBUG_LEVEL_NORMAL, __FILE__": SNDCTL_DSP_CAPS\n");
 
-            *(int*) argp = DSP_CAP_DUPLEX | DSP_CAP_TRIGGER
+            *(int*) argp = DSP_CAP_DUPLEX | DSP_CAP_TRIGGER | DSP_CAP_MMAP
 #ifdef DSP_CAP_MULTI
               | DSP_CAP_MULTI
 #endif
@@ -2153,6 +2420,11 @@ static int dsp_ioctl(fd_info *i, unsigned long request, void*argp, int *_errno)
 
             i->optr_n_blocks = 0;
 
+            i->play_map.offset = i->play_map.bytes = 0;
+            i->play_map.blocks = 0;
+            i->rec_map.offset = i->rec_map.bytes = 0;
+            i->rec_map.blocks = 0;
+
             pa_threaded_mainloop_unlock(i->mainloop);
             break;
         }
@@ -2206,6 +2478,19 @@ static int dsp_ioctl(fd_info *i, unsigned long request, void*argp, int *_errno)
                     *_errno = EIO;
             }
 
+            /* A mapped stream may have been reset in the meantime, and
+             * nothing but us starts it up again */
+            if (i->play_map.buf || i->rec_map.buf) {
+                pa_threaded_mainloop_lock(i->mainloop);
+
+                if (i->play_map.buf && !i->play_precork && (dsp_map_stream(i, 1) < 0 || dsp_map_write(i) < 0))
+                    *_errno = EIO;
+                if (i->rec_map.buf && !i->rec_precork && (dsp_map_stream(i, 0) < 0 || dsp_map_read(i) < 0))
+                    *_errno = EIO;
+
+                pa_threaded_mainloop_unlock(i->mainloop);
+            }
+
             break;
 
         case SNDCTL_DSP_SYNC:
@@ -2311,6 +2596,14 @@ static int dsp_ioctl(fd_info *i, unsigned long request, void*argp, int *_errno)
 
             pa_threaded_mainloop_lock(i->mainloop);
 
+            if (i->play_map.buf) {
+                info->bytes = (int) i->play_map.bytes;
+                info->blocks = i->play_map.blocks;
+                info->ptr = (int) i->play_map.offset;
+                i->play_map.blocks = 0;
+                goto exit_loop2;
+            }
+
             for (;;) {
                 pa_usec_t usec;
 
@@ -2345,9 +2638,31 @@ static int dsp_ioctl(fd_info *i, unsigned long request, void*argp, int *_errno)
             break;
         }
 
-        case SNDCTL_DSP_GETIPTR:
-            debug(DEBUG_LEVEL_NORMAL, __FILE__": invalid ioctl SNDCTL_DSP_GETIPTR\n");
-            goto inval;
+        case SNDCTL_DSP_GETIPTR: {
+            count_info *info;
+
+            debug(DEBUG_LEVEL_NORMAL, __FILE__": SNDCTL_DSP_GETIPTR\n");
+
+            /* Only meaningful for a mapped buffer */
+            if (!i->rec_map.buf)
+                goto inval;
+
+            info = (count_info*) argp;
+            memset(info, 0, sizeof(*info));
+
+            pa_threaded_mainloop_lock(i->mainloop);
+
+            info->bytes = (int) i->rec_map.bytes;
+            info->blocks = i->rec_map.blocks;
+            info->ptr = (int) i->rec_map.offset;
+            i->rec_map.blocks = 0;
+
+            pa_threaded_mainloop_unlock(i->mainloop);
+
+            debug(DEBUG_LEVEL_NORMAL, __FILE__": GETIPTR bytes=%i, blocks=%i, ptr=%i\n", info->bytes, info->blocks, info->ptr);
+
+            break;
+        }
 
         case SNDCTL_DSP_SETDUPLEX:
             debug(DEBUG_LEVEL_NORMAL, __FILE__": SNDCTL_DSP_SETDUPLEX\n");
@@ -2436,6 +2751,86 @@ int close(int fd) {
     return 0;
 }
 
+void *mmap(void *start, size_t length, int prot, int flags, int fd, off_t offset) {
+    fd_info *i;
+    void *r;
+    int _errno = 0;
+
+    debug(DEBUG_LEVEL_VERBOSE, __FILE__": mmap()\n");
+
+    if (fd < 0 || (flags & MAP_ANONYMOUS) || !function_enter()) {
+        LOAD_MMAP_FUNC();
+        return _mmap(start, length, prot, flags, fd, offset);
+    }
+
+    if (!(i = fd_info_find(fd)) || i->type != FD_INFO_STREAM) {
+        if (i)
+            fd_info_unref(i);
+
+        function_exit();
+        LOAD_MMAP_FUNC();
+        return _mmap(start, length, prot, flags, fd, offset);
+    }
+
+    if (offset != 0) {
+        _errno = EINVAL;
+        r = MAP_FAILED;
+    } else
+        r = dsp_mmap(i, start, length, prot, flags, &_errno);
+
+    fd_info_unref(i);
+
+    if (_errno)
+        errno = _errno;
+
+    function_exit();
+
+    return r;
+}
+
+#ifdef HAVE_OPEN64
+
+void *mmap64(void *start, size_t length, int prot, int flags, int fd, off64_t offset) {
+    debug(DEBUG_LEVEL_VERBOSE, __FILE__": mmap64()\n");
+
+    if (fd < 0 || (flags & MAP_ANONYMOUS) || offset != (off_t) offset) {
+        LOAD_MMAP64_FUNC();
+        return _mmap64(start, length, prot, flags, fd, offset);
+    }
+
+    return mmap(start, length, prot, flags, fd, (off_t) offset);
+}
+
+#endif
+
+int munmap(void *start, size_t length) {
+    fd_info *i;
+
+    debug(DEBUG_LEVEL_VERBOSE, __FILE__": munmap()\n");
+
+    if (function_enter()) {
+        pthread_mutex_lock(&fd_infos_mutex);
+
+        for (i = fd_infos; i; i = i->next)
+            if (i->play_map.buf == start || i->rec_map.buf == start) {
+                fd_info_ref(i);
+                break;
+            }
+
+        pthread_mutex_unlock(&fd_infos_mutex);
+
+        if (i) {
+            dsp_munmap(i, start);
+            fd_info_unref(i);
+        }
+
+        function_exit();
+    }
+
+    LOAD_MUNMAP_FUNC();
+    return _munmap(start, length);
+}
+
 int access(const char *pathname, int mode) {
 
     debug(DEBUG_LEVEL_VERBOSE, __FILE__": access(%s)\n", pathname?pathname:"NULL");